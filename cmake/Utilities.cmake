@@ -190,3 +190,38 @@ function(add_library_wrapper libName fileList testFileList dependencyList)
 endfunction( add_library_wrapper )
 
 
+
+# Define a custom make target that will run all benchmarks.
+# - Run 'make benchmark_all' to build and run them. The results of each
+#   benchmark executable are also written to benchmarks/<name>.csv in the
+#   build directory, to compare with those of other commits.
+if (NOT TARGET benchmark_all)
+  add_custom_target(benchmark_all)
+endif()
+
+# Add a benchmark executable for each benchmark file of a library.
+# - This is called in each library folder that has a benchmarks directory.
+function(add_benchmarks_wrapper libName benchmarkFileList dependencyList)
+
+  set(BENCHMARK_MAIN_PATH "${CMAKE_SOURCE_DIR}/src/test/benchmark_main.cc")
+  foreach(f ${benchmarkFileList})
+
+    get_filename_component(filename ${f} NAME_WE) # Get file name without extension
+    set(executableName "${libName}_${filename}")   # Generate a name for the executable
+
+    # This executable should not be built unless running benchmarks.
+    add_executable(${executableName} EXCLUDE_FROM_ALL ${BENCHMARK_MAIN_PATH} ./benchmarks/${f})
+    target_link_libraries(${executableName} ${dependencyList} ${libName})
+
+    # The benchmarks use the fixtures of the unit tests
+    target_compile_definitions(${executableName} PRIVATE "TEST_SRCDIR=\"${CMAKE_CURRENT_SOURCE_DIR}/tests\"")
+
+    add_custom_target(${executableName}_run
+                      COMMAND ${CMAKE_COMMAND} -E make_directory "${CMAKE_BINARY_DIR}/benchmarks"
+                      COMMAND ${executableName} --csv "${CMAKE_BINARY_DIR}/benchmarks/${executableName}.csv"
+                      DEPENDS ${executableName}
+                      WORKING_DIRECTORY "${CMAKE_BINARY_DIR}")
+    add_dependencies(benchmark_all ${executableName}_run)
+  endforeach(f)
+
+endfunction(add_benchmarks_wrapper)
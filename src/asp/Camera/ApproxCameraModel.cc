@@ -0,0 +1,467 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/ApproxCameraModel.h>
+#include <vw/Core/Exception.h>
+#include <vw/Math/Vector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+using namespace vw;
+
+namespace {
+
+  // The grids start with this many nodes per side, and their number
+  // of intervals doubles until the error is small enough, or there
+  // would be more than this many nodes.
+  const int    START_NODES = 17;
+  const int    MAX_NODES   = 1 << 20;
+  const int    MAX_HEIGHTS = 17;
+  const std::string TABLE_HEADER = "ASP approximate camera tables, version 1";
+
+  // The number of nodes after doubling the number of intervals
+  int refine(int n) {
+    return 2*(n - 1) + 1;
+  }
+
+  // Check about this many cells along each axis
+  int check_stride(int n) {
+    return std::max(1, (n - 1)/16);
+  }
+
+  template <class T>
+  void write_val(std::ofstream & ofs, T const& val) {
+    ofs.write((char const*)&val, sizeof(T));
+  }
+  template <class T>
+  void read_val(std::ifstream & ifs, T & val) {
+    ifs.read((char*)&val, sizeof(T));
+  }
+
+  template <class VecT>
+  void write_table(std::ofstream & ofs, ImageView< PixelMask<VecT> > const& table) {
+    write_val(ofs, table.cols());
+    write_val(ofs, table.rows());
+    for (int row = 0; row < table.rows(); row++) {
+      for (int col = 0; col < table.cols(); col++) {
+        char valid = is_valid(table(col, row));
+        write_val(ofs, valid);
+        for (size_t it = 0; it < VecT().size(); it++)
+          write_val(ofs, table(col, row).child()[it]);
+      }
+    }
+  }
+  template <class VecT>
+  void read_table(std::ifstream & ifs, ImageView< PixelMask<VecT> > & table) {
+    int cols = 0, rows = 0;
+    read_val(ifs, cols);
+    read_val(ifs, rows);
+    if (!ifs.good() || cols < 0 || rows < 0 || double(cols)*rows > MAX_NODES)
+      vw_throw(IOErr() << "Invalid approximate camera table.\n");
+    table.set_size(cols, rows);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        char valid = 0;
+        read_val(ifs, valid);
+        VecT val;
+        for (size_t it = 0; it < val.size(); it++)
+          read_val(ifs, val[it]);
+        table(col, row) = val;
+        if (valid)
+          table(col, row).validate();
+        else
+          table(col, row).invalidate();
+      }
+    }
+  }
+
+  // Bilinear interpolation of the four values at the corners of a cell.
+  // Return false if any of them is invalid.
+  template <class VecT>
+  bool interp_cell(ImageView< PixelMask<VecT> > const& table, int col, int row,
+                   double dx, double dy, VecT & val) {
+    PixelMask<VecT> const& v00 = table(col,     row    );
+    PixelMask<VecT> const& v10 = table(col + 1, row    );
+    PixelMask<VecT> const& v01 = table(col,     row + 1);
+    PixelMask<VecT> const& v11 = table(col + 1, row + 1);
+    if (!is_valid(v00) || !is_valid(v10) || !is_valid(v01) || !is_valid(v11))
+      return false;
+    val = (1 - dy)*((1 - dx)*v00.child() + dx*v10.child())
+      +        dy *((1 - dx)*v01.child() + dx*v11.child());
+    return true;
+  }
+
+  // Find the cell containing x, along an axis with n nodes starting
+  // at 0. Return false if outside.
+  bool find_cell(double x, int n, int & index, double & frac) {
+    if (!(x >= 0) || x > n - 1 || n < 2)
+      return false;
+    index = std::min(int(x), n - 2);
+    frac  = x - index;
+    return true;
+  }
+
+  double angle_between(Vector3 const& a, Vector3 const& b) {
+    return std::atan2(norm_2(cross_prod(a, b)), dot_prod(a, b));
+  }
+}
+
+namespace asp {
+
+  ApproxCameraModel::ApproxCameraModel(boost::shared_ptr<camera::CameraModel> exact_camera,
+                                       BBox2i const& image_box,
+                                       cartography::Datum const& datum,
+                                       double max_error):
+    m_exact_camera(exact_camera), m_max_error(max_error), m_image_box(image_box),
+    m_sensor_error(0), m_ground_error(0) {
+
+    if (m_max_error <= 0)
+      vw_throw(ArgumentErr() << "ApproxCameraModel: Expecting a positive error bound.\n");
+    if (image_box.empty())
+      vw_throw(ArgumentErr() << "ApproxCameraModel: Expecting a non-empty image box.\n");
+
+    compute_sensor_table(datum);
+  }
+
+  ApproxCameraModel::ApproxCameraModel(boost::shared_ptr<camera::CameraModel> exact_camera,
+                                       BBox2i const& image_box,
+                                       cartography::GeoReference const& georef,
+                                       BBox2 const& point_box,
+                                       Vector2 const& height_range,
+                                       double max_error):
+    m_exact_camera(exact_camera), m_max_error(max_error), m_image_box(image_box),
+    m_sensor_error(0), m_georef(georef), m_point_box(point_box),
+    m_height_range(height_range), m_ground_error(0) {
+
+    if (m_max_error <= 0)
+      vw_throw(ArgumentErr() << "ApproxCameraModel: Expecting a positive error bound.\n");
+    if (image_box.empty())
+      vw_throw(ArgumentErr() << "ApproxCameraModel: Expecting a non-empty image box.\n");
+    if (point_box.empty() || m_height_range[0] > m_height_range[1])
+      vw_throw(ArgumentErr() << "ApproxCameraModel: Expecting a non-empty ground region.\n");
+
+    // Heights are interpolated, so there must be at least two
+    if (m_height_range[0] == m_height_range[1]) {
+      m_height_range[0] -= 1.0;
+      m_height_range[1] += 1.0;
+    }
+
+    compute_sensor_table(georef.datum());
+    compute_ground_table();
+  }
+
+  ApproxCameraModel::ApproxCameraModel(boost::shared_ptr<camera::CameraModel> exact_camera,
+                                       std::string const& table_file):
+    m_exact_camera(exact_camera), m_max_error(0), m_sensor_error(0), m_ground_error(0) {
+
+    std::ifstream ifs(table_file.c_str(), std::ios::binary);
+    std::string header;
+    std::getline(ifs, header);
+    if (!ifs.good() || header != TABLE_HEADER)
+      vw_throw(IOErr() << "Not an approximate camera table: " << table_file << "\n");
+
+    read_val(ifs, m_max_error);
+    read_val(ifs, m_image_box.min()[0]); read_val(ifs, m_image_box.min()[1]);
+    read_val(ifs, m_image_box.max()[0]); read_val(ifs, m_image_box.max()[1]);
+    read_val(ifs, m_sensor_spacing[0]);  read_val(ifs, m_sensor_spacing[1]);
+    read_val(ifs, m_sensor_error);
+    read_table(ifs, m_center_table);
+    read_table(ifs, m_dir_table);
+
+    int num_heights = 0;
+    read_val(ifs, num_heights);
+    if (!ifs.good() || num_heights < 0 || num_heights == 1 || num_heights > MAX_HEIGHTS)
+      vw_throw(IOErr() << "Invalid approximate camera table: " << table_file << "\n");
+    if (num_heights > 0) {
+      int len = 0;
+      read_val(ifs, len);
+      if (!ifs.good() || len < 0 || len > 1000000)
+        vw_throw(IOErr() << "Invalid approximate camera table: " << table_file << "\n");
+      std::string wkt(len, ' ');
+      ifs.read(&wkt[0], len);
+      m_georef.set_wkt(wkt);
+      read_val(ifs, m_point_box.min()[0]); read_val(ifs, m_point_box.min()[1]);
+      read_val(ifs, m_point_box.max()[0]); read_val(ifs, m_point_box.max()[1]);
+      read_val(ifs, m_height_range[0]);    read_val(ifs, m_height_range[1]);
+      for (int it = 0; it < 3; it++)
+        read_val(ifs, m_ground_spacing[it]);
+      read_val(ifs, m_ground_error);
+      m_ground_table.resize(num_heights);
+      for (int it = 0; it < num_heights; it++)
+        read_table(ifs, m_ground_table[it]);
+    }
+
+    if (!ifs.good())
+      vw_throw(IOErr() << "Could not read: " << table_file << "\n");
+  }
+
+  void ApproxCameraModel::write(std::string const& table_file) const {
+
+    // Write to a temporary file first, so that concurrent runs never
+    // see a partial file.
+    std::string tmp_file = table_file + ".tmp";
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      ofs << TABLE_HEADER << "\n";
+      write_val(ofs, m_max_error);
+      write_val(ofs, m_image_box.min()[0]); write_val(ofs, m_image_box.min()[1]);
+      write_val(ofs, m_image_box.max()[0]); write_val(ofs, m_image_box.max()[1]);
+      write_val(ofs, m_sensor_spacing[0]);  write_val(ofs, m_sensor_spacing[1]);
+      write_val(ofs, m_sensor_error);
+      write_table(ofs, m_center_table);
+      write_table(ofs, m_dir_table);
+
+      int num_heights = m_ground_table.size();
+      write_val(ofs, num_heights);
+      if (num_heights > 0) {
+        std::string wkt = m_georef.get_wkt();
+        int len = wkt.size();
+        write_val(ofs, len);
+        ofs.write(wkt.c_str(), len);
+        write_val(ofs, m_point_box.min()[0]); write_val(ofs, m_point_box.min()[1]);
+        write_val(ofs, m_point_box.max()[0]); write_val(ofs, m_point_box.max()[1]);
+        write_val(ofs, m_height_range[0]);    write_val(ofs, m_height_range[1]);
+        for (int it = 0; it < 3; it++)
+          write_val(ofs, m_ground_spacing[it]);
+        write_val(ofs, m_ground_error);
+        for (int it = 0; it < num_heights; it++)
+          write_table(ofs, m_ground_table[it]);
+      }
+
+      if (!ofs.good())
+        vw_throw(IOErr() << "Could not write: " << tmp_file << "\n");
+    }
+    if (std::rename(tmp_file.c_str(), table_file.c_str()) != 0)
+      vw_throw(IOErr() << "Could not write: " << table_file << "\n");
+  }
+
+  // Tabulate on a coarse grid, and keep doubling its resolution, reusing
+  // the nodes computed so far, until the error at the centers of a sample
+  // of the cells is small enough. The error of the interpolated ray is
+  // converted to pixels by dividing by the angle between the rays of
+  // adjacent pixels. The camera center error is first converted to an
+  // angle, assuming the ground is about as far as the camera elevation.
+  void ApproxCameraModel::compute_sensor_table(cartography::Datum const& datum) {
+
+    int nx = START_NODES, ny = START_NODES;
+    ImageView< PixelMask<Vector3> > old_ctr, old_dir;
+    while (1) {
+
+      m_sensor_spacing = Vector2(m_image_box.width()/(nx - 1.0),
+                                 m_image_box.height()/(ny - 1.0));
+      ImageView< PixelMask<Vector3> > ctr_table(nx, ny), dir_table(nx, ny);
+      for (int row = 0; row < ny; row++) {
+        for (int col = 0; col < nx; col++) {
+          if (old_ctr.cols() > 0 && col % 2 == 0 && row % 2 == 0) {
+            ctr_table(col, row) = old_ctr(col/2, row/2);
+            dir_table(col, row) = old_dir(col/2, row/2);
+            continue;
+          }
+          Vector2 pix = m_image_box.min() + elem_prod(Vector2(col, row), m_sensor_spacing);
+          try {
+            ctr_table(col, row) = m_exact_camera->camera_center(pix);
+            dir_table(col, row) = m_exact_camera->pixel_to_vector(pix);
+          } catch(...) {
+            ctr_table(col, row).invalidate();
+            dir_table(col, row).invalidate();
+          }
+        }
+      }
+      m_center_table = ctr_table;
+      m_dir_table    = dir_table;
+
+      // Check the error
+      m_sensor_error = 0;
+      for (int row = 0; row < ny - 1; row += check_stride(ny)) {
+        for (int col = 0; col < nx - 1; col += check_stride(nx)) {
+          Vector2 pix = m_image_box.min()
+            + elem_prod(Vector2(col + 0.5, row + 0.5), m_sensor_spacing);
+          Vector3 ctr, dir;
+          if (!interp_sensor(pix, ctr, dir))
+            continue;
+          try {
+            Vector3 exact_ctr = m_exact_camera->camera_center(pix);
+            Vector3 exact_dir = m_exact_camera->pixel_to_vector(pix);
+            double pixel_angle
+              = angle_between(exact_dir, m_exact_camera->pixel_to_vector(pix + Vector2(1, 0)));
+            if (!(pixel_angle > 0))
+              continue;
+            double range = std::max(norm_2(exact_ctr) - datum.semi_major_axis(), 1.0);
+            Vector3 ctr_diff = ctr - exact_ctr;
+            ctr_diff -= dot_prod(ctr_diff, exact_dir)*exact_dir;
+            double err = (angle_between(dir, exact_dir) + norm_2(ctr_diff)/range)/pixel_angle;
+            m_sensor_error = std::max(m_sensor_error, err);
+          } catch(...) {}
+        }
+      }
+
+      if (m_sensor_error <= m_max_error || double(refine(nx))*refine(ny) > MAX_NODES)
+        break;
+
+      old_ctr = m_center_table;
+      old_dir = m_dir_table;
+      nx = refine(nx);
+      ny = refine(ny);
+    }
+  }
+
+  // Same approach as for the sensor table, at a lattice of points
+  // spanning the given box and heights.
+  void ApproxCameraModel::compute_ground_table() {
+
+    int nx = START_NODES, ny = START_NODES, nz = 3;
+
+    // Pixels far outside of the image do not matter
+    BBox2 check_box = m_image_box;
+    check_box.expand(std::max(m_image_box.width(), m_image_box.height())/10.0);
+
+    std::vector< ImageView< PixelMask<Vector2> > > old_table;
+    while (1) {
+
+      m_ground_spacing = Vector3(m_point_box.width()/(nx - 1.0),
+                                 m_point_box.height()/(ny - 1.0),
+                                 (m_height_range[1] - m_height_range[0])/(nz - 1.0));
+      bool refined_z = (!old_table.empty() && int(old_table.size()) != nz);
+      m_ground_table.resize(nz);
+      for (int z = 0; z < nz; z++) {
+        ImageView< PixelMask<Vector2> > table(nx, ny);
+        double height = m_height_range[0] + z*m_ground_spacing[2];
+        for (int row = 0; row < ny; row++) {
+          for (int col = 0; col < nx; col++) {
+            if (!old_table.empty() && col % 2 == 0 && row % 2 == 0 &&
+                (!refined_z || z % 2 == 0)) {
+              table(col, row) = old_table[refined_z ? z/2 : z](col/2, row/2);
+              continue;
+            }
+            Vector2 pt = m_point_box.min()
+              + Vector2(col*m_ground_spacing[0], row*m_ground_spacing[1]);
+            try {
+              Vector2 lonlat = m_georef.point_to_lonlat(pt);
+              Vector3 xyz = m_georef.datum().geodetic_to_cartesian
+                (Vector3(lonlat[0], lonlat[1], height));
+              table(col, row) = m_exact_camera->point_to_pixel(xyz);
+            } catch(...) {
+              table(col, row).invalidate();
+            }
+          }
+        }
+        m_ground_table[z] = table;
+      }
+
+      // Check the error
+      m_ground_error = 0;
+      for (int z = 0; z < nz - 1; z++) {
+        double height = m_height_range[0] + (z + 0.5)*m_ground_spacing[2];
+        for (int row = 0; row < ny - 1; row += check_stride(ny)) {
+          for (int col = 0; col < nx - 1; col += check_stride(nx)) {
+            Vector2 pt = m_point_box.min()
+              + Vector2((col + 0.5)*m_ground_spacing[0], (row + 0.5)*m_ground_spacing[1]);
+            try {
+              Vector2 lonlat = m_georef.point_to_lonlat(pt);
+              Vector3 xyz = m_georef.datum().geodetic_to_cartesian
+                (Vector3(lonlat[0], lonlat[1], height));
+              Vector2 pix;
+              if (!interp_ground(xyz, pix))
+                continue;
+              Vector2 exact_pix = m_exact_camera->point_to_pixel(xyz);
+              if (!check_box.contains(exact_pix))
+                continue;
+              m_ground_error = std::max(m_ground_error, norm_2(pix - exact_pix));
+            } catch(...) {}
+          }
+        }
+      }
+
+      int next_nz = (refine(nz) <= MAX_HEIGHTS) ? refine(nz) : nz;
+      if (m_ground_error <= m_max_error ||
+          double(refine(nx))*refine(ny)*next_nz > MAX_NODES)
+        break;
+
+      old_table = m_ground_table; // the tables are not modified, but replaced
+      nx = refine(nx);
+      ny = refine(ny);
+      nz = next_nz;
+    }
+  }
+
+  bool ApproxCameraModel::interp_sensor(Vector2 const& pix, Vector3 & ctr, Vector3 & dir) const {
+    int col, row;
+    double dx, dy;
+    if (!find_cell((pix[0] - m_image_box.min()[0])/m_sensor_spacing[0],
+                   m_center_table.cols(), col, dx) ||
+        !find_cell((pix[1] - m_image_box.min()[1])/m_sensor_spacing[1],
+                   m_center_table.rows(), row, dy))
+      return false;
+    if (!interp_cell(m_center_table, col, row, dx, dy, ctr) ||
+        !interp_cell(m_dir_table,    col, row, dx, dy, dir))
+      return false;
+    dir = normalize(dir);
+    return true;
+  }
+
+  bool ApproxCameraModel::interp_ground(Vector3 const& point, Vector2 & pix) const {
+
+    if (m_ground_table.empty())
+      return false;
+
+    Vector3 llh = m_georef.datum().cartesian_to_geodetic(point);
+    Vector2 pt  = m_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+
+    int col, row, z;
+    double dx, dy, dz;
+    if (!find_cell((pt[0] - m_point_box.min()[0])/m_ground_spacing[0],
+                   m_ground_table[0].cols(), col, dx) ||
+        !find_cell((pt[1] - m_point_box.min()[1])/m_ground_spacing[1],
+                   m_ground_table[0].rows(), row, dy) ||
+        !find_cell((llh[2] - m_height_range[0])/m_ground_spacing[2],
+                   m_ground_table.size(), z, dz))
+      return false;
+
+    Vector2 pix0, pix1;
+    if (!interp_cell(m_ground_table[z],     col, row, dx, dy, pix0) ||
+        !interp_cell(m_ground_table[z + 1], col, row, dx, dy, pix1))
+      return false;
+    pix = (1 - dz)*pix0 + dz*pix1;
+    return true;
+  }
+
+  Vector2 ApproxCameraModel::point_to_pixel(Vector3 const& point) const {
+    Vector2 pix;
+    if (interp_ground(point, pix))
+      return pix;
+    return m_exact_camera->point_to_pixel(point);
+  }
+
+  Vector3 ApproxCameraModel::pixel_to_vector(Vector2 const& pix) const {
+    Vector3 ctr, dir;
+    if (interp_sensor(pix, ctr, dir))
+      return dir;
+    return m_exact_camera->pixel_to_vector(pix);
+  }
+
+  Vector3 ApproxCameraModel::camera_center(Vector2 const& pix) const {
+    Vector3 ctr, dir;
+    if (interp_sensor(pix, ctr, dir))
+      return ctr;
+    return m_exact_camera->camera_center(pix);
+  }
+
+} // end namespace asp
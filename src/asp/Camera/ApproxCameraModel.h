@@ -0,0 +1,127 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ApproxCameraModel.h
+///
+/// A camera model which approximates another one by interpolating
+/// precomputed tables. The functions camera_center() and
+/// pixel_to_vector() are tabulated on a grid of pixels covering the
+/// image, and, optionally, point_to_pixel() on a lattice of points
+/// aligned with a georeference and spanning a range of heights, such
+/// as around a DEM. The grids are refined until the interpolation
+/// error, measured in pixels, is below a given bound. Inputs outside
+/// the tables, or where the exact camera failed, use the exact camera.
+///
+/// This is much faster for cameras such as ISIS and CSM, whose exact
+/// evaluation is expensive. The lookups are thread-safe, but the exact
+/// camera is still invoked outside the tables.
+
+#ifndef __ASP_CAMERA_APPROX_CAMERA_MODEL_H__
+#define __ASP_CAMERA_APPROX_CAMERA_MODEL_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class ApproxCameraModel: public vw::camera::CameraModel {
+  public:
+
+    /// Tabulate camera_center() and pixel_to_vector() over the given
+    /// pixel box. The datum is used to convert errors in the rays to
+    /// pixels, using the distance from the camera to the ground.
+    ApproxCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_camera,
+                      vw::BBox2i const& image_box,
+                      vw::cartography::Datum const& datum,
+                      double max_error);
+
+    /// In addition, tabulate point_to_pixel() at the points, in the
+    /// projected coordinates of the given georeference, in point_box,
+    /// having heights above the datum in height_range.
+    ApproxCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_camera,
+                      vw::BBox2i const& image_box,
+                      vw::cartography::GeoReference const& georef,
+                      vw::BBox2 const& point_box,
+                      vw::Vector2 const& height_range,
+                      double max_error);
+
+    /// Load the tables saved with write(). They must have been computed
+    /// with the given exact camera.
+    ApproxCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_camera,
+                      std::string const& table_file);
+
+    virtual ~ApproxCameraModel() {}
+    virtual std::string type() const { return "Approx"; }
+
+    virtual vw::Vector2 point_to_pixel (vw::Vector3 const& point) const;
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix  ) const;
+    virtual vw::Vector3 camera_center  (vw::Vector2 const& pix  ) const;
+    virtual vw::Quaternion<double> camera_pose(vw::Vector2 const& pix) const {
+      return m_exact_camera->camera_pose(pix);
+    }
+
+    /// Save the tables, so that later runs can skip computing them.
+    void write(std::string const& table_file) const;
+
+    boost::shared_ptr<vw::camera::CameraModel> exact_camera() const { return m_exact_camera; }
+
+    /// The largest interpolation error, in pixels, found when checking
+    /// the tables. This may exceed the bound if the tables reached
+    /// their maximum size.
+    double sensor_error() const { return m_sensor_error; }
+    double ground_error() const { return m_ground_error; }
+    bool   has_ground_table() const { return !m_ground_table.empty(); }
+
+  private:
+
+    boost::shared_ptr<vw::camera::CameraModel> m_exact_camera;
+    double m_max_error;
+
+    // Camera centers and directions at the nodes of a grid of pixels
+    vw::BBox2 m_image_box;
+    vw::Vector2 m_sensor_spacing;
+    vw::ImageView< vw::PixelMask<vw::Vector3> > m_center_table, m_dir_table;
+    double m_sensor_error;
+
+    // Pixels at the nodes of a lattice of ground points, one table per height
+    vw::cartography::GeoReference m_georef;
+    vw::BBox2 m_point_box;
+    vw::Vector2 m_height_range;
+    vw::Vector3 m_ground_spacing;
+    std::vector< vw::ImageView< vw::PixelMask<vw::Vector2> > > m_ground_table;
+    double m_ground_error;
+
+    void compute_sensor_table(vw::cartography::Datum const& datum);
+    void compute_ground_table();
+
+    // Interpolate in the tables. Return false if outside or invalid.
+    bool interp_sensor(vw::Vector2 const& pix, vw::Vector3 & ctr, vw::Vector3 & dir) const;
+    bool interp_ground(vw::Vector3 const& point, vw::Vector2 & pix) const;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_APPROX_CAMERA_MODEL_H__
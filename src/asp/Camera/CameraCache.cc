@@ -0,0 +1,373 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/CameraCache.h>
+#include <asp/Camera/RPCModel.h>
+#include <vw/Cartography/Datum.h>
+#include <vw/Camera/CameraModel.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace {
+
+  const std::string CACHE_HEADER = "ASP camera cache, version 1";
+
+  bool cache_enabled() {
+    return getenv("ASP_NO_CAMERA_CACHE") == NULL;
+  }
+
+  // The same XML file can be loaded as a DG or RPC camera, so keep
+  // separate caches for each.
+  std::string cache_file(std::string const& camera_file, std::string const& kind) {
+    return camera_file + "." + boost::to_lower_copy(kind) + ".cache";
+  }
+
+  template <class T>
+  void write_val(std::ofstream & ofs, T const& val) {
+    ofs.write((char const*)&val, sizeof(T));
+  }
+  template <class T>
+  void read_val(std::ifstream & ifs, T & val) {
+    ifs.read((char*)&val, sizeof(T));
+  }
+
+  void write_str(std::ofstream & ofs, std::string const& str) {
+    int len = str.size();
+    write_val(ofs, len);
+    ofs.write(str.c_str(), len);
+  }
+  void read_str(std::ifstream & ifs, std::string & str) {
+    int len = 0;
+    read_val(ifs, len);
+    if (!ifs.good() || len < 0 || len > 100000) {
+      ifs.setstate(std::ios::failbit);
+      return;
+    }
+    str.resize(len);
+    if (len > 0)
+      ifs.read(&str[0], len);
+  }
+
+  template <class VecT>
+  void write_vec(std::ofstream & ofs, VecT const& vec) {
+    for (size_t it = 0; it < vec.size(); it++)
+      write_val(ofs, vec[it]);
+  }
+  template <class VecT>
+  void read_vec(std::ifstream & ifs, VecT & vec) {
+    for (size_t it = 0; it < vec.size(); it++)
+      read_val(ifs, vec[it]);
+  }
+
+  template <class VecT>
+  void write_array(std::ofstream & ofs, std::vector<VecT> const& vals) {
+    int num = vals.size();
+    write_val(ofs, num);
+    for (int it = 0; it < num; it++)
+      write_vec(ofs, vals[it]);
+  }
+  template <class VecT>
+  void read_array(std::ifstream & ifs, std::vector<VecT> & vals) {
+    int num = 0;
+    read_val(ifs, num);
+    if (!ifs.good() || num < 0 || num > 10000000) {
+      ifs.setstate(std::ios::failbit);
+      return;
+    }
+    vals.resize(num);
+    for (int it = 0; it < num; it++)
+      read_vec(ifs, vals[it]);
+  }
+
+  // Identify the camera file by its size and modification time
+  void camera_file_id(std::string const& camera_file,
+                      long long & size, long long & time) {
+    size = fs::file_size(camera_file);
+    time = fs::last_write_time(camera_file);
+  }
+
+  // Open the cache and check that it is of the given kind and was made
+  // from the current camera file.
+  bool open_cache(std::string const& camera_file, std::string const& kind,
+                  std::ifstream & ifs) {
+    try {
+      if (!cache_enabled() || !fs::exists(cache_file(camera_file, kind)))
+        return false;
+      ifs.open(cache_file(camera_file, kind).c_str(), std::ios::binary);
+      std::string header, cache_kind;
+      std::getline(ifs, header);
+      read_str(ifs, cache_kind);
+      long long size = 0, time = 0, cache_size = -1, cache_time = -1;
+      camera_file_id(camera_file, size, time);
+      read_val(ifs, cache_size);
+      read_val(ifs, cache_time);
+      return (ifs.good() && header == CACHE_HEADER && cache_kind == kind &&
+              cache_size == size && cache_time == time);
+    } catch(...) {}
+    return false;
+  }
+
+  // Write the cache to a file with a unique name, then rename it, so that
+  // concurrent processes never see partial files.
+  template <class WriteFunc>
+  void save_cache(std::string const& camera_file, std::string const& kind,
+                  WriteFunc const& write_func) {
+    if (!cache_enabled())
+      return;
+    try {
+      fs::path tmp_file = fs::path(cache_file(camera_file, kind)).parent_path()
+        / fs::unique_path("%%%%-%%%%-%%%%.cache.tmp");
+      {
+        std::ofstream ofs(tmp_file.string().c_str(), std::ios::binary);
+        long long size = 0, time = 0;
+        camera_file_id(camera_file, size, time);
+        ofs << CACHE_HEADER << "\n";
+        write_str(ofs, kind);
+        write_val(ofs, size);
+        write_val(ofs, time);
+        write_func(ofs);
+        if (!ofs.good()) {
+          ofs.close();
+          fs::remove(tmp_file);
+          return;
+        }
+      }
+      fs::rename(tmp_file, cache_file(camera_file, kind));
+    } catch(...) {}
+  }
+
+  struct WriteDG {
+    asp::DGCameraData const& data;
+    WriteDG(asp::DGCameraData const& d): data(d) {}
+    void operator()(std::ofstream & ofs) const {
+      write_array(ofs, data.positions);
+      write_array(ofs, data.velocities);
+      int num = data.poses.size();
+      write_val(ofs, num);
+      for (int it = 0; it < num; it++)
+        for (int c = 0; c < 4; c++)
+          write_val(ofs, data.poses[it][c]);
+      write_val(ofs, data.position_t0); write_val(ofs, data.position_dt);
+      write_val(ofs, data.pose_t0);     write_val(ofs, data.pose_dt);
+      num = data.tlc.size();
+      write_val(ofs, num);
+      for (int it = 0; it < num; it++) {
+        write_val(ofs, data.tlc[it].first);
+        write_val(ofs, data.tlc[it].second);
+      }
+      write_val(ofs, data.tlc_t0);
+      write_vec(ofs, data.image_size);
+      write_vec(ofs, data.detector_origin);
+      write_val(ofs, data.focal_length);
+      write_val(ofs, data.mean_ground_elevation);
+    }
+  };
+
+  struct WriteRPC {
+    asp::RPCModel const& rpc;
+    WriteRPC(asp::RPCModel const& r): rpc(r) {}
+    void operator()(std::ofstream & ofs) const {
+      cartography::Datum const& datum = rpc.datum();
+      write_str(ofs, datum.name());
+      write_str(ofs, datum.spheroid_name());
+      write_str(ofs, datum.meridian_name());
+      write_val(ofs, datum.semi_major_axis());
+      write_val(ofs, datum.semi_minor_axis());
+      write_val(ofs, datum.meridian_offset());
+      write_vec(ofs, rpc.line_num_coeff());
+      write_vec(ofs, rpc.line_den_coeff());
+      write_vec(ofs, rpc.sample_num_coeff());
+      write_vec(ofs, rpc.sample_den_coeff());
+      write_vec(ofs, rpc.xy_offset());
+      write_vec(ofs, rpc.xy_scale());
+      write_vec(ofs, rpc.lonlatheight_offset());
+      write_vec(ofs, rpc.lonlatheight_scale());
+    }
+  };
+
+  struct WriteFootprint {
+    std::string const& key;
+    BBox2 const& box;
+    float gsd;
+    WriteFootprint(std::string const& k, BBox2 const& b, float g): key(k), box(b), gsd(g) {}
+    void operator()(std::ofstream & ofs) const {
+      write_str(ofs, key);
+      write_vec(ofs, box.min());
+      write_vec(ofs, box.max());
+      write_val(ofs, gsd);
+    }
+  };
+
+  // Each footprint key has its own cache file, so that concurrent
+  // processes do not write to the same file.
+  std::string footprint_kind(std::string const& key) {
+    std::ostringstream os;
+    os << "FOOTPRINT-" << std::hex << boost::hash<std::string>()(key);
+    return os.str();
+  }
+}
+
+namespace asp {
+
+  bool read_camera_cache(std::string const& camera_file, DGCameraData & data) {
+
+    std::ifstream ifs;
+    if (!open_cache(camera_file, "DG", ifs))
+      return false;
+
+    read_array(ifs, data.positions);
+    read_array(ifs, data.velocities);
+    int num = 0;
+    read_val(ifs, num);
+    if (!ifs.good() || num < 0 || num > 10000000)
+      return false;
+    data.poses.resize(num);
+    for (int it = 0; it < num; it++) {
+      double q[4];
+      for (int c = 0; c < 4; c++)
+        read_val(ifs, q[c]);
+      data.poses[it] = Quat(q[0], q[1], q[2], q[3]);
+    }
+    read_val(ifs, data.position_t0); read_val(ifs, data.position_dt);
+    read_val(ifs, data.pose_t0);     read_val(ifs, data.pose_dt);
+    read_val(ifs, num);
+    if (!ifs.good() || num < 0 || num > 10000000)
+      return false;
+    data.tlc.resize(num);
+    for (int it = 0; it < num; it++) {
+      read_val(ifs, data.tlc[it].first);
+      read_val(ifs, data.tlc[it].second);
+    }
+    read_val(ifs, data.tlc_t0);
+    read_vec(ifs, data.image_size);
+    read_vec(ifs, data.detector_origin);
+    read_val(ifs, data.focal_length);
+    read_val(ifs, data.mean_ground_elevation);
+
+    return ifs.good() && data.positions.size() == data.velocities.size() &&
+      data.positions.size() == data.poses.size();
+  }
+
+  bool read_camera_cache(std::string const& camera_file, boost::shared_ptr<RPCModel> & rpc) {
+
+    std::ifstream ifs;
+    if (!open_cache(camera_file, "RPC", ifs))
+      return false;
+
+    std::string name, spheroid_name, meridian_name;
+    double semi_major = 0, semi_minor = 0, meridian_offset = 0;
+    read_str(ifs, name);
+    read_str(ifs, spheroid_name);
+    read_str(ifs, meridian_name);
+    read_val(ifs, semi_major);
+    read_val(ifs, semi_minor);
+    read_val(ifs, meridian_offset);
+    RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    Vector2 xy_offset, xy_scale;
+    Vector3 llh_offset, llh_scale;
+    read_vec(ifs, line_num);
+    read_vec(ifs, line_den);
+    read_vec(ifs, samp_num);
+    read_vec(ifs, samp_den);
+    read_vec(ifs, xy_offset);
+    read_vec(ifs, xy_scale);
+    read_vec(ifs, llh_offset);
+    read_vec(ifs, llh_scale);
+    if (!ifs.good())
+      return false;
+
+    cartography::Datum datum(name, spheroid_name, meridian_name,
+                             semi_major, semi_minor, meridian_offset);
+    rpc.reset(new RPCModel(datum, line_num, line_den, samp_num, samp_den,
+                           xy_offset, xy_scale, llh_offset, llh_scale));
+    return true;
+  }
+
+  void write_camera_cache(std::string const& camera_file, DGCameraData const& data) {
+    save_cache(camera_file, "DG", WriteDG(data));
+  }
+
+  void write_camera_cache(std::string const& camera_file, RPCModel const& rpc) {
+    save_cache(camera_file, "RPC", WriteRPC(rpc));
+  }
+
+  std::string camera_fingerprint(vw::camera::CameraModel const* camera,
+                                 Vector2i const& image_size) {
+    std::ostringstream os;
+    os.precision(17);
+    os << image_size[0] << " " << image_size[1];
+    Vector2 pixels[5] = {Vector2(0, 0), Vector2(image_size[0]-1, 0),
+                         Vector2(0, image_size[1]-1), Vector2(image_size[0]-1, image_size[1]-1),
+                         Vector2(image_size[0], image_size[1])/2.0};
+    for (int it = 0; it < 5; it++) {
+      try {
+        os << " " << camera->camera_center(pixels[it]) << " "
+           << camera->pixel_to_vector(pixels[it]);
+      } catch(...) {
+        os << " none";
+      }
+    }
+    return os.str();
+  }
+
+  std::string file_fingerprint(std::string const& file) {
+    std::ostringstream os;
+    os << file;
+    try {
+      long long size = 0, time = 0;
+      camera_file_id(file, size, time);
+      os << " " << size << " " << time;
+    } catch(...) {}
+    return os.str();
+  }
+
+  bool read_footprint_cache(std::string const& camera_file, std::string const& key,
+                            BBox2 & box, float & gsd) {
+    std::ifstream ifs;
+    if (!open_cache(camera_file, footprint_kind(key), ifs))
+      return false;
+
+    std::string cache_key;
+    read_str(ifs, cache_key);
+    Vector2 min, max;
+    read_vec(ifs, min);
+    read_vec(ifs, max);
+    read_val(ifs, gsd);
+    if (!ifs.good() || cache_key != key)
+      return false;
+
+    box = BBox2(min, max);
+    return true;
+  }
+
+  void write_footprint_cache(std::string const& camera_file, std::string const& key,
+                             BBox2 const& box, float gsd) {
+    save_cache(camera_file, footprint_kind(key), WriteFootprint(key, box, gsd));
+  }
+
+} // end namespace asp
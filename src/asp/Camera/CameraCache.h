@@ -0,0 +1,95 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraCache.h
+///
+/// Binary caches of the camera data parsed from XML files. Parsing a
+/// large XML file takes much longer than reading back the few arrays
+/// learned from it, and tools such as parallel_stereo load the same
+/// cameras again for each tile. The cache is written next to the
+/// camera file, as <camera file>.dg.cache or <camera file>.rpc.cache,
+/// and is used only if it was made from a file with the same size and
+/// modification time. Failure to write the cache, such as in a
+/// read-only directory, is ignored.
+/// Set the environment variable ASP_NO_CAMERA_CACHE to turn off caching.
+///
+/// The footprint of a camera on the ground, which takes thousands of
+/// ray intersections to find, is cached in the same way, for each
+/// combination of camera, DEM and output projection. That is shared by
+/// mapproject, its tiles, and camera_footprint.
+
+#ifndef __ASP_CAMERA_CAMERA_CACHE_H__
+#define __ASP_CAMERA_CAMERA_CACHE_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace vw { namespace camera {
+  class CameraModel;
+}}
+
+namespace asp {
+
+  class RPCModel;
+
+  /// What is needed to construct a DG camera model, after the XML
+  /// values were converted to the units and frames it expects.
+  struct DGCameraData {
+    std::vector<vw::Vector3> positions, velocities;
+    std::vector<vw::Quat>    poses;
+    double position_t0, position_dt, pose_t0, pose_dt;
+    std::vector<std::pair<double, double> > tlc;
+    double tlc_t0;
+    vw::Vector2i image_size;
+    vw::Vector2  detector_origin;
+    double focal_length, mean_ground_elevation;
+  };
+
+  /// Return false if there is no valid cache for this camera file.
+  bool read_camera_cache(std::string const& camera_file, DGCameraData & data);
+  bool read_camera_cache(std::string const& camera_file, boost::shared_ptr<RPCModel> & rpc);
+
+  void write_camera_cache(std::string const& camera_file, DGCameraData const& data);
+  void write_camera_cache(std::string const& camera_file, RPCModel const& rpc);
+
+  /// A string identifying a camera by its rays at the center and corners of
+  /// the image. This changes if the camera is adjusted.
+  std::string camera_fingerprint(vw::camera::CameraModel const* camera,
+                                 vw::Vector2i const& image_size);
+
+  /// A string identifying a file by its name, size and modification time
+  std::string file_fingerprint(std::string const& file);
+
+  /// Read and write the footprint of a camera on the ground, as a box in
+  /// projected coordinates and the ground sample distance. The key must
+  /// identify all the inputs of the footprint computation.
+  bool read_footprint_cache(std::string const& camera_file, std::string const& key,
+                            vw::BBox2 & box, float & gsd);
+  void write_footprint_cache(std::string const& camera_file, std::string const& key,
+                             vw::BBox2 const& box, float gsd);
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_CAMERA_CACHE_H__
@@ -28,6 +28,12 @@
 #include <boost/version.hpp>
 #include <boost/config.hpp>
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+
 // From the CSM base interface library
 #include <csm/csm.h>
 #include <csm/Plugin.h>
@@ -49,6 +55,31 @@ namespace asp {
 
 vw::Mutex csm_init_mutex;
 
+// Serializes the calls into models from plugins which are not reentrant
+std::mutex csm_call_mutex;
+
+// Count the loaded models, to identify them
+std::atomic<long> csm_model_count(0);
+
+// The plugin libraries must stay loaded while their models are in use
+std::vector<boost::dll::shared_library> csm_plugin_libs;
+std::set<std::string> csm_loaded_plugin_files;
+
+// The plugin library for each model name, as listed in the manifest
+// of the plugin folder, read only once
+const std::string CSM_PLUGIN_MANIFEST = "csm_plugins.txt";
+std::map<std::string, std::string> csm_plugin_manifest;
+bool csm_plugin_manifest_read = false;
+
+// Lock the calls into the model, unless it can be used by many threads.
+// The lock is released when the returned object goes out of scope.
+std::unique_lock<std::mutex> lock_model(bool reentrant) {
+  std::unique_lock<std::mutex> lock(csm_call_mutex, std::defer_lock);
+  if (!reentrant)
+    lock.lock();
+  return lock;
+}
+
 // -----------------------------------------------------------------
 // Helper functions
 
@@ -94,10 +125,16 @@ Vector2 imageCoordToVector(csm::ImageCoord c) {
 // -----------------------------------------------------------------
 // CsmModel class functions
 
-  CsmModel::CsmModel():m_semi_major_axis(0.0), m_semi_minor_axis(0.0) {
+  CsmModel::CsmModel():m_reentrant(false), m_id(0),
+                       m_semi_major_axis(0.0), m_semi_minor_axis(0.0) {
 }
 
-CsmModel::CsmModel(std::string const& isd_path) {
+bool CsmModel::plugin_is_reentrant(std::string const& plugin_name) {
+  // The USGS plugin keeps all of its state in the models
+  return (plugin_name == "UsgsAstroPluginCSM");
+}
+
+CsmModel::CsmModel(std::string const& isd_path):m_reentrant(false), m_id(0) {
   load_model(isd_path);
 }
 
@@ -202,8 +239,9 @@ void CsmModel::print_available_models() {
       
 // This function is not kept out of the header file to hide CSM dependencies.
 /// Look through all of the loaded plugins and find one that is compatible with
-///  the provided ISD.
+///  the provided ISD. If the ISD names its model, only that model is tried.
 const csm::Plugin* find_plugin_for_isd(csm::Isd const& support_data,
+                                       std::string const& isd_model_name,
                                        std::string   & model_name,
                                        std::string   & model_family,
                                        bool            show_warnings) {
@@ -218,6 +256,8 @@ const csm::Plugin* find_plugin_for_isd(csm::Isd const& support_data,
     size_t num_models = csm_plugin->getNumModels();
     for (size_t i=0; i<num_models; ++i) {
       std::string this_model_name = (*iter)->getModelName(i);
+      if (!isd_model_name.empty() && this_model_name != isd_model_name)
+        continue;
 
       // Check if we can construct a camera with the ISD and this plugin/model.
       csm::WarningList warnings;
@@ -242,55 +282,83 @@ const csm::Plugin* find_plugin_for_isd(csm::Isd const& support_data,
 } // End function find_plugin_for_isd
 
 
-void CsmModel::initialize_plugins() {
+// The plugin library providing the given model. It is looked up in the
+// manifest of the plugin folder, which has on each line a model name
+// and the library providing it, either as a full path or relative to
+// the folder. Models not listed there are taken to be in the USGS
+// plugin. Must be called with csm_init_mutex held.
+std::string plugin_file_for_model(std::string const& model_name) {
+
+  const std::string folder = CsmModel::get_csm_plugin_folder();
+
+  if (!csm_plugin_manifest_read) {
+    csm_plugin_manifest_read = true;
+    fs::path manifest = fs::path(folder) / CSM_PLUGIN_MANIFEST;
+    std::ifstream ifs(manifest.string().c_str());
+    std::string line;
+    while (std::getline(ifs, line)) {
+      std::istringstream is(line);
+      std::string name, lib;
+      if (!(is >> name >> lib) || name[0] == '#')
+        continue;
+      fs::path lib_path(lib);
+      if (!lib_path.is_absolute())
+        lib_path = fs::path(folder) / lib_path;
+      csm_plugin_manifest[name] = lib_path.string();
+    }
+  }
+
+  std::map<std::string, std::string>::const_iterator it
+    = csm_plugin_manifest.find(model_name);
+  if (it != csm_plugin_manifest.end()) {
+    if (!fs::exists(it->second))
+      vw_throw( ArgumentErr() << "Cannot find plugin: " << it->second
+                << ", listed for model " << model_name << " in "
+                << (fs::path(folder) / CSM_PLUGIN_MANIFEST).string() << ".\n");
+    return it->second;
+  }
+
+  std::vector<std::string> plugin_files;
+  CsmModel::find_csm_plugins(plugin_files);
+  return plugin_files[0];
+}
+
+void CsmModel::initialize_plugins(std::string const& model_name) {
 
   // Only let one thread at a time in here.
   vw::Mutex::Lock lock(csm_init_mutex);
 
-  // If we already have plugins loaded, don't do initialization again.
-  csm::PluginList plugins = csm::Plugin::getList();
-  if (!plugins.empty())
+  // Load only the plugin providing this model, if not loaded already.
+  std::string plugin_file = plugin_file_for_model(model_name);
+  if (csm_loaded_plugin_files.find(plugin_file) != csm_loaded_plugin_files.end())
     return;
 
-  vw_out() << "Initializing CSM plugins...\n";
-
-  // Find all of the available CSM plugin DLL files.
-  std::vector<std::string> plugin_files;
-  size_t num_plugin_files = find_csm_plugins(plugin_files);
-  vw_out() << "Found " << num_plugin_files << " CSM plugin files.\n";
-
-  // Load all of the plugins.
-  for (size_t i=0; i<num_plugin_files; ++i) {
-    // Get the DLL in memory, causing it to automatically register itself
-    //  with the main Plugin interface.
-    vw_out() << "Loading CSM plugin: " << plugin_files[i] << std::endl;
-    boost::dll::shared_library lib_usgs(plugin_files[i]);
-  }
+  // Get the DLL in memory, causing it to automatically register itself
+  //  with the main Plugin interface.
+  vw_out() << "Loading CSM plugin: " << plugin_file << std::endl;
+  csm_plugin_libs.push_back(boost::dll::shared_library(plugin_file));
+  csm_loaded_plugin_files.insert(plugin_file);
 
   //csm::Plugin::setDataDirectory(plugin_folder); // Don't think we need this.
 
   print_available_models();
 }
 
-// Read the semi-major and semi-minor axes
-void CsmModel::read_ellipsoid(std::string const& isd_path) {
-
-  // Load and parse the json file
-  std::ifstream ifs(isd_path);
-  json json_isd;
-  ifs >> json_isd;
+// Read the semi-major and semi-minor axes from the parsed ISD
+void read_isd_ellipsoid(json const& json_isd, std::string const& isd_path,
+                        double & semi_major, double & semi_minor) {
 
   // Read the semi-major axis
-  m_semi_major_axis = 0.0;
+  semi_major = 0.0;
   try {
-    m_semi_major_axis = json_isd.at("radii").at("semimajor");
+    semi_major = json_isd.at("radii").at("semimajor");
   } catch (...){
   }
 
   // Read the semi-minor axis
-  m_semi_minor_axis = 0.0;
+  semi_minor = 0.0;
   try {
-    m_semi_minor_axis = json_isd.at("radii").at("semiminor");
+    semi_minor = json_isd.at("radii").at("semiminor");
   } catch (...){
   }
 
@@ -304,40 +372,66 @@ void CsmModel::read_ellipsoid(std::string const& isd_path) {
 
   // Convert from km to m if need be
   if (unit == "km") {
-    m_semi_major_axis *= 1000.0;
-    m_semi_minor_axis *= 1000.0;
+    semi_major *= 1000.0;
+    semi_minor *= 1000.0;
   } else if (unit != "m") {
     vw::vw_throw( vw::ArgumentErr() << "Unknown unit for the ellipsoid radii in "
                   << isd_path << ". The read value is: " << unit);
   }
 
   // Sanity check
-  if (m_semi_major_axis <= 0.0 || m_semi_minor_axis <= 0.0) 
+  if (semi_major <= 0.0 || semi_minor <= 0.0) 
     vw::vw_throw( vw::ArgumentErr() << "Could not read positive semi-major "
                   << "and semi-minor axies from:  " << isd_path
                   << ". The read values are: "
-                  << m_semi_major_axis << ' ' << m_semi_minor_axis);
+                  << semi_major << ' ' << semi_minor);
+}
+
+// Read the semi-major and semi-minor axes
+void CsmModel::read_ellipsoid(std::string const& isd_path) {
+
+  // Load and parse the json file
+  std::ifstream ifs(isd_path);
+  json json_isd;
+  ifs >> json_isd;
+
+  read_isd_ellipsoid(json_isd, isd_path, m_semi_major_axis, m_semi_minor_axis);
 }
 
 void CsmModel::load_model(std::string const& isd_path) {
 
-  // This only happens the first time it is called.
-  initialize_plugins();
+  // Parse the ISD once, for the ellipsoid and the name of the model
+  std::string isd_model_name;
+  {
+    std::ifstream ifs(isd_path);
+    json json_isd;
+    ifs >> json_isd;
+    read_isd_ellipsoid(json_isd, isd_path, m_semi_major_axis, m_semi_minor_axis);
+    try {
+      isd_model_name = json_isd.at("name_model").get<std::string>();
+    } catch (...){
+    }
+  }
+
+  // Load the plugin for this model. This happens only once per plugin.
+  initialize_plugins(isd_model_name);
 
   // Load ISD data
   csm::Isd support_data(isd_path);
 
-  CsmModel::read_ellipsoid(isd_path);
-  
   // Check each available CSM plugin until we find one that can handle the ISD.
   std::string model_name, model_family;
-  const csm::Plugin* csm_plugin = find_plugin_for_isd(support_data, model_name,
-                                                      model_family, false);
+  const csm::Plugin* csm_plugin = find_plugin_for_isd(support_data, isd_model_name,
+                                                      model_name, model_family, false);
+
+  // The ISD may name its model differently than the plugin does
+  if (csm_plugin == 0 && !isd_model_name.empty())
+    csm_plugin = find_plugin_for_isd(support_data, "", model_name, model_family, false);
 
   // If we did not find a plugin that would work, go through them again and print error
   //  messages for each plugin that fails.
   if (csm_plugin == 0) {
-    find_plugin_for_isd(support_data, model_name, model_family, true);
+    find_plugin_for_isd(support_data, "", model_name, model_family, true);
     vw::vw_throw( vw::ArgumentErr() << "Unable to construct a camera model for the ISD file "
                         << isd_path << " using any of the loaded CSM plugins!");
   }
@@ -368,9 +462,67 @@ void CsmModel::load_model(std::string const& isd_path) {
 
   m_csm_model.reset(raster_model); // We will handle cleanup of the model.
 
+  // Save what is needed to clone the model in other threads
+  m_plugin_name = csm_plugin->getPluginName();
+  m_reentrant   = plugin_is_reentrant(m_plugin_name);
+  m_model_state = "";
+  if (m_reentrant) {
+    try {
+      m_model_state = m_csm_model->getModelState();
+    } catch(...) {}
+    if (m_model_state.empty()) 
+      m_reentrant = false;
+  }
+  m_id = ++csm_model_count;
+
   std::cout << "Done setting up the CSM model\n";
 }
 
+// Each thread keeps the clones of the last few models it used. A clone
+// outlives its model only until it is replaced in this list.
+csm::RasterGM* CsmModel::thread_model() const {
+
+  if (!m_reentrant)
+    return m_csm_model.get();
+
+  const int NUM_CLONES = 8;
+  struct Clones {
+    long ids[NUM_CLONES];
+    boost::shared_ptr<csm::RasterGM> models[NUM_CLONES];
+    int next;
+    Clones(): next(0) {
+      for (int it = 0; it < NUM_CLONES; it++)
+        ids[it] = 0;
+    }
+  };
+  static thread_local Clones clones;
+  for (int it = 0; it < NUM_CLONES; it++) {
+    if (clones.ids[it] == m_id)
+      return clones.models[it].get();
+  }
+
+  // Construct the clone. Plugins need not be safe to use for that from
+  // several threads at the same time.
+  csm::Model* new_model = NULL;
+  {
+    vw::Mutex::Lock lock(csm_init_mutex);
+    const csm::Plugin* csm_plugin = csm::Plugin::findPlugin(m_plugin_name);
+    if (csm_plugin)
+      new_model = csm_plugin->constructModelFromState(m_model_state);
+  }
+  csm::RasterGM* raster_model = dynamic_cast<csm::RasterGM*>(new_model);
+  if (!raster_model) {
+    delete new_model;
+    vw::vw_throw( vw::ArgumentErr() << "Failed to clone the CSM sensor model.");
+  }
+
+  int slot = clones.next;
+  clones.ids[slot] = m_id;
+  clones.models[slot].reset(raster_model);
+  clones.next = (slot + 1) % NUM_CLONES;
+  return raster_model;
+}
+
 void CsmModel::throw_if_not_init() const {
   if (!m_csm_model)
     vw_throw( ArgumentErr() << "CsmModel: Sensor model has not been loaded yet!" );
@@ -382,7 +534,8 @@ void CsmModel::throw_if_not_init() const {
 vw::Vector2 CsmModel::get_image_size() const {
   throw_if_not_init();
 
-  csm::ImageVector size = m_csm_model->getImageSize();
+  std::unique_lock<std::mutex> lock = lock_model(m_reentrant);
+  csm::ImageVector size = thread_model()->getImageSize();
   return Vector2(size.samp, size.line);
 }
 
@@ -401,8 +554,12 @@ Vector2 CsmModel::point_to_pixel (Vector3 const& point) const {
   if (show_warnings) 
     warnings_ptr = &warnings;
 
-  csm::ImageCoord imagePt = m_csm_model->groundToImage(ecef, desiredPrecision,
-						       &achievedPrecision, warnings_ptr);
+  csm::ImageCoord imagePt;
+  {
+    std::unique_lock<std::mutex> lock = lock_model(m_reentrant);
+    imagePt = thread_model()->groundToImage(ecef, desiredPrecision,
+                                            &achievedPrecision, warnings_ptr);
+  }
 
   if (show_warnings) {
     csm::WarningList::const_iterator w_iter;
@@ -421,7 +578,8 @@ Vector3 CsmModel::pixel_to_vector(Vector2 const& pix) const {
 
   // This function generates the vector from the camera at the camera origin,
   //  there is a different call that gets the vector near the ground.
-  csm::EcefLocus locus = m_csm_model->imageToRemoteImagingLocus(imagePt);
+  std::unique_lock<std::mutex> lock = lock_model(m_reentrant);
+  csm::EcefLocus locus = thread_model()->imageToRemoteImagingLocus(imagePt);
       //double desiredPrecision = 0.001,
       //double* achievedPrecision = NULL,
       //WarningList* warnings = NULL)
@@ -434,7 +592,8 @@ Vector3 CsmModel::camera_center(Vector2 const& pix) const {
   throw_if_not_init();
 
   csm::ImageCoord imagePt = vectorToImageCoord(pix + ASP_TO_CSM_SHIFT);
-  csm::EcefCoord  ecef    = m_csm_model->getSensorPosition(imagePt);
+  std::unique_lock<std::mutex> lock = lock_model(m_reentrant);
+  csm::EcefCoord  ecef    = thread_model()->getSensorPosition(imagePt);
   
   return ecefCoordToVector(ecef);
 }
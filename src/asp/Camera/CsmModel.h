@@ -20,7 +20,10 @@
 ///
 /// Wrapper for Community Sensor Model implementations.
 ///
-///
+/// The models of plugins known to be reentrant are cloned from their
+/// saved state, once for each thread that uses them, so that they can
+/// be used by many threads at the same time. For other plugins the
+/// calls into the model are serialized.
 #ifndef __STEREO_CAMERA_CSM_MODEL_H__
 #define __STEREO_CAMERA_CSM_MODEL_H__
 
@@ -81,6 +84,15 @@ namespace asp {
     /// Print the CSM models that have been loaded into the main CSM plugin.
     static void print_available_models();
 
+    /// Return true if the model can be used by many threads at the
+    /// same time without serializing the calls.
+    bool supports_multi_threading() const { return m_reentrant; }
+
+    /// Return true if different models from this plugin do not share
+    /// any state which could change, so that they can be used in
+    /// different threads.
+    static bool plugin_is_reentrant(std::string const& plugin_name);
+
     /// Get the semi-axes of the datum. 
     vw::Vector3 target_radii() const {
       return vw::Vector3(m_semi_major_axis, // x
@@ -93,9 +105,20 @@ namespace asp {
     // TODO: Is it always going to be this type (RasterGM)?
     boost::shared_ptr<csm::RasterGM> m_csm_model;
 
-    /// Find and load any available CSM plugin libraries from disk.
-    /// - This does nothing after the first time it finds any plugins.
-    void initialize_plugins();
+    // Needed to clone the model for each thread
+    std::string m_plugin_name, m_model_state;
+    bool m_reentrant;
+    long m_id; // Identifies the loaded model, for finding its clones
+
+    /// Return the model to use in the current thread. If the plugin
+    /// is not reentrant, this is the shared model, and the calls into
+    /// it must be serialized.
+    csm::RasterGM* thread_model() const;
+
+    /// Load the CSM plugin library providing the given model, as
+    /// listed in the manifest of the plugin folder. Other plugins are
+    /// not loaded. This does nothing if that library is loaded already.
+    void initialize_plugins(std::string const& model_name);
 
     /// Throw an exception if we have not loaded the model yet.
     void throw_if_not_init() const;
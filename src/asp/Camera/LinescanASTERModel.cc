@@ -19,6 +19,8 @@
 #include <asp/Camera/ASTER_XML.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/LinescanASTERModel.h>
+#include <asp/Camera/LinescanSolve.h>
+#include <asp/Core/ProjectionContext.h>
 namespace asp {
 
 using namespace vw;
@@ -128,6 +130,14 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
     has_guess = true;
   }
 
+  // Else use the pixel found for the previous point, if any,
+  // which also avoids the search for a guess below.
+  vw::Vector2 hint;
+  if (!has_guess && ProjectionContext::get_hint(this, hint)) {
+    start = hint;
+    has_guess = true;
+  }
+
   if (!has_guess) {
     double min_err = norm_2(model(start));
     // No good initial guess. The method will fail to converge.
@@ -186,6 +196,14 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
   const int    MAX_ITERATIONS = 1e+5;
   const double MAX_ERROR = 1e-2;
 
+  // Try first the faster solver from the initial guess, which stops
+  // as soon as it converges, to a residual much below MAX_ERROR.
+  vw::Vector2 fast_solution = start;
+  if (gauss_newton_pixel_solve(model, fast_solution)) {
+    ProjectionContext::set_hint(this, fast_solution);
+    return fast_solution;
+  }
+
   // Try two initial guesses. TODO: Study this in more detail.
   
   // Solution with user-provided initial guess
@@ -216,6 +234,7 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
   VW_ASSERT( (status > 0) && (error < MAX_ERROR),
              vw::camera::PointToPixelErr() << "Unable to project point into LinescanASTER model" );
   
+  ProjectionContext::set_hint(this, solution);
   return solution;
 }
 
@@ -29,6 +29,8 @@
 #include <vw/Camera/Extrinsics.h>
 
 #include <asp/Core/StereoSettings.h>  // TESTING
+#include <asp/Camera/CameraCache.h>
+#include <asp/Camera/SplineInterpolation.h>
 
 namespace asp {
 
@@ -40,8 +42,8 @@ namespace asp {
   // from Digital Globe model, but you can rotate pose beforehand.
 
   // The standard class variant is:
-  //      typedef LinescanDGModel<vw::camera::PiecewiseAPositionInterpolation,
-  //                      			  vw::camera::SLERPPoseInterpolation> DGCameraModel;
+  //      typedef LinescanDGModel<DGPositionInterpolation,
+  //                              DGPoseInterpolation> DGCameraModel;
 
   // The useful load_dg_camera_model() function is at the end of the file.
 
@@ -149,18 +151,84 @@ namespace asp {
       inline result_type operator()( domain_type const& y ) const;
     };
 
+    // The same error as LinescanLMA, as a scalar function of the line,
+    // for the faster secant solver, which does not allocate memory.
+    class LineOffsetFunc {
+      const LinescanDGModel* m_model;
+      vw::Vector3 m_point;
+    public:
+      LineOffsetFunc( const LinescanDGModel* model, const vw::Vector3& pt ) :
+        m_model(model), m_point(pt) {}
+
+      inline double operator()( double y ) const;
+    };
+
   }; // End class LinescanDGModel
 
 
+  /// The DG positions are interpolated with a piecewise constant
+  /// acceleration and the poses with SLERP, or, if use_spline is set
+  /// for a camera, with cubic splines, which are faster to evaluate.
+  class DGPositionInterpolation {
+  public:
+    DGPositionInterpolation(std::vector<vw::Vector3> const& positions,
+                            std::vector<vw::Vector3> const& velocities,
+                            double t0, double dt, bool use_spline):
+      m_piecewise(positions, velocities, t0, dt), m_use_spline(use_spline) {
+      if (use_spline)
+        m_spline = HermitePositionInterpolation(positions, velocities, t0, dt);
+    }
+
+    vw::Vector3 operator()(double t) const {
+      if (m_use_spline)
+        return m_spline(t);
+      return m_piecewise(t);
+    }
+
+    bool uses_spline() const { return m_use_spline; }
+
+  private:
+    vw::camera::PiecewiseAPositionInterpolation m_piecewise;
+    HermitePositionInterpolation                m_spline;
+    bool m_use_spline;
+  };
+
+  class DGPoseInterpolation {
+  public:
+    DGPoseInterpolation(std::vector<vw::Quat> const& poses,
+                        double t0, double dt, bool use_spline):
+      m_slerp(poses, t0, dt), m_use_spline(use_spline) {
+      if (use_spline)
+        m_spline = HermitePoseInterpolation(poses, t0, dt);
+    }
+
+    vw::Quat operator()(double t) const {
+      if (m_use_spline)
+        return m_spline(t);
+      return m_slerp(t);
+    }
+
+    bool uses_spline() const { return m_use_spline; }
+
+  private:
+    vw::camera::SLERPPoseInterpolation m_slerp;
+    HermitePoseInterpolation           m_spline;
+    bool m_use_spline;
+  };
+
   /// This is the standard DG implementation
-  typedef LinescanDGModel<vw::camera::PiecewiseAPositionInterpolation,
-                  			  vw::camera::SLERPPoseInterpolation> DGCameraModel;
+  typedef LinescanDGModel<DGPositionInterpolation, DGPoseInterpolation> DGCameraModel;
 
   /// Load a DG camera model from an XML file.
   /// - This function does not take care of Xerces XML init/de-init, the caller must
   ///   make sure this is done before/after this function is called!
+  /// - A binary cache of the values parsed from the file is used if current,
+  ///   see CameraCache.h.
   inline boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const& path);
 
+  /// Parse the values needed to build a DG camera model from an XML file.
+  inline DGCameraData load_dg_camera_data_from_xml(std::string const& path);
+
 }      // namespace asp
 
 #include <asp/Camera/LinescanDGModel.tcc>
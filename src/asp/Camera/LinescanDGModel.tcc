@@ -22,6 +22,8 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/LinescanSolve.h>
+#include <asp/Core/ProjectionContext.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 namespace asp {
@@ -52,21 +54,34 @@ vw::Vector3 LinescanDGModel<PositionFuncT, PoseFuncT>::get_local_pixel_vector(vw
 template <class PositionFuncT, class PoseFuncT>
 vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel(vw::Vector3 const& point, double starty) const {
 
+  // Without a guess, start from the line found for the previous point
+  vw::Vector2 hint;
+  if (starty < 0 && ProjectionContext::get_hint(this, hint))
+    starty = hint.y();
+
   // Use the uncorrected function to get a fast but good starting seed.
   vw::camera::CameraGenericLMA model( this, point );
   int status;
   vw::Vector2 start = point_to_pixel_uncorrected(point, starty);
 
+  // The seed is very close, so a few Gauss-Newton steps are normally enough
+  vw::Vector2 solution = start;
+  if (gauss_newton_pixel_solve(model, solution)) {
+    ProjectionContext::set_hint(this, solution);
+    return solution;
+  }
+
   // Run the solver
   vw::Vector3 objective(0, 0, 0);
   const double ABS_TOL = 1e-16;
   const double REL_TOL = 1e-16;
   const int    MAX_ITERATIONS = 1e+5;
-  vw::Vector2 solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>(model, start, objective, status,
+  solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>(model, start, objective, status,
                                                        ABS_TOL, REL_TOL, MAX_ITERATIONS);
   VW_ASSERT( status > 0,
           vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model" );
 
+  ProjectionContext::set_hint(this, solution);
   return solution;
 }
 
@@ -74,30 +89,38 @@ vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel(vw::Vector
 template <class PositionFuncT, class PoseFuncT>
 vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel_uncorrected(vw::Vector3 const& point, double starty) const {
 
-  // Solve for the correct line number to use
-  LinescanLMA model( this, point );
-  int status;
-  vw::Vector<double> objective(1), start(1);
-  start[0] = m_image_size.y()/2; 
   // Use a refined guess, if available, otherwise the center line.
+  double start_line = m_image_size.y()/2; 
   if (starty >= 0)
-    start[0] = starty;
-
-  // Run the solver
-  const double ABS_TOL = 1e-16;
-  const double REL_TOL = 1e-16;
-  const int    MAX_ITERATIONS = 1e+5;
-  vw::Vector<double> solution = vw::math::levenberg_marquardt(model, start, objective, status,
-                                                              ABS_TOL, REL_TOL, MAX_ITERATIONS);
-
-  VW_ASSERT( status > 0, vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model" );
+    start_line = starty;
+
+  // Solve for the correct line number to use. The offset from the
+  // detector is nearly linear in the line, so the secant method
+  // converges in a few steps. Fall back to the general solver.
+  double line = start_line;
+  if (!secant_line_solve(LineOffsetFunc(this, point), start_line, line)) {
+    LinescanLMA model( this, point );
+    int status;
+    vw::Vector<double> objective(1), start(1);
+    start[0] = start_line;
+
+    // Run the solver
+    const double ABS_TOL = 1e-16;
+    const double REL_TOL = 1e-16;
+    const int    MAX_ITERATIONS = 1e+5;
+    vw::Vector<double> solution = vw::math::levenberg_marquardt(model, start, objective, status,
+                                                                ABS_TOL, REL_TOL, MAX_ITERATIONS);
+
+    VW_ASSERT( status > 0, vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model" );
+    line = solution[0];
+  }
 
   // Solve for sample location now that we know the correct line
-  double      t  = m_time_func( solution[0] );
+  double      t  = m_time_func( line );
   vw::Vector3 pt = inverse( m_pose_func(t) ).rotate( point - m_position_func(t) );
   pt *= m_focal_length / pt.z();
 
-  return vw::Vector2(pt.x() - m_detector_origin[0], solution[0]);
+  return vw::Vector2(pt.x() - m_detector_origin[0], line);
 }
 
 
@@ -129,6 +152,19 @@ LinescanDGModel<PositionFuncT, PoseFuncT>::LinescanLMA::operator()( domain_type
 }
 
 
+template <class PositionFuncT, class PoseFuncT>
+double LinescanDGModel<PositionFuncT, PoseFuncT>::LineOffsetFunc::operator()( double y ) const {
+  double       t        = m_model->get_time_at_line(y);
+  vw::Quat     pose     = m_model->get_camera_pose_at_time(t);
+  vw::Vector3  position = m_model->m_position_func(t);
+
+  // Get point in camera's frame and rescale to pixel units
+  vw::Vector3 pt = vw::camera::point_to_camera_coord(position, pose, m_point);
+  pt *= m_model->m_focal_length / pt.z();
+  return pt.y() - m_model->m_detector_origin[1]; // Error against the location of the detector
+}
+
+
 // -----------------------------------------------------------------
 // LinescanDGModel supporting functions
 
@@ -158,6 +194,36 @@ boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const
 {
   //vw_out() << "DEBUG - Loading DG camera file: " << camera_file << std::endl;
 
+  // Parsing the XML file is slow, so use the cache made from it if present
+  DGCameraData data;
+  if (!read_camera_cache(path, data)) {
+    data = load_dg_camera_data_from_xml(path);
+    write_camera_cache(path, data);
+  }
+
+  // The corrections and the interpolation are not cached, as they
+  // depend on the options
+  bool use_spline = stereo_settings().dg_spline_interpolation;
+  typedef boost::shared_ptr<DGCameraModel> CameraModelPtr;
+  return CameraModelPtr(new DGCameraModel(DGPositionInterpolation(data.positions, data.velocities,
+                                                                  data.position_t0, data.position_dt,
+                                                                  use_spline),
+                                          vw::camera::LinearPiecewisePositionInterpolation(data.velocities,
+                                                                                           data.position_t0, data.position_dt),
+                                          DGPoseInterpolation(data.poses, data.pose_t0, data.pose_dt,
+                                                              use_spline),
+                                          vw::camera::TLCTimeInterpolation(data.tlc, data.tlc_t0),
+                                          data.image_size,
+                                          data.detector_origin,
+                                          data.focal_length,
+                                          data.mean_ground_elevation,
+                                          !stereo_settings().disable_correct_velocity_aberration,
+                                          !stereo_settings().disable_correct_atmospheric_refraction)
+                        );
+} // End function load_dg_camera_model()
+
+DGCameraData load_dg_camera_data_from_xml(std::string const& path)
+{
   // Parse the Digital Globe XML file
   GeometricXML geo;
   AttitudeXML  att;
@@ -252,20 +318,22 @@ boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const
   double edt = eph.time_interval;
   double adt = att.time_interval;
 
-  // This is where we could set the Earth radius if we have that info.
-
-  typedef boost::shared_ptr<DGCameraModel> CameraModelPtr;
-  return CameraModelPtr(new DGCameraModel(vw::camera::PiecewiseAPositionInterpolation(eph.position_vec, eph.velocity_vec, et0, edt ),
-					                                vw::camera::LinearPiecewisePositionInterpolation(eph.velocity_vec, et0, edt),
-					                                vw::camera::SLERPPoseInterpolation(att.quat_vec, at0, adt),
-					                                tlc_time_interpolation, img.image_size,
-					                                final_detector_origin,
-					                                geo.principal_distance,
-					                                mean_ground_elevation,
-					                                !stereo_settings().disable_correct_velocity_aberration,
-					                                !stereo_settings().disable_correct_atmospheric_refraction)
-		    );
-} // End function load_dg_camera_model()
+  DGCameraData data;
+  data.positions             = eph.position_vec;
+  data.velocities            = eph.velocity_vec;
+  data.poses                 = att.quat_vec;
+  data.position_t0           = et0;
+  data.position_dt           = edt;
+  data.pose_t0               = at0;
+  data.pose_dt               = adt;
+  data.tlc                   = img.tlc_vec;
+  data.tlc_t0                = convert( parse_time( img.tlc_start_time ) );
+  data.image_size            = img.image_size;
+  data.detector_origin       = final_detector_origin;
+  data.focal_length          = geo.principal_distance;
+  data.mean_ground_elevation = mean_ground_elevation;
+  return data;
+} // End function load_dg_camera_data_from_xml()
 
 
 } // end namespace asp
@@ -0,0 +1,114 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file LinescanSolve.h
+///
+/// Small solvers for projecting ground points into linescan cameras.
+/// These do not allocate memory and stop as soon as they converge,
+/// which makes them much faster than the general least squares
+/// solvers when started close to the solution. If they fail, the
+/// callers fall back to the general solvers. Exceptions thrown by the
+/// camera functions, such as for times out of range, count as failure.
+
+#ifndef __ASP_CAMERA_LINESCAN_SOLVE_H__
+#define __ASP_CAMERA_LINESCAN_SOLVE_H__
+
+#include <vw/Math/Vector.h>
+
+#include <cmath>
+
+namespace asp {
+
+  /// Find the line y where func(y) = 0 with the secant method,
+  /// starting at y0. The function func is expected to be close to
+  /// linear, such as the offset from the detector of the projection
+  /// of a point into the camera at a given line.
+  template <class FuncT>
+  bool secant_line_solve(FuncT const& func, double y0, double & y,
+                         int max_iterations = 30, double tol = 1e-10) {
+
+    try {
+      double y1 = y0 + 1.0;
+      double f0 = func(y0), f1 = func(y1);
+      for (int it = 0; it < max_iterations; it++) {
+        if (f1 == f0 || !std::isfinite(f0) || !std::isfinite(f1))
+          return false;
+        double y2 = y1 - f1*(y1 - y0)/(f1 - f0);
+        if (!std::isfinite(y2))
+          return false;
+        y0 = y1; f0 = f1;
+        y1 = y2;
+        if (std::abs(y1 - y0) < tol) {
+          y = y1;
+          return true;
+        }
+        f1 = func(y1);
+        if (f1 == 0) {
+          y = y1;
+          return true;
+        }
+      }
+    } catch(...) {}
+    return false;
+  }
+
+  /// Find the pixel where the residual of the given model is zero,
+  /// with Gauss-Newton iterations, starting at pix. The model is as
+  /// vw::camera::CameraGenericLMA, returning for a pixel the 3D
+  /// difference between the camera ray and the direction to the
+  /// point. The Jacobian is found with finite differences. Succeed
+  /// only if the iterations converge to a residual below max_error.
+  template <class ModelT>
+  bool gauss_newton_pixel_solve(ModelT const& model, vw::Vector2 & pix,
+                                double max_error = 1e-8, int max_iterations = 20,
+                                double tol = 1e-8) {
+
+    const double step = 1e-3; // in pixels
+    try {
+      vw::Vector2 curr = pix;
+      for (int it = 0; it < max_iterations; it++) {
+
+        vw::Vector3 r  = model(curr);
+        vw::Vector3 dx = (model(curr + vw::Vector2(step, 0)) - r)/step;
+        vw::Vector3 dy = (model(curr + vw::Vector2(0, step)) - r)/step;
+
+        // Solve the 2x2 normal equations
+        double a = dot_prod(dx, dx), b = dot_prod(dx, dy), c = dot_prod(dy, dy);
+        double det = a*c - b*b;
+        if (!(std::abs(det) > 0) || !std::isfinite(det))
+          return false;
+        double gx = dot_prod(dx, r), gy = dot_prod(dy, r);
+        vw::Vector2 delta(-( c*gx - b*gy)/det, -(-b*gx + a*gy)/det);
+        if (!std::isfinite(delta[0]) || !std::isfinite(delta[1]))
+          return false;
+
+        curr += delta;
+        if (norm_2(delta) < tol) {
+          if (!(norm_2(model(curr)) < max_error))
+            return false;
+          pix = curr;
+          return true;
+        }
+      }
+    } catch(...) {}
+    return false;
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_LINESCAN_SOLVE_H__
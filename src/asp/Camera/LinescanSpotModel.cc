@@ -19,6 +19,8 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/SPOT_XML.h>
 #include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/LinescanSolve.h>
+#include <asp/Core/ProjectionContext.h>
 
 namespace asp {
 
@@ -34,8 +36,18 @@ vw::Vector2 SPOTCameraModel::point_to_pixel(Vector3 const& point, double starty)
   vw::camera::CameraGenericLMA model( this, point );
   int status;
   vw::Vector2 start = m_image_size / 2.0; // Use the center as the initial guess
+  vw::Vector2 hint;
   if (starty >= 0) // If the user provided a line number guess..
     start[1] = starty;
+  else if (ProjectionContext::get_hint(this, hint)) // else use the previous pixel
+    start = hint;
+
+  // Try first the faster solver, which stops as soon as it converges
+  vw::Vector2 solution = start;
+  if (gauss_newton_pixel_solve(model, solution)) {
+    ProjectionContext::set_hint(this, solution);
+    return solution;
+  }
 
   // Solver constants
   const double ABS_TOL = 1e-16;
@@ -44,13 +56,14 @@ vw::Vector2 SPOTCameraModel::point_to_pixel(Vector3 const& point, double starty)
   const double MAX_ERROR = 0.01;
 
   Vector3 objective(0, 0, 0);
-  vw::Vector2 solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>(model, start, objective, status,
+  solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>(model, start, objective, status,
                                                ABS_TOL, REL_TOL, MAX_ITERATIONS);
   // Check the error - If it is too high then the solver probably got stuck at the edge of the image.
   double  error = norm_2(model(solution));
   VW_ASSERT( (status > 0) && (error < MAX_ERROR),
 	           vw::camera::PointToPixelErr() << "Unable to project point into LinescanSPOT model" );
 
+  ProjectionContext::set_hint(this, solution);
   return solution;
 }
 
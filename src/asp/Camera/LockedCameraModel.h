@@ -0,0 +1,80 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file LockedCameraModel.h
+///
+/// A camera model which forwards all calls to another camera model
+/// while holding a lock shared among all such cameras. This makes it
+/// possible to use cameras that are not thread-safe, such as ISIS
+/// cameras, whose state lives in global SPICE variables, from
+/// multi-threaded code. Only the camera calls are serialized, the
+/// rest of the work can proceed in parallel.
+
+#ifndef __ASP_CAMERA_LOCKED_CAMERA_MODEL_H__
+#define __ASP_CAMERA_LOCKED_CAMERA_MODEL_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Camera/CameraModel.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace asp {
+
+  class LockedCameraModel: public vw::camera::CameraModel {
+  public:
+
+    LockedCameraModel(boost::shared_ptr<vw::camera::CameraModel> camera):
+      m_camera(camera) {}
+    virtual ~LockedCameraModel() {}
+
+    virtual std::string type() const { return m_camera->type(); }
+
+    virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point) const {
+      vw::Mutex::Lock lock(camera_mutex());
+      return m_camera->point_to_pixel(point);
+    }
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const {
+      vw::Mutex::Lock lock(camera_mutex());
+      return m_camera->pixel_to_vector(pix);
+    }
+    virtual vw::Vector3 camera_center(vw::Vector2 const& pix) const {
+      vw::Mutex::Lock lock(camera_mutex());
+      return m_camera->camera_center(pix);
+    }
+    virtual vw::Quaternion<double> camera_pose(vw::Vector2 const& pix) const {
+      vw::Mutex::Lock lock(camera_mutex());
+      return m_camera->camera_pose(pix);
+    }
+
+    boost::shared_ptr<vw::camera::CameraModel> camera() const { return m_camera; }
+
+  private:
+
+    // One lock for all cameras, as the state which is not thread-safe
+    // may be global rather than per camera.
+    static vw::Mutex & camera_mutex() {
+      static vw::Mutex mutex;
+      return mutex;
+    }
+
+    boost::shared_ptr<vw::camera::CameraModel> m_camera;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_LOCKED_CAMERA_MODEL_H__
@@ -19,6 +19,8 @@
 #include <vw/Camera/CameraModel.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/OpticalBarModel.h>
+#include <asp/Camera/LinescanSolve.h>
+#include <asp/Core/ProjectionContext.h>
 
 #include <vw/Cartography/Datum.h>  // DEBUG
 
@@ -70,17 +72,23 @@ double OpticalBarModel::pixel_to_time_delta(Vector2 const& pix) const {
   return time_delta;
 }
 
-Vector3 OpticalBarModel::get_velocity(vw::Vector2 const& pixel) const {
+void OpticalBarModel::compute_pose_and_velocity() {
+
+  m_pose = axis_angle_to_quaternion(m_initial_orientation);
 
-  // TODO: For speed, store the pose*velocity vector.
   // Convert the velocity from sensor coords to GCC coords
-  Matrix3x3 pose = camera_pose(pixel).rotation_matrix();
+  Matrix3x3 pose = m_pose.rotation_matrix();
 
   // Recover the satellite attitude relative to the tilted camera position
   //Matrix3x3 m = vw::math::rotation_x_axis(-m_forward_tilt_radians)*pose;
   Matrix3x3 m = pose*vw::math::rotation_x_axis(m_forward_tilt_radians);
   
-  return m*Vector3(0,m_speed,0);
+  m_velocity = m*Vector3(0,m_speed,0);
+}
+
+Vector3 OpticalBarModel::get_velocity(vw::Vector2 const& pixel) const {
+  // The velocity is constant during a scan
+  return m_velocity;
 }
 
 Vector3 OpticalBarModel::camera_center(Vector2 const& pix) const {
@@ -93,48 +101,60 @@ Vector3 OpticalBarModel::camera_center(Vector2 const& pix) const {
 
 Quat OpticalBarModel::camera_pose(Vector2 const& pix) const {
   // Camera pose is treated as constant for the duration of a scan.
-  return axis_angle_to_quaternion(m_initial_orientation);
+  return m_pose;
 }
 
-Vector3 OpticalBarModel::pixel_to_vector_uncorrected(Vector2 const& pixel) const {
- 
-  Vector2 sensor_plane_pos = pixel_to_sensor_plane(pixel);
-  Vector3 cam_center       = camera_center(pixel);
-  Quat    cam_pose         = camera_pose  (pixel);
+void OpticalBarModel::compute_column_terms(double col, ColumnTerms & terms) const {
+
+  terms.col    = col;
+  terms.center = camera_center(Vector2(col, 0));
 
   // This is the horizontal angle away from the center point (from straight out of the camera)
-  double alpha = sensor_to_alpha(sensor_plane_pos);
+  double alpha = sensor_to_alpha(pixel_to_sensor_plane(Vector2(col, 0)));
+  terms.sin_alpha = sin(alpha);
+  terms.cos_alpha = cos(alpha);
 
   // Distance from the camera center to the ground.
-  double H = norm_2(cam_center) - (m_mean_surface_elevation + m_mean_earth_radius);
+  double H = norm_2(terms.center) - (m_mean_surface_elevation + m_mean_earth_radius);
 
   // Distortion caused by compensation for the satellite's forward motion during the image.
   // - The film was actually translated underneath the lens to compensate for the motion.
-  double image_motion_compensation = ((m_focal_length * m_speed) / (H*m_scan_rate_radians))
-                                      * sin(alpha) * m_motion_compensation;
+  terms.motion_compensation = ((m_focal_length * m_speed) / (H*m_scan_rate_radians))
+                               * terms.sin_alpha * m_motion_compensation;
   if (!m_scan_left_to_right) // Sync alpha with motion compensation.
-    image_motion_compensation *= -1.0;
+    terms.motion_compensation *= -1.0;
+}
 
+Vector3 OpticalBarModel::pixel_to_vector_uncorrected(Vector2 const& pixel) const {
+  ColumnTerms terms;
+  compute_column_terms(pixel[0], terms);
+  Vector2 sensor_plane_pos = pixel_to_sensor_plane(pixel);
 
   // This vector is ESD format, consistent with the linescan model.
-  Vector3 r(m_focal_length * sin(alpha),
-            sensor_plane_pos[1] + image_motion_compensation,
-            m_focal_length * cos(alpha));
+  Vector3 r(m_focal_length * terms.sin_alpha,
+            sensor_plane_pos[1] + terms.motion_compensation,
+            m_focal_length * terms.cos_alpha);
   r = normalize(r);
 
   // r is the ray vector in the local camera system
 
   // Convert the ray vector into GCC coordinates.
-  Vector3 result = cam_pose.rotate(r);
-
-  return result;
+  return m_pose.rotate(r);
 }
 
-Vector3 OpticalBarModel::pixel_to_vector(Vector2 const& pixel) const {
+Vector3 OpticalBarModel::pixel_to_vector(Vector2 const& pixel, ColumnTerms const& terms) const {
   try {
-    Vector3 output_vector = pixel_to_vector_uncorrected(pixel);
+    Vector2 sensor_plane_pos = pixel_to_sensor_plane(pixel);
+
+    // This vector is ESD format, consistent with the linescan model.
+    Vector3 r(m_focal_length * terms.sin_alpha,
+              sensor_plane_pos[1] + terms.motion_compensation,
+              m_focal_length * terms.cos_alpha);
+
+    // Convert the ray vector from the local camera system into GCC coordinates.
+    Vector3 output_vector = m_pose.rotate(normalize(r));
 
-    Vector3 cam_ctr = camera_center(pixel);
+    Vector3 const& cam_ctr = terms.center;
     if (!m_correct_atmospheric_refraction) 
       output_vector = apply_atmospheric_refraction_correction(cam_ctr, m_mean_earth_radius,
                                                               m_mean_surface_elevation, output_vector);
@@ -142,7 +162,7 @@ Vector3 OpticalBarModel::pixel_to_vector(Vector2 const& pixel) const {
     if (!m_correct_velocity_aberration) 
       return output_vector;
     else
-      return apply_velocity_aberration_correction(cam_ctr, get_velocity(pixel),
+      return apply_velocity_aberration_correction(cam_ctr, m_velocity,
                                                   m_mean_earth_radius, output_vector);
 
   } catch(const vw::Exception &e) {
@@ -150,6 +170,32 @@ Vector3 OpticalBarModel::pixel_to_vector(Vector2 const& pixel) const {
     //  pixel to ray exception that other code will be able to handle.
     vw_throw(vw::camera::PixelToRayErr() << e.what());
   }
+  return Vector3(); // Never reached
+}
+
+Vector3 OpticalBarModel::pixel_to_vector(Vector2 const& pixel) const {
+  ColumnTerms terms;
+  compute_column_terms(pixel[0], terms);
+  return pixel_to_vector(pixel, terms);
+}
+
+void OpticalBarModel::pixels_to_vectors(std::vector<Vector2> const& pixels,
+                                        std::vector<Vector3>      & vectors) const {
+  vectors.resize(pixels.size());
+  ColumnTerms terms;
+  for (size_t it = 0; it < pixels.size(); it++) {
+    if (it == 0 || pixels[it][0] != terms.col)
+      compute_column_terms(pixels[it][0], terms);
+    vectors[it] = pixel_to_vector(pixels[it], terms);
+  }
+}
+
+void OpticalBarModel::points_to_pixels(std::vector<Vector3> const& points,
+                                       std::vector<Vector2>      & pixels) const {
+  // point_to_pixel() starts from the pixel found for the previous point
+  pixels.resize(points.size());
+  for (size_t it = 0; it < points.size(); it++)
+    pixels[it] = point_to_pixel(points[it]);
 }
 
 Vector2 OpticalBarModel::point_to_pixel(Vector3 const& point) const {
@@ -159,6 +205,16 @@ Vector2 OpticalBarModel::point_to_pixel(Vector3 const& point) const {
   CameraGenericLMA model( this, point );
   int status;
   Vector2 start = m_image_size / 2.0; // Use the center as the initial guess
+  Vector2 hint;
+  if (asp::ProjectionContext::get_hint(this, hint)) // or the pixel for the previous point
+    start = hint;
+
+  // Try first the faster solver, which stops as soon as it converges
+  Vector2 solution = start;
+  if (asp::gauss_newton_pixel_solve(model, solution)) {
+    asp::ProjectionContext::set_hint(this, solution);
+    return solution;
+  }
 
   // Solver constants
   const double ABS_TOL = 1e-16;
@@ -166,11 +222,12 @@ Vector2 OpticalBarModel::point_to_pixel(Vector3 const& point) const {
   const int    MAX_ITERATIONS = 1e+5;
 
   Vector3 objective(0, 0, 0);
-  Vector2 solution = math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>(model, start, objective, status,
+  solution = math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>(model, start, objective, status,
                                                ABS_TOL, REL_TOL, MAX_ITERATIONS);
   VW_ASSERT( status > 0,
              camera::PointToPixelErr() << "Unable to project point into Linescan model" );
 
+  asp::ProjectionContext::set_hint(this, solution);
   return solution;
 }
 
@@ -331,6 +388,7 @@ void OpticalBarModel::read(std::string const& filename) {
   cam_file.close();
   
   compute_scan_rate(); // This needs to be updated!
+  compute_pose_and_velocity();
 }
 
 
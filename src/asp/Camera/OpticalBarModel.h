@@ -28,6 +28,8 @@
 #include <vw/Math/LevenbergMarquardt.h>
 #include <vw/Camera/CameraModel.h>
 
+#include <vector>
+
 namespace asp {
 namespace camera {
 
@@ -107,6 +109,7 @@ namespace camera {
       m_mean_surface_elevation = DEFAULT_SURFACE_ELEVATION;
       
       compute_scan_rate();
+      compute_pose_and_velocity();
     }
 
     virtual ~OpticalBarModel() {}
@@ -135,6 +138,17 @@ namespace camera {
     /// Gives a pose vector which represents the rotation from camera to world units
     virtual vw::Quat camera_pose(vw::Vector2 const& pix) const;
 
+    /// Batch versions of pixel_to_vector() and point_to_pixel(). The
+    /// terms depending only on the image column, such as the camera
+    /// center, the scan angle, and the motion compensation, are found
+    /// once for each run of pixels in the same column. Each projection
+    /// is seeded with the pixel of the previous point, so the points
+    /// should be in scan order, such as along rows of a tile.
+    void pixels_to_vectors(std::vector<vw::Vector2> const& pixels,
+                           std::vector<vw::Vector3>      & vectors) const;
+    void points_to_pixels (std::vector<vw::Vector3> const& points,
+                           std::vector<vw::Vector2>      & pixels) const;
+
     // -- These are new functions --
 
     // These return the initial center/pose at time=0.
@@ -149,7 +163,8 @@ namespace camera {
     // Parameter accessors
 
     void set_camera_center(vw::Vector3 const& position   )     {m_initial_position    = position;}
-    void set_camera_pose  (vw::Vector3 const& orientation)     {m_initial_orientation = orientation;}
+    void set_camera_pose  (vw::Vector3 const& orientation)     {m_initial_orientation = orientation;
+                                                                compute_pose_and_velocity(); }
     void set_camera_pose  (vw::Quaternion<double> const& pose) {set_camera_pose(pose.axis_angle());}
 
     /// Returns the image size in pixels
@@ -171,13 +186,15 @@ namespace camera {
     void set_focal_length  (double       focal_length  ) { m_focal_length         = focal_length;
                                                            compute_scan_rate(); }
     //void set_scan_rate     (double       scan_rate     ) { m_scan_rate_radians    = scan_rate;      }
-    void set_speed         (double       speed         ) { m_speed                = speed;          }
+    void set_speed         (double       speed         ) { m_speed                = speed;
+                                                           compute_pose_and_velocity(); }
     void set_pixel_size    (double       pixel_size    ) { m_pixel_size           = pixel_size;
                                                            compute_scan_rate(); }
     void set_scan_time     (double       scan_time     ) { m_scan_time   = scan_time;     
                                                            compute_scan_rate(); }
     void set_scan_dir      (bool         scan_l_to_r   ) { m_scan_left_to_right   = scan_l_to_r;    }
-    void set_forward_tilt  (double       tilt_angle    ) { m_forward_tilt_radians = tilt_angle;     }
+    void set_forward_tilt  (double       tilt_angle    ) { m_forward_tilt_radians = tilt_angle;
+                                                           compute_pose_and_velocity(); }
 
     double get_motion_compensation() const           { return m_motion_compensation;    }
     void   set_motion_compensation(double mc_factor) { m_motion_compensation = mc_factor;}
@@ -192,6 +209,19 @@ namespace camera {
     /// Compute and record the scan rate into m_scan_rate.
     void compute_scan_rate();
 
+    /// Record the pose and the velocity, which are constant during a
+    /// scan, so they are not recomputed for each pixel.
+    void compute_pose_and_velocity();
+
+    /// The terms of pixel_to_vector() which depend only on the column.
+    struct ColumnTerms {
+      double      col;
+      vw::Vector3 center;
+      double      sin_alpha, cos_alpha, motion_compensation;
+    };
+    void compute_column_terms(double col, ColumnTerms & terms) const;
+    vw::Vector3 pixel_to_vector(vw::Vector2 const& pixel, ColumnTerms const& terms) const;
+
     /// Get position on the (flattened) sensor (film) plane in meters.
     vw::Vector2 pixel_to_sensor_plane(vw::Vector2 const& pixel) const;
 
@@ -256,6 +286,10 @@ namespace camera {
     /// Set this flag to enable atmospheric refraction correction.
     bool m_correct_atmospheric_refraction;
 
+    /// Derived from the values above by compute_pose_and_velocity().
+    vw::Quat    m_pose;
+    vw::Vector3 m_velocity; // In the GCC frame
+
   protected:
 
     /// Returns the radius of the Earth under the current camera position.
@@ -19,6 +19,7 @@
 
 
 #include <vw/Math/Vector.h>
+#include <vw/Math/LinearAlgebra.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/FileIO/FileUtils.h>
 #include <vw/Cartography/Datum.h>
@@ -32,8 +33,34 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
+
 using namespace vw;
 
+namespace {
+
+  // The normalized heights at which rays are found. The virtual center
+  // of the camera should be above the terrain.
+  const double VERT_SCALE_FACTOR = 0.9;
+
+  // The heights of the layers of the approximate inverse, normalized,
+  // including the ones above.
+  double inverse_layer_height(int layer) {
+    return -VERT_SCALE_FACTOR + VERT_SCALE_FACTOR*layer;
+  }
+
+  // The terms of the quadratic polynomials of the approximate inverse
+  vw::Vector<double, 6> inverse_terms(vw::Vector2 const& p) {
+    vw::Vector<double, 6> t;
+    t[0] = 1.0;       t[1] = p[0];      t[2] = p[1];
+    t[3] = p[0]*p[1]; t[4] = p[0]*p[0]; t[5] = p[1]*p[1];
+    return t;
+  }
+
+  std::atomic<long> g_rpc_model_count(0);
+}
+
 namespace asp {
 
   void RPCModel::initialize( DiskImageResourceGDAL* resource ) {
@@ -66,6 +93,8 @@ namespace asp {
     m_line_den_coeff   = CoeffVec(gdal_rpc.adfLINE_DEN_COEFF);
     m_sample_num_coeff = CoeffVec(gdal_rpc.adfSAMP_NUM_COEFF);
     m_sample_den_coeff = CoeffVec(gdal_rpc.adfSAMP_DEN_COEFF);
+
+    initialize_inverse();
   }
 
   RPCModel::RPCModel( std::string const& filename ) {
@@ -109,8 +138,74 @@ namespace asp {
     m_xy_offset(xy_offset),
     m_xy_scale(xy_scale), 
     m_lonlatheight_offset(lonlatheight_offset),
-    m_lonlatheight_scale(lonlatheight_scale) {}
-    
+    m_lonlatheight_scale(lonlatheight_scale) {
+    initialize_inverse();
+  }
+
+  // Fit the approximate inverse. At each layer, project a grid of
+  // pixels to the ground with Newton's method, going from each grid
+  // point to the next so that the guesses are good, then fit the
+  // polynomials with least squares. This takes a few thousand RPC
+  // evaluations, which is less than a few hundred rays without it.
+  void RPCModel::initialize_inverse() {
+
+    m_has_inverse = false;
+    m_id = ++g_rpc_model_count;
+
+    const int NUM_GRID = 11;
+    for (int layer = 0; layer < NUM_INVERSE_LAYERS; layer++) {
+
+      double height = m_lonlatheight_offset[2]
+        + m_lonlatheight_scale[2]*inverse_layer_height(layer);
+
+      std::vector<Vector2> normalized_pixels, normalized_lonlats;
+      Vector2 lonlat_guess = subvector(m_lonlatheight_offset, 0, 2);
+      for (int row = 0; row < NUM_GRID; row++) {
+        for (int col = 0; col < NUM_GRID; col++) {
+          // Go back and forth, so consecutive grid points are neighbors
+          int c = (row % 2 == 0) ? col : NUM_GRID - 1 - col;
+          Vector2 normalized_pixel(-1.0 + 2.0*c/(NUM_GRID - 1.0),
+                                   -1.0 + 2.0*row/(NUM_GRID - 1.0));
+          Vector2 pixel  = elem_prod(normalized_pixel, m_xy_scale) + m_xy_offset;
+          Vector2 lonlat = image_to_ground(pixel, height, lonlat_guess);
+          Vector2 normalized_lonlat
+            = elem_quot(lonlat - subvector(m_lonlatheight_offset, 0, 2),
+                        subvector(m_lonlatheight_scale, 0, 2));
+
+          // Keep only points where Newton's method converged
+          Vector3 normalized_geodetic(normalized_lonlat[0], normalized_lonlat[1],
+                                      inverse_layer_height(layer));
+          Vector2 err = normalized_geodetic_to_normalized_pixel(normalized_geodetic)
+            - normalized_pixel;
+          if (!(norm_2(err) < 1e-6))
+            continue;
+
+          normalized_pixels.push_back(normalized_pixel);
+          normalized_lonlats.push_back(normalized_lonlat);
+          lonlat_guess = lonlat;
+        }
+      }
+
+      if (normalized_pixels.size() < 20)
+        return; // Too few points, will do without the inverse
+
+      Matrix<double> A(normalized_pixels.size(), 6);
+      Vector<double> bx(normalized_pixels.size()), by(normalized_pixels.size());
+      for (size_t it = 0; it < normalized_pixels.size(); it++) {
+        select_row(A, it) = inverse_terms(normalized_pixels[it]);
+        bx[it] = normalized_lonlats[it][0];
+        by[it] = normalized_lonlats[it][1];
+      }
+      try {
+        select_col(m_inverse_coeffs[layer], 0) = least_squares(A, bx);
+        select_col(m_inverse_coeffs[layer], 1) = least_squares(A, by);
+      } catch(...) {
+        return;
+      }
+    }
+
+    m_has_inverse = true;
+  }
 
   void RPCModel::load_rpb_file( std::string const& filename) {
     //vw_out() << "Reading RPC model from RPB file, defaulting to WGS84 datum.\n";
@@ -202,6 +297,8 @@ namespace asp {
     if (max_coeff_index != 20)
       vw_throw( ArgumentErr() << "Error reading file " << filename
                               << ", loaded wrong number of coefficients!");
+
+    initialize_inverse();
   }
 
   // All of these implementations are largely inspired by the GDAL
@@ -224,6 +321,68 @@ namespace asp {
     return elem_prod( normalized_pixel, m_xy_scale ) + m_xy_offset;
   }
 
+  void RPCModel::points_to_pixels(std::vector<Vector3> const& points,
+                                  std::vector<Vector2>      & pixels) const {
+    std::vector<Vector3> geodetics(points.size());
+    for (size_t it = 0; it < points.size(); it++)
+      geodetics[it] = m_datum.cartesian_to_geodetic(points[it]);
+    geodetics_to_pixels(geodetics, pixels);
+  }
+
+  void RPCModel::geodetics_to_pixels(std::vector<Vector3> const& geodetics,
+                                     std::vector<Vector2>      & pixels) const {
+
+    pixels.resize(geodetics.size());
+
+    const int BLOCK_SIZE = 256;
+    double x[BLOCK_SIZE], y[BLOCK_SIZE], z[BLOCK_SIZE], sample[BLOCK_SIZE], line[BLOCK_SIZE];
+    for (size_t beg = 0; beg < geodetics.size(); beg += BLOCK_SIZE) {
+      int num = std::min(size_t(BLOCK_SIZE), geodetics.size() - beg);
+      for (int it = 0; it < num; it++) {
+        Vector3 const& g = geodetics[beg + it];
+        x[it] = (g[0] - m_lonlatheight_offset[0])/m_lonlatheight_scale[0];
+        y[it] = (g[1] - m_lonlatheight_offset[1])/m_lonlatheight_scale[1];
+        z[it] = (g[2] - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
+      }
+      normalized_geodetics_to_normalized_pixels(num, x, y, z,
+                                                m_line_num_coeff,   m_line_den_coeff,
+                                                m_sample_num_coeff, m_sample_den_coeff,
+                                                sample, line);
+      for (int it = 0; it < num; it++)
+        pixels[beg + it] = Vector2(sample[it]*m_xy_scale[0] + m_xy_offset[0],
+                                   line  [it]*m_xy_scale[1] + m_xy_offset[1]);
+    }
+  }
+
+  // The same computation as calculate_terms() followed by dot products,
+  // but with no branches or temporaries in the loop over the points.
+  void RPCModel::normalized_geodetics_to_normalized_pixels
+  (int num_pts, double const* x, double const* y, double const* z,
+   CoeffVec const& line_num_coeff,   CoeffVec const& line_den_coeff,
+   CoeffVec const& sample_num_coeff, CoeffVec const& sample_den_coeff,
+   double * sample, double * line) {
+
+    // Local copies, so the compiler knows they do not alias the outputs
+    double ln[20], ld[20], sn[20], sd[20];
+    for (int k = 0; k < 20; k++) {
+      ln[k] = line_num_coeff[k];   ld[k] = line_den_coeff[k];
+      sn[k] = sample_num_coeff[k]; sd[k] = sample_den_coeff[k];
+    }
+
+    for (int it = 0; it < num_pts; it++) {
+      double X = x[it], Y = y[it], Z = z[it];
+      double t[20] = {1.0, X, Y, Z, X*Y, X*Z, Y*Z, X*X, Y*Y, Z*Z,
+                      X*Y*Z, X*X*X, X*Y*Y, X*Z*Z, X*X*Y, Y*Y*Y, Y*Z*Z, X*X*Z, Y*Y*Z, Z*Z*Z};
+      double lnv = 0, ldv = 0, snv = 0, sdv = 0;
+      for (int k = 0; k < 20; k++) {
+        lnv += ln[k]*t[k]; ldv += ld[k]*t[k];
+        snv += sn[k]*t[k]; sdv += sd[k]*t[k];
+      }
+      sample[it] = snv/sdv;
+      line  [it] = lnv/ldv;
+    }
+  }
+
   Vector2 RPCModel::normalized_geodetic_to_normalized_pixel
   (Vector3 const& normalized_geodetic,
    RPCModel::CoeffVec const& line_num_coeff,
@@ -458,7 +617,7 @@ namespace asp {
 
     // Initial guess for the normalized lon and lat
     if (lonlat_guess == Vector2(0.0, 0.0)){
-      lonlat_guess = subvector(m_lonlatheight_offset, 0, 2);
+      lonlat_guess = approx_image_to_ground(pixel, height);
     }
     Vector2 normalized_lonlat = elem_quot(lonlat_guess - subvector(m_lonlatheight_offset, 0, 2),
                                           subvector(m_lonlatheight_scale, 0, 2)
@@ -509,12 +668,50 @@ namespace asp {
 
   }
 
+  Vector2 RPCModel::approx_image_to_ground(Vector2 const& pixel, double height) const {
+
+    if (!m_has_inverse)
+      return subvector(m_lonlatheight_offset, 0, 2);
+
+    Vector<double, 6> terms
+      = inverse_terms(elem_quot(pixel - m_xy_offset, m_xy_scale));
+
+    // Find the two layers to interpolate between, extrapolating
+    // if the height is out of range.
+    double h = (height - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
+    if (h != h)
+      return subvector(m_lonlatheight_offset, 0, 2);
+    int layer = (int)std::floor((h - inverse_layer_height(0))/VERT_SCALE_FACTOR);
+    layer = std::max(0, std::min(NUM_INVERSE_LAYERS - 2, layer));
+    double t = (h - inverse_layer_height(layer))/VERT_SCALE_FACTOR;
+
+    Vector2 normalized_lonlat
+      = (1.0 - t)*transpose(m_inverse_coeffs[layer    ])*terms
+      +        t *transpose(m_inverse_coeffs[layer + 1])*terms;
+
+    return elem_prod(normalized_lonlat, subvector(m_lonlatheight_scale, 0, 2))
+      + subvector(m_lonlatheight_offset, 0, 2);
+  }
+
   void RPCModel::point_and_dir(Vector2 const& pix, Vector3 & P, Vector3 & dir ) const {
 
     // For an RPC model there is no defined origin so it and the ray need to be computed.
 
+    // A ray is often found twice in a row for the same pixel, once by
+    // camera_center() and once by pixel_to_vector(), so remember the
+    // last one in each thread.
+    struct RayCache {
+      long id; Vector2 pix; Vector3 P, dir;
+      RayCache(): id(0) {}
+    };
+    static thread_local RayCache cache;
+    if (cache.id == m_id && cache.pix == pix) {
+      P   = cache.P;
+      dir = cache.dir;
+      return;
+    }
+
     // Center of valid region to bottom of valid region (normalized)
-    const double VERT_SCALE_FACTOR = 0.9; // - The virtual center should be above the terrain
     double  height_up = m_lonlatheight_offset[2] + m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
     double  height_dn = m_lonlatheight_offset[2] - m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
 
@@ -524,11 +721,11 @@ namespace asp {
     //vw_out() << "Height up = " << height_up << std::endl;
     //vw_out() << "Height dn = " << height_dn << std::endl;
 
-    // Given the pixel and elevation, estimate lon-lat.
-    // Use m_lonlatheight_offset as initial guess for lonlat_up,
-    // and then use lonlat_up as initial guess for lonlat_dn.
-    Vector2 lonlat_up = image_to_ground(pix, height_up, subvector(m_lonlatheight_offset, 0, 2));
-    Vector2 lonlat_dn = image_to_ground(pix, height_dn, lonlat_up);
+    // Given the pixel and elevation, estimate lon-lat. The initial
+    // guesses come from the approximate inverse, which was fit at
+    // exactly these heights, so Newton's method needs about one step.
+    Vector2 lonlat_up = image_to_ground(pix, height_up, approx_image_to_ground(pix, height_up));
+    Vector2 lonlat_dn = image_to_ground(pix, height_dn, approx_image_to_ground(pix, height_dn));
 
     //vw_out() << "lonlat_up = " << lonlat_up << std::endl;
     //vw_out() << "lonlat_dn = " << lonlat_dn << std::endl;
@@ -548,6 +745,11 @@ namespace asp {
     //  to put it high above the terrain.
     const double LONG_SCALE_UP = 10000; // This is a distance in meters approx from the top of the llh valid cube
     P = P_up - dir*LONG_SCALE_UP;
+
+    cache.id  = m_id;
+    cache.pix = pix;
+    cache.P   = P;
+    cache.dir = dir;
   }
 
   Vector3 RPCModel::camera_center(Vector2 const& pix ) const{
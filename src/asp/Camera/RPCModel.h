@@ -37,6 +37,7 @@
 
 #include <string>
 #include <ostream>
+#include <vector>
 
 namespace vw {
   class DiskImageResourceGDAL;
@@ -93,6 +94,24 @@ namespace asp {
 
     vw::Vector2 geodetic_to_pixel( vw::Vector3 const& geodetic ) const;
 
+    /// Batch versions of point_to_pixel() and geodetic_to_pixel(). The
+    /// points are processed in blocks with separate arrays for each
+    /// coordinate, so that the compiler can vectorize the evaluation
+    /// of the polynomials.
+    void points_to_pixels   (std::vector<vw::Vector3> const& points,
+                             std::vector<vw::Vector2>      & pixels) const;
+    void geodetics_to_pixels(std::vector<vw::Vector3> const& geodetics,
+                             std::vector<vw::Vector2>      & pixels) const;
+
+    /// Evaluate the RPC polynomials at num_pts normalized geodetics given
+    /// as separate x, y, z arrays, and write the normalized pixels to the
+    /// sample and line arrays.
+    static void normalized_geodetics_to_normalized_pixels
+      (int num_pts, double const* x, double const* y, double const* z,
+       CoeffVec const& line_num_coeff,   CoeffVec const& line_den_coeff,
+       CoeffVec const& sample_num_coeff, CoeffVec const& sample_den_coeff,
+       double * sample, double * line);
+
     // Access to constants
     vw::cartography::Datum const& datum   () const { return m_datum;               }
     CoeffVec    const& line_num_coeff     () const { return m_line_num_coeff;      }
@@ -121,7 +140,8 @@ namespace asp {
 
     /// Given a pixel (the projection of a point in 3D space onto the camera image)
     /// and the value of the height of the point, find the lonlat of the point 
-    /// using Newton's method. The user may provide a guess for the lonlat.
+    /// using Newton's method. The user may provide a guess for the lonlat,
+    /// otherwise the approximate inverse of the RPC model is used.
     vw::Vector2 image_to_ground(vw::Vector2 const& pixel, double height,
                                 vw::Vector2 lonlat_guess = vw::Vector2(0.0, 0.0)) const;
 
@@ -129,6 +149,10 @@ namespace asp {
     /// and the direction of the ray going through that point.
     void point_and_dir(vw::Vector2 const& pix, vw::Vector3 & P, vw::Vector3 & dir ) const;
 
+    /// A quick estimate of the lonlat of the point at the given height
+    /// which projects into the given pixel, from the approximate inverse.
+    vw::Vector2 approx_image_to_ground(vw::Vector2 const& pixel, double height) const;
+
   private:
     vw::cartography::Datum m_datum;
 
@@ -140,7 +164,20 @@ namespace asp {
     vw::Vector3 m_lonlatheight_offset;
     vw::Vector3 m_lonlatheight_scale;
 
+    // The approximate inverse. At each of a few heights, the normalized
+    // lonlat is fit as a quadratic polynomial in the normalized pixel.
+    // Between these heights the fits are interpolated linearly.
+    static const int NUM_INVERSE_LAYERS = 3;
+    bool m_has_inverse;
+    vw::Matrix<double, 6, 2> m_inverse_coeffs[NUM_INVERSE_LAYERS];
+
+    // Identifies the current coefficients, for caching rays
+    long m_id;
+
     void initialize( vw::DiskImageResourceGDAL* resource );
+
+    /// Must be called each time the coefficients change.
+    void initialize_inverse();
   };
 
   std::ostream& operator<<(std::ostream& os, const RPCModel& rpc);
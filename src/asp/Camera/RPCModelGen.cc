@@ -19,6 +19,7 @@
 #include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/Geometry.h>
+#include <vw/Math/LinearAlgebra.h>
 
 using namespace vw;
 
@@ -70,6 +71,56 @@ namespace asp {
     return;
   }
 
+  RpcSolveLMA::domain_type RpcSolveLMA::linear_solution() const {
+
+    int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order();
+
+    // Per coordinate, the unknowns are the 20 numerator coefficients
+    // followed by the 19 variable denominator ones, as in packCoeffs().
+    const int NUM_VARS = 39;
+    domain_type C(RPCModel::NUM_RPC_COEFFS);
+    for (int coord = 0; coord < RPCModel::IMAGE_COORD_SIZE; coord++) {
+
+      // Accumulate the normal equations
+      Matrix<double> N(NUM_VARS, NUM_VARS);
+      Vector<double> rhs(NUM_VARS);
+      std::fill(N.data(), N.data() + NUM_VARS*NUM_VARS, 0.0);
+      for (int k = 0; k < NUM_VARS; k++)
+        rhs[k] = 0.0;
+      double row[NUM_VARS];
+      for (int i = 0; i < numPts; i++) {
+        double p = m_normalizedPixels[RPCModel::IMAGE_COORD_SIZE*i + coord];
+        for (int k = 0; k < 20; k++)
+          row[k] = m_terms[k*numPts + i];
+        for (int k = 1; k < 20; k++)
+          row[19 + k] = -p*row[k];
+        for (int a = 0; a < NUM_VARS; a++) {
+          rhs[a] += row[a]*p;
+          for (int b = a; b < NUM_VARS; b++)
+            N(a, b) += row[a]*row[b];
+        }
+      }
+      for (int a = 0; a < NUM_VARS; a++)
+        for (int b = 0; b < a; b++)
+          N(a, b) = N(b, a);
+
+      // The penalty terms on the higher degree coefficients
+      for (int k = 4; k < 20; k++) {
+        double w = m_wt*(coeff_order[k]-1);
+        N(k,      k     ) += w*w;
+        N(19 + k, 19 + k) += w*w;
+      }
+
+      // The line coefficients come first
+      Vector<double> x = vw::math::least_squares(N, rhs);
+      int start = (coord == 1) ? 0 : NUM_VARS;
+      subvector(C, start, NUM_VARS) = x;
+    }
+
+    return C;
+  }
+
   /// Print out a name followed by the vector of values
   void print_vec(std::string const& name, Vector<double> const& vals){
     std::cout.precision(16);
@@ -241,6 +292,18 @@ namespace asp {
 
     VW_OUT(DebugMessage, "asp") << "Initial guess for RPC coeffs: " << startGuess << std::endl;
     
+    // The solution of the linearized problem is normally much closer.
+    // Use it unless it is worse, such as when a denominator is near zero.
+    try {
+      Vector<double> linearGuess = lma_model.linear_solution();
+      double linear_error = norm_2(lma_model.difference(lma_model(linearGuess), normalized_pixels));
+      double affine_error = norm_2(lma_model.difference(lma_model(startGuess),  normalized_pixels));
+      if (linear_error == linear_error && linear_error < affine_error)
+        startGuess = linearGuess;
+    } catch (...) {
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: The linear solve failed.\n";
+    }
+
     // Use the L-M solver to optimize the RPC model coefficient values.
     int status = find_solution_from_seed(lma_model, startGuess, normalized_pixels,
                                          solution, norm_error);
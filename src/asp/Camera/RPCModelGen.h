@@ -23,6 +23,9 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/LevenbergMarquardt.h>
 
+#include <algorithm>
+#include <vector>
+
 namespace asp {
 
   /// Unpack the 78 RPC coefficients from one long vector into four seperate vectors.
@@ -45,6 +48,10 @@ namespace asp {
     vw::Vector<double> m_normalizedGeodetics, 
                        m_normalizedPixels; ///< Also contains the extra penalty terms
     double             m_wt; ///< The penalty weight, k in the reference paper.
+
+    /// The 20 RPC terms of each geodetic, which do not change while solving.
+    /// Term k of point i is at k*numPts + i, so each term is contiguous.
+    std::vector<double> m_terms;
     
   public:
    
@@ -62,7 +69,18 @@ namespace asp {
                  ) :
       m_normalizedGeodetics(normalizedGeodetics),
       m_normalizedPixels(normalizedPixels),
-      m_wt(penaltyWeight){}
+      m_wt(penaltyWeight){
+
+      int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+      m_terms.resize(20*numPts);
+      for (int i = 0; i < numPts; i++){
+        vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i,
+                                  RPCModel::GEODETIC_COORD_SIZE);
+        RPCModel::CoeffVec terms = RPCModel::calculate_terms(G);
+        for (int k = 0; k < 20; k++)
+          m_terms[k*numPts + i] = terms[k];
+      }
+    }
 
     /// Given a set of RPC coefficients, compute the projected pixels.
     inline result_type operator()( domain_type const& C ) const {
@@ -83,17 +101,15 @@ namespace asp {
       result_type result;
       result.set_size(m_normalizedPixels.size());
       
-      // Loop through each test point
-      for (int i = 0; i < numPts; i++){
-        // Unpack the normalized Geodetic coordinate
-        vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i, RPCModel::GEODETIC_COORD_SIZE);
-        
-        // Project the normalized geodetic coordinate into the RPC camera to get a normalized pixel
-        vw::Vector2 pxn = RPCModel::normalized_geodetic_to_normalized_pixel(G, lineNum, lineDen, sampNum, sampDen);
-             
-        // Pack the normalized pixel into the output result vector
-        subvector(result, RPCModel::IMAGE_COORD_SIZE*i, RPCModel::IMAGE_COORD_SIZE) = pxn;
+      // Project the normalized geodetics into the RPC camera to get
+      // normalized pixels.
+      std::vector<double> ln, ld, sn, sd;
+      eval_polynomials(lineNum, lineDen, sampNum, sampDen, ln, ld, sn, sd);
 
+      // Pack the normalized pixels into the output result vector
+      for (int i = 0; i < numPts; i++){
+        result[RPCModel::IMAGE_COORD_SIZE*i    ] = sn[i]/sd[i];
+        result[RPCModel::IMAGE_COORD_SIZE*i + 1] = ln[i]/ld[i];
       }
 
       // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
@@ -115,6 +131,77 @@ namespace asp {
       return result;
     }
 
+    /// The Jacobian of operator(). A sample depends only on the sample
+    /// coefficients and a line only on the line ones, and the penalty
+    /// terms are linear, so this is found directly rather than with
+    /// numerical differentiation, which takes 78 projections.
+    inline jacobian_type jacobian( domain_type const& C ) const {
+
+      RPCModel::CoeffVec lineNum, lineDen, sampNum, sampDen;
+      unpackCoeffs(C, lineNum, lineDen, sampNum, sampDen);
+
+      int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+      std::vector<double> ln, ld, sn, sd;
+      eval_polynomials(lineNum, lineDen, sampNum, sampDen, ln, ld, sn, sd);
+
+      // The layout of the coefficients, as in packCoeffs()
+      const int LINE_NUM = 0, LINE_DEN = 19, SAMP_NUM = 39, SAMP_DEN = 58;
+
+      jacobian_type J(m_normalizedPixels.size(), C.size());
+      std::fill(J.data(), J.data() + J.rows()*J.cols(), 0.0);
+      for (int k = 0; k < 20; k++){
+        double const* T = &m_terms[0] + k*numPts;
+        for (int i = 0; i < numPts; i++){
+          int s_row = RPCModel::IMAGE_COORD_SIZE*i, l_row = s_row + 1;
+          J(s_row, SAMP_NUM + k) = T[i]/sd[i];
+          J(l_row, LINE_NUM + k) = T[i]/ld[i];
+          if (k > 0){ // The constant terms of the denominators are fixed
+            J(s_row, SAMP_DEN + k) = -sn[i]*T[i]/(sd[i]*sd[i]);
+            J(l_row, LINE_DEN + k) = -ln[i]*T[i]/(ld[i]*ld[i]);
+          }
+        }
+      }
+
+      // The penalty terms, in the order of operator()
+      int count = RPCModel::IMAGE_COORD_SIZE*numPts;
+      vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order();
+      for (int i = 4; i < 20; i++) J(count++, LINE_NUM + i) = m_wt*(coeff_order[i]-1);
+      for (int i = 4; i < 20; i++) J(count++, LINE_DEN + i) = m_wt*(coeff_order[i]-1);
+      for (int i = 4; i < 20; i++) J(count++, SAMP_NUM + i) = m_wt*(coeff_order[i]-1);
+      for (int i = 4; i < 20; i++) J(count++, SAMP_DEN + i) = m_wt*(coeff_order[i]-1);
+
+      return J;
+    }
+
+    /// Find the coefficients by solving the linearized problem, with
+    /// each pixel p = N/D written as N - p*(D-1) = p. The sample and
+    /// line coefficients are independent, so these are two small
+    /// linear least squares problems. This is a good starting point for
+    /// the nonlinear solver.
+    domain_type linear_solution() const;
+
+  private:
+
+    /// Evaluate the RPC polynomials at all the points. This is called
+    /// many times while solving, so use the precomputed terms,
+    /// accumulating one term at a time over all points.
+    void eval_polynomials(RPCModel::CoeffVec const& lineNum, RPCModel::CoeffVec const& lineDen,
+                          RPCModel::CoeffVec const& sampNum, RPCModel::CoeffVec const& sampDen,
+                          std::vector<double> & ln, std::vector<double> & ld,
+                          std::vector<double> & sn, std::vector<double> & sd) const {
+      int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+      ln.assign(numPts, 0.0); ld.assign(numPts, 0.0);
+      sn.assign(numPts, 0.0); sd.assign(numPts, 0.0);
+      for (int k = 0; k < 20; k++){
+        double const* T = &m_terms[0] + k*numPts;
+        double lnk = lineNum[k], ldk = lineDen[k], snk = sampNum[k], sdk = sampDen[k];
+        for (int i = 0; i < numPts; i++){
+          ln[i] += lnk*T[i]; ld[i] += ldk*T[i];
+          sn[i] += snk*T[i]; sd[i] += sdk*T[i];
+        }
+      }
+    }
+
   };
 
   /// Print out a name followed by the vector of values
@@ -59,12 +59,60 @@ namespace asp {
     };
   }
 
+  void RPCStereoModel::load_rpc_cameras() {
+    m_rpc_cams.clear();
+    for (size_t p = 0; p < m_cameras.size(); p++) {
+      // Get the RPC pointer so we can call RPC specific functions on it
+      const RPCModel *rpc_cam
+        = dynamic_cast<const RPCModel*>(vw::camera::unadjusted_model(m_cameras[p]));
+      VW_ASSERT(rpc_cam != NULL,
+                vw::ArgumentErr() << "Camera models are not RPC.\n");
+      m_rpc_cams.push_back(rpc_cam);
+    }
+  }
+
   Vector3 RPCStereoModel::operator()(vector<Vector2> const& pixVec,
                                      Vector3& errorVec) const {
+    vector<Vector3> camDirs, camCtrs;
+    camDirs.reserve(m_rpc_cams.size());
+    camCtrs.reserve(m_rpc_cams.size());
+    return triangulate_pixel(pixVec, camDirs, camCtrs, errorVec);
+  }
+
+  void RPCStereoModel::operator()(vector< vector<Vector2> > const& pixels,
+                                  vector<Vector3> & points,
+                                  vector<Vector3> & errors) const {
+
+    int num_cams = m_rpc_cams.size();
+    VW_ASSERT((int)pixels.size() == num_cams,
+              vw::ArgumentErr() << "the number of pixel arrays must match "
+                                << "the number of cameras.\n");
+
+    size_t num_points = pixels.empty() ? 0 : pixels[0].size();
+    points.resize(num_points);
+    errors.resize(num_points);
+
+    // Scratch buffers, allocated once for the whole batch
+    vector<Vector2> pixVec(num_cams);
+    vector<Vector3> camDirs, camCtrs;
+    camDirs.reserve(num_cams);
+    camCtrs.reserve(num_cams);
+
+    for (size_t k = 0; k < num_points; k++) {
+      for (int c = 0; c < num_cams; c++)
+        pixVec[c] = pixels[c][k];
+      points[k] = triangulate_pixel(pixVec, camDirs, camCtrs, errors[k]);
+    }
+  }
+
+  Vector3 RPCStereoModel::triangulate_pixel(vector<Vector2> const& pixVec,
+                                            vector<Vector3> & camDirs,
+                                            vector<Vector3> & camCtrs,
+                                            Vector3 & errorVec) const {
 
     // Note: This is a re-implementation of StereoModel::operator().
 
-    int num_cams = m_cameras.size();
+    int num_cams = m_rpc_cams.size();
     VW_ASSERT((int)pixVec.size() == num_cams,
               vw::ArgumentErr() << "the number of rays must match "
                                 << "the number of cameras.\n");
@@ -72,29 +120,20 @@ namespace asp {
     errorVec = Vector3();
 
     try {
-      vector<Vector3> camDirs(num_cams), 
-                      camCtrs(num_cams);
-      vector<const RPCModel*> rpc_cams(num_cams);
+      // Clearing keeps the capacity, so there is no allocation here
       camDirs.clear(); 
       camCtrs.clear(); 
-      rpc_cams.clear();
 
       // Pick the valid rays
       for (int p = 0; p < num_cams; p++){
 
-        // Get the RPC pointer so we can call RPC specific functions on it
-        const RPCModel *rpc_cam = dynamic_cast<const RPCModel*>(vw::camera::unadjusted_model(m_cameras[p]));
-        VW_ASSERT(rpc_cam != NULL,
-                  vw::ArgumentErr() << "Camera models are not RPC.\n");
-        rpc_cams.push_back(rpc_cam);
-
         Vector2 pix = pixVec[p];
         if (pix != pix || // i.e., NaN
             pix == camera::CameraModel::invalid_pixel() ) continue;
 
         // The base class function would call point_and_dir twice, but we only need to call it once!
         Vector3 ctr, dir;
-        rpc_cam->point_and_dir(pix, ctr, dir);
+        m_rpc_cams[p]->point_and_dir(pix, ctr, dir);
         camDirs.push_back(dir);
         camCtrs.push_back(ctr);
       }
@@ -118,18 +157,18 @@ namespace asp {
           vw::vw_throw(vw::NoImplErr() << "Least squares refinement is not "
                        << "implemented for multi-view stereo.");
 
-        detail::RPCTriangulateLMA model(rpc_cams[0], rpc_cams[1]);
+        detail::RPCTriangulateLMA model(m_rpc_cams[0], m_rpc_cams[1]);
         Vector4 objective(pixVec[0][0], pixVec[0][1], pixVec[1][0], pixVec[1][1]);
         int status = 0;
 
-        Vector3 initialGeodetic = rpc_cams[0]->datum().cartesian_to_geodetic(result);
+        Vector3 initialGeodetic = m_rpc_cams[0]->datum().cartesian_to_geodetic(result);
 
         // To do: Find good values for the numbers controlling the convergence
         Vector3 finalGeodetic = levenberg_marquardt( model, initialGeodetic,
                                                      objective, status, 1e-3, 1e-6, 10 );
 
         if ( status > 0 )
-          result = rpc_cams[0]->datum().geodetic_to_cartesian(finalGeodetic);
+          result = m_rpc_cams[0]->datum().geodetic_to_cartesian(finalGeodetic);
       } // End least squares case
 
 
@@ -32,6 +32,8 @@ namespace vw {
 
 namespace asp {
 
+  class RPCModel; // forward declaration
+
   /// Derived StereoModel class implementing the RPC camera model.
   /// - Using a seperate class allows us to get a speed improvement in ray generation.
   class RPCStereoModel: public vw::stereo::StereoModel {
@@ -44,13 +46,17 @@ namespace asp {
     RPCStereoModel(std::vector<const vw::camera::CameraModel *> const& cameras,
                    bool least_squares_refine = false,
                    double angle_tol = 0.0):
-      vw::stereo::StereoModel(cameras, least_squares_refine, angle_tol){}
+      vw::stereo::StereoModel(cameras, least_squares_refine, angle_tol){
+      load_rpc_cameras();
+    }
       
     RPCStereoModel(vw::camera::CameraModel const* camera_model1,
                    vw::camera::CameraModel const* camera_model2,
                    bool least_squares_refine = false,
                    double angle_tol = 0.0):
-      vw::stereo::StereoModel(camera_model1, camera_model2, least_squares_refine, angle_tol){}
+      vw::stereo::StereoModel(camera_model1, camera_model2, least_squares_refine, angle_tol){
+      load_rpc_cameras();
+    }
     
     virtual ~RPCStereoModel() {}
     
@@ -64,6 +70,26 @@ namespace asp {
     virtual vw::Vector3 operator()(vw::Vector2 const& pix1,
                                    vw::Vector2 const& pix2,
                                    double& error) const;
+
+    /// Triangulate a batch of points. Element k of pixels[c] is the pixel
+    /// in camera c observing the k-th point. The outputs are resized to
+    /// the number of points. No memory is allocated per point.
+    void operator()(std::vector< std::vector<vw::Vector2> > const& pixels,
+                    std::vector<vw::Vector3> & points,
+                    std::vector<vw::Vector3> & errors) const;
+
+  private:
+
+    /// Cast the cameras to RPC once rather than for each pixel.
+    void load_rpc_cameras();
+
+    /// Triangulate one point, using the given scratch buffers for the rays.
+    vw::Vector3 triangulate_pixel(std::vector<vw::Vector2> const& pixVec,
+                                  std::vector<vw::Vector3> & camDirs,
+                                  std::vector<vw::Vector3> & camCtrs,
+                                  vw::Vector3 & errorVec) const;
+
+    std::vector<const RPCModel*> m_rpc_cams;
   };
   
 } // namespace asp
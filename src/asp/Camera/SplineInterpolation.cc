@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/SplineInterpolation.h>
+#include <vw/Core/Exception.h>
+
+using namespace vw;
+
+namespace {
+
+  // The coefficients in u in [0, 1] of the cubic with values p0, p1
+  // and derivatives m0, m1 at the ends.
+  inline void hermite_coeffs(double p0, double p1, double m0, double m1, double * c) {
+    c[0] = p0;
+    c[1] = m0;
+    c[2] = 3.0*(p1 - p0) - 2.0*m0 - m1;
+    c[3] = 2.0*(p0 - p1) + m0 + m1;
+  }
+}
+
+namespace asp {
+
+HermitePositionInterpolation::HermitePositionInterpolation
+(std::vector<Vector3> const& positions, std::vector<Vector3> const& velocities,
+ double t0, double dt): m_t0(t0), m_dt(dt) {
+
+  if (positions.size() < 2 || positions.size() != velocities.size() || dt <= 0)
+    vw_throw(ArgumentErr() << "Spline interpolation needs at least two positions, "
+             << "as many velocities, and a positive time interval.\n");
+
+  m_inv_dt        = 1.0/dt;
+  m_num_intervals = positions.size() - 1;
+  m_coeffs.resize(12*m_num_intervals);
+  for (int i = 0; i < m_num_intervals; i++) {
+    for (int c = 0; c < 3; c++)
+      hermite_coeffs(positions[i][c], positions[i+1][c],
+                     dt*velocities[i][c], dt*velocities[i+1][c], &m_coeffs[12*i + 4*c]);
+  }
+}
+
+HermitePoseInterpolation::HermitePoseInterpolation
+(std::vector<Quat> const& poses, double t0, double dt): m_t0(t0), m_dt(dt) {
+
+  if (poses.size() < 2 || dt <= 0)
+    vw_throw(ArgumentErr() << "Spline interpolation needs at least two poses "
+             << "and a positive time interval.\n");
+
+  // A quaternion and its negative are the same rotation. Pick the signs
+  // so that consecutive samples are close.
+  int num = poses.size();
+  std::vector<Vector4> q(num);
+  for (int i = 0; i < num; i++) {
+    for (int c = 0; c < 4; c++)
+      q[i][c] = poses[i][c];
+    if (i > 0 && dot_prod(q[i], q[i-1]) < 0)
+      q[i] = -q[i];
+  }
+
+  // Central differences for the tangents, one-sided at the ends
+  std::vector<Vector4> m(num);
+  m[0] = q[1] - q[0];
+  m[num-1] = q[num-1] - q[num-2];
+  for (int i = 1; i < num-1; i++)
+    m[i] = 0.5*(q[i+1] - q[i-1]);
+
+  m_inv_dt        = 1.0/dt;
+  m_num_intervals = num - 1;
+  m_coeffs.resize(16*m_num_intervals);
+  for (int i = 0; i < m_num_intervals; i++) {
+    for (int c = 0; c < 4; c++)
+      hermite_coeffs(q[i][c], q[i+1][c], m[i][c], m[i+1][c], &m_coeffs[16*i + 4*c]);
+  }
+}
+
+} // end namespace asp
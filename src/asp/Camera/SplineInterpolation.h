@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SplineInterpolation.h
+///
+/// Cubic spline interpolation of camera positions and poses sampled at
+/// uniform times. The polynomial coefficients on each interval are
+/// precomputed, so an evaluation finds its interval by a division and
+/// runs a short fixed sequence of multiply-adds. Times outside the
+/// samples are extrapolated with the polynomial of the nearest interval.
+
+#ifndef __ASP_CAMERA_SPLINE_INTERPOLATION_H__
+#define __ASP_CAMERA_SPLINE_INTERPOLATION_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+  /// Cubic Hermite interpolation of positions, using the velocities
+  /// at the samples as derivatives. The result is continuous with
+  /// continuous velocity.
+  class HermitePositionInterpolation {
+  public:
+    HermitePositionInterpolation(): m_t0(0), m_dt(1), m_inv_dt(1), m_num_intervals(0) {}
+    HermitePositionInterpolation(std::vector<vw::Vector3> const& positions,
+                                 std::vector<vw::Vector3> const& velocities,
+                                 double t0, double dt);
+
+    vw::Vector3 operator()(double t) const {
+      double s = (t - m_t0) * m_inv_dt;
+      int i = std::min(std::max(int(std::floor(s)), 0), m_num_intervals - 1);
+      double u = s - i;
+      double const* c = &m_coeffs[12*i];
+      return vw::Vector3(c[0] + u*(c[1] + u*(c[2]  + u*c[3])),
+                         c[4] + u*(c[5] + u*(c[6]  + u*c[7])),
+                         c[8] + u*(c[9] + u*(c[10] + u*c[11])));
+    }
+
+    double get_t0  () const { return m_t0; }
+    double get_dt  () const { return m_dt; }
+    double get_tend() const { return m_t0 + m_dt * m_num_intervals; }
+
+  private:
+    double m_t0, m_dt, m_inv_dt;
+    int m_num_intervals;
+    std::vector<double> m_coeffs; // For each interval and coordinate, 4 coefficients in u
+  };
+
+  /// Interpolation of rotations by a cubic Hermite spline through the
+  /// quaternion components, with central-difference tangents, followed
+  /// by normalization. The rotation varies smoothly through the
+  /// samples, unlike with SLERP, which at a sample has a kink.
+  class HermitePoseInterpolation {
+  public:
+    HermitePoseInterpolation(): m_t0(0), m_dt(1), m_inv_dt(1), m_num_intervals(0) {}
+    HermitePoseInterpolation(std::vector<vw::Quat> const& poses, double t0, double dt);
+
+    vw::Quat operator()(double t) const {
+      double s = (t - m_t0) * m_inv_dt;
+      int i = std::min(std::max(int(std::floor(s)), 0), m_num_intervals - 1);
+      double u = s - i;
+      double const* c = &m_coeffs[16*i];
+      vw::Quat q(c[0]  + u*(c[1]  + u*(c[2]  + u*c[3])),
+                 c[4]  + u*(c[5]  + u*(c[6]  + u*c[7])),
+                 c[8]  + u*(c[9]  + u*(c[10] + u*c[11])),
+                 c[12] + u*(c[13] + u*(c[14] + u*c[15])));
+      return normalize(q);
+    }
+
+    double get_t0  () const { return m_t0; }
+    double get_dt  () const { return m_dt; }
+    double get_tend() const { return m_t0 + m_dt * m_num_intervals; }
+
+  private:
+    double m_t0, m_dt, m_inv_dt;
+    int m_num_intervals;
+    std::vector<double> m_coeffs; // For each interval and component, 4 coefficients in u
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_SPLINE_INTERPOLATION_H__
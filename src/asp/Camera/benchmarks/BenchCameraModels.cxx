@@ -0,0 +1,124 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Projection of ground points into the cameras, and of pixels to rays,
+// for the DG and RPC models made from the test XML files, and for a
+// pinhole camera.
+
+#include <test/Benchmark.h>
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Core/StereoSettings.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Cartography/Datum.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <xercesc/util/PlatformUtils.hpp>
+
+#include <vector>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  const int NUM_POINTS = 1000;
+
+  // Pixels spread over the image
+  std::vector<Vector2> sample_pixels(Vector2 const& image_size) {
+    std::vector<Vector2> pixels;
+    for (int it = 0; it < NUM_POINTS; it++)
+      pixels.push_back(elem_prod(image_size, Vector2(double(std::rand())/RAND_MAX,
+                                                     double(std::rand())/RAND_MAX)));
+    return pixels;
+  }
+
+  // The points seen at these pixels on the WGS84 datum
+  std::vector<Vector3> ground_points(camera::CameraModel const* cam,
+                                     std::vector<Vector2> const& pixels) {
+    cartography::Datum datum("WGS84");
+    std::vector<Vector3> points;
+    for (size_t it = 0; it < pixels.size(); it++)
+      points.push_back(cartography::datum_intersection(datum, cam->camera_center(pixels[it]),
+                                                       cam->pixel_to_vector(pixels[it])));
+    return points;
+  }
+
+  boost::shared_ptr<camera::CameraModel> dg_camera() {
+    xercesc::XMLPlatformUtils::Initialize();
+    stereo_settings().disable_correct_velocity_aberration    = true;
+    stereo_settings().disable_correct_atmospheric_refraction = true;
+    return load_dg_camera_model_from_xml("dg_example1.xml");
+  }
+
+  boost::shared_ptr<camera::CameraModel> rpc_camera() {
+    xercesc::XMLPlatformUtils::Initialize();
+    RPCXML rpc_xml;
+    rpc_xml.read_from_file("dg_example1.xml");
+    return boost::shared_ptr<camera::CameraModel>(new RPCModel(*rpc_xml.rpc_ptr()));
+  }
+
+  // A camera 700 km above the equator, looking down
+  boost::shared_ptr<camera::CameraModel> pinhole_camera() {
+    Vector3 center(6378137.0 + 700000.0, 0, 0);
+    Matrix3x3 rotation;
+    rotation(0, 2) = -1; rotation(1, 0) = 1; rotation(2, 1) = -1;
+    return boost::shared_ptr<camera::CameraModel>
+      (new camera::PinholeModel(center, rotation, 10000, 10000, 5000, 5000));
+  }
+
+  void bench_point_to_pixel(bench::State & state,
+                            boost::shared_ptr<camera::CameraModel> cam) {
+    std::vector<Vector3> points = ground_points(cam.get(), sample_pixels(Vector2(10000, 10000)));
+    size_t it = 0;
+    while (state.keep_running()) {
+      bench::do_not_optimize(cam->point_to_pixel(points[it]));
+      it = (it + 1) % points.size();
+    }
+  }
+
+  void bench_pixel_to_vector(bench::State & state,
+                             boost::shared_ptr<camera::CameraModel> cam) {
+    std::vector<Vector2> pixels = sample_pixels(Vector2(10000, 10000));
+    size_t it = 0;
+    while (state.keep_running()) {
+      bench::do_not_optimize(cam->pixel_to_vector(pixels[it]));
+      it = (it + 1) % pixels.size();
+    }
+  }
+}
+
+BENCHMARK(DGCameraModel, point_to_pixel) {
+  bench_point_to_pixel(state, dg_camera());
+}
+
+BENCHMARK(DGCameraModel, pixel_to_vector) {
+  bench_pixel_to_vector(state, dg_camera());
+}
+
+BENCHMARK(RPCModel, point_to_pixel) {
+  bench_point_to_pixel(state, rpc_camera());
+}
+
+BENCHMARK(RPCModel, pixel_to_vector) {
+  bench_pixel_to_vector(state, rpc_camera());
+}
+
+BENCHMARK(PinholeModel, point_to_pixel) {
+  bench_point_to_pixel(state, pinhole_camera());
+}
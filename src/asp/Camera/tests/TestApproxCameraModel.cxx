@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Camera/ApproxCameraModel.h>
+#include <vw/Camera/PinholeModel.h>
+
+#include <cstdio>
+
+using namespace vw;
+using namespace vw::camera;
+using namespace vw::cartography;
+using namespace asp;
+
+namespace {
+
+  // A camera 700 km above lon = lat = 0, looking down
+  boost::shared_ptr<CameraModel> nadir_camera(Datum const& datum) {
+    Vector3 ctr(datum.semi_major_axis() + 700000.0, 0, 0);
+    Matrix3x3 rotation(0,  0, -1,
+                       1,  0,  0,
+                       0, -1,  0);
+    return boost::shared_ptr<CameraModel>
+      (new PinholeModel(ctr, rotation, 10000, 10000, 500, 500));
+  }
+}
+
+TEST(ApproxCameraModel, matches_exact) {
+
+  GeoReference georef;
+  georef.set_well_known_geogcs("WGS84");
+  boost::shared_ptr<CameraModel> exact = nadir_camera(georef.datum());
+
+  double max_error = 0.01;
+  ApproxCameraModel approx(exact, BBox2i(0, 0, 1000, 1000), georef,
+                           BBox2(-0.2, -0.2, 0.4, 0.4), Vector2(0, 1000), max_error);
+  EXPECT_TRUE(approx.has_ground_table());
+  EXPECT_LT(approx.sensor_error(), max_error);
+  EXPECT_LT(approx.ground_error(), max_error);
+
+  for (int it = 0; it < 10; it++) {
+    Vector2 pix(37.3 + 91.1*it, 912.6 - 87.7*it);
+    Vector3 ctr = approx.camera_center(pix), dir = approx.pixel_to_vector(pix);
+    EXPECT_VECTOR_NEAR(exact->camera_center(pix), ctr, 1e-3);
+    EXPECT_NEAR(0.0, norm_2(exact->pixel_to_vector(pix) - dir), 1e-6);
+
+    Vector3 llh(-0.15 + 0.03*it, 0.17 - 0.035*it, 100.0*it);
+    Vector3 xyz = georef.datum().geodetic_to_cartesian(llh);
+    EXPECT_VECTOR_NEAR(exact->point_to_pixel(xyz), approx.point_to_pixel(xyz), 2*max_error);
+  }
+
+  // Outside the tables the exact camera is used
+  Vector3 xyz = georef.datum().geodetic_to_cartesian(Vector3(0.01, 0.01, 5000.0));
+  EXPECT_VECTOR_NEAR(exact->point_to_pixel(xyz), approx.point_to_pixel(xyz), 1e-8);
+}
+
+TEST(ApproxCameraModel, write_and_read) {
+
+  GeoReference georef;
+  georef.set_well_known_geogcs("WGS84");
+  boost::shared_ptr<CameraModel> exact = nadir_camera(georef.datum());
+
+  ApproxCameraModel approx(exact, BBox2i(0, 0, 1000, 1000), georef,
+                           BBox2(-0.2, -0.2, 0.4, 0.4), Vector2(0, 1000), 0.01);
+  std::string file = "approx_camera_table.bin";
+  approx.write(file);
+  ApproxCameraModel loaded(exact, file);
+  std::remove(file.c_str());
+
+  EXPECT_TRUE(loaded.has_ground_table());
+  Vector2 pix(123.4, 567.8);
+  EXPECT_VECTOR_NEAR(approx.camera_center(pix),   loaded.camera_center(pix),   1e-8);
+  EXPECT_VECTOR_NEAR(approx.pixel_to_vector(pix), loaded.pixel_to_vector(pix), 1e-12);
+  Vector3 xyz = georef.datum().geodetic_to_cartesian(Vector3(0.05, -0.07, 300.0));
+  EXPECT_VECTOR_NEAR(approx.point_to_pixel(xyz),  loaded.point_to_pixel(xyz),  1e-8);
+}
@@ -20,7 +20,10 @@
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/XMLBase.h>
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/CameraCache.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include <cstdio>
 #include <test/Helpers.h>
 
 #include <vw/Stereo/StereoModel.h>
@@ -31,6 +34,7 @@ using namespace vw;
 using namespace asp;
 using namespace xercesc;
 using namespace vw::test;
+namespace fs = boost::filesystem;
 
 TEST(StereoSessionDG, XMLReading) {
   XMLPlatformUtils::Initialize();
@@ -158,3 +162,75 @@ TEST(DGCameraModel, CreateCamera) {
   XMLPlatformUtils::Terminate();
 }
 
+TEST(DGCameraModel, CameraCache) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  // The first load writes the cache, the second one reads it
+  std::remove("dg_example1.xml.dg.cache");
+  boost::shared_ptr<DGCameraModel> cam1 = load_dg_camera_model_from_xml("dg_example1.xml");
+  DGCameraData data;
+  EXPECT_TRUE( read_camera_cache("dg_example1.xml", data) );
+  boost::shared_ptr<DGCameraModel> cam2 = load_dg_camera_model_from_xml("dg_example1.xml");
+  std::remove("dg_example1.xml.dg.cache");
+
+  for ( size_t i = 0; i < 30000; i += 5000 ) {
+    for ( size_t j = 0; j < 24000; j += 4000 ) {
+      Vector2 pix(i, j);
+      EXPECT_VECTOR_NEAR( cam1->camera_center(pix),   cam2->camera_center(pix),   1e-8 );
+      EXPECT_VECTOR_NEAR( cam1->pixel_to_vector(pix), cam2->pixel_to_vector(pix), 1e-12 );
+    }
+  }
+
+  XMLPlatformUtils::Terminate();
+}
+
+TEST(DGCameraModel, FootprintCache) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  boost::shared_ptr<DGCameraModel> cam = load_dg_camera_model_from_xml("dg_example1.xml");
+  std::string key = "test " + file_fingerprint("dg_example1.xml") + " "
+    + camera_fingerprint(cam.get(), Vector2i(35180, 24000));
+
+  BBox2 box(-105.1, 39.2, 0.3, 0.2), cached_box;
+  float gsd = 0.5, cached_gsd = 0;
+  write_footprint_cache("dg_example1.xml", key, box, gsd);
+  EXPECT_TRUE( read_footprint_cache("dg_example1.xml", key, cached_box, cached_gsd) );
+  EXPECT_VECTOR_NEAR( box.min(), cached_box.min(), 1e-12 );
+  EXPECT_VECTOR_NEAR( box.max(), cached_box.max(), 1e-12 );
+  EXPECT_NEAR( gsd, cached_gsd, 1e-12 );
+
+  // Another camera, DEM, or projection has another key
+  EXPECT_FALSE( read_footprint_cache("dg_example1.xml", key + " other", cached_box, cached_gsd) );
+
+  for (fs::directory_iterator it("."); it != fs::directory_iterator(); it++) {
+    std::string name = it->path().filename().string();
+    if (name.find("dg_example1.xml.footprint-") == 0)
+      fs::remove(it->path());
+  }
+
+  XMLPlatformUtils::Terminate();
+}
+
+TEST(DGCameraModel, SplineInterpolation) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  boost::shared_ptr<DGCameraModel> cam1 = load_dg_camera_model_from_xml("dg_example1.xml");
+  stereo_settings().dg_spline_interpolation = true;
+  boost::shared_ptr<DGCameraModel> cam2 = load_dg_camera_model_from_xml("dg_example1.xml");
+  stereo_settings().dg_spline_interpolation = false;
+  EXPECT_TRUE( cam2->get_position_func().uses_spline() );
+
+  // The two interpolations must agree to a small fraction of a pixel
+  for ( size_t i = 0; i < 30000; i += 5000 ) {
+    for ( size_t j = 0; j < 24000; j += 4000 ) {
+      Vector3 xyz = cam1->camera_center(Vector2(i,j)) + 6e5 * cam1->pixel_to_vector(Vector2(i,j));
+      EXPECT_VECTOR_NEAR( Vector2(i,j), cam2->point_to_pixel(xyz), 1e-1 );
+    }
+  }
+
+  XMLPlatformUtils::Terminate();
+}
+
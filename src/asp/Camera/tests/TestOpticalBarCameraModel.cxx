@@ -115,6 +115,24 @@ TEST(OpticalBarModel, CreateCamera) {
     }
   }
 
+  // The batch functions must agree with the per-pixel ones
+  std::vector<Vector2> pixels, pixels_out;
+  std::vector<Vector3> vectors, points;
+  for ( size_t i = 0; i < 3000; i += 500 ) {
+    for ( size_t j = 0; j < 2400; j += 400 )
+      pixels.push_back(Vector2(i,j));
+  }
+  raw_ptr->pixels_to_vectors(pixels, vectors);
+  ASSERT_EQ(pixels.size(), vectors.size());
+  for (size_t it = 0; it < pixels.size(); it++) {
+    EXPECT_VECTOR_NEAR(cam1->pixel_to_vector(pixels[it]), vectors[it], 1e-14);
+    points.push_back(cam1->camera_center(pixels[it]) + 2e4*vectors[it]);
+  }
+  raw_ptr->points_to_pixels(points, pixels_out);
+  ASSERT_EQ(pixels.size(), pixels_out.size());
+  for (size_t it = 0; it < pixels.size(); it++)
+    EXPECT_VECTOR_NEAR(pixels[it], pixels_out[it], 1e-2);
+
   
   /*
   Vector3   gcc2(-2470746.042265798, 5537165.6573024355, 2515786.8430585163);
@@ -28,6 +28,7 @@
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCStereoModel.h>
 #include <asp/Core/StereoSettings.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -134,6 +135,115 @@ TEST(RPCXML, ReadRPC) {
 
 
 
+TEST(RPCModel, BatchProjection) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel const& rpc = *xml.rpc_ptr();
+
+  // More points than one block, with the last block partial
+  std::vector<Vector3> geodetics, points;
+  for (int it = 0; it < 300; it++) {
+    double t = it/299.0;
+    Vector3 llh = rpc.lonlatheight_offset() +
+      elem_prod(Vector3(t - 0.5, 0.5 - t*t, 2*t - 1), rpc.lonlatheight_scale());
+    geodetics.push_back(llh);
+    points.push_back(rpc.datum().geodetic_to_cartesian(llh));
+  }
+
+  std::vector<Vector2> pixels1, pixels2;
+  rpc.geodetics_to_pixels(geodetics, pixels1);
+  rpc.points_to_pixels(points, pixels2);
+  ASSERT_EQ(geodetics.size(), pixels1.size());
+  ASSERT_EQ(points.size(),    pixels2.size());
+  for (size_t it = 0; it < geodetics.size(); it++) {
+    EXPECT_VECTOR_NEAR(rpc.geodetic_to_pixel(geodetics[it]), pixels1[it], 1e-8);
+    EXPECT_VECTOR_NEAR(rpc.point_to_pixel(points[it]),       pixels2[it], 1e-8);
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST(RPCModel, ApproxInverse) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel const& rpc = *xml.rpc_ptr();
+
+  double height = rpc.lonlatheight_offset()[2] + 0.3*rpc.lonlatheight_scale()[2];
+  for (int it = 0; it < 10; it++) {
+    Vector2 pix = rpc.xy_offset() + elem_prod(Vector2(0.2*it - 0.9, 0.9 - 0.15*it),
+                                              rpc.xy_scale());
+
+    // The approximation is close, and Newton's method makes it exact
+    Vector2 approx = rpc.approx_image_to_ground(pix, height);
+    Vector2 lonlat = rpc.image_to_ground(pix, height);
+    EXPECT_VECTOR_NEAR(lonlat, approx, 1e-3);
+    Vector3 llh(lonlat[0], lonlat[1], height);
+    EXPECT_VECTOR_NEAR(pix, rpc.geodetic_to_pixel(llh), 1e-3);
+
+    // Points on the ray project back into the pixel
+    Vector3 P   = rpc.camera_center(pix);
+    Vector3 dir = rpc.pixel_to_vector(pix);
+    for (int k = 1; k <= 2; k++)
+      EXPECT_VECTOR_NEAR(pix, rpc.point_to_pixel(P + 10000.0*k*dir), 1e-2);
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST(RPCModelGen, LinearSolveAndJacobian) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel const& rpc = *xml.rpc_ptr();
+
+  // Normalized geodetics and pixels, with zero penalty terms
+  int num = 6, numPts = num*num*num;
+  Vector<double> geodetics(RPCModel::GEODETIC_COORD_SIZE*numPts),
+    pixels(RPCModel::IMAGE_COORD_SIZE*numPts + RpcSolveLMA::NUM_PENALTY_TERMS);
+  for (size_t it = 0; it < pixels.size(); it++)
+    pixels[it] = 0.0;
+  int count = 0;
+  for (int i = 0; i < num; i++) {
+    for (int j = 0; j < num; j++) {
+      for (int k = 0; k < num; k++) {
+        Vector3 G(2.0*i/(num-1) - 1, 2.0*j/(num-1) - 1, 2.0*k/(num-1) - 1);
+        double samp = 0, line = 0;
+        RPCModel::normalized_geodetics_to_normalized_pixels
+          (1, &G[0], &G[1], &G[2], rpc.line_num_coeff(), rpc.line_den_coeff(),
+           rpc.sample_num_coeff(), rpc.sample_den_coeff(), &samp, &line);
+        subvector(geodetics, RPCModel::GEODETIC_COORD_SIZE*count, 3) = G;
+        pixels[RPCModel::IMAGE_COORD_SIZE*count    ] = samp;
+        pixels[RPCModel::IMAGE_COORD_SIZE*count + 1] = line;
+        count++;
+      }
+    }
+  }
+
+  // Without penalty the linear solve recovers pixels generated by an RPC model
+  RpcSolveLMA lma_model(geodetics, pixels, 0.0);
+  Vector<double> C = lma_model.linear_solution();
+  Vector<double> projected = lma_model(C);
+  for (int it = 0; it < RPCModel::IMAGE_COORD_SIZE*numPts; it++)
+    EXPECT_NEAR(pixels[it], projected[it], 1e-6);
+
+  // The direct Jacobian agrees with numerical differentiation
+  RpcSolveLMA penalized_model(geodetics, pixels, 0.1);
+  Matrix<double> J1 = penalized_model.jacobian(C);
+  Matrix<double> J2 = penalized_model.LeastSquaresModelBase<RpcSolveLMA>::jacobian(C);
+  ASSERT_EQ(J1.rows(), J2.rows());
+  ASSERT_EQ(J1.cols(), J2.cols());
+  for (size_t r = 0; r < J1.rows(); r++)
+    for (size_t c = 0; c < J1.cols(); c++)
+      EXPECT_NEAR(J2(r, c), J1(r, c), 1e-5);
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
 TEST( RPCStereoModel, mvpMatchTest ) {
   xercesc::XMLPlatformUtils::Initialize();
   test_stereo_models("wv_mvp_1.xml", "wv_mvp_2.xml");
@@ -0,0 +1,67 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Camera/SplineInterpolation.h>
+#include <vw/Math/EulerAngles.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST(SplineInterpolation, Position) {
+
+  // A circular orbit, sampled every second
+  double radius = 7e6, omega = 1e-3, t0 = 10.0, dt = 1.0;
+  std::vector<Vector3> positions, velocities;
+  for (int i = 0; i < 20; i++) {
+    double t = t0 + i*dt;
+    positions.push_back (radius*Vector3(cos(omega*t), sin(omega*t), 0));
+    velocities.push_back(radius*omega*Vector3(-sin(omega*t), cos(omega*t), 0));
+  }
+
+  HermitePositionInterpolation interp(positions, velocities, t0, dt);
+  EXPECT_NEAR(t0 + 19*dt, interp.get_tend(), 1e-12);
+
+  // Exact at the samples, and accurate in between
+  EXPECT_VECTOR_NEAR(positions[3], interp(t0 + 3*dt), 1e-6);
+  for (double t = t0; t < t0 + 19*dt; t += 0.37) {
+    Vector3 exact = radius*Vector3(cos(omega*t), sin(omega*t), 0);
+    EXPECT_VECTOR_NEAR(exact, interp(t), 1e-3);
+  }
+}
+
+TEST(SplineInterpolation, Pose) {
+
+  // A steady rotation about the z axis. Flip the sign of some samples,
+  // which must not matter.
+  double omega = 0.01, t0 = 0.0, dt = 0.5;
+  std::vector<Quat> poses;
+  for (int i = 0; i < 20; i++) {
+    Quat q = math::euler_xyz_to_quaternion(Vector3(0, 0, omega*(t0 + i*dt)));
+    if (i % 3 == 0)
+      q = Quat(-q[0], -q[1], -q[2], -q[3]);
+    poses.push_back(q);
+  }
+
+  HermitePoseInterpolation interp(poses, t0, dt);
+  Vector3 dir(0.6, -0.3, 0.2);
+  for (double t = t0; t < t0 + 19*dt; t += 0.11) {
+    Quat exact = math::euler_xyz_to_quaternion(Vector3(0, 0, omega*t));
+    EXPECT_VECTOR_NEAR(exact.rotate(dir), interp(t).rotate(dir), 1e-8);
+  }
+}
@@ -0,0 +1,112 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/CameraGrid.h>
+
+#include <cstring>
+#include <fstream>
+
+using namespace vw;
+
+namespace {
+
+  const char   MAGIC[8] = {'A', 'S', 'P', 'C', 'A', 'M', 'G', 'R'};
+  const uint32 VERSION  = 1;
+
+} // end anonymous namespace
+
+namespace asp {
+
+std::string camera_grid_file(std::string const& image_file) {
+  return image_file + ".camgrid";
+}
+
+// The header is the magic string, the version, the spacing, the image
+// size, and the number of nodes in each direction, followed by the
+// nodes and the cell errors, row after row, in the byte order of the machine.
+void write_camera_grid(std::string const& file, CameraGrid const& grid) {
+
+  std::ofstream ofs(file.c_str(), std::ios::binary);
+  if (!ofs)
+    vw_throw(IOErr() << "Cannot write: " << file << "\n");
+
+  int32 header[5] = {int32(grid.spacing), int32(grid.image_size[0]), int32(grid.image_size[1]),
+                     int32(grid.nodes.cols()), int32(grid.nodes.rows())};
+  ofs.write(MAGIC, sizeof(MAGIC));
+  ofs.write(reinterpret_cast<char const*>(&VERSION), sizeof(VERSION));
+  ofs.write(reinterpret_cast<char const*>(header),   sizeof(header));
+  for (int row = 0; row < grid.nodes.rows(); row++)
+    for (int col = 0; col < grid.nodes.cols(); col++)
+      ofs.write(reinterpret_cast<char const*>(&grid.nodes(col, row)[0]), 2*sizeof(double));
+  for (int row = 0; row < grid.cell_error.rows(); row++)
+    for (int col = 0; col < grid.cell_error.cols(); col++)
+      ofs.write(reinterpret_cast<char const*>(&grid.cell_error(col, row)), sizeof(float));
+
+  if (!ofs)
+    vw_throw(IOErr() << "Failed writing: " << file << "\n");
+}
+
+bool read_camera_grid(std::string const& file, CameraGrid & grid) {
+
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  char   magic[8];
+  uint32 version = 0;
+  int32  header[5];
+  if (!ifs.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      !ifs.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != VERSION ||
+      !ifs.read(reinterpret_cast<char*>(header), sizeof(header)))
+    return false;
+
+  int spacing = header[0], num_cols = header[3], num_rows = header[4];
+  if (spacing <= 0 || num_cols < 2 || num_rows < 2 ||
+      num_cols != (header[1] + spacing - 1) / spacing + 1 ||
+      num_rows != (header[2] + spacing - 1) / spacing + 1)
+    return false;
+
+  grid.spacing    = spacing;
+  grid.image_size = Vector2i(header[1], header[2]);
+  grid.nodes.set_size(num_cols, num_rows);
+  grid.cell_error.set_size(num_cols - 1, num_rows - 1);
+  for (int row = 0; row < num_rows; row++)
+    for (int col = 0; col < num_cols; col++)
+      ifs.read(reinterpret_cast<char*>(&grid.nodes(col, row)[0]), 2*sizeof(double));
+  for (int row = 0; row < num_rows - 1; row++)
+    for (int col = 0; col < num_cols - 1; col++)
+      ifs.read(reinterpret_cast<char*>(&grid.cell_error(col, row)), sizeof(float));
+
+  return bool(ifs);
+}
+
+Vector2 CameraGridReverseTransform::reverse(Vector2 const& p) const {
+
+  CameraGrid const& g = *m_grid;
+  double sx = p[0] / g.spacing, sy = p[1] / g.spacing;
+  int i = int(std::floor(sx)), j = int(std::floor(sy));
+  if (i < 0 || j < 0 || i >= g.cell_error.cols() || j >= g.cell_error.rows())
+    return m_exact->reverse(p);
+
+  // The comparison fails for NaN, so cells which do not project are done exactly
+  if (!(g.cell_error(i, j) <= m_max_error))
+    return m_exact->reverse(p);
+
+  double u = sx - i, v = sy - j;
+  return (1-v)*((1-u)*g.nodes(i, j)   + u*g.nodes(i+1, j)) +
+            v *((1-u)*g.nodes(i, j+1) + u*g.nodes(i+1, j+1));
+}
+
+} // end namespace asp
@@ -0,0 +1,211 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraGrid.h
+///
+/// The camera pixels of a map-projected image, tabulated by mapproject
+/// on a coarse grid of its pixels, and saved next to it, so that
+/// triangulation from map-projected images can interpolate them rather
+/// than intersect each ray with the DEM again. With each cell of the
+/// grid is saved the error of the interpolation at its center, and the
+/// cells where it is too large, or which do not project into the
+/// camera, are left to the exact transform. The errors are checked
+/// only at cell centers, so features of the DEM much smaller than a
+/// cell may be missed.
+
+#ifndef __ASP_CORE_CAMERA_GRID_H__
+#define __ASP_CORE_CAMERA_GRID_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Transform.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+namespace asp {
+
+  struct CameraGrid {
+    int          spacing;    ///< Pixels of the map-projected image between nodes
+    vw::Vector2i image_size; ///< Size of the map-projected image
+    vw::ImageView<vw::Vector2>  nodes;      ///< Camera pixels of the nodes, NaN where they fail
+    vw::ImageView<float>        cell_error; ///< Interpolation error at the cell centers, or NaN
+    CameraGrid(): spacing(0) {}
+  };
+
+  /// The grid saved for the given map-projected image, as image_file + ".camgrid".
+  std::string camera_grid_file(std::string const& image_file);
+
+  void write_camera_grid(std::string const& file, CameraGrid const& grid);
+
+  /// Returns false if the file is missing or is not valid.
+  bool read_camera_grid(std::string const& file, CameraGrid & grid);
+
+  /// Evaluate the reverse() of the transform, from map-projected to
+  /// camera pixels, at the nodes and cell centers of a grid over an image
+  /// of the given size, whose pixels are offset by the given amount in
+  /// the input of the transform. The rows of cells are found in parallel,
+  /// each with its own copy of the transform, as transforms may cache
+  /// data for the region given to reverse_bbox().
+  template <class TransformT>
+  void make_camera_grid(TransformT const& trans, vw::Vector2i const& offset,
+                        vw::Vector2i const& image_size, int spacing,
+                        vw::Vector2i const& camera_size, CameraGrid & grid);
+
+  /// A transform whose reverse() interpolates a camera grid, in the
+  /// cells where the error is at most max_error, and uses the exact
+  /// transform elsewhere. Other calls go to the exact transform. Like
+  /// the exact transform, it must be copied to be used in other threads.
+  class CameraGridReverseTransform: public vw::Transform {
+  public:
+    typedef boost::shared_ptr<vw::Transform> TransPtr;
+
+    CameraGridReverseTransform(boost::shared_ptr<CameraGrid const> grid, double max_error,
+                         TransPtr const& exact):
+      m_grid(grid), m_max_error(max_error), m_exact(exact) {}
+
+    virtual vw::Vector2 reverse(vw::Vector2 const& p) const;
+
+    virtual vw::Vector2 forward(vw::Vector2 const& p) const {
+      return m_exact->forward(p);
+    }
+    virtual vw::BBox2i reverse_bbox(vw::BBox2i const& bbox) const {
+      return m_exact->reverse_bbox(bbox);
+    }
+    virtual vw::BBox2i forward_bbox(vw::BBox2i const& bbox) const {
+      return m_exact->forward_bbox(bbox);
+    }
+
+    boost::shared_ptr<CameraGrid const> grid() const { return m_grid; }
+    double max_error() const { return m_max_error; }
+    TransPtr const& exact() const { return m_exact; }
+
+  private:
+    boost::shared_ptr<CameraGrid const> m_grid;
+    double   m_max_error;
+    TransPtr m_exact;
+  };
+
+  // ---------------------------------------------------------------------
+  // Implementation
+
+  inline bool is_valid_node(vw::Vector2 const& pix) {
+    return !std::isnan(pix[0]) && !std::isnan(pix[1]);
+  }
+
+  /// Find the nodes in one row of a camera grid, or if find_centers is
+  /// true, the errors of the row of cells below it, once all nodes are known.
+  template <class TransformT>
+  class CameraGridRowTask: public vw::Task, private boost::noncopyable {
+    TransformT        m_trans; // A private copy
+    vw::Vector2i      m_offset, m_camera_size;
+    int               m_row;
+    bool              m_find_centers;
+    CameraGrid      & m_grid;
+
+    bool eval(vw::Vector2 const& p, vw::Vector2 & pix) {
+      try {
+        pix = m_trans.reverse(p + m_offset);
+      } catch(...) {
+        return false;
+      }
+      // Results far outside the image are taken to be failures of the transform
+      return is_valid_node(pix) &&
+        pix[0] > -m_camera_size[0] && pix[0] < 2*m_camera_size[0] &&
+        pix[1] > -m_camera_size[1] && pix[1] < 2*m_camera_size[1];
+    }
+
+  public:
+    CameraGridRowTask(TransformT const& trans, vw::Vector2i const& offset,
+                      vw::Vector2i const& camera_size, int row, bool find_centers,
+                      CameraGrid & grid):
+      m_trans(trans), m_offset(offset), m_camera_size(camera_size), m_row(row),
+      m_find_centers(find_centers), m_grid(grid) {}
+
+    virtual void operator()() {
+      const float nan = std::numeric_limits<float>::quiet_NaN();
+      int s = m_grid.spacing, num_cols = m_grid.nodes.cols();
+
+      // Let the transform cache what it needs for this row
+      int height = m_find_centers ? s : 0;
+      m_trans.reverse_bbox(vw::BBox2i(0, m_row*s, (num_cols - 1)*s + 1, height + 1) + m_offset);
+
+      if (!m_find_centers) {
+        for (int i = 0; i < num_cols; i++) {
+          vw::Vector2 pix;
+          if (eval(vw::Vector2(i*s, m_row*s), pix))
+            m_grid.nodes(i, m_row) = pix;
+          else
+            m_grid.nodes(i, m_row) = vw::Vector2(nan, nan);
+        }
+        return;
+      }
+
+      for (int i = 0; i < num_cols - 1; i++) {
+        vw::Vector2 n0 = m_grid.nodes(i, m_row),   n1 = m_grid.nodes(i+1, m_row);
+        vw::Vector2 n2 = m_grid.nodes(i, m_row+1), n3 = m_grid.nodes(i+1, m_row+1);
+        vw::Vector2 c;
+        if (is_valid_node(n0) && is_valid_node(n1) && is_valid_node(n2) && is_valid_node(n3) &&
+            eval(vw::Vector2((i + 0.5)*s, (m_row + 0.5)*s), c))
+          m_grid.cell_error(i, m_row) = norm_2(0.25*(n0 + n1 + n2 + n3) - c);
+        else
+          m_grid.cell_error(i, m_row) = nan;
+      }
+    }
+  };
+
+  template <class TransformT>
+  void make_camera_grid(TransformT const& trans, vw::Vector2i const& offset,
+                        vw::Vector2i const& image_size, int spacing,
+                        vw::Vector2i const& camera_size, CameraGrid & grid) {
+    if (spacing <= 0)
+      vw::vw_throw(vw::ArgumentErr() << "The camera grid spacing must be positive.\n");
+
+    int num_cols = (image_size[0] + spacing - 1) / spacing + 1;
+    int num_rows = (image_size[1] + spacing - 1) / spacing + 1;
+    grid.spacing    = spacing;
+    grid.image_size = image_size;
+    grid.nodes.set_size(num_cols, num_rows);
+    grid.cell_error.set_size(num_cols - 1, num_rows - 1);
+
+    // All nodes are found before the cell centers, which need them
+    for (int pass = 0; pass < 2; pass++) {
+      bool find_centers = (pass == 1);
+      vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+      for (int row = 0; row < num_rows - int(find_centers); row++) {
+        boost::shared_ptr<vw::Task> task
+          (new CameraGridRowTask<TransformT>(trans, offset, camera_size, row,
+                                             find_centers, grid));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_CAMERA_GRID_H__
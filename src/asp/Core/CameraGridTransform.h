@@ -0,0 +1,235 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraGridTransform.h
+///
+/// Wrap a transform from output pixels to camera pixels, such as
+/// Map2CamTrans, so that the exact transform is evaluated only on a
+/// grid in each block of the output image, with bilinear interpolation
+/// in between. The interpolation is checked against the exact transform
+/// at the center of each grid cell, and the grid of a block is made finer
+/// until the errors are below a given value. Cells which still fail at
+/// the finest spacing, or which have nodes that do not project into the
+/// camera, use the exact transform. The errors are checked only at cell
+/// centers, so features of the DEM much smaller than a cell may be missed.
+///
+/// The grid of a block is made when a pixel in it is first needed, and
+/// each thread keeps the grids of the last few blocks it used.
+
+#ifndef __ASP_CORE_CAMERA_GRID_TRANSFORM_H__
+#define __ASP_CORE_CAMERA_GRID_TRANSFORM_H__
+
+#include <vw/Image/Transform.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+  template <class TransformT>
+  class CameraGridTransform: public vw::TransformBase< CameraGridTransform<TransformT> > {
+  public:
+
+    /// Size of the blocks of output pixels, and the coarsest and finest grid spacings
+    static const int BLOCK_SIZE   = 256;
+    static const int MAX_SPACING  = 32;
+    static const int MIN_SPACING  = 4;
+
+    CameraGridTransform(TransformT const& trans, vw::Vector2i const& image_size,
+                        double max_error):
+      m_trans(trans), m_max_error(max_error), m_id(next_id()) {
+      // Results far outside the image are taken to be failures of the transform
+      m_valid_box = vw::BBox2(-image_size[0], -image_size[1],
+                              3*image_size[0], 3*image_size[1]);
+    }
+
+    vw::Vector2 forward(vw::Vector2 const& p) const {
+      return m_trans.forward(p);
+    }
+
+    vw::Vector2 reverse(vw::Vector2 const& p) const {
+      int bx = int(std::floor(p[0] / BLOCK_SIZE));
+      int by = int(std::floor(p[1] / BLOCK_SIZE));
+      Block const& block = get_block(bx, by);
+
+      double sx = (p[0] - bx*BLOCK_SIZE) / block.spacing;
+      double sy = (p[1] - by*BLOCK_SIZE) / block.spacing;
+      int nc = block.num - 1;
+      int i  = std::min(std::max(int(std::floor(sx)), 0), nc - 1);
+      int j  = std::min(std::max(int(std::floor(sy)), 0), nc - 1);
+      if (block.exact[i + j*nc])
+        return m_trans.reverse(p);
+
+      double u = sx - i, v = sy - j;
+      vw::Vector2 const* n = &block.nodes[i + j*block.num];
+      return (1-v)*((1-u)*n[0]          + u*n[1]) +
+                v *((1-u)*n[block.num] + u*n[block.num + 1]);
+    }
+
+    /// The exact transform finds the input region, as it may do other
+    /// work there, such as caching the DEM.
+    vw::BBox2i reverse_bbox(vw::BBox2i const& bbox) const {
+      return m_trans.reverse_bbox(bbox);
+    }
+
+    vw::BBox2i forward_bbox(vw::BBox2i const& bbox) const {
+      return m_trans.forward_bbox(bbox);
+    }
+
+  private:
+
+    struct Block {
+      int spacing, num;               // Grid spacing and number of nodes per side
+      std::vector<vw::Vector2> nodes;  // Row-major
+      std::vector<char>        exact;  // For each cell, whether to use the exact transform
+    };
+
+    // Evaluate the exact transform. Return false if it fails.
+    bool eval(vw::Vector2 const& p, vw::Vector2 & pix) const {
+      try {
+        pix = m_trans.reverse(p);
+      } catch(...) {
+        return false;
+      }
+      return m_valid_box.contains(pix);
+    }
+
+    boost::shared_ptr<Block> make_block(int bx, int by) const {
+
+      vw::Vector2 origin(bx*BLOCK_SIZE, by*BLOCK_SIZE);
+      boost::shared_ptr<Block> block(new Block);
+      block->spacing = MAX_SPACING;
+      block->num     = BLOCK_SIZE / MAX_SPACING + 1;
+
+      int num = block->num;
+      std::vector<vw::Vector2> nodes(num*num);
+      std::vector<char> valid(num*num);
+      for (int j = 0; j < num; j++)
+        for (int i = 0; i < num; i++)
+          valid[i + j*num] = eval(origin + double(block->spacing)*vw::Vector2(i, j),
+                                  nodes[i + j*num]);
+
+      while (1) {
+
+        // Check the interpolation at the cell centers. Those become nodes
+        // if the grid is refined.
+        int nc = num - 1;
+        std::vector<vw::Vector2> centers(nc*nc);
+        std::vector<char> center_valid(nc*nc), exact(nc*nc);
+        bool all_good = true;
+        for (int j = 0; j < nc; j++) {
+          for (int i = 0; i < nc; i++) {
+            int c = i + j*nc, n = i + j*num;
+            center_valid[c] = eval(origin + double(block->spacing)*vw::Vector2(i + 0.5, j + 0.5),
+                                   centers[c]);
+            exact[c] = !(valid[n] && valid[n+1] && valid[n+num] && valid[n+num+1] &&
+                         center_valid[c]);
+            if (exact[c])
+              continue; // A finer grid would not help much near the edge of the DEM
+            vw::Vector2 interp = 0.25*(nodes[n] + nodes[n+1] + nodes[n+num] + nodes[n+num+1]);
+            if (norm_2(interp - centers[c]) > m_max_error) {
+              exact[c] = true;
+              all_good = false;
+            }
+          }
+        }
+
+        if (all_good || block->spacing <= MIN_SPACING) {
+          block->nodes.swap(nodes);
+          block->exact.swap(exact);
+          return block;
+        }
+
+        // Halve the spacing. The old nodes and the centers are reused.
+        int fine_num = 2*num - 1, spacing = block->spacing / 2;
+        std::vector<vw::Vector2> fine_nodes(fine_num*fine_num);
+        std::vector<char> fine_valid(fine_num*fine_num);
+        for (int j = 0; j < fine_num; j++) {
+          for (int i = 0; i < fine_num; i++) {
+            int f = i + j*fine_num;
+            if (i % 2 == 0 && j % 2 == 0) {
+              fine_nodes[f] = nodes[i/2 + (j/2)*num];
+              fine_valid[f] = valid[i/2 + (j/2)*num];
+            } else if (i % 2 == 1 && j % 2 == 1) {
+              fine_nodes[f] = centers[i/2 + (j/2)*nc];
+              fine_valid[f] = center_valid[i/2 + (j/2)*nc];
+            } else {
+              fine_valid[f] = eval(origin + double(spacing)*vw::Vector2(i, j), fine_nodes[f]);
+            }
+          }
+        }
+        nodes.swap(fine_nodes);
+        valid.swap(fine_valid);
+        num            = fine_num;
+        block->num     = fine_num;
+        block->spacing = spacing;
+      }
+    }
+
+    // A few blocks are used in turn when the tiles being written do not
+    // line up with the blocks.
+    static const int NUM_ENTRIES = 4;
+
+    struct Entries {
+      long id[NUM_ENTRIES];
+      int  bx[NUM_ENTRIES], by[NUM_ENTRIES];
+      boost::shared_ptr<Block> blocks[NUM_ENTRIES];
+      int  next;
+      Entries(): next(0) {
+        for (int it = 0; it < NUM_ENTRIES; it++)
+          id[it] = -1;
+      }
+    };
+
+    Block const& get_block(int bx, int by) const {
+      static thread_local Entries entries;
+      for (int it = 0; it < NUM_ENTRIES; it++) {
+        if (entries.id[it] == m_id && entries.bx[it] == bx && entries.by[it] == by)
+          return *entries.blocks[it];
+      }
+      // Replace the oldest entry
+      int it = entries.next;
+      entries.blocks[it] = make_block(bx, by);
+      entries.id[it] = m_id;
+      entries.bx[it] = bx;
+      entries.by[it] = by;
+      entries.next = (entries.next + 1) % NUM_ENTRIES;
+      return *entries.blocks[it];
+    }
+
+    // Copies of a transform share its id, and thus the grids made by either
+    static long next_id() {
+      static std::atomic<long> counter(0);
+      return counter++;
+    }
+
+    TransformT m_trans;
+    double     m_max_error;
+    vw::BBox2  m_valid_box;
+    long       m_id;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_CAMERA_GRID_TRANSFORM_H__
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/ColumnStats.h>
+#include <vw/Math/Statistics.h>
+
+namespace asp {
+
+bool robust_pair_mean(std::vector<vw::Vector2f> const& vals,
+                      vw::Vector2 const& remove_outliers_params,
+                      vw::Vector2 & mean) {
+
+  // The brackets are found for each channel on its own
+  std::vector<double> px(vals.size()), py(vals.size());
+  for (size_t it = 0; it < vals.size(); it++) {
+    px[it] = vals[it][0];
+    py[it] = vals[it][1];
+  }
+  std::sort(px.begin(), px.end());
+  std::sort(py.begin(), py.end());
+
+  // Being too strict with outlier removal can cause trouble
+  double pct_factor     = remove_outliers_params[0]/100.0;
+  double outlier_factor = remove_outliers_params[1];
+
+  double bx = 0, ex = 0, by = 0, ey = 0;
+  if (!vw::math::find_outlier_brackets(px, pct_factor, outlier_factor, bx, ex))
+    return false;
+  if (!vw::math::find_outlier_brackets(py, pct_factor, outlier_factor, by, ey))
+    return false;
+
+  // A pair is kept only if both its values are within the brackets
+  int num_valid = 0;
+  mean = vw::Vector2();
+  for (size_t it = 0; it < vals.size(); it++) {
+    double x = vals[it][0], y = vals[it][1];
+    if (x < bx || x > ex || y < by || y > ey)
+      continue;
+    num_valid++;
+    mean += vw::Vector2(x, y);
+  }
+
+  if (num_valid == 0)
+    return false;
+
+  mean /= num_valid;
+  return true;
+}
+
+} // end namespace asp
@@ -0,0 +1,124 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ColumnStats.h
+///
+/// Robust averages along the columns of a masked two-channel image,
+/// such as a disparity, to find artifacts which depend only on the
+/// column, as from the CCDs of a linescan sensor. The image is read in
+/// strips of columns, each by one thread, and each strip is read once,
+/// in bands of rows. The results do not depend on the number of threads.
+
+#ifndef __ASP_CORE_COLUMN_STATS_H__
+#define __ASP_CORE_COLUMN_STATS_H__
+
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace asp {
+
+  /// The mean of the pairs of values whose both values are within the
+  /// outlier brackets for their channel, as found by
+  /// vw::math::find_outlier_brackets() with the given percentile (in
+  /// percent) and factor. Return false if there are no such pairs.
+  bool robust_pair_mean(std::vector<vw::Vector2f> const& vals,
+                        vw::Vector2 const& remove_outliers_params,
+                        vw::Vector2 & mean);
+
+  /// Columns of the image which each thread does, and rows read at a time
+  const int COLUMN_STATS_STRIP_COLS = 128;
+  const int COLUMN_STATS_BAND_ROWS  = 1024;
+
+  template <class ViewT>
+  class ColumnMeanTask: public vw::Task, private boost::noncopyable {
+    ViewT const&               m_view;
+    vw::BBox2i                 m_box;
+    vw::Vector2                m_remove_outliers_params;
+    std::vector<vw::Vector2> & m_means;
+  public:
+    ColumnMeanTask(ViewT const& view, vw::BBox2i const& box,
+                   vw::Vector2 const& remove_outliers_params,
+                   std::vector<vw::Vector2> & means):
+      m_view(view), m_box(box), m_remove_outliers_params(remove_outliers_params),
+      m_means(means) {}
+
+    virtual void operator()() {
+      // Keep only the valid values of each column
+      std::vector< std::vector<vw::Vector2f> > vals(m_box.width());
+      for (int start = m_box.min().y(); start < m_box.max().y();
+           start += COLUMN_STATS_BAND_ROWS) {
+        vw::BBox2i band_box(m_box.min().x(), start, m_box.width(),
+                            std::min(COLUMN_STATS_BAND_ROWS, m_box.max().y() - start));
+        vw::ImageView<typename ViewT::pixel_type> band = crop(m_view, band_box);
+        for (int row = 0; row < band.rows(); row++) {
+          for (int col = 0; col < band.cols(); col++) {
+            if (is_valid(band(col, row))) {
+              vw::Vector2f val = remove_mask(band(col, row));
+              vals[col].push_back(val);
+            }
+          }
+        }
+      }
+
+      for (int col = 0; col < m_box.width(); col++) {
+        vw::Vector2 mean;
+        if (robust_pair_mean(vals[col], m_remove_outliers_params, mean))
+          m_means[m_box.min().x() + col] = mean;
+      }
+    }
+  };
+
+  /// The robust mean of each column of a masked two-channel image, over
+  /// the rows from beg_row to just before end_row, found with the given
+  /// number of threads. A column with no valid values gets a zero mean.
+  template <class ViewT>
+  std::vector<vw::Vector2> column_robust_means(vw::ImageViewBase<ViewT> const& view_base,
+                                               int beg_row, int end_row,
+                                               vw::Vector2 const& remove_outliers_params,
+                                               int num_threads) {
+    ViewT const& view = view_base.impl();
+    std::vector<vw::Vector2> means(view.cols(), vw::Vector2());
+    if (end_row <= beg_row)
+      return means;
+
+    vw::FifoWorkQueue queue(std::max(num_threads, 1));
+    for (int start = 0; start < view.cols(); start += COLUMN_STATS_STRIP_COLS) {
+      vw::BBox2i box(start, beg_row, std::min(COLUMN_STATS_STRIP_COLS, view.cols() - start),
+                     end_row - beg_row);
+      boost::shared_ptr< ColumnMeanTask<ViewT> >
+        task(new ColumnMeanTask<ViewT>(view, box, remove_outliers_params, means));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    return means;
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_COLUMN_STATS_H__
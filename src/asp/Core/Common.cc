@@ -20,8 +20,12 @@
 #include <vw/Math/BBox.h>
 #include <vw/FileIO/DiskImageResource.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/CompressedBlockCache.h>
+#include <asp/Core/MemoryBudget.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <algorithm>
+#include <future>
 #include <map>
 #include <sstream>
 #include <string>
@@ -44,6 +48,8 @@
 
 #if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
 #include "ogr_spatialref.h"
+#include <gdal.h>
+#include <gdal_utils.h>
 #endif
 
 // TODO(oalexan1): Set these based on the location of libisis rather
@@ -515,10 +521,22 @@ asp::check_command_line(int argc, char *argv[], vw::cartography::GdalWriteOption
   // options we must parse, even if we don't need some of them, and
   // public_options, which are the options specifically used by the
   // current tool, and for which we also print the help message.
+  // Options which all tools accept
+  double memory_budget_mb = 0, compressed_cache_mb = 0;
+  po::options_description common_options("");
+  common_options.add_options()
+    ("memory-budget", po::value(&memory_budget_mb)->default_value(0),
+     "How much memory this process may use, in MB. Tiles, caches, and the number of "
+     "threads are then sized to fit. If 0, there is no budget.")
+    ("compressed-cache-size", po::value(&compressed_cache_mb)->default_value(0),
+     "Keep this many MB of the image blocks read by dem_mosaic and point2dem "
+     "in memory, mostly compressed, so they are not read again from disk. If 0, "
+     "there is no such cache.");
+
   po::variables_map vm;
   try {
     po::options_description all_options;
-    all_options.add(all_public_options).add(positional_options);
+    all_options.add(all_public_options).add(positional_options).add(common_options);
 
     if (allow_unregistered) {
       po::parsed_options parsed = po::command_line_parser(argc, argv).options(all_options).allow_unregistered().style(po::command_line_style::unix_style).run();
@@ -531,7 +549,8 @@ asp::check_command_line(int argc, char *argv[], vw::cartography::GdalWriteOption
     po::notify(vm);
   } catch (po::error const& e) {
     vw::vw_throw(vw::ArgumentErr() << "Error parsing input:\n"
-                  << e.what() << "\n" << usage_comment << public_options);
+                  << e.what() << "\n" << usage_comment << public_options
+                  << common_options);
   }
 
   // We really don't want to use BIGTIFF unless we have to. It's
@@ -543,7 +562,7 @@ asp::check_command_line(int argc, char *argv[], vw::cartography::GdalWriteOption
   }
 
   if ( vm.count("help") )
-    vw::vw_throw(vw::ArgumentErr() << usage_comment << public_options);
+    vw::vw_throw(vw::ArgumentErr() << usage_comment << public_options << common_options);
 
   if ( vm.count("version") ) {
     std::ostringstream ostr;
@@ -584,14 +603,137 @@ asp::check_command_line(int argc, char *argv[], vw::cartography::GdalWriteOption
   boost::algorithm::to_upper( opt.tif_compress );
   boost::algorithm::trim( opt.tif_compress );
   VW_ASSERT( opt.tif_compress == "NONE" || opt.tif_compress == "LZW" ||
-             opt.tif_compress == "DEFLATE" || opt.tif_compress == "PACKBITS",
+             opt.tif_compress == "DEFLATE" || opt.tif_compress == "PACKBITS" ||
+             opt.tif_compress == "ZSTD" || opt.tif_compress == "LERC",
              ArgumentErr() << "\"" << opt.tif_compress
              << "\" is not a valid options for TIF_COMPRESS." );
   opt.gdal_options["COMPRESS"] = opt.tif_compress;
 
+  // The blocks are written one at a time, and without this GDAL
+  // compresses each before writing it, on the writing thread. With it,
+  // GDAL compresses the blocks in a pool of threads while they are
+  // queued for writing in order. This does not change the output.
+  if (opt.tif_compress != "NONE" && opt.num_threads > 1)
+    opt.gdal_options["NUM_THREADS"] = vw::num_to_str(opt.num_threads);
+
+  // Keep the image block cache within its part of the budget
+  memory_budget().set_budget_mb(memory_budget_mb);
+  if (memory_budget().has_budget()) {
+    double cache_mb = vw_settings().system_cache_size() / (1024.0 * 1024.0);
+    cache_mb = memory_budget().cap_mb(cache_mb, MEMORY_BUDGET_CACHE_FRACTION);
+    vw_settings().set_system_cache_size(size_t(cache_mb * 1024.0 * 1024.0));
+  }
+
+  // A fifth of the compressed block cache keeps the blocks read most
+  // recently decoded
+  if (compressed_cache_mb > 0) {
+    if (memory_budget().has_budget())
+      compressed_cache_mb = memory_budget().cap_mb(compressed_cache_mb,
+                                                   MEMORY_BUDGET_CACHE_FRACTION);
+    compressed_block_cache().set_size_mb(0.2 * compressed_cache_mb, 0.8 * compressed_cache_mb);
+  }
+
   return vm;
 }
 
+void asp::add_overviews_and_cog(std::string const& file, bool cog,
+                                Vector2 const& block_size,
+                                vw::cartography::GdalWriteOptions const& opt) {
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+
+  GDALAllRegister();
+
+  // Halve the resolution until the coarsest level fits in a block.
+  // GDAL finds each level from the previous one, so the file is read once.
+  vw_out() << "Adding overviews to: " << file << std::endl;
+  GDALDatasetH ds = GDALOpen(file.c_str(), GA_Update);
+  if (ds == NULL)
+    vw_throw(ArgumentErr() << "Could not open: " << file << ".\n");
+  int max_dim = std::max(GDALGetRasterXSize(ds), GDALGetRasterYSize(ds));
+  int min_block = std::max(int(std::min(block_size[0], block_size[1])), 1);
+  std::vector<int> levels;
+  for (int level = 2; max_dim / (level/2) > min_block; level *= 2)
+    levels.push_back(level);
+  CPLErr err = CE_None;
+  if (!levels.empty()) {
+    GDALTermProgress(0, NULL, NULL);
+    err = GDALBuildOverviews(ds, "AVERAGE", int(levels.size()), &levels[0],
+                             0, NULL, GDALTermProgress, NULL);
+  }
+  GDALClose(ds);
+  if (err != CE_None)
+    vw_throw(ArgumentErr() << "Could not build overviews for: " << file << ".\n");
+
+  if (!cog)
+    return;
+
+#if GDAL_VERSION_NUM < GDAL_COMPUTE_VERSION(3, 1, 0)
+  vw_throw(NoImplErr() << "Writing Cloud-Optimized GeoTIFF requires GDAL 3.1 or later.\n");
+#else
+  // Copy the blocks and existing overviews in the COG order
+  std::string tmp_file = fs::path(file).replace_extension(".cog.tmp.tif").string();
+  vw_out() << "Writing Cloud-Optimized GeoTIFF: " << file << std::endl;
+  std::vector<std::string> args;
+  args.push_back("-of"); args.push_back("COG");
+  args.push_back("-co"); args.push_back("BLOCKSIZE=" + vw::num_to_str(int(block_size[0])));
+  args.push_back("-co"); args.push_back("OVERVIEWS=FORCE_USE_EXISTING");
+  for (std::map<std::string, std::string>::const_iterator it = opt.gdal_options.begin();
+       it != opt.gdal_options.end(); it++) {
+    if (it->first != "COMPRESS" && it->first != "BIGTIFF")
+      continue;
+    args.push_back("-co"); args.push_back(it->first + "=" + it->second);
+  }
+  std::vector<char*> argv;
+  for (size_t it = 0; it < args.size(); it++)
+    argv.push_back(const_cast<char*>(args[it].c_str()));
+  argv.push_back(NULL);
+
+  GDALTranslateOptions * translate_opts = GDALTranslateOptionsNew(&argv[0], NULL);
+  GDALTranslateOptionsSetProgress(translate_opts, GDALTermProgress, NULL);
+  GDALDatasetH src = GDALOpen(file.c_str(), GA_ReadOnly);
+  if (src == NULL) {
+    GDALTranslateOptionsFree(translate_opts);
+    vw_throw(ArgumentErr() << "Could not open: " << file << ".\n");
+  }
+  int usage_error = 0;
+  GDALDatasetH dst = GDALTranslate(tmp_file.c_str(), src, translate_opts, &usage_error);
+  GDALTranslateOptionsFree(translate_opts);
+  GDALClose(src);
+  if (dst == NULL || usage_error)
+    vw_throw(ArgumentErr() << "Could not write Cloud-Optimized GeoTIFF: " << tmp_file << ".\n");
+  GDALClose(dst);
+  fs::rename(tmp_file, file);
+#endif
+
+#else
+  vw_throw( NoImplErr() << "Overviews are not available without GDAL support." );
+#endif
+}
+
+void asp::run_in_parallel(boost::function<void()> const& job1,
+                          boost::function<void()> const& job2) {
+  std::future<void> future1 = std::async(std::launch::async, job1);
+  // Wait for the first job even if the second one throws
+  try {
+    job2();
+  } catch (...) {
+    future1.wait();
+    throw;
+  }
+  future1.get();
+}
+
+vw::cartography::GdalWriteOptions
+asp::half_threads(vw::cartography::GdalWriteOptions const& opt) {
+  vw::cartography::GdalWriteOptions half = opt;
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  half.num_threads = std::max(num_threads / 2, 1);
+  return half;
+}
+
 void asp::set_srs_string(std::string srs_string, bool have_user_datum,
                          vw::cartography::Datum const& user_datum,
                          vw::cartography::GeoReference & georef){
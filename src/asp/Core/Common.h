@@ -28,6 +28,7 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 #include <vw/Core/StringUtils.h>
 #include <vw/Image/ImageIO.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
@@ -38,6 +39,7 @@
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
+#include <limits>
 #include <map>
 #include <string>
 
@@ -128,6 +130,24 @@ namespace asp {
                       vw::cartography::Datum const& user_datum,
                       vw::cartography::GeoReference & georef);
 
+  /// Add internal overviews to a GeoTIFF which was just written. If cog is
+  /// set, also convert it to the Cloud-Optimized GeoTIFF layout with the
+  /// given block size, reusing these overviews. The file is replaced.
+  /// This saves the separate pass of gdaladdo and gdal_translate.
+  void add_overviews_and_cog(std::string const& file, bool cog,
+                             vw::Vector2 const& block_size,
+                             vw::cartography::GdalWriteOptions const& opt);
+
+  /// Run two jobs at the same time, such as the same work for the left
+  /// and right images, and rethrow the exception of either, if any.
+  void run_in_parallel(boost::function<void()> const& job1,
+                       boost::function<void()> const& job2);
+
+  /// A copy of the options with half of their threads, for each of two
+  /// jobs run at the same time, so that together they use as many as before.
+  vw::cartography::GdalWriteOptions
+  half_threads(vw::cartography::GdalWriteOptions const& opt);
+
   //---------------------------------------------------------------------------
 
   /// String we use in ASP written point cloud files to indicate that an offset
@@ -135,6 +155,9 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String indicating that the points were stored as integer multiples of this value.
+  const std::string ASP_POINT_SCALE_TAG_STR = "POINT_SCALE";
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -181,6 +204,52 @@ namespace asp {
       ( image.impl(), RoundImagePixels<typename ImageT::pixel_type>(rounding_error) );
   }
 
+  /// Convert pixels to int32 multiples of given scale. Pixels with values that
+  /// do not fit, which can only be outliers far from the shift, become
+  /// the zero vector, which marks invalid points.
+  template <class VecT>
+  struct QuantizeImagePixels:
+    public vw::ReturnFixedType< vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> > {
+    typedef vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> IntVecT;
+    double m_scale;
+    QuantizeImagePixels(double scale):m_scale(scale){
+      VW_ASSERT( m_scale > 0.0, vw::ArgumentErr() << "The scale must be positive.");
+    }
+    IntVecT operator() (VecT const& pt) const {
+      const double max_val = std::numeric_limits<vw::int32>::max();
+      IntVecT out;
+      for (size_t i = 0; i < out.size(); i++) {
+        double val = round(pt[i]/m_scale);
+        if (!(std::abs(val) < max_val)) // also catches NaN
+          return IntVecT();
+        out[i] = vw::int32(val);
+      }
+      return out;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+  inline quantize_image_pixels( vw::ImageViewBase<ImageT> const& image, double scale ) {
+    return vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+      ( image.impl(), QuantizeImagePixels<typename ImageT::pixel_type>(scale) );
+  }
+
+  /// Multiply all components of the pixels by the given scale.
+  template <class VecT>
+  struct ScaleImagePixels: public vw::ReturnFixedType<VecT> {
+    double m_scale;
+    ScaleImagePixels(double scale):m_scale(scale){}
+    VecT operator() (VecT const& pt) const {
+      return m_scale*pt;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, ScaleImagePixels<typename ImageT::pixel_type> >
+  inline scale_image_pixels( vw::ImageViewBase<ImageT> const& image, double scale ) {
+    return vw::UnaryPerPixelView<ImageT, ScaleImagePixels<typename ImageT::pixel_type> >
+      ( image.impl(), ScaleImagePixels<typename ImageT::pixel_type>(scale) );
+  }
+
 
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
@@ -229,6 +298,38 @@ namespace asp {
                                std::map<std::string, std::string>() );
 
 
+  /// Block write image while subtracting a given value from all pixels
+  /// and storing the result as int32 multiples of the rounding error.
+  /// Unlike with float, the precision does not decrease away from the shift.
+  template <class ImageT>
+  void block_write_quantized_gdal_image(const std::string &filename,
+                                        vw::Vector3 const& shift,
+                                        double rounding_error,
+                                        vw::ImageViewBase<ImageT> const& image,
+                                        bool has_georef,
+                                        vw::cartography::GeoReference const& georef,
+                                        bool has_nodata, double nodata,
+                                        vw::cartography::GdalWriteOptions const& opt,
+                                        vw::ProgressCallback const& progress_callback
+                                        = vw::ProgressCallback::dummy_instance(),
+                                        std::map<std::string, std::string> const& keywords =
+                                        std::map<std::string, std::string>() );
+
+  /// Single-threaded version of block_write_quantized_gdal_image().
+  template <class ImageT>
+  void write_quantized_gdal_image(const std::string &filename,
+                                  vw::Vector3 const& shift,
+                                  double rounding_error,
+                                  vw::ImageViewBase<ImageT> const& image,
+                                  bool has_georef,
+                                  vw::cartography::GeoReference const& georef,
+                                  bool has_nodata, double nodata,
+                                  vw::cartography::GdalWriteOptions const& opt,
+                                  vw::ProgressCallback const& progress_callback
+                                  = vw::ProgressCallback::dummy_instance(),
+                                  std::map<std::string, std::string> const& keywords =
+                                  std::map<std::string, std::string>() );
+
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
@@ -93,6 +93,61 @@ namespace asp {
     }
   }
 
+  // Block write image while subtracting a given value from all pixels
+  // and storing the result as int32 multiples of the rounding error.
+  template <class ImageT>
+  void block_write_quantized_gdal_image(const std::string &filename,
+                                        vw::Vector3 const& shift,
+                                        double rounding_error,
+                                        vw::ImageViewBase<ImageT> const& image,
+                                        bool has_georef,
+                                        vw::cartography::GeoReference const& georef,
+                                        bool has_nodata, double nodata,
+                                        vw::cartography::GdalWriteOptions const& opt,
+                                        vw::ProgressCallback const& progress_callback,
+                                        std::map<std::string, std::string> const& keywords) {
+
+    VW_ASSERT(norm_2(shift) > 0, vw::ArgumentErr()
+              << "Expecting a non-zero shift when quantizing the image.\n");
+
+    double scale = get_rounding_error(shift, rounding_error);
+    std::map<std::string, std::string> local_keywords = keywords;
+    local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+    local_keywords[ASP_POINT_SCALE_TAG_STR]  = vw::num_to_str(scale);
+
+    block_write_gdal_image(filename,
+                           quantize_image_pixels(subtract_shift(image.impl(), shift), scale),
+                           has_georef, georef, has_nodata, nodata,
+                           opt, progress_callback, local_keywords);
+  }
+
+  // Single-threaded version of block_write_quantized_gdal_image().
+  template <class ImageT>
+  void write_quantized_gdal_image(const std::string &filename,
+                                  vw::Vector3 const& shift,
+                                  double rounding_error,
+                                  vw::ImageViewBase<ImageT> const& image,
+                                  bool has_georef,
+                                  vw::cartography::GeoReference const& georef,
+                                  bool has_nodata, double nodata,
+                                  vw::cartography::GdalWriteOptions const& opt,
+                                  vw::ProgressCallback const& progress_callback,
+                                  std::map<std::string, std::string> const& keywords) {
+
+    VW_ASSERT(norm_2(shift) > 0, vw::ArgumentErr()
+              << "Expecting a non-zero shift when quantizing the image.\n");
+
+    double scale = get_rounding_error(shift, rounding_error);
+    std::map<std::string, std::string> local_keywords = keywords;
+    local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+    local_keywords[ASP_POINT_SCALE_TAG_STR]  = vw::num_to_str(scale);
+
+    write_gdal_image(filename,
+                     quantize_image_pixels(subtract_shift(image.impl(), shift), scale),
+                     has_georef, georef, has_nodata, nodata,
+                     opt, progress_callback, local_keywords);
+  }
+
   // Often times, we'd like to save an image to disk by using big
   // blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
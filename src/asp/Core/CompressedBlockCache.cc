@@ -0,0 +1,278 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/CompressedBlockCache.h>
+#include <asp/Core/StageReport.h>
+
+#include <vw/Core/Exception.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <sstream>
+
+using namespace vw;
+
+namespace asp {
+
+void shuffle_and_deflate(char const* data, size_t size, int elem_size,
+                         std::vector<char> & compressed) {
+
+  if (elem_size <= 0 || size % elem_size != 0)
+    vw_throw(ArgumentErr() << "The block size is not a multiple of the value size.\n");
+
+  // Values of neighboring pixels mostly differ in their last bytes, so
+  // grouping the bytes by significance gives longer runs to deflate.
+  size_t num = size / elem_size;
+  std::vector<char> shuffled(size);
+  for (size_t it = 0; it < num; it++) {
+    for (int b = 0; b < elem_size; b++)
+      shuffled[b * num + it] = data[it * elem_size + b];
+  }
+
+  uLongf len = compressBound(size);
+  compressed.resize(len);
+  if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &len,
+                reinterpret_cast<Bytef const*>(size > 0 ? &shuffled[0] : ""),
+                size, Z_BEST_SPEED) != Z_OK)
+    vw_throw(LogicErr() << "Could not compress an image block.\n");
+  compressed.resize(len);
+}
+
+bool inflate_and_unshuffle(std::vector<char> const& compressed, size_t size,
+                           int elem_size, std::vector<char> & data) {
+
+  if (elem_size <= 0 || size % elem_size != 0 || compressed.empty())
+    return false;
+
+  std::vector<char> shuffled(size);
+  uLongf len = size;
+  if (uncompress(reinterpret_cast<Bytef*>(size > 0 ? &shuffled[0] : NULL), &len,
+                 reinterpret_cast<Bytef const*>(&compressed[0]),
+                 compressed.size()) != Z_OK || len != size)
+    return false;
+
+  size_t num = size / elem_size;
+  data.resize(size);
+  for (size_t it = 0; it < num; it++) {
+    for (int b = 0; b < elem_size; b++)
+      data[it * elem_size + b] = shuffled[b * num + it];
+  }
+  return true;
+}
+
+bool CompressedBlockCache::Key::operator<(Key const& k) const {
+  if (source != k.source) return source < k.source;
+  if (y != k.y) return y < k.y;
+  if (x != k.x) return x < k.x;
+  if (h != k.h) return h < k.h;
+  return w < k.w;
+}
+
+CompressedBlockCache::Key CompressedBlockCache::make_key(int source_id,
+                                                         BBox2i const& box) {
+  Key key;
+  key.source = source_id;
+  key.x = box.min().x(); key.y = box.min().y();
+  key.w = box.width();   key.h = box.height();
+  return key;
+}
+
+CompressedBlockCache::CompressedBlockCache():
+  m_max_decoded(0), m_max_compressed(0), m_decoded_bytes(0), m_compressed_bytes(0),
+  m_compressed_raw_bytes(0), m_decoded_hits(0), m_compressed_hits(0), m_misses(0) {}
+
+void CompressedBlockCache::set_size_mb(double decoded_mb, double compressed_mb) {
+  Mutex::Lock lock(m_mutex);
+  m_max_decoded    = size_t(std::max(decoded_mb, 0.0) * 1024.0 * 1024.0);
+  m_max_compressed = size_t(std::max(compressed_mb, 0.0) * 1024.0 * 1024.0);
+  m_decoded.clear();
+  m_compressed.clear();
+  m_decoded_lru.clear();
+  m_compressed_lru.clear();
+  m_decoded_bytes = m_compressed_bytes = m_compressed_raw_bytes = 0;
+}
+
+int CompressedBlockCache::source_id(std::string const& name) {
+  Mutex::Lock lock(m_mutex);
+  std::map<std::string, int>::const_iterator it = m_sources.find(name);
+  if (it != m_sources.end())
+    return it->second;
+  int id = m_sources.size();
+  m_sources[name] = id;
+  return id;
+}
+
+CompressedBlockCache::BlockPtr CompressedBlockCache::get(int source_id, BBox2i const& box) {
+
+  Key key = make_key(source_id, box);
+  BlockPtr data;
+  size_t raw_size = 0;
+  int elem_size = 0;
+  {
+    Mutex::Lock lock(m_mutex);
+    std::map<Key, Decoded>::iterator dit = m_decoded.find(key);
+    if (dit != m_decoded.end()) {
+      m_decoded_lru.splice(m_decoded_lru.begin(), m_decoded_lru, dit->second.lru_pos);
+      m_decoded_hits++;
+      return dit->second.block;
+    }
+    std::map<Key, Compressed>::iterator cit = m_compressed.find(key);
+    if (cit == m_compressed.end()) {
+      m_misses++;
+      return BlockPtr();
+    }
+    m_compressed_lru.splice(m_compressed_lru.begin(), m_compressed_lru, cit->second.lru_pos);
+    data      = cit->second.data;
+    raw_size  = cit->second.raw_size;
+    elem_size = cit->second.elem_size;
+  }
+
+  // Decompress without the lock, then keep the block decoded again.
+  // It stays in the compressed tier, so it need not be compressed when
+  // pushed out of the decoded one.
+  BlockPtr block(new std::vector<char>);
+  if (!inflate_and_unshuffle(*data, raw_size, elem_size, *block)) {
+    Mutex::Lock lock(m_mutex);
+    m_misses++;
+    return BlockPtr();
+  }
+  std::vector<std::pair<Key, Decoded> > evicted;
+  {
+    Mutex::Lock lock(m_mutex);
+    m_compressed_hits++;
+    add_decoded(key, block, elem_size, evicted);
+  }
+  add_compressed(evicted);
+  return block;
+}
+
+void CompressedBlockCache::put(int source_id, BBox2i const& box, BlockPtr const& block,
+                               int elem_size) {
+  if (!enabled())
+    return;
+  std::vector<std::pair<Key, Decoded> > evicted;
+  {
+    Mutex::Lock lock(m_mutex);
+    add_decoded(make_key(source_id, box), block, elem_size, evicted);
+  }
+  add_compressed(evicted);
+}
+
+void CompressedBlockCache::add_decoded(Key const& key, BlockPtr const& block, int elem_size,
+                                       std::vector<std::pair<Key, Decoded> > & evicted) {
+
+  if (m_decoded.find(key) != m_decoded.end())
+    return; // another thread read it meanwhile
+
+  m_decoded_lru.push_front(key);
+  Decoded & entry = m_decoded[key];
+  entry.block     = block;
+  entry.elem_size = elem_size;
+  entry.lru_pos   = m_decoded_lru.begin();
+  m_decoded_bytes += block->size();
+
+  // Push out the least recently used blocks. Those already compressed
+  // are simply dropped.
+  while (m_decoded_bytes > m_max_decoded && !m_decoded_lru.empty()) {
+    Key old_key = m_decoded_lru.back();
+    m_decoded_lru.pop_back();
+    std::map<Key, Decoded>::iterator it = m_decoded.find(old_key);
+    m_decoded_bytes -= it->second.block->size();
+    if (m_compressed.find(old_key) == m_compressed.end())
+      evicted.push_back(*it);
+    m_decoded.erase(it);
+  }
+}
+
+void CompressedBlockCache::add_compressed(std::vector<std::pair<Key, Decoded> > const& evicted) {
+
+  for (size_t it = 0; it < evicted.size(); it++) {
+    Key const& key = evicted[it].first;
+    Decoded const& block = evicted[it].second;
+    BlockPtr data(new std::vector<char>);
+    shuffle_and_deflate(block.block->empty() ? NULL : &(*block.block)[0],
+                        block.block->size(), block.elem_size, *data);
+
+    Mutex::Lock lock(m_mutex);
+    if (m_compressed.find(key) != m_compressed.end() || data->size() > m_max_compressed)
+      continue;
+    m_compressed_lru.push_front(key);
+    Compressed & entry = m_compressed[key];
+    entry.data      = data;
+    entry.raw_size  = block.block->size();
+    entry.elem_size = block.elem_size;
+    entry.lru_pos   = m_compressed_lru.begin();
+    m_compressed_bytes     += data->size();
+    m_compressed_raw_bytes += entry.raw_size;
+
+    while (m_compressed_bytes > m_max_compressed && !m_compressed_lru.empty()) {
+      Key old_key = m_compressed_lru.back();
+      m_compressed_lru.pop_back();
+      std::map<Key, Compressed>::iterator cit = m_compressed.find(old_key);
+      m_compressed_bytes     -= cit->second.data->size();
+      m_compressed_raw_bytes -= cit->second.raw_size;
+      m_compressed.erase(cit);
+    }
+  }
+}
+
+CompressedBlockCache::Stats CompressedBlockCache::stats() const {
+  Mutex::Lock lock(m_mutex);
+  const double MB = 1024.0 * 1024.0;
+  Stats s;
+  s.decoded_hits      = m_decoded_hits;
+  s.compressed_hits   = m_compressed_hits;
+  s.misses            = m_misses;
+  s.decoded_mb        = m_decoded_bytes / MB;
+  s.compressed_mb     = m_compressed_bytes / MB;
+  s.compressed_raw_mb = m_compressed_raw_bytes / MB;
+  return s;
+}
+
+void CompressedBlockCache::add_to_report(StageReport & report) const {
+  if (!enabled())
+    return;
+  Stats s = stats();
+  report.add("cache_decoded_hits",    s.decoded_hits);
+  report.add("cache_compressed_hits", s.compressed_hits);
+  report.add("cache_misses",          s.misses);
+  report.add("cache_compressed_mb",   s.compressed_mb);
+  report.add("cache_compressed_raw_mb", s.compressed_raw_mb);
+}
+
+std::string CompressedBlockCache::summary() const {
+  Stats s = stats();
+  long long total = s.decoded_hits + s.compressed_hits + s.misses;
+  std::ostringstream os;
+  os.precision(4);
+  os << "Compressed block cache: " << s.decoded_hits << " decoded hits, "
+     << s.compressed_hits << " compressed hits, " << s.misses << " misses";
+  if (total > 0)
+    os << " (hit rate " << 100.0 * (s.decoded_hits + s.compressed_hits) / total << "%)";
+  os << ", holding " << s.compressed_raw_mb << " MB in " << s.compressed_mb
+     << " MB compressed.";
+  return os.str();
+}
+
+CompressedBlockCache & compressed_block_cache() {
+  static CompressedBlockCache cache;
+  return cache;
+}
+
+} // end namespace asp
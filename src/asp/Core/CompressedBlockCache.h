@@ -0,0 +1,229 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CompressedBlockCache.h
+///
+/// A second tier of the image block cache, for tools which read the
+/// same blocks of their inputs many times, such as dem_mosaic, whose
+/// tiles overlap, and point2dem. The blocks read recently are kept
+/// decoded. Those pushed out are kept compressed instead of being
+/// dropped, so that reading them again costs a decompression rather
+/// than decoding the file. The bytes of each block are shuffled so
+/// that those of the same significance are together, then deflated at
+/// the fastest level. The cache is shared by all views and threads, and
+/// its size is set with --compressed-cache-size, which every tool
+/// parsing its options with check_command_line() accepts. Without it,
+/// the images are read directly, as before.
+
+#ifndef __ASP_CORE_COMPRESSED_BLOCK_CACHE_H__
+#define __ASP_CORE_COMPRESSED_BLOCK_CACHE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <cstring>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class StageReport;
+
+  /// Shuffle the bytes of values of elem_size bytes each, so the first
+  /// bytes of all values come first, and so on, then deflate them.
+  void shuffle_and_deflate(char const* data, size_t size, int elem_size,
+                           std::vector<char> & compressed);
+
+  /// Undo shuffle_and_deflate(). Returns false if the data is corrupt.
+  bool inflate_and_unshuffle(std::vector<char> const& compressed, size_t size,
+                             int elem_size, std::vector<char> & data);
+
+  class CompressedBlockCache: private boost::noncopyable {
+  public:
+
+    typedef boost::shared_ptr<std::vector<char> > BlockPtr;
+
+    struct Stats {
+      long long decoded_hits, compressed_hits, misses;
+      double decoded_mb, compressed_mb, compressed_raw_mb; ///< Now in each tier
+      Stats(): decoded_hits(0), compressed_hits(0), misses(0),
+               decoded_mb(0), compressed_mb(0), compressed_raw_mb(0) {}
+    };
+
+    CompressedBlockCache();
+
+    /// Set the sizes of the tiers, in MB, and empty them. With no
+    /// compressed tier the cache is off.
+    void set_size_mb(double decoded_mb, double compressed_mb);
+    bool enabled() const { return m_max_compressed > 0; }
+
+    /// The id of the source with this name, the same for the same name
+    int source_id(std::string const& name);
+
+    /// The block of the source at this box, or a null pointer if not cached.
+    BlockPtr get(int source_id, vw::BBox2i const& box);
+
+    /// Add a block of values of elem_size bytes each. The block must
+    /// not be changed afterwards.
+    void put(int source_id, vw::BBox2i const& box, BlockPtr const& block, int elem_size);
+
+    Stats stats() const;
+
+    /// Add the hit counts and sizes to a stage report
+    void add_to_report(StageReport & report) const;
+
+    /// A line with the hit counts and sizes, for the log
+    std::string summary() const;
+
+  private:
+
+    struct Key {
+      int source, x, y, w, h;
+      bool operator<(Key const& k) const;
+    };
+    typedef std::list<Key> LruList; // most recently used first
+    struct Decoded {
+      BlockPtr block;
+      int elem_size;
+      LruList::iterator lru_pos;
+    };
+    struct Compressed {
+      BlockPtr data;
+      size_t raw_size;
+      int elem_size;
+      LruList::iterator lru_pos;
+    };
+
+    static Key make_key(int source_id, vw::BBox2i const& box);
+
+    // Must hold the lock
+    void add_decoded(Key const& key, BlockPtr const& block, int elem_size,
+                     std::vector<std::pair<Key, Decoded> > & evicted);
+    // Compresses without the lock
+    void add_compressed(std::vector<std::pair<Key, Decoded> > const& evicted);
+
+    size_t m_max_decoded, m_max_compressed;
+    size_t m_decoded_bytes, m_compressed_bytes, m_compressed_raw_bytes;
+    long long m_decoded_hits, m_compressed_hits, m_misses;
+    std::map<std::string, int> m_sources;
+    std::map<Key, Decoded>    m_decoded;
+    std::map<Key, Compressed> m_compressed;
+    LruList m_decoded_lru, m_compressed_lru;
+    mutable vw::Mutex m_mutex;
+  };
+
+  /// The cache of this process
+  CompressedBlockCache & compressed_block_cache();
+
+  /// A view which reads its image in blocks through the compressed block
+  /// cache. The name identifies the image among those in the cache, so
+  /// it must differ for different images.
+  template <class ImageT>
+  class CompressedCacheView: public vw::ImageViewBase<CompressedCacheView<ImageT> > {
+    ImageT m_image;
+    int    m_source_id, m_block_size;
+
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<CompressedCacheView> pixel_accessor;
+
+    CompressedCacheView(ImageT const& image, std::string const& name, int block_size):
+      m_image(image), m_source_id(compressed_block_cache().source_id(name)),
+      m_block_size(block_size) {}
+
+    inline vw::int32 cols  () const { return m_image.cols(); }
+    inline vw::int32 rows  () const { return m_image.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const {
+      return prerasterize(vw::BBox2i(col, row, 1, 1))(col, row);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      vw::ImageView<pixel_type> out(bbox.width(), bbox.height());
+      int elem_size = sizeof(pixel_type);
+      int b = m_block_size;
+      vw::BBox2i image_box = vw::bounding_box(m_image);
+      for (int by = b * (bbox.min().y() / b); by < bbox.max().y(); by += b) {
+        for (int bx = b * (bbox.min().x() / b); bx < bbox.max().x(); bx += b) {
+          vw::BBox2i block_box(bx, by, b, b);
+          block_box.crop(image_box);
+          if (block_box.empty())
+            continue;
+
+          CompressedBlockCache::BlockPtr block
+            = compressed_block_cache().get(m_source_id, block_box);
+          if (!block) {
+            vw::ImageView<pixel_type> pixels = vw::crop(m_image, block_box);
+            block.reset(new std::vector<char>(size_t(elem_size) * pixels.cols() * pixels.rows()));
+            if (!block->empty())
+              std::memcpy(&(*block)[0], pixels.data(), block->size());
+            compressed_block_cache().put(m_source_id, block_box, block, elem_size);
+          }
+
+          // Copy the part of the block in the box, row by row
+          vw::BBox2i part = block_box;
+          part.crop(bbox);
+          pixel_type const* pixels = reinterpret_cast<pixel_type const*>(&(*block)[0]);
+          for (int row = part.min().y(); row < part.max().y(); row++) {
+            pixel_type const* src = pixels + size_t(row - block_box.min().y()) * block_box.width()
+              + (part.min().x() - block_box.min().x());
+            std::copy(src, src + part.width(),
+                      &out(part.min().x() - bbox.min().x(), row - bbox.min().y()));
+          }
+        }
+      }
+      return prerasterize_type(out, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// The image read through the compressed block cache, if the cache is
+  /// on, or else the image itself. The pixels must be plain values, as
+  /// they are copied as bytes.
+  template <class ImageT>
+  vw::ImageViewRef<typename ImageT::pixel_type>
+  compressed_cache(vw::ImageViewBase<ImageT> const& image, std::string const& name,
+                   int block_size = 256) {
+    if (!compressed_block_cache().enabled())
+      return image.impl();
+    return CompressedCacheView<ImageT>(image.impl(), name, block_size);
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_COMPRESSED_BLOCK_CACHE_H__
@@ -49,7 +49,7 @@ namespace asp {
     boost::shared_ptr<camera::CameraModel> m_left_camera_model;
     boost::shared_ptr<camera::CameraModel> m_right_camera_model;
     bool            m_do_align;
-    Matrix<double>  m_align_left_matrix, m_align_right_matrix;
+    HomographyTransform m_align_left_trans, m_align_right_trans;
     int             m_pixel_sample;
     ImageView<PixelMask<Vector2i> > & m_disparity_spread;
 
@@ -71,8 +71,8 @@ namespace asp {
        m_left_camera_model(left_camera_model),
        m_right_camera_model(right_camera_model),
        m_do_align(do_align),
-       m_align_left_matrix(align_left_matrix),
-       m_align_right_matrix(align_right_matrix),
+       m_align_left_trans(align_left_matrix),
+       m_align_right_trans(align_right_matrix),
        m_pixel_sample(pixel_sample),
        m_disparity_spread(disparity_spread){}
 
@@ -136,7 +136,7 @@ namespace asp {
         Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
         if (m_do_align){
           // Need to go to the image pixel in the untransformed image
-          left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+          left_fullres_pix = m_align_left_trans.reverse(left_fullres_pix);
         }
 
         bool has_intersection;
@@ -174,12 +174,16 @@ namespace asp {
       ImageView <PixelMask<float> > dem_crop = crop(m_dem, dem_box);
 
       // Compute the DEM disparity. Use one in every 'm_pixel_sample' pixels.
+      // Each intersection starts from the previous one in the row. The
+      // first one in a row starts from the first one in the previous row,
+      // as the end of the previous row is too far.
+      Vector3 row_start_xyz = prev_xyz;
 
       for (int row = bbox.min().y(); row < bbox.max().y(); row++){
         if (row%m_pixel_sample != 0) continue;
 
-        // Must wipe the previous guess since we are now too far from it
-        prev_xyz = Vector3();
+        prev_xyz = row_start_xyz;
+        bool row_started = false;
 
         for (int col = bbox.min().x(); col < bbox.max().x(); col++){
           if (col%m_pixel_sample != 0) continue;
@@ -189,7 +193,7 @@ namespace asp {
           Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
           if (m_do_align){
             // Need to go to the image pixel in the untransformed image
-            left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+            left_fullres_pix = m_align_left_trans.reverse(left_fullres_pix);
           }
 
           bool has_intersection;
@@ -210,6 +214,10 @@ namespace asp {
                                                 );
           if ( !has_intersection || xyz == Vector3() ) continue;
           prev_xyz = xyz;
+          if (!row_started) {
+            row_start_xyz = xyz;
+            row_started = true;
+          }
 
           // Since our DEM is only known approximately, the true
           // intersection point of the ray coming from the left camera
@@ -231,7 +239,7 @@ namespace asp {
               continue;
             }
             if (m_do_align){
-              right_fullres_pix = HomographyTransform(m_align_right_matrix).forward(right_fullres_pix);
+              right_fullres_pix = m_align_right_trans.forward(right_fullres_pix);
             }
 
             Vector2 right_lowres_pix = elem_prod(right_fullres_pix, m_downsample_scale);
@@ -288,7 +296,7 @@ namespace asp {
   void produce_dem_disparity( ASPGlobalOptions & opt,
                               boost::shared_ptr<camera::CameraModel> left_camera_model,
                               boost::shared_ptr<camera::CameraModel> right_camera_model,
-                              std::string session_name
+                              bool multi_threaded
                               ) {
 
     if (stereo_settings().is_search_defined())
@@ -362,8 +370,8 @@ namespace asp {
                                                        ));
     std::string disparity_file = opt.out_prefix + "-D_sub.tif";
     vw_out() << "Writing low-resolution disparity: " << disparity_file << "\n";
-    if ( session_name == "isis" ){
-      // ISIS does not support multi-threading
+    if ( !multi_threaded ){
+      // Cameras which cannot be used by several threads at once
       boost::scoped_ptr<DiskImageResource> drsrc( vw::cartography::build_gdal_rsrc( disparity_file,
                                                                         lowres_disparity, opt ) );
       write_image(*drsrc, lowres_disparity,
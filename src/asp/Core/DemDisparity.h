@@ -36,11 +36,12 @@ namespace vw {
 
 namespace asp {
 
-  /// Use a DEM to get the low-res disparity
+  /// Use a DEM to get the low-res disparity. Tiles are done in parallel
+  /// if the cameras can be used by several threads.
   void produce_dem_disparity(ASPGlobalOptions & opt,
                              boost::shared_ptr<vw::camera::CameraModel> left_camera_model,
                              boost::shared_ptr<vw::camera::CameraModel> right_camera_model,
-                             std::string session_name
+                             bool multi_threaded
                              );
 
 }
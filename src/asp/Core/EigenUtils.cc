@@ -86,19 +86,7 @@ void random_pc_subsample(int m, DoubleMatrix& points){
   points.conservativeResize(Eigen::NoChange, m);
 }
 
-int load_csv_aux(std::string const& file_name, int num_points_to_load,
-                 vw::BBox2 const& lonlat_box,
-                 bool calc_shift, vw::Vector3 & shift,
-                 vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
-                 bool & is_lola_rdr_format, double & mean_longitude,
-                 bool verbose, DoubleMatrix & data){
-
-  // Note: The input CsvConv object is responsible for parsing out the
-  //       type of information contained in the CSV file.
-
-  is_lola_rdr_format = false;
-
-  int num_total_points = csv_file_size(file_name);
+bool guess_lola_rdr_format(std::string const& file_name, bool verbose){
 
   std::string sep_str = csv_separator();
   const char* sep = sep_str.c_str();
@@ -110,11 +98,6 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
     vw_throw( vw::IOErr() << "Unable to open file \"" << file_name << "\"" );
   }
 
-  // We will randomly pick or not a point with probability load_ratio
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
-
   // Peek at the first valid line and see how many elements it has
   std::string line;
   while ( getline(file, line, '\n') ) {
@@ -122,7 +105,6 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       break;
   }
 
-  file.clear(); file.seekg(0, std::ios_base::beg); // go back to start of file
   strncpy(temp, line.c_str(), bufSize);
   const char* token = strtok (temp, sep);
   int numTokens = 0;
@@ -135,176 +117,168 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
                           << "line of file: " << file_name << "\n" );
   }
 
-  if (!csv_conv.is_configured()){
-    if (numTokens > 20){
-      is_lola_rdr_format = true;
-      if (verbose)
-        vw::vw_out() << "Guessing file " << file_name <<
-	  " to be in LOLA RDR PointPerRow format.\n";
-    }else{
-      is_lola_rdr_format = false;
-      if (verbose)
-        vw::vw_out() << "Guessing file " << file_name
-                     << " to be in latitude,longitude,height above datum (meters) format.\n";
-    }
-  }
-  // TODO: We parse these guessed file types manually but we should
-  // use a CsvConv object to do it!!!!!
-
-  if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
-    vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
-              << " LOLA RDR format, yet the datum semi-axes are not equal "
-              << "as expected for the Moon.\n" );
+  if (numTokens > 20){
+    if (verbose)
+      vw::vw_out() << "Guessing file " << file_name <<
+        " to be in LOLA RDR PointPerRow format.\n";
+    return true;
   }
 
-  bool shift_was_calc = false;
-  bool is_first_line  = true;
-  int points_count = 0;
-  mean_longitude = 0.0;
-  line = "";
-  while ( getline(file, line, '\n') ){
-
-    if (!is_first_line && !line.empty() && line[0] == '#') {
-      vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
-      continue;
-    }
-    
-    if (points_count >= num_points_to_load)
-      break;
+  if (verbose)
+    vw::vw_out() << "Guessing file " << file_name
+                 << " to be in latitude,longitude,height above datum (meters) format.\n";
+  return false;
+}
 
-    if (!is_valid_csv_line(line))
-      continue;
+bool parse_plain_csv_line(std::string const& line, bool is_lola_rdr_format,
+                          vw::cartography::GeoReference const& geo,
+                          bool & is_first_line, double & lon, double & lat,
+                          vw::Vector3 & xyz){
 
-    // Randomly skip a percentage of points
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
-      continue;
+  // We went with C-style file reading instead of C++ in this instance
+  // because we found it to be significantly faster on large files.
+  std::string sep_str = csv_separator();
+  const char* sep = sep_str.c_str();
 
-    // We went with C-style file reading instead of C++ in this instance
-    // because we found it to be significantly faster on large files.
+  const int bufSize = 1024;
+  char temp[bufSize];
 
-    vw::Vector3 xyz;
-    double lon = 0.0, lat = 0.0;
+  if (!is_lola_rdr_format){
 
-    if (csv_conv.is_configured()){
+    // lat,lon,height format
+    double height;
 
-      // Parse custom CSV file with given format string
-      bool success;
-      CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
-      if (!success)
-        continue;
+    strncpy(temp, line.c_str(), bufSize);
+    const char* token = strtok(temp, sep); null_check(token, line);
+    int ret = sscanf(token, "%lg", &lat);
 
-      xyz = csv_conv.csv_to_cartesian(vals, geo);
+    token = strtok(NULL, sep); null_check(token, line);
+    ret += sscanf(token, "%lg", &lon);
 
-      // Decide if the point is in the box. Also save for the future
-      // the longitude of the point, we'll use it to compute the mean longitude.
-      vw::Vector2 lonlat = csv_conv.csv_to_lonlat(vals, geo);
-      lon = lonlat[0]; // Needed for mean calculation below
-      lat = lonlat[1];
+    token = strtok(NULL, sep); null_check(token, line);
+    ret += sscanf(token, "%lg", &height);
 
-      // TODO: We really need a lonlat bbox function that handles wraparound!!!!!!
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)
-                              && !lonlat_box.contains(lonlat+vw::Vector2(360,0))
-                              && !lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
-        continue;
+    // Be prepared for the fact that the first line may be the header.
+    if (ret != 3){
+      if (!is_first_line){
+        vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
+      }else{
+        is_first_line = false;
+        return false;
       }
+    }
+    is_first_line = false;
 
-    }else if (!is_lola_rdr_format){
-
-      // lat,lon,height format
-      double height;
+    vw::Vector3 llh( lon, lat, height );
+    xyz = geo.datum().geodetic_to_cartesian( llh );
+    if ( xyz == vw::Vector3() || !(xyz == xyz) ) return false; // invalid and NaN check
 
-      strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
-      int ret = sscanf(token, "%lg", &lat);
+    return true;
+  }
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lon);
+  // Load a RDR_*PointPerRow_csv_table.csv file used for LOLA. Code
+  // copied from Ara Nefian's lidar2dem tool.
+  // We will ignore lines which do not start with year (or a value that
+  // cannot be converted into an integer greater than zero, specifically).
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &height);
+  int year, month, day, hour, min;
+  double rad, sec, is_invalid;
 
-      // Be prepared for the fact that the first line may be the header.
-      if (ret != 3){
-        if (!is_first_line){
-          vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
-        }else{
-          is_first_line = false;
-          continue;
-        }
-      }
+  strncpy(temp, line.c_str(), bufSize);
+  const char* token = strtok(temp, sep); null_check(token, line);
+
+  int ret = sscanf(token, "%d-%d-%dT%d:%d:%lg", &year, &month, &day, &hour,
+                   &min, &sec);
+  if( year <= 0 )
+    return false;
+
+  token = strtok(NULL, sep); null_check(token, line);
+  ret += sscanf(token, "%lg", &lon);
+
+  token = strtok(NULL, sep); null_check(token, line);
+  ret += sscanf(token, "%lg", &lat);
+  token = strtok(NULL, sep); null_check(token, line);
+  ret += sscanf(token, "%lg", &rad);
+  rad *= 1000; // km to m
+
+  // Scan 7 more fields, until we get to the is_invalid flag.
+  for (int i = 0; i < 7; i++)
+    token = strtok(NULL, sep); null_check(token, line);
+  ret += sscanf(token, "%lg", &is_invalid);
+
+  // Be prepared for the fact that the first line may be the header.
+  if (ret != 10){
+    if (!is_first_line){
+      vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
+    }else{
       is_first_line = false;
+      return false;
+    }
+  }
+  is_first_line = false;
 
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+  if (is_invalid)
+    return false;
 
-      vw::Vector3 llh( lon, lat, height );
-      xyz = geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) ) continue; // invalid and NaN check
+  vw::Vector3 lonlatrad( lon, lat, 0 );
 
-    }else{
+  xyz = geo.datum().geodetic_to_cartesian( lonlatrad );
+  if ( xyz == vw::Vector3() || !(xyz == xyz) )
+    return false; // invalid and NaN check
+
+  // Adjust the point so that it is at the right distance from
+  // planet center.
+  xyz = rad*(xyz/norm_2(xyz));
+
+  return true;
+}
 
-      // Load a RDR_*PointPerRow_csv_table.csv file used for LOLA. Code
-      // copied from Ara Nefian's lidar2dem tool.
-      // We will ignore lines which do not start with year (or a value that
-      // cannot be converted into an integer greater than zero, specifically).
+int load_csv_aux(std::string const& file_name, int num_points_to_load,
+                 vw::BBox2 const& lonlat_box,
+                 bool calc_shift, vw::Vector3 & shift,
+                 vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
+                 bool & is_lola_rdr_format, double & mean_longitude,
+                 bool verbose, DoubleMatrix & data){
 
-      int year, month, day, hour, min;
-      double lat, rad, sec, is_invalid;
+  // Note: The input CsvConv object is responsible for parsing out the
+  //       type of information contained in the CSV file.
 
-      strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
+  is_lola_rdr_format = false;
 
-      int ret = sscanf(token, "%d-%d-%dT%d:%d:%lg", &year, &month, &day, &hour,
-                       &min, &sec);
-      if( year <= 0 )
-        continue;
+  int num_total_points = csv_file_size(file_name);
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lon);
-
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lat);
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &rad);
-      rad *= 1000; // km to m
-
-      // Scan 7 more fields, until we get to the is_invalid flag.
-      for (int i = 0; i < 7; i++)
-        token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &is_invalid);
-
-      // Be prepared for the fact that the first line may be the header.
-      if (ret != 10){
-        if (!is_first_line){
-          vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
-        }else{
-          is_first_line = false;
-          continue;
-        }
-      }
-      is_first_line = false;
+  std::ifstream file( file_name.c_str() );
+  if( !file ) {
+    vw_throw( vw::IOErr() << "Unable to open file \"" << file_name << "\"" );
+  }
 
-      if (is_invalid)
-        continue;
+  // We will randomly pick or not a point with probability load_ratio
+  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
 
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
 
-      vw::Vector3 lonlatrad( lon, lat, 0 );
+  bool guessed_lola = guess_lola_rdr_format(file_name, verbose && !csv_conv.is_configured());
+  if (!csv_conv.is_configured())
+    is_lola_rdr_format = guessed_lola;
+  // TODO: We parse these guessed file types manually but we should
+  // use a CsvConv object to do it!!!!!
 
-      xyz = geo.datum().geodetic_to_cartesian( lonlatrad );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
+  if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
+    vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
+              << " LOLA RDR format, yet the datum semi-axes are not equal "
+              << "as expected for the Moon.\n" );
+  }
 
-      // Adjust the point so that it is at the right distance from
-      // planet center.
-      xyz = rad*(xyz/norm_2(xyz));
-    }
+  bool shift_was_calc = false;
+  bool is_first_line  = true;
+  int points_count = 0;
+  mean_longitude = 0.0;
 
+  // Store a point. Throw an error if the lon and lat are not within
+  // bounds. Note that we allow some slack for lon, perhaps the point
+  // cloud is say from 350 to 370 degrees.
+  boost::function<void(vw::Vector3 const&, double, double)> add_point
+    = [&](vw::Vector3 const& xyz, double lon, double lat) {
     if (calc_shift && !shift_was_calc){
       shift = xyz;
       shift_was_calc = true;
@@ -317,15 +291,61 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
     points_count++;
     mean_longitude += lon;
 
-    // Throw an error if the lon and lat are not within bounds.
-    // Note that we allow some slack for lon, perhaps the point
-    // cloud is say from 350 to 370 degrees.
     if (std::abs(lat) > 90.0)
       vw_throw(vw::ArgumentErr() << "Invalid latitude value: "
                << lat << " in " << file_name << "\n");
     if (lon < -360.0 || lon > 2*360.0)
       vw_throw(vw::ArgumentErr() << "Invalid longitude value: "
                << lon << " in " << file_name << "\n");
+  };
+
+  if (csv_conv.is_configured()){
+
+    // A custom CSV file with given format string. The lines are
+    // randomly selected, parsed, converted, and checked against the
+    // box in parallel, in batches.
+    CsvConv::CsvBatchJob load_job = [&](CsvConv::CsvPointBatch const& batch) {
+      for (size_t it = 0; it < batch.xyz.size(); it++){
+        if (points_count >= num_points_to_load)
+          break;
+        if (batch.valid[it])
+          add_point(batch.xyz[it], batch.lonlat[it][0], batch.lonlat[it][1]);
+      }
+      return points_count < num_points_to_load;
+    };
+    csv_conv.read_csv_points(file_name, geo, lonlat_box, load_ratio, load_job);
+
+  }else{
+
+    // The lat,lon,height or LOLA RDR format
+    std::string line;
+    while (points_count < num_points_to_load && getline(file, line, '\n')){
+
+      if (!is_first_line && !line.empty() && line[0] == '#') {
+        vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
+        continue;
+      }
+
+      if (!is_valid_csv_line(line))
+        continue;
+
+      // Randomly skip a percentage of points
+      double r = (double)std::rand()/(double)RAND_MAX;
+      if (r > load_ratio)
+        continue;
+
+      vw::Vector3 xyz;
+      double lon = 0.0, lat = 0.0;
+      if (!parse_plain_csv_line(line, is_lola_rdr_format, geo, is_first_line,
+                                lon, lat, xyz))
+        continue;
+
+      // Skip points outside the given box
+      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
+        continue;
+
+      add_point(xyz, lon, lat);
+    }
   }
   data.conservativeResize(Eigen::NoChange, points_count);
 
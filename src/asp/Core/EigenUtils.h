@@ -46,6 +46,21 @@ const int DIM = 3;
 // Return at most m random points out of the input point cloud.
 void random_pc_subsample(int m, DoubleMatrix& points);
   
+// Guess from the number of fields in its first valid line if a CSV
+// file with no --csv-format is in the LOLA RDR PointPerRow format,
+// rather than as latitude,longitude,height above datum.
+bool guess_lola_rdr_format(std::string const& file_name, bool verbose);
+
+// Parse a line of a CSV file with no --csv-format, which is either
+// latitude,longitude,height above datum or in the LOLA RDR format, and
+// convert it to ECEF. Returns false if the line should be skipped. A
+// line which fails to parse is an error, unless it is the first line,
+// which may be a header.
+bool parse_plain_csv_line(std::string const& line, bool is_lola_rdr_format,
+                          vw::cartography::GeoReference const& geo,
+                          bool & is_first_line, double & lon, double & lat,
+                          vw::Vector3 & xyz);
+
 // Load a csv file, perhaps sub-sampling it along the way
 void load_csv(std::string const& file_name,
               int num_points_to_load,
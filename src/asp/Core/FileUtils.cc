@@ -17,6 +17,9 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
+#include <boost/cstdint.hpp>
+
+#include <iomanip>
 
 #include <asp/Core/FileUtils.h>
 
@@ -61,6 +64,53 @@ namespace asp{
     return is_latest_timestamp(test_file, vec);
   }
 
+  // 64-bit FNV-1a. It is stable across platforms and runs, unlike std::hash.
+  namespace {
+    const boost::uint64_t FNV_OFFSET = 14695981039346656037ULL;
+    const boost::uint64_t FNV_PRIME  = 1099511628211ULL;
+    inline void fnv1a(const char* data, size_t len, boost::uint64_t & hash) {
+      for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= FNV_PRIME;
+      }
+    }
+  }
+
+  std::string content_hash(std::vector<std::string> const& files,
+                           std::string const& extra) {
+
+    boost::uint64_t hash = FNV_OFFSET;
+    std::vector<char> buf(1024*1024);
+    for (size_t i = 0; i < files.size(); i++) {
+      std::ifstream ifs(files[i].c_str(), std::ios::binary);
+      if (!ifs.good()) {
+        fnv1a(files[i].c_str(), files[i].size(), hash);
+        continue;
+      }
+      while (ifs) {
+        ifs.read(&buf[0], buf.size());
+        fnv1a(&buf[0], ifs.gcount(), hash);
+      }
+      // Separate the files, so that moving bytes across them changes the hash
+      char sep = '\0';
+      fnv1a(&sep, 1, hash);
+    }
+    fnv1a(extra.c_str(), extra.size(), hash);
+
+    std::ostringstream os;
+    os << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return os.str();
+  }
+
+  std::string file_fingerprint(std::string const& file) {
+    std::ostringstream os;
+    os << file;
+    if (file != "" && boost::filesystem::exists(file))
+      os << " " << boost::filesystem::file_size(file)
+         << " " << boost::filesystem::last_write_time(file);
+    return os.str();
+  }
+
   void read_1d_points(std::string const& file, std::vector<double> & points){
 
     std::ifstream ifs(file.c_str());
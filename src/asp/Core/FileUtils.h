@@ -22,6 +22,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <vw/Math/Vector.h>
 
@@ -40,6 +41,16 @@ namespace asp {
                            std::string const& f1, std::string const& f2,
                            std::string const& f3, std::string const& f4);
 
+  /// A hash of the contents of the given files, followed by the given
+  /// string, as 16 hex digits. A missing file contributes only its name.
+  /// Used to look up results computed earlier from the same inputs.
+  std::string content_hash(std::vector<std::string> const& files,
+                           std::string const& extra);
+
+  /// The path, size, and modification time of a file, for identifying
+  /// files which are too large to hash their contents.
+  std::string file_fingerprint(std::string const& file);
+
   void read_1d_points(std::string const& file, std::vector<double> & points);
   void read_2d_points(std::string const& file, std::vector<vw::Vector2> & points);
   void read_3d_points(std::string const& file, std::vector<vw::Vector3> & points);
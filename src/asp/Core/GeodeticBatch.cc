@@ -0,0 +1,187 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/GeodeticBatch.h>
+
+#include <proj_api.h>
+
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+using namespace vw::cartography;
+
+namespace asp {
+
+void batch_cartesian_to_geodetic(Datum const& datum, PointBlock & points) {
+
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const size_t num = points.size();
+  if (num == 0)
+    return;
+  double * x = &points.x[0], * y = &points.y[0], * z = &points.z[0];
+
+  // With a meridian offset, leave it to the datum to apply it
+  if (datum.meridian_offset() != 0) {
+    for (size_t it = 0; it < num; it++) {
+      Vector3 llh = datum.cartesian_to_geodetic(Vector3(x[it], y[it], z[it]));
+      x[it] = llh[0]; y[it] = llh[1]; z[it] = llh[2];
+    }
+    return;
+  }
+
+  // The closed-form solution of H. Vermeille, "Direct transformation
+  // from geocentric coordinates to geodetic coordinates", Journal of
+  // Geodesy, 2002. It holds outside a small region around the center
+  // of the ellipsoid, where the datum is used instead.
+  const double a  = datum.semi_major_axis(), b = datum.semi_minor_axis();
+  const double e2 = 1.0 - (b*b)/(a*a), e4 = e2*e2, inv_a2 = 1.0/(a*a);
+  const double deg = 180.0/M_PI;
+  for (size_t it = 0; it < num; it++) {
+    double X = x[it], Y = y[it], Z = z[it];
+    if (X == 0 && Y == 0 && Z == 0) { // Invalid point
+      x[it] = nan; y[it] = nan; z[it] = nan;
+      continue;
+    }
+    double w2 = X*X + Y*Y;
+    double p  = w2*inv_a2;
+    double q  = (1.0 - e2)*inv_a2*Z*Z;
+    double r  = (p + q - e4)/6.0;
+    if (r <= 0 || e2 < 0) {
+      Vector3 llh = datum.cartesian_to_geodetic(Vector3(X, Y, Z));
+      x[it] = llh[0]; y[it] = llh[1]; z[it] = llh[2];
+      continue;
+    }
+    double s  = e4*p*q/(4.0*r*r*r);
+    double t  = std::cbrt(1.0 + s + std::sqrt(s*(2.0 + s)));
+    double u  = r*(1.0 + t + 1.0/t);
+    double v  = std::sqrt(u*u + e4*q);
+    double uw = e2*(u + v - q)/(2.0*v);
+    double k  = std::sqrt(u + v + uw*uw) - uw;
+    double D  = k*std::sqrt(w2)/(k + e2);
+    double dz = std::sqrt(D*D + Z*Z);
+    x[it] = std::atan2(Y, X)*deg;
+    y[it] = 2.0*std::atan2(Z, D + dz)*deg;
+    z[it] = (k + e2 - 1.0)/k*dz;
+  }
+}
+
+void batch_recenter_longitude(double center, PointBlock & points) {
+  const size_t num = points.size();
+  for (size_t it = 0; it < num; it++) {
+    double & lon = points.x[it];
+    if (lon != lon) // NaN
+      continue;
+    while (lon < center - 180.0) lon += 360.0;
+    while (lon > center + 180.0) lon -= 360.0;
+  }
+}
+
+namespace {
+
+  // A PROJ projection with its own context, so that it can be used
+  // while other threads use their own.
+  class ProjHandle {
+    projCtx m_ctx;
+    projPJ  m_proj, m_latlong;
+  public:
+    ProjHandle(std::string const& proj4_str): m_ctx(pj_ctx_alloc()), m_proj(NULL), m_latlong(NULL) {
+      if (m_ctx)
+        m_proj = pj_init_plus_ctx(m_ctx, proj4_str.c_str());
+      if (m_proj)
+        m_latlong = pj_latlong_from_proj(m_proj);
+    }
+    ~ProjHandle() {
+      if (m_latlong) pj_free(m_latlong);
+      if (m_proj)    pj_free(m_proj);
+      if (m_ctx)     pj_ctx_free(m_ctx);
+    }
+    bool is_valid() const { return m_latlong != NULL; }
+    projPJ proj   () const { return m_proj;    }
+    projPJ latlong() const { return m_latlong; }
+  };
+
+  bool is_lonlat(GeoReference const& georef) {
+    std::string proj4 = georef.proj4_str();
+    return proj4.find("+proj=longlat") != std::string::npos ||
+           proj4.find("+proj=latlong") != std::string::npos;
+  }
+
+  // Use the georeference for each point, which is cheap if it is not projected
+  void geodetic_to_point_each(GeoReference const& georef, PointBlock & points) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (size_t it = 0; it < points.size(); it++) {
+      if (points.x[it] != points.x[it] || points.y[it] != points.y[it]) {
+        points.x[it] = nan; points.y[it] = nan; points.z[it] = nan;
+        continue;
+      }
+      try {
+        Vector3 P = georef.geodetic_to_point(Vector3(points.x[it], points.y[it], points.z[it]));
+        points.x[it] = P[0]; points.y[it] = P[1]; points.z[it] = P[2];
+      } catch (...) {
+        points.x[it] = nan; points.y[it] = nan; points.z[it] = nan;
+      }
+    }
+  }
+}
+
+void batch_geodetic_to_point(GeoReference const& georef, PointBlock & points) {
+
+  const size_t num = points.size();
+  if (num == 0)
+    return;
+  if (is_lonlat(georef)) {
+    geodetic_to_point_each(georef, points);
+    return;
+  }
+
+  ProjHandle proj(georef.overall_proj4_str());
+  if (!proj.is_valid()) {
+    geodetic_to_point_each(georef, points);
+    return;
+  }
+
+  // PROJ takes radians. The NaN points are given a harmless location,
+  // and are restored after. The heights are not changed.
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const double rad = M_PI/180.0;
+  std::vector<char>   invalid(num, 0);
+  std::vector<double> px(num), py(num);
+  for (size_t it = 0; it < num; it++) {
+    invalid[it] = (points.x[it] != points.x[it] || points.y[it] != points.y[it]);
+    px[it] = invalid[it] ? 0.0 : points.x[it]*rad;
+    py[it] = invalid[it] ? 0.0 : points.y[it]*rad;
+  }
+
+  // If PROJ fails for the whole block, do the points one at a time,
+  // so that only the bad ones are lost.
+  if (pj_transform(proj.latlong(), proj.proj(), long(num), 1, &px[0], &py[0], NULL) != 0) {
+    geodetic_to_point_each(georef, points);
+    return;
+  }
+
+  for (size_t it = 0; it < num; it++) {
+    if (invalid[it] || px[it] == HUGE_VAL || py[it] == HUGE_VAL) {
+      points.x[it] = nan; points.y[it] = nan; points.z[it] = nan;
+    } else {
+      points.x[it] = px[it]; points.y[it] = py[it];
+    }
+  }
+}
+
+} // end namespace asp
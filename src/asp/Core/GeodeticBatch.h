@@ -0,0 +1,150 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file GeodeticBatch.h
+///
+/// Conversions of whole blocks of points between cartesian, geodetic,
+/// and projected coordinates. The points are stored as separate arrays
+/// of coordinates, and each conversion is a plain loop over them, with
+/// a closed-form, non-iterative, formula for the ellipsoid and a
+/// single PROJ call for the projection, rather than a call through the
+/// datum and the georeference for each point. The results agree with
+/// the per-point functions of the datum and the georeference to within
+/// numerical precision.
+
+#ifndef __ASP_CORE_GEODETIC_BATCH_H__
+#define __ASP_CORE_GEODETIC_BATCH_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+namespace asp {
+
+  /// Points as separate arrays of their coordinates
+  struct PointBlock {
+    std::vector<double> x, y, z;
+    size_t size() const { return x.size(); }
+    void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+  };
+
+  /// Convert cartesian points to longitude, latitude, and height above
+  /// the datum, in place. As for the datum, zero points, which are
+  /// invalid, become NaN.
+  void batch_cartesian_to_geodetic(vw::cartography::Datum const& datum, PointBlock & points);
+
+  /// Shift the longitudes by multiples of 360 degrees to be within 180
+  /// degrees of the given center.
+  void batch_recenter_longitude(double center, PointBlock & points);
+
+  /// Convert longitude, latitude, and height to the projected
+  /// coordinates of the georeference and the height, in place. Points
+  /// which fail to project, or are NaN, become NaN.
+  void batch_geodetic_to_point(vw::cartography::GeoReference const& georef, PointBlock & points);
+
+  /// Convert a cartesian point image to the projected coordinates of a
+  /// georeference and height, a block at a time. The longitudes are
+  /// first made to be within 180 degrees of center_lon, then the
+  /// offset is added to longitude, latitude, and height. Invalid points
+  /// become NaN. Same as applying the per-point functions
+  /// cartesian_to_geodetic(), recenter_longitude(),
+  /// point_image_offset(), and geodetic_to_point() in turn.
+  template <class ImageT>
+  class GeodeticProjectionView: public vw::ImageViewBase<GeodeticProjectionView<ImageT> > {
+    ImageT                        m_image;
+    vw::cartography::GeoReference m_georef;
+    double                        m_center_lon;
+    vw::Vector3                   m_offset;
+
+  public:
+    typedef vw::Vector3 pixel_type;
+    typedef vw::Vector3 result_type;
+    typedef vw::ProceduralPixelAccessor<GeodeticProjectionView> pixel_accessor;
+
+    GeodeticProjectionView(ImageT const& image, vw::cartography::GeoReference const& georef,
+                           double center_lon, vw::Vector3 const& offset):
+      m_image(image), m_georef(georef), m_center_lon(center_lon), m_offset(offset) {}
+
+    inline vw::int32 cols  () const { return m_image.cols(); }
+    inline vw::int32 rows  () const { return m_image.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    // Single pixels are converted with the per-point functions, which
+    // avoids setting up the projection each time.
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const {
+      vw::Vector3 llh = m_georef.datum().cartesian_to_geodetic(m_image(col, row));
+      while (llh[0] < m_center_lon - 180.0) llh[0] += 360.0;
+      while (llh[0] > m_center_lon + 180.0) llh[0] -= 360.0;
+      return m_georef.geodetic_to_point(llh + m_offset);
+    }
+
+    /// \cond INTERNAL
+    typedef vw::CropView<vw::ImageView<result_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      vw::ImageView<result_type> tile = vw::crop(m_image, bbox);
+      size_t num = size_t(tile.cols()) * tile.rows();
+      PointBlock points;
+      points.resize(num);
+      result_type * data = tile.data();
+      for (size_t it = 0; it < num; it++) {
+        points.x[it] = data[it][0];
+        points.y[it] = data[it][1];
+        points.z[it] = data[it][2];
+      }
+
+      batch_cartesian_to_geodetic(m_georef.datum(), points);
+      batch_recenter_longitude(m_center_lon, points);
+      if (m_offset != vw::Vector3()) {
+        for (size_t it = 0; it < num; it++) {
+          points.x[it] += m_offset[0];
+          points.y[it] += m_offset[1];
+          points.z[it] += m_offset[2];
+        }
+      }
+      batch_geodetic_to_point(m_georef, points);
+
+      for (size_t it = 0; it < num; it++)
+        data[it] = vw::Vector3(points.x[it], points.y[it], points.z[it]);
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT> inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+    /// \endcond
+  };
+
+  template <class ImageT>
+  GeodeticProjectionView<ImageT>
+  geodetic_projection(vw::ImageViewBase<ImageT> const& image,
+                      vw::cartography::GeoReference const& georef,
+                      double center_lon, vw::Vector3 const& offset = vw::Vector3()) {
+    return GeodeticProjectionView<ImageT>(image.impl(), georef, center_lon, offset);
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_GEODETIC_BATCH_H__
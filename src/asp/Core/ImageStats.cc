@@ -0,0 +1,227 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/ImageStats.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+  const std::string STATS_CACHE_HEADER = "ASP image statistics, version 1";
+
+  bool cache_enabled() {
+    return getenv("ASP_NO_CAMERA_CACHE") == NULL;
+  }
+
+  std::string stats_cache_file(std::string const& image_file) {
+    return image_file + ".stats.cache";
+  }
+}
+
+namespace asp {
+
+StreamingStats::StreamingStats(): m_count(0), m_min(0), m_max(0), m_mean(0), m_m2(0),
+                                  m_lo(0), m_width(0) {}
+
+double StreamingStats::stddev() const {
+  if (m_count <= 0)
+    return 0;
+  return sqrt(m_m2 / m_count);
+}
+
+int StreamingStats::bin(double val) const {
+  if (m_width <= 0)
+    return 0;
+  int b = int(floor((val - m_lo) / m_width));
+  return std::min(std::max(b, 0), NUM_BINS - 1);
+}
+
+void StreamingStats::cover(double val) {
+
+  if (m_width <= 0) {
+    // All values so far were equal to m_lo and are in the first bin.
+    // Make the range twice what is needed for both values.
+    if (val == m_lo)
+      return;
+    double old_lo = m_lo, count = m_bins[0];
+    m_bins[0] = 0;
+    m_lo    = std::min(val, old_lo);
+    m_width = 2.0 * std::abs(val - old_lo) / NUM_BINS;
+    m_bins[bin(old_lo)] += count;
+    return;
+  }
+
+  // Double the bin size, growing the range down or up
+  while (val < m_lo) {
+    std::vector<double> bins(NUM_BINS, 0);
+    for (int b = 0; b < NUM_BINS; b++)
+      bins[(b + NUM_BINS) / 2] += m_bins[b];
+    m_bins.swap(bins);
+    m_lo   -= NUM_BINS * m_width;
+    m_width *= 2;
+  }
+  while (val >= m_lo + NUM_BINS * m_width) {
+    std::vector<double> bins(NUM_BINS, 0);
+    for (int b = 0; b < NUM_BINS; b++)
+      bins[b / 2] += m_bins[b];
+    m_bins.swap(bins);
+    m_width *= 2;
+  }
+}
+
+void StreamingStats::add_count(double val, double count) {
+  if (!std::isfinite(val) || count <= 0)
+    return;
+
+  if (m_count == 0) {
+    m_bins.assign(NUM_BINS, 0);
+    m_lo = m_min = m_max = val;
+  } else {
+    cover(val);
+  }
+  m_bins[bin(val)] += count;
+
+  // Combine the moments with those of 'count' copies of the value
+  double total = m_count + count, delta = val - m_mean;
+  m_mean += delta * count / total;
+  m_m2   += delta * delta * m_count * count / total;
+  m_count = total;
+  m_min   = std::min(m_min, val);
+  m_max   = std::max(m_max, val);
+}
+
+void StreamingStats::merge(StreamingStats const& other) {
+  if (other.m_count == 0)
+    return;
+
+  // The histogram of the other object is added bin by bin, at the bin
+  // centers, and the moments are combined exactly afterwards.
+  double count = m_count, mean = m_mean, m2 = m_m2, lo = m_min, hi = m_max;
+  for (int b = 0; b < NUM_BINS; b++) {
+    if (other.m_bins[b] == 0)
+      continue;
+    double val = other.m_lo;
+    if (other.m_width > 0)
+      val = std::min(std::max(other.m_lo + (b + 0.5) * other.m_width, other.m_min), other.m_max);
+    add_count(val, other.m_bins[b]);
+  }
+
+  if (count == 0) {
+    m_mean = other.m_mean;
+    m_m2   = other.m_m2;
+    m_min  = other.m_min;
+    m_max  = other.m_max;
+  } else {
+    double total = count + other.m_count, delta = other.m_mean - mean;
+    m_mean = mean + delta * other.m_count / total;
+    m_m2   = m2 + other.m_m2 + delta * delta * count * other.m_count / total;
+    m_min  = std::min(lo, other.m_min);
+    m_max  = std::max(hi, other.m_max);
+  }
+  m_count = count + other.m_count;
+}
+
+double StreamingStats::quantile(double q) const {
+  if (m_count == 0)
+    return 0;
+  if (q <= 0 || m_width <= 0)
+    return (q >= 1) ? m_max : m_min;
+  if (q >= 1)
+    return m_max;
+
+  // Interpolate within the bin where the count reaches the target
+  double target = q * m_count, sum = 0;
+  for (int b = 0; b < NUM_BINS; b++) {
+    if (sum + m_bins[b] >= target && m_bins[b] > 0) {
+      double val = m_lo + m_width * (b + (target - sum) / m_bins[b]);
+      return std::min(std::max(val, m_min), m_max);
+    }
+    sum += m_bins[b];
+  }
+  return m_max;
+}
+
+std::string image_stats_key(std::string const& image_file, double nodata) {
+  std::ostringstream os;
+  os << std::setprecision(17) << image_file;
+  try {
+    os << " " << fs::file_size(image_file) << " " << fs::last_write_time(image_file);
+  } catch(...) {}
+  os << " " << nodata;
+  return os.str();
+}
+
+bool read_image_stats_cache(std::string const& image_file, std::string const& key,
+                            std::vector<double> & stats) {
+  try {
+    if (!cache_enabled() || !fs::exists(stats_cache_file(image_file)))
+      return false;
+    std::ifstream ifs(stats_cache_file(image_file).c_str());
+    std::string header, cache_key;
+    std::getline(ifs, header);
+    std::getline(ifs, cache_key);
+    if (!ifs.good() || header != STATS_CACHE_HEADER || cache_key != key)
+      return false;
+    std::vector<double> vals;
+    double val;
+    while (ifs >> val)
+      vals.push_back(val);
+    if (vals.empty())
+      return false;
+    stats = vals;
+    return true;
+  } catch(...) {}
+  return false;
+}
+
+// Write to a file with a unique name, then rename it, so that concurrent
+// processes never see partial files. Failures, such as in a read-only
+// directory, are ignored.
+void write_image_stats_cache(std::string const& image_file, std::string const& key,
+                             std::vector<double> const& stats) {
+  if (!cache_enabled())
+    return;
+  try {
+    fs::path tmp_file = fs::path(stats_cache_file(image_file)).parent_path()
+      / fs::unique_path("%%%%-%%%%-%%%%.stats.tmp");
+    {
+      std::ofstream ofs(tmp_file.string().c_str());
+      ofs << STATS_CACHE_HEADER << "\n" << key << "\n" << std::setprecision(17);
+      for (size_t it = 0; it < stats.size(); it++)
+        ofs << stats[it] << "\n";
+      if (!ofs.good()) {
+        ofs.close();
+        fs::remove(tmp_file);
+        return;
+      }
+    }
+    fs::rename(tmp_file, stats_cache_file(image_file));
+  } catch(...) {}
+}
+
+} // end namespace asp
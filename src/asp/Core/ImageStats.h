@@ -0,0 +1,148 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ImageStats.h
+///
+/// Statistics of an image in one pass, possibly split among threads.
+/// The min, max, mean and standard deviation are exact. The percentiles
+/// come from a histogram whose range grows as needed, by doubling the
+/// bin size, so they are accurate to within a bin, that is, to the
+/// value range over a few thousand. Histograms for parts of an image
+/// can be merged, so the parts can be done by separate threads.
+///
+/// The statistics can be cached next to the image, as <image>.stats.cache,
+/// along with a key which must identify the file and how it was masked,
+/// so that all tools and output prefixes share them. Set the environment
+/// variable ASP_NO_CAMERA_CACHE to turn this off, as for the camera caches.
+
+#ifndef __ASP_CORE_IMAGE_STATS_H__
+#define __ASP_CORE_IMAGE_STATS_H__
+
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class StreamingStats {
+  public:
+    static const int NUM_BINS = 4096;
+
+    StreamingStats();
+
+    /// Values which are not finite are ignored
+    void add(double val) { add_count(val, 1); }
+
+    /// Add the values seen by another object
+    void merge(StreamingStats const& other);
+
+    double count () const { return m_count; }
+    double min   () const { return m_min;   }
+    double max   () const { return m_max;   }
+    double mean  () const { return m_mean;  }
+    double stddev() const;
+
+    /// Value at a fraction of the way through the sorted values. Zero if
+    /// no values were added.
+    double quantile(double q) const;
+
+  private:
+    void add_count(double val, double count);
+
+    // Grow the histogram range, if needed, to include the given value
+    void cover(double val);
+
+    int bin(double val) const;
+
+    double m_count, m_min, m_max, m_mean, m_m2; // m_m2 is the sum of squared deviations
+    double m_lo, m_width;                       // The histogram starts at m_lo
+    std::vector<double> m_bins;
+  };
+
+  /// Rows of the image which each thread does at a time
+  const int STATS_BAND_ROWS = 64;
+
+  template <class ViewT>
+  class ImageStatsTask: public vw::Task, private boost::noncopyable {
+    ViewT const&     m_view;
+    vw::BBox2i       m_box;
+    StreamingStats & m_stats;
+  public:
+    ImageStatsTask(ViewT const& view, vw::BBox2i const& box, StreamingStats & stats):
+      m_view(view), m_box(box), m_stats(stats) {}
+    virtual void operator()() {
+      vw::ImageView<typename ViewT::pixel_type> band = crop(m_view, m_box);
+      for (int row = 0; row < band.rows(); row++) {
+        for (int col = 0; col < band.cols(); col++) {
+          if (is_valid(band(col, row)))
+            m_stats.add(vw::compound_select_channel<double>(remove_mask(band(col, row)), 0));
+        }
+      }
+    }
+  };
+
+  /// Statistics of the valid pixels of a masked, single-channel image,
+  /// such as a subsampled one, found with the given number of threads.
+  /// The bands of the image are merged in order, so the results do not
+  /// depend on the number of threads.
+  template <class ViewT>
+  StreamingStats image_stats(vw::ImageViewBase<ViewT> const& view_base, int num_threads) {
+    ViewT const& view = view_base.impl();
+    int num_bands = (view.rows() + STATS_BAND_ROWS - 1) / STATS_BAND_ROWS;
+    std::vector<StreamingStats> band_stats(num_bands);
+    {
+      vw::FifoWorkQueue queue(std::max(num_threads, 1));
+      for (int band = 0; band < num_bands; band++) {
+        int start = band * STATS_BAND_ROWS;
+        vw::BBox2i box(0, start, view.cols(), std::min(STATS_BAND_ROWS, view.rows() - start));
+        boost::shared_ptr< ImageStatsTask<ViewT> >
+          task(new ImageStatsTask<ViewT>(view, box, band_stats[band]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    StreamingStats stats;
+    for (int band = 0; band < num_bands; band++)
+      stats.merge(band_stats[band]);
+    return stats;
+  }
+
+  /// A key for the cached statistics of an image, from its name, size
+  /// and modification time, and the no-data value below which it is masked.
+  std::string image_stats_key(std::string const& image_file, double nodata);
+
+  /// Read and write cached statistics. Reading fails if the key differs.
+  bool read_image_stats_cache(std::string const& image_file, std::string const& key,
+                              std::vector<double> & stats);
+  void write_image_stats_cache(std::string const& image_file, std::string const& key,
+                               std::vector<double> const& stats);
+
+} // end namespace asp
+
+#endif//__ASP_CORE_IMAGE_STATS_H__
@@ -22,6 +22,9 @@
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Stereo/StereoModel.h>
 
+#include <algorithm>
+#include <limits>
+
 using namespace vw;
 
 namespace asp {
@@ -113,6 +116,110 @@ namespace asp {
       norm_2( subvector( line, 0, 2 ) );
   }
 
+  /// Exact nearest neighbors of interest point descriptors, found by
+  /// comparing with all descriptors of the other image, an alternative
+  /// to the approximate FLANN search. ORB descriptors are packed in 64-bit
+  /// words and compared with the Hamming distance, others with the squared
+  /// L2 distance, as done by FLANN.
+  class BruteForceIpIndex {
+  public:
+    BruteForceIpIndex(): m_use_hamming(false), m_num_points(0), m_desc_len(0),
+                         m_num_words(0) {}
+
+    void load(ip::InterestPointList const& ip_list, bool use_hamming) {
+      m_use_hamming = use_hamming;
+      m_num_points  = ip_list.size();
+      m_desc_len    = ip_list.empty() ? 0 : ip_list.begin()->descriptor.size();
+      m_num_words   = (m_desc_len + 7) / 8;
+      if (m_use_hamming)
+        m_words.assign(m_num_points * m_num_words, 0);
+      else
+        m_values.resize(m_num_points * m_desc_len);
+
+      size_t count = 0;
+      for (ip::InterestPointList::const_iterator it = ip_list.begin();
+           it != ip_list.end(); it++) {
+        if (it->descriptor.size() != m_desc_len)
+          vw_throw(ArgumentErr() << "BruteForceIpIndex: Descriptors have different sizes.\n");
+        if (m_use_hamming)
+          pack(it->descriptor, &m_words[count * m_num_words]);
+        else
+          std::copy(it->descriptor.begin(), it->descriptor.end(),
+                    m_values.begin() + count * m_desc_len);
+        count++;
+      }
+    }
+
+    /// Same interface as FLANNTree::knn_search(). The distances are in
+    /// increasing order.
+    size_t knn_search(vw::Vector<float> const& desc, Vector<int> & indices,
+                      Vector<double> & distances, size_t k) const {
+
+      if (desc.size() != m_desc_len)
+        vw_throw(ArgumentErr() << "BruteForceIpIndex: Unexpected descriptor size.\n");
+
+      std::vector< std::pair<double, int> > best;
+      best.reserve(k + 1);
+      if (m_use_hamming) {
+        std::vector<uint64> query(m_num_words, 0);
+        if (m_num_words > 0)
+          pack(desc, &query[0]);
+        for (size_t p = 0; p < m_num_points; p++) {
+          const uint64 * words = &m_words[p * m_num_words];
+          int dist = 0;
+          for (size_t w = 0; w < m_num_words; w++)
+            dist += __builtin_popcountll(query[w] ^ words[w]);
+          add_candidate(best, k, dist, p);
+        }
+      } else {
+        for (size_t p = 0; p < m_num_points; p++) {
+          // Stop early once this can't be among the k best
+          double max_dist = (best.size() == k) ? best.back().first
+            : std::numeric_limits<double>::max();
+          const float * vals = &m_values[p * m_desc_len];
+          double dist = 0;
+          for (size_t d = 0; d < m_desc_len && dist < max_dist; d++) {
+            double diff = double(desc[d]) - double(vals[d]);
+            dist += diff * diff;
+          }
+          add_candidate(best, k, dist, p);
+        }
+      }
+
+      for (size_t i = 0; i < best.size(); i++) {
+        distances[i] = best[i].first;
+        indices  [i] = best[i].second;
+      }
+      return best.size();
+    }
+
+  private:
+
+    // Pack the descriptor values, as bytes, into 64-bit words
+    void pack(vw::Vector<float> const& desc, uint64 * words) const {
+      for (size_t d = 0; d < m_desc_len; d++) {
+        uint64 byte = static_cast<unsigned char>(desc[d]);
+        words[d / 8] |= (byte << (8 * (d % 8)));
+      }
+    }
+
+    // Keep the k candidates with the smallest distance, sorted
+    static void add_candidate(std::vector< std::pair<double, int> > & best,
+                              size_t k, double dist, size_t index) {
+      if (k == 0 || (best.size() == k && dist >= best.back().first))
+        return;
+      std::pair<double, int> val(dist, int(index));
+      best.insert(std::upper_bound(best.begin(), best.end(), val), val);
+      if (best.size() > k)
+        best.pop_back();
+    }
+
+    bool   m_use_hamming;
+    size_t m_num_points, m_desc_len, m_num_words;
+    std::vector<uint64> m_words;
+    std::vector<float>    m_values;
+  };
+
   // Local class definition -----
   class EpipolarLineMatchTask : public Task, private boost::noncopyable {
     typedef ip::InterestPointList::const_iterator IPListIter;
@@ -120,6 +227,7 @@ namespace asp {
     bool                            m_use_uchar_tree;
     math::FLANNTree<float        >& m_tree_float;
     math::FLANNTree<unsigned char>& m_tree_uchar;
+    BruteForceIpIndex const*        m_brute_force;
     IPListIter                      m_start, m_end;
     ip::InterestPointList const&    m_ip_other;
     camera::CameraModel            *m_cam1, *m_cam2;
@@ -131,6 +239,7 @@ namespace asp {
                            bool use_uchar_tree,
                            math::FLANNTree<float        >& tree_float,
                            math::FLANNTree<unsigned char>& tree_uchar,
+                           BruteForceIpIndex const* brute_force,
                            ip::InterestPointList::const_iterator start,
                            ip::InterestPointList::const_iterator end,
                            ip::InterestPointList const& ip2,
@@ -141,7 +250,7 @@ namespace asp {
                            std::vector<size_t>::iterator output ) :
       m_single_threaded_camera(single_threaded_camera),
       m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
-      m_start(start), m_end(end), m_ip_other(ip2),
+      m_brute_force(brute_force), m_start(start), m_end(end), m_ip_other(ip2),
       m_cam1(cam1), m_cam2(cam2),
       m_matcher( matcher ), m_camera_mutex(camera_mutex), m_output(output) {}
 
@@ -176,7 +285,9 @@ namespace asp {
 
         // Call the correct FLANN tree for the matching type
         size_t num_matches_valid = 0;
-        if (m_use_uchar_tree) {
+        if (m_brute_force != NULL) {
+          num_matches_valid = m_brute_force->knn_search( ip->descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+        } else if (m_use_uchar_tree) {
           vw::Vector<unsigned char> uchar_descriptor(ip->descriptor.size());
           for (size_t i=0; i<ip->descriptor.size(); ++i)
             uchar_descriptor[i] = static_cast<unsigned char>(ip->descriptor[i]);
@@ -264,9 +375,16 @@ namespace asp {
     Matrix<float        > ip2_matrix_float;
     Matrix<unsigned char> ip2_matrix_uchar;
 
-    // Pack the IP descriptors into a matrix and feed it to the chosen FLANNTree object
+    // Pack the IP descriptors into a matrix and feed it to the chosen FLANNTree object,
+    // or, if desired, to the exact brute force search.
     const bool use_uchar_FLANN = (ip_detect_method == DETECT_IP_METHOD_ORB);
-    if (use_uchar_FLANN) {
+    BruteForceIpIndex brute_force;
+    BruteForceIpIndex const* brute_force_ptr = NULL;
+    if (stereo_settings().ip_brute_force_matching) {
+      brute_force.load(ip2, use_uchar_FLANN);
+      brute_force_ptr = &brute_force;
+      vw_out(InfoMessage,"interest_point") << "Using brute force matching. Searching...\n";
+    } else if (use_uchar_FLANN) {
       ip_list_to_matrix(ip2, ip2_matrix_uchar);
       kd_uchar.load_match_data( ip2_matrix_uchar, vw::math::FLANN_DistType_Hamming );
     }else {
@@ -274,7 +392,8 @@ namespace asp {
       kd_float.load_match_data( ip2_matrix_float,  vw::math::FLANN_DistType_L2 );
     }
 
-    vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
+    if (brute_force_ptr == NULL)
+      vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
 
     FifoWorkQueue matching_queue; // Create a thread pool object
     Mutex camera_mutex;
@@ -302,7 +421,7 @@ namespace asp {
       std::advance( end_it, ip1_size / number_of_jobs );
       boost::shared_ptr<Task>
         match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-                    use_uchar_FLANN, kd_float, kd_uchar,
+                    use_uchar_FLANN, kd_float, kd_uchar, brute_force_ptr,
                     start_it, end_it,
                     ip2, cam1, cam2, *this,
                     camera_mutex, output_it ) );
@@ -312,7 +431,7 @@ namespace asp {
     }
     boost::shared_ptr<Task>
       match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-                  use_uchar_FLANN, kd_float, kd_uchar,
+                  use_uchar_FLANN, kd_float, kd_uchar, brute_force_ptr,
                   start_it, ip1.end(),
                   ip2, cam1, cam2, *this,
                   camera_mutex, output_it ) );
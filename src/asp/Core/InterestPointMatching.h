@@ -20,6 +20,8 @@
 #define __ASP_CORE_INTEREST_POINT_MATCHING_H__
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/ImageViewBase.h>
 #include <vw/Image/MaskViews.h>
 #include <vw/Camera/CameraModel.h>
@@ -32,8 +34,11 @@
 #include <vw/Math/Geometry.h>
 #include <vw/FileIO/FileUtils.h>
 
+#include <asp/Core/MatchFile.h>
 #include <asp/Core/StereoSettings.h>
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 
 // TODO: This function should live somewhere else!  It was pulled from vw->tools->ipmatch.cc
@@ -266,6 +271,11 @@ bool ip_matching_w_alignment(bool single_threaded_camera,
 
   /// Detect interest points
   ///
+  /// The image is processed in tiles of 1024^2 pixels in parallel, each
+  /// with its own cap on the number of points, and the points are
+  /// merged in the order of the tiles, so that the same ones are found,
+  /// and cached to file_path, no matter the number of threads.
+  ///
   /// This is not meant to be used directly. Please use ip_matching() or
   /// homography_ip_matching().
   template <class Image1T>
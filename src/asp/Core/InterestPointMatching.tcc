@@ -40,73 +40,39 @@ inline size_t remove_ip_bbox(vw::BBox2i const& roi, vw::ip::InterestPointList &
 
 
 
-template <class Image1T>
-void detect_ip(vw::ip::InterestPointList& ip,
-	       vw::ImageViewBase<Image1T> const& image,
-	       int ip_per_tile, std::string const file_path, double nodata) {
+/// The side of the tiles in which interest points are detected, the
+/// unit for --ip-per-tile, and the margin each tile is expanded by, so
+/// that the points near its edges are found as in the whole image.
+const int IP_DETECT_TILE_SIZE   = 1024;
+const int IP_DETECT_TILE_MARGIN = 64;
+
+/// Detect interest points in a tile in memory, and build their
+/// descriptors. The points are in the pixels of the tile.
+inline vw::ip::InterestPointList
+detect_ip_in_tile(vw::ImageView<float> const& tile, int points, double nodata) {
   using namespace vw;
-  ip.clear();
-
-  // If a valid file_path was provided, just try to read in the IP's from that file.
-  if ((file_path != "") && (boost::filesystem::exists(file_path))) {
-    vw_out() << "\t    Reading interest points from file: " << file_path << std::endl;
-    ip = ip::read_binary_ip_file_list(file_path);
-    vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
-    return;
-  }
-  
-  Stopwatch sw;
-  sw.start();
-
-  // Automatically determine how many ip we need. Can be overridden below
-  // either by --ip-per-image or --ip-per-tile (the latter takes priority).
-  double tile_size = 1024.0;
-  BBox2i box = bounding_box(image.impl());
-  double number_tiles = (box.width() / tile_size) * (box.height() / tile_size);
-
-  int ip_per_image = 5000; // default
-  if (stereo_settings().ip_per_image > 0) 
-    ip_per_image = stereo_settings().ip_per_image; 
-  
-  size_t points_per_tile = double(ip_per_image) / number_tiles;
-  if (points_per_tile > 5000) points_per_tile = 5000;
-  if (points_per_tile < 50  ) points_per_tile = 50;
-
-  // See if to override with ip per tile
-  if (ip_per_tile != 0)
-    points_per_tile = ip_per_tile;
-
+  ip::InterestPointList ip;
   const bool has_nodata = !boost::math::isnan(nodata);
 
-  if (ip_per_tile == 0 && stereo_settings().ip_per_image > 0)
-    vw_out() << "\t    Using " << stereo_settings().ip_per_image << " interest points per image.\n";
-  else 
-    vw_out() << "\t    Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
-  
   // Load the detection method from stereo_settings.
   // - This relies on a direct match in the enum integer value.
   DetectIpMethod detect_method = static_cast<DetectIpMethod>(stereo_settings().ip_matching_method);
 
   // Detect interest points.
-  // - Due to templated types we need to duplicate a bunch of code here
   if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
     // Zack's custom detector
     int num_scales = stereo_settings().num_scales;
     if (num_scales <= 0) 
       num_scales = vw::ip::IntegralInterestPointDetector
         <vw::ip::OBALoGInterestOperator>::IP_DEFAULT_SCALES;
-    else
-      vw_out() << "\t    Using " << num_scales << " scales in OBALoG interest point detection.\n";
 
-    vw::ip::IntegralAutoGainDetector detector(points_per_tile, num_scales);
+    vw::ip::IntegralAutoGainDetector detector(points, num_scales);
 
     // This detector can't handle a mask so if there is nodata just set those pixels to zero.
-
-    vw_out() << "\t    Detecting IP\n";
     if (!has_nodata)
-      ip = detect_interest_points(image.impl(), detector, points_per_tile);
+      ip = detect_interest_points(tile, detector, points);
     else
-      ip = detect_interest_points(apply_mask(create_mask_less_or_equal(image.impl(),nodata)), detector, points_per_tile);
+      ip = detect_interest_points(apply_mask(create_mask_less_or_equal(tile, nodata)), detector, points);
   } else {
 
     // Initialize the OpenCV detector.  Conveniently we can just pass in the type argument.
@@ -122,44 +88,160 @@ void detect_ip(vw::ip::InterestPointList& ip,
     bool opencv_normalize = stereo_settings().skip_image_normalization;
     if (stereo_settings().ip_normalize_tiles)
       opencv_normalize = true;
-    if (opencv_normalize)
-      vw_out() << "\t    Using per-tile image normalization for IP detection...\n";
 
     bool build_opencv_descriptors = true;
-    vw::ip::OpenCvInterestPointDetector detector(cv_method, opencv_normalize, build_opencv_descriptors, points_per_tile);
+    vw::ip::OpenCvInterestPointDetector detector(cv_method, opencv_normalize, build_opencv_descriptors, points);
 
     // These detectors do accept a mask so use one if applicable.
-
-    vw_out() << "\t    Detecting IP\n";
     if (!has_nodata)
-      ip = detect_interest_points(image.impl(), detector, points_per_tile);
+      ip = detect_interest_points(tile, detector, points);
     else
-      ip = detect_interest_points(create_mask_less_or_equal(image.impl(),nodata), detector, points_per_tile);
+      ip = detect_interest_points(create_mask_less_or_equal(tile, nodata), detector, points);
   } // End OpenCV case
 
-  sw.stop();
-  vw_out(DebugMessage,"asp") << "Detect interest points elapsed time: "
-			     << sw.elapsed_seconds() << " s." << std::endl;
-
-  if (!boost::math::isnan(nodata)) {
-    vw_out() << "\t    Removing IP near nodata with radius "
-             << stereo_settings().ip_nodata_radius << std::endl;
-    remove_ip_near_nodata(image.impl(), nodata, ip, stereo_settings().ip_nodata_radius);
-  }
+  if (has_nodata)
+    remove_ip_near_nodata(tile, nodata, ip, stereo_settings().ip_nodata_radius);
 
   // For the two OpenCV options we already built the descriptors, so only do this for the integral method.
   if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
-    sw.start();
-    vw_out() << "\t    Building descriptors" << std::endl;
     ip::SGradDescriptorGenerator descriptor;
     if (!has_nodata)
-      describe_interest_points(image.impl(), descriptor, ip);
+      describe_interest_points(tile, descriptor, ip);
     else
-      describe_interest_points(apply_mask(create_mask_less_or_equal(image.impl(),nodata)), descriptor, ip);
+      describe_interest_points(apply_mask(create_mask_less_or_equal(tile, nodata)), descriptor, ip);
+  }
+
+  return ip;
+}
+
+/// Detect the interest points in one tile of an image. The tile is
+/// expanded by a margin, and only the points in the tile itself are
+/// kept, in the pixels of the image.
+template <class ImageT>
+class DetectIpTileTask: public vw::Task, private boost::noncopyable {
+  ImageT const&               m_image;
+  vw::BBox2i                  m_tile;
+  int                         m_points_per_tile;
+  double                      m_nodata;
+  vw::ip::InterestPointList & m_ip;
+  vw::Mutex                 & m_mutex;
+  std::string               & m_error;
+public:
+  DetectIpTileTask(ImageT const& image, vw::BBox2i const& tile, int points_per_tile,
+                   double nodata, vw::ip::InterestPointList & ip,
+                   vw::Mutex & mutex, std::string & error):
+    m_image(image), m_tile(tile), m_points_per_tile(points_per_tile), m_nodata(nodata),
+    m_ip(ip), m_mutex(mutex), m_error(error) {}
+
+  void operator()() {
+    using namespace vw;
+    try {
+      BBox2i expanded = m_tile;
+      expanded.expand(IP_DETECT_TILE_MARGIN);
+      expanded.crop(bounding_box(m_image));
+
+      // The detectors find about as many points as asked for in the
+      // region given to them, so ask for these in the margin too.
+      double area_ratio = double(expanded.width()) * expanded.height()
+        / (double(IP_DETECT_TILE_SIZE) * IP_DETECT_TILE_SIZE);
+      int points = std::max(1, (int)round(m_points_per_tile * area_ratio));
+
+      ImageView<float> tile = crop(m_image, expanded);
+      ip::InterestPointList tile_ip = detect_ip_in_tile(tile, points, m_nodata);
+
+      for (ip::InterestPointList::iterator it = tile_ip.begin(); it != tile_ip.end(); it++) {
+        it->x  += expanded.min().x(); it->ix += expanded.min().x();
+        it->y  += expanded.min().y(); it->iy += expanded.min().y();
+        if (m_tile.contains(Vector2i(it->ix, it->iy)))
+          m_ip.push_back(*it);
+      }
+    } catch (std::exception const& e) {
+      Mutex::Lock lock(m_mutex);
+      if (m_error == "")
+        m_error = e.what();
+    }
+  }
+};
+
+template <class Image1T>
+void detect_ip(vw::ip::InterestPointList& ip,
+	       vw::ImageViewBase<Image1T> const& image,
+	       int ip_per_tile, std::string const file_path, double nodata) {
+  using namespace vw;
+  ip.clear();
 
-    vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
-                               << sw.elapsed_seconds() << " s." << std::endl;
+  // If a valid file_path was provided, just try to read in the IP's from that file.
+  if ((file_path != "") && (boost::filesystem::exists(file_path))) {
+    vw_out() << "\t    Reading interest points from file: " << file_path << std::endl;
+    ip = ip::read_binary_ip_file_list(file_path);
+    vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
+    return;
   }
+  
+  Stopwatch sw;
+  sw.start();
+
+  // Automatically determine how many ip we need. Can be overridden below
+  // either by --ip-per-image or --ip-per-tile (the latter takes priority).
+  double tile_size = IP_DETECT_TILE_SIZE;
+  BBox2i box = bounding_box(image.impl());
+  double number_tiles = (box.width() / tile_size) * (box.height() / tile_size);
+
+  int ip_per_image = 5000; // default
+  if (stereo_settings().ip_per_image > 0) 
+    ip_per_image = stereo_settings().ip_per_image; 
+  
+  size_t points_per_tile = double(ip_per_image) / number_tiles;
+  if (points_per_tile > 5000) points_per_tile = 5000;
+  if (points_per_tile < 50  ) points_per_tile = 50;
+
+  // See if to override with ip per tile
+  if (ip_per_tile != 0)
+    points_per_tile = ip_per_tile;
+
+  if (ip_per_tile == 0 && stereo_settings().ip_per_image > 0)
+    vw_out() << "\t    Using " << stereo_settings().ip_per_image << " interest points per image.\n";
+  else 
+    vw_out() << "\t    Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
+
+  if (stereo_settings().ip_matching_method == DETECT_IP_METHOD_INTEGRAL &&
+      stereo_settings().num_scales > 0)
+    vw_out() << "\t    Using " << stereo_settings().num_scales
+             << " scales in OBALoG interest point detection.\n";
+  if (stereo_settings().ip_matching_method != DETECT_IP_METHOD_INTEGRAL &&
+      (stereo_settings().skip_image_normalization || stereo_settings().ip_normalize_tiles))
+    vw_out() << "\t    Using per-tile image normalization for IP detection...\n";
+  if (!boost::math::isnan(nodata))
+    vw_out() << "\t    Removing IP near nodata with radius "
+             << stereo_settings().ip_nodata_radius << std::endl;
+
+  // Detect the points and build their descriptors in tiles, in
+  // parallel. The points of each tile are appended in the order of the
+  // tiles, so the result does not depend on the number of threads.
+  std::vector<BBox2i> tiles = subdivide_bbox(image.impl(), IP_DETECT_TILE_SIZE,
+                                             IP_DETECT_TILE_SIZE);
+  std::vector<ip::InterestPointList> tile_ip(tiles.size());
+  vw_out() << "\t    Detecting IP in " << tiles.size() << " tile(s)\n";
+  {
+    vw::Mutex mutex;
+    std::string error;
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    typedef DetectIpTileTask<Image1T> TaskType;
+    for (size_t it = 0; it < tiles.size(); it++) {
+      boost::shared_ptr<TaskType> task(new TaskType(image.impl(), tiles[it], points_per_tile,
+                                                    nodata, tile_ip[it], mutex, error));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    if (error != "")
+      vw_throw(ArgumentErr() << "Interest point detection failed: " << error << "\n");
+  }
+  for (size_t it = 0; it < tile_ip.size(); it++)
+    ip.splice(ip.end(), tile_ip[it]);
+
+  sw.stop();
+  vw_out(DebugMessage,"asp") << "Detect interest points elapsed time: "
+			     << sw.elapsed_seconds() << " s." << std::endl;
 
   vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
 
@@ -181,11 +263,13 @@ bool detect_ip_pair(vw::ip::InterestPointList& ip1,
 		    double nodata1, double nodata2) {
   using namespace vw;
 
-  // Detect Interest Points
-  vw_out() << "\t    Looking for IP in left image...\n";
-  detect_ip(ip1, image1.impl(), ip_per_tile, left_file_path, nodata1);
-  vw_out() << "\t    Looking for IP in right image...\n";
-  detect_ip(ip2, image2.impl(), ip_per_tile, right_file_path, nodata2);
+  // Detect Interest Points in both images at the same time
+  vw_out() << "\t    Looking for IP in left and right images...\n";
+  asp::run_in_parallel([&]() {
+      detect_ip(ip1, image1.impl(), ip_per_tile, left_file_path, nodata1);
+    }, [&]() {
+      detect_ip(ip2, image2.impl(), ip_per_tile, right_file_path, nodata2);
+    });
   
   if (stereo_settings().ip_debug_images) {
     vw_out() << "\t    Writing detected IP debug images. " << std::endl;
@@ -484,7 +568,7 @@ void detect_match_ip(std::vector<vw::ip::InterestPoint>& matched_ip1,
     // Create the output directory
     vw::create_out_dir(match_file);
     vw_out() << "Writing: " << match_file << std::endl;
-    ip::write_binary_match_file(match_file, matched_ip1, matched_ip2);
+    asp::write_match_file(match_file, matched_ip1, matched_ip2);
   }
   
 } // End function detect_match_ip
@@ -527,7 +611,7 @@ bool homography_ip_matching(vw::ImageViewBase<Image1T> const& image1,
   }
 
   vw_out() << "\t    * Writing match file: " << output_name << "\n";
-  ip::write_binary_match_file(output_name, final_ip1, final_ip2);
+  asp::write_match_file(output_name, final_ip1, final_ip2);
   return true;
 }
 
@@ -566,7 +650,7 @@ bool ip_matching_no_align(bool single_threaded_camera,
 
   // Write to disk
   vw_out() << "\t    * Writing match file: " << output_name << "\n";
-  ip::write_binary_match_file(output_name, matched_ip1, matched_ip2);
+  asp::write_match_file(output_name, matched_ip1, matched_ip2);
 
   return true;
 }
@@ -614,7 +698,7 @@ bool ip_matching_w_alignment(bool single_threaded_camera,
 
   // Write the matches to disk
   vw_out() << "\t    * Writing match file: " << output_name << "\n";
-  ip::write_binary_match_file(output_name, matched_ip1, matched_ip2);
+  asp::write_match_file(output_name, matched_ip1, matched_ip2);
 
   // Use the interest points that we found to compute an aligning
   // homography transform for the two images.
@@ -21,7 +21,7 @@
 
 #include <vw/Image/ImageView.h>
 #include <vw/Image/Transform.h>
-#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Stopwatch.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Core/LocalHomography.h>
@@ -54,50 +54,78 @@ namespace asp {
 
   }
 
-  /// Given a disparity map restricted to a subregion, find the homography
-  /// transform which aligns best the two images based on this disparity.
-  template<class SeedDispT>
+  // Summed-area tables of the valid disparities of an image, and of
+  // the left and right pixels they match, so that the mean match in
+  // any box can be found quickly.
+  class DisparitySums {
+  public:
+    DisparitySums(ImageView< PixelMask<Vector2f> > const& disparity):
+      m_cols(disparity.cols()), m_rows(disparity.rows()),
+      m_sums((m_cols+1)*size_t(m_rows+1)) {
+      for (int row = 0; row < m_rows; row++) {
+        Vector<double, 5> row_sum; // count, left x, left y, right x, right y
+        for (int col = 0; col < m_cols; col++) {
+          PixelMask<Vector2f> const& disp = disparity(col, row);
+          if (is_valid(disp)) {
+            row_sum[0] += 1;
+            row_sum[1] += col;
+            row_sum[2] += row;
+            row_sum[3] += col + disp.child().x();
+            row_sum[4] += row + disp.child().y();
+          }
+          at(col+1, row+1) = at(col+1, row) + row_sum;
+        }
+      }
+    }
+
+    // The number of valid disparities in a box, and the means of their
+    // left and right pixels
+    double mean_match(BBox2i const& box, Vector2 & left, Vector2 & right) const {
+      int c0 = box.min().x(), c1 = box.max().x();
+      int r0 = box.min().y(), r1 = box.max().y();
+      Vector<double, 5> sum = at(c1, r1) - at(c0, r1) - at(c1, r0) + at(c0, r0);
+      double count = sum[0];
+      if (count > 0) {
+        left  = Vector2(sum[1], sum[2])/count;
+        right = Vector2(sum[3], sum[4])/count;
+      }
+      return count;
+    }
+
+  private:
+    Vector<double, 5> & at(int c, int r) { return m_sums[c + size_t(r)*(m_cols+1)]; }
+    Vector<double, 5> const& at(int c, int r) const { return m_sums[c + size_t(r)*(m_cols+1)]; }
+
+    int m_cols, m_rows;
+    std::vector< Vector<double, 5> > m_sums;
+  };
+
+  /// Find the homography transform which aligns best the two images
+  /// based on the disparity in a subregion.
   vw::math::Matrix<double> homography_for_disparity(vw::BBox2i subregion,
-                                                    SeedDispT const& disparity,
+                                                    DisparitySums const& sums,
                                                     bool & success){
     success = true;
 
-    VW_ASSERT(subregion.width() == disparity.cols() &&
-              subregion.height() == disparity.rows(),
-              vw::ArgumentErr() << "homography_for_disparity: "
-              << "The sizes of subregion and disparity don't match.\n");
-
-    // We will split the subregion into N x N boxes, and average the
+    // We will split the subregion into N x N boxes, and use the mean
     // disparity in each box, to reduce the run-time.
     int N = 10;
 
     std::vector<int> partitionx, partitiony;
-    split_n_into_k(disparity.cols(), std::min(disparity.cols(), N), partitionx);
-    split_n_into_k(disparity.rows(), std::min(disparity.rows(), N), partitiony);
+    split_n_into_k(subregion.width(),  std::min(subregion.width(),  N), partitionx);
+    split_n_into_k(subregion.height(), std::min(subregion.height(), N), partitiony);
 
     std::vector<vw::ip::InterestPoint> left_ip, right_ip;
     for (int ix = 0; ix < (int)partitionx.size()-1; ix++){
       for (int iy = 0; iy < (int)partitiony.size()-1; iy++){
+        BBox2i box(subregion.min() + Vector2i(partitionx[ix], partitiony[iy]),
+                   subregion.min() + Vector2i(partitionx[ix+1], partitiony[iy+1]));
+        Vector2 left, right;
+        if (sums.mean_match(box, left, right) == 0) continue; // no valid points
 
-        // First sum up the disparities in each subbox.
-        double lx = 0, ly = 0, rx = 0, ry = 0, count = 0; // int may cause overflow
-        for (int x = partitionx[ix]; x < partitionx[ix+1]; x++){
-          for (int y = partitiony[iy]; y < partitiony[iy+1]; y++){
-
-            typename SeedDispT::pixel_type disp = disparity(x, y);
-            if (!is_valid(disp)) continue;
-            lx += x; rx += (x + disp.child().x());
-            ly += y; ry += (y + disp.child().y());
-            count++;
-          }
-        }
-        if (count == 0) continue; // no valid points
-
-        // Do the averaging. We must add the box corner to the left and
-        // right interest points.
         vw::ip::InterestPoint l, r;
-        l.x = subregion.min().x() + lx/count; r.x = subregion.min().x() + rx/count;
-        l.y = subregion.min().y() + ly/count; r.y = subregion.min().y() + ry/count;
+        l.x = left.x();  r.x = right.x();
+        l.y = left.y();  r.y = right.y();
         left_ip.push_back(l);
         right_ip.push_back(r);
       }
@@ -105,10 +133,9 @@ namespace asp {
 
     try {
       Matrix<double> left_matrix, right_matrix;
-      BBox2i image_size = bounding_box(disparity);
       bool adjust_left_image_size = true;
       homography_rectification( adjust_left_image_size,
-                                image_size.size(), image_size.size(),
+                                subregion.size(), subregion.size(),
                                 left_ip, right_ip, left_matrix, right_matrix );
       // Undoing the shift in origin.
       right_matrix(0,2) -= left_matrix(0,2);
@@ -121,41 +148,16 @@ namespace asp {
     return vw::math::identity_matrix<3>();
   }
 
-  // Task that computes local homography in a given tile
-  class LocalHomTask: public vw::Task, private boost::noncopyable {
-
-    int m_col, m_row;
-    BBox2i m_sub_bbox;
-    // We on purpose store a local deep copy of sub_disparity_crop to
-    // avoid segfault.
-    ImageView < PixelMask<Vector2i> > m_sub_disparity_crop;
-    ImageView<Matrix3x3> & m_local_hom;
-  public:
-    LocalHomTask(int col, int row,
-                 BBox2i sub_bbox,
-                 ImageViewRef < PixelMask<Vector2i> > const& sub_disparity_crop,
-                 ImageView<Matrix3x3> & local_hom):
-      m_col(col), m_row(row), m_sub_bbox(sub_bbox),
-      m_sub_disparity_crop(sub_disparity_crop),
-      m_local_hom(local_hom){}
-
-    void operator()() {
-      bool success;
-      // To do: If this function is ever used, the variable 'success'
-      // needs to be treated properly.
-      exit(1); // broken, for now
-      m_local_hom(m_col, m_row)
-        = homography_for_disparity(m_sub_bbox, m_sub_disparity_crop, success);
-    }
-  };
-
-  
   void create_local_homographies(ASPGlobalOptions const& opt){
 
     DiskImageView< PixelGray<float> > left_sub (opt.out_prefix + "-L_sub.tif");
     DiskImageView< PixelGray<float> > left_img (opt.out_prefix + "-L.tif");
-    DiskImageView< PixelMask<Vector2f> >
-      sub_disparity(opt.out_prefix + "-D_sub.tif");
+
+    // D_sub is small, so it is read in memory once, and its sums are
+    // used for all tiles.
+    ImageView< PixelMask<Vector2f> > sub_disparity
+      = DiskImageView< PixelMask<Vector2f> >(opt.out_prefix + "-D_sub.tif");
+    DisparitySums sums(sub_disparity);
 
     Vector2 upscale_factor( double(left_img.cols()) / double(left_sub.cols()),
                             double(left_img.rows()) / double(left_sub.rows()) );
@@ -165,14 +167,14 @@ namespace asp {
     int rows = (int)ceil(left_img.rows()/double(ts));
     ImageView<Matrix3x3> local_hom(cols, rows);
 
-    // Calculate the local homographies using multiple threads.
-    // To do: Each thread calls RANSAC, which calls rand(), which
-    // is not thread safe. So for now use just one thread.
+    // Each fit calls RANSAC, which calls rand(), which is not thread
+    // safe, and multiple threads pulling numbers from the same stream
+    // would give different answers each time. So the fits are done in
+    // one thread.
 
     Stopwatch sw;
     sw.start();
 
-    //FifoWorkQueue queue( vw_settings().default_num_threads() );
     for (int col = 0; col < cols; col++){
       for (int row = 0; row < rows; row++){
 
@@ -192,18 +194,8 @@ namespace asp {
         sub_bbox.expand(1);
         while(1){
 
-          // This code enables multi-threading. It gives different answers each time,
-          // as multiple threads pull random numbers from the same stream.
-          // This code must be kept disabled until Boost's random function is used
-          // with one random stream for each thread.
-          //boost::shared_ptr<LocalHomTask>
-          //task(new LocalHomTask(col, row, sub_bbox, crop(sub_disparity, sub_bbox),
-          //                        local_hom));
-          //queue.add_task(task);
-
           sub_bbox.crop( bounding_box(sub_disparity) );
-          local_hom(col, row)
-            = homography_for_disparity(sub_bbox, crop(sub_disparity, sub_bbox), success);
+          local_hom(col, row) = homography_for_disparity(sub_bbox, sums, success);
           if (success) break;
           vw_out() << "\t--> Failed to find local disparity in box: " << bbox  << std::endl;
           vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
@@ -214,7 +206,6 @@ namespace asp {
 
       }
     }
-    //queue.join_all();
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Local homographies elapsed time: "
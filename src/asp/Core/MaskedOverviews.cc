@@ -0,0 +1,151 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/MaskedOverviews.h>
+
+#include <vw/config.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <algorithm>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <gdal.h>
+#endif
+
+using namespace vw;
+
+namespace asp {
+
+void masked_downsample(std::vector<double> const& in, int cols, int rows, int bands,
+                       MaskedOverviewType type, std::vector<double> & out) {
+
+  if (bands <= 0 || in.size() != size_t(cols) * rows * bands)
+    vw_throw(ArgumentErr() << "The pixels do not match the image size.\n");
+
+  // The coordinates of a point cloud are the first three bands, and
+  // the offsets of a disparity are all bands but the valid flag.
+  int num_mean = (type == DISPARITY_OVERVIEWS) ? bands - 1 : std::min(bands, 3);
+
+  int out_cols = (cols + 1) / 2, out_rows = (rows + 1) / 2;
+  out.assign(size_t(out_cols) * out_rows * bands, 0.0);
+  for (int row = 0; row < out_rows; row++) {
+    for (int col = 0; col < out_cols; col++) {
+      double * o = &out[(size_t(row) * out_cols + col) * bands];
+      int num_valid = 0;
+      for (int r = 2 * row; r < std::min(2 * row + 2, rows); r++) {
+        for (int c = 2 * col; c < std::min(2 * col + 2, cols); c++) {
+          double const* p = &in[(size_t(r) * cols + c) * bands];
+          bool valid = false;
+          if (type == DISPARITY_OVERVIEWS) {
+            valid = (p[bands - 1] != 0);
+          } else {
+            for (int b = 0; b < num_mean; b++)
+              valid = valid || (p[b] != 0);
+          }
+          if (!valid)
+            continue;
+          num_valid++;
+          for (int b = 0; b < num_mean; b++)
+            o[b] += p[b];
+          for (int b = num_mean; b < bands; b++) {
+            if (type == DISPARITY_OVERVIEWS)
+              o[b] = p[b];                   // the valid flag
+            else
+              o[b] = std::max(o[b], p[b]);   // the largest error
+          }
+        }
+      }
+      if (num_valid > 0) {
+        for (int b = 0; b < num_mean; b++)
+          o[b] /= num_valid;
+      }
+    }
+  }
+}
+
+void add_masked_overviews(std::string const& file, MaskedOverviewType type, int min_size) {
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+
+  GDALAllRegister();
+  vw_out() << "Adding overviews to: " << file << std::endl;
+  GDALDatasetH ds = GDALOpen(file.c_str(), GA_Update);
+  if (ds == NULL)
+    vw_throw(ArgumentErr() << "Could not open: " << file << ".\n");
+
+  int bands = GDALGetRasterCount(ds);
+  int max_dim = std::max(GDALGetRasterXSize(ds), GDALGetRasterYSize(ds));
+  std::vector<int> levels;
+  for (int level = 2; max_dim / (level/2) > std::max(min_size, 1); level *= 2)
+    levels.push_back(level);
+  if (levels.empty() || bands == 0) {
+    GDALClose(ds);
+    return;
+  }
+
+  // Make the overviews without filling them, then fill them here
+  CPLErr err = GDALBuildOverviews(ds, "NONE", int(levels.size()), &levels[0],
+                                  0, NULL, NULL, NULL);
+
+  // Go over the blocks of the previous level, so each is read once
+  int block_cols = 0, block_rows = 0;
+  GDALGetBlockSize(GDALGetRasterBand(ds, 1), &block_cols, &block_rows);
+  block_cols = std::max(2 * (block_cols / 2), 256);
+  block_rows = std::max(2 * (block_rows / 2), 256);
+  std::vector<double> in, out;
+  for (size_t level = 0; level < levels.size() && err == CE_None; level++) {
+    std::vector<GDALRasterBandH> src(bands), dst(bands);
+    for (int b = 0; b < bands; b++) {
+      GDALRasterBandH band = GDALGetRasterBand(ds, b + 1);
+      src[b] = (level == 0) ? band : GDALGetOverview(band, int(level) - 1);
+      dst[b] = GDALGetOverview(band, int(level));
+    }
+    int cols = GDALGetRasterBandXSize(src[0]), rows = GDALGetRasterBandYSize(src[0]);
+    int out_cols = GDALGetRasterBandXSize(dst[0]), out_rows = GDALGetRasterBandYSize(dst[0]);
+    for (int y = 0; y < rows && err == CE_None; y += block_rows) {
+      for (int x = 0; x < cols && err == CE_None; x += block_cols) {
+        int w = std::min(block_cols, cols - x), h = std::min(block_rows, rows - y);
+        in.resize(size_t(w) * h * bands);
+        for (int b = 0; b < bands && err == CE_None; b++)
+          err = GDALRasterIO(src[b], GF_Read, x, y, w, h, &in[b], w, h, GDT_Float64,
+                             int(bands * sizeof(double)), int(w * bands * sizeof(double)));
+        masked_downsample(in, w, h, bands, type, out);
+
+        // GDAL may round the size of the overview differently
+        int ox = x / 2, oy = y / 2;
+        int ow = std::min((w + 1) / 2, out_cols - ox), oh = std::min((h + 1) / 2, out_rows - oy);
+        if (ow <= 0 || oh <= 0)
+          continue;
+        for (int b = 0; b < bands && err == CE_None; b++)
+          err = GDALRasterIO(dst[b], GF_Write, ox, oy, ow, oh, &out[b], ow, oh, GDT_Float64,
+                             int(bands * sizeof(double)),
+                             int(((w + 1) / 2) * bands * sizeof(double)));
+      }
+    }
+  }
+  GDALClose(ds);
+  if (err != CE_None)
+    vw_throw(ArgumentErr() << "Could not build overviews for: " << file << ".\n");
+
+#else
+  vw_throw( NoImplErr() << "Overviews are not available without GDAL support." );
+#endif
+}
+
+} // end namespace asp
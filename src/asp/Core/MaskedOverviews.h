@@ -0,0 +1,53 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MaskedOverviews.h
+///
+/// Internal overviews of the disparities and point clouds written by
+/// stereo, made so that invalid pixels do not spoil the reduced levels,
+/// as they would with the averaging of gdaladdo. For a disparity, the
+/// offsets of the valid pixels are averaged, and a pixel of an overview
+/// is valid if any of those it covers is. For a point cloud, where
+/// invalid points are zero, the coordinates of the valid points are
+/// averaged and the largest of their errors is kept. Each level is
+/// found from the previous one, so the file is read once.
+
+#ifndef __ASP_CORE_MASKED_OVERVIEWS_H__
+#define __ASP_CORE_MASKED_OVERVIEWS_H__
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  enum MaskedOverviewType { DISPARITY_OVERVIEWS, POINT_CLOUD_OVERVIEWS };
+
+  /// Halve the resolution of pixels with the given number of bands,
+  /// stored band after band for each pixel, row after row. The output
+  /// has (cols + 1)/2 columns and (rows + 1)/2 rows.
+  void masked_downsample(std::vector<double> const& in, int cols, int rows, int bands,
+                         MaskedOverviewType type, std::vector<double> & out);
+
+  /// Add the overviews to a GeoTIFF just written, halving the resolution
+  /// until the coarsest level fits in min_size pixels.
+  void add_masked_overviews(std::string const& file, MaskedOverviewType type,
+                            int min_size = 256);
+
+} // end namespace asp
+
+#endif//__ASP_CORE_MASKED_OVERVIEWS_H__
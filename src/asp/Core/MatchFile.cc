@@ -0,0 +1,197 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/StereoSettings.h>
+#include <vw/Core/Exception.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+using namespace vw;
+
+namespace {
+
+  const char   MAGIC[8]     = {'A', 'S', 'P', 'M', 'A', 'T', 'C', 'H'};
+  const uint32 VERSION      = 1;
+  const size_t HEADER_SIZE  = 8 + 4 + 4 + 8; // magic, version, descriptor length, count
+  const size_t RECORD_SIZE  = 10 * 4;        // ten 4-byte fields, see below
+
+  // A record is x, y, ix, iy, orientation, scale, interest, octave,
+  // scale level, and polarity, each in 4 bytes, in the byte order of
+  // the machine, as for the format of Vision Workbench.
+  void write_record(ip::InterestPoint const& p, char * record) {
+    float  f[5] = {p.x, p.y, p.orientation, p.scale, p.interest};
+    int32  i[5] = {int32(p.ix), int32(p.iy), int32(p.octave), int32(p.scale_lvl),
+                   int32(p.polarity)};
+    memcpy(record,      &f[0], 8);  // x, y
+    memcpy(record + 8,  &i[0], 8);  // ix, iy
+    memcpy(record + 16, &f[2], 12); // orientation, scale, interest
+    memcpy(record + 28, &i[2], 12); // octave, scale level, polarity
+  }
+
+  void read_record(char const* record, ip::InterestPoint & p) {
+    float f[5];
+    int32 i[5];
+    memcpy(&f[0], record,      8);
+    memcpy(&i[0], record + 8,  8);
+    memcpy(&f[2], record + 16, 12);
+    memcpy(&i[2], record + 28, 12);
+    p.x = f[0]; p.y = f[1]; p.orientation = f[2]; p.scale = f[3]; p.interest = f[4];
+    p.ix = i[0]; p.iy = i[1]; p.octave = i[2]; p.scale_lvl = i[3]; p.polarity = (i[4] != 0);
+  }
+
+  // A read-only view of a whole file in memory
+  class MappedFile {
+  public:
+    MappedFile(std::string const& file): m_data(NULL), m_size(0) {
+      int fd = open(file.c_str(), O_RDONLY);
+      if (fd < 0)
+        vw_throw(IOErr() << "Cannot open: " << file << "\n");
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        m_size = st.st_size;
+        void * data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+          m_data = static_cast<char const*>(data);
+      }
+      close(fd);
+      if (m_data == NULL)
+        vw_throw(IOErr() << "Cannot read: " << file << "\n");
+    }
+    ~MappedFile() { munmap(const_cast<char*>(m_data), m_size); }
+    char const* data() const { return m_data; }
+    size_t      size() const { return m_size; }
+  private:
+    char const* m_data;
+    size_t      m_size;
+  };
+
+} // end anonymous namespace
+
+namespace asp {
+
+bool is_compact_match_file(std::string const& match_file) {
+  std::ifstream ifs(match_file.c_str(), std::ios::binary);
+  char magic[8];
+  if (!ifs.read(magic, sizeof(magic)))
+    return false;
+  return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void write_compact_match_file(std::string const& match_file,
+                              std::vector<ip::InterestPoint> const& ip1,
+                              std::vector<ip::InterestPoint> const& ip2,
+                              bool with_descriptors) {
+  if (ip1.size() != ip2.size())
+    vw_throw(ArgumentErr() << "Expecting as many left as right interest points.\n");
+
+  uint32 desc_len = 0;
+  if (with_descriptors && !ip1.empty())
+    desc_len = ip1[0].descriptor.size();
+  for (size_t it = 0; it < ip1.size() && desc_len > 0; it++) {
+    if (ip1[it].descriptor.size() != desc_len || ip2[it].descriptor.size() != desc_len)
+      vw_throw(ArgumentErr() << "The interest point descriptors differ in size, "
+               << "so they cannot be written to: " << match_file << "\n");
+  }
+
+  std::ofstream ofs(match_file.c_str(), std::ios::binary);
+  if (!ofs)
+    vw_throw(IOErr() << "Cannot write: " << match_file << "\n");
+
+  uint64 num = ip1.size();
+  ofs.write(MAGIC, sizeof(MAGIC));
+  ofs.write(reinterpret_cast<char const*>(&VERSION),  sizeof(VERSION));
+  ofs.write(reinterpret_cast<char const*>(&desc_len), sizeof(desc_len));
+  ofs.write(reinterpret_cast<char const*>(&num),      sizeof(num));
+
+  std::vector<ip::InterestPoint> const* sides[2] = {&ip1, &ip2};
+  std::vector<char> buffer;
+  for (int s = 0; s < 2; s++) {
+    buffer.resize(RECORD_SIZE * num);
+    for (size_t it = 0; it < num; it++)
+      write_record((*sides[s])[it], &buffer[RECORD_SIZE * it]);
+    ofs.write(buffer.data(), buffer.size());
+  }
+  for (int s = 0; s < 2 && desc_len > 0; s++) {
+    for (size_t it = 0; it < num; it++)
+      ofs.write(reinterpret_cast<char const*>(&(*sides[s])[it].descriptor[0]),
+                desc_len * sizeof(float));
+  }
+
+  if (!ofs)
+    vw_throw(IOErr() << "Failed writing: " << match_file << "\n");
+}
+
+void read_match_file(std::string const& match_file,
+                     std::vector<ip::InterestPoint> & ip1,
+                     std::vector<ip::InterestPoint> & ip2) {
+
+  if (!is_compact_match_file(match_file)) {
+    ip::read_binary_match_file(match_file, ip1, ip2);
+    return;
+  }
+
+  MappedFile file(match_file);
+  char const* data = file.data();
+  uint32 version = 0, desc_len = 0;
+  uint64 num = 0;
+  if (file.size() >= HEADER_SIZE) {
+    memcpy(&version,  data + 8,  sizeof(version));
+    memcpy(&desc_len, data + 12, sizeof(desc_len));
+    memcpy(&num,      data + 16, sizeof(num));
+  }
+  if (version != VERSION)
+    vw_throw(IOErr() << "Unsupported version " << version << " of match file: "
+             << match_file << "\n");
+  if (file.size() != HEADER_SIZE + 2 * num * (RECORD_SIZE + desc_len * sizeof(float)))
+    vw_throw(IOErr() << "Truncated or invalid match file: " << match_file << "\n");
+
+  std::vector<ip::InterestPoint> * sides[2] = {&ip1, &ip2};
+  char const* records     = data + HEADER_SIZE;
+  char const* descriptors = records + 2 * num * RECORD_SIZE;
+  for (int s = 0; s < 2; s++) {
+    std::vector<ip::InterestPoint> & ip = *sides[s];
+    ip.clear();
+    ip.resize(num);
+    for (size_t it = 0; it < num; it++) {
+      read_record(records + (s * num + it) * RECORD_SIZE, ip[it]);
+      if (desc_len > 0) {
+        ip[it].descriptor.set_size(desc_len);
+        memcpy(&ip[it].descriptor[0],
+               descriptors + (s * num + it) * desc_len * sizeof(float),
+               desc_len * sizeof(float));
+      }
+    }
+  }
+}
+
+void write_match_file(std::string const& match_file,
+                      std::vector<ip::InterestPoint> const& ip1,
+                      std::vector<ip::InterestPoint> const& ip2) {
+  if (stereo_settings().compact_match_files)
+    write_compact_match_file(match_file, ip1, ip2);
+  else
+    ip::write_binary_match_file(match_file, ip1, ip2);
+}
+
+} // end namespace asp
@@ -0,0 +1,66 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MatchFile.h
+///
+/// Match files in a compact format, next to the format of Vision
+/// Workbench, which writes each interest point field by field with its
+/// descriptor. The compact format has a versioned header, then the
+/// left and then the right interest points as fixed-size records, then
+/// their descriptors, if kept. It is read by mapping the file in memory.
+///
+/// read_match_file() reads either format, so the tools reading match
+/// files with it need not know which one they get. The control network
+/// of bundle_adjust is built by Vision Workbench, which reads only its
+/// own format, so match files for bundle_adjust must be in that format.
+
+#ifndef __ASP_CORE_MATCH_FILE_H__
+#define __ASP_CORE_MATCH_FILE_H__
+
+#include <vw/InterestPoint/InterestData.h>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// If this file is in the compact format
+  bool is_compact_match_file(std::string const& match_file);
+
+  /// Write the matches in the compact format. Without descriptors, the
+  /// interest points read back have empty descriptors.
+  void write_compact_match_file(std::string const& match_file,
+                                std::vector<vw::ip::InterestPoint> const& ip1,
+                                std::vector<vw::ip::InterestPoint> const& ip2,
+                                bool with_descriptors = false);
+
+  /// Read a match file in either format
+  void read_match_file(std::string const& match_file,
+                       std::vector<vw::ip::InterestPoint> & ip1,
+                       std::vector<vw::ip::InterestPoint> & ip2);
+
+  /// Write a match file in the compact format, without descriptors,
+  /// if so asked with --compact-match-files, and else in the format of
+  /// Vision Workbench.
+  void write_match_file(std::string const& match_file,
+                        std::vector<vw::ip::InterestPoint> const& ip1,
+                        std::vector<vw::ip::InterestPoint> const& ip2);
+
+} // end namespace asp
+
+#endif//__ASP_CORE_MATCH_FILE_H__
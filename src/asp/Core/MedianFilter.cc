@@ -19,6 +19,10 @@
 #include <asp/Core/MedianFilter.h>
 #include <vw/Math/Vector.h>
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 using namespace vw;
 
 uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
@@ -39,3 +43,170 @@ uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
 
   return i;
 }
+
+namespace {
+
+  // Counts of the ranks in the window, and of buckets of ranks, so that
+  // the k-th smallest rank is found by moving from the last one found,
+  // skipping whole buckets where possible.
+  class RankHistogram {
+  public:
+    static const int BUCKET = 64;
+
+    RankHistogram(int num_ranks): m_fine(num_ranks + 1, 0),
+                                  m_coarse(num_ranks / BUCKET + 2, 0),
+                                  m_count(0), m_pos(0), m_below(0) {}
+
+    void add(int rank) {
+      m_fine[rank]++;
+      m_coarse[rank / BUCKET]++;
+      m_count++;
+      if (rank < m_pos)
+        m_below++;
+    }
+
+    void remove(int rank) {
+      m_fine[rank]--;
+      m_coarse[rank / BUCKET]--;
+      m_count--;
+      if (rank < m_pos)
+        m_below--;
+    }
+
+    int count() const { return m_count; }
+
+    // The k-th smallest rank in the window, counting from 0. The
+    // window must have more than k ranks.
+    int kth(int k) {
+      // Move down while too many ranks are below the position
+      while (m_below > k) {
+        if (m_pos % BUCKET == 0 && m_below - m_coarse[m_pos / BUCKET - 1] > k) {
+          m_pos   -= BUCKET;
+          m_below -= m_coarse[m_pos / BUCKET];
+        } else {
+          m_pos--;
+          m_below -= m_fine[m_pos];
+        }
+      }
+      // Move up while the ranks up to the position are not enough
+      while (m_below + m_fine[m_pos] <= k) {
+        if (m_pos % BUCKET == 0 && m_below + m_coarse[m_pos / BUCKET] <= k) {
+          m_below += m_coarse[m_pos / BUCKET];
+          m_pos   += BUCKET;
+        } else {
+          m_below += m_fine[m_pos];
+          m_pos++;
+        }
+      }
+      return m_pos;
+    }
+
+  private:
+    std::vector<int> m_fine, m_coarse;
+    int m_count;
+    int m_pos;   // Where the last k-th rank was found
+    int m_below; // The number of ranks in the window below m_pos
+  };
+
+}
+
+namespace asp {
+
+void median_filter(vw::ImageView<double>      const& values,
+                   vw::ImageView<vw::uint8>   const& valid,
+                   int half_width, int half_height,
+                   vw::ImageView<double>    & median,
+                   vw::ImageView<vw::uint8> & median_valid) {
+
+  int nc = values.cols(), nr = values.rows();
+  VW_ASSERT(valid.cols() == nc && valid.rows() == nr,
+            ArgumentErr() << "median_filter: The values and the mask must have the same size.\n");
+  half_width  = std::max(half_width,  0);
+  half_height = std::max(half_height, 0);
+
+  median.set_size(nc, nr);
+  median_valid.set_size(nc, nr);
+  if (nc == 0 || nr == 0)
+    return;
+
+  // Replace each valid value by its rank, with ties broken by position
+  std::vector< std::pair<double, int> > sorted;
+  for (int row = 0; row < nr; row++)
+    for (int col = 0; col < nc; col++)
+      if (valid(col, row))
+        sorted.push_back(std::make_pair(values(col, row), col + row * nc));
+  std::sort(sorted.begin(), sorted.end());
+  vw::ImageView<int> rank(nc, nr);
+  for (int row = 0; row < nr; row++)
+    for (int col = 0; col < nc; col++)
+      rank(col, row) = -1;
+  for (size_t it = 0; it < sorted.size(); it++)
+    rank(sorted[it].second % nc, sorted[it].second / nc) = it;
+
+  RankHistogram hist(sorted.size());
+
+  // Add (sign 1) or remove (sign -1) the pixels of a column or row
+  // segment, clipped to the image
+  auto update_col = [&](int col, int row0, int row1, int sign) {
+    if (col < 0 || col >= nc)
+      return;
+    for (int row = std::max(row0, 0); row <= std::min(row1, nr - 1); row++) {
+      int r = rank(col, row);
+      if (r < 0)
+        continue;
+      if (sign > 0) hist.add(r); else hist.remove(r);
+    }
+  };
+  auto update_row = [&](int row, int col0, int col1, int sign) {
+    if (row < 0 || row >= nr)
+      return;
+    for (int col = std::max(col0, 0); col <= std::min(col1, nc - 1); col++) {
+      int r = rank(col, row);
+      if (r < 0)
+        continue;
+      if (sign > 0) hist.add(r); else hist.remove(r);
+    }
+  };
+  auto store = [&](int col, int row) {
+    int n = hist.count();
+    median_valid(col, row) = (n > 0);
+    if (n == 0) {
+      median(col, row) = 0;
+      return;
+    }
+    double val = sorted[hist.kth((n - 1) / 2)].first;
+    if (n % 2 == 0)
+      val = 0.5 * (val + sorted[hist.kth(n / 2)].first);
+    median(col, row) = val;
+  };
+
+  // The window at the first pixel
+  for (int col = 0; col <= std::min(half_width, nc - 1); col++)
+    update_col(col, 0, half_height, 1);
+
+  // Go right on even rows and left on odd rows, so that the window
+  // moves by one pixel each time.
+  for (int row = 0; row < nr; row++) {
+    bool right = (row % 2 == 0);
+    for (int it = 0; it < nc; it++) {
+      int col = right ? it : nc - 1 - it;
+      store(col, row);
+      if (it == nc - 1)
+        break;
+      if (right) {
+        update_col(col - half_width,     row - half_height, row + half_height, -1);
+        update_col(col + 1 + half_width, row - half_height, row + half_height,  1);
+      } else {
+        update_col(col + half_width,     row - half_height, row + half_height, -1);
+        update_col(col - 1 - half_width, row - half_height, row + half_height,  1);
+      }
+    }
+    if (row == nr - 1)
+      break;
+    int col = right ? nc - 1 : 0;
+    update_row(row - half_height,     col - half_width, col + half_width, -1);
+    update_row(row + 1 + half_height, col - half_width, col + half_width,  1);
+  }
+}
+
+} // end namespace asp
@@ -18,19 +18,33 @@
 
 /// \file MedianFilter.h
 ///
+/// Median filters. The older ones, in the vw namespace, work on images
+/// rescaled to uint8. The ones in the asp namespace work on double
+/// values with a mask, and are exact. They replace each valid value by
+/// its rank among the valid values of the image, and keep a histogram
+/// of the ranks in a window which slides over the image. The histogram
+/// also has counts of buckets of ranks, and the median is tracked as the
+/// window moves, so finding it takes time nearly independent of the
+/// window size. Adding and removing pixels as the window moves takes
+/// time proportional to its width.
 
 #ifndef __MEDIAN_FILTER_H__
 #define __MEDIAN_FILTER_H__
 
 #define CALC_PIXEL_NUM_VALS 256
 
+#include <vw/Core/Exception.h>
 #include <vw/Core/Functors.h>
 #include <vw/Core/FundamentalTypes.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/EdgeExtension.h>
+#include <vw/Image/ImageViewBase.h>
 #include <vw/Image/PerPixelAccessorViews.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/Manipulation.h>
 
 namespace vw {
 
@@ -142,4 +156,102 @@ namespace vw {
 
 }
 
+namespace asp {
+
+  /// The median of the valid values in the window of the given half
+  /// sizes around each pixel, clipped at the image edges. For an even
+  /// number of values, it is the mean of the two middle ones. Pixels with
+  /// no valid values in their window are not valid in the output.
+  void median_filter(vw::ImageView<double>      const& values,
+                     vw::ImageView<vw::uint8>   const& valid,
+                     int half_width, int half_height,
+                     vw::ImageView<double>    & median,
+                     vw::ImageView<vw::uint8> & median_valid);
+
+  /// The median filter of each channel of a masked image, such as a DEM
+  /// or a disparity. Invalid pixels stay invalid.
+  template <class ChildT>
+  vw::ImageView< vw::PixelMask<ChildT> >
+  median_filter(vw::ImageView< vw::PixelMask<ChildT> > const& image,
+                int half_width, int half_height) {
+
+    typedef typename vw::PixelChannelType<ChildT>::type channel_type;
+    const int num_channels = vw::CompoundNumChannels<ChildT>::value;
+    int nc = image.cols(), nr = image.rows();
+
+    vw::ImageView< vw::PixelMask<ChildT> > result = copy(image);
+    vw::ImageView<vw::uint8> valid(nc, nr), median_valid;
+    for (int row = 0; row < nr; row++)
+      for (int col = 0; col < nc; col++)
+        valid(col, row) = is_valid(image(col, row));
+
+    vw::ImageView<double> values(nc, nr), median;
+    for (int ch = 0; ch < num_channels; ch++) {
+      for (int row = 0; row < nr; row++)
+        for (int col = 0; col < nc; col++)
+          values(col, row) = vw::compound_select_channel<channel_type const&>
+                               (image(col, row).child(), ch);
+      median_filter(values, valid, half_width, half_height, median, median_valid);
+      for (int row = 0; row < nr; row++) {
+        for (int col = 0; col < nc; col++) {
+          if (valid(col, row))
+            vw::compound_select_channel<channel_type&>(result(col, row).child(), ch)
+              = channel_type(median(col, row));
+        }
+      }
+    }
+    return result;
+  }
+
+  /// A median filter of a masked image, done tile by tile, so that the
+  /// tiles are filtered by separate threads when the view is written.
+  template <class ImageT>
+  class MedianFilterView: public vw::ImageViewBase< MedianFilterView<ImageT> > {
+    ImageT m_image;
+    int    m_half_width, m_half_height;
+
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<MedianFilterView> pixel_accessor;
+
+    MedianFilterView(ImageT const& image, int half_width, int half_height):
+      m_image(image), m_half_width(half_width), m_half_height(half_height) {}
+
+    inline vw::int32 cols  () const { return m_image.cols(); }
+    inline vw::int32 rows  () const { return m_image.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(double /*i*/, double /*j*/, vw::int32 /*p*/ = 0) const {
+      vw_throw(vw::NoImplErr() << "MedianFilterView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView< vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::BBox2i big_box = bbox;
+      big_box.expand(std::max(m_half_width, m_half_height));
+      big_box.crop(bounding_box(m_image));
+      vw::ImageView<pixel_type> tile = crop(m_image, big_box);
+      vw::ImageView<pixel_type> filtered = median_filter(tile, m_half_width, m_half_height);
+      return prerasterize_type(filtered, -big_box.min().x(), -big_box.min().y(),
+                               cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  MedianFilterView<ImageT> median_filter_view(vw::ImageViewBase<ImageT> const& image,
+                                              int half_width, int half_height) {
+    return MedianFilterView<ImageT>(image.impl(), half_width, half_height);
+  }
+
+} // end namespace asp
+
 #endif // __MEDIAN_FILTER_H__
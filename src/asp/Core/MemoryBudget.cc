@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/MemoryBudget.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace asp {
+
+MemoryBudget::MemoryBudget(): m_budget_mb(0), m_used_kb(0), m_peak_kb(0),
+                              m_warned(false) {}
+
+void MemoryBudget::set_budget_mb(double budget_mb) {
+  if (budget_mb < 0)
+    vw::vw_throw(vw::ArgumentErr() << "The memory budget must not be negative.\n");
+  m_budget_mb = budget_mb;
+}
+
+double MemoryBudget::cap_mb(double size_mb, double fraction) const {
+  if (!has_budget())
+    return size_mb;
+  return std::min(size_mb, fraction * m_budget_mb);
+}
+
+int MemoryBudget::tile_size(int max_size, double bytes_per_pixel, int num_tiles,
+                            double fraction, int granularity) const {
+  granularity = std::max(granularity, 1);
+  if (!has_budget() || bytes_per_pixel <= 0 || num_tiles <= 0)
+    return std::max(max_size, granularity);
+
+  double bytes = fraction * m_budget_mb * 1024.0 * 1024.0;
+  double side  = std::sqrt(bytes / (bytes_per_pixel * num_tiles));
+  int size = granularity * int(std::floor(side / granularity));
+  size = std::min(size, max_size);
+  return std::max(size, granularity);
+}
+
+int MemoryBudget::num_threads(int num_threads, double mb_per_thread,
+                              double fraction) const {
+  num_threads = std::max(num_threads, 1);
+  if (!has_budget() || mb_per_thread <= 0)
+    return num_threads;
+
+  int fit = int(std::floor(fraction * m_budget_mb / mb_per_thread));
+  return std::max(1, std::min(num_threads, fit));
+}
+
+void MemoryBudget::reserve(double size_mb, std::string const& what) {
+  long long used = (m_used_kb += (long long)(size_mb * 1024.0));
+
+  long long peak = m_peak_kb;
+  while (used > peak && !m_peak_kb.compare_exchange_weak(peak, used)) {}
+
+  if (has_budget() && used > m_budget_mb * 1024.0 && !m_warned.exchange(true))
+    vw::vw_out(vw::WarningMessage) << "Using " << used / 1024 << " MB, which is more "
+                                   << "than the memory budget of " << m_budget_mb
+                                   << " MB, when allocating memory for: " << what << ".\n";
+}
+
+void MemoryBudget::release(double size_mb) {
+  m_used_kb -= (long long)(size_mb * 1024.0);
+}
+
+double MemoryBudget::used_mb() const { return m_used_kb / 1024.0; }
+double MemoryBudget::peak_mb() const { return m_peak_kb / 1024.0; }
+
+MemoryBudget & memory_budget() {
+  static MemoryBudget budget;
+  return budget;
+}
+
+MemoryReservation::MemoryReservation(double size_mb, std::string const& what):
+  m_size_mb(size_mb) {
+  memory_budget().reserve(m_size_mb, what);
+}
+
+MemoryReservation::~MemoryReservation() {
+  memory_budget().release(m_size_mb);
+}
+
+} // end namespace asp
@@ -0,0 +1,97 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MemoryBudget.h
+///
+/// How much memory a process may use, as set with --memory-budget,
+/// which every tool parsing its options with check_command_line()
+/// accepts. The tools ask the budget how large to make their tiles and
+/// caches and how many threads to use, rather than each having its own
+/// memory knob. Large buffers can be reserved against the budget while
+/// in use, so the peak is known and a warning is printed when the
+/// estimates were wrong. Without a budget, the tools behave as before.
+
+#ifndef __ASP_CORE_MEMORY_BUDGET_H__
+#define __ASP_CORE_MEMORY_BUDGET_H__
+
+#include <boost/utility.hpp>
+
+#include <atomic>
+#include <string>
+
+namespace asp {
+
+  class MemoryBudget: private boost::noncopyable {
+  public:
+
+    MemoryBudget();
+
+    /// Set the budget, in MB. Zero means there is no budget.
+    void   set_budget_mb(double budget_mb);
+    double budget_mb()  const { return m_budget_mb; }
+    bool   has_budget() const { return m_budget_mb > 0; }
+
+    /// This size, in MB, or the given fraction of the budget if less
+    double cap_mb(double size_mb, double fraction) const;
+
+    /// The largest tile size, a multiple of granularity and no more than
+    /// max_size, such that num_tiles square tiles with this many bytes
+    /// per pixel fit in the given fraction of the budget. The result is
+    /// at least granularity.
+    int tile_size(int max_size, double bytes_per_pixel, int num_tiles,
+                  double fraction, int granularity = 256) const;
+
+    /// The most threads, up to num_threads and at least one, which fit
+    /// in the given fraction of the budget if each uses this many MB.
+    int num_threads(int num_threads, double mb_per_thread, double fraction) const;
+
+    /// Track a buffer. Warn, once, if what is reserved goes over budget.
+    void reserve(double size_mb, std::string const& what);
+    void release(double size_mb);
+
+    /// What is reserved now, and the most ever reserved, in MB
+    double used_mb() const;
+    double peak_mb() const;
+
+  private:
+    double m_budget_mb;
+    std::atomic<long long> m_used_kb, m_peak_kb;
+    std::atomic<bool> m_warned;
+  };
+
+  /// The budget of this process
+  MemoryBudget & memory_budget();
+
+  /// Reserve memory against the budget of this process for as long as
+  /// this object exists.
+  class MemoryReservation: private boost::noncopyable {
+  public:
+    MemoryReservation(double size_mb, std::string const& what);
+    ~MemoryReservation();
+  private:
+    double m_size_mb;
+  };
+
+  /// The part of the budget given to the image block cache, and the
+  /// part given to the buffers of a tool.
+  const double MEMORY_BUDGET_CACHE_FRACTION  = 0.25;
+  const double MEMORY_BUDGET_BUFFER_FRACTION = 0.75;
+
+} // end namespace asp
+
+#endif//__ASP_CORE_MEMORY_BUDGET_H__
@@ -35,10 +35,16 @@
 #include <vw/Image/InpaintView.h>
 
 #include <asp/Core/SoftwareRenderer.h>
+#include <asp/Core/MedianFilter.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
+#include <boost/filesystem/operations.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
 #include <valarray>
+#include <fstream>
+#include <algorithm>
 
 namespace asp{
 
@@ -233,6 +239,117 @@ namespace asp{
   }; // End function operator()
 
 
+  // The file storing the boundaries of the point cloud blocks. It starts with
+  // a text line with this tag, then the key, followed by binary data.
+  const std::string BOUNDARIES_TAG = "ASP_PC_BOUNDARIES_V1";
+
+  void write_boundaries(std::string const& file, std::string const& key,
+                        BBox3 const& bbox, std::vector<double> const& errors_hist,
+                        std::vector<BBoxPair> const& boundaries) {
+
+    // Write to a temporary file first, so that a reader never sees a partial file
+    std::string tmp_file = file + ".tmp";
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs.good()) {
+      vw_out(WarningMessage) << "Could not write: " << file << "\n";
+      return;
+    }
+
+    ofs << BOUNDARIES_TAG << "\n";
+    boost::uint64_t len = key.size();
+    ofs.write((const char*)&len, sizeof(len));
+    ofs.write(key.c_str(), len);
+
+    double b[6];
+    for (int k = 0; k < 3; k++) {
+      b[k]   = bbox.min()[k];
+      b[k+3] = bbox.max()[k];
+    }
+    ofs.write((const char*)b, sizeof(b));
+
+    len = errors_hist.size();
+    ofs.write((const char*)&len, sizeof(len));
+    if (len > 0)
+      ofs.write((const char*)&errors_hist[0], len*sizeof(double));
+
+    len = boundaries.size();
+    ofs.write((const char*)&len, sizeof(len));
+    for (size_t i = 0; i < boundaries.size(); i++) {
+      for (int k = 0; k < 3; k++) {
+        b[k]   = boundaries[i].first.min()[k];
+        b[k+3] = boundaries[i].first.max()[k];
+      }
+      BBox2i const& pix = boundaries[i].second;
+      vw::int32 p[4] = {pix.min().x(), pix.min().y(), pix.max().x(), pix.max().y()};
+      ofs.write((const char*)b, sizeof(b));
+      ofs.write((const char*)p, sizeof(p));
+    }
+    ofs.close();
+
+    if (!ofs.good()) {
+      vw_out(WarningMessage) << "Could not write: " << file << "\n";
+      boost::filesystem::remove(tmp_file);
+      return;
+    }
+    boost::filesystem::rename(tmp_file, file);
+    vw_out() << "Wrote the point cloud block boundaries to: " << file << "\n";
+  }
+
+  // Read the boundaries. Return false if the file is missing, or was
+  // written for a different key or with a different number of histogram bins.
+  bool read_boundaries(std::string const& file, std::string const& key,
+                       BBox3 & bbox, std::vector<double> & errors_hist,
+                       std::vector<BBoxPair> & boundaries) {
+
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    if (!ifs.good())
+      return false;
+
+    std::string tag;
+    std::getline(ifs, tag);
+    if (tag != BOUNDARIES_TAG)
+      return false;
+
+    boost::uint64_t len = 0;
+    ifs.read((char*)&len, sizeof(len));
+    if (!ifs.good() || len != key.size())
+      return false;
+    std::string file_key(len, ' ');
+    ifs.read(&file_key[0], len);
+    if (!ifs.good() || file_key != key)
+      return false;
+
+    double b[6];
+    ifs.read((char*)b, sizeof(b));
+    BBox3 file_bbox(Vector3(b[0], b[1], b[2]), Vector3(b[3], b[4], b[5]));
+
+    ifs.read((char*)&len, sizeof(len));
+    if (!ifs.good() || len != errors_hist.size())
+      return false;
+    std::vector<double> file_hist(len);
+    if (len > 0)
+      ifs.read((char*)&file_hist[0], len*sizeof(double));
+
+    ifs.read((char*)&len, sizeof(len));
+    if (!ifs.good())
+      return false;
+    std::vector<BBoxPair> file_boundaries(len);
+    for (size_t i = 0; i < file_boundaries.size(); i++) {
+      vw::int32 p[4];
+      ifs.read((char*)b, sizeof(b));
+      ifs.read((char*)p, sizeof(p));
+      file_boundaries[i].first  = BBox3(Vector3(b[0], b[1], b[2]), Vector3(b[3], b[4], b[5]));
+      file_boundaries[i].second = BBox2i(Vector2i(p[0], p[1]), Vector2i(p[2], p[3]));
+    }
+    if (!ifs.good())
+      return false;
+
+    bbox        = file_bbox;
+    errors_hist = file_hist;
+    boundaries.swap(file_boundaries);
+    return true;
+  }
+
   void remove_outliers(ImageView<Vector3> & image, ImageViewRef<double> const& errors,
                        double error_cutoff, BBox2i const& box){
 
@@ -271,30 +388,22 @@ namespace asp{
     int nc = image.cols(), nr = image.rows(); // shorten
     double nan = std::numeric_limits<double>::quiet_NaN();
 
-    ImageView<Vector3> image_out = copy(image);
-
-    for (int col = 0; col < image.cols(); col++){
-      for (int row = 0; row < image.rows(); row++){
-
-        if (boost::math::isnan(image(col, row).z()))
-          continue;
-
-        std::vector<double> vals;
-        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
-          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
-            if (boost::math::isnan(image(c, r).z()))
-              continue;
-            vals.push_back(image(c, r).z());
-          }
-        }
-        double median = vw::math::destructive_median(vals);
-        if (fabs(median - image(col, row).z()) > thresh){
-          image_out(col, row).z() = nan;
-        }
+    ImageView<double> heights(nc, nr), median;
+    ImageView<uint8>  valid(nc, nr), median_valid;
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
+        heights(col, row) = image(col, row).z();
+        valid(col, row)   = !boost::math::isnan(image(col, row).z());
       }
     }
+    asp::median_filter(heights, valid, half, half, median, median_valid);
 
-    image = copy(image_out);
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
+        if (valid(col, row) && fabs(median(col, row) - heights(col, row)) > thresh)
+          image(col, row).z() = nan;
+      }
+    }
   }
 
   // TODO: This function should live somewhere else!
@@ -367,9 +476,10 @@ namespace asp{
    std::string const& filter,
    double default_grid_size_multiplier,
    size_t *num_invalid_pixels, vw::Mutex *count_mutex,
-   const ProgressCallback& progress):
+   const ProgressCallback& progress,
+   std::string const& boundaries_file, std::string const& boundaries_key):
     // Ensure all members are initiated, even if to temporary values
-    m_point_image(point_image), m_texture(ImageView<float>(1,1)),
+    m_point_image(point_image), m_texture(ImageView<float>(1,1)), m_texture_is_height(false),
     m_bbox(BBox3()), m_snapped_bbox(BBox3()), m_spacing(0.0), m_default_spacing(0.0),
     m_default_spacing_x(0.0), m_default_spacing_y(0.0),
     m_search_radius_factor(search_radius_factor),
@@ -382,6 +492,7 @@ namespace asp{
     m_error_image(error_image), m_error_cutoff(-1.0),
     m_median_filter_params(median_filter_params), m_erode_len(erode_len),
     m_default_grid_size_multiplier(default_grid_size_multiplier),
+    m_max_samples_per_pixel(0),
     m_num_invalid_pixels(num_invalid_pixels),
     m_count_mutex(count_mutex){
 
@@ -428,26 +539,49 @@ namespace asp{
     sub_block_size = int(round(pow(2.0, floor(log(sub_block_size)/log(2.0)))));
     sub_block_size = std::max(16, sub_block_size);
     sub_block_size = std::min(max_subblock_size(), sub_block_size);
-    std::vector<BBox2i> blocks = subdivide_bbox(m_point_image, m_block_size, m_block_size);
-
-    // Find the bounding box of each subblock, stored in
-    // m_point_image_boundaries, together with other info by
-    // searching through the image.
-    FifoWorkQueue queue( vw_settings().default_num_threads() );
-    typedef SubBlockBoundaryTask task_type;
-    Mutex mutex;
-    float inc_amt = 1.0 / float(blocks.size());
-    for ( size_t i = 0; i < blocks.size(); i++ ) {
-      boost::shared_ptr<task_type>
-        task(new task_type(m_point_image, sub_block_size, blocks[i],
-                           m_bbox, m_point_image_boundaries,
-                           error_image, estim_max_error, estim_proj_box, errors_hist,
-                           max_valid_triangulation_error,
-                           mutex, progress, inc_amt));
-      queue.add_task(task);
-    }
-    queue.join_all();
-    progress.report_finished();
+
+    // All the inputs the boundaries depend on, besides the cloud and projection
+    std::ostringstream key_os;
+    key_os.precision(17);
+    key_os << boundaries_key << "\n" << point_image.cols() << " " << point_image.rows()
+           << " " << m_block_size << " " << sub_block_size << " " << errors_hist.size()
+           << " " << estim_max_error << " " << estim_proj_box
+           << " " << max_valid_triangulation_error;
+    std::string full_key = key_os.str();
+
+    if (boundaries_file != "" &&
+        read_boundaries(boundaries_file, full_key, m_bbox, errors_hist,
+                        m_point_image_boundaries)) {
+      vw_out() << "Read the point cloud block boundaries from: " << boundaries_file << "\n";
+      progress.report_finished();
+    } else {
+      std::vector<BBox2i> blocks = subdivide_bbox(m_point_image, m_block_size, m_block_size);
+
+      // Find the bounding box of each subblock, stored in
+      // m_point_image_boundaries, together with other info by
+      // searching through the image.
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      typedef SubBlockBoundaryTask task_type;
+      Mutex mutex;
+      float inc_amt = 1.0 / float(blocks.size());
+      for ( size_t i = 0; i < blocks.size(); i++ ) {
+        boost::shared_ptr<task_type>
+          task(new task_type(m_point_image, sub_block_size, blocks[i],
+                             m_bbox, m_point_image_boundaries,
+                             error_image, estim_max_error, estim_proj_box, errors_hist,
+                             max_valid_triangulation_error,
+                             mutex, progress, inc_amt));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      progress.report_finished();
+
+      if (boundaries_file != "" && !m_bbox.empty())
+        write_boundaries(boundaries_file, full_key, m_bbox, errors_hist,
+                         m_point_image_boundaries);
+    }
+
+    build_boundary_index();
 
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
@@ -527,6 +661,66 @@ namespace asp{
   } // End OrthoRasterizerView Constructor
 
 
+  void OrthoRasterizerView::build_boundary_index() {
+
+    m_index_box = BBox2();
+    m_index_cells.clear();
+    m_index_dims = Vector2i(0, 0);
+    for (size_t i = 0; i < m_point_image_boundaries.size(); i++) {
+      BBox3 const& b = m_point_image_boundaries[i].first;
+      m_index_box.grow(Vector2(b.min().x(), b.min().y()));
+      m_index_box.grow(Vector2(b.max().x(), b.max().y()));
+    }
+    int num = m_point_image_boundaries.size();
+    if (num == 0)
+      return;
+
+    // About one boundary per cell on average
+    int n = std::max(1, int(ceil(sqrt(double(num)))));
+    m_index_dims = Vector2i(n, n);
+    for (int k = 0; k < 2; k++) {
+      double len = m_index_box.max()[k] - m_index_box.min()[k];
+      if (!(len > 0) || std::isinf(len)) { // also catches NaN
+        m_index_dims[k] = 1;
+        len = 1.0;
+      }
+      m_index_cell_size[k] = len / m_index_dims[k];
+    }
+    m_index_cells.resize(m_index_dims[0] * m_index_dims[1]);
+
+    std::vector<int> cells;
+    for (int i = 0; i < num; i++) {
+      BBox3 const& b = m_point_image_boundaries[i].first;
+      int c0 = cell_index(b.min().x(), 0), c1 = cell_index(b.max().x(), 0);
+      int r0 = cell_index(b.min().y(), 1), r1 = cell_index(b.max().y(), 1);
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          m_index_cells[r * m_index_dims[0] + c].push_back(i);
+    }
+  }
+
+  // The boundaries which may intersect the given box, in increasing order
+  void OrthoRasterizerView::find_boundaries(BBox3 const& box,
+                                            std::vector<int> & indices) const {
+    indices.clear();
+    if (m_index_cells.empty())
+      return;
+    if (box.max().x() < m_index_box.min().x() || box.min().x() > m_index_box.max().x() ||
+        box.max().y() < m_index_box.min().y() || box.min().y() > m_index_box.max().y())
+      return;
+
+    int c0 = cell_index(box.min().x(), 0), c1 = cell_index(box.max().x(), 0);
+    int r0 = cell_index(box.min().y(), 1), r1 = cell_index(box.max().y(), 1);
+    for (int r = r0; r <= r1; r++) {
+      for (int c = c0; c <= c1; c++) {
+        std::vector<int> const& cell = m_index_cells[r * m_index_dims[0] + c];
+        indices.insert(indices.end(), cell.begin(), cell.end());
+      }
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  }
+
   // This is kind of like part 2 of the constructor
   // - This function finalizes the spacing and generates a spacing-snapped BBox.
   void OrthoRasterizerView::initialize_spacing(const double spacing) {
@@ -574,6 +768,12 @@ namespace asp{
 
   } // End function initialize_spacing()
 
+  double OrthoRasterizerView::search_radius() const {
+    if (m_search_radius_factor <= 0.0)
+      return std::max(m_spacing, m_default_spacing);
+    return m_spacing*m_search_radius_factor;
+  }
+
   // Function to convert pixel coordinates to the point domain
   BBox3 OrthoRasterizerView::pixel_to_point_bbox( BBox2 const& inbox ) const {
     BBox3 outbox = m_snapped_bbox;
@@ -592,8 +792,19 @@ namespace asp{
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type OrthoRasterizerView::prerasterize( BBox2i const& bbox )
     const {
-    
-    BBox2i bbox_1 = bbox;
+    BBox2i bbox_1;
+    std::vector< ImageView< PixelGray<float> > > bands;
+    rasterize_bands(bbox, false, bbox_1, bands);
+    return prerasterize_type (bands[0], BBox2i(-bbox_1.min().x(),
+                                               -bbox_1.min().y(), cols(), rows()));
+  }
+
+  void OrthoRasterizerView::rasterize_bands(BBox2i const& bbox, bool with_fused,
+                                            BBox2i & bbox_1,
+                                            std::vector< ImageView< PixelGray<float> > > & bands)
+    const {
+
+    bbox_1 = bbox;
 
     // bugfix, ensure we see enough beyond current tile
     bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
@@ -601,8 +812,14 @@ namespace asp{
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
+    // The first band is for the texture, the others for the fused
+    // textures, each gridded from the same points.
+    int num_bands = 1;
+    if (with_fused)
+      num_bands += m_fused_textures.size();
+
     ImageView<float > render_buffer;
-    ImageView<double> d_buffer, weights;
+    std::vector< ImageView<double> > d_buffers(num_bands), weights(num_bands);
     if (m_use_surface_sampling){
       render_buffer.set_size(bbox_1.width(), bbox_1.height());
     }
@@ -619,19 +836,18 @@ namespace asp{
     // with different weights (set by Gaussian). We make this radius
     // no smaller than the default DEM spacing. Search radius can be
     // over-ridden by user.
-    double search_radius;
-    if (m_search_radius_factor <= 0.0)
-      search_radius = std::max(m_spacing, m_default_spacing);
-    else
-      search_radius = m_spacing*m_search_radius_factor;
-    asp::Point2Grid point2grid(bbox_1.width(),
-                               bbox_1.height(),
-                               d_buffer, weights,
-                               local_3d_bbox.min().x(),
-                               local_3d_bbox.min().y(),
-                               m_spacing, m_default_spacing,
-                               search_radius, m_sigma_factor,
-                               m_filter, m_percentile);
+    double search_radius = this->search_radius();
+    std::vector< boost::shared_ptr<asp::Point2Grid> > point2grids(num_bands);
+    for (int band = 0; band < num_bands; band++)
+      point2grids[band].reset(new asp::Point2Grid(bbox_1.width(),
+                                                  bbox_1.height(),
+                                                  d_buffers[band], weights[band],
+                                                  local_3d_bbox.min().x(),
+                                                  local_3d_bbox.min().y(),
+                                                  m_spacing, m_default_spacing,
+                                                  search_radius, m_sigma_factor,
+                                                  m_filter, m_percentile,
+                                                  m_max_samples_per_pixel));
     
     // Set up the default color value
     double min_val = 0.0;
@@ -653,7 +869,8 @@ namespace asp{
       renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
       renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
     }else{
-      point2grid.Clear(min_val);
+      for (int band = 0; band < num_bands; band++)
+        point2grids[band]->Clear(min_val);
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -664,7 +881,10 @@ namespace asp{
     typedef std::map<BBox2i, BBox2i, compare_bboxes> BlockMapType;
     typedef BlockMapType::iterator MapIterType;
     BlockMapType blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary, m_point_image_boundaries ) {
+    std::vector<int> nearby;
+    find_boundaries(local_3d_bbox, nearby);
+    for (size_t i = 0; i < nearby.size(); i++) {
+      BBoxPair const& boundary = m_point_image_boundaries[nearby[i]];
       if (! local_3d_bbox.intersects(boundary.first) )
         continue;
 
@@ -682,6 +902,7 @@ namespace asp{
 
     }
 
+    bands.resize(num_bands);
     if ( blocks_map.empty() ){
 
       // TODO: Don't include these pixels in the total?
@@ -690,17 +911,22 @@ namespace asp{
         (*m_num_invalid_pixels) += bbox.width()*bbox.height();
       }
       
-      if (m_use_surface_sampling){
-        return prerasterize_type( render_buffer, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
-      }else{
-        return prerasterize_type( d_buffer,      BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
+      for (int band = 0; band < num_bands; band++) {
+        if (m_use_surface_sampling)
+          bands[band] = render_buffer;
+        else
+          bands[band] = d_buffers[band];
       }
+      return;
     }
 
     // This is very important. When doing surface sampling, for each
     // pixel we need to see its next up and right neighbors.
     int d = (int)m_use_surface_sampling;
 
+    std::vector<Vector3> batch;
+    std::vector< std::vector<Vector3> > fused_batches(num_bands);
+    std::vector< ImageView<float> > fused_copies(num_bands);
     for (MapIterType it = blocks_map.begin(); it != blocks_map.end(); it++){
 
       BBox2i block = it->second;
@@ -723,7 +949,21 @@ namespace asp{
       // Crop back to the area of interest
       point_copy = crop(point_copy, block - biased_block.min());
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      ImageView<float> texture_copy;
+      if (m_texture_is_height) {
+        // The filtering above only invalidates heights, and invalid points
+        // are skipped below, so the heights in memory can be used.
+        texture_copy.set_size(point_copy.cols(), point_copy.rows());
+        for (int c = 0; c < point_copy.cols(); c++)
+          for (int r = 0; r < point_copy.rows(); r++)
+            texture_copy(c, r) = point_copy(c, r).z();
+      } else {
+        texture_copy = crop(m_texture, block );
+      }
+
+      // The fused textures are read for the same block
+      for (int band = 1; band < num_bands; band++)
+        fused_copies[band] = crop(m_fused_textures[band - 1], block);
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -770,11 +1010,15 @@ namespace asp{
             }
 
           }else{
-            // The new engine
+            // The new engine. Collect the points, to grid them in one batch.
             if ( !boost::math::isnan(point_copy(col, row).z()) ){
-              point2grid.AddPoint(point_copy(col, row).x(),
-                                  point_copy(col, row).y(),
-                                  texture_copy(col,  row));
+              batch.push_back(Vector3(point_copy(col, row).x(),
+                                      point_copy(col, row).y(),
+                                      texture_copy(col,  row)));
+              for (int band = 1; band < num_bands; band++)
+                fused_batches[band].push_back(Vector3(point_copy(col, row).x(),
+                                                      point_copy(col, row).y(),
+                                                      fused_copies[band](col, row)));
             }
           }
           point_ul.next_col();
@@ -782,20 +1026,33 @@ namespace asp{
         row_acc.next_row();
       } // End row loop
 
+      if (!m_use_surface_sampling) {
+        point2grids[0]->AddPoints(batch);
+        batch.clear();
+        for (int band = 1; band < num_bands; band++) {
+          point2grids[band]->AddPoints(fused_batches[band]);
+          fused_batches[band].clear();
+        }
+      }
+
     }
 
-    if (!m_use_surface_sampling)
-      point2grid.normalize();
+    if (!m_use_surface_sampling) {
+      for (int band = 0; band < num_bands; band++)
+        point2grids[band]->normalize();
+    }
 
     // The software renderer returns an image which will render
     // upside down in most image formats, so we correct that here.
     // We also introduce transparent pixels into the result where necessary.
     // TODO: Here can do flipping in place.
-    ImageView< PixelGray<float> > result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
+    for (int band = 0; band < num_bands; band++) {
+      if (m_use_surface_sampling)
+        bands[band] = flip_vertical(render_buffer);
+      else
+        bands[band] = flip_vertical(d_buffers[band]);
+    }
+    ImageView< PixelGray<float> > const& result = bands[0];
 
     // Loop through result here and count up how many pixels have been
     // changed from the default value.
@@ -815,10 +1072,25 @@ namespace asp{
       vw::Mutex::Lock lock(*m_count_mutex);
       (*m_num_invalid_pixels) += num_unset;
     }
+  }
 
-    return prerasterize_type (result, BBox2i(-bbox_1.min().x(),
-                                             -bbox_1.min().y(), cols(), rows()));
+  FusedOrthoRasterizerView::prerasterize_type
+  FusedOrthoRasterizerView::prerasterize(BBox2i const& bbox) const {
+    BBox2i bbox_1;
+    std::vector< ImageView< PixelGray<float> > > bands;
+    m_rasterizer.rasterize_bands(bbox, true, bbox_1, bands);
+
+    // Each band becomes a plane
+    ImageView<pixel_type> result(bbox_1.width(), bbox_1.height(), bands.size());
+    for (size_t band = 0; band < bands.size(); band++)
+      for (int row = 0; row < result.rows(); row++)
+        for (int col = 0; col < result.cols(); col++)
+          result(col, row, band) = bands[band](col, row);
+
+    return prerasterize_type(result, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(),
+                                            cols(), rows()));
   }
+  /// \endcond
 
   // Return the affine georeferencing transform.
   vw::Matrix<double,3,3> OrthoRasterizerView::geo_transform() {
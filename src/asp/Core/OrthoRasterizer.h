@@ -32,6 +32,11 @@
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
 
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
 namespace asp{
 
   using namespace vw;
@@ -46,6 +51,8 @@ namespace asp{
     public ImageViewBase<OrthoRasterizerView> {
     ImageViewRef<Vector3> m_point_image;
     ImageViewRef<float>   m_texture;
+    std::vector< ImageViewRef<float> > m_fused_textures; // gridded along with the texture
+    bool    m_texture_is_height; // if the texture is the z channel of the point image
     BBox3   m_bbox, m_snapped_bbox; // bounding box of point cloud
     double  m_spacing;         // point cloud units (usually m or deg) per pixel
     double  m_default_spacing; // if user did not specify spacing
@@ -66,20 +73,41 @@ namespace asp{
     asp::FilterType m_filter;
     double m_percentile;
     double m_default_grid_size_multiplier;
+    int    m_max_samples_per_pixel;
     size_t     *m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
     vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    // A uniform grid over the x-y extent of the boundaries. Each cell
+    // lists the indices of the boundaries overlapping it, so that
+    // a tile looks only at the point cloud blocks near it.
+    BBox2    m_index_box;
+    Vector2  m_index_cell_size;
+    Vector2i m_index_dims;
+    std::vector< std::vector<int> > m_index_cells;
+    void build_boundary_index();
+    void find_boundaries(BBox3 const& box, std::vector<int> & indices) const;
+    int cell_index(double val, int k) const {
+      double i = floor((val - m_index_box.min()[k]) / m_index_cell_size[k]);
+      if (!(i > 0)) return 0; // also catches NaN
+      return (int)std::min(i, double(m_index_dims[k] - 1));
+    }
+
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
+    // Grid the texture, and the fused textures if with_fused is true,
+    // in one pass over the points near the given box. The bands are
+    // for the box expanded to bbox_1.
+    void rasterize_bands(BBox2i const& bbox, bool with_fused, BBox2i & bbox_1,
+                         std::vector< ImageView< PixelGray<float> > > & bands) const;
+    friend class FusedOrthoRasterizerView;
+
   public:
     typedef PixelGray<float> pixel_type;
     typedef const PixelGray<float> result_type;
@@ -87,6 +115,10 @@ namespace asp{
     static int max_subblock_size(){ return 128;} // is used in point2dem and below
 
     /// Constructor.  You must call initialize_spacing before using the object!!
+    /// If boundaries_file is set, the bounding boxes of the point cloud blocks
+    /// are read from it rather than computed, if it was saved with the same
+    /// key and parameters. Otherwise they are computed and saved to it.
+    /// The key must identify the point cloud and projection.
     OrthoRasterizerView(ImageViewRef<Vector3> point_image,
                         ImageViewRef<double > texture,
                         double  search_radius_factor,
@@ -107,7 +139,9 @@ namespace asp{
                         double  default_grid_size_multiplier,
                         size_t  *num_invalid_pixels,
                         vw::Mutex *count_mutex,
-                        const ProgressCallback& progress);
+                        const ProgressCallback& progress,
+                        std::string const& boundaries_file = "",
+                        std::string const& boundaries_key  = "");
 
     /// This must be called before the object can be used!
     void initialize_spacing(double spacing=0.0);
@@ -123,8 +157,33 @@ namespace asp{
       ArgumentErr() << "Orthorasterizer: set_texture() failed."
                     << " Texture dimensions must match point image dimensions.");
       m_texture = channel_cast<float>(channels_to_planes(texture.impl()));
+      m_texture_is_height = false;
     }
 
+    /// Use the z coordinate of the points as the texture, as when
+    /// creating a DEM. Then the texture is taken from the points
+    /// already in memory, rather than reading and projecting the
+    /// point cloud again for it.
+    void set_texture_to_height() { m_texture_is_height = true; }
+
+    /// Add a texture to be gridded in the same pass over the points as
+    /// the texture, to be rendered with FusedOrthoRasterizerView. This
+    /// way the DEM, orthoimage, and error image, each from the same
+    /// points, are produced by reading and filtering the cloud once.
+    /// Not supported with surface sampling.
+    template <class TextureViewT>
+    void add_fused_texture(TextureViewT texture) {
+      VW_ASSERT(texture.impl().cols() == m_point_image.cols() &&
+                texture.impl().rows() == m_point_image.rows(),
+      ArgumentErr() << "Orthorasterizer: add_fused_texture() failed."
+                    << " Texture dimensions must match point image dimensions.");
+      VW_ASSERT(!m_use_surface_sampling,
+      ArgumentErr() << "Orthorasterizer: fused textures cannot be used with surface sampling.");
+      m_fused_textures.push_back(channel_cast<float>(channels_to_planes(texture.impl())));
+    }
+    void clear_fused_textures() { m_fused_textures.clear(); }
+    int  num_fused_textures() const { return m_fused_textures.size(); }
+
     inline int32 cols() const {return (int)round((fabs(m_snapped_bbox.max().x() - m_snapped_bbox.min().x()) / m_spacing)) + 1;}
     inline int32 rows() const {return (int)round((fabs(m_snapped_bbox.max().y() - m_snapped_bbox.min().y()) / m_spacing)) + 1;}
 
@@ -149,6 +208,7 @@ namespace asp{
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
+    void set_max_samples_per_pixel(int  val) { m_max_samples_per_pixel = val; }
     double default_value() {
       if (m_minz_as_default) return m_bbox.min().z();
       else return m_default_value;
@@ -170,6 +230,10 @@ namespace asp{
 
     double spacing() const { return m_spacing; }
 
+    /// The radius, in projected units, within which the cloud points
+    /// contribute to a DEM grid point.
+    double search_radius() const;
+
     // Convert the hole fill length from output image pixels to point cloud pixels.
     int pc_hole_fill_len(int hole_fill_len){
 
@@ -191,6 +255,40 @@ namespace asp{
     
   };
 
+  /// The texture of an OrthoRasterizerView and its fused textures,
+  /// gridded together, as the planes of one image, in that order.
+  class FusedOrthoRasterizerView:
+    public ImageViewBase<FusedOrthoRasterizerView> {
+    OrthoRasterizerView const& m_rasterizer;
+  public:
+    typedef PixelGray<float> pixel_type;
+    typedef const PixelGray<float> result_type;
+    typedef ProceduralPixelAccessor<FusedOrthoRasterizerView> pixel_accessor;
+
+    FusedOrthoRasterizerView(OrthoRasterizerView const& rasterizer):
+      m_rasterizer(rasterizer) {}
+
+    inline int32 cols  () const { return m_rasterizer.cols(); }
+    inline int32 rows  () const { return m_rasterizer.rows(); }
+    inline int32 planes() const { return 1 + m_rasterizer.num_fused_textures(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "FusedOrthoRasterizerView::operator() has not been implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const;
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   // TODO: Make this a BBox class function!!!
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
@@ -34,20 +34,132 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PhotometricOutlier.h>
+
+#include <cmath>
 namespace fs = boost::filesystem;
 
 using namespace vw;
 using namespace asp;
 
+namespace {
+
+  // Bilinear interpolation of an image which is zero outside the given
+  // box, where the image starts.
+  template <class ImageT>
+  float interp_zero_edge(ImageT const& img, BBox2i const& box, Vector2 const& pix) {
+    int x0 = int(floor(pix[0])), y0 = int(floor(pix[1]));
+    double u = pix[0] - x0, v = pix[1] - y0;
+    double sum = 0.0;
+    for (int dy = 0; dy <= 1; dy++) {
+      for (int dx = 0; dx <= 1; dx++) {
+        Vector2i q(x0 + dx, y0 + dy);
+        if (!box.contains(q))
+          continue;
+        double w = (dx ? u : 1.0 - u) * (dy ? v : 1.0 - v);
+        sum += w * img(q[0] - box.min().x(), q[1] - box.min().y())[0];
+      }
+    }
+    return sum;
+  }
+
+  // The absolute difference of the left image and the right image
+  // projected into the left one through the disparity, found in one pass
+  // per tile. Only the part of the right image seen by the disparities
+  // of a tile is read. A pixel is invalid if its disparity is, or if the
+  // projected right image is zero there.
+  class PhotometricDiffView: public ImageViewBase<PhotometricDiffView> {
+    DiskImageView<PixelGray<float> >    m_left, m_right;
+    DiskImageView<PixelMask<Vector2f> > m_disp;
+
+  public:
+    PhotometricDiffView(DiskImageView<PixelGray<float> > const& left,
+                        DiskImageView<PixelGray<float> > const& right,
+                        DiskImageView<PixelMask<Vector2f> > const& disp):
+      m_left(left), m_right(right), m_disp(disp) {}
+
+    typedef PixelMask<PixelGray<float> > pixel_type;
+    typedef pixel_type result_type;
+    typedef ProceduralPixelAccessor<PhotometricDiffView> pixel_accessor;
+
+    inline int32 cols  () const { return m_disp.cols(); }
+    inline int32 rows  () const { return m_disp.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(double /*i*/, double /*j*/, int32 /*p*/ = 0) const {
+      vw_throw(NoImplErr() << "PhotometricDiffView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      ImageView<PixelMask<Vector2f> > disp = crop(m_disp, bbox);
+      ImageView<PixelGray<float> >    left = crop(m_left, bbox);
+
+      // The part of the right image seen by the disparities of this tile
+      BBox2i right_box;
+      for (int row = 0; row < disp.rows(); row++) {
+        for (int col = 0; col < disp.cols(); col++) {
+          if (!is_valid(disp(col, row)))
+            continue;
+          Vector2 pix = Vector2(col + bbox.min().x(), row + bbox.min().y())
+            + disp(col, row).child();
+          right_box.grow(Vector2i(int(floor(pix[0])), int(floor(pix[1]))));
+        }
+      }
+      if (!right_box.empty()) {
+        right_box.max() += Vector2i(2, 2);
+        right_box.crop(bounding_box(m_right));
+      }
+
+      // Outliers may make this box much larger than the tile. Then
+      // look up the right image pixel by pixel.
+      bool read_right = (!right_box.empty() &&
+                         double(right_box.area()) <= 4.0*double(bbox.area()));
+      ImageView<PixelGray<float> > right;
+      if (read_right)
+        right = crop(m_right, right_box);
+
+      ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          pixel_type & out = tile(col, row);
+          out = pixel_type(PixelGray<float>(0.0f));
+          out.invalidate();
+          if (!is_valid(disp(col, row)))
+            continue;
+          Vector2 pix = Vector2(col + bbox.min().x(), row + bbox.min().y())
+            + disp(col, row).child();
+          float value = read_right ?
+            interp_zero_edge(right, right_box, pix) :
+            interp_zero_edge(m_right, bounding_box(m_right), pix);
+          if (value == 0)
+            continue;
+          out = pixel_type(PixelGray<float>(std::abs(left(col, row)[0] - value)));
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+}
+
 void asp::photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                          std::string const& prefix,
                                          std::string const& input_disparity,
                                          std::string & output_disparity,
                                          int kernel_size ) {
-  // Projecting right into perspective of left
+  DiskImageView<PixelGray<float> > left_image(prefix+"-L.tif");
   DiskImageView<PixelGray<float> > right_disk_image(prefix+"-R.tif");
   DiskImageView<PixelMask<Vector2f> > disparity_disk_image( input_disparity );
-  stereo::DisparityTransform trans( disparity_disk_image );
 
   std::string cache_dir = "/tmp"; // modify here to use a different cache dir if needed
   if (!fs::is_directory(cache_dir)) {
@@ -55,33 +167,28 @@ void asp::photometric_outlier_rejection( vw::cartography::GdalWriteOptions const
     fs::create_directories(cache_dir);
   }
 
-  DiskCacheImageView<PixelGray<float> >
-    right_proj( transform( right_disk_image, trans, ZeroEdgeExtension() ), "tif", TerminalProgressCallback("asp","Projecting R:"), cache_dir);
-
-  // Differencing Left and Projected Right
-  ImageViewRef<PixelMask<PixelGray<float32> > > right_mask =
-    create_mask(right_proj);
-  DiskImageView<PixelGray<float32> > left_image(prefix+"-L.tif");
-  DiskCacheImageView<PixelGray<float> >
-    diff( abs(apply_mask(copy_mask(left_image,right_mask))-right_proj),
+  // Differencing Left and Right projected into the perspective of Left,
+  // masked where the projected Right is zero.
+  DiskCacheImageView<PixelMask<PixelGray<float> > >
+    diff( PhotometricDiffView(left_image, right_disk_image, disparity_disk_image),
           "tif", TerminalProgressCallback("asp","\tDifference:"),
           cache_dir);
   ChannelAccumulator<math::CDFAccumulator<float32> > cdf;
   cdf.resize(8000,2001);
-  for_each_pixel(diff, cdf);
+  for_each_pixel(apply_mask(diff), cdf);
   float thresh = cdf.quantile(0.99985); // Pulling out last bin of CDF
   vw_out() << "\t  Using threshold: " << thresh << "\n";
 
   // Thresholding image and dilating
   ImageView<PixelGray<float> > dust =
-    threshold(apply_mask(copy_mask(diff,right_mask)),thresh,1.0,0.0);
+    threshold(apply_mask(diff),thresh,1.0,0.0);
   ImageView<PixelGray<float> > grass;
   grassfire(dust,grass);
   dust = gaussian_filter(grass,kernel_size/3);
 
   ImageViewRef<PixelMask<Vector2f > > cleaned_disparity =
     intersect_mask(disparity_disk_image,
-                   intersect_mask(create_mask(threshold(dust,kernel_size,0.0,1.0)),right_mask));
+                   intersect_mask(create_mask(threshold(dust,kernel_size,0.0,1.0)),diff));
 
   vw::cartography::block_write_gdal_image( prefix+"-FDust.tif",
                           cleaned_disparity, opt,
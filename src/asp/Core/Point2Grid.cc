@@ -22,6 +22,9 @@
 #include <asp/Core/Point2Grid.h>
 #include <vw/Math/Functors.h>
 
+#include <boost/cstdint.hpp>
+
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -37,9 +40,9 @@ Point2Grid::Point2Grid(int width, int height,
                        ImageView<double> & buffer, ImageView<double> & weights,
                        double x0, double y0, double grid_size, double min_spacing,
                        double radius, double sigma_factor,
-                       FilterType filter, double percentile):
+                       FilterType filter, double percentile, int max_samples):
   m_width(width), m_height(height),
-  m_buffer(buffer), m_weights(weights),
+  m_buffer(buffer), m_weights(weights), m_max_samples(max_samples),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
   m_radius(radius), m_filter(filter), m_percentile(percentile){
   
@@ -91,13 +94,89 @@ void Point2Grid::Clear(const float value) {
 
   // For these we need to keep all values (in fact, for stddev we could get away with less,
   // but it is not worth trying so hard).
-  if (m_filter == f_median || m_filter == f_stddev ||
-      m_filter == f_nmad   || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
+  m_chunks.clear();
+  if (keeps_samples()) {
+    m_first_chunk.set_size(m_width, m_height);
+    m_last_chunk.set_size (m_width, m_height);
+    for (int c = 0; c < m_width; c++){
+      for (int r = 0; r < m_height; r++){
+        m_first_chunk(c, r) = -1;
+        m_last_chunk (c, r) = -1;
+      }
+    }
   }
   
 }
 
+bool Point2Grid::keeps_samples() const {
+  return (m_filter == f_median || m_filter == f_stddev ||
+          m_filter == f_nmad   || m_filter == f_percentile);
+}
+
+// A hash of the grid point and the number of values seen so far, used as
+// a reproducible random number, so the result does not depend on threads.
+inline boost::uint64_t sample_hash(boost::uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+void Point2Grid::add_sample(int ix, int iy, double z) {
+
+  boost::uint64_t num_seen = (boost::uint64_t)m_weights(ix, iy);
+  if (num_seen == 0)
+    m_buffer(ix, iy) = z; // the values are stored relative to this one
+  m_weights(ix, iy) += 1;
+  float val = z - m_buffer(ix, iy);
+
+  // Once the store is full, the new value replaces a random one with
+  // probability max_samples/(num_seen + 1), so that all values seen
+  // so far are equally likely to be kept.
+  if (m_max_samples > 0 && num_seen >= (boost::uint64_t)m_max_samples) {
+    boost::uint64_t pos = sample_hash((boost::uint64_t(iy) * m_width + ix) ^
+                                      (num_seen << 24)) % (num_seen + 1);
+    if (pos >= (boost::uint64_t)m_max_samples)
+      return;
+    vw::int32 chunk = m_first_chunk(ix, iy);
+    for (boost::uint64_t k = 0; k < pos / CHUNK_SIZE; k++)
+      chunk = m_chunks[chunk].next;
+    m_chunks[chunk].vals[pos % CHUNK_SIZE] = val;
+    return;
+  }
+
+  int pos = num_seen % CHUNK_SIZE;
+  if (pos == 0) {
+    // Start a new chunk
+    SampleChunk chunk;
+    chunk.next = -1;
+    m_chunks.push_back(chunk);
+    vw::int32 index = m_chunks.size() - 1;
+    if (m_last_chunk(ix, iy) < 0)
+      m_first_chunk(ix, iy) = index;
+    else
+      m_chunks[m_last_chunk(ix, iy)].next = index;
+    m_last_chunk(ix, iy) = index;
+  }
+  m_chunks[m_last_chunk(ix, iy)].vals[pos] = val;
+}
+
+void Point2Grid::get_samples(int ix, int iy, std::vector<double> & vals) const {
+
+  vals.clear();
+  boost::uint64_t num = (boost::uint64_t)m_weights(ix, iy);
+  if (m_max_samples > 0)
+    num = std::min(num, (boost::uint64_t)m_max_samples);
+
+  double ref = m_buffer(ix, iy);
+  vw::int32 chunk = m_first_chunk(ix, iy);
+  for (boost::uint64_t k = 0; k < num; k++) {
+    vals.push_back(ref + m_chunks[chunk].vals[k % CHUNK_SIZE]);
+    if (k % CHUNK_SIZE == CHUNK_SIZE - 1)
+      chunk = m_chunks[chunk].next;
+  }
+}
+
 void Point2Grid::AddPoint(double x, double y, double z){
 
   int minx = std::max( (int)ceil( (x - m_radius - m_x0)/m_grid_size ), 0 );
@@ -106,64 +185,110 @@ void Point2Grid::AddPoint(double x, double y, double z){
   int maxx = std::min( (int)floor( (x + m_radius - m_x0)/m_grid_size ), m_buffer.cols() - 1 );
   int maxy = std::min( (int)floor( (y + m_radius - m_y0)/m_grid_size ), m_buffer.rows() - 1 );
 
-  // Add the contribution of current point to all grid points within radius
+  if (minx > maxx || miny > maxy)
+    return;
+
+  // The squared distances along x to the grid columns, shared by all rows
+  int num_x = maxx - minx + 1;
+  if ((int)m_dx2.size() < num_x)
+    m_dx2.resize(num_x);
   for (int ix = minx; ix <= maxx; ix++){
-    for (int iy = miny; iy <= maxy; iy++){
-      
-      double gx   = m_x0 + ix*m_grid_size;
-      double gy   = m_y0 + iy*m_grid_size;
-      double dist = sqrt( (x-gx)*(x-gx) + (y-gy)*(y-gy) );
-      if ( dist > m_radius ) continue;
+    double gx = m_x0 + ix*m_grid_size;
+    m_dx2[ix - minx] = (x-gx)*(x-gx);
+  }
+
+  // Add the contribution of current point to all grid points within radius.
+  // Go along rows, as consecutive grid points in a row are contiguous in memory.
+  for (int iy = miny; iy <= maxy; iy++){
+
+    double gy  = m_y0 + iy*m_grid_size;
+    double dy2 = (y-gy)*(y-gy);
+    double * buf = &m_buffer (0, iy);
+    double * wts = &m_weights(0, iy);
+    double const* dx2 = &m_dx2[0] - minx;
 
-      if (m_filter == f_weighted_average) {
+    switch (m_filter) {
+
+    case f_weighted_average:
+      for (int ix = minx; ix <= maxx; ix++){
+        double dist = sqrt( dx2[ix] + dy2 );
+        if ( dist > m_radius ) continue;
         double wt = m_sampled_gauss[(int)round(dist/m_dx)];
         if (wt <= 0)
           continue;
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z*wt;
-        m_weights(ix, iy) += wt;
-
-      }else if (m_filter == f_mean){
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z;
-        m_weights(ix, iy) += 1;
-        
-      }else if (m_filter == f_min){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_buffer(ix, iy) = std::min(m_buffer(ix, iy), z);
-      
-      }else if (m_filter == f_max){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
+        if (wts[ix] == 0)
+          buf[ix] = 0.0; // set to 0 before incrementing below
+        buf[ix] += z*wt;
+        wts[ix] += wt;
+      }
+      break;
+
+    case f_mean:
+      for (int ix = minx; ix <= maxx; ix++){
+        if ( sqrt( dx2[ix] + dy2 ) > m_radius ) continue;
+        if (wts[ix] == 0)
+          buf[ix] = 0.0; // set to 0 before incrementing below
+        buf[ix] += z;
+        wts[ix] += 1;
+      }
+      break;
+
+    case f_min:
+      for (int ix = minx; ix <= maxx; ix++){
+        if ( sqrt( dx2[ix] + dy2 ) > m_radius ) continue;
+        if (wts[ix] == 0) {
+          buf[ix] = z; // first time we set the value
+          wts[ix] = 1; // mark the fact that the buffer was initialized
         }else
-          m_buffer(ix, iy) = std::max(m_buffer(ix, iy), z);
-        
-      }else if (m_filter == f_count){
-        if (m_weights(ix, iy) == 0) {
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
+          buf[ix] = std::min(buf[ix], z);
+      }
+      break;
+
+    case f_max:
+      for (int ix = minx; ix <= maxx; ix++){
+        if ( sqrt( dx2[ix] + dy2 ) > m_radius ) continue;
+        if (wts[ix] == 0) {
+          buf[ix] = z; // first time we set the value
+          wts[ix] = 1; // mark the fact that the buffer was initialized
         }else
-          m_weights(ix, iy) += 1;
-        
-      }else if (m_filter == f_stddev || m_filter == f_median ||
-                m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+          buf[ix] = std::max(buf[ix], z);
       }
-      
+      break;
+
+    case f_count:
+      for (int ix = minx; ix <= maxx; ix++){
+        if ( sqrt( dx2[ix] + dy2 ) > m_radius ) continue;
+        wts[ix] += 1;
+      }
+      break;
+
+    default: // the filters which keep all values
+      for (int ix = minx; ix <= maxx; ix++){
+        if ( sqrt( dx2[ix] + dy2 ) > m_radius ) continue;
+        add_sample(ix, iy, z); // not strictly needed for stddev
+      }
+      break;
     }
-    
   }
 }
 
+void Point2Grid::AddPoints(std::vector<vw::Vector3> const& points){
+  for (size_t i = 0; i < points.size(); i++)
+    AddPoint(points[i][0], points[i][1], points[i][2]);
+}
+
 void Point2Grid::normalize(){
+
+  std::vector<double> vals;
   for (int c = 0; c < m_buffer.cols(); c++){
     for (int r = 0; r < m_buffer.rows(); r++){
 
+      if (keeps_samples()) {
+        if (m_weights(c, r) == 0)
+          continue; // nothing to compute
+        get_samples(c, r, vals);
+      }
+
       if (m_filter == f_weighted_average || m_filter == f_mean) {
         if (m_weights(c, r) > 0)
           m_buffer (c, r) /= m_weights(c, r);
@@ -172,33 +297,25 @@ void Point2Grid::normalize(){
         m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
 
       else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
         vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < vals.size(); it++) 
+          V(vals[it]);
         m_buffer(c, r) = V.value();
       }
       
       else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
         vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < vals.size(); it++) 
+          V(vals[it]);
         m_buffer(c, r) = V.value();
       }
 
       else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
+        m_buffer(c, r) = vw::math::destructive_nmad(vals);
       }
       
       else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
+        m_buffer(c, r) = vw::math::destructive_percentile(vals, m_percentile);
       }
       
     }
@@ -23,6 +23,10 @@
 #define __VW_POINT2GRID_H__
 
 #include <vw/Image/ImageView.h>
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/Vector.h>
+
+#include <vector>
 
 namespace asp {
 
@@ -33,6 +37,14 @@ namespace asp {
   /// Given a set of xyz points, create an xy grid. For every node in the
   /// grid, combine all points within given radius of the grid point and
   /// calculate a single z value at the grid point.
+  ///
+  /// For the filters which need all values at a grid point (median, stddev,
+  /// nmad, percentile), these are stored as floats, relative to the first
+  /// value at that point, in fixed-size chunks allocated from one arena.
+  /// If max_samples is positive, at most that many values are kept per grid
+  /// point, as a uniform random subset of all of them (reservoir sampling),
+  /// which bounds the memory use. The result is then exact only at grid
+  /// points with no more than that many values.
   class Point2Grid {
 
   public:
@@ -41,22 +53,40 @@ namespace asp {
                double x0, double y0,
                double grid_size, double min_spacing, double radius,
                double sigma_factor,
-               FilterType filter, double percentile);
+               FilterType filter, double percentile,
+               int max_samples = 0);
     ~Point2Grid(){}
     void Clear    (const float val);
     void AddPoint (double x, double y, double z);
+    /// Add the points, with the value to grid as the third coordinate.
+    /// Same as adding them one at a time, in this order.
+    void AddPoints(std::vector<vw::Vector3> const& points);
     void normalize();
 
   private:
+
+    static const int CHUNK_SIZE = 16;
+    struct SampleChunk {
+      float     vals[CHUNK_SIZE];
+      vw::int32 next; // index of the next chunk for the same grid point, or -1
+    };
+
+    bool keeps_samples() const;
+    void add_sample(int ix, int iy, double z);
+    void get_samples(int ix, int iy, std::vector<double> & vals) const;
+
     int m_width, m_height; // DEM dimensions
-    vw::ImageView<double> & m_buffer;
-    vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
+    vw::ImageView<double> & m_buffer;  // for the filters keeping the values, first value
+    vw::ImageView<double> & m_weights; // for the filters keeping the values, number seen
+    std::vector<SampleChunk>   m_chunks; // the arena
+    vw::ImageView<vw::int32>   m_first_chunk, m_last_chunk; // -1 if no values
+    int                        m_max_samples;
     double     m_x0, m_y0; // lower-left corner
     double     m_grid_size;  // spacing between output DEM pixels
     double     m_radius;   // how far to search for cloud points
     double     m_dx;       // spacing between samples
     std::vector<double> m_sampled_gauss;
+    std::vector<double> m_dx2; // scratch space for AddPoint
     FilterType m_filter;
     double     m_percentile; // The actual value of the percentile to use if in that mode
 
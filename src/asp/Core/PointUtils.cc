@@ -25,8 +25,13 @@
 #include <asp/Core/PointUtils.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/Interpolation.h>
+#include <vw/Image/MaskViews.h>
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/next.hpp>
+#include <limits>
+#include <map>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -69,13 +74,20 @@ namespace asp{
     bool         m_has_valid_point;
     Vector3      m_curr_point;
     std::ifstream * m_ifs;
+
+    // The current batch of lines and the points parsed from them
+    std::vector<std::string>             m_lines;
+    std::vector<asp::CsvConv::CsvRecord> m_records;
+    std::vector<char>                    m_success;
+    std::vector<Vector3>                 m_points;
+    size_t                               m_point_index;
   public:
 
     CsvReader(std::string const & csv_file,
               asp::CsvConv const& csv_conv,
               GeoReference const& georef)
       : m_csv_file(csv_file), m_csv_conv(csv_conv),
-        m_is_first_line(true), m_has_valid_point(false){
+        m_is_first_line(true), m_has_valid_point(false), m_point_index(0){
 
       // We will convert from projected space to xyz, unless points
       // are already in this format.
@@ -96,27 +108,37 @@ namespace asp{
 
     virtual bool ReadNextPoint(){
 
-      std::string line;
-      asp::CsvConv::CsvRecord vals;
-
-      // Keep on reading, until a valid point is hit or the end of the file
-      // is reached.
-      while (1){
-	
-        m_has_valid_point = static_cast<bool>(getline(*m_ifs, line, '\n'));
-        if (!m_has_valid_point) return m_has_valid_point; // reached end of file
-
-        vals = m_csv_conv.parse_csv_line(m_is_first_line, m_has_valid_point, line);
-        if (m_has_valid_point) break;
+      // Keep on reading batches of lines, until a valid point is hit
+      // or the end of the file is reached. The lines in a batch are
+      // parsed in parallel. The conversion of the parsed values is
+      // serial, as it may go through PROJ.4 with a shared georeference.
+      while (m_point_index >= m_points.size()){
+
+        m_points.clear();
+        m_point_index = 0;
+        if (asp::read_lines(*m_ifs, asp::csv_batch_size(), m_lines) == 0){
+          m_has_valid_point = false;
+          return m_has_valid_point; // reached end of file
+        }
+
+        m_csv_conv.parse_csv_lines(m_lines, m_is_first_line, m_records, m_success);
+        m_is_first_line = false;
+
+        // Will return projected point and height or xyz. We really
+        // prefer projected points, as then the chipper will have an
+        // easier time grouping spatially points close together, as it
+        // operates the first two coordinates.
+        bool return_point_height = true;
+        for (size_t it = 0; it < m_lines.size(); it++){
+          if (m_success[it])
+            m_points.push_back(m_csv_conv.csv_to_cartesian_or_point_height
+                               (m_records[it], m_georef, return_point_height));
+        }
       }
 
-      // Will return projected point and height or xyz. We really
-      // prefer projected points, as then the chipper will have an
-      // easier time grouping spatially points close together, as it
-      // operates the first two coordinates.
-      bool return_point_height = true;
-      m_curr_point
-	= m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef, return_point_height);
+      m_curr_point = m_points[m_point_index];
+      m_point_index++;
+      m_has_valid_point = true;
 
       return m_has_valid_point;
     }
@@ -577,7 +599,9 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
   // Copy the input line into a temporary buffer
   const int bufSize = 2048;
   char temp[bufSize];
-  strncpy(temp, line.c_str(), bufSize);
+  size_t len = std::min(line.size(), size_t(bufSize - 1));
+  memcpy(temp, line.c_str(), len);
+  temp[len] = '\0';
 
   std::string sep = asp::csv_separator();
 
@@ -596,12 +620,14 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     return values;
   }
 
+  // Use the reentrant strtok_r(), as lines may be parsed in parallel.
   char * ptr = temp;
+  char * save_ptr = NULL;
   while(1){
 
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
+    const char* token = strtok_r(ptr, sep.c_str(), &save_ptr);  // Split line on seperator char
+    ptr = NULL; // After the first call, strtok_r expects a null pointer as input.
     if ( token == NULL ) break; // no more tokens
     if ( num_values_read >= this->num_targets ) break; // read enough values
 
@@ -612,10 +638,11 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     if (this->col2name.at(col_index) == "file") // This is a string input
       values.file = token;
     else {
-      // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
+      // Parse the floating point value from the token. This is
+      // much faster than sscanf(), which scans the entire string first.
+      char * end_ptr = NULL;
+      double val = strtod(token, &end_ptr);
+      if (end_ptr == token){ // Handle parsing failure
         success = false;
         break;
       }
@@ -641,6 +668,80 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
 }
 
 
+namespace {
+
+  // Parse a range of lines of a CSV file. Each task writes only to its
+  // own range of the outputs, so no locking is needed.
+  class CsvParseTask: public vw::Task, private boost::noncopyable {
+    asp::CsvConv                           const& m_conv;
+    std::vector<std::string>               const& m_lines;
+    size_t                                        m_beg, m_end;
+    bool                                          m_is_first_line;
+    std::vector<asp::CsvConv::CsvRecord>        & m_records;
+    std::vector<char>                           & m_success;
+  public:
+    CsvParseTask(asp::CsvConv const& conv, std::vector<std::string> const& lines,
+                 size_t beg, size_t end, bool is_first_line,
+                 std::vector<asp::CsvConv::CsvRecord> & records,
+                 std::vector<char> & success):
+      m_conv(conv), m_lines(lines), m_beg(beg), m_end(end),
+      m_is_first_line(is_first_line), m_records(records), m_success(success){}
+
+    virtual void operator()(){
+      for (size_t it = m_beg; it < m_end; it++){
+        bool is_first_line = (m_is_first_line && it == 0);
+        bool success = false;
+        m_records[it] = m_conv.parse_csv_line(is_first_line, success, m_lines[it]);
+        m_success[it] = success;
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+void asp::CsvConv::parse_csv_lines(std::vector<std::string> const& lines,
+                                   bool is_first_line,
+                                   std::vector<CsvRecord> & records,
+                                   std::vector<char> & success) const {
+  records.resize(lines.size());
+  success.resize(lines.size());
+
+  // Small batches are not worth the overhead of threads
+  const size_t min_lines_per_task = 1000;
+  int num_threads = std::max(1, int(vw_settings().default_num_threads()));
+  size_t num_tasks = std::min(size_t(num_threads),
+                              std::max(size_t(1), lines.size()/min_lines_per_task));
+  if (num_tasks <= 1){
+    CsvParseTask task(*this, lines, 0, lines.size(), is_first_line, records, success);
+    task();
+    return;
+  }
+
+  FifoWorkQueue queue(num_threads);
+  size_t task_size = (lines.size() + num_tasks - 1)/num_tasks;
+  for (size_t beg = 0; beg < lines.size(); beg += task_size){
+    size_t end = std::min(beg + task_size, lines.size());
+    boost::shared_ptr<CsvParseTask>
+      task(new CsvParseTask(*this, lines, beg, end, is_first_line && beg == 0,
+                            records, success));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
+size_t asp::read_lines(std::istream & is, size_t max_num_lines,
+                       std::vector<std::string> & lines){
+
+  // Read into the existing strings, to reuse their storage
+  lines.resize(max_num_lines);
+  size_t num_lines = 0;
+  while (num_lines < max_num_lines && std::getline(is, lines[num_lines], '\n'))
+    num_lines++;
+  lines.resize(num_lines);
+
+  return num_lines;
+}
+
 size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
 				   std::list<CsvRecord> & output_list) const {
   // Clear output object
@@ -651,14 +752,18 @@ size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
   if( !file )
     vw_throw( vw::IOErr() << "Unable to open file \"" << file_path << "\"" );
 
-  // Read through all the lines of the input file, parse each line, and build the output list.
-  bool success;
+  // Read through all the lines of the input file in batches, parse
+  // each batch in parallel, and build the output list.
   bool first_line = true;
-  std::string line = "";
-  while ( std::getline(file, line, '\n') ){
-    CsvRecord new_record = asp::CsvConv::parse_csv_line(first_line, success, line);
-    if (success)
-      output_list.push_back(new_record);
+  std::vector<std::string> lines;
+  std::vector<CsvRecord>   records;
+  std::vector<char>        success;
+  while (asp::read_lines(file, asp::csv_batch_size(), lines) > 0){
+    parse_csv_lines(lines, first_line, records, success);
+    for (size_t it = 0; it < lines.size(); it++){
+      if (success[it])
+        output_list.push_back(records[it]);
+    }
     first_line = false;
   }
 
@@ -667,6 +772,117 @@ size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
   return output_list.size();
 }
 
+namespace {
+
+  // Convert a range of parsed CSV lines to points, and check if they
+  // are in the lon-lat box. Each task writes only to its own range.
+  class CsvPointTask: public vw::Task, private boost::noncopyable {
+    asp::CsvConv                  const& m_conv;
+    GeoReference                  const& m_geo;
+    BBox2                         const& m_lonlat_box;
+    size_t                               m_beg, m_end;
+    asp::CsvConv::CsvPointBatch        & m_batch;
+  public:
+    CsvPointTask(asp::CsvConv const& conv, GeoReference const& geo,
+                 BBox2 const& lonlat_box, size_t beg, size_t end,
+                 asp::CsvConv::CsvPointBatch & batch):
+      m_conv(conv), m_geo(geo), m_lonlat_box(lonlat_box), m_beg(beg), m_end(end),
+      m_batch(batch){}
+
+    virtual void operator()(){
+      for (size_t it = m_beg; it < m_end; it++){
+        if (!m_batch.valid[it])
+          continue;
+
+        Vector3 xyz = m_conv.csv_to_cartesian(m_batch.records[it], m_geo);
+        if (xyz == Vector3() || xyz != xyz){ // invalid point
+          m_batch.valid[it] = false;
+          continue;
+        }
+        m_batch.xyz[it] = xyz;
+
+        Vector2 lonlat = m_conv.csv_to_lonlat(m_batch.records[it], m_geo);
+        m_batch.lonlat[it] = lonlat;
+        if (!m_lonlat_box.empty() && !m_lonlat_box.contains(lonlat)
+            && !m_lonlat_box.contains(lonlat + Vector2(360, 0))
+            && !m_lonlat_box.contains(lonlat - Vector2(360, 0)))
+          m_batch.valid[it] = false;
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+size_t asp::CsvConv::read_csv_points(std::string const& file_path,
+                                     GeoReference const& geo,
+                                     BBox2 const& lonlat_box, double sample_ratio,
+                                     CsvBatchJob const& job) const {
+
+  std::ifstream file( file_path.c_str() );
+  if( !file )
+    vw_throw( vw::IOErr() << "Unable to open file \"" << file_path << "\"" );
+
+  // PROJ.4 is not thread-safe with a shared georeference
+  const size_t min_lines_per_task = 1000;
+  int num_threads = std::max(1, int(vw_settings().default_num_threads()));
+  if (this->format == EASTING_HEIGHT_NORTHING)
+    num_threads = 1;
+
+  bool is_first_line = true;
+  size_t num_valid   = 0;
+  std::vector<std::string> lines;
+  CsvPointBatch batch;
+  while (asp::read_lines(file, asp::csv_batch_size(), lines) > 0){
+
+    // Skip empty and comment lines, and randomly skip a fraction of the
+    // rest, but keep the first line, which may be a header.
+    size_t num_kept = 0;
+    for (size_t it = 0; it < lines.size(); it++){
+      bool is_header = (is_first_line && it == 0);
+      if (!is_header && !asp::is_valid_csv_line(lines[it]))
+        continue;
+      if (!is_header && sample_ratio < 1.0 &&
+          double(std::rand())/double(RAND_MAX) > sample_ratio)
+        continue;
+      if (num_kept != it)
+        lines[num_kept].swap(lines[it]);
+      num_kept++;
+    }
+    lines.resize(num_kept);
+
+    parse_csv_lines(lines, is_first_line, batch.records, batch.valid);
+    is_first_line = false;
+
+    size_t num_lines = lines.size();
+    batch.xyz.assign(num_lines, Vector3());
+    batch.lonlat.assign(num_lines, Vector2());
+    size_t num_tasks = std::min(size_t(num_threads),
+                                std::max(size_t(1), num_lines/min_lines_per_task));
+    if (num_tasks <= 1){
+      CsvPointTask task(*this, geo, lonlat_box, 0, num_lines, batch);
+      task();
+    }else{
+      FifoWorkQueue queue(num_threads);
+      size_t task_size = (num_lines + num_tasks - 1)/num_tasks;
+      for (size_t beg = 0; beg < num_lines; beg += task_size){
+        boost::shared_ptr<CsvPointTask>
+          task(new CsvPointTask(*this, geo, lonlat_box, beg,
+                                std::min(beg + task_size, num_lines), batch));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    for (size_t it = 0; it < num_lines; it++)
+      num_valid += batch.valid[it];
+
+    if (!job(batch))
+      break;
+  }
+
+  return num_valid;
+}
+
 
 vw::Vector3 asp::CsvConv::sort_parsed_vector3(CsvRecord const& csv) const {
   Vector3 ordered_csv;
@@ -946,6 +1162,11 @@ bool asp::is_pcd(std::string const& file){
   return boost::iends_with(lfile, ".pcd");
 }
 
+bool asp::is_qfit(std::string const& file){
+  std::string lfile = boost::to_lower_copy(file);
+  return boost::iends_with(lfile, ".qi");
+}
+
 bool asp::is_las_or_csv_or_pcd(std::string const& file){
   return asp::is_las(file) || is_csv(file);
 }
@@ -1063,6 +1284,77 @@ void asp::parse_utm_str(std::string const& utm, int & zone, bool & north){
     vw_throw(ArgumentErr() << "Could not parse UTM string: '" << utm << "'\n");
 }
 
+namespace {
+
+  // Interpolate a DEM at the given pixels, which are all within one
+  // DEM tile. The tile is read once, with a one pixel border for the
+  // bilinear interpolation.
+  class DemBucketTask: public vw::Task, private boost::noncopyable {
+    ImageViewRef<double>  const& m_dem;
+    double                       m_dem_nodata;
+    std::vector<size_t>   const& m_indices;
+    std::vector<Vector2>  const& m_pix;
+    std::vector<double>        & m_heights;
+
+  public:
+    DemBucketTask(ImageViewRef<double> const& dem, double dem_nodata,
+                  std::vector<size_t> const& indices, std::vector<Vector2> const& pix,
+                  std::vector<double> & heights):
+      m_dem(dem), m_dem_nodata(dem_nodata), m_indices(indices), m_pix(pix),
+      m_heights(heights) {}
+
+    virtual void operator()() {
+      BBox2i box;
+      for (size_t it = 0; it < m_indices.size(); it++) {
+        Vector2 pix = m_pix[m_indices[it]];
+        box.grow(Vector2i(floor(pix[0]), floor(pix[1])));
+      }
+      box.max() += Vector2i(2, 2);
+      box.crop(bounding_box(m_dem));
+
+      ImageView< PixelMask<double> > tile = crop(create_mask(m_dem, m_dem_nodata), box);
+      ImageViewRef< PixelMask<double> > interp_tile
+        = interpolate(tile, BilinearInterpolation(), ConstantEdgeExtension());
+
+      for (size_t it = 0; it < m_indices.size(); it++) {
+        size_t index = m_indices[it];
+        Vector2 pix = m_pix[index] - box.min();
+        PixelMask<double> dem_ht = interp_tile(pix[0], pix[1]);
+        if (is_valid(dem_ht))
+          m_heights[index] = dem_ht.child();
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+void asp::dem_heights_at_pixels(ImageViewRef<double> const& dem, double dem_nodata,
+                                std::vector<Vector2> const& pix, int num_threads,
+                                std::vector<double> & heights) {
+
+  heights.assign(pix.size(), std::numeric_limits<double>::quiet_NaN());
+
+  // Bucket the pixels within the DEM by tile
+  const int tile_size = 1024;
+  std::map<std::pair<int, int>, std::vector<size_t> > buckets;
+  for (size_t it = 0; it < pix.size(); it++) {
+    if (!(pix[it][0] >= 0 && pix[it][0] <= dem.cols() - 1 &&
+          pix[it][1] >= 0 && pix[it][1] <= dem.rows() - 1))
+      continue; // out of range, or NaN
+    buckets[std::make_pair(int(pix[it][0]/tile_size), int(pix[it][1]/tile_size))]
+      .push_back(it);
+  }
+
+  FifoWorkQueue queue(num_threads > 0 ? num_threads : vw_settings().default_num_threads());
+  typedef std::map<std::pair<int, int>, std::vector<size_t> >::const_iterator BucketIter;
+  for (BucketIter it = buckets.begin(); it != buckets.end(); it++) {
+    boost::shared_ptr<DemBucketTask>
+      task(new DemBucketTask(dem, dem_nodata, it->second, pix, heights));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
 bool asp::is_valid_csv_line(std::string const& line){
   // A valid line is not empty and does not start with '#' and does not have spaces only.
 
@@ -1079,16 +1371,39 @@ bool asp::is_valid_csv_line(std::string const& line){
 
 boost::uint64_t asp::csv_file_size(std::string const& file){
 
-  std::ifstream fh( file.c_str() );
-  if( !fh )
+  FILE * fp = fopen(file.c_str(), "rb");
+  if (fp == NULL)
     vw_throw( vw::IOErr() << "Unable to open file \"" << file << "\"" );
 
-  int num_total_points = 0;
-  std::string line;
-  while ( getline(fh, line, '\n') ){
-    if (!asp::is_valid_csv_line(line)) continue;
-    num_total_points++;
+  // Count the lines which pass is_valid_csv_line(), reading the file
+  // in large blocks, without creating a string for each line.
+  boost::uint64_t num_total_points = 0;
+  bool at_line_start = true, is_comment = false, has_content = false;
+  std::vector<char> buf(4*1024*1024);
+  size_t num_read = 0;
+  while ((num_read = fread(&buf[0], 1, buf.size(), fp)) > 0){
+    for (size_t it = 0; it < num_read; it++){
+      char c = buf[it];
+      if (c == '\n'){
+        if (has_content && !is_comment)
+          num_total_points++;
+        at_line_start = true;
+        is_comment    = false;
+        has_content   = false;
+        continue;
+      }
+      if (at_line_start && c == '#')
+        is_comment = true;
+      if (c != ' ' && c != '\t')
+        has_content = true;
+      at_line_start = false;
+    }
   }
+  fclose(fp);
+
+  // The last line may not end with a newline
+  if (has_content && !is_comment)
+    num_total_points++;
 
   return num_total_points;
 }
@@ -1169,6 +1484,8 @@ std::string asp::get_cloud_type(std::string const& file_name){
     return "CSV";
   if (asp::is_las(file_name))
     return "LAS";
+  if (asp::is_qfit(file_name))
+    return "QFIT";
 
   // Note that any tif, ntf, and cub file with one channel with georeference be
   // interpreted as a DEM.
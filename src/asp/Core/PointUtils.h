@@ -24,15 +24,21 @@
 #define __ASP_CORE_POINT_UTILS_H__
 
 #include <string>
+#include <vector>
+#include <istream>
 #include <vw/Core/Functors.h>
 #include <vw/Image/PerPixelViews.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
+#include <vw/Math/BBox.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Mosaic/ImageComposite.h>
 #include <vw/FileIO/DiskImageUtils.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/CompressedBlockCache.h>
+
+#include <boost/function.hpp>
 
 namespace vw{
   namespace cartography{
@@ -62,6 +68,17 @@ namespace asp {
       std::string file;
     };
 
+    /// The points of a batch of lines of a CSV file, as read by read_csv_points()
+    struct CsvPointBatch{
+      std::vector<CsvRecord>   records; ///< The values read from each line
+      std::vector<vw::Vector3> xyz;     ///< The Cartesian point of each line
+      std::vector<vw::Vector2> lonlat;  ///< The longitude and latitude of each line
+      std::vector<char>        valid;   ///< If the line has a valid point, within the box
+    };
+
+    /// Process a batch of points. Return false to stop reading.
+    typedef boost::function<bool(CsvPointBatch const& batch)> CsvBatchJob;
+
 
   public: // Functions
 
@@ -91,11 +108,32 @@ namespace asp {
     CsvRecord parse_csv_line(bool & is_first_line, bool & success,
                               std::string const& line) const;
 
+    /// Parse a batch of lines with parse_csv_line() using multiple threads.
+    /// The outputs are in the same order as the lines. Set is_first_line
+    /// if the batch starts at the first line of the file, which may be a header.
+    void parse_csv_lines(std::vector<std::string> const& lines, bool is_first_line,
+                         std::vector<CsvRecord> & records,
+                         std::vector<char> & success) const;
+
     /// Reads an entire CSV file and stores a record for each line.
-    /// - Intended for use with smaller files.
+    /// - The lines are parsed in parallel, in batches.
     size_t read_csv_file(std::string const    & file_path,
                              std::list<CsvRecord> & output_list) const;
 
+    /// Stream the points of a CSV file, in batches of lines, which are
+    /// passed to the job in file order. The lines of a batch are parsed
+    /// and converted to points in parallel, except that the conversion
+    /// of projected coordinates is serial, as it goes through PROJ.4
+    /// with a shared georeference. If lonlat_box is not empty, only the
+    /// points within it, to within 360 degrees, are valid. Empty and
+    /// comment lines, and a random fraction 1 - sample_ratio of the
+    /// others, are skipped before parsing.
+    /// Returns the number of valid points passed to the job.
+    size_t read_csv_points(std::string const& file_path,
+                           vw::cartography::GeoReference const& geo,
+                           vw::BBox2 const& lonlat_box, double sample_ratio,
+                           CsvBatchJob const& job) const;
+
     /// Convert values read from a csv file using parse_csv_line (in the same order they appear in the file)
     /// to a Cartesian point. If return_point_height is true, and the csv point is not
     /// in xyz format, return instead the projected point and height above datum.
@@ -171,6 +209,7 @@ namespace asp {
   bool is_las              (std::string const& file); ///< Return true if this is a LAS file
   bool is_csv              (std::string const& file); ///< Return true if this is a CSV file
   bool is_pcd              (std::string const& file); ///< Return true if this is a PCD file
+  bool is_qfit             (std::string const& file); ///< Return true if this is an ATM QFIT file
   bool is_las_or_csv_or_pcd(std::string const& file); ///< Return true if this file is LAS or CSV or PCD format
 
 
@@ -205,9 +244,25 @@ namespace asp {
 
 
 
+  /// How many lines of a CSV file to parse in parallel at a time
+  inline size_t csv_batch_size(){ return 100000; }
+
+  /// Read up to max_num_lines lines from a stream. Returns the number of
+  /// lines read, which is zero at the end of the stream.
+  size_t read_lines(std::istream & is, size_t max_num_lines,
+                    std::vector<std::string> & lines);
+
   /// A valid line is not empty and does not start with '#'.
   bool is_valid_csv_line(std::string const& line);
 
+  /// The bilinearly interpolated heights of a DEM at the given pixels,
+  /// or NaN where the DEM is invalid or the pixel is outside of it.
+  /// The pixels are grouped by DEM tile, so each tile is read once,
+  /// and the tiles are processed in parallel.
+  void dem_heights_at_pixels(vw::ImageViewRef<double> const& dem, double dem_nodata,
+                             std::vector<vw::Vector2> const& pix, int num_threads,
+                             std::vector<double> & heights);
+
   /// Returns the number of points contained in a CSV file
   boost::uint64_t csv_file_size(std::string const& file);
 
@@ -368,16 +423,25 @@ template<int m>
 vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename){
 
   vw::Vector3 shift;
-  std::string shift_str;
+  std::string shift_str, scale_str;
   boost::shared_ptr<vw::DiskImageResource> rsrc
     ( new vw::DiskImageResourceGDAL(filename) );
   if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
-  // Read the first m channels
+  // Read the first m channels. Clouds are read in overlapping blocks
+  // by point2dem, which the compressed block cache, if on, keeps.
   vw::ImageViewRef< vw::Vector<double, m> > out_image
-    = vw::read_channels<m, double>(filename, 0);
+    = asp::compressed_cache(vw::read_channels<m, double>(filename, 0),
+                            filename + "-" + vw::num_to_str(m));
+
+  // Integer values must be multiplied by the scale they were stored with.
+  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_SCALE_TAG_STR, scale_str)){
+    double scale = atof(scale_str.c_str());
+    if (scale > 0.0)
+      out_image = scale_image_pixels(out_image, scale);
+  }
 
   // Add the shift back to the first several channels.
   if (shift != vw::Vector3())
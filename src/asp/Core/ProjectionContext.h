@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ProjectionContext.h
+///
+/// Remember, for each thread, the pixels most recently found by
+/// point_to_pixel() for a few cameras. Consecutive points in a thread
+/// are usually close to each other, as for mapprojection or
+/// triangulation of an image block, so the last pixel is a much
+/// better seed for the solver of the next one than the image center.
+/// A hint is only a starting guess, the solvers still check that
+/// they converged.
+
+#ifndef __ASP_CORE_PROJECTION_CONTEXT_H__
+#define __ASP_CORE_PROJECTION_CONTEXT_H__
+
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  class ProjectionContext {
+  public:
+
+    /// Get the last pixel found for this camera in the current thread.
+    /// Return false if there is none.
+    static bool get_hint(void const* camera, vw::Vector2 & pix) {
+      Entries & entries = thread_entries();
+      for (int it = 0; it < NUM_ENTRIES; it++) {
+        if (entries.cameras[it] == camera) {
+          pix = entries.pixels[it];
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /// Remember the last pixel found for this camera in the current thread.
+    static void set_hint(void const* camera, vw::Vector2 const& pix) {
+      Entries & entries = thread_entries();
+      for (int it = 0; it < NUM_ENTRIES; it++) {
+        if (entries.cameras[it] == camera) {
+          entries.pixels[it] = pix;
+          return;
+        }
+      }
+      // Replace the oldest entry
+      entries.cameras[entries.next] = camera;
+      entries.pixels [entries.next] = pix;
+      entries.next = (entries.next + 1) % NUM_ENTRIES;
+    }
+
+  private:
+
+    // A few cameras are used in turn, such as the left and right ones in stereo
+    static const int NUM_ENTRIES = 4;
+
+    struct Entries {
+      void const* cameras[NUM_ENTRIES];
+      vw::Vector2 pixels [NUM_ENTRIES];
+      int         next;
+      Entries(): next(0) {
+        for (int it = 0; it < NUM_ENTRIES; it++)
+          cameras[it] = NULL;
+      }
+    };
+
+    static Entries & thread_entries() {
+      static thread_local Entries entries;
+      return entries;
+    }
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_PROJECTION_CONTEXT_H__
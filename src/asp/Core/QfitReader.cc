@@ -0,0 +1,105 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/QfitReader.h>
+#include <vw/Core/Exception.h>
+
+#include <cstring>
+
+using namespace vw;
+
+namespace {
+
+  // Read a 32-bit integer, swapping the bytes if needed
+  inline int32 read_word(char const* p, bool swap) {
+    char bytes[4];
+    if (swap) {
+      bytes[0] = p[3]; bytes[1] = p[2]; bytes[2] = p[1]; bytes[3] = p[0];
+    } else {
+      std::memcpy(bytes, p, 4);
+    }
+    int32 value;
+    std::memcpy(&value, bytes, 4);
+    return value;
+  }
+
+  // The record lengths, in bytes, of the 10, 12, and 14 word formats
+  inline bool is_record_length(int32 len) {
+    return len == 40 || len == 48 || len == 56;
+  }
+}
+
+namespace asp {
+
+QfitReader::QfitReader(std::string const& file): m_num_words(0), m_swap(false),
+                                                 m_num_records(0) {
+
+  m_stream.open(file.c_str(), std::ios::in | std::ios::binary);
+  if (!m_stream.good())
+    vw_throw(ArgumentErr() << "Cannot open QFIT file: " << file << "\n");
+
+  char first[4];
+  if (!m_stream.read(first, 4))
+    vw_throw(ArgumentErr() << "Cannot read QFIT file: " << file << "\n");
+
+  // The files are usually big-endian, but either order is accepted
+  int32 len = read_word(first, false);
+  if (!is_record_length(len)) {
+    m_swap = true;
+    len = read_word(first, true);
+  }
+  if (!is_record_length(len))
+    vw_throw(ArgumentErr() << "Not a QFIT file, or unexpected record length: "
+             << file << "\n");
+
+  m_num_words = len / 4;
+  m_record.resize(len);
+
+  m_stream.seekg(0, std::ios::end);
+  m_num_records = vw::int64(m_stream.tellg()) / len - 1;
+
+  // Skip the first record
+  m_stream.seekg(len, std::ios::beg);
+}
+
+bool QfitReader::read_next_point(vw::Vector3 & llh) {
+
+  while (m_stream.read(&m_record[0], m_record.size())) {
+
+    int32 time = read_word(&m_record[0], m_swap);
+    if (time < 0)
+      continue; // A header record
+
+    double lat    = read_word(&m_record[4],  m_swap) / 1.0e6;
+    double lon    = read_word(&m_record[8],  m_swap) / 1.0e6;
+    double height = read_word(&m_record[12], m_swap) / 1.0e3;
+    if (lat == 0.0 || height <= -9999)
+      continue; // No laser return
+
+    // Convert positive east longitude to the [-180, 180] range
+    if (lon > 180)
+      lon -= 360;
+
+    llh = Vector3(lon, lat, height);
+    return true;
+  }
+
+  return false;
+}
+
+} // end namespace asp
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file QfitReader.h
+///
+/// Read the points of an IceBridge ATM lidar file in the binary QFIT
+/// format (the ILATM1B and BLATM1B products), as done by qi2txt, but
+/// without the conversion to text. The records are 10, 12, or 14
+/// scaled 32-bit integers, with the latitude, longitude and height
+/// above WGS84 in the second to fourth words. The first record holds
+/// the record length, which also tells the byte order of the file.
+/// Header records, which start with a negative time, are skipped.
+
+#ifndef __ASP_CORE_QFIT_READER_H__
+#define __ASP_CORE_QFIT_READER_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/Vector.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class QfitReader {
+  public:
+
+    /// Open the file and read its first record
+    QfitReader(std::string const& file);
+
+    /// Read the next valid point, as longitude (in [-180, 180]),
+    /// latitude, and height above WGS84. Return false at the end of the file.
+    bool read_next_point(vw::Vector3 & llh);
+
+    /// The number of records after the first one, including header records
+    vw::int64 num_records() const { return m_num_records; }
+
+    int words_per_record() const { return m_num_words; }
+
+  private:
+    std::ifstream          m_stream;
+    int                    m_num_words;
+    bool                   m_swap;
+    vw::int64              m_num_records;
+    std::vector<char>      m_record;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_QFIT_READER_H__
@@ -0,0 +1,143 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/RawImage.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <vector>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace {
+
+  const char   MAGIC[8] = {'A', 'S', 'P', 'R', 'A', 'W', 'I', 'M'};
+  const uint32 VERSION  = 1;
+
+  // The GDAL name of a channel type, for the VRT file
+  std::string gdal_data_type(int channel_type) {
+    switch (channel_type) {
+    case VW_CHANNEL_UINT8:   return "Byte";
+    case VW_CHANNEL_INT16:   return "Int16";
+    case VW_CHANNEL_UINT16:  return "UInt16";
+    case VW_CHANNEL_INT32:   return "Int32";
+    case VW_CHANNEL_UINT32:  return "UInt32";
+    case VW_CHANNEL_FLOAT32: return "Float32";
+    case VW_CHANNEL_FLOAT64: return "Float64";
+    default:
+      vw_throw(ArgumentErr() << "Unsupported channel type for a raw image: "
+               << channel_type << ".\n");
+    }
+    return "";
+  }
+
+  bool is_little_endian() {
+    uint16 one = 1;
+    return *reinterpret_cast<uint8*>(&one) == 1;
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+std::string raw_image_file(std::string const& image_file) {
+  return fs::path(image_file).replace_extension(".raw").string();
+}
+
+void write_raw_image_header(std::ofstream & ofs, RawImageHeader const& header) {
+  std::vector<char> buffer(RAW_IMAGE_HEADER_SIZE, 0);
+  int32 fields[4] = {header.cols, header.rows, header.channels, header.channel_type};
+  memcpy(&buffer[0],  MAGIC,    sizeof(MAGIC));
+  memcpy(&buffer[8],  &VERSION, sizeof(VERSION));
+  memcpy(&buffer[12], fields,   sizeof(fields));
+  ofs.write(&buffer[0], buffer.size());
+}
+
+void write_raw_image_vrt(std::string const& raw_file, RawImageHeader const& header) {
+
+  std::string vrt_file = raw_file + ".vrt";
+  std::ofstream ofs(vrt_file.c_str());
+  if (!ofs)
+    vw_throw(IOErr() << "Cannot write: " << vrt_file << "\n");
+
+  // The channels of a pixel are interleaved
+  size_t channel_size = channel_size_nothrow(ChannelTypeEnum(header.channel_type));
+  size_t pixel_size   = channel_size * header.channels;
+  ofs << "<VRTDataset rasterXSize=\"" << header.cols << "\" rasterYSize=\""
+      << header.rows << "\">\n";
+  for (int band = 0; band < header.channels; band++) {
+    ofs << "  <VRTRasterBand dataType=\"" << gdal_data_type(header.channel_type)
+        << "\" band=\"" << band + 1 << "\" subClass=\"VRTRawRasterBand\">\n"
+        << "    <SourceFilename relativeToVRT=\"1\">"
+        << fs::path(raw_file).filename().string() << "</SourceFilename>\n"
+        << "    <ImageOffset>" << RAW_IMAGE_HEADER_SIZE + band * channel_size
+        << "</ImageOffset>\n"
+        << "    <PixelOffset>" << pixel_size << "</PixelOffset>\n"
+        << "    <LineOffset>"  << pixel_size * header.cols << "</LineOffset>\n"
+        << "    <ByteOrder>"   << (is_little_endian() ? "LSB" : "MSB") << "</ByteOrder>\n"
+        << "  </VRTRasterBand>\n";
+  }
+  ofs << "</VRTDataset>\n";
+}
+
+RawImageMapping::RawImageMapping(std::string const& raw_file): m_data(NULL), m_size(0) {
+
+  int fd = open(raw_file.c_str(), O_RDONLY);
+  if (fd < 0)
+    vw_throw(IOErr() << "Cannot open: " << raw_file << "\n");
+  struct stat st;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= RAW_IMAGE_HEADER_SIZE) {
+    m_size = st.st_size;
+    void * data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED)
+      m_data = static_cast<char const*>(data);
+  }
+  close(fd);
+  if (m_data == NULL)
+    vw_throw(IOErr() << "Cannot read: " << raw_file << "\n");
+
+  uint32 version = 0;
+  int32 fields[4];
+  memcpy(&version, m_data + 8,  sizeof(version));
+  memcpy(fields,   m_data + 12, sizeof(fields));
+  m_header.cols         = fields[0];
+  m_header.rows         = fields[1];
+  m_header.channels     = fields[2];
+  m_header.channel_type = fields[3];
+
+  bool valid = (memcmp(m_data, MAGIC, sizeof(MAGIC)) == 0 && version == VERSION);
+  size_t pixel_size = valid ? channel_size_nothrow(ChannelTypeEnum(m_header.channel_type))
+                              * m_header.channels : 0;
+  if (!valid || pixel_size == 0 ||
+      m_size != RAW_IMAGE_HEADER_SIZE + pixel_size * m_header.cols * m_header.rows) {
+    munmap(const_cast<char*>(m_data), m_size);
+    vw_throw(IOErr() << "Not a valid raw image: " << raw_file << "\n");
+  }
+}
+
+RawImageMapping::~RawImageMapping() {
+  munmap(const_cast<char*>(m_data), m_size);
+}
+
+} // end namespace asp
@@ -0,0 +1,161 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file RawImage.h
+///
+/// Uncompressed intermediate images which are read by mapping them in
+/// memory, so that the tools which read the same pixels many times, such
+/// as stereo_corr with its overlapping tiles, do not decode and copy
+/// them each time. A raw image is a header padded to a page, followed
+/// by the pixels row after row, in the byte order of the machine. Next
+/// to it a VRT file is written, so that GDAL-based tools can view it.
+
+#ifndef __ASP_CORE_RAW_IMAGE_H__
+#define __ASP_CORE_RAW_IMAGE_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/Manipulation.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+namespace asp {
+
+  /// The size of the header, after which the pixels start
+  const size_t RAW_IMAGE_HEADER_SIZE = 4096;
+
+  struct RawImageHeader {
+    vw::int32 cols, rows, channels, channel_type;
+    RawImageHeader(): cols(0), rows(0), channels(0), channel_type(0) {}
+  };
+
+  /// The raw image for the given image, such as run-L.raw for run-L.tif
+  std::string raw_image_file(std::string const& image_file);
+
+  /// Write the header of a raw image. The stream is left at the start of the pixels.
+  void write_raw_image_header(std::ofstream & ofs, RawImageHeader const& header);
+
+  /// Write the VRT file describing a raw image, as raw_file + ".vrt".
+  void write_raw_image_vrt(std::string const& raw_file, RawImageHeader const& header);
+
+  /// A raw image mapped in memory, read-only
+  class RawImageMapping {
+  public:
+    RawImageMapping(std::string const& raw_file);
+    ~RawImageMapping();
+    RawImageHeader const& header() const { return m_header; }
+    char const* pixels() const { return m_data + RAW_IMAGE_HEADER_SIZE; }
+  private:
+    RawImageHeader m_header;
+    char const*    m_data;
+    size_t         m_size;
+  };
+
+  /// Write an image in the raw format, a band of rows at a time.
+  template <class ImageT>
+  void write_raw_image(std::string const& raw_file, vw::ImageViewBase<ImageT> const& image,
+                       vw::ProgressCallback const& progress = vw::ProgressCallback::dummy_instance()) {
+
+    typedef typename ImageT::pixel_type PixelT;
+    typedef typename vw::PixelChannelType<PixelT>::type ChannelT;
+    ImageT const& img = image.impl();
+
+    RawImageHeader header;
+    header.cols         = img.cols();
+    header.rows         = img.rows();
+    header.channels     = vw::PixelNumChannels<PixelT>::value;
+    header.channel_type = vw::ChannelTypeID<ChannelT>::value;
+
+    std::ofstream ofs(raw_file.c_str(), std::ios::binary);
+    if (!ofs)
+      vw::vw_throw(vw::IOErr() << "Cannot write: " << raw_file << "\n");
+    write_raw_image_header(ofs, header);
+
+    const int band_rows = 256;
+    for (int row = 0; row < header.rows; row += band_rows) {
+      int num_rows = std::min(band_rows, header.rows - row);
+      vw::ImageView<PixelT> band = vw::crop(img, vw::BBox2i(0, row, header.cols, num_rows));
+      ofs.write(reinterpret_cast<char const*>(band.data()),
+                sizeof(PixelT) * header.cols * num_rows);
+      progress.report_fractional_progress(row + num_rows, header.rows);
+    }
+    progress.report_finished();
+    if (!ofs)
+      vw::vw_throw(vw::IOErr() << "Failed writing: " << raw_file << "\n");
+    ofs.close();
+
+    write_raw_image_vrt(raw_file, header);
+  }
+
+  /// A view of a raw image mapped in memory. Its pixels are not copied,
+  /// rather they are accessed where they are mapped, as for an ImageView.
+  template <class PixelT>
+  class RawImageView: public vw::ImageViewBase<RawImageView<PixelT> > {
+    boost::shared_ptr<RawImageMapping> m_mapping;
+    PixelT const* m_data;
+    vw::int32     m_cols, m_rows;
+
+  public:
+    typedef PixelT        pixel_type;
+    typedef PixelT const& result_type;
+    typedef vw::MemoryStridingPixelAccessor<const PixelT> pixel_accessor;
+
+    RawImageView(std::string const& raw_file):
+      m_mapping(new RawImageMapping(raw_file)) {
+      typedef typename vw::PixelChannelType<PixelT>::type ChannelT;
+      RawImageHeader const& header = m_mapping->header();
+      if (header.channels     != int(vw::PixelNumChannels<PixelT>::value) ||
+          header.channel_type != int(vw::ChannelTypeID<ChannelT>::value))
+        vw::vw_throw(vw::ArgumentErr() << "The pixels of " << raw_file
+                     << " are not of the expected type.\n");
+      m_data = reinterpret_cast<PixelT const*>(m_mapping->pixels());
+      m_cols = header.cols;
+      m_rows = header.rows;
+    }
+
+    inline vw::int32 cols  () const { return m_cols; }
+    inline vw::int32 rows  () const { return m_rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const {
+      return pixel_accessor(m_data, 1, m_cols, m_cols * m_rows);
+    }
+
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*plane*/ = 0) const {
+      return m_data[size_t(row) * m_cols + col];
+    }
+
+    typedef RawImageView prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& /*bbox*/) const { return *this; }
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_RAW_IMAGE_H__
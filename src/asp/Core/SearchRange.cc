@@ -0,0 +1,78 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/SearchRange.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace vw;
+
+namespace asp {
+
+BBox2f robust_disparity_range(ImageView<PixelMask<Vector2f> > const& disparity,
+                              double min_fraction, double max_gap) {
+
+  std::vector<Vector2f> values;
+  for (int row = 0; row < disparity.rows(); row++) {
+    for (int col = 0; col < disparity.cols(); col++) {
+      if (is_valid(disparity(col, row)))
+        values.push_back(disparity(col, row).child());
+    }
+  }
+  if (values.empty())
+    return BBox2f(0, 0, 0, 0);
+
+  // Mark the disparities with a component in a small cluster
+  size_t num = values.size();
+  std::vector<char> keep(num, 1);
+  if (min_fraction > 0) {
+    double min_size = min_fraction * num;
+    std::vector<size_t> order(num);
+    for (int axis = 0; axis < 2; axis++) {
+      for (size_t i = 0; i < num; i++)
+        order[i] = i;
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+          return values[a][axis] < values[b][axis];
+        });
+      size_t start = 0;
+      for (size_t i = 1; i <= num; i++) {
+        if (i < num && values[order[i]][axis] - values[order[i-1]][axis] <= max_gap)
+          continue;
+        // The cluster is order[start], ..., order[i-1]
+        if (i - start < min_size) {
+          for (size_t k = start; k < i; k++)
+            keep[order[k]] = 0;
+        }
+        start = i;
+      }
+    }
+  }
+
+  BBox2f range, full_range;
+  bool any_kept = false;
+  for (size_t i = 0; i < num; i++) {
+    full_range.grow(values[i]);
+    if (keep[i]) {
+      range.grow(values[i]);
+      any_kept = true;
+    }
+  }
+  return any_kept ? range : full_range;
+}
+
+} // end namespace asp
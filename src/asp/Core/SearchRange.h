@@ -0,0 +1,50 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SearchRange.h
+///
+/// The search range for the disparities of a tile, found from the
+/// low-resolution disparities seen by it. A few outliers in those would
+/// make the bounding box of all of them, and thus the search, much
+/// larger than needed.
+
+#ifndef __ASP_CORE_SEARCH_RANGE_H__
+#define __ASP_CORE_SEARCH_RANGE_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  /// The range of the valid disparities, leaving out small clusters of
+  /// them. The values of each component are split into clusters where
+  /// consecutive values are more than max_gap apart. A cluster is left
+  /// out if it has fewer than min_fraction of the values, and so are
+  /// the disparities with a component in it. Several large clusters,
+  /// such as on both sides of a cliff, are kept, and the range spans
+  /// them. If all disparities would be left out, or min_fraction is not
+  /// positive, the range spans all valid disparities. It is empty, at
+  /// the origin, if there are none.
+  vw::BBox2f robust_disparity_range
+  (vw::ImageView<vw::PixelMask<vw::Vector2f> > const& disparity,
+   double min_fraction, double max_gap);
+
+} // end namespace asp
+
+#endif//__ASP_CORE_SEARCH_RANGE_H__
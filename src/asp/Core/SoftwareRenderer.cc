@@ -46,6 +46,7 @@
 #include <vw/Core/FundamentalTypes.h>
 #include <asp/Core/SoftwareRenderer.h>
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -628,6 +629,21 @@ static void FillTriangle(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c) {
   }
 }
 
+// Whether a triangle in window coordinates surely draws no pixels in
+// the clip box. Spans are drawn between the truncated edge positions,
+// so a margin of a couple of pixels keeps this on the safe side.
+inline bool
+OutsideClip(const GraphicsState *gc, const Vertex *a, const Vertex *b, const Vertex *c)
+{
+  static const RealT kMargin = 2.0;
+  RealT minX = std::min(a->window.x, std::min(b->window.x, c->window.x));
+  RealT maxX = std::max(a->window.x, std::max(b->window.x, c->window.x));
+  RealT minY = std::min(a->window.y, std::min(b->window.y, c->window.y));
+  RealT maxY = std::max(a->window.y, std::max(b->window.y, c->window.y));
+  return (maxX < gc->clipX0 - kMargin || minX > gc->clipX1 + kMargin ||
+          maxY < gc->clipY0 - kMargin || minY > gc->clipY1 + kMargin);
+}
+
 inline void
 MapToWindow(Coords &coords,
             const double ndcMap[3][2],
@@ -800,7 +816,11 @@ SoftwareRenderer::DrawPolygon(const int startIndex, const int numVertices) {
                 0.0, 0.0, double(m_bufferWidth), double(m_bufferHeight),
                 vertex2.window);
 
-    FillTriangle((GraphicsState *) m_graphicsState, &vertex0, &vertex1, &vertex2);
+    // The caller may draw the whole mesh near a tile, most of which
+    // falls outside of its buffer. Skip such triangles before any setup.
+    GraphicsState *gc = (GraphicsState *) m_graphicsState;
+    if (!OutsideClip(gc, &vertex0, &vertex1, &vertex2))
+      FillTriangle(gc, &vertex0, &vertex1, &vertex2);
 
     vertexIndex1 += m_triangleVertexStep;
     vertexIndex2 += m_triangleVertexStep;
@@ -0,0 +1,605 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/SparseDisparity.h>
+#include <asp/Core/StereoSettings.h>
+
+#include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Thread.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+using namespace vw;
+
+namespace {
+
+  typedef ImageViewRef<PixelMask<float> > MaskedImage;
+
+  // Undocumented settings, as in sparse_disp
+  const double EPIPOLAR_SCORE_TOL = 0.4;  // Matches used to estimate the epipolar direction
+  const double EPIPOLAR_FRACTION  = 0.9;  // The central fraction of those used
+  const double EPIPOLAR_TOL_INIT  = 32.0; // The tolerance for the coarse matches
+  const double EPIPOLAR_TOL_MIN   = 4.0;
+  const double EPIPOLAR_TOL_MAX   = 24.0;
+  const double MAX_SLOPE          = 3.0;  // The largest change in disparity per pixel
+  const int    SEARCH_PAD         = 8;    // Pad the search range of added points by this
+
+  // A matched point. Its neighbors are the points within its spacing of it.
+  struct Sample {
+    Vector2i pix;
+    Vector2f disp;
+    float    score;
+    int      spacing;
+    bool     valid;
+  };
+
+  // A point to match, and the disparities to search
+  struct Query {
+    Vector2i pix;
+    BBox2i   range; // Both ends inclusive
+    int      spacing;
+  };
+
+  typedef boost::function<void(int, int)> RangeJob;
+
+  // Run a job on a range of items, and keep the first error
+  class RangeTask: public Task, private boost::noncopyable {
+    RangeJob const& m_job;
+    int m_begin, m_end;
+    Mutex       & m_mutex;
+    std::string & m_error;
+  public:
+    RangeTask(RangeJob const& job, int begin, int end, Mutex & mutex, std::string & error):
+      m_job(job), m_begin(begin), m_end(end), m_mutex(mutex), m_error(error) {}
+    virtual void operator()() {
+      std::string error;
+      try {
+        m_job(m_begin, m_end);
+      } catch (std::exception const& e) {
+        error = e.what();
+      }
+      Mutex::Lock lock(m_mutex);
+      if (!error.empty() && m_error.empty())
+        m_error = error;
+    }
+  };
+
+  // Run a job on all items, split into a few ranges per thread
+  void run_on_ranges(int num_items, RangeJob const& job) {
+    int num_threads = std::max(vw_settings().default_num_threads(), 1);
+    int len = std::max(1, num_items / (4 * num_threads));
+    Mutex mutex;
+    std::string error;
+    {
+      FifoWorkQueue queue(num_threads);
+      for (int begin = 0; begin < num_items; begin += len) {
+        boost::shared_ptr<RangeTask>
+          task(new RangeTask(job, begin, std::min(begin + len, num_items), mutex, error));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+    if (!error.empty())
+      vw_throw(ArgumentErr() << error);
+  }
+
+  // Find the disparity in the range, with both ends inclusive, for
+  // which the template around the left pixel has the largest normalized
+  // cross-correlation with the right image. Templates with invalid or
+  // constant pixels are not matched.
+  bool match_template(MaskedImage const& left, MaskedImage const& right,
+                      Vector2i const& pix, int half, BBox2i const& range,
+                      Vector2i & best_disp, float & best_score) {
+
+    BBox2i tbox(pix - Vector2i(half, half), pix + Vector2i(half + 1, half + 1));
+    if (!bounding_box(left).contains(tbox))
+      return false;
+    ImageView<PixelMask<float> > tmpl = crop(left, tbox);
+    int tc = tmpl.cols(), tr = tmpl.rows(), num = tc * tr;
+
+    std::vector<float> t(num);
+    double sum = 0.0, sum2 = 0.0;
+    for (int row = 0; row < tr; row++) {
+      for (int col = 0; col < tc; col++) {
+        PixelMask<float> const& p = tmpl(col, row);
+        if (!is_valid(p))
+          return false;
+        t[row * tc + col] = p.child();
+        sum += p.child();
+      }
+    }
+    double mean = sum / num;
+    for (int k = 0; k < num; k++) {
+      t[k] -= mean;
+      sum2 += t[k] * t[k];
+    }
+    if (sum2 <= 1e-12 * num * std::max(1.0, mean * mean))
+      return false; // A flat template
+    double tnorm = std::sqrt(sum2);
+
+    // Pixels outside the right image are invalid
+    BBox2i wbox(tbox.min() + range.min(), tbox.max() + range.max());
+    ImageView<PixelMask<float> > win = crop(edge_extend(right, ZeroEdgeExtension()), wbox);
+
+    best_score = -2.0;
+    for (int dy = 0; dy <= range.height(); dy++) {
+      for (int dx = 0; dx <= range.width(); dx++) {
+        double cross = 0.0, s1 = 0.0, s2 = 0.0;
+        bool good = true;
+        for (int row = 0; row < tr && good; row++) {
+          for (int col = 0; col < tc; col++) {
+            PixelMask<float> const& p = win(col + dx, row + dy);
+            if (!is_valid(p)) {
+              good = false;
+              break;
+            }
+            double v = p.child();
+            cross += t[row * tc + col] * v;
+            s1 += v;
+            s2 += v * v;
+          }
+        }
+        double var = s2 - s1 * s1 / num;
+        if (!good || var <= 0)
+          continue;
+        double score = cross / (tnorm * std::sqrt(var));
+        if (score > best_score) {
+          best_score = score;
+          best_disp  = range.min() + Vector2i(dx, dy);
+        }
+      }
+    }
+    return best_score > 0;
+  }
+
+  // The points as a map from pixels to indices, to find neighbors and duplicates
+  typedef std::map<std::pair<int, int>, int> PixelIndex;
+
+  // Calls func(j) for each valid neighbor j of sample i, which are the
+  // points no farther than the spacing of i from it along either axis.
+  template <class FuncT>
+  void for_each_neighbor(std::vector<Sample> const& samples, PixelIndex const& index,
+                         int i, FuncT func) {
+    Sample const& s = samples[i];
+    int r = s.spacing;
+    PixelIndex::const_iterator it  = index.lower_bound(std::make_pair(s.pix.x() - r,
+                                                                      s.pix.y() - r));
+    PixelIndex::const_iterator end = index.upper_bound(std::make_pair(s.pix.x() + r,
+                                                                      s.pix.y() + r));
+    for (; it != end; it++) {
+      if (it->second < 0)
+        continue; // Not matched yet
+      Sample const& n = samples[it->second];
+      if (it->second == i || !n.valid || std::abs(n.pix.y() - s.pix.y()) > r)
+        continue;
+      func(it->second);
+    }
+  }
+
+  // The range of the disparities of a sample and its neighbors
+  BBox2f neighborhood_range(std::vector<Sample> const& samples, PixelIndex const& index,
+                            int i) {
+    BBox2f range;
+    range.grow(samples[i].disp);
+    for_each_neighbor(samples, index, i,
+                      [&](int j) { range.grow(samples[j].disp); });
+    return range;
+  }
+
+  // Estimate the epipolar direction as the main direction of the
+  // spread of the good disparities about their median.
+  void estimate_epipolar(std::vector<Sample> const& samples,
+                         Vector2 & center, Vector2 & direction) {
+    std::vector<double> dx, dy;
+    for (size_t i = 0; i < samples.size(); i++) {
+      if (samples[i].valid && samples[i].score > EPIPOLAR_SCORE_TOL) {
+        dx.push_back(samples[i].disp.x());
+        dy.push_back(samples[i].disp.y());
+      }
+    }
+    center = Vector2(); direction = Vector2(1, 0);
+    if (dx.size() < 2)
+      return;
+
+    // Keep the central fraction of the disparities
+    std::vector<double> sx = dx, sy = dy;
+    std::sort(sx.begin(), sx.end());
+    std::sort(sy.begin(), sy.end());
+    int n = sx.size();
+    int lo = int((1.0 - EPIPOLAR_FRACTION) / 2.0 * (n - 1));
+    int hi = int((1.0 + EPIPOLAR_FRACTION) / 2.0 * (n - 1) + 0.5);
+    std::vector<double> cx, cy;
+    for (int i = 0; i < n; i++) {
+      if (dx[i] >= sx[lo] && dx[i] <= sx[hi] && dy[i] >= sy[lo] && dy[i] <= sy[hi]) {
+        cx.push_back(dx[i]);
+        cy.push_back(dy[i]);
+      }
+    }
+    if (cx.empty())
+      return;
+    std::vector<double> mx = cx, my = cy;
+    std::nth_element(mx.begin(), mx.begin() + mx.size()/2, mx.end());
+    std::nth_element(my.begin(), my.begin() + my.size()/2, my.end());
+    center = Vector2(mx[mx.size()/2], my[my.size()/2]);
+
+    // The eigenvector of the largest eigenvalue of the scatter matrix
+    double a = 0, b = 0, c = 0;
+    for (size_t i = 0; i < cx.size(); i++) {
+      double x = cx[i] - center.x(), y = cy[i] - center.y();
+      a += x * x; b += x * y; c += y * y;
+    }
+    double theta = 0.5 * std::atan2(2.0 * b, a - c);
+    direction = Vector2(std::cos(theta), std::sin(theta));
+  }
+
+  // The distance of a disparity from the epipolar line
+  bool near_epipolar(Vector2 const& center, Vector2 const& direction,
+                     Vector2 const& disp, double tol, double & dist) {
+    Vector2 diff = disp - center;
+    dist = std::abs(diff.x() * direction.y() - diff.y() * direction.x());
+    return dist < tol || dist < 0.02 * norm_2(diff);
+  }
+
+  // Interpolate values at the samples with inverse distance weights, from
+  // the four nearest within the given distance. The samples are put in
+  // cells of the given size to find them.
+  class SampleGrid {
+    std::vector<Vector2>          m_pts;
+    std::vector<Vector4>          m_vals;
+    std::vector<std::vector<int> > m_cells;
+    int    m_cell, m_cols, m_rows;
+  public:
+    SampleGrid(std::vector<Vector2> const& pts, std::vector<Vector4> const& vals,
+               Vector2i const& size, int cell):
+      m_pts(pts), m_vals(vals), m_cell(std::max(cell, 1)) {
+      m_cols = size.x() / m_cell + 1;
+      m_rows = size.y() / m_cell + 1;
+      m_cells.resize(m_cols * m_rows);
+      for (size_t i = 0; i < m_pts.size(); i++) {
+        int col = std::min(std::max(int(m_pts[i].x() / m_cell), 0), m_cols - 1);
+        int row = std::min(std::max(int(m_pts[i].y() / m_cell), 0), m_rows - 1);
+        m_cells[row * m_cols + col].push_back(i);
+      }
+    }
+
+    bool interpolate(Vector2 const& p, double max_dist, Vector4 & val) const {
+      const int num = 4;
+      std::vector<std::pair<double, int> > nearest;
+      int col = int(p.x() / m_cell), row = int(p.y() / m_cell);
+      int max_ring = int(std::ceil(max_dist / m_cell)) + 1;
+      for (int ring = 0; ring <= max_ring; ring++) {
+        // Past this ring, all the points are farther than (ring - 1) cells
+        if (int(nearest.size()) >= num && nearest[num - 1].first < (ring - 1) * m_cell)
+          break;
+        for (int r = row - ring; r <= row + ring; r++) {
+          for (int c = col - ring; c <= col + ring; c++) {
+            if (std::max(std::abs(r - row), std::abs(c - col)) != ring ||
+                r < 0 || c < 0 || r >= m_rows || c >= m_cols)
+              continue;
+            std::vector<int> const& cell = m_cells[r * m_cols + c];
+            for (size_t k = 0; k < cell.size(); k++)
+              nearest.push_back(std::make_pair(norm_2(m_pts[cell[k]] - p), cell[k]));
+          }
+        }
+        std::sort(nearest.begin(), nearest.end());
+        if (int(nearest.size()) > num)
+          nearest.resize(num);
+      }
+      if (nearest.empty() || nearest[0].first > max_dist)
+        return false;
+
+      double wsum = 0;
+      val = Vector4();
+      for (size_t k = 0; k < nearest.size(); k++) {
+        double w = 1.0 / (nearest[k].first * nearest[k].first + 1.0);
+        val  += w * m_vals[nearest[k].second];
+        wsum += w;
+      }
+      val /= wsum;
+      return true;
+    }
+  };
+
+  // Match the queries in parallel. Failed matches are invalid.
+  void match_queries(MaskedImage const& left, MaskedImage const& right, int half,
+                     std::vector<Query> const& queries, std::vector<Sample> & found) {
+    found.resize(queries.size());
+    run_on_ranges(queries.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          Sample & s = found[i];
+          s.pix = queries[i].pix; s.spacing = queries[i].spacing;
+          Vector2i disp;
+          s.valid = match_template(left, right, s.pix, half, queries[i].range, disp, s.score);
+          s.disp  = Vector2f(disp.x(), disp.y());
+        }
+      });
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+SparseDispOptions::SparseDispOptions(): template_size(56), coarse_skip(0), fine_skip(64),
+                                        refine_tol(8.0), spread_pad(2.0), fill_dist(1000.0) {}
+
+void sparse_disparity(MaskedImage const& left,     MaskedImage const& right,
+                      MaskedImage const& left_sub, MaskedImage const& right_sub,
+                      BBox2i const& search_range, SparseDispOptions const& options,
+                      ImageView<PixelMask<Vector2f> > & disp_sub,
+                      ImageView<PixelMask<Vector2i> > & spread_sub) {
+
+  if (options.template_size < 3 || options.fine_skip < 1)
+    vw_throw(ArgumentErr() << "The sparse disparity template size must be at least 3, "
+             << "and the fine spacing at least 1.\n");
+
+  Vector2 scale(double(left_sub.cols()) / left.cols(), double(left_sub.rows()) / left.rows());
+  int half = options.template_size / 2;
+
+  // As in sparse_disp, start with at least 8 points along the shorter side
+  int min_side = std::min(left.cols(), left.rows());
+  int coarse = options.coarse_skip;
+  int max_coarse = std::max(options.fine_skip, min_side / 8);
+  if (coarse <= 0 || coarse > max_coarse)
+    coarse = max_coarse;
+  int fine = std::min(options.fine_skip, coarse);
+
+  // The coarse points. Match them first in the subsampled images over
+  // the whole search range, then at full resolution near that.
+  std::vector<Query> queries;
+  for (int row = half; row < left.rows() - half; row += coarse) {
+    for (int col = half; col < left.cols() - half; col += coarse) {
+      Query q;
+      q.pix = Vector2i(col, row); q.range = search_range; q.spacing = coarse;
+      queries.push_back(q);
+    }
+  }
+
+  bool use_sub = (scale.x() < 1.0 || scale.y() < 1.0);
+  std::vector<Sample> samples;
+  if (use_sub) {
+    std::vector<Query> sub_queries = queries;
+    for (size_t i = 0; i < sub_queries.size(); i++) {
+      sub_queries[i].pix = Vector2i(round(queries[i].pix.x() * scale.x()),
+                                    round(queries[i].pix.y() * scale.y()));
+      sub_queries[i].range = BBox2i(Vector2i(floor(search_range.min().x() * scale.x()),
+                                             floor(search_range.min().y() * scale.y())),
+                                    Vector2i(ceil(search_range.max().x() * scale.x()),
+                                             ceil(search_range.max().y() * scale.y())));
+    }
+    std::vector<Sample> sub_found;
+    match_queries(left_sub, right_sub, half, sub_queries, sub_found);
+
+    std::vector<Query> kept;
+    Vector2i pad(ceil(1.0 / scale.x()) + 2, ceil(1.0 / scale.y()) + 2);
+    for (size_t i = 0; i < queries.size(); i++) {
+      if (!sub_found[i].valid)
+        continue;
+      Vector2i d(round(sub_found[i].disp.x() / scale.x()),
+                 round(sub_found[i].disp.y() / scale.y()));
+      queries[i].range = BBox2i(d - pad, d + pad);
+      kept.push_back(queries[i]);
+    }
+    queries = kept;
+  }
+  match_queries(left, right, half, queries, samples);
+  vw_out() << "\t--> Sparse disparity: matched " << samples.size()
+           << " points at spacing " << coarse << ".\n";
+
+  // Reject the coarse matches far from the epipolar line, and find the
+  // tolerance for the later ones.
+  Vector2 ep_center, ep_dir;
+  estimate_epipolar(samples, ep_center, ep_dir);
+  std::vector<double> dists;
+  for (size_t i = 0; i < samples.size(); i++) {
+    double dist = 0;
+    if (samples[i].valid && !near_epipolar(ep_center, ep_dir, samples[i].disp,
+                                           EPIPOLAR_TOL_INIT, dist))
+      samples[i].valid = false;
+    if (samples[i].valid && samples[i].score > EPIPOLAR_SCORE_TOL)
+      dists.push_back(dist);
+  }
+  double ep_tol = EPIPOLAR_TOL_MAX;
+  if (!dists.empty()) {
+    std::sort(dists.begin(), dists.end());
+    ep_tol = dists[int(0.9 * (dists.size() - 1))];
+    ep_tol = std::min(EPIPOLAR_TOL_MAX, std::max(EPIPOLAR_TOL_MIN, ep_tol));
+  }
+  vw_out(DebugMessage, "asp") << "Epipolar direction " << ep_dir << ", tolerance "
+                              << ep_tol << "\n";
+
+  PixelIndex index;
+  for (size_t i = 0; i < samples.size(); i++)
+    index[std::make_pair(samples[i].pix.x(), samples[i].pix.y())] = i;
+
+  // Add points at half the spacing where neighbors disagree, down to the fine spacing
+  std::vector<int> to_refine;
+  for (size_t i = 0; i < samples.size(); i++)
+    if (samples[i].valid)
+      to_refine.push_back(i);
+
+  for (int delta = coarse / 2; delta >= fine && !to_refine.empty(); delta /= 2) {
+
+    queries.clear();
+    for (size_t k = 0; k < to_refine.size(); k++) {
+      int i = to_refine[k];
+      BBox2f range = neighborhood_range(samples, index, i);
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          if (dx == 0 && dy == 0)
+            continue;
+          Vector2i p = samples[i].pix + delta * Vector2i(dx, dy);
+          p.x() = std::min(std::max(p.x(), half), left.cols() - half - 1);
+          p.y() = std::min(std::max(p.y(), half), left.rows() - half - 1);
+          std::pair<int, int> key(p.x(), p.y());
+          if (index.find(key) != index.end())
+            continue;
+          index[key] = -1; // Queued
+          Query q;
+          q.pix     = p;
+          q.range   = BBox2i(Vector2i(floor(range.min().x()) - SEARCH_PAD,
+                                      floor(range.min().y()) - SEARCH_PAD),
+                             Vector2i(ceil(range.max().x()) + SEARCH_PAD,
+                                      ceil(range.max().y()) + SEARCH_PAD));
+          q.spacing = delta;
+          queries.push_back(q);
+        }
+      }
+    }
+
+    std::vector<Sample> found;
+    match_queries(left, right, half, queries, found);
+    int num_good = 0;
+    for (size_t k = 0; k < found.size(); k++) {
+      double dist = 0;
+      if (found[k].valid && !near_epipolar(ep_center, ep_dir, found[k].disp, ep_tol, dist))
+        found[k].valid = false;
+      num_good += found[k].valid;
+      index[std::make_pair(found[k].pix.x(), found[k].pix.y())] = samples.size();
+      samples.push_back(found[k]);
+    }
+    vw_out() << "\t--> Sparse disparity: searched " << found.size() << " points at spacing "
+             << delta << ", found " << num_good << " good matches.\n";
+
+    // Reject the points whose disparity changes too fast even toward
+    // their most similar neighbor.
+    std::vector<bool> too_steep(samples.size(), false);
+    for (size_t i = 0; i < samples.size(); i++) {
+      if (!samples[i].valid)
+        continue;
+      double min_x = -1, min_y = -1;
+      for_each_neighbor(samples, index, i, [&](int j) {
+          double d  = norm_2(Vector2(samples[j].pix - samples[i].pix));
+          double sx = std::abs(samples[j].disp.x() - samples[i].disp.x()) / d;
+          double sy = std::abs(samples[j].disp.y() - samples[i].disp.y()) / d;
+          min_x = (min_x < 0) ? sx : std::min(min_x, sx);
+          min_y = (min_y < 0) ? sy : std::min(min_y, sy);
+        });
+      too_steep[i] = (std::max(min_x, min_y) > MAX_SLOPE);
+    }
+    for (size_t i = 0; i < samples.size(); i++)
+      if (too_steep[i])
+        samples[i].valid = false;
+
+    // The points whose neighbors still disagree are refined further
+    to_refine.clear();
+    for (size_t i = 0; i < samples.size(); i++) {
+      if (!samples[i].valid)
+        continue;
+      BBox2f range = neighborhood_range(samples, index, i);
+      if (range.width() > options.refine_tol || range.height() > options.refine_tol)
+        to_refine.push_back(i);
+    }
+  }
+
+  // Grid the disparities and their spreads at the resolution of the
+  // subsampled image, in its pixels.
+  std::vector<Vector2> pts;
+  std::vector<Vector4> vals;
+  for (size_t i = 0; i < samples.size(); i++) {
+    if (!samples[i].valid)
+      continue;
+    BBox2f range = neighborhood_range(samples, index, i);
+    pts.push_back(Vector2(samples[i].pix));
+    vals.push_back(Vector4(samples[i].disp.x(), samples[i].disp.y(),
+                           range.width()  + options.spread_pad,
+                           range.height() + options.spread_pad));
+  }
+  if (pts.empty())
+    vw_throw(ArgumentErr() << "No sparse disparity matches were found. Consider "
+             << "setting or increasing the search range.\n");
+  vw_out() << "\t--> Sparse disparity: gridding " << pts.size() << " matches.\n";
+
+  SampleGrid grid(pts, vals, Vector2i(left.cols(), left.rows()), fine);
+  disp_sub.set_size(left_sub.cols(), left_sub.rows());
+  spread_sub.set_size(left_sub.cols(), left_sub.rows());
+  run_on_ranges(left_sub.rows(), [&](int begin, int end) {
+      for (int row = begin; row < end; row++) {
+        for (int col = 0; col < left_sub.cols(); col++) {
+          disp_sub  (col, row) = PixelMask<Vector2f>();
+          spread_sub(col, row) = PixelMask<Vector2i>();
+          Vector4 v;
+          Vector2 p = elem_quot(Vector2(col, row), scale);
+          if (!grid.interpolate(p, options.fill_dist, v))
+            continue;
+          disp_sub  (col, row) = Vector2f(v[0] * scale.x(), v[1] * scale.y());
+          spread_sub(col, row) = Vector2i(std::max(1, int(std::ceil(v[2] * scale.x()))),
+                                          std::max(1, int(std::ceil(v[3] * scale.y()))));
+        }
+      }
+    });
+}
+
+void produce_sparse_disparity(ASPGlobalOptions & opt) {
+
+  DiskImageView<float> left_image (opt.out_prefix + "-L.tif"),
+                       right_image(opt.out_prefix + "-R.tif"),
+                       left_sub   (opt.out_prefix + "-L_sub.tif"),
+                       right_sub  (opt.out_prefix + "-R_sub.tif");
+  DiskImageView<uint8> left_mask     (opt.out_prefix + "-lMask.tif"),
+                       right_mask    (opt.out_prefix + "-rMask.tif"),
+                       left_mask_sub (opt.out_prefix + "-lMask_sub.tif"),
+                       right_mask_sub(opt.out_prefix + "-rMask_sub.tif");
+
+  // Without a search range, search as sparse_disp does, about the
+  // origin, over no more than a quarter of the image.
+  BBox2i search_range = stereo_settings().search_range;
+  if (!stereo_settings().is_search_defined()) {
+    int hx = std::min(484, left_image.cols() / 8), hy = std::min(484, left_image.rows() / 8);
+    search_range = BBox2i(Vector2i(-hx, -hy), Vector2i(hx, hy));
+  }
+  vw_out() << "\t--> Sparse disparity search range: " << search_range << "\n";
+
+  SparseDispOptions options;
+  options.template_size = stereo_settings().sparse_disp_template_size;
+  options.coarse_skip   = stereo_settings().sparse_disp_coarse_skip;
+  options.fine_skip     = stereo_settings().sparse_disp_fine_skip;
+  options.refine_tol    = stereo_settings().sparse_disp_refine_tol;
+
+  Stopwatch sw;
+  sw.start();
+  ImageView<PixelMask<Vector2f> > disp_sub;
+  ImageView<PixelMask<Vector2i> > spread_sub;
+  sparse_disparity(copy_mask(left_image,  create_mask(left_mask)),
+                   copy_mask(right_image, create_mask(right_mask)),
+                   copy_mask(left_sub,    create_mask(left_mask_sub)),
+                   copy_mask(right_sub,   create_mask(right_mask_sub)),
+                   search_range, options, disp_sub, spread_sub);
+  sw.stop();
+  vw_out(DebugMessage, "asp") << "Sparse disparity elapsed time: " << sw.elapsed_seconds()
+                              << " s.\n";
+
+  std::string disp_file   = opt.out_prefix + "-D_sub.tif";
+  std::string spread_file = opt.out_prefix + "-D_sub_spread.tif";
+  vw_out() << "Writing: " << disp_file << "\n";
+  vw::cartography::block_write_gdal_image(disp_file, disp_sub, opt,
+                                          TerminalProgressCallback("asp", "\t--> Low-resolution disparity:"));
+  vw_out() << "Writing: " << spread_file << "\n";
+  vw::cartography::block_write_gdal_image(spread_file, spread_sub, opt,
+                                          TerminalProgressCallback("asp", "\t--> Low-resolution disparity spread:"));
+}
+
+} // end namespace asp
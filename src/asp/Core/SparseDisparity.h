@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SparseDisparity.h
+///
+/// The low-resolution disparity for --corr-seed-mode 3, found by
+/// matching templates at full resolution at a sparse set of points,
+/// as the sparse_disp program does. The points start on a coarse grid,
+/// whose matches are first found in the subsampled images over the
+/// whole search range, then at full resolution near them. Where
+/// neighboring points disagree, points at half the spacing are added,
+/// until the fine spacing is reached. Matches far from the epipolar
+/// direction, or changing too fast with respect to their neighbors,
+/// are rejected. The points are matched in parallel.
+
+#ifndef __ASP_CORE_SPARSE_DISPARITY_H__
+#define __ASP_CORE_SPARSE_DISPARITY_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  struct ASPGlobalOptions;
+
+  struct SparseDispOptions {
+    int    template_size; ///< The side of the template matched at each point
+    int    coarse_skip;   ///< The spacing of the initial points. If 0, found from the image size.
+    int    fine_skip;     ///< The spacing at which to stop adding points
+    double refine_tol;    ///< Add points where neighbor disparities differ by more than this
+    double spread_pad;    ///< Add this to the disparity spread of each point
+    double fill_dist;     ///< Do not extend the disparity farther than this from any match
+    SparseDispOptions();
+  };
+
+  /// Find the sparse disparity between the aligned images, given also
+  /// subsampled by the same factor as left_sub, and write it and its
+  /// spread at the resolution of left_sub, in that resolution's pixels.
+  /// The search range is at full resolution.
+  void sparse_disparity(vw::ImageViewRef<vw::PixelMask<float> > const& left,
+                        vw::ImageViewRef<vw::PixelMask<float> > const& right,
+                        vw::ImageViewRef<vw::PixelMask<float> > const& left_sub,
+                        vw::ImageViewRef<vw::PixelMask<float> > const& right_sub,
+                        vw::BBox2i const& search_range,
+                        SparseDispOptions const& options,
+                        vw::ImageView<vw::PixelMask<vw::Vector2f> > & disp_sub,
+                        vw::ImageView<vw::PixelMask<vw::Vector2i> > & spread_sub);
+
+  /// Write D_sub and D_sub_spread for --corr-seed-mode 3.
+  void produce_sparse_disparity(ASPGlobalOptions & opt);
+
+}
+
+#endif//__ASP_CORE_SPARSE_DISPARITY_H__
@@ -0,0 +1,146 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/StageReport.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/CompressedBlockCache.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/filesystem.hpp>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+  double wall_seconds() {
+    return std::chrono::duration<double>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // User and system time of this process
+  double cpu_seconds() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0.0;
+    return usage.ru_utime.tv_sec + 1e-6*usage.ru_utime.tv_usec +
+           usage.ru_stime.tv_sec + 1e-6*usage.ru_stime.tv_usec;
+  }
+
+  double peak_memory_mb() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0.0;
+#ifdef __APPLE__
+    return usage.ru_maxrss/(1024.0*1024.0); // in bytes
+#else
+    return usage.ru_maxrss/1024.0;          // in kilobytes
+#endif
+  }
+
+  // The bytes this process passed through read and write calls so
+  // far, or -1 if this is not known.
+  void bytes_read_written(double & read, double & written) {
+    read = -1; written = -1;
+    std::ifstream ifs("/proc/self/io");
+    std::string name;
+    double value;
+    while (ifs >> name >> value) {
+      if (name == "rchar:") read    = value;
+      if (name == "wchar:") written = value;
+    }
+  }
+
+  std::string host_name() {
+    char buf[256];
+    if (gethostname(buf, sizeof(buf)) != 0)
+      return "unknown";
+    buf[sizeof(buf) - 1] = '\0';
+    return buf;
+  }
+}
+
+namespace asp {
+
+StageReport::StageReport(std::string const& stage):
+  m_stage(stage), m_start_time(current_posix_time_string()),
+  m_start_wall(wall_seconds()), m_start_cpu(cpu_seconds()) {
+  bytes_read_written(m_start_read, m_start_written);
+}
+
+void StageReport::add(std::string const& name, double value) {
+  m_values.push_back(std::make_pair(name, value));
+}
+
+std::string StageReport::report_file(std::string const& out_prefix) {
+  return out_prefix + "-stage-report.csv";
+}
+
+void StageReport::write(std::string const& out_prefix) const {
+
+  double wall    = wall_seconds() - m_start_wall;
+  double cpu     = cpu_seconds()  - m_start_cpu;
+  int    threads = vw::vw_settings().default_num_threads();
+  double busy    = cpu/std::max(wall*threads, 1e-6);
+
+  double read = -1, written = -1;
+  bytes_read_written(read, written);
+  if (read >= 0 && m_start_read >= 0)
+    read = (read - m_start_read)/(1024.0*1024.0);
+  if (written >= 0 && m_start_written >= 0)
+    written = (written - m_start_written)/(1024.0*1024.0);
+
+  // Add how the compressed block cache did, if it is used
+  StageReport all = *this;
+  compressed_block_cache().add_to_report(all);
+  std::ostringstream values;
+  for (size_t it = 0; it < all.m_values.size(); it++) {
+    if (it > 0)
+      values << ';';
+    values << all.m_values[it].first << '=' << all.m_values[it].second;
+  }
+
+  std::string file = report_file(out_prefix);
+  bool write_header = !fs::exists(file);
+  std::ofstream ofs(file.c_str(), std::ios::app);
+  if (!ofs.good()) {
+    vw::vw_out(vw::WarningMessage) << "Could not write: " << file << std::endl;
+    return;
+  }
+
+  if (write_header)
+    ofs << "stage,prefix,host,start_time,wall_sec,cpu_sec,threads,thread_utilization,"
+        << "peak_memory_mb,read_mb,written_mb,values\n";
+
+  ofs.precision(8);
+  ofs << m_stage << ',' << out_prefix << ',' << host_name() << ',' << m_start_time << ','
+      << wall << ',' << cpu << ',' << threads << ',' << busy << ','
+      << peak_memory_mb() << ',' << read << ',' << written << ',' << values.str() << '\n';
+
+  vw::vw_out() << "Wrote: " << file << std::endl;
+}
+
+} // end namespace asp
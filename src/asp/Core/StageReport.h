@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file StageReport.h
+///
+/// Record how long a stage of a tool took and what it used: wall and
+/// CPU time, the number of threads and how busy they were, the peak
+/// memory, and the bytes read and written, together with any values
+/// the stage adds, such as the size of the search range. The record is
+/// appended as a line to <output prefix>-stage-report.csv. A tile run by
+/// parallel_stereo has its own output prefix, hence its own report,
+/// and parallel_stereo sums up the reports of all tiles at the end.
+///
+/// The bytes read and written are known only on Linux, and are -1
+/// elsewhere.
+
+#ifndef __ASP_CORE_STAGE_REPORT_H__
+#define __ASP_CORE_STAGE_REPORT_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace asp {
+
+  class StageReport {
+  public:
+
+    /// Start the clocks
+    StageReport(std::string const& stage);
+
+    /// Add a value to report, such as the search range size
+    void add(std::string const& name, double value);
+
+    /// Append the record to the report for this output prefix
+    void write(std::string const& out_prefix) const;
+
+    /// The name of the report file for this output prefix
+    static std::string report_file(std::string const& out_prefix);
+
+  private:
+    std::string m_stage, m_start_time;
+    double m_start_wall, m_start_cpu;
+    double m_start_read, m_start_written;
+    std::vector< std::pair<std::string, double> > m_values;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_STAGE_REPORT_H__
@@ -24,6 +24,7 @@
 #include <vw/Core/Log.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/MemoryBudget.h>
 #include <asp/Core/StereoSettings.h>
 
 namespace po = boost::program_options;
@@ -92,6 +93,9 @@ namespace asp {
     // to get a camera pointer, and there we don't parse stereo.default
     disable_correct_velocity_aberration    = false;
     disable_correct_atmospheric_refraction = false;
+    dg_spline_interpolation                = false;
+    compact_match_files                    = false;
+    raw_intermediates                      = false;
     
 
     double nan = std::numeric_limits<double>::quiet_NaN();
@@ -138,6 +142,8 @@ namespace asp {
        "When matching IP, filter out any pairs with a triangulation error higher than this.")
       ("ip-num-ransac-iterations", po::value(&global.ip_num_ransac_iterations)->default_value(100),
        "How many RANSAC iterations to do in interest point matching.")
+      ("ip-brute-force-matching", po::bool_switch(&global.ip_brute_force_matching)->default_value(false)->implicit_value(true),
+       "Match the interest point descriptors by comparing with all descriptors in the other image, rather than with the approximate FLANN search. Applies with a datum and cameras (nadir-facing sessions).")
       ("disable-tri-ip-filter",     po::value(&global.disable_tri_filtering)->default_value(false)->implicit_value(true),
        "Turn off the tri-ip filtering step.")
       ("ip-debug-images",     po::value(&global.ip_debug_images)->default_value(false)->implicit_value(true),
@@ -162,6 +168,10 @@ namespace asp {
        "Skip the step of normalizing the values of input images and removing nodata-pixels. Create instead symbolic links to original images.")
       ("force-reuse-match-files", po::bool_switch(&global.force_reuse_match_files)->default_value(false)->implicit_value(true),
        "Force reusing the match files even if older than the images or cameras.")
+      ("compact-match-files", po::bool_switch(&global.compact_match_files)->default_value(false)->implicit_value(true),
+       "Write the match files in a compact format, without descriptors, which is faster to read. Such files cannot be used by bundle_adjust.")
+      ("raw-intermediates", po::bool_switch(&global.raw_intermediates)->default_value(false)->implicit_value(true),
+       "Also write the aligned images and masks uncompressed, for stereo_corr to map them in memory rather than decode them for each tile.")
       ("part-of-multiview-run", po::bool_switch(&global.part_of_multiview_run)->default_value(false)->implicit_value(true),
        "If the current run is part of a larger multiview run.")
 //      ("correct-atmospheric-refraction", po::bool_switch(&global.correct_atmospheric_refraction)->default_value(false)->implicit_value(true),
@@ -178,7 +188,9 @@ namespace asp {
       ("prefilter-mode",         po::value(&global.pre_filter_mode)->default_value(2),
                      "Preprocessing filter mode. [0 None, 1 Gaussian, 2 LoG]")
       ("corr-seed-mode",         po::value(&global.seed_mode)->default_value(1),
-                     "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development)]")
+                     "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity from sparse matching at full resolution, as by sparse_disp]")
+      ("corr-seed-outlier-fraction", po::value(&global.corr_seed_outlier_fraction)->default_value(0.0),
+                     "When finding the search range of a tile from the low-res disparity, leave out clusters of disparities with fewer than this fraction of them.")
       ("min-num-ip",             po::value(&global.min_num_ip)->default_value(30),
                      "The minimum number of interest points which must be found to estimate the search range.")
       ("corr-sub-seed-percent",  po::value(&global.seed_percent_pad)->default_value(0.25),
@@ -195,6 +207,8 @@ namespace asp {
                      "Disparity search range. Specify in format: hmin vmin hmax vmax.")
       ("corr-search-limit",      po::value(&global.search_range_limit)->default_value(BBox2i(0,0,0,0), "auto"),
                      "Limit on automatically computed disparity search range: hmin vmin hmax vmax.")
+      ("search-range-from-lowres-corr", po::bool_switch(&global.search_range_from_lowres_corr)->default_value(false)->implicit_value(true),
+                     "Estimate the search range by correlating the low-resolution images, and use interest points only if that fails.")
       ("elevation-limit",        po::value(&global.elevation_limit)->default_value(Vector2(0,0), "auto"),
        "Limit on expected elevation range: Specify as two values: min max.")
       // Note that we count later on the default for lon_lat_limit being BBox2(0,0,0,0).
@@ -221,24 +235,48 @@ namespace asp {
                      "DEM to use in estimating the low-resolution disparity (when corr-seed-mode is 2).")
       ("disparity-estimation-dem-error", po::value(&global.disparity_estimation_dem_error)->default_value(0.0),
                      "Error (in meters) of the disparity estimation DEM.")
+      ("sparse-disp-template-size", po::value(&global.sparse_disp_template_size)->default_value(56),
+                     "The size of the template matched at each point when corr-seed-mode is 3.")
+      ("sparse-disp-coarse-skip", po::value(&global.sparse_disp_coarse_skip)->default_value(0),
+                     "The spacing of the initial points matched when corr-seed-mode is 3. If 0, an eighth of the shorter image side.")
+      ("sparse-disp-fine-skip",  po::value(&global.sparse_disp_fine_skip)->default_value(64),
+                     "Stop adding points at this spacing when corr-seed-mode is 3.")
+      ("sparse-disp-refine-tol", po::value(&global.sparse_disp_refine_tol)->default_value(8.0),
+                     "When corr-seed-mode is 3, add points near those whose neighbors' disparities differ by more than this.")
       ("use-local-homography",   po::bool_switch(&global.use_local_homography)->default_value(false)->implicit_value(true),
                      "Apply a local homography in each tile.")
       ("corr-timeout",           po::value(&global.corr_timeout)->default_value(900),
                      "Correlation timeout for a tile, in seconds.")
+      ("corr-tile-budget",       po::value(&global.corr_tile_budget)->default_value(0.0),
+                     "If positive, a tile whose correlation is estimated to take more seconds than this is done with more pyramid levels and, if still needed, a smaller search range, rather than being left empty by the timeout.")
       ("stereo-algorithm",       po::value(&global.stereo_algorithm)->default_value(0),
                      "Stereo algorithm to use [0=local window, 1=SGM, 2=MGM, 3=MGM Final].")
+      ("correlator-program",     po::value(&global.correlator_program)->default_value(""),
+                     "Correlate each tile with this program, such as one running on a GPU, rather than with the built-in block matching. See the documentation for how it is invoked.")
       ("corr-blob-filter",       po::value(&global.corr_blob_filter_area)->default_value(0),
                      "Filter blobs this size or less in correlation pyramid step.")
       ("corr-tile-size",         po::value(&global.corr_tile_size_ovr)->default_value(ASPGlobalOptions::corr_tile_size()),
                      "Override the default tile size used for processing.")
       ("sgm-collar-size",        po::value(&global.sgm_collar_size)->default_value(512),
                      "Extend SGM calculation to this distance to increase accuracy at tile borders.")
+      ("sgm-row-band-height",    po::value(&global.sgm_row_band_height)->default_value(0),
+                     "If positive, perform SGM/MGM in full-width row bands of this height, each extended by --sgm-collar-size, and write the disparity band by band, rather than requiring the image to fit in one tile.")
       ("sgm-search-buffer",        po::value(&global.sgm_search_buffer)->default_value(Vector2i(4,4),"4 4"),
                      "Search range expansion for SGM down stereo pyramid levels.  Smaller values are faster, but greater change of blunders.")
       ("corr-memory-limit-mb",     po::value(&global.corr_memory_limit_mb)->default_value(4*1024),
                      "Keep correlation memory usage (per tile) close to this limit.  Important for SGM/MGM.")
+      ("corr-cache-limit-mb",      po::value(&global.corr_cache_limit_mb)->default_value(4*1024),
+                     "Grow the image block cache, up to this size, so that the input image blocks read for a tile can be reused by the neighboring tiles.")
+      ("compact-disparity",        po::bool_switch(&global.compact_disparity)->default_value(false)->implicit_value(true),
+                     "With local window correlation, write the integer disparity with 16-bit rather than 32-bit channels, if the search range allows it.")
+      ("lowres-cache-dir",         po::value(&global.lowres_cache_dir)->default_value(""),
+                     "Save the low-resolution disparity, local homographies, and match files in a subdirectory of this directory, named after a hash of the inputs and settings they depend on, and reuse them in later runs, even with a different output prefix.")
       ("stereo-debug",   po::bool_switch(&global.stereo_debug)->default_value(false)->implicit_value(true),
-                     "Write stereo debug images and output.");
+                     "Write stereo debug images and output.")
+      ("stage-report",   po::bool_switch(&global.stage_report)->default_value(false)->implicit_value(true),
+                     "Append the wall and CPU time, thread utilization, peak memory, and bytes read and written by each stereo stage to <output prefix>-stage-report.csv.")
+      ("add-overviews",  po::bool_switch(&global.add_overviews)->default_value(false)->implicit_value(true),
+                     "Add internal overviews to the disparities and the point cloud, made of the valid pixels only.");
 
     po::options_description backwards_compat_options("Aliased backwards compatibility options");
     // Do not add default values here. They may override the values set
@@ -359,10 +397,18 @@ namespace asp {
                                             "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
                                             "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
+      ("save-int-point-cloud", po::bool_switch(&global.save_int_point_cloud)->default_value(false)->implicit_value(true),
+                                            "Save the final point cloud, after subtracting its center, as 32-bit integer multiples of the rounding error. This has the same size as using float, but the precision does not decrease away from the center.")
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
                                             "Only compute the center of triangulated point cloud and exit.")
       ("skip-point-cloud-center-comp", po::bool_switch(&global.skip_point_cloud_center_comp)->default_value(false)->implicit_value(true),
        "Skip the computation of the point cloud center. This option is used in parallel_stereo.")
+      ("tri-map2cam-cache-mb", po::value(&global.tri_map2cam_cache_mb)->default_value(0),
+       "With map-projected images, undo the map-projection with a cache of this size, in MB, shared among all tiles and threads, rather than have each tile redo this work. Locations between pixels are bilinearly interpolated. Set to 0 to not use this cache.")
+      ("tri-camera-grid-error", po::value(&global.tri_camera_grid_error)->default_value(0.1),
+       "With map-projected images written by mapproject with --write-camera-grid, interpolate the camera pixels saved by it where the interpolation error, in pixels, is no more than this. Elsewhere the map-projection is undone exactly. Set to 0 to not use the camera grids.")
+      ("approximate-camera-error", po::value(&global.approximate_camera_error)->default_value(0),
+       "If positive, triangulate with approximations of the cameras, interpolated from grids of camera rays made fine enough that the error, in pixels, is below this value. Not used with RPC cameras.")
       ("compute-error-vector",              po::bool_switch(&global.compute_error_vector)->default_value(false)->implicit_value(true),
                                             "Compute the triangulation error vector, not just its length.")
       ("compute-piecewise-adjustments-only", po::bool_switch(&global.compute_piecewise_adjustments_only)->default_value(false)->implicit_value(true),
@@ -404,6 +450,12 @@ namespace asp {
        "Delete any subsampled and other files created by the GUI when exiting.")
       ("create-image-pyramids-only",   po::bool_switch(&global.create_image_pyramids_only)->default_value(false)->implicit_value(true),
        "Without starting the GUI, build multi-resolution pyramids for the inputs, to be able to load them fast later.")
+      ("pyramid-cache-dir", po::value(&global.pyramid_cache_dir)->default_value(""),
+       "Keep the multi-resolution pyramids of all images in this directory, rather than next to each image, and reuse them in later sessions. Such pyramids are not deleted on exit.")
+      ("pyramid-cache-size", po::value(&global.pyramid_cache_size)->default_value(20000),
+       "When the pyramids in the cache directory take more than this many MB, remove those used least recently.")
+      ("disparity-channel", po::value(&global.disparity_channel)->default_value(0),
+       "When showing a disparity, show its horizontal (0) or vertical (1) channel.")
       ;
   }
 
@@ -413,7 +465,9 @@ namespace asp {
       ("disable-correct-velocity-aberration", po::bool_switch(&global.disable_correct_velocity_aberration)->default_value(false)->implicit_value(true),
        "Turn off velocity aberration correction for non-ISIS linescan cameras.")
       ("disable-correct-atmospheric-refraction", po::bool_switch(&global.disable_correct_atmospheric_refraction)->default_value(false)->implicit_value(true),
-       "Turn off atmospheric refraction correction for non-ISIS linescan cameras.");
+       "Turn off atmospheric refraction correction for non-ISIS linescan cameras.")
+      ("dg-spline-interpolation", po::bool_switch(&global.dg_spline_interpolation)->default_value(false)->implicit_value(true),
+       "Interpolate the positions and orientations of DigitalGlobe cameras with cubic splines. This is faster and smoother than the default piecewise interpolation.");
   }
 
   UndocOptsDescription::UndocOptsDescription() : po::options_description("Undocumented Options") {
@@ -421,7 +475,9 @@ namespace asp {
     (*this).add_options()
       ("trans-crop-win", po::value(&global.trans_crop_win)->default_value(BBox2i(0, 0, 0, 0), "xoff yoff xsize ysize"), "Left image crop window in respect to L.tif. This is an internal option. [default: use the entire image].")
       ("attach-georeference-to-lowres-disparity", po::bool_switch(&global.attach_georeference_to_lowres_disparity)->default_value(false)->implicit_value(true),
-       "If input images are georeferenced, make D_sub and D_sub_spread georeferenced.");
+       "If input images are georeferenced, make D_sub and D_sub_spread georeferenced.")
+      ("parallel-job-size", po::value(&global.parallel_job_size)->default_value(Vector2i(0, 0), "0 0"),
+       "Have stereo_parse estimate the correlation cost of each parallel_stereo job of this size, based on D_sub.");
   }
 
   po::options_description
@@ -455,6 +511,14 @@ namespace asp {
                universe_center == "none",
                ArgumentErr() << "\"" << universe_center
                << "\" is not a valid option for UNIVERSE_CENTER." );
+
+    // With a memory budget, the correlation buffers and cache must fit in it
+    if (memory_budget().has_budget()) {
+      corr_memory_limit_mb = size_t(memory_budget().cap_mb(corr_memory_limit_mb,
+                                                           MEMORY_BUDGET_BUFFER_FRACTION));
+      corr_cache_limit_mb  = size_t(memory_budget().cap_mb(corr_cache_limit_mb,
+                                                           MEMORY_BUDGET_CACHE_FRACTION));
+    }
   }
 
   void StereoSettings::write_copy( int argc, char *argv[],
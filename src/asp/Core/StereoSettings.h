@@ -103,6 +103,7 @@ namespace asp {
     double ip_nodata_radius;                /// Remove IP near nodata with this radius, in pixels.
     double ip_triangulation_max_error;      ///< Remove IP matches with triangulation error higher than this.
     int    ip_num_ransac_iterations;        ///< How many ransac iterations to do in ip matching.
+    bool   ip_brute_force_matching;         ///< Match ip descriptors exactly rather than with FLANN.
     bool   disable_tri_filtering;           ///< Turn of tri-ip filtering.
     vw::Vector2 remove_outliers_by_disp_params; /// Remove outliers based on disparity of ip.
     
@@ -122,6 +123,8 @@ namespace asp {
     bool   no_datum;                        ///< Do not assume a reliable datum exists
     bool   skip_image_normalization;        ///< Skip the step of normalizing the values of input images and removing nodata-pixels. Create instead symbolic links to original images.
     bool   force_reuse_match_files;         ///< Force reusing the match files even if older than the images or cameras
+    bool   compact_match_files;             ///< Write the match files in the compact format
+    bool   raw_intermediates;               ///< Write uncompressed copies of L.tif, R.tif, and the masks
     bool   part_of_multiview_run;           ///< If this run is part of a larger multiview run
     std::string datum;                      ///< The datum to use with RPC camera models
 
@@ -137,6 +140,7 @@ namespace asp {
                                       //     (see disparity-estimation-dem)
                                       // 3 = Use low-res disparity produced by sparse_disp
                                       //     (in development)
+    double corr_seed_outlier_fraction; // Leave out small clusters of low-res disparities
 
     int   min_num_ip;                 ///< Minimum number of IP's needed for search range estimation.
 
@@ -151,6 +155,7 @@ namespace asp {
     vw::Vector2i corr_kernel;         // Correlation kernel
     vw::BBox2i   search_range;        // Correlation search range
     vw::BBox2i   search_range_limit;  // Correlation search range limit
+    bool         search_range_from_lowres_corr; // Estimate the search range without IP
     vw::Vector2  elevation_limit;     // Expected range of elevation to limit results to.
     vw::BBox2    lon_lat_limit;       // Limit the triangulated interest points to this lonlat range
 
@@ -159,17 +164,29 @@ namespace asp {
     bool skip_low_res_disparity_comp;
     std::string disparity_estimation_dem;     // DEM to use in estimating the low-resolution disparity
     double disparity_estimation_dem_error; // Error (in meters) of the disparity estimation DEM
+    int    sparse_disp_template_size; // For corr-seed-mode 3: the template size,
+    int    sparse_disp_coarse_skip;   // the spacing of the initial points,
+    int    sparse_disp_fine_skip;     // the spacing at which to stop adding points,
+    double sparse_disp_refine_tol;    // and the disparity range for adding them
     bool   use_local_homography;      // Apply a local homography in each tile
     int    corr_timeout;              // Correlation timeout for a tile, in seconds
+    double corr_tile_budget;          // Adapt the search of a tile estimated to take longer than this
     int    stereo_algorithm;          // 0 = Default local window search method.
                                       // 1 = Slower SGM method.
                                       // 2 = Even slower smooth SGM method.
+    std::string correlator_program;   // Correlate each tile with this program
     int    corr_blob_filter_area;     // Use blob filtering in pyramidal correlation
     int    corr_tile_size_ovr;        // Override the default tile size used for processing.
     int    sgm_collar_size;           // Extra tile padding used for SGM calculation.
+    int    sgm_row_band_height;       // If positive, do SGM in full-width row bands of this height.
     vw::Vector2i sgm_search_buffer;   // Search padding in SGM around previous pyramid level disparity value.
     size_t corr_memory_limit_mb;      // Correlation memory limit, only important for SGM/MGM.
+    size_t corr_cache_limit_mb;       // Upper bound for the input image block cache in correlation.
+    bool   compact_disparity;         // Store the integer disparity as int16 when it fits.
+    std::string lowres_cache_dir;     // Reuse the low-res correlation results stored here.
     bool   stereo_debug;              // Write stereo debug images and messages
+    bool   stage_report;              // Append the time and resources used to a report
+    bool   add_overviews;             // Add validity-aware overviews to D, RD, F, and PC
 
     // Subpixel Options
     bool subpix_from_blend;           // Read from -B.tif instead of -D.tif
@@ -235,9 +252,13 @@ namespace asp {
     bool   use_least_squares;                 // Use a more rigorous triangulation
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   save_int_point_cloud;              // Save the point cloud as int32 multiples of the rounding error
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
+    int    tri_map2cam_cache_mb;              // Size of the shared cache of map-projection transforms
+    double tri_camera_grid_error;             // Use the mapproject camera grids where their error is below this
+    double approximate_camera_error;          // If positive, triangulate with approximate cameras
     
     // stereo_gui options
     int grid_cols;
@@ -250,15 +271,20 @@ namespace asp {
     std::string match_file, gcp_file, dem_file;
     bool delete_temporary_files_on_exit;
     bool create_image_pyramids_only, hide_all;
+    std::string pyramid_cache_dir;            // Where to keep pyramids across sessions
+    double pyramid_cache_size;                // In MB
+    int disparity_channel;                    // 0 for horizontal, 1 for vertical
     std::vector<std::string> vwip_files;
     
     // Sensor options
     bool disable_correct_velocity_aberration;
     bool disable_correct_atmospheric_refraction;
+    bool dg_spline_interpolation;
 
     // Undocumented options. We don't want these exposed to the user.
     vw::BBox2i trans_crop_win;        // Left image crop window in respect to L.tif.
     bool attach_georeference_to_lowres_disparity;
+    vw::Vector2i parallel_job_size;   // Print the estimated cost of correlation for tiles of this size.
 
     // Internal variable, to ensure we always initialize this class before using it
     bool initialized_stereo_settings;
@@ -0,0 +1,151 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/TextureFilter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  // A summed-area table. Entry (c, r) is the sum of the values at
+  // columns less than c and rows less than r.
+  class SummedArea {
+  public:
+    SummedArea(int cols, int rows):
+      m_cols(cols), m_rows(rows), m_sums((cols+1)*size_t(rows+1), 0.0) {}
+
+    // Fill the table, given the values in row-major order
+    void build(std::vector<double> const& values) {
+      for (int row = 0; row < m_rows; row++) {
+        double row_sum = 0.0;
+        for (int col = 0; col < m_cols; col++) {
+          row_sum += values[col + size_t(row)*m_cols];
+          at(col+1, row+1) = at(col+1, row) + row_sum;
+        }
+      }
+    }
+
+    // The sum over the window of given half size around a pixel,
+    // clipped to the image
+    double window_sum(int col, int row, int half) const {
+      int c0 = std::max(col - half, 0), c1 = std::min(col + half + 1, m_cols);
+      int r0 = std::max(row - half, 0), r1 = std::min(row + half + 1, m_rows);
+      return at(c1, r1) - at(c0, r1) - at(c1, r0) + at(c0, r0);
+    }
+
+  private:
+    double & at(int c, int r) { return m_sums[c + size_t(r)*(m_cols+1)]; }
+    double   at(int c, int r) const { return m_sums[c + size_t(r)*(m_cols+1)]; }
+
+    int m_cols, m_rows;
+    std::vector<double> m_sums;
+  };
+
+}
+
+namespace asp {
+
+void texture_measure(ImageView<PixelGray<float> > const& image,
+                     ImageView<float> & texture, int kernel_size) {
+
+  int cols = image.cols(), rows = image.rows();
+  texture.set_size(cols, rows);
+  if (cols <= 0 || rows <= 0)
+    return;
+
+  // Subtract a value near the mean to keep the sums of squares accurate
+  double shift = image(cols/2, rows/2).v();
+  size_t num = size_t(cols)*rows;
+  std::vector<double> values(num), squares(num);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      double v = image(col, row).v() - shift;
+      values [col + size_t(row)*cols] = v;
+      squares[col + size_t(row)*cols] = v*v;
+    }
+  }
+  SummedArea sum(cols, rows), sum2(cols, rows);
+  sum.build(values);
+  sum2.build(squares);
+
+  int half = std::max(kernel_size/2, 0);
+  SummedArea count(cols, rows);
+  std::fill(values.begin(), values.end(), 1.0);
+  count.build(values);
+
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      double n    = count.window_sum(col, row, half);
+      double mean = sum.window_sum(col, row, half)/n;
+      double var  = sum2.window_sum(col, row, half)/n - mean*mean;
+      texture(col, row) = std::sqrt(std::max(var, 0.0));
+    }
+  }
+}
+
+void texture_preserving_disparity_filter
+(ImageView<PixelMask<Vector2f> > const& disparity,
+ ImageView<PixelMask<Vector2f> > & output,
+ ImageView<float> const& texture, float texture_max, int kernel_size) {
+
+  int cols = disparity.cols(), rows = disparity.rows();
+  output = copy(disparity);
+  int max_half = kernel_size/2;
+  if (cols <= 0 || rows <= 0 || max_half <= 0 || texture_max <= 0)
+    return;
+
+  size_t num = size_t(cols)*rows;
+  std::vector<double> dx(num, 0.0), dy(num, 0.0), valid(num, 0.0);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      PixelMask<Vector2f> const& d = disparity(col, row);
+      if (!is_valid(d))
+        continue;
+      size_t k = col + size_t(row)*cols;
+      dx[k]    = d.child()[0];
+      dy[k]    = d.child()[1];
+      valid[k] = 1.0;
+    }
+  }
+  SummedArea sum_x(cols, rows), sum_y(cols, rows), count(cols, rows);
+  sum_x.build(dx);
+  sum_y.build(dy);
+  count.build(valid);
+
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      if (!is_valid(disparity(col, row)))
+        continue;
+      float t = texture(col, row);
+      if (t >= texture_max)
+        continue;
+      int half = int(round(max_half*(1.0 - t/texture_max)));
+      if (half <= 0)
+        continue;
+      double n = count.window_sum(col, row, half); // at least 1, this pixel
+      output(col, row).child() = Vector2f(sum_x.window_sum(col, row, half)/n,
+                                          sum_y.window_sum(col, row, half)/n);
+    }
+  }
+}
+
+} // end namespace asp
@@ -0,0 +1,53 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TextureFilter.h
+///
+/// Texture-aware smoothing of disparities. Both the texture measure and
+/// the smoothing are means over square windows, found from summed-area
+/// tables, so their cost per pixel does not depend on the window size.
+/// Windows are clipped at the image edges.
+
+#ifndef __ASP_CORE_TEXTURE_FILTER_H__
+#define __ASP_CORE_TEXTURE_FILTER_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  /// The standard deviation of the image in a window of the given size
+  /// around each pixel. It is low in regions with little texture.
+  void texture_measure(vw::ImageView<vw::PixelGray<float> > const& image,
+                       vw::ImageView<float> & texture, int kernel_size);
+
+  /// Replace each valid disparity by the mean of the valid disparities
+  /// in a window around it. The window is largest, of size kernel_size,
+  /// where there is no texture, and shrinks linearly to one pixel as the
+  /// texture grows to texture_max. Invalid disparities stay invalid.
+  void texture_preserving_disparity_filter
+  (vw::ImageView<vw::PixelMask<vw::Vector2f> > const& disparity,
+   vw::ImageView<vw::PixelMask<vw::Vector2f> > & output,
+   vw::ImageView<float> const& texture, float texture_max, int kernel_size);
+
+} // end namespace asp
+
+#endif//__ASP_CORE_TEXTURE_FILTER_H__
@@ -15,238 +15,182 @@
 //  limitations under the License.
 // __END_LICENSE__
 
+/// \file ThreadedEdgeMask.h
+///
+/// Mask the pixels outside the valid area of an image. A pixel is
+/// valid if it is within the first and last valid pixels of both its
+/// row and its column, where valid pixels are those different from the
+/// mask value. The valid area can be shrunk by a buffer on each side.
+///
+/// The image is scanned in bands of rows, when a tile first needs them,
+/// and each band is scanned once, by one of the threads, in blocks. A
+/// band keeps only the first and last valid pixels of its rows and
+/// columns. A tile needs the bands of its own rows, and for each column
+/// the bands from the image edges to the first and last valid pixels in
+/// it, which are usually the top and bottom bands. Hence tiles can be
+/// written before the whole image is scanned.
 
 #include <vw/Core/System.h>
 #include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
 #include <vw/Image/MaskViews.h>
-#include <boost/foreach.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/type_traits.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <vector>
 
 #ifndef __ASP_CORE_THREADEDEDGEMASK_H__
 #define __ASP_CORE_THREADEDEDGEMASK_H__
 
 namespace asp {
 
-  /// Quick way to check which pixels are inside the valid input mask??
   template <class ViewT>
   class ThreadedEdgeMaskView : public vw::ImageViewBase<ThreadedEdgeMaskView<ViewT> > {
+  public:
 
-    ViewT m_view;
+    typedef typename ViewT::pixel_type orig_pixel_type;
+    typedef typename boost::remove_cv<typename boost::remove_reference<orig_pixel_type>::type>::type unmasked_pixel_type;
+    typedef vw::PixelMask<unmasked_pixel_type> pixel_type;
+    typedef vw::PixelMask<unmasked_pixel_type> result_type;
+    typedef vw::ProceduralPixelAccessor<ThreadedEdgeMaskView> pixel_accessor;
 
-    typedef boost::shared_array<vw::int32> SharedArray;
-    SharedArray m_left, m_right, m_top, m_bottom;
+  private:
 
-    // Determines if a single pixel is valid.
-    inline bool valid(vw::int32 i, vw::int32 j) const {
-      if ( i > m_left[j] && i < m_right[j] && j > m_top[i] && j < m_bottom[i] )
-        return true;
-      else
-        return false;
-    }
+    // The first and last valid pixels in the rows and columns of a band
+    // of rows, in image coordinates, or -1 if there are none.
+    struct Band {
+      std::once_flag once;
+      std::vector<vw::int32> row_first, row_last, col_first, col_last;
+    };
 
-    // Task that checks individual blocks for edges
-    class EdgeMaskTask : public vw::Task, private boost::noncopyable {
-      ViewT m_view;
-      typename ViewT::pixel_type m_mask_value;
-      vw::BBox2i m_bbox;   // Region of image we're working in
-      typedef std::vector<vw::int32> Array;
-      typedef boost::shared_array<vw::int32> SharedArray;
-      SharedArray g_left, g_right, g_top, g_bottom;
-      Array       m_left, m_right, m_top, m_bottom;
-      // This how much we increment after we test a pixel. Set to 1 if
-      // you wish to test every pixel.
-      const vw::int32 STEP_SIZE;
-    public:
-      EdgeMaskTask(ViewT const& view,
-                   typename ViewT::pixel_type mask_value,
-                   vw::int32 search_step,
-                   vw::BBox2i bbox, SharedArray left, SharedArray right,
-                   SharedArray top, SharedArray bottom ) :
-        m_view(view), m_mask_value(mask_value), m_bbox(bbox), 
-        g_left(left), g_right(right), g_top(top), g_bottom(bottom), 
-        m_left( m_bbox.height() ), m_right( m_bbox.height() ), 
-        m_top( m_bbox.width() ), m_bottom( m_bbox.width() ), STEP_SIZE(search_step) {
-
-        std::fill( m_left.begin  (), m_left.end  (), -1 );
-        std::fill( m_right.begin (), m_right.end (), -1 );
-        std::fill( m_top.begin   (), m_top.end   (), -1 );
-        std::fill( m_bottom.begin(), m_bottom.end(), -1 );
-      }
+    ViewT m_view;
+    unmasked_pixel_type m_mask_value;
+    vw::int32 m_mask_buffer, m_band_height;
+    std::vector< boost::shared_ptr<Band> > m_bands; // Shared by copies
 
-      void operator()() {
-        using namespace vw;
-
-        // Rasterizing local tile
-        ImageView<typename ViewT::pixel_type> copy( crop(m_view, m_bbox ) );
-
-        { // Detecting Edges
-          // Search left and right side
-          for ( int32 j = 0; j < copy.rows(); ++j ) { // Loop up through the rows in the local tile
-            int32 i = 0;
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Move from left to right in row by STEP_SIZE
-              i += STEP_SIZE;                                      //    until we hit an invalid pixel
-            if ( i > 0 ) i -= STEP_SIZE;                           // Walk back one step if we are not at col 0
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Now do the same thing but in steps of 1
-              ++i;
-            if ( i > 0 ) --i;
-            // Early exit condition if entire row was nodata
-            if ( i == copy.cols() -1 )
-              continue; // We're keeping left and right as -1
-            m_left[j] = i;                                         // Now we have the left-most valid column in the row
-
-            i = copy.cols() - 1;                                   // Do the same thing going right to left
-            while ( i >= 0 && copy(i,j) == m_mask_value )
-              i -= STEP_SIZE;
-            if ( i < copy.cols() - 1 )
-              i += STEP_SIZE;
-            while ( i >= 0 && copy(i,j) == m_mask_value )
-              --i;
-            if ( i < copy.cols() - 1 )
-              ++i;
-            m_right[j] = i;
-          }
-                                                                   // Now find the first valid rows from the bottom
-          for ( int32 i = 0; i < copy.cols(); ++i ) {
-            int32 j = 0;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              j += STEP_SIZE;
-            if ( j > 0 )
-              j -= STEP_SIZE;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              ++j;
-            if ( j > 0 )
-              --j;
-            // Early exit condition if entire column was nodata
-            if ( j == copy.rows() - 1 )
-              continue; // We're keeping top and bottom as -1
-            m_top[i] = j;
-
-            j = copy.rows()-1;                                     // And the first valid rows from the top
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              j -= STEP_SIZE;
-            if ( j < copy.rows()-1 )
-              j += STEP_SIZE;
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              --j;
-            if ( j < copy.rows()-1 )
-              ++j;
-            m_bottom[i] = j;
-          }
-        }
+    // Scan a band in square blocks
+    void scan_band(int b, Band & band) const {
+      using namespace vw;
 
-        { // Merging result back into global perspective
-          int32 l = 0;
-          for ( int32 j = m_bbox.min()[1];                      // Loop through rows
-                j < m_bbox.max()[1]; j++ ) {
-            if ( m_left[l] == -1 ) {                            // Skip rows with no pixels
-              l++; continue;
-            }
-            g_left[j] = std::min( m_left[l] + m_bbox.min()[0],  // Add in the bounding box column
-                                  g_left[j] );
-            g_right[j] = std::max( m_right[l] + m_bbox.min()[0],
-                                   g_right[j] );
-            l++;
+      int32 r0 = b*m_band_height;
+      int32 nr = std::min(m_band_height, rows() - r0);
+      band.row_first.assign(nr,     -1);
+      band.row_last.assign (nr,     -1);
+      band.col_first.assign(cols(), -1);
+      band.col_last.assign (cols(), -1);
+
+      for (int32 c0 = 0; c0 < cols(); c0 += m_band_height) {
+        int32 nc = std::min(m_band_height, cols() - c0);
+        ImageView<unmasked_pixel_type> block = crop(m_view, BBox2i(c0, r0, nc, nr));
+
+        for (int32 j = 0; j < nr; j++) {
+          int32 i = 0;
+          if (band.row_first[j] < 0) {
+            while (i < nc && block(i, j) == m_mask_value)
+              i++;
+            if (i == nc)
+              continue;
+            band.row_first[j] = c0 + i;
           }
+          i = nc - 1;
+          while (i >= 0 && block(i, j) == m_mask_value)
+            i--;
+          if (i >= 0)
+            band.row_last[j] = c0 + i;
+        }
 
-          l = 0;
-          for ( int32 i = m_bbox.min()[0];                       // Loop through columns
-                i < m_bbox.max()[0]; i++ ) {
-            if ( m_top[l] == -1 ) {                              // Skip columns with no pixels
-              l++; continue;
-            }
-            g_top[i] = std::min( m_top[l] + m_bbox.min()[1],     // Add in the bounding box row
-                                 g_top[i] );
-            g_bottom[i] = std::max( m_bottom[l] + m_bbox.min()[1],
-                                    g_bottom[i] );
-            l++;
-          }
+        for (int32 i = 0; i < nc; i++) {
+          int32 j = 0;
+          while (j < nr && block(i, j) == m_mask_value)
+            j++;
+          if (j == nr)
+            continue;
+          band.col_first[c0 + i] = r0 + j;
+          j = nr - 1;
+          while (j >= 0 && block(i, j) == m_mask_value)
+            j--;
+          band.col_last[c0 + i] = r0 + j;
         }
       }
-    };
+    }
 
-    // Specialized deep copy constructor (private)
-    template <class OViewT>
-    ThreadedEdgeMaskView( ViewT const& view,
-                          ThreadedEdgeMaskView<OViewT> const& other,
-                          vw::BBox2i const& box ) :
-      m_view( view ), m_left(new vw::int32[box.height()]), m_right(new vw::int32[box.height()]),
-      m_top(new vw::int32[box.width()]), m_bottom(new vw::int32[box.width()]) {
-      using namespace vw;
+    Band const& band(int b) const {
+      Band & band = *m_bands[b];
+      std::call_once(band.once, &ThreadedEdgeMaskView::scan_band, this, b, std::ref(band));
+      return band;
+    }
 
-      // Copy only sections that we need
-      std::copy( other.m_left.get()+box.min()[1],
-                 other.m_left.get()+box.max()[1], m_left.get() );
-      std::copy( other.m_right.get()+box.min()[1],
-                 other.m_right.get()+box.max()[1], m_right.get() );
-      std::copy( other.m_top.get()+box.min()[0],
-                 other.m_top.get()+box.max()[0], m_top.get() );
-      std::copy( other.m_bottom.get()+box.min()[0],
-                 other.m_bottom.get()+box.max()[0], m_bottom.get() );
-
-      // Modify to new coordinate system
-      std::for_each( m_left.get(), m_left.get()+box.height(),
-                     ArgValInPlaceSumFunctor<int32>( -box.min()[0] ) );
-      std::for_each( m_right.get(), m_right.get()+box.height(),
-                     ArgValInPlaceSumFunctor<int32>( -box.min()[0] ) );
-      std::for_each( m_top.get(), m_top.get()+box.width(),
-                     ArgValInPlaceSumFunctor<int32>( -box.min()[1] ) );
-      std::for_each( m_bottom.get(), m_bottom.get()+box.width(),
-                     ArgValInPlaceSumFunctor<int32>( -box.min()[1] ) );
+    // The first and last valid pixels in a row or column, or -1 if there are none
+    vw::int32 row_first(vw::int32 j) const {
+      return band(j / m_band_height).row_first[j % m_band_height];
+    }
+    vw::int32 row_last(vw::int32 j) const {
+      return band(j / m_band_height).row_last[j % m_band_height];
+    }
+    vw::int32 col_first(vw::int32 i) const {
+      for (size_t b = 0; b < m_bands.size(); b++) {
+        vw::int32 j = band(b).col_first[i];
+        if (j >= 0)
+          return j;
+      }
+      return -1;
+    }
+    vw::int32 col_last(vw::int32 i) const {
+      for (int b = int(m_bands.size()) - 1; b >= 0; b--) {
+        vw::int32 j = band(b).col_last[i];
+        if (j >= 0)
+          return j;
+      }
+      return -1;
     }
 
-  public:
+    // The range of valid pixels in a row or column, after the buffer
+    // is applied. It is empty if there are none.
+    void row_range(vw::int32 j, vw::int32 & first, vw::int32 & last) const {
+      first = row_first(j);
+      last  = row_last(j);
+      if (first < 0) {
+        first = 0; last = -1;
+        return;
+      }
+      first += m_mask_buffer;
+      last  -= m_mask_buffer;
+    }
+    void col_range(vw::int32 i, vw::int32 & first, vw::int32 & last) const {
+      first = col_first(i);
+      if (first < 0) {
+        first = 0; last = -1;
+        return;
+      }
+      last   = col_last(i);
+      first += m_mask_buffer;
+      last  -= m_mask_buffer;
+    }
 
-    typedef typename ViewT::pixel_type orig_pixel_type;
-    typedef typename boost::remove_cv<typename boost::remove_reference<orig_pixel_type>::type>::type unmasked_pixel_type;
-    typedef vw::PixelMask<unmasked_pixel_type> pixel_type;
-    typedef vw::PixelMask<unmasked_pixel_type> result_type;
-    typedef vw::ProceduralPixelAccessor<ThreadedEdgeMaskView> pixel_accessor;
+    // Task scanning one band
+    class BandTask : public vw::Task, private boost::noncopyable {
+      ThreadedEdgeMaskView const& m_mask;
+      int m_band;
+    public:
+      BandTask(ThreadedEdgeMaskView const& mask, int b): m_mask(mask), m_band(b) {}
+      void operator()() { m_mask.band(m_band); }
+    };
+
+  public:
 
     ThreadedEdgeMaskView( ViewT const& view,
                           unmasked_pixel_type const& mask_value,
                           vw::int32 mask_buffer = 0,
                           vw::int32 block_size = vw::vw_settings().default_tile_size()) :
-      m_view(view), m_left( new vw::int32[view.rows()]), m_right( new vw::int32[view.rows()] ),
-      m_top( new vw::int32[view.cols()] ), m_bottom( new vw::int32[view.cols()] ) {
-      using namespace vw;
-
-      std::fill( m_left.get(),   m_left.get  ()+view.rows(), view.cols() );
-      std::fill( m_right.get(),  m_right.get ()+view.rows(), 0           );
-      std::fill( m_top.get(),    m_top.get   ()+view.cols(), view.rows() );
-      std::fill( m_bottom.get(), m_bottom.get()+view.cols(), 0           );
-
-      // Calculating edges in parallel
-      FifoWorkQueue queue( vw_settings().default_num_threads() );
-
-      std::vector<BBox2i> bboxes = subdivide_bbox( m_view, block_size, block_size );
-
-      // Figure out an ideal search step size. Smaller means we're
-      // more likely to catch small features. Bigger step size means
-      // will move a lot faster.
-      int32 search_step = norm_2(Vector2i(m_view.cols(),m_view.rows())) / 500;
-      if (search_step < 1 )
-        search_step = 1;
-      if ( search_step > 10 ) 
-        search_step = 10;
-      VW_OUT(DebugMessage, "threadededgemask") << "Setting search step to " << search_step << std::endl;
-
-      // Find the outermost valid pixel coming in from each line/direction.
-      BOOST_FOREACH( BBox2i const& box, bboxes ) {
-        VW_OUT(DebugMessage, "threadededgemask") << "Created EdgeMaskTask for " << box << std::endl;
-        boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, search_step, box, 
-                                                              m_left, m_right, m_top, m_bottom ) );
-        queue.add_task(task);
-      }
-      queue.join_all(); // Wait for all tasks to complete
-
-      // Erode the valid area by mask_buffer size on each side.
-      std::for_each( m_left.get(), m_left.get()+view.rows(),
-                     vw::ArgValInPlaceSumFunctor<vw::int32>( mask_buffer ) );
-      std::for_each( m_right.get(), m_right.get()+view.rows(),
-                     vw::ArgValInPlaceDifferenceFunctor<vw::int32>( mask_buffer ) );
-      std::for_each( m_top.get(), m_top.get()+view.cols(),
-                     vw::ArgValInPlaceSumFunctor<vw::int32>( mask_buffer ) );
-      std::for_each( m_bottom.get(), m_bottom.get()+view.cols(),
-                     vw::ArgValInPlaceDifferenceFunctor<vw::int32>( mask_buffer ) );
+      m_view(view), m_mask_value(mask_value), m_mask_buffer(mask_buffer),
+      m_band_height(std::max(block_size, vw::int32(1))) {
+      int num_bands = (view.rows() + m_band_height - 1) / m_band_height;
+      for (int b = 0; b < num_bands; b++)
+        m_bands.push_back(boost::shared_ptr<Band>(new Band));
     }
 
     inline vw::int32 cols  () const { return m_view.cols  (); }
@@ -256,37 +200,75 @@ namespace asp {
     inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
     inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
-      if ( this->valid(i,j) )
-        return pixel_type(m_view(i,j,p));
-      else
+      vw::int32 first, last;
+      row_range(j, first, last);
+      if (i < first || i > last)
         return pixel_type();
+      col_range(i, first, last);
+      if (j < first || j > last)
+        return pixel_type();
+      return pixel_type(m_view(i,j,p));
     }
 
+    /// The bounding box of the valid pixels. This scans the whole image.
     vw::BBox2i active_area() const {
-      return vw::BBox2i( vw::Vector2i(*std::min_element(&m_left  [0], &m_left  [rows()])+1,
-                                      *std::min_element(&m_top   [0], &m_top   [cols()])+1),
-                         vw::Vector2i(*std::max_element(&m_right [0], &m_right [rows()]),
-                                      *std::max_element(&m_bottom[0], &m_bottom[cols()])) );
+      using namespace vw;
+
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      for (size_t b = 0; b < m_bands.size(); b++)
+        queue.add_task(boost::shared_ptr<Task>(new BandTask(*this, b)));
+      queue.join_all();
+
+      BBox2i area;
+      for (int32 j = 0; j < rows(); j++) {
+        int32 first, last;
+        row_range(j, first, last);
+        if (first > last)
+          continue;
+        area.grow(Vector2i(first, j));
+        area.grow(Vector2i(last + 1, j));
+      }
+      BBox2i col_area;
+      for (int32 i = 0; i < cols(); i++) {
+        int32 first, last;
+        col_range(i, first, last);
+        if (first > last)
+          continue;
+        col_area.grow(Vector2i(i, first));
+        col_area.grow(Vector2i(i, last + 1));
+      }
+      return BBox2i(Vector2i(area.min()[0], col_area.min()[1]),
+                    Vector2i(area.max()[0], col_area.max()[1]));
     }
 
-    typedef vw::CropView<ThreadedEdgeMaskView<vw::CropView<typename ViewT::prerasterize_type> > > prerasterize_type;
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
     inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
-      // We are deep copying a small section of ThreadedEdgeMaskView
-      // and then uncropping back to original coordinates.
-      typedef ThreadedEdgeMaskView<vw::CropView<typename ViewT::prerasterize_type> > inner_type;
-      return vw::crop(inner_type( vw::crop(m_view.prerasterize(bbox),bbox),
-                                  *this, bbox ),
-                      -bbox.min()[0], -bbox.min()[1],
-                      this->cols(), this->rows() );
+      using namespace vw;
+
+      ImageView<unmasked_pixel_type> input = crop(m_view, bbox);
+      ImageView<pixel_type> tile(bbox.width(), bbox.height());
+
+      std::vector<int32> col_first(bbox.width()), col_last(bbox.width());
+      for (int32 i = 0; i < bbox.width(); i++)
+        col_range(bbox.min()[0] + i, col_first[i], col_last[i]);
+
+      for (int32 j = 0; j < bbox.height(); j++) {
+        int32 row = bbox.min()[1] + j, first, last;
+        row_range(row, first, last);
+        for (int32 i = 0; i < bbox.width(); i++) {
+          int32 col = bbox.min()[0] + i;
+          if (col >= first && col <= last && row >= col_first[i] && row <= col_last[i])
+            tile(i, j) = pixel_type(input(i, j));
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min()[0], -bbox.min()[1],
+                               cols(), rows());
     }
 
     template <class DestT> inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
       vw::rasterize( prerasterize(bbox), dest, bbox );
     }
-
-    // Friend other types of threaded edge mask
-    template <class OViewT>
-    friend class ThreadedEdgeMaskView;
   };
 
   template <class ViewT>
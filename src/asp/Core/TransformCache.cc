@@ -0,0 +1,184 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/TransformCache.h>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+
+namespace {
+  inline bool has_nan(Vector2 const& v) {
+    return std::isnan(v[0]) || std::isnan(v[1]);
+  }
+
+  long next_cache_id() {
+    static std::atomic<long> counter(0);
+    return counter++;
+  }
+
+  // The last tile a thread looked up. A cache id, rather than the
+  // address of the cache, tells to which cache it belongs, as a new
+  // cache may be made at the address of a deleted one.
+  struct LastTile {
+    long    cache_id;
+    int     trans_id;
+    Vector2i tile_index;
+    BBox2i  tile_box;
+    asp::TransformTileCache::TilePtr tile;
+    LastTile(): cache_id(-1), trans_id(-1) {}
+  };
+}
+
+namespace asp {
+
+TransformTileCache::TransformTileCache(size_t max_bytes, int tile_size):
+  m_max_bytes(max_bytes), m_tile_size(tile_size), m_cache_id(next_cache_id()) {
+  if (m_tile_size <= 0)
+    vw_throw(ArgumentErr() << "TransformTileCache: The tile size must be positive.\n");
+  m_tile_bytes = size_t(m_tile_size + 1) * size_t(m_tile_size + 1) * sizeof(Vector2);
+}
+
+int TransformTileCache::add_transform(TransPtr const& trans, CopyFunc const& copy_func) {
+  Mutex::Lock lock(m_mutex);
+  m_transforms.push_back(trans);
+  m_copy_funcs.push_back(copy_func);
+  return int(m_transforms.size()) - 1;
+}
+
+// Evaluate the transform at all integer pixels of the tile, including
+// the last row and column, which are shared with the neighboring tiles.
+TransformTileCache::TilePtr
+TransformTileCache::compute_tile(int trans_id, BBox2i const& tile_box) const {
+
+  // A private copy, so that its internal state is not shared among threads
+  TransPtr trans = m_copy_funcs[trans_id](m_transforms[trans_id]);
+
+  // Let the transform prepare for this region, if it makes use of that
+  BBox2i grown_box = tile_box;
+  grown_box.max() += Vector2i(1, 1);
+  try {
+    trans->reverse_bbox(grown_box);
+  } catch(...) {}
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  TilePtr tile(new ImageView<Vector2>(m_tile_size + 1, m_tile_size + 1));
+  for (int row = 0; row <= m_tile_size; row++) {
+    for (int col = 0; col <= m_tile_size; col++) {
+      Vector2 pix = tile_box.min() + Vector2(col, row);
+      try {
+        (*tile)(col, row) = trans->reverse(pix);
+      } catch(...) {
+        (*tile)(col, row) = Vector2(nan, nan);
+      }
+    }
+  }
+
+  return tile;
+}
+
+TransformTileCache::TilePtr
+TransformTileCache::tile(int trans_id, Vector2i const& tile_index, BBox2i & tile_box) {
+
+  tile_box = BBox2i(tile_index[0]*m_tile_size, tile_index[1]*m_tile_size,
+                    m_tile_size, m_tile_size);
+  KeyType key(trans_id, std::make_pair(tile_index[0], tile_index[1]));
+
+  {
+    Mutex::Lock lock(m_mutex);
+    if (trans_id < 0 || trans_id >= int(m_transforms.size()))
+      vw_throw(ArgumentErr() << "TransformTileCache: Invalid transform id.\n");
+
+    std::map<KeyType, Entry>::iterator it = m_tiles.find(key);
+    if (it != m_tiles.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru_pos);
+      return it->second.tile;
+    }
+  }
+
+  // Compute outside the lock, so other threads can proceed. Two threads
+  // may compute the same tile at the same time, then the first one is kept.
+  TilePtr tile = compute_tile(trans_id, tile_box);
+
+  Mutex::Lock lock(m_mutex);
+  std::map<KeyType, Entry>::iterator it = m_tiles.find(key);
+  if (it != m_tiles.end())
+    return it->second.tile;
+
+  m_lru.push_front(key);
+  Entry entry;
+  entry.tile    = tile;
+  entry.lru_pos = m_lru.begin();
+  m_tiles[key]  = entry;
+
+  // Evict the least recently used tiles. Those still in use elsewhere
+  // stay alive until released, as they are shared pointers.
+  while (m_tiles.size() > 1 && m_tiles.size() * m_tile_bytes > m_max_bytes) {
+    m_tiles.erase(m_lru.back());
+    m_lru.pop_back();
+  }
+
+  return tile;
+}
+
+Vector2 TransformTileCache::reverse(int trans_id, Vector2 const& pix) {
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  if (has_nan(pix))
+    return Vector2(nan, nan);
+
+  Vector2i tile_index(int(floor(pix[0]/m_tile_size)), int(floor(pix[1]/m_tile_size)));
+
+  // The pixels are looked up in nearby sequences, so the tile is
+  // mostly the one of the previous call in this thread. A tile evicted
+  // meanwhile is still valid, as its values do not change.
+  static thread_local LastTile last;
+  if (last.cache_id != m_cache_id || last.trans_id != trans_id ||
+      last.tile_index != tile_index) {
+    last.tile       = tile(trans_id, tile_index, last.tile_box);
+    last.cache_id   = m_cache_id;
+    last.trans_id   = trans_id;
+    last.tile_index = tile_index;
+  }
+  BBox2i const& tile_box = last.tile_box;
+  ImageView<Vector2> const& vals = *last.tile;
+
+  double x = pix[0] - tile_box.min().x(), y = pix[1] - tile_box.min().y();
+  int c = std::min(int(floor(x)), m_tile_size - 1);
+  int r = std::min(int(floor(y)), m_tile_size - 1);
+  double dx = x - c, dy = y - r;
+
+  Vector2 const& v00 = vals(c,   r  );
+  Vector2 const& v10 = vals(c+1, r  );
+  Vector2 const& v01 = vals(c,   r+1);
+  Vector2 const& v11 = vals(c+1, r+1);
+
+  // Exact at integer pixels
+  if (dx == 0 && dy == 0)
+    return v00;
+
+  if (has_nan(v00) || has_nan(v10) || has_nan(v01) || has_nan(v11))
+    return Vector2(nan, nan);
+
+  return (1.0 - dy) * ((1.0 - dx) * v00 + dx * v10) +
+                 dy * ((1.0 - dx) * v01 + dx * v11);
+}
+
+} // end namespace asp
@@ -0,0 +1,116 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TransformCache.h
+///
+/// A cache of the values of expensive image transforms, such as the
+/// ones undoing map-projection, shared among all tiles and threads.
+
+#ifndef __ASP_CORE_TRANSFORM_CACHE_H__
+#define __ASP_CORE_TRANSFORM_CACHE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Transform.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+
+#include <list>
+#include <map>
+#include <vector>
+
+namespace asp {
+
+  /// Thread-safe LRU cache of the reverse() values of transforms at the
+  /// integer pixels of image tiles. Each tile stores tile_size + 1 samples
+  /// in each direction, so that any location in the tile can be
+  /// bilinearly interpolated. Memory use is bounded by max_bytes.
+  class TransformTileCache {
+  public:
+
+    typedef boost::shared_ptr<vw::Transform>                TransPtr;
+    typedef boost::function<TransPtr(TransPtr const&)>      CopyFunc;
+    typedef boost::shared_ptr<vw::ImageView<vw::Vector2> >  TilePtr;
+
+    TransformTileCache(size_t max_bytes, int tile_size = 256);
+
+    /// Add a transform to the cache and return its id. Since transforms
+    /// may keep internal state, the copy function must return a private
+    /// copy of the transform, used when computing a tile.
+    int add_transform(TransPtr const& trans, CopyFunc const& copy_func);
+
+    /// The tile of reverse() values containing the given pixel.
+    /// Locations where the transform fails are set to NaN.
+    TilePtr tile(int trans_id, vw::Vector2i const& tile_index, vw::BBox2i & tile_box);
+
+    /// Interpolated reverse() value. Returns NaN if any of the
+    /// nearby samples is invalid. Each thread remembers the last tile
+    /// it used, so most calls do not take the lock.
+    vw::Vector2 reverse(int trans_id, vw::Vector2 const& pix);
+
+    int tile_size() const { return m_tile_size; }
+
+  private:
+
+    typedef std::pair<int, std::pair<int, int> > KeyType;
+    typedef std::list<KeyType>                   LruList;
+    struct Entry {
+      TilePtr tile;
+      LruList::iterator lru_pos;
+    };
+
+    TilePtr compute_tile(int trans_id, vw::BBox2i const& tile_box) const;
+
+    size_t m_max_bytes, m_tile_bytes;
+    int    m_tile_size;
+    long   m_cache_id; ///< Unique among all caches, identifies the last tile of a thread
+    std::vector<TransPtr> m_transforms;
+    std::vector<CopyFunc> m_copy_funcs;
+    std::map<KeyType, Entry> m_tiles;
+    LruList   m_lru; // most recently used first
+    vw::Mutex m_mutex;
+  };
+
+  /// A transform whose reverse() goes through the shared TransformTileCache,
+  /// hence it is thread-safe, and there is no need to copy it per tile.
+  /// The bbox functions use the base class sampling of reverse() and forward().
+  /// The forward() function is passed to the original transform.
+  class CachedReverseTransform: public vw::Transform {
+  public:
+    CachedReverseTransform(boost::shared_ptr<TransformTileCache> cache, int trans_id,
+                           TransformTileCache::TransPtr const& trans):
+      m_cache(cache), m_trans_id(trans_id), m_trans(trans) {}
+
+    virtual vw::Vector2 reverse(vw::Vector2 const& p) const {
+      return m_cache->reverse(m_trans_id, p);
+    }
+    virtual vw::Vector2 forward(vw::Vector2 const& p) const {
+      return m_trans->forward(p);
+    }
+
+  private:
+    boost::shared_ptr<TransformTileCache> m_cache;
+    int m_trans_id;
+    TransformTileCache::TransPtr m_trans;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_TRANSFORM_CACHE_H__
@@ -0,0 +1,62 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Matching of interest point descriptors, as done before the
+// geometric filtering in stereo_pprc and bundle_adjust.
+
+#include <test/Benchmark.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/InterestPoint/InterestData.h>
+#include <vw/InterestPoint/Matcher.h>
+
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  // Random descriptors, and the same with a little noise, in another order
+  void random_ip(int num, int len,
+                 std::vector<ip::InterestPoint> & ip1,
+                 std::vector<ip::InterestPoint> & ip2) {
+    ip1.resize(num);
+    for (int it = 0; it < num; it++) {
+      ip1[it].x = 1000.0*std::rand()/RAND_MAX;
+      ip1[it].y = 1000.0*std::rand()/RAND_MAX;
+      ip1[it].descriptor.set_size(len);
+      for (int k = 0; k < len; k++)
+        ip1[it].descriptor[k] = float(std::rand())/RAND_MAX;
+    }
+    ip2.clear();
+    for (int it = num - 1; it >= 0; it--) {
+      ip2.push_back(ip1[it]);
+      for (int k = 0; k < len; k++)
+        ip2.back().descriptor[k] += 0.01*(float(std::rand())/RAND_MAX - 0.5);
+    }
+  }
+}
+
+BENCHMARK(InterestPointMatcher, L2Norm_2000) {
+  std::vector<ip::InterestPoint> ip1, ip2, matched_ip1, matched_ip2;
+  random_ip(2000, 64, ip1, ip2);
+  ip::InterestPointMatcher<ip::L2NormMetric, ip::NullConstraint> matcher(0.8);
+  while (state.keep_running()) {
+    matcher(ip1, ip2, matched_ip1, matched_ip2, ProgressCallback::dummy_instance());
+    bench::do_not_optimize(matched_ip1.size());
+  }
+}
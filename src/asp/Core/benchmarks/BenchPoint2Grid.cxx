@@ -0,0 +1,118 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Gridding of points, one run per point, and rasterization of a DEM
+// tile from a synthetic point cloud.
+
+#include <test/Benchmark.h>
+#include <asp/Core/Point2Grid.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMath.h>
+#include <vw/Image/UtilityViews.h>
+
+#include <cmath>
+#include <vector>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  const int GRID_SIZE = 256;
+
+  // A rough surface over the grid, a little beyond it on each side
+  std::vector<Vector3> random_points(int num) {
+    std::vector<Vector3> points;
+    for (int it = 0; it < num; it++) {
+      double x = (GRID_SIZE + 4.0)*std::rand()/RAND_MAX - 2.0;
+      double y = (GRID_SIZE + 4.0)*std::rand()/RAND_MAX - 2.0;
+      points.push_back(Vector3(x, y, 100.0*sin(0.05*x)*cos(0.03*y) +
+                               double(std::rand())/RAND_MAX));
+    }
+    return points;
+  }
+
+  void bench_add_point(bench::State & state, FilterType filter) {
+    std::vector<Vector3> points = random_points(100000);
+    ImageView<double> buffer, weights;
+    Point2Grid grid(GRID_SIZE, GRID_SIZE, buffer, weights, 0.0, 0.0, 1.0, 1.0,
+                    1.5, 0.0, filter, 0.0);
+    size_t it = 0;
+    while (state.keep_running()) {
+      if (it == 0)
+        grid.Clear(-1.0); // so the median filter does not keep growing its samples
+      Vector3 const& P = points[it];
+      grid.AddPoint(P[0], P[1], P[2]);
+      it = (it + 1) % points.size();
+    }
+    bench::do_not_optimize(buffer(0, 0));
+  }
+
+  // A point cloud in projected coordinates, with some noise
+  struct SurfaceFunc: public ReturnFixedType<Vector3> {
+    Vector3 operator()(int col, int row) const {
+      double x = col + 0.3*sin(0.7*row), y = row + 0.3*cos(0.9*col);
+      return Vector3(x, y, 100.0*sin(0.05*x)*cos(0.03*y));
+    }
+  };
+}
+
+BENCHMARK(Point2Grid, AddPoint_weighted_average) {
+  bench_add_point(state, f_weighted_average);
+}
+
+BENCHMARK(Point2Grid, AddPoint_median) {
+  bench_add_point(state, f_median);
+}
+
+// Rasterize one tile of the DEM of a 1024 x 1024 cloud, of the size used
+// by point2dem
+BENCHMARK(OrthoRasterizerView, tile) {
+
+  int size = 1024;
+  ImageView<Vector3> points(size, size);
+  SurfaceFunc func;
+  for (int col = 0; col < size; col++)
+    for (int row = 0; row < size; row++)
+      points(col, row) = func(col, row);
+
+  ImageViewRef<double> error_image = constant_view(0.0, size, size);
+  size_t num_invalid_pixels = 0;
+  Mutex count_mutex;
+  OrthoRasterizerView rasterizer(points, select_channel(points, 2),
+                                 0.0, 0.0, false, 256, BBox2(),
+                                 false, Vector2(75.0, 3.0), error_image, 0.0, BBox3(), 0.0,
+                                 Vector2(), 0, false, "weighted_average", 1.0,
+                                 &num_invalid_pixels, &count_mutex,
+                                 ProgressCallback::dummy_instance());
+  rasterizer.set_use_minz_as_default(false);
+  rasterizer.set_default_value(-1.0);
+  rasterizer.set_texture_to_height();
+  rasterizer.initialize_spacing(1.0);
+
+  int ts = OrthoRasterizerView::max_subblock_size();
+  BBox2i tile(size/2, size/2, ts, ts);
+  while (state.keep_running()) {
+    ImageView<OrthoRasterizerView::pixel_type> dem = rasterizer.prerasterize(tile);
+    bench::do_not_optimize(dem(0, 0));
+  }
+}
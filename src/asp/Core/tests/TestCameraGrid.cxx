@@ -0,0 +1,77 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/CameraGrid.h>
+
+#include <cstdio>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A smooth distortion with a narrow bump, standing for a rough
+  // part of the DEM
+  struct BumpTransform: public vw::Transform {
+    virtual Vector2 reverse(Vector2 const& p) const {
+      double r2 = (p[0]-300)*(p[0]-300) + (p[1]-100)*(p[1]-100);
+      return Vector2(1.5*p[0] + 0.0001*p[0]*p[1] + 20*exp(-r2/50.0),
+                     0.8*p[1] - 0.0002*p[0]*p[0] + 10);
+    }
+  };
+}
+
+TEST(CameraGrid, interpolate) {
+
+  BumpTransform exact;
+  CameraGrid grid;
+  make_camera_grid(exact, Vector2i(0, 0), Vector2i(500, 400), 16, Vector2i(1000, 1000), grid);
+  EXPECT_EQ(33, grid.nodes.cols());
+  EXPECT_EQ(26, grid.nodes.rows());
+
+  // The grid is read back as written
+  std::string file = "test_grid.camgrid";
+  write_camera_grid(file, grid);
+  boost::shared_ptr<CameraGrid> in_grid(new CameraGrid);
+  ASSERT_TRUE(read_camera_grid(file, *in_grid));
+  EXPECT_EQ(grid.spacing, in_grid->spacing);
+  EXPECT_VECTOR_EQ(grid.image_size, in_grid->image_size);
+  EXPECT_VECTOR_NEAR(grid.nodes(7, 5), in_grid->nodes(7, 5), 1e-12);
+  EXPECT_EQ(grid.cell_error(7, 5), in_grid->cell_error(7, 5));
+  std::remove(file.c_str());
+  EXPECT_FALSE(read_camera_grid(file, *in_grid));
+
+  // Away from the bump the grid is interpolated, and at the bump
+  // the exact transform is used.
+  double max_error = 0.05;
+  boost::shared_ptr<vw::Transform> exact_ptr(new BumpTransform);
+  CameraGridReverseTransform trans(in_grid, max_error, exact_ptr);
+  for (int it = 0; it < 20; it++) {
+    Vector2 p(3.7 + 23.3*it, 390.2 - 13.9*it);
+    EXPECT_VECTOR_NEAR(exact.reverse(p), trans.reverse(p), 2*max_error);
+  }
+  for (int it = 0; it < 10; it++) {
+    Vector2 p(295.3 + it, 95.7 + 0.5*it);
+    EXPECT_VECTOR_NEAR(exact.reverse(p), trans.reverse(p), 1e-12);
+  }
+
+  // Outside the grid the exact transform is used
+  Vector2 p(600.5, 100.5);
+  EXPECT_VECTOR_NEAR(exact.reverse(p), trans.reverse(p), 1e-12);
+}
@@ -0,0 +1,59 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/CameraGridTransform.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A smooth distortion with a narrow bump, standing for a rough
+  // part of the DEM
+  struct BumpTransform: public TransformBase<BumpTransform> {
+    Vector2 reverse(Vector2 const& p) const {
+      double r2 = (p[0]-300)*(p[0]-300) + (p[1]-100)*(p[1]-100);
+      return Vector2(1.5*p[0] + 0.0001*p[0]*p[1] + 20*exp(-r2/50.0),
+                     0.8*p[1] - 0.0002*p[0]*p[0] + 10);
+    }
+  };
+}
+
+TEST(CameraGridTransform, interpolate) {
+
+  BumpTransform exact;
+  double max_error = 0.01;
+  CameraGridTransform<BumpTransform> grid(exact, Vector2i(1000, 1000), max_error);
+
+  // Away from the bump, where the grid is coarse, and at the bump,
+  // where it is refined or exact.
+  for (int it = 0; it < 20; it++) {
+    Vector2 p(3.7 + 31.3*it, 500.2 - 23.9*it);
+    EXPECT_VECTOR_NEAR(exact.reverse(p), grid.reverse(p), 5*max_error);
+  }
+  for (int it = 0; it < 20; it++) {
+    Vector2 p(290.3 + it, 95.7 + 0.5*it);
+    EXPECT_VECTOR_NEAR(exact.reverse(p), grid.reverse(p), 5*max_error);
+  }
+
+  // Copies give the same results
+  CameraGridTransform<BumpTransform> copy = grid;
+  Vector2 p(123.4, 56.7);
+  EXPECT_VECTOR_NEAR(grid.reverse(p), copy.reverse(p), 1e-12);
+}
@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/ColumnStats.h>
+#include <vw/Image/ImageView.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST(ColumnStats, robust_pair_mean) {
+
+  // One outlier in y only. The whole pair must be thrown out.
+  std::vector<Vector2f> vals;
+  double sx = 0, sy = 0;
+  for (int it = 0; it < 100; it++) {
+    Vector2f val(2.0 + 0.001*it, -1.0 + 0.002*it);
+    vals.push_back(val);
+    sx += val[0]; sy += val[1];
+  }
+  vals.push_back(Vector2f(2.05, 1e+6));
+
+  Vector2 mean;
+  ASSERT_TRUE(robust_pair_mean(vals, Vector2(95.0, 3.0), mean));
+  EXPECT_NEAR(sx/100.0, mean[0], 1e-6);
+  EXPECT_NEAR(sy/100.0, mean[1], 1e-6);
+
+  EXPECT_FALSE(robust_pair_mean(std::vector<Vector2f>(), Vector2(95.0, 3.0), mean));
+}
+
+TEST(ColumnStats, column_robust_means) {
+
+  // More columns than one strip, and more rows than one band, with
+  // some invalid pixels, and one column with none valid.
+  int cols = COLUMN_STATS_STRIP_COLS + 7, rows = COLUMN_STATS_BAND_ROWS + 50;
+  ImageView< PixelMask<Vector2f> > disp(cols, rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      disp(col, row) = PixelMask<Vector2f>(Vector2f(col, 0.5*col + (row % 2) - 0.5));
+      if (row % 3 == 0 || col == 5)
+        disp(col, row).invalidate();
+    }
+  }
+
+  // The rows are restricted so that the y average is not exactly 0.5*col
+  int beg_row = 1, end_row = rows;
+  std::vector<Vector2> means1 = column_robust_means(disp, beg_row, end_row,
+                                                    Vector2(95.0, 3.0), 1);
+  std::vector<Vector2> means4 = column_robust_means(disp, beg_row, end_row,
+                                                    Vector2(95.0, 3.0), 4);
+  ASSERT_EQ(size_t(cols), means1.size());
+  for (int col = 0; col < cols; col++) {
+    EXPECT_VECTOR_EQ(means1[col], means4[col]);
+    if (col == 5) {
+      EXPECT_VECTOR_EQ(Vector2(), means1[col]);
+      continue;
+    }
+
+    double sum = 0, count = 0;
+    for (int row = beg_row; row < end_row; row++) {
+      if (!is_valid(disp(col, row)))
+        continue;
+      sum += disp(col, row).child()[1];
+      count++;
+    }
+    EXPECT_NEAR(col,       means1[col][0], 1e-5);
+    EXPECT_NEAR(sum/count, means1[col][1], 1e-5);
+  }
+}
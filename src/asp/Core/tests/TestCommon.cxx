@@ -18,6 +18,8 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/FileUtils.h>
+#include <fstream>
 
 using namespace vw;
 using namespace asp;
@@ -143,3 +145,24 @@ TEST( Common, StereoMultiCmdCheck ) {
   EXPECT_EQ("dem.tif" , dem_path);
 
 } // End test StereoMultiCmdCheck
+
+TEST( Common, content_hash ) {
+
+  std::string file = "content_hash_test.txt";
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "some content\n";
+  }
+  std::vector<std::string> files(1, file);
+  std::string hash1 = content_hash(files, "settings");
+  EXPECT_EQ(16u, hash1.size());
+  EXPECT_EQ(hash1, content_hash(files, "settings"));
+  EXPECT_NE(hash1, content_hash(files, "other settings"));
+
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "other content\n";
+  }
+  EXPECT_NE(hash1, content_hash(files, "settings"));
+  remove(file.c_str());
+}
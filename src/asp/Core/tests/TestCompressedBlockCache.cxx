@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/CompressedBlockCache.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST(CompressedBlockCache, shuffle_and_deflate) {
+
+  std::vector<float> vals(1000);
+  for (size_t it = 0; it < vals.size(); it++)
+    vals[it] = 100.0f + 0.01f * it;
+  size_t size = vals.size() * sizeof(float);
+
+  std::vector<char> compressed, out;
+  shuffle_and_deflate(reinterpret_cast<char const*>(&vals[0]), size, sizeof(float),
+                      compressed);
+  EXPECT_LT(compressed.size(), size);
+  ASSERT_TRUE(inflate_and_unshuffle(compressed, size, sizeof(float), out));
+  ASSERT_EQ(size, out.size());
+  EXPECT_EQ(0, memcmp(&vals[0], &out[0], size));
+
+  // Corrupt data is not accepted
+  compressed[compressed.size() / 2] ^= 0x5a;
+  compressed.resize(compressed.size() / 2);
+  EXPECT_FALSE(inflate_and_unshuffle(compressed, size, sizeof(float), out));
+}
+
+TEST(CompressedBlockCache, tiers) {
+
+  // Room for one decoded block of 64 x 64 floats, and many compressed
+  CompressedBlockCache cache;
+  cache.set_size_mb(16384.0 / (1024.0 * 1024.0), 1.0);
+  int id = cache.source_id("image");
+  EXPECT_EQ(id, cache.source_id("image"));
+  EXPECT_NE(id, cache.source_id("other"));
+
+  std::vector<CompressedBlockCache::BlockPtr> blocks;
+  for (int it = 0; it < 3; it++) {
+    CompressedBlockCache::BlockPtr block(new std::vector<char>(16384));
+    for (size_t k = 0; k < block->size(); k++)
+      (*block)[k] = char((k / 64) + it);
+    blocks.push_back(block);
+    EXPECT_TRUE(!cache.get(id, BBox2i(64 * it, 0, 64, 64)));
+    cache.put(id, BBox2i(64 * it, 0, 64, 64), block, sizeof(float));
+  }
+
+  // The last block is decoded, the others were compressed
+  EXPECT_EQ(blocks[2], cache.get(id, BBox2i(128, 0, 64, 64)));
+  for (int it = 0; it < 3; it++) {
+    CompressedBlockCache::BlockPtr block = cache.get(id, BBox2i(64 * it, 0, 64, 64));
+    ASSERT_TRUE(block.get() != NULL);
+    EXPECT_TRUE(*block == *blocks[it]);
+  }
+  CompressedBlockCache::Stats stats = cache.stats();
+  EXPECT_EQ(3, stats.misses);
+  EXPECT_EQ(1, stats.decoded_hits);
+  EXPECT_EQ(3, stats.compressed_hits);
+  EXPECT_LT(stats.compressed_mb, stats.compressed_raw_mb);
+}
+
+TEST(CompressedBlockCache, view) {
+
+  ImageView<float> image(100, 70);
+  for (int col = 0; col < image.cols(); col++)
+    for (int row = 0; row < image.rows(); row++)
+      image(col, row) = col + 1000.0f * row;
+
+  compressed_block_cache().set_size_mb(0.01, 1.0);
+  ImageViewRef<float> cached = compressed_cache(image, "test-view", 32);
+
+  // Read the same overlapping boxes twice, from the source and the cache
+  for (int pass = 0; pass < 2; pass++) {
+    BBox2i boxes[] = {BBox2i(5, 7, 50, 40), BBox2i(30, 20, 70, 50), BBox2i(99, 69, 1, 1)};
+    for (int it = 0; it < 3; it++) {
+      ImageView<float> crop_img = crop(cached, boxes[it]);
+      for (int col = 0; col < crop_img.cols(); col++)
+        for (int row = 0; row < crop_img.rows(); row++)
+          EXPECT_EQ(image(col + boxes[it].min().x(), row + boxes[it].min().y()),
+                    crop_img(col, row));
+    }
+  }
+  EXPECT_EQ(image(42, 17), cached(42, 17));
+  CompressedBlockCache::Stats stats = compressed_block_cache().stats();
+  EXPECT_GT(stats.decoded_hits + stats.compressed_hits, 0);
+  compressed_block_cache().set_size_mb(0, 0);
+}
@@ -0,0 +1,118 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/GeodeticBatch.h>
+
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Points around the globe, at various heights, and an invalid one
+  void make_points(cartography::Datum const& datum, std::vector<Vector3> & xyz) {
+    xyz.clear();
+    for (int it = 0; it < 50; it++) {
+      Vector3 llh(-179.5 + 7.3*it, -89.7 + 3.6*it, -500.0 + 1234.5*it);
+      xyz.push_back(datum.geodetic_to_cartesian(llh));
+    }
+    xyz.push_back(Vector3());
+  }
+
+  void to_block(std::vector<Vector3> const& xyz, PointBlock & points) {
+    points.resize(xyz.size());
+    for (size_t it = 0; it < xyz.size(); it++) {
+      points.x[it] = xyz[it][0]; points.y[it] = xyz[it][1]; points.z[it] = xyz[it][2];
+    }
+  }
+}
+
+TEST(GeodeticBatch, cartesian_to_geodetic) {
+
+  // An ellipsoid and a sphere
+  const char * datums[] = {"WGS84", "D_MOON"};
+  for (int d = 0; d < 2; d++) {
+    cartography::GeoReference geo;
+    geo.set_well_known_geogcs(datums[d]);
+    cartography::Datum const& datum = geo.datum();
+
+    std::vector<Vector3> xyz;
+    make_points(datum, xyz);
+    PointBlock points;
+    to_block(xyz, points);
+    batch_cartesian_to_geodetic(datum, points);
+
+    for (size_t it = 0; it + 1 < xyz.size(); it++) {
+      Vector3 llh = datum.cartesian_to_geodetic(xyz[it]);
+      llh[0] += 360.0*round((points.x[it] - llh[0])/360.0);
+      EXPECT_NEAR(llh[0], points.x[it], 1e-9);
+      EXPECT_NEAR(llh[1], points.y[it], 1e-9);
+      EXPECT_NEAR(llh[2], points.z[it], 1e-5);
+    }
+    EXPECT_TRUE(std::isnan(points.z.back()));
+  }
+}
+
+TEST(GeodeticBatch, geodetic_to_point) {
+
+  cartography::GeoReference geo;
+  geo.set_well_known_geogcs("WGS84");
+  geo.set_UTM(11, true);
+
+  // Points near the UTM zone, and an invalid one
+  PointBlock points;
+  std::vector<Vector3> llh;
+  for (int it = 0; it < 30; it++)
+    llh.push_back(Vector3(-119.5 + 0.1*it, 30.0 + 0.7*it, 10.0*it));
+  to_block(llh, points);
+  points.x.push_back(std::numeric_limits<double>::quiet_NaN());
+  points.y.push_back(0); points.z.push_back(0);
+
+  batch_geodetic_to_point(geo, points);
+  for (size_t it = 0; it < llh.size(); it++) {
+    Vector3 P = geo.geodetic_to_point(llh[it]);
+    EXPECT_NEAR(P[0], points.x[it], 1e-6);
+    EXPECT_NEAR(P[1], points.y[it], 1e-6);
+    EXPECT_NEAR(P[2], points.z[it], 1e-12);
+  }
+  EXPECT_TRUE(std::isnan(points.x.back()));
+
+  // The view converts blocks the same way as single pixels
+  ImageView<Vector3> image(7, 5);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = geo.datum().geodetic_to_cartesian
+        (Vector3(-118.0 + 0.3*col, 35.0 + 0.2*row, 100.0*row));
+  image(3, 2) = Vector3();
+
+  Vector3 offset(0.01, 0.02, 5.0);
+  ImageView<Vector3> block = geodetic_projection(image, geo, -117.0, offset);
+  for (int row = 0; row < image.rows(); row++) {
+    for (int col = 0; col < image.cols(); col++) {
+      if (col == 3 && row == 2) {
+        EXPECT_TRUE(std::isnan(block(col, row)[2]));
+        continue;
+      }
+      EXPECT_VECTOR_NEAR(geodetic_projection(image, geo, -117.0, offset)(col, row),
+                         block(col, row), 1e-5);
+    }
+  }
+}
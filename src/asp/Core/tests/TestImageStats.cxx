@@ -0,0 +1,111 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/ImageStats.h>
+#include <vw/Image/ImageView.h>
+
+#include <algorithm>
+
+using namespace vw;
+using namespace asp;
+
+TEST(ImageStats, streaming) {
+
+  // Values which grow the histogram range in both directions
+  std::vector<double> vals;
+  for (int it = 0; it < 10000; it++)
+    vals.push_back(100.0*sin(0.37*it) + 0.01*it*it/100.0);
+
+  StreamingStats stats;
+  double sum = 0;
+  for (size_t it = 0; it < vals.size(); it++) {
+    stats.add(vals[it]);
+    sum += vals[it];
+  }
+  double mean = sum/vals.size(), var = 0;
+  for (size_t it = 0; it < vals.size(); it++)
+    var += (vals[it] - mean)*(vals[it] - mean);
+  var /= vals.size();
+
+  std::vector<double> sorted = vals;
+  std::sort(sorted.begin(), sorted.end());
+  double range = sorted.back() - sorted.front();
+
+  EXPECT_EQ(double(vals.size()), stats.count());
+  EXPECT_EQ(sorted.front(), stats.min());
+  EXPECT_EQ(sorted.back(),  stats.max());
+  EXPECT_NEAR(mean,      stats.mean(),   1e-8);
+  EXPECT_NEAR(sqrt(var), stats.stddev(), 1e-8);
+
+  // Quantiles are within a couple of bins
+  double tol = 4*range/StreamingStats::NUM_BINS;
+  EXPECT_NEAR(sorted[int(0.02*sorted.size())], stats.quantile(0.02), tol);
+  EXPECT_NEAR(sorted[int(0.50*sorted.size())], stats.quantile(0.50), tol);
+  EXPECT_NEAR(sorted[int(0.98*sorted.size())], stats.quantile(0.98), tol);
+
+  // Merging parts gives nearly the same as adding all values
+  StreamingStats a, b;
+  for (size_t it = 0; it < vals.size(); it++)
+    (it < 3000 ? a : b).add(vals[it]);
+  a.merge(b);
+  EXPECT_EQ(stats.count(), a.count());
+  EXPECT_EQ(stats.min(), a.min());
+  EXPECT_EQ(stats.max(), a.max());
+  EXPECT_NEAR(stats.mean(),   a.mean(),   1e-8);
+  EXPECT_NEAR(stats.stddev(), a.stddev(), 1e-8);
+  EXPECT_NEAR(stats.quantile(0.02), a.quantile(0.02), tol);
+  EXPECT_NEAR(stats.quantile(0.98), a.quantile(0.98), tol);
+}
+
+TEST(ImageStats, constant) {
+  StreamingStats stats;
+  for (int it = 0; it < 100; it++)
+    stats.add(5.0);
+  EXPECT_EQ(5.0, stats.min());
+  EXPECT_EQ(5.0, stats.max());
+  EXPECT_EQ(5.0, stats.quantile(0.02));
+  EXPECT_EQ(5.0, stats.quantile(0.98));
+  EXPECT_NEAR(0.0, stats.stddev(), 1e-12);
+
+  // Then a different value
+  stats.add(7.0);
+  EXPECT_EQ(7.0, stats.max());
+  EXPECT_NEAR(5.0, stats.quantile(0.5), 4.0/StreamingStats::NUM_BINS);
+}
+
+TEST(ImageStats, image) {
+  ImageView< PixelMask<float> > image(300, 200);
+  for (int row = 0; row < image.rows(); row++) {
+    for (int col = 0; col < image.cols(); col++) {
+      image(col, row) = PixelMask<float>(col + 0.5*row);
+      if (col < 10)
+        image(col, row).invalidate();
+    }
+  }
+
+  // The same with any number of threads
+  StreamingStats one  = image_stats(image, 1);
+  StreamingStats many = image_stats(image, 4);
+  EXPECT_EQ(290.0*200, one.count());
+  EXPECT_EQ(10.0, one.min());
+  EXPECT_EQ(299 + 0.5*199, one.max());
+  EXPECT_EQ(one.mean(),   many.mean());
+  EXPECT_EQ(one.stddev(), many.stddev());
+  EXPECT_EQ(one.quantile(0.98), many.quantile(0.98));
+}
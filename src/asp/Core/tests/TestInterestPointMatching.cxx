@@ -68,3 +68,31 @@ TEST( InterestPointMatching, DatumIntersection ) {
   }
 
 }
+
+TEST( InterestPointMatching, DetectInTiles ) {
+
+  // A textured image spanning several tiles
+  ImageView<float> image(2300, 1500);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = 0.5 + 0.25*sin(0.11*col + 0.03*row) + 0.25*cos(0.07*row*(1 + col/900.0));
+
+  // The points do not depend on the number of threads
+  int orig_threads = vw_settings().default_num_threads();
+  std::vector<ip::InterestPointList> ips(2);
+  int threads[] = {1, 4};
+  for (int k = 0; k < 2; k++) {
+    vw_settings().set_default_num_threads(threads[k]);
+    detect_ip(ips[k], image, 100);
+  }
+  vw_settings().set_default_num_threads(orig_threads);
+
+  ASSERT_GT(ips[0].size(), 0u);
+  ASSERT_EQ(ips[0].size(), ips[1].size());
+  ip::InterestPointList::const_iterator it0 = ips[0].begin(), it1 = ips[1].begin();
+  for (; it0 != ips[0].end(); it0++, it1++) {
+    EXPECT_EQ(it0->x, it1->x);
+    EXPECT_EQ(it0->y, it1->y);
+    EXPECT_TRUE(bounding_box(image).contains(Vector2i(it0->ix, it0->iy)));
+  }
+}
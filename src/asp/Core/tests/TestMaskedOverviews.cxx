@@ -0,0 +1,61 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MaskedOverviews.h>
+
+using namespace asp;
+
+TEST(MaskedOverviews, disparity) {
+
+  // A 3 x 2 disparity, with bands dx, dy, and valid. The invalid
+  // pixels do not count in the average.
+  double pixels[] = {1, 2, 1,   3, 4, 1,   9, 9, 0,
+                     5, 6, 0,   5, 8, 1,   7, 7, 1};
+  std::vector<double> in(pixels, pixels + 18), out;
+  masked_downsample(in, 3, 2, 3, DISPARITY_OVERVIEWS, out);
+  ASSERT_EQ(6u, out.size());
+  EXPECT_NEAR(3.0, out[0], 1e-12);
+  EXPECT_NEAR(14.0/3.0, out[1], 1e-12);
+  EXPECT_EQ(1.0, out[2]);
+  EXPECT_NEAR(7.0, out[3], 1e-12);
+  EXPECT_NEAR(7.0, out[4], 1e-12);
+  EXPECT_EQ(1.0, out[5]);
+
+  // No valid pixels
+  std::vector<double> invalid(12, 0.0);
+  invalid[0] = 4;
+  masked_downsample(invalid, 2, 2, 3, DISPARITY_OVERVIEWS, out);
+  ASSERT_EQ(3u, out.size());
+  EXPECT_EQ(0.0, out[0]);
+  EXPECT_EQ(0.0, out[2]);
+}
+
+TEST(MaskedOverviews, point_cloud) {
+
+  // A 2 x 2 cloud with x, y, z, and error. The zero point is invalid.
+  double pixels[] = {2, 4, 6, 0.5,   0, 0, 0, 0,
+                     4, 8, 0, 1.5,   6, 0, 3, 0.25};
+  std::vector<double> in(pixels, pixels + 16), out;
+  masked_downsample(in, 2, 2, 4, POINT_CLOUD_OVERVIEWS, out);
+  ASSERT_EQ(4u, out.size());
+  EXPECT_NEAR(4.0, out[0], 1e-12);
+  EXPECT_NEAR(4.0, out[1], 1e-12);
+  EXPECT_NEAR(3.0, out[2], 1e-12);
+  EXPECT_EQ(1.5, out[3]);
+}
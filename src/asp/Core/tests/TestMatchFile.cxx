@@ -0,0 +1,108 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MatchFile.h>
+
+#include <cstdio>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  std::vector<ip::InterestPoint> make_points(int num, float offset) {
+    std::vector<ip::InterestPoint> points(num);
+    for (int it = 0; it < num; it++) {
+      ip::InterestPoint & p = points[it];
+      p.x = offset + 1.5f*it; p.y = offset - 2.25f*it;
+      p.ix = int(p.x); p.iy = int(p.y);
+      p.orientation = 0.1f*it; p.scale = 2.0f + it; p.interest = 0.5f*it;
+      p.octave = it % 3; p.scale_lvl = it % 5; p.polarity = (it % 2 == 0);
+      p.descriptor.set_size(4);
+      for (int k = 0; k < 4; k++)
+        p.descriptor[k] = offset + it + 0.25f*k;
+    }
+    return points;
+  }
+
+  void expect_same(ip::InterestPoint const& a, ip::InterestPoint const& b) {
+    EXPECT_EQ(a.x, b.x);                     EXPECT_EQ(a.y, b.y);
+    EXPECT_EQ(a.ix, b.ix);                   EXPECT_EQ(a.iy, b.iy);
+    EXPECT_EQ(a.orientation, b.orientation); EXPECT_EQ(a.scale, b.scale);
+    EXPECT_EQ(a.interest, b.interest);       EXPECT_EQ(a.polarity, b.polarity);
+    EXPECT_EQ(a.octave, b.octave);           EXPECT_EQ(a.scale_lvl, b.scale_lvl);
+  }
+}
+
+TEST(MatchFile, compact) {
+
+  std::string file = "test_compact.match";
+  std::vector<ip::InterestPoint> ip1 = make_points(7, 10.0f), ip2 = make_points(7, 500.0f);
+  std::vector<ip::InterestPoint> out1, out2;
+
+  // Without descriptors
+  write_compact_match_file(file, ip1, ip2);
+  EXPECT_TRUE(is_compact_match_file(file));
+  read_match_file(file, out1, out2);
+  ASSERT_EQ(ip1.size(), out1.size());
+  ASSERT_EQ(ip2.size(), out2.size());
+  for (size_t it = 0; it < ip1.size(); it++) {
+    expect_same(ip1[it], out1[it]);
+    expect_same(ip2[it], out2[it]);
+    EXPECT_EQ(0u, out1[it].descriptor.size());
+  }
+
+  // With descriptors
+  write_compact_match_file(file, ip1, ip2, true);
+  read_match_file(file, out1, out2);
+  ASSERT_EQ(ip2.size(), out2.size());
+  for (size_t it = 0; it < ip2.size(); it++) {
+    ASSERT_EQ(4u, out2[it].descriptor.size());
+    for (int k = 0; k < 4; k++)
+      EXPECT_EQ(ip2[it].descriptor[k], out2[it].descriptor[k]);
+  }
+
+  // No matches
+  write_compact_match_file(file, std::vector<ip::InterestPoint>(),
+                           std::vector<ip::InterestPoint>());
+  read_match_file(file, out1, out2);
+  EXPECT_EQ(0u, out1.size());
+  EXPECT_EQ(0u, out2.size());
+
+  std::remove(file.c_str());
+}
+
+TEST(MatchFile, vw_format) {
+
+  // Files in the Vision Workbench format are read as before
+  std::string file = "test_vw.match";
+  std::vector<ip::InterestPoint> ip1 = make_points(5, 3.0f), ip2 = make_points(5, 8.0f);
+  ip::write_binary_match_file(file, ip1, ip2);
+  EXPECT_FALSE(is_compact_match_file(file));
+
+  std::vector<ip::InterestPoint> out1, out2;
+  read_match_file(file, out1, out2);
+  ASSERT_EQ(ip1.size(), out1.size());
+  for (size_t it = 0; it < ip1.size(); it++) {
+    expect_same(ip1[it], out1[it]);
+    expect_same(ip2[it], out2[it]);
+  }
+
+  std::remove(file.c_str());
+}
@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MedianFilter.h>
+#include <vw/Image/ImageView.h>
+
+#include <algorithm>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // The median of the valid values in the window, found by sorting them
+  bool brute_median(ImageView<double> const& values, ImageView<uint8> const& valid,
+                    int col, int row, int half_width, int half_height, double & median) {
+    std::vector<double> vals;
+    for (int r = std::max(row - half_height, 0);
+         r <= std::min(row + half_height, values.rows() - 1); r++) {
+      for (int c = std::max(col - half_width, 0);
+           c <= std::min(col + half_width, values.cols() - 1); c++) {
+        if (valid(c, r))
+          vals.push_back(values(c, r));
+      }
+    }
+    if (vals.empty())
+      return false;
+    std::sort(vals.begin(), vals.end());
+    int n = vals.size();
+    median = (n % 2 == 1) ? vals[n/2] : 0.5*(vals[n/2 - 1] + vals[n/2]);
+    return true;
+  }
+}
+
+TEST(MedianFilter, masked) {
+
+  // Repeated values, invalid pixels, and windows wider than the image
+  int nc = 23, nr = 17;
+  ImageView<double> values(nc, nr);
+  ImageView<uint8>  valid(nc, nr);
+  for (int row = 0; row < nr; row++) {
+    for (int col = 0; col < nc; col++) {
+      values(col, row) = ((7*col + 13*row*row) % 11) * 0.25 - 1.0;
+      valid (col, row) = ((col + 3*row) % 4 != 0) && !(col < 5 && row < 5);
+    }
+  }
+
+  int half_sizes[][2] = {{0, 0}, {1, 1}, {2, 3}, {4, 1}, {15, 30}};
+  for (int it = 0; it < 5; it++) {
+    int hw = half_sizes[it][0], hh = half_sizes[it][1];
+    ImageView<double> median;
+    ImageView<uint8>  median_valid;
+    median_filter(values, valid, hw, hh, median, median_valid);
+    ASSERT_EQ(nc, median.cols());
+    ASSERT_EQ(nr, median.rows());
+    for (int row = 0; row < nr; row++) {
+      for (int col = 0; col < nc; col++) {
+        double expected = 0;
+        bool has_median = brute_median(values, valid, col, row, hw, hh, expected);
+        EXPECT_EQ(has_median, bool(median_valid(col, row)));
+        if (has_median)
+          EXPECT_NEAR(expected, median(col, row), 1e-12);
+      }
+    }
+  }
+}
+
+TEST(MedianFilter, pixel_mask) {
+
+  // Each channel is filtered on its own, and invalid pixels stay invalid
+  ImageView< PixelMask<Vector2f> > disp(9, 7);
+  for (int row = 0; row < disp.rows(); row++) {
+    for (int col = 0; col < disp.cols(); col++) {
+      disp(col, row) = PixelMask<Vector2f>(Vector2f(col, -row));
+      if (col == 0)
+        disp(col, row).invalidate();
+    }
+  }
+  disp(4, 3) = PixelMask<Vector2f>(Vector2f(1000, 1000)); // An outlier
+
+  ImageView< PixelMask<Vector2f> > filtered = median_filter(disp, 1, 1);
+  EXPECT_FALSE(is_valid(filtered(0, 0)));
+  EXPECT_TRUE(is_valid(filtered(4, 3)));
+  EXPECT_NEAR(4.0,  filtered(4, 3).child()[0], 1e-6);
+  EXPECT_NEAR(-3.0, filtered(4, 3).child()[1], 1e-6);
+}
@@ -0,0 +1,75 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MemoryBudget.h>
+#include <vw/Core/Exception.h>
+
+using namespace asp;
+
+TEST(MemoryBudget, no_budget) {
+  MemoryBudget budget;
+  EXPECT_FALSE(budget.has_budget());
+  EXPECT_EQ(1000.0, budget.cap_mb(1000.0, 0.25));
+  EXPECT_EQ(2048,   budget.tile_size(2048, 8, 16, 0.75));
+  EXPECT_EQ(16,     budget.num_threads(16, 1000.0, 0.75));
+}
+
+TEST(MemoryBudget, sizes) {
+  MemoryBudget budget;
+  budget.set_budget_mb(1024);
+  EXPECT_EQ(256.0,  budget.cap_mb(1000.0, 0.25));
+  EXPECT_EQ(100.0,  budget.cap_mb(100.0,  0.25));
+
+  // Four tiles of 4 bytes per pixel in 1 GB: 8192 pixels on the side
+  EXPECT_EQ(8192, budget.tile_size(100000, 4, 4, 1.0));
+  EXPECT_EQ(2048, budget.tile_size(2048,   4, 4, 1.0));
+  // Rounded down to the granularity, and no less than it
+  EXPECT_EQ(5632, budget.tile_size(100000, 4, 8, 1.0));
+  EXPECT_EQ(256,  budget.tile_size(100000, 4, 1000000, 1.0));
+
+  EXPECT_EQ(4,  budget.num_threads(16, 192.0, 0.75));
+  EXPECT_EQ(2,  budget.num_threads(2,  192.0, 0.75));
+  EXPECT_EQ(1,  budget.num_threads(16, 5000.0, 0.75));
+
+  EXPECT_THROW(budget.set_budget_mb(-1), vw::ArgumentErr);
+}
+
+TEST(MemoryBudget, reservations) {
+  MemoryBudget budget;
+  budget.set_budget_mb(100);
+  budget.reserve(60, "first");
+  budget.reserve(30, "second");
+  EXPECT_NEAR(90.0, budget.used_mb(), 1e-6);
+  budget.release(60);
+  budget.reserve(20, "third");
+  EXPECT_NEAR(50.0, budget.used_mb(), 1e-6);
+  EXPECT_NEAR(90.0, budget.peak_mb(), 1e-6);
+  budget.reserve(60, "fourth"); // over budget, warns
+  EXPECT_NEAR(110.0, budget.peak_mb(), 1e-6);
+  budget.release(110);
+  EXPECT_NEAR(0.0, budget.used_mb(), 1e-6);
+
+  // A reservation is against the budget of the process
+  double used = memory_budget().used_mb();
+  {
+    MemoryReservation reservation(10, "a buffer");
+    EXPECT_NEAR(used + 10.0, memory_budget().used_mb(), 1e-6);
+  }
+  EXPECT_NEAR(used, memory_budget().used_mb(), 1e-6);
+}
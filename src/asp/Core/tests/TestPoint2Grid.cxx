@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/Point2Grid.h>
+
+using namespace vw;
+using namespace asp;
+
+// Grid many points onto a single DEM pixel
+double grid_one_pixel(FilterType filter, double percentile, int max_samples,
+                      int num_points) {
+
+  ImageView<double> buffer, weights;
+  double grid_size = 1.0, radius = 0.5;
+  Point2Grid grid(1, 1, buffer, weights, 0.0, 0.0, grid_size, grid_size,
+                  radius, 0.0, filter, percentile, max_samples);
+  grid.Clear(-1.0);
+  for (int i = 0; i < num_points; i++)
+    grid.AddPoint(0.0, 0.0, 1000.0 + (i * 37) % num_points); // a permutation of the values
+  grid.normalize();
+  return buffer(0, 0);
+}
+
+TEST(Point2Grid, ExactFilters) {
+
+  // 101 values, from 1000 to 1100, spanning several arena chunks
+  int num = 101;
+  EXPECT_NEAR(1050.0, grid_one_pixel(f_median,     0.0,  0, num), 1e-6);
+  EXPECT_NEAR(1050.0, grid_one_pixel(f_percentile, 50.0, 0, num), 1.0);
+  EXPECT_NEAR(1050.0, grid_one_pixel(f_median,     0.0,  200, num), 1e-6);
+
+  // No points
+  EXPECT_EQ(-1.0, grid_one_pixel(f_median, 0.0, 0, 0));
+}
+
+TEST(Point2Grid, BoundedSamples) {
+
+  // With a bounded store, the median of a random subset is close
+  // to the true median.
+  int num = 10001;
+  double median = grid_one_pixel(f_median, 0.0, 256, num);
+  EXPECT_NEAR(1000.0 + num/2, median, 0.1*num);
+
+  // The subset does not depend on anything but the inputs
+  EXPECT_EQ(median, grid_one_pixel(f_median, 0.0, 256, num));
+}
+
+TEST(Point2Grid, AddPoints) {
+
+  // Grid a tilted plane with the weighted average. Away from the
+  // boundary, by symmetry, the result is the plane itself.
+  int width = 10, height = 8;
+  std::vector<Vector3> points;
+  for (double x = -2.0; x <= width + 2.0; x += 0.25)
+    for (double y = -2.0; y <= height + 2.0; y += 0.25)
+      points.push_back(Vector3(x, y, 3.0 + 0.5*x - 0.25*y));
+
+  ImageView<double> buffer, weights;
+  Point2Grid grid(width, height, buffer, weights, 0.0, 0.0, 1.0, 1.0,
+                  1.5, 0.0, f_weighted_average, 0.0);
+  grid.Clear(-1.0);
+  grid.AddPoints(points);
+  grid.normalize();
+
+  for (int c = 0; c < width; c++)
+    for (int r = 0; r < height; r++)
+      EXPECT_NEAR(3.0 + 0.5*c - 0.25*r, buffer(c, r), 1e-8);
+}
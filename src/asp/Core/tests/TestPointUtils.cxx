@@ -18,6 +18,10 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 using namespace vw;
 using namespace asp;
@@ -152,3 +156,148 @@ TEST( PointUtils, PcdReader ) {
 }
 
 
+
+TEST( PointUtils, QuantizedPointCloud ) {
+
+  ImageView<Vector4> cloud(2, 1);
+  Vector3 shift(1.0e6, 2.0e6, 3.0e6);
+  cloud(0, 0) = Vector4(1.0e6 + 3.5, 2.0e6 - 1.25, 3.0e6 + 2.0e5, 0.125);
+  cloud(1, 0) = Vector4(); // invalid point
+
+  double scale = 1.0/1024.0;
+  vw::cartography::GeoReference georef;
+  vw::cartography::GdalWriteOptions opt;
+  block_write_quantized_gdal_image("quantized_pc.tif", shift, scale, cloud,
+                                   false, georef, false, 0, opt);
+
+  ImageView<Vector4> read_cloud = read_asp_point_cloud<4>("quantized_pc.tif");
+  EXPECT_VECTOR_NEAR(cloud(0, 0), read_cloud(0, 0), scale);
+  EXPECT_VECTOR_NEAR(Vector4(), read_cloud(1, 0), 1e-16);
+}
+
+TEST( PointUtils, ParseCsvLines ) {
+
+  CsvConv conv;
+  conv.parse_csv_format("1:x 2:y 3:z", "");
+
+  // A header, a comment, and enough lines to be parsed by several threads
+  std::ostringstream os;
+  os << "x,y,z\n" << "# comment\n";
+  int num_points = 5000;
+  for (int i = 0; i < num_points; i++)
+    os << i << ", " << 0.5*i << "\t" << -i << "\n";
+  os << "1, 2"; // not enough values, and no trailing newline
+
+  std::istringstream is(os.str());
+  std::vector<std::string> lines;
+  EXPECT_EQ(size_t(num_points + 3), read_lines(is, 2*num_points, lines));
+  EXPECT_EQ(size_t(0), read_lines(is, 2*num_points, lines));
+
+  is.clear();
+  is.str(os.str());
+  read_lines(is, 2*num_points, lines);
+
+  std::vector<CsvConv::CsvRecord> records;
+  std::vector<char> success;
+  conv.parse_csv_lines(lines, true, records, success);
+  ASSERT_EQ(lines.size(), records.size());
+  EXPECT_FALSE(success[0]);
+  EXPECT_FALSE(success[1]);
+  EXPECT_FALSE(success[num_points + 2]);
+  for (int i = 0; i < num_points; i++) {
+    EXPECT_TRUE(success[i + 2]);
+    EXPECT_VECTOR_NEAR(Vector3(i, 0.5*i, -i), records[i + 2].point_data, 1e-16);
+  }
+
+  // Must agree with parsing one line at a time
+  bool is_first_line = false, line_success = false;
+  CsvConv::CsvRecord vals = conv.parse_csv_line(is_first_line, line_success, lines[100]);
+  EXPECT_TRUE(line_success);
+  EXPECT_VECTOR_NEAR(vals.point_data, records[100].point_data, 1e-16);
+}
+
+TEST( PointUtils, ReadCsvPoints ) {
+
+  vw::cartography::GeoReference geo;
+  geo.set_well_known_geogcs("WGS84");
+
+  CsvConv conv;
+  conv.parse_csv_format("1:lon 2:lat 3:height_above_datum", "");
+
+  // A header, then points at longitudes 0, 1, ..., with a blank line
+  // and a bad line, in several batches
+  std::string file = "test_read_csv_points.csv";
+  int num_points = 2*int(csv_batch_size()) + 10;
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "lon,lat,height\n";
+    for (int i = 0; i < num_points; i++)
+      ofs << (i % 360) << ", 10, " << i << "\n";
+    ofs << "\n" << "1, 2\n";
+  }
+
+  // All the points, in file order
+  std::vector<double> heights;
+  CsvConv::CsvBatchJob collect_job = [&](CsvConv::CsvPointBatch const& batch) {
+    for (size_t it = 0; it < batch.xyz.size(); it++) {
+      if (!batch.valid[it])
+        continue;
+      Vector3 llh = geo.datum().cartesian_to_geodetic(batch.xyz[it]);
+      EXPECT_NEAR(10.0, batch.lonlat[it][1], 1e-12);
+      EXPECT_NEAR(llh[2], heights.size(), 1e-6);
+      heights.push_back(llh[2]);
+    }
+    return true;
+  };
+  EXPECT_EQ(size_t(num_points), conv.read_csv_points(file, geo, BBox2(), 1.0, collect_job));
+  EXPECT_EQ(size_t(num_points), heights.size());
+
+  // Only the points in the box
+  int num_in_box = 0;
+  CsvConv::CsvBatchJob box_job = [&](CsvConv::CsvPointBatch const& batch) {
+    for (size_t it = 0; it < batch.xyz.size(); it++) {
+      if (!batch.valid[it])
+        continue;
+      EXPECT_TRUE(batch.lonlat[it][0] >= 100 && batch.lonlat[it][0] <= 109.5);
+      num_in_box++;
+    }
+    return true;
+  };
+  size_t num_valid = conv.read_csv_points(file, geo, BBox2(100, 0, 9.5, 20), 1.0, box_job);
+  EXPECT_EQ(num_valid, size_t(num_in_box));
+  EXPECT_TRUE(num_in_box > 0);
+
+  // Stop after the first batch
+  int num_batches = 0;
+  CsvConv::CsvBatchJob stop_job = [&](CsvConv::CsvPointBatch const&) {
+    num_batches++;
+    return false;
+  };
+  conv.read_csv_points(file, geo, BBox2(), 1.0, stop_job);
+  EXPECT_EQ(1, num_batches);
+
+  std::remove(file.c_str());
+}
+
+TEST( PointUtils, DemHeightsAtPixels ) {
+
+  ImageView<double> dem(5, 4);
+  for (int col = 0; col < dem.cols(); col++)
+    for (int row = 0; row < dem.rows(); row++)
+      dem(col, row) = col + 10*row;
+  double nodata = -1;
+  dem(4, 3) = nodata;
+
+  std::vector<Vector2> pix;
+  pix.push_back(Vector2(1.5, 2.25)); // interior
+  pix.push_back(Vector2(-0.5, 1));   // outside
+  pix.push_back(Vector2(4, 3));      // nodata
+  pix.push_back(Vector2(4, 0));      // on the edge
+  std::vector<double> heights;
+  dem_heights_at_pixels(dem, nodata, pix, 2, heights);
+  ASSERT_EQ(pix.size(), heights.size());
+  EXPECT_NEAR(1.5 + 22.5, heights[0], 1e-12);
+  EXPECT_TRUE(std::isnan(heights[1]));
+  EXPECT_TRUE(std::isnan(heights[2]));
+  EXPECT_NEAR(4.0, heights[3], 1e-12);
+}
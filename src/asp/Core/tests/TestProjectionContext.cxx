@@ -0,0 +1,71 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/ProjectionContext.h>
+
+#include <thread>
+
+using namespace vw;
+using namespace asp;
+
+TEST( ProjectionContext, remember_last_pixel ) {
+
+  int cam1 = 0, cam2 = 0;
+  Vector2 pix;
+  EXPECT_FALSE(ProjectionContext::get_hint(&cam1, pix));
+
+  ProjectionContext::set_hint(&cam1, Vector2(1, 2));
+  ProjectionContext::set_hint(&cam2, Vector2(3, 4));
+  ProjectionContext::set_hint(&cam1, Vector2(5, 6));
+
+  EXPECT_TRUE(ProjectionContext::get_hint(&cam1, pix));
+  EXPECT_VECTOR_NEAR(Vector2(5, 6), pix, 1e-16);
+  EXPECT_TRUE(ProjectionContext::get_hint(&cam2, pix));
+  EXPECT_VECTOR_NEAR(Vector2(3, 4), pix, 1e-16);
+}
+
+TEST( ProjectionContext, oldest_camera_is_replaced ) {
+
+  int cams[5];
+  for (int it = 0; it < 5; it++)
+    ProjectionContext::set_hint(&cams[it], Vector2(it, it));
+
+  Vector2 pix;
+  EXPECT_FALSE(ProjectionContext::get_hint(&cams[0], pix));
+  EXPECT_TRUE (ProjectionContext::get_hint(&cams[4], pix));
+  EXPECT_VECTOR_NEAR(Vector2(4, 4), pix, 1e-16);
+}
+
+namespace {
+  void check_no_hint(void const* camera, bool * found) {
+    Vector2 pix;
+    *found = ProjectionContext::get_hint(camera, pix);
+  }
+}
+
+TEST( ProjectionContext, hints_are_per_thread ) {
+
+  int cam = 0;
+  ProjectionContext::set_hint(&cam, Vector2(7, 8));
+
+  bool found = true;
+  std::thread thread(check_no_hint, &cam, &found);
+  thread.join();
+  EXPECT_FALSE(found);
+}
@@ -0,0 +1,70 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/QfitReader.h>
+
+#include <cstdio>
+#include <fstream>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Write a 12-word QFIT file with the given byte order: the first record,
+  // a header record, two points, and a record with no laser return.
+  void write_qfit(std::string const& file, bool big_endian) {
+    int32 records[5][12] = {
+      {48, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+      {-9000000, 1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0},
+      {1000, 68123456, 310500000, 1234567, 0, 0, 0, 0, 0, 0, 0, 0},
+      {1001, -75500000, 20250000, -15000, 0, 0, 0, 0, 0, 0, 0, 0},
+      {1002, 0, 20250000, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+    std::ofstream ofs(file.c_str(), std::ios::binary);
+    for (int r = 0; r < 5; r++) {
+      for (int w = 0; w < 12; w++) {
+        uint32 v = records[r][w];
+        unsigned char b[4];
+        for (int k = 0; k < 4; k++)
+          b[big_endian ? 3 - k : k] = (v >> (8*k)) & 0xff;
+        ofs.write((char*)b, 4);
+      }
+    }
+  }
+}
+
+TEST(QfitReader, read_points) {
+
+  std::string file = "test_qfit.qi";
+  for (int big_endian = 0; big_endian < 2; big_endian++) {
+    write_qfit(file, big_endian);
+
+    QfitReader reader(file);
+    EXPECT_EQ(12, reader.words_per_record());
+    EXPECT_EQ(4,  reader.num_records());
+
+    Vector3 llh;
+    ASSERT_TRUE(reader.read_next_point(llh));
+    EXPECT_VECTOR_NEAR(Vector3(310.5 - 360, 68.123456, 1234.567), llh, 1e-9);
+    ASSERT_TRUE(reader.read_next_point(llh));
+    EXPECT_VECTOR_NEAR(Vector3(20.25, -75.5, -15), llh, 1e-9);
+    EXPECT_FALSE(reader.read_next_point(llh));
+  }
+  remove(file.c_str());
+}
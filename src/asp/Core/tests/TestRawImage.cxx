@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/RawImage.h>
+#include <vw/Image/PixelTypes.h>
+
+#include <boost/filesystem.hpp>
+#include <cstdio>
+
+using namespace vw;
+using namespace asp;
+
+TEST(RawImage, round_trip) {
+
+  std::string file = "test_raw_image.raw";
+  ImageView<PixelGray<float> > image(300, 7);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = 0.5f * col - 3.0f * row;
+
+  write_raw_image(file, image);
+  EXPECT_TRUE(boost::filesystem::exists(file + ".vrt"));
+
+  RawImageView<PixelGray<float> > raw(file);
+  ASSERT_EQ(image.cols(), raw.cols());
+  ASSERT_EQ(image.rows(), raw.rows());
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      EXPECT_EQ(image(col, row), raw(col, row));
+
+  // Reading through crops and pixel accessors, as the correlator does
+  ImageView<PixelGray<float> > tile = crop(raw, BBox2i(290, 2, 10, 5));
+  EXPECT_EQ(image(295, 4), tile(5, 2));
+
+  // The pixel type must match
+  EXPECT_THROW(RawImageView<uint8> wrong(file), ArgumentErr);
+
+  std::remove(file.c_str());
+  std::remove((file + ".vrt").c_str());
+}
+
+TEST(RawImage, file_name) {
+  EXPECT_EQ("run/run-lMask.raw", raw_image_file("run/run-lMask.tif"));
+}
@@ -0,0 +1,56 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/SearchRange.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST(SearchRange, robust_disparity_range) {
+
+  // Two large groups of disparities, as on both sides of a cliff,
+  // one outlier, and an invalid disparity.
+  ImageView<PixelMask<Vector2f> > disp(20, 10);
+  for (int row = 0; row < disp.rows(); row++)
+    for (int col = 0; col < disp.cols(); col++)
+      disp(col, row) = PixelMask<Vector2f>(Vector2f(col < 10 ? 5 + row % 2 : 40, -2));
+  disp(3, 3) = PixelMask<Vector2f>(Vector2f(900, 300));
+  disp(4, 4) = PixelMask<Vector2f>(Vector2f(-900, -300));
+  disp(4, 4).invalidate();
+
+  BBox2f range = robust_disparity_range(disp, 0.01, 2.0);
+  EXPECT_NEAR(5,  range.min()[0], 1e-6);
+  EXPECT_NEAR(-2, range.min()[1], 1e-6);
+  EXPECT_NEAR(40, range.max()[0], 1e-6);
+  EXPECT_NEAR(-2, range.max()[1], 1e-6);
+
+  // Without pruning, the outlier is in the range
+  range = robust_disparity_range(disp, 0.0, 2.0);
+  EXPECT_NEAR(900, range.max()[0], 1e-6);
+  EXPECT_NEAR(300, range.max()[1], 1e-6);
+  EXPECT_NEAR(5,   range.min()[0], 1e-6);
+
+  // No valid disparities
+  ImageView<PixelMask<Vector2f> > empty(3, 3);
+  for (int row = 0; row < empty.rows(); row++)
+    for (int col = 0; col < empty.cols(); col++)
+      empty(col, row).invalidate();
+  range = robust_disparity_range(empty, 0.01, 2.0);
+  EXPECT_NEAR(0, range.max()[0], 1e-6);
+  EXPECT_NEAR(0, range.min()[1], 1e-6);
+}
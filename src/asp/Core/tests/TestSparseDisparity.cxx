@@ -0,0 +1,85 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/SparseDisparity.h>
+#include <vw/Image/Manipulation.h>
+
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A texture with detail at all scales
+  float texture(int col, int row) {
+    return std::sin(0.3 * col) + std::cos(0.17 * row) + std::sin(0.05 * col * row / 64.0)
+      + ((col * 7919 + row * 104729) % 97) / 97.0;
+  }
+}
+
+TEST(SparseDisparity, shift) {
+
+  // The right image is the left one shifted by the disparity
+  Vector2i shift(12, -5);
+  int cols = 512, rows = 384;
+  ImageView<PixelMask<float> > left(cols, rows), right(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      left (col, row) = texture(col, row);
+      right(col, row) = texture(col - shift.x(), row - shift.y());
+    }
+  }
+  ImageView<PixelMask<float> > left_sub = subsample(left, 2), right_sub = subsample(right, 2);
+
+  SparseDispOptions options;
+  options.template_size = 21;
+  options.coarse_skip   = 128;
+  options.fine_skip     = 64;
+
+  ImageView<PixelMask<Vector2f> > disp;
+  ImageView<PixelMask<Vector2i> > spread;
+  sparse_disparity(left, right, left_sub, right_sub,
+                   BBox2i(Vector2i(-32, -32), Vector2i(32, 32)), options, disp, spread);
+
+  ASSERT_EQ(left_sub.cols(), disp.cols());
+  ASSERT_EQ(left_sub.rows(), disp.rows());
+  ASSERT_EQ(left_sub.cols(), spread.cols());
+
+  // The disparity is in the pixels of the subsampled image
+  int num_valid = 0;
+  for (int row = 0; row < disp.rows(); row += 16) {
+    for (int col = 0; col < disp.cols(); col += 16) {
+      if (!is_valid(disp(col, row)))
+        continue;
+      num_valid++;
+      EXPECT_NEAR(6.0,  disp(col, row).child()[0], 1e-3);
+      EXPECT_NEAR(-2.5, disp(col, row).child()[1], 1e-3);
+      EXPECT_TRUE(is_valid(spread(col, row)));
+      EXPECT_LE(1, spread(col, row).child()[0]);
+    }
+  }
+  EXPECT_GT(num_valid, 0);
+
+  // Flat images have no matches
+  ImageView<PixelMask<float> > flat(cols, rows);
+  fill(flat, PixelMask<float>(1.0));
+  EXPECT_THROW(sparse_disparity(flat, flat, subsample(flat, 2), subsample(flat, 2),
+                                BBox2i(Vector2i(-8, -8), Vector2i(8, 8)), options,
+                                disp, spread), ArgumentErr);
+}
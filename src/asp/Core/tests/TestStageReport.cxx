@@ -0,0 +1,62 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/StageReport.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+using namespace asp;
+
+TEST(StageReport, append) {
+
+  std::string prefix = "test_stage";
+  std::string file   = StageReport::report_file(prefix);
+  std::remove(file.c_str());
+
+  // Two runs append to the same report, with one header
+  StageReport first("correlation");
+  first.add("search_range_width", 40);
+  first.add("search_range_height", 3);
+  first.write(prefix);
+  StageReport second("triangulation");
+  second.write(prefix);
+
+  std::ifstream ifs(file.c_str());
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(ifs, line))
+    lines.push_back(line);
+  ASSERT_EQ(3u, lines.size());
+
+  std::vector<std::string> header, row;
+  boost::split(header, lines[0], boost::is_any_of(","));
+  boost::split(row,    lines[1], boost::is_any_of(","));
+  ASSERT_EQ(header.size(), row.size());
+  EXPECT_EQ("stage",       header[0]);
+  EXPECT_EQ("correlation", row[0]);
+  EXPECT_EQ(prefix,        row[1]);
+  EXPECT_GE(atof(row[4].c_str()), 0.0); // wall time
+  EXPECT_EQ("search_range_width=40;search_range_height=3", row.back());
+  EXPECT_EQ(0u, lines[2].find("triangulation,"));
+
+  std::remove(file.c_str());
+}
@@ -0,0 +1,80 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/TextureFilter.h>
+#include <vw/Image/ImageView.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+TEST(TextureFilter, texture_measure) {
+
+  // A flat half and a half with stripes
+  int nc = 20, nr = 10;
+  ImageView<PixelGray<float> > image(nc, nr);
+  for (int row = 0; row < nr; row++)
+    for (int col = 0; col < nc; col++)
+      image(col, row) = (col < 10) ? 0.5 : 0.5 + 0.1*(col % 2 == 0 ? 1 : -1);
+
+  ImageView<float> texture;
+  texture_measure(image, texture, 5);
+  ASSERT_EQ(nc, texture.cols());
+  ASSERT_EQ(nr, texture.rows());
+  EXPECT_NEAR(0.0, texture(3, 5), 1e-6);
+
+  // The window at (15, 5) has columns 13 to 17, with two values of 0.6
+  // and three of 0.4.
+  double mean = (0.6*2 + 0.4*3)/5.0;
+  double var  = (0.6*0.6*2 + 0.4*0.4*3)/5.0 - mean*mean;
+  EXPECT_NEAR(std::sqrt(var), texture(15, 5), 1e-5);
+}
+
+TEST(TextureFilter, smoothing) {
+
+  int nc = 15, nr = 15;
+  ImageView< PixelMask<Vector2f> > disp(nc, nr);
+  ImageView<float> texture(nc, nr);
+  for (int row = 0; row < nr; row++) {
+    for (int col = 0; col < nc; col++) {
+      disp(col, row) = PixelMask<Vector2f>(Vector2f(col, 2*row));
+      texture(col, row) = (col < 8) ? 0.0 : 1.0;
+    }
+  }
+  disp(3, 3).invalidate();
+  disp(4, 4) = PixelMask<Vector2f>(Vector2f(50, 0));
+
+  ImageView< PixelMask<Vector2f> > out;
+  texture_preserving_disparity_filter(disp, out, texture, 0.5, 3);
+
+  // Invalid pixels stay invalid, textured pixels are unchanged
+  EXPECT_FALSE(is_valid(out(3, 3)));
+  EXPECT_NEAR(12.0, out(12, 7).child()[0], 1e-6);
+  EXPECT_NEAR(14.0, out(12, 7).child()[1], 1e-6);
+
+  // The mean of the eight valid values in the window around (4, 4)
+  Vector2 sum;
+  for (int row = 3; row <= 5; row++)
+    for (int col = 3; col <= 5; col++)
+      if (is_valid(disp(col, row)))
+        sum += Vector2(disp(col, row).child()[0], disp(col, row).child()[1]);
+  EXPECT_NEAR(sum[0]/8.0, out(4, 4).child()[0], 1e-5);
+  EXPECT_NEAR(sum[1]/8.0, out(4, 4).child()[1], 1e-5);
+}
@@ -24,6 +24,7 @@
 #include <asp/Core/ThreadedEdgeMask.h>
 
 #include <algorithm>
+#include <cstdlib>
 #include <vector>
 
 using namespace vw;
@@ -54,3 +55,30 @@ TEST( ThreadedEdgeMask, active_area ) {
   output = threaded_edge_mask(input,0);
   EXPECT_EQ( input, output );
 }
+
+TEST( ThreadedEdgeMask, bands ) {
+  // A diamond, scanned in bands and blocks smaller than the image. A
+  // pixel is valid if it is inside the valid extent of both its row and
+  // its column.
+  int n = 21;
+  ImageView<uint8> input(n,n);
+  for (int j = 0; j < n; j++)
+    for (int i = 0; i < n; i++)
+      input(i,j) = (std::abs(i-10) + std::abs(j-10) <= 8) ? 1 + (i+j)%5 : 0;
+  input(10,10) = 0; // A hole inside stays valid
+
+  for (int buffer = 0; buffer < 3; buffer++) {
+    ImageView<PixelMask<uint8> > output = threaded_edge_mask(input,0,buffer,4);
+    for (int j = 0; j < n; j++) {
+      for (int i = 0; i < n; i++) {
+        int row_extent = 8 - std::abs(j-10) - buffer;
+        int col_extent = 8 - std::abs(i-10) - buffer;
+        bool expected = (std::abs(i-10) <= row_extent && std::abs(j-10) <= col_extent);
+        EXPECT_EQ( expected, is_valid(output(i,j)) );
+        if (expected)
+          EXPECT_EQ( input(i,j), output(i,j).child() );
+      }
+    }
+  }
+  EXPECT_EQ( BBox2i(2,2,17,17), threaded_edge_mask(input,0,0,4).active_area() );
+}
@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/TransformCache.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  struct ShiftTransform: public vw::Transform {
+    Vector2 m_shift;
+    ShiftTransform(double x, double y): m_shift(x, y) {}
+    virtual Vector2 reverse(Vector2 const& p) const { return p - m_shift; }
+    virtual Vector2 forward(Vector2 const& p) const { return p + m_shift; }
+  };
+
+  TransformTileCache::TransPtr same_transform(TransformTileCache::TransPtr const& trans) {
+    return trans;
+  }
+}
+
+TEST(TransformTileCache, reverse) {
+
+  TransformTileCache::TransPtr shift1(new ShiftTransform(1, 2));
+  TransformTileCache::TransPtr shift2(new ShiftTransform(-3, 5));
+
+  // Two caches and two transforms, looked up in turn at the same tile,
+  // must not use each other's tiles.
+  TransformTileCache cache1(1e+6, 16), cache2(1e+6, 16);
+  int id1 = cache1.add_transform(shift1, same_transform);
+  int id2 = cache1.add_transform(shift2, same_transform);
+  int id3 = cache2.add_transform(shift2, same_transform);
+
+  for (int it = 0; it < 3; it++) {
+    Vector2 pix(3.25, 7.5 + it);
+    EXPECT_VECTOR_NEAR(shift1->reverse(pix), cache1.reverse(id1, pix), 1e-12);
+    EXPECT_VECTOR_NEAR(shift2->reverse(pix), cache1.reverse(id2, pix), 1e-12);
+    EXPECT_VECTOR_NEAR(shift2->reverse(pix), cache2.reverse(id3, pix), 1e-12);
+  }
+
+  // A new cache, which may be made where a deleted one was
+  boost::shared_ptr<TransformTileCache> cache3(new TransformTileCache(1e+6, 16));
+  cache3->add_transform(shift1, same_transform);
+  EXPECT_VECTOR_NEAR(Vector2(2.25, 5.5), cache3->reverse(0, Vector2(3.25, 7.5)), 1e-12);
+  cache3.reset(new TransformTileCache(1e+6, 16));
+  cache3->add_transform(shift2, same_transform);
+  EXPECT_VECTOR_NEAR(Vector2(6.25, 2.5), cache3->reverse(0, Vector2(3.25, 7.5)), 1e-12);
+
+  // Another tile
+  EXPECT_VECTOR_NEAR(Vector2(39, 35), cache1.reverse(id1, Vector2(40, 37)), 1e-12);
+}
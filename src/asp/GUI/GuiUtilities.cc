@@ -22,6 +22,15 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <thread>
+#include <boost/algorithm/string/predicate.hpp>
 #include <QPolygon>
 #include <QtGui>
 #include <QtWidgets>
@@ -32,11 +41,13 @@
 #include <vw/Math/EulerAngles.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Cartography/GeoTransform.h>
-#include <vw/tools/hillshade.h>
 #include <vw/Core/RunOnce.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 #include <vw/InterestPoint/Matcher.h> // Needed for vw::ip::match_filename
 #include <asp/GUI/GuiUtilities.h>
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/PointUtils.h>
 
 using namespace vw;
 using namespace vw::gui;
@@ -65,13 +76,38 @@ bool isPolyZeroDim(const QPolygon & pa){
   return true;
 }
   
+namespace {
+  vw::Mutex g_popup_mutex;
+  std::vector<std::string> g_pending_popups;
+}
+
 void popUp(std::string msg){
+
+  // Qt widgets can be used only from the GUI thread
+  if (QCoreApplication::instance() == NULL ||
+      QThread::currentThread() != QCoreApplication::instance()->thread()) {
+    vw_out() << msg << std::endl;
+    vw::Mutex::Lock lock(g_popup_mutex);
+    g_pending_popups.push_back(msg);
+    return;
+  }
+
   QMessageBox msgBox;
   msgBox.setText(msg.c_str());
   msgBox.exec();
   return;
 }
 
+void showPendingPopUps(){
+  std::vector<std::string> msgs;
+  {
+    vw::Mutex::Lock lock(g_popup_mutex);
+    msgs.swap(g_pending_popups);
+  }
+  for (size_t it = 0; it < msgs.size(); it++)
+    popUp(msgs[it]);
+}
+
 bool getStringFromGui(QWidget * parent,
                       std::string title, std::string description,
                       std::string inputStr,
@@ -122,58 +158,55 @@ QRect bbox2qrect(BBox2 const& B){
                round(B.width()), round(B.height()));
 }
 
-bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                     double azimuth, double elevation,
-                     std::string const& input_file,
-                     std::string      & output_file) {
-
-  // Sanity check: Must have a georeference
-  cartography::GeoReference georef;
-  bool has_georef = vw::cartography::read_georeference(georef, input_file);
-  if (!has_georef) {
-    popUp("No georeference present in: " + input_file + ".");
-    return false;
-  }
-
-  double scale       = 0.0;
-  double blur_sigma  = std::numeric_limits<double>::quiet_NaN();
-  double nodata_val  = std::numeric_limits<double>::quiet_NaN();
-  vw::read_nodata_val(input_file, nodata_val);
-  std::ostringstream oss;
-  oss << "_hillshade_a" << azimuth << "_e" << elevation << ".tif"; 
-  std::string suffix = oss.str();
+vw::Vector2 georefPixelSize(vw::cartography::GeoReference const& georef,
+                            vw::Vector2 const& pix) {
+  // Distances on the datum, so this works for projected and lon-lat images
+  vw::cartography::Datum const& datum = georef.datum();
+  Vector3 c  = datum.geodetic_to_cartesian(Vector3(georef.pixel_to_lonlat(pix)[0],
+                                                   georef.pixel_to_lonlat(pix)[1], 0));
+  Vector2 lx = georef.pixel_to_lonlat(pix + Vector2(1, 0));
+  Vector2 ly = georef.pixel_to_lonlat(pix + Vector2(0, 1));
+  Vector3 cx = datum.geodetic_to_cartesian(Vector3(lx[0], lx[1], 0));
+  Vector3 cy = datum.geodetic_to_cartesian(Vector3(ly[0], ly[1], 0));
+  return Vector2(norm_2(cx - c), norm_2(cy - c));
+}
 
-  output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-  bool align_light_to_georef = false;
-  try {
-    DiskImageView<float> input(input_file);
-    try{
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file, output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma, align_light_to_georef);
-      }
-    }catch(...){
-      // Failed to write, presumably because we have no write access.
-      // Write the file in the current dir.
-      vw_out() << "Failed to write: " << output_file << "\n";
-      output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file,  output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma, align_light_to_georef);
+void hillshadeClip(ImageView<double> const& dem, double nodata_val,
+                   vw::Vector2 const& pixel_size, double azimuth, double elevation,
+                   double out_nodata, ImageView<double> & shade) {
+
+  // The direction to the light, with x to the east, y to the north,
+  // and the azimuth measured clockwise from north.
+  double a = azimuth * M_PI / 180.0, e = elevation * M_PI / 180.0;
+  Vector3 light(sin(a)*cos(e), cos(a)*cos(e), sin(e));
+
+  shade.set_size(dem.cols(), dem.rows());
+  for (int row = 0; row < dem.rows(); row++) {
+    for (int col = 0; col < dem.cols(); col++) {
+
+      // One-sided differences at the clip edges
+      int c0 = std::max(col - 1, 0), c1 = std::min(col + 1, dem.cols() - 1);
+      int r0 = std::max(row - 1, 0), r1 = std::min(row + 1, dem.rows() - 1);
+      double h = dem(col, row), hx0 = dem(c0, row), hx1 = dem(c1, row),
+        hy0 = dem(col, r0), hy1 = dem(col, r1);
+      bool valid = true;
+      double vals[5] = {h, hx0, hx1, hy0, hy1};
+      for (int it = 0; it < 5; it++)
+        valid = valid && !std::isnan(vals[it]) && vals[it] > nodata_val;
+      if (!valid || (c0 == c1 && r0 == r1)) {
+        shade(col, row) = out_nodata;
+        continue;
       }
+
+      double dzdx = 0, dzdy = 0;
+      if (c1 > c0)
+        dzdx = (hx1 - hx0) / ((c1 - c0) * pixel_size[0]);
+      if (r1 > r0)
+        dzdy = -(hy1 - hy0) / ((r1 - r0) * pixel_size[1]); // Rows go south
+      Vector3 normal(-dzdx, -dzdy, 1.0);
+      shade(col, row) = std::max(0.0, dot_prod(normal, light) / norm_2(normal));
     }
-  } catch (const Exception& e) {
-    popUp(e.what());
-    return false;
   }
-
-  return true;
 }
 
 
@@ -715,6 +748,202 @@ void findClosestPolyEdge(// inputs
 }
 
 
+namespace {
+
+  // The pyramids made by this process, by the key of their image
+  vw::Mutex g_pyramid_cache_mutex;
+  std::set<std::string> g_pyramid_cache_keys;
+
+  std::string hex_hash(std::string const& str) {
+    std::ostringstream key;
+    key << std::hex << std::setw(16) << std::setfill('0')
+        << (unsigned long long)(std::hash<std::string>()(str));
+    return key.str();
+  }
+
+  // Files in the cache start with the key of their image, then an underscore
+  std::string pyramid_cache_key(std::string const& image_file) {
+    fs::path path = fs::absolute(image_file);
+    std::ostringstream os;
+    os << path.string() << " " << fs::file_size(path) << " " << fs::last_write_time(path);
+    return hex_hash(os.str());
+  }
+
+  // Mark that the pyramid with this key is used now. The time of last
+  // use is the time of the marker file. The caller must hold the mutex.
+  void mark_pyramid_used(std::string const& cache_dir, std::string const& key,
+                         std::string const& image_file) {
+    std::ofstream used((fs::path(cache_dir) / (key + "_used")).string().c_str());
+    used << image_file << std::endl;
+    g_pyramid_cache_keys.insert(key);
+  }
+
+  bool inPyramidCache(std::string const& file) {
+    std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+    fs::path dir = fs::absolute(fs::path(file)).parent_path();
+    boost::system::error_code ec;
+    return cache_dir != "" && fs::equivalent(dir, fs::path(cache_dir), ec);
+  }
+
+  // The name GDAL opens a remote image with
+  std::string gdal_remote_name(std::string const& image_file) {
+    if (image_file.compare(0, 4, "/vsi") == 0)
+      return image_file;
+    return "/vsicurl/" + image_file;
+  }
+
+  // A remote image is read in small pieces. Do not let GDAL list the
+  // remote directory when opening it, and keep the recently read pieces,
+  // unless the user chose otherwise.
+  void set_remote_gdal_options() {
+    if (CPLGetConfigOption("GDAL_DISABLE_READDIR_ON_OPEN", NULL) == NULL)
+      CPLSetConfigOption("GDAL_DISABLE_READDIR_ON_OPEN", "EMPTY_DIR");
+    if (CPLGetConfigOption("VSI_CACHE", NULL) == NULL)
+      CPLSetConfigOption("VSI_CACHE", "TRUE");
+  }
+}
+
+bool isRemoteImage(std::string const& image_file){
+  return image_file.compare(0, 7, "http://")  == 0 ||
+         image_file.compare(0, 8, "https://") == 0 ||
+         image_file.compare(0, 6, "ftp://")   == 0 ||
+         image_file.compare(0, 4, "/vsi")     == 0;
+}
+
+std::string localImageFile(std::string const& image_file){
+
+  if (!isRemoteImage(image_file))
+    return image_file;
+
+  GDALAllRegister();
+  set_remote_gdal_options();
+  std::string remote = gdal_remote_name(image_file);
+
+  // The key is made from the URL and what the server says of the
+  // size and modification time of the image
+  VSIStatBufL stat;
+  if (VSIStatL(remote.c_str(), &stat) != 0)
+    vw_throw(ArgumentErr() << "Cannot access: " << image_file << ".\n");
+  std::ostringstream os;
+  os << remote << " " << stat.st_size << " " << stat.st_mtime;
+  std::string key = hex_hash(os.str());
+
+  // The name of the image, without any query string after it
+  std::string name = fs::path(remote.substr(0, remote.find('?'))).filename().string();
+  name = fs::path(name).replace_extension(".vrt").string();
+
+  // The pyramid is written next to the VRT, so it goes to the cache if
+  // there is one, and else to the temporary directory.
+  std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+  fs::path dir = (cache_dir != "") ? fs::path(cache_dir) :
+    (fs::temp_directory_path() / "stereo_gui_remote");
+  fs::path vrt = dir / (key + "_" + name);
+
+  vw::Mutex::Lock lock(g_pyramid_cache_mutex);
+  fs::create_directories(dir);
+  if (!fs::exists(vrt)) {
+    vw_out() << "Opening remote image: " << image_file << std::endl;
+    GDALDatasetH src = GDALOpen(remote.c_str(), GA_ReadOnly);
+    if (src == NULL)
+      vw_throw(ArgumentErr() << "Could not open: " << image_file << ".\n");
+    // Write to a temporary file first, as other processes may use the cache
+    std::string tmp_vrt = vrt.string() + ".tmp.vrt";
+    GDALDatasetH dst = GDALCreateCopy(GDALGetDriverByName("VRT"), tmp_vrt.c_str(),
+                                      src, FALSE, NULL, NULL, NULL);
+    GDALClose(src);
+    if (dst == NULL)
+      vw_throw(ArgumentErr() << "Could not write: " << tmp_vrt << ".\n");
+    GDALClose(dst);
+    fs::rename(tmp_vrt, vrt);
+  }
+
+  std::string vrt_file = vrt.string();
+  if (cache_dir != "")
+    mark_pyramid_used(cache_dir, key, image_file);
+  else
+    temporary_files().insert(&vrt_file, &vrt_file + 1);
+
+  return vrt_file;
+}
+
+std::string pyramidCacheFile(std::string const& image_file){
+
+  std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+  if (cache_dir == "" || asp::has_shp_extension(image_file) || inPyramidCache(image_file))
+    return image_file;
+
+  try {
+    std::string key = pyramid_cache_key(image_file);
+    fs::path link = fs::path(cache_dir) / (key + "_" + fs::path(image_file).filename().string());
+
+    vw::Mutex::Lock lock(g_pyramid_cache_mutex);
+    fs::create_directories(cache_dir);
+    if (!fs::exists(link) && !fs::is_symlink(link))
+      fs::create_symlink(fs::absolute(image_file), link);
+
+    mark_pyramid_used(cache_dir, key, image_file);
+    return link.string();
+  } catch (const std::exception & e) {
+    vw_out(WarningMessage) << "Cannot use the pyramid cache for " << image_file
+                           << ": " << e.what() << std::endl;
+  }
+  return image_file;
+}
+
+void prunePyramidCache(){
+
+  std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+  if (cache_dir == "" || !fs::is_directory(cache_dir))
+    return;
+
+  vw::Mutex::Lock lock(g_pyramid_cache_mutex);
+  try {
+    // The size and time of last use of each image's pyramid
+    std::map<std::string, double> sizes;
+    std::map<std::string, std::time_t> times;
+    double total = 0;
+    for (fs::directory_iterator it(cache_dir); it != fs::directory_iterator(); it++) {
+      std::string name = it->path().filename().string();
+      size_t pos = name.find('_');
+      if (pos == std::string::npos)
+        continue;
+      std::string key = name.substr(0, pos);
+      if (name == key + "_used")
+        times[key] = fs::last_write_time(it->path());
+      if (fs::is_symlink(it->symlink_status()) || !fs::is_regular_file(it->status()))
+        continue; // Do not count the images themselves
+      double size = fs::file_size(it->path()) / (1024.0 * 1024.0);
+      sizes[key] += size;
+      total      += size;
+    }
+
+    std::vector< std::pair<std::time_t, std::string> > by_time;
+    for (auto it = sizes.begin(); it != sizes.end(); it++)
+      by_time.push_back(std::make_pair(times.count(it->first) ? times[it->first] : 0,
+                                       it->first));
+    std::sort(by_time.begin(), by_time.end());
+
+    double max_size = asp::stereo_settings().pyramid_cache_size;
+    for (size_t i = 0; i < by_time.size() && total > max_size; i++) {
+      std::string key = by_time[i].second;
+      if (g_pyramid_cache_keys.find(key) != g_pyramid_cache_keys.end())
+        continue;
+      vw_out() << "Removing from the pyramid cache the files starting with: "
+               << (fs::path(cache_dir) / key).string() << std::endl;
+      std::vector<fs::path> files;
+      for (fs::directory_iterator it(cache_dir); it != fs::directory_iterator(); it++) {
+        if (it->path().filename().string().compare(0, key.size() + 1, key + "_") == 0)
+          files.push_back(it->path());
+      }
+      for (size_t f = 0; f < files.size(); f++)
+        fs::remove(files[f]);
+      total -= sizes[key];
+    }
+  } catch (const std::exception & e) {
+    vw_out(WarningMessage) << "Failed to prune the pyramid cache: " << e.what() << std::endl;
+  }
+}
+
 void imageData::read(std::string const& name_in,
 		     vw::cartography::GdalWriteOptions const& opt,
                      bool use_georef){
@@ -740,9 +969,11 @@ void imageData::read(std::string const& name_in,
     
     int top_image_max_pix = 1000*1000;
     int subsample = 4;
-    img = DiskImagePyramidMultiChannel(name, m_opt, top_image_max_pix, subsample);
+    std::string local_name = localImageFile(name);
+    img = DiskImagePyramidMultiChannel(pyramidCacheFile(local_name), m_opt,
+                                       top_image_max_pix, subsample);
     
-    has_georef = vw::cartography::read_georeference(georef, name);
+    has_georef = vw::cartography::read_georeference(georef, local_name);
     
     if (use_georef && !has_georef){
       popUp("No georeference present in: " + name + ".");
@@ -753,6 +984,45 @@ void imageData::read(std::string const& name_in,
   }
 }
 
+void readImagesInParallel(std::vector<std::string> const& image_files,
+                          vw::cartography::GdalWriteOptions const& opt,
+                          bool use_georef,
+                          std::vector<imageData> & images){
+
+  int num_images = image_files.size();
+  images.resize(num_images);
+  std::vector<std::exception_ptr> errors(num_images);
+
+  // Each thread takes the next image not yet started, as the images
+  // can take very different times.
+  std::atomic<int> next_image(0);
+  auto read_images = [&]() {
+    int i;
+    while ((i = next_image++) < num_images) {
+      try {
+        images[i].read(image_files[i], opt, use_georef);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+
+  int num_threads = std::max(1, std::min(int(opt.num_threads), num_images));
+  std::vector<std::thread> threads;
+  for (int t = 1; t < num_threads; t++)
+    threads.push_back(std::thread(read_images));
+  read_images(); // This thread does its share too
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  showPendingPopUps();
+  prunePyramidCache();
+  for (int i = 0; i < num_images; i++) {
+    if (errors[i])
+      std::rethrow_exception(errors[i]);
+  }
+}
+
 vw::Vector2 QPoint2Vec(QPoint const& qpt) {
   return vw::Vector2(qpt.x(), qpt.y());
 }
@@ -851,54 +1121,157 @@ chooseFilesDlg::~chooseFilesDlg(){}
 }
 
 
+namespace {
+
+  // The disparity in one direction, with invalid pixels as no-data
+  struct DisparityChannel: public vw::ReturnFixedType<double> {
+    int m_channel;
+    double m_nodata;
+    DisparityChannel(int channel, double nodata): m_channel(channel), m_nodata(nodata) {}
+    double operator()(PixelMask<Vector2f> const& p) const {
+      if (!is_valid(p) || p.child() != p.child())
+        return m_nodata;
+      return p.child()[m_channel];
+    }
+  };
+
+  // The distance of a point from the planet center. The points which
+  // were not found are zero.
+  struct PointRadius: public vw::ReturnFixedType<double> {
+    double m_nodata;
+    PointRadius(double nodata): m_nodata(nodata) {}
+    double operator()(Vector3 const& p) const {
+      if (p == Vector3() || p != p)
+        return m_nodata;
+      return norm_2(p);
+    }
+  };
+}
+
+StereoProduct stereoProductType(std::string const& file) {
+
+  std::string name = fs::path(file).filename().string();
+  const char * disp_suffixes[] = {"-D.tif", "-RD.tif", "-B.tif", "-F.tif", "-D_sub.tif"};
+  for (size_t it = 0; it < sizeof(disp_suffixes)/sizeof(disp_suffixes[0]); it++) {
+    if (boost::algorithm::ends_with(name, disp_suffixes[it]) && get_num_channels(file) == 3)
+      return DISPARITY;
+  }
+  if (boost::algorithm::ends_with(name, "-PC.tif") && get_num_channels(file) >= 3)
+    return POINT_CLOUD;
+  return NOT_STEREO_PRODUCT;
+}
+
+std::string stereoProductPreview(std::string const& file, StereoProduct product,
+                                 vw::cartography::GdalWriteOptions const& opt) {
+
+  // Below any disparity and any distance
+  double nodata_val = -std::numeric_limits<float>::max();
+  ImageViewRef<double> preview;
+  std::string suffix;
+  if (product == DISPARITY) {
+    int channel = asp::stereo_settings().disparity_channel;
+    if (channel != 0 && channel != 1)
+      vw_throw(ArgumentErr() << "The disparity channel must be 0 or 1.\n");
+    preview = per_pixel_filter(DiskImageView< PixelMask<Vector2f> >(file),
+                               DisparityChannel(channel, nodata_val));
+    suffix = (channel == 0) ? "_dx.tif" : "_dy.tif";
+  } else if (product == POINT_CLOUD) {
+    preview = per_pixel_filter(asp::read_asp_point_cloud<3>(file), PointRadius(nodata_val));
+    suffix = "_radius.tif";
+  } else {
+    return file;
+  }
+
+  // Write next to the input if possible, else in the current directory
+  bool has_georef = false, has_nodata = true;
+  vw::cartography::GeoReference georef;
+  std::string output_file;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    output_file = (attempt == 0) ? vw::mosaic::filename_from_suffix1(file, suffix) :
+      vw::mosaic::filename_from_suffix2(file, suffix);
+    try {
+      if (vw::mosaic::overwrite_if_no_good(file, output_file, preview.cols(), preview.rows())) {
+        vw_out() << "Writing: " << output_file << std::endl;
+        TerminalProgressCallback tpc("asp", ": ");
+        vw::cartography::block_write_gdal_image(output_file, preview, has_georef, georef,
+                                                has_nodata, nodata_val, opt, tpc);
+      }
+      break;
+    } catch (...) {
+      if (attempt == 1)
+        throw;
+      vw_out() << "Failed to write: " << output_file << "\n";
+    }
+  }
+
+  if (!inPyramidCache(output_file))
+    temporary_files().insert(&output_file, &output_file + 1);
+  return output_file;
+}
+
 DiskImagePyramidMultiChannel::DiskImagePyramidMultiChannel(std::string const& base_file,
                              vw::cartography::GdalWriteOptions const& opt,
                              int top_image_max_pix,
                              int subsample):m_opt(opt),
                                                 m_num_channels(0),
                                                 m_rows(0), m_cols(0),
-                                                m_type(UNINIT){
+                                                m_type(UNINIT),
+                                                m_colormap(false){
   if (base_file == "") return;
 
   // Instantiate the correct DiskImagePyramid then record information including
-  //  the list of temporary files it created.
+  //  the list of temporary files it created. Those in the pyramid cache are kept.
+  bool in_cache = inPyramidCache(base_file);
   try {
-    m_num_channels = get_num_channels(base_file);
+    // A disparity or point cloud is shown through a single channel made from it
+    std::string pyramid_file = base_file;
+    StereoProduct product = stereoProductType(base_file);
+    if (product != NOT_STEREO_PRODUCT) {
+      pyramid_file = stereoProductPreview(base_file, product, opt);
+      in_cache = inPyramidCache(pyramid_file);
+      m_colormap = true;
+    }
+
+    m_num_channels = get_num_channels(pyramid_file);
     if (m_num_channels == 1) {
       // Single channel image with float pixels.
-      m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>(base_file, m_opt);
+      m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>(pyramid_file, m_opt);
       m_rows = m_img_ch1_double.rows();
       m_cols = m_img_ch1_double.cols();
       m_type = CH1_DOUBLE;
-      temporary_files().files.insert(m_img_ch1_double.get_temporary_files().begin(), 
-                                     m_img_ch1_double.get_temporary_files().end());
+      if (!in_cache)
+        temporary_files().insert(m_img_ch1_double.get_temporary_files().begin(),
+                                 m_img_ch1_double.get_temporary_files().end());
     }else if (m_num_channels == 2){
       // uint8 image with an alpha channel.
-      m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 2> >(base_file, m_opt);
+      m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 2> >(pyramid_file, m_opt);
       m_num_channels = 2; // we read only 1 channel
       m_rows = m_img_ch2_uint8.rows();
       m_cols = m_img_ch2_uint8.cols();
       m_type = CH2_UINT8;
-      temporary_files().files.insert(m_img_ch2_uint8.get_temporary_files().begin(), 
-                                     m_img_ch2_uint8.get_temporary_files().end());
+      if (!in_cache)
+        temporary_files().insert(m_img_ch2_uint8.get_temporary_files().begin(),
+                                 m_img_ch2_uint8.get_temporary_files().end());
     } else if (m_num_channels == 3){
       // RGB image with three uint8 channels.
-      m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 3> >(base_file, m_opt);
+      m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 3> >(pyramid_file, m_opt);
       m_num_channels = 3;
       m_rows = m_img_ch3_uint8.rows();
       m_cols = m_img_ch3_uint8.cols();
       m_type = CH3_UINT8;
-      temporary_files().files.insert(m_img_ch3_uint8.get_temporary_files().begin(), 
-                                     m_img_ch3_uint8.get_temporary_files().end());
+      if (!in_cache)
+        temporary_files().insert(m_img_ch3_uint8.get_temporary_files().begin(),
+                                 m_img_ch3_uint8.get_temporary_files().end());
     } else if (m_num_channels == 4){
       // RGB image with three uint8 channels and an alpha channel
-      m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 4> >(base_file, m_opt);
+      m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 4> >(pyramid_file, m_opt);
       m_num_channels = 4;
       m_rows = m_img_ch4_uint8.rows();
       m_cols = m_img_ch4_uint8.cols();
       m_type = CH4_UINT8;
-      temporary_files().files.insert(m_img_ch4_uint8.get_temporary_files().begin(), 
-                                     m_img_ch4_uint8.get_temporary_files().end());
+      if (!in_cache)
+        temporary_files().insert(m_img_ch4_uint8.get_temporary_files().begin(),
+                                 m_img_ch4_uint8.get_temporary_files().end());
     }else{
       vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands.\n");
     }
@@ -926,7 +1299,8 @@ double DiskImagePyramidMultiChannel::get_nodata_val() const {
   
 void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i region_in,
                   bool highlight_nodata,
-                  QImage & qimg, double & scale_out, vw::BBox2i & region_out) const{
+                  QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                  DisplayFilter const& filter) const{
 
   bool scale_pixels = (m_type == CH1_DOUBLE);
   vw::Vector2 bounds;
@@ -939,8 +1313,20 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
     ImageView<double> clip;
     m_img_ch1_double.get_image_clip(scale_in, region_in, clip,
 				    scale_out, region_out);
-    formQimage(highlight_nodata, scale_pixels, m_img_ch1_double.get_nodata_val(), bounds,
-	       clip, qimg);
+    double nodata_val = m_img_ch1_double.get_nodata_val();
+    if (filter.mode == DisplayFilter::THRESHOLD) {
+      nodata_val = std::max(nodata_val, filter.threshold);
+    } else if (filter.mode == DisplayFilter::HILLSHADE) {
+      // The shade is in [0, 1], so -1 is free to mark no-data
+      ImageView<double> shade;
+      hillshadeClip(clip, nodata_val, scale_out*filter.pixel_size,
+                    filter.azimuth, filter.elevation, -1.0, shade);
+      clip = shade;
+      nodata_val = -1.0;
+    }
+    bool colormap = m_colormap && filter.mode != DisplayFilter::HILLSHADE;
+    formQimage(highlight_nodata, scale_pixels, nodata_val, bounds,
+	       clip, qimg, colormap);
   } else if (m_type == CH2_UINT8) {
     ImageView<Vector<vw::uint8, 2> > clip;
     m_img_ch2_uint8.get_image_clip(scale_in, region_in, clip,
@@ -995,6 +1381,53 @@ double DiskImagePyramidMultiChannel::get_value_as_double(int32 x, int32 y) const
   return 0;
 }
 
+namespace {
+  // Look up the pixels in a clip of the given level
+  template <class PixelT, class ChannelF>
+  void values_from_clip(vw::mosaic::DiskImagePyramid<PixelT> const& pyramid,
+                        double scale_in, std::vector<vw::Vector2> const& pix,
+                        ChannelF channel, std::vector<double> & vals, double & scale_out) {
+    BBox2i box;
+    for (size_t it = 0; it < pix.size(); it++) {
+      box.grow(floor(pix[it]));
+      box.grow(ceil(pix[it]) + Vector2(1, 1));
+    }
+    box.crop(BBox2i(0, 0, pyramid.cols(), pyramid.rows()));
+    vals.assign(pix.size(), std::numeric_limits<double>::quiet_NaN());
+    if (box.empty())
+      return;
+
+    ImageView<PixelT> clip;
+    BBox2i region_out;
+    pyramid.get_image_clip(scale_in, box, clip, scale_out, region_out);
+    for (size_t it = 0; it < pix.size(); it++) {
+      Vector2 p = round(pix[it] / scale_out);
+      int x = p.x() - region_out.min().x(), y = p.y() - region_out.min().y();
+      if (x >= 0 && y >= 0 && x < clip.cols() && y < clip.rows())
+        vals[it] = channel(clip(x, y));
+    }
+  }
+
+  double first_channel(double val) { return val; }
+  double first_channel(Vector<vw::uint8, 2> const& val) { return val[0]; }
+}
+
+void DiskImagePyramidMultiChannel::get_values_as_double(double scale_in,
+                                                        std::vector<vw::Vector2> const& pix,
+                                                        std::vector<double> & vals,
+                                                        double & scale_out) const {
+  if (m_type == CH1_DOUBLE) {
+    values_from_clip(m_img_ch1_double, scale_in, pix,
+                     static_cast<double(*)(double)>(first_channel), vals, scale_out);
+  }else if (m_type == CH2_UINT8){
+    values_from_clip(m_img_ch2_uint8, scale_in, pix,
+                     static_cast<double(*)(Vector<vw::uint8, 2> const&)>(first_channel),
+                     vals, scale_out);
+  }else{
+    vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands\n");
+  }
+}
+
 void PointList::push_back(std::list<vw::Vector2> pts) {
   std::list<vw::Vector2>::iterator iter  = pts.begin();
   while (iter != pts.end()) {
@@ -1013,6 +1446,7 @@ void MatchList::throwIfNoPoint(size_t image, size_t point) const {
 }
 
 void MatchList::resize(size_t num_images) {
+  invalidateGrids();
   m_matches.clear();
   m_valid_matches.clear();
   m_matches.resize(num_images);
@@ -1048,6 +1482,7 @@ bool MatchList::addPoint(size_t image, vw::ip::InterestPoint const &pt, bool val
 
   m_matches[image].push_back(pt);
   m_valid_matches[image].push_back(true);
+  invalidateGrids();
   return true;
 }
 
@@ -1089,6 +1524,7 @@ void MatchList::setPointPosition(size_t image, size_t point, float x, float y) {
   throwIfNoPoint(image, point);
   m_matches[image][point].x = x;
   m_matches[image][point].y = y;
+  invalidateGrids();
 }
 
 int MatchList::findNearestMatchPoint(size_t image, vw::Vector2 P, double distLimit) const {
@@ -1100,7 +1536,20 @@ int MatchList::findNearestMatchPoint(size_t image, vw::Vector2 P, double distLim
     min_dist = distLimit;
   int    min_index = -1;
   std::vector<vw::ip::InterestPoint> const& ip = m_matches[image]; // alias
-  for (size_t ip_iter = 0; ip_iter < ip.size(); ip_iter++) {
+
+  // With a limit, only the points near P need to be looked at
+  std::vector<size_t> indices;
+  if (distLimit > 0) {
+    pointsInBox(image, BBox2(P - Vector2(distLimit, distLimit),
+                             P + Vector2(distLimit, distLimit)), indices);
+  } else {
+    indices.resize(ip.size());
+    for (size_t it = 0; it < ip.size(); it++)
+      indices[it] = it;
+  }
+
+  for (size_t it = 0; it < indices.size(); it++) {
+    size_t ip_iter = indices[it];
     Vector2 Q(ip[ip_iter].x, ip[ip_iter].y);
     double curr_dist = norm_2(Q-P);
     if (curr_dist < min_dist) {
@@ -1111,12 +1560,81 @@ int MatchList::findNearestMatchPoint(size_t image, vw::Vector2 P, double distLim
   return min_index;
 }
 
+MatchList::PointGrid const& MatchList::pointGrid(size_t image) const {
+  if (m_grids.size() != m_matches.size())
+    m_grids.assign(m_matches.size(), boost::shared_ptr<PointGrid>());
+  if (m_grids[image])
+    return *m_grids[image];
+
+  boost::shared_ptr<PointGrid> grid(new PointGrid);
+  std::vector<vw::ip::InterestPoint> const& ip = m_matches[image]; // alias
+  for (size_t it = 0; it < ip.size(); it++)
+    grid->box.grow(Vector2(ip[it].x, ip[it].y));
+
+  // About 16 points in a bucket, if they are spread out
+  int num = std::max(1, int(ip.size() / 16));
+  double area = grid->box.empty() ? 0 : grid->box.width() * grid->box.height();
+  grid->cell = std::max(1.0, sqrt(area / num));
+  grid->nx = 1; grid->ny = 1;
+  if (!grid->box.empty()) {
+    grid->nx = std::min(4096, int(grid->box.width()  / grid->cell) + 1);
+    grid->ny = std::min(4096, int(grid->box.height() / grid->cell) + 1);
+  }
+
+  // Count, then place, the points in each bucket
+  std::vector<int> bucket(ip.size());
+  grid->start.assign(grid->nx * grid->ny + 1, 0);
+  for (size_t it = 0; it < ip.size(); it++) {
+    int i = std::min(grid->nx - 1, int((ip[it].x - grid->box.min().x()) / grid->cell));
+    int j = std::min(grid->ny - 1, int((ip[it].y - grid->box.min().y()) / grid->cell));
+    bucket[it] = i + j * grid->nx;
+    grid->start[bucket[it] + 1]++;
+  }
+  for (size_t b = 1; b < grid->start.size(); b++)
+    grid->start[b] += grid->start[b - 1];
+  grid->ids.resize(ip.size());
+  std::vector<int> pos(grid->start.begin(), grid->start.end() - 1);
+  for (size_t it = 0; it < ip.size(); it++)
+    grid->ids[pos[bucket[it]]++] = it;
+
+  m_grids[image] = grid;
+  return *grid;
+}
+
+void MatchList::pointsInBox(size_t image, vw::BBox2 const& box,
+                            std::vector<size_t> & indices) const {
+  indices.clear();
+  if (image >= m_matches.size() || m_matches[image].empty())
+    return;
+
+  PointGrid const& grid = pointGrid(image);
+  std::vector<vw::ip::InterestPoint> const& ip = m_matches[image]; // alias
+  int i0 = std::max(0, int(floor((box.min().x() - grid.box.min().x()) / grid.cell)));
+  int j0 = std::max(0, int(floor((box.min().y() - grid.box.min().y()) / grid.cell)));
+  int i1 = std::min(grid.nx - 1, int(floor((box.max().x() - grid.box.min().x()) / grid.cell)));
+  int j1 = std::min(grid.ny - 1, int(floor((box.max().y() - grid.box.min().y()) / grid.cell)));
+  for (int j = j0; j <= j1; j++) {
+    for (int i = i0; i <= i1; i++) {
+      int b = i + j * grid.nx;
+      for (int k = grid.start[b]; k < grid.start[b + 1]; k++) {
+        size_t id = grid.ids[k];
+        Vector2 P(ip[id].x, ip[id].y);
+        if (P.x() >= box.min().x() && P.x() <= box.max().x() &&
+            P.y() >= box.min().y() && P.y() <= box.max().y())
+          indices.push_back(id);
+      }
+    }
+  }
+  std::sort(indices.begin(), indices.end()); // The order of the points
+}
+
 void MatchList::deletePointsForImage(size_t image) {
   if (image >= m_matches.size() )
     vw_throw(ArgumentErr() << "Image " << image << " does not exist!\n");
 
   m_matches.erase      (m_matches.begin()       + image);
   m_valid_matches.erase(m_valid_matches.begin() + image);
+  invalidateGrids();
 }
 
 bool MatchList::deletePointAcrossImages(size_t point) {
@@ -1138,6 +1656,7 @@ bool MatchList::deletePointAcrossImages(size_t point) {
     m_matches[vec_iter].erase(m_matches[vec_iter].begin() + point);
     m_valid_matches[vec_iter].erase(m_valid_matches[vec_iter].begin() + point);
   }
+  invalidateGrids();
   return true;
 }
 
@@ -1157,6 +1676,7 @@ bool MatchList::allPointsValid() const {
 
 bool MatchList::loadPointsFromGCPs(std::string const gcpPath,
                                    std::vector<std::string> const& imageNames) {
+  invalidateGrids(); // The points are about to change
   using namespace vw::ba;
 
   if (getNumPoints() > 0) // Can't double-load points!
@@ -1210,6 +1730,7 @@ bool MatchList::loadPointsFromGCPs(std::string const gcpPath,
 
 bool MatchList::loadPointsFromVwip(std::vector<std::string> const& vwipFiles,
                                    std::vector<std::string> const& imageNames){
+  invalidateGrids(); // The points are about to change
 
   using namespace vw::ba;
 
@@ -1244,6 +1765,7 @@ void MatchList::setIpValid(size_t image) {
 
 bool MatchList::loadPointsFromMatchFiles(std::vector<std::string> const& matchFiles,
                                          std::vector<size_t     > const& leftIndices) {
+  invalidateGrids(); // The points are about to change
 
   // Count IP as in the same location if x and y are at least this close.
   const float ALLOWED_POS_DIFF = 0.5;
@@ -1279,7 +1801,7 @@ bool MatchList::loadPointsFromMatchFiles(std::vector<std::string> const& matchFi
       //std::cout << "For image index " << i
       //          << ", reading matches from file " << match_file 
       //          << ", matching to index " << j << std::endl;
-      ip::read_binary_match_file(match_file, left, right);
+      asp::read_match_file(match_file, left, right);
     }catch(...){
       vw_out() << "IP load failed, leaving default invalid IP\n";
       continue;
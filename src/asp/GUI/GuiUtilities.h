@@ -25,6 +25,7 @@
 
 #include <string>
 #include <vector>
+#include <limits>
 #include <list>
 #include <set>
 
@@ -78,12 +79,21 @@ namespace vw { namespace gui {
   /// A global structure to hold all the temporary files we have created
   struct TemporaryFiles {
     std::set<std::string> files;
+    vw::Mutex mutex; // Images are loaded in parallel
+
+    template <class IterT>
+    void insert(IterT begin, IterT end) {
+      vw::Mutex::Lock lock(mutex);
+      files.insert(begin, end);
+    }
   };
   /// Access the global list of temporary files
   TemporaryFiles& temporary_files();
 
-  // Pop-up a window with given message
+  // Pop-up a window with given message. From a thread other than the
+  // GUI thread, the message is kept until showPendingPopUps() is called.
   void popUp(std::string msg);
+  void showPendingPopUps();
 
   bool getStringFromGui(QWidget * parent,
 			std::string title, std::string description,
@@ -113,11 +123,13 @@ namespace vw { namespace gui {
   // and handle the nodata val. For two channel images, interpret the
   // second channel as mask. If there are 3 or more channels,
   // interpret those as RGB.
+  // With the colormap, scalar images are shown in colors from blue
+  // through green to red, rather than in shades of gray.
   template<class PixelT>
   typename boost::enable_if<boost::is_same<PixelT,double>, void>::type
   formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
 	     vw::Vector2 const& bounds,
-             ImageView<PixelT> const& clip, QImage & qimg);
+             ImageView<PixelT> const& clip, QImage & qimg, bool colormap = false);
 
   template<class PixelT>
   typename boost::enable_if<boost::is_same<PixelT, vw::Vector<vw::uint8, 2> >, void>::type
@@ -141,11 +153,29 @@ namespace vw { namespace gui {
   /// Convert a BBox2 object to a QRect object.
   QRect bbox2qrect(BBox2 const& B);
 
-  /// Save a hillshaded file
-  bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                       double azimuth, double elevation,
-                       std::string const& input_file,
-                       std::string      & output_file);
+  /// The size of a pixel on the ground, in meters, along the image
+  /// columns and rows, near the given pixel.
+  vw::Vector2 georefPixelSize(vw::cartography::GeoReference const& georef,
+                              vw::Vector2 const& pix);
+
+  /// Hillshade a DEM clip with the given pixel size in meters. The
+  /// result is in [0, 1], and out_nodata where the slope is not known.
+  void hillshadeClip(ImageView<double> const& dem, double nodata_val,
+                     vw::Vector2 const& pixel_size, double azimuth, double elevation,
+                     double out_nodata, ImageView<double> & shade);
+
+  /// How to show the pixels of a single-channel image. Hillshading and
+  /// thresholding are applied to each clip when it is fetched, so
+  /// changing them writes no files.
+  struct DisplayFilter {
+    enum Mode { NONE, HILLSHADE, THRESHOLD };
+    Mode        mode;
+    double      azimuth, elevation; // Of the light, in degrees
+    vw::Vector2 pixel_size;         // At full resolution, in meters
+    double      threshold;          // Pixels at or below this are shown as no-data
+    DisplayFilter(): mode(NONE), azimuth(0), elevation(0), pixel_size(1, 1),
+                     threshold(-std::numeric_limits<double>::max()) {}
+  };
 
   // Given an image, and an input file name, modify the filename using
   // a prefix. Write the image to that filename. If that fails, create
@@ -228,6 +258,7 @@ namespace vw { namespace gui {
     int m_num_channels;
     int m_rows, m_cols;
     ImgType m_type; // keeps track of which of the above images we use
+    bool m_colormap; // Show in color, as done for disparities and point clouds
 
     // Constructor
     DiskImagePyramidMultiChannel(std::string const& base_file = "",
@@ -239,7 +270,8 @@ namespace vw { namespace gui {
     // How we create it, depends on the type of image we want to display.
     void get_image_clip(double scale_in, vw::BBox2i region_in,
                       bool highlight_nodata,
-                      QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
+                      QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                      DisplayFilter const& filter = DisplayFilter()) const;
     double get_nodata_val() const;
     
     int32 cols  () const { return m_cols;  }
@@ -250,10 +282,33 @@ namespace vw { namespace gui {
     /// - Only works for single channel pyramids!
     double get_value_as_double( int32 x, int32 y) const;
 
+    /// The values at these full-resolution pixels, read from the pyramid
+    /// level for the given scale with one clip, so the pixels should be
+    /// close together. The scale of the level used is returned.
+    /// - Only works for the same pyramids as get_value_as_double().
+    void get_values_as_double(double scale_in, std::vector<vw::Vector2> const& pix,
+                              std::vector<double> & vals, double & scale_out) const;
+
     // Return value as string
     std::string get_value_as_str( int32 x, int32 y) const;
   };
 
+  /// Stereo outputs which are shown through a single-channel preview,
+  /// rather than as they are on disk.
+  enum StereoProduct { NOT_STEREO_PRODUCT, DISPARITY, POINT_CLOUD };
+
+  /// Tell from the name and number of channels if a file is a disparity,
+  /// such as run-D.tif or run-F.tif, or a point cloud, run-PC.tif.
+  StereoProduct stereoProductType(std::string const& file);
+
+  /// Write next to a disparity its channel chosen with --disparity-channel,
+  /// and next to a point cloud the distance of each point from the planet
+  /// center, with invalid pixels as no-data, and return the name of that
+  /// file. It is made again only if the input is newer. This is what the
+  /// pyramid is made of, so no other full-resolution pass is needed.
+  std::string stereoProductPreview(std::string const& file, StereoProduct product,
+                                   vw::cartography::GdalWriteOptions const& opt);
+
   /// A class to keep all data associated with an image file
   struct imageData{
     std::string      name;
@@ -272,6 +327,34 @@ namespace vw { namespace gui {
     bool isPoly() const { return asp::has_shp_extension(name); }
   };
 
+  /// Whether this is an http, https, or ftp URL, or a GDAL /vsi path,
+  /// such as /vsis3/bucket/image.tif.
+  bool isRemoteImage(std::string const& image_file);
+
+  /// For a remote image, write a local VRT file which refers to it, and
+  /// return its name. GDAL then fetches only the parts of the image being
+  /// read, with HTTP range requests. The pyramid of the image is made next
+  /// to the VRT, in the pyramid cache if there is one. A local image is
+  /// returned as is.
+  std::string localImageFile(std::string const& image_file);
+
+  /// With --pyramid-cache-dir, return the file in the cache through
+  /// which the pyramid of this image is made, so that the pyramid levels
+  /// are written next to it. Else return the image itself.
+  std::string pyramidCacheFile(std::string const& image_file);
+
+  /// Remove the pyramids in the cache used least recently, until the
+  /// cache fits in --pyramid-cache-size. Those used by this process stay.
+  void prunePyramidCache();
+
+  /// Load several images, with their pyramids built in parallel, using
+  /// up to opt.num_threads threads. The first error, in the order of the
+  /// images, is thrown once all are done.
+  void readImagesInParallel(std::vector<std::string> const& image_files,
+                            vw::cartography::GdalWriteOptions const& opt,
+                            bool use_georef,
+                            std::vector<imageData> & images);
+
   // QT conversion functions
   vw::Vector2 QPoint2Vec(QPoint      const& qpt);
   QPoint      Vec2QPoint(vw::Vector2 const& V  );
@@ -356,6 +439,11 @@ namespace vw { namespace gui {
     /// - If distLimit is set, return -1 if best match distance is over the limit.
     int findNearestMatchPoint(size_t image, vw::Vector2 P, double distLimit) const;
 
+    /// The indices of the points of an image in the given box. This uses
+    /// a grid over the points, made when first needed after a change.
+    void pointsInBox(size_t image, vw::BBox2 const& box,
+                     std::vector<size_t> & indices) const;
+
     /// Delete all IP for an image.
     void deletePointsForImage(size_t image);
 
@@ -394,6 +482,17 @@ namespace vw { namespace gui {
     /// Set all IP for the image as valid.
     void setIpValid(size_t image);
 
+    /// Buckets of points on a regular grid, stored one bucket after another
+    struct PointGrid {
+      vw::BBox2 box;
+      double    cell;
+      int       nx, ny;
+      std::vector<int>    start; // Where each bucket begins in 'ids'
+      std::vector<size_t> ids;
+    };
+    PointGrid const& pointGrid(size_t image) const;
+    void invalidateGrids() { m_grids.clear(); }
+
     /// A set of interest points for each input image
     /// - There is always one set of matched interest points shared among all images.
     /// - The only way the counts can differ is if the user is in the process of manually
@@ -403,17 +502,29 @@ namespace vw { namespace gui {
     /// Stay synced with m_matches, set to false if that match is not 
     std::vector<std::vector<bool> > m_valid_matches;
 
+    /// Made when needed for each image, and cleared when the points change
+    mutable std::vector< boost::shared_ptr<PointGrid> > m_grids;
+
   }; // End class MatchList
 
 //====================================================================================
 //====================================================================================
 // Function definitions
 
+/// The colormap color for a value in [0, 1]
+inline QRgb colormapColor(double t) {
+  t = std::min(std::max(t, 0.0), 1.0);
+  double r = std::min(std::max(1.5 - std::abs(4*t - 3), 0.0), 1.0);
+  double g = std::min(std::max(1.5 - std::abs(4*t - 2), 0.0), 1.0);
+  double b = std::min(std::max(1.5 - std::abs(4*t - 1), 0.0), 1.0);
+  return qRgba(round(255*r), round(255*g), round(255*b), 255);
+}
+
 template<class PixelT>
 typename boost::enable_if<boost::is_same<PixelT,double>, void>::type
 formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
 	   vw::Vector2 const& bounds,
-           ImageView<PixelT> const& clip, QImage & qimg){
+           ImageView<PixelT> const& clip, QImage & qimg, bool colormap){
 
   double min_val = std::numeric_limits<double>::max();
   double max_val = -std::numeric_limits<double>::max();
@@ -460,6 +571,8 @@ formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
           qimg.setPixel(col, row, qRgb(255, 0, 0));
         }
         
+      }else if (colormap){
+        qimg.setPixel(col, row, colormapColor(v/255.0));
       }else{
         // opaque
         qimg.setPixel(col, row, QColor(v, v, v, 255).rgba());
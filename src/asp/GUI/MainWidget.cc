@@ -23,6 +23,7 @@
 
 #include <string>
 #include <vector>
+#include <sstream>
 #include <QtGui>
 #include <QtWidgets>
 
@@ -181,10 +182,12 @@ namespace vw { namespace gui {
       m_image_files(image_files), 
       m_matchlist(matches),  m_editMatchPointVecIndex(editMatchPointVecIndex),
       m_use_georef(use_georef),
+      m_profileOnePoint(false), m_profile_generation(0), m_refined_generation(-1),
       m_view_matches(view_matches), m_zoom_all_to_same_region(zoom_all_to_same_region),
       m_allowMultipleSelections(allowMultipleSelections), m_can_emit_zoom_all_signal(false),
       m_polyEditMode(false), m_polyVecIndex(0),
-      m_pixelTol(6), m_backgroundColor(QColor("black")) {
+      m_pixelTol(6), m_backgroundColor(QColor("black")),
+      m_render_stop(false), m_refresh_posted(false), m_render_generation(0) {
 
     installEventFilter(this);
 
@@ -231,8 +234,12 @@ namespace vw { namespace gui {
     m_filesOrder.resize(num_images);
     m_world2image_geotransforms.resize(num_images);
     m_image2world_geotransforms.resize(num_images);
+
+    // Building the pyramids of many large images takes a while, so
+    // build them in parallel.
+    readImagesInParallel(image_files, m_opt, m_use_georef, m_images);
+
     for (int i = 0; i < num_images; i++){
-      m_images[i].read(image_files[i], m_opt, m_use_georef);
 
       // Read the base image, if different from the current image
       if (i == 0){
@@ -372,6 +379,13 @@ namespace vw { namespace gui {
 
 
   MainWidget::~MainWidget() {
+    {
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+      m_render_stop = true;
+    }
+    m_render_cv.notify_all();
+    if (m_render_thread.joinable())
+      m_render_thread.join();
   }
 
   bool MainWidget::eventFilter(QObject *obj, QEvent *E){
@@ -609,43 +623,15 @@ namespace vw { namespace gui {
       return;
     }
 
+    // The threshold is applied as the pixels are fetched. Check that it can be.
     int num_images = m_images.size();
-    m_shadow_thresh_images.clear(); // wipe the old copy
-    m_shadow_thresh_images.resize(num_images);
-
-    // Create the thresholded images and save them to disk. We have to do it each
-    // time as perhaps the shadow threshold changed.
     for (int image_iter = 0; image_iter < num_images; image_iter++) {
-      std::string input_file = m_image_files[image_iter];
-
-      double nodata_val = -std::numeric_limits<double>::max();
-      vw::read_nodata_val(input_file, nodata_val);
-      nodata_val = std::max(nodata_val, m_shadow_thresh);
-
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         popUp("Thresholding makes sense only for single-channel images.");
         m_shadow_thresh_view_mode = false;
         return;
       }
-
-      ImageViewRef<double> thresh_image
-        = apply_mask(create_mask_less_or_equal(DiskImageView<double>(input_file),
-                                               nodata_val), nodata_val);
-
-      std::string suffix = "_thresh.tif";
-      bool has_georef = false;
-      bool has_nodata = true;
-      vw::cartography::GeoReference georef;
-      std::string output_file
-        = write_in_orig_or_curr_dir(m_opt,
-                                    thresh_image, input_file, suffix,
-                                    has_georef,  georef,
-                                    has_nodata, nodata_val);
-
-      // Read it back right away
-      m_shadow_thresh_images[image_iter].read(output_file, m_opt, m_use_georef);
-      temporary_files().files.insert(output_file);
     }
 
     // We may not want to refresh the pixmap right away if we are going to
@@ -656,12 +642,8 @@ namespace vw { namespace gui {
 
   void MainWidget::maybeGenHillshade(){
 
+    // Hillshading is done as the pixels are fetched. Check that it can be done.
     int num_images = m_images.size();
-    m_hillshaded_images.clear(); // wipe the old copy
-    m_hillshaded_images.resize(num_images);
-
-    // Create the hillshaded images and save them to disk. We have to do
-    // it each time as perhaps the hillshade parameters changed.
     for (int image_iter = 0; image_iter < num_images; image_iter++) {
 
       if (!m_hillshade_mode[image_iter]) continue;
@@ -672,28 +654,12 @@ namespace vw { namespace gui {
         return;
       }
 
-      std::string input_file = m_image_files[image_iter];
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         popUp("Hill-shading makes sense only for single-channel images.");
         m_hillshade_mode[image_iter] = false;
         return;
       }
-
-      // Save the hillshaded images to disk
-      std::string hillshaded_file;
-      bool success = write_hillshade(m_opt,
-                                     m_hillshade_azimuth,
-                                     m_hillshade_elevation,
-                                     input_file, hillshaded_file);
-      if (!success) {
-        m_hillshade_mode[image_iter] = false;
-        return;
-      }
-
-      vw_out() << "Reading: " << hillshaded_file << std::endl;
-      m_hillshaded_images[image_iter].read(hillshaded_file, m_opt, m_use_georef);
-      temporary_files().files.insert(hillshaded_file);
     }
   }
 
@@ -955,7 +921,6 @@ namespace vw { namespace gui {
       if (m_images[i].isPoly())
         continue;
       
-      QImage qimg;
       // Since the image portion contained in image_box could be huge,
       // but the screen area small, render a sub-sampled version of
       // the image for speed.
@@ -963,96 +928,268 @@ namespace vw { namespace gui {
       // when multiplying large integers.
       double scale = sqrt((1.0*image_box.width()) * image_box.height())/
         std::max(1.0, sqrt((1.0*screen_box.width()) * screen_box.height()));
-      double scale_out;
-      BBox2i region_out;
       bool   highlight_nodata = m_shadow_thresh_view_mode;
       if (!std::isnan(asp::stereo_settings().nodata_value)) {
         // When the user specifies --nodata-value, we will show
         // nodata pixels as transparent.
         highlight_nodata = false;
       }
-      
-      if (m_shadow_thresh_view_mode){
-        m_shadow_thresh_images[i].img.get_image_clip(scale, image_box,
-                                                     highlight_nodata,
-                                                     qimg, scale_out, region_out);
-      }else if (m_hillshade_mode[i]){
-        m_hillshaded_images[i].img.get_image_clip(scale, image_box,
-                                                  highlight_nodata,
-                                                  qimg, scale_out, region_out);
-      }else{
-        // Original images
-        m_images[i].img.get_image_clip(scale, image_box,
-                                       highlight_nodata,
-                                       qimg, scale_out, region_out);
+
+      DisplayFilter filter;
+      if (m_shadow_thresh_view_mode) {
+        filter.mode      = DisplayFilter::THRESHOLD;
+        filter.threshold = m_shadow_thresh;
+      } else if (m_hillshade_mode[i]) {
+        filter.mode       = DisplayFilter::HILLSHADE;
+        filter.azimuth    = m_hillshade_azimuth;
+        filter.elevation  = m_hillshade_elevation;
+        filter.pixel_size = georefPixelSize(m_images[i].georef,
+                                            m_images[i].image_bbox.center());
       }
 
-      // Draw on image screen
-      if (!m_use_georef){
-        // This is a regular image, no georeference, just pass it to the QT painter
-        QRect rect(screen_box.min().x(), screen_box.min().y(),
-                   screen_box.width(), screen_box.height());
-        paint->drawImage (rect, qimg);
-      }else{
-        // We fetched a bunch of pixels at some scale.
-        // Need to place them on the screen at given projected position.
-        // - To do that we will fill up this QImage object with interpolated data, then paint it.
-        QImage qimg2 = QImage(screen_box.width(), screen_box.height(),
-                              QImage::Format_ARGB32_Premultiplied);
-
-        // Initialize all pixels to transparent
-        for (int col = 0; col < qimg2.width(); col++) {
-          for (int row = 0; row < qimg2.height(); row++) {
-            qimg2.setPixel(col, row,  QColor(0, 0, 0, 0).rgba());
-          }
+      bool exact = false;
+      std::vector<ImageClip const*> clips
+        = getImageClips(m_images[i], filter, scale, image_box, highlight_nodata, exact);
+      for (size_t c = 0; c < clips.size(); c++)
+        drawImageClip(paint, i, screen_box, clips[c]->qimg, clips[c]->scale_out,
+                      clips[c]->region_out, exact);
+
+    } // End loop through input images
+
+    return;
+  } // End function drawImage()
+
+
+  void MainWidget::drawImageClip(QPainter* paint, int i, BBox2i const& screen_box,
+                                 QImage const& qimg, double scale_out,
+                                 BBox2i const& region_out, bool exact) {
+
+    // Draw on image screen
+    if (!m_use_georef){
+      // This is a regular image, no georeference, just pass it to the QT painter
+      QRect rect(screen_box.min().x(), screen_box.min().y(),
+                 screen_box.width(), screen_box.height());
+      if (!exact) {
+        // A clip of some other region, placed where its pixels go
+        BBox2 clip_box(scale_out*Vector2(region_out.min()),
+                       scale_out*Vector2(region_out.max()));
+        BBox2 S = world2screen(MainWidget::image2world(clip_box, i));
+        rect = QRect(round(S.min().x()), round(S.min().y()),
+                     round(S.width()), round(S.height()));
+      }
+      paint->drawImage (rect, qimg);
+    }else{
+      // We fetched a bunch of pixels at some scale.
+      // Need to place them on the screen at given projected position.
+      // - To do that we will fill up this QImage object with interpolated data, then paint it.
+      QImage qimg2 = QImage(screen_box.width(), screen_box.height(),
+                            QImage::Format_ARGB32_Premultiplied);
+
+      // Initialize all pixels to transparent
+      for (int col = 0; col < qimg2.width(); col++) {
+        for (int row = 0; row < qimg2.height(); row++) {
+          qimg2.setPixel(col, row,  QColor(0, 0, 0, 0).rgba());
         }
+      }
 
-        // Loop through pixels
-        for (int x = screen_box.min().x(); x < screen_box.max().x(); x++){
-          for (int y = screen_box.min().y(); y < screen_box.max().y(); y++){
-
-            // Convert from a pixel as seen on screen to the world coordinate system.
-            Vector2 world_pt = screen2world(Vector2(x, y));
-
-            // p is in pixel coordinates of m_images[i]
-            Vector2 p;
-            try {
-              p = MainWidget::world2image(world_pt, i);
-              bool is_in = (p[0] >= 0 && p[0] <= m_images[i].img.cols()-1 &&
-                            p[1] >= 0 && p[1] <= m_images[i].img.rows()-1 );
-              if (!is_in) continue; // out of range
-            }catch ( const std::exception & e ) {
-              continue;
-            }
+      // Loop through pixels
+      for (int x = screen_box.min().x(); x < screen_box.max().x(); x++){
+        for (int y = screen_box.min().y(); y < screen_box.max().y(); y++){
+
+          // Convert from a pixel as seen on screen to the world coordinate system.
+          Vector2 world_pt = screen2world(Vector2(x, y));
+
+          // p is in pixel coordinates of m_images[i]
+          Vector2 p;
+          try {
+            p = MainWidget::world2image(world_pt, i);
+            bool is_in = (p[0] >= 0 && p[0] <= m_images[i].img.cols()-1 &&
+                          p[1] >= 0 && p[1] <= m_images[i].img.rows()-1 );
+            if (!is_in) continue; // out of range
+          }catch ( const std::exception & e ) {
+            continue;
+          }
 
-            // Convert to scaled image pixels and snap to integer value
-            p = round(p/scale_out);
+          // Convert to scaled image pixels and snap to integer value
+          p = round(p/scale_out);
 
-            if (!region_out.contains(p)) continue; // out of range again
+          if (!region_out.contains(p)) continue; // out of range again
 
-            int px = p.x() - region_out.min().x();
-            int py = p.y() - region_out.min().y();
-            if (px < 0 || py < 0 || px >= qimg.width() || py >= qimg.height() ){
-              vw_out() << "Book-keeping failure!";
-              vw_throw(ArgumentErr() << "Book-keeping failure.\n");
-            }
-            qimg2.setPixel(x-screen_box.min().x(), // Fill the temp QImage object
-                           y-screen_box.min().y(),
-                           qimg.pixel(px, py));
+          int px = p.x() - region_out.min().x();
+          int py = p.y() - region_out.min().y();
+          if (px < 0 || py < 0 || px >= qimg.width() || py >= qimg.height() ){
+            vw_out() << "Book-keeping failure!";
+            vw_throw(ArgumentErr() << "Book-keeping failure.\n");
           }
-        } // End loop through pixels
+          qimg2.setPixel(x-screen_box.min().x(), // Fill the temp QImage object
+                         y-screen_box.min().y(),
+                         qimg.pixel(px, py));
+        }
+      } // End loop through pixels
+
+      // Send the temp QImage object to the painter
+      QRect rect(screen_box.min().x(), screen_box.min().y(),
+                 screen_box.width(), screen_box.height());
+      paint->drawImage (rect, qimg2);
+    }
+  }
+
+  std::vector<MainWidget::ImageClip const*>
+  MainWidget::getImageClips(imageData const& image, DisplayFilter const& filter,
+                            double scale, BBox2i const& image_box,
+                            bool highlight_nodata, bool & exact) {
+
+    // Clips for other display modes are kept, to show them right away when
+    // switching back, but not too many.
+    if (m_image_clips.size() > 4*m_images.size() + 4)
+      clearImageClips();
+
+    // Take in the clips which arrived
+    {
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+      for (auto it = m_rendered_clips.begin(); it != m_rendered_clips.end(); it++) {
+        if (it->first.generation != m_render_generation)
+          continue; // The images changed since this was asked for
+        ImageClips & clips = m_image_clips[it->first.key];
+        clips.fine     = it->second;
+        clips.has_fine = true;
+      }
+      m_rendered_clips.clear();
+    }
+
+    std::ostringstream os;
+    os.precision(17);
+    os << image.name << " " << highlight_nodata << " " << filter.mode;
+    if (filter.mode == DisplayFilter::THRESHOLD)
+      os << " " << filter.threshold;
+    else if (filter.mode == DisplayFilter::HILLSHADE)
+      os << " " << filter.azimuth << " " << filter.elevation;
+    std::string key = os.str();
+    ImageClips & clips = m_image_clips[key];
+
+    std::vector<ImageClip const*> ans;
+    exact = (clips.has_fine && clips.fine.scale == scale && clips.fine.region == image_box);
+    if (exact) {
+      ans.push_back(&clips.fine);
+      return ans;
+    }
+
+    if (clips.coarse.qimg.isNull()) {
+      // The coarsest level of the pyramid, for the whole image. This is
+      // small, so it is fetched right away.
+      clips.coarse.region = BBox2i(0, 0, image.img.cols(), image.img.rows());
+      clips.coarse.scale  = std::max(image.img.cols(), image.img.rows());
+      image.img.get_image_clip(clips.coarse.scale, clips.coarse.region, highlight_nodata,
+                               clips.coarse.qimg, clips.coarse.scale_out,
+                               clips.coarse.region_out, filter);
+    }
+    ans.push_back(&clips.coarse);
+    if (clips.has_fine)
+      ans.push_back(&clips.fine);
+
+    if (clips.requested_scale == scale && clips.requested_region == image_box)
+      return ans; // Already asked for
+
+    clips.requested_scale  = scale;
+    clips.requested_region = image_box;
+    {
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+
+      // Only the latest view of each image is of interest
+      for (auto it = m_clip_requests.begin(); it != m_clip_requests.end(); it++) {
+        if (it->key == key) {
+          m_clip_requests.erase(it);
+          break;
+        }
+      }
+      ClipRequest req;
+      req.key              = key;
+      req.generation       = m_render_generation;
+      req.img              = image.img;
+      req.filter           = filter;
+      req.scale            = scale;
+      req.region           = image_box;
+      req.highlight_nodata = highlight_nodata;
+      m_clip_requests.push_back(req);
+
+      if (!m_render_thread.joinable())
+        m_render_thread = std::thread(&MainWidget::renderClips, this);
+    }
+    m_render_cv.notify_one();
+
+    return ans;
+  }
+
+  void MainWidget::clearImageClips() {
+    m_image_clips.clear();
+    std::lock_guard<std::mutex> lock(m_render_mutex);
+    m_render_generation++;
+    m_clip_requests.clear();
+    m_rendered_clips.clear();
+  }
+
+  void MainWidget::renderClips() {
+    while (1) {
+      ClipRequest req;
+      {
+        std::unique_lock<std::mutex> lock(m_render_mutex);
+        m_render_cv.wait(lock, [this]{
+            return m_render_stop || !m_clip_requests.empty() || !m_render_jobs.empty(); });
+        if (m_render_stop)
+          return;
+        if (!m_render_jobs.empty()) {
+          std::function<void()> job = m_render_jobs.front();
+          m_render_jobs.pop_front();
+          lock.unlock();
+          try {
+            job();
+          } catch (const std::exception & e) {
+            vw_out() << e.what() << std::endl;
+          }
+          continue;
+        }
+        req = m_clip_requests.front();
+        m_clip_requests.pop_front();
+      }
 
-        // Send the temp QImage object to the painter
-        QRect rect(screen_box.min().x(), screen_box.min().y(),
-                   screen_box.width(), screen_box.height());
-        paint->drawImage (rect, qimg2);
+      ImageClip clip;
+      clip.scale  = req.scale;
+      clip.region = req.region;
+      try {
+        req.img.get_image_clip(req.scale, req.region, req.highlight_nodata,
+                               clip.qimg, clip.scale_out, clip.region_out, req.filter);
+      } catch (const std::exception & e) {
+        vw_out() << e.what() << std::endl;
+        continue;
       }
 
-    } // End loop through input images
+      // Refresh the display once for all the clips which arrive meanwhile
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+      m_rendered_clips.push_back(std::make_pair(req, clip));
+      if (!m_refresh_posted) {
+        m_refresh_posted = true;
+        QMetaObject::invokeMethod(this, "renderedClipReady", Qt::QueuedConnection);
+      }
+    }
+  }
 
-    return;
-  } // End function drawImage()
+  void MainWidget::addRenderJob(std::function<void()> const& job) {
+    {
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+      m_render_jobs.push_back(job);
+      if (!m_render_thread.joinable())
+        m_render_thread = std::thread(&MainWidget::renderClips, this);
+    }
+    m_render_cv.notify_one();
+  }
 
+  void MainWidget::renderedClipReady() {
+    {
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+      m_refresh_posted = false;
+    }
+    refreshPixmap();
+  }
 
   void MainWidget::drawInterestPoints(QPainter* paint){
 
@@ -1081,26 +1218,36 @@ namespace vw { namespace gui {
     // Needed for image2word
     size_t trans_image_id = getTransformImageIndex();
 
-    // For each IP...
-    for (size_t ip_iter = 0; ip_iter < m_matchlist.getNumPoints(m_image_id); ip_iter++) {
-      // Generate the pixel coord of the point
-      Vector2 pt    = m_matchlist.getPointCoord(m_image_id, ip_iter);
-      Vector2 world = MainWidget::image2world(pt, static_cast<int>(trans_image_id));
-      Vector2 P     = world2screen(world);
-
-      // Do not draw points that are outside the viewing area
-      if (P.x() < 0 || P.x() > m_window_width ||
-          P.y() < 0 || P.y() > m_window_height) {
-        continue;
-      }
-      
+    // Only the points in view are looked at
+    std::vector<size_t> indices;
+    try {
+      BBox2 view_box = MainWidget::world2image(m_current_view, static_cast<int>(trans_image_id));
+      m_matchlist.pointsInBox(m_image_id, view_box, indices);
+    } catch (const std::exception & e) {
+      indices.resize(m_matchlist.getNumPoints(m_image_id));
+      for (size_t it = 0; it < indices.size(); it++)
+        indices[it] = it;
+    }
+
+    // With very many points in view, show how many fall in each screen
+    // cell instead of each point. Points being edited are still shown.
+    const int MAX_POINTS_TO_DRAW = 20000, CELL_SIZE = 8;
+    bool draw_density = (int(indices.size()) > MAX_POINTS_TO_DRAW);
+    int  num_cols = m_window_width / CELL_SIZE + 1, num_rows = m_window_height / CELL_SIZE + 1;
+    std::vector<int> valid_counts, invalid_counts;
+    if (draw_density) {
+      valid_counts.assign(num_cols * num_rows, 0);
+      invalid_counts.assign(num_cols * num_rows, 0);
+    }
+
+    auto draw_point = [&](size_t ip_iter, Vector2 const& P) {
       paint->setPen(ipColor); // The default IP color
 
       if (!m_matchlist.isPointValid(m_image_id, ip_iter))
         paint->setPen(ipInvalidColor);
 
       // Highlighting the last point
-      if (highlight_last && (ip_iter == m_matchlist.getNumPoints(m_image_id)-1)) 
+      if (highlight_last && (ip_iter == m_matchlist.getNumPoints(m_image_id)-1))
         paint->setPen(ipAddHighlightColor);
 
       if (static_cast<int>(ip_iter) == m_editMatchPointVecIndex)
@@ -1108,8 +1255,60 @@ namespace vw { namespace gui {
 
       QPoint Q(P.x(), P.y());
       paint->drawEllipse(Q, 2, 2); // Draw the point!
+    };
+
+    // For each IP...
+    std::vector< std::pair<size_t, Vector2> > on_top;
+    for (size_t it = 0; it < indices.size(); it++) {
+      size_t ip_iter = indices[it];
+
+      // Generate the pixel coord of the point
+      Vector2 pt    = m_matchlist.getPointCoord(m_image_id, ip_iter);
+      Vector2 world = MainWidget::image2world(pt, static_cast<int>(trans_image_id));
+      Vector2 P     = world2screen(world);
+
+      // Do not draw points that are outside the viewing area
+      if (P.x() < 0 || P.x() > m_window_width ||
+          P.y() < 0 || P.y() > m_window_height) {
+        continue;
+      }
+
+      if (!draw_density) {
+        draw_point(ip_iter, P);
+        continue;
+      }
+
+      if ((highlight_last && (ip_iter == m_matchlist.getNumPoints(m_image_id)-1)) ||
+          static_cast<int>(ip_iter) == m_editMatchPointVecIndex) {
+        on_top.push_back(std::make_pair(ip_iter, P));
+        continue;
+      }
+      int cell = int(P.x() / CELL_SIZE) + num_cols * int(P.y() / CELL_SIZE);
+      if (m_matchlist.isPointValid(m_image_id, ip_iter))
+        valid_counts[cell]++;
+      else
+        invalid_counts[cell]++;
 
     } // End loop through points
+
+    if (draw_density) {
+      // More opaque cells have more points, on a log scale
+      int max_count = 1;
+      for (size_t c = 0; c < valid_counts.size(); c++)
+        max_count = std::max(max_count, valid_counts[c] + invalid_counts[c]);
+      for (int row = 0; row < num_rows; row++) {
+        for (int col = 0; col < num_cols; col++) {
+          int c = col + row * num_cols, count = valid_counts[c] + invalid_counts[c];
+          if (count == 0)
+            continue;
+          QColor color = (valid_counts[c] > 0) ? ipColor : ipInvalidColor;
+          color.setAlpha(64 + int(191 * log(1.0 + count) / log(1.0 + max_count)));
+          paint->fillRect(col * CELL_SIZE, row * CELL_SIZE, CELL_SIZE, CELL_SIZE, color);
+        }
+      }
+      for (size_t it = 0; it < on_top.size(); it++)
+        draw_point(on_top[it].first, on_top[it].second);
+    }
   } // End function drawInterestPoints
 
 
@@ -1321,6 +1520,39 @@ namespace vw { namespace gui {
 
   // We assume the user picked n points in the image.
   // Draw n-1 segments in between them. Plot the obtained profile.
+  // Sample every stride-th of the given full-resolution pixels at the
+  // pyramid level for the given scale. Nearby pixels are read together.
+  void MainWidget::sampleProfile(DiskImagePyramidMultiChannel const& img,
+                                 std::vector<Vector2> const& samples, size_t stride,
+                                 double scale,
+                                 std::vector<double> & valsX,
+                                 std::vector<double> & valsY) const {
+    const size_t CHUNK_SIZE = 256;
+    double nodata_val = img.get_nodata_val();
+    valsX.clear(); valsY.clear();
+    std::vector<Vector2> chunk;
+    std::vector<double>  chunk_x, chunk_vals;
+    for (size_t it = 0; it < samples.size(); it += stride) {
+      chunk.push_back(samples[it]);
+      chunk_x.push_back(it);
+      if (chunk.size() < CHUNK_SIZE && it + stride < samples.size())
+        continue;
+
+      double scale_out = 1.0;
+      img.get_values_as_double(scale, chunk, chunk_vals, scale_out);
+      for (size_t c = 0; c < chunk.size(); c++) {
+        double pixel_val = chunk_vals[c];
+        // TODO: Deal with this NAN
+        if (pixel_val == nodata_val)
+          pixel_val = std::numeric_limits<double>::quiet_NaN();
+        valsX.push_back(chunk_x[c]);
+        valsY.push_back(pixel_val);
+      }
+      chunk.clear();
+      chunk_x.clear();
+    }
+  }
+
   void MainWidget::plotProfile(std::vector<imageData> const& images,
                                // indices in the image to profile
                                std::vector<double> const& profileX, 
@@ -1333,11 +1565,9 @@ namespace vw { namespace gui {
       m_profilePlot = new ProfilePlotter(this);
 
     int imgInd = 0; // just one image is present
-    double nodata_val = images[imgInd].img.get_nodata_val();
-    
-    m_valsX.clear(); m_valsY.clear();
-    int count = 0;
-    
+
+    // The full-resolution pixels along the profile
+    std::vector<Vector2> samples;
     int num_pts = profileX.size();
     for (int pt_iter = 0; pt_iter < num_pts; pt_iter++) {
 
@@ -1367,25 +1597,54 @@ namespace vw { namespace gui {
                       y >= 0 && y <= images[imgInd].img.rows()-1 );
         if (!is_in)
           continue;
-
-        double pixel_val = images[imgInd].img.get_value_as_double(x, y);
-
-        // TODO: Deal with this NAN
-        if (pixel_val == nodata_val)
-          pixel_val = std::numeric_limits<double>::quiet_NaN();
-        m_valsX.push_back(count);
-        m_valsY.push_back(pixel_val);
-        count++;
+        samples.push_back(Vector2(x, y));
       }
 
     }
 
-    if (num_pts == 1) {
+    if (num_pts == 1 && samples.size() > 1) {
       // Just one point, really
-      m_valsX.resize(1);
-      m_valsY.resize(1);
+      samples.resize(1);
     }
-    
+    m_profileOnePoint = (num_pts == 1);
+    m_profile_generation++;
+
+    // More samples than this cannot be seen in the plot. Show those
+    // first, from a coarser pyramid level, and the rest when ready.
+    const size_t MAX_QUICK_SAMPLES = 1000;
+    size_t stride = std::max(size_t(1), samples.size() / MAX_QUICK_SAMPLES);
+    sampleProfile(images[imgInd].img, samples, stride, double(stride), m_valsX, m_valsY);
+    showProfile();
+
+    if (stride > 1) {
+      int generation = m_profile_generation;
+      DiskImagePyramidMultiChannel img = images[imgInd].img;
+      addRenderJob([this, img, samples, generation]() {
+          std::vector<double> valsX, valsY;
+          sampleProfile(img, samples, 1, 1.0, valsX, valsY);
+          std::lock_guard<std::mutex> lock(m_render_mutex);
+          m_refined_valsX.swap(valsX);
+          m_refined_valsY.swap(valsY);
+          m_refined_generation = generation;
+          QMetaObject::invokeMethod(this, "refinedProfileReady", Qt::QueuedConnection);
+        });
+    }
+  }
+
+  void MainWidget::refinedProfileReady() {
+    {
+      std::lock_guard<std::mutex> lock(m_render_mutex);
+      if (m_refined_generation != m_profile_generation || m_profilePlot == NULL)
+        return; // The profile changed meanwhile
+      m_valsX.swap(m_refined_valsX);
+      m_valsY.swap(m_refined_valsY);
+      m_refined_generation = -1;
+    }
+    showProfile();
+  }
+
+  void MainWidget::showProfile() {
+
     // Wipe whatever was there before
     m_profilePlot->detachItems(); 
     
@@ -1410,7 +1669,7 @@ namespace vw { namespace gui {
       }
 
       // Plot a point as a fat dot
-      if (num_pts == 1)  {
+      if (m_profileOnePoint)  {
         curve->setStyle(QwtPlotCurve::Dots);
       }
       
@@ -26,7 +26,12 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <set>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem.hpp>
@@ -187,6 +192,10 @@ public slots:
     void mergePolys             (); ///< Merge existing polygons
     void saveScreenshot         (); ///< Save a screenshot of the current imagery
 
+  private slots:
+    void renderedClipReady      (); ///< A clip rendered in the background is ready
+    void refinedProfileReady    (); ///< A profile sampled in the background is ready
+
   protected:
 
     // Setup
@@ -261,6 +270,17 @@ public slots:
     std::vector<double> m_profileX, m_profileY; // indices in the image to profile
     std::vector<double> m_valsX, m_valsY;    // index and pixel value
     ProfilePlotter * m_profilePlot;          // the profile window
+    bool m_profileOnePoint;                  // if the profile is of just one point
+
+    // Long profiles are first sampled coarsely, then at full resolution
+    // in the background. Results for an older profile are discarded.
+    int m_profile_generation;
+    std::vector<double> m_refined_valsX, m_refined_valsY; // guarded by m_render_mutex
+    int m_refined_generation;                             // guarded by m_render_mutex
+    void sampleProfile(DiskImagePyramidMultiChannel const& img,
+                       std::vector<Vector2> const& samples, size_t stride, double scale,
+                       std::vector<double> & valsX, std::vector<double> & valsY) const;
+    void showProfile();
 
     // Use double buffering: draw to a pixmap first, refresh it only
     // if really necessary, and display it when paintEvent is called.
@@ -341,9 +361,7 @@ public slots:
     double m_shadow_thresh;
     bool   m_shadow_thresh_calc_mode;
     bool   m_shadow_thresh_view_mode;
-    std::vector<imageData> m_shadow_thresh_images;
 
-    std::vector<imageData> m_hillshaded_images;
     std::set<int> m_indicesWithAction;
     
     bool m_view_matches; ///< Control if IP's are drawn
@@ -354,6 +372,9 @@ public slots:
 
     // Drawing is driven by QPaintEvent, which calls out to drawImage()
     void drawImage(QPainter* paint);
+    void drawImageClip(QPainter* paint, int imageIndex, BBox2i const& screen_box,
+                       QImage const& qimg, double scale_out, BBox2i const& region_out,
+                       bool exact);
     /// Add all the interest points to the provided canvas
     /// - Called internally by paintEvent()
     void drawInterestPoints(QPainter* paint);
@@ -398,7 +419,53 @@ public slots:
     double pixelToWorldDist(double pd);
     void   appendToPolyVec (vw::geometry::dPoly const& P);
     void   addPolyVert     (double px, double py);
-    
+
+    // Fetching pixels from the pyramids of large images is slow, so it is
+    // done by a background thread, and the display is refreshed as the
+    // clips arrive. Until then, the coarsest pyramid level of each image,
+    // which is quick to read, and the last clip that arrived are shown.
+    struct ImageClip {
+      double     scale, scale_out;
+      BBox2i     region, region_out;
+      QImage     qimg;
+    };
+    struct ImageClips {
+      ImageClip coarse, fine;
+      bool      has_fine;
+      double    requested_scale;  // The last clip asked of the background thread
+      BBox2i    requested_region;
+      ImageClips(): has_fine(false), requested_scale(-1) {}
+    };
+    struct ClipRequest {
+      std::string key;
+      int         generation;
+      DiskImagePyramidMultiChannel img; // A copy, so the images can change meanwhile
+      DisplayFilter filter;
+      double      scale;
+      BBox2i      region;
+      bool        highlight_nodata;
+    };
+
+    /// Return the clip of the given image for this view if it is ready.
+    /// Else ask for it in the background, return the best substitute, and
+    /// set 'exact' to false.
+    std::vector<ImageClip const*> getImageClips(imageData const& image,
+                                                DisplayFilter const& filter, double scale,
+                                                BBox2i const& image_box,
+                                                bool highlight_nodata, bool & exact);
+    void clearImageClips(); ///< Drop all clips, and those being rendered
+    void renderClips();     ///< The background thread
+    void addRenderJob(std::function<void()> const& job);
+
+    std::map<std::string, ImageClips> m_image_clips; // Used only by the GUI thread
+    std::thread             m_render_thread;
+    std::mutex              m_render_mutex; // Guards the members below
+    std::condition_variable m_render_cv;
+    std::list<ClipRequest>  m_clip_requests;
+    std::list< std::function<void()> > m_render_jobs; // Other work, done first
+    std::list< std::pair<ClipRequest, ImageClip> > m_rendered_clips;
+    bool m_render_stop, m_refresh_posted;
+    int  m_render_generation;
   };
   
 }} // namespace vw::gui
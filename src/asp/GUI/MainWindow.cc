@@ -24,6 +24,7 @@
 #include <QtWidgets>
 #include <asp/GUI/MainWindow.h>
 #include <asp/GUI/MainWidget.h>
+#include <asp/Core/MatchFile.h>
 #include <asp/Core/StereoSettings.h>
 using namespace asp;
 using namespace vw::gui;
@@ -761,7 +762,7 @@ void MainWindow::viewMatches(){
 					       m_image_files[i]);
           leftIndex = i-1;
           //vw_out() << "     - Trying location " << trial_match << std::endl;
-          ip::read_binary_match_file(trial_match, left, right);
+          asp::read_match_file(trial_match, left, right);
 
         }catch(...){
           // Look in default location 2, match from first file to this file.
@@ -770,12 +771,12 @@ void MainWindow::viewMatches(){
 						 m_image_files[i]);
             leftIndex   = 0;
             //vw_out() << "     - Trying location " << trial_match << std::endl;
-            ip::read_binary_match_file(trial_match, left, right);
+            asp::read_match_file(trial_match, left, right);
           }catch(...){
             // Default locations failed, ask the user for the location.
             try {
               trial_match = fileDialog("Manually select the match file...", m_output_prefix);
-              ip::read_binary_match_file(trial_match, left, right);
+              asp::read_match_file(trial_match, left, right);
               leftIndex = 0;
               if (i > 1) {
                 // With multiple images we also need to ask which image the matches are in relation to!
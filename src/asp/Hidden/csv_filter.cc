@@ -58,6 +58,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 
+#include <cmath>
 #include <limits>
 #include <cstring>
 #include <ctime>
@@ -191,29 +192,28 @@ int main(int argc, char *argv[]) {
     if (opt.datum != "")
       csv_georef.set_datum(opt.datum);
 
-    // Read the CSV file
-    std::list<asp::CsvConv::CsvRecord> csv_records;
-    typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-    csv_conv.read_csv_file(opt.csv_file, csv_records);
-    
+    // Stream the CSV file, parsing and converting each batch of lines in parallel
     std::vector<Vector3> csv_llh;
     std::vector<double> timestamp;
     std::vector<std::string> timestamp_str;
-    for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-      Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
-      if (xyz == Vector3() || xyz != xyz)
-	continue; // invalid point
-      Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
-      csv_llh.push_back(llh);
+    asp::CsvConv::CsvBatchJob llh_job = [&](asp::CsvConv::CsvPointBatch const& batch) {
+      for (size_t it = 0; it < batch.xyz.size(); it++) {
+        if (!batch.valid[it])
+          continue; // invalid point
+        Vector3 llh = dem_georef.datum().cartesian_to_geodetic(batch.xyz[it]);
+        csv_llh.push_back(llh);
 
 #if 0
-      // Turn off parsing the time column
-      std::string time_str = iter->file;
-      double val = parse_time(time_str);
-      timestamp.push_back(val);
-      timestamp_str.push_back(time_str);
+        // Turn off parsing the time column
+        std::string time_str = batch.records[it].file;
+        double val = parse_time(time_str);
+        timestamp.push_back(val);
+        timestamp_str.push_back(time_str);
 #endif
-    }
+      }
+      return true;
+    };
+    csv_conv.read_csv_points(opt.csv_file, csv_georef, BBox2(), 1.0, llh_job);
     
     // Read the DEM
     DiskImageView<double> dem(opt.reference_dem);
@@ -229,10 +229,13 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    // We will interpolate into the DEM to find the difference
-    ImageViewRef< PixelMask<double> > interp_dem
-      = interpolate(create_mask(dem, dem_nodata),
-		    BicubicInterpolation(), ConstantEdgeExtension());
+    // Interpolate into the DEM to find the difference, reading each
+    // DEM tile once. A NaN is stored where the DEM is not valid.
+    std::vector<Vector2> csv_pix(csv_llh.size());
+    for (size_t it = 0; it < csv_llh.size(); it++)
+      csv_pix[it] = dem_georef.lonlat_to_pixel(subvector(csv_llh[it], 0, 2));
+    std::vector<double> dem_hts;
+    asp::dem_heights_at_pixels(dem, dem_nodata, csv_pix, opt.num_threads, dem_hts);
 
     // Object used to do geodetic_to_point
     GeodeticToPoint G2P(dem_georef);
@@ -265,20 +268,12 @@ int main(int argc, char *argv[]) {
       for (int it = 0; it < int(csv_llh.size()); it++) {
       
 	Vector3 llh = csv_llh[it];
-	Vector2 ll  = subvector(llh, 0, 2);
-	Vector2 pix = dem_georef.lonlat_to_pixel(ll);
       
-	// Check for out of range
-	bool out_of_range = (pix[0] < 0 || pix[0] > dem.cols() - 1 ||
-			     pix[1] < 0 || pix[1] > dem.rows() - 1);
-
-	if (out_of_range) continue;
-	
-	PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-	if (!is_valid(dem_ht))
+	// Out of range, or the DEM is not valid
+	if (std::isnan(dem_hts[it]))
 	  continue;
 	
-	double diff = llh[2] - dem_ht.child();
+	double diff = llh[2] - dem_hts[it];
 	
 	if (std::abs(diff) > opt.max_height_diff)
 	  continue;
@@ -322,25 +322,46 @@ def getCalibrationFileForFrame(cameraLoopkupFile, inputCalFolder, frame, yyyymmd
 
     return os.path.join(inputCalFolder, camera)
 
+# Make multiple calls to ortho2pinhole with different options until we get one that works well
+ORTHO_IP_METHOD    = [1, 0, 2, 1, 1, 2, 0] # IP method
+ORTHO_FORCE_SIMPLE = [0, 0, 0, 0, 0, 0, 1] # If all else fails use simple mode
+ORTHO_LOCAL_NORM   = [False, False, False, False, True, True, False] # If true, image tiles are individually normalized with method 1 and 2
+ORTHO_IP_PER_TILE  = [0, 0, 0, 1024, 0, 0, 0]
+
+ORTHO_MIN_IP     = 15  # Require more IP to make sure we don't get bogus camera models
+ORTHO_DESIRED_IP = 200 # If we don't hit this number, try other methods before taking the best one.
+
+# The max distance in meters the ortho2pinhole solution is allowed to move from the input
+#  navigation estimate.
+ORTHO_MAX_TRANSLATION = 7
+
+# How many frames to process with one ortho2pinhole call, on the first attempt
+ORTHO_FRAMES_PER_BATCH = 20
+
+def ortho2pinholeOptions(attempt, refDemPath, simpleCamera, numThreads):
+    '''The ortho2pinhole options for the given attempt, other than the files of a frame.'''
+
+    cmd = (('--reference-dem %s --crop-reference-dem --threads %d ' \
+            '--ip-detect-method %d --minimum-ip %d --max-translation %f') 
+           % (refDemPath, numThreads, ORTHO_IP_METHOD[attempt], ORTHO_MIN_IP,
+              ORTHO_MAX_TRANSLATION) )
+    if ORTHO_LOCAL_NORM[attempt]:
+        cmd += ' --skip-image-normalization'
+    if simpleCamera:
+        cmd += ' --short-circuit'
+    if ORTHO_IP_PER_TILE[attempt] > 0:
+        cmd += ' --ip-per-tile ' + str(ORTHO_IP_PER_TILE[attempt])
+    return cmd
+
 def cameraFromOrthoWrapper(inputPath, orthoPath, inputCamFile, estimatedCameraPath, 
-                           outputCamFile, refDemPath, simpleCamera, numThreads):
-    '''Generate a camera model from a single ortho file'''
-
-    # Make multiple calls with different options until we get one that works well
-    IP_METHOD    = [1, 0, 2, 1, 1, 2, 0] # IP method
-    FORCE_SIMPLE = [0, 0, 0, 0, 0, 0, 1] # If all else fails use simple mode
-    LOCAL_NORM   = [False, False, False, False, True, True, False] # If true, image tiles are individually normalized with method 1 and 2
-    IP_PER_TILE  = [0, 0, 0, 1024, 0, 0, 0]
-    numAttempts = len(IP_METHOD)
-   
-    MIN_IP     = 15  # Require more IP to make sure we don't get bogus camera models
-    DESIRED_IP = 200 # If we don't hit this number, try other methods before taking the best one.
+                           outputCamFile, refDemPath, simpleCamera, numThreads,
+                           firstAttempt = 0, bestIpCount = 0):
+    '''Generate a camera model from a single ortho file. If earlier attempts
+       were already made, start at firstAttempt, with the best camera so far,
+       made from bestIpCount points, in the temporary file.'''
 
-    # The max distance in meters the ortho2pinhole solution is allowed to move from the input
-    #  navigation estimate.
-    MAX_TRANSLATION = 7
+    numAttempts = len(ORTHO_IP_METHOD)
 
-    bestIpCount = 0
     tempFilePath  = outputCamFile + '_temp' # Used to hold the current best result
     matchPath     = outputCamFile + '.match' # Used to hold the match file if it exists
     tempMatchPath = matchPath + '_temp'
@@ -350,29 +371,18 @@ def cameraFromOrthoWrapper(inputPath, orthoPath, inputCamFile, estimatedCameraPa
     os.system("umask 022")    # enforce files be readable by others
 
     numPoints = 0 # must be initialized
-    for i in range(0,numAttempts):
+    for i in range(firstAttempt, numAttempts):
 
-        # Get parameters for this attempt
-        ipMethod  = IP_METHOD[i]
-        localNorm = LOCAL_NORM[i]
-    
-        if FORCE_SIMPLE[i]: # Always turn this on for the final attempt!
+        if ORTHO_FORCE_SIMPLE[i]: # Always turn this on for the final attempt!
             simpleCamera = True
 
         # Call ortho2pinhole command
         ortho2pinhole = asp_system_utils.which("ortho2pinhole")
-        cmd = (('%s %s %s %s %s --reference-dem %s --crop-reference-dem --threads %d ' \
-                '--ip-detect-method %d --minimum-ip %d --max-translation %f') 
-                % (ortho2pinhole, inputPath, orthoPath, inputCamFile, outputCamFile, 
-                   refDemPath, numThreads, ipMethod, MIN_IP, MAX_TRANSLATION) )
-        if localNorm:
-            cmd += ' --skip-image-normalization'
+        cmd = ('%s %s %s %s %s ' % (ortho2pinhole, inputPath, orthoPath, inputCamFile,
+                                    outputCamFile))
+        cmd += ortho2pinholeOptions(i, refDemPath, simpleCamera, numThreads)
         if estimatedCameraPath is not None:
             cmd += ' --camera-estimate ' + estimatedCameraPath
-        if simpleCamera:
-            cmd += ' --short-circuit'
-        if IP_PER_TILE[i] > 0:
-            cmd += ' --ip-per-tile ' + str(IP_PER_TILE[i])
 
         # Use a print statement as the logger fails from multiple processes
         print(cmd)
@@ -394,7 +404,7 @@ def cameraFromOrthoWrapper(inputPath, orthoPath, inputCamFile, estimatedCameraPa
         if len(m) != 1: # An unknown error occurred, move on.
             continue
         numPoints = int(m[0])
-        if numPoints >= DESIRED_IP: # Got a lot of points, quit
+        if numPoints >= ORTHO_DESIRED_IP: # Got a lot of points, quit
             break
         if numPoints > bestIpCount: # Got some points but not many, try other options 
             bestIpCount = numPoints #  to see if we can beat this result.
@@ -403,7 +413,7 @@ def cameraFromOrthoWrapper(inputPath, orthoPath, inputCamFile, estimatedCameraPa
             if os.path.exists(matchPath):
                 shutil.move(matchPath, tempMatchPath)
 
-    if (not simpleCamera) and (numPoints < DESIRED_IP): # If we never got the desired # of points
+    if (not simpleCamera) and (numPoints < ORTHO_DESIRED_IP): # If we never got the desired # of points
         shutil.move(tempFilePath, outputCamFile) # Use the camera file with the most points found
         if os.path.exists(tempMatchPath):
             shutil.move(tempMatchPath, matchPath)
@@ -423,6 +433,77 @@ def cameraFromOrthoWrapper(inputPath, orthoPath, inputCamFile, estimatedCameraPa
     # I saw this being recommended, to dump all print statements in the current task
     sys.stdout.flush()
 
+def cameraFromOrthoBatch(orthoArgsList):
+    '''Generate camera models for several ortho files. The first attempt
+       for all of them is made with one ortho2pinhole call, which saves
+       starting a process and loading the reference DEM for each frame.
+       Frames without enough points go on with the other attempts one by one.'''
+
+    if len(orthoArgsList) == 0:
+        return
+
+    # The options below are the same for all frames
+    (inputPath, orthoPath, inputCamFile, estimatedCameraPath, outputCamFile,
+     refDemPath, simpleCamera, numThreads) = orthoArgsList[0]
+
+    os.system("ulimit -c 0")  # disable core dumps
+    os.system("umask 022")    # enforce files be readable by others
+
+    batchList = outputCamFile + '_batch_list.txt'
+    with open(batchList, 'w') as f:
+        for args in orthoArgsList:
+            (inputPath, orthoPath, inputCamFile, estimatedCameraPath, outputCamFile) = args[0:5]
+            os.system('rm -f ' + outputCamFile + '.match') # Needs to be gone
+            line = '%s %s %s %s' % (inputPath, orthoPath, inputCamFile, outputCamFile)
+            if estimatedCameraPath is not None:
+                line += ' ' + estimatedCameraPath
+            f.write(line + '\n')
+
+    ortho2pinhole = asp_system_utils.which("ortho2pinhole")
+    cmd = ('%s --batch-list %s ' % (ortho2pinhole, batchList))
+    cmd += ortho2pinholeOptions(0, refDemPath, simpleCamera, numThreads)
+    print(cmd)
+    p = subprocess.Popen(cmd.split(), stdout=subprocess.PIPE, universal_newlines=True)
+    textOutput, err = p.communicate()
+    p.wait()
+    print(textOutput)
+    os.system('rm -f ' + batchList)
+
+    # The output of each frame starts with this line
+    frameOutputs = re.split(r"Processing frame \d+ of \d+: ", textOutput)[1:]
+
+    for i in range(len(orthoArgsList)):
+        args = orthoArgsList[i]
+        outputCamFile = args[4]
+        numPoints = 0
+        if os.path.exists(outputCamFile) and i < len(frameOutputs):
+            if simpleCamera:
+                numPoints = ORTHO_DESIRED_IP
+            else:
+                m = re.findall(r"Using (\d+) points to create the camera model.",
+                               frameOutputs[i])
+                if len(m) == 1:
+                    numPoints = int(m[0])
+
+        if numPoints >= ORTHO_DESIRED_IP:
+            print ('Best number of ortho points = ' + str(numPoints))
+            os.system("rm -f " + outputCamFile + "*-log-*") # wipe logs
+            continue
+
+        # Keep what we got as the best so far, and try the other methods
+        bestIpCount = 0
+        if numPoints > 0:
+            bestIpCount = numPoints
+            shutil.move(outputCamFile, outputCamFile + '_temp')
+            matchPath = outputCamFile + '.match'
+            if os.path.exists(matchPath):
+                shutil.move(matchPath, matchPath + '_temp')
+        else:
+            os.system('rm -f ' + outputCamFile)
+        cameraFromOrthoWrapper(*args, firstAttempt = 1, bestIpCount = bestIpCount)
+
+    sys.stdout.flush()
+
 def getCameraModelsFromOrtho(imageFolder, orthoFolder,
                              inputCalFolder, inputCalCamera,
                              cameraLookupFile, 
@@ -488,8 +569,9 @@ def getCameraModelsFromOrtho(imageFolder, orthoFolder,
     pool = multiprocessing.Pool(numProcesses)
 
     # Loop through all input images
-    taskHandles = []
-    outputFiles = []
+    taskHandles   = []
+    outputFiles   = []
+    orthoArgsList = []
     for imageFile in imageFiles:
 
         # Skip non-image files (including _sub images made by stereo_gui)
@@ -550,16 +632,22 @@ def getCameraModelsFromOrtho(imageFolder, orthoFolder,
             if not os.path.exists(inputCalCamera):
                 raise Exception("Could not find: " + inputCalCamera)
 
-        orthoArgs = (inputPath, orthoPath, inputCamFile,
-                     estimatedCameraPath, outputCamFile,
-                     refDemPath, simpleCameras, numThreads)
+        orthoArgsList.append((inputPath, orthoPath, inputCamFile,
+                              estimatedCameraPath, outputCamFile,
+                              refDemPath, simpleCameras, numThreads))
 
+    # Consecutive frames go together, as they see nearby parts of the DEM.
+    # Make the batches smaller if needed to keep all processes busy.
+    batchSize = (len(orthoArgsList) + numProcesses - 1) // max(numProcesses, 1)
+    batchSize = max(1, min(ORTHO_FRAMES_PER_BATCH, batchSize))
+    for start in range(0, len(orthoArgsList), batchSize):
+        batchArgs = (orthoArgsList[start:start + batchSize],)
         if numProcesses > 1:
             # Add ortho2pinhole command to the task pool
-            taskHandles.append(pool.apply_async(cameraFromOrthoWrapper, orthoArgs))
+            taskHandles.append(pool.apply_async(cameraFromOrthoBatch, batchArgs))
         else:
             # Single process, more logging info this way
-            cameraFromOrthoWrapper(*orthoArgs)
+            cameraFromOrthoBatch(*batchArgs)
 
     # Wait for all the tasks to complete
     logger.info('Finished adding ' + str(len(taskHandles)) + ' tasks to the pool.')
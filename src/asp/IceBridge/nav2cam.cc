@@ -46,6 +46,8 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/PinholeModel.h>
@@ -484,13 +486,13 @@ void print_matrix(Matrix3x3 const& m) {
 
 
 /// Helper function to write out the camera model once we have the position and pose.
-/// - This also adds the important row-direction flip from the camera to the image.
+/// - The intrinsics come from the reference model, which is read only once.
 void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
-                         std::string const& input_cam, 
+                         PinholeModel const& input_model,
                          std::string const& output_camera) {
-                         
-  // Load the reference pinhole model, update it, and write it out to disk.
-  PinholeModel camera_model(input_cam);
+
+  // Update a copy of the reference pinhole model and write it out to disk.
+  PinholeModel camera_model(input_model);
   camera_model.set_camera_center(center);
   camera_model.set_camera_pose(pose);
   //vw_out() << "Writing: " << output_camera << std::endl;
@@ -513,6 +515,156 @@ void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
   camera_model.write(output_camera);
 }
 
+/// Find the camera center and pose at the given time from the interpolated
+/// nav data. Return false, with a message, if that fails.
+bool compute_camera_pose(ScrollingNavInterpolator::PosInterpType const& pos_interpolator,
+                         ScrollingNavInterpolator::RotInterpType const& rot_interpolator,
+                         double ortho_time, int camera_mounting,
+                         Vector3 & center, Matrix3x3 & pose, std::string & error) {
+
+  const double POSE_TIME_DELTA = 0.1; // Look this far ahead/behind to determine direction
+  Datum datum_wgs84("WGS84");
+
+  // Try to interpolate this ortho position
+  Vector3 gcc_interp, rot_interp;
+  try{
+    gcc_interp = pos_interpolator(ortho_time);
+    rot_interp = rot_interpolator(ortho_time);
+  } catch(...){
+    error = "Failed to interpolate position";
+    return false;
+  }
+  Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
+
+  double roll    = rot_interp[0];
+  double pitch   = rot_interp[1];
+
+  /*
+    For some reason the heading interpolated from the navigation data is about 30 degrees
+    off from what is expected by looking at the flight path.  The roll and pitch values are
+    consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
+    provided).  What has proven to work the best so far is to estimate the camera pose 
+    including the heading just by using the flight path, and then to apply the pitch and roll
+    to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
+    which one map-projects closest to the lidar data.
+  */
+
+  // Get a point ahead of and behind the frame location
+  Vector3 gcc_interp_forward  = pos_interpolator(ortho_time+POSE_TIME_DELTA);
+  Vector3 gcc_interp_backward = pos_interpolator(ortho_time-POSE_TIME_DELTA);
+
+  if (gcc_interp_forward == gcc_interp_backward) {
+    error = "Failed to estimate pose";
+    return false;
+  }
+
+  // From these points get two flight direction vectors and take the mean.
+  Vector3 dir1 = gcc_interp_forward - gcc_interp;
+  Vector3 dir2 = gcc_interp - gcc_interp_backward;
+  Vector3 xDir = (dir1 + dir2) / 2.0;
+
+  // The Z vector is straight down from the camera to the ground.
+  Vector3 llh_ground = llh_interp;
+  llh_ground[2] = 0;
+  Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
+  Vector3 zDir = gcc_ground - gcc_interp;
+
+  // Normalize the vectors
+  xDir = xDir / norm_2(xDir);
+  zDir = zDir / norm_2(zDir);
+
+  // The Y vector is the cross product of the two established vectors
+  Vector3 yDir = cross_prod(zDir, xDir);
+
+  // Hack to allow testing of whether rotation is applied before axis change.
+  // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
+  // - Once we are satisfied this is always true, remove the option not to do this.
+  if (camera_mounting > 0) {
+    Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                  xDir[1], yDir[1], zDir[1],
+                                  xDir[2], yDir[2], zDir[2]);
+    Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+    Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+    Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
+    xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
+    yDir  = Vector3(M(0,1), M(1,1), M(2,1));
+    zDir  = Vector3(M(0,2), M(1,2), M(2,2));
+    roll  = 0; // Set to zero so that these rotations are not applied twice
+    pitch = 0;
+  }
+
+  // Account for the camera mounting direction relative to aircraft motion.
+  Vector3 vTemp;
+  switch(abs(camera_mounting)) {
+  case 1: // Left forwards
+    xDir = xDir * -1.0;
+    yDir = yDir * -1.0;
+    break;
+  case 2: // Top forwards
+    vTemp = xDir;
+    xDir = -1.0*yDir;
+    yDir = vTemp;
+    break;
+  case 3: // Bottom forwards
+    vTemp = xDir;
+    xDir = yDir;
+    yDir = -1.0*vTemp;
+    break;
+  default: break; // Right forwards, the default.
+  }
+
+  // Pack into a rotation matrix
+  Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                xDir[1], yDir[1], zDir[1],
+                                xDir[2], yDir[2], zDir[2]);
+
+  Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+  Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+
+  // Without documentation it is very difficult to determine
+  // which of these rotation orders is correct!
+  // - Could be neither since the yaw rotation is already baked in.
+  //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
+  //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
+  //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
+  center = gcc_interp;
+  pose   = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
+  return true;
+}
+
+/// Compute and write the camera for one frame. The tasks of a nav chunk
+/// share its interpolators, which are only read.
+class CameraTask: public vw::Task, private boost::noncopyable {
+  boost::shared_ptr<ScrollingNavInterpolator::PosInterpType> m_pos_interpolator;
+  boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> m_rot_interpolator;
+  double              m_ortho_time;
+  int                 m_camera_mounting;
+  PinholeModel const& m_input_model;
+  std::string         m_orthoimage_path, m_output_camera;
+
+public:
+  CameraTask(boost::shared_ptr<ScrollingNavInterpolator::PosInterpType> pos_interpolator,
+             boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> rot_interpolator,
+             double ortho_time, int camera_mounting, PinholeModel const& input_model,
+             std::string const& orthoimage_path, std::string const& output_camera):
+    m_pos_interpolator(pos_interpolator), m_rot_interpolator(rot_interpolator),
+    m_ortho_time(ortho_time), m_camera_mounting(camera_mounting),
+    m_input_model(input_model), m_orthoimage_path(orthoimage_path),
+    m_output_camera(output_camera) {}
+
+  virtual void operator()() {
+    Vector3 center;
+    Matrix3x3 pose;
+    std::string error;
+    if (!compute_camera_pose(*m_pos_interpolator, *m_rot_interpolator, m_ortho_time,
+                             m_camera_mounting, center, pose, error)) {
+      vw_out() << error << " for file " << m_orthoimage_path << std::endl;
+      return;
+    }
+    write_output_camera(center, pose, m_input_model, m_output_camera);
+  }
+};
+
 // ================================================================================
 
 int main(int argc, char* argv[]) {
@@ -537,6 +689,9 @@ int main(int argc, char* argv[]) {
   
     const boost::filesystem::path output_dir(opt.output_folder);
   
+    // The reference camera, with the intrinsics for all the output cameras
+    PinholeModel input_model(opt.input_cam);
+
     // Initialize the nav interpolator
     std::cout << "Opening input stream: " << opt.nav_file << std::endl;
     ScrollingNavInterpolator interpLoader(opt.nav_file, datum_wgs84);
@@ -567,7 +722,6 @@ int main(int argc, char* argv[]) {
     boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> rot_interpolator_ptr;
     double start, end;
   
-    const double POSE_TIME_DELTA     = 0.1; // Look this far ahead/behind to determine direction
     const double CHUNK_TIME_BOUNDARY = 1.0; // Require this much interpolation time
     size_t file_index = 0;
     const size_t num_files = opt.image_files.size();
@@ -585,6 +739,10 @@ int main(int argc, char* argv[]) {
       if (opt.detect_offset)
         continue;
 
+      // The cameras for this chunk are made in parallel. The queue is joined
+      // before the next chunk overwrites the nav data.
+      FifoWorkQueue queue(vw_settings().default_num_threads());
+
       // Loop through ortho files until we need to advance the nav chunk
       while (file_index < num_files) {
 
@@ -611,227 +769,13 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        // Try to interpolate this ortho position
-        Vector3 gcc_interp, rot_interp;
-        try{
-          gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
-          rot_interp = rot_interpolator_ptr->operator()(ortho_time);
-        } catch(...){
-          vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-        Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
-      
-        double roll    = rot_interp[0];
-        double pitch   = rot_interp[1];
-        //double heading = rot_interp[2];
-        //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
-        //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
-        //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
-        //vw_out() << "Heading = " << heading << std::endl;
-
-        //std::cout << "Ortho time  = " << ortho_time << std::endl;
-        //vw_out() << "llh = " << llh_interp << std::endl;
-      
-        // Now estimate the rotation information
-
-        /*
-          For some reason the heading interpolated from the navigation data is about 30 degrees
-          off from what is expected by looking at the flight path.  The roll and pitch values are
-          consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
-          provided).  What has proven to work the best so far is to estimate the camera pose 
-          including the heading just by using the flight path, and then to apply the pitch and roll
-          to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
-          which one map-projects closest to the lidar data.
-        */
-      
-        // Get a point ahead of and behind the frame location
-        Vector3 gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
-        Vector3 gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
-      
-        if (gcc_interp_forward == gcc_interp_backward) {
-          vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-      
-        // From these points get two flight direction vectors and take the mean.
-        Vector3 dir1 = gcc_interp_forward - gcc_interp;
-        Vector3 dir2 = gcc_interp - gcc_interp_backward;
-        Vector3 xDir = (dir1 + dir2) / 2.0;
-     
-        // The Z vector is straight down from the camera to the ground.
-        Vector3 llh_ground = llh_interp;
-        llh_ground[2] = 0;
-        Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
-        Vector3 zDir = gcc_ground - gcc_interp;
-      
-        // Normalize the vectors
-        xDir = xDir / norm_2(xDir);
-        zDir = zDir / norm_2(zDir);
-      
-        // The Y vector is the cross product of the two established vectors
-        Vector3 yDir = cross_prod(zDir, xDir);
-
-        // Hack to allow testing of whether rotation is applied before axis change.
-        // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
-        // - Once we are satisfied this is always true, remove the option not to do this.
-        if (opt.camera_mounting > 0) {
-          Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                        xDir[1], yDir[1], zDir[1],
-                                        xDir[2], yDir[2], zDir[2]);
-          Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-          Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-          Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
-          xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
-          yDir  = Vector3(M(0,1), M(1,1), M(2,1));
-          zDir  = Vector3(M(0,2), M(1,2), M(2,2));
-          roll  = 0; // Set to zero so that these rotations are not applied twice
-          pitch = 0;
-        }
-
-        // Account for the camera mounting direction relative to aircraft motion.
-        Vector3 vTemp;
-        switch(abs(opt.camera_mounting)) {
-        case 1: // Left forwards
-          xDir = xDir * -1.0;
-          yDir = yDir * -1.0;
-          break;
-        case 2: // Top forwards
-          vTemp = xDir;
-          xDir = -1.0*yDir;
-          yDir = vTemp;
-          break;
-        case 3: // Bottom forwards
-          vTemp = xDir;
-          xDir = yDir;
-          yDir = -1.0*vTemp;
-          break;
-        default: break; // Right forwards, the default.
-        }
-      
-        // Pack into a rotation matrix
-        Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                      xDir[1], yDir[1], zDir[1],
-                                      xDir[2], yDir[2], zDir[2]);
-      
-        // TODO: ENU or NED?
-        //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
-        //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
-        //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
-        //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
-
-        //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
-        //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
-      
-        //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
-
-
-        //std::cout << "gcc = " << gcc_interp << std::endl;
-        //std::cout << "xDir = " << xDir << std::endl;
-        //std::cout << "yDir = " << yDir << std::endl;
-        //std::cout << "zDir = " << zDir << std::endl;
-      
-        //std::cout << std::endl << "Estimate based matrix " << std::endl;
-        //print_matrix(rotation_matrix_gcc);
-      
-        // TODO: Clean all this up once we are satisfied with it!
-      
-        Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-        Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-
-        //std::cout << "M_roll, M_pitch:\n";
-        //print_matrix(M_roll ); std::cout << std::endl;
-        //print_matrix(M_pitch); std::cout << std::endl;
-      
-        // Without documentation it is very difficult to determine
-        // which of these rotation orders is correct!
-        // - Could be neither since the yaw rotation is already baked in.
-        //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
-        //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
-        Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
-        //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
-      
-        //std::cout << "Modified matrices:\n";
-        //print_matrix(M1); std::cout << std::endl;
-        //print_matrix(M2); std::cout << std::endl;
-        //print_matrix(M3); std::cout << std::endl;
-        //print_matrix(M4); std::cout << std::endl;
-
-        //std::string var_path = output_camera_path.string() + "_";
-        //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
-        //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
-        //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
-        //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
-        //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
-
-        write_output_camera(gcc_interp, M3,
-                            opt.input_cam, output_camera_path.string());
-
-        //std::cout << std::endl << "NED matrix " << std::endl;
-        //print_matrix(ned_matrix);
-
-        //std::cout << std::endl << "ENU matrix " << std::endl;
-        //std::cout << enu_matrix << std::endl << std::endl;
-        /*
-          double yaw = -3.14159 / 2;
-          Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
-      
-          for (int p=0; p<0; ++p) {
-          Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
-
-
-          std::cout << std::endl << "Angle based matrix " << p << std::endl;
-          std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
-
-          //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-          //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
-          std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-          std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-          std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
-        
-          //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-          //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
-          std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
-
-          std::cout << "------------\n";
-
-
-          std::cout << std::endl << "Angle based matrix " << p << std::endl;
-          std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
-
-          //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-          //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
-          std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-          std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-          std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
-        
-          //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-          //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
-          std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
-
-        
-          }
-          std::cout << std::endl << std::endl;
-        */
-        //write_output_camera(gcc_interp, rotation_matrix_gcc,
-        //                    opt.input_cam, output_camera_path.string());
-
+        // The camera is made in the background. The frame times,
+        // which are not thread-safe to compute, are found here.
+        boost::shared_ptr<CameraTask>
+          task(new CameraTask(pos_interpolator_ptr, rot_interpolator_ptr, ortho_time,
+                              opt.camera_mounting, input_model, orthoimage_path,
+                              output_camera_path.string()));
+        queue.add_task(task);
 
         // Update progress
         if (file_index % PRINT_INTERVAL == 0)
@@ -841,6 +785,8 @@ int main(int argc, char* argv[]) {
         ortho_time = 0;
 
       } // End loop through ortho files
+
+      queue.join_all();
     
     } // End loop through nav batches
   
@@ -35,6 +35,9 @@
 #include <vw/Cartography/GeoTransform.h>
 #include <boost/core/null_deleter.hpp>
 
+#include <fstream>
+#include <sstream>
+
 
 // Turn off warnings from eigen
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -69,8 +72,15 @@ using namespace vw::camera;
 typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
 
 
+/// The inputs and outputs of one frame, when many are processed in one run
+struct Frame {
+  std::string raw_image, ortho_image, input_cam, output_cam, camera_estimate;
+};
+
 struct Options : public vw::cartography::GdalWriteOptions {
-  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate;
+  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate,
+    batch_list;
+  std::vector<Frame> frames;
   double camera_height, orthoimage_height, ip_inlier_factor, max_translation;
   int    ip_per_tile, ip_detect_method, min_ip;
   bool   individually_normalize, keep_match_file, write_gcp_file, skip_image_normalization, 
@@ -278,28 +288,41 @@ int solve_for_cam_adjust(boost::shared_ptr<PinholeModel> camera_model,
 
 
 
-   
-/// Load the DEM and adjust some options depending on DEM statistics.
-void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
-                        vw::cartography::GeoReference const& ortho_georef,
-                        ImageViewRef< PixelMask<float> > &dem,
-                        vw::cartography::GeoReference &dem_georef,
-                        bool &elevation_change_present) {
+/// The reference DEM, opened once and shared by all the frames of a run,
+/// so that frames which see the same area reuse the DEM tiles that
+/// were already read.
+struct ReferenceDem {
+  boost::shared_ptr< DiskImageView<float> > image;
+  vw::cartography::GeoReference georef;
+  float nodata;
+};
 
-  // Set up the DEM if it was provided.
-  float dem_nodata = -std::numeric_limits<float>::max();
+void open_reference_dem(std::string const& dem_file, ReferenceDem & ref_dem) {
 
-  bool is_good = vw::cartography::read_georeference(dem_georef, opt.reference_dem);
+  bool is_good = vw::cartography::read_georeference(ref_dem.georef, dem_file);
   if (!is_good) {
     vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
-                           << opt.reference_dem << ".\n");
+                           << dem_file << ".\n");
   }
 
-  {
-    // Read the no-data
-    DiskImageResourceGDAL rsrc(opt.reference_dem);
-    if (rsrc.has_nodata_read()) dem_nodata = rsrc.nodata_read();
-  }
+  // Read the no-data
+  ref_dem.nodata = -std::numeric_limits<float>::max();
+  boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(dem_file));
+  if (rsrc->has_nodata_read()) ref_dem.nodata = rsrc->nodata_read();
+
+  ref_dem.image.reset(new DiskImageView<float>(rsrc));
+}
+   
+/// Set up the DEM for this frame and adjust some options depending on DEM statistics.
+void load_reference_dem(Options &opt, ReferenceDem const& ref_dem,
+                        boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
+                        vw::cartography::GeoReference const& ortho_georef,
+                        ImageViewRef< PixelMask<float> > &dem,
+                        vw::cartography::GeoReference &dem_georef,
+                        bool &elevation_change_present) {
+
+  float dem_nodata = ref_dem.nodata;
+  dem_georef = ref_dem.georef;
 
 
   bool crop_is_success = false;
@@ -310,8 +333,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
     DiskImageView<float> tmp_ortho(rsrc_ortho);
     BBox2 ortho_bbox = bounding_box(tmp_ortho);
 
-    DiskImageView<float> tmp_dem(opt.reference_dem);
-    BBox2 dem_bbox = bounding_box(tmp_dem);
+    BBox2 dem_bbox = bounding_box(*ref_dem.image);
     
     // The GeoTransform will hide the messy details of conversions
     vw::cartography::GeoTransform geotrans(dem_georef, ortho_georef, dem_bbox, ortho_bbox);
@@ -331,7 +353,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
       crop_box.crop(dem_bbox);
       
       if (!crop_box.empty()) {
-        ImageView<float> cropped_dem = crop(DiskImageView<float>(opt.reference_dem), crop_box);
+        ImageView<float> cropped_dem = crop(*ref_dem.image, crop_box);
         dem = create_mask(cropped_dem, dem_nodata);
         dem_georef = crop(dem_georef, crop_box);
         crop_is_success = true;
@@ -343,7 +365,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
   
   // Default behavior  
   if (!crop_is_success)
-    dem = create_mask(DiskImageView<float>(opt.reference_dem), dem_nodata);
+    dem = create_mask(*ref_dem.image, dem_nodata);
 
   
   // Get an estimate of the elevation range in the input image
@@ -637,7 +659,7 @@ double refine_camera_with_dem_pts(Options const& opt,
 
 
 // Primary task-solving function.
-void ortho2pinhole(Options & opt){
+void ortho2pinhole(Options & opt, ReferenceDem const& ref_dem){
 
   // Input image handles
   boost::shared_ptr<DiskImageResource>
@@ -660,7 +682,8 @@ void ortho2pinhole(Options & opt){
   bool has_ref_dem = (opt.reference_dem != "");
   bool elevation_change_present = false;
   if (has_ref_dem) {
-    load_reference_dem(opt, rsrc_ortho, ortho_georef, dem, dem_georef, elevation_change_present);
+    load_reference_dem(opt, ref_dem, rsrc_ortho, ortho_georef, dem, dem_georef,
+                       elevation_change_present);
   }
   
 
@@ -687,7 +710,7 @@ void ortho2pinhole(Options & opt){
   vw_out() << "Using estimated cam height: " << cam_height << std::endl;
 
   std::vector<vw::ip::InterestPoint> raw_ip, ortho_ip;
-  ip::read_binary_match_file(match_filename, raw_ip, ortho_ip);
+  asp::read_match_file(match_filename, raw_ip, ortho_ip);
   vw::camera::PinholeModel *pcam = dynamic_cast<vw::camera::PinholeModel*>(cam.get());
   if (pcam == NULL) {
     vw_throw(ArgumentErr() << "Expecting a pinhole camera model.\n");
@@ -942,7 +965,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("reference-dem",             po::value(&opt.reference_dem)->default_value(""),
      "If provided, extract from this DEM the heights above the ground rather than assuming the value in --orthoimage-height.")
     ("crop-reference-dem", po::bool_switch(&opt.crop_reference_dem)->default_value(false)->implicit_value(true),
-     "Crop the reference DEM to a generous area to make it faster to load.");
+     "Crop the reference DEM to a generous area to make it faster to load.")
+    ("batch-list",             po::value(&opt.batch_list)->default_value(""),
+     "Process many frames in one run, sharing the reference DEM. Each line of this file has a raw image, orthoimage, input camera, output camera, and optionally an estimated camera. The positional arguments are then not used.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
   
@@ -959,7 +984,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   positional_desc.add("input-cam",  1);
   positional_desc.add("output-cam", 1);
 
-  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]");
+  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]\n"
+                    "  or: --batch-list <list file> [options]");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -973,66 +999,143 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().skip_image_normalization = opt.skip_image_normalization;
   asp::stereo_settings().ip_inlier_factor         = opt.ip_inlier_factor;
   
-  if ( opt.raw_image.empty() )
-    vw_throw( ArgumentErr() << "Missing input raw image.\n" << usage << general_options );
+  // Read the frames, or make one from the positional arguments
+  if (opt.batch_list != "") {
+    std::ifstream handle(opt.batch_list.c_str());
+    if (!handle.good())
+      vw_throw( ArgumentErr() << "Cannot read the batch list " << opt.batch_list << ".\n");
+    std::string line;
+    while (getline(handle, line)) {
+      std::istringstream is(line);
+      Frame frame;
+      if (!(is >> frame.raw_image >> frame.ortho_image >> frame.input_cam >> frame.output_cam))
+        continue; // Skip blank or incomplete lines
+      if (!(is >> frame.camera_estimate))
+        frame.camera_estimate = opt.camera_estimate;
+      opt.frames.push_back(frame);
+    }
+    if (opt.frames.empty())
+      vw_throw( ArgumentErr() << "No frames were found in " << opt.batch_list << ".\n");
+  } else {
+    Frame frame;
+    frame.raw_image       = opt.raw_image;
+    frame.ortho_image     = opt.ortho_image;
+    frame.input_cam       = opt.input_cam;
+    frame.output_cam      = opt.output_cam;
+    frame.camera_estimate = opt.camera_estimate;
+    opt.frames.push_back(frame);
+  }
 
-  if ( opt.ortho_image.empty() )
-    vw_throw( ArgumentErr() << "Missing input ortho image.\n" << usage << general_options );
+  for (size_t it = 0; it < opt.frames.size(); it++) {
+    Frame const& frame = opt.frames[it];
+    
+    if ( frame.raw_image.empty() )
+      vw_throw( ArgumentErr() << "Missing input raw image.\n" << usage << general_options );
 
-  if ( opt.input_cam.empty() )
-    vw_throw( ArgumentErr() << "Missing input pinhole camera.\n" << usage << general_options );
+    if ( frame.ortho_image.empty() )
+      vw_throw( ArgumentErr() << "Missing input ortho image.\n" << usage << general_options );
 
-  if ( opt.output_cam.empty() )
-    vw_throw( ArgumentErr() << "Missing output pinhole camera.\n" << usage << general_options );
+    if ( frame.input_cam.empty() )
+      vw_throw( ArgumentErr() << "Missing input pinhole camera.\n" << usage << general_options );
 
-  if (opt.camera_estimate != "") {
-    if (!boost::filesystem::exists(opt.camera_estimate)) {
-      vw_throw( ArgumentErr() << "Estimated camera file " << opt.camera_estimate << " does not exist!\n");
-    }    
-  }
+    if ( frame.output_cam.empty() )
+      vw_throw( ArgumentErr() << "Missing output pinhole camera.\n" << usage << general_options );
 
-  if (opt.short_circuit && opt.camera_estimate == "")
-    vw_throw( ArgumentErr() << "Estimated camera file is required with the short-circuit option.\n");
+    if (frame.camera_estimate != "") {
+      if (!boost::filesystem::exists(frame.camera_estimate)) {
+        vw_throw( ArgumentErr() << "Estimated camera file " << frame.camera_estimate
+                  << " does not exist!\n");
+      }    
+    }
 
-  // Create the output directory
-  vw::create_out_dir(opt.output_cam);
+    if (opt.short_circuit && frame.camera_estimate == "")
+      vw_throw( ArgumentErr() << "Estimated camera file is required with the short-circuit option.\n");
+
+    // Create the output directory
+    vw::create_out_dir(frame.output_cam);
+  }
 
   // Turn on logging to file
-  asp::log_to_file(argc, argv, "", opt.output_cam);
+  asp::log_to_file(argc, argv, "", opt.frames[0].output_cam);
   
 }
 
+/// Make the camera for one frame
+void process_frame(Options & opt, ReferenceDem const& ref_dem) {
+
+  if (opt.short_circuit) {
+    vw_out() << "Creating camera without using ortho image.\n";
+
+    // Load input camera files
+    vw_out() << "Loading: " << opt.input_cam << std::endl;
+    PinholeModel input_cam(opt.input_cam);
+    vw_out() << "Loading: " << opt.camera_estimate << std::endl;
+    PinholeModel est_cam(opt.camera_estimate);
+  
+    // Copy camera position and pose from estimate camera to input camera
+    input_cam.set_camera_center(est_cam.camera_center());
+    input_cam.set_camera_pose  (est_cam.camera_pose  ());
+  
+    // Write to output camera
+    vw_out() << "Writing: " << opt.output_cam << std::endl;
+    input_cam.write(opt.output_cam);
+    return;
+  }
+
+  opt.raw_image   = handle_rgb_input(opt.raw_image,   opt);
+  opt.ortho_image = handle_rgb_input(opt.ortho_image, opt);
+
+  ortho2pinhole(opt, ref_dem);
+}
+
 // ================================================================================
 
 int main(int argc, char* argv[]) {
 
   Options opt;
+  int num_failed = 0;
   try {
     handle_arguments( argc, argv, opt );
-   
-    if (opt.short_circuit) {
-      vw_out() << "Creating camera without using ortho image.\n";
-  
-      // Load input camera files
-      vw_out() << "Loading: " << opt.input_cam << std::endl;
-      PinholeModel input_cam(opt.input_cam);
-      vw_out() << "Loading: " << opt.camera_estimate << std::endl;
-      PinholeModel est_cam(opt.camera_estimate);
-    
-      // Copy camera position and pose from estimate camera to input camera
-      input_cam.set_camera_center(est_cam.camera_center());
-      input_cam.set_camera_pose  (est_cam.camera_pose  ());
-    
-      // Write to output camera
-      vw_out() << "Writing: " << opt.output_cam << std::endl;
-      input_cam.write(opt.output_cam);
-      return 0;
+
+    ReferenceDem ref_dem;
+    if (opt.reference_dem != "" && !opt.short_circuit)
+      open_reference_dem(opt.reference_dem, ref_dem);
+
+    // These are changed while processing a frame, so each frame starts from
+    // the values on the command line.
+    double orthoimage_height  = opt.orthoimage_height;
+    double epipolar_threshold = asp::stereo_settings().epipolar_threshold;
+
+    bool batch = (opt.batch_list != "");
+    for (size_t it = 0; it < opt.frames.size(); it++) {
+      Frame const& frame = opt.frames[it];
+      opt.raw_image       = frame.raw_image;
+      opt.ortho_image     = frame.ortho_image;
+      opt.input_cam       = frame.input_cam;
+      opt.output_cam      = frame.output_cam;
+      opt.camera_estimate = frame.camera_estimate;
+      opt.orthoimage_height                    = orthoimage_height;
+      asp::stereo_settings().epipolar_threshold = epipolar_threshold;
+
+      if (!batch) {
+        process_frame(opt, ref_dem);
+        break;
+      }
+
+      // In a batch, a frame which fails does not stop the others
+      vw_out() << "Processing frame " << it + 1 << " of " << opt.frames.size()
+               << ": " << frame.raw_image << std::endl;
+      try {
+        process_frame(opt, ref_dem);
+      } catch (const std::exception& e) {
+        vw_out() << "Failed to make " << frame.output_cam << ": " << e.what() << std::endl;
+        num_failed++;
+      }
     }
-  
-    opt.raw_image   = handle_rgb_input(opt.raw_image,   opt);
-    opt.ortho_image = handle_rgb_input(opt.ortho_image, opt);
-  
-    ortho2pinhole(opt);
+
+    if (num_failed > 0)
+      vw_out() << "Failed to process " << num_failed << " of "
+               << opt.frames.size() << " frames.\n";
   } ASP_STANDARD_CATCHES;
-  return 0;
+  return (num_failed > 0) ? 1 : 0;
 }
@@ -22,6 +22,7 @@
 // STL
 #include <fstream>
 #include <iostream>
+#include <vector>
 // VW
 #include <vw/Math/Vector.h>
 
@@ -56,6 +57,21 @@ namespace asp {
     }
     vw::Vector3 operator()( double t ) { return evaluate(t);}
 
+    // Evaluates the equation at each of the times, leaving the cache
+    // as it was.
+    void evaluate( std::vector<double> const& times,
+                   std::vector<vw::Vector3>& output ) {
+      vw::Vector3 cached_output = m_cached_output;
+      double cached_time = m_cached_time;
+      output.resize( times.size() );
+      for ( size_t i = 0; i < times.size(); i++ ) {
+        update( times[i] );
+        output[i] = m_cached_output;
+      }
+      m_cached_output = cached_output;
+      m_cached_time = cached_time;
+    }
+
     // Tells the number of constants defining the equation
     // This is especially vague as it is meant for interaction with a
     // bundle adjuster. BA just wants to roll through the constants
@@ -31,10 +31,24 @@
 #include <vw/Image/PixelTypeInfo.h>
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 
+#include <algorithm>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem/path.hpp>
 
 #include <Cube.h>
+#include <Endian.h>
+#include <IString.h>
 #include <Portal.h>
+#include <Pvl.h>
 #include <SpecialPixel.h>
 
 using namespace std;
@@ -42,6 +56,21 @@ using namespace boost;
 
 namespace vw {
 
+  /// A read-only memory map of the cube file, with the layout of its pixels
+  struct DiskImageResourceIsis::RawCube {
+    char const* data;
+    size_t      size;
+    size_t      start;                    // Offset of the first pixel
+    bool        tiled, swap;
+    int         tile_samples, tile_lines; // The whole image for band-sequential cubes
+
+    RawCube(): data(NULL), size(0) {}
+    ~RawCube() {
+      if (data != NULL)
+        munmap(const_cast<char*>(data), size);
+    }
+  };
+
   // We use a fixed tile size of 2048x2048 pixels here.  Although this
   // may not be the native tile size of the ISIS cube, it seems to be
   // much faster to let the ISIS driver aggregate smaller blocks by
@@ -87,6 +116,109 @@ namespace vw {
       default:
         vw_throw(IOErr() << "DiskImageResourceIsis: Unknown pixel type.");
     }
+
+    open_raw();
+  }
+
+  void DiskImageResourceIsis::open_raw() {
+    m_raw.reset();
+    try {
+      Isis::PvlObject & core = m_cube->label()->findObject("IsisCube").findObject("Core");
+      if (core.hasKeyword("^DnFile"))
+        return; // The pixels are in another cube
+
+      // The pixels may be in a file next to a detached label
+      std::string data_file = m_filename;
+      if (core.hasKeyword("^Core"))
+        data_file = (boost::filesystem::path(m_filename).parent_path()
+                     / core["^Core"][0].toStdString()).string();
+
+      boost::shared_ptr<RawCube> raw(new RawCube);
+      raw->start = Isis::toInt(core["StartByte"][0]) - 1; // ISIS counts from 1
+      raw->tiled = (m_cube->format() == Isis::Cube::Tile);
+      raw->swap  = ((m_cube->byteOrder() == Isis::Lsb) != Isis::IsLsb());
+      if (raw->tiled) {
+        raw->tile_samples = Isis::toInt(core["TileSamples"][0]);
+        raw->tile_lines   = Isis::toInt(core["TileLines"  ][0]);
+      } else {
+        raw->tile_samples = m_format.cols;
+        raw->tile_lines   = m_format.rows;
+      }
+      if (raw->tile_samples <= 0 || raw->tile_lines <= 0)
+        return;
+
+      // Check that the file holds all the pixels
+      size_t tiles_per_band
+        = size_t((m_format.cols + raw->tile_samples - 1) / raw->tile_samples) *
+          size_t((m_format.rows + raw->tile_lines   - 1) / raw->tile_lines);
+      size_t needed = raw->start + tiles_per_band * m_format.planes *
+        size_t(raw->tile_samples) * raw->tile_lines * m_bytes_per_pixel;
+
+      int fd = ::open(data_file.c_str(), O_RDONLY);
+      if (fd < 0)
+        return;
+      struct stat st;
+      if (fstat(fd, &st) != 0 || size_t(st.st_size) < needed) {
+        ::close(fd);
+        return;
+      }
+      void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd); // The map stays valid
+      if (data == MAP_FAILED)
+        return;
+      raw->data = (char const*)data;
+      raw->size = st.st_size;
+      m_raw = raw;
+    } catch (...) {
+      // Read through ISIS
+      m_raw.reset();
+    }
+  }
+
+  // Copy each row of the box from the tiles it crosses, then fix the byte order
+  void DiskImageResourceIsis::read_raw(ImageBuffer const& dest, BBox2i const& bbox) const {
+
+    RawCube const& raw = *m_raw;
+    size_t bpp = m_bytes_per_pixel;
+    size_t tile_size = size_t(raw.tile_samples) * raw.tile_lines * bpp;
+    size_t tiles_per_row  = (m_format.cols + raw.tile_samples - 1) / raw.tile_samples;
+    size_t tiles_per_band = tiles_per_row *
+      ((m_format.rows + raw.tile_lines - 1) / raw.tile_lines);
+
+    std::vector<char> pixels(size_t(bbox.width()) * bbox.height() * m_format.planes * bpp);
+    char* out = &pixels[0];
+    for (int band = 0; band < m_format.planes; band++) {
+      for (int line = bbox.min().y(); line < bbox.max().y(); line++) {
+        size_t tile_row = line / raw.tile_lines, line_in_tile = line % raw.tile_lines;
+        int sample = bbox.min().x();
+        while (sample < bbox.max().x()) {
+          size_t tile_col = sample / raw.tile_samples;
+          int sample_in_tile = sample % raw.tile_samples;
+          int count = std::min(raw.tile_samples - sample_in_tile, bbox.max().x() - sample);
+          size_t tile = band * tiles_per_band + tile_row * tiles_per_row + tile_col;
+          char const* in = raw.data + raw.start + tile * tile_size
+            + (line_in_tile * raw.tile_samples + sample_in_tile) * bpp;
+          std::memcpy(out, in, count * bpp);
+          out    += count * bpp;
+          sample += count;
+        }
+      }
+    }
+
+    if (raw.swap && bpp > 1) {
+      for (size_t it = 0; it < pixels.size(); it += bpp)
+        std::reverse(pixels.begin() + it, pixels.begin() + it + bpp);
+    }
+
+    ImageBuffer src;
+    src.data = &pixels[0];
+    src.format = m_format;
+    src.format.cols = bbox.width();
+    src.format.rows = bbox.height();
+    src.cstride = bpp;
+    src.rstride = bpp * bbox.width();
+    src.pstride = bpp * bbox.width() * bbox.height();
+    convert(dest, src);
   }
 
   /// Read the disk image into the given buffer.
@@ -98,8 +230,17 @@ namespace vw {
               << " exceeds image dimensions [" << m_cube->sampleCount()
               << " " << m_cube->lineCount() << "]");
 
+    if (m_raw && BBox2i(0, 0, m_format.cols, m_format.rows).contains(bbox)) {
+      read_raw(dest, bbox);
+      return;
+    }
+
     // Read in the requested tile from the cube file.  Note that ISIS
-    // cube pixel indices appear to be 1-based.
+    // cube pixel indices appear to be 1-based. ISIS reads are not
+    // thread-safe, while the ISIS cameras may now be used by several
+    // threads, so only one thread at a time gets here.
+    static std::mutex isis_read_mutex;
+    std::lock_guard<std::mutex> lock(isis_read_mutex);
     Isis::Portal buffer( bbox.width(), bbox.height(),
                          m_cube->pixelType() );
     buffer.SetPosition(bbox.min().x()+1, bbox.min().y()+1, 1);
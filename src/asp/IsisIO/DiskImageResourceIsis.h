@@ -20,6 +20,12 @@
 ///
 /// Provides support for ISIS image files.
 ///
+/// The pixels of cubes in the tile or band-sequential layout are read
+/// directly from a memory map of the file, the layout having been found
+/// with ISIS when the cube was opened. ISIS is not thread-safe, while
+/// this way several threads can read the same cube at once. Other cubes
+/// are read with ISIS.
+///
 #ifndef __VW_FILEIO_DISK_IMAGE_RESOUCE_ISIS_H__
 #define __VW_FILEIO_DISK_IMAGE_RESOUCE_ISIS_H__
 
@@ -81,7 +87,14 @@ namespace vw {
     bool is_map_projected() const;
 
   private:
+    struct RawCube;
+
+    // Find the layout of the pixel data, if it can be read directly
+    void open_raw();
+    void read_raw(ImageBuffer const& dest, BBox2i const& bbox) const;
+
     boost::shared_ptr<Isis::Cube> m_cube;
+    boost::shared_ptr<RawCube>    m_raw; // Null if reading through ISIS
     std::string m_filename;
     int         m_bytes_per_pixel;
     Vector2i    m_native_block_size;
@@ -30,12 +30,14 @@
 
 // ASP
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/IsisIO/IsisCameraPool.h>
 
 namespace vw {
 namespace camera {
 
   // This is largely just a shortened reimplementation of ISIS's
-  // Camera.cpp.
+  // Camera.cpp. Each thread uses a camera from a pool, so the model
+  // can be used by several threads, see IsisCameraPool.h.
   class IsisCameraModel : public CameraModel {
 
   public:
@@ -43,7 +45,7 @@ namespace camera {
     // Constructors / Destructors
     //------------------------------------------------------------------
     IsisCameraModel(std::string cube_filename) :
-      m_interface(asp::isis::IsisInterface::open( cube_filename )) {}
+      m_pool(new asp::isis::IsisCameraPool( cube_filename )) {}
     virtual std::string type() const { return "Isis"; }
 
     //------------------------------------------------------------------
@@ -54,55 +56,55 @@ namespace camera {
     //  image plane.  Returns a pixel location (col, row) where the
     //  point appears in the image.
     virtual Vector2 point_to_pixel(Vector3 const& point) const {
-      return m_interface->point_to_pixel( point ); }
+      return m_pool->get()->point_to_pixel( point ); }
 
     // Returns a (normalized) pointing vector from the camera center
     //  through the position of the pixel 'pix' on the image plane.
     virtual Vector3 pixel_to_vector (Vector2 const& pix) const {
-      return m_interface->pixel_to_vector( pix ); }
+      return m_pool->get()->pixel_to_vector( pix ); }
 
 
     // Returns the position of the focal point of the camera
     virtual Vector3 camera_center(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_center( pix ); }
+      return m_pool->get()->camera_center( pix ); }
 
     // Pose is a rotation which moves a vector in camera coordinates
     // into world coordinates.
     virtual Quat camera_pose(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_pose( pix ); }
+      return m_pool->get()->camera_pose( pix ); }
 
     // Returns the number of lines is the ISIS cube
-    int lines() const { return m_interface->lines(); }
+    int lines() const { return m_pool->get()->lines(); }
 
     // Returns the number of samples in the ISIS cube
-    int samples() const{ return m_interface->samples(); }
+    int samples() const{ return m_pool->get()->samples(); }
 
     // Returns the serial number of the ISIS cube
     std::string serial_number() const {
-      return m_interface->serial_number(); }
+      return m_pool->get()->serial_number(); }
 
     // Returns the ephemeris time for a pixel
     double ephemeris_time( Vector2 const& pix = Vector2() ) const {
-      return m_interface->ephemeris_time( pix );
+      return m_pool->get()->ephemeris_time( pix );
     }
 
     // Sun position in the target frame's inertial frame
     Vector3 sun_position( Vector2 const& pix = Vector2() ) const {
-      return m_interface->sun_position( pix );
+      return m_pool->get()->sun_position( pix );
     }
 
     // The three main radii that make up the spheroid. Z is out the polar region.
     Vector3 target_radii() const {
-      return m_interface->target_radii();
+      return m_pool->get()->target_radii();
     }
 
     // The spheroid name.
     std::string target_name() const {
-      return m_interface->target_name();
+      return m_pool->get()->target_name();
     }
 
   protected:
-    boost::shared_ptr<asp::isis::IsisInterface> m_interface;
+    boost::shared_ptr<asp::isis::IsisCameraPool> m_pool;
 
     friend std::ostream& operator<<( std::ostream&, IsisCameraModel const& );
   };
@@ -112,7 +114,7 @@ namespace camera {
   inline std::ostream& operator<<( std::ostream& os,
                                    IsisCameraModel const& i ) {
     os << "IsisCameraModel" << i.lines() << "x" << i.samples() << "( "
-       << i.m_interface << " )";
+       << i.m_pool->cube_file() << " )";
     return os;
   }
 
@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/IsisIO/IsisCameraPool.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace asp::isis;
+
+namespace {
+
+  // Opening a cube and making its camera go through ISIS and NAIF
+  // global state, so that is done by one thread at a time.
+  std::mutex & isis_open_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  long next_pool_id() {
+    static std::atomic<long> counter(0);
+    return counter++;
+  }
+
+  // Tools such as bundle_adjust use many cubes in one thread, so each
+  // thread remembers its slot for the last few pools it used.
+  const int NUM_ENTRIES = 8;
+  struct ThreadSlots {
+    long id  [NUM_ENTRIES];
+    int  slot[NUM_ENTRIES];
+    int  next;
+    ThreadSlots(): next(0) {
+      for (int it = 0; it < NUM_ENTRIES; it++)
+        id[it] = -1;
+    }
+  };
+
+  int cameras_from_env() {
+    char const* val = getenv("ASP_ISIS_CAMERAS_PER_CUBE");
+    if (val == NULL)
+      return 1;
+    return std::max(atoi(val), 1);
+  }
+}
+
+int IsisCameraPool::max_cameras_per_cube() {
+  static const int num = cameras_from_env();
+  return num;
+}
+
+IsisCameraPool::IsisCameraPool(std::string const& cube_file):
+  m_cube_file(cube_file), m_next_slot(0), m_id(next_pool_id()) {
+
+  m_slots.resize(max_cameras_per_cube());
+  for (size_t it = 0; it < m_slots.size(); it++)
+    m_slots[it].reset(new Slot);
+
+  std::lock_guard<std::mutex> lock(isis_open_mutex());
+  m_slots[0]->interface.reset(IsisInterface::open(m_cube_file));
+}
+
+IsisCameraPool::Slot & IsisCameraPool::thread_slot() const {
+  static thread_local ThreadSlots slots;
+  for (int it = 0; it < NUM_ENTRIES; it++) {
+    if (slots.id[it] == m_id)
+      return *m_slots[slots.slot[it]];
+  }
+
+  // Threads take the slots in turn. A thread which forgot its slot may
+  // get a different one, which is fine, if slower.
+  int slot = m_next_slot++ % int(m_slots.size());
+  int it = slots.next;
+  slots.id  [it] = m_id;
+  slots.slot[it] = slot;
+  slots.next = (slots.next + 1) % NUM_ENTRIES;
+  return *m_slots[slot];
+}
+
+IsisCameraPool::Handle IsisCameraPool::get() const {
+  Slot & slot = thread_slot();
+  std::unique_lock<std::mutex> lock(slot.mutex);
+  if (!slot.interface) {
+    std::lock_guard<std::mutex> open_lock(isis_open_mutex());
+    slot.interface.reset(IsisInterface::open(m_cube_file));
+  }
+  return Handle(slot.interface.get(), std::move(lock));
+}
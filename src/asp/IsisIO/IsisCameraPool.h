@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IsisCameraPool.h
+///
+/// Several independent IsisInterface objects for the same cube. An ISIS
+/// camera keeps the last image or ground point it was set to, so one
+/// camera cannot be used by several threads at once. The pool makes up
+/// to a given number of cameras for a cube, when threads first ask for
+/// them, and assigns each thread one of them. If there are more threads
+/// than cameras, threads share cameras, and a camera is used by one
+/// thread at a time.
+///
+/// The number of cameras per cube is set with the environment variable
+/// ASP_ISIS_CAMERAS_PER_CUBE. The default is 1, which uses no more
+/// memory than before and serializes all use of the camera.
+
+#ifndef __ASP_ISIS_CAMERA_POOL_H__
+#define __ASP_ISIS_CAMERA_POOL_H__
+
+#include <asp/IsisIO/IsisInterface.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace asp {
+namespace isis {
+
+  class IsisCameraPool {
+    struct Slot {
+      boost::shared_ptr<IsisInterface> interface;
+      std::mutex mutex;
+    };
+
+  public:
+
+    /// A camera for the calling thread. No other thread uses the camera
+    /// while the handle exists.
+    class Handle {
+    public:
+      Handle(IsisInterface * interface, std::unique_lock<std::mutex> && lock):
+        m_interface(interface), m_lock(std::move(lock)) {}
+      IsisInterface * operator->() const { return m_interface; }
+    private:
+      IsisInterface * m_interface;
+      std::unique_lock<std::mutex> m_lock;
+    };
+
+    /// Open the first camera right away, so that errors in the cube show up here
+    IsisCameraPool(std::string const& cube_file);
+
+    Handle get() const;
+
+    std::string const& cube_file() const { return m_cube_file; }
+
+    /// Up to how many cameras to make for each cube
+    static int max_cameras_per_cube();
+
+  private:
+    // The slot of the calling thread
+    Slot & thread_slot() const;
+
+    std::string m_cube_file;
+    std::vector< boost::shared_ptr<Slot> > m_slots;
+    mutable std::atomic<int> m_next_slot;
+    long m_id;
+  };
+
+}}
+
+#endif//__ASP_ISIS_CAMERA_POOL_H__
@@ -15,12 +15,18 @@
 //  limitations under the License.
 // __END_LICENSE__
 
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
 #include <vw/Math/LevenbergMarquardt.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/CameraModel.h>
 #include <asp/IsisIO/IsisInterfaceLineScan.h>
+#include <asp/Core/ProjectionContext.h>
 
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <vector>
 
 #include <Camera.h>
@@ -42,6 +48,35 @@ IsisInterfaceLineScan::IsisInterfaceLineScan( std::string const& filename ) : Is
   m_distortmap = m_camera->DistortionMap();
   m_focalmap   = m_camera->FocalPlaneMap();
   m_detectmap  = m_camera->DetectorMap();
+
+  m_solver_mode = SOLVER_ISIS;
+  char const* mode = getenv("ASP_ISIS_LINESCAN_SOLVER");
+  if (mode != NULL) {
+    std::string val(mode);
+    if (val == "fast")
+      m_solver_mode = SOLVER_FAST;
+    else if (val == "verify")
+      m_solver_mode = SOLVER_VERIFY;
+    else if (val != "isis")
+      vw_throw(ArgumentErr() << "Unknown value of ASP_ISIS_LINESCAN_SOLVER: " << val
+               << ". Use 'isis', 'fast', or 'verify'.\n");
+  }
+  m_have_table       = false;
+  m_sample_scale     = 1.0;
+  m_sample_offset    = 0.0;
+  m_max_verify_error = 0.0;
+  m_num_verified     = 0;
+  m_num_fallbacks    = 0;
+}
+
+IsisInterfaceLineScan::~IsisInterfaceLineScan() {
+  if (m_solver_mode == SOLVER_VERIFY && m_num_verified > 0)
+    vw_out() << "Fast ISIS linescan solver: checked " << m_num_verified
+             << " projections, max difference from ISIS: " << m_max_verify_error
+             << " pixels.\n";
+  if (m_solver_mode != SOLVER_ISIS && m_num_fallbacks > 0)
+    vw_out() << "Fast ISIS linescan solver: used ISIS for " << m_num_fallbacks
+             << " projections where it failed.\n";
 }
 
 // Custom Function to help avoid over invoking the deeply buried
@@ -116,12 +151,12 @@ EphemerisLMA::operator()( EphemerisLMA::domain_type const& x ) const {
   return result;
 }
 
+// Returns a pixel starting from 1, as in ISIS
 Vector2
-IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
+IsisInterfaceLineScan::point_to_pixel_isis( Vector3 const& point, double start_line ) const {
 
-  // First seed LMA with an ephemeris time in the middle of the image
-  double middle = lines() / 2;
-  m_detectmap->SetParent( 1, m_alphacube.AlphaLine(middle) );
+  // First seed LMA with an ephemeris time at the start line
+  m_detectmap->SetParent( 1, m_alphacube.AlphaLine(start_line) );
   double start_e = m_camera->time().Et();
 
   // Build LMA
@@ -164,8 +199,126 @@ IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
   pixel[0] = m_alphacube.BetaSample( pixel[0] );
   pixel[1] = m_alphacube.BetaLine( pixel[1] );
   SetTime( pixel, false );
+  return pixel;
+}
+
+void IsisInterfaceLineScan::make_table() const {
+
+  // The camera position and pose are sampled every few lines. Jitter
+  // faster than that is not captured, which the verify mode would show.
+  const double LINES_PER_SAMPLE = 8.0;
+  int num_lines = lines();
+  int num_intervals = std::max(2, int(std::ceil(num_lines / LINES_PER_SAMPLE)));
+  double t0 = 0.5, dt = double(num_lines) / num_intervals; // Lines start from 1
+
+  // Make sure that SetTime() computes the first position
+  m_c_location = Vector2(std::numeric_limits<double>::quiet_NaN(), 0);
+
+  std::vector<Vector3> positions(num_intervals+1), velocities(num_intervals+1);
+  std::vector<Quat> poses(num_intervals+1);
+  for (int i = 0; i <= num_intervals; i++) {
+    SetTime( Vector2(1, t0 + i*dt), true );
+    positions[i] = m_center;
+    poses[i]     = m_pose;
+  }
+  for (int i = 0; i <= num_intervals; i++) {
+    int prev = std::max(i-1, 0), next = std::min(i+1, num_intervals);
+    velocities[i] = (positions[next] - positions[prev]) / ((next - prev)*dt);
+  }
+  m_position_spline = asp::HermitePositionInterpolation(positions, velocities, t0, dt);
+  m_pose_spline     = asp::HermitePoseInterpolation(poses, t0, dt);
+
+  // The image sample is a linear function of the detector sample
+  double mid_line = t0 + (num_intervals/2)*dt;
+  SetTime( Vector2(1, mid_line), true );
+  double first = m_detectmap->DetectorSample();
+  SetTime( Vector2(samples(), mid_line), true );
+  double last = m_detectmap->DetectorSample();
+  if (last != first)
+    m_sample_scale = (samples() - 1.0) / (last - first);
+  m_sample_offset = 1.0 - m_sample_scale * first;
+
+  m_have_table = true;
+}
+
+bool IsisInterfaceLineScan::line_residual( Vector3 const& point, double line,
+                                           double & residual, double & detector_sample ) const {
+  Vector3 look = inverse(m_pose_spline(line)).rotate( point - m_position_spline(line) );
+  if (look[2] == 0)
+    return false;
+  look = m_camera->FocalLength() * ( look / look[2] );
+  m_distortmap->SetUndistortedFocalPlane( look[0], look[1] );
+  m_focalmap->SetFocalPlane( m_distortmap->FocalPlaneX(),
+                             m_distortmap->FocalPlaneY() );
+  residual        = m_focalmap->DetectorLineOffset() - m_focalmap->DetectorLine();
+  detector_sample = m_focalmap->DetectorSample();
+  return true;
+}
+
+// Secant iterations for the line. This does not change the state of the
+// ISIS camera, other than the focal plane maps, which are set anew
+// before each use.
+bool IsisInterfaceLineScan::point_to_pixel_fast( Vector3 const& point, double start_line,
+                                                 Vector2 & pixel ) const {
+  const int    MAX_ITERATIONS = 20;
+  const double LINE_TOL       = 1e-5;
+
+  double l0 = start_line, l1 = start_line + 1.0, r0, r1, s0, s1;
+  if (!line_residual(point, l0, r0, s0) || !line_residual(point, l1, r1, s1))
+    return false;
+
+  int num_lines = lines();
+  for (int it = 0; it < MAX_ITERATIONS; it++) {
+    if (r1 == r0)
+      return false;
+    double l2 = l1 - r1 * (l1 - l0) / (r1 - r0);
+    l0 = l1;
+    r0 = r1;
+    l1 = l2;
+    // Far outside the image the splines are not to be trusted
+    if (!(l1 > -num_lines && l1 < 2.0*num_lines))
+      return false;
+    if (!line_residual(point, l1, r1, s1))
+      return false;
+    if (std::abs(l1 - l0) < LINE_TOL) {
+      pixel = Vector2(m_sample_scale * s1 + m_sample_offset, l1);
+      return true;
+    }
+  }
+  return false;
+}
+
+Vector2
+IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
+
+  // Start with the line found for the previous point, if any, or else
+  // the middle of the image
+  double start_line = lines() / 2;
+  Vector2 hint;
+  if (asp::ProjectionContext::get_hint(this, hint))
+    start_line = hint[1] + 1; // ISIS pixels start from 1
+
+  Vector2 pixel;
+  if (m_solver_mode == SOLVER_ISIS) {
+    pixel = point_to_pixel_isis(point, start_line);
+  } else {
+    if (!m_have_table)
+      make_table();
+    bool success = point_to_pixel_fast(point, start_line, pixel);
+    if (!success)
+      m_num_fallbacks++;
+    if (!success || m_solver_mode == SOLVER_VERIFY) {
+      Vector2 isis_pixel = point_to_pixel_isis(point, start_line);
+      if (success) {
+        m_num_verified++;
+        m_max_verify_error = std::max(m_max_verify_error, norm_2(isis_pixel - pixel));
+      }
+      pixel = isis_pixel;
+    }
+  }
 
   pixel -= Vector2(1,1);
+  asp::ProjectionContext::set_hint(this, pixel);
   return pixel;
 }
 
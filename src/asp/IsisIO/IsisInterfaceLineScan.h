@@ -26,6 +26,7 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/Camera/SplineInterpolation.h>
 
 #include <string>
 
@@ -40,12 +41,21 @@ namespace Isis {
 namespace asp {
 namespace isis {
 
+  /// The line of a ground point is found by a search in time, with
+  /// the ISIS camera evaluated at each step. Alternatively, the camera
+  /// positions and poses are tabulated once, and the search is done on
+  /// splines fit to them, with ISIS used only if that fails. That is
+  /// selected with the environment variable ASP_ISIS_LINESCAN_SOLVER,
+  /// set to 'isis' (the default), 'fast', or 'verify', which
+  /// does both, returns the ISIS result, and reports the differences.
   class IsisInterfaceLineScan : public IsisInterface {
 
   public:
     IsisInterfaceLineScan( std::string const& file );
 
-    virtual ~IsisInterfaceLineScan() {}
+    virtual ~IsisInterfaceLineScan();
+
+    enum SolverMode { SOLVER_ISIS, SOLVER_FAST, SOLVER_VERIFY };
 
     virtual std::string type()  { return "LineScan"; }
 
@@ -73,6 +83,29 @@ namespace isis {
     mutable vw::Quat    m_pose;
     void SetTime( vw::Vector2 const& px,
                   bool calc=false ) const;
+
+    vw::Vector2 point_to_pixel_isis( vw::Vector3 const& point, double start_line ) const;
+
+    // Return false if the search on the splines fails
+    bool point_to_pixel_fast( vw::Vector3 const& point, double start_line,
+                              vw::Vector2 & pixel ) const;
+
+    // Fit the splines, on first use
+    void make_table() const;
+
+    // How far the point is from being seen by the detector line at the given
+    // image line, in detector lines, and the detector sample where it is seen.
+    // Return false if the point is in the focal plane.
+    bool line_residual( vw::Vector3 const& point, double line,
+                        double & residual, double & detector_sample ) const;
+
+    SolverMode m_solver_mode;
+    mutable bool m_have_table;
+    mutable asp::HermitePositionInterpolation m_position_spline; // As a function of the image line
+    mutable asp::HermitePoseInterpolation     m_pose_spline;
+    mutable double m_sample_scale, m_sample_offset; // Detector sample to image sample
+    mutable double m_max_verify_error;
+    mutable int    m_num_verified, m_num_fallbacks;
   };
 
 }}
@@ -19,8 +19,8 @@
 #include <vw/Math/Vector.h>
 #include <asp/IsisIO/RPNEquation.h>
 
+#include <cmath>
 #include <iomanip>
-#include <stack>
 #include <vector>
 
 #include <boost/algorithm/string/classification.hpp>
@@ -38,15 +38,18 @@ RPNEquation::RPNEquation() {
   m_y_consts.clear();
   m_z_eq.clear();
   m_z_consts.clear();
+  m_x_ops.clear();
+  m_y_ops.clear();
+  m_z_ops.clear();
   m_cached_time = -1;
   m_time_offset = 0;
 }
 RPNEquation::RPNEquation( std::string const& x_eq,
                           std::string const& y_eq,
                           std::string const& z_eq ) {
-  string_to_eqn( x_eq, m_x_eq, m_x_consts );
-  string_to_eqn( y_eq, m_y_eq, m_y_consts );
-  string_to_eqn( z_eq, m_z_eq, m_z_consts );
+  string_to_eqn( x_eq, m_x_eq, m_x_consts, m_x_ops );
+  string_to_eqn( y_eq, m_y_eq, m_y_consts, m_y_ops );
+  string_to_eqn( z_eq, m_z_eq, m_z_consts, m_z_ops );
   m_cached_time = -1;
   m_time_offset = 0;
 }
@@ -56,22 +59,24 @@ RPNEquation::RPNEquation( std::string const& x_eq,
 void RPNEquation::update( double t ) {
   m_cached_time = t;
   double delta_t = t - m_time_offset;
-  m_cached_output[0] = evaluate( m_x_eq,
-                                 m_x_consts,
-                                 delta_t );
-  m_cached_output[1] = evaluate( m_y_eq,
-                                 m_y_consts,
-                                 delta_t );
-  m_cached_output[2] = evaluate( m_z_eq,
-                                 m_z_consts,
-                                 delta_t );
+  m_cached_output[0] = evaluate_ops( m_x_ops,
+                                     m_x_consts,
+                                     delta_t );
+  m_cached_output[1] = evaluate_ops( m_y_ops,
+                                     m_y_consts,
+                                     delta_t );
+  m_cached_output[2] = evaluate_ops( m_z_ops,
+                                     m_z_consts,
+                                     delta_t );
 }
 void RPNEquation::string_to_eqn( std::string const& str,
                                  std::vector<std::string>& commands,
-                                 std::vector<double>& consts ) {
+                                 std::vector<double>& consts,
+                                 std::vector<Op>& ops ) {
   // Breaks a string into the equation format used internally
   commands.clear();
   consts.clear();
+  ops.clear();
   boost::split( commands, str, boost::is_any_of(" ="));
 
   // Cleaning out any tokens that are just ""
@@ -91,89 +96,76 @@ void RPNEquation::string_to_eqn( std::string const& str,
       *iter = "c";
     }
   }
-}
 
-double RPNEquation::evaluate( std::vector<std::string> const& commands,
-                              std::vector<double>& consts,
-                              double t ) {
-  // Evaluates an equation in the internal format
   if ( commands.empty() )
-    return 0;
-  int consts_index = 0;
-  std::stack<double> rpn_stack;
-  double buffer;
+    return;
+
+  // Compiling the commands, checking that each operator will have
+  // its arguments, so evaluation need not.
+  size_t depth = 0;
   for ( std::vector<std::string>::const_iterator iter = commands.begin();
         iter != commands.end(); ++iter ) {
-    if ( *iter == "c" ) {
-      rpn_stack.push( consts[consts_index] );
-      consts_index++;
-    } else if ( *iter == "t" ) {
-      rpn_stack.push( t );
-    } else if ( rpn_stack.size() < 1 ) {
+    Op op;
+    size_t num_args = 0;
+    if      ( *iter == "c"   ) op = OP_CONST;
+    else if ( *iter == "t"   ) op = OP_TIME;
+    else if ( *iter == "sin" ) { op = OP_SIN; num_args = 1; }
+    else if ( *iter == "cos" ) { op = OP_COS; num_args = 1; }
+    else if ( *iter == "tan" ) { op = OP_TAN; num_args = 1; }
+    else if ( *iter == "abs" ) { op = OP_ABS; num_args = 1; }
+    else if ( *iter == "*"   ) { op = OP_MUL; num_args = 2; }
+    else if ( *iter == "/"   ) { op = OP_DIV; num_args = 2; }
+    else if ( *iter == "-"   ) { op = OP_SUB; num_args = 2; }
+    else if ( *iter == "+"   ) { op = OP_ADD; num_args = 2; }
+    else if ( *iter == "^"   ) { op = OP_POW; num_args = 2; }
+    else
+      vw_throw( IOErr() << "Unknown RPN operator: " << *iter << "\n" );
+
+    if ( depth < num_args )
       vw_throw( IOErr() << "Insufficient arguments for RPN command: "
                 << *iter << "\n" );
-    } else if ( *iter == "sin" ) {
-      buffer = sin( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "cos" ) {
-      buffer = cos( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "tan" ) {
-      buffer = tan( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "abs" ) {
-      buffer = fabs( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( rpn_stack.size() < 2 ) {
-      vw_throw( IOErr() << "Insufficient arguments for command: "
-                << *iter << "\n" );
-    } else if ( *iter == "*" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer *= rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "/" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() / buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "-" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() - buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "+" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer += rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "^" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = pow( rpn_stack.top(), buffer );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else {
-      vw_throw( IOErr() << "Unknown RPN operator: " << *iter << "\n" );
-    }
-  } // End of calculator
+    if ( num_args == 0 )
+      depth++;
+    else
+      depth -= num_args - 1;
+    if ( depth > m_stack.size() )
+      m_stack.resize( depth );
+    ops.push_back( op );
+  }
 
-  if ( rpn_stack.size() != 1 )
+  if ( depth != 1 )
     vw_throw( IOErr() << "Unbalanced RPN equation! More constants than need by operators.\n" );
+}
+
+double RPNEquation::evaluate_ops( std::vector<Op> const& ops,
+                                  std::vector<double> const& consts,
+                                  double t ) {
+  // Evaluates an equation already compiled. The stack depth was
+  // checked at compile time.
+  if ( ops.empty() )
+    return 0;
+  double* stack = &m_stack[0];
+  size_t top = 0, c = 0; // One past the top of the stack, and the next constant
+  for ( std::vector<Op>::const_iterator iter = ops.begin();
+        iter != ops.end(); ++iter ) {
+    switch ( *iter ) {
+    case OP_CONST: stack[top++] = consts[c++];       break;
+    case OP_TIME:  stack[top++] = t;                 break;
+    case OP_SIN:   stack[top-1] = sin( stack[top-1] );  break;
+    case OP_COS:   stack[top-1] = cos( stack[top-1] );  break;
+    case OP_TAN:   stack[top-1] = tan( stack[top-1] );  break;
+    case OP_ABS:   stack[top-1] = fabs( stack[top-1] ); break;
+    case OP_MUL:   top--; stack[top-1] *= stack[top];   break;
+    case OP_DIV:   top--; stack[top-1] /= stack[top];   break;
+    case OP_SUB:   top--; stack[top-1] -= stack[top];   break;
+    case OP_ADD:   top--; stack[top-1] += stack[top];   break;
+    case OP_POW:   top--; stack[top-1] = pow( stack[top-1], stack[top] ); break;
+    }
+  } // End of calculator
 
-  return rpn_stack.top();
+  return stack[0];
 }
 
-// FileIO
-//-----------------------------------------------------
 void RPNEquation::write( std::ofstream &f ) {
   for ( int i = 0; i < 3; i++ ) {
     std::vector<std::string>* eq_ptr = NULL;
@@ -213,15 +205,15 @@ void RPNEquation::read( std::ifstream &f ) {
 
   buffer.clear();
   std::getline( f, buffer );
-  string_to_eqn( buffer, m_x_eq, m_x_consts );
+  string_to_eqn( buffer, m_x_eq, m_x_consts, m_x_ops );
 
   buffer.clear();
   std::getline( f, buffer );
-  string_to_eqn( buffer, m_y_eq, m_y_consts );
+  string_to_eqn( buffer, m_y_eq, m_y_consts, m_y_ops );
 
   buffer.clear();
   std::getline( f, buffer );
-  string_to_eqn( buffer, m_z_eq, m_z_consts );
+  string_to_eqn( buffer, m_z_eq, m_z_consts, m_z_ops );
 }
 
 // Constant Access
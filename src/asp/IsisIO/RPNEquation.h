@@ -38,21 +38,34 @@ namespace asp {
   //
   // Remember: Have your equation space delimited
   // Also: 'c' is an internal place holder for RPNEquation
+  //
+  // The commands are compiled into op codes when the equation is
+  // read, so evaluating it does not compare strings. The string form
+  // is kept only for writing the equation back out.
   class RPNEquation : public BaseEquation {
+  public:
+    enum Op { OP_CONST, OP_TIME, OP_SIN, OP_COS, OP_TAN, OP_ABS,
+              OP_MUL, OP_DIV, OP_SUB, OP_ADD, OP_POW };
+  private:
     std::vector<std::string> m_x_eq;
     std::vector<double> m_x_consts;
+    std::vector<Op> m_x_ops;
     std::vector<std::string> m_y_eq;
     std::vector<double> m_y_consts;
+    std::vector<Op> m_y_ops;
     std::vector<std::string> m_z_eq;
     std::vector<double> m_z_consts;
+    std::vector<Op> m_z_ops;
+    std::vector<double> m_stack; // Scratch space, as deep as the deepest equation
 
     void update( double t );
     void string_to_eqn( std::string const& str,
                         std::vector<std::string>& commands,
-                        std::vector<double>& consts );
-    double evaluate( std::vector<std::string> const& commands,
-                     std::vector<double>& consts,
-                     double t );
+                        std::vector<double>& consts,
+                        std::vector<Op>& ops );
+    double evaluate_ops( std::vector<Op> const& ops,
+                         std::vector<double> const& consts,
+                         double t );
   public:
     RPNEquation();
     RPNEquation( std::string const& x_eq,
@@ -0,0 +1,61 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+
+#include <vw/Image/ImageView.h>
+#include <asp/IsisIO/DiskImageResourceIsis.h>
+#include <asp/IsisIO/IsisInterface.h>
+
+#include <Cube.h>
+#include <Portal.h>
+#include <SpecialPixel.h>
+
+using namespace vw;
+
+TEST(DiskImageResourceIsis, raw_read_matches_isis) {
+  if (!asp::isis::IsisEnv()) {
+    vw_out() << "ISISROOT or ISISDATA was not set. ISIS unit tests won't be run."
+             << std::endl;
+    return;
+  }
+
+  // A box which crosses the boundaries of the 128 x 128 tiles of the cube
+  std::string file = "E0201461.tiny.cub";
+  BBox2i box(100, 120, 200, 150);
+  DiskImageResourceIsis rsrc(file);
+  ImageView<float> image(box.width(), box.height());
+  rsrc.read(image.buffer(), box);
+
+  Isis::Cube cube;
+  cube.open(QString::fromStdString(file));
+  Isis::Portal portal(box.width(), box.height(), cube.pixelType());
+  portal.SetPosition(box.min().x() + 1, box.min().y() + 1, 1);
+  cube.read(portal);
+
+  int num_valid = 0;
+  for (int row = 0; row < box.height(); row++) {
+    for (int col = 0; col < box.width(); col++) {
+      double val = portal[row * box.width() + col];
+      if (Isis::IsSpecial(val))
+        continue;
+      EXPECT_NEAR(val, image(col, row), 1e-6 * std::max(1.0, std::abs(val)));
+      num_valid++;
+    }
+  }
+  EXPECT_GT(num_valid, 0);
+}
@@ -126,3 +126,33 @@ TEST(EphemerisEquations, reversepolish) {
   EXPECT_NEAR( 15.4176744337735, test[1], DELTA );
   EXPECT_NEAR( 2737.72972972973, test[2], DELTA );
 }
+
+TEST(EphemerisEquations, batch_evaluate) {
+  RPNEquation rpn( "3 t t * * 1 +", "t sin 4 * t +", "t 2 ^" );
+  PolyEquation poly(0,2,1);
+  poly[0] = 11;
+  poly[1] = -5; poly[2] = 0.6; poly[3] = .1;
+  poly[4] = -4; poly[5] = 2.5;
+
+  std::vector<double> times;
+  times.push_back( -1.5 );
+  times.push_back( 0 );
+  times.push_back( 2.25 );
+
+  Vector3 cached = rpn(7);
+  std::vector<Vector3> rpn_out, poly_out;
+  rpn.evaluate( times, rpn_out );
+  poly.evaluate( times, poly_out );
+  ASSERT_EQ( times.size(), rpn_out.size() );
+  ASSERT_EQ( times.size(), poly_out.size() );
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    EXPECT_VECTOR_NEAR( rpn(times[i]), rpn_out[i], DELTA );
+    EXPECT_VECTOR_NEAR( poly(times[i]), poly_out[i], DELTA );
+  }
+  EXPECT_VECTOR_NEAR( cached, rpn(7), DELTA );
+
+  // Malformed equations are caught when they are read
+  EXPECT_THROW( RPNEquation( "t +", "t", "t" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t 2", "t", "t" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t log", "t", "t" ), IOErr );
+}
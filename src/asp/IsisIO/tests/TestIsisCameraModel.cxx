@@ -39,6 +39,9 @@
 
 #include <boost/foreach.hpp>
 
+#include <cstdlib>
+#include <thread>
+
 using namespace vw;
 using namespace vw::camera;
 
@@ -271,3 +274,60 @@ TEST(IsisCameraModel, camera_model) {
     EXPECT_LT( angle_from_z, 0.5 );
   }
 }
+
+TEST(IsisCameraModel, threads) {
+  if (!asp::isis::IsisEnv()) {
+    vw_out() << "ISISROOT or ISISDATA was not set. ISIS unit tests won't be run."
+	     << std::endl;
+    return;
+  }
+
+  // Several threads using one model get the same results as one thread
+  IsisCameraModel cam("5165r.cub");
+  std::vector<Vector2> pixels;
+  srand( 42 );
+  for ( size_t i = 0; i < 20; i++ )
+    pixels.push_back(generate_random( cam.samples(), cam.lines() ));
+
+  std::vector<Vector3> expected;
+  for ( size_t i = 0; i < pixels.size(); i++ )
+    expected.push_back(cam.pixel_to_vector( pixels[i] ));
+
+  const int num_threads = 4;
+  std::vector< std::vector<Vector3> > results(num_threads);
+  std::vector<std::thread> threads;
+  for ( int t = 0; t < num_threads; t++ ) {
+    threads.push_back(std::thread([&, t]() {
+      for ( size_t i = 0; i < pixels.size(); i++ )
+        results[t].push_back(cam.pixel_to_vector( pixels[i] ));
+    }));
+  }
+  for ( int t = 0; t < num_threads; t++ )
+    threads[t].join();
+
+  for ( int t = 0; t < num_threads; t++ )
+    for ( size_t i = 0; i < pixels.size(); i++ )
+      EXPECT_VECTOR_NEAR( expected[i], results[t][i], 1e-10 );
+}
+
+TEST(IsisCameraModel, fast_linescan) {
+  if (!asp::isis::IsisEnv()) {
+    vw_out() << "ISISROOT or ISISDATA was not set. ISIS unit tests won't be run."
+	     << std::endl;
+    return;
+  }
+
+  // The search on splines finds the same pixels as ISIS
+  IsisCameraModel isis_cam("E1701676.reduce.cub");
+  setenv("ASP_ISIS_LINESCAN_SOLVER", "fast", 1);
+  IsisCameraModel fast_cam("E1701676.reduce.cub");
+  unsetenv("ASP_ISIS_LINESCAN_SOLVER");
+
+  srand( 42 );
+  for ( size_t i = 0; i < 10; i++ ) {
+    Vector2 pixel = generate_random( isis_cam.samples(), isis_cam.lines() );
+    Vector3 point = isis_cam.camera_center( pixel ) + 70000 * isis_cam.pixel_to_vector( pixel );
+    EXPECT_VECTOR_NEAR( isis_cam.point_to_pixel( point ),
+                        fast_cam.point_to_pixel( point ), 0.05 );
+  }
+}
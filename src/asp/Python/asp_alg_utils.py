@@ -103,3 +103,40 @@ def genSegmentList(length, size, padding):
     
     return L
 
+
+def hilbertIndex(order, x, y):
+    '''Return the position of cell (x, y) along a Hilbert curve covering
+       a grid of size 2^order x 2^order.'''
+
+    n = 1 << order
+    d = 0
+    s = n >> 1
+    while s > 0:
+        rx = 1 if (x & s) > 0 else 0
+        ry = 1 if (y & s) > 0 else 0
+        d += s * s * ((3 * rx) ^ ry)
+        # Rotate the quadrant so the curve stays continuous
+        if ry == 0:
+            if rx == 1:
+                x = n - 1 - x
+                y = n - 1 - y
+            x, y = y, x
+        s >>= 1
+    return d
+
+def hilbertOrder(grid_cols, grid_rows):
+    '''Return the indices of the cells of a grid with given dimensions,
+       stored in row-major order, sorted along a Hilbert curve. Consecutive
+       cells in the output are spatial neighbors, except for a few jumps
+       when the grid dimensions are not powers of two.'''
+
+    order = 0
+    while (1 << order) < max(grid_cols, grid_rows):
+        order += 1
+
+    cells = []
+    for row in range(grid_rows):
+        for col in range(grid_cols):
+            cells.append((hilbertIndex(order, col, row), row * grid_cols + col))
+    cells.sort()
+    return [c[1] for c in cells]
@@ -69,6 +69,36 @@ def get_num_cpus():
 
     return num_cpus
 
+def get_numa_node_cpus():
+    """Return, for each NUMA node (socket) of the current machine, the
+    list of its CPUs. This is known only on Linux, and elsewhere, or
+    with one node, a single list is returned."""
+
+    import glob, os, re
+    nodes = []
+    for node_dir in sorted(glob.glob('/sys/devices/system/node/node[0-9]*'),
+                           key=lambda d: int(re.sub(r'.*node', '', d))):
+        try:
+            with open(os.path.join(node_dir, 'cpulist'), 'r') as f:
+                text = f.read().strip()
+        except IOError:
+            continue
+        cpus = []
+        for part in text.split(','):
+            if part == '':
+                continue
+            if '-' in part:
+                (start, stop) = part.split('-')
+                cpus += list(range(int(start), int(stop) + 1))
+            else:
+                cpus.append(int(part))
+        if cpus:
+            nodes.append(cpus)
+
+    if len(nodes) == 0:
+        nodes = [list(range(get_num_cpus()))]
+    return nodes
+
 
 def checkIfToolExists(toolName):
     """Returns true if the system knows about the utility with this name (it is on the PATH)"""
@@ -414,3 +444,91 @@ def executeCommand(cmd,
     
     
     
+
+class JobPool:
+    '''Run shell commands, at most a given number at a time. A job is a
+    list of steps, each a pair of a step name and a command, which are
+    run one after another. Then the later steps of a job, such as
+    calibrating a file after converting it, do not wait for the earlier
+    steps of the other jobs. A job stops at its first failed step. The
+    time of each step is recorded, and a summary per step name can be
+    printed.'''
+
+    def __init__(self, num_workers):
+        self.num_workers = max(int(num_workers), 1)
+        self.pending     = [] # Jobs not started, as lists of steps
+        self.running     = [] # [process, steps left, start time]
+        self.failed      = [] # Commands which failed
+        self.step_names  = [] # In the order they were first seen
+        self.step_times  = {} # Name -> [count, total seconds, longest]
+
+    def add(self, steps):
+        '''Add a job, as a list of (name, command) steps, or as one step.'''
+        if isinstance(steps, tuple):
+            steps = [steps]
+        if len(steps) > 0:
+            self.pending.append(list(steps))
+        self._start_jobs()
+
+    def _start_jobs(self):
+        while len(self.running) < self.num_workers and len(self.pending) > 0:
+            self._start_step(self.pending.pop(0))
+
+    def _start_step(self, steps):
+        cmd = steps[0][1]
+        print(cmd)
+        proc = subprocess.Popen(cmd, shell=True, env=os.environ)
+        self.running.append([proc, steps, time.time()])
+
+    def _record_time(self, name, seconds):
+        if name not in self.step_times:
+            self.step_names.append(name)
+            self.step_times[name] = [0, 0.0, 0.0]
+        times = self.step_times[name]
+        times[0] += 1
+        times[1] += seconds
+        times[2]  = max(times[2], seconds)
+
+    def _check_running(self):
+        '''Start the next steps of the jobs whose current steps are done.
+        Return True if any were done.'''
+        any_done = False
+        for job in list(self.running):
+            (proc, steps, start) = job
+            code = proc.poll()
+            if code is None:
+                continue
+            any_done = True
+            self.running.remove(job)
+            (name, cmd) = steps[0]
+            self._record_time(name, time.time() - start)
+            if code != 0:
+                print('Failed with return code ' + str(code) + ': ' + cmd, file=sys.stderr)
+                self.failed.append(cmd)
+            elif len(steps) > 1:
+                # The next step of the job takes its place
+                self._start_step(steps[1:])
+        self._start_jobs()
+        return any_done
+
+    def wait_all(self, check=True):
+        '''Wait for all jobs to finish. If check is True, raise an
+        exception if any step failed.'''
+        print("Waiting for jobs to finish")
+        while len(self.running) > 0 or len(self.pending) > 0:
+            if not self._check_running():
+                time.sleep(0.05)
+        failed = self.failed
+        self.failed = []
+        if check and len(failed) > 0:
+            raise Exception('Failed to run: ' + '\n'.join(failed))
+
+    def print_timings(self):
+        '''Print, for each step name, how many steps were run, the total
+        of their times, and the longest time.'''
+        if len(self.step_names) == 0:
+            return
+        print('Step times, in seconds (count, total, longest):')
+        for name in self.step_names:
+            (count, total, longest) = self.step_times[name]
+            print('  %-14s %4d %10.1f %10.1f' % (name, count, total, longest))
@@ -0,0 +1,160 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraHandle.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <asp/Sessions/CameraHandle.h>
+#include <asp/Sessions/StereoSessionFactory.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+
+namespace asp {
+
+CameraHandle::CameraHandle(std::string const& session_type,
+                           vw::cartography::GdalWriteOptions const& opt,
+                           std::string const& image_file, std::string const& camera_file,
+                           std::string const& out_prefix):
+  m_session_type(session_type), m_image_file(image_file), m_camera_file(camera_file),
+  m_out_prefix(out_prefix), m_opt(opt), m_tried(false) {}
+
+bool CameraHandle::load(std::string & error) const {
+
+  vw::Mutex::Lock lock(m_mutex);
+  if (!m_tried) {
+    m_tried = true;
+    try {
+      // As in the tools, a session is made for each camera. The session
+      // type is known, so the factory does not guess it again.
+      std::string session_type = m_session_type;
+      boost::scoped_ptr<StereoSession> session
+        (StereoSessionFactory::create(session_type, m_opt,
+                                      m_image_file,  m_image_file,
+                                      m_camera_file, m_camera_file,
+                                      m_out_prefix));
+      m_camera = session->camera_model(m_image_file, m_camera_file);
+    } catch (std::exception const& e) {
+      m_error = e.what();
+      m_camera.reset();
+    }
+  }
+
+  error = m_error;
+  return (m_camera.get() != NULL);
+}
+
+boost::shared_ptr<vw::camera::CameraModel> CameraHandle::camera() const {
+  std::string error;
+  if (!load(error))
+    vw_throw(vw::ArgumentErr() << "Could not load the camera of: " << m_image_file
+             << ". " << error << "\n");
+  return m_camera;
+}
+
+void make_camera_handles(std::string & session_type,
+                         vw::cartography::GdalWriteOptions const& opt,
+                         std::vector<std::string> const& image_files,
+                         std::vector<std::string> const& camera_files,
+                         std::string const& out_prefix,
+                         std::vector<CameraHandlePtr> & handles,
+                         bool & supports_multi_threading) {
+
+  if (camera_files.size() != image_files.size())
+    vw_throw(vw::ArgumentErr() << "Expecting as many cameras as images.\n");
+
+  handles.clear();
+  supports_multi_threading = true;
+  if (image_files.empty())
+    return;
+
+  // Find the session type, if not known, and whether the cameras can
+  // be used from several threads.
+  {
+    boost::scoped_ptr<StereoSession> session
+      (StereoSessionFactory::create(session_type, opt,
+                                    image_files[0],  image_files[0],
+                                    camera_files[0], camera_files[0],
+                                    out_prefix));
+    supports_multi_threading = session->supports_multi_threading();
+  }
+
+  for (size_t it = 0; it < image_files.size(); it++)
+    handles.push_back(CameraHandlePtr(new CameraHandle(session_type, opt, image_files[it],
+                                                       camera_files[it], out_prefix)));
+}
+
+namespace {
+  class LoadCameraTask: public vw::Task, private boost::noncopyable {
+    CameraHandle const& m_handle;
+  public:
+    LoadCameraTask(CameraHandle const& handle): m_handle(handle) {}
+    virtual void operator()() {
+      std::string error;
+      m_handle.load(error); // The error is kept by the handle
+    }
+  };
+}
+
+void prefetch_cameras(std::vector<CameraHandlePtr> const& handles,
+                      bool multi_threaded, int num_threads) {
+
+  if (handles.empty())
+    return;
+
+  // Keep a camera loader while loading, so the XML parser, which the
+  // loader of each session sets up and tears down, is set up only once.
+  CameraModelLoader loader;
+
+  if (num_threads <= 0)
+    num_threads = vw::vw_settings().default_num_threads();
+  vw::FifoWorkQueue queue(multi_threaded ? num_threads : 1);
+  for (size_t it = 0; it < handles.size(); it++) {
+    boost::shared_ptr<LoadCameraTask> task(new LoadCameraTask(*handles[it]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  // Report the error of the first camera, in the order of the inputs
+  for (size_t it = 0; it < handles.size(); it++)
+    handles[it]->camera();
+}
+
+void load_cameras(std::string & session_type,
+                  vw::cartography::GdalWriteOptions const& opt,
+                  std::vector<std::string> const& image_files,
+                  std::vector<std::string> const& camera_files,
+                  std::string const& out_prefix,
+                  std::vector< boost::shared_ptr<vw::camera::CameraModel> > & cameras,
+                  bool & supports_multi_threading) {
+
+  std::vector<CameraHandlePtr> handles;
+  make_camera_handles(session_type, opt, image_files, camera_files, out_prefix,
+                      handles, supports_multi_threading);
+  prefetch_cameras(handles, supports_multi_threading, opt.num_threads);
+
+  cameras.clear();
+  for (size_t it = 0; it < handles.size(); it++)
+    cameras.push_back(handles[it]->camera());
+}
+
+} // end namespace asp
@@ -0,0 +1,103 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraHandle.h
+///
+/// Loading of the cameras of many images. A CameraHandle loads its
+/// camera through a stereo session the first time it is asked for it,
+/// so a tool can make handles for all its images and pay only for the
+/// cameras it uses. load_cameras() loads many cameras in parallel.
+
+#ifndef __ASP_SESSIONS_CAMERA_HANDLE_H__
+#define __ASP_SESSIONS_CAMERA_HANDLE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class CameraHandle: private boost::noncopyable {
+  public:
+
+    /// The session type must be known, as found by StereoSessionFactory::create().
+    CameraHandle(std::string const& session_type,
+                 vw::cartography::GdalWriteOptions const& opt,
+                 std::string const& image_file, std::string const& camera_file,
+                 std::string const& out_prefix = "");
+
+    /// The camera, loaded on the first call. This can be called from
+    /// several threads. If loading failed, each call throws.
+    boost::shared_ptr<vw::camera::CameraModel> camera() const;
+
+    /// Load the camera if not done yet. Return false, and the error, if
+    /// loading failed, rather than throwing.
+    bool load(std::string & error) const;
+
+    std::string const& image_file () const { return m_image_file;  }
+    std::string const& camera_file() const { return m_camera_file; }
+
+  private:
+    std::string m_session_type, m_image_file, m_camera_file, m_out_prefix;
+    vw::cartography::GdalWriteOptions m_opt;
+
+    mutable vw::Mutex   m_mutex;
+    mutable bool        m_tried;
+    mutable std::string m_error;
+    mutable boost::shared_ptr<vw::camera::CameraModel> m_camera;
+  };
+
+  typedef boost::shared_ptr<CameraHandle> CameraHandlePtr;
+
+  /// Make the handles for these images. An empty camera file means the
+  /// camera is in the image file. If the session type is empty, it is
+  /// found from the first image, and returned.
+  void make_camera_handles(std::string & session_type,
+                           vw::cartography::GdalWriteOptions const& opt,
+                           std::vector<std::string> const& image_files,
+                           std::vector<std::string> const& camera_files,
+                           std::string const& out_prefix,
+                           std::vector<CameraHandlePtr> & handles,
+                           bool & supports_multi_threading);
+
+  /// Load the cameras of these handles in parallel, or with one thread
+  /// if multi_threaded is false, as for ISIS cameras. Throw the error
+  /// of the first camera which could not be loaded.
+  void prefetch_cameras(std::vector<CameraHandlePtr> const& handles,
+                        bool multi_threaded, int num_threads);
+
+  /// Load the cameras of these images, in parallel if the session
+  /// supports it. This is make_camera_handles() followed by
+  /// prefetch_cameras().
+  void load_cameras(std::string & session_type,
+                    vw::cartography::GdalWriteOptions const& opt,
+                    std::vector<std::string> const& image_files,
+                    std::vector<std::string> const& camera_files,
+                    std::string const& out_prefix,
+                    std::vector< boost::shared_ptr<vw::camera::CameraModel> > & cameras,
+                    bool & supports_multi_threading);
+
+} // end namespace asp
+
+#endif//__ASP_SESSIONS_CAMERA_HANDLE_H__
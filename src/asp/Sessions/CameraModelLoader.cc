@@ -23,6 +23,7 @@
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Core/Exception.h>
 #include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
 #include <vw/FileIO/FileUtils.h>
 #include <vw/Math/EulerAngles.h>
 #include <vw/Math/Matrix.h>
@@ -40,6 +41,7 @@
 #include <asp/Sessions/CameraModelLoader.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/CameraCache.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <map>
@@ -50,13 +52,22 @@
 
 namespace asp {
 
+// Xerces counts the calls to Initialize() and Terminate(), but these
+// are not thread-safe, and sessions may be made in several threads.
+static vw::Mutex & xerces_init_mutex() {
+  static vw::Mutex mutex;
+  return mutex;
+}
+
 CameraModelLoader::CameraModelLoader()
 {
+  vw::Mutex::Lock lock(xerces_init_mutex());
   xercesc::XMLPlatformUtils::Initialize();
 }
 
 CameraModelLoader::~CameraModelLoader()
 {
+  vw::Mutex::Lock lock(xerces_init_mutex());
   xercesc::XMLPlatformUtils::Terminate();
 }
 
@@ -69,12 +80,18 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_pinhole_camer
 // - TODO: Move to another file
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_rpc_camera_model(std::string const& path) const
 {
+  // Use the cache made from an earlier parsing of this XML file, if current
+  boost::shared_ptr<asp::RPCModel> cached_model;
+  if (read_camera_cache(path, cached_model))
+    return cached_model;
+
   // Try the default loading method
   RPCModel* rpc_model = NULL;
   try {
     RPCXML rpc_xml; // This is for reading XML files
     rpc_xml.read_from_file(path);
     rpc_model = new RPCModel(*rpc_xml.rpc_ptr()); // Copy the value
+    write_camera_cache(path, *rpc_model);
   } catch (...) {
   }
   if (!rpc_model){ // The default loading method failed, try the backup method.
@@ -33,6 +33,7 @@
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
+#include <asp/Core/FileUtils.h>
 #include <asp/Camera/AdjustedLinescanDGModel.h>
 
 #include <boost/filesystem/operations.hpp>
@@ -42,9 +43,42 @@
 #include <string>
 #include <ostream>
 #include <limits>
+#include <sstream>
+#include <unistd.h>
 
 using namespace vw;
 
+namespace {
+
+  // The name of the file keeping in the low-resolution cache directory the
+  // interest point matches of the given images and cameras. The input files
+  // are identified by name, size and time, as they can be very large.
+  std::string match_cache_file(std::string const& session_name,
+                               std::vector<std::string> const& inputs,
+                               vw::Vector2 const& uncropped_image_size,
+                               asp::Vector6f const& stats1, asp::Vector6f const& stats2,
+                               int ip_per_tile, float nodata1, float nodata2) {
+    asp::StereoSettings const& s = asp::stereo_settings();
+    std::ostringstream os;
+    os.precision(17);
+    os << session_name << "\n";
+    for (size_t i = 0; i < inputs.size(); i++)
+      os << asp::file_fingerprint(inputs[i]) << "\n";
+    os << uncropped_image_size << " " << stats1 << " " << stats2 << " "
+       << ip_per_tile << " " << nodata1 << " " << nodata2 << "\n"
+       << s.alignment_method << " " << s.bundle_adjust_prefix << " "
+       << s.ip_per_image << " " << s.ip_matching_method << " "
+       << s.epipolar_threshold << " " << s.ip_inlier_factor << " " << s.ip_uniqueness_thresh << " "
+       << s.ip_nodata_radius << " " << s.ip_triangulation_max_error << " "
+       << s.ip_num_ransac_iterations << " " << s.disable_tri_filtering << " "
+       << s.num_scales << " " << s.ip_edge_buffer_percent << " " << s.ip_normalize_tiles << " "
+       << s.skip_rough_homography << " " << s.skip_image_normalization << " "
+       << s.force_use_entire_range << " " << s.individually_normalize << " "
+       << s.elevation_limit << " " << s.lon_lat_limit << " " << s.min_num_ip;
+    return s.lowres_cache_dir + "/match-"
+      + asp::content_hash(std::vector<std::string>(), os.str()) + ".match";
+  }
+}
 
 namespace asp {
 
@@ -145,7 +179,8 @@ namespace asp {
                                   vw::camera::CameraModel* cam2,
                                   std::string const& match_filename,
                                   std::string const  left_ip_file,
-                                  std::string const  right_ip_file){
+                                  std::string const  right_ip_file,
+                                  bool reuse_ip_files){
 
     vw_out() << "\t--> Matching interest points in StereoSession.\n";
 
@@ -170,11 +205,33 @@ namespace asp {
       return true;
     }
 
+    // Reuse the matches of an earlier run with the same inputs and
+    // settings, possibly with a different output prefix.
+    std::string cache_file;
+    if (stereo_settings().lowres_cache_dir != "" && !crop_left && !crop_right) {
+      std::vector<std::string> inputs;
+      inputs.push_back(input_file1);
+      inputs.push_back(input_file2);
+      inputs.push_back(m_left_camera_file);
+      inputs.push_back(m_right_camera_file);
+      cache_file = match_cache_file(name(), inputs, uncropped_image_size, stats1, stats2,
+                                    ip_per_tile, nodata1, nodata2);
+      if (boost::filesystem::exists(cache_file)) {
+        vw_out() << "\t--> Copying cached match file " << cache_file << " to "
+                 << match_filename << "\n";
+        boost::filesystem::copy_file(cache_file, match_filename,
+                                     boost::filesystem::copy_option::overwrite_if_exists);
+        return true;
+      }
+    }
+
     // If having to rebuild then wipe the old data
-    if (boost::filesystem::exists(left_ip_file)) 
-      boost::filesystem::remove(left_ip_file);
-    if (boost::filesystem::exists(right_ip_file)) 
-      boost::filesystem::remove(right_ip_file);
+    if (!reuse_ip_files) {
+      if (boost::filesystem::exists(left_ip_file)) 
+        boost::filesystem::remove(left_ip_file);
+      if (boost::filesystem::exists(right_ip_file)) 
+        boost::filesystem::remove(right_ip_file);
+    }
     if (boost::filesystem::exists(match_filename)) 
       boost::filesystem::remove(match_filename);
     
@@ -302,6 +359,24 @@ namespace asp {
       boost::filesystem::remove(match_filename);
       vw_throw(IOErr() << "Unable to match left and right images.");
     }
+
+    // Save the matches to the cache. Write to a temporary file first, so
+    // that concurrent runs never see a partial one.
+    if (cache_file != "") {
+      try {
+        std::ostringstream tmp_file;
+        tmp_file << cache_file << ".tmp" << getpid();
+        boost::filesystem::create_directories(stereo_settings().lowres_cache_dir);
+        boost::filesystem::copy_file(match_filename, tmp_file.str(),
+                                     boost::filesystem::copy_option::overwrite_if_exists);
+        boost::filesystem::rename(tmp_file.str(), cache_file);
+        vw_out() << "\t--> Saved the matches to: " << cache_file << "\n";
+      } catch (std::exception const& e) {
+        vw_out(WarningMessage) << "Could not save the matches to: "
+                               << cache_file << ". " << e.what() << "\n";
+      }
+    }
+
     return inlier;
   } // End function ip_matching()
 
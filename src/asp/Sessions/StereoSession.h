@@ -31,6 +31,7 @@
 #include <boost/shared_ptr.hpp>
 #include <asp/Core/Common.h>
 #include <asp/Core/FileUtils.h>
+#include <asp/Core/ImageStats.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Sessions/CameraModelLoader.h>
 
@@ -86,7 +87,8 @@ namespace asp {
     /// Method to help determine what session we actually have
     virtual std::string name() const = 0;
 
-    /// Specialization for how interest points are found
+    /// Specialization for how interest points are found. If reuse_ip_files
+    /// is true, existing ip files, which must be up-to-date, are not wiped.
     bool ip_matching(std::string  const& input_file1,
                      std::string  const& input_file2,
                      vw::Vector2  const& uncropped_image_size,
@@ -98,15 +100,19 @@ namespace asp {
                      vw::camera::CameraModel* cam2,
                      std::string const& match_filename,
                      std::string const left_ip_file ="",
-                     std::string const right_ip_file=""
+                     std::string const right_ip_file="",
+                     bool reuse_ip_files = false
                     );
 
     /// Compute the min, max, mean, and standard deviation of an image object and write them to a log.
     /// - "tag" is only used to make the log messages more descriptive.
     /// - If prefix and image_path is set, will cache the results to a file.
+    /// - If shared_key is set, also cache them next to the image, for any tool
+    ///   and output prefix. The key must identify the masking, see image_stats_key().
     template <class ViewT> static inline
     Vector6f gather_stats( vw::ImageViewBase<ViewT> const& view_base, std::string const& tag,
-                           std::string const& prefix="", std::string const& image_path="");
+                           std::string const& prefix="", std::string const& image_path="",
+                           std::string const& shared_key="");
 
     /// Normalize the intensity of two grayscale images based on input statistics
     template<class ImageT> static inline
@@ -272,7 +278,8 @@ namespace asp {
 
 template <class ViewT>
 Vector6f StereoSession::gather_stats( vw::ImageViewBase<ViewT> const& view_base, std::string const& tag,
-                                      std::string const& prefix, std::string const& image_path) {
+                                      std::string const& prefix, std::string const& image_path,
+                                      std::string const& shared_key) {
   using namespace vw;
   Vector6f result;
 
@@ -284,6 +291,8 @@ Vector6f StereoSession::gather_stats( vw::ImageViewBase<ViewT> const& view_base,
   if (use_cache)
     cache_path = prefix + '-' + boost::filesystem::path(image_path).stem().string() + "-stats.tif";
 
+  std::vector<double> shared_stats;
+
   // Check if this stats file was computed after any image modifications.
   if ((use_cache && asp::is_latest_timestamp(cache_path, image_path)) ||
       (stereo_settings().force_reuse_match_files && boost::filesystem::exists(cache_path))) {
@@ -292,6 +301,18 @@ Vector6f StereoSession::gather_stats( vw::ImageViewBase<ViewT> const& view_base,
     read_vector(stats, cache_path); // Just fetch the stats from the file on disk.
     result = stats;
 
+  } else if (shared_key != "" && image_path != "" &&
+             asp::read_image_stats_cache(image_path, shared_key, shared_stats) &&
+             shared_stats.size() == result.size()) {
+    // Computed by another tool or with another output prefix
+    vw_out(InfoMessage) << "\t--> Reading statistics cached for " + image_path << std::endl;
+    for (size_t it = 0; it < result.size(); it++)
+      result[it] = shared_stats[it];
+    if (use_cache) {
+      Vector<float32> stats = result;  // cast
+      write_vector(cache_path, stats);
+    }
+
   } else { // Compute the results
 
     // Compute statistics at a reduced resolution
@@ -301,22 +322,16 @@ Vector6f StereoSession::gather_stats( vw::ImageViewBase<ViewT> const& view_base,
 
     vw_out(InfoMessage) << " using downsample scale: " << stat_scale << std::endl;
 
-    ChannelAccumulator<vw::math::CDFAccumulator<float> > accumulator;
-    for_each_pixel( subsample( edge_extend(image, ConstantEdgeExtension()),
-                              stat_scale ),
-                    accumulator );
-
-    // Compute the CDF in parallel.
-    // -> Turned off because it makes the unit tests non-deterministic.
-    //Vector2i block_size(256,256);
-    //int buffer_size = 100000; // TODO: If this gets too large the CDFAccumulator class fails!
-    //vw::math::CDFAccumulator<float> accumulator(buffer_size);
-    //block_cdf_computation(image, accumulator, stat_scale, block_size);
-
-    result[0] = accumulator.quantile(0); // Min
-    result[1] = accumulator.quantile(1); // Max
-    result[2] = accumulator.approximate_mean();
-    result[3] = accumulator.approximate_stddev();
+    // In one pass, in parallel. The bands are merged in order, so the
+    // results are the same with any number of threads.
+    asp::StreamingStats accumulator
+      = asp::image_stats(subsample(edge_extend(image, ConstantEdgeExtension()), stat_scale),
+                         vw_settings().default_num_threads());
+
+    result[0] = accumulator.min();
+    result[1] = accumulator.max();
+    result[2] = accumulator.mean();
+    result[3] = accumulator.stddev();
     result[4] = accumulator.quantile(0.02); // Percentile values
     result[5] = accumulator.quantile(0.98);
 
@@ -326,6 +341,12 @@ Vector6f StereoSession::gather_stats( vw::ImageViewBase<ViewT> const& view_base,
       Vector<float32> stats = result;  // cast
       write_vector(cache_path, stats);
     }
+    if (shared_key != "" && image_path != "") {
+      shared_stats.resize(result.size());
+      for (size_t it = 0; it < result.size(); it++)
+        shared_stats[it] = result[it];
+      asp::write_image_stats_cache(image_path, shared_key, shared_stats);
+    }
 
   } // Done computing the results
 
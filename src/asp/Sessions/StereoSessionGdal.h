@@ -190,11 +190,17 @@ namespace asp {
     ImageViewRef< PixelMask<float> > right_masked_image
       = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
-    // Compute input image statistics
-    Vector6f left_stats  = gather_stats(left_masked_image,  "left",
-                                        this->m_out_prefix, left_cropped_file);
-    Vector6f right_stats = gather_stats(right_masked_image, "right",
-                                        this->m_out_prefix, right_cropped_file);
+    // Compute input image statistics, for both images at the same time
+    Vector6f left_stats, right_stats;
+    asp::run_in_parallel([&]() {
+        left_stats  = gather_stats(left_masked_image,  "left",
+                                   this->m_out_prefix, left_cropped_file,
+                                   asp::image_stats_key(left_cropped_file, left_nodata_value));
+      }, [&]() {
+        right_stats = gather_stats(right_masked_image, "right",
+                                   this->m_out_prefix, right_cropped_file,
+                                   asp::image_stats_key(right_cropped_file, right_nodata_value));
+      });
 
     ImageViewRef< PixelMask<float> > Limg, Rimg;
     std::string lcase_file = boost::to_lower_copy(this->m_left_camera_file);
@@ -225,7 +231,7 @@ namespace asp {
 
       // Load the interest points results from the file we just wrote.
       std::vector<ip::InterestPoint> left_ip, right_ip;
-      ip::read_binary_match_file(match_filename, left_ip, right_ip);
+      asp::read_match_file(match_filename, left_ip, right_ip);
 
       // Initialize alignment matrices and get the input image sizes.
       Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
@@ -280,26 +286,30 @@ namespace asp {
     float output_nodata = -32768.0;
 
     // The left image is written out with no alignment warping.
+    // The two images are written at the same time.
     vw_out() << "\t--> Writing pre-aligned images.\n";
     vw_out() << "\t--> Writing: " << left_output_file << ".\n";
-    block_write_gdal_image( left_output_file, apply_mask(Limg, output_nodata),
-                            has_left_georef, left_georef,
-                            has_nodata, output_nodata, options,
-                            TerminalProgressCallback("asp","\t  L:  ") );
-
     vw_out() << "\t--> Writing: " << right_output_file << ".\n";
-    if ( stereo_settings().alignment_method == "none" )
-      block_write_gdal_image( right_output_file, apply_mask(Rimg, output_nodata),
-                              has_right_georef, right_georef,
-                              has_nodata, output_nodata, options,
-                              TerminalProgressCallback("asp","\t  R:  ") );
-    else // Write out the right image cropped to align with the left image.
-      block_write_gdal_image( right_output_file,
-                              apply_mask(crop(edge_extend(Rimg, ConstantEdgeExtension()),
-                                         bounding_box(Limg)), output_nodata),
-                              has_right_georef, right_georef,
-                              has_nodata, output_nodata, options,
-                              TerminalProgressCallback("asp","\t  R:  ") );
+    vw::cartography::GdalWriteOptions half_options = asp::half_threads(options);
+    asp::run_in_parallel([&]() {
+        block_write_gdal_image( left_output_file, apply_mask(Limg, output_nodata),
+                                has_left_georef, left_georef,
+                                has_nodata, output_nodata, half_options,
+                                TerminalProgressCallback("asp","\t  L:  ") );
+      }, [&]() {
+        if ( stereo_settings().alignment_method == "none" )
+          block_write_gdal_image( right_output_file, apply_mask(Rimg, output_nodata),
+                                  has_right_georef, right_georef,
+                                  has_nodata, output_nodata, half_options,
+                                  TerminalProgressCallback("asp","\t  R:  ") );
+        else // Write out the right image cropped to align with the left image.
+          block_write_gdal_image( right_output_file,
+                                  apply_mask(crop(edge_extend(Rimg, ConstantEdgeExtension()),
+                                             bounding_box(Limg)), output_nodata),
+                                  has_right_georef, right_georef,
+                                  has_nodata, output_nodata, half_options,
+                                  TerminalProgressCallback("asp","\t  R:  ") );
+      });
   } // End function pre_preprocessing_hook
 
 
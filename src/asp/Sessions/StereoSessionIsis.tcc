@@ -48,6 +48,7 @@
 #include <asp/Core/PhotometricOutlier.h>
 #include <asp/Camera/CsmModel.h>
 #include <asp/IsisIO/IsisCameraModel.h>
+#include <asp/IsisIO/IsisCameraPool.h>
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 #include <asp/IsisIO/Equation.h>
 
@@ -207,7 +208,11 @@ void write_preprocessed_isis_image( vw::cartography::GdalWriteOptions const& opt
 }
 
 
+/// ISIS cameras can be used by several threads if there is more than
+/// one camera per cube, see IsisCameraPool.h.
 bool StereoSessionIsis::supports_multi_threading () const {
+  if (asp::isis::IsisCameraPool::max_cameras_per_cube() > 1)
+    return true;
   return (asp::CsmModel::file_has_isd_extension(m_left_camera_file ) && 
           asp::CsmModel::file_has_isd_extension(m_right_camera_file)   );
 }
@@ -290,13 +295,18 @@ pre_preprocessing_hook(bool adjust_left_image_size,
   boost::shared_ptr<DiskImageResourceIsis>
     left_isis_rsrc (new DiskImageResourceIsis(left_input_file )),
     right_isis_rsrc(new DiskImageResourceIsis(right_input_file));
+  // The two images are read at the same time.
   float left_lo, left_hi, right_lo, right_hi;
-  ImageViewRef< PixelMask <float> > left_masked_image
-    = find_ideal_isis_range(left_disk_image, left_isis_rsrc, left_nodata_value,
-                            "left", will_apply_user_nodata_left, left_lo, left_hi);
-  ImageViewRef< PixelMask <float> > right_masked_image
-    = find_ideal_isis_range(right_disk_image, right_isis_rsrc, right_nodata_value,
-                            "right", will_apply_user_nodata_right, right_lo, right_hi);
+  ImageViewRef< PixelMask <float> > left_masked_image, right_masked_image;
+  asp::run_in_parallel([&]() {
+      left_masked_image
+        = find_ideal_isis_range(left_disk_image, left_isis_rsrc, left_nodata_value,
+                                "left", will_apply_user_nodata_left, left_lo, left_hi);
+    }, [&]() {
+      right_masked_image
+        = find_ideal_isis_range(right_disk_image, right_isis_rsrc, right_nodata_value,
+                                "right", will_apply_user_nodata_right, right_lo, right_hi);
+    });
 
   // Handle mutual normalization if requested
   float left_lo_out  = left_lo,  left_hi_out  = left_hi,
@@ -355,7 +365,7 @@ pre_preprocessing_hook(bool adjust_left_image_size,
                      );
     // Read in the interest point data we just wrote to disk
     std::vector<ip::InterestPoint> left_ip, right_ip;
-    ip::read_binary_match_file(match_filename, left_ip, right_ip);
+    asp::read_match_file(match_filename, left_ip, right_ip);
 
     // Compute the appropriate transform matrix between the two input images.
     if ( stereo_settings().alignment_method == "homography" ) {
@@ -387,17 +397,21 @@ pre_preprocessing_hook(bool adjust_left_image_size,
   // Apply alignment and normalization
   bool will_apply_user_nodata = ( will_apply_user_nodata_left || will_apply_user_nodata_right);
 
-  // Write output images
-  write_preprocessed_isis_image( options, will_apply_user_nodata,
-                                 left_masked_image, left_output_file, "left",
-                                 left_lo, left_hi, left_lo_out, left_hi_out,
-                                 align_left_matrix, left_size,
-                                 has_left_georef, left_georef);
-  write_preprocessed_isis_image( options, will_apply_user_nodata,
-                                 right_masked_image, right_output_file, "right",
-                                 right_lo, right_hi, right_lo_out, right_hi_out,
-                                 align_right_matrix, right_size,
-                                 has_right_georef, right_georef);
+  // Write output images, both at the same time
+  vw::cartography::GdalWriteOptions half_options = asp::half_threads(options);
+  asp::run_in_parallel([&]() {
+      write_preprocessed_isis_image( half_options, will_apply_user_nodata,
+                                     left_masked_image, left_output_file, "left",
+                                     left_lo, left_hi, left_lo_out, left_hi_out,
+                                     align_left_matrix, left_size,
+                                     has_left_georef, left_georef);
+    }, [&]() {
+      write_preprocessed_isis_image( half_options, will_apply_user_nodata,
+                                     right_masked_image, right_output_file, "right",
+                                     right_lo, right_hi, right_lo_out, right_hi_out,
+                                     align_right_matrix, right_size,
+                                     has_right_georef, right_georef);
+    });
 }
 
 // Only used with mask_flatfield option?
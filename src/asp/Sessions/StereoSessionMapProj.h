@@ -27,6 +27,9 @@
 #include <asp/Sessions/StereoSessionGdal.h>
 #include <asp/Sessions/StereoSessionPinhole.h>
 #include <asp/Camera/CsmModel.h>
+#if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
+#include <asp/IsisIO/IsisCameraPool.h>
+#endif
 #include <vw/Cartography/Map2CamTrans.h>
 #include <vw/Image/Transform.h>
 
@@ -104,8 +107,13 @@ namespace asp {
     virtual std::string name() const { return "isismapisis"; }
     virtual bool uses_rpc_map_projection() const {return false;}
 
-    /// Only the alternative CSM sensor model for ISIS images supports multi threading.
+    /// The CSM sensor model for ISIS images supports multi threading, and
+    /// the ISIS one does with more than one camera per cube.
     virtual bool supports_multi_threading() const {
+#if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
+      if (asp::isis::IsisCameraPool::max_cameras_per_cube() > 1)
+        return true;
+#endif
       return (asp::CsmModel::file_has_isd_extension(m_left_camera_file ) && 
               asp::CsmModel::file_has_isd_extension(m_right_camera_file)   );
     }
@@ -21,6 +21,7 @@
 
 //#include <asp/Core/StereoSettings.h>
 #include <asp/Core/AffineEpipolar.h>
+#include <asp/Core/MatchFile.h>
 #include <asp/Sessions/StereoSessionNadirPinhole.h>
 
 #include <vw/Camera/CameraModel.h>
@@ -71,9 +72,11 @@ void asp::StereoSessionNadirPinhole::pre_preprocessing_hook(bool adjust_left_ima
     = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
   Vector6f left_stats  = gather_stats(left_masked_image,  "left",
-                                      this->m_out_prefix, left_cropped_file);
+                                      this->m_out_prefix, left_cropped_file,
+                                      asp::image_stats_key(left_cropped_file, left_nodata_value));
   Vector6f right_stats = gather_stats(right_masked_image, "right",
-                                      this->m_out_prefix, right_cropped_file);
+                                      this->m_out_prefix, right_cropped_file,
+                                      asp::image_stats_key(right_cropped_file, right_nodata_value));
 
   ImageViewRef< PixelMask<float> > Limg, Rimg;
   std::string lcase_file = boost::to_lower_copy(m_left_camera_file);
@@ -157,7 +160,7 @@ void asp::StereoSessionNadirPinhole::pre_preprocessing_hook(bool adjust_left_ima
                      );
 
     std::vector<ip::InterestPoint> left_ip, right_ip;
-    ip::read_binary_match_file( match_filename, left_ip, right_ip  );
+    asp::read_match_file( match_filename, left_ip, right_ip  );
 
     Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
                    align_right_matrix = math::identity_matrix<3>();
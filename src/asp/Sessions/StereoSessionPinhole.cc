@@ -89,7 +89,7 @@ asp::StereoSessionPinhole::determine_image_align(std::string const& out_prefix,
                    );
 
   std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
-  read_binary_match_file( match_filename,
+  asp::read_match_file( match_filename,
                           matched_ip1, matched_ip2 );
 
   // Get the matrix using RANSAC
@@ -150,9 +150,11 @@ void asp::StereoSessionPinhole::pre_preprocessing_hook(bool adjust_left_image_si
     = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
   Vector6f left_stats  = gather_stats(left_masked_image,  "left",
-                                      this->m_out_prefix, left_cropped_file);
+                                      this->m_out_prefix, left_cropped_file,
+                                      asp::image_stats_key(left_cropped_file, left_nodata_value));
   Vector6f right_stats = gather_stats(right_masked_image, "right",
-                                      this->m_out_prefix, right_cropped_file);
+                                      this->m_out_prefix, right_cropped_file,
+                                      asp::image_stats_key(right_cropped_file, right_nodata_value));
 
   // Use no-data in interpolation and edge extension.
   PixelMask<float> nodata_pix(0);
@@ -163,7 +163,7 @@ namespace asp {
 
       // Load the interest points results from the file we just wrote.
       std::vector<ip::InterestPoint> left_ip, right_ip;
-      ip::read_binary_match_file(match_filename, left_ip, right_ip);
+      asp::read_match_file(match_filename, left_ip, right_ip);
 
       // Initialize alignment matrices and get the input image sizes.
       Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
@@ -0,0 +1,192 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file EphemerisTable.cc
+///
+
+#include <asp/SpiceIO/EphemerisTable.h>
+#include <vw/Core/Exception.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vw;
+
+namespace {
+
+  const char     MAGIC[8]   = {'A', 'S', 'P', 'E', 'P', 'H', 'E', 'M'};
+  const uint32_t BYTE_ORDER = 0x01020304;
+
+  // Followed by the records. Its size keeps those 8-byte aligned.
+  struct Header {
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t record_size;
+    int64_t  num;
+    double   t0, dt;
+  };
+}
+
+namespace asp {
+namespace spice {
+
+  void EphemerisTable::write(std::string const& filename, double t0, double dt,
+                             std::vector<Vector3> const& positions,
+                             std::vector<Vector3> const& velocities,
+                             std::vector<Quat>    const& poses) {
+
+    if (positions.size() < 2 || velocities.size() != positions.size() ||
+        poses.size() != positions.size() || dt <= 0)
+      vw_throw(ArgumentErr() << "An ephemeris table needs at least two samples, "
+               << "as many positions, velocities and poses, and a positive time interval.\n");
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.byte_order  = BYTE_ORDER;
+    header.record_size = RECORD_SIZE;
+    header.num         = positions.size();
+    header.t0          = t0;
+    header.dt          = dt;
+
+    std::vector<double> records(RECORD_SIZE * positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+      double * r = &records[RECORD_SIZE * i];
+      for (int c = 0; c < 3; c++) {
+        r[c]     = positions [i][c];
+        r[c + 3] = velocities[i][c];
+      }
+      for (int c = 0; c < 4; c++)
+        r[c + 6] = poses[i][c];
+    }
+
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    ofs.write((char const*)&header, sizeof(header));
+    ofs.write((char const*)&records[0], records.size() * sizeof(double));
+    if (!ofs.good())
+      vw_throw(IOErr() << "Could not write the ephemeris table: " << filename << "\n");
+  }
+
+  EphemerisTable::EphemerisTable(std::string const& filename):
+    m_map(NULL), m_map_size(0), m_records(NULL), m_t0(0), m_dt(1), m_num(0) {
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      vw_throw(IOErr() << "Could not open the ephemeris table: " << filename << "\n");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+      close(fd);
+      vw_throw(IOErr() << "Invalid ephemeris table: " << filename << "\n");
+    }
+    m_map_size = st.st_size;
+    m_map = mmap(NULL, m_map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m_map == MAP_FAILED) {
+      m_map = NULL;
+      vw_throw(IOErr() << "Could not map the ephemeris table: " << filename << "\n");
+    }
+
+    Header const& header = *(Header const*)m_map;
+    std::string err;
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+      err = "Invalid ephemeris table: " + filename;
+    else if (header.byte_order != BYTE_ORDER)
+      err = "The ephemeris table " + filename
+        + " was written on a machine with a different byte order.";
+    else if (header.record_size != uint32_t(RECORD_SIZE) || header.num < 2 || !(header.dt > 0) ||
+             m_map_size != sizeof(Header) + header.num * RECORD_SIZE * sizeof(double))
+      err = "Invalid ephemeris table: " + filename;
+    if (!err.empty()) {
+      munmap(m_map, m_map_size);
+      m_map = NULL;
+      vw_throw(IOErr() << err << "\n");
+    }
+
+    m_t0      = header.t0;
+    m_dt      = header.dt;
+    m_num     = header.num;
+    m_records = (double const*)((char const*)m_map + sizeof(Header));
+  }
+
+  EphemerisTable::~EphemerisTable() {
+    if (m_map != NULL)
+      munmap(m_map, m_map_size);
+  }
+
+  int EphemerisTable::interval(double t, double & u) const {
+    double s = (t - m_t0) / m_dt;
+    // Allow for roundoff at the ends
+    if (!(s >= -1e-8 && s <= m_num - 1 + 1e-8))
+      vw_throw(ArgumentErr() << "Time " << t << " is outside the ephemeris table, which spans "
+               << m_t0 << " to " << end_time() << ".\n");
+    int i = std::min(std::max(int(std::floor(s)), 0), m_num - 2);
+    u = s - i;
+    return i;
+  }
+
+  Vector3 EphemerisTable::position(double t) const {
+    double u;
+    int i = interval(t, u);
+    double const* a = record(i);
+    double const* b = record(i + 1);
+
+    // Hermite basis functions, with the velocities scaled to the interval
+    double u2 = u*u, u3 = u2*u;
+    double h00 = 2*u3 - 3*u2 + 1, h10 = u3 - 2*u2 + u;
+    double h01 = -2*u3 + 3*u2,    h11 = u3 - u2;
+    Vector3 result;
+    for (int c = 0; c < 3; c++)
+      result[c] = h00*a[c] + h10*m_dt*a[c+3] + h01*b[c] + h11*m_dt*b[c+3];
+    return result;
+  }
+
+  Quat EphemerisTable::pose(double t) const {
+    double u;
+    int i = interval(t, u);
+    double const* a = record(i) + 6;
+    double const* b = record(i + 1) + 6;
+
+    // A quaternion and its negative are the same rotation
+    double sign = (a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3] < 0) ? -1.0 : 1.0;
+    Quat q((1-u)*a[0] + sign*u*b[0], (1-u)*a[1] + sign*u*b[1],
+           (1-u)*a[2] + sign*u*b[2], (1-u)*a[3] + sign*u*b[3]);
+    return normalize(q);
+  }
+
+  void EphemerisTable::positions(std::vector<double> const& times,
+                                 std::vector<Vector3> & result) const {
+    result.resize(times.size());
+    for (size_t it = 0; it < times.size(); it++)
+      result[it] = position(times[it]);
+  }
+
+  void EphemerisTable::poses(std::vector<double> const& times,
+                             std::vector<Quat> & result) const {
+    result.resize(times.size());
+    for (size_t it = 0; it < times.size(); it++)
+      result[it] = pose(times[it]);
+  }
+
+}} // namespace asp::spice
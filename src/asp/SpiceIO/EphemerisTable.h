@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file EphemerisTable.h
+///
+/// Camera positions, velocities and poses sampled at uniform times, in
+/// a compact binary file. The file is made once, such as from SPICE
+/// kernels with write_body_state_table(), and is then memory-mapped, so
+/// opening it costs nothing and the pages are shared among processes.
+/// Lookups need no SPICE calls. Positions are interpolated with cubic
+/// Hermite polynomials using the stored velocities, and poses by
+/// normalized linear interpolation of the quaternions.
+///
+/// The file is in the byte order of the machine which wrote it, which
+/// is checked when it is opened.
+
+#ifndef __ASP_SPICEIO_EPHEMERIS_TABLE_H__
+#define __ASP_SPICEIO_EPHEMERIS_TABLE_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+namespace spice {
+
+  class EphemerisTable {
+  public:
+
+    /// Write a table. All vectors must have the same size, of at least two.
+    static void write(std::string const& filename, double t0, double dt,
+                      std::vector<vw::Vector3> const& positions,
+                      std::vector<vw::Vector3> const& velocities,
+                      std::vector<vw::Quat>    const& poses);
+
+    /// Map a table into memory
+    EphemerisTable(std::string const& filename);
+    ~EphemerisTable();
+
+    double t0       () const { return m_t0; }
+    double dt       () const { return m_dt; }
+    double end_time () const { return m_t0 + m_dt * (m_num - 1); }
+    int    num_samples() const { return m_num; }
+
+    /// Times must be within the table
+    vw::Vector3 position(double t) const;
+    vw::Quat    pose    (double t) const;
+
+    /// Look up many times at once
+    void positions(std::vector<double> const& times, std::vector<vw::Vector3> & result) const;
+    void poses    (std::vector<double> const& times, std::vector<vw::Quat>    & result) const;
+
+  private:
+    EphemerisTable(EphemerisTable const&);
+    EphemerisTable& operator=(EphemerisTable const&);
+
+    // The sample interval of a time, and the position in it, in [0, 1]
+    int interval(double t, double & u) const;
+
+    // Each record is the position, velocity, and the quaternion w, x, y, z
+    static const int RECORD_SIZE = 10;
+    double const* record(int i) const { return m_records + RECORD_SIZE * i; }
+
+    void        * m_map;
+    size_t        m_map_size;
+    double const* m_records;
+    double        m_t0, m_dt;
+    int           m_num;
+  };
+
+}} // namespace asp::spice
+
+#endif//__ASP_SPICEIO_EPHEMERIS_TABLE_H__
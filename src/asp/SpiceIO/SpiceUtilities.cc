@@ -20,10 +20,13 @@
 ///
 
 #include <asp/SpiceIO/SpiceUtilities.h>
+#include <asp/SpiceIO/EphemerisTable.h>
 
 #include "SpiceUsr.h"
 #include "SpiceZfc.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <list>
@@ -231,6 +234,43 @@ namespace spice {
     CHECK_SPICE_ERROR();
   }
 
+  void body_state(std::vector<double> const& times,
+                  std::vector<Vector3> &position,
+                  std::vector<Vector3> &velocity,
+                  std::vector<Quat > &pose,
+                  std::string const& spacecraft,
+                  std::string const& reference_frame,
+                  std::string const& planet,
+                  std::string const& instrument) {
+    position.resize(times.size());
+    velocity.resize(times.size());
+    pose.resize(times.size());
+    for (size_t it = 0; it < times.size(); it++)
+      body_state(times[it], position[it], velocity[it], pose[it],
+                 spacecraft, reference_frame, planet, instrument);
+  }
+
+  void write_body_state_table(std::string const& filename,
+                              double begin_time, double end_time, double interval,
+                              std::string const& spacecraft,
+                              std::string const& reference_frame,
+                              std::string const& planet,
+                              std::string const& instrument) {
+    if (!(interval > 0) || !(end_time > begin_time))
+      vw_throw(ArgumentErr() << "Need a positive interval and an end time after the begin time.\n");
+
+    int num_intervals = std::max(1, int(ceil((end_time - begin_time) / interval)));
+    std::vector<double> times(num_intervals + 1);
+    for (int it = 0; it <= num_intervals; it++)
+      times[it] = begin_time + it * interval;
+
+    std::vector<Vector3> position, velocity;
+    std::vector<Quat> pose;
+    body_state(times, position, velocity, pose,
+               spacecraft, reference_frame, planet, instrument);
+    EphemerisTable::write(filename, begin_time, interval, position, velocity, pose);
+  }
+
   // Load all relevent SPICE kernels.
   //
   // Someday, rather than hard coding these values, the user might be
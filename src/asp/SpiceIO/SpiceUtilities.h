@@ -69,6 +69,25 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument);
 
+  /// The state at each of the given times
+  void body_state(std::vector<double> const& times,
+                  std::vector<vw::Vector3> &position,
+                  std::vector<vw::Vector3> &velocity,
+                  std::vector<vw::Quaternion<double> > &pose,
+                  std::string const& spacecraft,
+                  std::string const& reference_frame,
+                  std::string const& planet,
+                  std::string const& instrument);
+
+  /// Sample the state every given interval, from the begin time to at
+  /// least the end time, and save it as an EphemerisTable.
+  void write_body_state_table(std::string const& filename,
+                              double begin_time, double end_time, double interval,
+                              std::string const& spacecraft,
+                              std::string const& reference_frame,
+                              std::string const& planet,
+                              std::string const& instrument);
+
 }} // namespace asp::spice
 
 #endif // __SPICE_H__
@@ -0,0 +1,85 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Tools/StereoPipeline.h>
+#include <xercesc/util/PlatformUtils.hpp>
+
+using namespace vw;
+
+namespace asp {
+
+StereoPipeline::StereoPipeline(int argc, char* argv[]) {
+  for (int i = 0; i < argc; i++)
+    m_args.push_back(argv[i]);
+
+  xercesc::XMLPlatformUtils::Initialize();
+  stereo_register_sessions();
+}
+
+StereoPipeline::~StereoPipeline() {
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+void StereoPipeline::parse(std::string & output_prefix,
+                           std::vector<ASPGlobalOptions> & opt_vec) {
+
+  // The parser takes non-const strings, so give it copies
+  std::vector<std::string> args = m_args;
+  std::vector<char*> argv;
+  for (size_t i = 0; i < args.size(); i++)
+    argv.push_back(&args[i][0]);
+  argv.push_back(NULL);
+
+  // All stereo options are parsed whichever description is passed
+  bool verbose = false;
+  opt_vec.clear();
+  asp::parse_multiview(int(args.size()), &argv[0], TriangulationDescription(),
+                       verbose, output_prefix, opt_vec);
+  if (opt_vec.empty())
+    vw_throw(ArgumentErr() << "No stereo pairs were found in the arguments.\n");
+}
+
+void StereoPipeline::run_stage(int stage) {
+
+  std::string output_prefix;
+  std::vector<ASPGlobalOptions> opt_vec;
+  parse(output_prefix, opt_vec);
+
+  // The stereo program runs itself for each pair of a multiview run,
+  // with options set for that, before triangulating them all together.
+  if (opt_vec.size() > 1 && stage < POINT_CLOUD)
+    vw_throw(ArgumentErr() << "Only triangulation can be run in process for more than "
+             << "two images. Use the stereo program for the earlier stages.\n");
+
+  switch (stage) {
+  case PREPROCESSING: preprocessing_stage(opt_vec); break;
+  case CORRELATION:   correlation_stage(opt_vec);   break;
+  case REFINEMENT:    refinement_stage(opt_vec);    break;
+  case FILTERING:     filtering_stage(opt_vec);     break;
+  case POINT_CLOUD:   triangulation_stage(output_prefix, opt_vec); break;
+  default:
+    vw_throw(ArgumentErr() << "Unknown stereo stage: " << stage << ".\n");
+  }
+}
+
+void StereoPipeline::run(int entry_point, int stop_point) {
+  for (int stage = entry_point; stage < stop_point; stage++)
+    run_stage(stage);
+}
+
+} // end namespace asp
@@ -0,0 +1,76 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file StereoPipeline.h
+///
+/// Run the stereo stages in the calling process, rather than as the
+/// stereo_pprc, stereo_corr, stereo_rfne, stereo_fltr and stereo_tri
+/// programs, so that a program chaining them does not pay for starting
+/// a process per stage, and the stages share the caches of the process,
+/// such as the loaded plugins and the Vision Workbench tile cache. The
+/// stages still pass their results as files with the output prefix,
+/// as the programs do, so a run can be resumed at any stage.
+
+#ifndef __ASP_TOOLS_STEREO_PIPELINE_H__
+#define __ASP_TOOLS_STEREO_PIPELINE_H__
+
+#include <asp/Tools/stereo.h>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// The stages, as run by the main() of each program, given the
+  /// options parsed with parse_multiview().
+  void preprocessing_stage(std::vector<ASPGlobalOptions> const& opt_vec);
+  void correlation_stage  (std::vector<ASPGlobalOptions> const& opt_vec);
+  void refinement_stage   (std::vector<ASPGlobalOptions> const& opt_vec);
+  void filtering_stage    (std::vector<ASPGlobalOptions> const& opt_vec);
+  void triangulation_stage(std::string const& output_prefix,
+                           std::vector<ASPGlobalOptions> const& opt_vec);
+
+  /// Stereo for one pair of images, or triangulation for several, in
+  /// this process. It takes the same arguments as the stereo_*
+  /// programs, such as "stereo left.tif right.tif left.xml right.xml run/run",
+  /// where the first one, the program name, is not used.
+  /// The arguments are parsed again before each stage, as each program
+  /// would, so that a stage sees the settings as they would be read
+  /// from the command line and not as changed by the previous stage.
+  class StereoPipeline {
+  public:
+    StereoPipeline(int argc, char* argv[]);
+    ~StereoPipeline();
+
+    /// Run the stages from entry_point up to, but not including,
+    /// stop_point, with the stages numbered as in stereo.h.
+    void run(int entry_point = PREPROCESSING, int stop_point = WIRE_MESH);
+
+    /// Run a single stage.
+    void run_stage(int stage);
+
+  private:
+    std::vector<std::string> m_args;
+
+    /// Parse the arguments into the options of each pair.
+    void parse(std::string & output_prefix, std::vector<ASPGlobalOptions> & opt_vec);
+  };
+
+} // end namespace asp
+
+#endif//__ASP_TOOLS_STEREO_PIPELINE_H__
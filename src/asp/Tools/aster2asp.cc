@@ -34,6 +34,7 @@
 
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
 #include <asp/Core/Common.h>
@@ -227,6 +228,9 @@ void locate_inputs(Options const& opt,
 	      << "(VNIR_Band3B.LatticePoint.txt).\n");
 }
 
+// The block size with which the corrected images are first written
+const int ASTER_WRITE_BLOCK_SIZE = 1024;
+
 // Apply the radiometric corrections
 template <class ImageT>
 class RadioCorrectView: public ImageViewBase< RadioCorrectView<ImageT> >{
@@ -261,14 +265,23 @@ public:
 
     ImageView<input_type> input_tile = crop(m_img, bbox); // to speed things up
     ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-      Vector3 C = m_corr[col];
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-	input_type val = input_tile(col - bbox.min().x(), row - bbox.min().y());
+
+    // The gain and offset of each column of the tile, so that the
+    // pixels can be visited in the order they are stored in.
+    std::vector<double> gain(bbox.width()), offset(bbox.width());
+    for (int col = 0; col < bbox.width(); col++){
+      Vector3 C = m_corr[bbox.min().x() + col];
+      gain[col]   = C[1] / C[2];
+      offset[col] = C[0];
+    }
+    
+    for (int row = 0; row < bbox.height(); row++){
+      for (int col = 0; col < bbox.width(); col++){
+	input_type val = input_tile(col, row);
 	if (m_has_nodata && val == m_nodata)
-	  tile(col - bbox.min().x(), row - bbox.min().y() ) = val;
+	  tile(col, row) = val;
 	else
-	  tile(col - bbox.min().x(), row - bbox.min().y() ) = C[1] * val / C[2] + C[0];
+	  tile(col, row) = gain[col] * val + offset[col];
       }
     }
     
@@ -289,7 +302,7 @@ RadioCorrectView<ImageT> radio_correct(ImageT const& img, std::vector<Vector3> c
 
 // ASTER L1A images come with radiometric corrections appended, but not applied.
 // There is one correction per image column.
-void apply_radiometric_corrections(Options const& opt, 
+void apply_radiometric_corrections(Options & opt, 
 				   std::string const& input_image,
 				   std::string const& corr_table,
 				   std::string const& out_image){
@@ -324,13 +337,15 @@ void apply_radiometric_corrections(Options const& opt,
     vw_throw( ArgumentErr() << "ASTER L1A images are not supposed to be georeferenced.\n" );
 
   
+  // This is a plain per-pixel operation, so write it in big blocks,
+  // which are fewer reads of the input, then with the desired blocks.
   vw_out() << "Writing: " << out_image << std::endl;
-  vw::cartography::block_write_gdal_image(out_image,
-			      radio_correct(input_img, corr, has_nodata, nodata),
-			      has_georef, georef, 
-			      has_nodata, nodata,
-			      opt,
-			      TerminalProgressCallback("asp", "\t-->: "));
+  asp::save_with_temp_big_blocks(ASTER_WRITE_BLOCK_SIZE, out_image,
+                                 radio_correct(input_img, corr, has_nodata, nodata),
+                                 has_georef, georef, 
+                                 has_nodata, nodata,
+                                 opt,
+                                 TerminalProgressCallback("asp", "\t-->: "));
 }
 
 // Generate lon-lat-height to image pixel correspondences that we will
@@ -699,6 +714,28 @@ void gen_xml(double min_height, double max_height, int num_samples,
            out_cam_file);
 }
 
+// Create the camera of one band. The cameras of the two bands are
+// independent, so they are made in parallel.
+class GenXmlTask: public vw::Task, private boost::noncopyable {
+  Options const& m_opt;
+  std::string m_image, m_sat_pos, m_sight_vec, m_longitude, m_latitude, m_lattice_point,
+    m_out_cam;
+public:
+  GenXmlTask(Options const& opt, std::string const& image, std::string const& sat_pos,
+             std::string const& sight_vec, std::string const& longitude,
+             std::string const& latitude, std::string const& lattice_point,
+             std::string const& out_cam):
+    m_opt(opt), m_image(image), m_sat_pos(sat_pos), m_sight_vec(sight_vec),
+    m_longitude(longitude), m_latitude(latitude), m_lattice_point(lattice_point),
+    m_out_cam(out_cam) {}
+
+  virtual void operator()() {
+    gen_xml(m_opt.min_height, m_opt.max_height, m_opt.num_samples, m_opt.penalty_weight,
+	    m_image, m_sat_pos, m_sight_vec, m_longitude, m_latitude,  
+	    m_lattice_point, m_out_cam);
+  }
+};
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -744,14 +781,20 @@ int main( int argc, char *argv[] ) {
               	<< out_back_cam  		<< std::endl;
 #endif
     
-    gen_xml(opt.min_height, opt.max_height, opt.num_samples, opt.penalty_weight,
-	    nadir_image, nadir_sat_pos, nadir_sight_vec, nadir_longitude, nadir_latitude,  
-	    nadir_lattice_point, out_nadir_cam);
-    
-    gen_xml(opt.min_height, opt.max_height, opt.num_samples, opt.penalty_weight,
-	    back_image, back_sat_pos, back_sight_vec, back_longitude, back_latitude,  
-	    back_lattice_point, out_back_cam);
+    {
+      FifoWorkQueue queue(std::min(opt.num_threads, 2));
+      boost::shared_ptr<GenXmlTask> nadir_task
+        (new GenXmlTask(opt, nadir_image, nadir_sat_pos, nadir_sight_vec, nadir_longitude,
+                        nadir_latitude, nadir_lattice_point, out_nadir_cam));
+      boost::shared_ptr<GenXmlTask> back_task
+        (new GenXmlTask(opt, back_image, back_sat_pos, back_sight_vec, back_longitude,
+                        back_latitude, back_lattice_point, out_back_cam));
+      queue.add_task(nadir_task);
+      queue.add_task(back_task);
+      queue.join_all();
+    }
     
+    // Each of these is written with all threads
     apply_radiometric_corrections(opt, nadir_image, nadir_corr_table, out_nadir_image);
     apply_radiometric_corrections(opt, back_image,  back_corr_table,  out_back_image);
     
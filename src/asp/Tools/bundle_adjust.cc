@@ -21,18 +21,25 @@
 
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Core/CmdUtils.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/BundleAdjustment/BundleAdjustReport.h>
 #include <vw/BundleAdjustment/AdjustRef.h>
 #include <asp/Core/Macros.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
+#include <asp/Sessions/CameraHandle.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/GeodeticBatch.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/EigenUtils.h>
+#include <asp/Core/CameraGridTransform.h>
+#include <asp/Camera/LockedCameraModel.h>
 
 #include <asp/Tools/bundle_adjust.h>
 
+#include <boost/function.hpp>
+
 #include <xercesc/util/PlatformUtils.hpp>
 
 namespace po = boost::program_options;
@@ -44,7 +51,6 @@ using namespace vw::ba;
 
 typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
 
-typedef CameraRelationNetwork<JFeature> CRNJ;
 
 // Write the results to disk.
 void saveResults(Options const& opt, BAParamStorage const& param_storage) {
@@ -91,7 +97,7 @@ private:
 };
 
 /// Add error source for projecting a 3D point into the camera.
-void add_reprojection_residual_block(Vector2 const& observation, Vector2 const& pixel_sigma,
+ceres::ResidualBlockId add_reprojection_residual_block(Vector2 const& observation, Vector2 const& pixel_sigma,
                                      int point_index, int camera_index, bool is_gcp,
                                      BAParamStorage & param_storage,
                                      Options const& opt,
@@ -108,13 +114,14 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
 
   double* camera = param_storage.get_camera_ptr(camera_index);
   double* point  = param_storage.get_point_ptr (point_index );
+  ceres::ResidualBlockId block_id = NULL;
 
   if (opt.camera_type == BaCameraType_Other) {
     // The generic camera case
     boost::shared_ptr<CeresBundleModelBase> wrapper(new AdjustedCameraBundleModel(camera_model));
       ceres::CostFunction* cost_function =
         BaReprojectionError::Create(observation, pixel_sigma, wrapper);
-      problem.AddResidualBlock(cost_function, loss_function, point, camera);
+      block_id = problem.AddResidualBlock(cost_function, loss_function, point, camera);
 
   } else { // Pinhole and optical bar
 
@@ -123,6 +130,7 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
     double* distortion = param_storage.get_intrinsic_distortion_ptr(camera_index);
 
     boost::shared_ptr<CeresBundleModelBase> wrapper;
+    ceres::CostFunction* cost_function = NULL;
 
     if (opt.camera_type == BaCameraType_Pinhole) {
 
@@ -132,6 +140,12 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
         vw::vw_throw( vw::ArgumentErr() << "Tried to add pinhole block with non-pinhole camera.");
       wrapper.reset(new PinholeBundleModel(pinhole_model));
 
+      // Use exact derivatives when the projection can be differentiated
+      if (BaPinholeReprojectionError::is_supported(pinhole_model))
+        cost_function = BaPinholeReprojectionError::Create(observation, pixel_sigma,
+                                                           pinhole_model,
+                                                           param_storage.num_lens_distortion_params());
+
     } else { // Optical bar
 
       boost::shared_ptr<asp::camera::OpticalBarModel> bar_model = 
@@ -142,10 +156,10 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
       wrapper.reset(new OpticalBarBundleModel(bar_model));
     }
 
-    ceres::CostFunction* cost_function =
-      BaReprojectionError::Create(observation, pixel_sigma, wrapper);
-    problem.AddResidualBlock(cost_function, loss_function, point, camera, 
-                            center, focus, distortion);
+    if (cost_function == NULL)
+      cost_function = BaReprojectionError::Create(observation, pixel_sigma, wrapper);
+    block_id = problem.AddResidualBlock(cost_function, loss_function, point, camera, 
+                                        center, focus, distortion);
 
     // Apply the residual limits
     size_t num_limits = opt.intrinsics_limits.size() / 2;
@@ -189,11 +203,13 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
   // Fix this camera if requested
   if (opt.fixed_cameras_indices.find(camera_index) != opt.fixed_cameras_indices.end()) 
     problem.SetParameterBlockConstant(param_storage.get_camera_ptr(camera_index));
+
+  return block_id;
 }
 
 /// Add residual block for the error using reference xyz.
-void add_disparity_residual_block(Vector3 const& reference_xyz,
-                                  ImageViewRef<DispPixelT> const& interp_disp, 
+ceres::ResidualBlockId add_disparity_residual_block(Vector3 const& reference_xyz,
+                                  CroppedDisparity const& interp_disp, 
                                   int left_cam_index, int right_cam_index,
                                   BAParamStorage & param_storage,
                                   Options const& opt,
@@ -220,7 +236,7 @@ void add_disparity_residual_block(Vector3 const& reference_xyz,
       BaDispXyzError::Create(reference_xyz, interp_disp, left_wrapper, right_wrapper,
                              inline_adjustments, opt.intrinisc_options);
 
-    problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
+    return problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
 
   } else { // Pinhole or optical bar
 
@@ -248,13 +264,76 @@ void add_disparity_residual_block(Vector3 const& reference_xyz,
     ceres::CostFunction* cost_function =
       BaDispXyzError::Create(reference_xyz, interp_disp, left_wrapper, right_wrapper,
                              inline_adjustments, opt.intrinisc_options);
-    problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
+    return problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
 
   }
   
 } // End function add_disparity_residual_block
 
 
+/// The Ceres problem for bundle adjustment, kept across the passes. Before
+/// a new pass only the residual blocks of the new outliers are removed in
+/// place, rather than building the problem again. The residuals are
+/// always evaluated in the order their blocks were added, which the
+/// residual logs and the outlier filtering rely on.
+struct BaProblem {
+
+  BaProblem(): num_gcp(0), num_gcp_residuals(0) {
+    ceres::Problem::Options options;
+    options.enable_fast_removal = true; // to remove the outlier blocks quickly
+    problem.reset(new ceres::Problem(options));
+  }
+
+  /// The residual blocks which are left, in the order they were added
+  void get_residual_blocks(std::vector<ceres::ResidualBlockId> & blocks) const {
+    blocks.clear();
+    for (size_t it = 0; it < obs_blocks.size(); it++) {
+      if (obs_blocks[it] != NULL)
+        blocks.push_back(obs_blocks[it]);
+    }
+    blocks.insert(blocks.end(), other_blocks.begin(), other_blocks.end());
+  }
+
+  boost::shared_ptr<ceres::Problem>   problem;
+  std::vector<ceres::ResidualBlockId> obs_blocks;   // One per observation, NULL if not used
+  std::vector<ceres::ResidualBlockId> other_blocks; // GCP, cameras, and reference terrain
+  std::vector<size_t>                 cam_residual_counts;
+  int                                 num_gcp;
+  size_t                              num_gcp_residuals;
+  std::vector<vw::Vector3>            reference_vec;
+
+  // The disparities used by the reference terrain residuals, one per image pair
+  std::vector<CroppedDisparity>       interp_disp;
+};
+
+/// Remove the residual blocks of the points flagged as outliers since the
+/// problem was built, and these points themselves.
+void remove_outlier_blocks(BAObservations const& obs, BAParamStorage & param_storage,
+                           BaProblem & ba_problem) {
+
+  ceres::Problem & problem = *ba_problem.problem;
+  int num_removed = 0;
+  for (size_t icam = 0; icam < param_storage.num_cameras(); icam++) {
+    for (size_t iobs = obs.begin(icam); iobs < obs.end(icam); iobs++) {
+      int ipt = obs.point_id(iobs);
+      if (ba_problem.obs_blocks[iobs] == NULL || !param_storage.get_point_outlier(ipt))
+        continue;
+      problem.RemoveResidualBlock(ba_problem.obs_blocks[iobs]);
+      ba_problem.obs_blocks[iobs] = NULL;
+      ba_problem.cam_residual_counts[icam]--;
+      num_removed++;
+    }
+  }
+  
+  for (int ipt = 0; ipt < param_storage.num_points(); ipt++) {
+    double * point = param_storage.get_point_ptr(ipt);
+    if (param_storage.get_point_outlier(ipt) && problem.HasParameterBlock(point))
+      problem.RemoveParameterBlock(point);
+  }
+  
+  vw_out() << "Removed " << num_removed << " outlier residual blocks from the problem.\n";
+}
+
 //----------------------------------------------------------------
 // Residuals functions
 
@@ -262,10 +341,7 @@ void add_disparity_residual_block(Vector3 const& reference_xyz,
 void compute_residuals(bool apply_loss_function,
                        Options const& opt,
                        BAParamStorage const& param_storage,
-                       std::vector<size_t> const& cam_residual_counts,
-                       size_t num_gcp_residuals,
-                       std::vector<vw::Vector3> const& reference_vec,
-                       ceres::Problem &problem,
+                       BaProblem const& ba_problem,
                        std::vector<double> & residuals // output
                        ) {
   // TODO: Associate residuals with cameras!
@@ -273,19 +349,23 @@ void compute_residuals(bool apply_loss_function,
   double cost = 0;
   ceres::Problem::EvaluateOptions eval_options;
   eval_options.apply_loss_function = apply_loss_function;
-  if (opt.single_threaded_cameras)
-    eval_options.num_threads = 1; // ISIS must be single threaded!
-  else
-    eval_options.num_threads = opt.num_threads;
-  problem.Evaluate(eval_options, &cost, &residuals, 0, 0);
+  // Blocks removed in place change the default order, so list them
+  ba_problem.get_residual_blocks(eval_options.residual_blocks);
+  // Cameras which are not thread-safe are wrapped in a lock on loading
+  eval_options.num_threads = opt.num_threads;
+  ba_problem.problem->Evaluate(eval_options, &cost, &residuals, 0, 0);
   const size_t num_residuals = residuals.size();
+
+  std::vector<size_t> const& cam_residual_counts = ba_problem.cam_residual_counts;
+  size_t num_gcp_residuals = ba_problem.num_gcp_residuals;
+  std::vector<vw::Vector3> const& reference_vec = ba_problem.reference_vec;
   
   // Verify our residual calculations are correct
   size_t num_expected_residuals = num_gcp_residuals*param_storage.params_per_point();
   size_t total_num_cam_params   = param_storage.num_cameras()*param_storage.params_per_camera();
   for (size_t i=0; i<param_storage.num_cameras(); ++i)
     num_expected_residuals += cam_residual_counts[i]*PIXEL_SIZE;
-  if (opt.camera_weight > 0)
+  if (opt.use_camera_weight())
     num_expected_residuals += total_num_cam_params;
   if (opt.rotation_weight > 0 || opt.translation_weight > 0)
     num_expected_residuals += total_num_cam_params;
@@ -297,7 +377,7 @@ void compute_residuals(bool apply_loss_function,
 }
 
 /// Compute residual map by averaging all the reprojection error at a given point
-void compute_mean_residuals_at_xyz(CRNJ & crn,
+void compute_mean_residuals_at_xyz(BAObservations const& obs,
                                   std::vector<double> const& residuals,
                                   BAParamStorage const& param_storage,
                                   // outputs
@@ -312,13 +392,12 @@ void compute_mean_residuals_at_xyz(CRNJ & crn,
   //  same order they were originally added to Ceres.
   
   size_t residual_index = 0;
-  // Double loop through cameras and crn entries will give us the correct order
+  // Double loop through cameras and observations will give us the correct order
   for ( size_t icam = 0; icam < param_storage.num_cameras(); icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+    for (size_t iobs = obs.begin(icam); iobs < obs.end(icam); iobs++) {
 
       // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+      int ipt = obs.point_id(iobs);
 
       if (param_storage.get_point_outlier(ipt))
         continue; // skip outliers
@@ -348,7 +427,75 @@ void compute_mean_residuals_at_xyz(CRNJ & crn,
   
 } // End function compute_mean_residuals_at_xyz
 
-/// Write out a .csv file recording the residual error at each location on the ground
+/// How many items, such as residuals or points, a task puts in a report
+const size_t REPORT_BATCH_SIZE = 10000;
+
+/// Do some work on items in [begin, end)
+typedef boost::function<void(size_t begin, size_t end)> BatchJob;
+
+/// Do the work on a batch of items, as part of doing it for many in parallel.
+class BatchJobTask: public Task, private boost::noncopyable {
+  BatchJob const& m_job;
+  size_t m_begin, m_end;
+public:
+  BatchJobTask(BatchJob const& job, size_t begin, size_t end):
+    m_job(job), m_begin(begin), m_end(end) {}
+  void operator()() { m_job(m_begin, m_end); }
+};
+
+/// Do a job on all items, in batches which are done in parallel
+void run_in_batches(size_t num_items, size_t batch_size, BatchJob const& job, int num_threads) {
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  FifoWorkQueue queue(num_threads);
+  for (size_t begin = 0; begin < num_items; begin += batch_size) {
+    boost::shared_ptr<BatchJobTask>
+      task(new BatchJobTask(job, begin, std::min(begin + batch_size, num_items)));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
+/// Write the items in [begin, end) of a report to a stream
+typedef boost::function<void(size_t begin, size_t end, std::ostream & os)> ReportJob;
+
+/// Write a report of many items in order. Batches of items are formatted
+/// in parallel, each into a string. The strings are written out after each
+/// round of batches, so the report is never all in memory.
+void write_report(std::ostream & os, size_t num_items, ReportJob const& job, int num_threads) {
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  const size_t round_size = 4 * num_threads * REPORT_BATCH_SIZE;
+  std::vector<std::string> texts;
+  for (size_t round_begin = 0; round_begin < num_items; round_begin += round_size) {
+    size_t round_end = std::min(round_begin + round_size, num_items);
+    texts.assign((round_end - round_begin + REPORT_BATCH_SIZE - 1) / REPORT_BATCH_SIZE, "");
+    BatchJob format_job = [&](size_t begin, size_t end) {
+      std::ostringstream batch_os;
+      batch_os.precision(18);
+      job(round_begin + begin, round_begin + end, batch_os);
+      texts[begin / REPORT_BATCH_SIZE] = batch_os.str();
+    };
+    run_in_batches(round_end - round_begin, REPORT_BATCH_SIZE, format_job, num_threads);
+    for (size_t b = 0; b < texts.size(); b++)
+      os.write(texts[b].data(), texts[b].size());
+  }
+}
+
+/// The start of the binary residual reports and their version
+const char   RESIDUAL_PIXELS_MAGIC[8] = {'A', 'S', 'P', 'R', 'E', 'S', 'P', 'X'};
+const char   RESIDUAL_POINTS_MAGIC[8] = {'A', 'S', 'P', 'R', 'E', 'S', 'P', 'T'};
+const uint32 RESIDUAL_REPORT_VERSION  = 1;
+
+/// Write a value to a binary report, in the byte order of the machine
+template <class T>
+void write_binary(std::ostream & os, T const& val) {
+  os.write(reinterpret_cast<char const*>(&val), sizeof(T));
+}
+
+/// Write out a .csv file recording the residual error at each location on
+/// the ground, or with --binary-residual-report, a binary file with the
+/// same fields. The points are converted and formatted in parallel.
 void write_residual_map(std::string const& output_prefix,
                         std::vector<double> const& mean_residuals, // Mean residual of each point
                         std::vector<int   > const& num_point_observations, // Num non-outlier pixels per point
@@ -357,6 +504,8 @@ void write_residual_map(std::string const& output_prefix,
                         Options const& opt) {
 
   std::string output_path = output_prefix + "_point_log.csv";
+  if (opt.binary_residual_report)
+    output_path = output_prefix + "_point_log.bin";
 
   if (opt.datum.name() == UNSPECIFIED_DATUM) {
     vw_out(WarningMessage) << "No datum specified, can't write file: " << output_path << std::endl;
@@ -373,16 +522,28 @@ void write_residual_map(std::string const& output_prefix,
   // Open the output file and write the header
   //vw_out() << "Writing: " << output_path << std::endl;
   
+  const size_t num_points = param_storage.num_points();
   std::ofstream file;
-  file.open(output_path.c_str()); file.precision(18);
-  file << "# lon, lat, height_above_datum, mean_residual, num_observations\n";
-  file << "# " << opt.datum << std::endl;
+  if (opt.binary_residual_report) {
+    uint64 num_inliers = 0;
+    for (size_t i = 0; i < num_points; ++i)
+      num_inliers += !param_storage.get_point_outlier(i);
+    file.open(output_path.c_str(), std::ios::binary);
+    file.write(RESIDUAL_POINTS_MAGIC, sizeof(RESIDUAL_POINTS_MAGIC));
+    write_binary(file, RESIDUAL_REPORT_VERSION);
+    write_binary(file, num_inliers);
+  } else {
+    file.open(output_path.c_str()); file.precision(18);
+    file << "# lon, lat, height_above_datum, mean_residual, num_observations\n";
+    file << "# " << opt.datum << std::endl;
+  }
   
   // Now write all the points to the file
-  for (size_t i = 0; i < param_storage.num_points(); ++i) {
+  ReportJob point_job = [&](size_t begin, size_t end, std::ostream & os) {
+    for (size_t i = begin; i < end; ++i) {
 
-    if (param_storage.get_point_outlier(i))
-      continue; // skip outliers
+      if (param_storage.get_point_outlier(i))
+        continue; // skip outliers
     
       // The final GCC coordinate of this point
       const double * point = param_storage.get_point_ptr(i);
@@ -390,12 +551,25 @@ void write_residual_map(std::string const& output_prefix,
 
       Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
 
+      bool is_gcp = (cnet[i].type() == ControlPoint::GroundControlPoint);
+      if (opt.binary_residual_report) {
+        double vals[4] = {llh[0], llh[1], llh[2], mean_residuals[i]};
+        int32  flags[2] = {int32(num_point_observations[i]), int32(is_gcp)};
+        os.write(reinterpret_cast<char const*>(vals),  sizeof(vals));
+        os.write(reinterpret_cast<char const*>(flags), sizeof(flags));
+        continue;
+      }
       std::string comment = "";
-      if (cnet[i].type() == ControlPoint::GroundControlPoint)
+      if (is_gcp)
         comment = " # GCP";
-      file << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
-           << num_point_observations[i] << comment << std::endl;
-  }
+      os << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
+         << num_point_observations[i] << comment << "\n";
+    }
+  };
+  write_report(file, num_points, point_job, opt.num_threads);
+  
+  if (!file)
+    vw_throw( IOErr() << "Failed writing: " << output_path << "\n");
   file.close();
 
 } // End function write_residual_map
@@ -406,22 +580,23 @@ void write_residual_map(std::string const& output_prefix,
 void write_residual_logs(std::string const& residual_prefix, bool apply_loss_function,
                          Options const& opt,
                          BAParamStorage const& param_storage,
-                         std::vector<size_t> const& cam_residual_counts,
-                         size_t num_gcp_residuals, 
-                         std::vector<vw::Vector3> const& reference_vec,
-                         ControlNetwork const& cnet, CRNJ & crn, 
-                         ceres::Problem &problem) {
+                         BaProblem const& ba_problem,
+                         ControlNetwork const& cnet, BAObservations const& obs) {
   
   std::vector<double> residuals;
-  compute_residuals(apply_loss_function, opt, param_storage,
-                    cam_residual_counts,  num_gcp_residuals, reference_vec, problem,  
+  compute_residuals(apply_loss_function, opt, param_storage, ba_problem,
                     residuals // output
                     );
+
+  std::vector<size_t> const& cam_residual_counts = ba_problem.cam_residual_counts;
+  size_t num_gcp_residuals = ba_problem.num_gcp_residuals;
+  std::vector<vw::Vector3> const& reference_vec = ba_problem.reference_vec;
     
   const size_t num_residuals = residuals.size();
 
   const std::string residual_path               = residual_prefix + "_averages.txt";
-  const std::string residual_raw_pixels_path    = residual_prefix + "_raw_pixels.txt";
+  const std::string residual_raw_pixels_path    = residual_prefix +
+    (opt.binary_residual_report ? "_raw_pixels.bin" : "_raw_pixels.txt");
   const std::string residual_raw_gcp_path       = residual_prefix + "_raw_gcp.txt";
   const std::string residual_raw_cams_path      = residual_prefix + "_raw_cameras.txt";
   const std::string residual_reference_xyz_path = residual_prefix + "_reference_terrain.txt";
@@ -436,7 +611,10 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
   
   residual_file.open(residual_path.c_str());
   residual_file.precision(18);
-  residual_file_raw_pixels.open(residual_raw_pixels_path.c_str());
+  if (opt.binary_residual_report)
+    residual_file_raw_pixels.open(residual_raw_pixels_path.c_str(), std::ios::binary);
+  else
+    residual_file_raw_pixels.open(residual_raw_pixels_path.c_str());
   residual_file_raw_pixels.precision(18);
   residual_file_raw_cams.open(residual_raw_cams_path.c_str());
   residual_file_raw_cams.precision(18);
@@ -447,33 +625,76 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
     residual_file_reference_xyz.precision(18);
   }
   
-  size_t index = 0;
-  // For each camera, average together all the point observation residuals
+  // The pixel residuals come first, camera after camera, two per
+  // observation. Find where those of each camera start.
+  const size_t num_cameras = param_storage.num_cameras();
+  std::vector<size_t> cam_start(num_cameras + 1, 0);
+  for (size_t c = 0; c < num_cameras; ++c)
+    cam_start[c + 1] = cam_start[c] + PIXEL_SIZE * cam_residual_counts[c];
+  std::vector<std::string> cam_names(num_cameras);
+  for (size_t c = 0; c < num_cameras; ++c) {
+    cam_names[c] = opt.camera_files[c];
+    if (cam_names[c] == "")
+      cam_names[c] = opt.image_files[c];
+  }
+
+  // For each camera, average together all the point observation
+  // residuals. The cameras are done in parallel.
+  std::vector<double> cam_mean_residuals(num_cameras, 0);
+  BatchJob mean_job = [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      double mean_residual = 0; // Take average of all pixel coord errors
+      for (size_t i = cam_start[c]; i < cam_start[c + 1]; ++i)
+        mean_residual += fabs(residuals[i]);
+      cam_mean_residuals[c] = mean_residual / static_cast<double>(cam_residual_counts[c]);
+    }
+  };
+  run_in_batches(num_cameras, 1, mean_job, opt.num_threads);
   residual_file << "Mean residual error and point count for cameras:\n";
-  for (size_t c = 0; c < param_storage.num_cameras(); ++c) {
-    size_t num_this_cam_residuals = cam_residual_counts[c];
-    
-    // Write header for the raw file
-    std::string name = opt.camera_files[c];
-    if (name == "")
-      name = opt.image_files[c];
-    residual_file_raw_pixels << name << ", " << num_this_cam_residuals << std::endl;
-    
-    double mean_residual = 0; // Take average of all pixel coord errors
-    for (size_t i=0; i<num_this_cam_residuals; ++i) {
-      double ex = residuals[index];
-      ++index;
-      double ey = residuals[index];
-      ++index;
-      mean_residual += fabs(ex) + fabs(ey);
-      
-      residual_file_raw_pixels << ex << ", " << ey << std::endl; // Write ex, ey on raw file
+  for (size_t c = 0; c < num_cameras; ++c)
+    residual_file << cam_names[c] << ", " << cam_mean_residuals[c] << ", "
+                  << cam_residual_counts[c] << std::endl;
+
+  // Write the raw pixel residuals. In the binary report they are
+  // copied as they are. As text, each camera has a header line with its
+  // name and number of residuals, then a line per residual, and the
+  // lines are formatted in parallel.
+  if (opt.binary_residual_report) {
+    residual_file_raw_pixels.write(RESIDUAL_PIXELS_MAGIC, sizeof(RESIDUAL_PIXELS_MAGIC));
+    write_binary(residual_file_raw_pixels, RESIDUAL_REPORT_VERSION);
+    write_binary(residual_file_raw_pixels, uint32(num_cameras));
+    for (size_t c = 0; c < num_cameras; ++c) {
+      write_binary(residual_file_raw_pixels, uint32(cam_names[c].size()));
+      residual_file_raw_pixels.write(cam_names[c].data(), cam_names[c].size());
+      write_binary(residual_file_raw_pixels, uint64(cam_residual_counts[c]));
+      if (cam_residual_counts[c] > 0)
+        residual_file_raw_pixels.write(reinterpret_cast<char const*>(&residuals[cam_start[c]]),
+                                       sizeof(double) * (cam_start[c + 1] - cam_start[c]));
     }
-    // Write line for the summary file
-    mean_residual /= static_cast<double>(num_this_cam_residuals);
-    residual_file << name << ", " << mean_residual << ", "
-                  << num_this_cam_residuals << std::endl;
+  } else {
+    // The first line of each camera
+    std::vector<size_t> line_start(num_cameras + 1, 0);
+    for (size_t c = 0; c < num_cameras; ++c)
+      line_start[c + 1] = line_start[c] + 1 + cam_residual_counts[c];
+    ReportJob pixel_job = [&](size_t begin, size_t end, std::ostream & os) {
+      size_t c = std::upper_bound(line_start.begin(), line_start.end(), begin)
+        - line_start.begin() - 1;
+      for (size_t line = begin; line < end; ++line) {
+        while (line >= line_start[c + 1])
+          ++c;
+        if (line == line_start[c]) {
+          os << cam_names[c] << ", " << cam_residual_counts[c] << "\n";
+          continue;
+        }
+        size_t i = cam_start[c] + PIXEL_SIZE * (line - line_start[c] - 1);
+        os << residuals[i] << ", " << residuals[i + 1] << "\n"; // Write ex, ey on raw file
+      }
+    };
+    write_report(residual_file_raw_pixels, line_start[num_cameras], pixel_job, opt.num_threads);
   }
+  if (!residual_file_raw_pixels)
+    vw_throw( IOErr() << "Failed writing: " << residual_raw_pixels_path << "\n");
+  size_t index = cam_start[num_cameras];
   residual_file_raw_pixels.close();
   
   // List the GCP residuals
@@ -497,7 +718,7 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
   }
   
   // List the camera weight residuals
-  int num_passes = int(opt.camera_weight > 0) +
+  int num_passes = int(opt.use_camera_weight()) +
     int(opt.rotation_weight > 0 || opt.translation_weight > 0);
   for (int pass = 0; pass < num_passes; pass++) {
     residual_file << "Camera weight position and orientation residual errors:\n";
@@ -556,7 +777,7 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
   std::string map_prefix = residual_prefix + "_pointmap";
   std::vector<double> mean_residuals;
   std::vector<int   > num_point_observations;
-  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage,
+  compute_mean_residuals_at_xyz(obs,  residuals,  param_storage,
                                 mean_residuals, num_point_observations);
 
   write_residual_map(map_prefix, mean_residuals, num_point_observations,
@@ -573,13 +794,10 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
 
 /// Add to the outliers based on the large residuals
 int update_outliers(ControlNetwork   & cnet,
-                    CRNJ & crn,
+                    BAObservations const& obs,
                     BAParamStorage & param_storage,
                     Options const& opt,
-                    std::vector<size_t> const& cam_residual_counts,
-                    size_t num_gcp_residuals,
-                    std::vector<vw::Vector3> const& reference_vec, 
-                    ceres::Problem &problem) {
+                    BaProblem const& ba_problem) {
   
   vw_out() << "Removing pixel outliers in preparation for another solver attempt.\n";
 
@@ -590,16 +808,14 @@ int update_outliers(ControlNetwork   & cnet,
   // of the loss function.
   bool apply_loss_function = false;
   std::vector<double> residuals;
-  compute_residuals(apply_loss_function,  
-                    opt, param_storage,  cam_residual_counts,  
-                    num_gcp_residuals, reference_vec, problem,
+  compute_residuals(apply_loss_function, opt, param_storage, ba_problem,
                     residuals // output
                    );
 
   // Compute the mean residual at each xyz, and how many times that residual is seen
   std::vector<double> mean_residuals;
   std::vector<int   > num_point_observations;
-  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage,
+  compute_mean_residuals_at_xyz(obs,  residuals,  param_storage,
                                 // outputs
                                 mean_residuals, num_point_observations);
 
@@ -608,13 +824,12 @@ int update_outliers(ControlNetwork   & cnet,
   // non-outliers so far to be able to remove new outliers.  Need to
   // follow the same logic as when residuals were formed. And also ignore GCP.
   std::vector<double> actual_residuals;
-  std::set<int> was_added;
+  std::vector<bool> was_added(num_points, false);
   for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+    for (size_t iobs = obs.begin(icam); iobs < obs.end(icam); iobs++) {
 
       // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+      int ipt = obs.point_id(iobs);
 
       // skip existing outliers
       if (param_storage.get_point_outlier(ipt))
@@ -625,10 +840,10 @@ int update_outliers(ControlNetwork   & cnet,
         continue;
 
       // We already encountered this residual in the previous camera
-      if (was_added.find(ipt) != was_added.end()) 
+      if (was_added[ipt]) 
         continue;
       
-      was_added.insert(ipt);
+      was_added[ipt] = true;
       actual_residuals.push_back(mean_residuals[ipt]);
       //vw_out() << "XYZ residual " << ipt << " = " << mean_residuals[ipt] << std::endl;
     }
@@ -654,11 +869,10 @@ int update_outliers(ControlNetwork   & cnet,
   // Add to the outliers by reprojection error. Must repeat the same logic as above. 
   int num_outliers_by_reprojection = 0;
   for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+    for (size_t iobs = obs.begin(icam); iobs < obs.end(icam); iobs++) {
 
       // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+      int ipt = obs.point_id(iobs);
 
       // skip existing outliers
       if (param_storage.get_point_outlier(ipt))
@@ -744,7 +958,7 @@ void remove_outliers(ControlNetwork const& cnet, BAParamStorage &param_storage,
     // the subset of the IP from the control network which
     // are part of these original ones. 
     std::vector<ip::InterestPoint> orig_left_ip, orig_right_ip;
-    ip::read_binary_match_file(match_file, orig_left_ip, orig_right_ip);
+    asp::read_match_file(match_file, orig_left_ip, orig_right_ip);
     std::map< std::pair<double, double>, std::pair<double, double> > lookup;
     for (size_t ip_iter = 0; ip_iter < orig_left_ip.size(); ip_iter++) {
       lookup [ std::pair<double, double>(orig_left_ip[ip_iter].x, orig_left_ip[ip_iter].y) ]
@@ -827,23 +1041,105 @@ void remove_outliers(ControlNetwork const& cnet, BAParamStorage &param_storage,
 // End outlier functions
 // ----------------------------------------------------------------
 
-int do_ba_ceres_one_pass(Options             & opt,
-                         CRNJ                & crn,
-                         bool                  first_pass,
-                         bool                  last_pass,
-                         BAParamStorage      & param_storage, 
-                         BAParamStorage const& orig_parameters,
-                         bool                & convergence_reached,
-                         double              & final_cost){
+/// Choose the Ceres linear solver and the parameter block ordering.
+/// With the default "auto" solver, the choice depends on the number of
+/// cameras and on how many of them see common points, which sets the
+/// density of the reduced camera matrix left after eliminating the points.
+void set_linear_solver(Options const& opt, BAParamStorage & param_storage,
+                       ceres::Problem & problem, ceres::Solver::Options & options) {
+
+  ControlNetwork const& cnet = *opt.cnet;
+  const int num_cameras = param_storage.num_cameras();
+  const int num_points  = param_storage.num_points();
+
+  // Eliminate the points first (group 0), then solve for the cameras and
+  // intrinsics (group 1). All blocks in the problem must be in the ordering.
+  std::vector<double*> blocks;
+  problem.GetParameterBlocks(&blocks);
+  std::set<double*> point_blocks;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point = param_storage.get_point_ptr(ipt);
+    if (problem.HasParameterBlock(point))
+      point_blocks.insert(point);
+  }
+  if (!point_blocks.empty() && point_blocks.size() < blocks.size()) {
+    ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+    for (size_t it = 0; it < blocks.size(); it++)
+      ordering->AddElementToGroup(blocks[it], point_blocks.count(blocks[it]) > 0 ? 0 : 1);
+    options.linear_solver_ordering.reset(ordering);
+  }
+
+  // The camera pairs which share a point are the non-zero off-diagonal
+  // blocks of the reduced camera matrix.
+  std::set< std::pair<int, int> > camera_pairs;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    if (param_storage.get_point_outlier(ipt))
+      continue;
+    std::vector<int> cams;
+    for (ControlPoint::const_iterator m = cnet[ipt].begin(); m != cnet[ipt].end(); m++)
+      cams.push_back(m->image_id());
+    for (size_t a = 0; a < cams.size(); a++) {
+      for (size_t b = a + 1; b < cams.size(); b++) {
+        if (cams[a] != cams[b])
+          camera_pairs.insert(std::make_pair(std::min(cams[a], cams[b]),
+                                             std::max(cams[a], cams[b])));
+      }
+    }
+  }
+  double n = std::max(num_cameras, 1);
+  double fill_ratio = (n + 2.0 * camera_pairs.size()) / (n * n);
+
+  std::string solver = opt.linear_solver;
+  if (solver == "auto") {
+    // Per the Ceres solving FAQs, DENSE_SCHUR for a few cameras, SPARSE_SCHUR
+    // for more, and ITERATIVE_SCHUR for many. A nearly dense reduced camera
+    // matrix is not worth a sparse factorization, and a large one which is
+    // not very sparse fills in too much, so then rather iterate.
+    solver = "sparse_schur";
+    if (num_cameras < 100 || (num_cameras <= 1000 && fill_ratio > 0.3))
+      solver = "dense_schur";
+    else if (num_cameras > 3500 || (num_cameras > 1000 && fill_ratio > 0.05))
+      solver = "iterative_schur";
+  }
+  vw_out() << "Reduced camera matrix fill ratio: " << fill_ratio
+           << ". Using the linear solver: " << solver << ".\n";
+
+  if (solver == "dense_schur") {
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+  } else if (solver == "sparse_schur") {
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+  } else if (solver == "iterative_schur") {
+    options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    // This is supposed to help with speed in a certain size range. Only the
+    // Schur Jacobi preconditioner can use it.
+    options.use_explicit_schur_complement = (num_cameras <= 7000 &&
+                                             opt.preconditioner == "schur_jacobi");
+    if (opt.preconditioner == "jacobi")
+      options.preconditioner_type = ceres::JACOBI;
+    else if (opt.preconditioner == "schur_jacobi")
+      options.preconditioner_type = ceres::SCHUR_JACOBI;
+    else if (opt.preconditioner == "cluster_jacobi")
+      options.preconditioner_type = ceres::CLUSTER_JACOBI;
+    else if (opt.preconditioner == "cluster_tridiagonal")
+      options.preconditioner_type = ceres::CLUSTER_TRIDIAGONAL;
+    // The cluster preconditioners group the cameras by which points they
+    // see, using the default canonical views clustering.
+  }
+}
+
+/// Add all the residual blocks of the problem, skipping the outliers.
+void build_ba_problem(Options             & opt,
+                      BAObservations const& obs,
+                      BAParamStorage      & param_storage, 
+                      BAParamStorage const& orig_parameters,
+                      BaProblem           & ba_problem){
 
-  ceres::Problem problem;
+  ceres::Problem & problem = *ba_problem.problem;
 
   ControlNetwork & cnet = *opt.cnet;
   const int num_cameras = param_storage.num_cameras();
   const int num_points  = param_storage.num_points();
 
-  convergence_reached = true;
-  
   // Add the cost function component for difference of pixel observations
   // - Reduce error by making pixel projection consistent with observations.
 
@@ -866,17 +1162,18 @@ int do_ba_ceres_one_pass(Options             & opt,
   if (opt.heights_from_dem != "") 
     create_interp_dem(opt.heights_from_dem, dem_georef, interp_dem);
   
-  // TODO: Stop using the CRN, store residual blocks in point-major order?
+  // TODO: Store residual blocks in point-major order?
   
   // Add the various cost functions the solver will optimize over.
-  std::vector<size_t> cam_residual_counts(num_cameras);
-  typedef CameraNode<JFeature>::iterator crn_iter;
+  std::vector<size_t> & cam_residual_counts = ba_problem.cam_residual_counts;
+  cam_residual_counts.assign(num_cameras, 0);
+  ba_problem.obs_blocks.assign(obs.size(), NULL);
   for ( int icam = 0; icam < num_cameras; icam++ ) { // Camera loop
     cam_residual_counts[icam] = 0;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){ // IP loop
+    for (size_t iobs = obs.begin(icam); iobs < obs.end(icam); iobs++) { // IP loop
 
       // The index of the 3D point this IP is for.
-      int ipt = (**fiter).m_point_id;
+      int ipt = obs.point_id(iobs);
       if (param_storage.get_point_outlier(ipt))
         continue; // skip outliers
 
@@ -887,8 +1184,8 @@ int do_ba_ceres_one_pass(Options             & opt,
 
       // The observed value for the projection of point with index ipt into
       // the camera with index icam.
-      Vector2 observation = (**fiter).m_location;
-      Vector2 pixel_sigma = (**fiter).m_scale;
+      Vector2 observation = obs.location(iobs);
+      Vector2 pixel_sigma = obs.sigma(iobs);
 
       const bool is_gcp = (cnet[ipt].type() == ControlPoint::GroundControlPoint);
 
@@ -905,8 +1202,9 @@ int do_ba_ceres_one_pass(Options             & opt,
       }
 
       // Call function to add the appropriate Ceres residual block.
-      add_reprojection_residual_block(observation, pixel_sigma, ipt, icam,
-                                      is_gcp, param_storage, opt, problem);
+      ba_problem.obs_blocks[iobs]
+        = add_reprojection_residual_block(observation, pixel_sigma, ipt, icam,
+                                          is_gcp, param_storage, opt, problem);
 
       if (opt.heights_from_dem != "") {
         // For non-GCP points, copy the heights for xyz points from the DEM.
@@ -941,8 +1239,10 @@ int do_ba_ceres_one_pass(Options             & opt,
 
   // Add ground control points
   // - Error goes up as GCP's move from their input positions.
-  int    num_gcp = 0;
-  size_t num_gcp_residuals = 0;
+  int    & num_gcp = ba_problem.num_gcp;
+  size_t & num_gcp_residuals = ba_problem.num_gcp_residuals;
+  num_gcp = 0;
+  num_gcp_residuals = 0;
   for (int ipt = 0; ipt < num_points; ipt++){
     if (cnet[ipt].type() != ControlPoint::GroundControlPoint)
       continue; // Skip non-GCP's
@@ -978,7 +1278,8 @@ int do_ba_ceres_one_pass(Options             & opt,
       loss_function = new ceres::TrivialLoss();
     }
     double * point  = param_storage.get_point_ptr(ipt);
-    problem.AddResidualBlock(cost_function, loss_function, point);
+    ba_problem.other_blocks.push_back(problem.AddResidualBlock(cost_function,
+                                                               loss_function, point));
     ++num_gcp_residuals;
 
     if (opt.fix_gcp_xyz) 
@@ -987,19 +1288,26 @@ int do_ba_ceres_one_pass(Options             & opt,
 
   // Add camera constraints
   // - Error goes up as cameras move and rotate from their input positions.
-  if (opt.camera_weight > 0){
+  // - In incremental mode, the previously adjusted cameras which are not
+  //   fixed are tied to their input adjustments with their own weight.
+  if (opt.use_camera_weight()){
 
     for (int icam = 0; icam < num_cameras; icam++){
 
+      double weight = opt.camera_weight;
+      if (opt.incremental && opt.old_camera_indices.find(icam) != opt.old_camera_indices.end())
+        weight = std::max(opt.old_camera_weight, 0.0);
+
       double const* orig_cam_ptr = orig_parameters.get_camera_ptr(icam);
-      ceres::CostFunction* cost_function = CamError::Create(orig_cam_ptr, opt.camera_weight);
+      ceres::CostFunction* cost_function = CamError::Create(orig_cam_ptr, weight);
 
       // Don't use the same loss function as for pixels since that one discounts
       //  outliers and the cameras should never be discounted.
       ceres::LossFunction* loss_function = new ceres::TrivialLoss();
 
       double * camera  = param_storage.get_camera_ptr(icam);
-      problem.AddResidualBlock(cost_function, loss_function, camera);
+      ba_problem.other_blocks.push_back(problem.AddResidualBlock(cost_function,
+                                                                 loss_function, camera));
     } // End loop through cameras.
   }
 
@@ -1016,7 +1324,8 @@ int do_ba_ceres_one_pass(Options             & opt,
       ceres::LossFunction* loss_function = new ceres::TrivialLoss();
 
       double * camera  = param_storage.get_camera_ptr(icam);
-      problem.AddResidualBlock(cost_function, loss_function, camera);
+      ba_problem.other_blocks.push_back(problem.AddResidualBlock(cost_function,
+                                                                 loss_function, camera));
     }
   }
 
@@ -1028,9 +1337,8 @@ int do_ba_ceres_one_pass(Options             & opt,
   // option --unalign-disparity. If there are n images,
   // there must be n-1 disparities, from each image to the next.
   // The doc has more info in the bundle_adjust chapter.
-  std::vector< ImageView   <DispPixelT> > disp_vec;
-  std::vector< ImageViewRef<DispPixelT> > interp_disp; 
-  std::vector< vw::Vector3              > reference_vec;
+  std::vector<CroppedDisparity>         & interp_disp = ba_problem.interp_disp;
+  std::vector< vw::Vector3              > & reference_vec = ba_problem.reference_vec;
   if (opt.reference_terrain != "") {
     // TODO: Pass these properly
     g_max_disp_error           = opt.max_disp_error;
@@ -1072,7 +1380,8 @@ int do_ba_ceres_one_pass(Options             & opt,
       vw_throw( ArgumentErr() << "Unsupported file: " << opt.reference_terrain << " of type"
                               << file_type << ".\n");
 
-    if (load_reference_disparities(opt.disparity_list, disp_vec, interp_disp) != num_cameras-1)
+    std::vector<std::string> disp_files;
+    if (read_disparity_list(opt.disparity_list, disp_files) != num_cameras-1)
       vw_throw( ArgumentErr() << "Expecting one less disparity than there are cameras.\n");
     
     std::vector<vw::BBox2i> image_boxes;
@@ -1082,44 +1391,88 @@ int do_ba_ceres_one_pass(Options             & opt,
       image_boxes.push_back(bbox);
     }
 
+    // The lon-lat of the points, all found at once. Filter by the
+    // lonlat box if provided, this is very much recommended to
+    // quickly discard most points in the huge reference terrain.
+    // Let's hope there is no 360 degree offset when computing the
+    // longitude. The points left out have a NaN lon-lat.
+    int num_points = data.cols();
+    std::vector<vw::Vector3> reference_xyz(num_points);
+    asp::PointBlock llh;
+    llh.resize(num_points);
+    for (int data_col = 0; data_col < num_points; data_col++) {
+      for (int row = 0; row < asp::DIM; row++)
+        reference_xyz[data_col][row] = data(row, data_col);
+      llh.x[data_col] = reference_xyz[data_col][0];
+      llh.y[data_col] = reference_xyz[data_col][1];
+      llh.z[data_col] = reference_xyz[data_col][2];
+    }
+    asp::batch_cartesian_to_geodetic(geo.datum(), llh);
+    std::vector<vw::Vector2> reference_ll(num_points);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (int it = 0; it < num_points; it++) {
+      reference_ll[it] = Vector2(llh.x[it], llh.y[it]);
+      if ( asp::stereo_settings().lon_lat_limit != BBox2(0,0,0,0) &&
+           !asp::stereo_settings().lon_lat_limit.contains(reference_ll[it]) )
+        reference_ll[it] = Vector2(nan, nan);
+    }
+
+    // Index the points, to find quickly those in the footprint of each
+    // image pair. Without footprints all points are tried.
+    LonLatIndex index(reference_ll);
+    std::vector<Footprint> footprints;
+    std::string footprint_error = estimate_footprints(opt, footprints);
+    if (!footprint_error.empty())
+      vw_out(WarningMessage) << "Will try all reference points with all images. "
+                             << footprint_error << "\n";
+
     vw_out() << "Setting up the error to the reference terrain.\n";
     TerminalProgressCallback tpc("", "\t--> ");
     tpc.report_progress(0);
-    int num_cols = data.cols();
-    //double inc_amount = 1.0/double(pos_records.size());
-    double inc_amount = 1.0/double(num_cols);
+    double inc_amount = 1.0/double(std::max(num_cameras - 1, 1));
 
+    // The disparities are read only near the points, with this margin,
+    // in pixels, for the cameras to move during the optimization.
+    const int DISP_MARGIN = 256;
+
+    interp_disp.assign(num_cameras - 1, CroppedDisparity());
     reference_vec.clear();
-    for (int data_col = 0; data_col < num_cols; data_col++) {
+    for (int icam = 0; icam < num_cameras - 1; icam++) {
 
-      //vw::Vector3 reference_xyz = csv_conv.csv_to_cartesian(*iter, geo);
-      vw::Vector3 reference_xyz;
-      for (int row = 0; row < asp::DIM; row++)
-        reference_xyz[row] = data(row, data_col);
-
-      // Filter by lonlat box if provided, this is very much recommended
-      // to quickly discard most points in the huge reference terrain.
-      // Let's hope there is no 360 degree offset when computing
-      // the longitude. 
-      if ( asp::stereo_settings().lon_lat_limit != BBox2(0,0,0,0) ) {
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(reference_xyz);
-        vw::Vector2 ll  = subvector(llh, 0, 2);
-        if (!asp::stereo_settings().lon_lat_limit.contains(ll)) {
-          continue;
-        }
+      if (disp_files[icam] == "none") {
+        tpc.report_incremental_progress( inc_amount );
+        continue;
       }
 
-      Vector2 left_pred, right_pred;
-
-      // Iterate over the cameras, add a residual for each point and each camera pair.
-      for (int icam = 0; icam < num_cameras - 1; icam++) {
-
-        boost::shared_ptr<CameraModel> left_camera  = opt.camera_models[icam  ];
-        boost::shared_ptr<CameraModel> right_camera = opt.camera_models[icam+1];
+      // The candidate points, near the footprints of both images,
+      // with a buffer for the terrain height and the footprint estimate.
+      std::vector<size_t> candidates;
+      if (footprint_error.empty()) {
+        BBox2 box1, box2;
+        for (size_t p = 0; p < footprints[icam  ].size(); p++) box1.grow(footprints[icam  ][p]);
+        for (size_t p = 0; p < footprints[icam+1].size(); p++) box2.grow(footprints[icam+1][p]);
+        box1.crop(box2);
+        if (!box1.empty()) {
+          // Put the box in the longitude range of the points
+          double lon_shift = 360.0*round((index.box().center().x() - box1.center().x())/360.0);
+          box1 += Vector2(lon_shift, 0);
+          box1.expand(0.1*std::max(box1.width(), box1.height()));
+          index.query(box1, candidates);
+        }
+      } else {
+        index.query(index.box(), candidates);
+      }
 
+      // Keep the points which project into both images
+      boost::shared_ptr<CameraModel> left_camera  = opt.camera_models[icam  ];
+      boost::shared_ptr<CameraModel> right_camera = opt.camera_models[icam+1];
+      std::vector<size_t>  in_images;
+      std::vector<Vector2> left_preds, right_preds;
+      for (size_t c = 0; c < candidates.size(); c++) {
+        Vector2 left_pred, right_pred;
         try {
-          left_pred  = left_camera->point_to_pixel (reference_xyz);
-          right_pred = right_camera->point_to_pixel(reference_xyz);
+          left_pred  = left_camera->point_to_pixel (reference_xyz[candidates[c]]);
+          right_pred = right_camera->point_to_pixel(reference_xyz[candidates[c]]);
         } catch (const camera::PointToPixelErr& e) {
           continue; // Skip point if there is a projection issue.
         }
@@ -1127,6 +1480,37 @@ int do_ba_ceres_one_pass(Options             & opt,
         if ( (left_pred != left_pred) || (right_pred != right_pred) )
           continue; // nan check
 
+        // Check if the current point projects in the cameras
+        if ( !image_boxes[icam  ].contains(left_pred ) || 
+             !image_boxes[icam+1].contains(right_pred)   ) {
+          continue;
+        }
+        in_images.push_back(candidates[c]);
+        left_preds.push_back(left_pred);
+        right_preds.push_back(right_pred);
+      }
+
+      // Spread the points evenly over the left image
+      std::vector<size_t> picked;
+      stratified_subsample(left_preds, image_boxes[icam],
+                           opt.max_num_reference_points_per_pair, picked);
+
+      // Read the disparity only where needed
+      BBox2 pred_box;
+      for (size_t k = 0; k < picked.size(); k++)
+        pred_box.grow(left_preds[picked[k]]);
+      BBox2i disp_box;
+      if (!pred_box.empty()) {
+        disp_box = grow_bbox_to_int(pred_box);
+        disp_box.expand(DISP_MARGIN);
+      }
+      vw_out() << "Reading: " << disp_files[icam] << std::endl;
+      interp_disp[icam] = CroppedDisparity(disp_files[icam], disp_box);
+
+      for (size_t k = 0; k < picked.size(); k++) {
+        Vector2 left_pred  = left_preds [picked[k]];
+        Vector2 right_pred = right_preds[picked[k]];
+
         if (!interp_disp[icam].pixel_in_bounds(left_pred))
           continue; // Interp check
 
@@ -1134,12 +1518,6 @@ int do_ba_ceres_one_pass(Options             & opt,
         if (!is_valid(dispPix))
           continue;
 
-        // Check if the current point projects in the cameras
-        if ( !image_boxes[icam  ].contains(left_pred ) || 
-             !image_boxes[icam+1].contains(right_pred)   ) {
-          continue;
-        }
-
         Vector2 right_pix = left_pred + dispPix.child();
         if (!image_boxes[icam+1].contains(right_pix)) 
           continue; // Check offset location too
@@ -1149,12 +1527,13 @@ int do_ba_ceres_one_pass(Options             & opt,
           continue;
         }
 
-        reference_vec.push_back(reference_xyz);
+        reference_vec.push_back(reference_xyz[in_images[picked[k]]]);
 
         // Call function to select the appropriate Ceres residual block to add.
-        add_disparity_residual_block(reference_xyz, interp_disp[icam],
-                                     icam, icam+1, // left icam and right icam
-                                     param_storage, opt, problem);
+        ba_problem.other_blocks.push_back
+          (add_disparity_residual_block(reference_vec.back(), interp_disp[icam],
+                                        icam, icam+1, // left icam and right icam
+                                        param_storage, opt, problem));
       }
       tpc.report_incremental_progress( inc_amount );
     }
@@ -1162,6 +1541,36 @@ int do_ba_ceres_one_pass(Options             & opt,
     tpc.report_finished();
     vw_out() << "Found " << reference_vec.size() << " reference points in range.\n";
   } // End if (opt.reference_terrain != "")
+
+} // End function build_ba_problem
+
+int do_ba_ceres_one_pass(Options             & opt,
+                         BAObservations const& obs,
+                         bool                  first_pass,
+                         bool                  last_pass,
+                         BAParamStorage      & param_storage, 
+                         BAParamStorage const& orig_parameters,
+                         boost::shared_ptr<BaProblem> & ba_problem_ptr,
+                         bool                & convergence_reached,
+                         double              & final_cost){
+
+  ControlNetwork & cnet = *opt.cnet;
+  const int num_points  = param_storage.num_points();
+
+  convergence_reached = true;
+
+  // Reuse the problem from the previous pass, removing only the blocks of
+  // the new outliers. With --heights-from-dem the points are set from the
+  // DEM as the blocks are added, so then build the problem anew.
+  if (ba_problem_ptr.get() != NULL && opt.heights_from_dem == "") {
+    remove_outlier_blocks(obs, param_storage, *ba_problem_ptr);
+  } else {
+    ba_problem_ptr.reset(new BaProblem);
+    build_ba_problem(opt, obs, param_storage, orig_parameters, *ba_problem_ptr);
+  }
+  BaProblem      & ba_problem = *ba_problem_ptr;
+  ceres::Problem & problem    = *ba_problem.problem;
+  int num_gcp                 = ba_problem.num_gcp;
   
   const size_t MIN_KML_POINTS = 50;
   size_t kmlPointSkip = 30;
@@ -1187,12 +1596,10 @@ int do_ba_ceres_one_pass(Options             & opt,
 
     // These are not useful
     //write_residual_logs(residual_prefix, true,  opt, param_storage, 
-    //                    cam_residual_counts, num_gcp_residuals,
-    //                    reference_vec, cnet, crn, problem);
+    //                    ba_problem, cnet, obs);
     residual_prefix = opt.out_prefix + "-initial_residuals_no_loss_function";
     write_residual_logs(residual_prefix, false, opt, param_storage, 
-                        cam_residual_counts, num_gcp_residuals,
-                        reference_vec, cnet, crn, problem);
+                        ba_problem, cnet, obs);
 
     param_storage.record_points_to_kml(point_kml_path, opt.datum, 
                          kmlPointSkip, "initial_points",
@@ -1209,10 +1616,9 @@ int do_ba_ceres_one_pass(Options             & opt,
   options.max_num_consecutive_invalid_steps = std::max(5, opt.num_iterations/5); // try hard
   options.minimizer_progress_to_stdout      = true;//(opt.report_level >= vw::ba::ReportFile);
 
-  if (opt.single_threaded_cameras)
-    options.num_threads = 1;
-  else
-    options.num_threads = opt.num_threads;
+  // Cameras which are not thread-safe, such as ISIS, are wrapped in a lock,
+  // so the rest of the work, including the linear solver, uses all threads.
+  options.num_threads = opt.num_threads;
 
   // Use a callback function at every iteration, if desired to save the intermediate results
   BaCallback callback(opt, param_storage);
@@ -1222,16 +1628,7 @@ int do_ba_ceres_one_pass(Options             & opt,
   }
   
   // Set solver options according to the recommendations in the Ceres solving FAQs
-  options.linear_solver_type = ceres::SPARSE_SCHUR;
-  if (num_cameras < 100)
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-  if (num_cameras > 3500) {
-    options.use_explicit_schur_complement = true; // This is supposed to help with speed in a certain size range
-    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
-    options.preconditioner_type = ceres::SCHUR_JACOBI;
-  }
-  if (num_cameras > 7000)
-    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+  set_linear_solver(opt, param_storage, problem, options);
 
   //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
@@ -1257,11 +1654,11 @@ int do_ba_ceres_one_pass(Options             & opt,
   vw_out() << "Writing final condition log files..." << std::endl;
   // Not useful
   //residual_prefix = opt.out_prefix + "-final_residuals_loss_function";
-  //write_residual_logs(residual_prefix, true,  opt, param_storage, cam_residual_counts,
-  //		      num_gcp_residuals, reference_vec, cnet, crn, problem);
+  //write_residual_logs(residual_prefix, true,  opt, param_storage, ba_problem,
+  //		      cnet, obs);
   residual_prefix = opt.out_prefix + "-final_residuals_no_loss_function";
-  write_residual_logs(residual_prefix, false, opt, param_storage, cam_residual_counts,
-		      num_gcp_residuals, reference_vec, cnet, crn, problem);
+  write_residual_logs(residual_prefix, false, opt, param_storage, ba_problem,
+		      cnet, obs);
   
   point_kml_path = opt.out_prefix + "-final_points.kml";
   param_storage.record_points_to_kml(point_kml_path, opt.datum,
@@ -1280,10 +1677,9 @@ int do_ba_ceres_one_pass(Options             & opt,
   int num_new_outliers = 0;
   if (!last_pass) 
     num_new_outliers =
-      update_outliers(cnet, crn,
+      update_outliers(cnet, obs,
                       param_storage,   // in-out
-                      opt, cam_residual_counts,  
-                      num_gcp_residuals, reference_vec, problem);
+                      opt, ba_problem);
 
   // Remove flagged outliers and create clean match files.
   // Do this even when no new outliers are found, to
@@ -1440,13 +1836,16 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
   // - This includes modifications from any initial transforms that were specified.
   BAParamStorage orig_parameters(param_storage);
 
-  // TODO: Possible to avoid using CRNs?
-  CRNJ crn;
-  crn.read_controlnetwork(cnet);
+  // The observations of each camera, in a compact form
+  BAObservations obs;
+  obs.read_controlnetwork(cnet, num_cameras);
 
   if (opt.num_ba_passes <= 0)
     vw_throw(ArgumentErr() << "Error: Expecting at least one bundle adjust pass.\n");
   
+  // The problem is built on the first pass and then reused
+  boost::shared_ptr<BaProblem> ba_problem;
+  
   double final_cost;
   for (int pass = 0; pass < opt.num_ba_passes; pass++) {
 
@@ -1461,9 +1860,10 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     // Do another pass of bundle adjustment.
     bool last_pass = (pass == opt.num_ba_passes - 1);
     bool convergence_reached = true;
-    int  num_new_outliers    = do_ba_ceres_one_pass(opt, crn, (pass==0), last_pass,
+    int  num_new_outliers    = do_ba_ceres_one_pass(opt, obs, (pass==0), last_pass,
                                                     param_storage, orig_parameters,
-                                                    convergence_reached, final_cost);
+                                                    ba_problem, convergence_reached,
+                                                    final_cost);
 
     if (!last_pass && num_new_outliers == 0 && convergence_reached) {
       vw_out() << "No new outliers removed, and the algorithm converged. "
@@ -1505,9 +1905,10 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     bool first_pass = true;
     bool last_pass  = true;
     bool convergence_reached = true;
-    int  num_new_outliers    = do_ba_ceres_one_pass(opt, crn, first_pass, last_pass,
+    int  num_new_outliers    = do_ba_ceres_one_pass(opt, obs, first_pass, last_pass,
                                                     param_storage, orig_parameters,
-                                                    convergence_reached, final_cost);
+                                                    ba_problem, convergence_reached,
+                                                    final_cost);
     // Record the parameters of the best result.
     if (final_cost < best_cost) {
       vw_out() << "  --> Found a better solution!\n\n";
@@ -1594,7 +1995,6 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   const double nan = std::numeric_limits<double>::quiet_NaN();
   std::string intrinsics_to_float_str, intrinsics_to_share_str,
     intrinsics_limit_str;
-  float auto_overlap_buffer;
   bool  inline_adjustments;
   int   max_iterations_tmp;
   po::options_description general_options("");
@@ -1627,8 +2027,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Prefix to read initial adjustments from, written by a previous invocation of this program.")
     ("initial-transform",   po::value(&opt.initial_transform_file)->default_value(""),
      "Before optimizing the cameras, apply to them the 4x4 rotation + translation transform from this file. The transform is in respect to the planet center, such as written by pc_align's source-to-reference or reference-to-source alignment transform. Set the number of iterations to 0 to stop at this step. If --input-adjustments-prefix is specified, the transform gets applied after the adjustments are read.")
+    ("incremental",    po::bool_switch(&opt.incremental)->default_value(false)->implicit_value(true),
+     "Add new images to a previously adjusted set. The images having adjustments at --input-adjustments-prefix are kept fixed, unless --old-camera-weight is positive, and are not matched among themselves.")
+    ("old-camera-weight",    po::value(&opt.old_camera_weight)->default_value(0.0),
+     "With --incremental, if positive, float the previously adjusted cameras, with this weight for the constraint that they stay close to their input adjustments, in place of --camera-weight.")
     ("fixed-camera-indices",    po::value(&opt.fixed_cameras_indices_str)->default_value(""),
      "A list of indices, in quotes and starting from 0, with space as separator, corresponding to cameras to keep fixed during the optimization process.")
+    ("image-subset-indices",    po::value(&opt.image_subset_indices_str)->default_value(""),
+     "A list of indices, in quotes and starting from 0, with space as separator, of the input images to use. The other images and cameras are ignored. The indices in --fixed-camera-indices are in respect to the full list. This is used by parallel_bundle_adjust to solve for subsets of images.")
     ("fix-gcp-xyz",       po::bool_switch(&opt.fix_gcp_xyz)->default_value(false)->implicit_value(true),
      "If the GCP are highly accurate, use this option to not float them during the optimization.")
 
@@ -1639,6 +2045,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "An externally provided trustworthy 3D terrain, either as a DEM or as a lidar file, very close (after alignment) to the stereo result from the given images and cameras that can be used as a reference, instead of GCP, to optimize the intrinsics of the cameras.")
     ("max-num-reference-points", po::value(&opt.max_num_reference_points)->default_value(100000000),
      "Maximum number of (randomly picked) points from the reference terrain to use.")
+    ("max-num-reference-points-per-pair", po::value(&opt.max_num_reference_points_per_pair)->default_value(0),
+     "If positive, use at most this many points from the reference terrain for each image pair, spread evenly over the left image, rather than all of them.")
     ("disparity-list",           po::value(&opt.disparity_list)->default_value(""),
      "The unaligned disparity files to use when optimizing the intrinsics based on a reference terrain. Specify them as a list in quotes separated by spaces. First file is for the first two images, second is for the second and third images, etc. If an image pair has no disparity file, use 'none'.")
     ("max-disp-error",           po::value(&opt.max_disp_error)->default_value(-1),
@@ -1684,12 +2092,16 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Set the maximum number of iterations.") // alias for num-iterations
     ("parameter-tolerance",  po::value(&opt.parameter_tolerance)->default_value(1e-8),
      "Stop when the relative error in the variables being optimized is less than this.")
+    ("linear-solver",        po::value(&opt.linear_solver)->default_value("auto"),
+     "The Ceres linear solver. Options: auto, dense_schur, sparse_schur, iterative_schur. With auto, the choice is based on the number of cameras and on the fraction of camera pairs which see common points.")
+    ("preconditioner",       po::value(&opt.preconditioner)->default_value("schur_jacobi"),
+     "The preconditioner to use with --linear-solver iterative_schur. Options: jacobi, schur_jacobi, cluster_jacobi, cluster_tridiagonal. The cluster preconditioners group the cameras by the points they see, and need Ceres to be built with SuiteSparse.")
     ("overlap-limit",        po::value(&opt.overlap_limit)->default_value(0),
      "Limit the number of subsequent images to search for matches to the current image to this value.  By default match all images.")
     ("overlap-list",         po::value(&opt.overlap_list_file)->default_value(""),
      "A file containing a list of image pairs, one pair per line, separated by a space, which are expected to overlap. Matches are then computed only among the images in each pair.")
-    ("auto-overlap-buffer",  po::value(&auto_overlap_buffer)->default_value(-1),
-     "Try to automatically guess which images overlap with the provided buffer in lonlat degrees.")
+    ("auto-overlap-buffer",  po::value(&opt.auto_overlap_buffer)->default_value(-1),
+     "Try to automatically guess which images overlap with the provided buffer in lonlat degrees. The footprints are read from WorldView XML files, else found by intersecting the cameras with the datum.")
     ("position-filter-dist", po::value(&opt.position_filter_dist)->default_value(-1),
      "Set a distance in meters and don't perform IP matching on images with an estimated camera center farther apart than this distance.  Requires --camera-positions.")
     ("match-first-to-last", po::value(&opt.match_first_to_last)->default_value(false)->implicit_value(true),
@@ -1743,6 +2155,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "When matching IP, filter out any pairs with a triangulation error higher than this.")
     ("ip-num-ransac-iterations", po::value(&opt.ip_num_ransac_iterations)->default_value(1000),
      "How many RANSAC iterations to do in interest point matching.")
+    ("ip-brute-force-matching", po::bool_switch(&opt.ip_brute_force_matching)->default_value(false)->implicit_value(true),
+     "Match the interest point descriptors by comparing with all descriptors in the other image, rather than with the approximate FLANN search. Applies when matching with a datum and cameras.")
     ("min-triangulation-angle",      po::value(&opt.min_triangulation_angle)->default_value(0.1),
      "The minimum angle, in degrees, at which rays must meet at a triangulated point to accept this point as valid. It must be a positive value.")
     ("forced-triangulation-distance",      po::value(&opt.forced_triangulation_distance)->default_value(-1),
@@ -1761,6 +2175,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Given map-projected versions of the input images, the DEM they were mapprojected onto, and IP matches among the mapprojected images, create IP matches among the un-projected images before doing bundle adjustment. Specify the mapprojected images and the DEM as a string in quotes, separated by spaces. An example is in the documentation.")
     ("save-cnet-as-csv", po::bool_switch(&opt.save_cnet_as_csv)->default_value(false)->implicit_value(true),
      "Save the control network containing all interest points in the format used by ground control points, so it can be inspected.")
+    ("binary-residual-report", po::bool_switch(&opt.binary_residual_report)->default_value(false)->implicit_value(true),
+     "Write the raw pixel residuals and the residuals at the triangulated points in a compact binary format, rather than as text. This is faster and smaller with many interest points. The format is described in the documentation.")
     ("gcp-from-mapprojected-images", po::value(&opt.gcp_from_mapprojected)->default_value(""),
      "Given map-projected versions of the input images, the DEM the were mapprojected onto, and interest point matches among all of these created in stereo_gui, create GCP for the input images to align them better to the DEM. This is experimental and not documented.")
     ("instance-count",      po::value(&opt.instance_count)->default_value(1),
@@ -1773,6 +2189,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Quit after writing all match files.")
     ("skip-matching",    po::bool_switch(&opt.skip_matching)->default_value(false)->implicit_value(true),
      "Only use image matches which can be loaded from disk.")
+    ("num-matching-threads",    po::value(&opt.num_matching_threads)->default_value(0),
+     "How many image pairs to match in parallel. Each image has its interest points found once, and these are shared among its pairs. The default is the number of threads. With ISIS cameras, or with images normalized together for matching, the pairs are matched one at a time.")
+    ("camera-grid-error",       po::value(&opt.camera_grid_error)->default_value(0),
+     "With --mapprojected-data or --gcp-from-mapprojected-images, project the matches into the cameras by interpolating in a grid of projections, made finer until the interpolation errors are below this value, in camera pixels. This is faster with many matches per image. The default is 0, which projects each match exactly.")
     ("ip-debug-images",        po::value(&opt.ip_debug_images)->default_value(false)->implicit_value(true),
      "Write debug images to disk when detecting and matching interest points.")
     
@@ -1834,6 +2254,42 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr() << "Missing input image files.\n"
                             << usage << general_options );
 
+  // Keep only the images and cameras in the given subset. The indices of
+  // the fixed cameras refer to the full list, so convert them as well.
+  if (opt.image_subset_indices_str != "") {
+    std::map<int, int> subset_index;
+    std::istringstream is(opt.image_subset_indices_str);
+    int val;
+    while (is >> val) {
+      if (val < 0 || val >= (int)opt.image_files.size()) 
+        vw_throw( ArgumentErr() << "The image subset index " << val
+                                << " is out of bounds.\n" );
+      subset_index[val] = 0;
+    }
+    if (subset_index.empty())
+      vw_throw( ArgumentErr() << "No valid indices in --image-subset-indices.\n");
+
+    std::vector<std::string> image_files, camera_files;
+    for (std::map<int, int>::iterator it = subset_index.begin();
+         it != subset_index.end(); it++) {
+      it->second = image_files.size();
+      image_files.push_back(opt.image_files[it->first]);
+      camera_files.push_back(opt.camera_files[it->first]);
+    }
+    opt.image_files  = image_files;
+    opt.camera_files = camera_files;
+
+    std::ostringstream os;
+    std::istringstream is2(opt.fixed_cameras_indices_str);
+    while (is2 >> val) {
+      if (subset_index.find(val) != subset_index.end())
+        os << subset_index[val] << " ";
+    }
+    opt.fixed_cameras_indices_str = os.str();
+    
+    vw_out() << "Using a subset of " << opt.image_files.size() << " images.\n";
+  }
+
 
   // Work out the camera model type to use
   boost::to_lower( opt.stereo_session_string );
@@ -1900,10 +2356,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
       opt.overlap_list.insert(std::pair<std::string, std::string>(image2, image1));
     }
     ifs.close();
-  } else {
-    if (!vm["auto-overlap-buffer"].defaulted())
-      auto_build_overlap_list(opt, auto_overlap_buffer);
   }
+  // Else, with --auto-overlap-buffer, the overlap list is
+  // found once the cameras are loaded
   
   if ( opt.camera_weight < 0.0 )
     vw_throw( ArgumentErr() << "The camera weight must be non-negative.\n" << usage
@@ -1954,6 +2409,15 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr() << "When using a camera position file, the csv-format "
 	      << "option must be set.\n" << usage << general_options );
 
+  if (opt.linear_solver != "auto" && opt.linear_solver != "dense_schur" &&
+      opt.linear_solver != "sparse_schur" && opt.linear_solver != "iterative_schur")
+    vw_throw( ArgumentErr() << "Unknown linear solver: " << opt.linear_solver << ".\n"
+	      << usage << general_options );
+  if (opt.preconditioner != "jacobi" && opt.preconditioner != "schur_jacobi" &&
+      opt.preconditioner != "cluster_jacobi" && opt.preconditioner != "cluster_tridiagonal")
+    vw_throw( ArgumentErr() << "Unknown preconditioner: " << opt.preconditioner << ".\n"
+	      << usage << general_options );
+
   // Copy the IP settings to the global stereo_settings() object
   opt.copy_to_asp_settings();
 
@@ -2129,6 +2593,31 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     }
   }
 
+  // In incremental mode, the cameras having input adjustments are the old ones
+  opt.old_camera_indices.clear();
+  if (opt.incremental) {
+    if (opt.input_prefix == "")
+      vw_throw( ArgumentErr() << "The option --incremental requires "
+                              << "--input-adjustments-prefix.\n");
+    for (size_t icam = 0; icam < opt.image_files.size(); icam++) {
+      std::string adjust_file = asp::bundle_adjust_file_name(opt.input_prefix,
+                                                             opt.image_files[icam],
+                                                             opt.camera_files[icam]);
+      if (boost::filesystem::exists(adjust_file))
+        opt.old_camera_indices.insert(icam);
+    }
+    int num_new = opt.image_files.size() - opt.old_camera_indices.size();
+    vw_out() << "Incremental mode: " << opt.old_camera_indices.size()
+             << " previously adjusted and " << num_new << " new images.\n";
+    if (num_new == 0)
+      vw_out(WarningMessage) << "All images have input adjustments, "
+                             << "so there are no new images to adjust.\n";
+
+    if (opt.old_camera_weight <= 0) 
+      opt.fixed_cameras_indices.insert(opt.old_camera_indices.begin(),
+                                       opt.old_camera_indices.end());
+  }
+
   if (opt.reference_terrain != "") {
     std::string file_type = asp::get_cloud_type(opt.reference_terrain);
     if (file_type == "CSV" && opt.csv_format_str == "") 
@@ -2155,7 +2644,8 @@ void ba_match_ip(Options & opt,
 		 std::string const& camera2_path,
 		 vw::camera::CameraModel* cam1,
 		 vw::camera::CameraModel* cam2,
-		 std::string const& match_filename){
+		 std::string const& match_filename,
+                 bool reuse_ip_files = false){
   
   boost::shared_ptr<DiskImageResource>
     rsrc1(vw::DiskImageResourcePtr(image1_path)),
@@ -2164,7 +2654,8 @@ void ba_match_ip(Options & opt,
     vw_throw(ArgumentErr()
 	     << "Error: Input images can only have a single channel!\n\n");
   float nodata1, nodata2;
-  SessionPtr session(asp::StereoSessionFactory::create(opt.stereo_session_string, opt,
+  std::string session_string = opt.stereo_session_string; // may be called in parallel
+  SessionPtr session(asp::StereoSessionFactory::create(session_string, opt,
 						       image1_path,  image2_path,
 						       camera1_path, camera2_path,
 						       opt.out_prefix));
@@ -2182,9 +2673,11 @@ void ba_match_ip(Options & opt,
   // Since we computed statistics earlier, this will just be loading files.
   vw::Vector<vw::float32,6> image1_stats, image2_stats;
   image1_stats = asp::StereoSession::gather_stats(masked_image1,
-						  image1_path, opt.out_prefix, image1_path);
+						  image1_path, opt.out_prefix, image1_path,
+						  asp::image_stats_key(image1_path, nodata1));
   image2_stats = asp::StereoSession::gather_stats(masked_image2,
-						  image2_path, opt.out_prefix, image2_path);
+						  image2_path, opt.out_prefix, image2_path,
+						  asp::image_stats_key(image2_path, nodata2));
   
   // The match files are cached unless the images or camera
   // are newer than them. The IP files are cached for certain
@@ -2194,12 +2687,139 @@ void ba_match_ip(Options & opt,
   session->ip_matching(image1_path, image2_path,
 		       Vector2(masked_image1.cols(), masked_image1.rows()),
 		       image1_stats, image2_stats, opt.ip_per_tile,
-		       nodata1, nodata2, cam1, cam2, match_filename, ip_file1, ip_file2);
+		       nodata1, nodata2, cam1, cam2, match_filename, ip_file1, ip_file2,
+                       reuse_ip_files);
 }
 
 //==================================================================================
 // Mapprojected image functions.
 
+/// How many interest points in map-projected images are converted to
+/// camera pixels by each task
+const size_t MAPPROJ_IP_BATCH_SIZE = 500;
+
+/// Convert a batch of interest points from a map-projected image to its
+/// camera image, as part of converting many points in parallel. If a
+/// camera grid is given, the projection into the camera is interpolated.
+class ProjectedIpToRawIpTask: public Task, private boost::noncopyable {
+  std::vector<ip::InterestPoint> & m_ip;
+  std::vector<char>              & m_valid;
+  std::vector<size_t> const&       m_order;
+  size_t                           m_begin, m_end;
+  ImageViewRef< PixelMask<double> > const& m_interp_dem;
+  boost::shared_ptr<CameraModel>   m_camera_model;
+  vw::cartography::GeoReference const& m_georef;
+  vw::cartography::GeoReference const& m_dem_georef;
+  asp::CameraGridTransform<MapprojToCamTrans> const* m_grid;
+public:
+  ProjectedIpToRawIpTask(std::vector<ip::InterestPoint> & ip, std::vector<char> & valid,
+                         std::vector<size_t> const& order, size_t begin, size_t end,
+                         ImageViewRef< PixelMask<double> > const& interp_dem,
+                         boost::shared_ptr<CameraModel> camera_model,
+                         vw::cartography::GeoReference const& georef,
+                         vw::cartography::GeoReference const& dem_georef,
+                         asp::CameraGridTransform<MapprojToCamTrans> const* grid):
+    m_ip(ip), m_valid(valid), m_order(order), m_begin(begin), m_end(end),
+    m_interp_dem(interp_dem), m_camera_model(camera_model), m_georef(georef),
+    m_dem_georef(dem_georef), m_grid(grid) {}
+
+  void operator()() {
+    for (size_t k = m_begin; k < m_end; k++) {
+      size_t it = m_order[k];
+      ip::InterestPoint & P = m_ip[it];
+      if (m_grid == NULL) {
+        m_valid[it] = projected_ip_to_raw_ip(P, m_interp_dem, m_camera_model,
+                                             m_georef, m_dem_georef);
+        continue;
+      }
+
+      // The grid checks the DEM only at its nodes, so check the point too
+      m_valid[it] = false;
+      Vector2 pix(P.x, P.y), cam_pix;
+      Vector3 xyz;
+      if (!mapproj_pixel_to_xyz(pix, m_interp_dem, m_georef, m_dem_georef, xyz))
+        continue;
+      try {
+        cam_pix = m_grid->reverse(pix);
+      } catch(...) {
+        continue;
+      }
+      P.x  = cam_pix.x();
+      P.y  = cam_pix.y();
+      P.ix = P.x;
+      P.iy = P.y;
+      m_valid[it] = true;
+    }
+  }
+};
+
+/// Convert the interest points in the map-projected image of the given
+/// camera to the camera image, in batches of points which are done in
+/// parallel. Set valid to whether each point could be converted. With
+/// --camera-grid-error, the points are ordered by the blocks of the
+/// camera grid, so that each thread makes the grid of a block once.
+void projected_ips_to_raw_ips(Options const& opt, int cam_index,
+                              std::vector<ip::InterestPoint> & ip,
+                              ImageViewRef< PixelMask<double> > const& interp_dem,
+                              vw::cartography::GeoReference const& georef,
+                              vw::cartography::GeoReference const& dem_georef,
+                              int num_threads, std::vector<char> & valid) {
+
+  valid.assign(ip.size(), false);
+  std::vector<size_t> order(ip.size());
+  for (size_t it = 0; it < ip.size(); it++)
+    order[it] = it;
+
+  typedef asp::CameraGridTransform<MapprojToCamTrans> GridT;
+  boost::shared_ptr<GridT> grid;
+  if (opt.camera_grid_error > 0) {
+    boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(opt.image_files[cam_index]));
+    grid.reset(new GridT(MapprojToCamTrans(interp_dem, opt.camera_models[cam_index],
+                                           georef, dem_georef),
+                         Vector2i(rsrc->cols(), rsrc->rows()), opt.camera_grid_error));
+    std::vector<std::pair<Vector2i, size_t> > blocks(ip.size());
+    for (size_t it = 0; it < ip.size(); it++)
+      blocks[it] = std::make_pair(Vector2i(int(std::floor(ip[it].y / GridT::BLOCK_SIZE)),
+                                           int(std::floor(ip[it].x / GridT::BLOCK_SIZE))), it);
+    std::stable_sort(blocks.begin(), blocks.end(),
+                     [](std::pair<Vector2i, size_t> const& a, std::pair<Vector2i, size_t> const& b) {
+                       return a.first[0] < b.first[0] ||
+                         (a.first[0] == b.first[0] && a.first[1] < b.first[1]); });
+    for (size_t it = 0; it < ip.size(); it++)
+      order[it] = blocks[it].second;
+  }
+
+  if (opt.single_threaded_cameras)
+    num_threads = 1;
+  FifoWorkQueue queue(std::max(num_threads, 1));
+  for (size_t begin = 0; begin < ip.size(); begin += MAPPROJ_IP_BATCH_SIZE) {
+    size_t end = std::min(begin + MAPPROJ_IP_BATCH_SIZE, ip.size());
+    boost::shared_ptr<ProjectedIpToRawIpTask>
+      task(new ProjectedIpToRawIpTask(ip, valid, order, begin, end, interp_dem,
+                                      opt.camera_models[cam_index], georef, dem_georef,
+                                      grid.get()));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
+/// Read into memory the part of the DEM under the given map-projected
+/// images, to be shared by the threads converting their interest points.
+void cache_dem_under_mapproj_images(std::string const& dem_file,
+                                    std::vector<std::string> const& map_files,
+                                    vw::cartography::GeoReference const& dem_georef,
+                                    ImageViewRef< PixelMask<double> > & interp_dem) {
+  BBox2i region;
+  for (size_t it = 0; it < map_files.size(); it++) {
+    vw::cartography::GeoReference georef;
+    if (!vw::cartography::read_georeference(georef, map_files[it]))
+      vw_throw(ArgumentErr() << "Error: Cannot read georeference from: " << map_files[it] << ".\n");
+    boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(map_files[it]));
+    region.grow(dem_pixel_box(BBox2(0, 0, rsrc->cols(), rsrc->rows()), georef, dem_georef));
+  }
+  cache_dem_region(dem_file, region, interp_dem);
+}
+
 /// If the user map-projected the images (this is useful when the
 /// perspective or illumination conditions are too different, and
 /// automated matching fails), first create matches among the
@@ -2212,8 +2832,9 @@ void matches_from_mapproj_images(int i, int j,
                                  Options& opt,
                                  std::vector<std::string> const& map_files,
                                  vw::cartography::GeoReference const& dem_georef,
-                                 ImageViewRef< PixelMask<double> > & interp_dem,
-                                 std::string const& match_filename){
+                                 ImageViewRef< PixelMask<double> > const& interp_dem,
+                                 std::string const& match_filename,
+                                 bool reuse_ip_files, int num_threads){
   
   vw::cartography::GeoReference georef1, georef2;
   vw_out() << "Reading georef from " << map_files[i] << ' ' << map_files[j] << std::endl;
@@ -2242,7 +2863,7 @@ void matches_from_mapproj_images(int i, int j,
     ba_match_ip(opt, map_files[i], map_files[j],
                 opt.camera_files[i], opt.camera_files[j],
                 NULL, NULL, // cameras are set to null since images are mapprojected
-                map_match_file);
+                map_match_file, reuse_ip_files);
   } catch ( const std::exception& e ){
     vw_out() << "Could not find interest points between images "
              << map_files[i] << " and " << map_files[j] << std::endl;
@@ -2258,20 +2879,17 @@ void matches_from_mapproj_images(int i, int j,
   vw_out() << "Reading: " << map_match_file << std::endl;
   std::vector<ip::InterestPoint> ip1,     ip2;
   std::vector<ip::InterestPoint> ip1_cam, ip2_cam;
-  ip::read_binary_match_file(map_match_file, ip1, ip2);
+  asp::read_match_file(map_match_file, ip1, ip2);
   
   // Undo the map-projection
+  std::vector<char> valid1, valid2;
+  projected_ips_to_raw_ips(opt, i, ip1, interp_dem, georef1, dem_georef, num_threads, valid1);
+  projected_ips_to_raw_ips(opt, j, ip2, interp_dem, georef2, dem_georef, num_threads, valid2);
   for (size_t ip_iter = 0; ip_iter < ip1.size(); ip_iter++) {
-    
-    vw::ip::InterestPoint P1 = ip1[ip_iter];
-    vw::ip::InterestPoint P2 = ip2[ip_iter];
-    if (!projected_ip_to_raw_ip(P1, interp_dem, opt.camera_models[i], georef1, dem_georef))
+    if (!valid1[ip_iter] || !valid2[ip_iter])
       continue;
-    if (!projected_ip_to_raw_ip(P2, interp_dem, opt.camera_models[j], georef2, dem_georef))
-      continue;
-    
-    ip1_cam.push_back(P1);
-    ip2_cam.push_back(P2);
+    ip1_cam.push_back(ip1[ip_iter]);
+    ip2_cam.push_back(ip2[ip_iter]);
   }
   
   vw_out() << "Saving " << ip1_cam.size() << " matches.\n";
@@ -2281,6 +2899,140 @@ void matches_from_mapproj_images(int i, int j,
 
 } // End function matches_from_mapproj_images()
 
+/// Compute the statistics of an image, and if desired, find its interest
+/// points and save them to its ip file. Then all pairs this image is part of
+/// can reuse these, rather than each pair detecting them again.
+class DetectImageIpTask: public Task, private boost::noncopyable {
+  Options const& m_opt;
+  std::string    m_image_path, m_camera_path;
+  bool           m_detect_ip;
+public:
+  DetectImageIpTask(Options const& opt, std::string const& image_path,
+                    std::string const& camera_path, bool detect_ip):
+    m_opt(opt), m_image_path(image_path), m_camera_path(camera_path),
+    m_detect_ip(detect_ip) {}
+
+  void operator()() {
+    std::string session_string = m_opt.stereo_session_string;
+    SessionPtr session(asp::StereoSessionFactory::create(session_string, m_opt,
+                                                         m_image_path,  m_image_path,
+                                                         m_camera_path, m_camera_path,
+                                                         m_opt.out_prefix));
+    boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(m_image_path));
+    float nodata, dummy;
+    session->get_nodata_values(rsrc, rsrc, nodata, dummy);
+
+    DiskImageView<float> image(rsrc);
+    ImageViewRef< PixelMask<float> > masked_image = create_mask_less_or_equal(image, nodata);
+    vw::Vector<vw::float32,6> stats = asp::StereoSession::gather_stats(masked_image, m_image_path,
+                                                                m_opt.out_prefix,
+                                                                m_image_path,
+                                                                asp::image_stats_key(m_image_path,
+                                                                                     nodata));
+    if (!m_detect_ip)
+      return;
+
+    // Same as in StereoSession::ip_matching(), with the image normalized by itself
+    ImageViewRef<float> image_norm = image, dummy_norm = image;
+    if (asp::stereo_settings().ip_matching_method != asp::DETECT_IP_METHOD_INTEGRAL &&
+        stats[0] != stats[1])
+      asp::StereoSession::normalize_images(asp::stereo_settings().force_use_entire_range,
+                                           true, // individually normalize
+                                           true, // use percentile based stretch
+                                           stats, stats, image_norm, dummy_norm);
+
+    std::string ip_file = ip::ip_filename(m_opt.out_prefix, m_image_path);
+    if (boost::filesystem::exists(ip_file))
+      boost::filesystem::remove(ip_file);
+    vw::ip::InterestPointList ip;
+    asp::detect_ip(ip, image_norm, m_opt.ip_per_tile, ip_file, nodata);
+  }
+};
+
+/// Find the matches among two images, unless cached, and print the coverage.
+/// Return true on success.
+bool match_image_pair(int i, int j, Options & opt,
+                      std::vector<std::string> const& map_files,
+                      vw::cartography::GeoReference const& dem_georef,
+                      ImageViewRef< PixelMask<double> > const& interp_dem,
+                      std::string const& match_filename,
+                      bool reuse_ip_files, int num_threads) {
+
+  std::string image1_path  = opt.image_files[i];
+  std::string image2_path  = opt.image_files[j];
+  std::string camera1_path = opt.camera_files[i];
+  std::string camera2_path = opt.camera_files[j];
+
+  // IP matching may not succeed for all pairs
+  try{
+    boost::shared_ptr<DiskImageResource>
+      rsrc1(vw::DiskImageResourcePtr(image1_path)),
+      rsrc2(vw::DiskImageResourcePtr(image2_path));
+    if ( (rsrc1->channels() > 1) || (rsrc2->channels() > 1) )
+      vw_throw(ArgumentErr() << "Error: Input images can only have a single channel!\n\n");
+
+    if (opt.mapprojected_data == "") 
+      ba_match_ip(opt, image1_path, image2_path,
+                  camera1_path, camera2_path,
+                  opt.camera_models[i].get(),
+                  opt.camera_models[j].get(),
+                  match_filename, reuse_ip_files);
+    else
+      matches_from_mapproj_images(i, j, opt, map_files, dem_georef, interp_dem,  
+                                  match_filename, reuse_ip_files, num_threads);
+
+    // Compute the coverage fraction
+    std::vector<ip::InterestPoint> ip1, ip2;
+    asp::read_match_file(match_filename, ip1, ip2);
+    int right_ip_width = rsrc1->cols()*
+      static_cast<double>(100-opt.ip_edge_buffer_percent)/100.0;
+    Vector2i ip_size(right_ip_width, rsrc1->rows());
+    double ip_coverage = asp::calc_ip_coverage_fraction(ip2, ip_size);
+    vw_out() << "IP coverage fraction = " << ip_coverage << std::endl;
+    vw_out() << "Number of matches in " << match_filename << " " << ip1.size() << "\n";
+  } catch ( const std::exception& e ){
+    vw_out() << "Could not find interest points between images "
+             << opt.image_files[i] << " and " << opt.image_files[j] << std::endl;
+    vw_out(WarningMessage) << e.what() << std::endl;
+    return false;
+  } //End try/catch
+
+  return true;
+}
+
+/// Match one pair of images, as part of matching many pairs in parallel.
+/// With mapprojected images, the threads share the DEM, and each pair
+/// converts its interest points to the cameras in its own thread.
+class MatchImagePairTask: public Task, private boost::noncopyable {
+  int m_i, m_j;
+  Options & m_opt;
+  std::vector<std::string> const& m_map_files;
+  vw::cartography::GeoReference const& m_dem_georef;
+  ImageViewRef< PixelMask<double> > const& m_interp_dem;
+  std::string m_match_filename;
+  Mutex & m_mutex;
+  int & m_num_pairs_matched;
+public:
+  MatchImagePairTask(int i, int j, Options & opt,
+                     std::vector<std::string> const& map_files,
+                     vw::cartography::GeoReference const& dem_georef,
+                     ImageViewRef< PixelMask<double> > const& interp_dem,
+                     std::string const& match_filename,
+                     Mutex & mutex, int & num_pairs_matched):
+    m_i(i), m_j(j), m_opt(opt), m_map_files(map_files), m_dem_georef(dem_georef),
+    m_interp_dem(interp_dem), m_match_filename(match_filename),
+    m_mutex(mutex), m_num_pairs_matched(num_pairs_matched) {}
+
+  void operator()() {
+    bool success = match_image_pair(m_i, m_j, m_opt, m_map_files, m_dem_georef, m_interp_dem,
+                                    m_match_filename, true, 1);
+    if (success) {
+      Mutex::Lock lock(m_mutex);
+      m_num_pairs_matched++;
+    }
+  }
+};
+
 /// If the user map-projected the images and created matches by hand
 /// from each map-projected image to the DEM it was map-projected onto,
 /// project those matches back into the camera image, and create gcp
@@ -2324,7 +3076,7 @@ void create_gcp_from_mapprojected_images(Options const& opt){
 
     vw_out() << "Reading: " << match_filename << std::endl;
     std::vector<ip::InterestPoint> ip1, ip2;
-    ip::read_binary_match_file(match_filename, ip1, ip2);
+    asp::read_match_file(match_filename, ip1, ip2);
 
     if (matches[num_images].size() > 0 && matches[num_images].size() != ip2.size()) {
       vw_throw(ArgumentErr() << "All match files must have the same number of IP.\n");
@@ -2333,7 +3085,24 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     matches[num_images] = ip2;
   }
 
+  // Read into memory the part of the DEM which the matches need, then
+  // convert the matches of each image to its camera in parallel.
+  BBox2i dem_region;
+  for (int i = 0; i < num_images; i++) {
+    BBox2 ip_box;
+    for (size_t p = 0; p < matches[i].size(); p++)
+      ip_box.grow(Vector2(matches[i][p].x, matches[i][p].y));
+    dem_region.grow(dem_pixel_box(ip_box, img_georefs[i], dem_georef));
+  }
+  for (size_t p = 0; p < matches[num_images].size(); p++)
+    dem_region.grow(Vector2i(matches[num_images][p].x, matches[num_images][p].y));
+  cache_dem_region(dem_file, dem_region, interp_dem);
+
   std::vector<std::vector<vw::ip::InterestPoint> > cam_matches = matches;
+  std::vector<std::vector<char> > cam_valid(num_images);
+  for (int i = 0; i < num_images; i++)
+    projected_ips_to_raw_ips(opt, i, cam_matches[i], interp_dem, img_georefs[i], dem_georef,
+                             vw_settings().default_num_threads(), cam_valid[i]);
 
   std::string gcp_file;
   for (int i = 0; i < num_images; i++) {
@@ -2376,13 +3145,12 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     // Write the per-image information
     for (int i = 0; i < num_images; i++) {
 
-      // Take the ip in the map-projected image, and back-project it into the camera
-      ip::InterestPoint ip = matches[i][p];
-      if (!projected_ip_to_raw_ip(ip, interp_dem, opt.camera_models[i], img_georefs[i], dem_georef))
+      // The ip in the map-projected image, back-projected into the camera
+      if (!cam_valid[i][p])
           continue;
 
       // TODO: Here we can have a book-keeping problem!
-      cam_matches[i][p] = ip;
+      ip::InterestPoint const& ip = cam_matches[i][p];
 
       output_handle << ", " << opt.image_files[i];
       output_handle << ", " << ip.x << ", " << ip.y; // IP location in image
@@ -2455,7 +3223,8 @@ int main(int argc, char* argv[]) {
 
       // Use caching function call to compute the image statistics.
       asp::StereoSession::gather_stats(masked_image, image_path,
-                                       opt.out_prefix, image_path);
+                                       opt.out_prefix, image_path,
+                                       asp::image_stats_key(image_path, nodata));
     }
     if (opt.stop_after_stats){
       vw_out() << "Quitting after statistics computation.\n";
@@ -2465,28 +3234,30 @@ int main(int argc, char* argv[]) {
       
     // Create the stereo session. This will attempt to identify the session type.
     // Read in the camera model and image info for the input images.
+    // The cameras are loaded in parallel, unless the session does not
+    // support multi-threading.
+    bool multi_threaded_cameras = true;
+    asp::load_cameras(opt.stereo_session_string, opt, opt.image_files, opt.camera_files,
+                      opt.out_prefix, opt.camera_models, multi_threaded_cameras);
     for (int i = 0; i < num_images; i++){
-      vw_out(DebugMessage,"asp") << "Loading: " << opt.image_files [i] << ' '
-                                                << opt.camera_files[i] << "\n";
-
-      // The same camera is double-loaded into the same session instance.
-      // TODO: One day replace this with a simpler camera model loader class
-      SessionPtr session(asp::StereoSessionFactory::create(opt.stereo_session_string, opt,
-                                                           opt.image_files [i], opt.image_files [i],
-                                                           opt.camera_files[i], opt.camera_files[i],
-                                                           opt.out_prefix));
-      
-      opt.camera_models.push_back(session->camera_model(opt.image_files [i],
-                                                        opt.camera_files[i]));
+      if (!multi_threaded_cameras) {
+        // Serialize the calls to this camera only, rather than running
+        // all of the solver in one thread.
+        opt.single_threaded_cameras = true;
+        opt.camera_models[i].reset(new asp::LockedCameraModel(opt.camera_models[i]));
+      }
       if (opt.approximate_pinhole_intrinsics) {
         boost::shared_ptr<vw::camera::PinholeModel> pinhole_ptr = 
-                boost::dynamic_pointer_cast<vw::camera::PinholeModel>(opt.camera_models.back());
+                boost::dynamic_pointer_cast<vw::camera::PinholeModel>(opt.camera_models[i]);
         // Replace lens distortion with fast approximation
         vw::camera::update_pinhole_for_fast_point2pixel<TsaiLensDistortion>
           (*(pinhole_ptr.get()), file_image_size(opt.image_files[i]));
       }
 
-    } // End loop through images loading all the camera models
+    } // End loop through images setting up the camera models
+
+    if (opt.overlap_list_file == "" && opt.auto_overlap_buffer >= 0)
+      auto_build_overlap_list(opt, opt.auto_overlap_buffer);
 
     // Create the match points.
     // Iterate through each pair of input images
@@ -2565,7 +3336,6 @@ int main(int argc, char* argv[]) {
     }
 
     // When we make matches based on mapprojected images.
-    // TODO: Must gather the stats beforehand, as for unprojected images!
     std::vector<std::string> map_files;
     vw::cartography::GeoReference dem_georef;
     ImageViewRef< PixelMask<double> > interp_dem;
@@ -2583,6 +3353,8 @@ int main(int argc, char* argv[]) {
       map_files.erase(map_files.end() - 1);
       
       create_interp_dem(dem_file, dem_georef, interp_dem);
+      if (!opt.skip_matching)
+        cache_dem_under_mapproj_images(dem_file, map_files, dem_georef, interp_dem);
     }
     
     // TODO: Make this a function
@@ -2602,7 +3374,8 @@ int main(int argc, char* argv[]) {
     for (size_t i=0; i<this_count; ++i)
       this_instance_pairs.push_back(all_pairs[i+start_index]);
 
-    // Now process the selected pairs
+    // Now process the selected pairs. First find the ones which are not cached.
+    std::vector<std::pair<int,int> > pairs_to_match;
     for (size_t k=0; k<this_instance_pairs.size(); ++k) {
       const int i = this_instance_pairs[k].first;
       const int j = this_instance_pairs[k].second;
@@ -2614,6 +3387,12 @@ int main(int argc, char* argv[]) {
       // - The points are written to a file on disk.
       std::string camera1_path   = opt.camera_files[i];
       std::string camera2_path   = opt.camera_files[j];
+      // The previously adjusted images are not matched again among themselves
+      if (opt.incremental &&
+          opt.old_camera_indices.find(i) != opt.old_camera_indices.end() &&
+          opt.old_camera_indices.find(j) != opt.old_camera_indices.end())
+        continue;
+
       std::string match_filename = ip::match_filename(opt.out_prefix, image1_path,
 						      image2_path);
       opt.match_files[ std::pair<int, int>(i, j) ] = match_filename;
@@ -2635,50 +3414,79 @@ int main(int argc, char* argv[]) {
       }
       if (opt.skip_matching)
         continue;
-      
-      boost::shared_ptr<DiskImageResource>
-        rsrc1(vw::DiskImageResourcePtr(image1_path)),
-        rsrc2(vw::DiskImageResourcePtr(image2_path));
-      if ( (rsrc1->channels() > 1) || (rsrc2->channels() > 1) )
-        vw_throw(ArgumentErr() << "Error: Input images can only have a single channel!\n\n");
-      float nodata1, nodata2;
-      SessionPtr session(asp::StereoSessionFactory::create(opt.stereo_session_string, opt,
-                                                            image1_path,  image2_path,
-                                                            camera1_path, camera2_path,
-                                                            opt.out_prefix));
 
-      session->get_nodata_values(rsrc1, rsrc2, nodata1, nodata2);
-
-      // IP matching may not succeed for all pairs
-      try{
-
-        if (opt.mapprojected_data == "") 
-          ba_match_ip(opt, image1_path, image2_path,
-                      camera1_path, camera2_path,
-                      opt.camera_models[i].get(),
-                      opt.camera_models[j].get(),
-                      match_filename);
-
-        else
-          matches_from_mapproj_images(i, j, opt, map_files, dem_georef, interp_dem,  
-                                      match_filename);
-
-        // Compute the coverage fraction
-        std::vector<ip::InterestPoint> ip1, ip2;
-        ip::read_binary_match_file(match_filename, ip1, ip2);
-        int right_ip_width = rsrc1->cols()*
-                              static_cast<double>(100-opt.ip_edge_buffer_percent)/100.0;
-        Vector2i ip_size(right_ip_width, rsrc1->rows());
-        double ip_coverage = asp::calc_ip_coverage_fraction(ip2, ip_size);
-        vw_out() << "IP coverage fraction = " << ip_coverage << std::endl;
-        vw_out() << "Number of matches in " << match_filename << " " << ip1.size() << "\n";
-        ++num_pairs_matched;
-      } catch ( const std::exception& e ){
-        vw_out() << "Could not find interest points between images "
-                  << opt.image_files[i] << " and " << opt.image_files[j] << std::endl;
-        vw_out(WarningMessage) << e.what() << std::endl;
-      } //End try/catch
-    } // End loop through all input image pairs
+      pairs_to_match.push_back(this_instance_pairs[k]);
+    }
+
+    // The cameras which are not thread-safe create sessions which are not
+    // either, so those pairs are matched one at a time.
+    bool parallel_matching = (!opt.single_threaded_cameras && opt.num_matching_threads != 1);
+
+    // The interest points of an image are the same for all pairs it is
+    // in, unless both images are normalized with their joint statistics.
+    // Then find them once per image, and the pairs share them. With
+    // mapprojected images, those are the images which are matched.
+    bool per_image_ip = (asp::stereo_settings().ip_matching_method
+                         == asp::DETECT_IP_METHOD_INTEGRAL ||
+                         asp::stereo_settings().individually_normalize);
+
+    // Sharing the ip files is needed for the pairs to be matched in
+    // parallel, otherwise they would write to the same files.
+    if (!per_image_ip)
+      parallel_matching = false;
+
+    int num_matching_threads = opt.num_matching_threads;
+    if (num_matching_threads <= 0)
+      num_matching_threads = vw_settings().default_num_threads();
+    if (!parallel_matching)
+      num_matching_threads = 1;
+
+    if (!pairs_to_match.empty()) {
+      std::set<int> images_to_match;
+      for (size_t k = 0; k < pairs_to_match.size(); k++) {
+        images_to_match.insert(pairs_to_match[k].first);
+        images_to_match.insert(pairs_to_match[k].second);
+      }
+
+      // Find the statistics, and if possible the interest points, of each image
+      {
+        FifoWorkQueue queue(num_matching_threads);
+        for (std::set<int>::iterator it = images_to_match.begin();
+             it != images_to_match.end(); it++) {
+          std::string image_path = (opt.mapprojected_data == "") ?
+            opt.image_files[*it] : map_files[*it];
+          boost::shared_ptr<DetectImageIpTask>
+            task(new DetectImageIpTask(opt, image_path, opt.camera_files[*it],
+                                       per_image_ip));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      }
+
+      if (parallel_matching) {
+        vw_out() << "Matching " << pairs_to_match.size() << " image pairs using "
+                 << num_matching_threads << " threads.\n";
+        Mutex count_mutex;
+        FifoWorkQueue queue(num_matching_threads);
+        for (size_t k = 0; k < pairs_to_match.size(); k++) {
+          int i = pairs_to_match[k].first, j = pairs_to_match[k].second;
+          boost::shared_ptr<MatchImagePairTask>
+            task(new MatchImagePairTask(i, j, opt, map_files, dem_georef, interp_dem,
+                                        opt.match_files[std::pair<int, int>(i, j)],
+                                        count_mutex, num_pairs_matched));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      } else {
+        for (size_t k = 0; k < pairs_to_match.size(); k++) {
+          int i = pairs_to_match[k].first, j = pairs_to_match[k].second;
+          if (match_image_pair(i, j, opt, map_files, dem_georef, interp_dem,
+                               opt.match_files[std::pair<int, int>(i, j)], per_image_ip,
+                               vw_settings().default_num_threads()))
+            ++num_pairs_matched;
+        }
+      }
+    } // End matching the image pairs
 
     if (opt.stop_after_matching){
       vw_out() << "Quitting after matches computation.\n";
@@ -25,6 +25,8 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/BundleAdjustment/ModelBase.h>
 #include <vw/BundleAdjustment/CameraRelation.h>
 #include <vw/BundleAdjustment/ControlNetwork.h>
@@ -36,10 +38,14 @@
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/LensDistortion.h>
 #include <vw/Cartography/Datum.h>
+#include <vw/Cartography/CameraBBox.h>
 #include <vw/FileIO/KML.h>
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
+#include <cmath>
+#include <limits>
 
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Camera/RPC_XML.h>
@@ -59,24 +65,25 @@ enum BACameraType {BaCameraType_Pinhole    = 0,
 struct Options : public vw::cartography::GdalWriteOptions {
   std::vector<std::string> image_files, camera_files, gcp_files;
   std::string cnet_file, out_prefix, input_prefix, stereo_session_string,
-    cost_function, mapprojected_data, gcp_from_mapprojected;
+    cost_function, mapprojected_data, gcp_from_mapprojected, linear_solver, preconditioner;
   int    ip_per_tile, ip_per_image, ip_edge_buffer_percent;
   double min_triangulation_angle, forced_triangulation_distance,
     lambda, camera_weight, rotation_weight, 
     translation_weight, overlap_exponent, robust_threshold, parameter_tolerance,
-    ip_triangulation_max_error;
+    ip_triangulation_max_error, camera_grid_error;
   int    report_level, min_matches, num_iterations, overlap_limit,
-         instance_count, instance_index, num_random_passes, ip_num_ransac_iterations;
+         instance_count, instance_index, num_random_passes, ip_num_ransac_iterations,
+         num_matching_threads;
   bool   save_intermediate_cameras, approximate_pinhole_intrinsics,
     disable_pinhole_gcp_init, transform_cameras_using_gcp, fix_gcp_xyz, solve_intrinsics,
-         ip_normalize_tiles, ip_debug_images,
+         ip_normalize_tiles, ip_debug_images, ip_brute_force_matching,
     stop_after_stats, stop_after_matching, skip_matching, match_first_to_last;
   BACameraType camera_type;
   std::string datum_str, camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list,
     heights_from_dem;
-  double semi_major, semi_minor, position_filter_dist;
-  int    num_ba_passes, max_num_reference_points;
+  double semi_major, semi_minor, position_filter_dist, auto_overlap_buffer;
+  int    num_ba_passes, max_num_reference_points, max_num_reference_points_per_pair;
   std::string remove_outliers_params_str;
   std::vector<double> intrinsics_limits;
   vw::Vector<double, 4> remove_outliers_params;
@@ -89,17 +96,20 @@ struct Options : public vw::cartography::GdalWriteOptions {
   double ip_inlier_factor, ip_uniqueness_thresh, nodata_value, max_disp_error,
     reference_terrain_weight, heights_from_dem_weight, heights_from_dem_robust_threshold;
   bool   skip_rough_homography, enable_rough_homography, disable_tri_filtering, enable_tri_filtering, no_datum, individually_normalize, use_llh_error,
-    force_reuse_match_files, save_cnet_as_csv, disable_correct_velocity_aberration, disable_correct_atmospheric_refraction;
+    force_reuse_match_files, save_cnet_as_csv, binary_residual_report, disable_correct_velocity_aberration, disable_correct_atmospheric_refraction;
   vw::Vector2  elevation_limit;     // Expected range of elevation to limit results to.
   vw::BBox2    lon_lat_limit;       // Limit the triangulated interest points to this lonlat range
   std::string           overlap_list_file;
   std::set< std::pair<std::string, std::string> > overlap_list;
   vw::Matrix4x4 initial_transform;
-  std::string   fixed_cameras_indices_str;
+  std::string   fixed_cameras_indices_str, image_subset_indices_str;
   std::set<int> fixed_cameras_indices;
   IntrinsicOptions intrinisc_options;
   std::map< std::pair<int, int>, std::string> match_files;
   bool single_threaded_cameras; // Set to true if any sessions are single threaded.
+  bool incremental;           // Adjust only the images without input adjustments
+  double old_camera_weight;   // The weight of the previously adjusted cameras if incremental
+  std::set<int> old_camera_indices; // The cameras which have input adjustments
   
   // Make sure all values are initialized, even though they will be
   // over-written later.
@@ -107,15 +117,23 @@ struct Options : public vw::cartography::GdalWriteOptions {
              forced_triangulation_distance(-1),
              lambda(-1.0), camera_weight(-1),
              rotation_weight(0), translation_weight(0), overlap_exponent(0), 
-             robust_threshold(0), report_level(0), min_matches(0),
-             num_iterations(0), overlap_limit(0), save_intermediate_cameras(false),
+             robust_threshold(0), camera_grid_error(0), report_level(0), min_matches(0),
+             num_iterations(0), overlap_limit(0), num_matching_threads(0),
+             save_intermediate_cameras(false),
              fix_gcp_xyz(false), solve_intrinsics(false), camera_type(BaCameraType_Other),
-             semi_major(0), semi_minor(0), position_filter_dist(-1),
+             semi_major(0), semi_minor(0), position_filter_dist(-1), auto_overlap_buffer(-1),
              num_ba_passes(2), max_num_reference_points(-1),
+             max_num_reference_points_per_pair(-1),
              datum(vw::cartography::Datum(UNSPECIFIED_DATUM, "User Specified Spheroid",
                                           "Reference Meridian", 1, 1, 0)),
              ip_detect_method(0), num_scales(-1), skip_rough_homography(false),
-             individually_normalize(false), use_llh_error(false), force_reuse_match_files(false){}
+             individually_normalize(false), use_llh_error(false), force_reuse_match_files(false),
+             single_threaded_cameras(false), incremental(false), old_camera_weight(0){}
+
+  /// Whether the cameras are tied to their initial values with a weight.
+  bool use_camera_weight() const {
+    return camera_weight > 0 || (incremental && old_camera_weight > 0);
+  }
 
   /// Duplicate info to asp settings where it needs to go.
   void copy_to_asp_settings() const{
@@ -152,6 +170,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
     asp::stereo_settings().ip_edge_buffer_percent     = ip_edge_buffer_percent;
     asp::stereo_settings().ip_debug_images            = ip_debug_images;
     asp::stereo_settings().ip_normalize_tiles         = ip_normalize_tiles;
+    asp::stereo_settings().ip_brute_force_matching    = ip_brute_force_matching;
   }
   
   /// Ensure that no camera files have duplicate names.  This will cause the output files
@@ -272,6 +291,9 @@ bool init_cams(Options & opt, BAParamStorage & param_storage,
   // Read the adjustments from a previous run, if present
   if (opt.input_prefix != "") {
     for (size_t icam = 0; icam < num_cameras; icam++){
+      // In incremental mode the new images have no adjustments yet
+      if (opt.incremental && opt.old_camera_indices.find(icam) == opt.old_camera_indices.end())
+        continue;
       std::string adjust_file
         = asp::bundle_adjust_file_name(opt.input_prefix, opt.image_files[icam],
                                        opt.camera_files[icam]);
@@ -461,9 +483,150 @@ ceres::LossFunction* get_loss_function(Options const& opt, double th = 0.0){
   return loss_function;
 }
 
-/// Attempt to automatically create the overlap list file estimated
-///  footprints for each of the input images.
-/// - Currently this only supports cameras with Worldview style XML files.
+/// The footprint of an image on the ground, as a convex polygon in lon-lat
+typedef std::vector<vw::Vector2> Footprint;
+
+/// The convex hull of a set of points, counter-clockwise, by the monotone chain method
+inline Footprint convex_hull_2d(std::vector<vw::Vector2> points) {
+
+  std::sort(points.begin(), points.end(), [](vw::Vector2 const& a, vw::Vector2 const& b) {
+      return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+    });
+  points.erase(std::unique(points.begin(), points.end()), points.end());
+  if (points.size() < 3)
+    return points;
+
+  // The cross product of OA and OB, positive if O, A, B turn counter-clockwise
+  auto cross = [](vw::Vector2 const& O, vw::Vector2 const& A, vw::Vector2 const& B) {
+    return (A[0] - O[0])*(B[1] - O[1]) - (A[1] - O[1])*(B[0] - O[0]);
+  };
+
+  // The lower hull, then the upper one
+  Footprint hull(2*points.size());
+  size_t k = 0;
+  for (size_t i = 0; i < points.size(); i++) {
+    while (k >= 2 && cross(hull[k-2], hull[k-1], points[i]) <= 0) k--;
+    hull[k++] = points[i];
+  }
+  for (size_t i = points.size() - 1, t = k + 1; i > 0; i--) {
+    while (k >= t && cross(hull[k-2], hull[k-1], points[i-1]) <= 0) k--;
+    hull[k++] = points[i-1];
+  }
+  hull.resize(k - 1); // the last point is the first one
+  return hull;
+}
+
+/// If two convex polygons are within the buffer from each other. By the
+/// separating axis theorem, they are not if their projections onto the
+/// normal of some edge, or onto the coordinate axes, are farther
+/// apart than that.
+inline bool footprints_overlap(Footprint const& a, Footprint const& b, double buffer) {
+
+  std::vector<vw::Vector2> axes;
+  axes.push_back(vw::Vector2(1, 0));
+  axes.push_back(vw::Vector2(0, 1));
+  Footprint const* polys[2] = {&a, &b};
+  for (int p = 0; p < 2; p++) {
+    Footprint const& poly = *polys[p];
+    for (size_t i = 0; poly.size() >= 2 && i < poly.size(); i++) {
+      vw::Vector2 edge = poly[(i + 1) % poly.size()] - poly[i];
+      double len = norm_2(edge);
+      if (len > 0)
+        axes.push_back(vw::Vector2(-edge[1], edge[0])/len);
+    }
+  }
+
+  for (size_t k = 0; k < axes.size(); k++) {
+    double a_min = std::numeric_limits<double>::max(), a_max = -a_min;
+    double b_min = a_min, b_max = a_max;
+    for (size_t i = 0; i < a.size(); i++) {
+      double d = dot_prod(a[i], axes[k]);
+      a_min = std::min(a_min, d); a_max = std::max(a_max, d);
+    }
+    for (size_t i = 0; i < b.size(); i++) {
+      double d = dot_prod(b[i], axes[k]);
+      b_min = std::min(b_min, d); b_max = std::max(b_max, d);
+    }
+    if (a_min > b_max + buffer || b_min > a_max + buffer)
+      return false;
+  }
+  return true;
+}
+
+/// Estimate the footprint of an image. For WorldView cameras the corners
+/// are read from the XML file. For other cameras the rays through the
+/// image boundary are intersected with the datum.
+class FootprintTask: public vw::Task, private boost::noncopyable {
+  Options     const& m_opt;
+  int                m_index;
+  Footprint        & m_footprint;
+  vw::Mutex        & m_mutex;
+  std::string      & m_error;
+public:
+  FootprintTask(Options const& opt, int index, Footprint & footprint,
+                vw::Mutex & mutex, std::string & error):
+    m_opt(opt), m_index(index), m_footprint(footprint), m_mutex(mutex), m_error(error) {}
+
+  virtual void operator()() {
+    std::string const& camera_file = m_opt.camera_files[m_index];
+    std::vector<vw::Vector2> points;
+    try {
+      std::vector<vw::Vector2> pixel_corners;
+      bool read_success = false;
+      if (boost::iends_with(camera_file, ".xml")) {
+        try {
+          read_success = asp::read_WV_XML_corners(camera_file, pixel_corners, points);
+        } catch(...) {
+          read_success = false;
+        }
+      }
+      if (!read_success) {
+        points.clear();
+        if (m_opt.datum.name() == UNSPECIFIED_DATUM)
+          vw_throw( ArgumentErr() << "A datum is needed to estimate the footprint of: "
+                                  << camera_file << ".\n" );
+        vw::cartography::GeoReference georef(m_opt.datum); // in lon-lat
+        vw::Vector2i image_size = vw::file_image_size(m_opt.image_files[m_index]);
+        float gsd = 0;
+        vw::cartography::camera_bbox(georef, m_opt.camera_models[m_index],
+                                     image_size[0], image_size[1], gsd, &points);
+      }
+      if (points.empty())
+        vw_throw( ArgumentErr() << "Unable to estimate the footprint of: "
+                                << camera_file << ".\n" );
+    } catch (std::exception const& e) {
+      vw::Mutex::Lock lock(m_mutex);
+      if (m_error.empty())
+        m_error = e.what();
+      return;
+    }
+    m_footprint = convex_hull_2d(points);
+  }
+};
+
+/// Estimate the footprints of all images, in parallel, unless the
+/// cameras are not thread-safe. Return the first error, if any.
+std::string estimate_footprints(Options const& opt, std::vector<Footprint> & footprints) {
+  const size_t num_images = opt.camera_files.size();
+  footprints.assign(num_images, Footprint());
+  vw::Mutex   mutex;
+  std::string error;
+  int num_threads = opt.single_threaded_cameras ? 1 :
+    std::max(vw_settings().default_num_threads(), 1);
+  vw::FifoWorkQueue queue(num_threads);
+  for (size_t i = 0; i < num_images; i++) {
+    boost::shared_ptr<FootprintTask>
+      task(new FootprintTask(opt, i, footprints[i], mutex, error));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  return error;
+}
+
+/// Attempt to automatically create the overlap list from the estimated
+/// footprints of the input images. The pairs of images whose footprint
+/// bounding boxes overlap are found by sweeping over the boxes sorted
+/// by longitude, then their footprints are intersected.
 void auto_build_overlap_list(Options &opt, double lonlat_buffer) {
 
   typedef std::pair<std::string, std::string> StringPair;
@@ -472,62 +635,174 @@ void auto_build_overlap_list(Options &opt, double lonlat_buffer) {
   opt.overlap_list.clear();
 
   vw_out() << "Attempting to automatically estimate image overlaps...\n";
-  int  num_overlaps = 0;
-  bool read_success = false;
-
-  // Loop through all image pairs
-  for (size_t i=0; i<num_images-1; ++i) {
 
-    // Try to get the lonlat bounds for this image
-    std::vector<vw::Vector2> pixel_corners_i, lonlat_corners_i;
-    try {
-      read_success = asp::read_WV_XML_corners(opt.camera_files[i], pixel_corners_i, lonlat_corners_i);
-    } catch(...) {
-      read_success = false;
-    }
-    if (!read_success) {
-      vw_throw( ArgumentErr() << "Unable to get corner estimate from file: "
-                              << opt.camera_files[i] << ".\n" );
+  std::vector<Footprint> footprints;
+  std::string error = estimate_footprints(opt, footprints);
+  if (!error.empty())
+    vw_throw( ArgumentErr() << error );
+
+  std::vector<vw::BBox2> bboxes(num_images);
+  std::vector<size_t> order(num_images);
+  for (size_t i = 0; i < num_images; i++) {
+    for (size_t p = 0; p < footprints[i].size(); p++)
+      bboxes[i].grow(footprints[i][p]);
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return bboxes[a].min().x() < bboxes[b].min().x();
+    });
+
+  // Only the images which start before the current one ends, plus the
+  // buffer, may overlap with it. Record the pairs in input order.
+  std::vector<std::pair<size_t, size_t> > pairs;
+  for (size_t oi = 0; oi < num_images; oi++) {
+    size_t i = order[oi];
+    for (size_t oj = oi + 1; oj < num_images; oj++) {
+      size_t j = order[oj];
+      if (bboxes[j].min().x() > bboxes[i].max().x() + lonlat_buffer)
+        break;
+      if (bboxes[j].min().y() > bboxes[i].max().y() + lonlat_buffer ||
+          bboxes[i].min().y() > bboxes[j].max().y() + lonlat_buffer)
+        continue;
+      if (footprints_overlap(footprints[i], footprints[j], lonlat_buffer))
+        pairs.push_back(std::make_pair(std::min(i, j), std::max(i, j)));
     }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  for (size_t k = 0; k < pairs.size(); k++) {
+    size_t i = pairs[k].first, j = pairs[k].second;
+    vw_out() << "Predicted overlap between images " << opt.image_files[i]
+             << " and " << opt.image_files[j] << std::endl;
+    opt.overlap_list.insert(StringPair(opt.image_files[i], opt.image_files[j]));
+    opt.overlap_list.insert(StringPair(opt.image_files[j], opt.image_files[i]));
+  }
+  int num_overlaps = pairs.size();
+
+  if (num_overlaps == 0)
+    vw_throw( ArgumentErr() << "Failed to automatically detect any overlapping images!" );
 
-    vw::BBox2 bbox_i; // Convert to BBox
-    for (size_t p=0; p<lonlat_corners_i.size(); ++p)
-      bbox_i.grow(lonlat_corners_i[p]);
-    bbox_i.expand(lonlat_buffer); // Only expand this bounding box by the buffer.
+  vw_out() << "Will try to match at " << num_overlaps << " detected overlaps\n.";
+} // End function auto_build_overlap_list
 
-    for (size_t j=i+1; j<num_images; ++j) {
+/// A grid of buckets over the lon-lat box of a set of points, such as
+/// those of a reference terrain, to find quickly the points near a
+/// footprint. Points with a NaN longitude or latitude are left out.
+class LonLatIndex {
+public:
+  LonLatIndex(std::vector<vw::Vector2> const& lonlat, int points_per_cell = 16) {
+    for (size_t it = 0; it < lonlat.size(); it++)
+      if (is_valid_lonlat(lonlat[it]))
+        m_box.grow(lonlat[it]);
+    size_t num_cells = std::max(size_t(1), lonlat.size() / std::max(points_per_cell, 1));
+    int side = std::max(1, int(std::ceil(std::sqrt(double(num_cells)))));
+    m_cols = side;
+    m_rows = side;
+    m_cell_size = vw::Vector2(std::max(m_box.width(),  1e-12)/m_cols,
+                              std::max(m_box.height(), 1e-12)/m_rows);
+
+    // Count the points in each cell, then store their indices cell after cell
+    std::vector<int> cells(lonlat.size(), -1);
+    m_start.assign(m_cols*m_rows + 1, 0);
+    for (size_t it = 0; it < lonlat.size(); it++) {
+      if (!is_valid_lonlat(lonlat[it]))
+        continue;
+      cells[it] = cell(lonlat[it]);
+      m_start[cells[it] + 1]++;
+    }
+    for (size_t c = 0; c + 1 < m_start.size(); c++)
+      m_start[c + 1] += m_start[c];
+    m_indices.resize(m_start.back());
+    std::vector<size_t> pos(m_start.begin(), m_start.end() - 1);
+    for (size_t it = 0; it < lonlat.size(); it++)
+      if (cells[it] >= 0)
+        m_indices[pos[cells[it]]++] = it;
+  }
 
-      std::vector<vw::Vector2> pixel_corners_j, lonlat_corners_j;
-      try {
-        read_success = asp::read_WV_XML_corners(opt.camera_files[j], pixel_corners_j, lonlat_corners_j);
-      } catch(...) {
-        read_success = false;
-      }
-      if (!read_success) {
-        vw_throw( ArgumentErr() << "Unable to get corner estimate from file: "
-                                << opt.camera_files[j] << ".\n" );
-      }
+  /// The box of the points, in the longitude range of the points
+  vw::BBox2 const& box() const { return m_box; }
 
-      vw::BBox2 bbox_j; // Convert to BBox
-      for (size_t p=0; p<lonlat_corners_j.size(); ++p)
-        bbox_j.grow(lonlat_corners_j[p]);
-
-      // Record the files if the bboxes overlap
-      // - TODO: Use polygon intersection instead of bounding boxes!
-      if (bbox_i.intersects(bbox_j)) {
-        vw_out() << "Predicted overlap between images " << opt.image_files[i]
-                 << " and " << opt.image_files[j] << std::endl;
-        opt.overlap_list.insert(StringPair(opt.image_files[i], opt.image_files[j]));
-        opt.overlap_list.insert(StringPair(opt.image_files[j], opt.image_files[i]));
-        ++num_overlaps;
+  /// The indices, in increasing order, of the points in the cells
+  /// which meet the given box
+  void query(vw::BBox2 const& box, std::vector<size_t> & indices) const {
+    indices.clear();
+    vw::BBox2 b = box;
+    b.crop(m_box);
+    if (b.empty() || m_indices.empty())
+      return;
+    vw::Vector2i c0 = cell_coords(b.min()), c1 = cell_coords(b.max());
+    for (int row = c0[1]; row <= c1[1]; row++)
+      for (int col = c0[0]; col <= c1[0]; col++) {
+        int c = col + row*m_cols;
+        indices.insert(indices.end(), m_indices.begin() + m_start[c],
+                       m_indices.begin() + m_start[c+1]);
       }
-    } // End inner loop through cameras
-  } // End outer loop through cameras
+    std::sort(indices.begin(), indices.end());
+  }
 
-  if (num_overlaps == 0)
-    vw_throw( ArgumentErr() << "Failed to automatically detect any overlapping images!" );
+private:
+  static bool is_valid_lonlat(vw::Vector2 const& ll) {
+    return ll[0] == ll[0] && ll[1] == ll[1];
+  }
+  vw::Vector2i cell_coords(vw::Vector2 const& ll) const {
+    int col = int((ll[0] - m_box.min().x())/m_cell_size[0]);
+    int row = int((ll[1] - m_box.min().y())/m_cell_size[1]);
+    return vw::Vector2i(std::min(std::max(col, 0), m_cols - 1),
+                        std::min(std::max(row, 0), m_rows - 1));
+  }
+  int cell(vw::Vector2 const& ll) const {
+    vw::Vector2i c = cell_coords(ll);
+    return c[0] + c[1]*m_cols;
+  }
 
-  vw_out() << "Will try to match at " << num_overlaps << " detected overlaps\n.";
-} // End function auto_build_overlap_list
+  vw::BBox2           m_box;
+  int                 m_cols, m_rows;
+  vw::Vector2         m_cell_size;
+  std::vector<size_t> m_start, m_indices;
+};
+
+/// Pick at most max_num of the given pixels, spread evenly over the
+/// image box. The box is split into about max_num cells, and each cell
+/// keeps the same number of its pixels, in their order. The indices of
+/// the picked pixels are returned in increasing order. If max_num is
+/// not positive, all pixels are picked.
+inline void stratified_subsample(std::vector<vw::Vector2> const& pixels,
+                                 vw::BBox2i const& image_box, int max_num,
+                                 std::vector<size_t> & picked) {
+  picked.clear();
+  if (max_num <= 0 || int(pixels.size()) <= max_num) {
+    for (size_t it = 0; it < pixels.size(); it++)
+      picked.push_back(it);
+    return;
+  }
+
+  // Cells about square, max_num of them in total
+  double cell_side = std::sqrt(double(image_box.width())*image_box.height()/max_num);
+  cell_side = std::max(cell_side, 1.0);
+  int cols = std::max(1, int(std::ceil(image_box.width ()/cell_side)));
+  int rows = std::max(1, int(std::ceil(image_box.height()/cell_side)));
+  std::vector<int> cells(pixels.size()), counts(cols*rows, 0);
+  for (size_t it = 0; it < pixels.size(); it++) {
+    vw::Vector2 p = pixels[it] - image_box.min();
+    int col = std::min(std::max(int(p[0]/cell_side), 0), cols - 1);
+    int row = std::min(std::max(int(p[1]/cell_side), 0), rows - 1);
+    cells[it] = col + row*cols;
+    counts[cells[it]]++;
+  }
+  int num_full = 0;
+  for (size_t c = 0; c < counts.size(); c++)
+    if (counts[c] > 0)
+      num_full++;
+
+  // Each non-empty cell keeps the same share
+  int per_cell = std::max(1, max_num / std::max(num_full, 1));
+  std::fill(counts.begin(), counts.end(), 0);
+  for (size_t it = 0; it < pixels.size() && int(picked.size()) < max_num; it++) {
+    if (counts[cells[it]] >= per_cell)
+      continue;
+    counts[cells[it]]++;
+    picked.push_back(it);
+  }
+}
 
 #endif // __ASP_TOOLS_BUNDLEADJUST_H__
@@ -25,6 +25,7 @@
 
 
 #include <vw/Camera/CameraUtilities.h>
+#include <vw/FileIO/DiskImageView.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/OpticalBarModel.h>
@@ -45,6 +46,7 @@
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <ceres/rotation.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
 #if LOCAL_GCC_VERSION >= 40600
@@ -160,6 +162,52 @@ private:
 
 
 
+/// Cameras built from the values of their parameter blocks, to be reused
+/// while these values stay the same. Numerical differentiation perturbs one
+/// parameter at a time, so the camera does not change for the perturbations
+/// of the point, and it stays the same for the consecutive residuals of
+/// one camera. A camera found again is moved to the first slot, and new
+/// cameras go to the second one, so the perturbed cameras do not evict the
+/// unperturbed one. The key identifies the underlying camera.
+template <class CamT>
+class BundleCameraCache {
+public:
+  BundleCameraCache() { m_keys[0] = m_keys[1] = NULL; }
+
+  /// The cached camera for these values, or an empty pointer.
+  boost::shared_ptr<CamT> find(void const* key, std::vector<double> const& values) {
+    for (int s = 0; s < 2; s++) {
+      if (m_cams[s].get() == NULL || m_keys[s] != key || m_values[s] != values)
+        continue;
+      if (s == 1) {
+        std::swap(m_keys  [0], m_keys  [1]);
+        std::swap(m_cams  [0], m_cams  [1]);
+        std::swap(m_values[0], m_values[1]);
+      }
+      return m_cams[0];
+    }
+    return boost::shared_ptr<CamT>();
+  }
+
+  void insert(void const* key, std::vector<double> const& values,
+              boost::shared_ptr<CamT> cam) {
+    m_keys[1] = key; m_values[1] = values; m_cams[1] = cam;
+  }
+
+private:
+  void const*             m_keys[2];
+  std::vector<double>     m_values[2];
+  boost::shared_ptr<CamT> m_cams[2];
+};
+
+/// One cache per thread and camera type, as each thread evaluates
+/// its own residuals.
+template <class CamT>
+BundleCameraCache<CamT> & bundle_camera_cache() {
+  static thread_local BundleCameraCache<CamT> cache;
+  return cache;
+}
+
 /// "Full service" pinhole model which solves for all desired camera parameters.
 /// - If the current run does not want to solve for everything, those parameter
 ///   blocks should be set as constant so that Ceres does not change them.
@@ -214,23 +262,39 @@ public:
     // Update the lens distortion parameters in the new camera.
     // - These values are also optimized as scale factors.
     // TODO: This approach FAILS when the input value is zero!!
-    boost::shared_ptr<LensDistortion> distortion = m_underlying_camera->lens_distortion()->copy();
-    vw::Vector<double> lens = distortion->distortion_parameters();
+    vw::Vector<double> lens = m_underlying_camera->lens_distortion()->distortion_parameters();
     for (size_t i=0; i<lens.size(); ++i)
       lens[i] *= raw_lens[i];
-    distortion->set_distortion_parameters(lens);
 
-    // Duplicate the input camera model with the pose, focus, center, and lens updated.
-    vw::camera::PinholeModel cam(correction.position(),
-                                 correction.pose().rotation_matrix(),
-                                 focus, focus, // focal lengths
-                                 center_x, center_y, // pixel offsets
-                                 distortion.get(),
-                                 m_underlying_camera->pixel_pitch());
+    // The camera depends only on these values
+    std::vector<double> values(raw_pose, raw_pose + num_pose_params());
+    values.push_back(center_x);
+    values.push_back(center_y);
+    values.push_back(focus);
+    values.insert(values.end(), lens.begin(), lens.end());
 
     try {
+      BundleCameraCache<vw::camera::PinholeModel> & cache
+        = bundle_camera_cache<vw::camera::PinholeModel>();
+      boost::shared_ptr<vw::camera::PinholeModel> cam
+        = cache.find(m_underlying_camera.get(), values);
+      if (cam.get() == NULL) {
+        boost::shared_ptr<LensDistortion> distortion
+          = m_underlying_camera->lens_distortion()->copy();
+        distortion->set_distortion_parameters(lens);
+
+        // Duplicate the input camera model with the pose, focus, center, and lens updated.
+        cam.reset(new vw::camera::PinholeModel(correction.position(),
+                                               correction.pose().rotation_matrix(),
+                                               focus, focus, // focal lengths
+                                               center_x, center_y, // pixel offsets
+                                               distortion.get(),
+                                               m_underlying_camera->pixel_pitch()));
+        cache.insert(m_underlying_camera.get(), values, cam);
+      }
+
       // Project the point into the camera.
-      Vector2 pixel = cam.point_to_pixel_no_check(point);
+      Vector2 pixel = cam->point_to_pixel_no_check(point);
       return pixel;
     } catch(...){
     }
@@ -241,8 +305,6 @@ public:
 
 private:
 
-  // TODO: Cache the constructed camera to save time when just the point changes!
-
   // TODO: Make const
   /// This camera is used for all of the intrinsic values.
   boost::shared_ptr<vw::camera::PinholeModel> m_underlying_camera;
@@ -302,24 +364,40 @@ public:
     double mcf       = raw_intrin[1] * m_underlying_camera->get_motion_compensation();
     double scan_time = raw_intrin[2] * m_underlying_camera->get_scan_time();
 
-    // Duplicate the input camera model with the pose, focus, center, speed, and MCF updated.
-    asp::camera::OpticalBarModel cam(m_underlying_camera->get_image_size(),
-                                     vw::Vector2(center_x, center_y),
-                                     m_underlying_camera->get_pixel_size(),
-                                     focus,
-                                     scan_time,
-                                     //m_underlying_camera->get_scan_rate(),
-                                     m_underlying_camera->get_scan_dir(),
-                                     m_underlying_camera->get_forward_tilt(),
-                                     correction.position(),
-                                     correction.pose().axis_angle(),
-                                     speed,  mcf);
-
-    //std::cout << "Created camera: " << cam << std::endl;
+    // The camera depends only on these values
+    std::vector<double> values(raw_pose, raw_pose + num_pose_params());
+    values.push_back(center_x);
+    values.push_back(center_y);
+    values.push_back(focus);
+    values.push_back(speed);
+    values.push_back(mcf);
+    values.push_back(scan_time);
 
     // Project the point into the camera.
     try {
-      return cam.point_to_pixel(point);
+      BundleCameraCache<asp::camera::OpticalBarModel> & cache
+        = bundle_camera_cache<asp::camera::OpticalBarModel>();
+      boost::shared_ptr<asp::camera::OpticalBarModel> cam
+        = cache.find(m_underlying_camera.get(), values);
+      if (cam.get() == NULL) {
+        // Duplicate the input camera model with the pose, focus, center, speed, and MCF updated.
+        cam.reset(new asp::camera::OpticalBarModel(m_underlying_camera->get_image_size(),
+                                                   vw::Vector2(center_x, center_y),
+                                                   m_underlying_camera->get_pixel_size(),
+                                                   focus,
+                                                   scan_time,
+                                                   //m_underlying_camera->get_scan_rate(),
+                                                   m_underlying_camera->get_scan_dir(),
+                                                   m_underlying_camera->get_forward_tilt(),
+                                                   correction.position(),
+                                                   correction.pose().axis_angle(),
+                                                   speed,  mcf));
+        cache.insert(m_underlying_camera.get(), values, cam);
+      }
+
+      //std::cout << "Created camera: " << *cam << std::endl;
+
+      return cam->point_to_pixel(point);
     } catch(...){
     }
     
@@ -329,8 +407,6 @@ public:
 
 private:
 
-  // TODO: Cache the constructed camera to save time when just the point changes!
-
   // TODO: Make const
   /// This camera is used for all of the intrinsic values.
   boost::shared_ptr<asp::camera::OpticalBarModel> m_underlying_camera;
@@ -433,6 +509,186 @@ private:
 }; // End class BaReprojectionError
 
 
+/// The same residual as BaReprojectionError with PinholeBundleModel, for
+/// pinhole cameras with no lens distortion or with TSAI distortion, but
+/// with the projection written for any scalar type, so that Ceres finds
+/// the exact derivatives in one pass with automatic differentiation.
+/// The parameter blocks are the same, with the intrinsics being scale
+/// factors for the values of the underlying camera.
+struct BaPinholeReprojectionError {
+  BaPinholeReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                             boost::shared_ptr<vw::camera::PinholeModel> cam):
+    m_observation(observation), m_pixel_sigma(pixel_sigma),
+    m_center(cam->point_offset()), m_focus(cam->focal_length()[0]),
+    m_pixel_pitch(cam->pixel_pitch()),
+    m_lens(cam->lens_distortion()->distortion_parameters()) {}
+
+  template <typename T>
+  bool operator()(T const* const* parameters, T* residuals) const {
+
+    T const* point  = parameters[0];
+    T const* pose   = parameters[1];
+    T const* center = parameters[2];
+    T const* focus  = parameters[3];
+    T const* lens   = parameters[4];
+
+    // Go to camera coordinates, with the inverse of the camera-to-world
+    // rotation, which is stored in axis-angle form.
+    T diff[3] = {point[0] - pose[0], point[1] - pose[1], point[2] - pose[2]};
+    T inv_axis[3] = {-pose[3], -pose[4], -pose[5]};
+    T local[3];
+    ceres::AngleAxisRotatePoint(inv_axis, diff, local);
+
+    // Do not allow a point behind the camera to ruin the problem
+    if (local[2] <= T(0.0)) {
+      residuals[0] = T(g_big_pixel_value);
+      residuals[1] = T(g_big_pixel_value);
+      return true;
+    }
+
+    T x = local[0] / local[2], y = local[1] / local[2];
+    if (m_lens.size() >= 4) {
+      // TSAI distortion, with k1, k2, p1, p2, and optionally k3
+      T k1 = lens[0] * m_lens[0], k2 = lens[1] * m_lens[1];
+      T p1 = lens[2] * m_lens[2], p2 = lens[3] * m_lens[3];
+      T r2 = x*x + y*y;
+      T radial = k1*r2 + k2*r2*r2;
+      if (m_lens.size() >= 5)
+        radial += lens[4] * m_lens[4] * r2*r2*r2;
+      T dx = x*radial + T(2.0)*p1*x*y + p2*(r2 + T(2.0)*x*x);
+      T dy = y*radial + T(2.0)*p2*x*y + p1*(r2 + T(2.0)*y*y);
+      x += dx;
+      y += dy;
+    }
+
+    T f = focus[0] * m_focus;
+    T pix_x = (f * x + center[0] * m_center[0]) / m_pixel_pitch;
+    T pix_y = (f * y + center[1] * m_center[1]) / m_pixel_pitch;
+
+    residuals[0] = (pix_x - m_observation[0]) / m_pixel_sigma[0];
+    residuals[1] = (pix_y - m_observation[1]) / m_pixel_sigma[1];
+    return true;
+  }
+
+  /// If this camera can be handled. Besides the type of distortion, the
+  /// projection is compared with the one of the camera, at the initial
+  /// values of the parameters, so that any difference in conventions
+  /// falls back to the generic residual. The result is cached per camera.
+  static bool is_supported(boost::shared_ptr<vw::camera::PinholeModel> cam) {
+
+    static std::map<vw::camera::PinholeModel const*, bool> supported;
+    static vw::Mutex mutex;
+    vw::Mutex::Lock lock(mutex);
+    std::map<vw::camera::PinholeModel const*, bool>::iterator it = supported.find(cam.get());
+    if (it != supported.end())
+      return it->second;
+
+    bool is_good = false;
+    std::string name = cam->lens_distortion()->name();
+    size_t num_lens = cam->lens_distortion()->distortion_parameters().size();
+    if ((name == "NULL" || (name == "TSAI" && (num_lens == 4 || num_lens == 5))) &&
+        cam->focal_length()[0] == cam->focal_length()[1] && cam->pixel_pitch() > 0) {
+      try {
+        // A pixel away from the optical center, to exercise the distortion
+        Vector2 pix = 0.5 * cam->point_offset() / cam->pixel_pitch();
+        Vector3 point = cam->camera_center(pix) + 1000.0 * cam->pixel_to_vector(pix);
+        Vector2 expected = cam->point_to_pixel(point);
+
+        CameraAdjustment correction;
+        correction.copy_from_pinhole(*cam);
+        Vector3 axis_angle = correction.pose().axis_angle();
+        double pose_vals[6] = {correction.position()[0], correction.position()[1],
+                               correction.position()[2],
+                               axis_angle[0], axis_angle[1], axis_angle[2]};
+        std::vector<double> ones(std::max(num_lens, size_t(1)), 1.0);
+        double const* params[5] = {&point[0], pose_vals, &ones[0], &ones[0], &ones[0]};
+        double residuals[2];
+        BaPinholeReprojectionError error(expected, Vector2(1, 1), cam);
+        error(params, residuals);
+        is_good = (std::abs(residuals[0]) < 1e-4 && std::abs(residuals[1]) < 1e-4);
+      } catch(...) {}
+    }
+
+    supported[cam.get()] = is_good;
+    return is_good;
+  }
+
+  // Factory to hide the construction of the CostFunction object from the client code.
+  static ceres::CostFunction* Create(Vector2 const& observation,
+                                     Vector2 const& pixel_sigma,
+                                     boost::shared_ptr<vw::camera::PinholeModel> cam,
+                                     int num_lens_params){
+    const int NUM_RESIDUALS = 2;
+    const int STRIDE        = 4; // the number of derivatives per evaluation pass
+
+    ceres::DynamicAutoDiffCostFunction<BaPinholeReprojectionError, STRIDE>* cost_function =
+      new ceres::DynamicAutoDiffCostFunction<BaPinholeReprojectionError, STRIDE>(
+            new BaPinholeReprojectionError(observation, pixel_sigma, cam));
+
+    cost_function->SetNumResiduals(NUM_RESIDUALS);
+    cost_function->AddParameterBlock(3); // Point
+    cost_function->AddParameterBlock(6); // Pose
+    cost_function->AddParameterBlock(2); // Center
+    cost_function->AddParameterBlock(1); // Focus
+    cost_function->AddParameterBlock(num_lens_params);
+    return cost_function;
+  }
+
+private:
+  Vector2            m_observation;
+  Vector2            m_pixel_sigma;
+  Vector2            m_center;
+  double             m_focus, m_pixel_pitch;
+  vw::Vector<double> m_lens;
+
+}; // End class BaPinholeReprojectionError
+
+
+/// A disparity read in memory only over the part of the left image
+/// which the reference terrain projects into, and interpolated
+/// bilinearly in the pixels of the whole left image. Outside of the
+/// part read, and next to invalid pixels, the disparity is invalid.
+class CroppedDisparity {
+public:
+  CroppedDisparity() {}
+
+  /// Read the disparity within the given box of the left image
+  CroppedDisparity(std::string const& disp_file, BBox2i const& box) {
+    DiskImageView<DispPixelT> disp(disp_file);
+    m_full_box = bounding_box(disp);
+    m_box = box;
+    m_box.crop(m_full_box);
+    if (!m_box.empty())
+      m_disp = crop(disp, m_box);
+  }
+
+  /// If the pixel is within the whole disparity
+  bool pixel_in_bounds(Vector2 const& pix) const {
+    return !m_full_box.empty() &&
+      pix[0] >= 0 && pix[0] <= m_full_box.width () - 1 &&
+      pix[1] >= 0 && pix[1] <= m_full_box.height() - 1;
+  }
+
+  DispPixelT operator()(double x, double y) const {
+    x -= m_box.min().x();
+    y -= m_box.min().y();
+    int c = int(std::floor(x)), r = int(std::floor(y));
+    if (c < 0 || r < 0 || c >= m_disp.cols() || r >= m_disp.rows())
+      return DispPixelT();
+    int c1 = std::min(c + 1, m_disp.cols() - 1), r1 = std::min(r + 1, m_disp.rows() - 1);
+    DispPixelT const& d00 = m_disp(c, r),  & d10 = m_disp(c1, r);
+    DispPixelT const& d01 = m_disp(c, r1), & d11 = m_disp(c1, r1);
+    if (!is_valid(d00) || !is_valid(d10) || !is_valid(d01) || !is_valid(d11))
+      return DispPixelT();
+    float u = x - c, v = y - r;
+    return DispPixelT((1-v)*((1-u)*d00.child() + u*d10.child()) +
+                         v *((1-u)*d01.child() + u*d11.child()));
+  }
+
+private:
+  ImageView<DispPixelT> m_disp;
+  BBox2i                m_box, m_full_box;
+};
 
 
 /// A ceres cost function. Here we float two pinhole camera's
@@ -445,7 +701,7 @@ private:
 /// straight into the right image.
 struct BaDispXyzError {
   BaDispXyzError(Vector3 const& reference_xyz,
-                 ImageViewRef<DispPixelT> const& interp_disp,
+                 CroppedDisparity const& interp_disp,
                  boost::shared_ptr<CeresBundleModelBase> left_camera_wrapper,
                  boost::shared_ptr<CeresBundleModelBase> right_camera_wrapper,
                  bool is_pinhole, // Would like to remove these!
@@ -593,7 +849,7 @@ struct BaDispXyzError {
   // Factory to hide the construction of the CostFunction object from
   // the client code.
   static ceres::CostFunction* Create(
-      Vector3 const& reference_xyz, ImageViewRef<DispPixelT> const& interp_disp,
+      Vector3 const& reference_xyz, CroppedDisparity const& interp_disp,
       boost::shared_ptr<CeresBundleModelBase> left_camera_wrapper,
       boost::shared_ptr<CeresBundleModelBase> right_camera_wrapper,
       bool is_pinhole, IntrinsicOptions intrin_opt = IntrinsicOptions()) {
@@ -632,7 +888,7 @@ struct BaDispXyzError {
   }  // End function Create
 
   Vector3 m_reference_xyz;
-  ImageViewRef<DispPixelT> const& m_interp_disp;
+  CroppedDisparity m_interp_disp; // Shares the pixels
   size_t m_num_left_param_blocks, m_num_right_param_blocks;
   // TODO: Make constant!
   boost::shared_ptr<CeresBundleModelBase> m_left_camera_wrapper;
@@ -24,6 +24,7 @@
 
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/BundleAdjustment/AdjustRef.h>
+#include <vw/Image/Transform.h>
 #include <asp/Core/FileUtils.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
@@ -262,6 +263,7 @@ public:
   int num_points       () const {return m_num_points; }
   int num_cameras      () const {return m_num_cameras;}
   int num_intrinsics   () const {return m_num_intrinsics_per_camera;} // Per camera
+  int num_lens_distortion_params() const {return m_num_distortion_params;}
   int params_per_point () const {return m_params_per_point;}
   int params_per_camera() const {return m_num_pose_params;}
 
@@ -463,6 +465,73 @@ private: // Functions
 }; // End class BAParamStorage
 
 
+/// Compact storage of the pixel observations of the points in a control
+/// network, grouped by camera. This replaces a CameraRelationNetwork,
+/// whose features are each allocated separately and linked together with
+/// shared pointers, which takes a lot of memory for large networks. For each
+/// camera, the observations are in increasing order of the point index,
+/// as in the CameraRelationNetwork.
+class BAObservations {
+public:
+
+  BAObservations(): m_offsets(1, 0) {}
+
+  void read_controlnetwork(ControlNetwork const& cnet, size_t num_cameras) {
+
+    // Count the observations in each camera, then find where each camera
+    // starts in the arrays with the observations.
+    std::vector<size_t> counts(num_cameras, 0);
+    for (size_t ipt = 0; ipt < cnet.size(); ipt++) {
+      for (ControlPoint::const_iterator m = cnet[ipt].begin(); m != cnet[ipt].end(); m++) {
+        if (m->image_id() >= num_cameras)
+          vw_throw(ArgumentErr() << "BAObservations: Out of bounds camera index.\n");
+        counts[m->image_id()]++;
+      }
+    }
+    m_offsets.assign(num_cameras + 1, 0);
+    for (size_t icam = 0; icam < num_cameras; icam++)
+      m_offsets[icam + 1] = m_offsets[icam] + counts[icam];
+
+    size_t num_obs = m_offsets[num_cameras];
+    m_point_ids.assign(num_obs, 0);
+    m_values.assign(4*num_obs, 0.0);
+
+    std::vector<size_t> pos(m_offsets.begin(), m_offsets.end() - 1);
+    for (size_t ipt = 0; ipt < cnet.size(); ipt++) {
+      for (ControlPoint::const_iterator m = cnet[ipt].begin(); m != cnet[ipt].end(); m++) {
+        size_t k = pos[m->image_id()]++;
+        m_point_ids[k]    = ipt;
+        m_values[4*k + 0] = m->position()[0];
+        m_values[4*k + 1] = m->position()[1];
+        m_values[4*k + 2] = m->sigma()[0];
+        m_values[4*k + 3] = m->sigma()[1];
+      }
+    }
+  }
+
+  size_t num_cameras() const { return m_offsets.size() - 1; }
+  size_t size       () const { return m_point_ids.size(); } // All observations
+
+  /// The observations of camera icam have indices from begin(icam)
+  /// to end(icam), not including the latter.
+  size_t begin(size_t icam) const { return m_offsets[icam]; }
+  size_t end  (size_t icam) const { return m_offsets[icam + 1]; }
+
+  int point_id(size_t k) const { return m_point_ids[k]; }
+  vw::Vector2 location(size_t k) const {
+    return vw::Vector2(m_values[4*k + 0], m_values[4*k + 1]);
+  }
+  vw::Vector2 sigma(size_t k) const {
+    return vw::Vector2(m_values[4*k + 2], m_values[4*k + 3]);
+  }
+
+private:
+  std::vector<size_t> m_offsets;   // num_cameras + 1 values
+  std::vector<int>    m_point_ids; // one per observation
+  std::vector<double> m_values;    // location and sigma, four per observation
+};
+
+
 //==================================================================================
 
 /// Simple class to manage position/rotation information.
@@ -810,28 +879,16 @@ bool update_point_from_dem(double* point, cartography::GeoReference const& dem_g
   return true;
 }
 
-/// Load all of the reference disparities specified in the input text file
-/// and store them in the vectors.  Return the number loaded.
-template <class DispPixelT>
-int load_reference_disparities(std::string const& disp_list_filename,
-                               std::vector< ImageView   <DispPixelT> > &disp_vec,
-                               std::vector< ImageViewRef<DispPixelT> > &interp_disp) {
-  // TODO: Disparities can be large, but if small it is better to
-  // read them in memory.
+/// Read the list of reference disparities, with "none" for the image
+/// pairs without one. Return their number.
+int read_disparity_list(std::string const& disp_list_filename,
+                        std::vector<std::string> & disp_files) {
+  disp_files.clear();
   std::istringstream is(disp_list_filename);
   std::string disp_file;
-  while (is >> disp_file) {
-    if (disp_file != "none") {
-      vw_out() << "Reading: " << disp_file << std::endl;
-      disp_vec.push_back(copy(DiskImageView<DispPixelT>(disp_file)));
-    }else{
-      // Read in an empty disparity
-      disp_vec.push_back(ImageView<DispPixelT>());
-    }
-    interp_disp.push_back(interpolate(disp_vec.back(),
-                                      BilinearInterpolation(), ConstantEdgeExtension()));
-  }
-  return static_cast<int>(disp_vec.size());
+  while (is >> disp_file)
+    disp_files.push_back(disp_file);
+  return static_cast<int>(disp_files.size());
 }
 
 /// Apply a scale-rotate-translate transform to pinhole cameras and control points
@@ -1356,16 +1413,14 @@ void init_pinhole_model_with_mono_gcp(boost::shared_ptr<ControlNetwork> const& c
   apply_rigid_transform(rotation, translation, scale, camera_models, cnet_ptr);
 }
 
-/// Take an interest point from a map projected image and convert it
-/// to the corresponding IP in the original non-map-projected image.
-/// - Return false if the pixel could not be converted.
-bool projected_ip_to_raw_ip(ip::InterestPoint &P,
-                            ImageViewRef< PixelMask<double> > const& interp_dem,
-                            boost::shared_ptr<CameraModel> camera_model,
-                            cartography::GeoReference const& georef,
-                            cartography::GeoReference const& dem_georef) {
+/// Find the point on the DEM seen at the given pixel of a map-projected image.
+/// - Return false if the pixel is outside the DEM or in a hole.
+bool mapproj_pixel_to_xyz(Vector2 const& pix,
+                          ImageViewRef< PixelMask<double> > const& interp_dem,
+                          cartography::GeoReference const& georef,
+                          cartography::GeoReference const& dem_georef,
+                          Vector3 & xyz) {
   // Get IP coordinate in the DEM
-  Vector2 pix(P.x, P.y);
   Vector2 ll      = georef.pixel_to_lonlat(pix);
   Vector2 dem_pix = dem_georef.lonlat_to_pixel(ll);
   if (!interp_dem.pixel_in_bounds(dem_pix))
@@ -1375,7 +1430,21 @@ bool projected_ip_to_raw_ip(ip::InterestPoint &P,
   if (!is_valid(dem_val))
     return false;
   Vector3 llh(ll[0], ll[1], dem_val.child());
-  Vector3 xyz = dem_georef.datum().geodetic_to_cartesian(llh);
+  xyz = dem_georef.datum().geodetic_to_cartesian(llh);
+  return true;
+}
+
+/// Take an interest point from a map projected image and convert it
+/// to the corresponding IP in the original non-map-projected image.
+/// - Return false if the pixel could not be converted.
+bool projected_ip_to_raw_ip(ip::InterestPoint &P,
+                            ImageViewRef< PixelMask<double> > const& interp_dem,
+                            boost::shared_ptr<CameraModel> camera_model,
+                            cartography::GeoReference const& georef,
+                            cartography::GeoReference const& dem_georef) {
+  Vector3 xyz;
+  if (!mapproj_pixel_to_xyz(Vector2(P.x, P.y), interp_dem, georef, dem_georef, xyz))
+    return false;
 
   // Project into the camera
   Vector2 cam_pix;
@@ -1391,4 +1460,67 @@ bool projected_ip_to_raw_ip(ip::InterestPoint &P,
   return true;
 }
 
+/// The transform from the pixels of a map-projected image to those of
+/// its camera, through the DEM, as in projected_ip_to_raw_ip(). The
+/// reverse transform throws where a pixel cannot be converted, so that
+/// it can be approximated with asp::CameraGridTransform.
+class MapprojToCamTrans: public vw::TransformBase<MapprojToCamTrans> {
+  ImageViewRef< PixelMask<double> > m_interp_dem;
+  boost::shared_ptr<CameraModel>    m_camera_model;
+  cartography::GeoReference         m_georef, m_dem_georef;
+public:
+  MapprojToCamTrans(ImageViewRef< PixelMask<double> > const& interp_dem,
+                    boost::shared_ptr<CameraModel> camera_model,
+                    cartography::GeoReference const& georef,
+                    cartography::GeoReference const& dem_georef):
+    m_interp_dem(interp_dem), m_camera_model(camera_model),
+    m_georef(georef), m_dem_georef(dem_georef) {}
+
+  Vector2 reverse(Vector2 const& pix) const {
+    Vector3 xyz;
+    if (!mapproj_pixel_to_xyz(pix, m_interp_dem, m_georef, m_dem_georef, xyz))
+      vw_throw(ArgumentErr() << "The pixel " << pix << " is not on the DEM.\n");
+    return m_camera_model->point_to_pixel(xyz);
+  }
+};
+
+/// The most DEM pixels which cache_dem_region() reads into memory
+const double MAX_CACHED_DEM_PIXELS = 64.0e+6;
+
+/// The box of DEM pixels seen in the given box of pixels of a map-projected image
+BBox2i dem_pixel_box(BBox2 const& map_pix_box,
+                     cartography::GeoReference const& georef,
+                     cartography::GeoReference const& dem_georef) {
+  if (map_pix_box.empty())
+    return BBox2i();
+  BBox2 dem_box = dem_georef.lonlat_to_pixel_bbox(georef.pixel_to_lonlat_bbox(map_pix_box));
+  return grow_bbox_to_int(dem_box);
+}
+
+/// Read into memory the given region of the DEM loaded by
+/// create_interp_dem(), unless it is too large, and make interp_dem use
+/// it, in the same pixels, with the DEM being invalid outside of it.
+/// Then the threads finding heights share the region, rather than
+/// going through the cache of the disk image at each pixel.
+void cache_dem_region(std::string const& dem_file, BBox2i region,
+                      ImageViewRef< PixelMask<double> > & interp_dem){
+
+  double nodata_val = -std::numeric_limits<float>::max(); // as in create_interp_dem()
+  vw::read_nodata_val(dem_file, nodata_val);
+  DiskImageView<double> dem(dem_file);
+
+  // Pad by a pixel or two for the interpolation
+  region.expand(2);
+  region.crop(bounding_box(dem));
+  if (region.empty() || double(region.width())*double(region.height()) > MAX_CACHED_DEM_PIXELS)
+    return;
+
+  vw_out() << "Reading into memory the DEM region: " << region << std::endl;
+  ImageView<double> dem_region = crop(dem, region);
+  ImageViewRef< PixelMask<double> > cached
+    = crop(edge_extend(create_mask(dem_region, nodata_val), ZeroEdgeExtension()),
+           -region.min().x(), -region.min().y(), dem.cols(), dem.rows());
+  interp_dem = interpolate(cached, BilinearInterpolation(), ConstantEdgeExtension());
+}
+
 
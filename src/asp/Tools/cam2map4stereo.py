@@ -87,21 +87,28 @@ def mapfile( cube, prefix, suffix ):
 
     return mapname
 
-def camrange( cube, lonGroupName, options ):
-    '''run camrange on cube'''
-    info = ImgInfo();
-    try:
-        # Run the camrange function to write to a temp file
+def run_camrange( cubes, pool ):
+    '''Run camrange on the cubes in parallel. Return the temporary files
+    with the results, which are deleted once these are no longer used.'''
+    tmpfiles = []
+    for cube in cubes:
         tmpfile = tempfile.NamedTemporaryFile(dir='.', prefix="camrange",
                                               suffix=".txt", mode="w")
         cmd = 'camrange from= '+ cube +' to= '+ tmpfile.name
-
-        print('Running ' + cmd)
-        result = subprocess.call(cmd, shell=True)
-        if not result == 0:
-            raise Exception('ProcessError', 'Non zero return code ('+str(result)+')')
+        pool.add(('camrange', cmd))
+        tmpfiles.append(tmpfile)
+    try:
+        pool.wait_all()
+    except Exception as e:
+        raise Exception('ProcessError', str(e))
+    for tmpfile in tmpfiles:
         os.system("cat %s" % tmpfile.name )
+    return tmpfiles
 
+def camrange( tmpfile, lonGroupName, options ):
+    '''Read the results of camrange, for the given longitude group'''
+    info = ImgInfo();
+    try:
         # Path to the ISIS getkey tool
         getkey_path = os.environ['ISISROOT']+'/bin/getkey'
 
@@ -179,13 +186,18 @@ def main():
         except optparse.OptionError as msg:
             raise Usage(msg)
 
-        # Call camrange to get bounds. If the lon bounds come as [0, 360] then try a different group.
+        # The two images are processed at the same time
+        pool = asp_system_utils.JobPool(2)
+
+        # Call camrange to get bounds, once per image. If the lon bounds
+        # come as [0, 360] then try a different group from its results.
+        camrange_files = run_camrange( args[0:2], pool )
         success = False
         lonGroupNames = ['UniversalGroundRange',  'PositiveEast180',
                          'PositiveWest180', 'PositiveWest360']
         for lonGroupName in lonGroupNames:
-            image1 = camrange( args[0], lonGroupName, options)
-            image2 = camrange( args[1], lonGroupName, options)
+            image1 = camrange( camrange_files[0], lonGroupName, options)
+            image2 = camrange( camrange_files[1], lonGroupName, options)
             lonRange = float(max(image1.maxlon, image2.maxlon)) - \
                        float(min(image1.minlon, image2.minlon))
             if lonRange >= 360.0:
@@ -235,26 +247,24 @@ def main():
         cam2map.append( 'minlon=' + mapout.minlon )
         cam2map.append( 'maxlon=' + mapout.maxlon )
 
-        # Run for first image
+        # Run for both images at the same time
 
         # Need to put these together to keep ISIS from calling the GUI
-        cam2map_cmd = ' '.join(cam2map)
-        print(cam2map_cmd)
-        if( not options.dryrun ):
-            code = subprocess.call(cam2map_cmd, shell=True)
-            if not code == 0:
-                raise Exception('ProcessError', 'Non zero return code ('+str(code)+')')
-
-        # Run for second image
+        cam2map_cmds = [' '.join(cam2map)]
         cam2map[1] = 'from=' + args[1]
         cam2map[2] = 'to='+ mapfile( args[1], options.prefix, options.suffix )
-        cam2map_cmd = ' '.join(cam2map)
-        print(cam2map_cmd)
-        if( not options.dryrun ):
-            code = subprocess.call(cam2map_cmd, shell=True)
-            if not code == 0:
-                raise Exception('ProcessError', 'Non zero return code ('+str(code)+')')
+        cam2map_cmds.append(' '.join(cam2map))
+        for cam2map_cmd in cam2map_cmds:
+            if( options.dryrun ):
+                print(cam2map_cmd)
+            else:
+                pool.add(('cam2map', cam2map_cmd))
+        try:
+            pool.wait_all()
+        except Exception as e:
+            raise Exception('ProcessError', str(e))
 
+        pool.print_timings()
         print("Finished")
         return 0
 
@@ -32,6 +32,7 @@
 #include <asp/Core/FileUtils.h>
 #include <asp/Camera/RPCModelGen.h>
 #include <asp/Core/PointUtils.h>
+#include <vw/Core/ThreadPool.h>
 
 #include <limits>
 #include <cstring>
@@ -183,6 +184,38 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   }
 }
 
+/// Project a range of samples into the camera. The point_to_pixel
+/// function can be capricious, so failures are just flagged.
+class ProjectSamplesTask: public vw::Task, private boost::noncopyable {
+  boost::shared_ptr<CameraModel> m_cam;
+  std::vector<Vector3> const& m_xyz;
+  int                         m_beg, m_end;
+  std::vector<Vector2>      & m_pix;
+  std::vector<char>         & m_ok;
+  vw::TerminalProgressCallback & m_tpc;
+  double                      m_inc_amount;
+  Mutex                     & m_mutex;
+public:
+  ProjectSamplesTask(boost::shared_ptr<CameraModel> cam, std::vector<Vector3> const& xyz,
+                     int beg, int end, std::vector<Vector2> & pix, std::vector<char> & ok,
+                     vw::TerminalProgressCallback & tpc, double inc_amount, Mutex & mutex):
+    m_cam(cam), m_xyz(xyz), m_beg(beg), m_end(end), m_pix(pix), m_ok(ok),
+    m_tpc(tpc), m_inc_amount(inc_amount), m_mutex(mutex) {}
+
+  virtual void operator()() {
+    for (int i = m_beg; i < m_end; i++) {
+      try {
+        m_pix[i] = m_cam->point_to_pixel(m_xyz[i]);
+        m_ok[i]  = 1;
+      }catch(...){
+        m_ok[i]  = 0;
+      }
+    }
+    Mutex::Lock lock(m_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -268,6 +301,11 @@ int main( int argc, char *argv[] ) {
     ImageViewRef< PixelMask<float> > input_img
       = create_mask_less_or_equal(disk_view, opt.input_nodata_value);
 
+    // First find the samples on the ground, with their lon-lat-heights,
+    // then project them into the camera in parallel. Each group of
+    // samples is one step of the outer loop.
+    std::vector<Vector3> samples_llh, samples_xyz;
+    std::vector<int> group_start;
     if (opt.dem_file.empty()) {
 
       vw_out() << "Using datum: " << opt.datum << std::endl;
@@ -277,8 +315,8 @@ int main( int argc, char *argv[] ) {
       double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
       double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
       double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
-      tpc.report_progress(0);
       for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon) {
+        group_start.push_back(samples_xyz.size());
         for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat) {
           for (double ht = H[0]; ht <= H[1]; ht += delta_ht) {
 
@@ -288,15 +326,10 @@ int main( int argc, char *argv[] ) {
             // Go back to llh. This is a bugfix for the 360 deg offset problem.
             llh = opt.datum.cartesian_to_geodetic(xyz);
 
-            Vector2 cam_pix = cam->point_to_pixel(xyz);
-            if (image_box.contains(cam_pix)) {
-              all_llh.push_back(llh);
-              all_pixels.push_back(cam_pix);
-            }
-
+            samples_llh.push_back(llh);
+            samples_xyz.push_back(xyz);
           }
         }
-        tpc.report_incremental_progress(inc_amount);
       }
 
     }else{
@@ -317,8 +350,8 @@ int main( int argc, char *argv[] ) {
       // coefficients.
       double delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
       double delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
-      tpc.report_progress(0);
       for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
+        group_start.push_back(samples_xyz.size());
         for (double drow = 0; drow < dem.rows(); drow += delta_row) {
           int col = dcol, row = drow; // cast to int
 
@@ -335,25 +368,45 @@ int main( int argc, char *argv[] ) {
           // Go back to llh. This is a bugfix for the 360 deg offset problem.
           llh = dem_geo.datum().cartesian_to_geodetic(xyz);
 
-          Vector2 cam_pix;
-          try {
-            // the point_to_pixel function can be capricious
-            cam_pix = cam->point_to_pixel(xyz);
-          }catch(...){
-            continue;
-          }
-
-          if (image_box.contains(cam_pix) && is_valid(input_img(cam_pix[0], cam_pix[1]))) {
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-          }
-
+          samples_llh.push_back(llh);
+          samples_xyz.push_back(xyz);
         }
-        tpc.report_incremental_progress(inc_amount);
       }
     }
+    group_start.push_back(samples_xyz.size());
+
+    // Project into the camera. Cameras which are not thread-safe, such
+    // as ISIS, are used from one thread.
+    int num_threads = session->supports_multi_threading() ? opt.num_threads : 1;
+    std::vector<Vector2> samples_pix(samples_xyz.size());
+    std::vector<char>    samples_ok (samples_xyz.size(), 0);
+    {
+      Mutex progress_mutex;
+      tpc.report_progress(0);
+      FifoWorkQueue queue(std::max(num_threads, 1));
+      for (size_t g = 0; g + 1 < group_start.size(); g++) {
+        boost::shared_ptr<ProjectSamplesTask>
+          task(new ProjectSamplesTask(cam, samples_xyz, group_start[g], group_start[g+1],
+                                      samples_pix, samples_ok, tpc, inc_amount,
+                                      progress_mutex));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
     tpc.report_finished();
 
+    // Keep the samples, in the original order, which project into the
+    // image, and for a DEM, into valid image pixels.
+    for (size_t i = 0; i < samples_xyz.size(); i++) {
+      if (!samples_ok[i] || !image_box.contains(samples_pix[i]))
+        continue;
+      if (!opt.dem_file.empty() &&
+          !is_valid(input_img(samples_pix[i][0], samples_pix[i][1])))
+        continue;
+      all_llh.push_back(samples_llh[i]);
+      all_pixels.push_back(samples_pix[i]);
+    }
+
     // The pixel box
     BBox2 pixel_box;
     for (size_t i = 0; i < all_pixels.size(); i++) 
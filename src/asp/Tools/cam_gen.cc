@@ -20,6 +20,8 @@
 
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Cartography/Datum.h>
@@ -263,7 +265,8 @@ void parse_values(std::string list, std::vector<T> & values){
 struct Options : public vw::cartography::GdalWriteOptions {
   string image_file, camera_file, lon_lat_values_str, pixel_values_str, datum_str,
     reference_dem, frame_index, gcp_file, camera_type, sample_file, input_camera,
-    stereo_session, bundle_adjust_prefix, parsed_cam_ctr_str, parsed_cam_quat_str;
+    stereo_session, bundle_adjust_prefix, parsed_cam_ctr_str, parsed_cam_quat_str,
+    batch_file;
   double focal_length, pixel_pitch, gcp_std, height_above_datum,
     cam_height, cam_weight;
   Vector2 optical_center;
@@ -272,6 +275,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
   Options(): focal_length(-1), pixel_pitch(-1), gcp_std(1), height_above_datum(0), refine_camera(false), cam_height(0), cam_weight(0) {}
 };
 
+void prepare_frame(Options & opt);
+
 void handle_arguments(int argc, char *argv[], Options& opt) {
   po::options_description general_options("");
   general_options.add_options()
@@ -314,7 +319,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("session-type,t",   po::value(&opt.stereo_session)->default_value(""),
      " Select the input camera model type. Normally this is auto-detected, but may need to be specified if the input camera model is in XML format. Options:nadirpinhole pinhole isis dg rpc spot5 aster opticalbar csm.")
     ("bundle-adjust-prefix", po::value(&opt.bundle_adjust_prefix),
-     "Use the camera adjustment obtained by previously running bundle_adjust when providing an input camera.");
+     "Use the camera adjustment obtained by previously running bundle_adjust when providing an input camera.")
+    ("batch-file", po::value(&opt.batch_file)->default_value(""),
+     "Create the cameras for many images in one run, in parallel. Each line of this file has an image, its output camera, and optionally the lon-lat values of its corners, which otherwise are read from --frame-index. The DEM and the other options are shared by all images.");
   
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -325,7 +332,7 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   po::positional_options_description positional_desc;
   positional_desc.add("image-file",1);
 
-  string usage("[options] <image-file> -o <camera-file>");
+  string usage("[options] <image-file> -o <camera-file>\n       cam_gen [options] --batch-file <file>");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -333,13 +340,24 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                             positional, positional_desc, usage,
                             allow_unregistered, unregistered);
 
-  if ( opt.image_file.empty() )
-    vw_throw( ArgumentErr() << "Missing the input image.\n"
-              << usage << general_options );
+  if (opt.batch_file != "") {
+    if (!opt.image_file.empty() || !opt.camera_file.empty() ||
+        !opt.lon_lat_values_str.empty())
+      vw_throw( ArgumentErr() << "With --batch-file, the images, output cameras, "
+                << "and lon-lat values must be in that file.\n"
+                << usage << general_options );
+    if (opt.input_camera != "")
+      vw_throw( ArgumentErr() << "Option --batch-file cannot be used with --input-camera.\n"
+                << usage << general_options );
+  } else {
+    if ( opt.image_file.empty() )
+      vw_throw( ArgumentErr() << "Missing the input image.\n"
+                << usage << general_options );
 
-  if ( opt.camera_file.empty() )
-    vw_throw( ArgumentErr() << "Missing the output camera file name.\n"
-              << usage << general_options );
+    if ( opt.camera_file.empty() )
+      vw_throw( ArgumentErr() << "Missing the output camera file name.\n"
+                << usage << general_options );
+  }
 
   boost::to_lower(opt.camera_type);
   
@@ -350,11 +368,6 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr() << "opticalbar type must use a sample camera file.\n"
               << usage << general_options );
 
-  std::string ext = get_extension(opt.camera_file);
-  if (ext != ".tsai") 
-    vw_throw( ArgumentErr() << "The output camera file must end with .tsai.\n"
-              << usage << general_options );
-
   // If we cannot read the data from a DEM, must specify a lot of things.
   if (opt.reference_dem.empty() && opt.datum_str.empty())
     vw_throw( ArgumentErr() << "Must provide either a reference DEM or a datum.\n"
@@ -364,10 +377,29 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr() << "The GCP standard deviation must be positive.\n"
               << usage << general_options );
 
+  if (opt.parse_eci && opt.parse_ecef)
+    vw_throw( ArgumentErr() << "Cannot parse both ECI end ECEF at the same time.\n");
+
+  // Note that optical center can be negative (for some SkySat products).
+  if ( opt.sample_file == "" && (opt.focal_length <= 0 || opt.pixel_pitch <= 0))
+    vw_throw( ArgumentErr() << "Must provide positive focal length"
+              << "and pixel pitch values OR a sample file.\n");
+
+  if (opt.batch_file == "")
+    prepare_frame(opt);
+} // End function handle_arguments
+
+// Find the corners, pixels, and other inputs specific to the current image
+void prepare_frame(Options & opt) {
+
+  std::string ext = get_extension(opt.camera_file);
+  if (ext != ".tsai") 
+    vw_throw( ArgumentErr() << "The output camera file must end with .tsai: "
+              << opt.camera_file << "\n");
+
   if (opt.frame_index != "" && opt.lon_lat_values_str != "") 
     vw_throw( ArgumentErr() << "Cannot specify both the frame index file "
-	      << "and the lon-lat corners.\n"
-              << usage << general_options );
+	      << "and the lon-lat corners.\n");
 
   if (opt.frame_index != "") {
     // Parse the frame index to extract opt.lon_lat_values_str.
@@ -401,9 +433,6 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
         vw_out() << "Parsed the lon-lat corner values: " << opt.lon_lat_values_str
 		 << std::endl;
 
-	if (opt.parse_eci && opt.parse_ecef)
-	  vw_throw( ArgumentErr() << "Cannot parse both ECI end ECEF at the same time.\n");
-	
 	// Also parse the camera height constraint, unless manually specified
 	if (opt.cam_weight > 0 || opt.parse_eci || opt.parse_ecef) {
 	  std::vector<std::string> vals;
@@ -502,22 +531,30 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     }
   }
   
-  // Note that optical center can be negative (for some SkySat products).
-  if ( opt.sample_file == "" && (opt.focal_length <= 0 || opt.pixel_pitch <= 0))
-    vw_throw( ArgumentErr() << "Must provide positive focal length"
-              << "and pixel pitch values OR a sample file.\n");
-  
   // Create the output directory
   vw::create_out_dir(opt.camera_file);
-} // End function handle_arguments
+} // End function prepare_frame
+
+// Read the sample camera file, if there is one, so that it is not
+// read again for each image.
+boost::shared_ptr<CameraModel> load_sample_cam(Options const& opt) {
+  boost::shared_ptr<CameraModel> sample_cam;
+  if (opt.camera_type == "opticalbar")
+    sample_cam.reset(new asp::camera::OpticalBarModel(opt.sample_file));
+  else if (opt.sample_file != "")
+    sample_cam.reset(new PinholeModel(opt.sample_file));
+  return sample_cam;
+}
 
 // Form a camera based on info the user provided
 void manufacture_cam(Options const& opt, int wid, int hgt,
+                     boost::shared_ptr<CameraModel> const& sample_cam,
 		     boost::shared_ptr<CameraModel> & out_cam){
 
   if (opt.camera_type == "opticalbar") {
     boost::shared_ptr<asp::camera::OpticalBarModel> opticalbar_cam;
-    opticalbar_cam.reset(new asp::camera::OpticalBarModel(opt.sample_file));
+    opticalbar_cam.reset(new asp::camera::OpticalBarModel
+                         (*dynamic_cast<asp::camera::OpticalBarModel*>(sample_cam.get())));
     // Make sure the image size matches the input image file.
     opticalbar_cam->set_image_size(Vector2i(wid, hgt));
     opticalbar_cam->set_optical_center(Vector2(wid/2.0, hgt/2.0));
@@ -526,7 +563,7 @@ void manufacture_cam(Options const& opt, int wid, int hgt,
     boost::shared_ptr<PinholeModel> pinhole_cam;
     if (opt.sample_file != "") {
       // Use the initial guess from file
-      pinhole_cam.reset(new PinholeModel(opt.sample_file));
+      pinhole_cam.reset(new PinholeModel(*dynamic_cast<PinholeModel*>(sample_cam.get())));
     } else {
       // Use the intrinsics from the command line. Use trivial rotation and translation.
       Vector3 ctr(0, 0, 0);
@@ -882,6 +919,255 @@ void extract_lon_lat_from_camera(Options & opt, ImageViewRef< PixelMask<float> >
   opt.pixel_values = good_pixel_values;
 }
 
+// Create the camera for the current image, and the GCP for its corners
+// without the GCP index. The DEM and the sample camera are shared among
+// the images, and are not modified.
+void gen_camera(Options & opt, vw::cartography::Datum const& datum,
+                GeoReference const& geo, ImageView<float> const& dem,
+                float nodata_value, bool has_dem,
+                boost::shared_ptr<CameraModel> const& sample_cam,
+                bool verbose, std::vector<std::string> & gcp_lines){
+
+  // Prepare the DEM for interpolation
+  ImageViewRef< PixelMask<float> > interp_dem
+    = interpolate(create_mask(dem, nodata_value),
+		    BilinearInterpolation(), ZeroEdgeExtension());
+
+  // If we have camera center in ECI or ECEF coordinates in km, convert
+  // to height above datum.
+  Vector3 parsed_cam_ctr;
+  if (opt.parsed_cam_ctr_str != "") {
+    std::vector<double> vals;
+    parse_values<double>(opt.parsed_cam_ctr_str, vals);
+    if (vals.size() != 3) 
+	vw_throw( ArgumentErr() << "Could not parse 3 values from: "
+		  << opt.parsed_cam_ctr_str << ".\n");
+
+    parsed_cam_ctr = Vector3(vals[0], vals[1], vals[2]);
+    parsed_cam_ctr *= 1000.0;  // convert to meters
+    vw_out().precision(18);
+    vw_out() << "Parsed camera center (meters): " << parsed_cam_ctr << "\n";
+
+    Vector3 llh = datum.cartesian_to_geodetic(parsed_cam_ctr);
+    
+    // If parsed_cam_ctr is in ECI coordinates, the lon and lat won't be accurate
+    // but the height will be.
+    if (opt.cam_weight > 0) 
+	opt.cam_height = llh[2];
+  }
+  
+  vw::Quat parsed_cam_quat;
+  if (opt.parsed_cam_quat_str != "") {
+    std::vector<double> vals;
+    parse_values<double>(opt.parsed_cam_quat_str, vals);
+    if (vals.size() != 4) 
+	vw_throw( ArgumentErr() << "Could not parse 4 values from: "
+		  << opt.parsed_cam_quat_str << ".\n");
+
+    parsed_cam_quat = vw::Quat(vals[0], vals[1], vals[2], vals[3]);
+    vw_out() << "Parsed camera quaternion: " << parsed_cam_quat << "\n";
+  }
+  
+  if (opt.cam_weight > 0) {
+    vw_out() << "Will attempt to find a camera center height above datum of "
+	       << opt.cam_height
+	       << " meters with a weight strength of " << opt.cam_weight << ".\n";
+  }
+  
+  if (opt.input_camera != ""){
+    // Extract lon and lat from tracing rays from the camera to the ground.
+    // This can modify opt.pixel_values.
+    extract_lon_lat_from_camera(opt, create_mask(dem, nodata_value), geo);
+  }
+
+  if (opt.lon_lat_values.size() < 3) 
+    vw_throw( ArgumentErr() << "Expecting at least three longitude-latitude pairs.\n");
+
+  if (opt.lon_lat_values.size() != opt.pixel_values.size()){
+    vw_throw( ArgumentErr()
+		<< "The number of lon-lat pairs must equal the number of pixel pairs.\n");
+  }
+
+  size_t num_lon_lat_pairs = opt.lon_lat_values.size()/2;
+  
+  Vector2 pix;
+  Vector3 llh, xyz;
+  std::vector<Vector3> xyz_vec;
+
+  // If to write a gcp file
+  bool write_gcp = (opt.gcp_file != "");
+
+  for (size_t corner_it = 0; corner_it < num_lon_lat_pairs; corner_it++) {
+
+    // Get the height from the DEM if possible
+    llh[0] = opt.lon_lat_values[2*corner_it+0];
+    llh[1] = opt.lon_lat_values[2*corner_it+1];
+
+    if (llh[1] < -90 || llh[1] > 90) 
+      vw_throw( ArgumentErr() << "Detected a latitude out of bounds. "
+                << "Perhaps the longitude and latitude are reversed?\n");
+    double height = opt.height_above_datum;
+    if (has_dem) {
+      bool success = false;
+      pix = geo.lonlat_to_pixel(subvector(llh, 0, 2));
+      int len =  BilinearInterpolation::pixel_buffer;
+      if (pix[0] >= 0 && pix[0] <= interp_dem.cols() - 1 - len &&
+          pix[1] >= 0 && pix[1] <= interp_dem.rows() - 1 - len) {
+        PixelMask<float> masked_height = interp_dem(pix[0], pix[1]);
+        if (is_valid(masked_height)) {
+          height = masked_height.child();
+          success = true;
+        }
+      }
+      if (!success) 
+        vw_out() << "Could not determine a valid height value at lon-lat: "
+		   << llh[0] << ' ' << llh[1] << ". Will use a height of " << height << ".\n";
+    }
+    
+    llh[2] = height;
+    //vw_out() << "Lon-lat-height for corner ("
+    //         << opt.pixel_values[2*corner_it] << ", " << opt.pixel_values[2*corner_it+1]
+    //         << ") is "
+    //         << llh[0] << ", " << llh[1] << ", " << llh[2] << std::endl;
+  
+    xyz = datum.geodetic_to_cartesian(llh);
+    xyz_vec.push_back(xyz);
+
+    if (write_gcp) {
+      std::ostringstream gcp;
+      gcp.precision(17);
+      gcp << llh[1] << ' ' << llh[0] << ' ' << llh[2] << ' '
+          << 1 << ' ' << 1 << ' ' << 1 << ' ' << opt.image_file << ' '
+          << opt.pixel_values[2*corner_it] << ' ' << opt.pixel_values[2*corner_it+1] << ' '
+          << opt.gcp_std << ' ' << opt.gcp_std;
+      gcp_lines.push_back(gcp.str());
+    }
+  } // End loop through lon-lat pairs
+  
+  // Form a camera based on info the user provided
+  boost::shared_ptr<CameraModel> out_cam;
+  DiskImageView<float> img(opt.image_file);
+  int wid = img.cols(), hgt = img.rows();
+  if (wid <= 0 || hgt <= 0) 
+    vw_throw( ArgumentErr() << "Could not read an image with positive dimensions from: "
+		<< opt.image_file << ".\n");
+  manufacture_cam(opt, wid, hgt, sample_cam, out_cam);
+
+  // Transform it and optionally refine it
+  fit_camera_to_xyz_ht(opt.parse_ecef, parsed_cam_ctr,
+			 opt.camera_type, opt.refine_camera,  
+			 xyz_vec, opt.pixel_values, 
+			 opt.cam_height, opt.cam_weight, datum,
+			 verbose, out_cam);
+  
+  if ((opt.parse_eci || opt.parse_ecef) && opt.camera_type == "opticalbar") {
+    vw_throw( ArgumentErr() << "Cannot parse ECI/ECEF data for an optical bar camera.\n");
+  }
+
+  // Code that is not working. 
+  //((vw::camera::PinholeModel*)out_cam.get())->set_camera_center(parsed_cam_ctr); 
+  //((vw::camera::PinholeModel*)out_cam.get())->set_camera_pose(parsed_cam_quat); 
+  //if (opt.parse_eci)
+  // ((vw::camera::PinholeModel*)out_cam.get())->set_camera_pose(parsed_cam_quat);
+  //if (opt.parse_ecef) 
+  // ((vw::camera::PinholeModel*)out_cam.get())->set_camera_pose
+  //	(inverse(parsed_cam_quat));
+  
+  llh = datum.cartesian_to_geodetic(out_cam->camera_center(Vector2()));
+  vw_out() << "Output camera center lon, lat, and height above datum: " << llh << std::endl;
+  vw_out() << "Writing: " << opt.camera_file << std::endl;
+  if (opt.camera_type == "opticalbar")
+    ((asp::camera::OpticalBarModel*)out_cam.get())->write(opt.camera_file);
+  else {
+    ((vw::camera::PinholeModel*)out_cam.get())->write(opt.camera_file);
+  }
+}
+
+// Create the camera for one image of the batch file
+class CamGenTask: public vw::Task, private boost::noncopyable {
+  Options                          m_opt;
+  vw::cartography::Datum const&    m_datum;
+  GeoReference const&              m_geo;
+  ImageView<float> const&          m_dem;
+  float                            m_nodata_value;
+  bool                             m_has_dem;
+  boost::shared_ptr<CameraModel>   m_sample_cam;
+  std::vector<std::string>       & m_gcp_lines;
+  int                            & m_num_failed;
+  Mutex                          & m_mutex;
+
+public:
+  CamGenTask(Options const& opt, vw::cartography::Datum const& datum,
+             GeoReference const& geo, ImageView<float> const& dem,
+             float nodata_value, bool has_dem,
+             boost::shared_ptr<CameraModel> sample_cam,
+             std::vector<std::string> & gcp_lines, int & num_failed, Mutex & mutex):
+    m_opt(opt), m_datum(datum), m_geo(geo), m_dem(dem), m_nodata_value(nodata_value),
+    m_has_dem(has_dem), m_sample_cam(sample_cam), m_gcp_lines(gcp_lines),
+    m_num_failed(num_failed), m_mutex(mutex) {}
+
+  virtual void operator()() {
+    try {
+      prepare_frame(m_opt);
+      bool verbose = false;
+      gen_camera(m_opt, m_datum, m_geo, m_dem, m_nodata_value, m_has_dem,
+                 m_sample_cam, verbose, m_gcp_lines);
+    } catch (std::exception const& e) {
+      vw_out(ErrorMessage) << "Could not create a camera for " << m_opt.image_file
+                           << ": " << e.what() << std::endl;
+      m_gcp_lines.clear();
+      Mutex::Lock lock(m_mutex);
+      m_num_failed++;
+    }
+  }
+};
+
+// Each line of the batch file has an image, its output camera, and
+// optionally the lon-lat values of the image corners.
+void read_batch_file(Options const& opt, std::vector<Options> & frames) {
+  frames.clear();
+  std::ifstream ifs(opt.batch_file.c_str());
+  if (!ifs.good())
+    vw_throw( ArgumentErr() << "Could not read: " << opt.batch_file << ".\n");
+
+  std::string line;
+  while (getline(ifs, line, '\n')) {
+    std::istringstream is(line);
+    std::string image_file, camera_file;
+    if (!(is >> image_file) || image_file[0] == '#')
+      continue; // skip empty lines and comments
+    if (!(is >> camera_file))
+      vw_throw( ArgumentErr() << "Expecting an image and an output camera on line: "
+                << line << ".\n");
+
+    Options frame = opt;
+    frame.image_file  = image_file;
+    frame.camera_file = camera_file;
+    std::getline(is, frame.lon_lat_values_str);
+    boost::algorithm::trim(frame.lon_lat_values_str);
+    vw::create_out_dir(frame.camera_file); // here, rather than from many threads
+    frames.push_back(frame);
+  }
+
+  if (frames.empty())
+    vw_throw( ArgumentErr() << "No images found in: " << opt.batch_file << ".\n");
+}
+
+// Write the GCP of all images, numbering them in order
+void write_gcp_file(std::string const& gcp_file,
+                    std::vector< std::vector<std::string> > const& gcp_lines) {
+  vw_out() << "Writing: " << gcp_file << std::endl;
+  std::ofstream fs(gcp_file.c_str());
+  int count = 0;
+  for (size_t frame = 0; frame < gcp_lines.size(); frame++) {
+    for (size_t it = 0; it < gcp_lines[frame].size(); it++) {
+      fs << count << ' ' << gcp_lines[frame][it] << std::endl;
+      count++;
+    }
+  }
+  fs.close();
+}
+
 int main(int argc, char * argv[]){
   
   Options opt;
@@ -912,166 +1198,40 @@ int main(int argc, char * argv[]){
                << datum << std::endl;
     }
 
-    // Prepare the DEM for interpolation
-    ImageViewRef< PixelMask<float> > interp_dem
-      = interpolate(create_mask(dem, nodata_value),
-		    BilinearInterpolation(), ZeroEdgeExtension());
-
-    // If we have camera center in ECI or ECEF coordinates in km, convert
-    // to height above datum.
-    Vector3 parsed_cam_ctr;
-    if (opt.parsed_cam_ctr_str != "") {
-      std::vector<double> vals;
-      parse_values<double>(opt.parsed_cam_ctr_str, vals);
-      if (vals.size() != 3) 
-	vw_throw( ArgumentErr() << "Could not parse 3 values from: "
-		  << opt.parsed_cam_ctr_str << ".\n");
-
-      parsed_cam_ctr = Vector3(vals[0], vals[1], vals[2]);
-      parsed_cam_ctr *= 1000.0;  // convert to meters
-      vw_out().precision(18);
-      vw_out() << "Parsed camera center (meters): " << parsed_cam_ctr << "\n";
-
-      Vector3 llh = datum.cartesian_to_geodetic(parsed_cam_ctr);
-      
-      // If parsed_cam_ctr is in ECI coordinates, the lon and lat won't be accurate
-      // but the height will be.
-      if (opt.cam_weight > 0) 
-	opt.cam_height = llh[2];
-    }
-    
-    vw::Quat parsed_cam_quat;
-    if (opt.parsed_cam_quat_str != "") {
-      std::vector<double> vals;
-      parse_values<double>(opt.parsed_cam_quat_str, vals);
-      if (vals.size() != 4) 
-	vw_throw( ArgumentErr() << "Could not parse 4 values from: "
-		  << opt.parsed_cam_quat_str << ".\n");
-
-      parsed_cam_quat = vw::Quat(vals[0], vals[1], vals[2], vals[3]);
-      vw_out() << "Parsed camera quaternion: " << parsed_cam_quat << "\n";
-    }
-    
-    if (opt.cam_weight > 0) {
-      vw_out() << "Will attempt to find a camera center height above datum of "
-	       << opt.cam_height
-	       << " meters with a weight strength of " << opt.cam_weight << ".\n";
-    }
-    
-    if (opt.input_camera != ""){
-      // Extract lon and lat from tracing rays from the camera to the ground.
-      // This can modify opt.pixel_values.
-      extract_lon_lat_from_camera(opt, create_mask(dem, nodata_value), geo);
-    }
-
-    if (opt.lon_lat_values.size() < 3) 
-      vw_throw( ArgumentErr() << "Expecting at least three longitude-latitude pairs.\n");
+    // Read these once, to be shared by all the images
+    boost::shared_ptr<CameraModel> sample_cam = load_sample_cam(opt);
 
-    if (opt.lon_lat_values.size() != opt.pixel_values.size()){
-      vw_throw( ArgumentErr()
-		<< "The number of lon-lat pairs must equal the number of pixel pairs.\n");
-    }
+    std::vector<Options> frames;
+    if (opt.batch_file == "")
+      frames.push_back(opt);
+    else
+      read_batch_file(opt, frames);
 
-    size_t num_lon_lat_pairs = opt.lon_lat_values.size()/2;
-    
-    Vector2 pix;
-    Vector3 llh, xyz;
-    std::vector<Vector3> xyz_vec;
-
-    // If to write a gcp file
-    std::ostringstream gcp;
-    gcp.precision(17);
-    bool write_gcp = (opt.gcp_file != "");
-
-    for (size_t corner_it = 0; corner_it < num_lon_lat_pairs; corner_it++) {
-
-      // Get the height from the DEM if possible
-      llh[0] = opt.lon_lat_values[2*corner_it+0];
-      llh[1] = opt.lon_lat_values[2*corner_it+1];
-
-      if (llh[1] < -90 || llh[1] > 90) 
-        vw_throw( ArgumentErr() << "Detected a latitude out of bounds. "
-                  << "Perhaps the longitude and latitude are reversed?\n");
-      double height = opt.height_above_datum;
-      if (has_dem) {
-        bool success = false;
-        pix = geo.lonlat_to_pixel(subvector(llh, 0, 2));
-        int len =  BilinearInterpolation::pixel_buffer;
-        if (pix[0] >= 0 && pix[0] <= interp_dem.cols() - 1 - len &&
-            pix[1] >= 0 && pix[1] <= interp_dem.rows() - 1 - len) {
-          PixelMask<float> masked_height = interp_dem(pix[0], pix[1]);
-          if (is_valid(masked_height)) {
-            height = masked_height.child();
-            success = true;
-          }
-        }
-        if (!success) 
-          vw_out() << "Could not determine a valid height value at lon-lat: "
-		   << llh[0] << ' ' << llh[1] << ". Will use a height of " << height << ".\n";
+    std::vector< std::vector<std::string> > gcp_lines(frames.size());
+    if (opt.batch_file == "") {
+      bool verbose = true;
+      gen_camera(frames[0], datum, geo, dem, nodata_value, has_dem, sample_cam,
+                 verbose, gcp_lines[0]);
+    } else {
+      vw_out() << "Creating cameras for " << frames.size() << " images.\n";
+      int num_failed = 0;
+      Mutex mutex;
+      FifoWorkQueue queue(vw_settings().default_num_threads());
+      for (size_t frame = 0; frame < frames.size(); frame++) {
+        boost::shared_ptr<CamGenTask>
+          task(new CamGenTask(frames[frame], datum, geo, dem, nodata_value, has_dem,
+                              sample_cam, gcp_lines[frame], num_failed, mutex));
+        queue.add_task(task);
       }
-      
-      llh[2] = height;
-      //vw_out() << "Lon-lat-height for corner ("
-      //         << opt.pixel_values[2*corner_it] << ", " << opt.pixel_values[2*corner_it+1]
-      //         << ") is "
-      //         << llh[0] << ", " << llh[1] << ", " << llh[2] << std::endl;
-    
-      xyz = datum.geodetic_to_cartesian(llh);
-      xyz_vec.push_back(xyz);
-
-      if (write_gcp)
-        gcp << corner_it << ' ' << llh[1] << ' ' << llh[0] << ' ' << llh[2] << ' '
-            << 1 << ' ' << 1 << ' ' << 1 << ' ' << opt.image_file << ' '
-            << opt.pixel_values[2*corner_it] << ' ' << opt.pixel_values[2*corner_it+1] << ' '
-            << opt.gcp_std << ' ' << opt.gcp_std << std::endl;
-    } // End loop through lon-lat pairs
+      queue.join_all();
 
-    if (write_gcp) {
-      vw_out() << "Writing: " << opt.gcp_file << std::endl;
-      std::ofstream fs(opt.gcp_file.c_str());
-      fs << gcp.str();
-      fs.close();
-    }
-    
-    // Form a camera based on info the user provided
-    boost::shared_ptr<CameraModel> out_cam;
-    DiskImageView<float> img(opt.image_file);
-    int wid = img.cols(), hgt = img.rows();
-    if (wid <= 0 || hgt <= 0) 
-      vw_throw( ArgumentErr() << "Could not read an image with positive dimensions from: "
-		<< opt.image_file << ".\n");
-    manufacture_cam(opt, wid, hgt, out_cam);
-
-    // Transform it and optionally refine it
-    bool verbose = true;
-    fit_camera_to_xyz_ht(opt.parse_ecef, parsed_cam_ctr,
-			 opt.camera_type, opt.refine_camera,  
-			 xyz_vec, opt.pixel_values, 
-			 opt.cam_height, opt.cam_weight, datum,
-			 verbose, out_cam);
-    
-    if ((opt.parse_eci || opt.parse_ecef) && opt.camera_type == "opticalbar") {
-      vw_throw( ArgumentErr() << "Cannot parse ECI/ECEF data for an optical bar camera.\n");
-    }
-
-    // Code that is not working. 
-    //((vw::camera::PinholeModel*)out_cam.get())->set_camera_center(parsed_cam_ctr); 
-    //((vw::camera::PinholeModel*)out_cam.get())->set_camera_pose(parsed_cam_quat); 
-    //if (opt.parse_eci)
-    // ((vw::camera::PinholeModel*)out_cam.get())->set_camera_pose(parsed_cam_quat);
-    //if (opt.parse_ecef) 
-    // ((vw::camera::PinholeModel*)out_cam.get())->set_camera_pose
-    //	(inverse(parsed_cam_quat));
-    
-    llh = datum.cartesian_to_geodetic(out_cam->camera_center(Vector2()));
-    vw_out() << "Output camera center lon, lat, and height above datum: " << llh << std::endl;
-    vw_out() << "Writing: " << opt.camera_file << std::endl;
-    if (opt.camera_type == "opticalbar")
-      ((asp::camera::OpticalBarModel*)out_cam.get())->write(opt.camera_file);
-    else {
-      ((vw::camera::PinholeModel*)out_cam.get())->write(opt.camera_file);
+      if (num_failed > 0)
+        vw_out(WarningMessage) << "Could not create the cameras for " << num_failed
+                               << " out of " << frames.size() << " images.\n";
     }
 
+    if (opt.gcp_file != "")
+      write_gcp_file(opt.gcp_file, gcp_lines);
 
   } ASP_STANDARD_CATCHES;
     
@@ -25,14 +25,19 @@
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/FileIO/KML.h>
+#include <vw/Image/Transform.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
+#include <asp/Camera/ApproxCameraModel.h>
+#include <asp/Camera/CameraCache.h>
 
 #include <limits>
 #include <cstring>
+#include <sstream>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -51,6 +56,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
   string image_file, camera_file, stereo_session, bundle_adjust_prefix,
          datum_str, dem_file, target_srs_string, output_kml;
   bool quick;
+  double approx_camera_error;
+  int dem_subsample;
   //BBox2i image_crop_box;
 };
 
@@ -62,6 +69,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("t_srs",         po::value(&opt.target_srs_string)->default_value(""), "Specify the output projection (PROJ.4 string). Can also be an URL or in WKT format, as for GDAL.")
     ("quick",            po::bool_switch(&opt.quick)->default_value(false),
 	     "Use a faster but less accurate computation.")
+    ("approximate-camera-error", po::value(&opt.approx_camera_error)->default_value(0),
+     "If positive, use an approximation of the camera, interpolated from a grid of camera rays made fine enough that the error, in pixels, is below this value. Much faster for ISIS and CSM cameras.")
     ("output-kml", po::value(&opt.output_kml),
      "Create an output KML file at this path.")
     ("session-type,t",   po::value(&opt.stereo_session)->default_value(""),
@@ -72,7 +81,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     //("image-crop-box", po::value(&opt.image_crop_box)->default_value(BBox2i(0,0,0,0), "0 0 0 0"),
     // "The output image and RPC model should not exceed this box, specified in input image pixels as minx miny widx widy.")
     ("dem-file",   po::value(&opt.dem_file)->default_value(""),
-     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.");
+     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.")
+    ("dem-subsample", po::value(&opt.dem_subsample)->default_value(1),
+     "Use only every this many pixels of the DEM in each direction. The footprint does not depend much on the fine detail of the terrain, so a value such as 4 or 8 makes it much faster to read a large DEM.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -105,6 +116,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
 
  
+  if (opt.dem_subsample < 1)
+    vw_throw( ArgumentErr() << "The DEM subsample factor must be positive.\n"
+              << usage << general_options );
+
   // Must specify the DEM or the datum somehow
   if (opt.dem_file.empty() && opt.datum_str.empty() && opt.target_srs_string.empty())
     vw_throw( ArgumentErr() << "Need to provide a DEM, a datum, or a t_srs string.\n" << usage << general_options );
@@ -117,6 +132,33 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   //}
 }
 
+// Replace the camera with an approximation, if desired. The datum is
+// needed to estimate the approximation error in pixels.
+void approximate_camera(Options const& opt, cartography::Datum const& datum,
+                        Vector2i const& image_size,
+                        boost::shared_ptr<CameraModel> & cam) {
+  if (opt.approx_camera_error <= 0)
+    return;
+  boost::shared_ptr<asp::ApproxCameraModel> approx_cam
+    (new asp::ApproxCameraModel(cam, BBox2i(0, 0, image_size[0], image_size[1]),
+                                datum, opt.approx_camera_error));
+  vw_out() << "Approximate camera error: " << approx_cam->sensor_error() << " pixels.\n";
+  cam = approx_cam;
+}
+
+// Identify all the inputs of the footprint computation
+std::string cache_key(Options const& opt, std::string const& dem,
+                      GeoReference const& target_georef,
+                      CameraModel const* cam, Vector2i const& image_size) {
+  std::ostringstream os;
+  os.precision(17);
+  os << "camera_footprint " << opt.quick << " " << opt.approx_camera_error << " "
+     << opt.dem_subsample << " "
+     << dem << " " << target_georef.overall_proj4_str() << " "
+     << asp::camera_fingerprint(cam, image_size);
+  return os.str();
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -159,6 +201,8 @@ int main( int argc, char *argv[] ) {
     BBox2 footprint_bbox;
     float mean_gsd=0;
     std::vector<Vector3> coords;
+    // The cache does not have the boundary points needed for the KML file
+    bool use_cache = opt.output_kml.empty();
     if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
 
       // Initialize the georef/datum
@@ -169,11 +213,18 @@ int main( int argc, char *argv[] ) {
       asp::set_srs_string(opt.target_srs_string, have_user_datum, datum, target_georef);
       vw_out() << "Using georef: " << target_georef << std::endl;
 
-      std::vector<Vector2> coords2;
-      footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1], mean_gsd, &coords2);
-      for (size_t i=0; i<coords2.size(); ++i) {
-        Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
-        coords.push_back(target_georef.point_to_geodetic(proj_coord));
+      std::string key = cache_key(opt, "datum", target_georef, cam.get(), image_size);
+      if (!use_cache || !asp::read_footprint_cache(opt.camera_file, key,
+                                                   footprint_bbox, mean_gsd)) {
+        approximate_camera(opt, target_georef.datum(), image_size, cam);
+        std::vector<Vector2> coords2;
+        footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1],
+                                     mean_gsd, &coords2);
+        for (size_t i=0; i<coords2.size(); ++i) {
+          Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
+          coords.push_back(target_georef.point_to_geodetic(proj_coord));
+        }
+        asp::write_footprint_cache(opt.camera_file, key, footprint_bbox, mean_gsd);
       }
       
     } else { // DEM provided, intersect with it.
@@ -190,11 +241,23 @@ int main( int argc, char *argv[] ) {
 
       target_georef = dem_georef; // return box in this projection
       vw_out() << "Using georef: " << target_georef << std::endl;
+
+      if (opt.dem_subsample > 1) {
+        dem        = subsample(dem, opt.dem_subsample);
+        dem_georef = resample(dem_georef, 1.0/opt.dem_subsample);
+      }
       
-      footprint_bbox = camera_bbox(dem, dem_georef, target_georef, cam,
-                                   image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
-      for (size_t i=0; i<coords.size(); ++i)
-        coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
+      std::string key = cache_key(opt, asp::file_fingerprint(opt.dem_file), target_georef,
+                                  cam.get(), image_size);
+      if (!use_cache || !asp::read_footprint_cache(opt.camera_file, key,
+                                                   footprint_bbox, mean_gsd)) {
+        approximate_camera(opt, dem_georef.datum(), image_size, cam);
+        footprint_bbox = camera_bbox(dem, dem_georef, target_georef, cam,
+                                     image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
+        for (size_t i=0; i<coords.size(); ++i)
+          coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
+        asp::write_footprint_cache(opt.camera_file, key, footprint_bbox, mean_gsd);
+      }
     }
     
     // Print out the results    
@@ -28,11 +28,14 @@
 #include <asp/Core/StereoSettings.h>
 
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/FileIO/DiskImageUtils.h>
-#include <vw/Image/BlockImageOperator.h>
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <random>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -73,13 +76,16 @@ class Options : public vw::cartography::GdalWriteOptions {
 public:
   std::string input_prefix;
   float error_cutoff;
+  double tolerance;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   po::options_description general_options("General Options");
   general_options.add_options()
-    ("error-cutoff", po::value(&opt.error_cutoff)->default_value(0));
+    ("error-cutoff", po::value(&opt.error_cutoff)->default_value(0))
+    ("tolerance", po::value(&opt.tolerance)->default_value(0),
+     "If positive, process the tiles in random order, and stop once the percentage of valid pixels is known to within this value, with 95% confidence. For example, 0.005 for half a percent.");
 
   po::options_description positional("");
   positional.add_options()
@@ -100,50 +106,85 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "Missing input prefix.\n" << usage << general_options );
   opt.input_prefix = vm["input-prefix"].as<std::string>();
 
+  if (opt.tolerance < 0)
+    vw_throw( ArgumentErr() << "The tolerance must be non-negative.\n"
+              << usage << general_options );
+
 }
 
 
-/// Count the number of pixels above a threshold on a per-block basis.
-class ValidPixelCounterFunctor {
-  
-  double m_error_threshold;
-  uint64 m_masked_count;
-  uint64 m_invalid_count;
-  Mutex  m_mutex;
-  
+/// Count the pixels in one tile which are outside the left mask, and those
+/// which are inside it but whose error is zero or not below the threshold.
+class ValidPixelCounterTask: public vw::Task, private boost::noncopyable {
+
+  ImageViewRef<double> const& m_image;
+  BBox2i  m_bbox;
+  double  m_error_threshold;
+  uint64& m_masked_count;
+  uint64& m_invalid_count;
+
 public:
-  
-  ValidPixelCounterFunctor(double threshold)
-    : m_error_threshold(threshold), m_masked_count(0), m_invalid_count(0) {}
-
-  uint64 get_masked_count () const {return m_masked_count; }
-  uint64 get_invalid_count() const {return m_invalid_count;}
-
-  template <class T>
-  void operator()(ImageView<T> const& image, BBox2i const& bbox) {
-    // Count the pixels where the value is zero or >= the threshold.
-    uint64 local_invalid_count = 0;
-    uint64 local_masked_count  = 0;
-    for (int r=0; r<bbox.height(); ++r) {
-      for (int c=0; c<bbox.width(); ++c) {
-        typename ImageView<T>::pixel_type value = image(c,r);
+
+  ValidPixelCounterTask(ImageViewRef<double> const& image, BBox2i const& bbox,
+                        double threshold, uint64 & masked_count, uint64 & invalid_count):
+    m_image(image), m_bbox(bbox), m_error_threshold(threshold),
+    m_masked_count(masked_count), m_invalid_count(invalid_count) {}
+
+  virtual void operator()() {
+    ImageView<double> tile = crop(m_image, m_bbox);
+    uint64 masked_count = 0, invalid_count = 0;
+    for (int r = 0; r < tile.rows(); r++) {
+      for (int c = 0; c < tile.cols(); c++) {
+        double value = tile(c, r);
         if (value < 0.0) { // These pixels are outside the left mask.
-          ++local_masked_count;
+          ++masked_count;
           continue;
         }
-        if ((value == 0) || (value >= m_error_threshold)) {
-          ++local_invalid_count; // Bad triangulation
-        }
+        if ((value == 0) || (value >= m_error_threshold))
+          ++invalid_count; // Bad triangulation
       }
     }
-    // Safely add to the shared totals.
-    m_mutex.lock();
-    m_masked_count  += local_masked_count;
-    m_invalid_count += local_invalid_count;
-    m_mutex.unlock();
+    // Each task has its own counts, so no locking is needed
+    m_masked_count  = masked_count;
+    m_invalid_count = invalid_count;
   }
 };
 
+/// The fraction of invalid pixels among the unmasked ones in the given
+/// tiles, and the half-width of its 95% confidence interval, treating
+/// these tiles as randomly drawn without replacement from num_tiles.
+void invalid_fraction(std::vector<uint64> const& tile_pixels,
+                      std::vector<uint64> const& masked_counts,
+                      std::vector<uint64> const& invalid_counts,
+                      size_t num_done, size_t num_tiles,
+                      double & fraction, double & margin) {
+
+  double unmasked = 0, invalid = 0;
+  for (size_t it = 0; it < num_done; it++) {
+    unmasked += double(tile_pixels[it]) - double(masked_counts[it]);
+    invalid  += double(invalid_counts[it]);
+  }
+  fraction = (unmasked > 0) ? invalid/unmasked : 0.0;
+
+  margin = std::numeric_limits<double>::max();
+  if (num_done == num_tiles) {
+    margin = 0;
+    return;
+  }
+  if (num_done < 2 || unmasked <= 0)
+    return;
+
+  // The variance of a ratio estimator for a sample of clusters
+  double sum = 0;
+  for (size_t it = 0; it < num_done; it++) {
+    double u = double(tile_pixels[it]) - double(masked_counts[it]);
+    double d = double(invalid_counts[it]) - fraction*u;
+    sum += d*d;
+  }
+  double n = num_done, mean_unmasked = unmasked/n;
+  double var = (1.0 - n/num_tiles) * sum/((n - 1.0)*n*mean_unmasked*mean_unmasked);
+  margin = 1.96*std::sqrt(var);
+}
 
 //-----------------------------------------------------------------------------------
 
@@ -194,22 +235,69 @@ int main( int argc, char *argv[] ) {
       return 0;
     };
 
-    // Use BlockImageOperator to count invalid pixels in parallel threads.
-    ValidPixelCounterFunctor functor(opt.error_cutoff);
-
-    //write_image("debug.tif", masked_error_image);
+    // Count the invalid pixels per tile in parallel threads. With a
+    // tolerance, visit the tiles in random order, in batches, and stop
+    // when the estimate is good enough. The seed is fixed so the result
+    // is repeatable.
+    std::vector<BBox2i> tiles = subdivide_bbox(masked_error_image, tile_size, tile_size);
+    if (opt.tolerance > 0)
+      std::shuffle(tiles.begin(), tiles.end(), std::mt19937(1));
+
+    size_t num_tiles = tiles.size();
+    std::vector<uint64> tile_pixels(num_tiles), masked_counts(num_tiles, 0),
+      invalid_counts(num_tiles, 0);
+    for (size_t it = 0; it < num_tiles; it++)
+      tile_pixels[it] = uint64(tiles[it].width()) * uint64(tiles[it].height());
+
+    int num_threads = vw_settings().default_num_threads();
+    size_t batch_size = num_tiles;
+    if (opt.tolerance > 0)
+      batch_size = std::max(4*num_threads, 16);
+
+    size_t num_done = 0;
+    double fraction = 0, margin = 0;
+    while (num_done < num_tiles) {
+      size_t batch_end = std::min(num_tiles, num_done + batch_size);
+      FifoWorkQueue queue(num_threads);
+      for (size_t it = num_done; it < batch_end; it++) {
+        boost::shared_ptr<ValidPixelCounterTask>
+          task(new ValidPixelCounterTask(masked_error_image, tiles[it], opt.error_cutoff,
+                                         masked_counts[it], invalid_counts[it]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      num_done = batch_end;
 
-    const Vector2i block_size(tile_size, tile_size);
-    block_op_cache(masked_error_image, functor, block_size);
+      invalid_fraction(tile_pixels, masked_counts, invalid_counts, num_done, num_tiles,
+                       fraction, margin);
+      if (opt.tolerance > 0 && margin <= opt.tolerance)
+        break;
+    }
 
-    uint64 num_masked  = functor.get_masked_count();
-    uint64 num_invalid = functor.get_invalid_count();
+    // Scale the counts in the processed tiles to the whole image
+    uint64 sampled_pixels = 0, sampled_masked = 0, sampled_invalid = 0;
+    for (size_t it = 0; it < num_done; it++) {
+      sampled_pixels  += tile_pixels[it];
+      sampled_masked  += masked_counts[it];
+      sampled_invalid += invalid_counts[it];
+    }
     uint64 num_rows    = masked_error_image.rows();
     uint64 num_cols    = masked_error_image.cols();
     uint64 num_pixels  = num_rows*num_cols;
+    uint64 num_masked  = sampled_masked;
+    uint64 num_invalid = sampled_invalid;
+    if (num_done < num_tiles && sampled_pixels > 0) {
+      double scale = double(num_pixels) / double(sampled_pixels);
+      num_masked  = round(scale * sampled_masked);
+      num_invalid = round(fraction * (num_pixels - num_masked));
+    }
     uint64 num_unmasked_pixels = num_pixels - num_masked;
     uint64 num_valid   = num_unmasked_pixels - num_invalid;
 
+    if (num_done < num_tiles)
+      std::cout << "Estimated from " << num_done << " out of " << num_tiles
+                << " tiles, to within " << margin << "." << std::endl;
+
     double percent_invalid = static_cast<double>(num_invalid) / static_cast<double>(num_unmasked_pixels);
 
     std::cout << "Total number of pixels:     " << num_pixels      << std::endl;
@@ -21,9 +21,11 @@
 
 
 #include <vw/Cartography/GeoTransform.h>
+#include <vw/Image/Manipulation.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/CameraGridTransform.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -53,6 +55,7 @@ class DatumConvertView : public ImageViewBase<DatumConvertView<ImageT> >
   double              m_nodata_val;
   bool                m_use_gcc_convert;
   bool                m_debug_mode;
+  bool                m_exact;
   //ProjContext m_src_datum_proj, m_dst_datum_proj;
 
 public:
@@ -64,13 +67,19 @@ public:
   /// Image view which replaces each input elevation with the elevation
   ///  value of the same location in the output georeference system.
   /// - This view does not do any horizontal movement.
+  /// - Unless exact is set, the output height is found exactly only on a
+  ///   grid in each tile, at two reference heights, and is interpolated
+  ///   in between, bilinearly in position and linearly in height. Grid
+  ///   cells where this is off by more than a millimeter at the center
+  ///   use the exact conversion.
   DatumConvertView(ImageT       const& input_dem,
                    GeoReference const& input_georef,
                    GeoReference const& output_georef,
                    double nodata_val,
-                   bool debug_mode=false):
+                   bool debug_mode=false, bool exact=false):
     m_input_dem(input_dem), m_input_georef(input_georef), m_output_georef(output_georef), 
-    m_tf(input_georef, output_georef), m_nodata_val(nodata_val), m_use_gcc_convert(false), m_debug_mode(debug_mode){//,
+    m_tf(input_georef, output_georef), m_nodata_val(nodata_val), m_use_gcc_convert(false),
+    m_debug_mode(debug_mode), m_exact(exact || debug_mode){//,
     //m_src_datum_proj(input_georef.overall_proj4_str ()), 
     //m_dst_datum_proj(output_georef.overall_proj4_str()) {
     
@@ -101,9 +110,113 @@ public:
     if ( m_input_dem(col, row) == m_nodata_val )
       return m_nodata_val;
 
+    return exact_height(Vector2(col, row), m_input_dem(col, row));
+  }
+
+  /// \cond INTERNAL
+  typedef CropView<ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+    ImageView<result_type> dem = crop(m_input_dem, bbox);
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    int num_cols = tile.cols(), num_rows = tile.rows();
+
+    if (m_exact) {
+      for (int row = 0; row < num_rows; row++) {
+        for (int col = 0; col < num_cols; col++) {
+          if (dem(col, row) == m_nodata_val)
+            tile(col, row) = m_nodata_val;
+          else
+            tile(col, row) = exact_height(Vector2(col + bbox.min().x(), row + bbox.min().y()),
+                                          dem(col, row));
+        }
+      }
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    // The output height at each node, at height zero, and its rate of
+    // change with the input height
+    std::vector<int> node_cols, node_rows;
+    grid_nodes(num_cols, node_cols);
+    grid_nodes(num_rows, node_rows);
+    int nx = node_cols.size(), ny = node_rows.size();
+    std::vector<double> base(nx*ny), slope(nx*ny);
+    for (int j = 0; j < ny; j++)
+      for (int i = 0; i < nx; i++)
+        fit_node(Vector2(node_cols[i] + bbox.min().x(), node_rows[j] + bbox.min().y()),
+                 base[i + j*nx], slope[i + j*nx]);
+
+    // Check the interpolation at the center of each cell
+    int ncx = std::max(nx - 1, 1), ncy = std::max(ny - 1, 1);
+    std::vector<char> exact(ncx*ncy);
+    for (int j = 0; j < ncy; j++) {
+      for (int i = 0; i < ncx; i++) {
+        int i1 = std::min(i + 1, nx - 1), j1 = std::min(j + 1, ny - 1);
+        Vector2 center(0.5*(node_cols[i] + node_cols[i1]) + bbox.min().x(),
+                       0.5*(node_rows[j] + node_rows[j1]) + bbox.min().y());
+        double b = 0.25*(base [i + j*nx] + base [i1 + j*nx] + base [i + j1*nx] + base [i1 + j1*nx]);
+        double s = 0.25*(slope[i + j*nx] + slope[i1 + j*nx] + slope[i + j1*nx] + slope[i1 + j1*nx]);
+        double exact_base, exact_slope;
+        fit_node(center, exact_base, exact_slope);
+        exact[i + j*ncx] = (std::abs(b - exact_base) > HEIGHT_TOL ||
+                            std::abs(s - exact_slope)*REF_HEIGHT > HEIGHT_TOL);
+      }
+    }
+
+    for (int row = 0; row < num_rows; row++) {
+      int j  = std::min(row / GRID_SPACING, ncy - 1);
+      int j1 = std::min(j + 1, ny - 1);
+      double v = (j1 > j) ? double(row - node_rows[j]) / (node_rows[j1] - node_rows[j]) : 0.0;
+      for (int col = 0; col < num_cols; col++) {
+        double height = dem(col, row);
+        if (height == m_nodata_val) {
+          tile(col, row) = m_nodata_val;
+          continue;
+        }
+        int i  = std::min(col / GRID_SPACING, ncx - 1);
+        int i1 = std::min(i + 1, nx - 1);
+        if (exact[i + j*ncx]) {
+          tile(col, row) = exact_height(Vector2(col + bbox.min().x(), row + bbox.min().y()),
+                                        height);
+          continue;
+        }
+        double u = (i1 > i) ? double(col - node_cols[i]) / (node_cols[i1] - node_cols[i]) : 0.0;
+        int n00 = i + j*nx, n10 = i1 + j*nx, n01 = i + j1*nx, n11 = i1 + j1*nx;
+        double b = (1-v)*((1-u)*base [n00] + u*base [n10]) + v*((1-u)*base [n01] + u*base [n11]);
+        double s = (1-v)*((1-u)*slope[n00] + u*slope[n10]) + v*((1-u)*slope[n01] + u*slope[n11]);
+        tile(col, row) = b + s*height;
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+  template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+  /// \endcond
+
+private:
+
+  static const int GRID_SPACING = 32;    // In pixels
+  static constexpr double REF_HEIGHT = 1000.0; // The second height at the nodes, in meters
+  static constexpr double HEIGHT_TOL = 0.001;
+
+  void grid_nodes(int size, std::vector<int> & nodes) const {
+    nodes.clear();
+    for (int it = 0; it < size - 1; it += GRID_SPACING)
+      nodes.push_back(it);
+    nodes.push_back(std::max(size - 1, 0));
+  }
+
+  // The output height at height zero and the rate of change with height
+  void fit_node(Vector2 const& input_pixel, double & base, double & slope) const {
+    base  = exact_height(input_pixel, 0.0);
+    slope = (exact_height(input_pixel, REF_HEIGHT) - base) / REF_HEIGHT;
+  }
+
+  result_type exact_height(Vector2 const& input_pixel, double current_height) const {
+
     // Compute the elevation in the output datum
-    double  current_height  = m_input_dem(col, row);
-    Vector2 input_pixel(col, row);
     Vector2 input_lonlat    = m_input_georef.pixel_to_lonlat(input_pixel);
     Vector3 input_llh(input_lonlat[0], input_lonlat[1], current_height);
 
@@ -166,16 +279,6 @@ public:
     return output_llh[2];
   }
 
-  /// \cond INTERNAL
-  typedef DatumConvertView<typename ImageT::prerasterize_type> prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_input_dem.prerasterize(bbox), m_input_georef,
-                              m_output_georef, m_nodata_val, m_debug_mode);
-  }
-  template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
-    vw::rasterize( prerasterize(bbox), dest, bbox );
-  }
-  /// \endcond
 };
 
 // Helper function which uses the class above.
@@ -185,8 +288,10 @@ datum_convert( ImageViewBase<ImageT> const& input_dem,
                GeoReference          const& input_georef,
                GeoReference          const& output_georef,
                double                       nodata_val,
-               bool                         debug_mode) {
-  return DatumConvertView<ImageT>(input_dem.impl(), input_georef, output_georef, nodata_val, debug_mode);
+               bool                         debug_mode,
+               bool                         exact) {
+  return DatumConvertView<ImageT>(input_dem.impl(), input_georef, output_georef, nodata_val,
+                                  debug_mode, exact);
 }
 
 
@@ -257,7 +362,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   string input_dem, output_dem, output_datum, input_datum,
          target_srs_string, input_grid, output_info_string;
   double nodata_value;
-  bool   keep_bounds, use_double, debug_mode;
+  bool   keep_bounds, use_double, debug_mode, exact;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ){
@@ -277,6 +382,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
      "The value of no-data pixels, unless specified in the DEM.")
     ("debug-mode",  po::bool_switch(&opt.debug_mode)->default_value(false)->implicit_value(true),
      "Print conversion info for every pixel (to help verify output).")
+    ("exact",  po::bool_switch(&opt.exact)->default_value(false)->implicit_value(true),
+     "Convert every pixel exactly, rather than interpolate the conversion on a grid.")
     ("double", po::bool_switch(&opt.use_double)->default_value(false)->implicit_value(true),
      "Output using double precision (64 bit) instead of float (32 bit).");
 
@@ -465,18 +572,36 @@ void do_work(Options const& opt) {
   ImageViewRef<double> dem_new_heights = datum_convert(pixel_cast<double>(dem_img),
                                                        dem_georef,
                                                        output_working_georef,
-                                                       dem_nodata_val, opt.debug_mode);
+                                                       dem_nodata_val, opt.debug_mode,
+                                                       opt.exact);
 
   // Apply the horizontal warping to the image on account of the new datum.
-  ImageViewRef<double> output_dem = apply_mask(geo_transform(create_mask(dem_new_heights,
-                                                                         dem_nodata_val),
-                                                             dem_georef, output_working_georef,
-                                                             output_pixel_box.width(),
-                                                             output_pixel_box.height(),
-                                                             ConstantEdgeExtension()
-                                                            ),
-                                               dem_nodata_val
-                                              );
+  // Unless asked otherwise, the transform of pixels is interpolated on a grid.
+  bool exact = (opt.exact || opt.debug_mode);
+  ImageViewRef<double> output_dem;
+  if (exact) {
+    output_dem = apply_mask(geo_transform(create_mask(dem_new_heights,
+                                                      dem_nodata_val),
+                                          dem_georef, output_working_georef,
+                                          output_pixel_box.width(),
+                                          output_pixel_box.height(),
+                                          ConstantEdgeExtension()
+                                          ),
+                            dem_nodata_val
+                            );
+  } else {
+    const double MAX_PIXEL_ERROR = 0.01;
+    asp::CameraGridTransform<GeoTransform>
+      grid_tf(GeoTransform(dem_georef, output_working_georef),
+              Vector2i(dem_img.cols(), dem_img.rows()), MAX_PIXEL_ERROR);
+    output_dem = apply_mask(transform(create_mask(dem_new_heights, dem_nodata_val),
+                                      grid_tf,
+                                      output_pixel_box.width(),
+                                      output_pixel_box.height(),
+                                      ConstantEdgeExtension(),
+                                      BilinearInterpolation()),
+                            dem_nodata_val);
+  }
 
   vw_out() << "Writing adjusted DEM: " << opt.output_dem << endl;
 
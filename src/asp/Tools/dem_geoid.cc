@@ -29,6 +29,7 @@ extern "C" {
 }
 
 #include <vw/Image/Interpolation.h>
+#include <vw/Image/Manipulation.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 
@@ -43,6 +44,10 @@ using namespace std;
 
 /// Image view which adds or subtracts the ellipsoid/geoid difference
 ///  from elevations in a DEM image.
+/// - If the grid spacing is more than one pixel, the geoid height is
+///   found exactly only on a grid of that spacing in each tile, and is
+///   interpolated bilinearly in between, as the geoid is very smooth.
+///   Grid cells with a corner outside the geoid use the exact value.
 template <class ImageT>
 class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
 {
@@ -55,6 +60,7 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
   bool     m_reverse_adjustment; ///< If true, convert from orthometric height to geoid height
   double   m_correction;
   double   m_nodata_val;
+  int      m_grid_spacing; ///< In DEM pixels
 
 public:
 
@@ -67,13 +73,14 @@ public:
                bool is_egm2008, vector<double> const& egm2008_grid,
                ImageViewRef<PixelMask<double> > const& geoid,
                GeoReference const& geoid_georef, bool reverse_adjustment,
-               double correction, double nodata_val):
+               double correction, double nodata_val, int grid_spacing):
     m_img(img), m_georef(georef),
     m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
     m_geoid(geoid), m_geoid_georef(geoid_georef),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
-    m_nodata_val(nodata_val){}
+    m_nodata_val(nodata_val),
+    m_grid_spacing(grid_spacing){}
 
   inline int32 cols  () const { return m_img.cols(); }
   inline int32 rows  () const { return m_img.rows(); }
@@ -86,7 +93,107 @@ public:
     if ( m_img(col, row, p) == m_nodata_val )
       return m_nodata_val; // Skip invalid pixels
 
-    Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
+    double geoid_height = 0.0;
+    if (!exact_geoid_height(Vector2(col, row), geoid_height))
+      return m_nodata_val;
+
+    return adjust(m_img(col, row, p), geoid_height);
+  }
+
+  /// \cond INTERNAL
+  typedef CropView<ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+    ImageView<result_type> dem = crop(m_img, bbox);
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    int cols = tile.cols(), rows = tile.rows();
+
+    if (m_grid_spacing <= 1) {
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+          double geoid_height = 0.0, height = dem(col, row);
+          if (height == m_nodata_val ||
+              !exact_geoid_height(Vector2(col + bbox.min().x(), row + bbox.min().y()),
+                                  geoid_height))
+            tile(col, row) = m_nodata_val;
+          else
+            tile(col, row) = adjust(height, geoid_height);
+        }
+      }
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), this->cols(), this->rows());
+    }
+
+    // The grid nodes, at multiples of the spacing and at the last row and column
+    std::vector<int> node_cols, node_rows;
+    grid_nodes(cols, node_cols);
+    grid_nodes(rows, node_rows);
+    int nx = node_cols.size(), ny = node_rows.size();
+    std::vector<double> nodes(nx*ny);
+    std::vector<char>   valid(nx*ny);
+    for (int j = 0; j < ny; j++)
+      for (int i = 0; i < nx; i++)
+        valid[i + j*nx] = exact_geoid_height(Vector2(node_cols[i] + bbox.min().x(),
+                                                     node_rows[j] + bbox.min().y()),
+                                             nodes[i + j*nx]);
+
+    // Along a row, the interpolated value changes linearly within a cell
+    for (int row = 0; row < rows; row++) {
+      int j = std::min(row / m_grid_spacing, std::max(ny - 2, 0));
+      int j1 = std::min(j + 1, ny - 1);
+      double v = (j1 > j) ? double(row - node_rows[j]) / (node_rows[j1] - node_rows[j]) : 0.0;
+      for (int col = 0; col < cols; col++) {
+        double height = dem(col, row);
+        if (height == m_nodata_val) {
+          tile(col, row) = m_nodata_val;
+          continue;
+        }
+        int i = std::min(col / m_grid_spacing, std::max(nx - 2, 0));
+        int i1 = std::min(i + 1, nx - 1);
+        double u = (i1 > i) ? double(col - node_cols[i]) / (node_cols[i1] - node_cols[i]) : 0.0;
+        int n00 = i + j*nx, n10 = i1 + j*nx, n01 = i + j1*nx, n11 = i1 + j1*nx;
+        double geoid_height = 0.0;
+        if (valid[n00] && valid[n10] && valid[n01] && valid[n11]) {
+          geoid_height = (1-v)*((1-u)*nodes[n00] + u*nodes[n10]) +
+                            v *((1-u)*nodes[n01] + u*nodes[n11]);
+        } else if (!exact_geoid_height(Vector2(col + bbox.min().x(), row + bbox.min().y()),
+                                       geoid_height)) {
+          tile(col, row) = m_nodata_val;
+          continue;
+        }
+        tile(col, row) = adjust(height, geoid_height);
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), this->cols(), this->rows());
+  }
+  template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+  /// \endcond
+
+private:
+
+  void grid_nodes(int size, std::vector<int> & nodes) const {
+    nodes.clear();
+    for (int it = 0; it < size - 1; it += m_grid_spacing)
+      nodes.push_back(it);
+    nodes.push_back(std::max(size - 1, 0));
+  }
+
+  // Compute height above the geoid
+  // - See the note in the main program about the formula below
+  result_type adjust(double height_above_ellipsoid, double geoid_height) const {
+    if (m_reverse_adjustment)
+      return height_above_ellipsoid + geoid_height;
+    else
+      return height_above_ellipsoid - geoid_height;
+  }
+
+  // The geoid height, plus the correction, at the given DEM pixel.
+  // Return false if the pixel is outside the geoid.
+  bool exact_geoid_height(Vector2 const& pix, double & geoid_height) const {
+
+    Vector2 lonlat = m_georef.pixel_to_lonlat(pix);
 
     // For testing (see the link to the reference web form belows).
     //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
@@ -111,9 +218,7 @@ public:
     while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
     while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
 
-
-
-    result_type geoid_height = 0.0;
+    geoid_height = 0.0;
     if (m_is_egm2008){
       int nr = m_geoid.rows(), 
           nc = m_geoid.cols();
@@ -122,37 +227,16 @@ public:
                            &lonlat[0], &lonlat[1], &geoid_height);
     }else{
       // Use our own interpolation into the geoid image
-      Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
-      PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
+      Vector2  geoid_pix = m_geoid_georef.lonlat_to_pixel(lonlat);
+      PixelMask<double> interp_val = m_geoid(geoid_pix[0], geoid_pix[1]);
       if (!is_valid(interp_val))
-        return m_nodata_val;
+        return false;
       geoid_height = interp_val.child();
     }
 
     geoid_height += m_correction;
-
-    result_type height_above_ellipsoid = m_img(col, row, p);
-
-    // Compute height above the geoid
-    // - See the note in the main program about the formula below
-    if (m_reverse_adjustment)
-      return height_above_ellipsoid + geoid_height;
-    else
-      return height_above_ellipsoid - geoid_height;
-  }
-
-  /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
-  }
-  template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
-    vw::rasterize( prerasterize(bbox), dest, bbox );
+    return true;
   }
-  /// \endcond
 };
 
 // Helper function which uses the class above.
@@ -162,11 +246,30 @@ dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
            bool is_egm2008, vector<double> & egm2008_grid,
            ImageViewRef<PixelMask<double> > const& geoid,
            GeoReference const& geoid_georef, bool reverse_adjustment,
-           double correction, double nodata_val) {
+           double correction, double nodata_val, int grid_spacing) {
   return DemGeoidView<ImageT>( img.impl(), georef,
                                is_egm2008, egm2008_grid,
                                geoid, geoid_georef,
-                               reverse_adjustment, correction, nodata_val );
+                               reverse_adjustment, correction, nodata_val, grid_spacing );
+}
+
+/// The spacing, in DEM pixels, of the grid on which the geoid is found
+/// exactly. It spans at most a quarter of a geoid pixel, so that the
+/// bilinear interpolation is much finer than that of the geoid itself.
+int geoid_grid_spacing(GeoReference const& dem_georef, Vector2i const& dem_size,
+                       GeoReference const& geoid_georef) {
+
+  const int MAX_SPACING = 32;
+  Vector2 center = Vector2(dem_size) / 2.0;
+  Vector2 lonlat = dem_georef.pixel_to_lonlat(center);
+  double dem_step = std::max(norm_2(dem_georef.pixel_to_lonlat(center + Vector2(1, 0)) - lonlat),
+                             norm_2(dem_georef.pixel_to_lonlat(center + Vector2(0, 1)) - lonlat));
+  double geoid_step = std::min(fabs(geoid_georef.transform()(0, 0)),
+                               fabs(geoid_georef.transform()(1, 1)));
+  if (!(dem_step > 0) || !(geoid_step > 0))
+    return 1;
+  double spacing = 0.25 * geoid_step / dem_step;
+  return std::max(1, std::min(MAX_SPACING, int(spacing)));
 }
 
 /// Parameters for this tool
@@ -175,6 +278,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   double nodata_value;
   bool   use_double; // Otherwise use float
   bool   reverse_adjustment;
+  bool   exact;
 };
 
 // Get the absolute path to the geoid. It is normally in the share/geoids
@@ -214,7 +318,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
          "Output using double precision (64 bit) instead of float (32 bit).")
     ("reverse-adjustment",
                         po::bool_switch(&opt.reverse_adjustment)->default_value(false)->implicit_value(true),
-        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.");
+        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.")
+    ("exact",           po::bool_switch(&opt.exact)->default_value(false)->implicit_value(true),
+        "Find the geoid height at every DEM pixel, rather than on a grid finer than the geoid, with bilinear interpolation in between.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -453,11 +559,19 @@ int main( int argc, char *argv[] ) {
     //vw_out() << "Input DEM georef: " << dem_georef << std::endl;
     //vw_out() << "Geoid georef: " << geoid_georef << std::endl;
 
+    int grid_spacing = 1;
+    if (!opt.exact)
+      grid_spacing = geoid_grid_spacing(dem_georef, Vector2i(dem_img.cols(), dem_img.rows()),
+                                        geoid_georef);
+    vw_out() << "Finding the geoid height on a grid with spacing of "
+             << grid_spacing << " pixels.\n";
+
     // Set up conversion image view
     ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef,
                                              is_egm2008, egm2008_grid,
                                              geoid, geoid_georef,
-                                             reverse_adjustment, major_correction, dem_nodata_val);
+                                             reverse_adjustment, major_correction, dem_nodata_val,
+                                             grid_spacing);
 
     string adj_dem_file = opt.out_prefix + "-adj.tif";
     vw_out() << "Writing adjusted DEM: " << adj_dem_file << endl;
@@ -42,12 +42,16 @@
 #include <algorithm>
 
 #include <vw/FileIO/DiskImageManager.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/InpaintView.h>
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/Filter.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/CompressedBlockCache.h>
+#include <asp/Core/FileUtils.h>
+#include <asp/Core/MemoryBudget.h>
 
 
 #include <boost/math/special_functions/fpclassify.hpp>
@@ -56,6 +60,8 @@
 
 #include <boost/filesystem/convenience.hpp>
 
+#include <gdal.h>
+
 using namespace std;
 using namespace vw;
 using namespace vw::cartography;
@@ -216,6 +222,40 @@ struct BigOrZero: public ReturnFixedType<PixelT> {
   }
 };
 
+// Convolve each row of an image with a symmetric kernel, writing the
+// result transposed, so that calling this twice does the 2D separable
+// convolution. Pixels outside the image are zero. Where the kernel
+// covers only equal values the result is that value, so it is not
+// computed. Since the weights are capped, they are constant away from
+// the DEM boundaries, so this saves most of the work for large kernels.
+void convolve_rows_transposed(ImageView<double> const& in, std::vector<double> const& kernel,
+                              ImageView<double> & out) {
+  int cols = in.cols(), rows = in.rows();
+  int half = int(kernel.size())/2;
+  out.set_size(rows, cols);
+  std::vector<int> run_beg(cols), run_end(cols);
+  for (int row = 0; row < rows; row++) {
+
+    // The first and last index of the run of equal values containing each pixel
+    for (int col = 0; col < cols; col++)
+      run_beg[col] = (col > 0 && in(col, row) == in(col - 1, row)) ? run_beg[col - 1] : col;
+    for (int col = cols - 1; col >= 0; col--)
+      run_end[col] = (col < cols - 1 && in(col, row) == in(col + 1, row)) ? run_end[col + 1] : col;
+
+    for (int col = 0; col < cols; col++) {
+      if (run_beg[col] <= col - half && run_end[col] >= col + half) {
+        out(row, col) = in(col, row);
+        continue;
+      }
+      double sum = 0.0;
+      int beg = std::max(col - half, 0), end = std::min(col + half, cols - 1);
+      for (int c = beg; c <= end; c++)
+        sum += kernel[c - col + half] * in(c, row);
+      out(row, col) = sum;
+    }
+  }
+}
+
 void blur_weights(ImageView<double> & weights, double sigma){
 
   if (sigma <= 0)
@@ -248,7 +288,21 @@ void blur_weights(ImageView<double> & weights, double sigma){
     }
   }
 
-  ImageView<double> blurred_wts = gaussian_filter(extra_wts, sigma);
+  // The same Gaussian kernel as gaussian_filter() would use
+  int kernel_size = 2*half_kernel + 1;
+  std::vector<double> kernel(kernel_size);
+  double kernel_sum = 0.0;
+  for (int k = 0; k < kernel_size; k++) {
+    double x = k - half_kernel;
+    kernel[k] = exp(-x*x/(2.0*sigma*sigma));
+    kernel_sum += kernel[k];
+  }
+  for (int k = 0; k < kernel_size; k++)
+    kernel[k] /= kernel_sum;
+
+  ImageView<double> transposed_wts, blurred_wts;
+  convolve_rows_transposed(extra_wts, kernel, transposed_wts);
+  convolve_rows_transposed(transposed_wts, kernel, blurred_wts);
 
   // Copy back.  The weights must not grow. In particular, where the
   // original weights were zero, the new weights must also be zero, as
@@ -318,36 +372,39 @@ std::string processed_proj4(std::string const& srs){
 }
 
 struct Options: vw::cartography::GdalWriteOptions {
-  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference;
-  vector<string> dem_files;
+  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference,
+    tile_plan_file, weights_cache_dir, stack_stats_str, dem_times_file;
+  vector<string> dem_files, stack_stats;
+  vector<double> dem_times;
   double tr, geo_tile_size;
   bool   has_out_nodata, force_projwin;
   double out_nodata_value;
   int    tile_size, tile_index, erode_len, priority_blending_len,
-         extra_crop_len, hole_fill_len, block_size, save_dem_weight;
+         extra_crop_len, hole_fill_len, block_size, save_dem_weight, median_sample_size;
   double weights_exp, weights_blur_sigma, dem_blur_sigma;
   double nodata_threshold;
   bool   first, last, min, max, block_max, mean, stddev, median, nmad,
          count, save_index_map, use_centerline_weights,
-         first_dem_as_reference, propagate_nodata, no_border_blend;
+         first_dem_as_reference, propagate_nodata, no_border_blend, overviews, cog;
   std::set<int> tile_list;
   BBox2 projwin;
   Options(): tr(0), geo_tile_size(0), has_out_nodata(false), force_projwin(false), tile_index(-1),
              erode_len(0), priority_blending_len(0), extra_crop_len(0),
-             hole_fill_len(0), block_size(0), save_dem_weight(-1), 
+             hole_fill_len(0), block_size(0), save_dem_weight(-1), median_sample_size(0),
              weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
              nodata_threshold(std::numeric_limits<double>::quiet_NaN()),
              first(false), last(false), min(false), max(false), block_max(false),
              mean(false), stddev(false), median(false), nmad(false),
              count(false), save_index_map(false),
-             use_centerline_weights(false), first_dem_as_reference(false), projwin(BBox2()) {}
+             use_centerline_weights(false), first_dem_as_reference(false),
+             overviews(false), cog(false), projwin(BBox2()) {}
 };
 
 /// Return the number of no-blending options selected.
 int no_blend(Options const& opt){
   return int(opt.first) + int(opt.last) + int(opt.min) + int(opt.max)
     + int(opt.mean) + int(opt.stddev) + int(opt.median)
-    + int(opt.nmad) + int(opt.count) + int(opt.block_max);
+    + int(opt.nmad) + int(opt.count) + int(opt.block_max) + int(!opt.stack_stats.empty());
 }
 
 std::string tile_suffix(Options const& opt){
@@ -362,12 +419,512 @@ std::string tile_suffix(Options const& opt){
   if (opt.median   ) ans = "-median";
   if (opt.nmad     ) ans = "-nmad";
   if (opt.count    ) ans = "-count";
+  if (!opt.stack_stats.empty()) ans = "-stack";
   if (opt.save_index_map)       ans += "-index-map";
   if (opt.save_dem_weight >= 0) ans += "-weight-dem-index-" + stringify(opt.save_dem_weight);
 
   return ans;
 }
 
+/// A uniform grid over the output mosaic pixels, listing for each cell
+/// the input DEMs whose footprint intersects it, so that each output
+/// tile is compared only with the DEMs near it. DEMs with an unknown
+/// footprint are always listed.
+class DemFootprintIndex {
+  BBox2i m_domain;
+  int    m_cell_size, m_num_cols, m_num_rows;
+  std::vector< std::vector<int> > m_cells;
+  std::vector<int> m_always;
+
+  // The range of cells intersecting a box, which must be non-empty
+  // after cropping to the domain.
+  BBox2i cell_range(BBox2i box) const {
+    box.crop(m_domain);
+    Vector2i beg = (box.min() - m_domain.min())/m_cell_size;
+    Vector2i end = (box.max() - Vector2i(1, 1) - m_domain.min())/m_cell_size + Vector2i(1, 1);
+    return BBox2i(beg, end);
+  }
+
+public:
+  DemFootprintIndex(): m_cell_size(1), m_num_cols(0), m_num_rows(0){}
+
+  void build(std::vector<BBox2i> const& footprints, BBox2i const& domain, int cell_size) {
+    m_domain    = domain;
+    m_cell_size = std::max(cell_size, 1);
+    m_num_cols  = std::max((domain.width()  + m_cell_size - 1)/m_cell_size, 1);
+    m_num_rows  = std::max((domain.height() + m_cell_size - 1)/m_cell_size, 1);
+    m_cells.clear();
+    m_cells.resize(m_num_cols*m_num_rows);
+    m_always.clear();
+
+    for (int dem_iter = 0; dem_iter < (int)footprints.size(); dem_iter++) {
+      BBox2i box = footprints[dem_iter];
+      if (box.empty()) {
+        m_always.push_back(dem_iter);
+        continue;
+      }
+      box.crop(m_domain);
+      if (box.empty())
+        continue; // does not reach the mosaic
+      BBox2i range = cell_range(box);
+      for (int row = range.min().y(); row < range.max().y(); row++)
+        for (int col = range.min().x(); col < range.max().x(); col++)
+          m_cells[row*m_num_cols + col].push_back(dem_iter);
+    }
+  }
+
+  /// The DEMs which may intersect the given box, in increasing order
+  void query(BBox2i const& box, std::vector<int> & dems) const {
+    dems = m_always;
+    BBox2i cropped = box;
+    cropped.crop(m_domain);
+    if (!cropped.empty()) {
+      BBox2i range = cell_range(cropped);
+      for (int row = range.min().y(); row < range.max().y(); row++)
+        for (int col = range.min().x(); col < range.max().x(); col++) {
+          std::vector<int> const& cell = m_cells[row*m_num_cols + col];
+          dems.insert(dems.end(), cell.begin(), cell.end());
+        }
+    }
+    std::sort(dems.begin(), dems.end());
+    dems.erase(std::unique(dems.begin(), dems.end()), dems.end());
+  }
+};
+
+/// Whether a DEM height is valid, with the no-data threshold applied
+/// as when blending.
+inline bool is_valid_height(double val, double nodata_value, bool use_threshold) {
+  if (std::isnan(val))
+    return false;
+  if (use_threshold)
+    return val > nodata_value;
+  return val != nodata_value;
+}
+
+/// The grassfire weights of a DEM in the given box, capped at the given
+/// value. They are found from the box grown by the cap, which gives the
+/// same result as using the whole DEM, with much less memory.
+ImageView<double> capped_grassfire(ImageViewRef<double> const& dem, BBox2i const& box,
+                                   int cap, double nodata_value, bool use_threshold,
+                                   bool no_border_blend) {
+  BBox2i grown_box = box;
+  grown_box.expand(cap + 1);
+  grown_box.crop(bounding_box(dem));
+
+  ImageView<double> vals = crop(dem, grown_box);
+  ImageView<uint8> mask(vals.cols(), vals.rows());
+  for (int col = 0; col < vals.cols(); col++) {
+    for (int row = 0; row < vals.rows(); row++) {
+      mask(col, row) = is_valid_height(vals(col, row), nodata_value, use_threshold);
+    }
+  }
+
+  ImageView<double> grown_wts = grassfire(mask, no_border_blend);
+  ImageView<double> wts = crop(grown_wts, box.min().x() - grown_box.min().x(),
+                               box.min().y() - grown_box.min().y(),
+                               box.width(), box.height());
+  for (int col = 0; col < wts.cols(); col++) {
+    for (int row = 0; row < wts.rows(); row++) {
+      wts(col, row) = std::min(wts(col, row), double(cap));
+    }
+  }
+  return wts;
+}
+
+/// The center and width of the valid region of a DEM, after erosion,
+/// in each row and column, as used for centerline weights.
+struct CenterlineExtents {
+  std::vector<int> min_in_row, max_in_row, min_in_col, max_in_col;
+  std::vector<double> h_center, h_max_dist, v_center, v_max_dist;
+};
+
+/// A pixel is valid for centerline weights if it survives the erosion
+ImageView<uint8> eroded_mask(ImageViewRef<double> const& dem, BBox2i const& box,
+                             Options const& opt, double nodata_value) {
+  bool use_threshold = !boost::math::isnan(opt.nodata_threshold);
+  ImageView<double> wts = capped_grassfire(dem, box, opt.erode_len + 1, nodata_value,
+                                           use_threshold, opt.no_border_blend);
+  ImageView<uint8> mask(wts.cols(), wts.rows());
+  for (int col = 0; col < wts.cols(); col++) {
+    for (int row = 0; row < wts.rows(); row++) {
+      mask(col, row) = (wts(col, row) > opt.erode_len);
+    }
+  }
+  return mask;
+}
+
+/// Find the extent of the eroded valid region in each row and column of
+/// a block of a DEM, and merge it into the extents of the whole DEM.
+class CenterlineExtentsTask: public Task, private boost::noncopyable {
+  ImageViewRef<double> m_dem;
+  BBox2i               m_box;
+  Options      const&  m_opt;
+  double               m_nodata_value;
+  CenterlineExtents  & m_extents;
+  Mutex              & m_mutex;
+public:
+  CenterlineExtentsTask(ImageViewRef<double> dem, BBox2i const& box, Options const& opt,
+                        double nodata_value, CenterlineExtents & extents, Mutex & mutex):
+    m_dem(dem), m_box(box), m_opt(opt), m_nodata_value(nodata_value),
+    m_extents(extents), m_mutex(mutex) {}
+
+  virtual void operator()() {
+    ImageView<uint8> mask = eroded_mask(m_dem, m_box, m_opt, m_nodata_value);
+
+    Mutex::Lock lock(m_mutex);
+    for (int row = 0; row < mask.rows(); row++) {
+      for (int col = 0; col < mask.cols(); col++) {
+        if (!mask(col, row))
+          continue;
+        int c = col + m_box.min().x(), r = row + m_box.min().y();
+        m_extents.min_in_row[r] = std::min(m_extents.min_in_row[r], c);
+        m_extents.max_in_row[r] = std::max(m_extents.max_in_row[r], c);
+        m_extents.min_in_col[c] = std::min(m_extents.min_in_col[c], r);
+        m_extents.max_in_col[c] = std::max(m_extents.max_in_col[c], r);
+      }
+    }
+  }
+};
+
+/// The blending weights of a DEM, before they are capped, eroded,
+/// blurred, and raised to a power for each tile. These are the grassfire
+/// weights capped at the bias, or the centerline weights of the eroded
+/// DEM, with -1 where it is not valid. The centerline weights are found
+/// from the whole DEM, rather than from the region seen by a tile.
+class DemWeightsView: public ImageViewBase<DemWeightsView> {
+  ImageViewRef<double> m_dem;
+  Options       const& m_opt;
+  double               m_nodata_value;
+  int                  m_bias;
+  boost::shared_ptr<CenterlineExtents> m_extents;
+
+public:
+  DemWeightsView(ImageViewRef<double> dem, Options const& opt, double nodata_value, int bias,
+                 boost::shared_ptr<CenterlineExtents> extents):
+    m_dem(dem), m_opt(opt), m_nodata_value(nodata_value), m_bias(bias), m_extents(extents) {}
+
+  typedef RealT      pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<DemWeightsView> pixel_accessor;
+  inline int cols  () const { return m_dem.cols(); }
+  inline int rows  () const { return m_dem.rows(); }
+  inline int planes() const { return 1; }
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "DemWeightsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i bbox) const {
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    if (!m_opt.use_centerline_weights) {
+      bool use_threshold = !boost::math::isnan(m_opt.nodata_threshold);
+      tile = pixel_cast<pixel_type>(capped_grassfire(m_dem, bbox, m_bias, m_nodata_value,
+                                                     use_threshold, m_opt.no_border_blend));
+    } else {
+      ImageView<uint8> mask = eroded_mask(m_dem, bbox, m_opt, m_nodata_value);
+      CenterlineExtents const& ext = *m_extents;
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++) {
+          Vector2 pix(col + bbox.min().x(), row + bbox.min().y());
+          double weight = -1.0;
+          if (mask(col, row)) {
+            double weight_h = compute_line_weights(pix, true,  ext.h_center, ext.h_max_dist);
+            double weight_v = compute_line_weights(pix, false, ext.v_center, ext.v_max_dist);
+            weight = weight_h*weight_v;
+          }
+          tile(col, row) = weight;
+        }
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// The file in the weights cache for the given DEM. The key has the DEM
+/// path, size, and modification time, and the options the weights depend on.
+std::string weights_cache_file(Options const& opt, std::string const& dem_file,
+                               double nodata_value, int bias) {
+  std::ostringstream os;
+  os.precision(17);
+  os << asp::file_fingerprint(dem_file) << "\n"
+     << nodata_value << " " << !boost::math::isnan(opt.nodata_threshold) << " "
+     << opt.no_border_blend << " " << opt.use_centerline_weights << " ";
+  if (opt.use_centerline_weights)
+    os << opt.erode_len;
+  else
+    os << bias;
+  return opt.weights_cache_dir + "/"
+    + asp::content_hash(std::vector<std::string>(), os.str()) + "-weights.tif";
+}
+
+/// Compute the blending weights of a DEM and save them to the cache,
+/// with overviews, for inspection. Write to a temporary file first, so
+/// that concurrent runs never see a partial file.
+void save_dem_weights(Options const& opt, std::string const& dem_file, double nodata_value,
+                      int bias, int block_size, std::string const& weight_file) {
+
+  ImageViewRef<double> dem = pixel_cast<double>(DiskImageView<RealT>(dem_file));
+
+  boost::shared_ptr<CenterlineExtents> extents(new CenterlineExtents);
+  if (opt.use_centerline_weights) {
+    int cols = dem.cols(), rows = dem.rows();
+    CenterlineExtents & ext = *extents;
+    ext.min_in_row.assign(rows, cols); ext.max_in_row.assign(rows, 0);
+    ext.min_in_col.assign(cols, rows); ext.max_in_col.assign(cols, 0);
+
+    Mutex mutex;
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    std::vector<BBox2i> blocks = subdivide_bbox(dem, block_size, block_size);
+    for (size_t it = 0; it < blocks.size(); it++) {
+      boost::shared_ptr<CenterlineExtentsTask>
+        task(new CenterlineExtentsTask(dem, blocks[it], opt, nodata_value, ext, mutex));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    // As in centerline_weights2()
+    ext.h_center.resize(rows); ext.h_max_dist.resize(rows);
+    for (int row = 0; row < rows; row++) {
+      ext.h_center  [row] = (ext.min_in_row[row] + ext.max_in_row[row])/2.0;
+      ext.h_max_dist[row] = std::max(ext.max_in_row[row] - ext.min_in_row[row], 0);
+    }
+    ext.v_center.resize(cols); ext.v_max_dist.resize(cols);
+    for (int col = 0; col < cols; col++) {
+      ext.v_center  [col] = (ext.min_in_col[col] + ext.max_in_col[col])/2.0;
+      ext.v_max_dist[col] = std::max(ext.max_in_col[col] - ext.min_in_col[col], 0);
+    }
+  }
+
+  std::ostringstream tmp_file;
+  tmp_file << weight_file << ".tmp" << getpid() << ".tif";
+
+  vw_out() << "Writing: " << weight_file << std::endl;
+  bool has_georef = true, has_nodata = false;
+  GeoReference georef = read_georef(dem_file);
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  block_write_gdal_image(tmp_file.str(),
+                         DemWeightsView(dem, opt, nodata_value, bias, extents),
+                         has_georef, georef, has_nodata, 0, opt, tpc);
+
+  GDALAllRegister();
+  GDALDatasetH ds = GDALOpen(tmp_file.str().c_str(), GA_Update);
+  if (ds != NULL) {
+    int levels[] = {2, 4, 8, 16, 32};
+    if (GDALBuildOverviews(ds, "AVERAGE", int(sizeof(levels)/sizeof(int)), levels,
+                           0, NULL, NULL, NULL) != CE_None)
+      vw_out(WarningMessage) << "Could not build overviews for: " << weight_file << "\n";
+    GDALClose(ds);
+  }
+
+  if (fs::exists(weight_file))
+    fs::remove(tmp_file.str()); // Another run got there first
+  else
+    fs::rename(tmp_file.str(), weight_file);
+}
+
+/// The statistics which can be found with --stack-stats, in the
+/// order of the StackStatType values
+const char * g_stack_stat_names[] = {"count", "mean", "stddev", "min", "max", "first",
+                                     "last", "first-time", "last-time", "trend"};
+enum StackStatType {STACK_COUNT, STACK_MEAN, STACK_STDDEV, STACK_MIN, STACK_MAX, STACK_FIRST,
+                    STACK_LAST, STACK_FIRST_TIME, STACK_LAST_TIME, STACK_TREND, NUM_STACK_STATS};
+
+/// The type of a statistic given by name, or -1 if there is no such statistic
+int stack_stat_type(std::string const& name) {
+  for (int it = 0; it < NUM_STACK_STATS; it++) {
+    if (name == g_stack_stat_names[it])
+      return it;
+  }
+  return -1;
+}
+
+/// Accumulate at each pixel of a tile the statistics of the stack of
+/// DEM heights, in one pass over the DEMs. Each DEM has a time, used
+/// for the first and last values and the linear trend. Only the
+/// accumulators needed for the requested statistics are allocated.
+class StackStats {
+  std::vector<int> m_stats;
+  double m_nodata, m_time_origin;
+  bool m_moments, m_minmax, m_first, m_last, m_trend;
+  ImageView<double> m_count, m_mean, m_m2, m_min, m_max, m_first_val, m_first_time,
+    m_last_val, m_last_time, m_sum_t, m_sum_tt, m_sum_th;
+
+  bool needs(int a, int b = -1, int c = -1) {
+    for (size_t it = 0; it < m_stats.size(); it++) {
+      if (m_stats[it] == a || m_stats[it] == b || m_stats[it] == c)
+        return true;
+    }
+    return false;
+  }
+
+  void alloc(ImageView<double> & img, int cols, int rows) {
+    img.set_size(cols, rows);
+    fill(img, 0.0);
+  }
+
+public:
+  StackStats(int cols, int rows, std::vector<std::string> const& stats,
+             double nodata, double time_origin):
+    m_nodata(nodata), m_time_origin(time_origin) {
+    for (size_t it = 0; it < stats.size(); it++)
+      m_stats.push_back(stack_stat_type(stats[it]));
+    m_moments = needs(STACK_MEAN, STACK_STDDEV, STACK_TREND);
+    m_minmax  = needs(STACK_MIN, STACK_MAX);
+    m_first   = needs(STACK_FIRST, STACK_FIRST_TIME);
+    m_last    = needs(STACK_LAST, STACK_LAST_TIME);
+    m_trend   = needs(STACK_TREND);
+    alloc(m_count, cols, rows);
+    if (m_moments) { alloc(m_mean, cols, rows); alloc(m_m2, cols, rows); }
+    if (m_minmax)  { alloc(m_min, cols, rows); alloc(m_max, cols, rows); }
+    if (m_first)   { alloc(m_first_val, cols, rows); alloc(m_first_time, cols, rows); }
+    if (m_last)    { alloc(m_last_val,  cols, rows); alloc(m_last_time,  cols, rows); }
+    if (m_trend)   {
+      alloc(m_sum_t, cols, rows); alloc(m_sum_tt, cols, rows); alloc(m_sum_th, cols, rows);
+    }
+  }
+
+  /// Add a valid height at a pixel. The DEMs are added in the input order,
+  /// so for equal times the first and last values follow that order.
+  void add(int col, int row, double val, double time) {
+    double n = ++m_count(col, row);
+    bool is_first = (n == 1);
+    if (m_moments) { // Welford's running mean and sum of squared differences
+      double delta = val - m_mean(col, row);
+      m_mean(col, row) += delta/n;
+      m_m2(col, row)   += delta*(val - m_mean(col, row));
+    }
+    if (m_minmax) {
+      if (is_first || val < m_min(col, row)) m_min(col, row) = val;
+      if (is_first || val > m_max(col, row)) m_max(col, row) = val;
+    }
+    if (m_first && (is_first || time < m_first_time(col, row))) {
+      m_first_val(col, row) = val;
+      m_first_time(col, row) = time;
+    }
+    if (m_last && (is_first || time >= m_last_time(col, row))) {
+      m_last_val(col, row) = val;
+      m_last_time(col, row) = time;
+    }
+    if (m_trend) { // Shift the times for numerical stability
+      double t = time - m_time_origin;
+      m_sum_t (col, row) += t;
+      m_sum_tt(col, row) += t*t;
+      m_sum_th(col, row) += t*val;
+    }
+  }
+
+  bool is_valid(int col, int row) const { return m_count(col, row) > 0; }
+  int num_stats() const { return m_stats.size(); }
+
+  /// The value of the given statistic, or no-data if it cannot be found
+  double value(int stat_index, int col, int row) const {
+    double n = m_count(col, row);
+    if (n <= 0)
+      return m_nodata;
+    switch (m_stats[stat_index]) {
+    case STACK_COUNT:      return n;
+    case STACK_MEAN:       return m_mean(col, row);
+    case STACK_MIN:        return m_min(col, row);
+    case STACK_MAX:        return m_max(col, row);
+    case STACK_FIRST:      return m_first_val(col, row);
+    case STACK_LAST:       return m_last_val(col, row);
+    case STACK_FIRST_TIME: return m_first_time(col, row);
+    case STACK_LAST_TIME:  return m_last_time(col, row);
+    case STACK_STDDEV:
+      if (n <= 1)
+        return m_nodata;
+      return sqrt(m_m2(col, row)/(n - 1.0));
+    case STACK_TREND: { // Least squares slope of height versus time
+      double sum_t = m_sum_t(col, row);
+      double denom = n*m_sum_tt(col, row) - sum_t*sum_t;
+      if (n <= 1 || denom <= g_tol*n*m_sum_tt(col, row))
+        return m_nodata; // all times are the same
+      return (n*m_sum_th(col, row) - sum_t*n*m_mean(col, row))/denom;
+    }
+    default:
+      vw_throw(ArgumentErr() << "Unknown stack statistic.\n");
+    }
+    return m_nodata;
+  }
+};
+
+/// The valid values of a stack of DEMs at each pixel of a tile, for the
+/// median and NMAD. Up to a given number of values per pixel are kept
+/// exactly, at the float precision of the output. Beyond that, a uniform
+/// random sample of that size is kept (reservoir sampling), so the memory
+/// used per pixel is bounded. The random choices depend only on the pixel
+/// and on how many values it has seen, so the result does not depend on
+/// the tiling or the number of threads.
+class PixelValueStack {
+  Vector2i m_origin;
+  int      m_max_depth;
+  bool     m_keep_indices;
+  ImageView<int> m_count;
+  std::vector< ImageView<float> > m_values;
+  std::vector< ImageView<int> >   m_indices;
+
+  static uint64 hash(uint64 x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+public:
+  PixelValueStack(BBox2i const& bbox, int max_depth, bool keep_indices):
+    m_origin(bbox.min()), m_max_depth(std::max(max_depth, 1)), m_keep_indices(keep_indices),
+    m_count(bbox.width(), bbox.height()) {
+    fill(m_count, 0);
+  }
+
+  /// Add the value at a pixel of the tile, and the index of its DEM
+  void add(int col, int row, double val, int index) {
+    int & count = m_count(col, row);
+    int slot = count;
+    if (count >= m_max_depth) {
+      // Keep the new value with probability max_depth/(count + 1)
+      uint64 key = hash(hash(hash(uint64(int64(m_origin.x() + col))) ^
+                             uint64(int64(m_origin.y() + row))) ^ uint64(count));
+      slot = int(key % uint64(count + 1));
+    }
+    count++;
+    if (slot >= m_max_depth)
+      return;
+
+    // Allocate the layers only as deep as needed
+    while ((int)m_values.size() <= slot) {
+      m_values.push_back(ImageView<float>(m_count.cols(), m_count.rows()));
+      if (m_keep_indices)
+        m_indices.push_back(ImageView<int>(m_count.cols(), m_count.rows()));
+    }
+    m_values[slot](col, row) = val;
+    if (m_keep_indices)
+      m_indices[slot](col, row) = index;
+  }
+
+  /// The values kept at a pixel, and their DEM indices if these are kept
+  void values(int col, int row, std::vector<double> & vals, std::vector<int> & indices) const {
+    int depth = std::min(m_count(col, row), m_max_depth);
+    vals.resize(depth);
+    indices.resize(m_keep_indices ? depth : 0);
+    for (int it = 0; it < depth; it++) {
+      vals[it] = m_values[it](col, row);
+      if (m_keep_indices)
+        indices[it] = m_indices[it](col, row);
+    }
+  }
+};
+
 /// Class that does the actual image processing work
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
@@ -377,6 +934,9 @@ class DemMosaicView: public ImageViewBase<DemMosaicView>{
   GeoReference                   m_out_georef;
   vector<double>          const& m_nodata_values;    // alias
   vector<BBox2i>          const& m_dem_pixel_bboxes; // alias
+  DemFootprintIndex       const& m_dem_index;        // alias
+  vector<string>          const& m_weight_files;     // alias, empty if not cached
+  vector<double>          const& m_dem_times;        // alias, for --stack-stats
   long long int                & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                    & m_count_mutex;      // alias, a lock for m_num_valid_pixels
 
@@ -388,12 +948,17 @@ public:
                 GeoReference           const& out_georef,
                 vector<double>         const& nodata_values,
                 vector<BBox2i>         const& dem_pixel_bboxes,
+                DemFootprintIndex      const& dem_index,
+                vector<string>         const& weight_files,
+                vector<double>         const& dem_times,
                 long long int               & num_valid_pixels,
                 vw::Mutex                   & count_mutex):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
     m_imgMgr(imgMgr), m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
-    m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
+    m_dem_pixel_bboxes(dem_pixel_bboxes), m_dem_index(dem_index),
+    m_weight_files(weight_files), m_dem_times(dem_times),
+    m_num_valid_pixels(num_valid_pixels),
     m_count_mutex(count_mutex) {
 
     // How many valid pixels we will have
@@ -437,7 +1002,7 @@ public:
   typedef ProceduralPixelAccessor<DemMosaicView> pixel_accessor;
   inline int cols  () const { return m_cols; }
   inline int rows  () const { return m_rows; }
-  inline int planes() const { return 1; }
+  inline int planes() const { return std::max(int(m_opt.stack_stats.size()), 1); }
   inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
 
   inline pixel_type operator()( double/*i*/, double/*j*/, int/*p*/ = 0 ) const {
@@ -459,6 +1024,10 @@ public:
     if (use_priority_blend)
       bbox.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
 
+    // Track the output tile and weights against the memory budget
+    asp::MemoryReservation reservation(2.0 * sizeof(double) * bbox.width() * bbox.height()
+                                       / (1024.0 * 1024.0), "a block of the DEM mosaic");
+
     // We will do all computations in double precision, regardless
     // of the precision of the inputs, for increased accuracy.
     // - The image data buffers are initialized here
@@ -475,8 +1044,19 @@ public:
     // - Used for median, nmad, and stddev calculation.
     std::vector< ImageView<double> > tile_vec, weight_vec;
     std::vector< std::string > dem_vec;
-    if (m_opt.median || m_opt.nmad) // Store each input separately
-      tile_vec.reserve(m_imgMgr.size());
+    boost::shared_ptr<PixelValueStack> value_stack;
+    if (m_opt.median || m_opt.nmad) // Store the valid inputs at each pixel
+      value_stack.reset(new PixelValueStack(bbox, m_opt.median_sample_size,
+                                            m_opt.save_index_map));
+    bool use_stack_stats = !m_opt.stack_stats.empty();
+    boost::shared_ptr<StackStats> stack_stats;
+    if (use_stack_stats) { // All statistics in one pass over the DEMs
+      double time_origin = 0.0;
+      for (size_t it = 0; it < m_dem_times.size(); it++)
+        time_origin += m_dem_times[it]/m_dem_times.size();
+      stack_stats.reset(new StackStats(bbox.width(), bbox.height(), m_opt.stack_stats,
+                                       m_opt.out_nodata_value, time_origin));
+    }
     if (m_opt.stddev) { // Need one working image
       tile_vec.push_back(ImageView<double>(bbox.width(), bbox.height()));
       // Each pixel starts at zero, nodata is handled later
@@ -524,8 +1104,11 @@ public:
     ImageView<double> first_dem;
     ImageView<double> local_wts_orig;
 
-    // Loop through all input DEMs
-    for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++){
+    // Loop through the input DEMs which may intersect this tile, in order
+    std::vector<int> dem_indices;
+    m_dem_index.query(bbox, dem_indices);
+    for (size_t index_iter = 0; index_iter < dem_indices.size(); index_iter++){
+      int dem_iter = dem_indices[index_iter];
 
       // Load the information for this DEM
       GeoReference georef        = m_georefs         [dem_iter];
@@ -552,7 +1135,8 @@ public:
       if (in_box.width() <= 1 || in_box.height() <= 1)
         continue; // No overlap with this tile, skip to the next DEM.
 
-      if (m_opt.median || m_opt.nmad || use_priority_blend || m_opt.block_max){
+      if (m_opt.median || m_opt.nmad || use_priority_blend || m_opt.block_max ||
+          use_stack_stats){
         // Must use a blank tile each time
         fill( tile, m_opt.out_nodata_value );
         fill( weights, 0.0 );
@@ -560,7 +1144,12 @@ public:
 
       // Crop the disk dem to a 2-channel in-memory image. First
       // channel is the image pixels, second will be the weights.
-      ImageViewRef<double     > disk_dem = pixel_cast<double>(m_imgMgr.get_handle(dem_iter, bbox));
+      // The overlapping parts of neighboring tiles are read from the
+      // compressed block cache, if on.
+      std::string dem_name = m_imgMgr.get_file_name(dem_iter);
+      ImageViewRef<double     > disk_dem
+        = pixel_cast<double>(asp::compressed_cache(m_imgMgr.get_handle(dem_iter, bbox),
+                                                   dem_name));
       ImageView   <DoubleGrayA> dem      = crop(disk_dem, in_box);
 
       if (m_opt.first_dem_as_reference && dem_iter == 0) {
@@ -569,8 +1158,6 @@ public:
         first_dem = crop(disk_dem, bbox);
       }
 
-      std::string dem_name = m_imgMgr.get_file_name(dem_iter);
-
       // If the nodata_threshold is specified, all values no more than this
       // will be invalidated.
       double nodata_value = m_nodata_values[dem_iter];
@@ -607,26 +1194,32 @@ public:
         continue;
       }
 
-      // Compute linear weights
-      ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
-                                              m_opt.no_border_blend);
-      local_wts_orig = local_wts;
-      if (m_opt.use_centerline_weights) {
-        // Erode based on grassfire weights, and then overwrite the grassfire
-        // weights with centerline weights
-        ImageView<DoubleGrayA> dem2 = copy(dem);
-        for (int col = 0; col < dem2.cols(); col++) {
-          for (int row = 0; row < dem2.rows(); row++) {
-            if (local_wts(col, row) <= m_opt.erode_len) {
-              dem2(col, row) = DoubleGrayA(nodata_value);
+      // Compute linear weights, or read them from the cache
+      ImageView<double> local_wts;
+      if (!m_weight_files.empty() && m_weight_files[dem_iter] != "") {
+        local_wts = crop(pixel_cast<double>(DiskImageView<RealT>(m_weight_files[dem_iter])),
+                         in_box);
+      } else {
+        local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
+                              m_opt.no_border_blend);
+        local_wts_orig = local_wts;
+        if (m_opt.use_centerline_weights) {
+          // Erode based on grassfire weights, and then overwrite the grassfire
+          // weights with centerline weights
+          ImageView<DoubleGrayA> dem2 = copy(dem);
+          for (int col = 0; col < dem2.cols(); col++) {
+            for (int row = 0; row < dem2.rows(); row++) {
+              if (local_wts(col, row) <= m_opt.erode_len) {
+                dem2(col, row) = DoubleGrayA(nodata_value);
+              }
             }
           }
-        }
-        // TODO: Generalize this modification and move it to VW!!!
-        centerline_weights2
-                (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
-                 local_wts, -1.0);
-      } // End centerline weights case
+          // TODO: Generalize this modification and move it to VW!!!
+          centerline_weights2
+            (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
+             local_wts, -1.0);
+        } // End centerline weights case
+      }
 
       // If we don't limit the weights from above, we will have tiling artifacts,
       // as in different tiles the weights grow to different heights since
@@ -791,7 +1384,7 @@ public:
                m_opt.last                                         ||
                ( m_opt.min && ( val < tile(c, r) || is_nodata ) ) ||
                ( m_opt.max && ( val > tile(c, r) || is_nodata ) ) ||
-               m_opt.median || m_opt.nmad || 
+               m_opt.median || m_opt.nmad || use_stack_stats ||
                use_priority_blend   || m_opt.block_max){
             // --> Conditions where we replace the current value
             tile   (c, r) = val;
@@ -837,10 +1430,29 @@ public:
         } // End col loop
       } // End row loop
 
-      // For the median option, keep a copy of the output tile for each input DEM!
-      // Also do it for max per block.
+      // For the median option, add the valid values of this DEM to the stack
+      if (m_opt.median || m_opt.nmad) {
+        for (int c = 0; c < bbox.width(); c++) {
+          for (int r = 0; r < bbox.height(); r++) {
+            if (tile(c, r) != m_opt.out_nodata_value)
+              value_stack->add(c, r, tile(c, r), dem_iter);
+          }
+        }
+      }
+
+      // Accumulate the statistics of the stack
+      if (use_stack_stats) {
+        for (int c = 0; c < bbox.width(); c++) {
+          for (int r = 0; r < bbox.height(); r++) {
+            if (tile(c, r) != m_opt.out_nodata_value)
+              stack_stats->add(c, r, tile(c, r), m_dem_times[dem_iter]);
+          }
+        }
+      }
+
+      // For max per block, keep a copy of the output tile for each input DEM.
       // - This will be memory intensive. 
-      if (m_opt.median || m_opt.nmad || m_opt.block_max) {
+      if (m_opt.block_max) {
         tile_vec.push_back(copy(tile));
         dem_vec.push_back(dem_name);
       }
@@ -889,22 +1501,16 @@ public:
     if (m_opt.median || m_opt.nmad){
       // Init output pixels to nodata
       fill( tile, m_opt.out_nodata_value );
-      vector<double> vals, vals_all(tile_vec.size());
+      vector<double> vals, vals_all;
+      vector<int> indices;
       // Iterate through all pixels
       for (int c = 0; c < bbox.width(); c++){
         for (int r = 0; r < bbox.height(); r++){
           // Compute the median for this pixel
-          vals.clear();
-          for (int i = 0; i < (int)tile_vec.size(); i++){
-            ImageView<double> & tile_ref = tile_vec[i];
-            double this_val = tile_ref(c, r);
-            vals_all[i] = this_val; // Record the original order.
-            if (this_val == m_opt.out_nodata_value)
-              continue;
-            vals.push_back(this_val);
-          }
+          value_stack->values(c, r, vals, indices);
           if (vals.empty())
             continue;
+          vals_all = vals; // Record the original order.
           if (m_opt.median)
             tile(c, r) = math::destructive_median(vals);
           else
@@ -920,11 +1526,8 @@ public:
           for (size_t m = 0; m < vals_all.size(); m++) {
             double dist = fabs(vals_all[m] - tile(c, r));
             if (dist < min_dist) {
-	      // Here we save the index not in the current array which
-	      // is m, but in the full list of DEMs, some of which are
-	      // likely skipped in this tile as they don't intersect
-	      // it.
-              index_map(c, r) = clip2dem_index[m];
+	      // Here we save the index in the full list of DEMs
+              index_map(c, r) = indices[m];
               min_dist = dist;
             }
           }
@@ -1097,6 +1700,27 @@ public:
     if (m_opt.save_index_map)
       tile = index_map;
 
+    // Each statistic of the stack is a separate plane. A pixel is
+    // valid if any DEM was seen there.
+    if (use_stack_stats) {
+      ImageView<RealT> stats_tile(bbox.width(), bbox.height(), stack_stats->num_stats());
+      long long int num_valid_in_tile = 0;
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++) {
+          for (int p = 0; p < stack_stats->num_stats(); p++)
+            stats_tile(col, row, p) = stack_stats->value(p, col, row);
+          if (stack_stats->is_valid(col, row))
+            num_valid_in_tile++;
+        }
+      }
+      {
+        vw::Mutex::Lock lock(m_count_mutex);
+        m_num_valid_pixels += num_valid_in_tile;
+      }
+      return prerasterize_type(stats_tile, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows());
+    }
+
     // How many valid pixels are there in the tile
     long long int num_valid_in_tile = 0;
     for (int col = 0; col < tile.cols(); col++) {
@@ -1151,42 +1775,106 @@ public:
 }; // End class DemMosaicView
 
 
+/// Read the size, georeference, and nodata value of a DEM. The file is
+/// closed when done, so that only a few files are open at a time.
+class DemHeaderTask: public Task, private boost::noncopyable {
+  std::string    m_file;
+  double         m_default_nodata;
+  BBox2i       & m_pixel_box;
+  GeoReference & m_georef;
+  double       & m_nodata;
+  std::string  & m_error;
+  TerminalProgressCallback & m_tpc;
+  double         m_inc_amount;
+  Mutex        & m_mutex;
+public:
+  DemHeaderTask(std::string const& file, double default_nodata,
+                BBox2i & pixel_box, GeoReference & georef, double & nodata,
+                std::string & error, TerminalProgressCallback & tpc, double inc_amount,
+                Mutex & mutex):
+    m_file(file), m_default_nodata(default_nodata), m_pixel_box(pixel_box),
+    m_georef(georef), m_nodata(nodata), m_error(error), m_tpc(tpc),
+    m_inc_amount(inc_amount), m_mutex(mutex){}
+
+  virtual void operator()(){
+    try {
+      DiskImageResourceGDAL in_rsrc(m_file);
+      m_pixel_box = BBox2i(0, 0, in_rsrc.cols(), in_rsrc.rows());
+      m_nodata    = m_default_nodata;
+      if (in_rsrc.has_nodata_read())
+        m_nodata = RealT(in_rsrc.nodata_read());
+      m_georef = read_georef(m_file);
+    } catch (std::exception const& e) {
+      m_error = e.what();
+    }
+    Mutex::Lock lock(m_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
 /// Find the bounding box of all DEMs in the projected space.
 /// - mosaic_bbox is the output bounding box in projected space
 /// - dem_proj_bboxes and dem_pixel_bboxes are the locations of
 ///   each input DEM in the output DEM in projected and pixel coordinates.
+/// - Also return the georeference and nodata value of each DEM, with
+///   the output nodata value if the DEM has none. These are read in parallel.
 void load_dem_bounding_boxes(Options       const& opt,
                              GeoReference  const& mosaic_georef,
                              BBox2              & mosaic_bbox, // Projected coordinates
                              std::vector<BBox2> & dem_proj_bboxes,
-                             std::vector<BBox2i> & dem_pixel_bboxes) {
+                             std::vector<BBox2i> & dem_pixel_bboxes,
+                             std::vector<GeoReference> & dem_georefs,
+                             std::vector<double> & dem_nodata_values) {
 
   vw_out() << "Determining the bounding boxes of the input DEMs.\n";
 
   // Initialize the outputs
+  int num_dems = opt.dem_files.size();
   mosaic_bbox = BBox2();
   dem_proj_bboxes.clear();
   dem_pixel_bboxes.clear();
+  dem_pixel_bboxes.resize(num_dems);
+  dem_georefs.clear();
+  dem_georefs.resize(num_dems);
+  dem_nodata_values.clear();
+  dem_nodata_values.resize(num_dems);
   
   TerminalProgressCallback tpc("", "\t--> ");
   tpc.report_progress(0);
-  double inc_amount = 1.0 / double(opt.dem_files.size() );
+  double inc_amount = 1.0 / double(2*num_dems);
+
+  // Read the headers in parallel, as with many DEMs on a networked
+  // file system this is dominated by the latency of each file.
+  std::vector<std::string> errors(num_dems);
+  {
+    Mutex mutex;
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++){
+      boost::shared_ptr<DemHeaderTask>
+        task(new DemHeaderTask(opt.dem_files[dem_iter], opt.out_nodata_value,
+                               dem_pixel_bboxes[dem_iter], dem_georefs[dem_iter],
+                               dem_nodata_values[dem_iter], errors[dem_iter],
+                               tpc, inc_amount, mutex));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++){
+    if (errors[dem_iter] != "")
+      vw_throw(ArgumentErr() << "Failed to read: " << opt.dem_files[dem_iter] << ". "
+               << errors[dem_iter] << "\n");
+  }
 
   BBox2 first_dem_proj_box;
   
   // Loop through all DEMs
-  for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){ 
-
-    // Open a handle to this DEM file
-    DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-    DiskImageView<RealT>  img(opt.dem_files[dem_iter]);
-    GeoReference          georef = read_georef(opt.dem_files[dem_iter]);
-    BBox2i                pixel_box = bounding_box(img);
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++){ 
 
-    dem_pixel_bboxes.push_back(pixel_box);
+    GeoReference const& georef    = dem_georefs[dem_iter];
+    BBox2i       const& pixel_box = dem_pixel_bboxes[dem_iter];
 
     if (dem_iter == 0) 
-      first_dem_proj_box = georef.bounding_box(img);
+      first_dem_proj_box = georef.pixel_to_point_bbox(BBox2(pixel_box));
     
     bool has_lonat = (georef.proj4_str().find("+proj=longlat") != std::string::npos ||
                       mosaic_georef.proj4_str().find("+proj=longlat") != std::string::npos );
@@ -1195,7 +1883,7 @@ void load_dem_bounding_boxes(Options       const& opt,
     // the same projection, and it is not longlat, as then we need to worry about
     // a 360 degree shift.
     if ( (!has_lonat) && mosaic_georef.overall_proj4_str() == georef.overall_proj4_str() ){
-      BBox2 proj_box = georef.bounding_box(img);
+      BBox2 proj_box = georef.pixel_to_point_bbox(BBox2(pixel_box));
       mosaic_bbox.grow(proj_box);
       dem_proj_bboxes.push_back(proj_box);
     }else{
@@ -1204,7 +1892,7 @@ void load_dem_bounding_boxes(Options       const& opt,
       // lonlat of the mosaic so far and of the current DEM will be
       // offset by 360 degrees. Try to deal with that.
       BBox2 proj_box;
-      BBox2 imgbox = bounding_box(img);
+      BBox2 imgbox = pixel_box;
       BBox2 mosaic_pixel_box;
       
       // Get the bbox of current mosaic in pixels.
@@ -1245,6 +1933,49 @@ void load_dem_bounding_boxes(Options       const& opt,
 } // End function load_dem_bounding_boxes
 
 
+/// Save the output grid and, for each tile, the indices of the input
+/// DEMs intersecting it. A tile is then produced from only these DEMs
+/// by forcing this grid, which is how parallel_dem_mosaic distributes
+/// the work. DEMs are selected with the same test used when loading
+/// them for a tile.
+void save_tile_plan(Options const& opt, GeoReference const& mosaic_georef,
+                    BBox2 const& mosaic_bbox, double spacing,
+                    int cols, int rows, int num_tiles_x, int num_tiles_y,
+                    std::vector<BBox2> const& tile_proj_bboxes,
+                    std::vector<BBox2> const& dem_proj_bboxes) {
+
+  vw_out() << "Writing: " << opt.tile_plan_file << std::endl;
+  std::ofstream ofs(opt.tile_plan_file.c_str());
+  if (!ofs.good())
+    vw_throw(ArgumentErr() << "Cannot write: " << opt.tile_plan_file << "\n");
+  
+  ofs.precision(17);
+  ofs << "mosaic_projwin " << mosaic_bbox.min().x() << ' ' << mosaic_bbox.min().y() << ' '
+      << mosaic_bbox.max().x() << ' ' << mosaic_bbox.max().y() << "\n";
+  ofs << "spacing "   << spacing << "\n";
+  ofs << "nodata "    << opt.out_nodata_value << "\n";
+  ofs << "size "      << cols << ' ' << rows << "\n";
+  ofs << "tile_size " << opt.tile_size << "\n";
+  ofs << "num_tiles " << num_tiles_x << ' ' << num_tiles_y << "\n";
+  ofs << "proj4 "     << mosaic_georef.overall_proj4_str() << "\n";
+  for (size_t dem_iter = 0; dem_iter < opt.dem_files.size(); dem_iter++)
+    ofs << "dem " << dem_iter << ' ' << opt.dem_files[dem_iter] << "\n";
+
+  for (size_t tile_id = 0; tile_id < tile_proj_bboxes.size(); tile_id++) {
+    std::vector<int> tile_dems;
+    for (size_t dem_iter = 0; dem_iter < dem_proj_bboxes.size(); dem_iter++) {
+      if (tile_proj_bboxes[tile_id].intersects(dem_proj_bboxes[dem_iter]))
+        tile_dems.push_back(dem_iter);
+    }
+    ofs << "tile " << tile_id << ' ' << tile_dems.size();
+    for (size_t it = 0; it < tile_dems.size(); it++)
+      ofs << ' ' << tile_dems[it];
+    ofs << "\n";
+  }
+  
+  ofs.close();
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   po::options_description general_options("Options");
@@ -1288,8 +2019,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	   "Find the median DEM value (this can be memory-intensive, fewer threads are suggested).")
     ("nmad",  po::bool_switch(&opt.nmad)->default_value(false),
 	   "Find the normalized median absolute deviation DEM value (this can be memory-intensive, fewer threads are suggested).")
+    ("median-sample-size", po::value<int>(&opt.median_sample_size)->default_value(64),
+     "For --median and --nmad, keep at most this many values at each pixel. With more overlapping DEMs, the result is found from a uniform random sample of this size, with bounded memory.")
     ("count",   po::bool_switch(&opt.count)->default_value(false),
      "Each pixel is set to the number of valid DEM heights at that pixel.")
+    ("stack-stats", po::value(&opt.stack_stats_str)->default_value(""),
+     "Find these statistics of the DEM heights at each pixel, in one pass over the DEMs, and save them as the bands of one output image. Choose, in quotes, one or more of: count, mean, stddev, min, max, first, last, first-time, last-time, trend.")
+    ("dem-times-file", po::value(&opt.dem_times_file)->default_value(""),
+     "A text file with a time for each input DEM, in the input order (for example, a decimal year). Used with --stack-stats for the first and last values and times, and the trend (height change per unit of time). Default: the index of each DEM in the input order.")
     ("block-max", po::bool_switch(&opt.block_max)->default_value(false),
      "For each block of size --block-size, keep the DEM with the largest sum of values in the block.")
     ("georef-tile-size",    po::value<double>(&opt.geo_tile_size),
@@ -1320,6 +2057,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "The output DEM will have the same size, grid, and georeference as this one, but it will not be used in the mosaic.")
     ("force-projwin", po::bool_switch(&opt.force_projwin)->default_value(false),
      "Make the output mosaic fill precisely the specified projwin, by padding it if necessary and aligning the output grid to the region.")
+    ("weights-cache-dir", po::value(&opt.weights_cache_dir)->default_value(""),
+     "Save the blending weights of each input DEM in this directory, and reuse them in later runs with the same DEM and weight options. Only with regular blending.")
+    ("save-tile-plan", po::value(&opt.tile_plan_file)->default_value(""),
+     "Save to this file the output grid, the list of tiles, and for each tile the indices of the input DEMs intersecting it, then quit. Used by parallel_dem_mosaic.")
+    ("overviews", po::bool_switch(&opt.overviews)->default_value(false),
+     "Add internal overviews to each output file.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write each output file as a Cloud-Optimized GeoTIFF, with internal overviews.")
     ("save-index-map",   po::bool_switch(&opt.save_index_map)->default_value(false),
      "For each output pixel, save the index of the input DEM it came from (applicable only for --first, --last, --min, --max, --median, and --nmad). A text file with the index assigned to each input DEM is saved as well.")
     ("threads",             po::value<int>(&opt.num_threads)->default_value(4),
@@ -1356,6 +2101,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.tile_size <= 0)
     vw_throw(ArgumentErr() << "The size of a tile in pixels must be positive.\n"
                            << usage << general_options );
+  if (opt.median_sample_size <= 0)
+    vw_throw(ArgumentErr() << "The median sample size must be positive.\n"
+                           << usage << general_options );
 
   if (opt.priority_blending_len < 0)
     vw_throw(ArgumentErr() << "The priority blending length must not be negative.\n"
@@ -1364,13 +2112,36 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   // If priority blending is used, need to adjust extra_crop_len accordingly
   opt.extra_crop_len = std::max(opt.extra_crop_len, 3*opt.priority_blending_len);
 
+  // Parse the statistics to find with --stack-stats
+  std::replace(opt.stack_stats_str.begin(), opt.stack_stats_str.end(), ',', ' ');
+  opt.stack_stats.clear();
+  {
+    std::istringstream is(opt.stack_stats_str);
+    std::string stat;
+    while (is >> stat) {
+      if (stack_stat_type(stat) < 0)
+        vw_throw(ArgumentErr() << "Unknown statistic for --stack-stats: " << stat << ".\n"
+                               << usage << general_options );
+      opt.stack_stats.push_back(stat);
+    }
+  }
+
   // Make sure no more than one of these options is enabled.
   int noblend = no_blend(opt);
   if (noblend > 1)
     vw_throw(ArgumentErr() << "At most one of the options --first, --last, "
-         << "--min, --max, -mean, --stddev, --median, --nmad, --count can be specified.\n"
+         << "--min, --max, -mean, --stddev, --median, --nmad, --count, "
+         << "--stack-stats can be specified.\n"
          << usage << general_options );
 
+  if (!opt.stack_stats.empty() &&
+      (opt.save_index_map || opt.save_dem_weight >= 0 || opt.hole_fill_len > 0 ||
+       opt.dem_blur_sigma > 0 || opt.propagate_nodata || opt.output_type != "Float32"))
+    vw_throw(ArgumentErr() << "The option --stack-stats cannot be used with --save-index-map, "
+             << "--save-dem-weight, --hole-fill-length, --dem-blur-sigma, "
+             << "--propagate-nodata, or an output type other than Float32.\n"
+             << usage << general_options );
+
   if (opt.geo_tile_size < 0)
     vw_throw(ArgumentErr() << "The size of a tile in georeferenced units must not be negative.\n"
                            << usage << general_options );
@@ -1404,6 +2175,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
        << "Cannot save both the index map and the DEM weights at the same time.\n"
        << usage << general_options );
 
+  if (opt.weights_cache_dir != "" && (noblend || opt.priority_blending_len > 0))
+    vw_throw(ArgumentErr()
+       << "The weights cache can be used only with regular blending.\n"
+       << usage << general_options );
+
+  if (opt.tile_plan_file != "" && (opt.tile_index >= 0 || opt.tile_list_str != ""))
+    vw_throw(ArgumentErr()
+       << "Cannot save the tile plan when a tile index or tile list is specified.\n"
+       << usage << general_options );
+
   // For compatibility with the GDAL tools, allow the min and max to be reversed.
   if (opt.projwin != BBox2()) {
     if (opt.projwin.min().x() > opt.projwin.max().x())
@@ -1456,6 +2237,21 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.dem_files.insert(opt.dem_files.begin(), opt.this_dem_as_reference);
   }
   
+  // The time of each DEM, for the statistics of the stack
+  opt.dem_times.clear();
+  if (opt.dem_times_file != "") {
+    if (opt.stack_stats.empty())
+      vw_throw(ArgumentErr() << "The option --dem-times-file needs --stack-stats.\n"
+               << usage << general_options );
+    asp::read_1d_points(opt.dem_times_file, opt.dem_times);
+    if (opt.dem_times.size() != opt.dem_files.size())
+      vw_throw(ArgumentErr() << "Expecting as many times in " << opt.dem_times_file
+               << " as input DEMs.\n");
+  } else if (!opt.stack_stats.empty()) {
+    for (size_t it = 0; it < opt.dem_files.size(); it++)
+      opt.dem_times.push_back(it);
+  }
+
   if (int(opt.dem_files.size()) <= opt.save_dem_weight) {
     vw_throw(ArgumentErr() << "Cannot save weights for given index as it is out of bounds.\n"
 	     << usage << general_options );
@@ -1535,7 +2331,7 @@ int main( int argc, char *argv[] ) {
                  << "Cannot change the projection, spacing, or output box, if the first DEM "
                  << "is to be used as reference.\n");
       if (opt.first  || opt.last || opt.min    || opt.max || opt.mean || 
-          opt.median || opt.nmad || opt.stddev ||
+          opt.median || opt.nmad || opt.stddev || !opt.stack_stats.empty() ||
           opt.priority_blending_len > 0 || //opt.save_dem_weight >= 0 ||
           !boost::math::isnan(opt.nodata_threshold)) {
         vw_throw(ArgumentErr()
@@ -1606,8 +2402,11 @@ int main( int argc, char *argv[] ) {
     BBox2 mosaic_bbox;
     vector<BBox2> dem_proj_bboxes;
     vector<BBox2i> dem_pixel_bboxes, loaded_dem_pixel_bboxes;
+    vector<GeoReference> dem_georefs;
+    vector<double> dem_nodata_values;
     load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
-                            dem_proj_bboxes, dem_pixel_bboxes);
+                            dem_proj_bboxes, dem_pixel_bboxes,
+                            dem_georefs, dem_nodata_values);
 
     if (opt.projwin != BBox2()) {
       // If to create the mosaic only in a given region
@@ -1651,6 +2450,27 @@ int main( int argc, char *argv[] ) {
     if (opt.block_size > 0)
       block_size = opt.block_size;
 
+    // With a memory budget, make the blocks, and if need be the number
+    // of threads, such that the blocks being worked on fit. Each pixel
+    // of a block, with its bias, takes about four doubles, for the
+    // tile, weights, and the input DEMs cropped to it.
+    if (asp::memory_budget().has_budget()) {
+      const double BYTES_PER_PIXEL = 4.0 * sizeof(double);
+      if (opt.block_size <= 0)
+        block_size = asp::memory_budget().tile_size(block_size, BYTES_PER_PIXEL,
+                                                    opt.num_threads,
+                                                    asp::MEMORY_BUDGET_BUFFER_FRACTION);
+      double block_mb = BYTES_PER_PIXEL * (block_size + 2.0*bias) * (block_size + 2.0*bias)
+                        / (1024.0 * 1024.0);
+      int num_threads = asp::memory_budget().num_threads(opt.num_threads, block_mb,
+                                                         asp::MEMORY_BUDGET_BUFFER_FRACTION);
+      if (num_threads < opt.num_threads) {
+        vw_out() << "Using " << num_threads << " threads to fit in the memory budget.\n";
+        opt.num_threads = num_threads;
+        vw_settings().set_default_num_threads(num_threads);
+      }
+    }
+
     // See if to lump all mosaic in just a given file, rather than creating tiles.
     bool write_to_precise_file = ( opt.out_prefix.size() >= 4 &&
 				   opt.out_prefix.substr(opt.out_prefix.size()-4, 4) == ".tif");
@@ -1685,8 +2505,10 @@ int main( int argc, char *argv[] ) {
       end_tile = num_tiles;
     }
 
-    // Compute the bounding box of each output tile
+    // Compute the bounding box of each output tile, in pixels, and in
+    // projected coordinates
     std::vector<BBox2i> tile_pixel_bboxes;
+    std::vector<BBox2>  tile_proj_bboxes;
     for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
 
       int tile_index_y = tile_id / num_tiles_x;
@@ -1699,6 +2521,13 @@ int main( int argc, char *argv[] ) {
       tile_box.crop(BBox2i(0, 0, cols, rows));
 
       tile_pixel_bboxes.push_back(tile_box);
+      tile_proj_bboxes.push_back(mosaic_georef.pixel_to_point_bbox(tile_box));
+    }
+
+    if (opt.tile_plan_file != "") {
+      save_tile_plan(opt, mosaic_georef, mosaic_bbox, spacing, cols, rows,
+                     num_tiles_x, num_tiles_y, tile_proj_bboxes, dem_proj_bboxes);
+      return 0;
     }
 
     // Store the no-data values, pointers to images, and georeferences (for speed).
@@ -1706,6 +2535,9 @@ int main( int argc, char *argv[] ) {
     vector<double>          nodata_values;
     vector<GeoReference>    georefs;
     std::vector<string>     loaded_dems;
+    std::vector<BBox2i>     dem_footprints; // in the output pixels, or empty if unknown
+    std::vector<string>     weight_files;   // cached blending weights
+    std::vector<double>     loaded_dem_times;
     DiskImageManager<RealT> imgMgr;
 
     BBox2i output_dem_box = BBox2i(0, 0, cols, rows); // output DEM box
@@ -1723,9 +2555,8 @@ int main( int argc, char *argv[] ) {
         if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end()) 
           continue;
         
-        // Get tile bbox in pixels, then convert it to projected coords.
-        BBox2i tile_pixel_box = tile_pixel_bboxes[tile_id - start_tile];
-        BBox2  tile_proj_box  = mosaic_georef.pixel_to_point_bbox(tile_pixel_box);
+        // Get tile bbox in projected coords
+        BBox2 const& tile_proj_box = tile_proj_bboxes[tile_id - start_tile];
 
         if (tile_proj_box.intersects(dem_bbox)) {
           use_this_dem = true;
@@ -1737,7 +2568,7 @@ int main( int argc, char *argv[] ) {
 
       // The GeoTransform will hide the messy details of conversions
       // from pixels to points and lon-lat.
-      GeoReference georef  = read_georef(opt.dem_files[dem_iter]);
+      GeoReference georef  = dem_georefs[dem_iter];
       BBox2i dem_pixel_box = dem_pixel_bboxes[dem_iter];
       GeoTransform geotrans(georef, mosaic_georef, dem_pixel_box, output_dem_box);
 
@@ -1745,25 +2576,29 @@ int main( int argc, char *argv[] ) {
       BBox2 curr_box = geotrans.forward_bbox(dem_pixel_box);
       curr_box.crop(output_dem_box);
 
+      // The output pixels this DEM can affect. A tile reads the DEM
+      // this many input pixels beyond the tile. Add a small margin for
+      // the approximate nature of the box conversions. In case of
+      // longitude wraparound, always check the DEM against each tile.
+      BBox2i grown_dem_box = dem_pixel_box;
+      grown_dem_box.expand(bias + BilinearInterpolation::pixel_buffer + 2);
+      BBox2i footprint;
+      if (!geotrans.check_bbox_wraparound()) {
+        BBox2 box = geotrans.forward_bbox(grown_dem_box);
+        if (!box.empty()) {
+          footprint = grow_bbox_to_int(box);
+          footprint.expand(2);
+        }
+      }
+      dem_footprints.push_back(footprint);
+
       // This is a fix for GDAL crashing when there are too many open
       // file handles. In such situation, just selectively close the
       // handles furthest from the current location.
       imgMgr.add_file_handle_not_thread_safe(opt.dem_files[dem_iter], curr_box);
       
-      double curr_nodata_value = opt.out_nodata_value;
-      try {
-        // Get the nodata-value. Need a try block, in case we can't
-        // open more handles.
-        DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-        if ( in_rsrc.has_nodata_read() )
-          curr_nodata_value = RealT(in_rsrc.nodata_read());
-      }catch(std::exception const& e){
-        // Try again
-        imgMgr.freeup_handles_not_thread_safe();
-        DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-        if ( in_rsrc.has_nodata_read() )
-          curr_nodata_value = RealT(in_rsrc.nodata_read());
-      }
+      // The nodata value was read with the bounding boxes
+      double curr_nodata_value = dem_nodata_values[dem_iter];
       
       loaded_dems.push_back(opt.dem_files[dem_iter]);
 
@@ -1774,8 +2609,33 @@ int main( int argc, char *argv[] ) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+      if (!opt.dem_times.empty())
+        loaded_dem_times.push_back(opt.dem_times[dem_iter]);
+
+      // Compute the blending weights of this DEM, unless cached earlier.
+      // A reference DEM which is not blended needs no weights.
+      if (opt.weights_cache_dir != "" && dem_iter == 0 && opt.this_dem_as_reference != "") {
+        weight_files.push_back("");
+      } else if (opt.weights_cache_dir != "") {
+        std::string weight_file = weights_cache_file(opt, opt.dem_files[dem_iter],
+                                                     curr_nodata_value, bias);
+        if (!fs::exists(weight_file)) {
+          vw_out() << "Computing the blending weights of: " << opt.dem_files[dem_iter] << "\n";
+          fs::create_directories(opt.weights_cache_dir);
+          save_dem_weights(opt, opt.dem_files[dem_iter], curr_nodata_value,
+                           bias, block_size, weight_file);
+        } else {
+          vw_out() << "Using the cached blending weights: " << weight_file << "\n";
+        }
+        weight_files.push_back(weight_file);
+      }
     } // End loop through DEM files
 
+    // Index the DEMs by where they are in the output, with cells the
+    // size of the blocks being written.
+    DemFootprintIndex dem_index;
+    dem_index.build(dem_footprints, output_dem_box, block_size);
+
     // If there are 17 tiles, let them be tile-00, ..., tile-16.
     int num_digits = 1;
     int tens = 10;
@@ -1811,7 +2671,8 @@ int main( int argc, char *argv[] ) {
         = crop(DemMosaicView(cols, rows, bias, opt,
                              imgMgr, georefs,
                              mosaic_georef, nodata_values,
-                             loaded_dem_pixel_bboxes,
+                             loaded_dem_pixel_bboxes, dem_index, weight_files,
+                             loaded_dem_times,
                              num_valid_pixels, count_mutex),
                tile_box);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
@@ -1822,6 +2683,12 @@ int main( int argc, char *argv[] ) {
       vw_out() << "Writing: " << dem_tile << std::endl;
       bool has_georef = true, has_nodata = true;
       TerminalProgressCallback tpc("asp", "\t--> ");
+
+      // With --cog the blocks are rewritten when converting the file, so
+      // skip the rewrite with smaller blocks after the first write.
+      Vector2 out_block_size = opt.raster_tile_size;
+      if (opt.cog)
+        opt.raster_tile_size = Vector2(block_size, block_size);
       if (opt.output_type == "Float32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile, out_dem,
                                        has_georef, crop_georef,
@@ -1858,16 +2725,28 @@ int main( int argc, char *argv[] ) {
                                        opt, tpc);
       else
         vw_throw( NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n" );
+      opt.raster_tile_size = out_block_size;
 
       vw_out() << "Number of valid (not no-data) pixels written: " << num_valid_pixels
                << "."<< std::endl;
       if (num_valid_pixels == 0) {
         vw_out() << "Removing tile with no valid pixels: " << dem_tile << std::endl;
         boost::filesystem::remove(dem_tile);
+      } else if (opt.overviews || opt.cog) {
+        asp::add_overviews_and_cog(dem_tile, opt.cog, out_block_size, opt);
       }
       
     } // End loop through tiles
 
+    // Write the statistic in each band of the stack statistics
+    if (!opt.stack_stats.empty()) {
+      std::string bands_file = opt.out_prefix + "-stack-bands.txt";
+      vw_out() << "Writing: " << bands_file << std::endl;
+      std::ofstream bh(bands_file.c_str());
+      for (size_t it = 0; it < opt.stack_stats.size(); it++)
+        bh << it + 1 << ' ' << opt.stack_stats[it] << std::endl;
+    }
+
     // Write the name of each DEM file that was used together with its index
     if (opt.save_index_map) {
       std::string index_map = opt.out_prefix + "-index-map.txt";
@@ -1878,6 +2757,9 @@ int main( int argc, char *argv[] ) {
       }
     }
 
+    if (asp::compressed_block_cache().enabled())
+      vw_out() << asp::compressed_block_cache().summary() << std::endl;
+
   } ASP_STANDARD_CATCHES;
 
   return 0;
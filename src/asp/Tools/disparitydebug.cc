@@ -31,10 +31,15 @@
 
 #include <stdlib.h>
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/ImageStats.h>
+
+#include <boost/bind.hpp>
 using namespace vw;
 using namespace vw::stereo;
 
@@ -46,9 +51,11 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string input_file_name;
   BBox2       normalization_range;
   BBox2       roi;    ///< Only generate output images in this region
+  double      clip_percent; ///< Percent of disparities to exclude at each end of the range
 
   // Output
   std::string output_prefix, output_file_type;
+  bool        overviews, cog;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -58,8 +65,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Normalization range. Specify in format: hmin,vmin,hmax,vmax.")
     ("roi", po::value(&opt.roi)->default_value(BBox2(0,0,0,0), "auto"),
      "Region of interest. Specify in format: xmin,ymin,xmax,ymax.")
+    ("clip-percent", po::value(&opt.clip_percent)->default_value(0.0),
+     "When finding the normalization range, exclude this percent of the valid disparities at each end of it, to discard outliers.")
     ("output-prefix,o", po::value(&opt.output_prefix), "Specify the output prefix.")
-    ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file type.");
+    ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file type.")
+    ("overviews", po::bool_switch(&opt.overviews)->default_value(false),
+     "Add internal overviews to the output images.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output images as Cloud-Optimized GeoTIFF, with internal overviews.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -82,6 +95,94 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
               << usage << general_options );
   if ( opt.output_prefix.empty() )
     opt.output_prefix = vw::prefix_from_filename(opt.input_file_name);
+  if ( opt.clip_percent < 0 || opt.clip_percent >= 50 )
+    vw_throw( ArgumentErr() << "The clip percent must be in [0, 50).\n" );
+  if ( (opt.overviews || opt.cog) && opt.output_file_type != "tif" )
+    vw_throw( ArgumentErr() << "Overviews can be added only to tif output files.\n" );
+}
+
+/// Accumulate the statistics of the horizontal and vertical disparities
+/// in one block of the image.
+template <class ViewT>
+class DisparityStatsTask: public vw::Task, private boost::noncopyable {
+  ViewT const&         m_view;
+  BBox2i               m_box;
+  asp::StreamingStats& m_h_stats;
+  asp::StreamingStats& m_v_stats;
+public:
+  DisparityStatsTask(ViewT const& view, BBox2i const& box,
+                     asp::StreamingStats& h_stats, asp::StreamingStats& v_stats):
+    m_view(view), m_box(box), m_h_stats(h_stats), m_v_stats(v_stats) {}
+  virtual void operator()() {
+    ImageView<typename ViewT::pixel_type> block = crop(m_view, m_box);
+    for (int row = 0; row < block.rows(); row++) {
+      for (int col = 0; col < block.cols(); col++) {
+        if (!is_valid(block(col, row)))
+          continue;
+        m_h_stats.add(remove_mask(block(col, row))[0]);
+        m_v_stats.add(remove_mask(block(col, row))[1]);
+      }
+    }
+  }
+};
+
+/// Find the disparity range from whole blocks of the image spread evenly
+/// over the region, about a million pixels in total. A subsampled view
+/// would read every block that any sampled row passes through.
+template <class ViewT>
+BBox2 sampled_disparity_range(ViewT const& disparity, std::string const& file,
+                              BBox2i const& roi, double clip_percent, int num_threads) {
+
+  // Blocks of at least 256 rows, so that an image stored in strips is
+  // not read one row at a time
+  boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(file));
+  Vector2i block_size = rsrc->block_read_size();
+  block_size = Vector2i(std::max(block_size[0], 256), std::max(block_size[1], 256));
+
+  // Take every stride-th block in each direction
+  double num_samples = 1000.0 * 1000.0;
+  int stride = std::max(1, int(floor(sqrt(double(roi.width()) * roi.height() / num_samples))));
+  std::vector<BBox2i> sampled;
+  for (int y = roi.min().y(); y < roi.max().y(); y += stride * block_size[1]) {
+    for (int x = roi.min().x(); x < roi.max().x(); x += stride * block_size[0]) {
+      BBox2i box(x, y, block_size[0], block_size[1]);
+      box.crop(roi);
+      sampled.push_back(box);
+    }
+  }
+
+  // The blocks are merged in order, so the result does not depend on the threads
+  std::vector<asp::StreamingStats> h_stats(sampled.size()), v_stats(sampled.size());
+  {
+    FifoWorkQueue queue(std::max(num_threads, 1));
+    for (size_t it = 0; it < sampled.size(); it++) {
+      boost::shared_ptr< DisparityStatsTask<ViewT> >
+        task(new DisparityStatsTask<ViewT>(disparity, sampled[it], h_stats[it], v_stats[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  asp::StreamingStats h, v;
+  for (size_t it = 0; it < sampled.size(); it++) {
+    h.merge(h_stats[it]);
+    v.merge(v_stats[it]);
+  }
+
+  double q = clip_percent / 100.0;
+  return BBox2(Vector2(h.quantile(q),     v.quantile(q)),
+               Vector2(h.quantile(1 - q), v.quantile(1 - q)));
+}
+
+template <class ImageT>
+void write_debug_image(std::string const& file, ImageT const& image,
+                       bool has_georef, cartography::GeoReference const& georef,
+                       bool has_nodata, float output_nodata,
+                       vw::cartography::GdalWriteOptions const& write_opt,
+                       Options const& opt, std::string const& tag) {
+  block_write_gdal_image( file, image, has_georef, georef, has_nodata, output_nodata,
+                          write_opt, TerminalProgressCallback("asp", tag));
+  if (opt.overviews || opt.cog)
+    asp::add_overviews_and_cog(file, opt.cog, opt.raster_tile_size, write_opt);
 }
 
 template <class PixelT>
@@ -103,16 +204,12 @@ void do_disparity_visualization(Options& opt) {
   if (has_georef)
     georef = crop(georef, roiToUse);
 
-  // We don't want to sample every pixel as the image might be very
-  // large. Let's subsample the image so that it is rough 1000x1000 samples.
-  float subsample_amt =
-    float(roiToUse.height())*float(roiToUse.width()) / ( 1000.f * 1000.f );
-
   // Compute intensity display range if not passed in
+  int num_threads = (opt.num_threads > 0) ? opt.num_threads : vw_settings().default_num_threads();
   if ( opt.normalization_range == BBox2(0,0,0,0) )
     opt.normalization_range =
-      get_disparity_range(subsample(crop(disk_disparity_map, roiToUse),
-                                    subsample_amt > 1 ? subsample_amt : 1));
+      sampled_disparity_range(disk_disparity_map, opt.input_file_name, BBox2i(roiToUse),
+                              opt.clip_percent, num_threads);
 
   vw_out() << "\t    Horizontal: [" << opt.normalization_range.min().x()
            << " " << opt.normalization_range.max().x() << "]    Vertical: ["
@@ -144,21 +241,23 @@ void do_disparity_visualization(Options& opt) {
                         )
               );
 
-  // Write both images to disk, casting as UINT8
+  // Write both images to disk at the same time, casting as UINT8. They
+  // read the same blocks of the disparity, which then come from the
+  // cache of the file system the second time.
   std::string h_file = opt.output_prefix+"-H."+opt.output_file_type;
-  vw_out() << "\t--> Writing horizontal disparity debug image: " << h_file << "\n";
-  block_write_gdal_image( h_file,
-                          channel_cast_rescale<uint8>(horizontal),
-                          has_georef, georef,
-                          has_nodata, output_nodata,
-                          opt, TerminalProgressCallback("asp","\t    H : "));
   std::string v_file = opt.output_prefix+"-V."+opt.output_file_type;
+  vw_out() << "\t--> Writing horizontal disparity debug image: " << h_file << "\n";
   vw_out() << "\t--> Writing vertical disparity debug image: " << v_file << "\n";
-  block_write_gdal_image( v_file,
-                          channel_cast_rescale<uint8>(vertical),
-                          has_georef, georef,
-                          has_nodata, output_nodata,
-                          opt, TerminalProgressCallback("asp","\t    V : "));
+  vw::cartography::GdalWriteOptions write_opt = asp::half_threads(opt);
+  asp::run_in_parallel
+    (boost::bind(&write_debug_image< ImageViewRef<uint8> >, h_file,
+                 ImageViewRef<uint8>(channel_cast_rescale<uint8>(horizontal)),
+                 has_georef, boost::cref(georef), has_nodata, output_nodata,
+                 boost::cref(write_opt), boost::cref(opt), std::string("\t    H : ")),
+     boost::bind(&write_debug_image< ImageViewRef<uint8> >, v_file,
+                 ImageViewRef<uint8>(channel_cast_rescale<uint8>(vertical)),
+                 has_georef, boost::cref(georef), has_nodata, output_nodata,
+                 boost::cref(write_opt), boost::cref(opt), std::string("\t    V : ")));
 }
 
 int main( int argc, char *argv[] ) {
@@ -175,6 +274,8 @@ int main( int argc, char *argv[] ) {
       switch (fmt.channel_type) {
       case VW_CHANNEL_INT32:
         do_disparity_visualization<Vector2i>(opt); break;
+      case VW_CHANNEL_INT16:
+        do_disparity_visualization<Vector<int16, 2> >(opt); break;
       default:
         do_disparity_visualization<Vector2f>(opt); break;
       } break;
@@ -183,6 +284,8 @@ int main( int argc, char *argv[] ) {
       switch (fmt.channel_type) {
       case VW_CHANNEL_INT32:
         do_disparity_visualization<PixelMask<Vector2i> >(opt); break;
+      case VW_CHANNEL_INT16:
+        do_disparity_visualization<PixelMask<Vector<int16, 2> > >(opt); break;
       default:
         do_disparity_visualization<PixelMask<Vector2f> >(opt); break;
       } break;
@@ -17,10 +17,13 @@
 
 
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/GeodeticBatch.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
+#include <fstream>
+
 
 using std::endl;
 using std::string;
@@ -253,25 +256,42 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   GeoReference csv_georef = dem_georef;
   csv_conv.parse_georef(csv_georef);
 
-  std::list<asp::CsvConv::CsvRecord> csv_records;
-  typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-  csv_conv.read_csv_file(csv_file, csv_records);
-  
-  std::vector<Vector3> csv_llh;
-  for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-    Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
-    if (xyz == Vector3() || xyz != xyz)
-      continue; // invalid point
-    Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz); // use the dem's datum
-    csv_llh.push_back(llh);
-  }
+  // Stream the CSV file, parsing and converting each batch of lines
+  // in parallel. Keep only the points within the DEM extent.
+  std::vector<Vector2> csv_ll, csv_pix;
+  std::vector<double>  csv_ht;
+  asp::CsvConv::CsvBatchJob keep_job = [&](asp::CsvConv::CsvPointBatch const& batch) {
+    asp::PointBlock llh; // use the dem's datum
+    llh.resize(batch.xyz.size());
+    for (size_t it = 0; it < batch.xyz.size(); it++) {
+      llh.x[it] = batch.xyz[it][0]; llh.y[it] = batch.xyz[it][1]; llh.z[it] = batch.xyz[it][2];
+    }
+    asp::batch_cartesian_to_geodetic(dem_georef.datum(), llh);
+
+    for (size_t it = 0; it < batch.xyz.size(); it++) {
+      if (!batch.valid[it])
+        continue;
+      Vector2 ll(llh.x[it], llh.y[it]);
+      Vector2 pix = dem_georef.lonlat_to_pixel(ll);
 
-  // We will interpolate into the DEM to find the difference
-  ImageViewRef< PixelMask<double> > interp_dem
-    = interpolate(create_mask(dem, dem_nodata),
-		  BilinearInterpolation(), ConstantEdgeExtension());
+      // Check for out of range
+      if (pix[0] < 0 || pix[0] > dem.cols() - 1) continue;
+      if (pix[1] < 0 || pix[1] > dem.rows() - 1) continue;
 
-  // Save the diffs
+      csv_ll.push_back(ll);
+      csv_pix.push_back(pix);
+      csv_ht.push_back(llh.z[it]);
+    }
+    return true;
+  };
+  csv_conv.read_csv_points(csv_file, csv_georef, BBox2(), 1.0, keep_job);
+
+  // Interpolate into the DEM, reading each DEM tile once. A NaN is
+  // stored for the points where the DEM is not valid.
+  std::vector<double> dem_hts;
+  asp::dem_heights_at_pixels(dem, dem_nodata, csv_pix, opt.num_threads, dem_hts);
+
+  // Save the diffs, in the order of the points in the file
   int    count     = 0;
   double diff_min  = std::numeric_limits<double>::max();
   double diff_max  = -diff_min;
@@ -280,20 +300,12 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
 
   std::vector<Vector3> csv_diff;
   std::vector<double> csv_errs;
-  for (size_t it = 0; it < csv_llh.size(); it++) {
+  for (size_t it = 0; it < csv_ll.size(); it++) {
 
-    Vector3 llh = csv_llh[it];
-    Vector2 ll  = subvector(llh, 0, 2);
-    Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-    
-    // Check for out of range
-    if (pix[0] < 0 || pix[0] > dem.cols() - 1) continue;
-    if (pix[1] < 0 || pix[1] > dem.rows() - 1) continue;
-    PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-    if (!is_valid(dem_ht))
+    if (std::isnan(dem_hts[it]))
       continue;
 
-    double diff = dem_ht.child() - llh[2];
+    double diff = dem_hts[it] - csv_ht[it];
     if (reverse) 
       diff *= -1;
     if (opt.use_absolute)
@@ -305,7 +317,7 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
     diff_mean += diff;
     diff_std  += diff*diff;
     count     += 1;
-    csv_diff.push_back(Vector3(ll[0], ll[1], diff));
+    csv_diff.push_back(Vector3(csv_ll[it][0], csv_ll[it][1], diff));
     csv_errs.push_back(diff);
   }
 
@@ -30,8 +30,6 @@ from stereo_utils import get_asp_version
 import asp_system_utils
 asp_system_utils.verify_python_version_is_supported()
 
-job_pool = []
-
 def man(option, opt, value, parser):
     print(parser.usage, file=sys.stderr)
     print('''\
@@ -73,19 +71,6 @@ class CCDs(dict):
         return self[self.match]
 
 
-def add_job( cmd, num_working_threads=4 ):
-    if len(job_pool) >= num_working_threads:
-        job_pool[0].wait()
-        job_pool.pop(0)
-    print(cmd)
-    job_pool.append( subprocess.Popen(cmd, shell=True) )
-
-def wait_on_all_jobs():
-    print("Waiting for jobs to finish")
-    while len(job_pool) > 0:
-        job_pool[0].wait()
-        job_pool.pop(0)
-
 def read_flatfile( flat ):
     f = open(flat,'r')
     averages = [0.0,0.0]
@@ -117,41 +102,37 @@ def check_output_files(file_list):
         if not os.path.exists(f):
             raise Exception('Failed to generate file: ' + f)
 
-def hi2isis( img_files, threads ):
+def hi2isis_hical( img_files, pool, delete=False ):
+    '''Convert each channel file to ISIS format with hi2isis, then
+    calibrate it with hical. Each file goes through both steps on its own.'''
     hi2isis_cubs = []
+    hical_cubs   = []
     for img in img_files:
-        # Expect to end in .IMG, change to end in .cub
-        to_cub = os.path.splitext( os.path.basename(img) )[0] + '.cub'
-        if os.path.exists(to_cub):
-            print(to_cub + ' exists, skipping hi2isis.')
-        else:
-            cmd = 'hi2isis from= '+ img +' to= '+ to_cub
-            add_job(cmd, threads)
-        hi2isis_cubs.append( to_cub )
-    wait_on_all_jobs()
-    check_output_files(hi2isis_cubs)
-    return hi2isis_cubs
-
-def hical( cub_files, threads, delete=False ):
-    hical_cubs = []
-    for cub in cub_files:
-        # Expect to end in .cub, change to end in .hical.cub
+        # Expect to end in .IMG, change to end in .cub, then in .hical.cub
+        cub    = os.path.splitext( os.path.basename(img) )[0] + '.cub'
         to_cub = os.path.splitext(cub)[0] + '.hical.cub'
+        steps  = []
         if os.path.exists(to_cub):
-            print(to_cub + ' exists, skipping hical.')
+            print(to_cub + ' exists, skipping hi2isis and hical.')
         else:
-            cmd = 'hical from=  '+ cub +' to= '+ to_cub
-            add_job(cmd, threads)
+            if os.path.exists(cub):
+                print(cub + ' exists, skipping hi2isis.')
+            else:
+                steps.append(('hi2isis', 'hi2isis from= '+ img +' to= '+ cub))
+            steps.append(('hical', 'hical from=  '+ cub +' to= '+ to_cub))
+        pool.add(steps)
+        hi2isis_cubs.append( cub )
         hical_cubs.append( to_cub )
-    wait_on_all_jobs()
+    pool.wait_all()
     check_output_files(hical_cubs)
     if delete:
-        for cub in cub_files: os.remove( cub )
-        hical_log_files = glob.glob( os.path.commonprefix(cub_files) + '*.hical.log' )
+        for cub in hi2isis_cubs:
+            if os.path.exists(cub): os.remove( cub )
+        hical_log_files = glob.glob( os.path.commonprefix(hi2isis_cubs) + '*.hical.log' )
         for file in hical_log_files: os.remove( file )
     return hical_cubs
 
-def histitch( cub_files, threads, delete=False ):
+def histitch( cub_files, pool, delete=False ):
     histitch_cubs = []
     to_del_cubs   = []
     # Strictly, we should probably look in the image headers, but instead we'll
@@ -181,7 +162,7 @@ def histitch( cub_files, threads, delete=False ):
             else:
                 cmd = 'histitch balance= TRUE from1= '+ channel_files[i][0] \
                         +' from2= '+ channel_files[i][1] +' to= '+ to_cub
-                add_job(cmd, threads)
+                pool.add(('histitch', cmd))
                 to_del_cubs.append( channel_files[i][0] )
                 to_del_cubs.append( channel_files[i][1] )
             histitch_cubs.append( to_cub )
@@ -192,28 +173,25 @@ def histitch( cub_files, threads, delete=False ):
                 found = channel_files[i][1]
             print('Found '+ found  +' but not the matching channel file.')
             cmd = 'histitch from1= '+ found +' to= '+ to_cub
-            add_job(cmd, threads)
+            pool.add(('histitch', cmd))
             to_del_cubs.append( found )
             histitch_cubs.append( to_cub )
 
-    wait_on_all_jobs()
+    pool.wait_all()
     check_output_files(histitch_cubs)
     if delete:
         for cub in to_del_cubs: os.remove( cub )
     return histitch_cubs
 
-def spice( cub_files, threads):
-    for cub in cub_files:
-        cmd = 'spiceinit from= '+ cub
-        add_job(cmd, threads)
-    wait_on_all_jobs()
+def spice( cub_files, pool):
+    '''Attach SPICE to each cube, then fit it, one cube at a time in each job.'''
     for cub in cub_files:
-        cmd = 'spicefit from= '+ cub
-        add_job(cmd, threads)
-    wait_on_all_jobs()
+        pool.add([('spiceinit', 'spiceinit from= '+ cub),
+                  ('spicefit',  'spicefit from= '+ cub)])
+    pool.wait_all()
     return
 
-def noproj( CCD_object, threads, delete=False ):
+def noproj( CCD_object, pool, delete=False ):
     noproj_CCDs = []
     for i in CCD_object.keys():
         to_cub = CCD_object.prefix + str(i) + '.noproj.cub'
@@ -229,25 +207,24 @@ def noproj( CCD_object, threads, delete=False ):
             # cmd = 'noproj from= '+ CCD_object[i]    \
             #     +' match= '+ CCD_object.matchcube() \
             #     +' source= frommatch to= '+ to_cub
-            add_job(cmd, threads)
-            # print (cmd)
-            # os.system(cmd)
+            pool.add(('noproj', cmd))
         noproj_CCDs.append( to_cub )
-    wait_on_all_jobs()
+    pool.wait_all()
+    check_output_files(noproj_CCDs)
     if delete:
         for cub in CCD_object.values(): os.remove( cub )
     return CCDs( noproj_CCDs, CCD_object.match )
 
 # Check for failure for hijitreg.  Sometimes bombs?  Default to zeros.
-def hijitreg( noproj_CCDs, threads ):
+def hijitreg( noproj_CCDs, pool ):
     for i in noproj_CCDs.keys():
         j = i + 1
         if( j not in noproj_CCDs ): continue
         cmd = 'hijitreg from= '+ noproj_CCDs[i]         \
             +' match= '+ noproj_CCDs[j]                 \
             + ' flatfile= flat_'+str(i)+'_'+str(j)+'.txt'
-        add_job(cmd, threads)
-    wait_on_all_jobs()
+        pool.add(('hijitreg', cmd))
+    pool.wait_all(check=False)
 
     averages = dict()
 
@@ -255,12 +232,17 @@ def hijitreg( noproj_CCDs, threads ):
         j = i + 1
         if( j not in noproj_CCDs ): continue
         flat_file = 'flat_'+str(i)+'_'+str(j)+'.txt'
+        if not os.path.exists( flat_file ):
+            print('Missing ' + flat_file + ', using zero offsets for CCDs ' +
+                  str(i) + ' and ' + str(j) + '.')
+            averages[i] = [0.0, 0.0]
+            continue
         averages[i] = read_flatfile( flat_file )
         os.remove( flat_file )
 
     return averages
 
-def mosaic( noprojed_CCDs, averages ):
+def mosaic( noprojed_CCDs, averages, pool ):
     mosaic = noprojed_CCDs.prefix+'.mos_hijitreged.cub'
     shutil.copy( noprojed_CCDs.matchcube(), mosaic )
     sample_sum = 1
@@ -271,7 +253,7 @@ def mosaic( noprojed_CCDs, averages ):
         line_sum    += averages[i][1]
         handmos( noprojed_CCDs[i], mosaic,
                  str( int(round( sample_sum )) ),
-                 str( int(round( line_sum )) ) )
+                 str( int(round( line_sum )) ), pool )
 
     sample_sum = 1
     line_sum = 1
@@ -281,24 +263,26 @@ def mosaic( noprojed_CCDs, averages ):
         line_sum    -= averages[i-1][1]
         handmos( noprojed_CCDs[i], mosaic,
                  str( int(round( sample_sum )) ),
-                 str( int(round( line_sum )) ) )
+                 str( int(round( line_sum )) ), pool )
 
     return mosaic
 
 
-def handmos( fromcub, tocub, outsamp, outline ):
+def handmos( fromcub, tocub, outsamp, outline, pool ):
+    # All CCDs go into the same mosaic, so one at a time
     cmd = 'handmos from= '+ fromcub +' mosaic= '+ tocub \
             +' outsample= '+ outsamp \
             +' outline= '+   outline \
             +' priority= beneath'
-    os.system(cmd)
+    pool.add(('handmos', cmd))
+    pool.wait_all()
     return
 
-def cubenorm( fromcub, delete=False ):
+def cubenorm( fromcub, pool, delete=False ):
     tocub = os.path.splitext(fromcub)[0] + '.norm.cub'
     cmd   = 'cubenorm from= '+ fromcub+' to= '+ tocub
-    print(cmd)
-    os.system(cmd)
+    pool.add(('cubenorm', cmd))
+    pool.wait_all()
     if delete:
         os.remove( fromcub )
     return tocub
@@ -376,7 +360,7 @@ def main():
             parser.add_option("--resume-at-no-proj", dest="resume_no_proj", action="store_true",
                               help="Pick back up after spiceinit has happened or jigsaw. This was noproj uses your new camera information")
             parser.add_option("-t", "--threads", dest="threads",
-                              help="Number of threads to use.",type="int")
+                              help="How many ISIS programs to run at the same time (default 4).",type="int")
             parser.add_option("-m", "--match", dest="match",type="int",
                               help="CCD number of match CCD, passed as the match argument to noproj (default 5).")
             parser.add_option("-k", "--keep", action="store_false",
@@ -414,20 +398,21 @@ def main():
         except optparse.OptionError as msg:
             raise Usage(msg)
 
-        if not options.resume_no_proj:
-            # hi2isis
-            hi2isised = hi2isis( args, options.threads )
+        # Run the ISIS programs for the channel files and the CCDs in parallel
+        pool = asp_system_utils.JobPool(options.threads)
 
-            # hical
-            hicaled = hical( hi2isised, options.threads, options.delete )
+        if not options.resume_no_proj:
+            # hi2isis and hical
+            hicaled = hi2isis_hical( args, pool, options.delete )
 
             # histitch
-            histitched = histitch( hicaled, options.threads, options.delete )
+            histitched = histitch( hicaled, pool, options.delete )
 
             # attach spice
-            spice( histitched, options.threads )
+            spice( histitched, pool )
 
         if options.stop_no_proj:
+            pool.print_timings()
             print("Finished")
             return 0
 
@@ -437,13 +422,13 @@ def main():
         CCD_files = CCDs( histitched, options.match )
 
         # noproj
-        noprojed_CCDs = noproj( CCD_files, options.threads, options.delete )
+        noprojed_CCDs = noproj( CCD_files, pool, options.delete )
 
         # hijitreg
-        averages = hijitreg( noprojed_CCDs, options.threads )
+        averages = hijitreg( noprojed_CCDs, pool )
 
         # mosaic handmos
-        mosaicked = mosaic( noprojed_CCDs, averages )
+        mosaicked = mosaic( noprojed_CCDs, averages, pool )
 
         # Clean up noproj files
         if options.delete:
@@ -451,8 +436,9 @@ def main():
               os.remove( cub )
 
         # Run a final cubenorm across the image:
-        cubenorm( mosaicked, options.delete )
+        cubenorm( mosaicked, pool, options.delete )
 
+        pool.print_timings()
         print("Finished")
         return 0
 
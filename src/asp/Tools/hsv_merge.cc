@@ -26,31 +26,51 @@ namespace fs = boost::filesystem;
 
 #include <vw/Cartography/GeoReference.h>
 
+#include <algorithm>
+#include <limits>
+
 using namespace vw;
 
 // Functors
-template <class Arg1T, class Arg2T>
-struct ReplaceChannelFunc: public ReturnFixedType<Arg1T> {
+
+/// Replace the value channel in HSV of an RGB pixel with a gray value,
+/// and convert back to RGB. The value is the largest of the RGB
+/// channels, and the hue and saturation depend only on their ratios, so
+/// this scales the RGB channels so that the largest one becomes the
+/// gray value. This is found without a round trip through HSV, which
+/// at integer channel types would also quantize the hue and saturation.
+template <class ChannelT>
+struct ReplaceValueFunc: public ReturnFixedType<PixelRGB<ChannelT> > {
+
+  inline PixelRGB<ChannelT> operator()( PixelRGB <ChannelT> const& rgb,
+                                        PixelGray<ChannelT> const& gray ) const {
+    float value = std::max(std::max(float(rgb[0]), float(rgb[1])), float(rgb[2]));
+    float target = gray[0];
+    if (value <= 0) // No hue or saturation
+      return PixelRGB<ChannelT>(gray[0], gray[0], gray[0]);
+    float scale = target / value;
+    PixelRGB<ChannelT> result;
+    for (int c = 0; c < 3; c++)
+      result[c] = convert(rgb[c] * scale);
+    return result;
+  }
+
 private:
-  int m_channel;
-public:
-  ReplaceChannelFunc( int const& channel ) : m_channel(channel) {}
-
-  inline Arg1T operator()( Arg1T const& arg1,
-                           Arg2T const& arg2 ) const {
-    Arg1T t( arg1 );
-    t[m_channel] = arg2;
-    return t;
+  // Round for integer channel types
+  static ChannelT convert(float val) {
+    if (std::numeric_limits<ChannelT>::is_integer)
+      return ChannelT(std::min(std::max(val + 0.5f, float(std::numeric_limits<ChannelT>::min())),
+                               float(std::numeric_limits<ChannelT>::max())));
+    return ChannelT(val);
   }
 };
 
 template <class Image1T, class Image2T>
-inline BinaryPerPixelView<Image1T, Image2T, ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> >
-replace_channel( ImageViewBase<Image1T> const& image1,
-                 int const& channel,
-                 ImageViewBase<Image2T> const& image2 ) {
-  typedef ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> func_type;
-  return BinaryPerPixelView<Image1T, Image2T, func_type >( image1.impl(), image2.impl(), func_type(channel));
+inline BinaryPerPixelView<Image1T, Image2T, ReplaceValueFunc<typename PixelChannelType<typename Image1T::pixel_type>::type> >
+replace_value( ImageViewBase<Image1T> const& rgb_image,
+               ImageViewBase<Image2T> const& gray_image ) {
+  typedef ReplaceValueFunc<typename PixelChannelType<typename Image1T::pixel_type>::type> func_type;
+  return BinaryPerPixelView<Image1T, Image2T, func_type >( rgb_image.impl(), gray_image.impl(), func_type());
 }
 
 // Standard Arguments
@@ -68,7 +88,7 @@ void do_merge(Options const& opt) {
   cartography::read_georeference(georef, opt.input_rgb);
 
   ImageViewRef<PixelRGB<ChannelT> > result =
-    pixel_cast<PixelRGB<ChannelT> >(replace_channel(pixel_cast<PixelHSV<ChannelT> >(rgb_image),2,shaded_image));
+    replace_value(rgb_image, shaded_image);
 
   bool has_georef = true;
   bool has_nodata = false;
@@ -38,6 +38,9 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <vector>
 
 #include <boost/program_options.hpp>
@@ -118,27 +121,6 @@ void tab(int indent) {
     std::cout << ' ';
 }
 
-// TODO: Are there pixel functions for these?
-template <typename T>
-T manual_min(const std::vector<T> &vec) {
-
-  T minVal = vec[0];
-  for (size_t i=1; i<vec.size(); ++i)
-    if (vec[i] < minVal)
-      minVal = vec[i];
-  return minVal;
-}
-template <typename T>
-T manual_max(const std::vector<T> &vec) {
-
-  T maxVal = vec[0];
-  for (size_t i=1; i<vec.size(); ++i)
-    if (vec[i] > maxVal)
-      maxVal = vec[i];
-  return maxVal;
-}
-
-
 // This type represents an operation performed on one or more inputs.
 struct calc_operation {
 
@@ -202,54 +184,6 @@ struct calc_operation {
       std::vector<calc_operation> temp = inputs[0].inputs;
       inputs = temp;
     }
-
-
-    /// Apply the operation tree to the input parameters and return a result
-    template <typename T>
-    T applyOperation(const std::vector<T> &params) const {
-      // Get the results from each input node.
-      // - This is a recursive call.
-      const size_t numInputs = inputs.size();
-      std::vector<T> inputResults(numInputs);
-      for (size_t i=0; i<numInputs; ++i)
-        inputResults[i] = inputs[i].applyOperation(params);
-
-      // Now perform the operation for this node
-      switch(opType) {
-        // Unary
-        case OP_number:   return T(value);
-        case OP_variable: if (varName >= static_cast<int>(params.size()))
-          vw_throw(ArgumentErr()
-                   << "Unrecognized variable input. Note that the first variable is var_0.\n");
-          return params[varName];
-        if (numInputs < 1)
-          vw_throw(LogicErr() << "Insufficient inputs for this operation.\n");
-        case OP_negate:   return T(-1 * inputResults[0]);
-        case OP_abs:      return T(std::abs(inputResults[0])); // regular abs casts to integer.
-
-        // Binary
-        if (numInputs < 2)
-          vw_throw(LogicErr() << "Insufficient inputs for this operation.\n");
-        case OP_add:      return (inputResults[0] + inputResults[1]);
-        case OP_subtract: return (inputResults[0] - inputResults[1]);
-        case OP_divide:   return (inputResults[0] / inputResults[1]);
-        case OP_multiply: return (inputResults[0] * inputResults[1]);
-        case OP_power:    return (pow(inputResults[0], inputResults[1]));
-
-        // Multi
-        case OP_min:      return manual_min(inputResults); // TODO: Do these functions exist?
-        case OP_max:      return manual_max(inputResults);
-
-        case OP_lt:   return (inputResults[0] <  inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_gt:   return (inputResults[0] >  inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_lte:  return (inputResults[0] <= inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_gte:  return (inputResults[0] >= inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_eq:   return (inputResults[0] == inputResults[1]) ? inputResults[2] : inputResults[3];
-
-        default:
-          vw_throw(LogicErr() << "Unexpected operation type.\n");
-      }
-    }
 };
 
 
@@ -361,6 +295,144 @@ struct calc_grammar : b_s::qi::grammar<ITER, calc_operation(), b_s::ascii::space
 }; // End struct calc_grammer
 
 
+//=================================================================================
+
+/// The operation tree compiled into a list of steps, each applying one
+/// operation to a whole row of values at a time, rather than walking the
+/// tree for each pixel. Each step writes its own row, and reads the rows
+/// of earlier steps or of the input images. The loops over a row have no
+/// branches other than the comparisons, so the compiler can vectorize them.
+class CalcProgram {
+public:
+  CalcProgram(): m_result(0) {}
+
+  CalcProgram(calc_operation const& tree, int num_images) {
+    m_result = compile(tree, num_images);
+  }
+
+  /// Space for the rows of all steps, with the constants filled in.
+  /// Each thread needs its own.
+  void init_workspace(int length, std::vector<double> & workspace) const {
+    workspace.resize(m_steps.size() * length);
+    for (size_t s = 0; s < m_steps.size(); s++) {
+      if (m_steps[s].op == OP_number)
+        std::fill(&workspace[s*length], &workspace[s*length] + length, m_steps[s].value);
+    }
+  }
+
+  /// Apply the operations to rows of the given length, one per input
+  /// image, stored one after another. Return the row of the results.
+  double const* run(double const* inputs, int length, std::vector<double> & workspace) const {
+    for (size_t s = 0; s < m_steps.size(); s++) {
+      Step const& step = m_steps[s];
+      if (step.op == OP_number)
+        continue;
+      double * out = &workspace[s*length];
+      std::vector<double const*> args(step.args.size());
+      for (size_t a = 0; a < args.size(); a++)
+        args[a] = row(step.args[a], inputs, length, workspace);
+      double const* x = args[0];
+      double const* y = (args.size() > 1) ? args[1] : NULL;
+      switch(step.op) {
+        case OP_negate:   for (int i = 0; i < length; i++) out[i] = -x[i];           break;
+        case OP_abs:      for (int i = 0; i < length; i++) out[i] = std::abs(x[i]);  break;
+        case OP_add:      for (int i = 0; i < length; i++) out[i] = x[i] + y[i];     break;
+        case OP_subtract: for (int i = 0; i < length; i++) out[i] = x[i] - y[i];     break;
+        case OP_divide:   for (int i = 0; i < length; i++) out[i] = x[i] / y[i];     break;
+        case OP_multiply: for (int i = 0; i < length; i++) out[i] = x[i] * y[i];     break;
+        case OP_power:    for (int i = 0; i < length; i++) out[i] = pow(x[i], y[i]); break;
+        case OP_min:
+          std::copy(x, x + length, out);
+          for (size_t a = 1; a < args.size(); a++)
+            for (int i = 0; i < length; i++) out[i] = (args[a][i] < out[i]) ? args[a][i] : out[i];
+          break;
+        case OP_max:
+          std::copy(x, x + length, out);
+          for (size_t a = 1; a < args.size(); a++)
+            for (int i = 0; i < length; i++) out[i] = (args[a][i] > out[i]) ? args[a][i] : out[i];
+          break;
+        case OP_lt:  select(std::less<double>(),          args, length, out); break;
+        case OP_gt:  select(std::greater<double>(),       args, length, out); break;
+        case OP_lte: select(std::less_equal<double>(),    args, length, out); break;
+        case OP_gte: select(std::greater_equal<double>(), args, length, out); break;
+        case OP_eq:  select(std::equal_to<double>(),      args, length, out); break;
+        default:
+          vw_throw(LogicErr() << "Unexpected operation type.\n");
+      }
+    }
+    return row(m_result, inputs, length, workspace);
+  }
+
+private:
+
+  // A step, or an input image i, stored as -1-i
+  struct Step {
+    OperationType    op;
+    double           value;
+    std::vector<int> args;
+  };
+
+  double const* row(int index, double const* inputs, int length,
+                    std::vector<double> const& workspace) const {
+    if (index < 0)
+      return inputs + (-1 - index) * length;
+    return &workspace[index * length];
+  }
+
+  // Pick the third or fourth argument depending on how the first two compare
+  template <class CompareT>
+  static void select(CompareT compare, std::vector<double const*> const& args,
+                     int length, double * out) {
+    for (int i = 0; i < length; i++)
+      out[i] = compare(args[0][i], args[1][i]) ? args[2][i] : args[3][i];
+  }
+
+  // Add the steps for this node after those for its inputs, and return
+  // where its result will be.
+  int compile(calc_operation const& node, int num_images) {
+
+    if (node.opType == OP_variable) {
+      if (node.varName < 0 || node.varName >= num_images)
+        vw_throw(ArgumentErr()
+                 << "Unrecognized variable input. Note that the first variable is var_0.\n");
+      return -1 - node.varName;
+    }
+
+    size_t num_inputs = node.inputs.size(), min_inputs = 0;
+    switch(node.opType) {
+      case OP_number:   min_inputs = 0; break;
+      case OP_pass:
+      case OP_negate:
+      case OP_abs:
+      case OP_min:
+      case OP_max:      min_inputs = 1; break;
+      case OP_lt:
+      case OP_gt:
+      case OP_lte:
+      case OP_gte:
+      case OP_eq:       min_inputs = 4; break;
+      default:          min_inputs = 2; break;
+    }
+    if (num_inputs < min_inputs)
+      vw_throw(ArgumentErr() << "Insufficient inputs for the operation "
+               << getTagName(node.opType) << ".\n");
+
+    if (node.opType == OP_pass) // This is just parentheses
+      return compile(node.inputs[0], num_images);
+
+    Step step;
+    step.op    = node.opType;
+    step.value = node.value;
+    for (size_t i = 0; i < num_inputs; i++)
+      step.args.push_back(compile(node.inputs[i], num_images));
+    m_steps.push_back(step);
+    return m_steps.size() - 1;
+  }
+
+  std::vector<Step> m_steps;
+  int               m_result;
+};
+
 //=================================================================================
 
 /// List of possible output data types
@@ -433,7 +505,7 @@ private: // Variables
   std::vector<bool      > m_has_nodata_vec;
   std::vector<input_pixel_type> m_nodata_vec;
   result_type    m_output_nodata;
-  calc_operation m_operation_tree;
+  CalcProgram    m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -448,7 +520,7 @@ public: // Functions
                  calc_operation const& operation_tree)
                   : m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
                     m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-                    m_operation_tree(operation_tree) {
+                    m_program(operation_tree, imageVec.size()) {
     const size_t numImages = imageVec.size();
     VW_ASSERT( (numImages > 0), ArgumentErr() << "ImageCalcView: One or more images required.." );
     VW_ASSERT( (has_nodata_vec.size() == numImages), LogicErr() << "ImageCalcView: Incorrect hasNodata count passed in.");
@@ -484,56 +556,49 @@ public: // Functions
     typedef typename ImageChannelType<ImageView<result_type> >::type output_channel_type;
 
     // Set up the output image tile
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-
-    // TODO: Left to right processing.
-
-    // Set up for pixel calculations
-    const size_t num_images = m_image_vec.size();
-    std::vector<input_pixel_type> input_pixels(num_images);
-    std::vector<double>           input_doubles(num_images);
+    ImageView<result_type> tile(bbox.width(), bbox.height(), m_num_channels);
 
     // Rasterize all the input images at this particular tile
+    const size_t num_images = m_image_vec.size();
     std::vector<ImageView<input_pixel_type> > input_tiles(num_images);
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
-        bool isNodata = false;
-        for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
+    // Process a row at a time, with the rows of the inputs one after another
+    const int width = bbox.width();
+    std::vector<double> input_rows(num_images * width), workspace;
+    std::vector<char>   is_nodata(width);
+    m_program.init_workspace(width, workspace);
 
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
-            isNodata = true;
-            break;
-          }
-        } // End image loop
+    for (int r = 0; r < bbox.height(); r++) {
 
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
+      // If any of the input pixels are nodata, the output is nodata.
+      std::fill(is_nodata.begin(), is_nodata.end(), 0);
+      for (size_t i=0; i<num_images; ++i) {
+        if (!m_has_nodata_vec[i])
           continue;
-        }
-
-
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
+        for (int c = 0; c < width; c++)
+          is_nodata[c] |= (m_nodata_vec[i] == input_tiles[i](c, r));
+      }
 
-          // Apply the operation tree to this pixel and store in the output pixel
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          //if (newVal > 255)
-          //  std::cout << "Value: " << newVal << " --> " << static_cast<double>(clamp_and_cast<output_channel_type>(newVal)) << "\n";
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i) {
+          double * in = &input_rows[i * width];
+          for (int c = 0; c < width; c++)
+            in[c] = input_tiles[i](c, r, chan)[0];
+        }
 
-        } // End channel loop
+        // Apply the operations to this row and store in the output pixels
+        double const* out = m_program.run(&input_rows[0], width, workspace);
+        for (int c = 0; c < width; c++) {
+          if (is_nodata[c])
+            tile(c, r, chan) = m_output_nodata;
+          else
+            tile(c, r, chan) = clamp_and_cast<output_channel_type>(out[c]);
+        }
+      } // End channel loop
 
-      } // End row loop
-    } // End column loop
+    } // End row loop
 
   // Return the tile we created with fake borders to make it look the size of the entire output image
   return prerasterize_type(tile,
@@ -27,6 +27,8 @@
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/AlgorithmFunctions.h>
 #include <vw/Image/Manipulation.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Core/ThreadPool.h>
 
 
 #include <asp/Core/Common.h>
@@ -108,7 +110,7 @@ void match_ip_in_regions(std::string const& image_file1,
     // If the match file already exists, load it instead of finding new points.
     if (boost::filesystem::exists(match_file)) {
       vw_out() << "Reading matched interest points from file: " << match_file << std::endl;
-      ip::read_binary_match_file(match_file, matched_ip1, matched_ip2);
+      asp::read_match_file(match_file, matched_ip1, matched_ip2);
       vw_out() << "Read in " << matched_ip1.size() << " matched IP.\n";
     }
   }
@@ -240,6 +242,22 @@ Matrix<double> compute_relative_transform(std::string const& image1,
 } // End function compute_relative_transform
 
 
+/// Compute the transform between a pair of consecutive images. Each pair
+/// is independent of the others, so these are run in parallel.
+class RelativeTransformTask: public Task, private boost::noncopyable {
+  std::string      m_image1, m_image2;
+  Options const&   m_opt;
+  Matrix<double> & m_transform;
+public:
+  RelativeTransformTask(std::string const& image1, std::string const& image2,
+                        Options const& opt, Matrix<double> & transform):
+    m_image1(image1), m_image2(image2), m_opt(opt), m_transform(transform) {}
+
+  virtual void operator()() {
+    m_transform = compute_relative_transform(m_image1, m_image2, m_opt);
+  }
+};
+
 /// Compute the positions of each image relative to the first image.
 /// - The top left corner of the first image is coordinate 0,0 in the output image.
 void compute_all_image_positions(Options const& opt,
@@ -273,11 +291,24 @@ void compute_all_image_positions(Options const& opt,
   // This approach only works for serial pairs, if we add another type of
   //  orientation it will need to be changed.
   Matrix<double> last_transform = identity_matrix(3);
+
+  // Match all consecutive pairs first, then chain the results in order.
+  std::vector<Matrix<double> > relative_transforms(num_images);
+  if (num_images > 1) {
+    int num_threads = std::min(int(num_images) - 1, vw_settings().default_num_threads());
+    FifoWorkQueue queue(std::max(num_threads, 1));
+    for (size_t i=1; i<num_images; ++i) {
+      boost::shared_ptr<RelativeTransformTask>
+        task(new RelativeTransformTask(opt.image_files[i-1], opt.image_files[i], opt,
+                                       relative_transforms[i]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
   
   for (size_t i=1; i<num_images; ++i) {
 
-    Matrix<double> relative_transform = 
-        compute_relative_transform(opt.image_files[i-1], opt.image_files[i], opt);
+    Matrix<double> const& relative_transform = relative_transforms[i];
 
     image_size = file_image_size(opt.image_files[i]);
 
@@ -407,18 +438,10 @@ public:
       typedef ImageView<T> ImageT;
       typedef InterpolationView<ImageT, BilinearInterpolation> InterpT;
       
-      // Find the required section of the input image.
-      //BBox2f temp_bbox = compute_transformed_bbox_fast(intersect, inv_trans);
-      BBox2i temp_bbox = m_transforms[i]->reverse_bbox(intersect);
-      temp_bbox.expand(BilinearInterpolation::pixel_buffer);
-      BBox2i input_bbox = temp_bbox;
-      input_bbox.crop(bounding_box(m_images[i]));
-      
       BBox2i tile_bbox = intersect - bbox.min(); // ROI of this input in the output tile
 
       //std::cout << "intersect = " << intersect << std::endl;
       //std::cout << "intersect.max() = " << intersect.max() << std::endl;
-      //std::cout << "input_bbox = " << input_bbox << std::endl;
       //std::cout << "tile_bbox = " << tile_bbox << std::endl;
 
       // TODO: Clean up
@@ -431,8 +454,20 @@ public:
       BBox2i expanded_intersect = intersect;
       expanded_intersect.expand(m_blend_radius);
       
+      // Read in memory the section of the input image needed for the
+      // expanded region, then transform it. The input image is block
+      // cached, so the blocks shared with the neighboring tiles are
+      // read from disk only once.
+      BBox2i source_box = m_transforms[i]->reverse_bbox(expanded_intersect);
+      source_box.expand(BilinearInterpolation::pixel_buffer);
+      source_box.crop(bounding_box(m_images[i]));
+      if (source_box.empty())
+        continue;
+      ImageT source = crop(m_images[i], source_box);
+      TranslateTransform to_full(source_box.min().x(), source_box.min().y());
+
       // Get the cropped piece of the transformed input image that we need
-      ImageView<T> trans_input = crop(transform(m_images[i], *temp,
+      ImageView<T> trans_input = crop(transform(source, compose(*temp, to_full),
                                                 ZeroEdgeExtension(),
                                                 BilinearInterpolation()),
                                       expanded_intersect);
@@ -685,11 +720,15 @@ int main( int argc, char *argv[] ) {
     size_t num_images = opt.image_files.size();
     std::vector<ImageViewRef<PixelMask<float> > > images(num_images);
     double nodata;
+    // Cache the input blocks, as the output tiles and their blending
+    // margins overlap. The cache size is set by --cache-size-mb.
+    Vector2i source_block_size = opt.raster_tile_size;
     for (size_t i=0; i<num_images; ++i) {
       // Apply a nodata mask here.
       ImageViewRef<float> temp;
       get_input_image(opt.image_files[i], opt, temp, nodata);
-      images[i] = create_mask_less_or_equal(temp, nodata);
+      images[i] = block_cache(create_mask_less_or_equal(temp, nodata),
+                              source_block_size, 1);
     }
 
     // If nodata was not provided, take one from the input images.
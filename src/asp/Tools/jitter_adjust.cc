@@ -73,6 +73,12 @@ const int NUM_POINT_PARAMS = 3;
 
 typedef Vector<double, NUM_CAMERA_PARAMS> camera_vector_t;
 
+// A residual is computed with the adjustments within this many of the
+// ones it floats, rather than with all the adjustments of its camera,
+// as those further away do not change where a point projects. This
+// keeps the cost of a residual from growing with the number of adjustments.
+const int ADJ_WINDOW_MARGIN = 5;
+
 // In spite of trying a lot, I could not find a way to make a base class
 // from which both AdjustedLinescanDGModel and PiecewiseAdjustedLinescanModel
 // could inherit. Hence this wrapper.
@@ -185,7 +191,31 @@ struct PiecewiseReprojectionError {
     m_camera_index3(camera_index3),
     m_camera_index4(camera_index4),
     m_end_index(end_index),
-    m_ipt(ipt){}
+    m_ipt(ipt){
+
+    // The window of adjustments to use for this residual, and the
+    // lines at which its first and last adjustments are placed. This
+    // is how the adjustments of the full camera would be placed.
+    int min_index = camera_index1, max_index = camera_index1;
+    int indices[] = {camera_index2, camera_index3, camera_index4};
+    for (int i = 0; i < 3; i++) {
+      if (indices[i] < 0)
+        continue;
+      min_index = std::min(min_index, indices[i]);
+      max_index = std::max(max_index, indices[i]);
+    }
+    m_win_start = std::max(start_index, min_index - ADJ_WINDOW_MARGIN);
+    m_win_end   = std::min(end_index,   max_index + ADJ_WINDOW_MARGIN + 1);
+    if (m_win_end - m_win_start < 2) {
+      // Need at least two adjustments
+      m_win_start = start_index;
+      m_win_end   = end_index;
+    }
+
+    double dl = (adjustment_bounds[1] - adjustment_bounds[0])/(end_index - start_index - 1.0);
+    m_win_bounds = Vector2(adjustment_bounds[0] + dl*(m_win_start   - start_index),
+                           adjustment_bounds[0] + dl*(m_win_end - 1 - start_index));
+  }
 
   template <typename T>
   bool do_calc(const T* const camera1, const T* const camera2,
@@ -195,10 +225,12 @@ struct PiecewiseReprojectionError {
     try{
 
       int num_cameras = m_cameras_vec.size();
-      std::vector<double> local_cameras_vec = m_cameras_vec;
 
-	// Copy the camera adjustments to local storage.  Update them
-	// with the latest value for the current camera being floated.
+      // Copy the camera adjustments in the window to local storage.
+      // Update them with the latest value for the cameras being floated.
+      std::vector<double> local_cameras_vec
+        (m_cameras_vec.begin() + NUM_CAMERA_PARAMS*m_win_start,
+         m_cameras_vec.begin() + NUM_CAMERA_PARAMS*m_win_end);
 
       for (int i = 1; i <= 4; i++) {
 
@@ -228,15 +260,15 @@ struct PiecewiseReprojectionError {
 		  ArgumentErr() << "Book-keeping failure in camera indicies");
 
 	for (int p = 0; p < NUM_CAMERA_PARAMS; p++) {
-	  local_cameras_vec[NUM_CAMERA_PARAMS*camera_index + p] = camera[p];
+	  local_cameras_vec[NUM_CAMERA_PARAMS*(camera_index - m_win_start) + p] = camera[p];
 	}
       }
 
-      // Extract the adjustments specific to the current camera
+      // Extract the adjustments in the window
       std::vector<vw::Vector3> position_adjustments;
       std::vector<vw::Quat>   pose_adjustments;
       populate_adjustements(local_cameras_vec,
-			    m_start_index, m_end_index,
+			    0, m_win_end - m_win_start,
 			    position_adjustments, pose_adjustments);
 
       // The adjusted camera has just the adjustments, it does not create a full
@@ -245,7 +277,7 @@ struct PiecewiseReprojectionError {
 
       asp::AdjustedModelWrapper cam_wrapper(m_session, m_cam,
                                             interp_type,
-                                            m_adjustment_bounds,
+                                            m_win_bounds,
                                             position_adjustments, pose_adjustments,
                                             m_image_size);
       
@@ -399,6 +431,11 @@ struct PiecewiseReprojectionError {
 
   int m_end_index;    // all adjustment indices for current camera will be < this
   int m_ipt;          // index of the current 3D point in the vector of points
+
+  // The adjustments with indices in [m_win_start, m_win_end) are used,
+  // placed between the lines in m_win_bounds.
+  int m_win_start, m_win_end;
+  Vector2 m_win_bounds;
 };
 
 // A ceres cost function. The residual is the difference between the
@@ -520,7 +557,7 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   std::vector<Vector2> adjustment_bounds;
   adjustment_bounds.resize(num_cameras);
   std::vector<ip::InterestPoint> ip0, ip1;
-  ip::read_binary_match_file(match_file, ip0, ip1);
+  asp::read_match_file(match_file, ip0, ip1);
   adjustment_bounds[0]
     = find_bounds_from_percentiles(ip0, stereo_settings().piecewise_adjustment_percentiles);
   adjustment_bounds[1]
@@ -773,8 +810,20 @@ void jitter_adjust(std::vector<std::string> const& image_files,
 
   options.num_threads = num_threads;
 
+  // Eliminate the points first (group 0), then solve for the adjustments
+  // (group 1). A point affects only a few neighboring adjustments of each
+  // camera, so the reduced matrix for the adjustments is banded, and its
+  // sparse factorization grows linearly with the number of adjustments.
+  ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point = points + ipt * NUM_POINT_PARAMS;
+    if (problem.HasParameterBlock(point))
+      ordering->AddElementToGroup(point, 0);
+  }
+  for (int cam_index = 0; cam_index < num_total_adj; cam_index++)
+    ordering->AddElementToGroup(cameras + cam_index * NUM_CAMERA_PARAMS, 1);
+  options.linear_solver_ordering.reset(ordering);
   options.linear_solver_type = ceres::SPARSE_SCHUR;
-  //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
   //options->max_solver_time_in_seconds = FLAGS_max_solver_time;
   //options->use_nonmonotonic_steps = FLAGS_nonmonotonic_steps;
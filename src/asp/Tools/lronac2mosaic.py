@@ -27,8 +27,6 @@ from stereo_utils import get_asp_version
 import asp_system_utils
 asp_system_utils.verify_python_version_is_supported()
 
-job_pool = [];
-
 # Global output folder variable
 outputFolder = ""
 
@@ -53,19 +51,6 @@ class Usage(Exception):
     def __init__(self, msg):
         self.msg = msg
 
-def add_job( cmd, num_working_threads=4 ):
-    if ( len(job_pool) >= num_working_threads):
-        job_pool[0].wait();
-        job_pool.pop(0);
-    print(cmd)
-    job_pool.append( subprocess.Popen(cmd, shell=True, env=os.environ) );
-
-def wait_on_all_jobs():
-    print("Waiting for jobs to finish")
-    while len(job_pool) > 0:
-        job_pool[0].wait();
-        job_pool.pop(0);
-
 # Go through a list of cubes and sort them into left/right pairs
 def build_cube_pairs(cubePaths):
     pairDict = dict();
@@ -115,75 +100,56 @@ def read_flatfile( flat ):
     print(str(averages))
     return averages
 
-# Call lronac2isis on each input file, return list of output files.
-def lronac2isis( img_files, threads, outputFolder ):
+# Call lronac2isis, lronaccal and lronacecho on each input file, return
+# list of output files. Each file goes through these steps on its own.
+def lronac2isis_cal_echo( img_files, pool, outputFolder, delete=False ):
     lronac2isis_cubs = []
+    lronaccal_cubs   = []
+    lronacecho_cubs  = []
     for img in img_files:
         # Expect to end in .IMG, change to end in .cub and move to output folder
         newExtension = os.path.splitext(img)[0] + '.cub'
         cubFilePath  = os.path.join(outputFolder, os.path.basename(newExtension))
-        if( os.path.exists(cubFilePath) ):
-            print(cubFilePath + ' exists, skipping lronac2isis.')
-        else:
-            cmd = 'lronac2isis from='+ img +' to='+ cubFilePath
-            add_job(cmd, threads)
-        lronac2isis_cubs.append( cubFilePath )
-    wait_on_all_jobs()
-    return lronac2isis_cubs
+        # Then in .lronaccal.cub and in .lronaccal.lronacecho.cub
+        calCub  = os.path.splitext(cubFilePath)[0] + '.lronaccal.cub'
+        echoCub = os.path.splitext(calCub)[0] + '.lronacecho.cub'
 
-
-# Call lronaccal on each input file, return list of output files.
-def lronaccal( cub_files, threads, delete=False ):
-    lronaccal_cubs = []
-    for cub in cub_files:
-        # Expect to end in .cub, change to end in .lronaccal.cub
-        to_cub = os.path.splitext(cub)[0] + '.lronaccal.cub'
-        if( os.path.exists(to_cub) ):
-            print(to_cub + ' exists, skipping lronaccal.')
+        steps = []
+        if( os.path.exists(echoCub) ):
+            print(echoCub + ' exists, skipping lronacecho.')
         else:
-            cmd = 'lronaccal from='+ cub +' to='+ to_cub
-            add_job(cmd, threads)
-        lronaccal_cubs.append( to_cub )
-    wait_on_all_jobs()
-
-    if( delete ): # Delete all input .cub files and log files
-        for cub in cub_files:
-          os.remove( cub )
-        lronaccal_log_files = glob.glob( os.path.commonprefix(cub_files) + '*.lronaccal.log' )
+            if( os.path.exists(calCub) ):
+                print(calCub + ' exists, skipping lronaccal.')
+            else:
+                if( os.path.exists(cubFilePath) ):
+                    print(cubFilePath + ' exists, skipping lronac2isis.')
+                else:
+                    steps.append(('lronac2isis', 'lronac2isis from='+ img +' to='+ cubFilePath))
+                steps.append(('lronaccal', 'lronaccal from='+ cubFilePath +' to='+ calCub))
+            steps.append(('lronacecho', 'lronacecho from='+ calCub +' to='+ echoCub))
+        pool.add(steps)
+
+        lronac2isis_cubs.append( cubFilePath )
+        lronaccal_cubs.append( calCub )
+        lronacecho_cubs.append( echoCub )
+    pool.wait_all()
+
+    if( delete ): # Delete all intermediate .cub files and log files
+        for cub in lronac2isis_cubs + lronaccal_cubs:
+          if os.path.exists(cub):
+            os.remove( cub )
+        lronaccal_log_files = glob.glob( os.path.commonprefix(lronac2isis_cubs) + '*.lronaccal.log' )
         for file in lronaccal_log_files:
           os.remove( file )
-    return lronaccal_cubs
-
-
-# Call lronacecho on each input file, return list of output files.
-def lronacecho( cub_files, threads, delete=False ):
-    lronacecho_cubs = []
-    for cub in cub_files:
-        # Expect to end in .cub, change to end in .lronaccal.cub
-        to_cub = os.path.splitext(cub)[0] + '.lronacecho.cub'
-        if( os.path.exists(to_cub) ):
-            print(to_cub + ' exists, skipping lronacecho.')
-        else:
-            cmd = 'lronacecho from='+ cub +' to='+ to_cub
-            add_job(cmd, threads)
-        lronacecho_cubs.append( to_cub )
-    wait_on_all_jobs()
-
-    if( delete ): # Delete all input .cub files and log files
-        for cub in cub_files:
-          os.remove( cub )
     return lronacecho_cubs
 
 
-def spice( cub_files, threads):
+# Attach SPICE to each cube, then fit it, one cube at a time in each job.
+def spice( cub_files, pool):
     for cub in cub_files:
-        cmd = 'spiceinit web=false from='+ cub
-        add_job(cmd, threads)
-    wait_on_all_jobs()
-    for cub in cub_files:
-        cmd = 'spicefit from='+ cub
-        add_job(cmd, threads)
-    wait_on_all_jobs()
+        pool.add([('spiceinit', 'spiceinit web=false from='+ cub),
+                  ('spicefit',  'spicefit from='+ cub)])
+    pool.wait_all()
     return
 
 # Returns true if the .cub LRONAC file has CROSSTRACK_SUMMING = 1
@@ -203,7 +169,7 @@ def isFileHalfRes(cubFilePath):
 
 
 # Left file is/home/smcmich1 in index 0, right is in index 1
-def noproj( file_pairs, threads, delete, fakePvl, outputFolder):
+def noproj( file_pairs, pool, delete, fakePvl, outputFolder):
     if fakePvl: # Generate temporary PVL files containing LRONAC definition
                 # - We need one for full-res mode, one for half-X-res mode.
 
@@ -284,8 +250,8 @@ def noproj( file_pairs, threads, delete, fakePvl, outputFolder):
                   + ' to=' + os.path.abspath(to_cub) + ' && ' \
                   + 'cd .. && rm -rf ' + tempDir
 
-              add_job(cmd, threads)
-    wait_on_all_jobs()
+              pool.add(('noproj', cmd))
+    pool.wait_all()
 
     if( delete ): # Clean up input cube files
         for v in file_pairs.values():
@@ -297,15 +263,15 @@ def noproj( file_pairs, threads, delete, fakePvl, outputFolder):
     return noproj_pairs;
 
 
-def lronacjitreg( noproj_pairs, threads, delete=False ):
+def lronacjitreg( noproj_pairs, pool, delete=False ):
     boundsCommands = '--correlator-type 2 --kernel 15 15'
     for k,v in noproj_pairs.items():
         cmd = 'lronacjitreg ' + boundsCommands    \
             + ' --output-log outputLog_'+str(k)+'.txt' \
             + ' '+ v[0] \
             + ' '+ v[1];
-        add_job(cmd, threads)
-    wait_on_all_jobs()
+        pool.add(('lronacjitreg', cmd))
+    pool.wait_all()
 
     # Read in all the shift values from the output text files
     averages = dict()
@@ -319,7 +285,7 @@ def lronacjitreg( noproj_pairs, threads, delete=False ):
     return averages
 
 
-def mosaic( noproj_pairs, averages, threads ):
+def mosaic( noproj_pairs, averages, pool ):
     mosaicList = dict();
     for k,v in noproj_pairs.items():
 
@@ -333,35 +299,35 @@ def mosaic( noproj_pairs, averages, threads ):
         handmos( v[1], mosaicPath,
                  str( int(round( xOffset )) ),
                  str( int(round( yOffset )) ),
-                 threads )
+                 pool )
         mosaicList[k] = mosaicPath;
 
-    wait_on_all_jobs()
+    pool.wait_all()
 
     return mosaicList
 
 
-def handmos( fromcub, tocub, outsamp, outline, threads ):
+def handmos( fromcub, tocub, outsamp, outline, pool ):
     cmd = 'handmos from='+ fromcub +' mosaic='+ tocub \
             +' outsample = '+ str(outsamp) \
             +' outline = '  + str(outline) \
             +' matchbandbin=FALSE priority=ontop';
-    add_job(cmd, threads);
+    pool.add(('handmos', cmd));
     return
 
 
-def cubenorm( mosaicList, threads, delete=False ):
+def cubenorm( mosaicList, pool, delete=False ):
     normedList = dict();
     for k,v in mosaicList.items():
 
         normedPath = os.path.splitext(v)[0] + '.norm.cub'
 
         cmd = 'cubenorm from='+ v +' to='+ normedPath
-        add_job(cmd, threads);
+        pool.add(('cubenorm', cmd));
 
         normedList[k] = normedPath;
 
-    wait_on_all_jobs()
+    pool.wait_all()
 
     if( delete ): # Clean up input cube files
         for v in mosaicList.values():
@@ -369,7 +335,7 @@ def cubenorm( mosaicList, threads, delete=False ):
 
     return normedList
 
-def cropInputs(inputFiles, outputFolder, cropAmount, threads, delete=False):
+def cropInputs(inputFiles, outputFolder, cropAmount, pool, delete=False):
 
     outputPaths = []
     for path in inputFiles:
@@ -377,10 +343,10 @@ def cropInputs(inputFiles, outputFolder, cropAmount, threads, delete=False):
         newExtension = os.path.splitext(path)[0] + '.cropped.cub'
         croppedPath  = os.path.join(outputFolder, os.path.basename(newExtension))
         cmd = 'crop from='+ path +' to='+ croppedPath + ' nlines=' + str(cropAmount)
-        add_job(cmd, threads)
+        pool.add(('crop', cmd))
         outputPaths.append( croppedPath )
 
-    wait_on_all_jobs()
+    pool.wait_all()
 
     if delete:
         for path in inputFiles:
@@ -414,7 +380,7 @@ def main():
             parser.add_option("-c", "--crop", dest="cropAmount",
                               help="Process only the first N lines of the image.",type="int")
             parser.add_option("-t", "--threads", dest="threads",
-                              help="Number of threads to use.",type="int")
+                              help="How many ISIS programs to run at the same time (default 4).",type="int")
             parser.add_option("-k", "--keep", action="store_false",
                               dest="delete",
                               help="Will not delete intermediate files.")
@@ -440,26 +406,24 @@ def main():
 
         print("Beginning processing.....")
 
-        if not options.resume_no_proj: # If not skipping to later point
-
-            print("lronac2isis") # Per-file operation, returns list of new files
-            lronac2isised = lronac2isis( args, options.threads, options.outputFolder )
+        # Run the ISIS programs for the input files in parallel
+        pool = asp_system_utils.JobPool(options.threads)
 
-            print("lronaccal")   # Per-file operation, returns list of new files
-            lronaccaled = lronaccal( lronac2isised, options.threads, options.delete )
+        if not options.resume_no_proj: # If not skipping to later point
 
-            print("lronacecho")  # Per-file operation, returns list of new files
-            lronacechod = lronacecho( lronaccaled, options.threads, options.delete )
+            print("lronac2isis, lronaccal, lronacecho") # Per-file operations, return list of new files
+            lronacechod = lronac2isis_cal_echo( args, pool, options.outputFolder, options.delete )
 
             if (options.cropAmount > 0): # Crop the input files as soon as ISIS calls allow it
                 lronacechod = cropInputs(lronacechod, options.outputFolder, options.cropAmount,
-                                         options.threads, options.delete)
+                                         pool, options.delete)
 
             print("spice")       # Attach spice info to cubes (adds to existing files)
-            spice( lronacechod, options.threads )
+            spice( lronacechod, pool )
 
 
         if options.stop_no_proj: # Stop early if requested
+            pool.print_timings()
             print("Finished")
             return 0
 
@@ -470,13 +434,13 @@ def main():
         lronac_file_pairs = build_cube_pairs( lronacechod )
 
         print("noproj")       # Per-file operation
-        noprojed_file_pairs = noproj( lronac_file_pairs, options.threads, options.delete, options.fakePvl, options.outputFolder)
+        noprojed_file_pairs = noproj( lronac_file_pairs, pool, options.delete, options.fakePvl, options.outputFolder)
 
         print("lronacjitreg") # Determines mean shift for each file pair
-        averages = lronacjitreg( noprojed_file_pairs, options.threads, options.delete )
+        averages = lronacjitreg( noprojed_file_pairs, pool, options.delete )
 
         print("mosaic")       # handmos - Use mean shifts to combine the file pairs
-        mosaicked = mosaic( noprojed_file_pairs, averages, options.threads )
+        mosaicked = mosaic( noprojed_file_pairs, averages, pool )
 
         # Clean up noproj files
         if( options.delete ):
@@ -485,8 +449,9 @@ def main():
               os.remove( cub[1] )
 
         # Run a final cubenorm across the image:
-        cubenorm( mosaicked, options.threads, options.delete )
+        cubenorm( mosaicked, pool, options.delete )
 
+        pool.print_timings()
         print("Finished")
         return 0
 
@@ -36,6 +36,8 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Tools/stereo.h>
 
+#include <vw/Core/ThreadPool.h>
+
 #include <iomanip>
 
 #include <boost/accumulators/accumulators.hpp>
@@ -121,6 +123,51 @@ bool handle_arguments(int argc, char* argv[],
   return true;
 }
 
+// The sums of the valid disparities, and of their squares, in a row
+struct RowSums {
+  int    count;
+  double sum_x, sum_y, sum_x2, sum_y2;
+  RowSums(): count(0), sum_x(0), sum_y(0), sum_x2(0), sum_y2(0) {}
+};
+
+// Find the disparity in a band of rows, and sum it up per row. The bands
+// are processed in parallel, and each writes only the sums of its rows.
+class RowSumsTask: public vw::Task, private boost::noncopyable {
+  ImageViewRef<PixelMask<Vector2f> > const& m_disparity;
+  BBox2i                                     m_box;
+  std::vector<RowSums>                     & m_sums;
+public:
+  RowSumsTask(ImageViewRef<PixelMask<Vector2f> > const& disparity, BBox2i const& box,
+              std::vector<RowSums> & sums):
+    m_disparity(disparity), m_box(box), m_sums(sums) {}
+
+  virtual void operator()() {
+    ImageView<PixelMask<Vector2f> > band = crop(m_disparity, m_box);
+    for (int row = 0; row < band.rows(); row++) {
+      RowSums & sums = m_sums[m_box.min().y() + row];
+      for (int col = 0; col < band.cols(); col++) {
+        if (!is_valid(band(col, row)))
+          continue;
+        double dX = band(col, row)[0];
+        double dY = band(col, row)[1];
+        sums.count++;
+        sums.sum_x  += dX;
+        sums.sum_y  += dY;
+        sums.sum_x2 += dX*dX;
+        sums.sum_y2 += dY*dY;
+      }
+    }
+  }
+};
+
+// The standard deviation, from the sum and sum of squares of n values
+double std_dev(double sum, double sum2, double n) {
+  if (n <= 0)
+    return 0;
+  double mean = sum/n;
+  return sqrt(std::max(sum2/n - mean*mean, 0.0));
+}
+
 bool determineShifts(Parameters & params, 
                      double &dX, double &dY)
 {
@@ -252,16 +299,17 @@ bool determineShifts(Parameters & params,
   printf("Running stereo correlation...\n");
   
   // Pyramid Correlation works best rasterizing in 1024^2 chunks
-  vw_settings().set_default_tile_size(1024);
+  const int tile_size = 1024;
+  vw_settings().set_default_tile_size(tile_size);
 
   int    filter_kernel_size = 5;
   int    max_pyramid_levels = 5;
   int    corr_timeout       = 0;
   int    min_lr_level = 0;
   double seconds_per_op     = 0.0;
-  DiskCacheImageView<PixelMask<Vector2f> >
+  ImageViewRef<PixelMask<Vector2f> >
     disparity_map
-    ( stereo::pyramid_correlate( apply_mask(create_mask_less_or_equal(crop(left_disk_image,  crop_roi),0)),
+    = ( stereo::pyramid_correlate( apply_mask(create_mask_less_or_equal(crop(left_disk_image,  crop_roi),0)),
 				 apply_mask(create_mask_less_or_equal(crop(right_disk_image, crop_roi),0)),
 				 constant_view( uint8(255), left_disk_image ),
 				 constant_view( uint8(255), right_disk_image ),
@@ -271,9 +319,21 @@ bool determineShifts(Parameters & params,
 				 corr_type, corr_timeout, seconds_per_op,
 				 params.lrthresh, min_lr_level, filter_kernel_size, max_pyramid_levels ) );
 
-  // Compute the mean horizontal and vertical shifts
-  // - Currently disparity_map contains the per-pixel shifts
-  
+  // Compute the disparity in bands of rows, in parallel, and sum it up
+  // for each row. Since disparity_map has the width of the crop
+  // region, each band is one tile.
+  std::vector<RowSums> row_sums(disparity_map.rows());
+  {
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int start = 0; start < disparity_map.rows(); start += tile_size) {
+      BBox2i box(0, start, disparity_map.cols(),
+                 std::min(tile_size, disparity_map.rows() - start));
+      boost::shared_ptr<RowSumsTask> task(new RowSumsTask(disparity_map, box, row_sums));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
   printf("Accumulating offsets...\n");  
 
   std::ofstream out;
@@ -326,36 +386,16 @@ bool determineShifts(Parameters & params,
   int    numValidRows        = 0;
   int    totalNumValidPixels = 0;
   
-  vw::StdDevAccumulator<float> stdCalcX, stdCalcY;
-  
+  // The sums over all rows
+  RowSums total;
+
   std::vector<double> rowOffsets(disparity_map.rows());
   std::vector<double> colOffsets(disparity_map.rows());  
   for (int row=0; row<disparity_map.rows(); ++row)
   {
-  
-    // Accumulate the shifts for this row
-    vw::StdDevAccumulator<float> stdDevCalcRow;
-    double rowSum        = 0.0;
-    double colSum        = 0.0;
+    RowSums const& sums = row_sums[row];
+    int    numValidInRow = sums.count;
     double stdDevRow     = 0.0;
-    int    numValidInRow = 0;
-    for (int col=0; col<disparity_map.cols(); ++col)
-    {
-    
-      if (is_valid(disparity_map(col,row)))
-      {
-        float dY = disparity_map(col,row)[1]; // Y
-        float dX = disparity_map(col,row)[0]; // X
-        rowSum += dY;
-        colSum += dX;
-        ++numValidInRow;
-      
-        stdCalcX(dX);
-        stdCalcY(dY);
-
-        stdDevCalcRow(dY);
-      }
-    } // End loop through cols
 
     // Compute mean shift for this row
     if (numValidInRow == 0)
@@ -366,11 +406,17 @@ bool determineShifts(Parameters & params,
     }
     else  // At least one valid pixel
     {
-      rowOffsets[row] = rowSum / static_cast<double>(numValidInRow);
-      colOffsets[row] = colSum / static_cast<double>(numValidInRow);
-      stdDevRow = stdDevCalcRow.value();
+      rowOffsets[row] = sums.sum_y / static_cast<double>(numValidInRow);
+      colOffsets[row] = sums.sum_x / static_cast<double>(numValidInRow);
+      stdDevRow = std_dev(sums.sum_y, sums.sum_y2, numValidInRow);
       totalNumValidPixels += numValidInRow;
       ++numValidRows;      
+
+      total.count  += sums.count;
+      total.sum_x  += sums.sum_x;
+      total.sum_y  += sums.sum_y;
+      total.sum_x2 += sums.sum_x2;
+      total.sum_y2 += sums.sum_y2;
     }
     
     if (writeLogFile)
@@ -404,10 +450,12 @@ bool determineShifts(Parameters & params,
     if(numValidRows > 0) 
     {
       out << "#   Using IpFind result only:   0" << endl;
-      out << "#   Average Sample Offset: " << setprecision(4) << stdCalcX.mean()
-          << "  StdDev: " << setprecision(4) << stdCalcX.value() << endl;
-      out << "#   Average Line Offset:   " << setprecision(4) << stdCalcY.mean()
-          << " StdDev: " << setprecision(4) << stdCalcY.value() << endl;
+      out << "#   Average Sample Offset: " << setprecision(4) << total.sum_x/total.count
+          << "  StdDev: " << setprecision(4)
+          << std_dev(total.sum_x, total.sum_x2, total.count) << endl;
+      out << "#   Average Line Offset:   " << setprecision(4) << total.sum_y/total.count
+          << " StdDev: " << setprecision(4)
+          << std_dev(total.sum_y, total.sum_y2, total.count) << endl;
      }
      else  // No valid rows
      {
@@ -438,8 +486,10 @@ bool determineShifts(Parameters & params,
   }
   
   // Compute overall mean shift
-  meanVertOffset  = stdCalcY.mean();
-  meanHorizOffset = stdCalcX.mean();
+  if (total.count > 0) {
+    meanVertOffset  = total.sum_y/total.count;
+    meanHorizOffset = total.sum_x/total.count;
+  }
   
   dX = meanHorizOffset;
   dY = meanVertOffset;
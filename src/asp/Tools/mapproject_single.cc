@@ -34,9 +34,18 @@
 #include <asp/Core/Common.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Camera/ApproxCameraModel.h>
+#include <asp/Camera/CameraCache.h>
+#include <asp/Core/CameraGridTransform.h>
+#include <asp/Core/CameraGrid.h>
 
 #include <boost/algorithm/string/replace.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
@@ -51,13 +60,14 @@ typedef PixelMask<float> DemPixelT;
 struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
-    bundle_adjust_prefix;
-  bool isQuery, noGeoHeaderInfo, nearest_neighbor;
+    bundle_adjust_prefix, image_list;
+  bool isQuery, noGeoHeaderInfo, nearest_neighbor, write_camera_grid, camera_grid_only;
   bool multithreaded_model; // This is set based on the session type.
 
   // Settings
   std::string target_srs_string, output_type, metadata;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  double nodata_value, tr, mpp, ppd, datum_offset, approx_camera_error,
+    camera_grid_error;
   BBox2 target_projwin, target_pixelwin;
 };
 
@@ -88,6 +98,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("bundle-adjust-prefix", po::value(&opt.bundle_adjust_prefix),
      "Use the camera adjustment obtained by previously running bundle_adjust with this output prefix.")
     ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type, when the input is single channel. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type. This option will be ignored for multi-channel images, when the output type is set to be the same as the input type.")
+    ("approximate-camera-error", po::value(&opt.approx_camera_error)->default_value(0),
+     "If positive, use an approximation of the camera, interpolated from tables of the camera over the DEM and over the image, made fine enough that the error, in pixels, is below this value. Much faster for ISIS and CSM cameras.")
+    ("camera-grid-error", po::value(&opt.camera_grid_error)->default_value(0),
+     "If positive, project into the camera exactly only on a grid in each block of output pixels, and interpolate bilinearly in between. The grid is refined where the interpolation error at the centers of its cells, in pixels, is above this value. Much faster for all cameras.")
+    ("write-camera-grid", po::bool_switch(&opt.write_camera_grid)->default_value(false),
+     "Also write the camera pixels of every 16th output pixel, and the interpolation errors at the centers of the cells of that grid, to <output-image>.camgrid. Stereo triangulation from the output image then interpolates them, rather than projecting into the camera again, where the error is small enough.")
+    ("camera-grid-only", po::bool_switch(&opt.camera_grid_only)->default_value(false),
+     "Only write the camera grid of an existing output image, as for --write-camera-grid. Used when the image was projected in tiles.")
+    ("image-list", po::value(&opt.image_list)->default_value(""),
+     "Project onto the DEM all the images in this file, in one process. Each line must have an image, its camera, and the output file. The images are processed in the order of their footprints on the DEM, and the blocks of the DEM, once read, are shared by all of them. Then only the DEM is passed on the command line.")
     ("nearest-neighbor", po::bool_switch(&opt.nearest_neighbor)->default_value(false),
       "Use nearest neighbor interpolation.  Useful for classification images.")
     ("mo",  po::value(&opt.metadata)->default_value(""), "Write metadata to the output file. Provide as a string in quotes if more than one item, separated by a space, such as 'VAR1=VALUE1 VAR2=VALUE2'. Neither the variable names nor the values should contain spaces.")
@@ -117,8 +137,13 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                              positional, positional_desc, usage,
                              allow_unregistered, unregistered );
 
-  if ( !vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model") )
+  if (opt.image_list != "") {
+    if ( !vm.count("dem") || vm.count("camera-image") )
+      vw_throw( ArgumentErr() << "With --image-list, specify only the DEM on the command line.\n"
+                << usage << general_options );
+  } else if ( !vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model") ) {
     vw_throw( ArgumentErr() << usage << general_options );
+  }
 
   // If exactly three files were passed in, the last one must be the output file and the image file
   // must contain the camera model.
@@ -139,6 +164,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.stereo_session = "rpc";
   }
 
+  if (opt.camera_grid_only)
+    opt.write_camera_grid = true;
+
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
@@ -342,13 +370,25 @@ void calc_target_geom(// Inputs
   //   This is in a unit defined by dem_georef and also might not be meters.
   // - This call WILL intersect pixels outside the dem valid area!
   // - TODO: Modify this function to optionally disable intersection outside the DEM
+  // - The result is cached, as the tiles of a parallel run all need it.
   float auto_res;
   bool quick = datum_dem; // The non-quick option does not make sense with huge DEMs.
+  std::string cache_camera = opt.camera_file.empty() ? opt.image_file : opt.camera_file;
+  std::ostringstream cache_key;
+  cache_key.precision(17);
+  cache_key << "mapproject " << quick << " "
+            << asp::file_fingerprint(opt.dem_file) << " " << opt.datum_offset << " "
+            << dem_georef.overall_proj4_str() << " " << dem_georef.transform() << " "
+            << target_georef.overall_proj4_str() << " "
+            << asp::camera_fingerprint(camera_model.get(), image_size);
   try {
-    cam_box = camera_bbox(dem, dem_georef,
-                          target_georef, 
-                          camera_model,
-                          image_size.x(), image_size.y(), auto_res, quick);
+    if (!asp::read_footprint_cache(cache_camera, cache_key.str(), cam_box, auto_res)) {
+      cam_box = camera_bbox(dem, dem_georef,
+                            target_georef, 
+                            camera_model,
+                            image_size.x(), image_size.y(), auto_res, quick);
+      asp::write_footprint_cache(cache_camera, cache_key.str(), cam_box, auto_res);
+    }
   } catch (std::exception const& e) {
     if (opt.target_projwin == BBox2() || calc_target_res) {
       vw_throw( ArgumentErr()
@@ -562,8 +602,217 @@ void project_image_alpha(Options & opt,
 
 }
 
-// The two "pick" functions below select between the Map2CamTrans and Datum2CamTrans
-// transform classes which will be passed to the image projection function.
+/// Like Map2CamTrans, but with the heights looked up in a DEM view which
+/// is shared by all images of a batch run, so that the blocks of the DEM
+/// are read once per process rather than once per image. The part of the
+/// DEM under an output tile is copied for the thread working on it.
+class SharedDem2CamTrans: public TransformBase<SharedDem2CamTrans> {
+public:
+  SharedDem2CamTrans(camera::CameraModel const* cam,
+                     GeoReference const& image_georef,
+                     GeoReference const& dem_georef,
+                     ImageViewRef<DemPixelT> const& dem,
+                     Vector2i const& image_size,
+                     bool nearest_neighbor):
+    m_cam(cam), m_image_georef(image_georef), m_dem_georef(dem_georef), m_dem(dem),
+    m_image_box(0, 0, image_size[0], image_size[1]), m_nearest_neighbor(nearest_neighbor),
+    m_id(next_id()) {}
+
+  /// Pixels which do not project into the camera go far from the image
+  Vector2 reverse(Vector2 const& p) const {
+    Vector2 lonlat = m_image_georef.pixel_to_lonlat(p);
+    double height = 0;
+    if (!dem_height(m_dem_georef.lonlat_to_pixel(lonlat), height))
+      return invalid_pixel();
+    Vector3 xyz = m_dem_georef.datum().geodetic_to_cartesian
+      (Vector3(lonlat[0], lonlat[1], height));
+    try {
+      return m_cam->point_to_pixel(xyz);
+    } catch(...) {}
+    return invalid_pixel();
+  }
+
+  /// Copy the DEM under the tile, then find the image pixels seen from
+  /// the tile boundary and a grid inside it, ignoring those which do not
+  /// project. The margin allows for relief between the grid points and
+  /// for the interpolation of the image.
+  BBox2i reverse_bbox(BBox2i const& bbox) const {
+    cache_dem(bbox);
+    BBox2 box;
+    for (int x = bbox.min().x(); x < bbox.max().x(); x++) {
+      grow_valid(box, Vector2(x, bbox.min().y()));
+      grow_valid(box, Vector2(x, bbox.max().y() - 1));
+    }
+    for (int y = bbox.min().y(); y < bbox.max().y(); y++) {
+      grow_valid(box, Vector2(bbox.min().x(),     y));
+      grow_valid(box, Vector2(bbox.max().x() - 1, y));
+    }
+    const int step = 8;
+    for (int y = bbox.min().y() + step; y < bbox.max().y() - 1; y += step)
+      for (int x = bbox.min().x() + step; x < bbox.max().x() - 1; x += step)
+        grow_valid(box, Vector2(x, y));
+    if (box.empty())
+      return BBox2i();
+
+    BBox2i result = grow_bbox_to_int(box);
+    result.expand(4);
+    BBox2i image_box = m_image_box;
+    image_box.expand(4);
+    result.crop(image_box);
+    return result;
+  }
+
+private:
+
+  static Vector2 invalid_pixel() { return Vector2(-1e10, -1e10); }
+
+  void grow_valid(BBox2 & box, Vector2 const& p) const {
+    Vector2 pix = reverse(p);
+    if (pix[0] > invalid_pixel()[0])
+      box.grow(pix);
+  }
+
+  struct DemCache {
+    long id;
+    BBox2i box;
+    ImageView<DemPixelT> dem;
+    DemCache(): id(-1) {}
+  };
+
+  static DemCache & thread_cache() {
+    static thread_local DemCache cache;
+    return cache;
+  }
+
+  // Copies of a transform share its id
+  static long next_id() {
+    static std::atomic<long> counter(0);
+    return counter++;
+  }
+
+  void cache_dem(BBox2i const& bbox) const {
+    BBox2 dem_box;
+    for (int i = 0; i <= 2; i++) {
+      for (int j = 0; j <= 2; j++) {
+        Vector2 p = Vector2(bbox.min()) + Vector2(i*bbox.width(), j*bbox.height())/2.0;
+        dem_box.grow(m_dem_georef.lonlat_to_pixel(m_image_georef.pixel_to_lonlat(p)));
+      }
+    }
+    BBox2i dem_ibox = grow_bbox_to_int(dem_box);
+    dem_ibox.expand(2);
+    dem_ibox.crop(bounding_box(m_dem));
+
+    DemCache & cache = thread_cache();
+    if (cache.id == m_id && cache.box.contains(dem_ibox))
+      return;
+    cache.id  = m_id;
+    cache.box = dem_ibox;
+    cache.dem = crop(m_dem, dem_ibox);
+  }
+
+  bool dem_pixel(int x, int y, double & height) const {
+    DemPixelT val;
+    DemCache const& cache = thread_cache();
+    if (cache.id == m_id && cache.box.contains(Vector2i(x, y))) {
+      val = cache.dem(x - cache.box.min().x(), y - cache.box.min().y());
+    } else {
+      if (x < 0 || y < 0 || x >= m_dem.cols() || y >= m_dem.rows())
+        return false;
+      val = m_dem(x, y);
+    }
+    height = val.child();
+    return is_valid(val);
+  }
+
+  // Bilinear interpolation, or the nearest pixel. The heights around the
+  // point must all be valid.
+  bool dem_height(Vector2 const& pix, double & height) const {
+    if (m_nearest_neighbor)
+      return dem_pixel(int(round(pix[0])), int(round(pix[1])), height);
+
+    int x = int(floor(pix[0])), y = int(floor(pix[1]));
+    double u = pix[0] - x, v = pix[1] - y;
+    double h00, h10, h01, h11;
+    if (!dem_pixel(x, y, h00) || !dem_pixel(x+1, y, h10) ||
+        !dem_pixel(x, y+1, h01) || !dem_pixel(x+1, y+1, h11))
+      return false;
+    height = (1-v)*((1-u)*h00 + u*h10) + v*((1-u)*h01 + u*h11);
+    return true;
+  }
+
+  camera::CameraModel const* m_cam;
+  GeoReference            m_image_georef, m_dem_georef;
+  ImageViewRef<DemPixelT> m_dem;
+  BBox2i                  m_image_box;
+  bool                    m_nearest_neighbor;
+  long                    m_id;
+};
+
+// The spacing of the grid written with --write-camera-grid
+const int CAMERA_GRID_SPACING = 16;
+
+/// Write the camera pixels of the output image on a grid, for
+/// triangulation from it, as described in CameraGrid.h. The exact
+/// transform is used, not the one interpolated for --camera-grid-error.
+template <class Map2CamTransT>
+void write_camera_grid(Options const& opt, BBox2i const& croppedImageBB,
+                       Vector2i const& image_size, Map2CamTransT const& transform) {
+  asp::CameraGrid grid;
+  asp::make_camera_grid(transform, croppedImageBB.min(), croppedImageBB.size(),
+                        CAMERA_GRID_SPACING, image_size, grid);
+  std::string grid_file = asp::camera_grid_file(opt.output_file);
+  vw_out() << "Writing: " << grid_file << "\n";
+  asp::write_camera_grid(grid_file, grid);
+}
+
+// The two "grid" functions below make the transform be evaluated
+// exactly only on a grid, if so requested. They also write the camera
+// grid, if so requested.
+
+template <class ImagePixelT, class Map2CamTransT>
+void project_image_nodata_grid(Options & opt,
+                               GeoReference const& croppedGeoRef,
+                               Vector2i     const& virtual_image_size,
+                               BBox2i       const& croppedImageBB,
+                               Vector2i     const& image_size,
+                               Map2CamTransT const& transform) {
+  if (opt.camera_grid_only)
+    ; // Nothing to project
+  else if (opt.camera_grid_error > 0)
+    project_image_nodata<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                      asp::CameraGridTransform<Map2CamTransT>
+                                      (transform, image_size, opt.camera_grid_error));
+  else
+    project_image_nodata<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                      transform);
+  if (opt.write_camera_grid)
+    write_camera_grid(opt, croppedImageBB, image_size, transform);
+}
+
+template <class ImagePixelT, class Map2CamTransT>
+void project_image_alpha_grid(Options & opt,
+                              GeoReference const& croppedGeoRef,
+                              Vector2i     const& virtual_image_size,
+                              BBox2i       const& croppedImageBB,
+                              Vector2i     const& image_size,
+                              boost::shared_ptr<camera::CameraModel> const& camera_model,
+                              Map2CamTransT const& transform) {
+  if (opt.camera_grid_only)
+    ; // Nothing to project
+  else if (opt.camera_grid_error > 0)
+    project_image_alpha<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                     camera_model,
+                                     asp::CameraGridTransform<Map2CamTransT>
+                                     (transform, image_size, opt.camera_grid_error));
+  else
+    project_image_alpha<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                     camera_model, transform);
+  if (opt.write_camera_grid)
+    write_camera_grid(opt, croppedImageBB, image_size, transform);
+}
+
+// The two "pick" functions below select between the Map2CamTrans, SharedDem2CamTrans,
+// and Datum2CamTrans transform classes which will be passed to the image projection function.
 // - TODO: Is there a good reason for the transform classes to be CRTP instead of virtual?
 
 template <class ImagePixelT>
@@ -574,12 +823,21 @@ void project_image_nodata_pick_transform(Options & opt,
                           Vector2i     const& image_size,
                           Vector2i     const& virtual_image_size,
                           BBox2i       const& croppedImageBB,
-                          boost::shared_ptr<camera::CameraModel> const& camera_model) {
+                          boost::shared_ptr<camera::CameraModel> const& camera_model,
+                          ImageViewRef<DemPixelT> const* shared_dem) {
   const bool        call_from_mapproject = true;
-  if (fs::path(opt.dem_file).extension() != "") {
+  if (fs::path(opt.dem_file).extension() != "" && shared_dem != NULL) {
+    // A DEM file was provided, and it was loaded for all images of a batch
+    return project_image_nodata_grid<ImagePixelT>(opt, croppedGeoRef,
+                                             virtual_image_size, croppedImageBB, image_size,
+                                             SharedDem2CamTrans(camera_model.get(), target_georef,
+                                                                dem_georef, *shared_dem,
+                                                                image_size,
+                                                                opt.nearest_neighbor));
+  } else if (fs::path(opt.dem_file).extension() != "") {
     // A DEM file was provided
-    return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
-                                             virtual_image_size, croppedImageBB,
+    return project_image_nodata_grid<ImagePixelT>(opt, croppedGeoRef,
+                                             virtual_image_size, croppedImageBB, image_size,
                                              Map2CamTrans(// Converts coordinates in DEM
                                                           // georeference to camera pixels
                                                           camera_model.get(), target_georef,
@@ -588,8 +846,8 @@ void project_image_nodata_pick_transform(Options & opt,
                                                           opt.nearest_neighbor));
   } else {
     // A constant datum elevation was provided
-    return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
-                                             virtual_image_size, croppedImageBB,
+    return project_image_nodata_grid<ImagePixelT>(opt, croppedGeoRef,
+                                             virtual_image_size, croppedImageBB, image_size,
                                              Datum2CamTrans(// Converts coordinates in DEM
                                                             // georeference to camera pixels
                                                             camera_model.get(), target_georef,
@@ -607,12 +865,23 @@ void project_image_alpha_pick_transform(Options & opt,
                           Vector2i     const& image_size,
                           Vector2i     const& virtual_image_size,
                           BBox2i       const& croppedImageBB,
-                          boost::shared_ptr<camera::CameraModel> const& camera_model) {
+                          boost::shared_ptr<camera::CameraModel> const& camera_model,
+                          ImageViewRef<DemPixelT> const* shared_dem) {
   const bool        call_from_mapproject = true;
-  if (fs::path(opt.dem_file).extension() != "") {
+  if (fs::path(opt.dem_file).extension() != "" && shared_dem != NULL) {
+    // A DEM file was provided, and it was loaded for all images of a batch
+    return project_image_alpha_grid<ImagePixelT>(opt, croppedGeoRef,
+                                            virtual_image_size, croppedImageBB, image_size,
+                                            camera_model,
+                                            SharedDem2CamTrans(camera_model.get(), target_georef,
+                                                               dem_georef, *shared_dem,
+                                                               image_size,
+                                                               opt.nearest_neighbor));
+  } else if (fs::path(opt.dem_file).extension() != "") {
     // A DEM file was provided
-    return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
-                                            virtual_image_size, croppedImageBB, camera_model, 
+    return project_image_alpha_grid<ImagePixelT>(opt, croppedGeoRef,
+                                            virtual_image_size, croppedImageBB, image_size,
+                                            camera_model,
                                             Map2CamTrans( // Converts coordinates in DEM
                                                           // georeference to camera pixels
                                                          camera_model.get(), target_georef,
@@ -622,8 +891,9 @@ void project_image_alpha_pick_transform(Options & opt,
                                            );
   } else {
     // A constant datum elevation was provided
-    return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
-                                            virtual_image_size, croppedImageBB, camera_model, 
+    return project_image_alpha_grid<ImagePixelT>(opt, croppedGeoRef,
+                                            virtual_image_size, croppedImageBB, image_size,
+                                            camera_model,
                                             Datum2CamTrans( // Converts coordinates in DEM
                                                             // georeference to camera pixels
                                                            camera_model.get(), target_georef,
@@ -634,245 +904,434 @@ void project_image_alpha_pick_transform(Options & opt,
   }
 }
 
-int main(int argc, char* argv[]) {
-
-  Options opt;
-  try {
-    handle_arguments(argc, argv, opt);
-  
-    // TODO: Replace this using the new CameraModelLoader functions
-
-    // We create a stereo session where both of the cameras and images
-    // are the same, because we want to take advantage of the stereo
-    // pipeline's ability to generate camera models for various
-    // missions.  Hence, we create two identical camera models, but only one is used.
-    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
-    SessionPtr session( asp::StereoSessionFactory::create
-                        (opt.stereo_session, // in-out
-                         opt,
-                         opt.image_file, opt.image_file, // The same file is passed in twice
-                         opt.camera_file, opt.camera_file,
-                         opt.output_file,
-                         opt.dem_file,
-                         false) ); // Do not allow promotion from normal to map projected session
-
-    if ( opt.output_file.empty() )
-      vw_throw( ArgumentErr() << "Missing output filename.\n" );
-
-    // Initialize a camera model
-    boost::shared_ptr<camera::CameraModel> camera_model =
-      session->camera_model(opt.image_file, opt.camera_file);
-
-    opt.multithreaded_model = session->supports_multi_threading();
-      
-    {
-      // Safety check that the users are not trying to map project map
-      // projected images. This should not be an error as sometimes
-      // even raw images have some half-baked georeference attached to them.
-      GeoReference dummy_georef;
-      bool has_georef = vw::cartography::read_georeference( dummy_georef, opt.image_file );
-      if (has_georef)
-        vw_out(WarningMessage) << "Your input camera image is already map-"
-                               << "projected. The expected input is required "
-                               << "to be unprojected or raw camera imagery.\n";
+// Tabulate the camera over the part of the DEM seen in the output
+// image, for the range of heights found there, and over the image.
+boost::shared_ptr<camera::CameraModel>
+approximate_camera(Options const& opt,
+                   boost::shared_ptr<camera::CameraModel> camera_model,
+                   Vector2i const& image_size,
+                   ImageViewRef<DemPixelT> const& dem,
+                   GeoReference const& dem_georef,
+                   GeoReference const& target_georef,
+                   BBox2i const& target_box) {
+
+  BBox2 point_box = target_georef.pixel_to_point_bbox(target_box);
+  BBox2 dem_point_box
+    = dem_georef.lonlat_to_point_bbox(target_georef.point_to_lonlat_bbox(point_box));
+
+  // Sample the DEM to find the range of heights, and pad it a little
+  BBox2i dem_box = dem_georef.point_to_pixel_bbox(dem_point_box);
+  dem_box.crop(bounding_box(dem));
+  const int num_samples = 200;
+  double min_ht = std::numeric_limits<double>::max(), max_ht = -min_ht;
+  for (int row = 0; row < num_samples && !dem_box.empty(); row++) {
+    for (int col = 0; col < num_samples; col++) {
+      int x = dem_box.min().x() + (long long)col*(dem_box.width()  - 1)/(num_samples - 1);
+      int y = dem_box.min().y() + (long long)row*(dem_box.height() - 1)/(num_samples - 1);
+      DemPixelT ht = dem(x, y);
+      if (!is_valid(ht))
+        continue;
+      min_ht = std::min(min_ht, double(ht.child()));
+      max_ht = std::max(max_ht, double(ht.child()));
     }
+  }
+  if (min_ht > max_ht) {
+    vw_out(WarningMessage) << "No valid DEM heights found. Will not approximate the camera.\n";
+    return camera_model;
+  }
+  double pad = 0.1*(max_ht - min_ht) + 10.0;
+
+  boost::shared_ptr<asp::ApproxCameraModel> approx_cam
+    (new asp::ApproxCameraModel(camera_model, BBox2i(0, 0, image_size[0], image_size[1]),
+                                dem_georef, dem_point_box,
+                                Vector2(min_ht - pad, max_ht + pad),
+                                opt.approx_camera_error));
+  vw_out() << "Approximate camera error: " << approx_cam->ground_error() << " pixels.\n";
+  return approx_cam;
+}
 
-    // Load the DEM
-    bool datum_dem = false;
-    GeoReference dem_georef;
-    ImageViewRef<DemPixelT> dem;
-    if (fs::path(opt.dem_file).extension() != "") {
-      // A path to a real DEM file was provided, load it!
-
-      bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
-      if (!has_georef)
-        vw_throw( ArgumentErr() << "There is no georeference information in: " << opt.dem_file << ".\n" );
-
-      boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
-
-      // If we have a nodata value, create a mask.
-      DiskImageView<float> dem_disk_image(opt.dem_file);
-      if (dem_rsrc->has_nodata_read()){
-        dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
-      }else{
-        dem = pixel_cast<DemPixelT>(dem_disk_image);
-      }      
-    } else {
-      // Projecting to a datum instead of a DEM
-      datum_dem = true;
-      std::string datum_name = opt.dem_file;
-
-      // Use the camera center to determine whether to center the fake DEM on 0 or 180.
-      Vector3 llr_camera_loc =
-        cartography::XYZtoLonLatRadEstimateFunctor::apply( camera_model->camera_center(Vector2()) );
-      float lonstart = 0;
-      if ((llr_camera_loc[0] < 0) && (llr_camera_loc[0] > -180))
-        lonstart = -180;
-      dem_georef = GeoReference(Datum(datum_name),
-                                Matrix3x3(1,  0, lonstart-0.5, // Need adjustments to work at boundaries!
-                                          0, -1, 90+0.5,
-                                          0,  0,  1) );
-      dem = constant_view(PixelMask<float>(opt.datum_offset), 360, 180 );
-      vw_out() << "\t--> Using flat datum \"" << datum_name << "\" as elevation model.\n";
-      //std::cout << "dem_georef = " << dem_georef << std::endl;
-    }
-    // Finished setting up the datum
+/// Load the DEM, or make a constant one if a datum was given instead.
+/// The camera center decides whether the datum DEM starts at longitude
+/// 0 or -180.
+void load_dem(Options const& opt,
+              boost::shared_ptr<camera::CameraModel> const& camera_model,
+              bool & datum_dem, GeoReference & dem_georef,
+              ImageViewRef<DemPixelT> & dem) {
+  datum_dem = false;
+  if (fs::path(opt.dem_file).extension() != "") {
+    // A path to a real DEM file was provided, load it!
 
-    // Read projection. Work out output bounding box in points using original camera model.
-    GeoReference target_georef = dem_georef;
+    bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
+    if (!has_georef)
+      vw_throw( ArgumentErr() << "There is no georeference information in: " << opt.dem_file << ".\n" );
 
-    // User specified the proj4 string for the output georeference
-    if (opt.target_srs_string != ""){
-      bool  have_user_datum = false;
-      Datum user_datum;
-      asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum, target_georef);
-    }
+    boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
 
-    // Find the target resolution based --tr, --mpp, and --ppd if provided. Do
-    // the math to convert pixel-per-degree to meter-per-pixel and vice-versa.
-    int sum = (!std::isnan(opt.tr)) + (!std::isnan(opt.mpp)) + (!std::isnan(opt.ppd));
-    if (sum >= 2){
-      vw_throw( ArgumentErr() << "Must specify at most one of the options: --tr, --mpp, --ppd.\n" );
-    }
+    // If we have a nodata value, create a mask.
+    DiskImageView<float> dem_disk_image(opt.dem_file);
+    if (dem_rsrc->has_nodata_read()){
+      dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
+    }else{
+      dem = pixel_cast<DemPixelT>(dem_disk_image);
+    }      
+  } else {
+    // Projecting to a datum instead of a DEM
+    datum_dem = true;
+    std::string datum_name = opt.dem_file;
+
+    // Use the camera center to determine whether to center the fake DEM on 0 or 180.
+    Vector3 llr_camera_loc =
+      cartography::XYZtoLonLatRadEstimateFunctor::apply( camera_model->camera_center(Vector2()) );
+    float lonstart = 0;
+    if ((llr_camera_loc[0] < 0) && (llr_camera_loc[0] > -180))
+      lonstart = -180;
+    dem_georef = GeoReference(Datum(datum_name),
+                              Matrix3x3(1,  0, lonstart-0.5, // Need adjustments to work at boundaries!
+                                        0, -1, 90+0.5,
+                                        0,  0,  1) );
+    dem = constant_view(PixelMask<float>(opt.datum_offset), 360, 180 );
+    vw_out() << "\t--> Using flat datum \"" << datum_name << "\" as elevation model.\n";
+    //std::cout << "dem_georef = " << dem_georef << std::endl;
+  }
+  // Finished setting up the datum
+}
 
-    double radius = target_georef.datum().semi_major_axis();
-    if ( !std::isnan(opt.tr) ){ // --tr was set
-      if (target_georef.is_projected()) {
-        if (std::isnan(opt.mpp)) opt.mpp = opt.tr; // User must have provided be meters per pixel
-      }else {
-        if (std::isnan(opt.ppd)) opt.ppd = 1.0/opt.tr; // User must have provided degrees per pixel
-      }
-    }
-    
-    if (!std::isnan(opt.mpp)){ // Meters per pixel was set
-      if (std::isnan(opt.ppd)) opt.ppd = 2.0*M_PI*radius/(360.0*opt.mpp);
-    }
-    if (!std::isnan(opt.ppd)){ // Pixels per degree was set
-      if (std::isnan(opt.mpp)) opt.mpp = 2.0*M_PI*radius/(360.0*opt.ppd);
-    }
-    
-    bool user_provided_resolution = (!std::isnan(opt.ppd));
-    bool     calc_target_res = !user_provided_resolution;
-    Vector2i image_size      = vw::file_image_size(opt.image_file);
-    BBox2    cam_box;
-    calc_target_geom(// Inputs
-                     calc_target_res, image_size, camera_model,
-                     dem, dem_georef, datum_dem,
-                     // Outputs
-                     opt, cam_box, target_georef);
-
-    vw_out() << "Projected space bounding box: " << cam_box << std::endl;
-
-    // Compute output image size in pixels using bounding box in output projected space
-    BBox2i target_image_size = target_georef.point_to_pixel_bbox( cam_box );
-
-    vw_out() << "Image box: " << target_image_size << std::endl;
-    
-    // Very important note: this box may be in the middle of the
-    // image.  However, the virtual image we create with
-    // transform_nodata() below is assumed to start at (0, 0), and in
-    // target_georef we assume the same thing. Hence, its width and
-    // height are going to be the max values of target_image_size.
-    // There is no performance hit here, since that potentially huge
-    // image is never actually realized, we crop it as seen below
-    // before finding its pixels. This could be made less confusing.
-    int virtual_image_width  = target_image_size.max().x();
-    int virtual_image_height = target_image_size.max().y();
-
-    // Shrink output image BB if an output image BB was passed in
-    GeoReference croppedGeoRef  = target_georef;
-    BBox2i       croppedImageBB = target_image_size;
-    if ( opt.target_pixelwin != BBox2() ) {
-      // Replace with passed in bounding box
-      croppedImageBB = opt.target_pixelwin;
-
-      // Update output georeference to match the reduced image size
-      croppedGeoRef = vw::cartography::crop(target_georef, croppedImageBB);
-    }
-    //vw_out() << "croppedImageBB = " << croppedImageBB << std::endl;
-    //vw_out() << "\nCROPPED georeference:\n"        << croppedGeoRef << std::endl;
+/// Find the output georeference and the extent of the output image in
+/// its projected coordinates.
+void calc_output_geom(Options & opt, Vector2i const& image_size,
+                      boost::shared_ptr<camera::CameraModel> const& camera_model,
+                      ImageViewRef<DemPixelT> const& dem,
+                      GeoReference const& dem_georef, bool datum_dem,
+                      GeoReference & target_georef, BBox2 & cam_box) {
 
-    // Important: Don't modify the line below, we count on it in mapproject.in.
-    vw_out() << "Output image size:\n";
-    vw_out() << "(width: " << virtual_image_width
-             << " height: " << virtual_image_height << ")" << std::endl;
+  // Read projection. Work out output bounding box in points using original camera model.
+  target_georef = dem_georef;
 
-    if (opt.isQuery){ // Quit before we do any image work
-      vw_out() << "Query finished, exiting mapproject tool.\n";
-      return 0;
+  // User specified the proj4 string for the output georeference
+  if (opt.target_srs_string != ""){
+    bool  have_user_datum = false;
+    Datum user_datum;
+    asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum, target_georef);
+  }
+
+  // Find the target resolution based --tr, --mpp, and --ppd if provided. Do
+  // the math to convert pixel-per-degree to meter-per-pixel and vice-versa.
+  int sum = (!std::isnan(opt.tr)) + (!std::isnan(opt.mpp)) + (!std::isnan(opt.ppd));
+  if (sum >= 2){
+    vw_throw( ArgumentErr() << "Must specify at most one of the options: --tr, --mpp, --ppd.\n" );
+  }
+
+  double radius = target_georef.datum().semi_major_axis();
+  if ( !std::isnan(opt.tr) ){ // --tr was set
+    if (target_georef.is_projected()) {
+      if (std::isnan(opt.mpp)) opt.mpp = opt.tr; // User must have provided be meters per pixel
+    }else {
+      if (std::isnan(opt.ppd)) opt.ppd = 1.0/opt.tr; // User must have provided degrees per pixel
     }
+  }
+  
+  if (!std::isnan(opt.mpp)){ // Meters per pixel was set
+    if (std::isnan(opt.ppd)) opt.ppd = 2.0*M_PI*radius/(360.0*opt.mpp);
+  }
+  if (!std::isnan(opt.ppd)){ // Pixels per degree was set
+    if (std::isnan(opt.mpp)) opt.mpp = 2.0*M_PI*radius/(360.0*opt.ppd);
+  }
+  
+  bool user_provided_resolution = (!std::isnan(opt.ppd));
+  bool     calc_target_res = !user_provided_resolution;
+  calc_target_geom(// Inputs
+                   calc_target_res, image_size, camera_model,
+                   dem, dem_georef, datum_dem,
+                   // Outputs
+                   opt, cam_box, target_georef);
+
+  vw_out() << "Projected space bounding box: " << cam_box << std::endl;
+}
 
-    // For certain pinhole camera models the reverse check can make map projection very slow,
-    // so we disable it here.  The check is very important for computing the bounding box safely
-    // but we don't really need it when projecting the pixels back in to the camera.
-    boost::shared_ptr<vw::camera::PinholeModel> pinhole_ptr = 
-                boost::dynamic_pointer_cast<vw::camera::PinholeModel>(camera_model);
-    if (pinhole_ptr)
-      pinhole_ptr->set_do_point_to_pixel_check(false);
-
-    // Determine the pixel type of the input image
-    boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_file);
-    ImageFormat image_fmt = image_rsrc->format();
-    const int num_input_channels = num_channels(image_fmt.pixel_format);
-
-    // Prepare output directory
-    vw::create_out_dir(opt.output_file);
-
-    // Redirect to the correctly typed function to perform the actual map projection.
-    // - Must correspond to the type of the input image.
-    if (image_fmt.pixel_format == VW_PIXEL_RGB) {
-
-      // We can't just use float for everything or the output will be cast
-      //  into the -1 to 1 range which is probably not desired.
-      // - Always use an alpha channel with RGB images.
-      switch(image_fmt.channel_type) {
-      case VW_CHANNEL_UINT8:
-        project_image_alpha_pick_transform<PixelRGBA<uint8> >(opt, dem_georef, target_georef,
-                                                              croppedGeoRef, image_size, 
-                                                              Vector2i(virtual_image_width,
-                                                                       virtual_image_height),
-                                                              croppedImageBB, camera_model);
-        break;
-      case VW_CHANNEL_INT16:
-        project_image_alpha_pick_transform<PixelRGBA<int16> >(opt, dem_georef, target_georef,
+/// Project the image once its output geometry is known. If shared_dem
+/// is not NULL, the heights are looked up in it rather than in a view
+/// of the DEM file made for this image.
+void project_image(Options & opt, Vector2i const& image_size,
+                   boost::shared_ptr<camera::CameraModel> camera_model,
+                   ImageViewRef<DemPixelT> const& dem, GeoReference const& dem_georef,
+                   GeoReference const& target_georef, BBox2 const& cam_box,
+                   ImageViewRef<DemPixelT> const* shared_dem) {
+
+  // Compute output image size in pixels using bounding box in output projected space
+  BBox2i target_image_size = target_georef.point_to_pixel_bbox( cam_box );
+
+  vw_out() << "Image box: " << target_image_size << std::endl;
+  
+  // Very important note: this box may be in the middle of the
+  // image.  However, the virtual image we create with
+  // transform_nodata() below is assumed to start at (0, 0), and in
+  // target_georef we assume the same thing. Hence, its width and
+  // height are going to be the max values of target_image_size.
+  // There is no performance hit here, since that potentially huge
+  // image is never actually realized, we crop it as seen below
+  // before finding its pixels. This could be made less confusing.
+  int virtual_image_width  = target_image_size.max().x();
+  int virtual_image_height = target_image_size.max().y();
+
+  // Shrink output image BB if an output image BB was passed in
+  GeoReference croppedGeoRef  = target_georef;
+  BBox2i       croppedImageBB = target_image_size;
+  if ( opt.target_pixelwin != BBox2() ) {
+    // Replace with passed in bounding box
+    croppedImageBB = opt.target_pixelwin;
+
+    // Update output georeference to match the reduced image size
+    croppedGeoRef = vw::cartography::crop(target_georef, croppedImageBB);
+  }
+  //vw_out() << "croppedImageBB = " << croppedImageBB << std::endl;
+  //vw_out() << "\nCROPPED georeference:\n"        << croppedGeoRef << std::endl;
+
+  // Important: Don't modify the line below, we count on it in mapproject.in.
+  vw_out() << "Output image size:\n";
+  vw_out() << "(width: " << virtual_image_width
+           << " height: " << virtual_image_height << ")" << std::endl;
+
+  if (opt.isQuery){ // Quit before we do any image work
+    vw_out() << "Query finished, exiting mapproject tool.\n";
+    return;
+  }
+
+  // For certain pinhole camera models the reverse check can make map projection very slow,
+  // so we disable it here.  The check is very important for computing the bounding box safely
+  // but we don't really need it when projecting the pixels back in to the camera.
+  boost::shared_ptr<vw::camera::PinholeModel> pinhole_ptr = 
+              boost::dynamic_pointer_cast<vw::camera::PinholeModel>(camera_model);
+  if (pinhole_ptr)
+    pinhole_ptr->set_do_point_to_pixel_check(false);
+
+  if (opt.approx_camera_error > 0)
+    camera_model = approximate_camera(opt, camera_model, image_size, dem, dem_georef,
+                                      target_georef, croppedImageBB);
+
+  // Determine the pixel type of the input image
+  boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_file);
+  ImageFormat image_fmt = image_rsrc->format();
+  const int num_input_channels = num_channels(image_fmt.pixel_format);
+
+  // Prepare output directory
+  vw::create_out_dir(opt.output_file);
+
+  // A camera grid left from projecting an earlier image would be wrong
+  std::string grid_file = asp::camera_grid_file(opt.output_file);
+  if (!opt.write_camera_grid && fs::exists(grid_file))
+    fs::remove(grid_file);
+
+  // Redirect to the correctly typed function to perform the actual map projection.
+  // - Must correspond to the type of the input image.
+  if (image_fmt.pixel_format == VW_PIXEL_RGB) {
+
+    // We can't just use float for everything or the output will be cast
+    //  into the -1 to 1 range which is probably not desired.
+    // - Always use an alpha channel with RGB images.
+    switch(image_fmt.channel_type) {
+    case VW_CHANNEL_UINT8:
+      project_image_alpha_pick_transform<PixelRGBA<uint8> >(opt, dem_georef, target_georef,
+                                                            croppedGeoRef, image_size, 
+                                                            Vector2i(virtual_image_width,
+                                                                     virtual_image_height),
+                                                            croppedImageBB, camera_model, shared_dem);
+      break;
+    case VW_CHANNEL_INT16:
+      project_image_alpha_pick_transform<PixelRGBA<int16> >(opt, dem_georef, target_georef,
+                                                            croppedGeoRef, image_size, 
+                                                            Vector2i(virtual_image_width,
+                                                                     virtual_image_height),
+                                                            croppedImageBB, camera_model, shared_dem);
+      break;
+    case VW_CHANNEL_UINT16:
+      project_image_alpha_pick_transform<PixelRGBA<uint16> >(opt, dem_georef, target_georef,
+                                                             croppedGeoRef, image_size, 
+                                                             Vector2i(virtual_image_width,
+                                                                      virtual_image_height),
+                                                             croppedImageBB, camera_model, shared_dem);
+      break;
+    default:
+      project_image_alpha_pick_transform<PixelRGBA<float32> >(opt, dem_georef, target_georef,
                                                               croppedGeoRef, image_size, 
                                                               Vector2i(virtual_image_width,
                                                                        virtual_image_height),
-                                                              croppedImageBB, camera_model);
-        break;
-      case VW_CHANNEL_UINT16:
-        project_image_alpha_pick_transform<PixelRGBA<uint16> >(opt, dem_georef, target_georef,
-                                                               croppedGeoRef, image_size, 
-                                                               Vector2i(virtual_image_width,
-                                                                        virtual_image_height),
-                                                               croppedImageBB, camera_model);
-        break;
-      default:
-        project_image_alpha_pick_transform<PixelRGBA<float32> >(opt, dem_georef, target_georef,
-                                                                croppedGeoRef, image_size, 
-                                                                Vector2i(virtual_image_width,
-                                                                         virtual_image_height),
-                                                                croppedImageBB, camera_model);
-        break;
-      };
-      
-    } else {
-      // If the input image is not RGB, only single channel images are supported.
-      if (num_input_channels != 1 || image_fmt.planes != 1)
-        vw_throw( ArgumentErr() << "Input images must be single channel or RGB!\n" );
-      // This will cast to float but will not rescale the pixel values.
-      project_image_nodata_pick_transform<float>(opt, dem_georef, target_georef, croppedGeoRef,
-                                                 image_size, 
-                           Vector2i(virtual_image_width, virtual_image_height),
-                           croppedImageBB, camera_model);
-    } 
-    // Done map projecting!
+                                                              croppedImageBB, camera_model, shared_dem);
+      break;
+    };
+    
+  } else {
+    // If the input image is not RGB, only single channel images are supported.
+    if (num_input_channels != 1 || image_fmt.planes != 1)
+      vw_throw( ArgumentErr() << "Input images must be single channel or RGB!\n" );
+    // This will cast to float but will not rescale the pixel values.
+    project_image_nodata_pick_transform<float>(opt, dem_georef, target_georef, croppedGeoRef,
+                                               image_size, 
+                         Vector2i(virtual_image_width, virtual_image_height),
+                         croppedImageBB, camera_model, shared_dem);
+  }
+}
 
-  } ASP_STANDARD_CATCHES;
+/// Load the camera for the current image, and warn if the image is
+/// already map-projected.
+boost::shared_ptr<camera::CameraModel> load_camera(Options & opt) {
+
+  // TODO: Replace this using the new CameraModelLoader functions
+
+  // We create a stereo session where both of the cameras and images
+  // are the same, because we want to take advantage of the stereo
+  // pipeline's ability to generate camera models for various
+  // missions.  Hence, we create two identical camera models, but only one is used.
+  typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
+  SessionPtr session( asp::StereoSessionFactory::create
+                      (opt.stereo_session, // in-out
+                       opt,
+                       opt.image_file, opt.image_file, // The same file is passed in twice
+                       opt.camera_file, opt.camera_file,
+                       opt.output_file,
+                       opt.dem_file,
+                       false) ); // Do not allow promotion from normal to map projected session
+
+  if ( opt.output_file.empty() )
+    vw_throw( ArgumentErr() << "Missing output filename.\n" );
+
+  // Initialize a camera model
+  boost::shared_ptr<camera::CameraModel> camera_model =
+    session->camera_model(opt.image_file, opt.camera_file);
+
+  opt.multithreaded_model = session->supports_multi_threading();
+
+  {
+    // Safety check that the users are not trying to map project map
+    // projected images. This should not be an error as sometimes
+    // even raw images have some half-baked georeference attached to them.
+    GeoReference dummy_georef;
+    bool has_georef = vw::cartography::read_georeference( dummy_georef, opt.image_file );
+    if (has_georef)
+      vw_out(WarningMessage) << "Your input camera image is already map-"
+                             << "projected. The expected input is required "
+                             << "to be unprojected or raw camera imagery.\n";
+  }
 
-  return 0;
+  return camera_model;
+}
+
+/// Interleave the bits of the coordinates, so that sorting by this key
+/// keeps close points together.
+uint64 morton_key(int x, int y) {
+  uint64 key = 0;
+  for (int bit = 0; bit < 32; bit++) {
+    key |= uint64((uint32(x) >> bit) & 1) << (2*bit);
+    key |= uint64((uint32(y) >> bit) & 1) << (2*bit + 1);
+  }
+  return key;
+}
+
+/// Project each image of the list onto the same DEM, in one process.
+/// The DEM is opened once, so its blocks, kept in the cache of this
+/// process, are shared by all images. To make the best use of that,
+/// the images are processed in the order of their footprints on the DEM.
+void mapproject_batch(Options const& batch_opt) {
+
+  std::ifstream ifs(batch_opt.image_list.c_str());
+  if (!ifs.good())
+    vw_throw( ArgumentErr() << "Cannot read: " << batch_opt.image_list << ".\n" );
+
+  struct Entry {
+    Options      opt;
+    GeoReference target_georef;
+    BBox2        cam_box;
+    uint64       key;
+  };
+  std::vector<Entry> entries;
+
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    Entry entry;
+    entry.opt = batch_opt;
+    if (!(is >> entry.opt.image_file))
+      continue; // An empty line
+    if (!(is >> entry.opt.camera_file >> entry.opt.output_file))
+      vw_throw( ArgumentErr() << "Expecting an image, a camera, and an output file on "
+                << "each line of " << batch_opt.image_list << ", got: " << line << "\n" );
+    if ( boost::iends_with(boost::to_lower_copy(entry.opt.camera_file), ".xml") &&
+         entry.opt.stereo_session == "" )
+      entry.opt.stereo_session = "rpc";
+    entries.push_back(entry);
+  }
+  if (entries.empty())
+    vw_throw( ArgumentErr() << "No images in: " << batch_opt.image_list << ".\n" );
+
+  // The DEM, unless projecting onto a datum, when its georeference depends on the camera
+  bool datum_dem = (fs::path(batch_opt.dem_file).extension() == "");
+  GeoReference dem_georef;
+  ImageViewRef<DemPixelT> dem;
+  if (!datum_dem)
+    load_dem(batch_opt, boost::shared_ptr<camera::CameraModel>(), datum_dem, dem_georef, dem);
+
+  // Find where each image lands on the DEM
+  for (size_t it = 0; it < entries.size(); it++) {
+    Entry & entry = entries[it];
+    vw_out() << "Finding the footprint of: " << entry.opt.image_file << "\n";
+    boost::shared_ptr<camera::CameraModel> camera_model = load_camera(entry.opt);
+    if (datum_dem)
+      load_dem(entry.opt, camera_model, datum_dem, dem_georef, dem);
+    calc_output_geom(entry.opt, vw::file_image_size(entry.opt.image_file), camera_model,
+                     dem, dem_georef, datum_dem, entry.target_georef, entry.cam_box);
+    Vector2 dem_pix = dem_georef.lonlat_to_pixel
+      (entry.target_georef.point_to_lonlat(entry.cam_box.center()));
+    const int block = 256;
+    entry.key = morton_key(int(floor(dem_pix[0]/block)) + (1 << 20),
+                           int(floor(dem_pix[1]/block)) + (1 << 20));
+  }
+
+  std::vector<size_t> order(entries.size());
+  for (size_t it = 0; it < order.size(); it++)
+    order[it] = it;
+  std::stable_sort(order.begin(), order.end(),
+                   [&entries](size_t a, size_t b) { return entries[a].key < entries[b].key; });
+
+  for (size_t it = 0; it < order.size(); it++) {
+    Entry & entry = entries[order[it]];
+    vw_out() << "Projecting image " << it + 1 << " of " << entries.size() << ": "
+             << entry.opt.image_file << "\n";
+    boost::shared_ptr<camera::CameraModel> camera_model = load_camera(entry.opt);
+    if (datum_dem)
+      load_dem(entry.opt, camera_model, datum_dem, dem_georef, dem);
+    project_image(entry.opt, vw::file_image_size(entry.opt.image_file), camera_model,
+                  dem, dem_georef, entry.target_georef, entry.cam_box,
+                  datum_dem ? NULL : &dem);
+  }
 }
 
+int main(int argc, char* argv[]) {
 
+  Options opt;
+  try {
+    handle_arguments(argc, argv, opt);
 
+    if (!opt.image_list.empty()) {
+      mapproject_batch(opt);
+      return 0;
+    }
+
+    boost::shared_ptr<camera::CameraModel> camera_model = load_camera(opt);
 
+    bool datum_dem = false;
+    GeoReference dem_georef;
+    ImageViewRef<DemPixelT> dem;
+    load_dem(opt, camera_model, datum_dem, dem_georef, dem);
+
+    // The output georeference and extent, from the original camera model
+    Vector2i     image_size = vw::file_image_size(opt.image_file);
+    GeoReference target_georef;
+    BBox2        cam_box;
+    calc_output_geom(opt, image_size, camera_model, dem, dem_georef, datum_dem,
+                     target_georef, cam_box);
+
+    project_image(opt, image_size, camera_model, dem, dem_georef, target_georef, cam_box, NULL);
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -37,6 +37,7 @@
 #include <Eigen/Geometry>
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
@@ -61,7 +62,9 @@ typedef PM::DataPoints DP;
 #define FIFTEEN 15
 #define ONE_TWO_EIGHT 128
 
-typedef flann::Index<flann::L2<double> > KDTree_double;
+// The trees store the points as floats, to save memory. The points are
+// shifted to be near the origin, so not much precision is lost.
+typedef flann::Index<flann::L2<float> > KDTree_float;
 
 /// Options container
 struct Options : public vw::cartography::GdalWriteOptions {
@@ -175,25 +178,7 @@ bool triplet_less(vw::Vector3 const& p, vw::Vector3 const& q){
   return false;
 }
 
-// Define equality for pairs of integers
-bool operator==(std::pair<int, int> const& p, std::pair<int, int> const& q){
-  return (p.first == q.first) && (p.second == q.second);
-}
-
-// An operator used to sort pairs of integers
-struct CustomCompare {
-  bool operator()(std::pair<int, int> const& p, std::pair<int, int> const& q){
-    if (p.first < q.first) return true;
-    if (p.first > q.first) return false;
-    
-    if (p.second < q.second) return true;
-    if (p.second > q.second) return false;
-    
-    return false;
-  }
-};
-
-bool vector_less(Eigen::VectorXd const& p, Eigen::VectorXd const& q){
+bool vector_less(Eigen::VectorXi const& p, Eigen::VectorXi const& q){
   for (int i = 0; i < p.size(); i++) {
     if (p[i] < q[i]) return true;
     if (p[i] > q[i]) return false;
@@ -248,7 +233,7 @@ void sort_and_make_unqiue(std::vector<vw::Vector3> & cloud){
   cloud.resize(std::distance(cloud.begin(), it));
 }
 
-void BuildKDTree_double(std::vector<vw::Vector3> const& cloud, KDTree_double* tree){
+void BuildKDTree_float(std::vector<vw::Vector3> const& cloud, KDTree_float* tree){
   int rows = cloud.size();
   int dim = vw::Vector3().size();
 
@@ -256,8 +241,8 @@ void BuildKDTree_double(std::vector<vw::Vector3> const& cloud, KDTree_double* tr
   if (rows*dim <= 0) 
     vw_throw( ArgumentErr() << "Cannot operate on empty clouds.\n" );
   
-  std::vector<double> dataset(rows * dim);
-  flann::Matrix<double> dataset_mat(&dataset[0], rows, dim);
+  std::vector<float> dataset(rows * dim);
+  flann::Matrix<float> dataset_mat(&dataset[0], rows, dim);
   
   for (int i = 0; i < rows; i++) {
     for (int j = 0; j < dim; j++) {
@@ -266,31 +251,85 @@ void BuildKDTree_double(std::vector<vw::Vector3> const& cloud, KDTree_double* tr
   }
 
   // Using the default leaf_max_size = 10 in flann::KDTreeSingleIndexParams()
-  KDTree_double temp_tree(dataset_mat, flann::KDTreeSingleIndexParams(FIFTEEN));
+  KDTree_float temp_tree(dataset_mat, flann::KDTreeSingleIndexParams(FIFTEEN));
   temp_tree.buildIndex();
   *tree = temp_tree;
 }
 
-void SearchKDTree_double(KDTree_double* tree, const vw::Vector3& input, 
-                         std::vector<int>& indices,
-                         std::vector<double>& dists, int nn){
-  int rows_t = 1;
-  int dim = input.size();
-  
-  std::vector<double> query;
-  query.resize(rows_t*dim);
-  for (int i = 0; i < dim; i++)
-    query[i] = input[i];
-  flann::Matrix<double> query_mat(&query[0], rows_t, dim);
+/// For each point in the cloud, with the transform T applied to it,
+/// find the index of the nearest point in the tree. All points are
+/// searched for at once.
+void SearchKDTree_float(KDTree_float* tree, std::vector<vw::Vector3> const& cloud,
+                        Eigen::MatrixXd const& T, std::vector<int>& indices){
+  int rows_t = cloud.size();
+  int dim = vw::Vector3().size();
+  int nn = 1;
+
+  std::vector<float> query(rows_t*dim);
+  for (int i = 0; i < rows_t; i++) {
+    Eigen::Vector4d v(cloud[i][0], cloud[i][1], cloud[i][2], 1.0);
+    v = T*v;
+    for (int j = 0; j < dim; j++)
+      query[i*dim + j] = v[j];
+  }
+  flann::Matrix<float> query_mat(&query[0], rows_t, dim);
   
+  std::vector<float> dists(rows_t*nn);
   indices.resize(rows_t*nn);
-  dists.resize(rows_t*nn);
-  flann::Matrix<int> indices_mat(&indices[0], rows_t, nn);
-  flann::Matrix<double> dists_mat(&dists[0], rows_t, nn);
+  flann::Matrix<int>   indices_mat(&indices[0], rows_t, nn);
+  flann::Matrix<float> dists_mat(&dists[0], rows_t, nn);
   
   tree->knnSearch(query_mat, indices_mat, dists_mat, nn, flann::SearchParams(ONE_TWO_EIGHT));
 }
 
+/// Build the tree for a cloud. Used to build the trees in parallel.
+class BuildTreeTask: public vw::Task, private boost::noncopyable {
+  std::vector<vw::Vector3> const& m_cloud;
+  KDTree_float                  * m_tree;
+public:
+  BuildTreeTask(std::vector<vw::Vector3> const& cloud, KDTree_float* tree):
+    m_cloud(cloud), m_tree(tree) {}
+  virtual void operator()() { BuildKDTree_float(m_cloud, m_tree); }
+};
+
+/// Find the points in clouds i and j which are each other's nearest
+/// neighbors, as pairs (index in j, index in i). The trees were built
+/// before the clouds were last moved, so the points are first brought
+/// back to where they were when the tree was built, with the inverse of
+/// the transforms applied since then. The distances are not changed by
+/// this, as the transforms are rigid.
+class MutualMatchTask: public vw::Task, private boost::noncopyable {
+  std::vector< std::vector<vw::Vector3> > const& m_clouds;
+  std::vector< boost::shared_ptr<KDTree_float> > const& m_trees;
+  std::vector<Eigen::MatrixXd> const& m_inv_tree_trans;
+  int m_i, m_j;
+  std::vector< std::pair<int, int> > & m_corr;
+public:
+  MutualMatchTask(std::vector< std::vector<vw::Vector3> > const& clouds,
+                  std::vector< boost::shared_ptr<KDTree_float> > const& trees,
+                  std::vector<Eigen::MatrixXd> const& inv_tree_trans,
+                  int i, int j, std::vector< std::pair<int, int> > & corr):
+    m_clouds(clouds), m_trees(trees), m_inv_tree_trans(inv_tree_trans),
+    m_i(i), m_j(j), m_corr(corr) {}
+
+  virtual void operator()() {
+
+    // For each point in cloud i, find a match in cloud j, and vice versa
+    std::vector<int> match_ij, match_ji;
+    SearchKDTree_float(m_trees[m_j].get(), m_clouds[m_i], m_inv_tree_trans[m_j], match_ij);
+    SearchKDTree_float(m_trees[m_i].get(), m_clouds[m_j], m_inv_tree_trans[m_i], match_ji);
+
+    m_corr.clear();
+    for (size_t index_i = 0; index_i < match_ij.size(); index_i++) {
+      int index_j = match_ij[index_i];
+      if (index_j < 0 || index_j >= int(match_ji.size()))
+        continue; // should not happen
+      if (match_ji[index_j] == int(index_i))
+        m_corr.push_back(std::pair<int, int>(index_j, index_i));
+    }
+  }
+};
+
 std::string transform_file(std::string const& out_prefix, int index){
   std::ostringstream os;
   os << out_prefix << "-transform-" << index << ".txt";
@@ -367,14 +406,13 @@ int main(int argc, char *argv[]){
     vw::Vector3 shift;
     bool   calc_shift = true; // Shift points so the first point is (0,0,0)
     bool   is_lola_rdr_format = false;   // may get overwritten
-    double mean_ref_longitude    = 0.0;  // may get overwritten
-    double mean_source_longitude = 0.0;  // may get overwritten
+    std::vector<double> mean_longitudes(numClouds, 0.0); // may get overwritten
     BBox2 empty_box;
     DP in_cloud;
     bool verbose = true;
     load_cloud(opt.cloud_files[0], opt.max_num_points, empty_box,
                calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-               mean_ref_longitude, verbose, in_cloud);
+               mean_longitudes[0], verbose, in_cloud);
     convert_cloud(in_cloud, clouds[0]);
     
     vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
@@ -384,7 +422,7 @@ int main(int argc, char *argv[]){
     for (int cloudIter = 1; cloudIter < numClouds; cloudIter++) {
       load_cloud(opt.cloud_files[cloudIter], opt.max_num_points, empty_box,
                  calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-                 mean_ref_longitude, verbose, in_cloud);
+                 mean_longitudes[cloudIter], verbose, in_cloud);
       convert_cloud(in_cloud, clouds[cloudIter]);
     }
     
@@ -414,15 +452,24 @@ int main(int argc, char *argv[]){
         apply_transform_to_cloud(clouds[cloudIter], transVec[cloudIter]);
     }
     
-    // Build the trees
-    std::vector< boost::shared_ptr<KDTree_double> > Trees;
-    for (int it = 0; it < numClouds; it++) {
-      boost::shared_ptr<KDTree_double>
-        tree(new KDTree_double(flann::KDTreeSingleIndexParams(FIFTEEN)));
-      BuildKDTree_double(clouds[it], tree.get());
-      Trees.push_back(tree);
+    // Build the trees, in parallel
+    int num_threads = vw_settings().default_num_threads();
+    std::vector< boost::shared_ptr<KDTree_float> > Trees;
+    {
+      FifoWorkQueue queue(num_threads);
+      for (int it = 0; it < numClouds; it++) {
+        boost::shared_ptr<KDTree_float>
+          tree(new KDTree_float(flann::KDTreeSingleIndexParams(FIFTEEN)));
+        Trees.push_back(tree);
+        boost::shared_ptr<BuildTreeTask> task(new BuildTreeTask(clouds[it], tree.get()));
+        queue.add_task(task);
+      }
+      queue.join_all();
     }
 
+    // The inverse of the transform applied to each cloud since its tree was built
+    std::vector<Eigen::MatrixXd> invTreeTrans(numClouds, Eigen::MatrixXd::Identity(4, 4));
+
     std::string errCaption = std::string("Computing the error, defined as the mean of ") +
       "pairwise distances from each cloud to the centroid cloud.\n";
     if (opt.verbose) vw_out() << errCaption;
@@ -461,71 +508,47 @@ int main(int argc, char *argv[]){
       // This will record for each point in each cloud which point in
       // every other cloud is closest to it. This matrix will store the
       // indices of these points.
-      std::vector<Eigen::VectorXd> CentroidPtsBelMod(numOfPoints);
+      std::vector<Eigen::VectorXi> CentroidPtsBelMod(numOfPoints);
       for (size_t row = 0; row < CentroidPtsBelMod.size(); row++) {
-        CentroidPtsBelMod[row] = Eigen::VectorXd(numClouds);
+        CentroidPtsBelMod[row] = Eigen::VectorXi(numClouds);
         for (int cloudIter = 0; cloudIter < numClouds; cloudIter++) {
           CentroidPtsBelMod[row][cloudIter] = -1;
         }
       }
     
-      for (size_t i = 0; i < numClouds; i++) {
+      // Find the mutual nearest neighbors among all pairs of clouds, in parallel
+      std::vector< std::pair<int, int> > pairs;
+      for (int i = 0; i < numClouds; i++)
+        for (int j = i + 1; j < numClouds; j++)
+          pairs.push_back(std::pair<int, int>(i, j));
+      std::vector< std::vector< std::pair<int, int> > > pairCorr(pairs.size());
+      {
+        FifoWorkQueue queue(num_threads);
+        for (size_t pairIter = 0; pairIter < pairs.size(); pairIter++) {
+          boost::shared_ptr<MutualMatchTask>
+            task(new MutualMatchTask(clouds, Trees, invTreeTrans,
+                                     pairs[pairIter].first, pairs[pairIter].second,
+                                     pairCorr[pairIter]));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      }
 
-        //spanI = modelSpan(i)+1:modelSpan(i+1); 
-        std::vector<int> spanI;
-        int beg = modelSpan[i], end = modelSpan[i+1] - 1;
-        for (int it = beg; it <= end; it++) spanI.push_back(it);
-        
+      for (int i = 0; i < numClouds; i++) {
         //CentroidPtsBelMod(spanI,i) = 1:length(spanI);
-        for (size_t it = 0; it < spanI.size(); it++) {
-          CentroidPtsBelMod[spanI[it]][i] = it;
-        }
+        for (int it = modelSpan[i]; it < modelSpan[i+1]; it++)
+          CentroidPtsBelMod[it][i] = it - modelSpan[i];
+      }
 
-        for (size_t j = i + 1; j < numClouds; j++) {
-        
-          //spanJ = modelSpan(j)+1:modelSpan(j+1); 
-          std::vector<int> spanJ;
-          int beg = modelSpan[j], end = modelSpan[j+1] - 1;
-          for (int it = beg; it <= end; it++) spanJ.push_back(it);
-        
-          std::vector<int> match, match2;
-          std::vector<double> dist;
-          typedef std::set<std::pair<int, int>, CustomCompare> PairType;
-
-          // For each point in cloud i, find a match in cloud j
-          PairType Corr1;
-          for (size_t index_i = 0; index_i < clouds[i].size(); index_i++){
-            SearchKDTree_double(Trees[j].get(), clouds[i][index_i], match, dist, 1);
-            if (match.empty()) continue; // should not happen
-            int index_j = match[0];
-            Corr1.insert(std::pair<int, int>(index_j, index_i));
-          }
-
-          // Now do it in reverse
-          PairType Corr2;
-          for (size_t index_j = 0; index_j < clouds[j].size(); index_j++){
-            SearchKDTree_double(Trees[i].get(), clouds[j][index_j], match, dist, 1);
-            if (match.empty()) continue; // should not happen
-            int index_i = match[0];
-            Corr2.insert(std::pair<int, int>(index_j, index_i));
-          }
-
-          std::vector< std::pair<int, int> > Corr;
-          for (PairType::iterator it = Corr1.begin(); it != Corr1.end(); it++) {
-            PairType::iterator it2 = Corr2.find(*it);
-            if (it2 == Corr2.end()) continue;
-
-            Corr.push_back(*it);
-          }
-
-          for (size_t it = 0; it < Corr.size(); it++) {
-            // CentroidPtsBelMod(spanI(Corr(:,2)),j) = Corr(:,1)';
-            CentroidPtsBelMod[spanI[Corr[it].second]][j] = Corr[it].first;
-
-            // CentroidPtsBelMod(spanJ(Corr(:,1)),i) = Corr(:,2)';
-            CentroidPtsBelMod[spanJ[Corr[it].first]][i] = Corr[it].second;
-          }
+      for (size_t pairIter = 0; pairIter < pairs.size(); pairIter++) {
+        int i = pairs[pairIter].first, j = pairs[pairIter].second;
+        std::vector< std::pair<int, int> > const& Corr = pairCorr[pairIter];
+        for (size_t it = 0; it < Corr.size(); it++) {
+          // CentroidPtsBelMod(spanI(Corr(:,2)),j) = Corr(:,1)';
+          CentroidPtsBelMod[modelSpan[i] + Corr[it].second][j] = Corr[it].first;
 
+          // CentroidPtsBelMod(spanJ(Corr(:,1)),i) = Corr(:,2)';
+          CentroidPtsBelMod[modelSpan[j] + Corr[it].first][i] = Corr[it].second;
         }
       }
 
@@ -608,6 +631,7 @@ int main(int argc, char *argv[]){
 
         // Move the clouds to the new location for the next iteration
         apply_transform_to_cloud(clouds[cloudIter], currT);
+        invTreeTrans[cloudIter] = invTreeTrans[cloudIter] * currT.inverse();
 
 	// Compute the error after the transform is applied
         for (int row = 0; row < CentroidPtsBelMod.size(); row++) {
@@ -684,7 +708,8 @@ int main(int argc, char *argv[]){
         os << opt.out_prefix << "-trans_cloud-" << cloudIter;
         std::string trans_prefix = os.str();
         save_trans_point_cloud(opt, opt.cloud_files[cloudIter], trans_prefix,
-                               geo, csv_conv, transVec[cloudIter]);
+                               geo, csv_conv, mean_longitudes[cloudIter],
+                               transVec[cloudIter]);
       }
     }
   
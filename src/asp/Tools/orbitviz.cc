@@ -24,8 +24,10 @@
 #include <vw/InterestPoint/InterestData.h>
 
 #include <asp/Core/Macros.h>
+#include <asp/Core/MatchFile.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Sessions/StereoSessionFactory.h>
+#include <asp/Sessions/CameraHandle.h>
 
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
 #include <asp/IsisIO/IsisCameraModel.h>
@@ -133,7 +135,7 @@ size_t get_files_from_solver_folder(std::string                 const& solver_fo
   const size_t MIN_MATCHES = 30; // This is the default value, but it could be made an option.
   std::vector<ip::InterestPoint> ip1, ip2;
   for (size_t m=0; m<num_matches; ++m) {
-    vw::ip::read_binary_match_file(solver_folder+ "/"+match_files[m], ip1, ip2);
+    asp::read_match_file(solver_folder+ "/"+match_files[m], ip1, ip2);
     //std::cout << "Read " << ip1.size() << " matches from file " << match_files[m] << std::endl;
     if (ip1.size() < MIN_MATCHES)
       match_files[m] = "";
@@ -239,17 +241,11 @@ int main(int argc, char* argv[]) {
     if ( image_files.empty() )
       vw_throw( ArgumentErr() << "No image files detected.\n" );
     
-    std::string first_image = image_files[0];
-    std::string first_camera = first_image;
-    if (!camera_files.empty()) 
-      first_camera = camera_files[0];
-    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
-    SessionPtr session
-      (asp::StereoSessionFactory::create(opt.stereo_session_string, // may change inside
-                                         opt,
-                                         first_image, first_image,
-                                         first_camera, first_camera
-                                         ) );
+    // Load the cameras. Only ISIS cameras cannot be loaded in parallel.
+    std::vector< boost::shared_ptr<camera::CameraModel> > cameras;
+    bool multi_threaded_cameras = true;
+    asp::load_cameras(opt.stereo_session_string, // may change inside
+                      opt, image_files, camera_files, "", cameras, multi_threaded_cameras);
 
     // Prepare output directory
     vw::create_out_dir(opt.out_file);
@@ -284,20 +280,11 @@ int main(int argc, char* argv[]) {
     
     Vector2 camera_pixel(opt.linescan_sample, opt.linescan_line);
 
-    // Building Camera Models and then writing to KML
+    // Writing to KML
     std::vector<Vector3> camera_positions(num_cameras);
     for (size_t i=0; i < num_cameras; i++) {
-      boost::shared_ptr<camera::CameraModel> current_camera;
-
-      // This is so clumsy, a new stereo session needs to be loaded for each
-      // input camera.
-      SessionPtr session
-        (asp::StereoSessionFactory::create(opt.stereo_session_string, // may change inside
-                                           opt,
-                                           image_files[i],  image_files[i],
-                                           camera_files[i], camera_files[i]
-                                           ) );
-      current_camera = session->camera_model(image_files[i], camera_files[i]);
+      boost::shared_ptr<camera::CameraModel> current_camera = cameras[i];
+      Vector3 xyz = current_camera->camera_center(camera_pixel);
 
       if ( opt.write_csv ) {
         csv_handle << image_files[i] << ", ";
@@ -311,15 +298,13 @@ int main(int argc, char* argv[]) {
         }
 #endif
 
-        Vector3 xyz = current_camera->camera_center(camera_pixel);
         csv_handle << std::setprecision(12);
         csv_handle << xyz[0] << ", "
                    << xyz[1] << ", " << xyz[2] << "\n";
       } // End csv write condition
       
       // Compute and record the GDC coordinates
-      Vector3 lon_lat_alt = datum.cartesian_to_geodetic(
-                                current_camera->camera_center(camera_pixel));
+      Vector3 lon_lat_alt = datum.cartesian_to_geodetic(xyz);
       camera_positions[i] = lon_lat_alt;
 
       // Adding Placemarks
@@ -17,8 +17,11 @@
 
 
 #include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
 #include <vw/Cartography/GeoTransform.h>
 
+#include <algorithm>
+
 
 using std::endl;
 using std::string;
@@ -34,55 +37,6 @@ namespace fs = boost::filesystem;
 
 
 
-// TODO: Move these to vw/PixelType.h ??
-// - These don't follow the existing pixel color conventions!
-
-/// Convert an RGB pixel to a YCbCr pixel
-/// - So far this only works for unsigned char and unsigned short.
-template <typename T>
-T rgbToYCbCr(T const& rgb, double min_val, double max_val) {
-  // Convert
-  double mean_val = (min_val + max_val+1) / 2.0;
-  double temp[3];
-  temp[0] =            0.299   *rgb[0] + 0.587   *rgb[1] + 0.114   *rgb[2];
-  temp[1] = mean_val - 0.168736*rgb[0] - 0.331264*rgb[1] + 0.5     *rgb[2];
-  temp[2] = mean_val + 0.5     *rgb[0] - 0.418688*rgb[1] - 0.081312*rgb[2];
-  // Copy and constrain
-  T ycbcr;
-  for (int i=0; i<3; ++i)
-  {
-    ycbcr[i] = temp[i];
-    if (temp[i] < min_val) ycbcr[i] = min_val;
-    if (temp[i] > max_val) ycbcr[i] = max_val;
-  }
-  return ycbcr;
-}
-
-
-/// Converts a single YCbCr pixel to RGB
-/// - So far this only works for unsigned char and unsigned short.
-template <typename T>
-T ycbcrToRgb(T const& ycbcr, double min_val, double max_val) {
-  // Convert
-  double mean_val = (min_val + max_val+1) / 2.0;
-  double temp[3];
-  temp[0] = ycbcr[0]                                   + 1.402   * (ycbcr[2] - mean_val);
-  temp[1] = ycbcr[0] - 0.34414 * (ycbcr[1] - mean_val) - 0.71414 * (ycbcr[2] - mean_val);
-  temp[2] = ycbcr[0] + 1.772   * (ycbcr[1] - mean_val);
-
-  // Copy and constrain
-  T rgb;
-  for (int i=0; i<3; ++i)
-  {
-    rgb[i] = temp[i];
-    if (temp[i] < min_val) rgb[i] = min_val;
-    if (temp[i] > max_val) rgb[i] = max_val;
-  }
-  return rgb;
-}
-
-
-
 /// Image view class which applies a pan sharp algorithm.
 /// - This takes a gray and an RGB image as input and generates an RGB image as output.
 /// - This operation is not particularly useful unless the gray image is higher
@@ -137,49 +91,56 @@ public: // Functions
   typedef ProceduralPixelAccessor<PanSharpView<ImageGrayT, ImageColorT, DataTypeT> > pixel_accessor;
   inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
 
+private:
 
-  /// Apply pansharp algorithm to a single pair of pixels.
-  /// - Any required interpolation etc. will have already happened by now.
-  template <class P1, class P2>
-  result_type convert_pixel(P1 const& gray_pixel, P2 const& color_pixel) const {
-    // Convert RGB to YCbCr
-    P2 temp = rgbToYCbCr(color_pixel, m_min_val, m_max_val);
-    result_type ycbcr_pixel(temp[0], temp[1], temp[2]); // Extra step breaks any type dependency from the inputs
-
-    // Replace Y channel with gray value
-    ycbcr_pixel[0] = gray_pixel[0];
-
-    // Convert YCbCr back to RGB
-    return ycbcrToRgb(ycbcr_pixel, m_min_val, m_max_val);
+  static double clamp(double val, double min_val, double max_val) {
+    return std::min(std::max(val, min_val), max_val);
   }
 
+public:
 
+  /// Apply the pansharp algorithm to a tile. The color pixels are
+  /// converted to YCbCr, their Y channel is replaced with the gray value,
+  /// and they are converted back to RGB. Only Cb and Cr of the color
+  /// pixels are needed. As with the per-channel conversions this
+  /// replaces, the Cb and Cr values, and the output values, are clamped
+  /// to the valid range, but the gray value is not.
   typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
 
+    // Read the tile of both images at once. This also warps the color
+    // image once for the whole tile.
+    ImageView<typename ImageGrayT::pixel_type > gray  = crop(m_gray_image,  bbox);
+    ImageView<typename ImageColorT::pixel_type> color = crop(m_color_image, bbox);
+
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // Loop through each output pixels and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      int source_c = c + bbox.min()[0];
-      for (int r = 0; r < bbox.height(); r++) {
-        int source_r = r + bbox.min()[1];
+    double min_val  = m_min_val, max_val = m_max_val;
+    double mean_val = (min_val + max_val + 1) / 2.0;
+    for (int r = 0; r < bbox.height(); r++) {
+      for (int c = 0; c < bbox.width(); c++) {
 
         // Check for a masked pixel
-        if ( !is_valid(m_gray_image (source_c, source_r)) ||
-             !is_valid(m_color_image(source_c, source_r))  ) {
+        if (!is_valid(gray(c, r)) || !is_valid(color(c, r))) {
           tile(c, r) = m_output_nodata;
           continue;
         }
 
-        // Pass the two input pixels into the conversion function
-        //result_type output_pixel = convert_pixel(m_gray_image(source_c, r), m_color_image(source_c, r));
-        tile(c,r) = convert_pixel(m_gray_image (source_c, source_r),
-                                  m_color_image(source_c, source_r));
-
-      } // End row loop
-    } // End column loop
+        double red   = color(c, r)[0];
+        double green = color(c, r)[1];
+        double blue  = color(c, r)[2];
+        double cb = clamp(mean_val - 0.168736*red - 0.331264*green + 0.5     *blue,
+                          min_val, max_val) - mean_val;
+        double cr = clamp(mean_val + 0.5     *red - 0.418688*green - 0.081312*blue,
+                          min_val, max_val) - mean_val;
+        double y  = gray(c, r)[0];
+
+        tile(c, r) = result_type(clamp(y                + 1.402  *cr, min_val, max_val),
+                                 clamp(y - 0.34414*cb - 0.71414*cr, min_val, max_val),
+                                 clamp(y + 1.772  *cb,                min_val, max_val));
+      } // End column loop
+    } // End row loop
 
     // Return the tile we created with fake borders to make it look the size of the entire output image
     return prerasterize_type(tile,
@@ -50,6 +50,8 @@
 
 #include <limits>
 #include <cstring>
+#include <algorithm>
+#include <iostream>
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
@@ -92,9 +94,10 @@ struct Options : public vw::cartography::GdalWriteOptions {
   // Input
   string reference, source, init_transform_file, alignment_method, config_file,
     datum, csv_format_str, csv_proj4_str, match_file, hillshade_options,
-    ipfind_options, ipmatch_options, fgr_options;
+    ipfind_options, ipmatch_options, fgr_options, reference_cache_dir, source_list;
   PointMatcher<RealT>::Matrix init_transform;
   int    num_iter,
+         num_pyramid_levels,
          max_num_reference_points,
          max_num_source_points;
   double diff_translation_err,
@@ -118,6 +121,9 @@ struct Options : public vw::cartography::GdalWriteOptions {
   
   /// Return true if the reference file is a DEM file and this option is not disabled
   bool use_dem_distances() const { return ( (asp::get_cloud_type(this->reference) == "DEM") && !dont_use_dem_distances); }
+
+  /// Return true if the reference points need to be loaded, rather than using only the reference DEM
+  bool load_ref_points() const { return alignment_method != "point-to-dem"; }
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -137,10 +143,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                                  "Fraction of source (movable) points considered inliers (after gross outliers further than max-displacement from reference points are removed).")
     ("max-num-reference-points", po::value(&opt.max_num_reference_points)->default_value(100000000),
                                  "Maximum number of (randomly picked) reference points to use.")
+    ("source-list",              po::value(&opt.source_list)->default_value(""),
+                                 "Align to the reference, in turn, each source cloud in this list, loading the reference only once. Each line has a source cloud, optionally followed by the output prefix for it. The default output prefix is the value of --output-prefix, followed by a dash and the name of the source without the extension. Use '-' to read the list from standard input. Lines starting with '#' are ignored.")
+    ("reference-cache-dir",      po::value(&opt.reference_cache_dir)->default_value(""),
+                                 "Keep in this directory a binary copy of the points loaded from the reference cloud, and use it in later runs with the same reference and options, to not read the reference again. The reference points are then picked from the whole cloud, before being restricted to the region of the source.")
+    ("num-pyramid-levels",       po::value(&opt.num_pyramid_levels)->default_value(1),
+                                 "The number of resolution levels for ICP. If more than 1, first align coarser versions of the clouds, obtained by averaging the points in cubes of growing size, with each level starting from the transform found at the previous one, and end with the full clouds. This helps with large initial offsets. Only for point-to-plane, point-to-point, and similarity-point-to-point alignment.")
     ("max-num-source-points",    po::value(&opt.max_num_source_points)->default_value(100000),
                                  "Maximum number of (randomly picked) source points to use (after discarding gross outliers).")
     ("alignment-method",         po::value(&opt.alignment_method)->default_value("point-to-plane"),
-                                 "The type of iterative closest point method to use. [point-to-plane, point-to-point, similarity-point-to-point, fgr, least-squares, similarity-least-squares]")
+                                 "The type of iterative closest point method to use. [point-to-plane, point-to-point, similarity-point-to-point, point-to-dem, fgr, least-squares, similarity-least-squares]")
     ("highest-accuracy",         po::bool_switch(&opt.highest_accuracy)->default_value(false)->implicit_value(true),
                                  "Compute with highest accuracy for point-to-plane (can be much slower).")
     ("csv-format",               po::value(&opt.csv_format_str)->default_value(""), asp::csv_opt_caption().c_str())
@@ -200,9 +212,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                              positional, positional_desc, usage,
                              allow_unregistered, unregistered );
 
-  if ( opt.reference.empty() || opt.source.empty() )
+  if ( opt.reference.empty() || (opt.source.empty() && opt.source_list.empty()) )
     vw_throw( ArgumentErr() << "Missing input files.\n" << usage << general_options );
 
+  if ( !opt.source.empty() && !opt.source_list.empty() )
+    vw_throw( ArgumentErr() << "Cannot specify both a source cloud and a source list.\n"
+              << usage << general_options );
+
+  if ( !opt.source_list.empty() && (opt.hillshading_transform != "" || opt.match_file != "") )
+    vw_throw( ArgumentErr() << "An initial transform from hillshading or from a match file "
+              << "cannot be used with --source-list, as it is specific to one source.\n"
+              << usage << general_options );
+
   if ( opt.out_prefix.empty() )
     vw_throw( ArgumentErr() << "Missing output prefix.\n" << usage << general_options );
 
@@ -259,20 +280,22 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.alignment_method != "point-to-plane"            &&
       opt.alignment_method != "point-to-point"            &&
       opt.alignment_method != "similarity-point-to-point" &&
+      opt.alignment_method != "point-to-dem"              &&
       opt.alignment_method != "fgr"                       &&
       opt.alignment_method != "least-squares"             &&
       opt.alignment_method != "similarity-least-squares"
       )
     vw_throw( ArgumentErr() << "Only the following alignment methods are supported: "
 	      << "point-to-plane, point-to-point, similarity-point-to-point, "
-	      << "fgr, least-squares, and similarity-least-squares.\n"
+	      << "point-to-dem, fgr, least-squares, and similarity-least-squares.\n"
 	      << usage << general_options );
 
   if (opt.alignment_method != "point-to-plane"            &&
       opt.alignment_method != "point-to-point"            &&
       opt.alignment_method != "similarity-point-to-point" &&
+      opt.alignment_method != "point-to-dem"              &&
       opt.compute_translation_only) {
-    vw_throw( ArgumentErr() << "The option --compute-translation-only is only applicable to point-to-plane, point-to-point, and similarity-point-to-point alignment.\n"
+    vw_throw( ArgumentErr() << "The option --compute-translation-only is only applicable to point-to-plane, point-to-point, similarity-point-to-point, and point-to-dem alignment.\n"
 	      << usage << general_options );
   }
   
@@ -282,6 +305,23 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr()
 	      << "Least squares alignment can be used only when the "
 	      << "reference cloud is a DEM.\n" );
+
+  if (opt.num_pyramid_levels < 1)
+    vw_throw( ArgumentErr() << "The number of pyramid levels must be positive.\n"
+              << usage << general_options );
+
+  if (opt.num_pyramid_levels > 1                           &&
+      opt.alignment_method != "point-to-plane"            &&
+      opt.alignment_method != "point-to-point"            &&
+      opt.alignment_method != "similarity-point-to-point")
+    vw_throw( ArgumentErr() << "The option --num-pyramid-levels is only applicable to point-to-plane, point-to-point, and similarity-point-to-point alignment.\n"
+	      << usage << general_options );
+
+  if (opt.alignment_method == "point-to-dem" &&
+      (asp::get_cloud_type(opt.reference) != "DEM" || opt.dont_use_dem_distances))
+    vw_throw( ArgumentErr()
+	      << "Point-to-DEM alignment can be used only when the "
+	      << "reference cloud is a DEM, and without --no-dem-distances.\n" );
 }
 
 /// Compute output statistics for pc_align
@@ -516,13 +556,17 @@ void export_to_fgr(DP const & data, fgr::Points& pts, fgr::Feature & feat){
 
 // Parse a string like:
 // div_factor: 1.4 use_absolute_scale: 0 max_corr_dist: 0.025 iteration_number: 100 tuple_scale: 0.95 tuple_max_cnt: 10000
+// optionally followed by voxel_size, feature_radius, and normal_radius.
 void parse_fgr_options(std::string const & options,
                        double            & div_factor,
                        bool              & use_absolute_scale,
                        double            & max_corr_dist,
                        int               & iteration_number,
                        float             & tuple_scale,
-                       int               & tuple_max_cnt){
+                       int               & tuple_max_cnt,
+                       double            & voxel_size,
+                       double            & feature_radius,
+                       double            & normal_radius){
 
   // Initialize the outputs
   div_factor         = -1;
@@ -531,6 +575,9 @@ void parse_fgr_options(std::string const & options,
   iteration_number   = -1;
   tuple_scale        = -1;
   tuple_max_cnt      = -1;
+  voxel_size         = 0;
+  feature_radius     = 0;
+  normal_radius      = 0;
 
   std::istringstream is(options);
   std::string name, val;
@@ -547,18 +594,43 @@ void parse_fgr_options(std::string const & options,
       tuple_scale = atof(val.c_str());
     if (name.find("tuple_max_cnt") != std::string::npos)
       tuple_max_cnt = atof(val.c_str());
+    if (name.find("voxel_size") != std::string::npos)
+      voxel_size = atof(val.c_str());
+    if (name.find("feature_radius") != std::string::npos)
+      feature_radius = atof(val.c_str());
+    if (name.find("normal_radius") != std::string::npos)
+      normal_radius = atof(val.c_str());
   }
   
   // Sanity check
   if (div_factor <= 0 || max_corr_dist < 0 || iteration_number < 0 || tuple_scale <= 0 ||
-      tuple_max_cnt <= 0) {
+      tuple_max_cnt <= 0 || voxel_size < 0 || feature_radius < 0 || normal_radius < 0) {
     vw_throw( ArgumentErr() << "Could not parse correctly --fgr-options.");
   }
+
+  // As in Open3D's examples, the normals use a smaller neighborhood
+  if (normal_radius == 0)
+    normal_radius = feature_radius / 2.5;
+}
+
+// Pass the FPFH features of the points to FGR
+void export_to_fgr(DP const & data, std::vector<Eigen::VectorXf> const& features,
+                   fgr::Points& pts, fgr::Feature & feat){
+
+  pts.clear();
+  for (int c = 0; c < data.features.cols(); c++){
+    Eigen::Vector3f pts_v;
+    for (int r = 0; r < 3; r++) pts_v[r] = data.features(r, c);
+    pts.push_back(pts_v);
+  }
+  feat = features;
 }
   
-/// Compute alignment using FGR
+/// Compute alignment using FGR. If the matcher of the ICP object already
+/// has a tree of the reference points, it is used for their features.
 PointMatcher<RealT>::Matrix
-fgr_alignment(DP const & source_point_cloud, DP const & ref_point_cloud, Options const& opt) {
+fgr_alignment(DP const & source_point_cloud, DP const & ref_point_cloud,
+              vw::Vector3 const& shift, PM::ICP const& icp, Options const& opt) {
 
   // Parse the options and initialize the FGR object
   double  div_factor; 
@@ -567,9 +639,10 @@ fgr_alignment(DP const & source_point_cloud, DP const & ref_point_cloud, Options
   int     iteration_number;
   float   tuple_scale;
   int     tuple_max_cnt;
+  double  voxel_size, feature_radius, normal_radius;
   parse_fgr_options(opt.fgr_options,  
                     div_factor, use_absolute_scale, max_corr_dist, iteration_number,  
-                    tuple_scale, tuple_max_cnt);
+                    tuple_scale, tuple_max_cnt, voxel_size, feature_radius, normal_radius);
   fgr::CApp app(div_factor, use_absolute_scale, max_corr_dist, iteration_number,  
                 tuple_scale, tuple_max_cnt);
 
@@ -577,13 +650,68 @@ fgr_alignment(DP const & source_point_cloud, DP const & ref_point_cloud, Options
   fgr::Points pts;
   fgr::Feature feat;
 
-  // Pass the reference cloud to FGR
-  export_to_fgr(ref_point_cloud, pts, feat);
-  app.LoadFeature(pts, feat);
+  if (feature_radius <= 0) {
+    // Pass the reference cloud to FGR
+    export_to_fgr(ref_point_cloud, pts, feat);
+    app.LoadFeature(pts, feat);
+
+    // Pass the source cloud to FGR
+    export_to_fgr(source_point_cloud, pts, feat);
+    app.LoadFeature(pts, feat);
+  } else {
+    // Use FPFH features, of the clouds downsampled to voxels if desired
+    DP ref_cloud = ref_point_cloud, source_cloud = source_point_cloud;
+    if (voxel_size > 0) {
+      voxel_downsample(ref_point_cloud, voxel_size, ref_cloud);
+      voxel_downsample(source_point_cloud, voxel_size, source_cloud);
+      vw_out() << "Downsampled the clouds for FGR to " << ref_cloud.features.cols()
+               << " reference and " << source_cloud.features.cols()
+               << " source points." << endl;
+    }
+
+    // Orient the normals away from the planet center, if the points are shifted
+    // from it, so that they agree between the clouds.
+    Eigen::Vector3d up(0, 0, 1);
+    if (norm_2(shift) > 0)
+      up = Eigen::Vector3d(shift[0], shift[1], shift[2]).normalized();
+
+    typedef Nabo::NearestNeighbourSearch<RealT> NNS;
+    Stopwatch sw;
+    sw.start();
+
+    // Share the tree the parallel matcher made of the same reference points
+    boost::shared_ptr<NNS> ref_tree;
+    PM::Matrix ref_tree_cloud;
+    ParallelKDTreeMatcher const* matcher
+      = dynamic_cast<ParallelKDTreeMatcher const*>(icp.matcher.get());
+    if (matcher && matcher->tree() && voxel_size == 0 &&
+        matcher->cloud().rows() == ref_cloud.features.rows() &&
+        matcher->cloud().cols() == ref_cloud.features.cols() &&
+        matcher->cloud() == ref_cloud.features) {
+      ref_tree = matcher->tree();
+    } else {
+      ref_tree_cloud = ref_cloud.features; // the tree refers to these points
+      ref_tree.reset(NNS::create(ref_tree_cloud, DIM));
+    }
+    std::vector<Eigen::VectorXf> ref_features, source_features;
+    compute_fpfh_features_with_cache(opt.reference_cache_dir, ref_cloud, *ref_tree,
+                                     normal_radius, feature_radius, up,
+                                     opt.num_threads, ref_features);
+
+    PM::Matrix source_tree_cloud = source_cloud.features;
+    boost::shared_ptr<NNS> source_tree(NNS::create(source_tree_cloud, DIM));
+    compute_fpfh_features(source_cloud, *source_tree, normal_radius, feature_radius, up,
+                          opt.num_threads, source_features);
+    sw.stop();
+    if (opt.verbose)
+      vw_out() << "Computing the FPFH features took " << sw.elapsed_seconds()
+               << " [s]" << endl;
 
-  // Pass the source cloud to FGR
-  export_to_fgr(source_point_cloud, pts, feat);
-  app.LoadFeature(pts, feat);
+    export_to_fgr(ref_cloud, ref_features, pts, feat);
+    app.LoadFeature(pts, feat);
+    export_to_fgr(source_cloud, source_features, pts, feat);
+    app.LoadFeature(pts, feat);
+  }
 
   // Perform alignment
   app.NormalizePoints();
@@ -730,6 +858,99 @@ least_squares_alignment(DP const& source_point_cloud, // Should not be modified
   return T;
 }
 
+/// Compute alignment with ICP, using the reference DEM grid to find the
+/// closest reference surface rather than a tree of reference points.
+/// At each iteration the DEM is interpolated below each transformed
+/// source point to find the local DEM plane, and the transform is
+/// updated to minimize the distances from the points to these planes,
+/// using only the fraction --outlier-ratio of the points closest to the DEM.
+PointMatcher<RealT>::Matrix
+point_to_dem_alignment(DP const& source_point_cloud, // Should not be modified
+                       vw::Vector3 const& point_cloud_shift,
+                       vw::cartography::GeoReference        const& dem_georef,
+                       vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                       Options const& opt) {
+
+  const int num_pts = source_point_cloud.features.cols();
+  int num_vars = opt.compute_translation_only ? 3 : 6;
+
+  // The transform in the internal shifted coordinate system
+  PointMatcher<RealT>::Matrix T = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+
+  std::vector<Eigen::Vector3d> points, normals;
+  std::vector<double> dists, abs_dists;
+  int iter = 0;
+  for (iter = 0; iter < opt.num_iter; iter++) {
+
+    // Find the DEM plane below each transformed point
+    points.clear(); normals.clear(); dists.clear(); abs_dists.clear();
+    Eigen::Matrix3d R = T.topLeftCorner(DIM, DIM);
+    Eigen::Vector3d t = T.topRightCorner(DIM, 1);
+    for (int i = 0; i < num_pts; i++) {
+      Eigen::Vector3d q = R * source_point_cloud.features.col(i).head(DIM) + t;
+      Vector3 gcc_coord(q[0] + point_cloud_shift[0], q[1] + point_cloud_shift[1],
+                        q[2] + point_cloud_shift[2]);
+      Vector3 llh = dem_georef.datum().cartesian_to_geodetic(gcc_coord);
+      Vector3 surface_point, normal;
+      if (!interp_dem_plane(dem_ref, dem_georef, llh, surface_point, normal))
+        continue;
+      points.push_back(q);
+      normals.push_back(Eigen::Vector3d(normal[0], normal[1], normal[2]));
+      dists.push_back(dot_prod(normal, gcc_coord - surface_point));
+      abs_dists.push_back(std::abs(dists.back()));
+    }
+
+    if (int(points.size()) < num_vars)
+      vw_throw( ArgumentErr() << "Too few source points project onto the reference DEM.\n");
+
+    // Keep only the points closest to the DEM
+    int cutoff_index = std::max(num_vars - 1,
+                                int(opt.outlier_ratio * (abs_dists.size() - 1)));
+    std::nth_element(abs_dists.begin(), abs_dists.begin() + cutoff_index, abs_dists.end());
+    double cutoff = abs_dists[cutoff_index];
+
+    // Linearize the point-to-plane distance in a small rotation w and a
+    // translation dt, so a point q moves to q + w x q + dt, and solve
+    // the normal equations.
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(num_vars, num_vars);
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(num_vars);
+    Eigen::VectorXd row(num_vars);
+    for (size_t i = 0; i < points.size(); i++) {
+      if (std::abs(dists[i]) > cutoff)
+        continue;
+      if (opt.compute_translation_only) {
+        row = normals[i];
+      } else {
+        row.head(DIM) = points[i].cross(normals[i]);
+        row.tail(DIM) = normals[i];
+      }
+      A += row * row.transpose();
+      b -= dists[i] * row;
+    }
+    Eigen::VectorXd x = A.ldlt().solve(b);
+
+    Eigen::Vector3d w  = Eigen::Vector3d::Zero();
+    Eigen::Vector3d dt = x.tail(DIM);
+    if (!opt.compute_translation_only)
+      w = x.head(DIM);
+
+    PointMatcher<RealT>::Matrix dT = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+    double angle = w.norm();
+    if (angle > 0)
+      dT.topLeftCorner(DIM, DIM) = Eigen::AngleAxisd(angle, w / angle).toRotationMatrix();
+    dT.topRightCorner(DIM, 1) = dt;
+    T = dT * T;
+
+    if (angle * 180.0 / M_PI < opt.diff_rotation_err && dt.norm() < opt.diff_translation_err)
+      break;
+  }
+
+  vw_out() << "Point-to-DEM alignment stopped after " << std::min(iter + 1, opt.num_iter)
+           << " iterations.\n";
+
+  return T;
+}
+
 /// Filters out all points from point_cloud with an error entry higher than cutoff
 void filterPointsByError(DP & point_cloud, PointMatcher<RealT>::Matrix &errors, double cutoff) {
 
@@ -798,6 +1019,17 @@ double compute_registration_error(DP          const& ref_point_cloud,
   Stopwatch sw;
   sw.start();
 
+  // Without reference points, the errors are only the distances to the DEM
+  if (!opt.load_ref_points()) {
+    std::vector<double> dem_errors;
+    calcErrorsWithDem(source_point_cloud, shift, dem_georef, dem_ref, dem_errors);
+    error_matrix.resize(1, dem_errors.size());
+    for (size_t col = 0; col < dem_errors.size(); col++)
+      error_matrix(0, col) = dem_errors[col];
+    sw.stop();
+    return sw.elapsed_seconds();
+  }
+
   // Always start by computing the error using LPM
   // Use a big number to make sure no points are filtered!
   pm_icp_object.filterGrossOutliersAndCalcErrors(ref_point_cloud, BIG_NUMBER,
@@ -881,11 +1113,76 @@ Eigen::Vector3d vw_vector3_to_eigen(vw::Vector3 const& vw_vector) {
 // Need this to placate libpointmatcher.
 std::string alignment_method_fallback(std::string const& alignment_method){
   if (alignment_method == "least-squares" || alignment_method == "similarity-least-squares" ||
-      alignment_method == "fgr") 
+      alignment_method == "fgr" || alignment_method == "point-to-dem") 
     return "point-to-plane";
   return alignment_method;
 }
 
+/// Set the ICP parameters from the command line, or from the config file, if given.
+void set_icp_params(PM::ICP & icp, DP const& ref_point_cloud, Options const& opt) {
+  if (opt.config_file == ""){
+    // Read the options from the command line
+    icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
+                  (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
+                  opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
+                  false/*opt.verbose*/);
+  }else{
+    vw_out() << "Will read the options from: " << opt.config_file << endl;
+    ifstream ifs(opt.config_file.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open configuration file: "
+                << opt.config_file << "\n" );
+    icp.loadFromYaml(ifs);
+  }
+  // Do this again in case the matcher was replaced above
+  if (opt.load_ref_points())
+    use_parallel_matcher(icp, ref_point_cloud, opt.num_threads);
+}
+
+/// Run ICP on voxel-downsampled versions of the clouds, from the
+/// coarsest level to the finest, each level starting with the
+/// transform found at the previous one. The voxels at level k are
+/// 4^k times the estimated reference point spacing. Level 0, with
+/// the full clouds, is left to the caller.
+PointMatcher<RealT>::Matrix coarse_to_fine_alignment(DP const& source_point_cloud,
+                                                     DP const& ref_point_cloud,
+                                                     Options const& opt) {
+
+  PointMatcher<RealT>::Matrix T = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+  double spacing = estimate_point_spacing(ref_point_cloud);
+  if (spacing <= 0)
+    return T;
+
+  // Fewer points than this make for a poor alignment
+  int min_num_points = 100;
+
+  for (int level = opt.num_pyramid_levels - 1; level >= 1; level--) {
+
+    double voxel_size = spacing * pow(4.0, level);
+    DP ref_level, source_level;
+    voxel_downsample(ref_point_cloud,    voxel_size, ref_level);
+    voxel_downsample(source_point_cloud, voxel_size, source_level);
+
+    vw_out() << "Pyramid level " << level << ": voxel size " << voxel_size << " m, "
+             << ref_level.features.cols() << " reference and "
+             << source_level.features.cols() << " source points.\n";
+    if (ref_level.features.cols()    < min_num_points ||
+        source_level.features.cols() < min_num_points) {
+      vw_out() << "Too few points at this level, skipping it.\n";
+      continue;
+    }
+
+    PM::ICP icp;
+    icp.initRefTree(ref_level, alignment_method_fallback(opt.alignment_method),
+                    opt.highest_accuracy, false /*opt.verbose*/);
+    use_parallel_matcher(icp, ref_level, opt.num_threads);
+    set_icp_params(icp, ref_level, opt);
+    T = icp(source_level, ref_level, T, opt.compute_translation_only);
+  }
+
+  return T;
+}
+
 // Hillshade the reference and source DEMs, and use them to find
 // interest point matches among the hillshaded images.  These will be
 // used later to find a rotation + translation + scale transform.
@@ -956,7 +1253,7 @@ initial_transform_from_match_file(std::string const& ref_file,
 
   vector<vw::ip::InterestPoint> ref_ip, source_ip;
   vw_out() << "Reading match file: " << match_file << "\n";
-  vw::ip::read_binary_match_file(match_file, ref_ip, source_ip);
+  asp::read_match_file(match_file, ref_ip, source_ip);
 
   DiskImageView<float> ref(ref_file);
   vw::cartography::GeoReference ref_geo;
@@ -1138,6 +1435,274 @@ void adjust_and_intersect_ref_source_boxes(BBox2 & ref_box, BBox2 & source_box,
   adjust_lonlat_bbox(source, source_box);
 }
 
+/// A source cloud to align to the reference, with its output prefix
+struct AlignmentJob {
+  std::string source, out_prefix;
+  BBox2 source_box; // the intersection of the source box with the reference box
+};
+
+/// Read the jobs from a list having on each line a source cloud,
+/// optionally followed by an output prefix.
+void read_alignment_jobs(Options const& opt, std::vector<AlignmentJob> & jobs) {
+
+  jobs.clear();
+  if (opt.source_list == "") {
+    AlignmentJob job;
+    job.source     = opt.source;
+    job.out_prefix = opt.out_prefix;
+    jobs.push_back(job);
+    return;
+  }
+
+  std::ifstream ifs;
+  if (opt.source_list != "-") {
+    ifs.open(opt.source_list.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open the source list: " << opt.source_list << "\n" );
+  }
+  std::istream & is = (opt.source_list == "-") ? std::cin : ifs;
+
+  std::string line;
+  while (std::getline(is, line)) {
+    std::istringstream iss(line);
+    AlignmentJob job;
+    if (!(iss >> job.source) || job.source[0] == '#')
+      continue;
+    if (!(iss >> job.out_prefix))
+      job.out_prefix = opt.out_prefix + "-" + fs::path(job.source).stem().string();
+    jobs.push_back(job);
+  }
+
+  if (jobs.empty())
+    vw_throw( ArgumentErr() << "No source clouds found in: " << opt.source_list << "\n" );
+}
+
+/// Align the source of the given job to the reference, which was
+/// loaded already, and write the outputs. The options are for this job,
+/// so they have its source and output prefix.
+void align_source(Options                   const& opt,
+                  BBox2                     const& source_box,
+                  GeoReference              const& geo,
+                  asp::CsvConv              const& csv_conv,
+                  DP                        const& ref_point_cloud,
+                  Vector3                          shift,
+                  bool                             is_lola_rdr_format,
+                  double                           mean_ref_longitude,
+                  cartography::GeoReference const& dem_georef,
+                  vw::ImageViewRef< PixelMask<float> > const& reference_dem_ref,
+                  PM::ICP                        & icp) {
+
+  double mean_source_longitude = 0.0;  // may get overwritten
+
+  // Load the subsampled source point cloud. If the user wants
+  // to filter gross outliers in the source points based on
+  // max_disp, load a lot more points than asked, filter based on
+  // max_disp, then resample to the number desired by the user.
+  int num_source_pts = opt.max_num_source_points;
+  if (opt.max_disp > 0.0)
+    num_source_pts = max(num_source_pts, 50000000);
+  // Use the same shift used for the reference point cloud, if it was loaded
+  bool calc_shift = !opt.load_ref_points();
+  Stopwatch sw2;
+  sw2.start();
+  DP source_point_cloud;
+  load_cloud(opt.source, num_source_pts, source_box, 
+	      calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+	      mean_source_longitude, opt.verbose, source_point_cloud);
+  sw2.stop();
+  if (opt.verbose)
+    vw_out() << "Loading the source point cloud took "
+             << sw2.elapsed_seconds() << " [s]" << endl;
+
+  // Without reference points, shift one more time, to place the
+  // centroid of the source at the origin. Otherwise this was done
+  // with the centroid of the reference when loading it.
+  if (!opt.load_ref_points()) {
+    int numSrcPts = source_point_cloud.features.cols();
+    Eigen::VectorXd meanSrc = source_point_cloud.features.rowwise().sum() / numSrcPts;
+    source_point_cloud.features.topRows(DIM).colwise() -= meanSrc.head(DIM);
+    for (int row = 0; row < DIM; row++)
+      shift[row] += meanSrc(row); // Update the shift variable as well as the points
+    if (opt.verbose)
+      vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
+  }
+
+  // The point clouds are shifted, so shift the initial transform as well.
+  PointMatcher<RealT>::Matrix initT = apply_shift(opt.init_transform, shift);
+
+  double elapsed_time;
+
+  // Apply the initial guess transform to the source point cloud.
+  apply_transform_to_cloud(initT, source_point_cloud);
+  
+  PointMatcher<RealT>::Matrix beg_errors;
+  if (opt.max_disp > 0.0){
+    // Filter gross outliers
+    filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
+                        shift, dem_georef, reference_dem_ref, opt);
+  }
+
+  random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
+  vw_out() << "Reducing number of source points to "
+           << source_point_cloud.features.cols() << endl;
+
+  // Write the point cloud to disk for debugging
+  //debug_save_point_cloud(ref_point_cloud, geo, shift, "ref.csv");
+  //dump_bin("ref.bin", ref_point_cloud);
+
+  elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
+                                            shift, dem_georef, reference_dem_ref,
+					      opt, beg_errors);
+  calc_stats("Input", beg_errors);
+  if (opt.verbose)
+    vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
+
+
+  // Compute the transformation to align the source to reference.
+  Stopwatch sw4;
+  sw4.start();
+  PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+  set_icp_params(icp, ref_point_cloud, opt);
+
+  // We bypass calling ICP if the user explicitely asks for 0 iterations.
+  PointMatcher<RealT>::Matrix T = Id;
+  if (opt.num_iter > 0){
+    if (opt.alignment_method == "fgr") {
+      T = fgr_alignment(source_point_cloud, ref_point_cloud, shift, icp, opt);
+    } else if (opt.alignment_method == "point-to-dem") {
+      T = point_to_dem_alignment(source_point_cloud, shift,
+                                 dem_georef, reference_dem_ref, opt);
+    } else if (opt.alignment_method == "point-to-plane" ||
+               opt.alignment_method == "point-to-point" ||
+               opt.alignment_method == "similarity-point-to-point") {
+      // Use libpointmatcher, perhaps starting from coarser versions of the clouds
+      PointMatcher<RealT>::Matrix coarseT = Id;
+      if (opt.num_pyramid_levels > 1)
+        coarseT = coarse_to_fine_alignment(source_point_cloud, ref_point_cloud, opt);
+      T = icp(source_point_cloud, ref_point_cloud, coarseT,
+		opt.compute_translation_only);
+	vw_out() << "Match ratio: "
+		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
+    }else if (opt.alignment_method == "least-squares" ||
+              opt.alignment_method == "similarity-least-squares"){
+      /// Compute alignment using least squares
+	T = least_squares_alignment(source_point_cloud, shift,
+				    dem_georef, reference_dem_ref, opt);
+    }else
+      vw_throw( ArgumentErr() << "Unknown alignment method: " << opt.alignment_method);
+  }
+  sw4.stop();
+  if (opt.verbose)
+    vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
+
+  // Transform the source to make it close to reference.
+  DP trans_source_point_cloud(source_point_cloud);
+  apply_transform_to_cloud(T, trans_source_point_cloud);
+
+  // Calculate by how much points move as result of T
+  double max_obtained_disp = calc_max_displacment(source_point_cloud, trans_source_point_cloud);
+  Vector3 source_ctr_vec, source_ctr_llh;
+  Vector3 trans_xyz, trans_ned, trans_llh;
+  vw::Matrix3x3 NED2ECEF;
+  calc_translation_vec(initT, source_point_cloud, trans_source_point_cloud, shift,
+			 geo.datum(), source_ctr_vec, source_ctr_llh,
+                       trans_xyz, trans_ned, trans_llh, NED2ECEF);
+
+  // For each point, compute the distance to the nearest reference point.
+  PointMatcher<RealT>::Matrix end_errors;
+  elapsed_time = compute_registration_error(ref_point_cloud, trans_source_point_cloud, icp,
+                                            shift, dem_georef, reference_dem_ref, opt,
+					      end_errors);
+  calc_stats("Output", end_errors);
+  if (opt.verbose)
+    vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
+
+  // We must apply to T the initial guess transform
+  PointMatcher<RealT>::Matrix combinedT = T*initT;
+
+  // Go back to the original coordinate system, undoing the shift
+  PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
+
+  // Print statistics
+  vw_out() << "Alignment transform (origin is planet center):" << endl << globalT << endl;
+  vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
+  // Swap lat and lon, as we want to print lat first
+  std::swap(source_ctr_llh[0], source_ctr_llh[1]);
+  vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
+  vw_out() << std::endl;
+
+  vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
+  vw_out() << "Translation vector (North-East-Down, meters): "
+           << trans_ned << std::endl;
+  vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
+           << std::endl;
+  vw::vw_out() << "Maximum displacement of points between the source "
+               << "cloud with any initial transform applied to it and the "
+               << "source cloud after alignment to the reference: " 
+               << max_obtained_disp << " m" << std::endl;
+  if (opt.max_disp > 0 && opt.max_disp < max_obtained_disp) {
+    vw_out() << "Warning: The input --max-displacement value is smaller than the "
+             << "final observed displacement. It may be advised to increase the former "
+             << "and rerun the tool.\n";
+  }
+
+  // Swap lat and lon, as we want to print lat first
+  std::swap(trans_llh[0], trans_llh[1]);
+  vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
+  vw_out() << std::endl;
+
+  Matrix3x3 rot;
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) = globalT(r, c);
+
+  double scale = pow(det(rot), 1.0/3.0);
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) /= scale;
+  vw_out() << "Transform scale - 1 = " << (scale-1.0) << std::endl;
+  
+  Matrix3x3 rot_NED = inverse(NED2ECEF) * rot * NED2ECEF;
+ 
+  Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
+  Vector3 euler_angles_NED = math::rotation_matrix_to_euler_xyz(rot_NED) * 180/M_PI;
+  Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
+  vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
+  vw_out() << "Euler angles (North-East-Down, degrees): " << euler_angles_NED  << endl;
+  vw_out() << "Axis of rotation and angle (degrees): "
+           << axis_angles/norm_2(axis_angles) << ' '
+           << norm_2(axis_angles) << endl;
+
+  
+  Stopwatch sw5;
+  sw5.start();
+  write_transforms(opt, globalT);
+
+  if (opt.save_trans_ref){
+    string trans_ref_prefix = opt.out_prefix + "-trans_reference";
+    save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
+                           geo, csv_conv, mean_ref_longitude, globalT.inverse());
+  }
+
+  if (opt.save_trans_source){
+    string trans_source_prefix = opt.out_prefix + "-trans_source";
+    save_trans_point_cloud(opt, opt.source, trans_source_prefix,
+                           geo, csv_conv, mean_source_longitude, globalT);
+  }
+
+  save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+  save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+
+  if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
+    + "-iterationInfo.csv" << std::endl;
+
+  sw5.stop();
+  if (opt.verbose) vw_out() << "Saving to disk took "
+                            << sw5.elapsed_seconds() << " [s]" << endl;
+}
+
 int main( int argc, char *argv[] ) {
 
   // Mandatory line for Eigen
@@ -1158,11 +1723,16 @@ int main( int argc, char *argv[] ) {
     asp::CsvConv csv_conv;
     csv_conv.parse_csv_format(opt.csv_format_str, opt.csv_proj4_str);
 
+    // The source clouds to align, with their output prefixes
+    std::vector<AlignmentJob> jobs;
+    read_alignment_jobs(opt, jobs);
+
     // Try to read the georeference/datum info
     GeoReference geo;
     std::vector<std::string> clouds;
     clouds.push_back(opt.reference);
-    clouds.push_back(opt.source);
+    for (size_t it = 0; it < jobs.size(); it++)
+      clouds.push_back(jobs[it].source);
     read_georef(clouds, opt.datum, opt.csv_proj4_str,  
                 opt.semi_major_axis, opt.semi_minor_axis,  
                 opt.csv_format_str,  csv_conv, geo);
@@ -1202,39 +1772,59 @@ int main( int argc, char *argv[] ) {
     vw_out() << "Computing the intersection of the bounding boxes "
              << "of the reference and source points using " 
              << num_sample_pts << " sample points.\n";
-    BBox2 ref_box, source_box, trans_ref_box, trans_source_box;
-
+    BBox2 ref_box, trans_ref_box;
     PointMatcher<RealT>::Matrix inv_init_trans = opt.init_transform.inverse();
     calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
                               opt.reference, opt.max_disp, inv_init_trans,
                               ref_box, trans_ref_box);
-    calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                              opt.source, opt.max_disp, opt.init_transform,
-                              source_box, trans_source_box);
-
-    // When boxes are huge, it is hard to do the optimization of intersecting
-    // them, as they may differ not by 0 or 360, but by 180. Better do nothing
-    // in that case. The solution may degrade a bit, as we may load points
-    // not in the intersection of the boxes, but at least it won't be wrong.
-    // In this case, there is a chance the boxes were computed wrong anyway.
-    if (ref_box.width() > 180.0 || source_box.width() > 180.0) {
-      vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
-               << "It is suggested that they be cropped, to get more accurate results.\n";
-      ref_box = BBox2();
-      source_box = BBox2();
-    }
+
+    // Load the reference in the union of its intersections with the
+    // sources, and each source in its intersection with the reference.
+    // An empty box means no restriction.
+    BBox2 ref_load_box;
+    bool restrict_ref = true;
+    for (size_t it = 0; it < jobs.size(); it++) {
+      BBox2 curr_ref_box = ref_box, curr_trans_ref_box = trans_ref_box;
+      BBox2 source_box, trans_source_box;
+      calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
+                                jobs[it].source, opt.max_disp, opt.init_transform,
+                                source_box, trans_source_box);
+
+      // When boxes are huge, it is hard to do the optimization of intersecting
+      // them, as they may differ not by 0 or 360, but by 180. Better do nothing
+      // in that case. The solution may degrade a bit, as we may load points
+      // not in the intersection of the boxes, but at least it won't be wrong.
+      // In this case, there is a chance the boxes were computed wrong anyway.
+      if (curr_ref_box.width() > 180.0 || source_box.width() > 180.0) {
+        vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
+                 << "It is suggested that they be cropped, to get more accurate results.\n";
+        curr_ref_box = BBox2();
+        source_box = BBox2();
+      }
     
-    vw_out() << "Reference box: " << ref_box << std::endl;
-    vw_out() << "Source box:    " << source_box << std::endl;
+      vw_out() << "Reference box: " << curr_ref_box << std::endl;
+      vw_out() << "Source box:    " << source_box << std::endl;
+
+      if (!curr_ref_box.empty() && !source_box.empty()) {
+        adjust_and_intersect_ref_source_boxes(curr_ref_box, trans_source_box,
+                                              opt.reference, jobs[it].source);
+        adjust_and_intersect_ref_source_boxes(curr_trans_ref_box, source_box,
+                                              opt.reference, jobs[it].source);
+      }
+    
+      vw_out() << "Intersection reference box:  " << curr_ref_box << std::endl;
+      vw_out() << "Intersection source    box:  " << source_box   << std::endl;
 
-    if (!ref_box.empty() && !source_box.empty()) {
-      adjust_and_intersect_ref_source_boxes(ref_box, trans_source_box, opt.reference, opt.source);
-      adjust_and_intersect_ref_source_boxes(trans_ref_box, source_box, opt.reference, opt.source);
+      if (curr_ref_box.empty())
+        restrict_ref = false;
+      else
+        ref_load_box.grow(curr_ref_box);
+      jobs[it].source_box = source_box;
     }
+    if (!restrict_ref)
+      ref_load_box = BBox2();
     
     sw0.stop();
-    vw_out() << "Intersection reference box:  " << ref_box    << std::endl;
-    vw_out() << "Intersection source    box:  " << source_box << std::endl;
     vw_out() << "Intersection of bounding boxes took " << sw0.elapsed_seconds() << " [s]" << endl;
 
     // Load the point clouds. We will shift both point clouds by the
@@ -1245,55 +1835,46 @@ int main( int argc, char *argv[] ) {
     bool   calc_shift = true; // Shift points so the first point is (0,0,0)
     bool   is_lola_rdr_format = false;   // may get overwritten
     double mean_ref_longitude    = 0.0;  // may get overwritten
-    double mean_source_longitude = 0.0;  // may get overwritten
     Stopwatch sw1;
     sw1.start();
     DP ref_point_cloud;
-    load_cloud(opt.reference, opt.max_num_reference_points, ref_box,
-               calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-               mean_ref_longitude, opt.verbose, ref_point_cloud);
+    if (!opt.load_ref_points()) {
+      vw_out() << "Using the reference DEM directly, without loading its points.\n";
+    } else if (opt.reference_cache_dir == "") {
+      load_cloud(opt.reference, opt.max_num_reference_points, ref_load_box,
+                 calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+                 mean_ref_longitude, opt.verbose, ref_point_cloud);
+    } else {
+      // The settings which change how the reference is loaded
+      std::ostringstream settings;
+      settings.precision(17);
+      settings << opt.csv_format_str << "\n" << opt.csv_proj4_str << "\n" << geo.datum();
+      load_cloud_with_cache(opt.reference_cache_dir, settings.str(),
+                            opt.reference, opt.max_num_reference_points, ref_load_box,
+                            calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+                            mean_ref_longitude, opt.verbose, ref_point_cloud);
+    }
     sw1.stop();
     if (opt.verbose)
       vw_out() << "Loading the reference point cloud took "
                << sw1.elapsed_seconds() << " [s]" << endl;
     //ref_point_cloud.save(outputBaseFile + "_ref.vtk");
 
-    // Load the subsampled source point cloud. If the user wants
-    // to filter gross outliers in the source points based on
-    // max_disp, load a lot more points than asked, filter based on
-    // max_disp, then resample to the number desired by the user.
-    int num_source_pts = opt.max_num_source_points;
-    if (opt.max_disp > 0.0)
-      num_source_pts = max(num_source_pts, 50000000);
-    calc_shift = false; // Use the same shift used for the reference point cloud
-    Stopwatch sw2;
-    sw2.start();
-    DP source_point_cloud;
-    load_cloud(opt.source, num_source_pts, source_box, 
-	      calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-	      mean_source_longitude, opt.verbose, source_point_cloud);
-    sw2.stop();
-    if (opt.verbose)
-      vw_out() << "Loading the source point cloud took "
-               << sw2.elapsed_seconds() << " [s]" << endl;
-
     // So far we shifted by first point in reference point cloud to reduce
-    // the magnitude of all loaded points. Now that we have loaded all
-    // points, shift one more time, to place the centroid of the
-    // reference at the origin.
+    // the magnitude of all loaded points. Shift one more time, to place the
+    // centroid of the reference at the origin. The sources are loaded with
+    // this shift. Without reference points, this is done for each source.
     // Note: If this code is ever converting to using floats,
     // the operation below needs to be re-implemented to be accurate.
-    int numRefPts = ref_point_cloud.features.cols();
-    Eigen::VectorXd meanRef = ref_point_cloud.features.rowwise().sum() / numRefPts;
-    ref_point_cloud.features.topRows(DIM).colwise()    -= meanRef.head(DIM);
-    source_point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
-    for (int row = 0; row < DIM; row++)
-      shift[row] += meanRef(row); // Update the shift variable as well as the points
-    if (opt.verbose)
-      vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
-
-    // The point clouds are shifted, so shift the initial transform as well.
-    PointMatcher<RealT>::Matrix initT = apply_shift(opt.init_transform, shift);
+    if (opt.load_ref_points()) {
+      int numRefPts = ref_point_cloud.features.cols();
+      Eigen::VectorXd meanRef = ref_point_cloud.features.rowwise().sum() / numRefPts;
+      ref_point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
+      for (int row = 0; row < DIM; row++)
+        shift[row] += meanRef(row); // Update the shift variable as well as the points
+      if (opt.verbose)
+        vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
+    }
 
     // If the reference point cloud came from a DEM, also load the data in DEM format.
     cartography::GeoReference dem_georef;
@@ -1306,199 +1887,52 @@ int main( int argc, char *argv[] ) {
       reference_dem_ref.reset(reference_dem);
     }
 
-    // Now all of the input data is loaded.
-
     // Filter the reference and initialize the reference tree
-    double elapsed_time;
     PM::ICP icp; // LibpointMatcher object
 
-    Stopwatch sw3;
-    if (opt.verbose)
-      vw_out() << "Building the reference cloud tree." << endl;
-    sw3.start();
-    icp.initRefTree(ref_point_cloud, alignment_method_fallback(opt.alignment_method),
-		    opt.highest_accuracy, false /*opt.verbose*/);
-    sw3.stop();
-    if (opt.verbose)
-      vw_out() << "Reference point cloud processing took " << sw3.elapsed_seconds() << " [s]" << endl;
-
-    // Apply the initial guess transform to the source point cloud.
-    apply_transform_to_cloud(initT, source_point_cloud);
-    
-    PointMatcher<RealT>::Matrix beg_errors;
-    if (opt.max_disp > 0.0){
-      // Filter gross outliers
-      filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
-                          shift, dem_georef, reference_dem_ref, opt);
-    }
-
-    random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
-    vw_out() << "Reducing number of source points to "
-             << source_point_cloud.features.cols() << endl;
-
-    // Write the point cloud to disk for debugging
-    //debug_save_point_cloud(ref_point_cloud, geo, shift, "ref.csv");
-    //dump_bin("ref.bin", ref_point_cloud);
-
-    elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref,
-					      opt, beg_errors);
-    calc_stats("Input", beg_errors);
-    if (opt.verbose)
-      vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
-
-
-    // Compute the transformation to align the source to reference.
-    Stopwatch sw4;
-    sw4.start();
-    PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
-    if (opt.config_file == ""){
-      // Read the options from the command line
-      icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
-                    (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
-                    opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
-                    false/*opt.verbose*/);
-    }else{
-      vw_out() << "Will read the options from: " << opt.config_file << endl;
-      ifstream ifs(opt.config_file.c_str());
-      if (!ifs.good())
-        vw_throw( ArgumentErr() << "Cannot open configuration file: "
-                  << opt.config_file << "\n" );
-      icp.loadFromYaml(ifs);
-    }
-
-    // We bypass calling ICP if the user explicitely asks for 0 iterations.
-    PointMatcher<RealT>::Matrix T = Id;
-    if (opt.num_iter > 0){
-      if (opt.alignment_method == "fgr") {
-        T = fgr_alignment(source_point_cloud, ref_point_cloud, opt);
-      } else if (opt.alignment_method == "point-to-plane" ||
-                 opt.alignment_method == "point-to-point" ||
-                 opt.alignment_method == "similarity-point-to-point") {
-        // Use libpointmatcher
-        T = icp(source_point_cloud, ref_point_cloud, Id,
-		opt.compute_translation_only);
-	vw_out() << "Match ratio: "
-		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
-      }else if (opt.alignment_method == "least-squares" ||
-                opt.alignment_method == "similarity-least-squares"){
-        /// Compute alignment using least squares
-	T = least_squares_alignment(source_point_cloud, shift,
-				    dem_georef, reference_dem_ref, opt);
-      }else
-        vw_throw( ArgumentErr() << "Unknown alignment method: " << opt.alignment_method);
-    }
-    sw4.stop();
-    if (opt.verbose)
-      vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
-
-    // Transform the source to make it close to reference.
-    DP trans_source_point_cloud(source_point_cloud);
-    apply_transform_to_cloud(T, trans_source_point_cloud);
-
-    // Calculate by how much points move as result of T
-    double max_obtained_disp = calc_max_displacment(source_point_cloud, trans_source_point_cloud);
-    Vector3 source_ctr_vec, source_ctr_llh;
-    Vector3 trans_xyz, trans_ned, trans_llh;
-    vw::Matrix3x3 NED2ECEF;
-    calc_translation_vec(initT, source_point_cloud, trans_source_point_cloud, shift,
-			 geo.datum(), source_ctr_vec, source_ctr_llh,
-                         trans_xyz, trans_ned, trans_llh, NED2ECEF);
-
-    // For each point, compute the distance to the nearest reference point.
-    PointMatcher<RealT>::Matrix end_errors;
-    elapsed_time = compute_registration_error(ref_point_cloud, trans_source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref, opt,
-					      end_errors);
-    calc_stats("Output", end_errors);
-    if (opt.verbose)
-      vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
-
-    // We must apply to T the initial guess transform
-    PointMatcher<RealT>::Matrix combinedT = T*initT;
-
-    // Go back to the original coordinate system, undoing the shift
-    PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
-
-    // Print statistics
-    vw_out() << "Alignment transform (origin is planet center):" << endl << globalT << endl;
-    vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
-    // Swap lat and lon, as we want to print lat first
-    std::swap(source_ctr_llh[0], source_ctr_llh[1]);
-    vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
-    vw_out() << std::endl;
-
-    vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
-    vw_out() << "Translation vector (North-East-Down, meters): "
-             << trans_ned << std::endl;
-    vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
-             << std::endl;
-    vw::vw_out() << "Maximum displacement of points between the source "
-                 << "cloud with any initial transform applied to it and the "
-                 << "source cloud after alignment to the reference: " 
-                 << max_obtained_disp << " m" << std::endl;
-    if (opt.max_disp > 0 && opt.max_disp < max_obtained_disp) {
-      vw_out() << "Warning: The input --max-displacement value is smaller than the "
-               << "final observed displacement. It may be advised to increase the former "
-               << "and rerun the tool.\n";
-    }
-
-    // Swap lat and lon, as we want to print lat first
-    std::swap(trans_llh[0], trans_llh[1]);
-    vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
-    vw_out() << std::endl;
-
-    Matrix3x3 rot;
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) = globalT(r, c);
-
-    double scale = pow(det(rot), 1.0/3.0);
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) /= scale;
-    vw_out() << "Transform scale - 1 = " << (scale-1.0) << std::endl;
-    
-    Matrix3x3 rot_NED = inverse(NED2ECEF) * rot * NED2ECEF;
-   
-    Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
-    Vector3 euler_angles_NED = math::rotation_matrix_to_euler_xyz(rot_NED) * 180/M_PI;
-    Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
-    vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
-    vw_out() << "Euler angles (North-East-Down, degrees): " << euler_angles_NED  << endl;
-    vw_out() << "Axis of rotation and angle (degrees): "
-             << axis_angles/norm_2(axis_angles) << ' '
-             << norm_2(axis_angles) << endl;
-
-    
-    Stopwatch sw5;
-    sw5.start();
-    write_transforms(opt, globalT);
-
-    if (opt.save_trans_ref){
-      string trans_ref_prefix = opt.out_prefix + "-trans_reference";
-      save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
-                             geo, csv_conv, globalT.inverse());
+    if (opt.load_ref_points()) {
+      Stopwatch sw3;
+      if (opt.verbose)
+        vw_out() << "Building the reference cloud tree." << endl;
+      sw3.start();
+      icp.initRefTree(ref_point_cloud, alignment_method_fallback(opt.alignment_method),
+                      opt.highest_accuracy, false /*opt.verbose*/);
+      // Query the nearest reference points using all threads
+      use_parallel_matcher(icp, ref_point_cloud, opt.num_threads);
+      sw3.stop();
+      if (opt.verbose)
+        vw_out() << "Reference point cloud processing took " << sw3.elapsed_seconds()
+                 << " [s]" << endl;
     }
 
-    if (opt.save_trans_source){
-      string trans_source_prefix = opt.out_prefix + "-trans_source";
-      save_trans_point_cloud(opt, opt.source, trans_source_prefix,
-                             geo, csv_conv, globalT);
+    // Now the reference is loaded. Align the sources to it.
+    if (opt.source_list == "") {
+      align_source(opt, jobs[0].source_box, geo, csv_conv, ref_point_cloud, shift,
+                   is_lola_rdr_format, mean_ref_longitude, dem_georef, reference_dem_ref, icp);
+    } else {
+      // A failed job does not stop the others
+      int num_failed = 0;
+      for (size_t it = 0; it < jobs.size(); it++) {
+        vw_out() << "\nAligning source " << it + 1 << " of " << jobs.size() << ": "
+                 << jobs[it].source << "\n";
+        Options job_opt = opt;
+        job_opt.source     = jobs[it].source;
+        job_opt.out_prefix = jobs[it].out_prefix;
+        try {
+          vw::create_out_dir(job_opt.out_prefix);
+          align_source(job_opt, jobs[it].source_box, geo, csv_conv, ref_point_cloud, shift,
+                       is_lola_rdr_format, mean_ref_longitude, dem_georef, reference_dem_ref,
+                       icp);
+        } catch (const std::exception& e) {
+          vw_out() << "Failed to align " << jobs[it].source << ": " << e.what() << "\n";
+          num_failed++;
+        }
+      }
+      if (num_failed > 0)
+        vw_throw( ArgumentErr() << "Failed to align " << num_failed << " out of "
+                  << jobs.size() << " source clouds.\n" );
     }
 
-    save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-    save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-
-    if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
-      + "-iterationInfo.csv" << std::endl;
-
-    sw5.stop();
-    if (opt.verbose) vw_out() << "Saving to disk took "
-                              << sw5.elapsed_seconds() << " [s]" << endl;
-
   } ASP_STANDARD_CATCHES;
 
   return 0;
@@ -57,6 +57,8 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/GeodeticBatch.h>
+#include <asp/Core/QfitReader.h>
 #include <asp/Core/EigenUtils.h>
 #include <liblas/liblas.hpp>
 
@@ -64,6 +66,8 @@
 #include <cstring>
 
 #include <pointmatcher/PointMatcher.h>
+#include <nabo/nabo.h>
+#include <boost/shared_ptr.hpp>
 
 namespace asp {
 /*
@@ -114,6 +118,27 @@ void load_cloud(std::string const& file_name,
 		bool verbose,
 		typename PointMatcher<RealT>::DataPoints & data);
 
+/// Same as load_cloud(), but keep in the given directory a binary copy
+/// of the points loaded from the file with no lon-lat box, and use it
+/// on later runs, so that the file need not be read and parsed again.
+/// The cache is keyed by the file path, size, and modification time, the
+/// number of points, and the other settings the loading depends on,
+/// passed in as a string. The lon-lat box and the shift are applied to
+/// the cached points.
+void load_cloud_with_cache(std::string const& cache_dir,
+                           std::string const& settings,
+                           std::string const& file_name,
+                           int num_points_to_load,
+                           vw::BBox2 const& lonlat_box,
+                           bool calc_shift,
+                           vw::Vector3 & shift,
+                           vw::cartography::GeoReference const& geo,
+                           CsvConv const& csv_conv,
+                           bool   & is_lola_rdr_format,
+                           double & mean_longitude,
+                           bool verbose,
+                           typename PointMatcher<RealT>::DataPoints & data);
+
 /// Calculate the lon-lat bounding box of the points and bias it based
 /// on max displacement (which is in meters). This is used to throw
 /// away points in the other cloud which are not within this box.
@@ -183,11 +208,15 @@ struct TransformPC: public vw::UnaryReturnSameType {
 /// Apply a given transform to the point cloud in input file, and save it.
 /// - Note: We transform the entire point cloud, not just the resampled
 ///         version used in alignment.
+/// - The input is read only once, in blocks or batches of lines.
+/// - The mean longitude of the points, as found when loading them,
+///   is used to adjust by 360 degrees the longitudes in CSV files.
 void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
                             std::string input_file,
                             std::string out_prefix,
                             vw::cartography::GeoReference const& geo,
                             CsvConv const& csv_conv,
+                            double mean_longitude,
                             PointMatcher<RealT>::Matrix const& T);
 
 /// Save a transformed point cloud with N bands
@@ -240,6 +269,81 @@ bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
                        vw::Vector3                   const & lonlat,
                        double                              & dem_height);
 
+/// Find the DEM surface point at the given lon-lat, and the normal to
+/// the DEM there, from the heights at the neighboring pixels. Both are
+/// in ECEF. Returns false if this location is not in the valid DEM area.
+bool interp_dem_plane(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
+                      vw::cartography::GeoReference const & georef,
+                      vw::Vector3                   const & lonlat,
+                      vw::Vector3                         & surface_point,
+                      vw::Vector3                         & normal);
+
+
+//=======================================================================================
+
+/// A libpointmatcher matcher which finds the nearest reference points
+/// with a libnabo tree, like the KDTreeMatcher, but splits the queried
+/// points among several threads. Both the ICP iterations and the
+/// computation of the registration errors make use of it.
+class ParallelKDTreeMatcher: public PM::Matcher {
+public:
+  ParallelKDTreeMatcher(int knn, RealT epsilon, int search_type, RealT max_dist,
+                        int num_threads);
+  virtual ~ParallelKDTreeMatcher() {}
+
+  virtual void init(DP const& filteredReference);
+  virtual PM::Matches findClosests(DP const& filteredReading);
+
+  typedef Nabo::NearestNeighbourSearch<RealT> NNS;
+
+  /// The reference points and their tree, which other nearest neighbor
+  /// searches among these points can share
+  PM::Matrix const& cloud() const { return m_cloud; }
+  boost::shared_ptr<NNS> const& tree() const { return m_tree; }
+
+private:
+
+  int   m_knn, m_search_type, m_num_threads;
+  RealT m_epsilon, m_max_dist;
+  PM::Matrix m_cloud;
+  boost::shared_ptr<NNS> m_tree;
+};
+
+/// Estimate the distance between neighboring points of a cloud sampling
+/// a surface, from the area of its bounding box and the number of points.
+double estimate_point_spacing(DP const& point_cloud);
+
+/// Replace the points in each cube with the given side length by their mean.
+void voxel_downsample(DP const& in_cloud, double voxel_size, DP & out_cloud);
+
+/// The bins in each Fast Point Feature Histogram
+const int FPFH_NUM_BINS = 33;
+
+/// Compute the Fast Point Feature Histograms (Rusu et al., 2009) of the
+/// points of a cloud, in parallel, finding the neighbors with the given
+/// tree of the cloud. The normals are estimated from at most 30
+/// neighbors within normal_radius, and oriented along the up direction.
+/// The features use at most 100 neighbors within feature_radius.
+void compute_fpfh_features(DP const& cloud,
+                           Nabo::NearestNeighbourSearch<RealT> const& tree,
+                           double normal_radius, double feature_radius,
+                           Eigen::Vector3d const& up, int num_threads,
+                           std::vector<Eigen::VectorXf> & features);
+
+/// Same as compute_fpfh_features(), but if cache_dir is not empty the
+/// features are read from there if computed before for the same points
+/// and parameters, or else saved there.
+void compute_fpfh_features_with_cache(std::string const& cache_dir, DP const& cloud,
+                                      Nabo::NearestNeighbourSearch<RealT> const& tree,
+                                      double normal_radius, double feature_radius,
+                                      Eigen::Vector3d const& up, int num_threads,
+                                      std::vector<Eigen::VectorXf> & features);
+
+/// If the ICP object uses the KDTreeMatcher, replace it with a
+/// ParallelKDTreeMatcher with the same parameters, built for the given
+/// reference cloud. Other matchers are kept.
+void use_parallel_matcher(PM::ICP & icp, DP const& ref_point_cloud, int num_threads);
+
 }
 
 #include <asp/Tools/pc_align_utils.tcc>
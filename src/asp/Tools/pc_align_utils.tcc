@@ -47,6 +47,16 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <pointmatcher/PointMatcher.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <Eigen/Eigenvalues>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <sstream>
 
 namespace asp {
 
@@ -174,6 +184,107 @@ void load_las(std::string const& file_name,
 
 }
 
+// Load points from an ATM QFIT file. The heights are above WGS84
+// whatever the datum of the other cloud.
+vw::int64 load_qfit_aux(std::string const& file_name,
+                        int num_points_to_load,
+                        vw::BBox2 const& lonlat_box,
+                        bool calc_shift,
+                        vw::Vector3 & shift,
+                        double & mean_longitude,
+                        bool verbose, DoubleMatrix & data){
+
+  data.conservativeResize(DIM+1, num_points_to_load);
+
+  asp::QfitReader reader(file_name);
+  vw::cartography::Datum wgs84("WGS84");
+
+  // We will randomly pick or not a point with probability load_ratio
+  vw::int64 num_total_points = reader.num_records();
+  double load_ratio
+    = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
+
+  bool shift_was_calc = false;
+  vw::int64 points_count = 0;
+  double lon_sum = 0.0;
+
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  int hundred = 100;
+  vw::int64 spacing = std::max(num_total_points/hundred, vw::int64(1));
+  double inc_amount = 1.0 / hundred;
+  if (verbose) tpc.report_progress(0);
+
+  vw::Vector3 llh;
+  while (reader.read_next_point(llh)){
+
+    if (points_count >= num_points_to_load)
+      break;
+
+    double r = (double)std::rand()/(double)RAND_MAX;
+    if (r > load_ratio)
+      continue;
+
+    vw::Vector3 xyz = wgs84.geodetic_to_cartesian(llh);
+
+    if (calc_shift && !shift_was_calc){
+      shift = xyz;
+      shift_was_calc = true;
+    }
+
+    // Skip points outside the given box
+    if (!lonlat_box.empty()){
+      vw::Vector2 ll = subvector(llh, 0, 2);
+      if ( !lonlat_box.contains(ll)                         &&
+           !lonlat_box.contains(ll + vw::Vector2(360, 0)) &&
+           !lonlat_box.contains(ll - vw::Vector2(360, 0)) )
+        continue;
+    }
+
+    for (int row = 0; row < DIM; row++)
+      data(row, points_count) = xyz[row] - shift[row];
+    data(DIM, points_count) = 1;
+    lon_sum += llh[0];
+
+    if (verbose && points_count%spacing == 0) tpc.report_incremental_progress( inc_amount );
+
+    points_count++;
+  }
+
+  if (verbose) tpc.report_finished();
+
+  data.conservativeResize(Eigen::NoChange, points_count);
+  mean_longitude = lon_sum/std::max(1.0, (double)points_count);
+
+  return num_total_points;
+}
+
+void load_qfit(std::string const& file_name,
+               int num_points_to_load,
+               vw::BBox2 const& lonlat_box,
+               bool calc_shift,
+               vw::Vector3 & shift,
+               double & mean_longitude,
+               bool verbose, DoubleMatrix & data){
+
+  vw::int64 num_total_points = load_qfit_aux(file_name, num_points_to_load,
+                                             lonlat_box, calc_shift, shift,
+                                             mean_longitude, verbose, data);
+
+  int num_loaded_points = data.cols();
+  if (!lonlat_box.empty()                    &&
+      num_loaded_points < num_points_to_load &&
+      num_loaded_points < num_total_points){
+
+    // We loaded too few points. Try harder.
+    num_points_to_load = std::max(4*num_points_to_load, 10000000);
+    if (verbose)
+      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
+    load_qfit_aux(file_name, num_points_to_load, lonlat_box,
+                  calc_shift, shift, mean_longitude, verbose, data);
+  }
+
+}
+
 // Load xyz points from disk into a matrix with 4 columns. Last column is just ones.
 void load_cloud(std::string const& file_name,
                int num_points_to_load,
@@ -204,6 +315,9 @@ void load_cloud(std::string const& file_name,
   else if (file_type == "LAS")
     load_las(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
 	     geo, verbose, data);
+  else if (file_type == "QFIT")
+    load_qfit(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
+              mean_longitude, verbose, data);
   else if (file_type == "CSV"){
     bool verbose = true;
     load_csv(file_name, num_points_to_load, lonlat_box, 
@@ -240,6 +354,150 @@ void load_cloud(std::string const& file_name,
   
 }
 
+namespace {
+  const std::string PC_ALIGN_CACHE_MAGIC = "ASP_PC_ALIGN_CLOUD_CACHE_1";
+}
+
+// Load xyz points from disk in libpointmatcher's format, with a cache.
+void load_cloud_with_cache(std::string const& cache_dir,
+                           std::string const& settings,
+                           std::string const& file_name,
+                           int num_points_to_load,
+                           vw::BBox2 const& lonlat_box,
+                           bool calc_shift,
+                           vw::Vector3 & shift,
+                           vw::cartography::GeoReference const& geo,
+                           CsvConv const& csv_conv,
+                           bool   & is_lola_rdr_format,
+                           double & mean_longitude,
+                           bool verbose,
+                           typename PointMatcher<RealT>::DataPoints & data){
+
+  namespace fs = boost::filesystem;
+  data.featureLabels = form_labels<RealT>(DIM);
+  PointMatcherSupport::validateFile(file_name);
+
+  // The key stored in the cache, which must match exactly
+  std::ostringstream os;
+  os.precision(17);
+  os << fs::absolute(fs::path(file_name)).string() << "\n"
+     << fs::file_size(file_name) << " " << fs::last_write_time(file_name) << "\n"
+     << num_points_to_load << "\n" << settings << "\n";
+  std::string key = os.str();
+
+  std::ostringstream name;
+  name << std::hex << std::hash<std::string>()(key);
+  std::string cache_file = cache_dir + "/" + fs::path(file_name).stem().string()
+    + "-" + name.str() + ".cache";
+
+  // The points with no shift, and with no lon-lat box applied
+  DoubleMatrix & points = data.features;
+  bool have_cache = false;
+  std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+  if (ifs.good()) {
+    std::string magic, cached_key;
+    boost::uint64_t key_len = 0, num_points = 0;
+    int lola = 0;
+    std::getline(ifs, magic);
+    ifs.read((char*)&key_len, sizeof(key_len));
+    if (ifs.good() && magic == PC_ALIGN_CACHE_MAGIC && key_len == key.size()) {
+      cached_key.resize(key_len);
+      ifs.read(&cached_key[0], key_len);
+      ifs.read((char*)&lola, sizeof(lola));
+      ifs.read((char*)&mean_longitude, sizeof(mean_longitude));
+      ifs.read((char*)&num_points, sizeof(num_points));
+      if (ifs.good() && cached_key == key) {
+        points.resize(DIM + 1, num_points);
+        std::vector<double> xyz(DIM*num_points);
+        if (num_points > 0)
+          ifs.read((char*)&xyz[0], xyz.size()*sizeof(double));
+        if (ifs.good()) {
+          for (boost::uint64_t col = 0; col < num_points; col++) {
+            for (int row = 0; row < DIM; row++)
+              points(row, col) = xyz[DIM*col + row];
+            points(DIM, col) = 1;
+          }
+          is_lola_rdr_format = (lola != 0);
+          have_cache = true;
+        }
+      }
+    }
+  }
+  ifs.close();
+
+  if (have_cache) {
+    if (verbose)
+      vw::vw_out() << "Read " << points.cols() << " points from cache: "
+                   << cache_file << std::endl;
+  } else {
+    vw::BBox2   no_box;
+    vw::Vector3 no_shift;
+    load_cloud(file_name, num_points_to_load, no_box, false, no_shift,
+               geo, csv_conv, is_lola_rdr_format, mean_longitude, verbose, points);
+
+    // Write to a temporary file first, so a partial cache is never read
+    if (!fs::exists(cache_dir))
+      fs::create_directories(cache_dir);
+    std::string tmp_file = cache_file + ".tmp";
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    boost::uint64_t key_len = key.size(), num_points = points.cols();
+    int lola = is_lola_rdr_format;
+    std::vector<double> xyz(DIM*num_points);
+    for (boost::uint64_t col = 0; col < num_points; col++) {
+      for (int row = 0; row < DIM; row++)
+        xyz[DIM*col + row] = points(row, col);
+    }
+    ofs << PC_ALIGN_CACHE_MAGIC << "\n";
+    ofs.write((char*)&key_len, sizeof(key_len));
+    ofs.write(key.c_str(), key_len);
+    ofs.write((char*)&lola, sizeof(lola));
+    ofs.write((char*)&mean_longitude, sizeof(mean_longitude));
+    ofs.write((char*)&num_points, sizeof(num_points));
+    if (num_points > 0)
+      ofs.write((char*)&xyz[0], xyz.size()*sizeof(double));
+    ofs.close();
+    if (ofs.good()) {
+      fs::rename(tmp_file, cache_file);
+      if (verbose)
+        vw::vw_out() << "Wrote cache: " << cache_file << std::endl;
+    } else {
+      fs::remove(tmp_file);
+      vw::vw_out(vw::WarningMessage) << "Could not write cache: " << cache_file << std::endl;
+    }
+  }
+
+  // Keep the points in the box, and apply the shift
+  int count = 0;
+  bool shift_was_calc = false;
+  for (int col = 0; col < points.cols(); col++) {
+    vw::Vector3 xyz;
+    for (int row = 0; row < DIM; row++)
+      xyz[row] = points(row, col);
+    
+    if (!lonlat_box.empty()) {
+      vw::Vector2 lonlat = subvector(geo.datum().cartesian_to_geodetic(xyz), 0, 2);
+      if (!lonlat_box.contains(lonlat) &&
+          !lonlat_box.contains(lonlat + vw::Vector2(360, 0)) &&
+          !lonlat_box.contains(lonlat - vw::Vector2(360, 0)))
+        continue;
+    }
+
+    if (calc_shift && !shift_was_calc) {
+      shift = xyz;
+      shift_was_calc = true;
+    }
+
+    for (int row = 0; row < DIM; row++)
+      points(row, count) = xyz[row] - shift[row];
+    points(DIM, count) = 1;
+    count++;
+  }
+  points.conservativeResize(Eigen::NoChange, count);
+
+  if (verbose)
+    vw::vw_out() << "Loaded points: " << points.cols() << std::endl;
+}
+
 // Apply a rotation + translation transform to a vector3
 vw::Vector3 apply_transform_to_vec(PointMatcher<RealT>::Matrix const transform,
                                    vw::Vector3 const& p){
@@ -325,25 +583,36 @@ void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
   const double rad_latT = EXPANSION_MARGIN * box1_trans.height() / 2.0;
 
   // Make a box around each point the size of the box we computed earlier and 
-  //  keep growing the output bounding box.
-  
-  for (int col = 0; col < points.features.cols(); col++){
-    vw::Vector3 p;
+  //  keep growing the output bounding box. All points are converted to
+  //  lon-lat at once.
+  const int num_pts = points.features.cols();
+  asp::PointBlock llh, llhT;
+  llh.resize(num_pts);
+  if (has_transform)
+    llhT.resize(num_pts);
+  for (int col = 0; col < num_pts; col++){
+    vw::Vector3 q;
     for (int row = 0; row < DIM; row++)
-      p[row] = points.features(row, col);
+      q[row] = points.features(row, col);
+    llh.x[col] = q[0]; llh.y[col] = q[1]; llh.z[col] = q[2];
+
+    // Do the same thing in transformed coordinates
+    if (has_transform) {
+      vw::Vector3 qT = apply_transform_to_vec(transform, q);
+      llhT.x[col] = qT[0]; llhT.y[col] = qT[1]; llhT.z[col] = qT[2];
+    }
+  }
+  asp::batch_cartesian_to_geodetic(geo.datum(), llh);
+  asp::batch_cartesian_to_geodetic(geo.datum(), llhT);
 
-    vw::Vector3 q   = p;
-    vw::Vector3 llh = geo.datum().cartesian_to_geodetic(q);
-    llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjust
-    vw::BBox2 b(llh[0]-rad_lon, llh[1]-rad_lat, rad_lon*2, 2*rad_lat);
+  for (int col = 0; col < num_pts; col++){
+    double lon = llh.x[col] + 360.0*round((mean_longitude - llh.x[col])/360.0); // 360 deg adjust
+    vw::BBox2 b(lon-rad_lon, llh.y[col]-rad_lat, rad_lon*2, 2*rad_lat);
     out_box.grow(b);
 
-    // Do the same thing in transformed coordinates
     if (has_transform) {
-      vw::Vector3 qT   = apply_transform_to_vec(transform, q);
-      vw::Vector3 llhT = geo.datum().cartesian_to_geodetic(qT);
-      llhT[0] += 360.0*round((mean_longitude - llhT[0])/360.0); // 360 deg adjust
-      vw::BBox2 bT(llhT[0]-rad_lonT, llhT[1]-rad_latT, 2*rad_lonT, 2*rad_latT);
+      double lonT = llhT.x[col] + 360.0*round((mean_longitude - llhT.x[col])/360.0);
+      vw::BBox2 bT(lonT-rad_lonT, llhT.y[col]-rad_latT, 2*rad_lonT, 2*rad_latT);
       trans_out_box.grow(bT);
     }
   }
@@ -522,12 +791,13 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
                             std::string out_prefix,
                             vw::cartography::GeoReference const& geo,
                             CsvConv const& csv_conv,
+                            double mean_longitude,
                             PointMatcher<RealT>::Matrix const& T){
 
   std::string file_type = get_cloud_type(input_file);
 
   std::string output_file;
-  if (file_type == "CSV")
+  if (file_type == "CSV" || file_type == "QFIT")
     output_file = out_prefix + ".csv";
   else if (file_type == "LAS")
     output_file = out_prefix + boost::filesystem::path(input_file).extension().string();
@@ -627,18 +897,16 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
   }else if (file_type == "CSV"){
 
     // Write a CSV file in format consistent with the input CSV file.
+    // Read, transform, and write the points in batches of lines, so
+    // the input is read only once and the points are not kept in memory.
+
+    bool is_lola_rdr_format = false;
+    if (!csv_conv.is_configured())
+      is_lola_rdr_format = guess_lola_rdr_format(input_file, false);
 
-    vw::BBox2   empty_box;
-    bool        verbose = false;
-    bool        calc_shift = true;
-    vw::Vector3 shift;
-    bool        is_lola_rdr_format;
-    double      mean_longitude;
-    DP          point_cloud;
-    load_cloud(input_file, std::numeric_limits<int>::max(),
-	       empty_box, calc_shift, shift,
-	       geo, csv_conv, is_lola_rdr_format,
-	       mean_longitude, verbose, point_cloud);
+    std::ifstream infile( input_file.c_str() );
+    if (!infile)
+      vw_throw( vw::IOErr() << "Unable to open file \"" << input_file << "\"" );
 
     std::ofstream outfile( output_file.c_str() );
     outfile.precision(16);
@@ -660,45 +928,94 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
       outfile << "# Projection: " << geo.overall_proj4_str() << std::endl;
     }
 
-    int numPts = point_cloud.features.cols();
+    // Report the progress based on how much of the file was read
+    double file_size = std::max(double(boost::filesystem::file_size(input_file)), 1.0);
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    int hundred = 100;
-    int spacing = std::max(numPts/hundred, 1);
-    double inc_amount = 1.0 / hundred;
-    for (int col = 0; col < numPts; col++){
+    double bytes_read = 0;
+
+    bool is_first_line = true;
+    std::vector<std::string> lines;
+    std::vector<CsvConv::CsvRecord> records;
+    std::vector<char> parsed;
+    while (read_lines(infile, csv_batch_size(), lines) > 0){
+
+      if (csv_conv.is_configured())
+        csv_conv.parse_csv_lines(lines, is_first_line, records, parsed);
+
+      for (size_t it = 0; it < lines.size(); it++){
+
+        bytes_read += lines[it].size() + 1;
+
+        vw::Vector3 P;
+        if (csv_conv.is_configured()){
+          if (!parsed[it])
+            continue;
+          P = csv_conv.csv_to_cartesian(records[it], geo);
+        }else{
+          double lon = 0.0, lat = 0.0;
+          if (!is_valid_csv_line(lines[it]) ||
+              !parse_plain_csv_line(lines[it], is_lola_rdr_format, geo, is_first_line,
+                                    lon, lat, P))
+            continue;
+        }
 
-      Eigen::VectorXd V(DIM + 1);
-      for (int row = 0; row < DIM; row++)
-        V[row] = point_cloud.features(row, col) + shift[row];
-      V[DIM] = 1;
+        // Apply the transform
+        P = apply_transform(T, P);
+
+        if (csv_conv.is_configured()){
 
-      // Apply the transform
-      V = T*V;
+          vw::Vector3 csv = csv_conv.cartesian_to_csv(P, geo, mean_longitude);
+          outfile << csv[0] << ',' << csv[1] << ',' << csv[2] << std::endl;
 
-      vw::Vector3 P;
-      for (int row = 0; row < DIM; row++) P[row] = V[row];
+        }else{
+          vw::Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
+          llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjustment
 
-      if (csv_conv.is_configured()){
+          if (is_lola_rdr_format)
+            outfile << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << std::endl;
+          else
+            outfile << llh[1] << ',' << llh[0] << ',' << llh[2] << std::endl;
+        }
+      }
+
+      is_first_line = false;
+      tpc.report_progress(std::min(bytes_read/file_size, 1.0));
+    }
+    tpc.report_finished();
+    outfile.close();
 
-        vw::Vector3 csv = csv_conv.cartesian_to_csv(P, geo, mean_longitude);
-        outfile << csv[0] << ',' << csv[1] << ',' << csv[2] << std::endl;
+  }else if (file_type == "QFIT"){
 
-      }else{
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
-        llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjustment
+    // Write the transformed points as a CSV file with latitude,
+    // longitude, and height above WGS84.
+    asp::QfitReader reader(input_file);
+    vw::cartography::Datum wgs84("WGS84");
 
-        if (is_lola_rdr_format)
-          outfile << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << std::endl;
-        else
-          outfile << llh[1] << ',' << llh[0] << ',' << llh[2] << std::endl;
-      }
+    std::ofstream outfile( output_file.c_str() );
+    outfile.precision(16);
+    outfile << "# latitude,longitude,height above datum (meters)" << std::endl;
+    outfile << "# " << wgs84 << std::endl;
+
+    vw::int64 num_total_points = reader.num_records();
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    int hundred = 100;
+    vw::int64 spacing = std::max(num_total_points/hundred, vw::int64(1));
+    double inc_amount = 1.0 / hundred;
+    vw::int64 count = 0;
+    vw::Vector3 llh;
+    while (reader.read_next_point(llh)){
+      vw::Vector3 P = apply_transform(T, wgs84.geodetic_to_cartesian(llh));
+      llh = wgs84.cartesian_to_geodetic(P);
+      llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjustment
+      outfile << llh[1] << ',' << llh[0] << ',' << llh[2] << std::endl;
 
-      if (col%spacing == 0) tpc.report_incremental_progress( inc_amount );
+      if (count%spacing == 0) tpc.report_incremental_progress( inc_amount );
+      count++;
     }
     tpc.report_finished();
     outfile.close();
 
-  }else{
+  }}else{
     vw_throw( vw::ArgumentErr() << "Unknown file type: " << input_file << "\n" );
   }
 } // end save_trans_point_cloud
@@ -755,6 +1072,52 @@ bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
   return true;
 }
 
+bool interp_dem_plane(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
+                      vw::cartography::GeoReference const & georef,
+                      vw::Vector3                   const & lonlat,
+                      vw::Vector3                         & surface_point,
+                      vw::Vector3                         & normal) {
+  vw::Vector2 pix;
+  try {
+    pix = georef.lonlat_to_pixel(subvector(lonlat, 0, 2));
+  }catch(...){
+    return false;
+  }
+
+  // Need one more pixel on each side for the neighbors
+  double c = pix[0], r = pix[1];
+  if (c < 1 || c >= dem.cols()-2 ||
+      r < 1 || r >= dem.rows()-2 )
+    return false;
+
+  // The DEM points at this pixel and one pixel to the left, right, top, and bottom
+  vw::Vector2 offsets[5] = {vw::Vector2(0, 0), vw::Vector2(-1, 0), vw::Vector2(1, 0),
+                            vw::Vector2(0, -1), vw::Vector2(0, 1)};
+  vw::Vector3 xyz[5];
+  for (int it = 0; it < 5; it++) {
+    vw::Vector2 curr_pix = pix + offsets[it];
+    vw::PixelMask<float> v = dem(curr_pix[0], curr_pix[1]);
+    if (!is_valid(v))
+      return false;
+    vw::Vector2 curr_lonlat = georef.pixel_to_lonlat(curr_pix);
+    xyz[it] = georef.datum().geodetic_to_cartesian(vw::Vector3(curr_lonlat[0], curr_lonlat[1],
+                                                               v.child()));
+  }
+
+  surface_point = xyz[0];
+  normal = cross_prod(xyz[2] - xyz[1], xyz[4] - xyz[3]);
+  double len = norm_2(normal);
+  if (len == 0)
+    return false;
+  normal /= len;
+
+  // Let the normal point away from the planet center
+  if (dot_prod(normal, surface_point) < 0)
+    normal = -normal;
+
+  return true;
+}
+
 /// Try to read the georef/datum info, need it to read CSV files.
 void read_georef(std::vector<std::string> const& clouds,
                  std::string const& datum_str,
@@ -822,6 +1185,18 @@ void read_georef(std::vector<std::string> const& clouds,
     }
   }
   
+  // QFIT files have heights above WGS84
+  if (!is_good) {
+    for (size_t it = 0; it < clouds.size(); it++) {
+      if ( asp::get_cloud_type(clouds[it]) == "QFIT" ){
+        geo.set_datum(vw::cartography::Datum("WGS84"));
+        vw::vw_out() << "Detected datum from " << clouds[it] << ":\n" << geo.datum() << std::endl;
+        is_good = true;
+        break;
+      }
+    }
+  }
+
   // We should have read in the datum from an input file, but check to see if
   //  we should override it with input parameters.
 
@@ -878,4 +1253,475 @@ void read_georef(std::vector<std::string> const& clouds,
   return;
 }
 
+namespace {
+
+  // Find the nearest reference points for a range of columns of the
+  // queried points. Each task writes to its own columns of the output.
+  class KnnQueryTask: public vw::Task, private boost::noncopyable {
+    typedef Nabo::NearestNeighbourSearch<RealT> NNS;
+    NNS           const& m_tree;
+    PM::Matrix    const& m_query;
+    int m_beg, m_len, m_knn;
+    RealT m_epsilon, m_max_dist;
+    PM::Matches        & m_matches;
+    unsigned long      & m_visit_count;
+  public:
+    KnnQueryTask(NNS const& tree, PM::Matrix const& query, int beg, int len,
+                 int knn, RealT epsilon, RealT max_dist, PM::Matches & matches,
+                 unsigned long & visit_count):
+      m_tree(tree), m_query(query), m_beg(beg), m_len(len), m_knn(knn),
+      m_epsilon(epsilon), m_max_dist(max_dist), m_matches(matches),
+      m_visit_count(visit_count) {}
+
+    virtual void operator()() {
+      PM::Matrix       query = m_query.middleCols(m_beg, m_len);
+      PM::Matrix       dists(m_knn, m_len);
+      NNS::IndexMatrix ids(m_knn, m_len);
+      m_visit_count = m_tree.knn(query, ids, dists, m_knn, m_epsilon,
+                                 NNS::ALLOW_SELF_MATCH, m_max_dist);
+      m_matches.dists.middleCols(m_beg, m_len) = dists;
+      m_matches.ids.middleCols(m_beg, m_len)   = ids;
+    }
+  };
+
+}
+
+namespace {
+  // Order voxels lexicographically, so points in the same voxel are sorted together
+  bool voxel_index_less(std::pair<vw::Vector3i, int> const& a,
+                        std::pair<vw::Vector3i, int> const& b) {
+    for (int it = 0; it < 3; it++) {
+      if (a.first[it] != b.first[it])
+        return a.first[it] < b.first[it];
+    }
+    return a.second < b.second;
+  }
+}
+
+ParallelKDTreeMatcher::ParallelKDTreeMatcher(int knn, RealT epsilon, int search_type,
+                                             RealT max_dist, int num_threads):
+  PM::Matcher("ParallelKDTreeMatcher", PM::Matcher::ParametersDoc(),
+              PM::Matcher::Parameters()),
+  m_knn(knn), m_search_type(search_type), m_num_threads(std::max(num_threads, 1)),
+  m_epsilon(epsilon), m_max_dist(max_dist) {}
+
+void ParallelKDTreeMatcher::init(DP const& filteredReference) {
+  // The tree refers to the points rather than copying them, so keep them here
+  m_cloud = filteredReference.features;
+  m_tree.reset(NNS::create(m_cloud, m_cloud.rows() - 1,
+                           NNS::SearchType(m_search_type)));
+}
+
+PM::Matches ParallelKDTreeMatcher::findClosests(DP const& filteredReading) {
+
+  if (!m_tree)
+    vw_throw(vw::ArgumentErr() << "The reference tree was not initialized.\n");
+
+  int num_points = filteredReading.features.cols();
+  PM::Matches matches(PM::Matches::Dists(m_knn, num_points),
+                      PM::Matches::Ids(m_knn, num_points));
+
+  // Use more chunks than threads, as queries take longer in some areas
+  int min_chunk  = 1000;
+  int num_chunks = std::min(4 * m_num_threads, num_points / min_chunk);
+  if (num_chunks <= 1) {
+    this->visitCounter += m_tree->knn(filteredReading.features, matches.ids, matches.dists,
+                                      m_knn, m_epsilon, NNS::ALLOW_SELF_MATCH, m_max_dist);
+    return matches;
+  }
+
+  std::vector<unsigned long> visit_counts(num_chunks, 0);
+  vw::FifoWorkQueue queue(m_num_threads);
+  for (int chunk = 0; chunk < num_chunks; chunk++) {
+    int beg = (long long)num_points * chunk / num_chunks;
+    int end = (long long)num_points * (chunk + 1) / num_chunks;
+    boost::shared_ptr<KnnQueryTask>
+      task(new KnnQueryTask(*m_tree, filteredReading.features, beg, end - beg,
+                            m_knn, m_epsilon, m_max_dist, matches, visit_counts[chunk]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  for (int chunk = 0; chunk < num_chunks; chunk++)
+    this->visitCounter += visit_counts[chunk];
+
+  return matches;
+}
+
+double estimate_point_spacing(DP const& point_cloud) {
+
+  int num_points = point_cloud.features.cols();
+  if (num_points == 0)
+    return 0.0;
+
+  // The two largest sides of the box span the surface
+  Eigen::VectorXd extent = point_cloud.features.topRows(DIM).rowwise().maxCoeff()
+    - point_cloud.features.topRows(DIM).rowwise().minCoeff();
+  std::vector<double> sides(extent.data(), extent.data() + DIM);
+  std::sort(sides.begin(), sides.end());
+
+  return sqrt(sides[DIM-1] * sides[DIM-2] / num_points);
+}
+
+void voxel_downsample(DP const& in_cloud, double voxel_size, DP & out_cloud) {
+
+  if (voxel_size <= 0)
+    vw_throw(vw::ArgumentErr() << "The voxel size must be positive.\n");
+
+  // Sort the points by the voxel they fall in, then average each run
+  int num_points = in_cloud.features.cols();
+  typedef std::pair<vw::Vector3i, int> VoxelIndex;
+  std::vector<VoxelIndex> voxels(num_points);
+  for (int col = 0; col < num_points; col++) {
+    vw::Vector3i voxel;
+    for (int row = 0; row < DIM; row++)
+      voxel[row] = (int)floor(in_cloud.features(row, col) / voxel_size);
+    voxels[col] = VoxelIndex(voxel, col);
+  }
+  std::sort(voxels.begin(), voxels.end(), voxel_index_less);
+
+  out_cloud.featureLabels = form_labels<RealT>(DIM);
+  out_cloud.features.resize(DIM + 1, num_points);
+  int num_out = 0;
+  for (int beg = 0; beg < num_points; ) {
+    int end = beg;
+    Eigen::VectorXd sum = Eigen::VectorXd::Zero(DIM);
+    while (end < num_points && voxels[end].first == voxels[beg].first) {
+      sum += in_cloud.features.col(voxels[end].second).head(DIM);
+      end++;
+    }
+    out_cloud.features.col(num_out).head(DIM) = sum / (end - beg);
+    out_cloud.features(DIM, num_out) = 1;
+    num_out++;
+    beg = end;
+  }
+  out_cloud.features.conservativeResize(Eigen::NoChange, num_out);
+}
+
+void use_parallel_matcher(PM::ICP & icp, DP const& ref_point_cloud, int num_threads) {
+
+  if (!icp.matcher || icp.matcher->className != "KDTreeMatcher")
+    return;
+
+  int   knn         = icp.matcher->get<int>("knn");
+  RealT epsilon     = icp.matcher->get<RealT>("epsilon");
+  int   search_type = icp.matcher->get<int>("searchType");
+  RealT max_dist    = icp.matcher->get<RealT>("maxDist");
+  if (num_threads <= 0)
+    num_threads = vw::vw_settings().default_num_threads();
+
+  ParallelKDTreeMatcher * matcher
+    = new ParallelKDTreeMatcher(knn, epsilon, search_type, max_dist, num_threads);
+  icp.matcher.reset(matcher);
+  matcher->init(ref_point_cloud);
+}
+
+namespace {
+
+  typedef Nabo::NearestNeighbourSearch<RealT> FpfhNNS;
+
+  const int FPFH_NORMAL_MAX_NN  = 30;
+  const int FPFH_FEATURE_MAX_NN = 100;
+  const int FPFH_BINS_PER_ANGLE = FPFH_NUM_BINS / 3;
+
+  // The neighbors within the radius of a range of columns of the
+  // cloud, including each point itself. Missing neighbors have
+  // infinite distance.
+  void fpfh_neighbors(FpfhNNS const& tree, PM::Matrix const& cloud, int beg, int len,
+                      int max_nn, double radius,
+                      FpfhNNS::IndexMatrix & ids, PM::Matrix & dists2) {
+    int knn = std::min(max_nn, (int)cloud.cols());
+    PM::Matrix query = cloud.middleCols(beg, len);
+    ids.resize(knn, len);
+    dists2.resize(knn, len);
+    tree.knn(query, ids, dists2, knn, 0, FpfhNNS::ALLOW_SELF_MATCH, radius);
+  }
+
+  // The bin in [0, FPFH_BINS_PER_ANGLE) of a value in [lo, hi]
+  inline int fpfh_bin(double val, double lo, double hi) {
+    int bin = (int)floor(FPFH_BINS_PER_ANGLE * (val - lo) / (hi - lo));
+    return std::max(0, std::min(FPFH_BINS_PER_ANGLE - 1, bin));
+  }
+
+  // The three angles between two oriented points, as in PCL's
+  // computePairFeatures(), binned into the histogram with the given weight.
+  // The point with the smaller angle between its normal and the line
+  // joining the points is the source, so the features are symmetric.
+  void add_pair_features(Eigen::Vector3d const& p1, Eigen::Vector3d const& n1,
+                         Eigen::Vector3d const& p2, Eigen::Vector3d const& n2,
+                         float weight, float * hist) {
+    Eigen::Vector3d dp = p2 - p1;
+    double f4 = dp.norm();
+    if (f4 == 0)
+      return;
+
+    Eigen::Vector3d ns = n1, nt = n2;
+    double angle1 = ns.dot(dp) / f4, angle2 = nt.dot(dp) / f4;
+    if (acos(std::abs(angle1)) > acos(std::abs(angle2))) {
+      ns = n2; nt = n1; dp = -dp;
+      angle1 = -angle2;
+    }
+    Eigen::Vector3d v = dp.cross(ns);
+    double v_norm = v.norm();
+    if (v_norm == 0)
+      return;
+    v /= v_norm;
+    Eigen::Vector3d w = ns.cross(v);
+
+    double f1 = atan2(w.dot(nt), ns.dot(nt)); // in [-pi, pi]
+    double f2 = v.dot(nt);                    // in [-1, 1]
+    double f3 = angle1;                       // in [-1, 1]
+
+    hist[fpfh_bin(f1, -M_PI, M_PI)]                         += weight;
+    hist[FPFH_BINS_PER_ANGLE + fpfh_bin(f2, -1.0, 1.0)]     += weight;
+    hist[2 * FPFH_BINS_PER_ANGLE + fpfh_bin(f3, -1.0, 1.0)] += weight;
+  }
+
+  // One of the passes of the FPFH computation over a range of points.
+  // Each task writes only to the columns of its own points.
+  class FpfhTask: public vw::Task, private boost::noncopyable {
+  public:
+    enum Pass { NORMALS, SPFH, FPFH };
+  private:
+    Pass m_pass;
+    FpfhNNS    const& m_tree;
+    PM::Matrix const& m_cloud;
+    int m_beg, m_len;
+    double m_normal_radius, m_feature_radius;
+    Eigen::Vector3d m_up;
+    Eigen::MatrixXd & m_normals; // 3 x num_points
+    Eigen::MatrixXf & m_spfh;    // FPFH_NUM_BINS x num_points
+    std::vector<Eigen::VectorXf> & m_features;
+
+    Eigen::Vector3d point(int col) const {
+      return m_cloud.col(col).head(DIM);
+    }
+
+  public:
+    FpfhTask(Pass pass, FpfhNNS const& tree, PM::Matrix const& cloud, int beg, int len,
+             double normal_radius, double feature_radius, Eigen::Vector3d const& up,
+             Eigen::MatrixXd & normals, Eigen::MatrixXf & spfh,
+             std::vector<Eigen::VectorXf> & features):
+      m_pass(pass), m_tree(tree), m_cloud(cloud), m_beg(beg), m_len(len),
+      m_normal_radius(normal_radius), m_feature_radius(feature_radius), m_up(up),
+      m_normals(normals), m_spfh(spfh), m_features(features) {}
+
+    virtual void operator()() {
+      FpfhNNS::IndexMatrix ids;
+      PM::Matrix dists2;
+      if (m_pass == NORMALS)
+        fpfh_neighbors(m_tree, m_cloud, m_beg, m_len, FPFH_NORMAL_MAX_NN,
+                       m_normal_radius, ids, dists2);
+      else
+        fpfh_neighbors(m_tree, m_cloud, m_beg, m_len, FPFH_FEATURE_MAX_NN,
+                       m_feature_radius, ids, dists2);
+      double r2 = (m_pass == NORMALS) ? m_normal_radius * m_normal_radius
+        : m_feature_radius * m_feature_radius;
+
+      for (int it = 0; it < m_len; it++) {
+        int col = m_beg + it;
+
+        // The valid neighbors, other than the point itself except for the normals
+        std::vector<int> nbrs;
+        std::vector<double> nbr_dists2;
+        for (int k = 0; k < ids.rows(); k++) {
+          if (!(dists2(k, it) <= r2) || ids(k, it) < 0 || ids(k, it) >= m_cloud.cols())
+            continue;
+          if (m_pass != NORMALS && ids(k, it) == col)
+            continue;
+          nbrs.push_back(ids(k, it));
+          nbr_dists2.push_back(dists2(k, it));
+        }
+
+        if (m_pass == NORMALS) {
+          // The direction of least variance of the neighbors. Points with
+          // too few neighbors get no normal.
+          m_normals.col(col).setZero();
+          if (nbrs.size() < 3)
+            continue;
+          Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+          for (size_t k = 0; k < nbrs.size(); k++)
+            mean += point(nbrs[k]);
+          mean /= nbrs.size();
+          Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+          for (size_t k = 0; k < nbrs.size(); k++) {
+            Eigen::Vector3d d = point(nbrs[k]) - mean;
+            cov += d * d.transpose();
+          }
+          Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+          Eigen::Vector3d normal = solver.eigenvectors().col(0);
+          if (normal.dot(m_up) < 0)
+            normal = -normal;
+          m_normals.col(col) = normal;
+
+        } else if (m_pass == SPFH) {
+          // The histogram of the pairs of this point and its neighbors
+          m_spfh.col(col).setZero();
+          Eigen::Vector3d n1 = m_normals.col(col);
+          std::vector<int> valid;
+          for (size_t k = 0; k < nbrs.size(); k++) {
+            if (m_normals.col(nbrs[k]).squaredNorm() > 0)
+              valid.push_back(nbrs[k]);
+          }
+          if (n1.squaredNorm() == 0 || valid.empty())
+            continue;
+          float weight = 100.0f / valid.size();
+          for (size_t k = 0; k < valid.size(); k++)
+            add_pair_features(point(col), n1, point(valid[k]), m_normals.col(valid[k]),
+                              weight, m_spfh.col(col).data());
+
+        } else {
+          // The histogram of the point plus those of its neighbors
+          // weighted by the inverse of their squared distance, with each
+          // of the three angle histograms normalized to sum to 100.
+          Eigen::VectorXf hist = Eigen::VectorXf::Zero(FPFH_NUM_BINS);
+          for (size_t k = 0; k < nbrs.size(); k++) {
+            if (nbr_dists2[k] == 0)
+              continue;
+            hist += m_spfh.col(nbrs[k]) / float(nbr_dists2[k]);
+          }
+          for (int angle = 0; angle < 3; angle++) {
+            float sum = hist.segment(angle * FPFH_BINS_PER_ANGLE, FPFH_BINS_PER_ANGLE).sum();
+            if (sum > 0)
+              hist.segment(angle * FPFH_BINS_PER_ANGLE, FPFH_BINS_PER_ANGLE) *= 100.0f / sum;
+          }
+          m_features[col] = hist + m_spfh.col(col);
+        }
+      }
+    }
+  };
+
+}
+
+void compute_fpfh_features(DP const& cloud,
+                           Nabo::NearestNeighbourSearch<RealT> const& tree,
+                           double normal_radius, double feature_radius,
+                           Eigen::Vector3d const& up, int num_threads,
+                           std::vector<Eigen::VectorXf> & features) {
+
+  if (normal_radius <= 0 || feature_radius <= 0)
+    vw_throw(vw::ArgumentErr() << "The FPFH normal and feature radii must be positive.\n");
+  if (num_threads <= 0)
+    num_threads = vw::vw_settings().default_num_threads();
+
+  int num_points = cloud.features.cols();
+  Eigen::MatrixXd normals(DIM, num_points);
+  Eigen::MatrixXf spfh(FPFH_NUM_BINS, num_points);
+  features.assign(num_points, Eigen::VectorXf::Zero(FPFH_NUM_BINS));
+  if (num_points == 0)
+    return;
+
+  // Each pass needs the results of the previous one at the neighbors,
+  // so the passes run one after another, each in parallel.
+  int min_chunk  = 1000;
+  int num_chunks = std::max(1, std::min(4 * num_threads, num_points / min_chunk));
+  FpfhTask::Pass passes[] = {FpfhTask::NORMALS, FpfhTask::SPFH, FpfhTask::FPFH};
+  for (int pass = 0; pass < 3; pass++) {
+    vw::FifoWorkQueue queue(num_threads);
+    for (int chunk = 0; chunk < num_chunks; chunk++) {
+      int beg = (long long)num_points * chunk / num_chunks;
+      int end = (long long)num_points * (chunk + 1) / num_chunks;
+      boost::shared_ptr<FpfhTask>
+        task(new FpfhTask(passes[pass], tree, cloud.features, beg, end - beg,
+                          normal_radius, feature_radius, up, normals, spfh, features));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+}
+
+namespace {
+  const std::string PC_ALIGN_FPFH_CACHE_MAGIC = "ASP_PC_ALIGN_FPFH_CACHE_1";
+}
+
+void compute_fpfh_features_with_cache(std::string const& cache_dir, DP const& cloud,
+                                      Nabo::NearestNeighbourSearch<RealT> const& tree,
+                                      double normal_radius, double feature_radius,
+                                      Eigen::Vector3d const& up, int num_threads,
+                                      std::vector<Eigen::VectorXf> & features) {
+
+  if (cache_dir.empty()) {
+    compute_fpfh_features(cloud, tree, normal_radius, feature_radius, up, num_threads,
+                          features);
+    return;
+  }
+
+  namespace fs = boost::filesystem;
+
+  // The key is made of the parameters and a hash of the points, so the
+  // features are recomputed when either changes.
+  boost::uint64_t num_points = cloud.features.cols(), points_hash = 1469598103934665603ULL;
+  for (boost::uint64_t col = 0; col < num_points; col++) {
+    for (int row = 0; row < DIM; row++) {
+      double val = cloud.features(row, col);
+      unsigned char const* bytes = reinterpret_cast<unsigned char const*>(&val);
+      for (size_t b = 0; b < sizeof(val); b++)
+        points_hash = (points_hash ^ bytes[b]) * 1099511628211ULL; // FNV-1a
+    }
+  }
+  std::ostringstream os;
+  os.precision(17);
+  os << normal_radius << " " << feature_radius << " " << up[0] << " " << up[1] << " "
+     << up[2] << "\n" << num_points << " " << std::hex << points_hash << "\n";
+  std::string key = os.str();
+
+  std::ostringstream name;
+  name << std::hex << std::hash<std::string>()(key);
+  std::string cache_file = cache_dir + "/fpfh-" + name.str() + ".cache";
+
+  std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+  if (ifs.good()) {
+    std::string magic, cached_key;
+    boost::uint64_t key_len = 0, cached_num = 0;
+    std::getline(ifs, magic);
+    ifs.read((char*)&key_len, sizeof(key_len));
+    if (ifs.good() && magic == PC_ALIGN_FPFH_CACHE_MAGIC && key_len == key.size()) {
+      cached_key.resize(key_len);
+      ifs.read(&cached_key[0], key_len);
+      ifs.read((char*)&cached_num, sizeof(cached_num));
+      if (ifs.good() && cached_key == key && cached_num == num_points) {
+        std::vector<float> vals(FPFH_NUM_BINS*num_points);
+        if (num_points > 0)
+          ifs.read((char*)&vals[0], vals.size()*sizeof(float));
+        if (ifs.good()) {
+          features.resize(num_points);
+          for (boost::uint64_t col = 0; col < num_points; col++)
+            features[col] = Eigen::Map<Eigen::VectorXf>(&vals[FPFH_NUM_BINS*col],
+                                                        FPFH_NUM_BINS);
+          vw::vw_out() << "Read FPFH features from cache: " << cache_file << std::endl;
+          return;
+        }
+      }
+    }
+  }
+  ifs.close();
+
+  compute_fpfh_features(cloud, tree, normal_radius, feature_radius, up, num_threads,
+                        features);
+
+  // Write to a temporary file first, so a partial cache is never read
+  if (!fs::exists(cache_dir))
+    fs::create_directories(cache_dir);
+  std::string tmp_file = cache_file + ".tmp";
+  std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+  boost::uint64_t key_len = key.size();
+  std::vector<float> vals(FPFH_NUM_BINS*num_points);
+  for (boost::uint64_t col = 0; col < num_points; col++)
+    Eigen::Map<Eigen::VectorXf>(&vals[FPFH_NUM_BINS*col], FPFH_NUM_BINS) = features[col];
+  ofs << PC_ALIGN_FPFH_CACHE_MAGIC << "\n";
+  ofs.write((char*)&key_len, sizeof(key_len));
+  ofs.write(key.c_str(), key_len);
+  ofs.write((char*)&num_points, sizeof(num_points));
+  if (num_points > 0)
+    ofs.write((char*)&vals[0], vals.size()*sizeof(float));
+  ofs.close();
+  if (ofs.good()) {
+    fs::rename(tmp_file, cache_file);
+    vw::vw_out() << "Wrote FPFH features cache: " << cache_file << std::endl;
+  } else {
+    fs::remove(tmp_file);
+    vw::vw_out(vw::WarningMessage) << "Could not write cache: " << cache_file << std::endl;
+  }
+}
+
 }
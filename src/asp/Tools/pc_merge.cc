@@ -31,6 +31,9 @@
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
+#include <boost/algorithm/string.hpp>
+
+#include <fstream>
 #include <limits>
 
 using namespace vw;
@@ -45,11 +48,12 @@ struct Options : vw::cartography::GdalWriteOptions {
 
   // Settings
   bool  write_double;  ///< If true, output file is double instead of float
+  int   inputs_per_tile; ///< If positive, write tiles with this many inputs and a VRT of them
 
   // Output
   std::string out_file;
 
-  Options() : write_double(false) {}
+  Options() : write_double(false), inputs_per_tile(0) {}
 };
 
 
@@ -58,7 +62,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("General Options");
   general_options.add_options()
     ("output-file,o",  po::value(&opt.out_file)->default_value(""),        "Specify the output file.")
-    ("write-double,d", po::value(&opt.write_double)->default_value(false), "Write a double precision output file.");
+    ("write-double,d", po::value(&opt.write_double)->default_value(false), "Write a double precision output file.")
+    ("inputs-per-tile", po::value(&opt.inputs_per_tile)->default_value(0),
+     "Instead of a single merged file, merge each group of this many consecutive inputs into its own tile, and make the output file, which must end in .vrt, a GDAL virtual mosaic of the tiles.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -86,6 +92,15 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "The output file must be specified!\n"
               << usage << general_options );
 
+  if (opt.inputs_per_tile < 0)
+    vw_throw( ArgumentErr() << "The number of inputs per tile must be non-negative.\n"
+              << usage << general_options );
+
+  if (opt.inputs_per_tile > 0 &&
+      boost::to_lower_copy(fs::path(opt.out_file).extension().string()) != ".vrt")
+    vw_throw( ArgumentErr() << "When using --inputs-per-tile, the output file must end in .vrt.\n"
+              << usage << general_options );
+
   vw::create_out_dir(opt.out_file);
 }
 
@@ -136,23 +151,38 @@ Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options
 }
 
 
+/// Use the georeference of the last input having one, if any.
+bool find_georef(std::vector<std::string> const& pc_files, GeoReference & georef){
+  bool has_georef = false;
+  for (size_t i = 0; i < pc_files.size(); i++){
+    cartography::GeoReference local_georef;
+
+    if (read_georeference(local_georef, pc_files[i])){
+      georef = local_georef;
+      has_georef = true;
+    }
+  }
+  return has_georef;
+}
+
 // Do the actual work of loading, merging, and saving the point clouds
 
 // Case 1: Single-channel cloud.
 template <class PixelT>
 typename boost::enable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
-do_work(Vector3 const& shift, Options const& opt) {
+do_work(Vector3 const& shift, std::vector<std::string> const& pointcloud_files,
+        std::string const& out_file, Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = asp::OrthoRasterizerView::max_subblock_size();
-  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
+  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(pointcloud_files, spacing);
 
-  vw_out() << "Writing image: " << opt.out_file << "\n";
+  vw_out() << "Writing image: " << out_file << "\n";
 
   bool has_georef = false;
   bool has_nodata = false;
   double nodata = -std::numeric_limits<float>::max(); // smallest float
   GeoReference georef;
-  vw::cartography::block_write_gdal_image(opt.out_file, merged_cloud, has_georef,
+  vw::cartography::block_write_gdal_image(out_file, merged_cloud, has_georef,
                               georef,  has_nodata, nodata, opt,
                               TerminalProgressCallback("asp", "\t--> Merging: "));
 }
@@ -160,41 +190,117 @@ do_work(Vector3 const& shift, Options const& opt) {
 // Case 2: Multi-channel cloud.
 template <class PixelT>
 typename boost::disable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
-do_work(Vector3 const& shift, Options const& opt) {
+do_work(Vector3 const& shift, std::vector<std::string> const& pointcloud_files,
+        std::string const& out_file, Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = asp::OrthoRasterizerView::max_subblock_size();
-  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
+  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(pointcloud_files, spacing);
 
   // See if we can pull a georeference from somewhere. Of course it will be wrong
   // when applied to the merged cloud, but it will at least have the correct datum
   // and projection.
-  bool has_georef = false;
   cartography::GeoReference georef;
-  for (size_t i = 0; i < opt.pointcloud_files.size(); i++){
-    cartography::GeoReference local_georef;
-
-    if (read_georeference(local_georef, opt.pointcloud_files[i])){
-      georef = local_georef;
-      has_georef = true;
-    }
-  }
+  bool has_georef = find_georef(pointcloud_files, georef);
 
   bool has_nodata = false;
   double nodata = -std::numeric_limits<float>::max(); // smallest float
 
-  vw_out() << "Writing point cloud: " << opt.out_file << "\n";
+  vw_out() << "Writing point cloud: " << out_file << "\n";
 
   // If shift != zero then this will cast the output data to type float.
   //  Otherwise it will keep its data type.
   double point_cloud_rounding_error = 0.0;
   asp::block_write_approx_gdal_image
-    ( opt.out_file, shift,
+    ( out_file, shift,
       point_cloud_rounding_error,
       merged_cloud,
       has_georef, georef, has_nodata, nodata,
       opt, TerminalProgressCallback("asp", "\t--> Merging: "));
 }
 
+/// Merge each group of opt.inputs_per_tile consecutive inputs into a
+/// tile, then write a VRT which places the tiles side by side, with the
+/// same spacing as the inputs within a tile.
+template <class PixelT>
+void do_work_tiled(Vector3 const& shift, int num_channels, Options const& opt) {
+
+  std::string tile_prefix = fs::path(opt.out_file).replace_extension("").string();
+  std::vector<std::string> tile_files;
+  int num_inputs = opt.pointcloud_files.size();
+  for (int beg = 0; beg < num_inputs; beg += opt.inputs_per_tile) {
+    int end = std::min(beg + opt.inputs_per_tile, num_inputs);
+    std::vector<std::string> group(opt.pointcloud_files.begin() + beg,
+                                   opt.pointcloud_files.begin() + end);
+    std::ostringstream os;
+    os << tile_prefix << "-tile-" << tile_files.size() << ".tif";
+    tile_files.push_back(os.str());
+    do_work<PixelT>(shift, group, tile_files.back(), opt);
+  }
+
+  // One channel images and unshifted clouds keep their type, others are float
+  std::string data_type = "Float32";
+  if (num_channels > 1 && shift == Vector3())
+    data_type = "Float64";
+
+  GeoReference georef;
+  bool has_georef = (num_channels > 1) && find_georef(opt.pointcloud_files, georef);
+
+  // Place the tiles
+  const int spacing = asp::OrthoRasterizerView::max_subblock_size();
+  std::vector<Vector2i> sizes, starts;
+  int cols = 0, rows = 0;
+  for (size_t i = 0; i < tile_files.size(); i++) {
+    Vector2i size = file_image_size(tile_files[i]);
+    int start = cols;
+    if (i > 0)
+      start = spacing*(int)ceil(double(start)/spacing) + spacing;
+    sizes.push_back(size);
+    starts.push_back(Vector2i(start, 0));
+    cols = start + size[0];
+    rows = std::max(rows, size[1]);
+  }
+
+  vw_out() << "Writing: " << opt.out_file << "\n";
+  std::ofstream ofs(opt.out_file.c_str());
+  if (!ofs.good())
+    vw_throw( ArgumentErr() << "Cannot write: " << opt.out_file << "\n" );
+  ofs.precision(17);
+  ofs << "<VRTDataset rasterXSize=\"" << cols << "\" rasterYSize=\"" << rows << "\">\n";
+  if (has_georef)
+    ofs << "  <SRS>" << georef.get_wkt() << "</SRS>\n";
+  if (shift != Vector3())
+    ofs << "  <Metadata>\n"
+        << "    <MDI key=\"" << asp::ASP_POINT_OFFSET_TAG_STR << "\">"
+        << vw::vec_to_str(shift) << "</MDI>\n"
+        << "  </Metadata>\n";
+  for (int band = 1; band <= num_channels; band++) {
+    ofs << "  <VRTRasterBand dataType=\"" << data_type << "\" band=\"" << band << "\">\n";
+    for (size_t i = 0; i < tile_files.size(); i++) {
+      // The tiles are next to the VRT
+      std::string tile_name = fs::path(tile_files[i]).filename().string();
+      ofs << "    <SimpleSource>\n"
+          << "      <SourceFilename relativeToVRT=\"1\">" << tile_name << "</SourceFilename>\n"
+          << "      <SourceBand>" << band << "</SourceBand>\n"
+          << "      <SrcRect xOff=\"0\" yOff=\"0\" xSize=\"" << sizes[i][0]
+          << "\" ySize=\"" << sizes[i][1] << "\"/>\n"
+          << "      <DstRect xOff=\"" << starts[i][0] << "\" yOff=\"" << starts[i][1]
+          << "\" xSize=\"" << sizes[i][0] << "\" ySize=\"" << sizes[i][1] << "\"/>\n"
+          << "    </SimpleSource>\n";
+    }
+    ofs << "  </VRTRasterBand>\n";
+  }
+  ofs << "</VRTDataset>\n";
+  ofs.close();
+}
+
+template <class PixelT>
+void do_work(Vector3 const& shift, int num_channels, Options const& opt) {
+  if (opt.inputs_per_tile > 0)
+    do_work_tiled<PixelT>(shift, num_channels, opt);
+  else
+    do_work<PixelT>(shift, opt.pointcloud_files, opt.out_file, opt);
+}
+
 //-----------------------------------------------------------------------------------
 
 int main( int argc, char *argv[] ) {
@@ -214,10 +320,10 @@ int main( int argc, char *argv[] ) {
     {
       // The input point clouds have their shift incorporated and are stored as doubles.
       // If the output file is stored as float, it needs to have a single shift value applied.
-      case 1:  do_work< vw::PixelGray<float> >(shift, opt); break;
-      case 3:  do_work<Vector3>(shift, opt); break;
-      case 4:  do_work<Vector4>(shift, opt); break;
-      case 6:  do_work<Vector6>(shift, opt); break;
+      case 1:  do_work< vw::PixelGray<float> >(shift, num_channels, opt); break;
+      case 3:  do_work<Vector3>(shift, num_channels, opt); break;
+      case 4:  do_work<Vector4>(shift, num_channels, opt); break;
+      case 6:  do_work<Vector6>(shift, num_channels, opt); break;
       default: vw_throw( ArgumentErr() << "Unsupported number of channels!.\n" );
     }
 
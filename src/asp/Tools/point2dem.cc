@@ -20,10 +20,13 @@
 ///
 
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/GeodeticBatch.h>
 #include <asp/Core/OrthoRasterizer.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/CompressedBlockCache.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/FileUtils.h>
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Image/InpaintView.h>
 
@@ -36,6 +39,9 @@
 #include <vw/Cartography/PointImageManipulation.h>
 
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <cpl_vsi.h>
 
 #include <limits>
 
@@ -83,10 +89,14 @@ struct Options : vw::cartography::GdalWriteOptions {
   Vector2     remove_outliers_params;
   double      max_valid_triangulation_error;
   Vector2     median_filter_params;
-  int         erode_len;
+  int         erode_len, max_samples_per_pixel;
   std::string csv_format_str, csv_proj4_str, filter;
   double      search_radius_factor, sigma_factor, default_grid_size_multiplier;
-  bool        use_surface_sampling;
+  bool        use_surface_sampling, aggregate_coarse_dems, cache_boundaries;
+  bool        convert_in_memory, fused_rasterization;
+  std::string update_dem, changed_clouds_str;
+  std::vector<std::string> changed_clouds;
+  BBox2       changed_proj_box; // the changed clouds, in the output projection
   bool        has_las_or_csv_or_pcd;
   Vector2i    max_output_size;
 
@@ -98,8 +108,10 @@ struct Options : vw::cartography::GdalWriteOptions {
       semi_major(0), semi_minor(0), fsaa(1),
       dem_hole_fill_len(0), ortho_hole_fill_len(0), ortho_hole_fill_extra_len(0),
       remove_outliers_with_pct(true), max_valid_triangulation_error(0),
-      erode_len(0), search_radius_factor(0), sigma_factor(0),
+      erode_len(0), max_samples_per_pixel(0), search_radius_factor(0), sigma_factor(0),
       default_grid_size_multiplier(1.0), use_surface_sampling(false),
+      aggregate_coarse_dems(false), cache_boundaries(false), convert_in_memory(false),
+      fused_rasterization(false),
       has_las_or_csv_or_pcd(false), max_output_size(9999999, 9999999){}
 };
 
@@ -274,7 +286,12 @@ void las_or_csv_or_pcd_to_tifs(Options& opt,
       suffix = ".tif";
     else
       suffix = "-" + stem + ".tif";
-    std::string out_file = opt.out_prefix + "-tmp" + suffix;
+    // GDAL's in-memory file system keeps the converted cloud in RAM,
+    // while all the readers below can still open it by name.
+    std::string tmp_prefix = opt.out_prefix;
+    if (opt.convert_in_memory)
+      tmp_prefix = "/vsimem/" + tmp_prefix;
+    std::string out_file = tmp_prefix + "-tmp" + suffix;
 
     // Handle the case when the output file may exist
     const int NUM_TEMP_NAME_RETRIES = 1000;
@@ -284,7 +301,7 @@ void las_or_csv_or_pcd_to_tifs(Options& opt,
       // File exists, try a different name
       vw_out() << "File exists: " << out_file << std::endl;
       std::ostringstream os; os << count;
-      out_file = opt.out_prefix + "-tmp-" + os.str() + suffix;
+      out_file = tmp_prefix + "-tmp-" + os.str() + suffix;
     }
     if (fs::exists(out_file))
       vw_throw( ArgumentErr() << "Too many attempts at creating a temporary file.\n");
@@ -307,6 +324,68 @@ void las_or_csv_or_pcd_to_tifs(Options& opt,
 
 // TODO: Move this somewhere?
 /// Parses a string containing a list of numbers
+// Validate the options for updating an existing DEM, and make the
+// output grid, projection, and nodata value be the ones of that DEM.
+void set_update_dem_options(Options & opt) {
+
+  std::istringstream is(opt.changed_clouds_str);
+  std::string cloud;
+  opt.changed_clouds.clear();
+  while (is >> cloud) {
+    if (asp::is_las_or_csv_or_pcd(cloud))
+      vw_throw( ArgumentErr() << "The changed clouds must be in the ASP tif format.\n" );
+    opt.changed_clouds.push_back(cloud);
+  }
+  if (opt.changed_clouds.empty())
+    vw_throw( ArgumentErr() << "The option --update-dem needs --changed-clouds.\n" );
+
+  if (opt.dem_spacing.size() > 1)
+    vw_throw( ArgumentErr() << "Cannot use --update-dem with multiple DEM spacings.\n" );
+  if (opt.no_dem || opt.do_error || opt.do_normalize || opt.do_ortho)
+    vw_throw( ArgumentErr() << "With --update-dem, only the DEM can be created.\n" );
+  if (opt.use_surface_sampling)
+    vw_throw( ArgumentErr() << "Cannot use --update-dem with surface sampling.\n" );
+  if (opt.target_projwin != BBox2())
+    vw_throw( ArgumentErr() << "Cannot use --update-dem with --t_projwin.\n" );
+
+  // These act on the input clouds, and their effect on the DEM can
+  // extend arbitrarily beyond the changed clouds.
+  if ((opt.median_filter_params[0] > 0 && opt.median_filter_params[1] > 0) ||
+      opt.erode_len > 0)
+    vw_throw( ArgumentErr() << "Cannot use --update-dem with median "
+                            << "filtering or erosion of the clouds.\n" );
+
+  std::string out_dem = opt.out_prefix + "-DEM." + opt.output_file_type;
+  if (opt.filter != "weighted_average")
+    out_dem = opt.out_prefix + "-" + opt.filter + "-DEM." + opt.output_file_type;
+  if (fs::exists(out_dem) && fs::equivalent(out_dem, opt.update_dem))
+    vw_throw( ArgumentErr() << "The output DEM must be different from the one being updated.\n" );
+
+  GeoReference dem_georef;
+  if (!read_georeference(dem_georef, opt.update_dem))
+    vw_throw( ArgumentErr() << "The DEM to update has no georeference: " << opt.update_dem << "\n" );
+  Matrix3x3 T = dem_georef.transform();
+  if (T(0,0) <= 0 || std::abs(T(0,0) + T(1,1)) > 1e-10 * T(0,0) || T(0,1) != 0 || T(1,0) != 0)
+    vw_throw( ArgumentErr() << "The DEM to update must have square pixels, "
+                            << "aligned with the projection axes.\n" );
+
+  // The projection window which reproduces the DEM grid. The rasterizer
+  // places the pixel centers at the window corners.
+  DiskImageView<float> dem(opt.update_dem);
+  double spacing = T(0,0);
+  Vector2 ul(T(0,2), T(1,2));
+  if (dem_georef.pixel_interpretation() == cartography::GeoReference::PixelAsArea)
+    ul += Vector2(0.5*spacing, -0.5*spacing);
+  opt.target_projwin = BBox2(Vector2(ul.x(), ul.y() - (dem.rows() - 1.0)*spacing),
+                             Vector2(ul.x() + (dem.cols() - 1.0)*spacing, ul.y()));
+  opt.dem_spacing = std::vector<double>(1, spacing);
+  opt.target_srs_string = dem_georef.overall_proj4_str();
+
+  double nodata_value = opt.nodata_value;
+  if (vw::read_nodata_val(opt.update_dem, nodata_value))
+    opt.nodata_value = nodata_value;
+}
+
 void split_number_string(const std::string &input, std::vector<double> &output) {
 
   // Get a space delimited string
@@ -398,6 +477,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("csv-format",     po::value(&opt.csv_format_str)->default_value(""), asp::csv_opt_caption().c_str())
     ("csv-proj4",      po::value(&opt.csv_proj4_str)->default_value(""), "The PROJ.4 string to use to interpret the entries in input CSV files, if those files contain Easting and Northing fields. If not specified, --t_srs will be used.")
     ("filter",      po::value(&opt.filter)->default_value("weighted_average"), "The filter to apply to the heights of the cloud points within a given circular neighborhood when gridding (its radius is controlled via --search-radius-factor). Options: weighted_average (default), min, max, mean, median, stddev, count (number of points), nmad (= 1.4826 * median(abs(X - median(X)))), n-pct (where n is a real value between 0 and 100, for example, 80-pct, meaning, 80th percentile). Except for the default, the name of the filter will be added to the obtained DEM file name, e.g., output-min-DEM.tif.")
+    ("max-samples-per-pixel", po::value(&opt.max_samples_per_pixel)->default_value(0),
+     "With the median, stddev, nmad, and percentile filters, keep at most this many values for each DEM pixel, as a random subset of all of them, to bound the memory usage. The result is then exact only at pixels with no more than this many values. Set to 0 to keep all values.")
     ("rounding-error", po::value(&opt.rounding_error)->default_value(asp::APPROX_ONE_MM),
             "How much to round the output DEM and errors, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. [Default: 1/2^10]")
     ("search-radius-factor", po::value(&opt.search_radius_factor)->default_value(0.0),
@@ -408,6 +489,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "If the output DEM grid size (--dem-spacing) is not specified, compute it automatically (as the mean ground sample distance), and then multiply it by this number. It is suggested that this number be set to 4 though the default is 1.")
     ("use-surface-sampling", po::bool_switch(&opt.use_surface_sampling)->default_value(false),
      "Use the older algorithm, interpret the point cloud as a surface made up of triangles and interpolate into it (prone to aliasing).")
+    ("aggregate-coarse-dems", po::bool_switch(&opt.aggregate_coarse_dems)->default_value(false),
+     "When more than one value is passed to --dem-spacing, rasterize the point cloud only at the finest spacing, and produce the outputs at each coarser spacing which is an integer multiple of it by averaging blocks of pixels (or taking their min or max, for these filters). This avoids reading and binning the cloud again, at the cost of some approximation.")
+    ("convert-in-memory", po::bool_switch(&opt.convert_in_memory)->default_value(false),
+     "Keep the point clouds converted from LAS, CSV, and PCD files in memory rather than in temporary files on disk. This needs memory somewhat less than 24 bytes per point, due to compression.")
+    ("fused-rasterization", po::bool_switch(&opt.fused_rasterization)->default_value(false),
+     "Produce the DEM, orthoimage, and triangulation error image in the same pass over the point cloud, reading and filtering each block of points once, rather than once for each of them. The products are first written together to a temporary multi-band file. Cannot be used with --use-surface-sampling, --update-dem, or --orthoimage-hole-fill-len.")
+    ("update-dem", po::value(&opt.update_dem)->default_value(""),
+     "Update this existing DEM, by recomputing only the pixels which may be affected by the clouds in --changed-clouds, and copying the rest. The input clouds must be all the clouds this DEM was created from, with the same options. The output grid, projection, and nodata value are the ones of this DEM. Only the DEM is created.")
+    ("changed-clouds", po::value(&opt.changed_clouds_str)->default_value(""),
+     "The point clouds which changed since the DEM passed to --update-dem was created, as a list in quotes, separated by spaces.")
+    ("cache-block-boundaries", po::bool_switch(&opt.cache_boundaries)->default_value(false),
+     "Save the bounding boxes of the blocks of the point cloud, in the output projection, to a file next to the cloud (or with the output prefix, for multiple or LAS/CSV inputs), and read them from there in later runs with the same cloud, projection, and outlier removal options, rather than recomputing them.")
     ("fsaa",   po::value<int>(&opt.fsaa)->default_value(1),            "Oversampling amount to perform antialiasing (obsolete).")
     ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.");
   
@@ -492,14 +585,41 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "Cannot use surface "
                             << "sampling with any filter of point cloud points.\n" );
 
+  if (opt.max_samples_per_pixel < 0)
+    vw_throw( ArgumentErr() << "The value of --max-samples-per-pixel must be non-negative.\n" );
+
+  if (opt.aggregate_coarse_dems) {
+    if (opt.use_surface_sampling)
+      vw_throw( ArgumentErr() << "Cannot use --aggregate-coarse-dems with surface sampling.\n" );
+    if (opt.filter != "weighted_average" && opt.filter != "mean" &&
+        opt.filter != "min" && opt.filter != "max")
+      vw_throw( ArgumentErr() << "The --aggregate-coarse-dems option can be used only with "
+                              << "the weighted_average, mean, min, and max filters.\n" );
+    for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+      if (opt.dem_spacing[i] <= 0)
+        vw_throw( ArgumentErr() << "The --aggregate-coarse-dems option needs "
+                                << "all values of --dem-spacing to be set.\n" );
+    }
+  }
+
   if (opt.use_surface_sampling && opt.has_las_or_csv_or_pcd)
     vw_throw( ArgumentErr() << "Cannot use surface " << "sampling with LAS or CSV files.\n" );
 
+  if (opt.update_dem != "")
+    set_update_dem_options(opt);
+  else if (opt.changed_clouds_str != "")
+    vw_throw( ArgumentErr() << "The option --changed-clouds needs --update-dem.\n" );
+
   if (opt.fsaa != 1 && !opt.use_surface_sampling){
     vw_throw( ArgumentErr() << "The --fsaa option is obsolete. It can be used only with the "
               << "--use-surface-sampling option which invokes the old algorithm.\n" << usage << general_options );
   }
 
+  if (opt.fused_rasterization &&
+      (opt.use_surface_sampling || opt.update_dem != "" || opt.ortho_hole_fill_len > 0))
+    vw_throw( ArgumentErr() << "The option --fused-rasterization cannot be used with "
+              << "--use-surface-sampling, --update-dem, or --orthoimage-hole-fill-len.\n");
+
   if (opt.dem_hole_fill_len < 0)
     vw_throw( ArgumentErr() << "The value of --dem-hole-fill-len must be non-negative.\n");
   if (opt.ortho_hole_fill_len < 0)
@@ -790,6 +910,154 @@ namespace asp{
     return CombinedView<ImageT>(nodata_value, image1.impl(), image2.impl(), image3.impl());
   }
 
+  /// Form a coarser image by aggregating the valid pixels in each
+  /// factor x factor block of a finer one, with the mean, min, or max.
+  /// Used to derive the coarser DEMs from the finest one without
+  /// rasterizing the point cloud again.
+  template <class ImageT>
+  class BlockAggregateView : public ImageViewBase<BlockAggregateView<ImageT> >
+  {
+    ImageT      m_image;
+    int         m_factor;
+    std::string m_filter;
+    double      m_nodata_value;
+
+  public:
+
+    typedef float pixel_type;
+    typedef float result_type;
+    typedef ProceduralPixelAccessor<BlockAggregateView> pixel_accessor;
+
+    BlockAggregateView(ImageViewBase<ImageT> const& image, int factor,
+                       std::string const& filter, double nodata_value):
+      m_image(image.impl()), m_factor(factor), m_filter(filter),
+      m_nodata_value(nodata_value){}
+
+    inline int32 cols  () const { return (m_image.cols() + m_factor - 1) / m_factor; }
+    inline int32 rows  () const { return (m_image.rows() + m_factor - 1) / m_factor; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      vw_throw(NoImplErr() << "BlockAggregateView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    typedef CropView< ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+      BBox2i fine_box(m_factor*bbox.min().x(), m_factor*bbox.min().y(),
+                      m_factor*bbox.width(),   m_factor*bbox.height());
+      fine_box.crop(bounding_box(m_image));
+      ImageView<float> fine = crop(m_image, fine_box);
+
+      ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      for (int row = 0; row < bbox.height(); row++) {
+        for (int col = 0; col < bbox.width(); col++) {
+
+          int beg_c = m_factor*(bbox.min().x() + col) - fine_box.min().x();
+          int beg_r = m_factor*(bbox.min().y() + row) - fine_box.min().y();
+          int end_c = std::min(beg_c + m_factor, fine.cols());
+          int end_r = std::min(beg_r + m_factor, fine.rows());
+
+          double sum = 0.0, min_val = 0.0, max_val = 0.0;
+          int count = 0;
+          for (int r = beg_r; r < end_r; r++) {
+            for (int c = beg_c; c < end_c; c++) {
+              double val = fine(c, r);
+              if (val == m_nodata_value || val != val) // skip nodata and NaN
+                continue;
+              if (count == 0 || val < min_val) min_val = val;
+              if (count == 0 || val > max_val) max_val = val;
+              sum += val;
+              count++;
+            }
+          }
+
+          if (count == 0)
+            tile(col, row) = m_nodata_value;
+          else if (m_filter == "min")
+            tile(col, row) = min_val;
+          else if (m_filter == "max")
+            tile(col, row) = max_val;
+          else
+            tile(col, row) = sum / count;
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows());
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+  template <class ImageT>
+  BlockAggregateView<ImageT> block_aggregate(ImageViewBase<ImageT> const& image, int factor,
+                                             std::string const& filter, double nodata_value) {
+    return BlockAggregateView<ImageT>(image.impl(), factor, filter, nodata_value);
+  }
+
+  /// Take the pixels in the given box from the newly created DEM, and
+  /// the rest from an existing DEM on disk, with the same grid. The new
+  /// DEM is computed only for the tiles intersecting the box.
+  template <class ImageT>
+  class RegionUpdateView : public ImageViewBase<RegionUpdateView<ImageT> >
+  {
+    ImageT                           m_new_dem;
+    DiskImageView< PixelGray<float> > m_old_dem;
+    BBox2i                           m_box;
+
+  public:
+
+    typedef PixelGray<float> pixel_type;
+    typedef PixelGray<float> result_type;
+    typedef ProceduralPixelAccessor<RegionUpdateView> pixel_accessor;
+
+    RegionUpdateView(ImageViewBase<ImageT> const& new_dem, std::string const& old_dem_file,
+                     BBox2i const& box):
+      m_new_dem(new_dem.impl()), m_old_dem(old_dem_file), m_box(box){
+      if (m_new_dem.cols() != m_old_dem.cols() || m_new_dem.rows() != m_old_dem.rows())
+        vw_throw( ArgumentErr() << "The DEM being updated has size " << m_old_dem.cols()
+                  << " x " << m_old_dem.rows() << " while the new DEM has size "
+                  << m_new_dem.cols() << " x " << m_new_dem.rows() << ".\n" );
+    }
+
+    inline int32 cols  () const { return m_old_dem.cols(); }
+    inline int32 rows  () const { return m_old_dem.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      vw_throw(NoImplErr() << "RegionUpdateView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    typedef CropView< ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+      ImageView<pixel_type> tile = crop(m_old_dem, bbox);
+
+      BBox2i new_box = bbox;
+      new_box.crop(m_box);
+      if (!new_box.empty())
+        crop(tile, new_box - bbox.min()) = crop(m_new_dem, new_box);
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows());
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+  template <class ImageT>
+  RegionUpdateView<ImageT> region_update(ImageViewBase<ImageT> const& new_dem,
+                                         std::string const& old_dem_file, BBox2i const& box) {
+    return RegionUpdateView<ImageT>(new_dem.impl(), old_dem_file, box);
+  }
+
   /// Round pixels in given image to multiple of given scale.
   /// Don't round nodata values.
   template <class PixelT>
@@ -894,6 +1162,30 @@ namespace asp{
     return per_pixel_filter(error_channels, asp::VectorNorm< Vector<double, num_ech> >());
   }
 
+  // The xyz point and the norm of its error, from a cloud with
+  // num_ch channels, the errors starting at channel 4.
+  template<int num_ch>
+  struct PointAndErrorNorm: public ReturnFixedType<Vector4> {
+    Vector4 operator() (Vector<double, num_ch> const& pt) const {
+      Vector4 out;
+      subvector(out, 0, 3) = subvector(pt, 0, 3);
+      out[3] = norm_2(subvector(pt, 3, num_ch - 3));
+      return out;
+    }
+  };
+
+  template<int num_ch>
+  ImageViewRef<Vector4> point_and_error_norm(std::vector<std::string> const& pc_files){
+
+    VW_ASSERT(pc_files.size() >= 1, ArgumentErr() << "Expecting at least one file.\n");
+
+    ImageViewRef< Vector<double, num_ch> > point_disk_image
+      = asp::form_point_cloud_composite<Vector<double, num_ch> >(pc_files,
+          asp::OrthoRasterizerView::max_subblock_size());
+
+    return per_pixel_filter(point_disk_image, asp::PointAndErrorNorm<num_ch>());
+  }
+
   int num_channels(std::vector<std::string> const& pc_files){
 
     // Find the number of channels in the point clouds.
@@ -918,6 +1210,153 @@ namespace asp{
 } // end namespace asp
 
 
+// The pixels of the DEM being updated which may be affected by the
+// changed clouds. A point contributes to the grid points within the
+// search radius, and hole-filling reaches further.
+BBox2i update_pixel_box(asp::OrthoRasterizerView & rasterizer, Options const& opt) {
+
+  Matrix3x3 T = rasterizer.geo_transform();
+  BBox2 box;
+  box.grow(Vector2((opt.changed_proj_box.min().x() - T(0,2))/T(0,0),
+                   (opt.changed_proj_box.max().y() - T(1,2))/T(1,1)));
+  box.grow(Vector2((opt.changed_proj_box.max().x() - T(0,2))/T(0,0),
+                   (opt.changed_proj_box.min().y() - T(1,2))/T(1,1)));
+
+  int margin = (int)ceil(rasterizer.search_radius()/rasterizer.spacing())
+    + opt.dem_hole_fill_len + 1;
+  BBox2i pixel_box(Vector2i(floor(box.min().x()), floor(box.min().y())),
+                   Vector2i(ceil(box.max().x()) + 1, ceil(box.max().y()) + 1));
+  pixel_box.expand(margin);
+  pixel_box.crop(bounding_box(rasterizer));
+
+  return pixel_box;
+}
+
+// Write a normalized version of the DEM already written (for debugging)
+void write_normalized_dem(asp::OrthoRasterizerView& rasterizer, Options& opt,
+                          cartography::GeoReference const& georef) {
+  int hole_fill_len = 0;
+  DiskImageView< PixelGray<float> > dem_image(opt.out_prefix + "-DEM." + opt.output_file_type);
+  asp::save_image(opt, apply_mask(channel_cast<uint8>(normalize(create_mask(dem_image,opt.nodata_value),
+                                                                rasterizer.bounding_box().min().z(),
+                                                                rasterizer.bounding_box().max().z(),
+                                                                0, 255)
+                                                     )
+                                 ),
+                  georef, hole_fill_len, "DEM-normalized");
+}
+
+// Produce the DEM, error, and ortho images in one pass over the
+// cloud. They are gridded together, as the bands of a temporary
+// image, from which each is then written. The results are the same
+// as when rasterizing the cloud once for each of them.
+void do_fused_rasterization(asp::OrthoRasterizerView& rasterizer,
+                            Options& opt,
+                            cartography::GeoReference const& georef,
+                            size_t *num_invalid_pixels) {
+
+  // The first band is the height. The others follow in this order.
+  rasterizer.clear_fused_textures();
+  int ortho_band = -1, error_band = -1, num_error_bands = 0;
+  if (opt.do_error) {
+    int num_channels = asp::num_channels(opt.pointcloud_files);
+    if (num_channels == 4){
+      // The error is a scalar.
+      ImageViewRef<Vector4> point_disk_image
+        = asp::form_point_cloud_composite<Vector4>
+        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+      error_band = 1 + rasterizer.num_fused_textures();
+      num_error_bands = 1;
+      rasterizer.add_fused_texture(select_channel(point_disk_image, 3));
+    }else if (num_channels == 6){
+      // The error is a 3D vector, in the NED coordinate system.
+      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
+        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+      error_band = 1 + rasterizer.num_fused_textures();
+      num_error_bands = 3;
+      for (int ch_index = 0; ch_index < 3; ch_index++)
+        rasterizer.add_fused_texture(select_channel(ned_err, ch_index));
+    }else{
+      vw_out() << "The point cloud files must have an equal number of channels which "
+               << "must be 4 or 6 to be able to process the intersection error.\n";
+    }
+  }
+  if (opt.do_ortho) {
+    ImageViewRef< PixelGray<float> > texture
+      = asp::form_point_cloud_composite< PixelGray<float> >
+      (opt.texture_files, asp::OrthoRasterizerView::max_subblock_size());
+    ortho_band = 1 + rasterizer.num_fused_textures();
+    rasterizer.add_fused_texture(texture);
+  }
+
+  // Stop the program if it is going to create too large a DEM, this will cause a crash.
+  asp::FusedOrthoRasterizerView fused_view(rasterizer);
+  Vector2i dem_size = bounding_box(fused_view).size();
+  vw_out()<< "Creating output file that is " << dem_size << " px.\n";
+  if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
+    vw_throw( ArgumentErr()
+              << "Requested DEM size is too large, max allowed output size is "
+              << opt.max_output_size << " pixels.\n" );
+
+  Stopwatch sw;
+  sw.start();
+  std::string fused_file = opt.out_prefix + "-fused.tmp.tif";
+  vw_out() << "Writing: " << fused_file << "\n";
+  bool has_georef = true, has_nodata = true;
+  vw::cartography::block_write_gdal_image
+    (fused_file, fused_view, has_georef, georef, has_nodata, opt.nodata_value, opt,
+     TerminalProgressCallback("asp", "Rasterizing: "));
+  rasterizer.clear_fused_textures();
+  sw.stop();
+  vw_out(DebugMessage,"asp") << "Fused render time: " << sw.elapsed_seconds() << ".\n";
+
+  DiskImageView< PixelGray<float> > fused(fused_file);
+
+  if (!opt.no_dem) {
+    ImageViewRef< PixelGray<float> > dem
+      = asp::round_image_pixels_skip_nodata(select_plane(fused, 0), opt.rounding_error,
+                                            opt.nodata_value);
+    // Holes are filled reading from disk, as for the unfilled DEM
+    int hole_fill_len = opt.dem_hole_fill_len;
+    if (hole_fill_len > 0)
+      dem = apply_mask
+        (vw::fill_holes_grass(create_mask(dem, opt.nodata_value), hole_fill_len),
+         opt.nodata_value);
+    asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+
+    double num_invalid_pixelsD = static_cast<double>(*num_invalid_pixels);
+    double num_total_pixels    = static_cast<double>(dem_size[0]*dem_size[1]);
+    double invalid_ratio       = num_invalid_pixelsD / num_total_pixels;
+    vw_out() << "Percentage of valid pixels = " << 1.0-invalid_ratio << "\n";
+  }
+  *num_invalid_pixels = 0; // Reset this count
+
+  int hole_fill_len = 0;
+  if (num_error_bands == 1) {
+    save_image(opt, asp::round_image_pixels_skip_nodata(select_plane(fused, error_band),
+                                                        opt.rounding_error,
+                                                        opt.nodata_value),
+               georef, hole_fill_len, "IntersectionErr");
+  } else if (num_error_bands == 3) {
+    save_image(opt, asp::round_image_pixels_skip_nodata
+               (asp::combine_channels(opt.nodata_value, select_plane(fused, error_band),
+                                      select_plane(fused, error_band + 1),
+                                      select_plane(fused, error_band + 2)),
+                opt.rounding_error, opt.nodata_value),
+               georef, hole_fill_len, "IntersectionErr");
+  }
+
+  if (opt.do_normalize)
+    write_normalized_dem(rasterizer, opt, georef);
+
+  if (ortho_band >= 0)
+    asp::save_image(opt, select_plane(fused, ortho_band), georef, hole_fill_len, "DRG");
+
+  if (fs::exists(fused_file))
+    fs::remove(fused_file);
+}
+
 void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
                                Options& opt,
                                cartography::GeoReference& georef,
@@ -968,6 +1407,13 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
     opt.rounding_error = 0.0;
   }
 
+  // Grid the DEM, error, and ortho images together, if more than one is wanted
+  int num_products = int(!opt.no_dem) + int(opt.do_error) + int(opt.do_ortho);
+  if (opt.fused_rasterization && num_products > 1) {
+    do_fused_rasterization(rasterizer, opt, georef, num_invalid_pixels);
+    return;
+  }
+
   ImageViewRef< PixelGray<float> > rasterizer_fsaa
     = generate_fsaa_raster( rasterizer, opt );
 
@@ -982,9 +1428,27 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
                                             opt.nodata_value);
 
     int hole_fill_len = opt.dem_hole_fill_len;
-    if (hole_fill_len > 0){
-      // Note that we first cache the tiles of the rasterized DEM, and
-      // fill holes later. This greatly improves the performance.
+    std::string unfilled_dem;
+    if (hole_fill_len > 0 && opt.update_dem == ""){
+      // Rasterize the DEM once, to a temporary file, then fill holes
+      // reading from it. The large margins needed by hole-filling then
+      // cost only disk reads rather than rasterizing the cloud again.
+      unfilled_dem = opt.out_prefix + "-DEM-unfilled.tmp.tif";
+      vw_out() << "Writing: " << unfilled_dem << "\n";
+      bool has_georef = true, has_nodata = true;
+      vw::cartography::block_write_gdal_image
+        (unfilled_dem, dem, has_georef, georef, has_nodata, opt.nodata_value, opt,
+         TerminalProgressCallback("asp", "Unfilled DEM: "));
+      dem = apply_mask
+        (vw::fill_holes_grass(create_mask
+                               (DiskImageView< PixelGray<float> >(unfilled_dem),
+                                opt.nodata_value),
+                               hole_fill_len),
+         opt.nodata_value);
+    } else if (hole_fill_len > 0){
+      // When updating a DEM, only the tiles in the changed region are
+      // rasterized. Cache them, and fill holes later. This greatly
+      // improves the performance.
       dem = apply_mask
         (vw::fill_holes_grass(create_mask
                                (block_cache(dem, tile_size, opt.num_threads),
@@ -993,6 +1457,16 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
          opt.nodata_value);
     }
 
+    // Recompute only the changed region of an existing DEM. Keep its
+    // georeference, which the new one was made to agree with.
+    GeoReference dem_georef = georef;
+    if (opt.update_dem != "") {
+      BBox2i update_box = update_pixel_box(rasterizer, opt);
+      vw_out() << "Updating the region " << update_box << " of: " << opt.update_dem << "\n";
+      dem = asp::region_update(dem, opt.update_dem, update_box);
+      read_georeference(dem_georef, opt.update_dem);
+    }
+
     // Stop the program if it is going to create too large a DEM, this will cause a crash.
     Vector2i dem_size = bounding_box(dem).size();
     vw_out()<< "Creating output file that is " << dem_size << " px.\n";
@@ -1001,14 +1475,19 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
                 << "Requested DEM size is too large, max allowed output size is "
                 << opt.max_output_size << " pixels.\n" );
 
-    asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+    asp::save_image(opt, dem, dem_georef, hole_fill_len, "DEM");
+    if (unfilled_dem != "" && fs::exists(unfilled_dem))
+      fs::remove(unfilled_dem);
     sw2.stop();
     vw_out(DebugMessage,"asp") << "DEM render time: " << sw2.elapsed_seconds() << ".\n";
 
-    double num_invalid_pixelsD = static_cast<double>(*num_invalid_pixels);
-    double num_total_pixels    = static_cast<double>(dem_size[0]*dem_size[1]);
-    double invalid_ratio       = num_invalid_pixelsD / num_total_pixels;
-    vw_out() << "Percentage of valid pixels = " << 1.0-invalid_ratio << "\n";
+    // When updating a DEM, only the changed region was counted
+    if (opt.update_dem == "") {
+      double num_invalid_pixelsD = static_cast<double>(*num_invalid_pixels);
+      double num_total_pixels    = static_cast<double>(dem_size[0]*dem_size[1]);
+      double invalid_ratio       = num_invalid_pixelsD / num_total_pixels;
+      vw_out() << "Percentage of valid pixels = " << 1.0-invalid_ratio << "\n";
+    }
     *num_invalid_pixels = 0; // Reset this count
   }
 
@@ -1056,17 +1535,8 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   }
 
   // Write out a normalized version of the DEM, if requested (for debugging)
-  if (opt.do_normalize) {
-    int hole_fill_len = 0;
-    DiskImageView< PixelGray<float> > dem_image(opt.out_prefix + "-DEM." + opt.output_file_type);
-    asp::save_image(opt, apply_mask(channel_cast<uint8>(normalize(create_mask(dem_image,opt.nodata_value),
-                                                                  rasterizer.bounding_box().min().z(),
-                                                                  rasterizer.bounding_box().max().z(),
-                                                                  0, 255)
-                                                       )
-                                   ),
-                    georef, hole_fill_len, "DEM-normalized");
-  }
+  if (opt.do_normalize)
+    write_normalized_dem(rasterizer, opt, georef);
 
   // Write DRG if the user requested and provided a texture file.
   // This must be at the end, as we may be messing with the point
@@ -1152,6 +1622,78 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
 } // End do_software_rasterization
 
 
+// If the coarse spacing is an integer multiple of the fine one, return
+// that multiple, otherwise return 0.
+int aggregation_factor(double coarse_spacing, double fine_spacing) {
+  if (fine_spacing <= 0.0)
+    return 0;
+  double ratio  = coarse_spacing / fine_spacing;
+  int    factor = int(round(ratio));
+  if (factor < 2 || std::abs(ratio - factor) > 1e-6 * ratio)
+    return 0;
+  return factor;
+}
+
+// Produce the DEM, error, and ortho images at a coarser spacing by
+// aggregating the ones already written at the finest spacing.
+void aggregate_fine_products(Options & opt, std::string const& fine_prefix,
+                             GeoReference const& fine_georef, int factor) {
+
+  vw_out() << "\t-- Aggregating the finest products by a factor of " << factor << " --\n";
+
+  // The coarse grid shares its corner with the fine grid
+  GeoReference georef = fine_georef;
+  Matrix3x3 transform = georef.transform();
+  if (georef.pixel_interpretation() != cartography::GeoReference::PixelAsArea) {
+    transform(0,2) += 0.5 * (factor - 1) * transform(0,0);
+    transform(1,2) += 0.5 * (factor - 1) * transform(1,1);
+  }
+  transform(0,0) *= factor;
+  transform(1,1) *= factor;
+  georef.set_transform(transform);
+
+  std::string tag = "";
+  if (opt.filter != "weighted_average")
+    tag = "-" + opt.filter;
+
+  // Heights are aggregated with the chosen filter, the rest with the mean
+  const char* names[] = {"DEM", "IntersectionErr", "DEM-normalized", "DRG"};
+  bool requested[]    = {!opt.no_dem, opt.do_error, opt.do_normalize, opt.do_ortho};
+  for (size_t it = 0; it < sizeof(names)/sizeof(names[0]); it++) {
+
+    // Do not pick up stale files from earlier runs
+    if (!requested[it])
+      continue;
+
+    std::string name      = names[it];
+    std::string fine_file = fine_prefix + tag + "-" + name + "." + opt.output_file_type;
+    if (!fs::exists(fine_file))
+      continue;
+
+    std::string filter = (name == "DEM") ? opt.filter : "mean";
+    bool do_round = (name == "DEM" || name == "IntersectionErr");
+    double rounding_error = do_round ? opt.rounding_error : 0.0;
+
+    if (get_num_channels(fine_file) == 3) {
+      DiskImageView<Vector3f> fine(fine_file);
+      save_image(opt, asp::round_image_pixels_skip_nodata
+                 (asp::combine_channels
+                  (opt.nodata_value,
+                   block_aggregate(select_channel(fine, 0), factor, filter, opt.nodata_value),
+                   block_aggregate(select_channel(fine, 1), factor, filter, opt.nodata_value),
+                   block_aggregate(select_channel(fine, 2), factor, filter, opt.nodata_value)),
+                  rounding_error, opt.nodata_value),
+                 georef, 0, name);
+    } else {
+      DiskImageView<float> fine(fine_file);
+      save_image(opt, asp::round_image_pixels_skip_nodata
+                 (block_aggregate(fine, factor, filter, opt.nodata_value),
+                  rounding_error, opt.nodata_value),
+                 georef, 0, name);
+    }
+  }
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_points,
                                              Options& opt,
@@ -1165,6 +1707,31 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
   vw::Mutex count_mutex; // Need to pass in by pointer due to C++ class restrictions
   size_t num_invalid_pixels = 0; // Need to pass in by pointer because we can't get back the number from
                                  //  the original rasterizer object otherwise for some reason.
+
+  // The bounding boxes of the cloud blocks depend on the cloud, the
+  // projection, and on how the cloud is read and filtered.
+  std::string boundaries_file, boundaries_key;
+  if (opt.cache_boundaries) {
+    if (opt.pointcloud_files.size() == 1 && !opt.has_las_or_csv_or_pcd)
+      boundaries_file = fs::path(opt.pointcloud_files[0]).replace_extension("").string()
+        + "-boundaries.bin";
+    else
+      boundaries_file = opt.out_prefix + "-boundaries.bin";
+    std::ostringstream os;
+    os.precision(17);
+    for (size_t i = 0; i < opt.pointcloud_files.size(); i++)
+      os << asp::file_fingerprint(opt.pointcloud_files[i]) << "\n";
+    // A VRT of clouds does not change when the clouds in it do
+    for (size_t i = 0; i < opt.changed_clouds.size(); i++)
+      os << asp::file_fingerprint(opt.changed_clouds[i]) << "\n";
+    os << georef.overall_proj4_str() << "\n"
+       << opt.csv_format_str << " " << opt.csv_proj4_str << "\n"
+       << opt.phi_rot << " " << opt.omega_rot << " " << opt.kappa_rot << " " << opt.rot_order
+       << " " << opt.lon_offset << " " << opt.lat_offset << " " << opt.height_offset << "\n"
+       << opt.remove_outliers_with_pct << " " << opt.remove_outliers_params;
+    boundaries_key = os.str();
+  }
+
   asp::OrthoRasterizerView
     rasterizer(proj_points.impl(), select_channel(proj_points.impl(),2),
                opt.search_radius_factor, opt.sigma_factor, opt.use_surface_sampling,
@@ -1175,7 +1742,8 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
                opt.median_filter_params, opt.erode_len, opt.has_las_or_csv_or_pcd,
                opt.filter, opt.default_grid_size_multiplier,
                &num_invalid_pixels, &count_mutex,
-               TerminalProgressCallback("asp","QuadTree: "));
+               TerminalProgressCallback("asp","QuadTree: "),
+               boundaries_file, boundaries_key);
 
   sw1.stop();
   vw_out(DebugMessage,"asp") << "Quad time: " << sw1.elapsed_seconds() << std::endl;
@@ -1184,34 +1752,130 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
   rasterizer.set_use_alpha(opt.has_alpha);
   rasterizer.set_use_minz_as_default(false);
   rasterizer.set_default_value(opt.nodata_value);
+  rasterizer.set_max_samples_per_pixel(opt.max_samples_per_pixel);
+  rasterizer.set_texture_to_height(); // The texture passed in above is the height
 
   std::string base_out_prefix = opt.out_prefix;
 
+  // When aggregating, the finest spacing is rasterized first, and
+  // the coarser products are derived from it.
+  std::vector<size_t> order;
+  size_t fine_index = 0;
+  if (opt.aggregate_coarse_dems) {
+    for (size_t i = 0; i < opt.dem_spacing.size(); i++)
+      if (opt.dem_spacing[i] < opt.dem_spacing[fine_index])
+        fine_index = i;
+    order.push_back(fine_index);
+  }
+  for (size_t i = 0; i < opt.dem_spacing.size(); i++)
+    if (!opt.aggregate_coarse_dems || i != fine_index)
+      order.push_back(i);
+
+  std::string  fine_prefix;
+  GeoReference fine_georef;
+
   // Call the function for each dem spacing
-  for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+  for (size_t j = 0; j < order.size(); j++) {
+    size_t i = order[j];
     double this_spacing = opt.dem_spacing[i];
 
-    // Required second init step for each spacing
-    rasterizer.initialize_spacing(this_spacing);
-
     // Each spacing gets a variation of the output prefix
     if (i == 0)
       opt.out_prefix = base_out_prefix;
     else // Write later iterations to a different path.
       opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
+
+    if (opt.aggregate_coarse_dems && i != fine_index) {
+      int factor = aggregation_factor(this_spacing, opt.dem_spacing[fine_index]);
+      if (factor > 1) {
+        aggregate_fine_products(opt, fine_prefix, fine_georef, factor);
+        continue;
+      }
+      vw_out() << "The spacing " << this_spacing << " is not an integer multiple of "
+               << opt.dem_spacing[fine_index] << ". Rasterizing the cloud for it.\n";
+    }
+
+    // Required second init step for each spacing
+    rasterizer.initialize_spacing(this_spacing);
+
     do_software_rasterization(rasterizer, opt, georef, error_image,
                               estim_max_error, &num_invalid_pixels);
+
+    if (i == fine_index) {
+      fine_prefix = opt.out_prefix;
+      fine_georef = georef;
+    }
   } // End loop through spacings
 
   opt.out_prefix = base_out_prefix; // Restore the original value
 }
 
-// Sample the image and get generous estimates (but without outliers)
+// Apply the optional rotation from the options to the cloud points
+ImageViewRef<Vector3> rotate_cloud(Options const& opt, ImageViewRef<Vector3> point_image,
+                                   bool verbose) {
+  if (opt.phi_rot == 0 && opt.omega_rot == 0 && opt.kappa_rot == 0)
+    return point_image;
+
+  if (verbose)
+    vw_out() << "\t--> Applying rotation sequence: " << opt.rot_order
+             << "      Angles: " << opt.phi_rot << "   "
+             << opt.omega_rot << "  " << opt.kappa_rot << "\n";
+  return asp::point_transform
+    (point_image, math::euler_to_rotation_matrix(opt.phi_rot, opt.omega_rot,
+                                                 opt.kappa_rot, opt.rot_order));
+}
+
+// Convert xyz points to projected points, with the optional offset applied.
+// - The points are converted a block at a time. Invalid (0,0,0,0) points
+//   become NaN, which is checked for in the OrthoRasterizer class.
+ImageViewRef<Vector3> project_cloud(Options const& opt, ImageViewRef<Vector3> point_image,
+                                    GeoReference const& georef, double avg_lon,
+                                    bool verbose) {
+  Vector3 offset(opt.lon_offset, opt.lat_offset, opt.height_offset);
+  if (offset != Vector3() && verbose)
+    vw_out() << "\t--> Applying offset: " << opt.lon_offset
+             << " " << opt.lat_offset << " " << opt.height_offset << "\n";
+
+  return asp::geodetic_projection(point_image, georef, avg_lon, offset);
+}
+
+// The bounding box, in the output projection, of the valid points of
+// the clouds which changed since the DEM being updated was created.
+BBox2 changed_clouds_proj_box(Options const& opt, GeoReference const& georef,
+                              double avg_lon) {
+  BBox2 box;
+  for (size_t i = 0; i < opt.changed_clouds.size(); i++) {
+    vw_out() << "Finding the extent of changed cloud: " << opt.changed_clouds[i] << "\n";
+    ImageViewRef<Vector3> proj_points
+      = project_cloud(opt, rotate_cloud(opt, asp::read_asp_point_cloud<3>(opt.changed_clouds[i]),
+                                        false),
+                      georef, avg_lon, false);
+    std::vector<BBox2i> blocks = subdivide_bbox(proj_points, 1024, 1024);
+    for (size_t b = 0; b < blocks.size(); b++) {
+      ImageView<Vector3> points = crop(proj_points, blocks[b]);
+      for (int row = 0; row < points.rows(); row++) {
+        for (int col = 0; col < points.cols(); col++) {
+          Vector3 const& p = points(col, row);
+          if (!boost::math::isnan(p.z()))
+            box.grow(subvector(p, 0, 2));
+        }
+      }
+    }
+  }
+
+  if (box.empty())
+    vw_throw( ArgumentErr() << "The changed clouds have no valid points.\n" );
+
+  return box;
+}
+
+// Sample the cloud and get generous estimates (but without outliers)
 // of the maximum triangulation error and of the 3D box containing the
-// projected points. These will be tightened later.
-double estim_max_tri_error_and_proj_box(ImageViewRef<Vector3> const& proj_points,
-                                        ImageViewRef<double> const& error_image,
-                                        Vector2 const& remove_outliers_params,
+// projected points. These will be tightened later. Each sampled pixel
+// is read once, with both its point and error.
+double estim_max_tri_error_and_proj_box(Options const& opt,
+                                        ImageViewRef<Vector4> const& point_and_error,
+                                        GeoReference const& georef, double avg_lon,
                                         BBox3 & estim_proj_box) {
 
   // Initialize the outputs
@@ -1223,26 +1887,38 @@ double estim_max_tri_error_and_proj_box(ImageViewRef<Vector3> const& proj_points
   for (int attempt = 8; attempt <= 18; attempt++){
     
     double sample = (1 << attempt);
-    int32 subsample_amt = int32(norm_2(Vector2(error_image.cols(), error_image.rows()))/sample);
+    int32 subsample_amt = int32(norm_2(Vector2(point_and_error.cols(),
+                                               point_and_error.rows()))/sample);
     if (subsample_amt < 1 )
       subsample_amt = 1;
     
     Stopwatch sw2;
     sw2.start();
+    int num_cols = (point_and_error.cols() + subsample_amt - 1)/subsample_amt;
+    int num_rows = (point_and_error.rows() + subsample_amt - 1)/subsample_amt;
+    ImageView<Vector3> points(num_cols, num_rows);
     PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
-    for_each_pixel(subsample(error_image, subsample_amt),
-                   error_accum,
-                   TerminalProgressCallback
-                   ("asp","Bounding box and triangulation error range estimation: ") );
+    TerminalProgressCallback tpc("asp","Bounding box and triangulation error range estimation: ");
+    for (int row = 0; row < num_rows; row++) {
+      for (int col = 0; col < num_cols; col++) {
+        Vector4 p = point_and_error(col*subsample_amt, row*subsample_amt);
+        points(col, row) = subvector(p, 0, 3);
+        error_accum(p[3]);
+      }
+      tpc.report_fractional_progress(row + 1, num_rows);
+    }
+    tpc.report_finished();
+
     if (error_accum.size() > 0){
       success = true;
-      estim_max_error = error_accum.value(remove_outliers_params);
+      estim_max_error = error_accum.value(opt.remove_outliers_params);
     }
-    sw2.stop();
 
-    asp::estimate_points_bdbox(subsample(proj_points, subsample_amt),  
-                               remove_outliers_params,  
-                               estim_proj_box);
+    // The sampled points are in memory, so this is quick
+    ImageView<Vector3> proj_points
+      = project_cloud(opt, rotate_cloud(opt, points, false), georef, avg_lon, false);
+    asp::estimate_points_bdbox(proj_points, opt.remove_outliers_params, estim_proj_box);
+    sw2.stop();
     
     if (estim_proj_box.empty()) 
       success = false;
@@ -1323,24 +1999,21 @@ int main( int argc, char *argv[] ) {
                                                  asp::OrthoRasterizerView::max_subblock_size());
     
     // Apply an (optional) rotation to the 3D points before building the mesh.
-    if (opt.phi_rot != 0 || opt.omega_rot != 0 || opt.kappa_rot != 0) {
-      vw_out() << "\t--> Applying rotation sequence: " << opt.rot_order
-               << "      Angles: " << opt.phi_rot << "   "
-               << opt.omega_rot << "  " << opt.kappa_rot << "\n";
-      point_image = asp::point_transform
-        (point_image, math::euler_to_rotation_matrix(opt.phi_rot, opt.omega_rot,
-                                                     opt.kappa_rot, opt.rot_order));
-    }
+    point_image = rotate_cloud(opt, point_image, true);
 
-    // Set up the error image
-    ImageViewRef<double> error_image;
+    // Set up the error image, and the points together with their error,
+    // to sample them both in one pass
+    ImageViewRef<double>  error_image;
+    ImageViewRef<Vector4> point_and_error;
     if (opt.remove_outliers_with_pct || opt.max_valid_triangulation_error > 0.0){
       int num_channels = asp::num_channels(opt.pointcloud_files);
 
       if      (num_channels == 4) {
-        error_image = asp::error_norm<4>(opt.pointcloud_files);
+        error_image     = asp::error_norm<4>(opt.pointcloud_files);
+        point_and_error = asp::point_and_error_norm<4>(opt.pointcloud_files);
       } else if (num_channels == 6) {
-        error_image = asp::error_norm<6>(opt.pointcloud_files);
+        error_image     = asp::error_norm<6>(opt.pointcloud_files);
+        point_and_error = asp::point_and_error_norm<6>(opt.pointcloud_files);
       } else {
         vw_out() << "The point cloud files must have an equal number of channels which "
                  << "must be 4 or 6 to be able to remove outliers.\n";
@@ -1363,27 +2036,12 @@ int main( int argc, char *argv[] ) {
       output_georef.set_lon_center(avg_lon < 100);
 
     // Convert xyz points to projected points
-    // - The cartesian_to_geodetic call converts invalid (0,0,0,0) points to NaN,
-    //   which is checked for in the OrthoRasterizer class.
-    ImageViewRef<Vector3> proj_points;
-    if (opt.lon_offset != 0 || opt.lat_offset != 0 || opt.height_offset != 0) {
-      vw_out() << "\t--> Applying offset: " << opt.lon_offset
-               << " " << opt.lat_offset << " " << opt.height_offset << "\n";
-      proj_points
-        = geodetic_to_point         // GDC to XYZ
-        (asp::point_image_offset    // Add user coordinate offset
-         (asp::recenter_longitude   // XYZ to GDC, then normalize longitude
-          (cartesian_to_geodetic(point_image, output_georef), 
-           avg_lon),
-          Vector3(opt.lon_offset, opt.lat_offset, opt.height_offset)
-          ),
-         output_georef);
-    } else {
-      proj_points = geodetic_to_point(asp::recenter_longitude
-                                      (cartesian_to_geodetic(point_image, output_georef),
-                                       avg_lon),
-                                      output_georef);
-    }
+    ImageViewRef<Vector3> proj_points
+      = project_cloud(opt, point_image, output_georef, avg_lon, true);
+
+    // Find where the clouds changed, if updating an existing DEM
+    if (opt.update_dem != "")
+      opt.changed_proj_box = changed_clouds_proj_box(opt, output_georef, avg_lon);
 
     double estim_max_error = 0.0;
     BBox3 estim_proj_box;
@@ -1392,8 +2050,8 @@ int main( int argc, char *argv[] ) {
       if (error_image.cols() != point_image.cols() || error_image.rows() != point_image.rows()) 
         vw_throw(ArgumentErr() << "The error image and point image must have the same size.");
 
-      estim_max_error = estim_max_tri_error_and_proj_box(proj_points, error_image,
-                                                         opt.remove_outliers_params,
+      estim_max_error = estim_max_tri_error_and_proj_box(opt, point_and_error,
+                                                         output_georef, avg_lon,
                                                          estim_proj_box);
     }
 
@@ -1402,8 +2060,15 @@ int main( int argc, char *argv[] ) {
                                             estim_max_error, estim_proj_box);
     
     // Wipe the temporary files
-    for (int i = 0; i < (int)tmp_tifs.size(); i++)
-      if (fs::exists(tmp_tifs[i])) fs::remove(tmp_tifs[i]);
+    for (int i = 0; i < (int)tmp_tifs.size(); i++) {
+      if (boost::starts_with(tmp_tifs[i], "/vsimem/"))
+        VSIUnlink(tmp_tifs[i].c_str());
+      else if (fs::exists(tmp_tifs[i]))
+        fs::remove(tmp_tifs[i]);
+    }
+
+    if (asp::compressed_block_cache().enabled())
+      vw_out() << asp::compressed_block_cache().summary() << std::endl;
     
   } ASP_STANDARD_CATCHES;
 
@@ -29,8 +29,13 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+
 using namespace vw;
 namespace po = boost::program_options;
 
@@ -41,9 +46,11 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string pointcloud_file;
   std::string target_srs_string;
   bool compressed;
+  std::string sort_points;
+  int block_size;
   // Output
   std::string out_prefix;
-  Options() : compressed(false){}
+  Options() : compressed(false), block_size(0){}
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -59,7 +66,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
           "This is identical to the datum option.")
 
     ("t_srs", po::value(&opt.target_srs_string)->default_value(""),
-     "Specify a custom projection (PROJ.4 string).");
+     "Specify a custom projection (PROJ.4 string).")
+    ("sort-points", po::value(&opt.sort_points)->default_value("none"),
+     "How to order the points within each block of the cloud. Options: none (row by row), morton (along a Z-order curve in x and y), which gives downstream readers better spatial locality.")
+    ("block-size", po::value(&opt.block_size)->default_value(1024),
+     "The cloud is read and processed in square blocks of this size, in parallel, with a bounded number of blocks in memory at a time.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -94,6 +105,15 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.datum == "")
     opt.datum = opt.reference_spheroid;
 
+  boost::to_lower(opt.sort_points);
+  if (opt.sort_points != "none" && opt.sort_points != "morton")
+    vw_throw( ArgumentErr() << "Unknown value for --sort-points: " << opt.sort_points << ".\n"
+              << usage << general_options );
+
+  if (opt.block_size <= 0)
+    vw_throw( ArgumentErr() << "The block size must be positive.\n"
+              << usage << general_options );
+
   // Create the output directory
   vw::create_out_dir(opt.out_prefix);
 
@@ -102,10 +122,123 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 }
 
-int main( int argc, char *argv[] ) {
+/// Interleave the bits of two 32-bit integers, giving the position of
+/// a point along a Z-order (Morton) curve.
+boost::uint64_t morton_key(boost::uint32_t x, boost::uint32_t y) {
+  boost::uint64_t key = 0;
+  for (int bit = 0; bit < 32; bit++) {
+    key |= boost::uint64_t((x >> bit) & 1) << (2*bit);
+    key |= boost::uint64_t((y >> bit) & 1) << (2*bit + 1);
+  }
+  return key;
+}
+
+/// Read a block of the cloud and collect its valid points, optionally
+/// sorted along a Morton curve, and their bounding box. The points
+/// are quantized for sorting with the same offset and scale as in the
+/// LAS file.
+class LasBlockTask: public vw::Task, private boost::noncopyable {
+  ImageViewRef<Vector3> const& m_point_image;
+  BBox2i                       m_box;
+  bool                         m_is_geodetic;
+  bool                         m_sort;
+  Vector3                      m_offset, m_scale;
+  std::vector<Vector3>       & m_points;
+  BBox3                      & m_bbox;
+
+public:
+  LasBlockTask(ImageViewRef<Vector3> const& point_image, BBox2i const& box,
+               bool is_geodetic, bool sort, Vector3 const& offset, Vector3 const& scale,
+               std::vector<Vector3> & points, BBox3 & bbox):
+    m_point_image(point_image), m_box(box), m_is_geodetic(is_geodetic), m_sort(sort),
+    m_offset(offset), m_scale(scale), m_points(points), m_bbox(bbox) {}
+
+  virtual void operator()() {
+    ImageView<Vector3> block = crop(m_point_image, m_box);
+    m_points.clear();
+    for (int row = 0; row < block.rows(); row++) {
+      for (int col = 0; col < block.cols(); col++) {
+        Vector3 const& point = block(col, row);
+
+        // Skip no-data points
+        bool is_good = ( (!m_is_geodetic && point != vw::Vector3()) ||
+                         (m_is_geodetic  && !boost::math::isnan(point.z())) );
+        if (!is_good) continue;
+
+        m_points.push_back(point);
+        m_bbox.grow(point);
+      }
+    }
+
+    if (!m_sort)
+      return;
+
+    std::vector< std::pair<boost::uint64_t, size_t> > keys(m_points.size());
+    for (size_t i = 0; i < m_points.size(); i++) {
+      // Shift the signed LAS integers to be non-negative
+      double x = round((m_points[i][0] - m_offset[0])/m_scale[0]) + 2147483648.0;
+      double y = round((m_points[i][1] - m_offset[1])/m_scale[1]) + 2147483648.0;
+      x = std::max(0.0, std::min(x, 4294967295.0));
+      y = std::max(0.0, std::min(y, 4294967295.0));
+      keys[i] = std::make_pair(morton_key(boost::uint32_t(x), boost::uint32_t(y)), i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<Vector3> sorted(m_points.size());
+    for (size_t i = 0; i < keys.size(); i++)
+      sorted[i] = m_points[keys[i].second];
+    m_points.swap(sorted);
+  }
+};
 
-  // To do: need to understand what is the optimal strategy for
-  // traversing the input point cloud file to minimize the reading time.
+/// Process the blocks in batches, with each batch processed in
+/// parallel. If a writer is given, the points of each batch are
+/// written in block order before the next batch is read, so that the
+/// memory use is bounded. Return the bounding box of the valid points.
+BBox3 process_blocks(ImageViewRef<Vector3> const& point_image,
+                     std::vector<BBox2i> const& blocks, bool is_geodetic,
+                     bool sort, Vector3 const& offset, Vector3 const& scale,
+                     liblas::Header const* header, liblas::Writer * writer,
+                     int num_threads) {
+
+  BBox3 cloud_bbox;
+  size_t batch_size = 2*num_threads;
+  std::vector< std::vector<Vector3> > points(batch_size);
+  std::vector<BBox3> bboxes(batch_size);
+
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  for (size_t beg = 0; beg < blocks.size(); beg += batch_size) {
+    tpc.report_fractional_progress(beg, blocks.size());
+    size_t end = std::min(beg + batch_size, blocks.size());
+
+    FifoWorkQueue queue(num_threads);
+    for (size_t it = beg; it < end; it++) {
+      boost::shared_ptr<LasBlockTask>
+        task(new LasBlockTask(point_image, blocks[it], is_geodetic, sort, offset, scale,
+                              points[it - beg], bboxes[it - beg]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    for (size_t it = beg; it < end; it++) {
+      cloud_bbox.grow(bboxes[it - beg]);
+      bboxes[it - beg] = BBox3();
+      if (writer == NULL)
+        continue;
+      std::vector<Vector3> const& block_points = points[it - beg];
+      for (size_t i = 0; i < block_points.size(); i++) {
+        liblas::Point las_point(header);
+        las_point.SetCoordinates(block_points[i][0], block_points[i][1], block_points[i][2]);
+        writer->WritePoint(las_point);
+      }
+    }
+  }
+  tpc.report_finished();
+
+  return cloud_bbox;
+}
+
+int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
@@ -148,7 +281,14 @@ int main( int argc, char *argv[] ) {
       point_image = geodetic_to_point(asp::recenter_longitude(point_image, avg_lon), georef);
     }
 
-    BBox3 cloud_bbox = asp::pointcloud_bbox(point_image, is_geodetic);
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    std::vector<BBox2i> blocks = subdivide_bbox(point_image, opt.block_size, opt.block_size);
+
+    vw_out() << "Computing the point cloud bounding box.\n";
+    BBox3 cloud_bbox = process_blocks(point_image, blocks, is_geodetic, false,
+                                      Vector3(), Vector3(), NULL, NULL, num_threads);
 
     // The las format stores the values as 32 bit integers. So, for a
     // given point, we store round((point-offset)/scale), as well as
@@ -184,32 +324,8 @@ int main( int argc, char *argv[] ) {
     ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
-    TerminalProgressCallback tpc("asp", "\t--> ");
-    for (int row = 0; row < point_image.rows(); row++){
-      tpc.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
-
-        Vector3 point = point_image(col, row);
-
-        // Skip no-data points
-        bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
-                         (is_geodetic  && !boost::math::isnan(point.z())) );
-        if (!is_good) continue;
-
-#if 0
-        // For comparison later with las2txt.
-        std::cout.precision(16);
-        std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
-                  << point[2] << std::endl;
-#endif
-
-        liblas::Point las_point(&header);
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-        writer.WritePoint(las_point);
-
-      }
-    }
-    tpc.report_finished();
+    process_blocks(point_image, blocks, is_geodetic, opt.sort_points == "morton",
+                   offset, scale, &header, &writer, num_threads);
 
   } ASP_STANDARD_CATCHES;
 
@@ -97,36 +97,45 @@ inline bool is_valid_pt(Vector3 const& P) {
   return true;
 }
 
-// Add a given vertex to the .obj file unless already present
-inline void add_vertex(Vector3 const& V, std::pair<int, int> const& pix,
-                       int cloud_cols, int cloud_rows,
-                       std::ofstream & ofs,
-                       std::map<std::pair<int, int>, int> & pix_to_vertex,
-                       int & vertex_count) {
-  if (pix_to_vertex.find(pix) == pix_to_vertex.end()) {
-    ofs << "v " << V[0] << " " << V[1] << " " << V[2] << '\n';
-
-    double u = double(pix.first)/cloud_cols;
+// Add the vertex of a given pixel to the .obj file unless already
+// present, which is when its index is positive. Return the index.
+inline int add_vertex(Vector3 const& V, int col, int row,
+                      int cloud_cols, int cloud_rows,
+                      std::ofstream & ofs, int & index, int & vertex_count) {
+  if (index > 0)
+    return index;
+
+  ofs << "v " << V[0] << " " << V[1] << " " << V[2] << '\n';
+
+  double u = double(col)/cloud_cols;
     
-    // TODO(oalexan1). Study this. The second option looks more accurate.
-    // In the second option the lower-left pixel (0, cloud_rows - 1)
-    // gets mapped to (u, v) = (0, 0). This seems correct per:
-    // https://computergraphics.stackexchange.com/questions/9339/convert-image-pixel-dimensions-to-uv
-    // In some places on the net I even saw a subpixel shift of (0.5, 0.5)
-    // which makes things even more complicated.
+  // TODO(oalexan1). Study this. The second option looks more accurate.
+  // In the second option the lower-left pixel (0, cloud_rows - 1)
+  // gets mapped to (u, v) = (0, 0). This seems correct per:
+  // https://computergraphics.stackexchange.com/questions/9339/convert-image-pixel-dimensions-to-uv
+  // In some places on the net I even saw a subpixel shift of (0.5, 0.5)
+  // which makes things even more complicated.
 #if 0
-    double v = double(pix.second)/cloud_rows;
-    ofs << "vt " << u  << ' ' << 1.0 - v << std::endl;
+  double v = double(row)/cloud_rows;
+  ofs << "vt " << u  << ' ' << 1.0 - v << '\n';
 #else
-    double v = double(cloud_rows - 1 - pix.second)/cloud_rows;
-    ofs << "vt " << u  << ' ' << v << std::endl;
+  double v = double(cloud_rows - 1 - row)/cloud_rows;
+  ofs << "vt " << u  << ' ' << v << '\n';
 #endif
-    
-    pix_to_vertex[pix] = vertex_count;
-    vertex_count++;
-  }
+
+  index = vertex_count;
+  vertex_count++;
+  return index;
 }
 
+inline void add_face(std::ofstream & ofs, int a, int b, int c) {
+  ofs << "f " << a << "/" << a << " " << b << "/" << b << " " << c << "/" << c << '\n';
+}
+
+// The mesh is made in bands of rows, so that only a band of the cloud
+// and the vertex indices of two rows are in memory. The faces are
+// written to a temporary file, which is appended to the mesh at the
+// end, after all the vertices.
 void save_mesh(std::string const& output_prefix,
                std::string const& output_prefix_no_dir,
                ImageViewRef<Vector3> point_cloud,
@@ -138,72 +147,78 @@ void save_mesh(std::string const& output_prefix,
   ofs.precision(precision);
   ofs << "mtllib " << output_prefix_no_dir << ".mtl\n";
 
+  std::string faces_file = mesh_file + ".faces.tmp";
+  std::ofstream faces_ofs(faces_file.c_str());
+  if (!faces_ofs.good())
+    vw_throw(IOErr() << "Could not write: " << faces_file << "\n");
+
   // Some constants for the calculation in here
   int cloud_cols = point_cloud.cols();
   int cloud_rows = point_cloud.rows();
+  const int BAND_ROWS = 256;
   
-  TerminalProgressCallback vertex_progress("asp", "\tVertices:   ");
-  double vertex_progress_mult = 1.0/double(std::max(cloud_cols - 1, 1));
+  TerminalProgressCallback progress("asp", "\tMesh:   ");
+  double progress_mult = 1.0/double(std::max(cloud_rows - 1, 1));
 
-  // Make sure we we save a vertex only once even if we encounter it
-  // multiple times.
-  std::map<std::pair<int, int>, int> pix_to_vertex;
-    
-  std::vector<Vector3i> faces;
+  // The vertex indices of the pixels in the current row and the next
+  // one. Zero means that the vertex was not written yet.
+  std::vector<int> upper(cloud_cols, 0), lower(cloud_cols, 0);
+
+  ImageView<Vector3> band;
+  int band_start = 0;
   int vertex_count = 1; // The obj spec calls for the starting vertex to have index 1.
-  for (int col = 0; col < cloud_cols - 1; col++) {
-    vertex_progress.report_progress(col*vertex_progress_mult);
-    
-    for (int row = 0; row < cloud_rows - 1; row++) {
+  for (int row = 0; row < cloud_rows - 1; row++) {
+    progress.report_progress(row*progress_mult);
+
+    // Read the next band, which overlaps the previous one by a row
+    if (band.rows() == 0 || row + 1 >= band_start + band.rows()) {
+      band_start = row;
+      int num_rows = std::min(BAND_ROWS + 1, cloud_rows - row);
+      band = crop(point_cloud, BBox2i(0, row, cloud_cols, num_rows));
+    }
+    int r = row - band_start;
+
+    for (int col = 0; col < cloud_cols - 1; col++) {
       // We have a square that needs to be split into two triangles.
       // Here the image is viewed as having the origin on the upper-left,
       // the column axis going right, and the row axis going down.
-      std::pair<int, int> pix_ul = std::make_pair(col,     row);
-      std::pair<int, int> pix_ur = std::make_pair(col + 1, row);
-      std::pair<int, int> pix_ll = std::make_pair(col,     row + 1);
-      std::pair<int, int> pix_lr = std::make_pair(col + 1, row + 1);
-      Vector3 UL = point_cloud(pix_ul.first, pix_ul.second);
-      Vector3 UR = point_cloud(pix_ur.first, pix_ur.second);
-      Vector3 LL = point_cloud(pix_ll.first, pix_ll.second);
-      Vector3 LR = point_cloud(pix_lr.first, pix_lr.second);
+      Vector3 UL = band(col,     r);
+      Vector3 UR = band(col + 1, r);
+      Vector3 LL = band(col,     r + 1);
+      Vector3 LR = band(col + 1, r + 1);
 
       if (is_valid_pt(UL) && is_valid_pt(LL) && is_valid_pt(UR)) {
-
-        add_vertex(UL - C, pix_ul, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LL - C, pix_ll, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(UR - C, pix_ur, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-
-        Vector3 face(pix_to_vertex[pix_ul], pix_to_vertex[pix_ll], pix_to_vertex[pix_ur]);
-        faces.push_back(face);
+        int a = add_vertex(UL - C, col,     row,     cloud_cols, cloud_rows, ofs,
+                           upper[col],     vertex_count);
+        int b = add_vertex(LL - C, col,     row + 1, cloud_cols, cloud_rows, ofs,
+                           lower[col],     vertex_count);
+        int c = add_vertex(UR - C, col + 1, row,     cloud_cols, cloud_rows, ofs,
+                           upper[col + 1], vertex_count);
+        add_face(faces_ofs, a, b, c);
       }
       
       if (is_valid_pt(UR) && is_valid_pt(LL) && is_valid_pt(LR)) {
-
-        add_vertex(UR - C, pix_ur, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LL - C, pix_ll, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LR - C, pix_lr, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-
-        Vector3 face(pix_to_vertex[pix_ur], pix_to_vertex[pix_ll], pix_to_vertex[pix_lr]);
-        faces.push_back(face);
+        int a = add_vertex(UR - C, col + 1, row,     cloud_cols, cloud_rows, ofs,
+                           upper[col + 1], vertex_count);
+        int b = add_vertex(LL - C, col,     row + 1, cloud_cols, cloud_rows, ofs,
+                           lower[col],     vertex_count);
+        int c = add_vertex(LR - C, col + 1, row + 1, cloud_cols, cloud_rows, ofs,
+                           lower[col + 1], vertex_count);
+        add_face(faces_ofs, a, b, c);
       }
-      
     }
+
+    upper.swap(lower);
+    std::fill(lower.begin(), lower.end(), 0);
   }
-  vertex_progress.report_finished();
-
-  TerminalProgressCallback face_progress("asp", "\tFaces:   ");
-  double face_progress_mult = 1.0/double(std::max(faces.size(), size_t(1)));
-  for (size_t face_iter = 0; face_iter < faces.size(); face_iter++) {
-    face_progress.report_progress(face_iter*face_progress_mult);
-
-    Vector3 const& F = faces[face_iter]; // alias
-    ofs << "f "
-        << F[0] << "/" << F[0] << " "
-        << F[1] << "/" << F[1] << " "
-        << F[2] << "/" << F[2]
-        << std::endl;
-  }
-  face_progress.report_finished();
+  progress.report_finished();
+
+  faces_ofs.close();
+  std::ifstream faces_ifs(faces_file.c_str());
+  if (faces_ifs.peek() != std::ifstream::traits_type::eof())
+    ofs << faces_ifs.rdbuf();
+  faces_ifs.close();
+  boost::filesystem::remove(faces_file);
 }
 
 
@@ -80,8 +80,10 @@
 #include <vw/Image/InpaintView.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/FileUtils.h>
 #include <vw/Core/CmdUtils.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/IsisIO/IsisCameraModel.h>
@@ -90,6 +92,7 @@
 #include <asp/Camera/RPCModelGen.h>
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <atomic>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -108,6 +111,37 @@ namespace fs = boost::filesystem;
 int g_num_locks = 0;
 int g_warning_count = 0;
 int g_max_warning_count = 1000;
+
+// Counters and timings saved with --save-profile. The counters are
+// incremented from the solver threads, hence are atomic.
+struct SfsProfile {
+  bool enabled;
+  std::atomic<long long> num_projections, num_reused_projections, num_table_lookups;
+  double shadow_time, callback_time;
+  std::vector<std::string> levels; // one JSON object per level
+  SfsProfile(): enabled(false), num_projections(0), num_reused_projections(0),
+                num_table_lookups(0), shadow_time(0), callback_time(0) {}
+};
+SfsProfile g_profile;
+
+// Add the time until going out of scope to the given total
+struct ProfileTimer {
+  double & m_total;
+  vw::Stopwatch m_sw;
+  ProfileTimer(double & total): m_total(total) { m_sw.start(); }
+  ~ProfileTimer() { m_sw.stop(); m_total += m_sw.elapsed_seconds(); }
+};
+
+// The peak resident memory of this process, in KB, or -1 if unknown
+long long peak_memory_kb() {
+  std::ifstream ifs("/proc/self/status");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return atoll(line.substr(6).c_str());
+  }
+  return -1;
+}
 const size_t g_num_model_coeffs = 16;
 const size_t g_max_num_haze_coeffs = 6; // see nonlin_reflectance()
 
@@ -162,6 +196,106 @@ namespace vw { namespace camera {
     
   };
     
+  // The file in which to cache the tables of an approximate camera model.
+  // The key passed in identifies the camera, and the rest of the
+  // inputs the region and the grid of the table.
+  std::string approx_table_file(std::string const& cache_dir, std::string const& cache_key,
+                                GeoReference const& geo, BBox2 const& point_box,
+                                double gridx, double gridy, double mean_ht,
+                                int numx, int numy) {
+    if (cache_dir == "")
+      return "";
+    std::ostringstream os;
+    os.precision(17);
+    os << cache_key << "\n" << geo << "\n" << point_box << " " << gridx << " " << gridy
+       << " " << mean_ht << " " << numx << " " << numy;
+    return cache_dir + "/"
+      + asp::content_hash(std::vector<std::string>(), os.str()) + "-approx-table.bin";
+  }
+
+  // Save the tabulated values of an approximate camera model, together
+  // with the mean direction and the crop box found when computing them.
+  // Write to a temporary file first, so that concurrent runs never see
+  // a partial file.
+  void save_approx_table(std::string const& file,
+                         ImageView< PixelMask<Vector3> > const& pixel_to_vec_mat,
+                         ImageView< PixelMask<Vector2> > const& point_to_pix_mat,
+                         Vector3 const& mean_dir, BBox2 const& crop_box, int count) {
+
+    fs::create_directories(fs::path(file).parent_path());
+    std::string tmp_file = file + ".tmp";
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      int dims[3] = {pixel_to_vec_mat.cols(), pixel_to_vec_mat.rows(), count};
+      ofs.write((char*)dims, sizeof(dims));
+      double vals[7] = {mean_dir[0], mean_dir[1], mean_dir[2],
+                        crop_box.min().x(), crop_box.min().y(),
+                        crop_box.max().x(), crop_box.max().y()};
+      ofs.write((char*)vals, sizeof(vals));
+      for (int y = 0; y < pixel_to_vec_mat.rows(); y++) {
+        for (int x = 0; x < pixel_to_vec_mat.cols(); x++) {
+          PixelMask<Vector3> const& vec = pixel_to_vec_mat(x, y);
+          PixelMask<Vector2> const& pix = point_to_pix_mat(x, y);
+          char valid = is_valid(vec) && is_valid(pix);
+          double cell[5] = {vec.child()[0], vec.child()[1], vec.child()[2],
+                            pix.child()[0], pix.child()[1]};
+          ofs.write(&valid, sizeof(valid));
+          ofs.write((char*)cell, sizeof(cell));
+        }
+      }
+      if (!ofs.good()) {
+        vw_out(WarningMessage) << "Could not write: " << tmp_file << "\n";
+        return;
+      }
+    }
+    fs::rename(tmp_file, file);
+  }
+
+  // Load the tables saved with save_approx_table(). The tables must be
+  // already allocated. Return false if the file is missing or does not
+  // match their dimensions.
+  bool load_approx_table(std::string const& file,
+                         ImageView< PixelMask<Vector3> > & pixel_to_vec_mat,
+                         ImageView< PixelMask<Vector2> > & point_to_pix_mat,
+                         Vector3 & mean_dir, BBox2 & crop_box, int & count) {
+
+    if (file == "" || !fs::exists(file))
+      return false;
+
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    int dims[3];
+    double vals[7];
+    ifs.read((char*)dims, sizeof(dims));
+    ifs.read((char*)vals, sizeof(vals));
+    if (!ifs.good() || dims[0] != pixel_to_vec_mat.cols() || dims[1] != pixel_to_vec_mat.rows())
+      return false;
+
+    for (int y = 0; y < pixel_to_vec_mat.rows(); y++) {
+      for (int x = 0; x < pixel_to_vec_mat.cols(); x++) {
+        char valid;
+        double cell[5];
+        ifs.read(&valid, sizeof(valid));
+        ifs.read((char*)cell, sizeof(cell));
+        pixel_to_vec_mat(x, y) = Vector3(cell[0], cell[1], cell[2]);
+        point_to_pix_mat(x, y) = Vector2(cell[3], cell[4]);
+        if (valid) {
+          pixel_to_vec_mat(x, y).validate();
+          point_to_pix_mat(x, y).validate();
+        } else {
+          pixel_to_vec_mat(x, y).invalidate();
+          point_to_pix_mat(x, y).invalidate();
+        }
+      }
+    }
+    if (!ifs.good())
+      return false;
+
+    count    = dims[2];
+    mean_dir = Vector3(vals[0], vals[1], vals[2]);
+    crop_box = BBox2(Vector2(vals[3], vals[4]), Vector2(vals[5], vals[6]));
+    return true;
+  }
+  
   // This class provides an approximation for the point_to_pixel()
   // function of an ISIS camera around a current DEM. The algorithm
   // works by tabulation of point_to_pixel and pixel_to_vector values
@@ -445,7 +579,9 @@ namespace vw { namespace camera {
                       double nodata_val,
                       bool use_rpc_approximation, bool use_semi_approx,
                       double rpc_penalty_weight,
-                      vw::Mutex &camera_mutex):
+                      vw::Mutex &camera_mutex,
+                      std::string const& cache_dir = "",
+                      std::string const& cache_key = ""):
       ApproxBaseCameraModel(exact_adjusted_camera, exact_unadjusted_camera, img_bbox),
       m_geo(geo),
       m_use_rpc_approximation(use_rpc_approximation),
@@ -557,14 +693,31 @@ namespace vw { namespace camera {
         }
       }
       
-      // Fill in the table. Find along the way the mean direction from
-      // the camera to the ground. Invalid values will be masked.
+      // Fill in the table, unless computed in an earlier run. Find along
+      // the way the mean direction from the camera to the ground.
+      // Invalid values will be masked.
       m_count = 0;
       m_mean_dir = Vector3();
-      comp_entries_in_table();
-      m_mean_dir /= std::max(1, m_count);
-      m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
+      std::string table_file
+        = approx_table_file(cache_dir, cache_key, m_geo, m_point_box, m_approx_table_gridx,
+                            m_approx_table_gridy, m_mean_ht, numx, numy);
+      if (load_approx_table(table_file, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                            m_mean_dir, m_crop_box, m_count)) {
+        vw_out() << "Loaded the approximate camera table: " << table_file << "\n";
+      } else {
+        comp_entries_in_table();
+        m_mean_dir /= std::max(1, m_count);
+        m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
+        if (table_file != "") 
+          save_approx_table(table_file, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                            m_mean_dir, m_crop_box, m_count);
+      }
       m_compute_mean = false; // done computing the mean
+
+      // The table covers its whole range, so it will not grow. Then
+      // lookups need no lock, unless falling back to the exact camera.
+      m_stop_growing_range = (m_begX == 0 && m_begY == 0 &&
+                              m_endX == numx - 1 && m_endY == numy - 1);
       
       // Ensure the box is valid
       //if (m_crop_box.empty()) m_crop_box = BBox2(0, 0, 2, 2);
@@ -614,6 +767,9 @@ namespace vw { namespace camera {
         = interpolate(m_point_to_pix_mat, BilinearInterpolation(),
                       ConstantEdgeExtension());
 
+      if (g_profile.enabled)
+        g_profile.num_table_lookups++;
+      
       Vector3 dir = m_mean_dir;
       Vector2 pix;
       double major_radius = m_geo.datum().semi_major_axis() + m_mean_ht;
@@ -882,7 +1038,9 @@ namespace vw { namespace camera {
                               ImageView<double> const& dem,
                               GeoReference const& geo,
                               double nodata_val,
-                              vw::Mutex &camera_mutex):
+                              vw::Mutex &camera_mutex,
+                              std::string const& cache_dir = "",
+                              std::string const& cache_key = ""):
       ApproxBaseCameraModel(exact_adjusted_camera, exact_unadjusted_camera, img_bbox),
       m_geo(geo), m_camera_mutex(camera_mutex) {
 
@@ -958,13 +1116,25 @@ namespace vw { namespace camera {
         }
       }
       
-      // Fill in the table. Find along the way the mean direction from
-      // the camera to the ground. Invalid values will be masked.
+      // Fill in the table, unless computed in an earlier run. Find along
+      // the way the mean direction from the camera to the ground.
+      // Invalid values will be masked.
       m_count = 0;
       m_mean_dir = Vector3();
-      comp_entries_in_table();
-      m_mean_dir /= std::max(1, m_count);
-      m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
+      std::string table_file
+        = approx_table_file(cache_dir, cache_key, m_geo, m_point_box, m_approx_table_gridx,
+                            m_approx_table_gridy, m_mean_ht, numx, numy);
+      if (load_approx_table(table_file, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                            m_mean_dir, m_crop_box, m_count)) {
+        vw_out() << "Loaded the approximate camera table: " << table_file << "\n";
+      } else {
+        comp_entries_in_table();
+        m_mean_dir /= std::max(1, m_count);
+        m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
+        if (table_file != "") 
+          save_approx_table(table_file, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                            m_mean_dir, m_crop_box, m_count);
+      }
       
       m_crop_box.crop(m_img_bbox);
 
@@ -987,6 +1157,9 @@ namespace vw { namespace camera {
         = interpolate(m_point_to_pix_mat, BilinearInterpolation(),
                       ConstantEdgeExtension());
 
+      if (g_profile.enabled)
+        g_profile.num_table_lookups++;
+      
       Vector3 dir = m_mean_dir;
       Vector2 pix;
       double major_radius = m_geo.datum().semi_major_axis() + m_mean_ht;
@@ -1142,6 +1315,44 @@ void compute_image_stats(ImageT const& I1, ImageT const& I2,
 
 }
 
+// Find the exposure, and optionally the haze, which best fit
+// intensity = albedo * (exposure * reflectance + haze) in the least
+// squares sense, where both images are valid. That is the model with
+// one haze coefficient, and the same cost as the sfs intensity term,
+// so this is a quick, closed-form estimate of these, with the DEM
+// fixed. Without haze, it is set to 0. Return false if it cannot be
+// found.
+template <class ImageT>
+bool fit_exposure_and_haze(ImageT const& intensity, ImageT const& reflectance,
+                           double albedo, bool fit_haze,
+                           double & exposure, double & haze) {
+
+  if (intensity.cols() != reflectance.cols() || intensity.rows() != reflectance.rows()) 
+    vw_throw(ArgumentErr() << "Expecting two input images of same size.\n");
+
+  exposure = 0; haze = 0;
+  double n = 0, sr = 0, si = 0, srr = 0, sri = 0;
+  for (int col = 0; col < intensity.cols(); col++){
+    for (int row = 0; row < intensity.rows(); row++){
+      if (!is_valid(intensity(col, row)) || !is_valid(reflectance(col, row))) continue;
+      double r = reflectance(col, row), i = intensity(col, row)/albedo;
+      n++; sr += r; si += i; srr += r*r; sri += r*i;
+    }
+  }
+
+  if (fit_haze) {
+    double det = n*srr - sr*sr;
+    if (n < 2 || det <= 0) return false;
+    exposure = (n*sri - sr*si)/det;
+    haze     = (si - exposure*sr)/n;
+  } else {
+    if (srr <= 0) return false;
+    exposure = sri/srr;
+  }
+  
+  return true;
+}
+
 // Find the points on a given DEM that are shadowed by other points of
 // the DEM.  Start marching from the point on the DEM on a ray towards
 // the sun in small increments, until hitting the maximum DEM height.
@@ -1207,26 +1418,111 @@ bool isInShadow(int col, int row, Vector3 & sunPos,
   return false;
 }
 
-void areInShadow(Vector3 & sunPos, ImageView<double> const& dem,
+// Find all points of a DEM that are shadowed by other points of the
+// DEM, with one sweep towards the sun, rather than marching a ray from
+// each point as isInShadow() does. The DEM is split into lines of pixels
+// along the direction of the sun at the DEM center, one pixel per column
+// (or row). The lines are traversed starting from the sun side, while
+// keeping for each line the upper convex hull of the points so far.
+// A point is in shadow if the steepest slope from it to that hull is
+// above the sun elevation. Along a line, the heights are lowered by
+// s^2/(2R), with s the distance along the line and R the planet
+// radius, which accounts for the curvature. This takes time linear in
+// the number of pixels.
+void areInShadow(Vector3 const& sunPos, ImageView<double> const& dem,
                  double gridx, double gridy,
                  cartography::GeoReference const& geo,
                  ImageView<float> & shadow){
 
-  // Find the max DEM height
-  double max_dem_height = -std::numeric_limits<double>::max();
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      if (dem(col, row) > max_dem_height) {
-        max_dem_height = dem(col, row);
+  int cols = dem.cols(), rows = dem.rows();
+  shadow.set_size(cols, rows);
+  fill(shadow, 0);
+  if (cols <= 0 || rows <= 0)
+    return;
+
+  // The xyz position of the DEM center
+  int ctr_col = (cols - 1)/2, ctr_row = (rows - 1)/2;
+  Vector2 ctr_pix(ctr_col, ctr_row);
+  Vector2 ctr_llh = geo.pixel_to_lonlat(ctr_pix);
+  Vector3 ctr_xyz = geo.datum().geodetic_to_cartesian
+    (Vector3(ctr_llh[0], ctr_llh[1], dem(ctr_col, ctr_row)));
+  double radius = norm_2(ctr_xyz);
+
+  // The direction of the sun in pixels, found at the DEM center, by
+  // moving a few grid points along the horizontal component of the ray
+  Vector3 dir = sunPos - ctr_xyz;
+  if (dir == Vector3())
+    return;
+  dir = dir/norm_2(dir);
+  Vector3 dir2 = dir - dot_prod(dir, ctr_xyz)*ctr_xyz/dot_prod(ctr_xyz, ctr_xyz);
+  if (norm_2(dir2) < 1e-12)
+    return; // the sun is at zenith
+  Vector3 ahead_xyz = ctr_xyz + 10.0*std::min(gridx, gridy)*dir2/norm_2(dir2);
+  Vector3 ahead_llh = geo.datum().cartesian_to_geodetic(ahead_xyz);
+  ahead_llh[0] += 360.0*round((ctr_llh[0] - ahead_llh[0])/360.0);
+  Vector2 sun_pix = geo.lonlat_to_pixel(Vector2(ahead_llh[0], ahead_llh[1])) - ctr_pix;
+  if (norm_2(sun_pix) < 1e-12)
+    return;
+
+  // The unit direction towards the sun, in meters along the DEM grid
+  Vector2 sun_dir(sun_pix[0]*gridx, sun_pix[1]*gridy);
+  sun_dir = sun_dir/norm_2(sun_dir);
+
+  // Traverse the DEM along the major axis of the sun direction, one
+  // pixel per line for each major index, starting from the sun side
+  bool col_major = (std::abs(sun_pix[0]) >= std::abs(sun_pix[1]));
+  int num_major = col_major ? cols : rows;
+  int num_minor = col_major ? rows : cols;
+  double d_major = col_major ? sun_pix[0] : sun_pix[1];
+  double d_minor = col_major ? sun_pix[1] : sun_pix[0];
+  double slope = d_minor/d_major;
+  int beg = (d_major > 0) ? num_major - 1 : 0;
+  int step = (d_major > 0) ? -1 : 1;
+
+  // A pixel with minor index j at major index i is on the line with
+  // id round(j - i*slope).
+  int min_line = int(floor(std::min(0.0, -slope*(num_major - 1)))) - 1;
+  int max_line = int(ceil (std::max(0.0, -slope*(num_major - 1)))) + num_minor + 1;
+  std::vector< std::vector<Vector2> > hulls(max_line - min_line + 1);
+
+  for (int i = beg; i >= 0 && i < num_major; i += step) {
+    for (int j = 0; j < num_minor; j++) {
+
+      int col = col_major ? i : j;
+      int row = col_major ? j : i;
+      std::vector<Vector2> & hull = hulls[int(round(j - i*slope)) - min_line];
+
+      // The distance towards the sun and the lowered height
+      double s = (col - ctr_pix[0])*gridx*sun_dir[0] + (row - ctr_pix[1])*gridy*sun_dir[1];
+      Vector2 P(s, dem(col, row) - s*s/(2.0*radius));
+
+      // Remove the hull points below the segment from P to the next
+      // point. The last remaining point has the steepest slope from P.
+      while (hull.size() >= 2) {
+        Vector2 const& Q1 = hull[hull.size() - 1];
+        Vector2 const& Q2 = hull[hull.size() - 2];
+        if ((Q1[1] - P[1])*(Q2[0] - P[0]) > (Q2[1] - P[1])*(Q1[0] - P[0]))
+          break;
+        hull.pop_back();
       }
-    }
-  }
 
-  shadow.set_size(dem.cols(), dem.rows());
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      shadow(col, row) = isInShadow(col, row, sunPos, dem,
-                                    max_dem_height, gridx, gridy, geo);
+      if (!hull.empty() && hull.back()[0] > P[0]) {
+        
+        // The tangent of the sun elevation at this pixel
+        Vector2 llh = geo.pixel_to_lonlat(Vector2(col, row));
+        Vector3 xyz = geo.datum().geodetic_to_cartesian(Vector3(llh[0], llh[1], dem(col, row)));
+        Vector3 pdir = sunPos - xyz;
+        if (pdir != Vector3()) {
+          pdir = pdir/norm_2(pdir);
+          double up = dot_prod(pdir, xyz)/norm_2(xyz);
+          double horiz = norm_2(pdir - up*xyz/norm_2(xyz));
+          double max_slope = (hull.back()[1] - P[1])/(hull.back()[0] - P[0]);
+          if (horiz > 0 && max_slope > up/horiz - s/radius)
+            shadow(col, row) = 1;
+        }
+      }
+
+      hull.push_back(P);
     }
   }
 }
@@ -1235,7 +1531,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::string input_dems_str, out_prefix, stereo_session_string, bundle_adjust_prefix;
   std::vector<std::string> input_dems, input_images, input_cameras;
   std::string shadow_thresholds, custom_shadow_threshold_list, max_valid_image_vals, skip_images_str, image_exposure_prefix,
-    model_coeffs_prefix, model_coeffs, image_haze_prefix;
+    model_coeffs_prefix, model_coeffs, image_haze_prefix, approx_camera_cache_dir,
+    coarse_levels_cache_dir;
   std::vector<float> shadow_threshold_vec, max_valid_image_vals_vec;
   std::vector<double> image_exposures_vec;
   std::vector< std::vector<double> > image_haze_vec;
@@ -1250,7 +1547,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
     save_dem_with_nodata, use_approx_camera_models, use_approx_adjusted_camera_models,
     use_rpc_approximation, use_semi_approx,
     crop_input_images, float_dem_at_boundary, boundary_fix, fix_dem, 
-    float_reflectance_model, float_sun_position, query, save_sparingly, float_haze;
+    float_reflectance_model, float_sun_position, query, save_sparingly, float_haze,
+    save_profile;
   double smoothness_weight, integrability_weight, smoothness_weight_pq, init_dem_height, nodata_val,
     initial_dem_constraint_weight, albedo_constraint_weight, camera_position_step_size,
     rpc_penalty_weight, rpc_max_error, unreliable_intensity_threshold, robust_threshold, shadow_threshold;
@@ -1275,7 +1573,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
             crop_input_images(false), 
             float_dem_at_boundary(false), boundary_fix(false), fix_dem(false),
             float_reflectance_model(false), float_sun_position(false),
-            query(false), save_sparingly(false), float_haze(false),
+            query(false), save_sparingly(false), float_haze(false), save_profile(false),
             smoothness_weight(0), integrability_weight(0), smoothness_weight_pq(0),
             initial_dem_constraint_weight(0.0),
             albedo_constraint_weight(0.0),
@@ -2025,6 +2323,51 @@ void estimateHeightError(ImageView<double> const& dem,
   }
 }
 
+// Ceres evaluates each intensity residual many times when finding its
+// derivatives numerically, and most of the perturbations (of the
+// neighboring heights, albedo, exposure, and haze) change neither the
+// DEM point at the center nor the camera. So, keep in each thread the
+// grid positions and camera projection of the last residual, and
+// reuse them when these inputs are the same.
+struct ResidualCache {
+
+  // The grid positions of the current pixel and its four neighbors
+  cartography::GeoReference const* geo;
+  int col, row;
+  Vector2 lonlats[5];
+
+  // The camera projection of the center point
+  CameraModel const* camera_key;
+  double adjustments[6];
+  Vector3 base, camera_center;
+  Vector2 pix;
+  bool has_projection, projection_success;
+
+  ResidualCache(): geo(NULL), col(-1), row(-1), camera_key(NULL),
+                   has_projection(false), projection_success(false) {
+    for (int it = 0; it < 6; it++) adjustments[it] = 0.0;
+  }
+
+  // Invalidate the projection unless it was found for the same camera and
+  // camera adjustments. The adjustments may be NULL if they are not used.
+  void set_camera(CameraModel const* key, const double * adj) {
+    bool same = (key == camera_key);
+    for (int it = 0; it < 6; it++) {
+      double val = (adj == NULL) ? 0.0 : adj[it];
+      same = same && (adjustments[it] == val);
+      adjustments[it] = val;
+    }
+    camera_key = key;
+    if (!same)
+      has_projection = false;
+  }
+};
+
+ResidualCache & residual_cache() {
+  static thread_local ResidualCache cache;
+  return cache;
+}
+
 bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
                                     double bottom_h, double top_h,
                                     bool use_pq, double p, double q, // dem partial derivatives
@@ -2046,7 +2389,9 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
                                     double             & weight,
                                     const double       * reflectance_model_coeffs,
                                     SlopeErrEstim      * slopeErrEstim = NULL,
-                                    HeightErrEstim     * heightErrEstim = NULL) {
+                                    HeightErrEstim     * heightErrEstim = NULL,
+                                    ImageView<float> const* shadow_mask = NULL,
+                                    ResidualCache      * cache = NULL) {
 
   // Set output values
   reflectance = 0.0; reflectance.invalidate();
@@ -2066,35 +2411,32 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
     bottom_h = center_h - gridy*q;
   }
 
-  // The xyz position at the center grid point
-  Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
-  double h = center_h;
-  Vector3 lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 base = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the left grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col-1, row));
-  h = left_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 left = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the right grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col+1, row));
-  h = right_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 right = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the bottom grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col, row+1));
-  h = bottom_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 bottom = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the top grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col, row-1));
-  h = top_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 top = geo.datum().geodetic_to_cartesian(lonlat3);
+  // The lon-lat positions of the center, left, right, bottom, and top
+  // grid points
+  ResidualCache local_cache;
+  if (cache == NULL)
+    cache = &local_cache;
+  if (cache->geo != &geo || cache->col != col || cache->row != row) {
+    cache->lonlats[0] = geo.pixel_to_lonlat(Vector2(col,   row  ));
+    cache->lonlats[1] = geo.pixel_to_lonlat(Vector2(col-1, row  ));
+    cache->lonlats[2] = geo.pixel_to_lonlat(Vector2(col+1, row  ));
+    cache->lonlats[3] = geo.pixel_to_lonlat(Vector2(col,   row+1));
+    cache->lonlats[4] = geo.pixel_to_lonlat(Vector2(col,   row-1));
+    cache->geo = &geo; cache->col = col; cache->row = row;
+  }
+  Vector2 const* lonlats = cache->lonlats;
+
+  // The xyz positions at these points
+  Vector3 base   = geo.datum().geodetic_to_cartesian
+    (Vector3(lonlats[0][0], lonlats[0][1], center_h));
+  Vector3 left   = geo.datum().geodetic_to_cartesian
+    (Vector3(lonlats[1][0], lonlats[1][1], left_h));
+  Vector3 right  = geo.datum().geodetic_to_cartesian
+    (Vector3(lonlats[2][0], lonlats[2][1], right_h));
+  Vector3 bottom = geo.datum().geodetic_to_cartesian
+    (Vector3(lonlats[3][0], lonlats[3][1], bottom_h));
+  Vector3 top    = geo.datum().geodetic_to_cartesian
+    (Vector3(lonlats[4][0], lonlats[4][1], top_h));
 
   // four-point normal (centered)
   Vector3 dx = right - left;
@@ -2112,18 +2454,36 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   // is pixel-dependent for linescan cameras).
   Vector2 pix;
   Vector3 cameraPosition;
-  try {
-    pix = camera->point_to_pixel(base);
-    
-    // Need camera center only for Lunar Lambertian
-    if (global_params.reflectanceType != LAMBERT)
-      cameraPosition = camera->camera_center(pix);
-    
-  } catch(...){
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
-    return false;
+  if (cache->has_projection && cache->base == base) {
+    // Reuse the projection from the previous evaluation
+    if (g_profile.enabled)
+      g_profile.num_reused_projections++;
+    if (!cache->projection_success)
+      return false;
+    pix = cache->pix;
+    cameraPosition = cache->camera_center;
+  } else {
+    cache->base = base;
+    cache->has_projection = (cache != &local_cache);
+    cache->projection_success = false;
+    if (g_profile.enabled)
+      g_profile.num_projections++;
+    try {
+      pix = camera->point_to_pixel(base);
+      
+      // Need camera center only for Lunar Lambertian
+      if (global_params.reflectanceType != LAMBERT)
+        cameraPosition = camera->camera_center(pix);
+      
+    } catch(...){
+      reflectance = 0.0; reflectance.invalidate();
+      intensity   = 0.0; intensity.invalidate();
+      weight      = 0.0;
+      return false;
+    }
+    cache->pix = pix;
+    cache->camera_center = cameraPosition;
+    cache->projection_success = true;
   }
   
   double phase_angle = 0.0;
@@ -2168,9 +2528,13 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   }
 
   if (model_shadows) {
-    bool inShadow = isInShadow(col, row, local_model_params.sunPosition,
-                               dem, max_dem_height, gridx, gridy,
-                               geo);
+    bool inShadow = false;
+    if (shadow_mask != NULL)
+      inShadow = ((*shadow_mask)(col, row) > 0);
+    else
+      inShadow = isInShadow(col, row, local_model_params.sunPosition,
+                            dem, max_dem_height, gridx, gridy,
+                            geo);
 
     if (inShadow) {
       // The reflectance is valid, it is just zero
@@ -2260,6 +2624,16 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
     }
     vw_out() << "Maximum DEM height: " << max_dem_height << std::endl;
   }
+
+  // Find the shadows of the whole DEM at once
+  ImageView<float> shadow;
+  if (model_shadows) {
+    Vector3 sunPos;
+    for (int it = 0; it < 3; it++) 
+      sunPos[it] = scaled_sun_posn[it] * model_params.sunPosition[it]; 
+    ProfileTimer timer(g_profile.shadow_time);
+    areInShadow(sunPos, dem, gridx, gridy, geo, shadow);
+  }
   
   // Init the reflectance and intensity as invalid. Do it at all grid
   // points, not just where we sample, to ensure that these quantities
@@ -2297,7 +2671,8 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                      weight(col, row),
                                      reflectance_model_coeffs,
                                      slopeErrEstim,
-                                     heightErrEstim);
+                                     heightErrEstim,
+                                     model_shadows ? &shadow : NULL);
 
     }
   }
@@ -2343,6 +2718,23 @@ void save_exposures(std::string const& out_prefix,
   exf.close();
 }
 
+void save_haze(std::string const& out_prefix,
+               std::vector<std::string> const& input_images,
+               std::vector< std::vector<double> > const& haze){
+  std::string haze_file = haze_file_name(out_prefix);
+  vw_out() << "Writing: " << haze_file << std::endl;
+  std::ofstream hzf(haze_file.c_str());
+  hzf.precision(18);
+  for (size_t image_iter = 0; image_iter < haze.size(); image_iter++) {
+    hzf << input_images[image_iter];
+    for (size_t hiter = 0; hiter < haze[image_iter].size(); hiter++) {
+      hzf << " " << haze[image_iter][hiter];
+    }
+    hzf << "\n";
+  }
+  hzf.close();
+}
+
 // Pull the ISIS model from an adjusted IsisCameraModel or
 // ApproxCameraModel or ApproxAdjustedCameraModel
 boost::shared_ptr<CameraModel> get_isis_cam(Options const& opt,
@@ -2478,6 +2870,7 @@ public:
   virtual ceres::CallbackReturnType operator()
     (const ceres::IterationSummary& summary) {
 
+    ProfileTimer timer(g_profile.callback_time);
     g_iter++;
 
     vw_out() << "Finished iteration: " << g_iter << std::endl;
@@ -2486,20 +2879,8 @@ public:
     if (!g_opt->save_computed_intensity_only)
       save_exposures(g_opt->out_prefix, g_opt->input_images, *g_exposures);
 
-    if (g_opt->num_haze_coeffs > 0 && !g_opt->save_computed_intensity_only) {
-      std::string haze_file = haze_file_name(g_opt->out_prefix);
-      vw_out() << "Writing: " << haze_file << std::endl;
-      std::ofstream hzf(haze_file.c_str());
-      hzf.precision(18);
-      for (size_t image_iter = 0; image_iter < (*g_haze).size(); image_iter++) {
-        hzf << g_opt->input_images[image_iter];
-        for (size_t hiter = 0; hiter < (*g_haze)[image_iter].size(); hiter++) {
-          hzf << " " << (*g_haze)[image_iter][hiter];
-        }
-        hzf << "\n";
-      }
-      hzf.close();
-    }
+    if (g_opt->num_haze_coeffs > 0 && !g_opt->save_computed_intensity_only)
+      save_haze(g_opt->out_prefix, g_opt->input_images, *g_haze);
     
     std::string model_coeffs_file = model_coeffs_file_name(g_opt->out_prefix);
     if (!g_opt->save_computed_intensity_only) {
@@ -2877,6 +3258,11 @@ calc_intensity_residual(const F* const exposure,
     PixelMask<double> reflectance(0), intensity(0);
     double weight = 0;
 
+    // The projection can be reused only for the same camera adjustments
+    ResidualCache & cache = residual_cache();
+    cache.set_camera(m_camera.get(),
+                     g_opt->use_approx_adjusted_camera_models ? NULL : camera_adjustments);
+
     // Need to be careful not to access an array which does not exist
     G p = 0, q = 0;
     if (use_pq) {
@@ -2894,7 +3280,8 @@ calc_intensity_residual(const F* const exposure,
                                      m_model_params,  m_global_params,
                                      m_crop_box, m_image, m_blend_weight, camera,
                                      scaled_sun_posn,
-                                     reflectance, intensity, weight, reflectance_model_coeffs);
+                                     reflectance, intensity, weight, reflectance_model_coeffs,
+                                     NULL, NULL, NULL, &cache);
       
     if (g_opt->unreliable_intensity_threshold > 0){
       if (is_valid(intensity) && intensity.child() <= g_opt->unreliable_intensity_threshold &&
@@ -3394,6 +3781,10 @@ struct IntensityErrorPQ {
 // See https://en.wikipedia.org/wiki/Finite_difference
 // for the obtained formulas.
 
+// This and the other regularization terms below are linear in the
+// unknowns, so they use automatic differentiation, which gives exact
+// Jacobians in one evaluation, rather than numerical differentiation.
+
 struct SmoothnessError {
   SmoothnessError(double smoothness_weight, double gridx, double gridy):
     m_smoothness_weight(smoothness_weight),
@@ -3407,13 +3798,13 @@ struct SmoothnessError {
 
     // Normalize by grid size seems to make the functional less
     // sensitive to the actual grid size used.
-    residuals[0] = (left[0] + right[0] - 2*center[0])/m_gridx/m_gridx;   // u_xx
+    residuals[0] = (left[0] + right[0] - 2.0*center[0])/m_gridx/m_gridx; // u_xx
     residuals[1] = (br[0] + tl[0] - bl[0] - tr[0] )/4.0/m_gridx/m_gridy; // u_xy
     residuals[2] = residuals[1];                                         // u_yx
-    residuals[3] = (bottom[0] + top[0] - 2*center[0])/m_gridy/m_gridy;   // u_yy
+    residuals[3] = (bottom[0] + top[0] - 2.0*center[0])/m_gridy/m_gridy; // u_yy
     
     for (int i = 0; i < 4; i++)
-      residuals[i] *= m_smoothness_weight;
+      residuals[i] = m_smoothness_weight * residuals[i];
 
     return true;
   }
@@ -3422,8 +3813,8 @@ struct SmoothnessError {
   // the client code.
   static ceres::CostFunction* Create(double smoothness_weight,
                                      double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<SmoothnessError,
-            ceres::CENTRAL, 4, 1, 1, 1, 1, 1, 1, 1, 1, 1>
+    return (new ceres::AutoDiffCostFunction<SmoothnessError,
+            4, 1, 1, 1, 1, 1, 1, 1, 1, 1>
             (new SmoothnessError(smoothness_weight, gridx, gridy)));
   }
 
@@ -3447,7 +3838,7 @@ struct SmoothnessErrorPQ {
     residuals[3] = (top_pq[1] - bottom_pq[1])/(2*m_gridy);   // q_y
     
     for (int i = 0; i < 4; i++)
-      residuals[i] *= m_smoothness_weight_pq;
+      residuals[i] = m_smoothness_weight_pq * residuals[i];
 
     return true;
   }
@@ -3456,8 +3847,8 @@ struct SmoothnessErrorPQ {
   // the client code.
   static ceres::CostFunction* Create(double smoothness_weight_pq,
                                      double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<SmoothnessErrorPQ,
-            ceres::CENTRAL, 4, 2, 2, 2, 2>
+    return (new ceres::AutoDiffCostFunction<SmoothnessErrorPQ,
+            4, 2, 2, 2, 2>
             (new SmoothnessErrorPQ(smoothness_weight_pq, gridx, gridy)));
   }
 
@@ -3485,7 +3876,7 @@ struct IntegrabilityError {
     residuals[1] = (top[0] - bottom[0])/(2*m_gridy) - pq[1];
     
     for (int i = 0; i < 2; i++)
-      residuals[i] *= m_integrability_weight;
+      residuals[i] = m_integrability_weight * residuals[i];
     
     return true;
   }
@@ -3494,8 +3885,8 @@ struct IntegrabilityError {
   // the client code.
   static ceres::CostFunction* Create(double integrability_weight,
                                      double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<IntegrabilityError,
-            ceres::CENTRAL, 2, 1, 1, 1, 1, 2>
+    return (new ceres::AutoDiffCostFunction<IntegrabilityError,
+            2, 1, 1, 1, 1, 2>
             (new IntegrabilityError(integrability_weight, gridx, gridy)));
   }
 
@@ -3518,8 +3909,8 @@ struct HeightChangeError {
   // the client code.
   static ceres::CostFunction* Create(double orig_height,
                                      double initial_dem_constraint_weight){
-    return (new ceres::NumericDiffCostFunction<HeightChangeError,
-            ceres::CENTRAL, 1, 1>
+    return (new ceres::AutoDiffCostFunction<HeightChangeError,
+            1, 1>
             (new HeightChangeError(orig_height, initial_dem_constraint_weight)));
   }
 
@@ -3541,8 +3932,8 @@ struct AlbedoChangeError {
   // the client code.
   static ceres::CostFunction* Create(double initial_albedo,
                                      double albedo_constraint_weight){
-    return (new ceres::NumericDiffCostFunction<AlbedoChangeError,
-            ceres::CENTRAL, 1, 1>
+    return (new ceres::AutoDiffCostFunction<AlbedoChangeError,
+            1, 1>
             (new AlbedoChangeError(initial_albedo, albedo_constraint_weight)));
   }
 
@@ -3607,10 +3998,12 @@ void compute_grid_sizes_in_meters(ImageView<double> const& dem,
   if (!gridy_vec.empty()) gridy = gridy_vec[gridy_vec.size()/2];
 }
 
-ImageView<double> comp_blending_weights(MaskedImgT const& img,
-                                        double blending_dist,
-                                        double blending_power,
-                                        int min_blend_size){
+// The weights are returned as float, as they are kept in memory for
+// each image and DEM clip, and double precision is not needed.
+ImageView<float> comp_blending_weights(MaskedImgT const& img,
+                                       double blending_dist,
+                                       double blending_power,
+                                       int min_blend_size){
  
   //   if (img.cols() <= 2 || img.rows() <= 2) {
   //     // The image is too small to have good weights. grassfire crashes.
@@ -3636,9 +4029,51 @@ ImageView<double> comp_blending_weights(MaskedImgT const& img,
       weights(col, row) = pow( std::min(weights(col, row)/blending_dist, 1.0), blending_power );
     }
   }
-  return weights;
+  return pixel_cast<float>(weights);
 }
 
+// Crop an input image to the region needed, keep it in memory, mask
+// it, and find its blending weights. This uses no ISIS camera, so the
+// images can be processed in parallel. The reading is serialized, as
+// .cub files are read through the ISIS library.
+class CropImageTask: public Task, private boost::noncopyable {
+  Options    const& m_opt;
+  Mutex           & m_read_mutex;
+  std::string       m_img_file;
+  BBox2i            m_crop_box;
+  float             m_nodata_val, m_shadow_thresh, m_max_valid_val;
+  MaskedImgT      & m_masked_img;
+  DoubleImgT      & m_blend_weight;
+
+public:
+  CropImageTask(Options const& opt, Mutex & read_mutex,
+                std::string const& img_file, BBox2i const& crop_box,
+                float nodata_val, float shadow_thresh, float max_valid_val,
+                MaskedImgT & masked_img, DoubleImgT & blend_weight):
+    m_opt(opt), m_read_mutex(read_mutex), m_img_file(img_file), m_crop_box(crop_box),
+    m_nodata_val(nodata_val), m_shadow_thresh(shadow_thresh), m_max_valid_val(max_valid_val),
+    m_masked_img(masked_img), m_blend_weight(blend_weight) {}
+
+  void operator()() {
+    ImageView<float> cropped_img;
+    {
+      Mutex::Lock lock(m_read_mutex);
+      cropped_img = crop(DiskImageView<float>(m_img_file), m_crop_box);
+    }
+    m_masked_img = create_pixel_range_mask2(cropped_img,
+                                            std::max(m_nodata_val, m_shadow_thresh),
+                                            m_max_valid_val);
+
+    // Compute blending weights only when using an approx camera model and
+    // cropping the images. Otherwise the weights are too huge.
+    if (m_opt.blending_dist > 0)
+      m_blend_weight = pixel_cast<double>(comp_blending_weights(m_masked_img,
+                                                                m_opt.blending_dist,
+                                                                m_opt.blending_power,
+                                                                m_opt.min_blend_size));
+  }
+};
+
 void handle_arguments(int argc, char *argv[], Options& opt) {
   po::options_description general_options("");
   general_options.add_options()
@@ -3699,6 +4134,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Save a copy of the DEM while using a no-data value at a DEM grid point where all images show shadows. To be used if shadow thresholds are set.")
     ("use-approx-camera-models",   po::bool_switch(&opt.use_approx_camera_models)->default_value(false)->implicit_value(true),
      "Use approximate camera models for speed.")
+    ("approx-camera-cache-dir", po::value(&opt.approx_camera_cache_dir)->default_value(""),
+     "Save the tables of the approximate camera models in this directory, and reuse them in later runs with the same cameras, adjustments, and DEM region.")
     ("use-rpc-approximation",   po::bool_switch(&opt.use_rpc_approximation)->default_value(false)->implicit_value(true),
      "Use RPC approximations for the camera models instead of approximate tabulated camera models (invoke with --use-approx-camera-models).")
     ("rpc-penalty-weight", po::value(&opt.rpc_penalty_weight)->default_value(0.1),
@@ -3709,6 +4146,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "This is an undocumented experiment.")
     ("coarse-levels", po::value(&opt.coarse_levels)->default_value(0),
      "Solve the problem on a grid coarser than the original by a factor of 2 to this power, then refine the solution on finer grids.")
+    ("coarse-levels-cache-dir", po::value(&opt.coarse_levels_cache_dir)->default_value(""),
+     "Save the subsampled images and blending weights of the coarse levels in this directory, and reuse them in later runs with the same images and options.")
     ("max-coarse-iterations", po::value(&opt.max_coarse_iterations)->default_value(50),
      "How many iterations to do at levels of resolution coarser than the final result.")
     ("crop-input-images",   po::bool_switch(&opt.crop_input_images)->default_value(false)->implicit_value(true),
@@ -3751,6 +4190,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Print some info and exit. Invoked from parallel_sfs.")
     ("save-sparingly",   po::bool_switch(&opt.save_sparingly)->default_value(false)->implicit_value(true),
      "Avoid saving any results except the adjustments and the DEM, as that's a lot of files.")
+    ("save-profile",   po::bool_switch(&opt.save_profile)->default_value(false)->implicit_value(true),
+     "Save to <output prefix>-profile.json the solver time at each level, the time to evaluate each type of residuals, the camera and lookup table use, the shadow modeling and output time, and the peak memory use.")
     ("camera-position-step-size", po::value(&opt.camera_position_step_size)->default_value(1.0),
      "Larger step size will result in more aggressiveness in varying the camera position if it is being floated (which may result in a better solution or in divergence).");
 
@@ -4166,6 +4607,103 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   
 }
 
+// The file in the coarse levels cache for the subsampled image or
+// blending weight of the given image. The key has the image and all
+// options the masked image and the weight depend on.
+std::string coarse_level_file(Options const& opt, int image_iter, int level, double factor,
+                              BBox2i const& crop_box, float img_nodata_val,
+                              bool is_weight) {
+  std::ostringstream os;
+  os.precision(17);
+  os << asp::file_fingerprint(opt.input_images[image_iter]) << "\n"
+     << level << " " << factor << " " << crop_box << " " << opt.crop_input_images << " "
+     << img_nodata_val << " " << opt.shadow_threshold_vec[image_iter] << " "
+     << opt.max_valid_image_vals_vec[image_iter];
+  if (is_weight)
+    os << " " << opt.blending_dist << " " << opt.blending_power << " " << opt.min_blend_size;
+
+  fs::path image_path(opt.input_images[image_iter]);
+  return opt.coarse_levels_cache_dir + "/" + image_path.stem().string()
+    + (is_weight ? "-wt-" : "-") + asp::content_hash(std::vector<std::string>(), os.str())
+    + "-level" + vw::num_to_str(level) + ".tif";
+}
+
+// The residual blocks of each type, kept only with --save-profile
+typedef std::map<std::string, std::vector<ceres::ResidualBlockId> > ProfileBlocks;
+
+void record_block(ProfileBlocks & blocks, const char* type, ceres::ResidualBlockId id) {
+  if (g_profile.enabled)
+    blocks[type].push_back(id);
+}
+
+// Record a JSON object with the solver timings for this level, the
+// time of one evaluation of each type of residuals, with and without
+// the Jacobian, and the counters so far.
+void profile_level(ceres::Problem & problem, ProfileBlocks const& blocks,
+                   ceres::Solver::Summary const& summary, int num_threads) {
+
+  std::ostringstream os;
+  os.precision(8);
+  os << "    {\n"
+     << "      \"level\": " << g_level << ",\n"
+     << "      \"num_iterations\": " << summary.iterations.size() << ",\n"
+     << "      \"solver_time\": " << summary.total_time_in_seconds << ",\n"
+     << "      \"preprocessor_time\": " << summary.preprocessor_time_in_seconds << ",\n"
+     << "      \"residual_evaluation_time\": "
+     << summary.residual_evaluation_time_in_seconds << ",\n"
+     << "      \"jacobian_evaluation_time\": "
+     << summary.jacobian_evaluation_time_in_seconds << ",\n"
+     << "      \"linear_solver_time\": " << summary.linear_solver_time_in_seconds << ",\n"
+     << "      \"residuals\": {";
+
+  for (ProfileBlocks::const_iterator it = blocks.begin(); it != blocks.end(); it++) {
+    ceres::Problem::EvaluateOptions eval_options;
+    eval_options.residual_blocks = it->second;
+    eval_options.num_threads = num_threads;
+    double cost = 0.0;
+    std::vector<double> residuals;
+    ceres::CRSMatrix jacobian;
+    Stopwatch sw1, sw2;
+    sw1.start();
+    problem.Evaluate(eval_options, &cost, &residuals, NULL, NULL);
+    sw1.stop();
+    sw2.start();
+    problem.Evaluate(eval_options, &cost, &residuals, NULL, &jacobian);
+    sw2.stop();
+    os << (it == blocks.begin() ? "\n" : ",\n")
+       << "        \"" << it->first << "\": {\"count\": " << it->second.size()
+       << ", \"cost\": " << cost
+       << ", \"residual_time\": " << sw1.elapsed_seconds()
+       << ", \"residual_and_jacobian_time\": " << sw2.elapsed_seconds() << "}";
+  }
+  
+  os << "\n      },\n"
+     << "      \"camera_projections\": " << g_profile.num_projections << ",\n"
+     << "      \"reused_camera_projections\": " << g_profile.num_reused_projections << ",\n"
+     << "      \"approx_camera_table_lookups\": " << g_profile.num_table_lookups << ",\n"
+     << "      \"exact_camera_calls\": " << g_num_locks << ",\n"
+     << "      \"shadow_time\": " << g_profile.shadow_time << ",\n"
+     << "      \"callback_time\": " << g_profile.callback_time << ",\n"
+     << "      \"peak_memory_kb\": " << peak_memory_kb() << "\n"
+     << "    }";
+  g_profile.levels.push_back(os.str());
+}
+
+// Save the profile of all levels.
+void save_profile(std::string const& out_prefix, double total_time, int num_threads) {
+  std::string profile_file = out_prefix + "-profile.json";
+  vw_out() << "Writing: " << profile_file << std::endl;
+  std::ofstream ofs(profile_file.c_str());
+  ofs.precision(8);
+  ofs << "{\n"
+      << "  \"total_time\": " << total_time << ",\n"
+      << "  \"num_threads\": " << num_threads << ",\n"
+      << "  \"levels\": [";
+  for (size_t it = 0; it < g_profile.levels.size(); it++)
+    ofs << (it == 0 ? "\n" : ",\n") << g_profile.levels[it];
+  ofs << "\n  ]\n}\n";
+}
+
 // Run sfs at a given coarseness level
 void run_sfs_level(// Fixed inputs
                    int num_iterations, Options & opt,
@@ -4192,6 +4730,7 @@ void run_sfs_level(// Fixed inputs
   int num_images = opt.input_images.size();
   int num_dems   = dems.size();
   ceres::Problem problem;
+  ProfileBlocks blocks;
   
   // Find the grid sizes in meters. Note that dem heights are in
   // meters too, so we treat both horizontal and vertical measurements
@@ -4307,13 +4846,15 @@ void run_sfs_level(// Fixed inputs
                                                  blend_weights[dem_iter][image_iter],
                                                  &scaled_sun_posns[3*image_iter], // sun positions
                                                  cameras[dem_iter][image_iter]);
-            problem.AddResidualBlock(cost_function_img, loss_function_img,
-                                     &dems[dem_iter](col-1, row),  // left
-                                     &dems[dem_iter](col, row),    // center
-                                     &dems[dem_iter](col+1, row),  // right
-                                     &dems[dem_iter](col, row+1),  // bottom
-                                     &dems[dem_iter](col, row-1)  // top
-                                     );
+            ceres::ResidualBlockId img_id =
+              problem.AddResidualBlock(cost_function_img, loss_function_img,
+                                       &dems[dem_iter](col-1, row),  // left
+                                       &dems[dem_iter](col, row),    // center
+                                       &dems[dem_iter](col+1, row),  // right
+                                       &dems[dem_iter](col, row+1),  // bottom
+                                       &dems[dem_iter](col, row-1)  // top
+                                       );
+            record_block(blocks, "intensity", img_id);
             use_dem.insert(dem_iter); 
             
           }else if (opt.integrability_weight == 0){
@@ -4329,18 +4870,20 @@ void run_sfs_level(// Fixed inputs
                                      blend_weights[dem_iter][image_iter],
                                      &scaled_sun_posns[3*image_iter], // sun positions
                                      cameras[dem_iter][image_iter]);
-            problem.AddResidualBlock(cost_function_img, loss_function_img,
-                                     &exposures[image_iter],       // exposure
-                                     &haze[image_iter][0],         // haze
-                                     &dems[dem_iter](col-1, row),  // left
-                                     &dems[dem_iter](col, row),    // center
-                                     &dems[dem_iter](col+1, row),  // right
-                                     &dems[dem_iter](col, row+1),  // bottom
-                                     &dems[dem_iter](col, row-1),  // top
-                                     &albedos[dem_iter](col, row), // albedo
-                                     &adjustments[6*image_iter],   // camera
-                                     //&scaled_sun_posns[3*image_iter], // sun positions
-                                     &reflectance_model_coeffs[0]);
+            ceres::ResidualBlockId img_id =
+              problem.AddResidualBlock(cost_function_img, loss_function_img,
+                                       &exposures[image_iter],       // exposure
+                                       &haze[image_iter][0],         // haze
+                                       &dems[dem_iter](col-1, row),  // left
+                                       &dems[dem_iter](col, row),    // center
+                                       &dems[dem_iter](col+1, row),  // right
+                                       &dems[dem_iter](col, row+1),  // bottom
+                                       &dems[dem_iter](col, row-1),  // top
+                                       &albedos[dem_iter](col, row), // albedo
+                                       &adjustments[6*image_iter],   // camera
+                                       //&scaled_sun_posns[3*image_iter], // sun positions
+                                       &reflectance_model_coeffs[0]);
+            record_block(blocks, "intensity", img_id);
             use_dem.insert(dem_iter); 
             use_albedo.insert(dem_iter);
           } else {
@@ -4356,15 +4899,17 @@ void run_sfs_level(// Fixed inputs
                                        masked_images[dem_iter][image_iter],
                                        blend_weights[dem_iter][image_iter],
                                        cameras[dem_iter][image_iter]);
-            problem.AddResidualBlock(cost_function_img, loss_function_img,
-                                     &exposures[image_iter],          // exposure
-                                     &haze[image_iter][0],            // haze
-                                     &dems[dem_iter](col, row),       // center
-                                     &pq[dem_iter](col, row)[0],      // pq
-                                     &albedos[dem_iter](col, row),    // albedo
-                                     &adjustments[6*image_iter],      // camera
-                                     &scaled_sun_posns[3*image_iter],    // sun positions
-                                     &reflectance_model_coeffs[0]);   // reflectance 
+            ceres::ResidualBlockId img_id =
+              problem.AddResidualBlock(cost_function_img, loss_function_img,
+                                       &exposures[image_iter],          // exposure
+                                       &haze[image_iter][0],            // haze
+                                       &dems[dem_iter](col, row),       // center
+                                       &pq[dem_iter](col, row)[0],      // pq
+                                       &albedos[dem_iter](col, row),    // albedo
+                                       &adjustments[6*image_iter],      // camera
+                                       &scaled_sun_posns[3*image_iter],    // sun positions
+                                       &reflectance_model_coeffs[0]); // reflectance
+            record_block(blocks, "intensity", img_id);
             
             
             use_dem.insert(dem_iter); 
@@ -4381,37 +4926,43 @@ void run_sfs_level(// Fixed inputs
           ceres::LossFunction* loss_function_sm = NULL;
           ceres::CostFunction* cost_function_sm =
             SmoothnessError::Create(smoothness_weight, gridx, gridy);
-          problem.AddResidualBlock(cost_function_sm, loss_function_sm,
-                                   &dems[dem_iter](col-1, row+1),  // bottom left
-                                   &dems[dem_iter](col, row+1),    // bottom 
-                                   &dems[dem_iter](col+1, row+1),  // bottom right
-                                   &dems[dem_iter](col-1, row  ),  // left
-                                   &dems[dem_iter](col, row  ),    // center
-                                   &dems[dem_iter](col+1, row  ),  // right 
-                                   &dems[dem_iter](col-1, row-1),  // top left
-                                   &dems[dem_iter](col, row-1),    // top
-                                   &dems[dem_iter](col+1, row-1)); // top right
+          ceres::ResidualBlockId sm_id =
+            problem.AddResidualBlock(cost_function_sm, loss_function_sm,
+                                     &dems[dem_iter](col-1, row+1),  // bottom left
+                                     &dems[dem_iter](col, row+1),    // bottom 
+                                     &dems[dem_iter](col+1, row+1),  // bottom right
+                                     &dems[dem_iter](col-1, row  ),  // left
+                                     &dems[dem_iter](col, row  ),    // center
+                                     &dems[dem_iter](col+1, row  ),  // right 
+                                     &dems[dem_iter](col-1, row-1),  // top left
+                                     &dems[dem_iter](col, row-1),    // top
+                                     &dems[dem_iter](col+1, row-1)); // top right
+          record_block(blocks, "smoothness", sm_id);
           
           if (opt.integrability_weight > 0) {
             ceres::LossFunction* loss_function_int = NULL;
             ceres::CostFunction* cost_function_int =
               IntegrabilityError::Create(opt.integrability_weight, gridx, gridy);
-            problem.AddResidualBlock(cost_function_int, loss_function_int,
-                                     &dems[dem_iter](col,   row+1),   // bottom
-                                     &dems[dem_iter](col-1, row),     // left
-                                     &dems[dem_iter](col+1, row),     // right
-                                     &dems[dem_iter](col,   row-1),   // top
-                                     &pq[dem_iter]  (col,   row)[0]); // pq
+            ceres::ResidualBlockId int_id =
+              problem.AddResidualBlock(cost_function_int, loss_function_int,
+                                       &dems[dem_iter](col,   row+1),   // bottom
+                                       &dems[dem_iter](col-1, row),     // left
+                                       &dems[dem_iter](col+1, row),     // right
+                                       &dems[dem_iter](col,   row-1),   // top
+                                       &pq[dem_iter]  (col,   row)[0]); // pq
+            record_block(blocks, "integrability", int_id);
 
             if (opt.smoothness_weight_pq > 0) {
               ceres::LossFunction* loss_function_sm_pq = NULL;
               ceres::CostFunction* cost_function_sm_pq =
                 SmoothnessErrorPQ::Create(opt.smoothness_weight_pq, gridx, gridy);
-              problem.AddResidualBlock(cost_function_sm_pq, loss_function_sm_pq,
-                                       &pq[dem_iter](col, row+1)[0],  // bottom 
-                                       &pq[dem_iter](col-1, row)[0],  // left
-                                       &pq[dem_iter](col+1, row)[0],  // right 
-                                       &pq[dem_iter](col, row-1)[0]); // top
+              ceres::ResidualBlockId sm_pq_id =
+                problem.AddResidualBlock(cost_function_sm_pq, loss_function_sm_pq,
+                                         &pq[dem_iter](col, row+1)[0],  // bottom 
+                                         &pq[dem_iter](col-1, row)[0],  // left
+                                         &pq[dem_iter](col+1, row)[0],  // right 
+                                         &pq[dem_iter](col, row-1)[0]); // top
+              record_block(blocks, "smoothness_pq", sm_pq_id);
             }
           }
           
@@ -4423,8 +4974,10 @@ void run_sfs_level(// Fixed inputs
             ceres::CostFunction* cost_function_hc =
               HeightChangeError::Create(orig_dems[dem_iter](col, row),
                                         opt.initial_dem_constraint_weight);
-            problem.AddResidualBlock(cost_function_hc, loss_function_hc,
-                                     &dems[dem_iter](col, row));
+            ceres::ResidualBlockId hc_id =
+              problem.AddResidualBlock(cost_function_hc, loss_function_hc,
+                                       &dems[dem_iter](col, row));
+            record_block(blocks, "height_change", hc_id);
             use_dem.insert(dem_iter); 
           }
           
@@ -4434,8 +4987,10 @@ void run_sfs_level(// Fixed inputs
             ceres::CostFunction* cost_function_hc =
               AlbedoChangeError::Create(initial_albedo,
                                         opt.albedo_constraint_weight);
-            problem.AddResidualBlock(cost_function_hc, loss_function_hc,
-                                     &albedos[dem_iter](col, row));
+            ceres::ResidualBlockId ac_id =
+              problem.AddResidualBlock(cost_function_hc, loss_function_hc,
+                                       &albedos[dem_iter](col, row));
+            record_block(blocks, "albedo_change", ac_id);
             use_albedo.insert(dem_iter);
           }
         }
@@ -4595,6 +5150,9 @@ void run_sfs_level(// Fixed inputs
   
   vw_out() << summary.FullReport() << "\n" << std::endl;
 
+  if (g_profile.enabled)
+    profile_level(problem, blocks, summary, opt.num_threads);
+  
   // callTop();
 }
 
@@ -4779,6 +5337,7 @@ int main(int argc, char* argv[]) {
   g_opt = &opt;
   try {
     handle_arguments( argc, argv, opt );
+    g_profile.enabled = opt.save_profile;
 
     if (opt.compute_exposures_only && !opt.image_exposures_vec.empty()) {
       // TODO: This needs to be adjusted if haze is computed.
@@ -5092,6 +5651,20 @@ int main(int argc, char* argv[]) {
           BBox2i img_bbox = crop_boxes[0][dem_iter][image_iter];
           Stopwatch sw;
           sw.start();
+
+          // Identify the camera for the table cache. The table of the
+          // unadjusted camera does not depend on the adjustments.
+          std::ostringstream cache_key;
+          cache_key.precision(17);
+          cache_key << asp::file_fingerprint(opt.input_images[image_iter]) << "\n"
+                    << asp::file_fingerprint(opt.input_cameras[image_iter]) << "\n"
+                    << img_bbox << " " << opt.use_approx_camera_models;
+          if (opt.use_approx_adjusted_camera_models)
+            cache_key << "\n" << exact_adjusted_camera.translation()
+                      << " " << exact_adjusted_camera.rotation()
+                      << " " << exact_adjusted_camera.pixel_offset()
+                      << " " << exact_adjusted_camera.scale();
+          
           boost::shared_ptr<CameraModel> apcam;
           if (opt.use_approx_camera_models) {
             apcam = boost::shared_ptr<CameraModel>
@@ -5100,7 +5673,8 @@ int main(int argc, char* argv[]) {
                                      geos[0][dem_iter],
                                      dem_nodata_val, opt.use_rpc_approximation,
                                      opt.use_semi_approx,
-                                     opt.rpc_penalty_weight, camera_mutex));
+                                     opt.rpc_penalty_weight, camera_mutex,
+                                     opt.approx_camera_cache_dir, cache_key.str()));
             
             // Copy the adjustments over to the approximate camera model
             Vector3 translation  = exact_adjusted_camera.translation();
@@ -5115,7 +5689,8 @@ int main(int argc, char* argv[]) {
               (new ApproxAdjustedCameraModel(exact_adjusted_camera, exact_unadjusted_camera,
                                              img_bbox,
                                              dems[0][dem_iter], geos[0][dem_iter],
-                                             dem_nodata_val, camera_mutex));
+                                             dem_nodata_val, camera_mutex,
+                                             opt.approx_camera_cache_dir, cache_key.str()));
             // Adjustments are already baked into the adjusted
             // approximate cameras, that is why the logic as above to
             // reincorporate the adjustments is not needed.
@@ -5257,7 +5832,11 @@ int main(int argc, char* argv[]) {
       }
     }
     
+    // The cropping and blending weights are done in parallel, as they
+    // need no ISIS camera.
     float img_nodata_val = -std::numeric_limits<float>::max();
+    Mutex read_mutex;
+    FifoWorkQueue crop_queue(vw_settings().default_num_threads());
     for (int image_iter = 0; image_iter < num_images; image_iter++){
       for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
       
@@ -5265,32 +5844,29 @@ int main(int argc, char* argv[]) {
           continue;
        
         std::string img_file = opt.input_images[image_iter];
-        if (vw::read_nodata_val(img_file, img_nodata_val)){
-          //vw_out() << "Found image " << image_iter << " nodata value: "
-          //         << img_nodata_val << std::endl;
+        {
+          Mutex::Lock lock(read_mutex);
+          if (vw::read_nodata_val(img_file, img_nodata_val)){
+            //vw_out() << "Found image " << image_iter << " nodata value: "
+            //         << img_nodata_val << std::endl;
+          }
         }
         // Model the shadow threshold
         float shadow_thresh = opt.shadow_threshold_vec[image_iter];
         if (opt.crop_input_images) {
           // Make a copy in memory for faster access
           if (!crop_boxes[0][dem_iter][image_iter].empty()) {
-            ImageView<float> cropped_img = 
-              crop(DiskImageView<float>(img_file), crop_boxes[0][dem_iter][image_iter]);
-            masked_images_vec[0][dem_iter][image_iter]
-              = create_pixel_range_mask2(cropped_img,
-                                         std::max(img_nodata_val, shadow_thresh),
-                                         opt.max_valid_image_vals_vec[image_iter]
-                                         );
-            
-            // Compute blending weights only when using an approx camera model and
-            // cropping the images. Otherwise the weights are too huge.
-            if (opt.blending_dist > 0)
-              blend_weights_vec[0][dem_iter][image_iter]
-                = comp_blending_weights(masked_images_vec[0][dem_iter][image_iter],
-                                        opt.blending_dist, opt.blending_power,
-                                        opt.min_blend_size);
+            boost::shared_ptr<CropImageTask> task
+              (new CropImageTask(opt, read_mutex, img_file,
+                                 crop_boxes[0][dem_iter][image_iter],
+                                 img_nodata_val, shadow_thresh,
+                                 opt.max_valid_image_vals_vec[image_iter],
+                                 masked_images_vec[0][dem_iter][image_iter],
+                                 blend_weights_vec[0][dem_iter][image_iter]));
+            crop_queue.add_task(task);
           }
         }else{
+          Mutex::Lock lock(read_mutex);
           masked_images_vec[0][dem_iter][image_iter]
             = create_pixel_range_mask2(DiskImageView<float>(img_file),
                                        std::max(img_nodata_val, shadow_thresh),
@@ -5298,6 +5874,7 @@ int main(int argc, char* argv[]) {
         }
       }
     }
+    crop_queue.join_all();
     g_img_nodata_val = &img_nodata_val;
 
     // Get the sun and camera positions from the ISIS cube
@@ -5367,10 +5944,10 @@ int main(int argc, char* argv[]) {
     // skip. If the user provided initial exposures and haze, use those, but
     // still go through the motions to find the images to skip.
     vw_out() << "Computing exposures.\n";
-    std::vector<double> local_exposures_vec(num_images, 0);
+    std::vector<double> local_exposures_vec(num_images, 0), local_haze_vec(num_images, 0);
     for (int image_iter = 0; image_iter < num_images; image_iter++) {
       
-      std::vector<double> exposures_per_dem;
+      std::vector<double> exposures_per_dem, haze_per_dem;
       for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
         
         if (opt.skip_images[dem_iter].find(image_iter) !=
@@ -5396,20 +5973,26 @@ int main(int argc, char* argv[]) {
                                        reflectance, intensity, weight,
                                        &opt.model_coeffs_vec[0]);
         
-        // TODO: Below is not the optimal way of finding the exposure!
-        // Find it as the analytical minimum using calculus.
+        // The least squares fit of the exposure, and of the haze if modeled
         double imgmean, imgstdev, refmean, refstdev;
         compute_image_stats(intensity, reflectance, imgmean, imgstdev, refmean, refstdev);
-        double exposure = imgmean/refmean/initial_albedo;
+        double exposure = 0.0, haze = 0.0;
+        bool fit_haze = (opt.num_haze_coeffs > 0 && opt.image_haze_vec.empty());
+        bool is_fit = fit_exposure_and_haze(intensity, reflectance, initial_albedo, fit_haze,
+                                            exposure, haze);
         vw_out() << "img mean std: " << imgmean << ' ' << imgstdev << std::endl;
         vw_out() << "ref mean std: " << refmean << ' ' << refstdev << std::endl;
         vw_out() << "Local exposure for image " << image_iter << " and clip "
                  << dem_iter << ": " << exposure << std::endl;
+        if (fit_haze)
+          vw_out() << "Local haze for image " << image_iter << " and clip "
+                   << dem_iter << ": " << haze << std::endl;
     
         double big = 1e+100; // There's no way image exposure can be bigger than this
-        bool is_good = ( 0 < exposure && exposure < big );
+        bool is_good = ( is_fit && 0 < exposure && exposure < big );
         if (is_good) {
           exposures_per_dem.push_back(exposure);
+          haze_per_dem.push_back(haze);
         }else{
           // Skip images with bad exposure. Apparently there is no good
           // imagery in the area.
@@ -5424,6 +6007,8 @@ int main(int argc, char* argv[]) {
         std::sort(exposures_per_dem.begin(), exposures_per_dem.end());
         local_exposures_vec[image_iter] = 
           0.5*(exposures_per_dem[(len-1)/2] + exposures_per_dem[len/2]);
+        std::sort(haze_per_dem.begin(), haze_per_dem.end());
+        local_haze_vec[image_iter] = 0.5*(haze_per_dem[(len-1)/2] + haze_per_dem[len/2]);
         //vw_out() << "Median exposure for image " << image_iter << " on all clips: "
         //     << local_exposures_vec[image_iter] << std::endl;
       }
@@ -5438,7 +6023,8 @@ int main(int argc, char* argv[]) {
                << opt.image_exposures_vec[image_iter] << std::endl;
     }
 
-    // Initialize the haze as 0.
+    // Initialize the haze, unless supplied, with the additive term
+    // found above, and the other coefficients with 0.
     if ((!opt.image_haze_vec.empty()) && (int)opt.image_haze_vec.size() != num_images)
       vw_throw(ArgumentErr() << "Expecting as many haze values as images.\n");
     if (opt.image_haze_vec.empty()) {
@@ -5446,11 +6032,15 @@ int main(int argc, char* argv[]) {
         // Pad the haze vec
         std::vector<double> haze_vec;
         while (haze_vec.size() < g_max_num_haze_coeffs) haze_vec.push_back(0);
+        if (opt.num_haze_coeffs > 0)
+          haze_vec[0] = local_haze_vec[image_iter];
         opt.image_haze_vec.push_back(haze_vec);
       }
     }
     if (opt.compute_exposures_only){
       save_exposures(opt.out_prefix, opt.input_images, opt.image_exposures_vec);
+      if (opt.num_haze_coeffs > 0)
+        save_haze(opt.out_prefix, opt.input_images, opt.image_haze_vec);
       // all done
       return 0;
     }
@@ -5742,23 +6332,41 @@ int main(int argc, char* argv[]) {
           if (num_dems > 1)      os << "-clip"  << dem_iter;
           std::string sub_image = opt.out_prefix + "-"
             + image_path.stem().string() + os.str() + ".tif";
-          vw_out() << "Writing subsampled image: " << sub_image << "\n";
+
+          // With a cache, the file is written to a temporary name first, so
+          // that concurrent runs never see a partial file.
+          bool use_cache = (opt.coarse_levels_cache_dir != "");
+          if (use_cache) {
+            fs::create_directories(opt.coarse_levels_cache_dir);
+            sub_image = coarse_level_file(opt, image_iter, level, factors[level],
+                                          crop_boxes[0][dem_iter][image_iter],
+                                          img_nodata_val, false);
+          }
+          
           bool has_img_georef = false;
           GeoReference img_georef;
           bool has_img_nodata = true;
           int tile_size = 256;
           int sub_threads = 1;
           TerminalProgressCallback tpc("asp", ": ");
-          vw::cartography::block_write_gdal_image
-            (sub_image,
-             apply_mask
-             (block_rasterize
-              (vw::cache_tile_aware_render
-               (vw::resample_aa
-                (masked_images_vec[level-1][dem_iter][image_iter], sub_scale),
-                Vector2i(tile_size, tile_size) * sub_scale),
-               Vector2i(tile_size, tile_size), sub_threads), img_nodata_val),
-             has_img_georef, img_georef, has_img_nodata, img_nodata_val, opt, tpc);
+          if (use_cache && fs::exists(sub_image)) {
+            vw_out() << "Using the cached subsampled image: " << sub_image << "\n";
+          } else {
+            std::string out_image = use_cache ? sub_image + ".tmp.tif" : sub_image;
+            vw_out() << "Writing subsampled image: " << sub_image << "\n";
+            vw::cartography::block_write_gdal_image
+              (out_image,
+               apply_mask
+               (block_rasterize
+                (vw::cache_tile_aware_render
+                 (vw::resample_aa
+                  (masked_images_vec[level-1][dem_iter][image_iter], sub_scale),
+                  Vector2i(tile_size, tile_size) * sub_scale),
+                 Vector2i(tile_size, tile_size), sub_threads), img_nodata_val),
+               has_img_georef, img_georef, has_img_nodata, img_nodata_val, opt, tpc);
+            if (use_cache)
+              fs::rename(out_image, sub_image);
+          }
           
           // Read it right back
           if (opt.crop_input_images) {
@@ -5777,22 +6385,33 @@ int main(int argc, char* argv[]) {
             fs::path weight_path(opt.input_images[image_iter]);
             std::string sub_weight = opt.out_prefix + "-wt-"
               + weight_path.stem().string() + os.str() + ".tif";
-            vw_out() << "Writing subsampled weight: " << sub_weight << "\n";
-          
-            vw::cartography::block_write_gdal_image
-              (sub_weight,
-               apply_mask
-               (block_rasterize
-                (vw::cache_tile_aware_render
-                 (vw::resample_aa
-                  (create_mask(blend_weights_vec[level-1][dem_iter][image_iter],
-                               dem_nodata_val), sub_scale),
-                  Vector2i(tile_size,tile_size) * sub_scale),
-                 Vector2i(tile_size, tile_size), sub_threads), dem_nodata_val),
-               has_img_georef, img_georef, has_img_nodata, dem_nodata_val, opt, tpc);
-
-            ImageView<double> memory_weight = copy(DiskImageView<double>(sub_weight));
-            blend_weights_vec[level][dem_iter][image_iter] = memory_weight;
+            if (use_cache)
+              sub_weight = coarse_level_file(opt, image_iter, level, factors[level],
+                                             crop_boxes[0][dem_iter][image_iter],
+                                             img_nodata_val, true);
+
+            if (use_cache && fs::exists(sub_weight)) {
+              vw_out() << "Using the cached subsampled weight: " << sub_weight << "\n";
+            } else {
+              std::string out_weight = use_cache ? sub_weight + ".tmp.tif" : sub_weight;
+              vw_out() << "Writing subsampled weight: " << sub_weight << "\n";
+              vw::cartography::block_write_gdal_image
+                (out_weight,
+                 apply_mask
+                 (block_rasterize
+                  (vw::cache_tile_aware_render
+                   (vw::resample_aa
+                    (create_mask(blend_weights_vec[level-1][dem_iter][image_iter],
+                                 dem_nodata_val), sub_scale),
+                    Vector2i(tile_size,tile_size) * sub_scale),
+                   Vector2i(tile_size, tile_size), sub_threads), dem_nodata_val),
+                 has_img_georef, img_georef, has_img_nodata, dem_nodata_val, opt, tpc);
+              if (use_cache)
+                fs::rename(out_weight, sub_weight);
+            }
+
+            ImageView<float> memory_weight = copy(DiskImageView<float>(sub_weight));
+            blend_weights_vec[level][dem_iter][image_iter] = pixel_cast<double>(memory_weight);
           }
         
         }
@@ -5863,5 +6482,8 @@ int main(int argc, char* argv[]) {
 
   sw_total.stop();
   vw_out() << "Total elapsed time: " << sw_total.elapsed_seconds() << " s." << std::endl;
+
+  if (g_profile.enabled)
+    save_profile(opt.out_prefix, sw_total.elapsed_seconds(), opt.num_threads);
  
 }
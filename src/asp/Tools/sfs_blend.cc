@@ -74,26 +74,88 @@ struct Options: vw::cartography::GdalWriteOptions {
              shadow_blend_length(0.0), min_blend_size(0.0) {}
 };
 
-// The workhorse of this code, do the blending
+// The squared Euclidean distance transform of a sampled function along
+// a line, with the lower envelope of parabolas (Felzenszwalb and
+// Huttenlocher). Here f is 0 at the sites and a large value elsewhere.
+void dist_transform_1d(std::vector<double> const& f, std::vector<double> & d,
+                       std::vector<int> & v, std::vector<double> & z) {
+  int n = f.size();
+  d.resize(n); v.resize(n); z.resize(n + 1);
+  if (n == 0)
+    return;
+  int k = 0;
+  v[0] = 0;
+  z[0] = -std::numeric_limits<double>::max();
+  z[1] =  std::numeric_limits<double>::max();
+  for (int q = 1; q < n; q++) {
+    double s = ((f[q] + double(q)*q) - (f[v[k]] + double(v[k])*v[k])) / (2.0*q - 2.0*v[k]);
+    while (s <= z[k]) {
+      k--;
+      s = ((f[q] + double(q)*q) - (f[v[k]] + double(v[k])*v[k])) / (2.0*q - 2.0*v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = std::numeric_limits<double>::max();
+  }
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k+1] < q)
+      k++;
+    d[q] = double(q - v[k])*(q - v[k]) + f[v[k]];
+  }
+}
+
+// The Euclidean distance from each pixel to the nearest nonzero pixel
+// of the given mask. This is the same as searching for it in a circle
+// around each pixel, but takes linear time rather than time
+// proportional to the circle area.
+void dist_to_sites(ImageView<uint8> const& sites, ImageView<double> & dist) {
+  int cols = sites.cols(), rows = sites.rows();
+  double big = 1e+20; // much larger than any squared distance in a tile
+  dist.set_size(cols, rows);
+  std::vector<double> f, d, z;
+  std::vector<int> v;
+
+  // Along the columns, then along the rows
+  f.resize(rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++)
+      f[row] = sites(col, row) ? 0.0 : big;
+    dist_transform_1d(f, d, v, z);
+    for (int row = 0; row < rows; row++)
+      dist(col, row) = d[row];
+  }
+  f.resize(cols);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++)
+      f[col] = dist(col, row);
+    dist_transform_1d(f, d, v, z);
+    for (int col = 0; col < cols; col++)
+      dist(col, row) = sqrt(d[col]);
+  }
+}
+
+// The workhorse of this code, do the blending. Each pixel has the
+// blended DEM and the blending weight, so that both are found in one
+// pass.
 class SfsBlendView: public ImageViewBase<SfsBlendView>{
   
   ImageViewRef<float> m_sfs_dem, m_lola_dem, m_image_mosaic;
   float m_sfs_nodata, m_lola_nodata, m_weight_nodata;
   int m_extra;
-  bool m_save_weight;
   Options const& m_opt;
   
-  typedef float PixelT;
+  typedef Vector2f PixelT;
   
 public:
   SfsBlendView(ImageViewRef<float> sfs_dem, ImageViewRef<float> lola_dem,
                ImageViewRef<float> image_mosaic,
                float sfs_nodata, float lola_nodata, float weight_nodata, int extra,
-               bool save_weight, Options const& opt):
+               Options const& opt):
     m_sfs_dem(sfs_dem), m_lola_dem(lola_dem), m_image_mosaic(image_mosaic),
     m_sfs_nodata(sfs_nodata), m_lola_nodata(lola_nodata),
-    m_weight_nodata(weight_nodata), m_extra(extra),
-    m_save_weight(save_weight), m_opt(opt) {}
+    m_weight_nodata(weight_nodata), m_extra(extra), m_opt(opt) {}
 
   typedef PixelT pixel_type;
   typedef PixelT result_type;
@@ -118,16 +180,16 @@ public:
     biased_box.crop(bounding_box(m_sfs_dem));
 
     // Make crops in memory (from references)
-    ImageView<pixel_type> sfs_dem_crop = crop(m_sfs_dem, biased_box);
-    ImageView<pixel_type> lola_dem_crop = crop(m_lola_dem, biased_box);
-    ImageView<pixel_type> image_mosaic_crop = crop(m_image_mosaic, biased_box);
+    ImageView<float> sfs_dem_crop = crop(m_sfs_dem, biased_box);
+    ImageView<float> lola_dem_crop = crop(m_lola_dem, biased_box);
+    ImageView<float> image_mosaic_crop = crop(m_image_mosaic, biased_box);
 
     // The mask of lit pixels
-    ImageView< PixelMask<pixel_type> > mask = create_mask_less_or_equal(image_mosaic_crop,
-                                                                        m_opt.image_threshold);
+    ImageView< PixelMask<float> > mask = create_mask_less_or_equal(image_mosaic_crop,
+                                                                   m_opt.image_threshold);
     
     // The mask of unlit pixels
-    ImageView< PixelMask<pixel_type> > inv_mask = vw::copy(mask);
+    ImageView< PixelMask<float> > inv_mask = vw::copy(mask);
     for (int col = 0; col < inv_mask.cols(); col++) {
       for (int row = 0; row < inv_mask.rows(); row++) {
         if (is_valid(mask(col, row))) {
@@ -143,19 +205,28 @@ public:
     // The grassfire weight positive in the lit region, with zero at the light-shadow
     // boundary
     bool no_zero_at_border = true; // don't decrease the weights to zero at image border
-    ImageView<pixel_type> lit_grass_dist
+    ImageView<float> lit_grass_dist
       = vw::grassfire(vw::copy(vw::fill_holes_grass(mask, m_opt.min_blend_size)),
                       no_zero_at_border);
 
     // The grassfire weights positive in the shadow region, with zero at the light-shadow
     // boundary
-    ImageView<pixel_type> shadow_grass_dist = vw::grassfire(inv_mask, no_zero_at_border);
+    ImageView<float> shadow_grass_dist = vw::grassfire(inv_mask, no_zero_at_border);
 
     // Find the clamped signed distance to the boundary. Note that our
     // boundary is in fact two pixel wide at the light-shadow
     // interface, given how lit_grass_dist and shadow_grass_dist are
     // defined as the negation of each other. The boundary is the set
     // of pixels where both of these are <= 1.
+    ImageView<uint8> is_boundary(sfs_dem_crop.cols(), sfs_dem_crop.rows());
+    for (int col = 0; col < sfs_dem_crop.cols(); col++) {
+      for (int row = 0; row < sfs_dem_crop.rows(); row++)
+        is_boundary(col, row) = (lit_grass_dist(col, row) <= 1 &&
+                                 shadow_grass_dist(col, row) <= 1);
+    }
+    ImageView<double> bd_dist;
+    dist_to_sites(is_boundary, bd_dist);
+    
     ImageView<float> dist_to_bd;
     dist_to_bd.set_size(sfs_dem_crop.cols(), sfs_dem_crop.rows());
     for (int col = 0; col < sfs_dem_crop.cols(); col++) {
@@ -174,46 +245,16 @@ public:
           continue;
         }
         
-        // Find the shortest Euclidean distance to the no-data region.
-        double max_dist = std::max(m_opt.lit_blend_length, m_opt.shadow_blend_length);
+        // The shortest Euclidean distance to the boundary, clamped at the
+        // blending lengths
         double signed_dist = 0.0;
+        double curr_dist = bd_dist(col, row);
         if (lit_grass_dist(col, row) > 0) {
-          signed_dist = m_opt.lit_blend_length;
+          signed_dist = std::min(double(m_opt.lit_blend_length), curr_dist);
         } else if (shadow_grass_dist(col, row) > 0) {
-          signed_dist = -m_opt.shadow_blend_length;
-        }
-        
-        for (int col2 = std::max(0.0, col - max_dist);
-             col2 <= std::min(sfs_dem_crop.cols() - 1.0, col + max_dist);
-             col2++) {
-
-          // Estimate the range of rows for the circle with given radius
-          // at given col value.
-          double ht_val = ceil(sqrt(double(max_dist * max_dist) -
-                                    double((col - col2) * (col - col2))));
-          
-          for (int row2 = std::max(0.0, row - ht_val);
-               row2 <= std::min(sfs_dem_crop.rows() - 1.0, row + ht_val);
-               row2++) {
-
-            if (lit_grass_dist(col2, row2) > 1 || shadow_grass_dist(col2, row2) > 1) 
-              continue; // not at the boundary
-
-            // See if the current point is closer than anything so far
-            double curr_dist = sqrt( double(col - col2) * (col - col2) +
-                                     double(row - row2) * (row - row2) );
-            if (lit_grass_dist(col, row) > 0) {
-              if (curr_dist < signed_dist) 
-                signed_dist = curr_dist;
-            } else if (shadow_grass_dist(col, row) > 0) {
-              if (curr_dist < -signed_dist) 
-                signed_dist = -curr_dist;
-            }
-            
-          }
+          signed_dist = -std::min(double(m_opt.shadow_blend_length), curr_dist);
         }
 
-        // The closest we've got
         dist_to_bd(col, row) = signed_dist;
       }
     }
@@ -223,15 +264,12 @@ public:
       dist_to_bd = vw::gaussian_filter(dist_to_bd, m_opt.weight_blur_sigma);
 
     // Do the blending
-    ImageView<float> blended_dem;
+    ImageView<pixel_type> blended_dem;
     blended_dem.set_size(sfs_dem_crop.cols(), sfs_dem_crop.rows());
     for (int col = 0; col < sfs_dem_crop.cols(); col++) {
       for (int row = 0; row < sfs_dem_crop.rows(); row++) {
 
-        if (!m_save_weight)
-          blended_dem(col, row) = m_sfs_nodata;
-        else
-          blended_dem(col, row) = m_weight_nodata;
+        blended_dem(col, row) = pixel_type(m_sfs_nodata, m_weight_nodata);
           
         float weight = (dist_to_bd(col, row) + m_opt.shadow_blend_length) /
           (m_opt.shadow_blend_length + m_opt.lit_blend_length);
@@ -249,11 +287,9 @@ public:
         if (lola_dem_crop(col, row) == m_lola_nodata) 
           continue;
 
-        if (!m_save_weight) 
-          blended_dem(col, row)
-            = weight * sfs_dem_crop(col, row) + (1.0 - weight) * lola_dem_crop(col, row);
-        else
-          blended_dem(col, row) = weight;
+        blended_dem(col, row)
+          = pixel_type(weight * sfs_dem_crop(col, row) + (1.0 - weight) * lola_dem_crop(col, row),
+                       weight);
       }
     }
     
@@ -382,32 +418,33 @@ int main(int argc, char *argv[]) {
     int block_size = 256 + 2 * extra;
     block_size = 16*ceil(block_size/16.0); // internal constraint
 
-    vw_out() << "Writing: " << opt.output_dem << std::endl;
+    // Find the blended DEM and the weight in one pass, save them with
+    // big blocks to a temporary file, then split them into the outputs with
+    // the desired blocks.
+    std::string tmp_file
+      = fs::path(opt.output_dem).replace_extension(".tmp.tif").string();
+    vw_out() << "Writing: " << tmp_file << std::endl;
     bool has_georef = true, has_nodata = true;
     TerminalProgressCallback tpc("asp", ": ");
     float weight_nodata = -1.0;
-    bool save_weight = false;
-    asp::save_with_temp_big_blocks(block_size,
-                                   opt.output_dem,
-                                   SfsBlendView(sfs_dem, lola_dem, image_mosaic,
-                                                sfs_nodata, lola_nodata, weight_nodata,
-                                                extra, save_weight, opt),
-                                   has_georef, sfs_georef,
-                                   has_nodata, sfs_nodata, opt, tpc);
-
-    // Write the weight. Have to rerun the same logic due to ASP's limitations,
-    // it cannot write two large files at the same time.
-    vw_out() << "Writing the blending weight: "
-             << opt.output_weight << std::endl;
-    save_weight = true;
-    asp::save_with_temp_big_blocks(block_size,
-                                   opt.output_weight,
-                                   SfsBlendView(sfs_dem, lola_dem, image_mosaic,
-                                                sfs_nodata, lola_nodata, weight_nodata,
-                                                extra, save_weight, opt),
-                                   has_georef, sfs_georef,
-                                   has_nodata, weight_nodata, opt, tpc);
-    
+    bool tmp_has_nodata = false; // the two bands have different no-data values
+    Vector2 orig_block_size = opt.raster_tile_size;
+    opt.raster_tile_size = Vector2(block_size, block_size);
+    block_write_gdal_image(tmp_file,
+                           SfsBlendView(sfs_dem, lola_dem, image_mosaic,
+                                        sfs_nodata, lola_nodata, weight_nodata,
+                                        extra, opt),
+                           has_georef, sfs_georef, tmp_has_nodata, 0, opt, tpc);
+    opt.raster_tile_size = orig_block_size;
+
+    DiskImageView<Vector2f> blend(tmp_file);
+    vw_out() << "Writing: " << opt.output_dem << std::endl;
+    block_write_gdal_image(opt.output_dem, select_channel(blend, 0),
+                           has_georef, sfs_georef, has_nodata, sfs_nodata, opt, tpc);
+    vw_out() << "Writing the blending weight: " << opt.output_weight << std::endl;
+    block_write_gdal_image(opt.output_weight, select_channel(blend, 1),
+                           has_georef, sfs_georef, has_nodata, weight_nodata, opt, tpc);
+    fs::remove(tmp_file);
     
   } ASP_STANDARD_CATCHES;
 
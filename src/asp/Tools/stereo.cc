@@ -25,6 +25,7 @@
 #include <vw/Stereo/CorrelationView.h>
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
+#include <vw/Image/Algorithms2.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -825,4 +826,89 @@ namespace asp {
            has_tif_or_ntf_extension(opt.in_file2));
   } // End function skip_image_normalization
 
+  std::string disp_extents_file(std::string const& out_prefix) {
+    return out_prefix + "-D-extents.txt";
+  }
+
+  void compute_disp_extents(ImageView<PixelMask<Vector2f> > const& disp,
+                            DispExtents & extents) {
+    int cols = disp.cols(), rows = disp.rows();
+    extents.size = Vector2i(cols, rows);
+    extents.min_in_row.assign(rows, cols);
+    extents.max_in_row.assign(rows, 0);
+    extents.min_in_col.assign(cols, rows);
+    extents.max_in_col.assign(cols, 0);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        if (!is_valid(disp(col, row)))
+          continue;
+        extents.min_in_row[row] = std::min(extents.min_in_row[row], col);
+        extents.max_in_row[row] = std::max(extents.max_in_row[row], col);
+        extents.min_in_col[col] = std::min(extents.min_in_col[col], row);
+        extents.max_in_col[col] = std::max(extents.max_in_col[col], row);
+      }
+    }
+  }
+
+  void write_disp_extents(std::string const& file, DispExtents const& extents) {
+    vw_out() << "Writing: " << file << std::endl;
+    std::ofstream ofs(file.c_str());
+    ofs << extents.size[0] << " " << extents.size[1] << "\n";
+    for (int row = 0; row < extents.size[1]; row++)
+      ofs << extents.min_in_row[row] << " " << extents.max_in_row[row] << "\n";
+    for (int col = 0; col < extents.size[0]; col++)
+      ofs << extents.min_in_col[col] << " " << extents.max_in_col[col] << "\n";
+    ofs.close();
+    if (!ofs)
+      vw_throw(ArgumentErr() << "Could not write: " << file << "\n");
+  }
+
+  bool read_disp_extents(std::string const& file, DispExtents & extents) {
+    std::ifstream ifs(file.c_str());
+    int cols = 0, rows = 0;
+    if (!(ifs >> cols >> rows) || cols <= 0 || rows <= 0)
+      return false;
+    extents.size = Vector2i(cols, rows);
+    extents.min_in_row.resize(rows); extents.max_in_row.resize(rows);
+    extents.min_in_col.resize(cols); extents.max_in_col.resize(cols);
+    for (int row = 0; row < rows; row++)
+      ifs >> extents.min_in_row[row] >> extents.max_in_row[row];
+    for (int col = 0; col < cols; col++)
+      ifs >> extents.min_in_col[col] >> extents.max_in_col[col];
+    return bool(ifs);
+  }
+
+  void centerline_weights_from_extents(ImageView<PixelMask<Vector2f> > const& disp,
+                                       BBox2i const& roi, DispExtents const& extents,
+                                       ImageView<double> & weights) {
+
+    if (disp.cols() != roi.width() || disp.rows() != roi.height() ||
+        !BBox2i(0, 0, extents.size[0], extents.size[1]).contains(roi))
+      vw_throw(ArgumentErr() << "Inconsistent disparity extents.\n");
+
+    // As in centerline_weights()
+    int rows = extents.size[1], cols = extents.size[0];
+    std::vector<double> h_center(rows), h_max_dist(rows), v_center(cols), v_max_dist(cols);
+    for (int row = 0; row < rows; row++) {
+      h_center  [row] = (extents.min_in_row[row] + extents.max_in_row[row])/2.0;
+      h_max_dist[row] = std::max(extents.max_in_row[row] - extents.min_in_row[row], 0);
+    }
+    for (int col = 0; col < cols; col++) {
+      v_center  [col] = (extents.min_in_col[col] + extents.max_in_col[col])/2.0;
+      v_max_dist[col] = std::max(extents.max_in_col[col] - extents.min_in_col[col], 0);
+    }
+
+    weights.set_size(roi.width(), roi.height());
+    fill(weights, 0);
+    for (int row = 0; row < roi.height(); row++) {
+      for (int col = 0; col < roi.width(); col++) {
+        if (!is_valid(disp(col, row)))
+          continue;
+        Vector2 pix = roi.min() + Vector2(col, row);
+        weights(col, row) = compute_line_weights(pix, true,  h_center, h_max_dist)
+                          * compute_line_weights(pix, false, v_center, v_max_dist);
+      }
+    }
+  }
+
 } // end namespace asp
@@ -94,6 +94,32 @@ namespace asp {
 
   bool skip_image_normalization(ASPGlobalOptions const& opt);
 
+  /// The first and last valid column in each row, and the first and
+  /// last valid row in each column, of an SGM disparity tile. These are
+  /// all that is needed of a whole tile to find the centerline blending
+  /// weights in a part of it, so stereo_blend can read from a neighboring
+  /// tile just the collar band it needs.
+  struct DispExtents {
+    vw::Vector2i size;
+    std::vector<int> min_in_row, max_in_row, min_in_col, max_in_col;
+  };
+
+  /// The file where stereo_corr saves the extents of its disparity.
+  std::string disp_extents_file(std::string const& out_prefix);
+
+  void compute_disp_extents(vw::ImageView<vw::PixelMask<vw::Vector2f> > const& disp,
+                            DispExtents & extents);
+  void write_disp_extents(std::string const& file, DispExtents const& extents);
+
+  /// Returns false if the file is missing or is not valid.
+  bool read_disp_extents(std::string const& file, DispExtents & extents);
+
+  /// The same weights as centerline_weights() for the full tile, in the
+  /// given region, with disp being the tile cropped to that region.
+  void centerline_weights_from_extents(vw::ImageView<vw::PixelMask<vw::Vector2f> > const& disp,
+                                       vw::BBox2i const& roi, DispExtents const& extents,
+                                       vw::ImageView<double> & weights);
+
 } // end namespace vw
 
 #endif//__ASP_STEREO_H__
@@ -37,6 +37,8 @@
 #include <vw/Image/ImageMath.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/FileUtils.h>
 #include <boost/filesystem.hpp>
 
 using namespace vw;
@@ -273,6 +275,33 @@ bool load_image_and_weights(std::string const& file_path, BBox2i const& roi,
   return true;
 }
 
+/// Load just the desired portion of a neighboring disparity tile, and
+/// find its weights from the valid extents saved by stereo_corr, to
+/// avoid reading the whole tile for a narrow collar. Returns false
+/// if the extents are missing or out of date.
+bool load_collar_and_weights(std::string const& file_path, BBox2i const& roi,
+                             DispImageType & image, WeightsType & weights) {
+
+  std::string suffix = "-Dnosym.tif";
+  if (!boost::algorithm::ends_with(file_path, suffix))
+    return false;
+  std::string extents_file
+    = asp::disp_extents_file(file_path.substr(0, file_path.size() - suffix.size()));
+  if (!asp::is_latest_timestamp(extents_file, file_path))
+    return false;
+
+  asp::DispExtents extents;
+  if (!asp::read_disp_extents(extents_file, extents))
+    return false;
+  DiskImageType disk_image(file_path);
+  if (extents.size != Vector2i(disk_image.cols(), disk_image.rows()))
+    return false;
+
+  image = crop(disk_image, roi);
+  asp::centerline_weights_from_extents(image, roi, extents, weights);
+  return true;
+}
+
 /// Perform the blending
 void blend_tile_region(DispImageType      & main_image, WeightsType      & main_weights,
                        BBox2i const& main_roi,
@@ -411,7 +440,8 @@ tile_blend( DispImageType const& input_image,
       if (!ans1 || !ans2) continue; // nothing to blend
 
       check_roi_bounds(input_rois[i], tile_rois[i], bounding_box(output_image));
-      load_image_and_weights(opt.tile_paths[i], tile_rois[i], images[i], weights[i]);
+      if (!load_collar_and_weights(opt.tile_paths[i], tile_rois[i], images[i], weights[i]))
+        load_image_and_weights(opt.tile_paths[i], tile_rois[i], images[i], weights[i]);
       
       if (debug) {
         write_image("tile_image_"  +position_string(i)+".tif", images [i]);
@@ -569,7 +599,7 @@ void stereo_blending( ASPGlobalOptions const& opt ) {
     // - No need to run the blend operation on integer files!
     boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(blend_options.main_path));
     ChannelTypeEnum disp_data_type = rsrc->channel_type();
-    if (disp_data_type == VW_CHANNEL_INT32)
+    if (disp_data_type == VW_CHANNEL_INT32 || disp_data_type == VW_CHANNEL_INT16)
       vw_throw(ArgumentErr() << "Error: stereo_blend should only be called after SGM correlation.");
     integer_disp = DiskImageType(blend_options.main_path);
     
@@ -600,6 +630,7 @@ int main(int argc, char* argv[]) {
   try {
 
     vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 2 --> BLENDING \n";
+    asp::StageReport report("blending");
 
     stereo_register_sessions();
 
@@ -618,6 +649,8 @@ int main(int argc, char* argv[]) {
     // Internal Processes
     //---------------------------------------------------------
     stereo_blending( opt );
+    if (stereo_settings().stage_report)
+      report.write(opt.out_prefix);
 
     vw_out() << "\n[ " << current_posix_time_string() << " ] : BLENDING FINISHED \n";
 
@@ -27,9 +27,19 @@
 #include <vw/Stereo/CorrelationView.h>
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
+#include <vw/Image/AntiAliasing.h>
+#include <vw/Image/BlockRasterize.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/StereoPipeline.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/MaskedOverviews.h>
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/LocalHomography.h>
+#include <asp/Core/FileUtils.h>
+#include <asp/Core/MemoryBudget.h>
+#include <asp/Core/RawImage.h>
+#include <asp/Core/SearchRange.h>
+#include <asp/Core/SparseDisparity.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionPinhole.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -37,6 +47,8 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <vw/Stereo/StereoModel.h>
 
+#include <unistd.h>
+
 using namespace vw;
 using namespace vw::stereo;
 using namespace asp;
@@ -233,9 +245,11 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
     // Use a DEM to get the low-res disparity
     boost::shared_ptr<camera::CameraModel> left_camera_model, right_camera_model;
     opt.session->camera_models(left_camera_model, right_camera_model);
-    produce_dem_disparity(opt, left_camera_model, right_camera_model, opt.session->name());
+    produce_dem_disparity(opt, left_camera_model, right_camera_model,
+                          opt.session->supports_multi_threading());
   }else if ( stereo_settings().seed_mode == 3 ) {
-    // D_sub is already generated by now by sparse_disp
+    // Match a sparse set of points at full resolution
+    asp::produce_sparse_disparity(opt);
   }
 
   read_search_range_from_dsub(opt); // TODO: We already call this when needed!
@@ -606,7 +620,7 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
     vw_throw( ArgumentErr() << "Missing IP file: " << match_filename);
 
   vw_out() << "\t    * Loading match file: " << match_filename << "\n";
-  ip::read_binary_match_file(match_filename, in_ip1, in_ip2);
+  asp::read_match_file(match_filename, in_ip1, in_ip2);
 
   // TODO: Consolidate IP adjustment
   // TODO: This logic is messed up. We __know__ from stereo_settings() what
@@ -748,11 +762,209 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
 } // End function approximate_search_range
 
 
+/// Estimate the search range by correlating the low-resolution images,
+/// reduced further to about 1/32 of the full resolution, over a range of
+/// a quarter of their size in each direction. Small clusters of the
+/// resulting disparities are left out, as with
+/// --corr-seed-outlier-fraction. Return false, so that interest points
+/// are used instead, if fewer than min-num-ip disparities are found, or
+/// if they reach the edge of the range, so the true range may be larger.
+bool search_range_from_lowres_corr(ASPGlobalOptions const& opt, BBox2i & search_range) {
+
+  vw_out() << "\t--> Using correlation at low resolution to determine search window.\n";
+
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif");
+  DiskImageView<PixelGray<float> > left_sub ( opt.out_prefix+"-L_sub.tif" ),
+                                   right_sub( opt.out_prefix+"-R_sub.tif" );
+  DiskImageView<uint8> left_mask_sub ( opt.out_prefix+"-lMask_sub.tif" ),
+                       right_mask_sub( opt.out_prefix+"-rMask_sub.tif" );
+
+  // Keep at least a few hundred pixels on a side
+  const double TARGET_SCALE = 1.0/32.0;
+  const int    MIN_SIZE     = 256;
+  double sub_scale = double(left_sub.cols()) / double(Lmask.cols());
+  double scale     = std::min(1.0, TARGET_SCALE / sub_scale);
+  int    min_size  = std::min(std::min(left_sub.cols(),  left_sub.rows()),
+                              std::min(right_sub.cols(), right_sub.rows()));
+  scale = std::max(scale, std::min(1.0, double(MIN_SIZE) / std::max(min_size, 1)));
+
+  ImageView<PixelMask<PixelGray<float> > > left_small, right_small;
+  if (scale < 1.0) {
+    left_small  = resample_aa(copy_mask(left_sub,  create_mask(left_mask_sub )), scale);
+    right_small = resample_aa(copy_mask(right_sub, create_mask(right_mask_sub)), scale);
+  } else {
+    left_small  = copy_mask(left_sub,  create_mask(left_mask_sub ));
+    right_small = copy_mask(right_sub, create_mask(right_mask_sub));
+  }
+  ImageView<PixelGray<float> > left_img  = apply_mask(left_small);
+  ImageView<PixelGray<float> > right_img = apply_mask(right_small);
+  ImageView<uint8> left_mask_img  = channel_cast_rescale<uint8>(select_channel(left_small,  1));
+  ImageView<uint8> right_mask_img = channel_cast_rescale<uint8>(select_channel(right_small, 1));
+
+  Vector2i half_range(left_img.cols()/4, left_img.rows()/4);
+  BBox2i small_range(-half_range, half_range);
+
+  // Block matching with normalized cross correlation works for all
+  // images, and is fast at this size.
+  const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+  ImageView<PixelMask<Vector2f> > disp = vw::stereo::pyramid_correlate(
+      left_img, right_img, left_mask_img, right_mask_img,
+      vw::stereo::PREFILTER_LOG, stereo_settings().slogW,
+      small_range, stereo_settings().corr_kernel, stereo::CROSS_CORRELATION,
+      0, 0.0, // No timeout
+      stereo_settings().xcorr_threshold,
+      stereo_settings().min_xcorr_level,
+      rm_half_kernel,
+      stereo_settings().corr_max_levels,
+      vw::stereo::VW_CORRELATION_BM, 0,
+      get_sgm_subpixel_mode(), stereo_settings().sgm_search_buffer,
+      stereo_settings().corr_memory_limit_mb, 0, false);
+
+  int num_valid = 0;
+  for (int row = 0; row < disp.rows(); row++)
+    for (int col = 0; col < disp.cols(); col++)
+      if (is_valid(disp(col, row)))
+        num_valid++;
+  if (num_valid < stereo_settings().min_num_ip) {
+    vw_out() << "\t    * Found only " << num_valid << " disparities.\n";
+    return false;
+  }
+
+  const double OUTLIER_FRACTION = 0.01, OUTLIER_GAP = 2.0;
+  BBox2f range = asp::robust_disparity_range(disp, OUTLIER_FRACTION, OUTLIER_GAP);
+  if (range.min().x() <= small_range.min().x() + 1 || range.max().x() >= small_range.max().x() - 1 ||
+      range.min().y() <= small_range.min().y() + 1 || range.max().y() >= small_range.max().y() - 1) {
+    vw_out() << "\t    * Disparities " << range << " reach the edge of the search range "
+             << small_range << ".\n";
+    return false;
+  }
+
+  // Scale to full resolution, with a margin of two pixels at the low one
+  const double MARGIN = 2.0;
+  double sx = double(Lmask.cols()) / left_img.cols();
+  double sy = double(Lmask.rows()) / left_img.rows();
+  search_range = BBox2i(Vector2i(floor((range.min().x() - MARGIN)*sx),
+                                 floor((range.min().y() - MARGIN)*sy)),
+                        Vector2i(ceil ((range.max().x() + MARGIN)*sx),
+                                 ceil ((range.max().y() + MARGIN)*sy)));
+  return true;
+}
+
+/// The key of the low-resolution correlation cache. It is a hash of the
+/// low-resolution images and masks, the cameras, and the settings which
+/// affect D_sub, D_sub_spread, the local homographies, and the match files.
+std::string lowres_cache_key(ASPGlobalOptions const& opt) {
+
+  std::vector<std::string> files;
+  files.push_back(opt.out_prefix + "-L_sub.tif");
+  files.push_back(opt.out_prefix + "-R_sub.tif");
+  files.push_back(opt.out_prefix + "-lMask_sub.tif");
+  files.push_back(opt.out_prefix + "-rMask_sub.tif");
+  files.push_back(opt.cam_file1);
+  files.push_back(opt.cam_file2);
+
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
+                           Rmask(opt.out_prefix + "-rMask.tif");
+
+  StereoSettings const& s = stereo_settings();
+  std::ostringstream os;
+  os.precision(17);
+  os << opt.session->name() << "\n"
+     << file_fingerprint(opt.in_file1) << "\n" << file_fingerprint(opt.in_file2) << "\n"
+     << Lmask.cols() << " " << Lmask.rows() << " " << Rmask.cols() << " " << Rmask.rows() << "\n"
+     << opt.raster_tile_size << "\n"
+     << s.alignment_method << " " << s.left_image_crop_win << " " << s.right_image_crop_win << "\n"
+     << s.ip_per_tile << " " << s.ip_per_image << " " << s.ip_matching_method << " "
+     << s.epipolar_threshold << " " << s.ip_inlier_factor << " " << s.ip_uniqueness_thresh << " "
+     << s.ip_nodata_radius << " " << s.ip_triangulation_max_error << " "
+     << s.ip_num_ransac_iterations << " " << s.disable_tri_filtering << " "
+     << s.remove_outliers_by_disp_params << " " << s.num_scales << " "
+     << s.ip_edge_buffer_percent << " " << s.ip_normalize_tiles << " "
+     << s.elevation_limit << " " << s.lon_lat_limit << " " << s.min_num_ip << "\n"
+     << s.seed_mode << " " << s.seed_percent_pad << " " << s.search_range << " "
+     << s.search_range_limit << " " << s.cost_mode << " " << s.corr_kernel << " "
+     << s.corr_timeout << " " << s.xcorr_threshold << " " << s.min_xcorr_level << " "
+     << s.corr_max_levels << " " << s.stereo_algorithm << " " << s.sgm_collar_size << " "
+     << s.sgm_subpixel_mode << " " << s.sgm_search_buffer << " " << s.corr_blob_filter_area << " "
+     << s.slogW << " " << s.rm_quantile_percentile << " " << s.rm_quantile_multiple << " "
+     << s.rm_threshold << " " << s.rm_min_matches << " " << s.use_local_homography << " "
+     << s.search_range_from_lowres_corr << "\n"
+     << file_fingerprint(s.disparity_estimation_dem) << " " << s.disparity_estimation_dem_error;
+
+  return content_hash(files, os.str());
+}
+
+// Copy the low-resolution correlation results from the cache. The cached
+// file names are the output names with the output prefix and dash removed.
+bool restore_lowres_cache(ASPGlobalOptions const& opt, std::string const& cache_dir) {
+
+  if (!fs::exists(cache_dir + "/D_sub.tif"))
+    return false;
+
+  for (fs::directory_iterator it(cache_dir); it != fs::directory_iterator(); it++) {
+    std::string out_file = opt.out_prefix + "-" + it->path().filename().string();
+    vw_out() << "\t--> Copying cached " << it->path().string() << " to " << out_file << "\n";
+    fs::copy_file(it->path(), out_file, fs::copy_option::overwrite_if_exists);
+  }
+  return true;
+}
+
+// Save the low-resolution correlation results to the cache. Write to a
+// temporary directory first, so that concurrent runs never see a partial entry.
+void save_lowres_cache(ASPGlobalOptions const& opt, std::string const& cache_dir,
+                       std::string const& match_filename) {
+
+  std::vector<std::string> suffixes;
+  suffixes.push_back("D_sub.tif");
+  if (stereo_settings().seed_mode == 2)
+    suffixes.push_back("D_sub_spread.tif");
+  if (stereo_settings().use_local_homography)
+    suffixes.push_back("local_hom.txt");
+  std::string prefix = opt.out_prefix + "-";
+  if (boost::starts_with(match_filename, prefix))
+    suffixes.push_back(match_filename.substr(prefix.size()));
+
+  try {
+    std::ostringstream tmp_dir;
+    tmp_dir << cache_dir << ".tmp" << getpid();
+    fs::create_directories(tmp_dir.str());
+    for (size_t i = 0; i < suffixes.size(); i++) {
+      std::string file = prefix + suffixes[i];
+      if (fs::exists(file))
+        fs::copy_file(file, tmp_dir.str() + "/" + suffixes[i],
+                      fs::copy_option::overwrite_if_exists);
+    }
+    if (fs::exists(cache_dir))
+      fs::remove_all(tmp_dir.str()); // Another run got there first
+    else
+      fs::rename(tmp_dir.str(), cache_dir);
+    vw_out() << "\t--> Saved the low-resolution correlation to: " << cache_dir << "\n";
+  } catch (std::exception const& e) {
+    vw_out(WarningMessage) << "Could not save the low-resolution correlation to: "
+                           << cache_dir << ". " << e.what() << "\n";
+  }
+}
+
 /// The first step of correlation computation.
 void lowres_correlation( ASPGlobalOptions & opt ) {
 
   vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 1 --> LOW-RESOLUTION CORRELATION \n";
 
+  // Reuse the results of an earlier run with the same inputs and settings,
+  // possibly with a different output prefix.
+  std::string cache_dir;
+  if (stereo_settings().lowres_cache_dir != "" &&
+      (stereo_settings().seed_mode == 1 || stereo_settings().seed_mode == 2)) {
+    cache_dir = stereo_settings().lowres_cache_dir + "/" + lowres_cache_key(opt);
+    if (restore_lowres_cache(opt, cache_dir)) {
+      vw_out() << "\n[ " << current_posix_time_string()
+               << " ] : LOW-RESOLUTION CORRELATION FINISHED \n";
+      return;
+    }
+  }
+
+  string match_filename;
+
   // Working out search range if need be
   if (stereo_settings().is_search_defined()) {
     vw_out() << "\t--> Using user-defined search range.\n";
@@ -768,7 +980,7 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
   }else if (stereo_settings().seed_mode == 2){
     // Do nothing as we will compute the search range based on D_sub
   }else if (stereo_settings().seed_mode == 3){
-    // Do nothing as low-res disparity (D_sub) is already provided by sparse_disp
+    // Do nothing as the search range is found from the sparse disparity (D_sub)
   } else { // Regular seed mode
 
     // If there is no match file for the input images, gather some IP from the
@@ -782,12 +994,15 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
     // Compute new IP and write them to disk.
     // - If IP are already on disk this function will load them instead.
     // - This function will choose an appropriate IP computation based on the input images.
-    string match_filename;
-    double ip_scale;
-    ip_scale = compute_ip(opt, match_filename);
-
-    // This function applies filtering to find good points
-    stereo_settings().search_range = approximate_search_range(opt, ip_scale, match_filename);
+    // Try the quicker estimate from correlation first, if asked to.
+    if (!stereo_settings().search_range_from_lowres_corr ||
+        !search_range_from_lowres_corr(opt, stereo_settings().search_range)) {
+      double ip_scale;
+      ip_scale = compute_ip(opt, match_filename);
+
+      // This function applies filtering to find good points
+      stereo_settings().search_range = approximate_search_range(opt, ip_scale, match_filename);
+    }
 
     vw_out() << "\t--> Detected search range: " << stereo_settings().search_range << "\n";
   } // End of case where we had to calculate the search range
@@ -851,18 +1066,162 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
     }
   }
 
+  if (cache_dir != "")
+    save_lowres_cache(opt, cache_dir, match_filename);
+
   vw_out() << "\n[ " << current_posix_time_string() << " ] : LOW-RESOLUTION CORRELATION FINISHED \n";
 } // End lowres_correlation
 
 
 
+/// The range of the low-resolution disparities seen by a tile. With
+/// --corr-seed-outlier-fraction, small clusters of them, which are
+/// likely outliers, are left out, with a gap of two low-resolution
+/// pixels between clusters.
+BBox2f seed_disparity_range(ImageViewRef<PixelMask<Vector2f> > const& disparity) {
+  double fraction = stereo_settings().corr_seed_outlier_fraction;
+  if (fraction <= 0)
+    return stereo::get_disparity_range(disparity);
+  ImageView<PixelMask<Vector2f> > disp_copy = disparity;
+  return asp::robust_disparity_range(disp_copy, fraction, 2.0);
+}
+
+/// With --corr-tile-budget, make the search of a tile cheaper if it is
+/// estimated to take longer than the budget, rather than let the timeout
+/// leave the tile empty. The estimate is the number of correlation
+/// operations at full resolution times the measured time per operation.
+/// Each more pyramid level makes the search at the coarsest level about
+/// 16 times cheaper, so up to two more are used first. If that is not
+/// enough, the search range is shrunk about its center.
+void fit_tile_to_budget(BBox2i const& bbox, double seconds_per_op,
+                        BBox2f & search_range, int & max_levels) {
+
+  double budget = stereo_settings().corr_tile_budget;
+  if (budget <= 0 || seconds_per_op <= 0 || search_range.empty())
+    return;
+
+  double volume = double(bbox.area()) *
+    (search_range.width() + 1.0) * (search_range.height() + 1.0);
+  double cost = seconds_per_op * volume;
+  if (cost <= budget)
+    return;
+
+  const int max_extra_levels = 2;
+  int extra_levels = 0;
+  while (extra_levels < max_extra_levels && cost > budget) {
+    extra_levels++;
+    cost /= 16.0;
+  }
+  max_levels += extra_levels;
+
+  BBox2f orig_range = search_range;
+  bool shrink = (cost > budget);
+  if (shrink) {
+    double scale = sqrt(budget / cost);
+    Vector2 center = (search_range.min() + search_range.max()) / 2.0;
+    Vector2 half   = scale * (search_range.max() - search_range.min()) / 2.0;
+    search_range = grow_bbox_to_int(BBox2f(center - half, center + half));
+  }
+
+  vw_out() << "\t--> Tile " << bbox << " is over the time budget. Using "
+           << max_levels << " pyramid levels";
+  if (shrink)
+    vw_out() << " and search range " << search_range << " rather than " << orig_range;
+  vw_out() << ".\n";
+}
+
+/// Correlate the tile bbox with the program set with --correlator-program,
+/// such as a block matcher running on a GPU. The program is invoked as
+///   <program> left.tif right.tif disp.tif <search range> <kernel> <cost mode>
+/// with the search range given as min x, min y, width, and height. The
+/// left image is the tile expanded by half the kernel, the right image
+/// covers where that tile can go in the search range, with invalid
+/// pixels as NaN in both. The program must write a three-channel float
+/// image the size of the left image, with the disparity relative to the
+/// search range minimum and a third channel positive where valid.
+template <class LeftImageT, class LeftMaskT, class RightImageT, class RightMaskT>
+CropView<ImageView<PixelMask<Vector2f> > >
+external_correlation(BBox2i const& bbox,
+                     LeftImageT  const& left_image,  LeftMaskT  const& left_mask,
+                     RightImageT const& right_image, RightMaskT const& right_mask,
+                     BBox2i const& search_range, Vector2i const& kernel_size,
+                     stereo::CostFunctionType cost_mode) {
+
+  BBox2i left_box = bbox;
+  left_box.expand(std::max(kernel_size[0], kernel_size[1])/2);
+  BBox2i right_box(left_box.min() + search_range.min(),
+                   left_box.max() + search_range.max());
+
+  float nan = std::numeric_limits<float>::quiet_NaN();
+  ImageView<float> left  = crop(edge_extend(apply_mask(copy_mask(pixel_cast<float>(left_image),
+                                                                  create_mask(left_mask)), nan),
+                                             ConstantEdgeExtension()), left_box);
+  ImageView<float> right = crop(edge_extend(apply_mask(copy_mask(pixel_cast<float>(right_image),
+                                                                  create_mask(right_mask)), nan),
+                                             ConstantEdgeExtension()), right_box);
+  // Outside the images the pixels are zero, so mark them as invalid
+  BBox2i left_bounds  = bounding_box(left_image)  - left_box.min();
+  BBox2i right_bounds = bounding_box(right_image) - right_box.min();
+  for (int row = 0; row < left.rows(); row++)
+    for (int col = 0; col < left.cols(); col++)
+      if (!left_bounds.contains(Vector2i(col, row))) left(col, row) = nan;
+  for (int row = 0; row < right.rows(); row++)
+    for (int col = 0; col < right.cols(); col++)
+      if (!right_bounds.contains(Vector2i(col, row))) right(col, row) = nan;
+
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("asp-corr-%%%%-%%%%-%%%%");
+  fs::create_directories(dir);
+  std::string left_file  = (dir / "left.tif" ).string();
+  std::string right_file = (dir / "right.tif").string();
+  std::string disp_file  = (dir / "disp.tif" ).string();
+  write_image(left_file,  left);
+  write_image(right_file, right);
+
+  std::ostringstream cmd;
+  cmd << stereo_settings().correlator_program << " " << left_file << " "
+      << right_file << " " << disp_file << " 0 0 " << search_range.width() << " "
+      << search_range.height() << " " << kernel_size[0] << " " << kernel_size[1] << " "
+      << int(cost_mode);
+  VW_OUT(DebugMessage, "stereo") << "Running: " << cmd.str() << "\n";
+  int ret = system(cmd.str().c_str());
+  if (ret != 0 || !fs::exists(disp_file)) {
+    fs::remove_all(dir);
+    vw_throw(ArgumentErr() << "Failed to run: " << cmd.str() << "\n");
+  }
+
+  ImageView<Vector3f> disp = DiskImageView<Vector3f>(disp_file);
+  fs::remove_all(dir);
+  if (disp.cols() != left_box.width() || disp.rows() != left_box.height())
+    vw_throw(ArgumentErr() << "Expecting the output of " << stereo_settings().correlator_program
+             << " to be of size " << left_box.width() << " x " << left_box.height()
+             << ", but got " << disp.cols() << " x " << disp.rows() << ".\n");
+
+  // Pixels are invalid unless set
+  ImageView<PixelMask<Vector2f> > result(left_box.width(), left_box.height());
+  for (int row = 0; row < disp.rows(); row++) {
+    for (int col = 0; col < disp.cols(); col++) {
+      Vector3f const& d = disp(col, row);
+      if (d[2] > 0 && !std::isnan(left(col, row)))
+        result(col, row) = Vector2f(d[0] + search_range.min().x(),
+                                    d[1] + search_range.min().y());
+    }
+  }
+
+  ImageView<PixelMask<Vector2f> > tile = crop(result, bbox - left_box.min());
+  return CropView<ImageView<PixelMask<Vector2f> > >(tile, BBox2i(-bbox.min().x(), -bbox.min().y(),
+                                                                left_image.cols(), left_image.rows()));
+}
+
 /// This correlator takes a low resolution disparity image as an input
 /// so that it may narrow its search range for each tile that is processed.
-class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
-  DiskImageView<PixelGray<float> >   m_left_image;
-  DiskImageView<PixelGray<float> >   m_right_image;
-  DiskImageView<vw::uint8> m_left_mask;
-  DiskImageView<vw::uint8> m_right_mask;
+/// The images and masks are read from disk, or mapped in memory with
+/// --raw-intermediates.
+template <class ImageT, class MaskT>
+class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView<ImageT, MaskT> > {
+  ImageT   m_left_image;
+  ImageT   m_right_image;
+  MaskT    m_left_mask;
+  MaskT    m_right_mask;
   ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
   ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
   ImageView<Matrix3x3> const& m_local_hom;
@@ -878,11 +1237,11 @@ class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
 public:
 
   // Set these input types here instead of making them template arguments
-  typedef DiskImageView<PixelGray<float> >   ImageType;
-  typedef DiskImageView<vw::uint8>           MaskType;
+  typedef ImageT ImageType;
+  typedef MaskT  MaskType;
   typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
   typedef ImageViewRef<PixelMask<Vector2i> > SpreadImageType;
-  typedef ImageType::pixel_type InputPixelType;
+  typedef typename ImageType::pixel_type InputPixelType;
 
   SeededCorrelatorView( ImageType             const& left_image,
                         ImageType             const& right_image,
@@ -948,11 +1307,11 @@ public:
       DispSeedImageType disparity_in_box = crop( m_sub_disp, seed_bbox );
 
       if (!use_local_homography){
-        local_search_range = stereo::get_disparity_range( disparity_in_box );
+        local_search_range = seed_disparity_range( disparity_in_box );
       }else{ // use local homography
         int ts = ASPGlobalOptions::corr_tile_size();
         lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
-        local_search_range = stereo::get_disparity_range
+        local_search_range = seed_disparity_range
           (transform_disparities(do_round, seed_bbox,
            lowres_hom, disparity_in_box));
       }
@@ -979,8 +1338,8 @@ public:
                                                                disparity_in_box + spread_in_box);
           DispSeedImageType lower_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
                                                                disparity_in_box - spread_in_box);
-          BBox2f upper_range = stereo::get_disparity_range(upper_disp);
-          BBox2f lower_range = stereo::get_disparity_range(lower_disp);
+          BBox2f upper_range = seed_disparity_range(upper_disp);
+          BBox2f lower_range = seed_disparity_range(lower_disp);
 
           local_search_range = upper_range;
           local_search_range.grow(lower_range);
@@ -992,12 +1351,17 @@ public:
         Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
         fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
 
+        // The warped image and its mask are read through a cache, so
+        // that each block is warped once, rather than once for each of
+        // them and again each time the correlator reads it.
+        int block_size = vw_settings().default_tile_size();
         ImageViewRef< PixelMask<InputPixelType> >
           right_trans_masked_img
-          = transform (copy_mask( m_right_image.impl(),
-                       create_mask(m_right_mask.impl()) ),
-                         HomographyTransform(fullres_hom),
-                         m_left_image.impl().cols(), m_left_image.impl().rows());
+          = block_cache(transform (copy_mask( m_right_image.impl(),
+                                              create_mask(m_right_mask.impl()) ),
+                                   HomographyTransform(fullres_hom),
+                                   m_left_image.impl().cols(), m_left_image.impl().rows()),
+                        Vector2i(block_size, block_size), 1);
         right_trans_img  = apply_mask(right_trans_masked_img);
         right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
       } //endif use_local_homography
@@ -1029,10 +1393,23 @@ public:
       VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
     }
 
+    int max_levels = stereo_settings().corr_max_levels;
+    fit_tile_to_budget(bbox, m_seconds_per_op, local_search_range, max_levels);
+
     SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
     Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
 
     // Now we are ready to actually perform correlation
+    if (!stereo_settings().correlator_program.empty()) {
+      if (use_local_homography)
+        return external_correlation(bbox, m_left_image, m_left_mask,
+                                    right_trans_img, right_trans_mask,
+                                    local_search_range, m_kernel_size, m_cost_mode);
+      return external_correlation(bbox, m_left_image, m_left_mask,
+                                  m_right_image, m_right_mask,
+                                  local_search_range, m_kernel_size, m_cost_mode);
+    }
+
     const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
     if (use_local_homography){
       typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
@@ -1047,7 +1424,7 @@ public:
                           stereo_settings().xcorr_threshold,
                           stereo_settings().min_xcorr_level,
                           rm_half_kernel,
-                          stereo_settings().corr_max_levels,
+                          max_levels,
                           static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
                           stereo_settings().sgm_collar_size,
                           sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
@@ -1066,7 +1443,7 @@ public:
                           stereo_settings().xcorr_threshold,
                           stereo_settings().min_xcorr_level,
                           rm_half_kernel,
-                          stereo_settings().corr_max_levels,
+                          max_levels,
                           static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
                           stereo_settings().sgm_collar_size,
                           sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
@@ -1084,6 +1461,49 @@ public:
 }; // End class SeededCorrelatorView
 
 
+/// Grow the image block cache so that the blocks of L.tif, R.tif and the masks
+/// read for one tile are still in memory when the neighboring tiles, whose
+/// expanded windows overlap it, are processed.
+void set_corr_cache_size(ASPGlobalOptions const& opt, BBox2i const& search_range) {
+
+  Vector2i ts     = opt.raster_tile_size;
+  Vector2i kernel = stereo_settings().corr_kernel;
+
+  // The left window is expanded by the kernel, the right one also by the search range.
+  double left_pixels  = double(ts[0] + kernel[0]) * double(ts[1] + kernel[1]);
+  double right_pixels = double(ts[0] + kernel[0] + search_range.width()) *
+                        double(ts[1] + kernel[1] + search_range.height());
+  const double BYTES_PER_PIXEL = sizeof(float) + sizeof(vw::uint8); // image and mask
+
+  // Keep the tiles in flight as well as the ones to be processed next.
+  double num_tiles = 2.0 * std::max(opt.num_threads, 1);
+  double needed_mb = num_tiles * (left_pixels + right_pixels) * BYTES_PER_PIXEL
+                     / (1024.0 * 1024.0);
+  needed_mb = std::min(needed_mb, double(stereo_settings().corr_cache_limit_mb));
+
+  size_t needed_bytes  = size_t(needed_mb) * 1024 * 1024;
+  size_t current_bytes = vw_settings().system_cache_size();
+  if (needed_bytes <= current_bytes)
+    return;
+
+  vw_settings().set_system_cache_size(needed_bytes);
+  vw_out() << "\t--> Image block cache size: " << size_t(needed_mb) << " MB\n";
+}
+
+/// Whether the integer disparities for the given search range can be stored
+/// as int16. The per-tile search ranges are derived from the low-resolution
+/// disparity and may go beyond this one, so leave a generous margin.
+bool fits_in_int16(BBox2i const& search_range) {
+  if (search_range.empty())
+    return false;
+  int margin = std::max(search_range.width(), search_range.height());
+  int max_val = 0;
+  for (int i = 0; i < 2; i++)
+    max_val = std::max(max_val, std::max(std::abs(search_range.min()[i]),
+                                         std::abs(search_range.max()[i])));
+  return (max_val + margin < std::numeric_limits<vw::int16>::max());
+}
+
 /// Main stereo correlation function, called after parsing input arguments.
 void stereo_correlation( ASPGlobalOptions& opt ) {
 
@@ -1122,6 +1542,8 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   vw_out(DebugMessage) << "\t   Prefilter Size:  " << stereo_settings().slogW << endl;
   vw_out() << "\t--------------------------------------------------\n";
 
+  set_corr_cache_size(opt, stereo_settings().search_range);
+
   // Load up for the actual native resolution processing
   DiskImageView<PixelGray<float> > left_disk_image (opt.out_prefix+"-L.tif"),
                                    right_disk_image(opt.out_prefix+"-R.tif");
@@ -1164,21 +1586,56 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   BBox2i   trans_crop_win = stereo_settings().trans_crop_win;
   int      corr_timeout   = stereo_settings().corr_timeout;
   double   seconds_per_op = 0.0;
-  if (corr_timeout > 0)
+  if (corr_timeout > 0 || stereo_settings().corr_tile_budget > 0)
     seconds_per_op = calc_seconds_per_op(cost_mode, left_disk_image, right_disk_image, kernel_size);
 
   // Set up the reference to the stereo disparity code
   // - Processing is limited to trans_crop_win for use with parallel_stereo.
-  ImageViewRef<PixelMask<Vector2f> > fullres_disparity =
-    crop(SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
-                               sub_disp, sub_disp_spread, local_hom, kernel_size, 
-                               cost_mode, corr_timeout, seconds_per_op ), 
-         trans_crop_win);
+  // - With --raw-intermediates, the images and masks are mapped in memory.
+  std::string raw_files[4] = {opt.out_prefix + "-L.tif",     opt.out_prefix + "-R.tif",
+                              opt.out_prefix + "-lMask.tif", opt.out_prefix + "-rMask.tif"};
+  bool use_raw = stereo_settings().raw_intermediates;
+  for (int it = 0; it < 4; it++) {
+    std::string raw_file = asp::raw_image_file(raw_files[it]);
+    if (use_raw && !is_latest_timestamp(raw_file, raw_files[it])) {
+      vw_out(WarningMessage) << "Missing or out of date: " << raw_file
+                             << ". Reading the images without mapping them in memory.\n";
+      use_raw = false;
+    }
+    raw_files[it] = raw_file;
+  }
+  ImageViewRef<PixelMask<Vector2f> > fullres_disparity;
+  if (use_raw) {
+    typedef asp::RawImageView<PixelGray<float> > RawImage;
+    typedef asp::RawImageView<vw::uint8>         RawMask;
+    fullres_disparity =
+      crop(SeededCorrelatorView<RawImage, RawMask>
+           (RawImage(raw_files[0]), RawImage(raw_files[1]),
+            RawMask(raw_files[2]),  RawMask(raw_files[3]),
+            sub_disp, sub_disp_spread, local_hom, kernel_size,
+            cost_mode, corr_timeout, seconds_per_op),
+           trans_crop_win);
+  } else {
+    typedef DiskImageView<PixelGray<float> > DiskImage;
+    typedef DiskImageView<vw::uint8>         DiskMask;
+    fullres_disparity =
+      crop(SeededCorrelatorView<DiskImage, DiskMask>
+           (left_disk_image, right_disk_image, Lmask, Rmask,
+            sub_disp, sub_disp_spread, local_hom, kernel_size,
+            cost_mode, corr_timeout, seconds_per_op),
+           trans_crop_win);
+  }
 
   // With SGM, we must do the entire image chunk as one tile. Otherwise,
   // if it gets done in smaller tiles, there will be artifacts at tile boundaries.
+  // Alternatively, the chunk can be processed in full-width row bands which
+  // overlap by the collar size, which bounds the memory use.
   bool using_sgm = (stereo_settings().stereo_algorithm > vw::stereo::VW_CORRELATION_BM);
-  if (using_sgm) {
+  bool use_row_bands = (using_sgm && stereo_settings().sgm_row_band_height > 0);
+  if (using_sgm && !stereo_settings().correlator_program.empty())
+    vw_throw(ArgumentErr() << "The option --correlator-program can be used only "
+             << "with --stereo-algorithm 0.\n");
+  if (using_sgm && !use_row_bands) {
     Vector2i image_size = bounding_box(fullres_disparity).size();
     int max_dim = std::max(image_size[0], image_size[1]);
     if (stereo_settings().corr_tile_size_ovr < max_dim)
@@ -1211,9 +1668,41 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
 
   string d_file = opt.out_prefix + "-D.tif";
   vw_out() << "Writing: " << d_file << "\n";
-  if (stereo_settings().stereo_algorithm > vw::stereo::VW_CORRELATION_BM) {
+  if (use_row_bands) {
+    // Compute one full-width band at a time, keep it in the cache, and
+    // write it out in small blocks. Make the band height a multiple of
+    // the output block size so that no block straddles two bands.
+    const int out_ts = ASPGlobalOptions::rfne_tile_size();
+    int band_height  = stereo_settings().sgm_row_band_height;
+    if (memory_budget().has_budget()) {
+      // Two bands must fit in the part of the budget for the cache
+      double row_mb = double(fullres_disparity.cols()) * sizeof(PixelMask<Vector2f>)
+                      / (1024.0 * 1024.0);
+      double bands_mb = memory_budget().cap_mb(2.0 * band_height * row_mb,
+                                               MEMORY_BUDGET_CACHE_FRACTION);
+      band_height = std::max(out_ts, std::min(band_height, int(bands_mb / (2.0 * row_mb))));
+    }
+    if (band_height % out_ts != 0)
+      band_height = ((band_height / out_ts) + 1) * out_ts;
+    Vector2i band_size(fullres_disparity.cols(), band_height);
+    vw_out() << "\t--> Using SGM row bands of size " << band_size << ".\n";
+
+    // The cache must hold a band, or else it would be recomputed for each output block.
+    size_t band_bytes = size_t(band_size[0]) * size_t(band_size[1])
+                        * sizeof(PixelMask<Vector2f>);
+    if (vw_settings().system_cache_size() < 2 * band_bytes)
+      vw_settings().set_system_cache_size(2 * band_bytes);
+
+    opt.raster_tile_size = Vector2i(out_ts, out_ts);
+    vw::cartography::block_write_gdal_image(d_file,
+                                            block_cache(fullres_disparity, band_size, 1),
+                                            has_left_georef, left_georef,
+                                            has_nodata, nodata, opt,
+                                            TerminalProgressCallback("asp", "\t--> Correlation :") );
+
+  } else if (stereo_settings().stereo_algorithm > vw::stereo::VW_CORRELATION_BM) {
     // SGM performs subpixel correlation in this step, so write out floats.
-    
+
     // Rasterize the image first as one block, then write it out using multiple blocks.
     // - If we don't do this, the output image file is not tiled and handles very slowly.
     // - This is possible because with SGM the image must be small enough to fit in memory.
@@ -1224,6 +1713,22 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
                                             has_nodata, nodata, opt,
                                             TerminalProgressCallback("asp", "\t--> Correlation :") );
 
+    // Save the valid extents of this disparity, so that stereo_blend can
+    // blend the seams with neighboring tiles reading only their collars.
+    asp::DispExtents extents;
+    asp::compute_disp_extents(result, extents);
+    asp::write_disp_extents(asp::disp_extents_file(opt.out_prefix), extents);
+
+  } else if (stereo_settings().compact_disparity &&
+             fits_in_int16(stereo_settings().search_range)) {
+    // Cast to 16-bit integers, which is enough for this search range.
+    vw_out() << "\t--> Writing the disparity with 16-bit integer channels.\n";
+    vw::cartography::block_write_gdal_image(d_file, 
+              pixel_cast<PixelMask<Vector<int16, 2> > >(fullres_disparity),
+              has_left_georef, left_georef,
+              has_nodata, nodata, opt,
+              TerminalProgressCallback("asp", "\t--> Correlation :") );
+
   } else {
     // Otherwise cast back to integer results to save on storage space.
     vw::cartography::block_write_gdal_image(d_file, 
@@ -1233,10 +1738,62 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
               TerminalProgressCallback("asp", "\t--> Correlation :") );
   }
 
+  if (stereo_settings().add_overviews)
+    asp::add_masked_overviews(d_file, asp::DISPARITY_OVERVIEWS);
+
   vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
 
 } // End function stereo_correlation
 
+namespace asp {
+
+void correlation_stage(std::vector<ASPGlobalOptions> const& opt_vec) {
+
+  asp::StageReport report("correlation");
+  ASPGlobalOptions opt = opt_vec[0];
+
+  // Leave the number of parallel block threads equal to the default unless we
+  //  are using SGM in which case only one block at a time should be processed.
+  // - Processing multiple blocks is possible, but it is better to use a larger blocks
+  //   with more threads applied to the single block.
+  // - Thread handling is still a little confusing because opt.num_threads is ONLY used
+  //   to control the number of parallel image blocks written at a time.  Everything else
+  //   reads directly from vw_settings().default_num_threads()
+  const bool using_sgm = (stereo_settings().stereo_algorithm > vw::stereo::VW_CORRELATION_BM);
+  opt.num_threads = vw_settings().default_num_threads();
+  if (using_sgm)
+    opt.num_threads = 1;
+
+  // Integer correlator requires large tiles
+  //---------------------------------------------------------
+  int ts = stereo_settings().corr_tile_size_ovr;
+  
+  // GDAL block write sizes must be a multiple to 16 so if the input value is
+  //  not a multiple of 16 increase it until it is.
+  const int TILE_MULTIPLE = 16;
+  if (ts % TILE_MULTIPLE != 0)
+    ts = ((ts / TILE_MULTIPLE) + 1) * TILE_MULTIPLE;
+    
+  opt.raster_tile_size = Vector2i(ts, ts);
+
+  // Internal Processes
+  //---------------------------------------------------------
+  stereo_correlation( opt );
+
+  if (stereo_settings().stage_report) {
+    BBox2i search_range = stereo_settings().search_range;
+    BBox2i crop_win     = stereo_settings().trans_crop_win;
+    report.add("search_range_width",  search_range.width());
+    report.add("search_range_height", search_range.height());
+    report.add("tile_width",          crop_win.width());
+    report.add("tile_height",         crop_win.height());
+    report.write(opt.out_prefix);
+  }
+}
+
+} // end namespace asp
+
+#ifndef ASP_STEREO_LIBRARY
 int main(int argc, char* argv[]) {
 
   try {
@@ -1249,39 +1806,11 @@ int main(int argc, char* argv[]) {
     string output_prefix;
     asp::parse_multiview(argc, argv, CorrelationDescription(),
                          verbose, output_prefix, opt_vec);
-    ASPGlobalOptions opt = opt_vec[0];
-
-    // Leave the number of parallel block threads equal to the default unless we
-    //  are using SGM in which case only one block at a time should be processed.
-    // - Processing multiple blocks is possible, but it is better to use a larger blocks
-    //   with more threads applied to the single block.
-    // - Thread handling is still a little confusing because opt.num_threads is ONLY used
-    //   to control the number of parallel image blocks written at a time.  Everything else
-    //   reads directly from vw_settings().default_num_threads()
-    const bool using_sgm = (stereo_settings().stereo_algorithm > vw::stereo::VW_CORRELATION_BM);
-    opt.num_threads = vw_settings().default_num_threads();
-    if (using_sgm)
-      opt.num_threads = 1;
-
-    // Integer correlator requires large tiles
-    //---------------------------------------------------------
-    int ts = stereo_settings().corr_tile_size_ovr;
-    
-    // GDAL block write sizes must be a multiple to 16 so if the input value is
-    //  not a multiple of 16 increase it until it is.
-    const int TILE_MULTIPLE = 16;
-    if (ts % TILE_MULTIPLE != 0)
-      ts = ((ts / TILE_MULTIPLE) + 1) * TILE_MULTIPLE;
-      
-    opt.raster_tile_size = Vector2i(ts, ts);
-
-    // Internal Processes
-    //---------------------------------------------------------
-    stereo_correlation( opt );
+    asp::correlation_stage(opt_vec);
   
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
-
+#endif
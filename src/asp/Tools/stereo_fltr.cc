@@ -19,6 +19,9 @@
 /// \file stereo_fltr.cc
 ///
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/StereoPipeline.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/MaskedOverviews.h>
 
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Stereo/Algorithms.h>
@@ -28,6 +31,7 @@
 #include <vw/Image/InpaintView.h>
 
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/TextureFilter.h>
 #include <asp/Sessions/StereoSession.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -95,7 +99,7 @@ public:
     ImageView<pixel_type                 > input_disp_tile = crop(m_disp_img, bbox2);
 
     ImageView<float> texture_image;
-    vw::stereo::texture_measure(input_tile, texture_image, m_texture_smooth_range);
+    asp::texture_measure(input_tile, texture_image, m_texture_smooth_range);
     //write_image( "texture_image.tif", texture_image );
 
 
@@ -103,7 +107,7 @@ public:
     vw::stereo::disparity_median_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
     
     ImageView<pixel_type > disp_tile_filtered;
-    vw::stereo::texture_preserving_disparity_filter(disp_tile_median, disp_tile_filtered, texture_image, 
+    asp::texture_preserving_disparity_filter(disp_tile_median, disp_tile_filtered, texture_image, 
                                                     m_texture_max, m_max_smooth_kernel_size);
 
     // Fake the bounds on the returned image region
@@ -232,9 +236,209 @@ struct MultipleDisparityCleanUp {
   }
 };
 
+/// All the filtering done per tile, fused into one pass. Each tile is
+/// read once together with one halo large enough for all the enabled
+/// steps, and the steps are then run on the tile buffers: the outlier
+/// removal passes, the texture-aware smoothing, the masking with the
+/// left and right image masks, and the removal of small blobs. Each
+/// step shrinks the part of the buffer which is computed correctly by
+/// its own halo, so the sum of the halos is enough for the tile.
+template <class DispImageT, class ImageT>
+class FusedDisparityFilter: public ImageViewBase<FusedDisparityFilter<DispImageT, ImageT> >{
+  DispImageT m_disp_img;
+  ImageT     m_img;
+  ImageViewRef<uint8> m_left_mask, m_right_mask;
+  bool m_texture_filter;
+
+public:
+  FusedDisparityFilter( ImageViewBase<DispImageT> const& disp_img,
+                        ImageViewBase<ImageT    > const& img,
+                        ImageViewRef<uint8> left_mask,
+                        ImageViewRef<uint8> right_mask,
+                        bool texture_filter):
+    m_disp_img(disp_img.impl()), m_img(img.impl()),
+    m_left_mask(left_mask), m_right_mask(right_mask),
+    m_texture_filter(texture_filter) {}
+
+  // Image View interface
+  typedef typename DispImageT::pixel_type pixel_type;
+  typedef pixel_type                      result_type;
+  typedef ProceduralPixelAccessor<FusedDisparityFilter> pixel_accessor;
+
+  inline int32 cols  () const { return m_disp_img.cols(); }
+  inline int32 rows  () const { return m_disp_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "FusedDisparityFilter::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    int cleanup_passes = stereo_settings().rm_cleanup_passes;
+    int erode_area     = stereo_settings().erode_max_size;
+
+    // The halos of the steps, from the last one to the first
+    int erode_halo = 0;
+    if (erode_area > 0)
+      erode_halo = 2*int(ceil(sqrt(double(erode_area))));
+    int texture_halo = 0;
+    if (m_texture_filter)
+      texture_halo = texture_half_kernel();
+    Vector2i halo = cleanup_passes*stereo_settings().rm_half_kernel
+      + Vector2i(1, 1)*(erode_halo + texture_halo);
+
+    BBox2i bbox2 = bbox;
+    bbox2.min() -= halo;
+    bbox2.max() += halo;
+    bbox2.crop(bounding_box(m_disp_img));
+    ImageView<pixel_type> tile = crop(m_disp_img, bbox2);
+
+    // Outlier removal. The passes alternate between two buffers.
+    if (cleanup_passes > 0) {
+      ImageView<pixel_type> other(tile.cols(), tile.rows());
+      int mode = stereo_settings().filter_mode;
+      for (int i = 0; i < cleanup_passes; i++) {
+        if (mode == 1){
+          other = stereo::disparity_cleanup_using_mean
+            (tile,
+             stereo_settings().rm_half_kernel.x(),
+             stereo_settings().rm_half_kernel.y(),
+             stereo_settings().max_mean_diff);
+        }else if (mode == 2){
+          other = stereo::disparity_cleanup_using_thresh
+            (tile,
+             stereo_settings().rm_half_kernel.x(),
+             stereo_settings().rm_half_kernel.y(),
+             stereo_settings().rm_threshold,
+             stereo_settings().rm_min_matches/100.0);
+        }else
+          vw_throw( ArgumentErr() << "\nExpecting value of 1 or 2 for filter-mode. "
+                    << "Got: " << mode << "\n" );
+        std::swap(tile, other);
+      }
+    }
+
+    // Texture-aware smoothing
+    if (m_texture_filter) {
+      ImageView<typename ImageT::pixel_type> input_tile = crop(m_img, bbox2);
+      ImageView<float> texture_image;
+      asp::texture_measure(input_tile, texture_image,
+                                  stereo_settings().disp_smooth_size+2);
+      ImageView<pixel_type> disp_tile_median;
+      vw::stereo::disparity_median_filter(tile, disp_tile_median,
+                                          stereo_settings().median_filter_size);
+      ImageView<pixel_type> disp_tile_filtered;
+      asp::texture_preserving_disparity_filter
+        (disp_tile_median, disp_tile_filtered, texture_image,
+         stereo_settings().disp_smooth_texture, stereo_settings().disp_smooth_size);
+      tile = disp_tile_filtered;
+    }
+
+    mask_tile(tile, bbox2);
+
+    // Removal of small blobs
+    if (erode_area > 0) {
+      int tile_size = max(bbox2.width(), bbox2.height()); // don't subsplit
+      BlobIndexThreaded smallBlobIndex(tile, erode_area, tile_size);
+      ImageView<pixel_type> clean_tile = applyErodeView(tile, smallBlobIndex);
+      tile = clean_tile;
+    }
+
+    return prerasterize_type(tile, -bbox2.min().x(), -bbox2.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+
+private:
+
+  // The same expansion as used by TextureAwareDisparityFilter
+  int texture_half_kernel() const {
+    int max_half_kernel = stereo_settings().disp_smooth_size+2;
+    if (stereo_settings().disp_smooth_size > max_half_kernel)
+      max_half_kernel = stereo_settings().disp_smooth_size;
+    max_half_kernel += stereo_settings().median_filter_size;
+    return max_half_kernel/2;
+  }
+
+  // Invalidate the disparities of the given tile of the image which
+  // start at an invalid left pixel or end at an invalid right pixel.
+  void mask_tile(ImageView<pixel_type> & tile, BBox2i const& tile_box) const {
+
+    ImageView<uint8> left = crop(m_left_mask, tile_box);
+
+    // The part of the right mask seen by the disparities of this tile
+    BBox2i right_box;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        if (!is_valid(tile(col, row)) || !left(col, row))
+          continue;
+        Vector2 pix = Vector2(col + tile_box.min().x(), row + tile_box.min().y())
+          + tile(col, row).child();
+        right_box.grow(Vector2i(int(floor(pix[0])), int(floor(pix[1]))));
+      }
+    }
+    if (!right_box.empty()) {
+      right_box.max() += Vector2i(2, 2);
+      right_box.crop(bounding_box(m_right_mask));
+    }
+
+    // Outliers may make this box much larger than the tile. Then
+    // look up the right mask pixel by pixel.
+    bool read_right = (!right_box.empty() &&
+                       double(right_box.area()) <= 4.0*double(tile_box.area()));
+    ImageView<uint8> right;
+    if (read_right)
+      right = crop(m_right_mask, right_box);
+
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        pixel_type & disp = tile(col, row);
+        if (!is_valid(disp))
+          continue;
+        if (!left(col, row)) {
+          invalidate(disp);
+          continue;
+        }
+        Vector2 pix = Vector2(col + tile_box.min().x(), row + tile_box.min().y())
+          + disp.child();
+        Vector2i rpix(int(round(pix[0])), int(round(pix[1])));
+        if (!right_box.contains(rpix)) {
+          invalidate(disp);
+          continue;
+        }
+        uint8 value = read_right ?
+          right(rpix[0] - right_box.min().x(), rpix[1] - right_box.min().y()) :
+          m_right_mask(rpix[0], rpix[1]);
+        if (!value)
+          invalidate(disp);
+      }
+    }
+  }
+};
+
+template <class DispImageT, class ImageT>
+FusedDisparityFilter<DispImageT, ImageT>
+fused_disparity_filter( ImageViewBase<DispImageT> const& disp_img,
+                        ImageViewBase<ImageT    > const& img,
+                        ImageViewRef<uint8> left_mask,
+                        ImageViewRef<uint8> right_mask,
+                        bool texture_filter) {
+  typedef FusedDisparityFilter<DispImageT, ImageT> return_type;
+  return return_type(disp_img.impl(), img.impl(), left_mask, right_mask, texture_filter);
+}
+
 template <class ImageT>
-void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
-                                    ASPGlobalOptions const& opt ) {
+void write_good_pixel_map( ImageViewBase<ImageT> const& inputview,
+                           ASPGlobalOptions const& opt ) {
   // Write Good Pixel Map
   // Sub-sampling so that the user can actually view it.
   double sub_scale = double( min( inputview.impl().cols(),
@@ -272,6 +476,18 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
     ( goodPixelFile, goodPixelImage, has_left_georef, good_pixel_georef,
       has_nodata, nodata,
       opt, TerminalProgressCallback("asp", "\t--> Good pixel map: ") );
+}
+
+template <class ImageT>
+void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
+                                    ASPGlobalOptions const& opt ) {
+
+  write_good_pixel_map(inputview, opt);
+
+  cartography::GeoReference left_georef;
+  bool has_left_georef = read_georeference(left_georef,  opt.out_prefix + "-L.tif");
+  bool has_nodata = false;
+  double nodata = -32768.0;
 
   bool removeSmallBlobs = (stereo_settings().erode_max_size > 0);
 
@@ -412,8 +628,9 @@ void stereo_filtering( ASPGlobalOptions& opt ) {
       write_good_pixel_and_filtered
         ( ErodeView<ImageViewRef<PixelMask<Vector2f> > >(filtered_disparity,
                                                          bindex ), opt );
-    } else { // mask_flatfield == false
-      // No Erosion step
+    } else if ( stereo_settings().enable_fill_holes ) {
+      // Hole filling needs the blobs of the whole image, so it cannot
+      // be done one tile at a time.
       if ( stereo_settings().rm_cleanup_passes >= 1 ) {
         // Apply an outlier removal filter
         write_good_pixel_and_filtered
@@ -437,30 +654,79 @@ void stereo_filtering( ASPGlobalOptions& opt ) {
               apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024))),
             opt);
       } // End cleanup passes check
+    } else {
+      // All filtering in one pass over the tiles. As before, the
+      // texture-aware smoothing is done only if there are no cleanup passes.
+      bool texture_filter = (stereo_settings().rm_cleanup_passes == 0);
+      ImageViewRef<uint8> left_edge_mask
+        = apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024));
+      ImageViewRef<uint8> right_edge_mask
+        = apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024));
+
+      cartography::GeoReference left_georef;
+      bool has_left_georef = read_georeference(left_georef,  opt.out_prefix + "-L.tif");
+      bool has_nodata = false;
+      double nodata = -32768.0;
+
+      string outF = opt.out_prefix + "-F.tif";
+      vw_out() << "Writing: " << outF << endl;
+      vw::cartography::block_write_gdal_image
+        ( outF, fused_disparity_filter(disparity_disk_image, left_disk_image,
+                                       left_edge_mask, right_edge_mask,
+                                       texture_filter),
+          has_left_georef, left_georef, has_nodata, nodata, opt,
+          TerminalProgressCallback("asp", "\t--> Filtering: ") );
+
+      // The good pixel map is made from the filtered disparity on disk,
+      // rather than by filtering again.
+      write_good_pixel_map(DiskImageView<PixelMask<Vector2f> >(outF), opt);
     } // End mask_flatfield check
 
+    if (stereo_settings().add_overviews)
+      asp::add_masked_overviews(opt.out_prefix + "-F.tif", asp::DISPARITY_OVERVIEWS);
+
   } catch (IOErr const& e) {
     vw_throw( ArgumentErr() << "\nUnable to start at filtering stage -- could not read input files.\n"
               << e.what() << "\nExiting.\n\n" );
   }
 } // end stereo_filtering()
 
+namespace asp {
+
+void filtering_stage(std::vector<ASPGlobalOptions> const& opt_vec) {
+
+  vw_out() << "\n[ " << current_posix_time_string()
+           << " ] : Stage 3 --> FILTERING \n";
+  asp::StageReport report("filtering");
+
+  // This is probably the right place in which to warn the user about
+  // new hole filling behavior.
+  vw_out(WarningMessage)
+    << "Hole-filling is disabled by default in stereo_fltr. "
+    << "It is suggested to use instead point2dem's analogous "
+    << "functionality. It can be re-enabled using "
+    << "--enable-fill-holes." << endl;
+
+  ASPGlobalOptions opt = opt_vec[0];
+
+  // Internal Processes
+  //---------------------------------------------------------
+  stereo_filtering( opt );
+  if (stereo_settings().stage_report)
+    report.write(opt.out_prefix);
+
+  vw_out() << "\n[ " << current_posix_time_string()
+           << " ] : FILTERING FINISHED \n";
+}
+
+} // end namespace asp
+
+#ifndef ASP_STEREO_LIBRARY
 int main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
 
-    vw_out() << "\n[ " << current_posix_time_string()
-             << " ] : Stage 3 --> FILTERING \n";
-
-    // This is probably the right place in which to warn the user about
-    // new hole filling behavior.
-    vw_out(WarningMessage)
-      << "Hole-filling is disabled by default in stereo_fltr. "
-      << "It is suggested to use instead point2dem's analogous "
-      << "functionality. It can be re-enabled using "
-      << "--enable-fill-holes." << endl;
-
     stereo_register_sessions();
 
     bool verbose = false;
@@ -468,17 +734,11 @@ int main(int argc, char* argv[]) {
     string output_prefix;
     asp::parse_multiview(argc, argv, FilteringDescription(),
                          verbose, output_prefix, opt_vec);
-    ASPGlobalOptions opt = opt_vec[0];
-
-    // Internal Processes
-    //---------------------------------------------------------
-    stereo_filtering( opt );
-
-    vw_out() << "\n[ " << current_posix_time_string()
-             << " ] : FILTERING FINISHED \n";
+    asp::filtering_stage(opt_vec);
 
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
+#endif
@@ -156,6 +156,7 @@ int main(int argc, char** argv) {
           std::string file = all_files[i];
           bool is_image = false;
           try {
+            file = vw::gui::localImageFile(file);
             DiskImageView<float> tmp(file);
             is_image = true;
           }catch(std::exception & e){
@@ -200,6 +201,7 @@ int main(int argc, char** argv) {
         vw::gui::imageData img;
         img.read(images[i], opt_vec[0], stereo_settings().use_georef);
       }
+      vw::gui::prunePyramidCache();
       return 0;
     }
 
@@ -33,6 +33,73 @@ using namespace asp;
 using namespace std;
 namespace fs = boost::filesystem;
 
+/// Estimate the cost of correlation for each tile of given size of L.tif,
+/// with the tiles in row-major order, as produced by parallel_stereo.
+/// Each cost is the number of pixels times the area of the search range,
+/// which is found from D_sub and D_sub_spread as done in stereo_corr.
+/// Returns false if D_sub is not available.
+bool estimate_tile_costs(ASPGlobalOptions const& opt, Vector2i const& image_size,
+                         Vector2i const& tile_size, std::vector<double> & costs) {
+
+  costs.clear();
+  ImageViewRef<PixelMask<Vector2f> > sub_disp_ref;
+  if (!load_sub_disp_image(opt.out_prefix + "-D_sub.tif", sub_disp_ref))
+    return false;
+  ImageView<PixelMask<Vector2f> > sub_disp = sub_disp_ref;
+  if (sub_disp.cols() == 0 || sub_disp.rows() == 0)
+    return false;
+
+  ImageView<PixelMask<Vector2i> > sub_disp_spread;
+  std::string spread_file = opt.out_prefix + "-D_sub_spread.tif";
+  if (fs::exists(spread_file))
+    sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+  bool has_spread = (sub_disp_spread.cols() == sub_disp.cols() &&
+                     sub_disp_spread.rows() == sub_disp.rows());
+
+  Vector2 upscale(double(image_size[0]) / sub_disp.cols(),
+                  double(image_size[1]) / sub_disp.rows());
+  Vector2i kernel = stereo_settings().corr_kernel;
+
+  int tiles_nx = (image_size[0] + tile_size[0] - 1) / tile_size[0];
+  int tiles_ny = (image_size[1] + tile_size[1] - 1) / tile_size[1];
+  for (int ty = 0; ty < tiles_ny; ty++) {
+    for (int tx = 0; tx < tiles_nx; tx++) {
+
+      BBox2i tile(tx*tile_size[0], ty*tile_size[1], tile_size[0], tile_size[1]);
+      tile.crop(BBox2i(0, 0, image_size[0], image_size[1]));
+
+      // The region of D_sub for this tile
+      BBox2i sub_box(floor(tile.min().x()/upscale[0]), floor(tile.min().y()/upscale[1]),
+                     0, 0);
+      sub_box.max() = Vector2i(ceil(tile.max().x()/upscale[0]),
+                               ceil(tile.max().y()/upscale[1]));
+      sub_box.crop(bounding_box(sub_disp));
+
+      BBox2 range;
+      Vector2 spread;
+      for (int row = sub_box.min().y(); row < sub_box.max().y(); row++) {
+        for (int col = sub_box.min().x(); col < sub_box.max().x(); col++) {
+          if (!is_valid(sub_disp(col, row)))
+            continue;
+          range.grow(elem_prod(Vector2(sub_disp(col, row).child()), upscale));
+          if (has_spread && is_valid(sub_disp_spread(col, row))) {
+            for (int i = 0; i < 2; i++)
+              spread[i] = std::max(spread[i], upscale[i]*sub_disp_spread(col, row).child()[i]);
+          }
+        }
+      }
+
+      double search_area = 1.0;
+      if (!range.empty())
+        search_area = (range.width()  + 2*spread[0] + kernel[0]) *
+                      (range.height() + 2*spread[1] + kernel[1]);
+      costs.push_back(double(tile.area()) * search_area);
+    }
+  }
+
+  return true;
+}
+
 int main( int argc, char* argv[] ) {
 
   try {
@@ -121,7 +188,12 @@ int main( int argc, char* argv[] ) {
     vw_out() << "rfne_tile_size," << ASPGlobalOptions::rfne_tile_size() << endl;
     vw_out() << "tri_tile_size,"  << ASPGlobalOptions::tri_tile_size()  << endl;
 
+    vw_out() << "default_corr_tile_size," << ASPGlobalOptions::corr_tile_size() << endl;
+
     vw_out() << "stereo_algorithm," << stereo_settings().stereo_algorithm << endl;
+    vw_out() << "cost_mode," << stereo_settings().cost_mode << endl;
+    vw_out() << "corr_kernel," << stereo_settings().corr_kernel[0] << ","
+             << stereo_settings().corr_kernel[1] << endl;
     vw_out() << "subpixel_mode," << stereo_settings().subpixel_mode << endl;
     if (stereo_settings().stereo_algorithm == vw::stereo::VW_CORRELATION_BM)
       vw_out() << "collar_size," << 0 << endl;
@@ -129,6 +201,18 @@ int main( int argc, char* argv[] ) {
       vw_out() << "collar_size," << stereo_settings().sgm_collar_size << endl;
     vw_out() << "corr_memory_limit_mb," << stereo_settings().corr_memory_limit_mb << endl;
 
+    // Used by parallel_stereo to process the most expensive jobs first
+    Vector2i job_size = stereo_settings().parallel_job_size;
+    std::vector<double> tile_costs;
+    if (job_size[0] > 0 && job_size[1] > 0 &&
+        estimate_tile_costs(opt, Vector2i(trans_left_image_size[0], trans_left_image_size[1]),
+                            job_size, tile_costs)) {
+      vw_out() << "tile_costs";
+      for (size_t t = 0; t < tile_costs.size(); t++)
+        vw_out() << "," << tile_costs[t];
+      vw_out() << endl;
+    }
+
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
     // invoked after low-res disparity is computed, whether done in
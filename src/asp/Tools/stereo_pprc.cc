@@ -27,6 +27,9 @@
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Math/Functors.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/StereoPipeline.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/RawImage.h>
 #include <asp/Core/ThreadedEdgeMask.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -127,6 +130,32 @@ void create_sym_links(string const& left_input_file,
   }
 } // End function create_sym_links
 
+/// Write uncompressed copies of the aligned images and masks, for
+/// stereo_corr to map in memory. Copies newer than their images are kept.
+void write_raw_intermediates(std::string const& left_image_file,
+                             std::string const& right_image_file,
+                             std::string const& left_mask_file,
+                             std::string const& right_mask_file) {
+
+  std::string image_files[2] = {left_image_file, right_image_file};
+  std::string mask_files [2] = {left_mask_file,  right_mask_file};
+  std::string sides[2]       = {"L", "R"};
+  for (int it = 0; it < 2; it++) {
+    std::string raw_file = asp::raw_image_file(image_files[it]);
+    if (!is_latest_timestamp(raw_file, image_files[it])) {
+      vw_out() << "Writing: " << raw_file << "\n";
+      asp::write_raw_image(raw_file, DiskImageView<PixelGray<float> >(image_files[it]),
+                           TerminalProgressCallback("asp", "\t    Raw " + sides[it] + ": "));
+    }
+    raw_file = asp::raw_image_file(mask_files[it]);
+    if (!is_latest_timestamp(raw_file, mask_files[it])) {
+      vw_out() << "Writing: " << raw_file << "\n";
+      asp::write_raw_image(raw_file, DiskImageView<uint8>(mask_files[it]),
+                           TerminalProgressCallback("asp", "\t    Raw " + sides[it] + " Mask: "));
+    }
+  }
+}
+
 /// The main preprocessing function
 void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
 
@@ -257,15 +286,16 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
     }
     if ( !std::isnan(nodata_factor) ){
       // Find the black pixels threshold using Otsu's optimal threshold method.
-      left_threshold  = nodata_factor*optimal_threshold(left_image );
-      right_threshold = nodata_factor*optimal_threshold(right_image);
+      asp::run_in_parallel
+        ([&]() { left_threshold  = nodata_factor*optimal_threshold(left_image ); },
+         [&]() { right_threshold = nodata_factor*optimal_threshold(right_image); });
     }
     if ( !std::isnan(nodata_fraction) ){
       // Declare a fixed proportion of low-value pixels to be no-data.
       math::CDFAccumulator< PixelGray<float> > left_cdf (1024, 1024),
                                                right_cdf(1024, 1024);
-      for_each_pixel(left_image,  left_cdf );
-      for_each_pixel(right_image, right_cdf);
+      asp::run_in_parallel([&]() { for_each_pixel(left_image,  left_cdf ); },
+                           [&]() { for_each_pixel(right_image, right_cdf); });
       left_threshold  = left_cdf.quantile (nodata_fraction);
       right_threshold = right_cdf.quantile(nodata_fraction);
     }
@@ -316,8 +346,9 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
 
     // Intersect the left mask with the warped version of the right
     // mask, and vice-versa to reduce noise, if the images
-    // are map-projected.
+    // are map-projected. The two masks are written at the same time.
     vw_out() << "Writing masks: " << left_mask_file << ' ' << right_mask_file << ".\n";
+    vw::cartography::GdalWriteOptions half_opt = asp::half_threads(opt);
     if (has_left_georef && has_right_georef && !opt.input_dem.empty()){
       ImageViewRef< PixelMask<uint8> > warped_left_mask // Left image mask transformed into right coordinates
         = crop(vw::cartography::geo_transform
@@ -334,31 +365,37 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
                bounding_box(left_mask)
               );
 
-      vw::cartography::block_write_gdal_image(left_mask_file,
+      asp::run_in_parallel([&]() {
+          vw::cartography::block_write_gdal_image(left_mask_file,
                                   apply_mask(intersect_mask(left_mask, warped_right_mask)),
                                   has_left_georef, left_georef,
                                   has_nodata, output_nodata,
-                                  opt, TerminalProgressCallback("asp", "\t    Mask L: ")
+                                  half_opt, TerminalProgressCallback("asp", "\t    Mask L: ")
                                   );
-      vw::cartography::block_write_gdal_image(right_mask_file,
+        }, [&]() {
+          vw::cartography::block_write_gdal_image(right_mask_file,
                                   apply_mask(intersect_mask(right_mask, warped_left_mask)),
                                   has_right_georef, right_georef,
                                   has_nodata, output_nodata,
-                                  opt, TerminalProgressCallback("asp", "\t    Mask R: ")
+                                  half_opt, TerminalProgressCallback("asp", "\t    Mask R: ")
                                  );
+        });
     }else{
       // No DEM to map-project to.
       // TODO: Even so, the trick above with intersecting the masks will still work,
       // if the images are map-projected (such as with cam2map-ed cubes),
       // but this would require careful research.
-      vw::cartography::block_write_gdal_image( left_mask_file, apply_mask(left_mask),
+      asp::run_in_parallel([&]() {
+          vw::cartography::block_write_gdal_image( left_mask_file, apply_mask(left_mask),
                                    has_left_georef, left_georef,
                                    has_nodata, output_nodata,
-                                   opt, TerminalProgressCallback("asp", "\t Mask L: ") );
-      vw::cartography::block_write_gdal_image( right_mask_file, apply_mask(right_mask),
+                                   half_opt, TerminalProgressCallback("asp", "\t Mask L: ") );
+        }, [&]() {
+          vw::cartography::block_write_gdal_image( right_mask_file, apply_mask(right_mask),
                                    has_right_georef, right_georef,
                                    has_nodata, output_nodata,
-                                   opt, TerminalProgressCallback("asp", "\t Mask R: ") );
+                                   half_opt, TerminalProgressCallback("asp", "\t Mask R: ") );
+        });
     }
 
     sw.stop();
@@ -434,29 +471,38 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
     // images are small.  Using an ImageViewRef would make the
     // subsampling operations happen twice, once for L_sub.tif and
     // second time for lMask_sub.tif.
+    // The left and right images are subsampled at the same time, with
+    // half of the threads each, so that the memory use stays the same.
     ImageView< PixelMask < PixelGray<float> > > left_sub_image, right_sub_image;
+    uint32 half_sub_threads = std::max(sub_threads / 2, uint32(1));
     if ( sub_scale > 0.5 ) {
       // When we are near the pixel input to output ratio, standard
       // interpolation gives the best possible results.
-      left_sub_image  = block_rasterize(resample(copy_mask(left_image,  create_mask(left_mask)),  sub_scale), 
-                                        sub_tile_size_vec, sub_threads);
-      right_sub_image = block_rasterize(resample(copy_mask(right_image, create_mask(right_mask)), sub_scale), 
-                                        sub_tile_size_vec, sub_threads);
+      asp::run_in_parallel([&]() {
+          left_sub_image  = block_rasterize(resample(copy_mask(left_image,  create_mask(left_mask)),  sub_scale), 
+                                            sub_tile_size_vec, half_sub_threads);
+        }, [&]() {
+          right_sub_image = block_rasterize(resample(copy_mask(right_image, create_mask(right_mask)), sub_scale), 
+                                            sub_tile_size_vec, half_sub_threads);
+        });
     } else {
       // When we heavily reduce the image size, super sampling seems
       // like the best approach. The method below should be equivalent.
-      left_sub_image
-        = block_rasterize
-        (cache_tile_aware_render(resample_aa(copy_mask(left_image,create_mask(left_mask)),
-                                             sub_scale),
-                                 Vector2i(256,256) * sub_scale),
-         sub_tile_size_vec, sub_threads);
-      right_sub_image
-        = block_rasterize
-        (cache_tile_aware_render(resample_aa(copy_mask(right_image,create_mask(right_mask)),
-                                             sub_scale),
-                                 Vector2i(256,256) * sub_scale),
-         sub_tile_size_vec, sub_threads);
+      asp::run_in_parallel([&]() {
+          left_sub_image
+            = block_rasterize
+            (cache_tile_aware_render(resample_aa(copy_mask(left_image,create_mask(left_mask)),
+                                                 sub_scale),
+                                     Vector2i(256,256) * sub_scale),
+             sub_tile_size_vec, half_sub_threads);
+        }, [&]() {
+          right_sub_image
+            = block_rasterize
+            (cache_tile_aware_render(resample_aa(copy_mask(right_image,create_mask(right_mask)),
+                                                 sub_scale),
+                                     Vector2i(256,256) * sub_scale),
+             sub_tile_size_vec, half_sub_threads);
+        });
     }
 
     // Enforce no predictor in compression, it works badly with sub-images
@@ -502,6 +548,10 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
   } // End try/catch to see if the subsampled images have content
 
 
+  if (stereo_settings().raw_intermediates)
+    write_raw_intermediates(left_image_file, right_image_file,
+                            left_mask_file, right_mask_file);
+
   if (skip_img_norm && stereo_settings().subpixel_mode == 2){
     // If image normalization is not done, we still need to compute the image
     // stats, to do normalization on the fly in stereo_rfne.
@@ -514,10 +564,14 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
       = copy_mask(left_image, create_mask(left_mask));
     ImageViewRef< PixelMask< PixelGray<float> > > right_masked_image
       = copy_mask(right_image, create_mask(right_mask));
-    Vector6f left_stats       = StereoSession::gather_stats(left_masked_image,  "left",
-                                                            opt.out_prefix, left_image_file);
-    Vector6f right_stats      = StereoSession::gather_stats(right_masked_image, "right",
-                                                            opt.out_prefix, right_image_file);
+    Vector6f left_stats, right_stats;
+    asp::run_in_parallel([&]() {
+        left_stats  = StereoSession::gather_stats(left_masked_image,  "left",
+                                                  opt.out_prefix, left_image_file);
+      }, [&]() {
+        right_stats = StereoSession::gather_stats(right_masked_image, "right",
+                                                  opt.out_prefix, right_image_file);
+      });
     string   left_stats_file  = opt.out_prefix + "-lStats.tif";
     string   right_stats_file = opt.out_prefix + "-rStats.tif";
 
@@ -530,13 +584,46 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
 
 } // End function stereo_preprocessing
 
+namespace asp {
+
+void preprocessing_stage(std::vector<ASPGlobalOptions> const& opt_vec) {
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 0 --> PREPROCESSING \n";
+  asp::StageReport report("preprocessing");
+
+  ASPGlobalOptions opt = opt_vec[0];
+
+  vw_out() <<   "Using image files:  " << opt.in_file1  << ", " << opt.in_file2  << std::endl;
+  if (opt.cam_file1 != "" || opt.cam_file2 != "") 
+    vw_out() << "Using camera files: " << opt.cam_file1 << ", " << opt.cam_file2 << std::endl;
+  if (!opt.input_dem.empty())
+    vw_out() << "Using input DEM: " << opt.input_dem << std::endl;
+
+  // We will not adjust the left image size if we do multiview stereo,
+  // so we can keep one-to-one correspondence between the several
+  // pairwise runs that are part of the multiview run for the time
+  // when we need to combine all these runs to do simultaneous triangulation.
+  bool adjust_left_image_size = (opt_vec.size() == 1 &&
+                                 !stereo_settings().part_of_multiview_run);
+
+  // Internal Processes
+  //---------------------------------------------------------
+  vw_out() << "Using \"" << opt.stereo_default_filename << "\"\n";
+  stereo_preprocessing(adjust_left_image_size, opt );
+  if (stereo_settings().stage_report)
+    report.write(opt.out_prefix);
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : PREPROCESSING FINISHED \n";
+}
+
+} // end namespace asp
+
+#ifndef ASP_STEREO_LIBRARY
 int main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
   
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 0 --> PREPROCESSING \n";
-
     stereo_register_sessions();
 
     bool verbose = false;
@@ -544,30 +631,11 @@ int main(int argc, char* argv[]) {
     string output_prefix;
     asp::parse_multiview(argc, argv, PreProcessingDescription(),
                          verbose, output_prefix, opt_vec);
-    ASPGlobalOptions opt = opt_vec[0];
-
-    vw_out() <<   "Using image files:  " << opt.in_file1  << ", " << opt.in_file2  << std::endl;
-    if (opt.cam_file1 != "" || opt.cam_file2 != "") 
-      vw_out() << "Using camera files: " << opt.cam_file1 << ", " << opt.cam_file2 << std::endl;
-    if (!opt.input_dem.empty())
-      vw_out() << "Using input DEM: " << opt.input_dem << std::endl;
-
-    // We will not adjust the left image size if we do multiview stereo,
-    // so we can keep one-to-one correspondence between the several
-    // pairwise runs that are part of the multiview run for the time
-    // when we need to combine all these runs to do simultaneous triangulation.
-    bool adjust_left_image_size = (opt_vec.size() == 1 &&
-                                   !stereo_settings().part_of_multiview_run);
-
-    // Internal Processes
-    //---------------------------------------------------------
-    vw_out() << "Using \"" << opt.stereo_default_filename << "\"\n";
-    stereo_preprocessing(adjust_left_image_size, opt );
-
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : PREPROCESSING FINISHED \n";
+    asp::preprocessing_stage(opt_vec);
 
      xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
+#endif
@@ -20,6 +20,9 @@
 ///
 
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/StereoPipeline.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/MaskedOverviews.h>
 #include <vw/Stereo/PreFilter.h>
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/ParabolaSubpixelView.h>
@@ -237,7 +240,6 @@ public:
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
     ImageView<pixel_type> tile_disparity;
-    bool verbose = false;
     if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
 
       int ts = ASPGlobalOptions::corr_tile_size();
@@ -255,9 +257,7 @@ public:
                      m_left_image.impl().cols(), m_left_image.impl().rows());
       ImageViewRef<right_pix_type> right_trans_img = apply_mask(right_trans_masked_img);
 
-
-      tile_disparity = crop(refine_disparity(m_left_image, right_trans_img,
-                                             m_integer_disp, m_opt, verbose), bbox);
+      tile_disparity = refine_tile(bbox, right_trans_img);
 
       // Must undo the local homography transform
       bool do_round = false; // don't round floating point disparities
@@ -265,8 +265,7 @@ public:
                                              tile_disparity);
 
     }else{
-      tile_disparity = crop(refine_disparity(m_left_image, m_right_image,
-                                             m_integer_disp, m_opt, verbose), bbox);
+      tile_disparity = refine_tile(bbox, m_right_image);
     }
     
     prerasterize_type disparity = prerasterize_type(tile_disparity,
@@ -275,6 +274,89 @@ public:
     return disparity;
   }
 
+private:
+
+  /// How far around a tile the subpixel methods may look, accounting
+  /// for the kernel, the subpixel pyramid, and the prefilter.
+  int subpixel_margin() const {
+    int levels = stereo_settings().subpixel_max_levels;
+    if (stereo_settings().subpixel_mode == 1 || stereo_settings().subpixel_mode == 4)
+      levels = 0; // no pyramid
+    int kernel = max(stereo_settings().subpixel_kernel);
+    int filter = 2*int(ceil(3.0*stereo_settings().slogW));
+    return (kernel + 2) * (1 << levels) + filter + 2;
+  }
+
+  /// Refine the disparity in the given tile. The integer disparity of the
+  /// tile and the image windows it refers to are first brought in memory
+  /// and the subpixel methods are run on those, so that their inner loops,
+  /// which visit the same pixels many times, use direct pixel access rather
+  /// than going through the lazy views. Tiles with no valid disparity are
+  /// skipped.
+  template <class RightT>
+  ImageView<pixel_type> refine_tile(BBox2i const& bbox, RightT const& right_image) const {
+
+    bool verbose = false;
+    ImageView<pixel_type> tile_disparity = crop(m_integer_disp, bbox);
+
+    // Mode 6 writes its own files, so it is always run on the whole images
+    if (stereo_settings().subpixel_mode == 6)
+      return crop(refine_disparity(m_left_image, right_image,
+                                   m_integer_disp, m_opt, verbose), bbox);
+
+    // Disparity range for the tile
+    BBox2 disp_range;
+    for (int row = 0; row < tile_disparity.rows(); row++) {
+      for (int col = 0; col < tile_disparity.cols(); col++) {
+        if (is_valid(tile_disparity(col, row)))
+          disp_range.grow(tile_disparity(col, row).child());
+      }
+    }
+    if (disp_range.empty())
+      return tile_disparity; // nothing to refine
+
+    // The left window, and the right window it maps to
+    int margin = subpixel_margin();
+    BBox2i left_box = bbox;
+    left_box.expand(margin);
+    left_box.crop(bounding_box(m_left_image));
+    BBox2i right_box = left_box;
+    right_box.min() += Vector2i(floor(disp_range.min().x()), floor(disp_range.min().y()));
+    right_box.max() += Vector2i(ceil (disp_range.max().x()), ceil (disp_range.max().y()));
+    right_box.crop(bounding_box(right_image));
+    if (right_box.empty())
+      return crop(refine_disparity(m_left_image, right_image,
+                                   m_integer_disp, m_opt, verbose), bbox);
+
+    // Disparities must be relative to the windows
+    Vector2f offset(left_box.min().x() - right_box.min().x(),
+                    left_box.min().y() - right_box.min().y());
+    ImageView<pixel_type> window_disp = crop(m_integer_disp, left_box);
+    for (int row = 0; row < window_disp.rows(); row++) {
+      for (int col = 0; col < window_disp.cols(); col++) {
+        if (is_valid(window_disp(col, row)))
+          window_disp(col, row).child() += offset;
+      }
+    }
+
+    ImageView<typename Image1T::pixel_type> left_window  = crop(m_left_image, left_box);
+    ImageView<typename RightT::pixel_type>  right_window = crop(right_image,  right_box);
+    tile_disparity = crop(refine_disparity(left_window, right_window, window_disp,
+                                           m_opt, verbose),
+                          BBox2i(bbox.min() - left_box.min(), bbox.max() - left_box.min()));
+
+    for (int row = 0; row < tile_disparity.rows(); row++) {
+      for (int col = 0; col < tile_disparity.cols(); col++) {
+        if (is_valid(tile_disparity(col, row)))
+          tile_disparity(col, row).child() -= offset;
+      }
+    }
+
+    return tile_disparity;
+  }
+
+public:
+
   template <class DestT>
   inline void rasterize(DestT const& dest, BBox2i bbox) const {
     vw::rasterize(prerasterize(bbox), dest, bbox);
@@ -326,6 +408,9 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
       if (disp_data_type == VW_CHANNEL_INT32)
         input_disp = pixel_cast<PixelMask<Vector2f> >(
                         DiskImageView< PixelMask<Vector2i> >(disp_file));
+      else if (disp_data_type == VW_CHANNEL_INT16) // Written with --compact-disparity
+        input_disp = pixel_cast<PixelMask<Vector2f> >(
+                        DiskImageView< PixelMask<Vector<int16, 2> > >(disp_file));
       else // File on disk is float
         input_disp = DiskImageView< PixelMask<Vector2f> >(disp_file);
     }
@@ -391,16 +476,44 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
                               has_left_georef, left_georef,
                               has_nodata, nodata, opt,
                               TerminalProgressCallback("asp", "\t--> Refinement :") );
+
+  if (stereo_settings().add_overviews)
+    asp::add_masked_overviews(rd_file, asp::DISPARITY_OVERVIEWS);
 }
 
+namespace asp {
+
+void refinement_stage(std::vector<ASPGlobalOptions> const& opt_vec) {
+
+  vw_out() << "\n[ " << current_posix_time_string()
+           << " ] : Stage 2 --> REFINEMENT \n";
+  asp::StageReport report("refinement");
+
+  ASPGlobalOptions opt = opt_vec[0];
+
+  // Subpixel refinement uses smaller tiles.
+  //---------------------------------------------------------
+  int ts = ASPGlobalOptions::rfne_tile_size();
+  opt.raster_tile_size = Vector2i(ts, ts);
+
+  // Internal Processes
+  //---------------------------------------------------------
+  stereo_refinement( opt );
+  if (stereo_settings().stage_report)
+    report.write(opt.out_prefix);
+
+  vw_out() << "\n[ " << current_posix_time_string()
+           << " ] : REFINEMENT FINISHED \n";
+}
+
+} // end namespace asp
+
+#ifndef ASP_STEREO_LIBRARY
 int main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
 
-    vw_out() << "\n[ " << current_posix_time_string()
-             << " ] : Stage 2 --> REFINEMENT \n";
-
     stereo_register_sessions();
 
     bool verbose = false;
@@ -408,22 +521,11 @@ int main(int argc, char* argv[]) {
     string output_prefix;
     asp::parse_multiview(argc, argv, SubpixelDescription(),
                          verbose, output_prefix, opt_vec);
-    ASPGlobalOptions opt = opt_vec[0];
-
-    // Subpixel refinement uses smaller tiles.
-    //---------------------------------------------------------
-    int ts = ASPGlobalOptions::rfne_tile_size();
-    opt.raster_tile_size = Vector2i(ts, ts);
-
-    // Internal Processes
-    //---------------------------------------------------------
-    stereo_refinement( opt );
-
-    vw_out() << "\n[ " << current_posix_time_string()
-             << " ] : REFINEMENT FINISHED \n";
+    asp::refinement_stage(opt_vec);
 
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
+#endif
@@ -19,13 +19,22 @@
 /// \file stereo_tri.cc
 ///
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Camera/CameraModel.h>
 #include <vw/Stereo/StereoView.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/InterestPoint/InterestData.h>
 
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCStereoModel.h>
+#include <asp/Camera/ApproxCameraModel.h>
+#include <asp/Core/TransformCache.h>
+#include <asp/Core/CameraGrid.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/StereoPipeline.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/MaskedOverviews.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
 
@@ -39,7 +48,9 @@
 #include <asp/Sessions/StereoSessionSpot.h>
 #include <asp/Sessions/StereoSessionASTER.h>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <boost/function.hpp>
 #include <ctime>
+#include <future>
 
 using namespace vw;
 using namespace asp;
@@ -51,12 +62,104 @@ typedef typename StereoSession::tx_type TXT;
 // a sanity check.
 template<class T>
 T make_transform_copy(T trans){
+  asp::CameraGridReverseTransform* g_ptr
+    = dynamic_cast<asp::CameraGridReverseTransform*>(trans.get());
+  if (g_ptr) // The grid is shared, only the exact transform is copied
+    return T(new asp::CameraGridReverseTransform(g_ptr->grid(), g_ptr->max_error(),
+                                                 make_transform_copy(g_ptr->exact())));
   vw::cartography::Map2CamTrans* t_ptr = dynamic_cast<vw::cartography::Map2CamTrans*>(trans.get());
   if (!t_ptr)
     vw_throw( NoImplErr() << "Need to support new map projection transform in stereo_tri.");
   return T(new vw::cartography::Map2CamTrans(*t_ptr));
 }
 
+/// A job on the items [begin, end), such as bins or columns, using
+/// these left and right transforms.
+typedef boost::function<void(int begin, int end, TXT const& left_trans,
+                             TXT const& right_trans)> BandJob;
+
+/// Run a job on a band of items, then report the progress
+class BandTask: public vw::Task, private boost::noncopyable {
+  BandJob const& m_job;
+  int m_begin, m_end, m_num_items;
+  TXT m_left_trans, m_right_trans;
+  vw::ProgressCallback const& m_tpc;
+  vw::Mutex & m_mutex;
+  std::string & m_error;
+public:
+  BandTask(BandJob const& job, int begin, int end, int num_items,
+           TXT const& left_trans, TXT const& right_trans,
+           vw::ProgressCallback const& tpc, vw::Mutex & mutex, std::string & error):
+    m_job(job), m_begin(begin), m_end(end), m_num_items(num_items),
+    m_left_trans(left_trans), m_right_trans(right_trans),
+    m_tpc(tpc), m_mutex(mutex), m_error(error) {}
+  virtual void operator()() {
+    std::string error;
+    try {
+      m_job(m_begin, m_end, m_left_trans, m_right_trans);
+    } catch (std::exception const& e) {
+      error = e.what();
+    }
+    vw::Mutex::Lock lock(m_mutex);
+    if (!error.empty() && m_error.empty())
+      m_error = error;
+    m_tpc.report_incremental_progress(double(m_end - m_begin) / m_num_items);
+  }
+};
+
+/// Run a job on bands of items in parallel. The transforms for
+/// map-projected images are not thread-safe, so with copy_transforms
+/// each band gets its own copies of them. The first error is rethrown.
+void run_on_bands(int num_items, TXT const& left_trans, TXT const& right_trans,
+                  bool copy_transforms, BandJob const& job,
+                  vw::ProgressCallback const& tpc) {
+
+  // A few bands per thread, for load balancing
+  int num_threads = std::max(vw_settings().default_num_threads(), 1);
+  int band_len    = std::max(1, num_items / (4 * num_threads));
+
+  vw::Mutex   mutex;
+  std::string error;
+  tpc.report_progress(0);
+  {
+    FifoWorkQueue queue(num_threads);
+    for (int begin = 0; begin < num_items; begin += band_len) {
+      int end = std::min(begin + band_len, num_items);
+      TXT left  = copy_transforms ? make_transform_copy(left_trans)  : left_trans;
+      TXT right = copy_transforms ? make_transform_copy(right_trans) : right_trans;
+      boost::shared_ptr<BandTask> task(new BandTask(job, begin, end, num_items, left, right,
+                                                    tpc, mutex, error));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  tpc.report_finished();
+
+  if (!error.empty())
+    vw_throw(ArgumentErr() << error);
+}
+
+/// Triangulate a row of pixels, with pixels[c][k] being the k-th pixel in camera c.
+/// The generic stereo model is invoked one point at a time.
+template <class StereoModelT>
+void triangulate_row(StereoModelT const& stereo_model,
+                     vector< vector<Vector2> > const& pixels,
+                     vector<Vector3> & points, vector<Vector3> & errors) {
+  vector<Vector2> pixVec(pixels.size());
+  for (size_t k = 0; k < points.size(); k++) {
+    for (size_t c = 0; c < pixels.size(); c++)
+      pixVec[c] = pixels[c][k];
+    points[k] = stereo_model(pixVec, errors[k]);
+  }
+}
+
+/// The RPC stereo model can process the whole row in one call.
+inline void triangulate_row(asp::RPCStereoModel const& stereo_model,
+                            vector< vector<Vector2> > const& pixels,
+                            vector<Vector3> & points, vector<Vector3> & errors) {
+  stereo_model(pixels, points, errors);
+}
+
 /// The main class for taking in a set of disparities and returning a point cloud via joint triangulation.
 template <class DisparityImageT, class StereoModelT>
 class StereoTXAndErrorView : public ImageViewBase<StereoTXAndErrorView<DisparityImageT, StereoModelT> >
@@ -124,7 +227,7 @@ public:
     return result; // Contains location and error vector
   }
 
-  typedef StereoTXAndErrorView<ImageViewRef<DPixelT>, StereoModelT> prerasterize_type;
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
     return PreRasterHelper( bbox, m_transforms );
   }
@@ -139,20 +242,30 @@ private:
   template <class T>
   prerasterize_type PreRasterHelper( BBox2i const& bbox, vector<T> const& transforms) const {
 
-    // Code for NON-MAP-PROJECTED session types.
-    if (m_is_map_projected == false) {
-      // We explicitly bring in-memory the disparities for the current box
-      // to speed up processing later, and then we pretend this is the entire
-      // image by virtually enlarging it using a CropView.
-      vector< ImageViewRef<DPixelT> > disparity_cropviews;
-      for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-        ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-        ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-        disparity_cropviews.push_back(cropview_clip);
-      }
-
-      return prerasterize_type(disparity_cropviews, transforms, m_stereo_model, m_is_map_projected);
+    // We explicitly bring in-memory the disparities for the current box
+    // to speed up processing later. With many views they are read
+    // at the same time, as each is in its own file.
+    int num_disp = m_disparity_maps.size();
+    vector< ImageView<DPixelT> > disparity_clips(num_disp);
+    vector< std::future<void> > reads;
+    for (int p = 1; p < num_disp; p++)
+      reads.push_back(std::async(std::launch::async, [this, &disparity_clips, &bbox, p]() {
+            disparity_clips[p] = crop( m_disparity_maps[p], bbox );
+          }));
+    // Wait for all reads even if one throws
+    try {
+      disparity_clips[0] = crop( m_disparity_maps[0], bbox );
+    } catch (...) {
+      for (size_t r = 0; r < reads.size(); r++)
+        reads[r].wait();
+      throw;
     }
+    for (size_t r = 0; r < reads.size(); r++)
+      reads[r].get();
+
+    // Code for NON-MAP-PROJECTED session types.
+    if (m_is_map_projected == false)
+      return triangulate_tile(bbox, disparity_clips, transforms);
 
     // Code for MAP-PROJECTED session types.
 
@@ -176,18 +289,10 @@ private:
                 << "than the number of images." );
     }
 
-    vector< ImageViewRef<DPixelT> > disparity_cropviews;
     for (int p = 0; p < (int)m_disparity_maps.size(); p++){
 
-      // We explicitly bring in-memory the disparities for the current
-      // box to speed up processing later, and then we pretend this is
-      // the entire image by virtually enlarging it using a CropView.
-      ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-      ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-      disparity_cropviews.push_back(cropview_clip);
-
       // Work out what spots in the right image we'll be touching.
-      BBox2i disparity_range = stereo::get_disparity_range(clip);
+      BBox2i disparity_range = stereo::get_disparity_range(disparity_clips[p]);
       disparity_range.max() += Vector2i(1,1);
       BBox2i right_bbox = bbox + disparity_range.min();
       right_bbox.max() += disparity_range.size();
@@ -197,9 +302,61 @@ private:
       transforms_copy[p+1]->reverse_bbox(right_bbox); 
     }
 
-    return prerasterize_type(disparity_cropviews, transforms_copy, m_stereo_model, m_is_map_projected);
+    return triangulate_tile(bbox, disparity_clips, transforms_copy);
   } // End function PreRasterHelper() DGMapRPC version
 
+  /// Triangulate a tile one row at a time. The pixels of each row are
+  /// gathered in per-camera arrays which are reused for all rows, so there
+  /// is no per-pixel memory allocation, and the stereo model is given
+  /// a whole row at once. The left pixel is de-warped once for all
+  /// views, and not at all where no disparity is valid, as then
+  /// there is nothing to triangulate.
+  template <class T>
+  prerasterize_type triangulate_tile(BBox2i const& bbox,
+                                     vector< ImageView<DPixelT> > const& disparity_clips,
+                                     vector<T> const& transforms) const {
+
+    int num_disp = disparity_clips.size();
+    int width    = bbox.width();
+    vector< vector<Vector2> > pixels(num_disp + 1, vector<Vector2>(width));
+    vector<Vector3> points(width), errors(width);
+    Vector2 nan_pix(std::numeric_limits<double>::quiet_NaN(),
+                    std::numeric_limits<double>::quiet_NaN());
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    for (int row = 0; row < bbox.height(); row++) {
+
+      // For each input image, de-warp the pixel in to the native camera coordinates
+      for (int col = 0; col < width; col++) {
+        Vector2 pix(col + bbox.min().x(), row + bbox.min().y());
+        bool any_valid = false;
+        for (int c = 0; c < num_disp; c++){
+          DPixelT disp = disparity_clips[c](col, row); // Disparity value at this pixel
+          if (is_valid(disp)) { // De-warp the "right" pixel
+            pixels[c+1][col] = transforms[c+1]->reverse( pix + stereo::DispHelper(disp) );
+            any_valid = true;
+          } else { // Insert flag values
+            pixels[c+1][col] = nan_pix;
+          }
+        }
+        // De-warp "left" pixel. With no valid rays the stereo model
+        // returns the null point regardless.
+        pixels[0][col] = any_valid ? transforms[0]->reverse(pix) : nan_pix;
+      }
+
+      // Compute the location of the 3D points observed by the pixels in this row
+      triangulate_row(m_stereo_model, pixels, points, errors);
+
+      for (int col = 0; col < width; col++) {
+        subvector(tile(col, row), 0, 3) = points[col];
+        subvector(tile(col, row), 3, 3) = errors[col];
+      }
+    }
+
+    // Use the crop trick to fake that the support region is the same size as the entire image.
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
 }; // End class StereoTXAndErrorView
 
 /// Just a wrapper function for StereoTXAndErrorView view construction
@@ -228,7 +385,10 @@ class UnalignDisparityView: public ImageViewBase<UnalignDisparityView<DisparityT
   ASPGlobalOptions const& m_opt;
   int m_num_cols, m_num_rows;
   bool m_is_map_projected;
-  std::map <std::pair<int, int>, Vector2> m_unaligned_trans;
+  // For map-projected images, the unaligned left pixel at each sample
+  // of the disparity, with the samples at these columns and rows
+  std::vector<int> m_sample_cols, m_sample_rows;
+  ImageView< PixelMask<Vector2> > m_unaligned_trans;
 public:
   UnalignDisparityView( DisparityT const& disparity,
                        TXT        const& left_transform,
@@ -258,44 +418,47 @@ public:
       int col_sample = std::max(1, std::min(sample_len, m_disparity.cols()/num_min_samples));
       int row_sample = std::max(1, std::min(sample_len, m_disparity.rows()/num_min_samples));
 
-      vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = col_sample / std::max(double(m_disparity.cols()), 1.0);
-      tpc.report_progress(0);
-      vw_out() << "\nEstimating the unaligned disparity dimensions.\n";
-
-      for (int col = 0; col < m_disparity.cols(); col++) {
-
-	// Ensure that the last column is picked
-	if (col % col_sample != 0 && col != m_disparity.cols() - 1) 
-	  continue;
-
-        for (int row = 0; row < m_disparity.rows(); row++) {
-	  
-	  // Ensure that the last row is picked
-	  if (row % row_sample != 0 && row != m_disparity.rows() - 1) 
-	    continue;
-
-	  // This is quite important to avoid an incorrectly computed img_box.
-          typename DisparityT::pixel_type dpix = m_disparity(col, row);
-          if (!is_valid(dpix))
-	    continue;
-
-          // Unalign the left pixel
-	  Vector2 left_pix;
-	  try{
-	    left_pix  = m_left_transform->reverse(Vector2(col, row));
-	  }catch(...){
-	    continue;
-	  }
-          img_box.grow(left_pix);
-
-	  // Save this lookup map for the future
-	  m_unaligned_trans[std::make_pair(col, row)] = left_pix;
+      // Ensure that the last column and row are picked
+      for (int col = 0; col < m_disparity.cols(); col++)
+        if (col % col_sample == 0 || col == m_disparity.cols() - 1)
+          m_sample_cols.push_back(col);
+      for (int row = 0; row < m_disparity.rows(); row++)
+        if (row % row_sample == 0 || row == m_disparity.rows() - 1)
+          m_sample_rows.push_back(row);
+      m_unaligned_trans.set_size(m_sample_cols.size(), m_sample_rows.size());
+
+      // Unalign the left pixel at each sample, for bands of sample
+      // columns in parallel. Each column of samples has its own box.
+      std::vector<BBox2i> col_boxes(m_sample_cols.size());
+      BandJob sample_job = [&](int begin, int end, TXT const& left_trans, TXT const&) {
+        for (int i = begin; i < end; i++) {
+          for (size_t j = 0; j < m_sample_rows.size(); j++) {
+            PixelMask<Vector2> & left_pix = m_unaligned_trans(i, j);
+            left_pix.invalidate();
+
+            // This is quite important to avoid an incorrectly computed img_box.
+            typename DisparityT::pixel_type dpix = m_disparity(m_sample_cols[i],
+                                                               m_sample_rows[j]);
+            if (!is_valid(dpix))
+              continue;
+
+            try {
+              left_pix = PixelMask<Vector2>(left_trans->reverse(Vector2(m_sample_cols[i],
+                                                                        m_sample_rows[j])));
+            } catch(...) {
+              left_pix.invalidate();
+              continue;
+            }
+            col_boxes[i].grow(left_pix.child());
+          }
         }
-
-	tpc.report_incremental_progress(inc_amount);
-      }
-      tpc.report_finished();
+      };
+      vw_out() << "\nEstimating the unaligned disparity dimensions.\n";
+      vw::TerminalProgressCallback tpc("asp", "\t--> ");
+      run_on_bands(m_sample_cols.size(), m_left_transform, m_right_transform,
+                   true, sample_job, tpc);
+      for (size_t i = 0; i < col_boxes.size(); i++)
+        img_box.grow(col_boxes[i]);
 
       // Grow the box to account for the fact that we did a sub-sampling
       // and may have missed some points.
@@ -389,19 +552,12 @@ public:
 	}
       }
     }else{
-      for (int col = 0; col < m_disparity.cols(); col++) {
-	for (int row = 0; row < m_disparity.rows(); row++) {
-	  
-	  std::pair<int, int> pix = std::make_pair(col, row);
-	  std::map <std::pair<int, int>, Vector2>::const_iterator it = m_unaligned_trans.find(pix);
-	  if (it == m_unaligned_trans.end())
-	    continue;
-
-	  Vector2 rev = it->second;
-	  if (curr_bbox.contains(rev)) {
-	    disp_bbox.grow(Vector2(col, row));
-	  }
-	}
+      for (size_t i = 0; i < m_sample_cols.size(); i++) {
+        for (size_t j = 0; j < m_sample_rows.size(); j++) {
+          PixelMask<Vector2> const& rev = m_unaligned_trans(i, j);
+          if (is_valid(rev) && curr_bbox.contains(rev.child()))
+            disp_bbox.grow(Vector2(m_sample_cols[i], m_sample_rows[j]));
+        }
       }
 
       // Grow the box to account for the fact that we did a sub-sampling
@@ -573,6 +729,12 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
     pinPtr->pinhole_cam_trans(left_trans, right_trans);
   }
 
+  // The transforms for map-projected images are not thread-safe
+  bool copy_transforms = opt_vec[0].session->isMapProjected();
+
+  typedef typename DisparityT::pixel_type DispPixelT;
+  typedef std::vector< std::pair<Vector2, Vector2> > MatchList;
+
   std::vector<vw::ip::InterestPoint> left_ip, right_ip;
 
   if (!gen_triplets) {
@@ -584,40 +746,45 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
     int lenx = round( disp.cols()/bin_len ); lenx = std::max(1, lenx);
     int leny = round( disp.rows()/bin_len ); leny = std::max(1, leny);
 
-    // Iterate over bins.
+    // Iterate over bins. The columns of bins are done in parallel, and
+    // the matches are then kept in the same order as done serially.
+    std::vector<MatchList> bin_matches(lenx);
+    BandJob bin_job = [&](int begin, int end, TXT const& left_trans, TXT const& right_trans) {
+      for (int binx = begin; binx < end; binx++) {
 
-    vw_out() << "Computing interest point matches based on disparity.\n";
-    vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(lenx);
-    tpc.report_progress(0);
+        // Pick the disparity at the center of the bin
+        int posx = round( (binx+0.5)*bin_len );
 
-    for (int binx = 0; binx < lenx; binx++) {
+        for (int biny = 0; biny < leny; biny++) {
 
-      // Pick the disparity at the center of the bin
-      int posx = round( (binx+0.5)*bin_len );
+          int posy = round( (biny+0.5)*bin_len );
 
-      for (int biny = 0; biny < leny; biny++) {
-
-        int posy = round( (biny+0.5)*bin_len );
+          if (posx >= disp.cols() || posy >= disp.rows())
+            continue;
+          DispPixelT dpix = disp(posx, posy);
+          if (!is_valid(dpix))
+            continue;
 
-        if (posx >= disp.cols() || posy >= disp.rows()) 
-          continue;
-        typedef typename DisparityT::pixel_type DispPixelT;
-        DispPixelT dpix = disp(posx, posy);
-        if (!is_valid(dpix))
-          continue;
+          // De-warp left and right pixels to be in the camera coordinate system
+          Vector2 left_pix  = left_trans->reverse ( Vector2(posx, posy) );
+          Vector2 right_pix = right_trans->reverse( Vector2(posx, posy) + stereo::DispHelper(dpix) );
+          bin_matches[binx].push_back(std::make_pair(left_pix, right_pix));
+        }
+      }
+    };
 
-        // De-warp left and right pixels to be in the camera coordinate system
-        Vector2 left_pix  = left_trans->reverse ( Vector2(posx, posy) );
-        Vector2 right_pix = right_trans->reverse( Vector2(posx, posy) + stereo::DispHelper(dpix) );
+    vw_out() << "Computing interest point matches based on disparity.\n";
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    run_on_bands(lenx, left_trans, right_trans, copy_transforms, bin_job, tpc);
 
+    for (size_t binx = 0; binx < bin_matches.size(); binx++) {
+      for (size_t it = 0; it < bin_matches[binx].size(); it++) {
+        Vector2 const& left_pix  = bin_matches[binx][it].first;
+        Vector2 const& right_pix = bin_matches[binx][it].second;
         left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
         right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
       }
-
-      tpc.report_incremental_progress( inc_amount );
     }
-    tpc.report_finished();
 
   } else{
 
@@ -629,136 +796,124 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
 
     // Note that the code above is modified in subtle ways.
 
+    // The candidate matches are found in parallel, then added in the
+    // same order as done serially.
+
     // Need these to not insert an ip twice, as then bundle_adjust
     // will wipe both copies
     std::map<double, double> left_done, right_done;
-    
+
+    // Add this ip unless found already. This is clumsy, but we
+    // can't use a set since there is no ordering for pairs.
+    auto add_matches = [&](std::vector<MatchList> const& matches) {
+      for (size_t k = 0; k < matches.size(); k++) {
+        for (size_t it = 0; it < matches[k].size(); it++) {
+          Vector2 const& left_pix  = matches[k][it].first;
+          Vector2 const& right_pix = matches[k][it].second;
+          std::map<double, double>::iterator done;
+          done = left_done.find(left_pix.x());
+          if (done != left_done.end() && done->second == left_pix.y()) continue;
+          done = right_done.find(right_pix.x());
+          if (done != right_done.end() && done->second == right_pix.y()) continue;
+          left_done[left_pix.x()] = left_pix.y();
+          right_done[right_pix.x()] = right_pix.y();
+          left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
+          right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
+        }
+      }
+    };
+
     // Start with the left
     {
       DiskImageView<float> left_img(opt_vec[0].in_file1);
-    
-      double num_pixels = double(left_img.cols()) * double(left_img.rows());
+      int left_cols = left_img.cols(), left_rows = left_img.rows();
+
+      double num_pixels = double(left_cols) * double(left_rows);
       int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
       VW_ASSERT( bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
 
-      int lenx = round( left_img.cols()/bin_len ); lenx = std::max(1, lenx);
-      int leny = round( left_img.rows()/bin_len ); leny = std::max(1, leny);
+      int lenx = round( left_cols/bin_len ); lenx = std::max(1, lenx);
+      int leny = round( left_rows/bin_len ); leny = std::max(1, leny);
 
       // Iterate over bins.
+      std::vector<MatchList> bin_matches(lenx + 1);
+      BandJob bin_job = [&](int begin, int end, TXT const& left_trans, TXT const& right_trans) {
+        for (int binx = begin; binx < end; binx++) {
+
+          int posx = binx*bin_len; // integer multiple of bin length
+
+          for (int biny = 0; biny <= leny; biny++) {
+
+            int posy = biny*bin_len; // integer multiple of bin length
+
+            if (posx >= left_cols || posy >= left_rows)
+              continue;
+
+            // Make the left pixel go to the disparity domain. Find the corresponding
+            // right pixel. And make that one go to the right image domain.
+            Vector2 left_pix(posx, posy);
+            Vector2 trans_left_pix = round(left_trans->forward(left_pix));
+            if (trans_left_pix[0] < 0 || trans_left_pix[0] >= disp.cols()) continue;
+            if (trans_left_pix[1] < 0 || trans_left_pix[1] >= disp.rows()) continue;
+            DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
+            if (!is_valid(dpix))
+              continue;
+            Vector2 trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
+            Vector2 right_pix = right_trans->reverse(trans_right_pix);
+            bin_matches[binx].push_back(std::make_pair(left_pix, right_pix));
+          }
+        }
+      };
 
       vw_out() << "Computing interest point matches based on disparity.\n";
       vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = 1.0 / double(lenx);
-      tpc.report_progress(0);
-
-      for (int binx = 0; binx <= lenx; binx++) {
-
-        int posx = binx*bin_len; // integer multiple of bin length
-
-        for (int biny = 0; biny <= leny; biny++) {
-
-          int posy = biny*bin_len; // integer multiple of bin length
-
-          if (posx >= left_img.cols() || posy >= left_img.rows()) 
-            continue;
-
-          Vector2 left_pix(posx, posy);
-          Vector2 trans_left_pix, trans_right_pix, right_pix;
-        
-          typedef typename DisparityT::pixel_type DispPixelT;
-
-          // Make the left pixel go to the disparity domain. Find the corresponding
-          // right pixel. And make that one go to the right image domain.
-          trans_left_pix = round(left_trans->forward(left_pix));
-          if (trans_left_pix[0] < 0 || trans_left_pix[0] >= disp.cols()) continue;
-          if (trans_left_pix[1] < 0 || trans_left_pix[1] >= disp.rows()) continue;
-          DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
-          if (!is_valid(dpix))
-            continue;
-          trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-          right_pix = right_trans->reverse(trans_right_pix);
-
-          // Add this ip unless found already. This is clumsy, but we
-          // can't use a set since there is no ordering for pairs.
-          std::map<double, double>::iterator it;
-          it = left_done.find(left_pix.x());
-          if (it != left_done.end() && it->second == left_pix.y()) continue; 
-          it = right_done.find(right_pix.x());
-          if (it != right_done.end() && it->second == right_pix.y()) continue; 
-          left_done[left_pix.x()] = left_pix.y();
-          right_done[right_pix.x()] = right_pix.y();
-          ip::InterestPoint lip(left_pix.x(), left_pix.y());
-          ip::InterestPoint rip(right_pix.x(), right_pix.y());
-          left_ip.push_back(lip); 
-          right_ip.push_back(rip);
-        }
-        
-        tpc.report_incremental_progress( inc_amount );
-      }
-      tpc.report_finished();
+      run_on_bands(lenx + 1, left_trans, right_trans, copy_transforms, bin_job, tpc);
+      add_matches(bin_matches);
     }
-    
+
     // Now create ip in predictable location for the right image.This is hard,
     // as the disparity goes from left to right, so we need to examine every disparity.
-    typedef typename DisparityT::pixel_type DispPixelT;
     ImageView<DispPixelT> disp_copy = copy(disp);
     {
       DiskImageView<float> right_img(opt_vec[0].in_file2);
-    
+
       double num_pixels = double(right_img.cols()) * double(right_img.rows());
       int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
       VW_ASSERT( bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
 
-      // Iterate over disparity.
+      // Iterate over disparity, with the columns done in parallel.
+      std::vector<MatchList> col_matches(disp_copy.cols());
+      BandJob col_job = [&](int begin, int end, TXT const& left_trans, TXT const& right_trans) {
+        for (int col = begin; col < end; col++) {
+          for (int row = 0; row < disp_copy.rows(); row++) {
+
+            DispPixelT dpix = disp_copy(col, row);
+            if (!is_valid(dpix))
+              continue;
+
+            // Compute the left and right pixels.
+            Vector2 trans_left_pix(col, row);
+            Vector2 left_pix        = left_trans->reverse(trans_left_pix);
+            Vector2 trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
+            Vector2 right_pix       = right_trans->reverse(trans_right_pix);
+
+            // If the right pixel is a multiple of the bin size, keep
+            // it.
+            right_pix = round(right_pix); // very important
+            if ( int(right_pix[0]) % bin_len != 0 ) continue;
+            if ( int(right_pix[1]) % bin_len != 0 ) continue;
+
+            col_matches[col].push_back(std::make_pair(left_pix, right_pix));
+          }
+        }
+      };
 
       vw_out() << "Doing a second pass. This will be very slow.\n";
       vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = 1.0 / double(disp_copy.cols());
-      tpc.report_progress(0);
-
-      for (int col = 0; col < disp_copy.cols(); col++) {
-        for (int row = 0; row < disp_copy.rows(); row++) {
-
-          Vector2 trans_left_pix(col, row);
-          Vector2 left_pix, trans_right_pix, right_pix;
-
-          DispPixelT dpix = disp_copy(trans_left_pix[0], trans_left_pix[1]);
-          if (!is_valid(dpix))
-            continue;
-
-          // Compute the left and right pixels. 
-          left_pix        = left_trans->reverse(trans_left_pix);
-          trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-          right_pix       = right_trans->reverse(trans_right_pix);
-
-
-          // If the right pixel is a multiple of the bin size, keep
-          // it.
-          right_pix = round(right_pix); // very important
-          if ( int(right_pix[0]) % bin_len != 0 ) continue;
-          if ( int(right_pix[1]) % bin_len != 0 ) continue;
-
-          // Add this ip unless found already. This is clumsy, but we
-          // can't use a set since there is no ordering for pairs.
-          std::map<double, double>::iterator it;
-          it = left_done.find(left_pix.x());
-          if (it != left_done.end() && it->second == left_pix.y()) continue; 
-          it = right_done.find(right_pix.x());
-          if (it != right_done.end() && it->second == right_pix.y()) continue; 
-          left_done[left_pix.x()] = left_pix.y();
-          right_done[right_pix.x()] = right_pix.y();
-          ip::InterestPoint lip(left_pix.x(), left_pix.y());
-          ip::InterestPoint rip(right_pix.x(), right_pix.y());
-          left_ip.push_back(lip); 
-          right_ip.push_back(rip);
-        }
-        
-        tpc.report_incremental_progress( inc_amount );
-      }
-      tpc.report_finished();
+      run_on_bands(disp_copy.cols(), left_trans, right_trans, copy_transforms, col_job, tpc);
+      add_matches(col_matches);
     }
 
-    
   } // end considering multi-image friendly ip
 
   vw_out() << "Determined " << left_ip.size()
@@ -801,7 +956,23 @@ namespace asp{
     bool has_nodata = false;
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
-    if ( opt.session->supports_multi_threading() ){
+    if (stereo_settings().save_int_point_cloud && norm_2(shift) > 0) {
+      if ( opt.session->supports_multi_threading() ){
+        asp::block_write_quantized_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            point_cloud,
+            has_georef, georef, has_nodata, nodata,
+            opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+      }else{
+        asp::write_quantized_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            point_cloud,
+            has_georef, georef, has_nodata, nodata,
+            opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+      }
+    }else if ( opt.session->supports_multi_threading() ){
       asp::block_write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
@@ -925,6 +1096,56 @@ namespace asp{
 
 } // End namespace asp
 
+/// Load the cameras of one stereo pair
+class PairCamerasTask: public vw::Task, private boost::noncopyable {
+  ASPGlobalOptions const& m_opt;
+  boost::shared_ptr<camera::CameraModel> & m_left, & m_right;
+public:
+  PairCamerasTask(ASPGlobalOptions const& opt, boost::shared_ptr<camera::CameraModel> & left,
+                  boost::shared_ptr<camera::CameraModel> & right):
+    m_opt(opt), m_left(left), m_right(right) {}
+  virtual void operator()() {
+    try {
+      m_opt.session->camera_models(m_left, m_right);
+    } catch (std::exception const& e) {
+      m_left.reset();
+      m_right.reset();
+    }
+  }
+};
+
+/// Load the cameras of all the stereo pairs, in parallel if the
+/// session allows it. The left camera is the same for all pairs, and
+/// comes first, followed by the right camera of each pair.
+void load_multiview_cameras(vector<ASPGlobalOptions> const& opt_vec,
+                            vector< boost::shared_ptr<camera::CameraModel> > & cameras) {
+
+  int num_pairs = opt_vec.size();
+  vector< boost::shared_ptr<camera::CameraModel> > left(num_pairs), right(num_pairs);
+  int num_threads = opt_vec[0].session->supports_multi_threading() ?
+    vw_settings().default_num_threads() : 1;
+  {
+    FifoWorkQueue queue(std::max(num_threads, 1));
+    for (int p = 0; p < num_pairs; p++) {
+      boost::shared_ptr<PairCamerasTask> task(new PairCamerasTask(opt_vec[p], left[p], right[p]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  // A task which threw leaves its cameras unset. Load these again
+  // here, so that the error is reported.
+  for (int p = 0; p < num_pairs; p++) {
+    if (left[p].get() == NULL || right[p].get() == NULL)
+      opt_vec[p].session->camera_models(left[p], right[p]);
+  }
+
+  cameras.clear();
+  cameras.push_back(left[0]);
+  for (int p = 0; p < num_pairs; p++)
+    cameras.push_back(right[p]);
+}
+
 /// Main triangulation function
 void stereo_triangulation( string          const& output_prefix,
                            vector<ASPGlobalOptions> const& opt_vec ) {
@@ -943,24 +1164,20 @@ void stereo_triangulation( string          const& output_prefix,
     vector<string> image_files, camera_files;
     vector< boost::shared_ptr<camera::CameraModel> > cameras;
     vector<typename SessionT::tx_type> transforms;
+    load_multiview_cameras(opt_vec, cameras);
     for (int p = 0; p < (int)opt_vec.size(); p++){
 
-      boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
-      opt_vec[p].session->camera_models(camera_model1, camera_model2);
-
       //boost::shared_ptr<SessionT> sPtr = boost::dynamic_pointer_cast<SessionT>(opt_vec[p].session);
       boost::shared_ptr<SessionT> sPtr = opt_vec[p].session;
 
       if (p == 0){ // The first image is the "left" image for all pairs.
         image_files.push_back(opt_vec[p].in_file1);
         camera_files.push_back(opt_vec[p].cam_file1);
-        cameras.push_back(camera_model1);
         transforms.push_back(sPtr->tx_left());
       }
 
       image_files.push_back(opt_vec[p].in_file2);
       camera_files.push_back(opt_vec[p].cam_file2);
-      cameras.push_back(camera_model2);
       transforms.push_back(sPtr->tx_right());
     }
 
@@ -1056,20 +1273,67 @@ void stereo_triangulation( string          const& output_prefix,
     if (stereo_settings().image_lines_per_piecewise_adjustment > 0) {
 
       stereo_settings().bundle_adjust_prefix = output_prefix; // trigger loading adj cams
-      cameras.clear();
-      for (int p = 0; p < (int)opt_vec.size(); p++){
-
-        boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
-        opt_vec[p].session->camera_models(camera_model1, camera_model2);
-        if (p == 0) // The first image is the "left" image for all pairs.
-          cameras.push_back(camera_model1);
-        cameras.push_back(camera_model2);
+      load_multiview_cameras(opt_vec, cameras);
+    }
+
+    // Optionally replace the cameras with approximations interpolated
+    // from grids of rays. RPC cameras are already fast.
+    if (stereo_settings().approximate_camera_error > 0 &&
+        opt_vec[0].session->name() != "rpc") {
+      for (size_t c = 0; c < cameras.size(); c++) {
+        Vector2i image_size = vw::file_image_size(image_files[c]);
+        cartography::Datum datum = opt_vec[0].session->get_datum(cameras[c].get(), false);
+        boost::shared_ptr<asp::ApproxCameraModel> approx_cam
+          (new asp::ApproxCameraModel(cameras[c], BBox2i(0, 0, image_size[0], image_size[1]),
+                                      datum, stereo_settings().approximate_camera_error));
+        vw_out() << "\t--> Approximate camera error for " << image_files[c] << ": "
+                 << approx_cam->sensor_error() << " pixels." << std::endl;
+        cameras[c] = approx_cam;
       }
     }
 
     if (is_map_projected)
       vw_out() << "\t--> Inputs are map projected" << std::endl;
 
+    // For map-projected images, use the camera pixels which mapproject
+    // tabulated with --write-camera-grid, where they interpolate well.
+    if (is_map_projected && stereo_settings().tri_camera_grid_error > 0 &&
+        stereo_settings().left_image_crop_win  == BBox2i(0, 0, 0, 0) &&
+        stereo_settings().right_image_crop_win == BBox2i(0, 0, 0, 0)) {
+      int num_grids = 0;
+      for (size_t t = 0; t < transforms.size(); t++) {
+        boost::shared_ptr<asp::CameraGrid> grid(new asp::CameraGrid);
+        if (!asp::read_camera_grid(asp::camera_grid_file(image_files[t]), *grid) ||
+            grid->image_size != file_image_size(image_files[t]))
+          continue;
+        transforms[t] = TXT(new asp::CameraGridReverseTransform
+                            (grid, stereo_settings().tri_camera_grid_error, transforms[t]));
+        num_grids++;
+      }
+      if (num_grids > 0)
+        vw_out() << "\t--> Undoing the map-projection of " << num_grids
+                 << " image(s) with the camera grids written by mapproject." << std::endl;
+    }
+
+    // For map-projected images, undoing the map-projection is expensive,
+    // and each tile would otherwise redo it for its own copy of the
+    // transforms. Optionally use a cache of these values shared among
+    // all tiles and threads. Since the cached transforms are thread-safe,
+    // the per-tile copying is not needed.
+    vector<TXT> tri_transforms = transforms;
+    bool tri_map_projected = is_map_projected;
+    if (is_map_projected && stereo_settings().tri_map2cam_cache_mb > 0) {
+      size_t cache_bytes = size_t(stereo_settings().tri_map2cam_cache_mb) * 1024 * 1024;
+      boost::shared_ptr<asp::TransformTileCache> cache
+        (new asp::TransformTileCache(cache_bytes, opt_vec[0].raster_tile_size[0]));
+      for (size_t t = 0; t < transforms.size(); t++) {
+        int trans_id = cache->add_transform(transforms[t], &make_transform_copy<TXT>);
+        tri_transforms[t] = TXT(new asp::CachedReverseTransform(cache, trans_id, transforms[t]));
+      }
+      tri_map_projected = false;
+      vw_out() << "\t--> Using a shared cache of map-projection transforms." << std::endl;
+    }
+
     // Strip the smart pointers and form the stereo model
     std::vector<const vw::camera::CameraModel *> camera_ptrs;
     int num_cams = cameras.size();
@@ -1080,21 +1344,45 @@ void stereo_triangulation( string          const& output_prefix,
     // Convert the angle tol to be in terms of dot product and pass it
     // to the stereo model.
     double angle_tol = vw::stereo::StereoModel::robust_1_minus_cos(stereo_settings().min_triangulation_angle*M_PI/180);
-    StereoModelT stereo_model( camera_ptrs, stereo_settings().use_least_squares,
-                               angle_tol);
+
+    // With plain RPC cameras use the RPC stereo model, which triangulates
+    // entire rows at once, and finds each ray with one RPC evaluation.
+    // Adjusted cameras must go through the generic model.
+    bool all_rpc = true;
+    for (int c = 0; c < num_cams; c++) {
+      if (dynamic_cast<const asp::RPCModel*>(camera_ptrs[c]) == NULL)
+        all_rpc = false;
+    }
 
     // Apply radius function and stereo model in one go
     vw_out() << "\t--> Generating a 3D point cloud." << endl;
-    ImageViewRef<Vector6> point_cloud = per_pixel_filter
-      (stereo_error_triangulate
-       (disparity_maps, transforms, stereo_model, is_map_projected),
-       universe_radius_func);
+    ImageViewRef<Vector6> point_cloud;
+    if (all_rpc) {
+      asp::RPCStereoModel stereo_model( camera_ptrs, stereo_settings().use_least_squares,
+                                        angle_tol);
+      point_cloud = per_pixel_filter
+        (stereo_error_triangulate
+         (disparity_maps, tri_transforms, stereo_model, tri_map_projected),
+         universe_radius_func);
+    }else{
+      StereoModelT stereo_model( camera_ptrs, stereo_settings().use_least_squares,
+                                 angle_tol);
+      point_cloud = per_pixel_filter
+        (stereo_error_triangulate
+         (disparity_maps, tri_transforms, stereo_model, tri_map_projected),
+         universe_radius_func);
+    }
 
     // If we crop the left and right images, at each run we must
     // recompute the cloud center, as the cropping windows may have changed.
     bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
     bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
 
+    if (stereo_settings().save_double_precision_point_cloud &&
+        stereo_settings().save_int_point_cloud)
+      vw_throw(ArgumentErr() << "Cannot use both --save-double-precision-point-cloud "
+                             << "and --save-int-point-cloud.\n");
+
     // Compute the point cloud center, unless done by now
     Vector3 cloud_center = Vector3();
     if (!stereo_settings().save_double_precision_point_cloud){
@@ -1129,6 +1417,9 @@ void stereo_triangulation( string          const& output_prefix,
       save_point_cloud(cloud_center, crop_pc, point_cloud_file, opt_vec[0]);
     } // End if/else
 
+    if (stereo_settings().add_overviews)
+      asp::add_masked_overviews(point_cloud_file, asp::POINT_CLOUD_OVERVIEWS);
+
     // Must print this at the end, as it contains statistics on the number of rejected points.
     vw_out() << "\t--> " << universe_radius_func;
 
@@ -1140,13 +1431,47 @@ void stereo_triangulation( string          const& output_prefix,
 } // End function stereo_triangulation()
 
 
+namespace asp {
+
+void triangulation_stage(std::string const& output_prefix,
+                         std::vector<ASPGlobalOptions> const& opt_vec_in) {
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 4 --> TRIANGULATION \n";
+  asp::StageReport report("triangulation");
+
+  // Keep only those stereo pairs for which filtered disparity exists
+  vector<ASPGlobalOptions> opt_vec;
+  for (int p = 0; p < (int)opt_vec_in.size(); p++){
+    if (fs::exists(opt_vec_in[p].out_prefix+"-F.tif"))
+      opt_vec.push_back(opt_vec_in[p]);
+  }
+  if (opt_vec.empty())
+    vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
+
+  // Triangulation uses small tiles.
+  //---------------------------------------------------------
+  int ts = ASPGlobalOptions::tri_tile_size();
+  for (int s = 0; s < (int)opt_vec.size(); s++)
+    opt_vec[s].raster_tile_size = Vector2i(ts, ts);
+
+  // Internal Processes
+  //---------------------------------------------------------
+
+  stereo_triangulation(output_prefix, opt_vec);
+  if (stereo_settings().stage_report)
+    report.write(output_prefix);
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : TRIANGULATION FINISHED \n";
+}
+
+} // end namespace asp
+
+#ifndef ASP_STEREO_LIBRARY
 int main( int argc, char* argv[] ) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
 
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 4 --> TRIANGULATION \n";
-
     stereo_register_sessions();
 
     // Unlike other stereo executables, triangulation can handle multiple images and cameras.
@@ -1163,31 +1488,11 @@ int main( int argc, char* argv[] ) {
                        output_prefix);
     }
 
-    // Keep only those stereo pairs for which filtered disparity exists
-    vector<ASPGlobalOptions> opt_vec_new;
-    for (int p = 0; p < (int)opt_vec.size(); p++){
-      if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
-        opt_vec_new.push_back(opt_vec[p]);
-    }
-    opt_vec = opt_vec_new;
-    if (opt_vec.empty())
-      vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
-
-    // Triangulation uses small tiles.
-    //---------------------------------------------------------
-    int ts = ASPGlobalOptions::tri_tile_size();
-    for (int s = 0; s < (int)opt_vec.size(); s++)
-      opt_vec[s].raster_tile_size = Vector2i(ts, ts);
-
-    // Internal Processes
-    //---------------------------------------------------------
-
-    stereo_triangulation(output_prefix, opt_vec);
-
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : TRIANGULATION FINISHED \n";
+    asp::triangulation_stage(output_prefix, opt_vec);
 
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
+#endif
@@ -29,6 +29,9 @@
 using namespace vw;
 namespace po = boost::program_options;
 
+#include <boost/algorithm/string.hpp>
+
+#include <fstream>
 #include <limits>
 
 /// Simple class to store image info and compute the associated transfrom.
@@ -231,6 +234,67 @@ void parseImgData(std::string data, int band,
 } // End function parseImgData
 
 
+/// Placements within this many pixels of whole pixels are taken to be whole
+const double VRT_PLACEMENT_TOL = 1e-6;
+
+/// If the images are placed at whole pixels, without scaling, the
+/// mosaic at full resolution can be a VRT which refers to them,
+/// rather than a new image.
+bool can_write_vrt(std::vector<ImageData> const& img_data, double percent, bool fix_seams) {
+  if (percent != 100.0 || fix_seams)
+    return false;
+  for (size_t k = 0; k < img_data.size(); k++) {
+    AffineTransform const& T = img_data[k].transform;
+    Vector2 offset = T.forward(Vector2(0, 0));
+    Vector2 unit   = T.forward(Vector2(1, 1)) - offset;
+    if (norm_2(unit - Vector2(1, 1)) > VRT_PLACEMENT_TOL ||
+        norm_2(offset - round(offset)) > VRT_PLACEMENT_TOL)
+      return false;
+  }
+  return true;
+}
+
+/// Write the mosaic as a VRT. Each image is painted, in order, over its
+/// part of the output, as reduced in parseImgData() to not overlap with
+/// later images. Its nodata pixels are not painted.
+void write_mosaic_vrt(std::string const& vrt_file, std::string const& output_type,
+                      int dst_cols, int dst_rows, std::vector<ImageData> const& img_data,
+                      double output_nodata_value) {
+
+  std::ofstream ofs(vrt_file.c_str());
+  if (!ofs)
+    vw_throw(IOErr() << "Cannot write: " << vrt_file << "\n");
+  ofs.precision(17);
+
+  ofs << "<VRTDataset rasterXSize=\"" << dst_cols << "\" rasterYSize=\""
+      << dst_rows << "\">\n";
+  ofs << "  <VRTRasterBand dataType=\"" << output_type << "\" band=\"1\">\n";
+  ofs << "    <NoDataValue>" << output_nodata_value << "</NoDataValue>\n";
+  BBox2i dst_bounds(0, 0, dst_cols, dst_rows);
+  for (size_t k = 0; k < img_data.size(); k++) {
+    BBox2i dst_box(Vector2i(round(img_data[k].dst_box.min())),
+                   Vector2i(round(img_data[k].dst_box.max())));
+    dst_box.crop(dst_bounds);
+    if (dst_box.empty())
+      continue;
+    Vector2i src_min = round(img_data[k].transform.reverse(Vector2(dst_box.min())));
+    ofs << "    <ComplexSource>\n"
+        << "      <SourceFilename relativeToVRT=\"0\">"
+        << img_data[k].src_file << "</SourceFilename>\n"
+        << "      <SourceBand>" << img_data[k].band << "</SourceBand>\n"
+        << "      <SrcRect xOff=\"" << src_min.x() << "\" yOff=\"" << src_min.y()
+        << "\" xSize=\"" << dst_box.width() << "\" ySize=\"" << dst_box.height() << "\"/>\n"
+        << "      <DstRect xOff=\"" << dst_box.min().x() << "\" yOff=\"" << dst_box.min().y()
+        << "\" xSize=\"" << dst_box.width() << "\" ySize=\"" << dst_box.height() << "\"/>\n"
+        << "      <NODATA>" << img_data[k].nodata_value << "</NODATA>\n"
+        << "    </ComplexSource>\n";
+  }
+  ofs << "  </VRTRasterBand>\n";
+  ofs << "</VRTDataset>\n";
+  if (!ofs)
+    vw_throw(IOErr() << "Failed writing: " << vrt_file << "\n");
+}
+
 /// A class to mosaic and rescale images using bilinear interpolation.
 class TifMosaicView: public ImageViewBase<TifMosaicView>{
 private:
@@ -358,9 +422,10 @@ public:
 struct Options : vw::cartography::GdalWriteOptions {
   std::string img_data, output_image, output_type;
   int band;
-  bool has_input_nodata_value, has_output_nodata_value, fix_seams;
+  bool has_input_nodata_value, has_output_nodata_value, fix_seams, overviews, cog;
   double percent, input_nodata_value, output_nodata_value;
   Options(): band(0), has_input_nodata_value(false), has_output_nodata_value(false),
+             fix_seams(false), overviews(false), cog(false),
              input_nodata_value (std::numeric_limits<double>::quiet_NaN()),
              output_nodata_value(std::numeric_limits<double>::quiet_NaN()){}
 };
@@ -372,7 +437,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("image-data", po::value(&opt.img_data)->default_value(""),
          "Information on the images to mosaic.")
     ("output-image,o", po::value(&opt.output_image)->default_value(""),
-     "Specify the output image.")
+     "Specify the output image. If it ends in .vrt, the images must be placed at whole pixels, at full resolution, and without --fix-seams. Then the output is a VRT which refers to the input images, rather than a copy of them.")
     ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type.")
     ("band", po::value(&opt.band), "Which band to use (for multi-spectral images).")
     ("input-nodata-value", po::value(&opt.input_nodata_value),
@@ -382,7 +447,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("reduce-percent", po::value(&opt.percent)->default_value(100.0),
      "Reduce resolution using this percentage.")
     ("fix-seams",   po::bool_switch(&opt.fix_seams)->default_value(false),
-     "Fix seams in the output mosaic due to inconsistencies between image and camera data using interest point matching.");
+     "Fix seams in the output mosaic due to inconsistencies between image and camera data using interest point matching.")
+    ("overviews",   po::bool_switch(&opt.overviews)->default_value(false),
+     "Add internal overviews to the output image.")
+    ("cog",   po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output image as a Cloud-Optimized GeoTIFF, with internal overviews.");
 
   po::options_description positional("");
   po::positional_options_description positional_desc;
@@ -435,6 +504,23 @@ int main( int argc, char *argv[] ) {
     if (opt.has_output_nodata_value)
       output_nodata_value = opt.output_nodata_value;
 
+    // Refer to the input images rather than copying them
+    if (boost::iends_with(opt.output_image, ".vrt")) {
+      if (!can_write_vrt(img_data, opt.percent, opt.fix_seams))
+        vw_throw( ArgumentErr() << "Cannot write the mosaic as a VRT, as the images are "
+                  << "not placed at whole pixels, or they are scaled, or with --fix-seams.\n");
+      if (opt.overviews || opt.cog)
+        vw_throw( ArgumentErr() << "Cannot add overviews to a VRT.\n");
+      if (opt.output_type != "Float32" && opt.output_type != "Byte"   &&
+          opt.output_type != "UInt16"  && opt.output_type != "Int16"  &&
+          opt.output_type != "UInt32"  && opt.output_type != "Int32")
+        vw_throw( NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n" );
+      vw_out() << "Writing: " << opt.output_image << std::endl;
+      write_mosaic_vrt(opt.output_image, opt.output_type, dst_cols, dst_rows, img_data,
+                       output_nodata_value);
+      return 0;
+    }
+
     // Set up our output image object
     vw_out() << "Writing: " << opt.output_image << std::endl;
     TerminalProgressCallback tpc("asp", "\t    Mosaic:");
@@ -479,6 +565,9 @@ int main( int argc, char *argv[] ) {
                                               opt, tpc);
     else
       vw_throw( NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n" );
+
+    if (opt.overviews || opt.cog)
+      asp::add_overviews_and_cog(opt.output_image, opt.cog, opt.raster_tile_size, opt);
     
   } ASP_STANDARD_CATCHES;
   return 0;
@@ -468,6 +468,48 @@ void get_offsets(int tdi, bool is_wv01, bool is_forward,
   }
 }
 
+// Resample a tile of the image, with each output column taken from the
+// input at a subpixel shift that is the same for the whole column. Then
+// the bilinear weights are the same for all pixels of a column, and are
+// found once per tile. The tile is traversed row by row. The input is
+// the part of the image within img_box, and it is extended by the
+// values at its edges.
+template <class PixelT>
+void shift_columns(ImageView<PixelT> const& img, BBox2i const& img_box,
+                   BBox2i const& bbox,
+                   std::vector<double> const& shift_x,
+                   std::vector<double> const& shift_y,
+                   ImageView<PixelT> & tile){
+
+  int width = bbox.width(), height = bbox.height();
+  int max_x = img.cols() - 1, max_y = img.rows() - 1;
+  tile.set_size(width, height);
+
+  std::vector<int>    x0(width), x1(width), y_off(width);
+  std::vector<double> wx(width), wy(width);
+  for (int c = 0; c < width; c++) {
+    int col = bbox.min().x() + c;
+    double i = col - img_box.min().x() + shift_x[col];
+    int x = (int)floor(i);
+    wx[c] = i - x;
+    x0[c] = std::min(std::max(x,     0), max_x);
+    x1[c] = std::min(std::max(x + 1, 0), max_x);
+    y_off[c] = (int)floor(shift_y[col]);
+    wy[c] = shift_y[col] - y_off[c];
+  }
+
+  for (int r = 0; r < height; r++) {
+    int row = bbox.min().y() + r - img_box.min().y();
+    for (int c = 0; c < width; c++) {
+      int y  = row + y_off[c];
+      int y0 = std::min(std::max(y,     0), max_y);
+      int y1 = std::min(std::max(y + 1, 0), max_y);
+      tile(c, r) = PixelT((1 - wy[c])*((1 - wx[c])*img(x0[c], y0) + wx[c]*img(x1[c], y0)) +
+                                wy[c] *((1 - wx[c])*img(x0[c], y1) + wx[c]*img(x1[c], y1)));
+    }
+  }
+}
+
 // Apply WorldView corrections to each vertical block as high as the image
 // corresponding to one CCD sensor.
 template <class ImageT>
@@ -476,7 +518,9 @@ class WVPerBlockCorrectView: public ImageViewBase< WVPerBlockCorrectView<ImageT>
   int m_tdi;
   bool m_is_wv01, m_is_forward;
   double m_pitch_ratio;
-  std::vector<double> m_posx, m_ccdx, m_posy, m_ccdy;
+
+  // The shift of each column, accumulated from the CCD offsets to its left
+  std::vector<double> m_shift_x, m_shift_y;
   
   typedef typename ImageT::pixel_type PixelT;
 
@@ -485,18 +529,36 @@ public:
                  double pitch_ratio):
     m_img(img), m_tdi(tdi), m_is_wv01(is_wv01), m_is_forward(is_forward),
     m_pitch_ratio(pitch_ratio){
-    
+
+    std::vector<double> posx, ccdx, posy, ccdy;
     get_offsets(m_tdi, m_is_wv01, m_is_forward,  
-                m_posx, m_ccdx, m_posy, m_ccdy);
+                posx, ccdx, posy, ccdy);
 
     // Compensate for the variable pitch ratio
-    for (int i = 0; i < (int)m_posx.size(); i++) m_posx[i] *= m_pitch_ratio;
-    for (int i = 0; i < (int)m_posy.size(); i++) m_posy[i] *= m_pitch_ratio;
+    for (int i = 0; i < (int)posx.size(); i++) posx[i] *= m_pitch_ratio;
+    for (int i = 0; i < (int)posy.size(); i++) posy[i] *= m_pitch_ratio;
     
-    VW_ASSERT(m_posx.size() == m_ccdx.size() &&
-              m_posy.size() == m_ccdy.size(),
+    VW_ASSERT(posx.size() == ccdx.size() &&
+              posy.size() == ccdy.size(),
               ArgumentErr() << "wv_correct: Expecting the arrays of positions "
               << "and offsets to have the same sizes.");
+
+    // Accumulate the corrections up to each column
+    m_shift_x.resize(m_img.cols(), 0.0);
+    m_shift_y.resize(m_img.cols(), 0.0);
+    for (int col = 0; col < m_img.cols(); col++){
+      double valx = 0.0, valy = 0.0;
+      for (size_t t = 0; t < ccdx.size(); t++){
+        if (posx[t] < col)
+          valx -= ccdx[t];
+      }
+      for (size_t t = 0; t < ccdy.size(); t++){
+        if (posy[t] < col)
+          valy -= ccdy[t];
+      }
+      m_shift_x[col] = valx;
+      m_shift_y[col] = valy;
+    }
   }
   
   typedef PixelT pixel_type;
@@ -526,38 +588,8 @@ public:
     biased_box.crop(bounding_box(m_img));
     
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
-
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-
-      // Accumulate the corrections up to the current column
-      double valx = 0, valy = 0;
-      if (m_ccdx.size() > 0){
-        valx = 0.0;
-        for (size_t t = 0; t < m_ccdx.size(); t++){
-          if (m_posx[t] < col){
-            valx -= m_ccdx[t];
-          }
-        }
-        valy = 0.0;
-        for (size_t t = 0; t < m_ccdy.size(); t++){
-          if (m_posy[t] < col){
-            valy -= m_ccdy[t];
-          }
-        }
-      }
-      
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() + valx,
-                       row - biased_box.min().y() + valy);
-      }
-    }
+    ImageView<result_type> tile;
+    shift_columns(cropped_img, biased_box, bbox, m_shift_x, m_shift_y, tile);
     
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
@@ -580,26 +612,24 @@ WVPerBlockCorrectView<ImageT> wv_correct(ImageT const& img,
 template <class ImageT>
 class WVPerColumnCorrectView: public ImageViewBase< WVPerColumnCorrectView<ImageT> >{
   ImageT m_img;
-  std::vector<double> m_dx, m_dy;
+  std::vector<double> m_shift_x, m_shift_y; // The negated corrections
   typedef typename ImageT::pixel_type PixelT;
 
 public:
   WVPerColumnCorrectView(ImageT const& img,
                          std::vector<double> const& dx,
                          std::vector<double> const& dy):
-    m_img(img), m_dx(dx), m_dy(dy){
+    m_img(img){
 
     // Add more zeros if the corrections are too short.
     // This is needed because different WV images can have
     // different widths.
     // TODO(oalexan1): This is not safe long-term.
-    while (m_dx.size() < m_img.cols()) 
-      m_dx.push_back(0);
-    while (m_dy.size() < m_img.cols()) 
-      m_dy.push_back(0);
-    
-    if (m_img.cols() != m_dx.size() || m_img.cols() != m_dy.size()) {
-      // vw_throw( ArgumentErr() << "Expecting as many corrections as columns.\n" );
+    m_shift_x.resize(m_img.cols(), 0.0);
+    m_shift_y.resize(m_img.cols(), 0.0);
+    for (int col = 0; col < m_img.cols(); col++) {
+      if (col < (int)dx.size()) m_shift_x[col] = -dx[col];
+      if (col < (int)dy.size()) m_shift_y[col] = -dy[col];
     }
   }
   
@@ -628,23 +658,10 @@ public:
     biased_box.expand(bias);
     biased_box.crop(bounding_box(m_img));
     
+    // Note that the same correction is used for an entire column
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
-
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
-        // Note that the same correction is used for an entire column
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() - m_dx[col],
-                       row - biased_box.min().y() - m_dy[col]);
-      }
-    }
+    ImageView<result_type> tile;
+    shift_columns(cropped_img, biased_box, bbox, m_shift_x, m_shift_y, tile);
 
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
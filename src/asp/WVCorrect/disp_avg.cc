@@ -26,7 +26,8 @@
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
-#include <vw/Image/Statistics.h>
+#include <asp/Core/ColumnStats.h>
+#include <vw/Core/Settings.h>
 
 using namespace vw;
 
@@ -98,55 +99,17 @@ int main( int argc, char *argv[] ){
       beg_row = std::min(opt.beg_row, rows);
       end_row = std::min(opt.end_row, rows);
     }
-    TerminalProgressCallback disp_progress("asp", "\tAveraging:   ");
-    double disp_progress_mult = 1.0/double(std::max(col_stop - col_start, 1));
 
+    // Each thread does a strip of columns
+    vw_out() << "Averaging the disparity columns.\n";
+    std::vector<Vector2> means
+      = asp::column_robust_means(D, beg_row, end_row, opt.remove_outliers_params,
+                                 vw_settings().default_num_threads());
     std::vector<double> Dx(cols, 0), Dy(cols, 0);
-    
-    for (int col = col_start; col < col_stop; col++){
-      disp_progress.report_progress((col - col_start) * disp_progress_mult);
-
-      std::vector<double> px, py;
-      for (int row = beg_row; row < end_row; row++){
-        PixelMask<Vector2f> p = D(col, row);
-        if (!is_valid(p)) continue;
-        px.push_back(p.child()[0]);
-        py.push_back(p.child()[1]);
-      }
-
-      std::sort(px.begin(), px.end());
-      std::sort(py.begin(), py.end());
-      
-      // Being too strict with outlier removal can cause trouble
-      double pct_factor     = opt.remove_outliers_params[0]/100.0;
-      double outlier_factor = opt.remove_outliers_params[1];
-      
-      double bx = 0, ex = 0, by = 0, ey = 0;
-      if (!vw::math::find_outlier_brackets(px, pct_factor, outlier_factor, bx, ex))
-        continue;
-      if (!vw::math::find_outlier_brackets(py, pct_factor, outlier_factor, by, ey))
-        continue;
-
-      int len = px.size();
-      int num_valid = 0;
-      Dx[col] = 0;
-      Dy[col] = 0;
-      for (int k = 0; k < len; k++){
-
-        if (px[k] < bx || px[k] > ex || py[k] < by || py[k] > ey) continue;
-
-        num_valid++;
-        Dx[col] += px[k];
-        Dy[col] += py[k];
-      }
-      
-      if (num_valid > 0){
-        Dx[col] /= num_valid;
-        Dy[col] /= num_valid;
-      }
+    for (int col = col_start; col < col_stop; col++) {
+      Dx[col] = means[col][0];
+      Dy[col] = means[col][1];
     }
-    
-    disp_progress.report_finished();
   
     // Write dx file
     std::ofstream dx(opt.dx.c_str());
@@ -0,0 +1,93 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file Benchmark.h
+///
+/// A small harness for timing the kernels of a library. A benchmark is
+/// written as
+///
+///   BENCHMARK(Group, name) {
+///     ... setup, not timed ...
+///     while (state.keep_running())
+///       ... the work to time once ...
+///   }
+///
+/// The runner in benchmark_main.cc picks how many times to run the work
+/// so that a measurement takes long enough, repeats the measurement,
+/// and reports the median and the minimum time per run. The random
+/// seed and the number of threads are fixed, so the numbers can be
+/// compared across commits on the same machine.
+
+#ifndef __ASP_TEST_BENCHMARK_H__
+#define __ASP_TEST_BENCHMARK_H__
+
+#include <vw/Core/FundamentalTypes.h>
+
+#include <chrono>
+#include <string>
+
+namespace asp {
+namespace bench {
+
+  class State {
+  public:
+    State(vw::int64 num_iterations): m_num_iterations(num_iterations), m_count(0),
+                                     m_seconds(0.0) {}
+
+    /// Return true while there are runs left. The first call starts the clock.
+    bool keep_running() {
+      if (m_count == 0)
+        m_start = std::chrono::steady_clock::now();
+      if (m_count == m_num_iterations) {
+        m_seconds = std::chrono::duration<double>
+          (std::chrono::steady_clock::now() - m_start).count();
+        return false;
+      }
+      m_count++;
+      return true;
+    }
+
+    vw::int64 num_iterations() const { return m_num_iterations; }
+    double    seconds()        const { return m_seconds; }
+
+  private:
+    vw::int64 m_num_iterations, m_count;
+    double    m_seconds;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  typedef void (*BenchmarkFun)(State & state);
+
+  /// Add a benchmark to those the runner knows about
+  int register_benchmark(std::string const& name, BenchmarkFun fun);
+
+  /// Keep the compiler from removing a computation whose result is not used
+  template <class T>
+  inline void do_not_optimize(T const& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+  }
+
+}} // end namespace asp::bench
+
+#define BENCHMARK(group, name)                                          \
+  static void asp_benchmark_##group##_##name(asp::bench::State & state); \
+  static int asp_benchmark_reg_##group##_##name =                        \
+    asp::bench::register_benchmark(#group "." #name, asp_benchmark_##group##_##name); \
+  static void asp_benchmark_##group##_##name(asp::bench::State & state)
+
+#endif//__ASP_TEST_BENCHMARK_H__
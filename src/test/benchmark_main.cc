@@ -0,0 +1,144 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Run the benchmarks of a library. Options:
+//   --filter <string>      Run only the benchmarks with this in their name.
+//   --csv <file>           Also write the results to this CSV file.
+//   --repetitions <int>    How many times to measure each benchmark (default 5).
+//   --min-time <seconds>   Least duration of one measurement (default 0.2).
+
+#include <test/Benchmark.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+  typedef std::vector< std::pair<std::string, asp::bench::BenchmarkFun> > Registry;
+
+  // Made on first use, as benchmarks register themselves during static
+  // initialization, in no particular order.
+  Registry & registry() {
+    static Registry benchmarks;
+    return benchmarks;
+  }
+
+  // Seconds per run of a benchmark when running it this many times
+  double time_runs(asp::bench::BenchmarkFun fun, vw::int64 num_iterations) {
+    std::srand(1);
+    asp::bench::State state(num_iterations);
+    fun(state);
+    return state.seconds() / num_iterations;
+  }
+}
+
+namespace asp { namespace bench {
+  int register_benchmark(std::string const& name, BenchmarkFun fun) {
+    registry().push_back(std::make_pair(name, fun));
+    return 0;
+  }
+}}
+
+int main(int argc, char **argv) {
+
+  std::string filter, csv_file;
+  int    repetitions = 5;
+  double min_time    = 0.2;
+  for (int it = 1; it < argc; it++) {
+    std::string arg = argv[it];
+    if (it + 1 < argc && arg == "--filter")
+      filter = argv[++it];
+    else if (it + 1 < argc && arg == "--csv")
+      csv_file = argv[++it];
+    else if (it + 1 < argc && arg == "--repetitions")
+      repetitions = std::max(atoi(argv[++it]), 1);
+    else if (it + 1 < argc && arg == "--min-time")
+      min_time = atof(argv[++it]);
+    else {
+      std::cerr << "Usage: " << argv[0] << " [--filter <string>] [--csv <file>] "
+                << "[--repetitions <int>] [--min-time <seconds>]" << std::endl;
+      return 1;
+    }
+  }
+
+  // Open this before changing the directory below
+  std::ofstream csv;
+  if (!csv_file.empty()) {
+    csv.open(csv_file.c_str());
+    csv << "benchmark,iterations,median_ns,min_ns\n";
+  }
+
+  // Use the same settings for each run. The fixtures are in the
+  // tests directory of the library.
+  vw::vw_settings().set_rc_filename("");
+  vw::vw_settings().set_default_num_threads(1);
+  fs::current_path(fs::path(TEST_SRCDIR));
+
+  Registry benchmarks = registry();
+  std::sort(benchmarks.begin(), benchmarks.end());
+  for (size_t b = 0; b < benchmarks.size(); b++) {
+
+    std::string const& name = benchmarks[b].first;
+    if (name.find(filter) == std::string::npos)
+      continue;
+
+    try {
+      // Find how many runs take at least min_time
+      vw::int64 num_iterations = 1;
+      while (1) {
+        double seconds = time_runs(benchmarks[b].second, num_iterations) * num_iterations;
+        if (seconds >= min_time || num_iterations >= (vw::int64(1) << 40))
+          break;
+        double factor = (seconds > 0) ? 1.4 * min_time / seconds : 10.0;
+        num_iterations = std::max(num_iterations + 1,
+                                  vw::int64(num_iterations * std::min(factor, 10.0)));
+      }
+
+      std::vector<double> times;
+      for (int r = 0; r < repetitions; r++)
+        times.push_back(1e9 * time_runs(benchmarks[b].second, num_iterations));
+      std::sort(times.begin(), times.end());
+      double median = times[times.size()/2];
+
+      char line[1024];
+      snprintf(line, sizeof(line), "%-45s %12lld runs %14.1f ns median %14.1f ns min",
+               name.c_str(), (long long)num_iterations, median, times[0]);
+      std::cout << line << std::endl;
+      if (csv.is_open())
+        csv << name << ',' << num_iterations << ',' << median << ',' << times[0] << '\n';
+
+    } catch (std::exception const& e) {
+      std::cerr << name << " failed: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}